@@ -0,0 +1,103 @@
+package main
+
+import (
+	"../skyd"
+	"flag"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"runtime"
+	"strconv"
+	"strings"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+const (
+	objectsUsage        = "the number of objects in the generated table"
+	eventsUsage         = "the number of events per object"
+	propertiesUsage     = "the number of properties per event"
+	cardinalityUsage    = "the number of distinct values of the action factor"
+	iterationsUsage     = "the number of timed runs of each query"
+	benchmarksUsage     = "a comma separated list of: count, groupby, funnel, session, ingest-inorder, ingest-outoforder, ingest-late"
+	writersUsage        = "the number of concurrent writers in ingest benchmarks"
+	ingestServletsUsage = "a comma separated list of the servlet counts that ingest benchmarks run with"
+	eventBlocksUsage    = "write events in the columnar block format"
+	dataDirUsage        = "the directory to generate the table in (a temporary directory by default)"
+)
+
+//------------------------------------------------------------------------------
+//
+// Variables
+//
+//------------------------------------------------------------------------------
+
+var options skyd.BenchmarkOptions
+var benchmarks string
+var ingestServlets string
+var dataDir string
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Initialization
+//--------------------------------------
+
+func init() {
+	options = skyd.DefaultBenchmarkOptions()
+	flag.IntVar(&options.Objects, "objects", options.Objects, objectsUsage)
+	flag.IntVar(&options.EventsPerObject, "events", options.EventsPerObject, eventsUsage)
+	flag.IntVar(&options.Properties, "properties", options.Properties, propertiesUsage)
+	flag.IntVar(&options.FactorCardinality, "cardinality", options.FactorCardinality, cardinalityUsage)
+	flag.IntVar(&options.Iterations, "iterations", options.Iterations, iterationsUsage)
+	flag.StringVar(&benchmarks, "benchmarks", strings.Join(options.Benchmarks, ","), benchmarksUsage)
+	flag.IntVar(&options.Writers, "writers", options.Writers, writersUsage)
+	flag.StringVar(&ingestServlets, "ingest-servlets", fmt.Sprintf("%d,%d", options.IngestServlets[0], options.IngestServlets[1]), ingestServletsUsage)
+	flag.BoolVar(&options.EventBlocks, "event-blocks", false, eventBlocksUsage)
+	flag.StringVar(&dataDir, "data-path", "", dataDirUsage)
+}
+
+//--------------------------------------
+// Main
+//--------------------------------------
+
+func main() {
+	runtime.GOMAXPROCS(runtime.NumCPU())
+	flag.Parse()
+	options.Benchmarks = strings.Split(benchmarks, ",")
+	options.IngestServlets = nil
+	for _, str := range strings.Split(ingestServlets, ",") {
+		n, err := strconv.Atoi(str)
+		if err != nil || n < 1 {
+			fmt.Fprintf(os.Stderr, "Invalid servlet count: %s\n", str)
+			os.Exit(1)
+		}
+		options.IngestServlets = append(options.IngestServlets, n)
+	}
+
+	path := dataDir
+	if path == "" {
+		var err error
+		if path, err = ioutil.TempDir("", "sky_bench"); err != nil {
+			fmt.Fprintln(os.Stderr, err)
+			os.Exit(1)
+		}
+	}
+
+	_, err := skyd.RunBenchmarks(path, options, os.Stdout)
+	if dataDir == "" {
+		os.RemoveAll(path)
+	}
+	if err != nil {
+		fmt.Fprintln(os.Stderr, err)
+		os.Exit(1)
+	}
+}
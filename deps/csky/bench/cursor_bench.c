@@ -0,0 +1,429 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include <sky/cursor.h>
+#include <sky/minipack.h>
+#include <sky/sky_string.h>
+#include <sky/timestamp.h>
+
+//==============================================================================
+//
+// Overview
+//
+//==============================================================================
+
+// Measures the cost of decoding events through the cursor and of the
+// individual minipack decoders that it's built on. The cursor benchmarks
+// generate a single object with a fixed number of events and walk it
+// repeatedly with sky_cursor_next_event(), varying the number of properties
+// per event, their data type and the share of them that the query
+// references. Unreferenced properties have no descriptor and are skipped by
+// their tag length. Half of the properties are action properties, which the
+// cursor clears before each event.
+//
+// Each line reports nanoseconds and cycles per event or value along with
+// the branch misses. The hardware counters come from perf_event_open() and
+// are reported as "n/a" when they aren't available.
+//
+// Usage: cursor_bench [events per run] [runs]
+
+
+//==============================================================================
+//
+// Constants
+//
+//==============================================================================
+
+#define DEFAULT_EVENT_COUNT  10000
+#define DEFAULT_RUN_COUNT    200
+
+#define SLOT_SIZE            16
+#define DATA_HEADER_SIZE     16
+
+#define DECODE_VALUE_COUNT   1000000
+
+#define COUNTER_CYCLES        0
+#define COUNTER_INSTRUCTIONS  1
+#define COUNTER_BRANCH_MISSES 2
+#define COUNTER_COUNT         3
+
+
+//==============================================================================
+//
+// Typedefs
+//
+//==============================================================================
+
+typedef struct {
+    int fds[COUNTER_COUNT];
+    uint64_t values[COUNTER_COUNT];
+    struct timespec start;
+    double elapsed_ns;
+} counters;
+
+typedef struct {
+    const char *name;
+    const char *data_type;
+} data_type_spec;
+
+
+//==============================================================================
+//
+// Globals
+//
+//==============================================================================
+
+data_type_spec DATA_TYPES[] = {
+    {"integer", "integer"},
+    {"float", "float"},
+    {"string", "string"},
+    {"boolean", "boolean"},
+    {"mixed", NULL},
+};
+
+uint32_t PROPERTY_COUNTS[] = {1, 4, 16, 64};
+
+double REFERENCED_RATIOS[] = {0.0, 0.25, 1.0};
+
+// Keeps decoded values alive so the decode loops aren't optimized out.
+volatile uint64_t sink;
+
+
+//==============================================================================
+//
+// Counters
+//
+//==============================================================================
+
+#ifdef __linux__
+static int counter_open(uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static void counters_init(counters *c)
+{
+    memset(c, 0, sizeof(*c));
+#ifdef __linux__
+    c->fds[COUNTER_CYCLES] = counter_open(PERF_COUNT_HW_CPU_CYCLES);
+    c->fds[COUNTER_INSTRUCTIONS] = counter_open(PERF_COUNT_HW_INSTRUCTIONS);
+    c->fds[COUNTER_BRANCH_MISSES] = counter_open(PERF_COUNT_HW_BRANCH_MISSES);
+#else
+    int i;
+    for(i=0; i<COUNTER_COUNT; i++) c->fds[i] = -1;
+#endif
+}
+
+static void counters_close(counters *c)
+{
+#ifdef __linux__
+    int i;
+    for(i=0; i<COUNTER_COUNT; i++) {
+        if(c->fds[i] >= 0) close(c->fds[i]);
+    }
+#endif
+}
+
+static void counters_start(counters *c)
+{
+#ifdef __linux__
+    int i;
+    for(i=0; i<COUNTER_COUNT; i++) {
+        if(c->fds[i] >= 0) {
+            ioctl(c->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(c->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &c->start);
+}
+
+static void counters_stop(counters *c)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    c->elapsed_ns = (double)(end.tv_sec - c->start.tv_sec) * 1e9 + (double)(end.tv_nsec - c->start.tv_nsec);
+
+    int i;
+    for(i=0; i<COUNTER_COUNT; i++) {
+        c->values[i] = 0;
+#ifdef __linux__
+        if(c->fds[i] >= 0) {
+            ioctl(c->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if(read(c->fds[i], &c->values[i], sizeof(uint64_t)) != sizeof(uint64_t)) {
+                c->values[i] = 0;
+            }
+        }
+#endif
+    }
+}
+
+// Formats a counter per unit of work or "n/a" if it wasn't counted.
+static const char *counter_format(counters *c, int counter, double count, char *buf, size_t sz)
+{
+    if(c->fds[counter] < 0) {
+        snprintf(buf, sz, "n/a");
+    }
+    else {
+        snprintf(buf, sz, "%.2f", (double)c->values[counter] / count);
+    }
+    return buf;
+}
+
+static void counters_report(const char *name, counters *c, double count, const char *unit)
+{
+    char cycles[32], instructions[32], branch_misses[32];
+    printf("%-36s : %8.2f ns/%s; %8s cycles/%s; %8s instructions/%s; %6s branch misses/%s\n",
+        name,
+        c->elapsed_ns / count, unit,
+        counter_format(c, COUNTER_CYCLES, count, cycles, sizeof(cycles)), unit,
+        counter_format(c, COUNTER_INSTRUCTIONS, count, instructions, sizeof(instructions)), unit,
+        counter_format(c, COUNTER_BRANCH_MISSES, count, branch_misses, sizeof(branch_misses)), unit);
+}
+
+
+//==============================================================================
+//
+// Data Generation
+//
+//==============================================================================
+
+// Returns the cursor data type of a property for a benchmark's type.
+static const char *property_data_type(data_type_spec *spec, uint32_t index)
+{
+    if(spec->data_type != NULL) {
+        return spec->data_type;
+    }
+    return DATA_TYPES[index % 4].data_type;
+}
+
+// Action properties have negative ids and object properties have positive
+// ones.
+static int64_t property_id(uint32_t index)
+{
+    return (index % 2 == 0 ? -1 : 1) * (int64_t)(index / 2 + 1);
+}
+
+static void *pack_value(void *ptr, const char *data_type, uint32_t seed)
+{
+    size_t sz;
+    if(strcmp(data_type, "integer") == 0) {
+        minipack_pack_int(ptr, (int64_t)(seed * 7919) % 100000, &sz);
+    }
+    else if(strcmp(data_type, "float") == 0) {
+        minipack_pack_double(ptr, (double)seed * 0.25, &sz);
+    }
+    else if(strcmp(data_type, "string") == 0) {
+        char str[16];
+        int length = snprintf(str, sizeof(str), "/page/%u", seed % 1000);
+        minipack_pack_raw(ptr, (uint32_t)length, &sz);
+        memcpy(ptr + sz, str, length);
+        sz += length;
+    }
+    else {
+        minipack_pack_bool(ptr, seed % 2 == 0, &sz);
+    }
+    return ptr + sz;
+}
+
+// Generates an object with an empty state and a number of events one second
+// apart that each set every property.
+static void *generate_object(data_type_spec *spec, uint32_t property_count, uint32_t event_count, size_t *sz)
+{
+    size_t capacity = 1 + (size_t)event_count * (16 + (size_t)property_count * 32);
+    void *data = malloc(capacity);
+    void *ptr = data;
+    size_t elem_sz;
+
+    minipack_pack_raw(ptr, 0, &elem_sz);
+    ptr += elem_sz;
+
+    uint32_t i, j;
+    for(i=0; i<event_count; i++) {
+        *((uint8_t*)ptr) = EVENT_FLAG;
+        ptr += 1;
+        minipack_pack_int64(ptr, sky_timestamp_shift((int64_t)i * 1000000LL), &elem_sz);
+        ptr += elem_sz;
+        minipack_pack_map(ptr, property_count, &elem_sz);
+        ptr += elem_sz;
+        for(j=0; j<property_count; j++) {
+            minipack_pack_int(ptr, property_id(j), &elem_sz);
+            ptr += elem_sz;
+            ptr = pack_value(ptr, property_data_type(spec, j), i + j);
+        }
+    }
+
+    *sz = (size_t)(ptr - data);
+    return data;
+}
+
+
+//==============================================================================
+//
+// Cursor Benchmarks
+//
+//==============================================================================
+
+// Walks an object through the cursor a number of times and returns the
+// number of events read.
+static uint64_t walk_object(sky_cursor *cursor, void *data, size_t sz, uint32_t runs)
+{
+    uint64_t count = 0;
+    uint32_t i;
+    for(i=0; i<runs; i++) {
+        sky_cursor_set_ptr(cursor, data, sz);
+        while(true) {
+            sky_cursor_next_event(cursor);
+            if(cursor->eof) break;
+            count++;
+        }
+    }
+    return count;
+}
+
+static void bench_cursor(data_type_spec *spec, uint32_t property_count, double ratio,
+                         uint32_t event_count, uint32_t runs)
+{
+    size_t sz;
+    void *data = generate_object(spec, property_count, event_count, &sz);
+
+    // Reference the first properties up to the ratio.
+    uint32_t referenced = (uint32_t)(property_count * ratio + 0.5);
+    sky_cursor *cursor = sky_cursor_new(-(int32_t)((property_count + 1) / 2), (int32_t)(property_count / 2));
+    sky_cursor_set_ts_offset(cursor, 0);
+    sky_cursor_set_timestamp_offset(cursor, 8);
+    uint32_t i;
+    for(i=0; i<referenced; i++) {
+        sky_cursor_set_property(cursor, property_id(i), DATA_HEADER_SIZE + i * SLOT_SIZE, SLOT_SIZE, property_data_type(spec, i));
+    }
+    sky_cursor_set_data_sz(cursor, DATA_HEADER_SIZE + property_count * SLOT_SIZE);
+
+    // Warm up and then measure.
+    walk_object(cursor, data, sz, 1);
+    counters c;
+    counters_init(&c);
+    counters_start(&c);
+    uint64_t count = walk_object(cursor, data, sz, runs);
+    counters_stop(&c);
+
+    char name[64];
+    snprintf(name, sizeof(name), "next_event/%s/%u props/%d%% ref", spec->name, property_count, (int)(ratio * 100));
+    counters_report(name, &c, (double)count, "event");
+    counters_close(&c);
+
+    sky_cursor_free(cursor);
+    free(data);
+}
+
+
+//==============================================================================
+//
+// Decoder Benchmarks
+//
+//==============================================================================
+
+static void pack_raw_and_data(void *ptr, uint32_t length, size_t *sz)
+{
+    minipack_pack_raw(ptr, length, sz);
+    memset(ptr + *sz, 'x', length);
+    *sz += length;
+}
+
+static uint32_t unpack_raw_and_data(void *ptr, size_t *sz)
+{
+    uint32_t length = minipack_unpack_raw(ptr, sz);
+    *sz += length;
+    return length;
+}
+
+// Decodes a buffer of packed values of one type with a decoder and reports
+// the cost per value.
+#define BENCH_DECODE(NAME, PACK, UNPACK) do {\
+    void *buf = malloc(DECODE_VALUE_COUNT * 16); \
+    void *ptr = buf; \
+    size_t sz; \
+    uint32_t i; \
+    for(i=0; i<DECODE_VALUE_COUNT; i++) { \
+        PACK; \
+        ptr += sz; \
+    } \
+    void *end = ptr; \
+    counters c; \
+    counters_init(&c); \
+    counters_start(&c); \
+    uint64_t total = 0; \
+    for(ptr=buf; ptr<end; ptr+=sz) { \
+        total += (uint64_t)UNPACK; \
+        if(sz == 0) break; \
+    } \
+    counters_stop(&c); \
+    sink = total; \
+    counters_report(NAME, &c, DECODE_VALUE_COUNT, "value"); \
+    counters_close(&c); \
+    free(buf); \
+} while(0)
+
+static void bench_decoders()
+{
+    BENCH_DECODE("minipack_unpack_int/fixnum", minipack_pack_int(ptr, i % 100, &sz), minipack_unpack_int(ptr, &sz));
+    BENCH_DECODE("minipack_unpack_int/int16", minipack_pack_int(ptr, 1000 + i % 1000, &sz), minipack_unpack_int(ptr, &sz));
+    BENCH_DECODE("minipack_unpack_int/int64", minipack_pack_int64(ptr, (int64_t)i << 20, &sz), minipack_unpack_int(ptr, &sz));
+    BENCH_DECODE("minipack_unpack_uint", minipack_pack_uint(ptr, i, &sz), minipack_unpack_uint(ptr, &sz));
+    BENCH_DECODE("minipack_unpack_double", minipack_pack_double(ptr, i * 0.5, &sz), minipack_unpack_double(ptr, &sz));
+    BENCH_DECODE("minipack_unpack_bool", minipack_pack_bool(ptr, i % 2 == 0, &sz), minipack_unpack_bool(ptr, &sz));
+    BENCH_DECODE("minipack_unpack_raw", pack_raw_and_data(ptr, 8, &sz), unpack_raw_and_data(ptr, &sz));
+    BENCH_DECODE("minipack_unpack_map", minipack_pack_map(ptr, i % 16, &sz), minipack_unpack_map(ptr, &sz));
+    BENCH_DECODE("minipack_sizeof_elem_and_data", minipack_pack_double(ptr, i * 0.5, &sz), (sz = minipack_sizeof_elem_and_data(ptr)));
+}
+
+
+//==============================================================================
+//
+// Main
+//
+//==============================================================================
+
+int main(int argc, char **argv)
+{
+    uint32_t event_count = argc > 1 ? (uint32_t)atoi(argv[1]) : DEFAULT_EVENT_COUNT;
+    uint32_t runs = argc > 2 ? (uint32_t)atoi(argv[2]) : DEFAULT_RUN_COUNT;
+    if(event_count == 0 || runs == 0) {
+        fprintf(stderr, "usage: %s [events per run] [runs]\n", argv[0]);
+        return 1;
+    }
+
+    printf("Events:     %u per object, %u runs\n", event_count, runs);
+    printf("------------------------------------------------\n");
+
+    uint32_t t, p, r;
+    for(t=0; t<sizeof(DATA_TYPES)/sizeof(*DATA_TYPES); t++) {
+        for(p=0; p<sizeof(PROPERTY_COUNTS)/sizeof(*PROPERTY_COUNTS); p++) {
+            for(r=0; r<sizeof(REFERENCED_RATIOS)/sizeof(*REFERENCED_RATIOS); r++) {
+                bench_cursor(&DATA_TYPES[t], PROPERTY_COUNTS[p], REFERENCED_RATIOS[r], event_count, runs);
+            }
+        }
+    }
+
+    printf("------------------------------------------------\n");
+    bench_decoders();
+    return 0;
+}
@@ -15,6 +15,44 @@
 #define sky_event_flag_t uint8_t
 #define EVENT_FLAG       0x92
 
+// A checkpoint holds the permanent values of an object before the event
+// that follows it, as the flag and then an event of the values. The cursor
+// sets the values when it starts on a checkpoint and otherwise skips it.
+#define SKY_EVENT_CHECKPOINT_FLAG 0xC7
+
+#define SKY_DATA_TYPE_NONE     0
+#define SKY_DATA_TYPE_STRING   1
+#define SKY_DATA_TYPE_INT      2
+#define SKY_DATA_TYPE_DOUBLE   3
+#define SKY_DATA_TYPE_BOOLEAN  4
+
+// Filters are postfix programs evaluated against each decoded event. A
+// comparison is encoded as the op, the comparison, the value type, the
+// little endian property id and then the value: a double for numbers, a
+// byte for booleans or a uint32 length followed by the bytes for strings.
+#define SKY_FILTER_OP_TRUE   0x01
+#define SKY_FILTER_OP_FALSE  0x02
+#define SKY_FILTER_OP_AND    0x03
+#define SKY_FILTER_OP_OR     0x04
+#define SKY_FILTER_OP_CMP    0x10
+
+#define SKY_FILTER_CMP_EQ    1
+#define SKY_FILTER_CMP_NE    2
+#define SKY_FILTER_CMP_LT    3
+#define SKY_FILTER_CMP_LE    4
+#define SKY_FILTER_CMP_GT    5
+#define SKY_FILTER_CMP_GE    6
+
+#define SKY_FILTER_VALUE_NUMBER   1
+#define SKY_FILTER_VALUE_STRING   2
+#define SKY_FILTER_VALUE_BOOLEAN  3
+
+#define SKY_FILTER_MAX_DEPTH 32
+
+// The most events that the cursor keeps for moving back to a mark. Marks
+// are lost once more events than this are read after the first of them.
+#define SKY_CURSOR_REWIND_MAX 1024
+
 
 //==============================================================================
 //
@@ -29,15 +67,73 @@ typedef int (*sky_cursor_next_object_func)(void *cursor);
 typedef void (*sky_property_descriptor_set_func)(void *target, void *value, size_t *sz);
 typedef void (*sky_property_descriptor_clear_func)(void *target);
 
-typedef struct { uint16_t ts_offset; uint16_t timestamp_offset;} sky_timestamp_descriptor;
+typedef struct {
+    uint16_t ts_offset;
+    uint16_t timestamp_offset;
+    uint16_t prev_timestamp_offset;
+    bool has_prev_timestamp;
+} sky_timestamp_descriptor;
 
 typedef struct {
     int64_t property_id;
     uint16_t offset;
+    uint8_t data_type;
+    uint8_t sz;
     sky_property_descriptor_set_func set_func;
     sky_property_descriptor_clear_func clear_func;
 } sky_property_descriptor;
 
+typedef struct {
+    uint8_t type;
+    uint8_t data_type;
+    uint8_t sz;
+    uint16_t offset;
+    uint8_t *bitmap;
+    uint8_t *values;
+    uint8_t *dict_offsets;
+    uint32_t dict_count;
+    uint32_t dict_code;
+    uint8_t *groups;
+    uint8_t *groups_endptr;
+    uint32_t packed_group;
+    int64_t *packed;
+} sky_cursor_block_column;
+
+// The header of a batch of decoded events. Callers define their own struct
+// that begins with these fields and is followed by one pointer per property
+// column registered with sky_cursor_set_batch_column().
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+    int64_t *ts;
+    uint32_t *timestamp;
+    bool *session_start;
+    uint32_t *prev_timestamp;
+} sky_cursor_batch;
+
+typedef struct {
+    uint16_t offset;
+    uint16_t sz;
+    uint8_t *values;
+} sky_cursor_batch_column;
+
+// An event stream holding the values of one property family of the current
+// object. Its events share the timestamps of the object's own events and
+// are merged into them as they're read.
+typedef struct {
+    void *ptr;
+    void *endptr;
+} sky_cursor_family;
+
+// An object that the scan passed over, weighed by the events decoded from
+// it, along with a copy of its key.
+typedef struct {
+    uint64_t event_count;
+    void *key;
+    size_t key_sz;
+    size_t key_capacity;
+} sky_cursor_heavy_object;
+
 struct sky_cursor {
     void *data;
     uint32_t data_sz;
@@ -52,14 +148,133 @@ struct sky_cursor {
     bool in_session;
     uint32_t last_timestamp;
     uint32_t session_idle_in_sec;
+    void *pending_ptr;
+    void *pending_dataptr;
+    int64_t pending_ts;
 
     sky_timestamp_descriptor timestamp_descriptor;
     sky_property_descriptor *property_descriptors;
     sky_property_descriptor *property_zero_descriptor;
     uint32_t property_count;
+    int64_t min_property_id;
+    int64_t max_property_id;
+
+    bool in_block;
+    uint32_t block_event_index;
+    uint32_t block_event_count;
+    int64_t block_base_ts;
+    uint8_t *block_ts_deltas;
+    uint8_t *block_ts_ptr;
+    uint8_t *block_ts_endptr;
+    int64_t block_prev_ts;
+    int64_t block_prev_delta;
+    void *block_endptr;
+    sky_cursor_block_column *block_columns;
+    uint32_t block_column_count;
+    uint32_t block_column_capacity;
+    uint32_t next_dict_code;
+
+    // Packed columns are unpacked a group at a time into their slice of the
+    // buffer. Groups whose value ranges can't match the filter are skipped
+    // without reading their values.
+    int64_t *block_packed;
+    bool block_has_packed;
+    uint32_t block_skip_end;
+    bool event_skipped;
+
+    sky_cursor_batch *batch;
+    sky_cursor_batch_column *batch_columns;
+    uint32_t batch_column_count;
+
+    uint8_t *filter;
+    uint32_t filter_sz;
+
+    bool has_time_range;
+    int64_t min_ts;
+    int64_t max_ts;
 
     void *context;
     sky_cursor_next_object_func next_object_func;
+
+    // The property family streams of the current object. Scans add them
+    // after pointing the cursor at the object.
+    sky_cursor_family *families;
+    uint32_t family_count;
+    uint32_t family_capacity;
+
+    // The decoded events read since the first outstanding mark, each with
+    // its index in the session, so that the cursor can move back to a mark
+    // without decoding them again. After a restore the cursor replays them
+    // until it's back on the last decoded event and then carries on from
+    // where decoding stopped, whose session and end flags are kept aside.
+    uint8_t *rewind;
+    int32_t *rewind_session_indexes;
+    uint32_t rewind_capacity;
+    uint32_t rewind_count;
+    uint32_t rewind_pos;
+    uint32_t mark_depth;
+    bool rewind_overflow;
+    bool replaying;
+    bool live_in_session;
+    bool live_eof;
+
+    // The objects the cursor has been pointed at, their size in bytes and
+    // the events decoded from them since the stats were last cleared.
+    uint64_t object_count;
+    uint64_t byte_count;
+    uint64_t event_count;
+
+    // Set from another thread to stop the scan at the next object.
+    bool cancelled;
+
+    // Object scans only pass on objects whose key hashes from the floor
+    // up to, but not including, the threshold when the cursor samples.
+    // Without a ceiling the sample runs to the top of the hash space.
+    bool has_sample;
+    bool sample_ceiling;
+    uint64_t sample_floor;
+    uint64_t sample_threshold;
+
+    // Object scans pass on only the current state of each object, as its
+    // single event, when the cursor reads states.
+    bool state_only;
+
+    // Object scans only pass on objects with at least a number of events
+    // whose first and last events are at least a shifted span apart when
+    // the cursor has object bounds.
+    bool has_object_bounds;
+    uint32_t min_object_events;
+    int64_t min_object_span;
+
+    // Object scans only pass on objects whose key is one of the members
+    // when the cursor has them. The keys are sorted and stored back to back
+    // and each member is its offset into them.
+    bool has_members;
+    uint8_t *member_keys;
+    size_t member_keys_sz;
+    uint32_t *members;
+    uint32_t member_count;
+
+    // The key of the object the scan is on, if it's known, and the keys of
+    // the objects marked by the aggregation. Each marked key is stored after
+    // its little endian uint32 size.
+    const void *object_key;
+    size_t object_key_sz;
+    bool object_marked;
+    uint8_t *marks;
+    size_t marks_sz;
+    size_t marks_capacity;
+
+    // The heaviest objects of the scan by the events decoded from them,
+    // kept in a min-heap when the cursor tracks them. An object is weighed
+    // when the cursor moves past it, so it needs a known key, which is
+    // held from the time the cursor was pointed at it.
+    sky_cursor_heavy_object *heavy;
+    uint32_t heavy_capacity;
+    uint32_t heavy_count;
+    const void *heavy_key;
+    size_t heavy_key_sz;
+    uint64_t object_start_event_count;
 };
 
 
@@ -96,6 +311,8 @@ void sky_cursor_set_timestamp_offset(sky_cursor *cursor, uint32_t offset);
 
 void sky_cursor_set_ts_offset(sky_cursor *cursor, uint32_t offset);
 
+void sky_cursor_set_prev_timestamp_offset(sky_cursor *cursor, uint32_t offset);
+
 void sky_cursor_set_property(sky_cursor *cursor,
   int64_t property_id, uint32_t offset, uint32_t sz, const char *data_type);
 
@@ -122,10 +339,134 @@ bool sky_cursor_eos(sky_cursor *cursor);
 
 void sky_cursor_set_session_idle(sky_cursor *cursor, uint32_t seconds);
 
+void sky_cursor_set_time_range(sky_cursor *cursor, int64_t min_ts, int64_t max_ts);
+
+void sky_cursor_clear_time_range(sky_cursor *cursor);
+
 void sky_cursor_next_session(sky_cursor *cursor);
 
 bool sky_lua_cursor_next_session(sky_cursor *cursor);
 
+
+//--------------------------------------
+// Rewinding
+//--------------------------------------
+
+int32_t sky_cursor_mark(sky_cursor *cursor);
+
+bool sky_cursor_restore(sky_cursor *cursor, int32_t mark);
+
+
+//--------------------------------------
+// Batch Iteration
+//--------------------------------------
+
+void *sky_cursor_set_batch(sky_cursor *cursor, uint32_t sz, uint32_t capacity);
+
+int sky_cursor_set_batch_column(sky_cursor *cursor, int64_t property_id, uint32_t offset);
+
+void *sky_cursor_batch_column_values(sky_cursor *cursor, int64_t property_id, uint8_t *data_type, uint8_t *sz);
+
+uint32_t sky_cursor_next_batch(sky_cursor *cursor);
+
 void sky_cursor_clear_data(sky_cursor *cursor);
 
+
+//--------------------------------------
+// Families
+//--------------------------------------
+
+int sky_cursor_add_family(sky_cursor *cursor, void *ptr, size_t sz);
+
+
+//--------------------------------------
+// Filtering
+//--------------------------------------
+
+int sky_cursor_set_filter(sky_cursor *cursor, const void *code, uint32_t sz);
+
+
+//--------------------------------------
+// Stats
+//--------------------------------------
+
+void sky_cursor_clear_stats(sky_cursor *cursor);
+
+
+//--------------------------------------
+// Cancellation
+//--------------------------------------
+
+void sky_cursor_cancel(sky_cursor *cursor);
+
+bool sky_cursor_is_cancelled(sky_cursor *cursor);
+
+void sky_cursor_clear_cancel(sky_cursor *cursor);
+
+
+//--------------------------------------
+// Sampling
+//--------------------------------------
+
+void sky_cursor_set_sample(sky_cursor *cursor, double ratio);
+
+void sky_cursor_set_sample_range(sky_cursor *cursor, double start, double end);
+
+bool sky_cursor_sample_key(sky_cursor *cursor, const void *key, size_t sz);
+
+
+//--------------------------------------
+// States
+//--------------------------------------
+
+void sky_cursor_set_state_only(sky_cursor *cursor, bool state_only);
+
+
+//--------------------------------------
+// Object Bounds
+//--------------------------------------
+
+void sky_cursor_set_object_bounds(sky_cursor *cursor, uint32_t min_events, int64_t min_span);
+
+bool sky_cursor_object_in_bounds(sky_cursor *cursor, uint64_t event_count, int64_t span);
+
+
+//--------------------------------------
+// Members
+//--------------------------------------
+
+int sky_cursor_set_members(sky_cursor *cursor, const void *keys, size_t sz,
+  const uint32_t *offsets, uint32_t count);
+
+void sky_cursor_clear_members(sky_cursor *cursor);
+
+bool sky_cursor_member_key(sky_cursor *cursor, const void *key, size_t sz);
+
+
+//--------------------------------------
+// Marks
+//--------------------------------------
+
+void sky_cursor_set_object_key(sky_cursor *cursor, const void *key, size_t sz);
+
+void sky_cursor_mark_object(sky_cursor *cursor);
+
+const void *sky_cursor_marks(sky_cursor *cursor, size_t *sz);
+
+void sky_cursor_clear_marks(sky_cursor *cursor);
+
+
+//--------------------------------------
+// Heavy Objects
+//--------------------------------------
+
+int sky_cursor_set_heavy_capacity(sky_cursor *cursor, uint32_t capacity);
+
+uint32_t sky_cursor_heavy_count(sky_cursor *cursor);
+
+const void *sky_cursor_heavy_object_key(sky_cursor *cursor, uint32_t index, size_t *sz,
+  uint64_t *event_count);
+
+void sky_cursor_clear_heavy(sky_cursor *cursor);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+#ifndef _sky_event_block_h
+#define _sky_event_block_h
+
+#include <inttypes.h>
+
+//==============================================================================
+//
+// Overview
+//
+//==============================================================================
+
+// An event block is a fixed-layout, columnar encoding of a run of events
+// that can appear in an object's value anywhere a msgpack event can. It
+// starts with a byte that is never a valid msgpack type so the cursor can
+// tell the two apart without any extra framing. All integers are stored
+// little endian.
+//
+//   HEADER (24 bytes)
+//     uint8   flag          (SKY_EVENT_BLOCK_FLAG)
+//     uint8   version       (SKY_EVENT_BLOCK_VERSION)
+//     uint16  column count
+//     uint32  event count
+//     uint32  block size    (total bytes, including the header)
+//     uint32  timestamps size (total bytes of the timestamps)
+//     int64   base timestamp
+//
+//   TIMESTAMPS
+//     varint  delta of delta[event count]
+//
+//   COLUMNS (one per property)
+//     int64   property id
+//     uint8   type          (SKY_EVENT_BLOCK_TYPE_*)
+//     uint8   reserved[3]
+//     uint32  column size   (total bytes, including this column header)
+//     uint8   presence bitmap[(event count + 7) / 8]
+//     values:
+//       INT     int64[event count]
+//       DOUBLE  float64[event count]
+//       BOOLEAN uint8[event count]
+//       STRING  uint32 offset[event count + 1], followed by the string bytes
+//       DICT    uint32 code[event count], uint32 entry count,
+//               uint32 offset[entry count + 1], followed by the entry bytes
+//       PACKED  uint32 offset[group count + 1], followed by the groups
+//
+// Each timestamp is stored as the change in the gap from the previous
+// event, starting from the base timestamp with a gap of zero. The values
+// are zigzag encoded into little endian base 128 varints so regular gaps
+// take a single byte. Since they can only be read in order, the cursor
+// keeps the previous timestamp and gap as it moves through the block.
+//
+// Version 1 blocks store each timestamp as a fixed int64 delta from the
+// base timestamp instead and leave the timestamps size as zero:
+//
+//   TIMESTAMPS (version 1)
+//     int64   delta[event count]   (added to the base timestamp)
+//
+// Every column has a slot for every event so a value can be located by its
+// event index alone. Slots for events without the property are zeroed and
+// their presence bit is cleared.
+//
+// String columns with few distinct values are stored as a dictionary of the
+// distinct strings and a code for each event that indexes into it.
+//
+// Integer columns whose values fall in narrow ranges are bit packed in
+// groups of 128 events. Each group holds the smallest value in it as a
+// frame of reference followed by the difference of each value from it in
+// a fixed number of bits:
+//
+//   GROUP
+//     int64   reference
+//     uint8   width         (bits per value, 0-64)
+//     uint8   values[width * 16]
+//
+// Values are packed starting from the low bit of the first byte. The group
+// offsets are from the end of the offset list and the last one is the size
+// of the groups. The final group is padded out to 128 values and slots for
+// events without the property hold the reference.
+
+
+//==============================================================================
+//
+// Constants
+//
+//==============================================================================
+
+#define SKY_EVENT_BLOCK_FLAG              0xC1
+#define SKY_EVENT_BLOCK_VERSION           2
+#define SKY_EVENT_BLOCK_FIXED_TS_VERSION  1
+
+#define SKY_EVENT_BLOCK_HEADER_SZ         24
+#define SKY_EVENT_BLOCK_COLUMN_HEADER_SZ  16
+
+#define SKY_EVENT_BLOCK_TYPE_STRING       1
+#define SKY_EVENT_BLOCK_TYPE_INT          2
+#define SKY_EVENT_BLOCK_TYPE_DOUBLE       3
+#define SKY_EVENT_BLOCK_TYPE_BOOLEAN      4
+#define SKY_EVENT_BLOCK_TYPE_DICT         5
+#define SKY_EVENT_BLOCK_TYPE_PACKED       6
+
+#define SKY_EVENT_BLOCK_GROUP_SZ          128
+#define SKY_EVENT_BLOCK_GROUP_HEADER_SZ   9
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef _sky_kernel_h
+#define _sky_kernel_h
+
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "sky/cursor.h"
+
+//==============================================================================
+//
+// Overview
+//
+//==============================================================================
+
+// A kernel runs the common shape of an aggregation natively instead of in
+// Lua: events counted and numeric properties summed, grouped by up to two
+// factors. Each group of a kernel reads the batch columns of its factors
+// and fields from the cursor so it has to be bound to a cursor whose batch
+// already has those columns.
+//
+// Groups are kept in an open addressing hash table keyed by the factor
+// sequences of the event. The values of a group are its event count
+// followed by one sum per field.
+
+
+//==============================================================================
+//
+// Constants
+//
+//==============================================================================
+
+#define SKY_KERNEL_MAX_DIMENSIONS 2
+
+
+//==============================================================================
+//
+// Typedefs
+//
+//==============================================================================
+
+typedef struct {
+    uint32_t dimension_count;
+    int64_t dimension_ids[SKY_KERNEL_MAX_DIMENSIONS];
+    int32_t *dimensions[SKY_KERNEL_MAX_DIMENSIONS];
+    uint32_t field_count;
+    int64_t *field_ids;
+    uint8_t *field_types;
+    uint8_t *field_sizes;
+    void **fields;
+
+    uint32_t capacity;
+    uint32_t count;
+    uint64_t *keys;
+    bool *used;
+    double *values;
+} sky_kernel_group;
+
+typedef struct sky_kernel {
+    sky_kernel_group *groups;
+    uint32_t group_count;
+    size_t memory_used;
+    size_t memory_limit;
+} sky_kernel;
+
+
+//==============================================================================
+//
+// Functions
+//
+//==============================================================================
+
+//--------------------------------------
+// Lifecycle
+//--------------------------------------
+
+sky_kernel *sky_kernel_new();
+
+void sky_kernel_free(sky_kernel *kernel);
+
+
+//--------------------------------------
+// Groups
+//--------------------------------------
+
+int sky_kernel_add_group(sky_kernel *kernel,
+  uint32_t dimension_count, const int64_t *dimension_ids,
+  uint32_t field_count, const int64_t *field_ids);
+
+int sky_kernel_bind(sky_kernel *kernel, sky_cursor *cursor);
+
+void sky_kernel_set_memory_limit(sky_kernel *kernel, size_t limit);
+
+void sky_kernel_group_key_dimensions(sky_kernel_group *group, uint64_t key,
+  int32_t *dimensions);
+
+
+//--------------------------------------
+// Execution
+//--------------------------------------
+
+int sky_kernel_run(sky_kernel *kernel, sky_cursor *cursor);
+
+void sky_kernel_reset(sky_kernel *kernel);
+
+#endif
@@ -17,6 +17,8 @@
 
 size_t minipack_sizeof_elem_and_data(void *ptr);
 
+size_t minipack_fixnum_run(void *ptr, size_t len);
+
 
 //==============================================================================
 //
@@ -0,0 +1,273 @@
+#ifndef _sky_object_scan_h
+#define _sky_object_scan_h
+
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <leveldb/c.h>
+
+#include "sky/cursor.h"
+
+//==============================================================================
+//
+// Overview
+//
+//==============================================================================
+
+// An object scan feeds the objects of a table to a cursor straight from a
+// LevelDB iterator so that no call leaves C between objects.
+//
+// Every key of a table starts with the table prefix. An object is stored
+// under its object key as its state followed by the indexed tail of its
+// event stream. Older events are sealed into chunks whose keys are the
+// object key, a zero byte and an 8 byte start timestamp, so they sort right
+// after the head. Each event stream begins with a raw index of the shifted
+// timestamps in it, which lets the scan drop the chunks after the cursor's
+// time range and start from the latest checkpoint of the object's permanent
+// values before it. Objects without a checkpoint before the range are read
+// from their first event.
+// Newer objects have an empty state in their head and store it under the
+// object key and a one byte instead, after their chunks. Cursors that read
+// only states get each object's state as its single event.
+//
+// Tables with property families store the values of each family apart from
+// the rest of an object, under the object key, a two byte and the family
+// name, after the object's state. Each is an event stream behind an empty
+// state and an index, like a head. The scan seeks past them and only adds
+// the families it reads to the cursor, so unreferenced families are never
+// read.
+//
+// The iterator must be created with pinned data: values are passed to the
+// cursor in place, and an object's chunks are read after moving past its
+// head. The pins are released when the cursor moves to the next object.
+//
+// A frozen scan feeds the objects of a frozen file instead. Each object is
+// stored whole, in the cursor's format, and located through an index of
+// fixed size entries: a little endian uint64 offset, a uint32 size and a
+// uint32 offset of the object's key. The objects are passed to the cursor
+// in place and those whose index falls outside of the cursor's time range
+// are skipped.
+//
+// Both scans drop objects outside of the cursor's sample or its members by
+// their key before any of the object is read, and give the cursor the key of
+// each object they pass on so that the aggregation can mark it.
+//
+// A pipelined object scan moves the iterator on a producer thread of its
+// own, so that block reads, decompression and merging overlap with the
+// decoding and aggregation of the objects already read. The producer copies
+// each object that the cursor would be pointed at, with its key and
+// families, into a slot of a bounded ring and the cursor is pointed at the
+// copies in turn, prefetching the next one. The producer starts when the
+// cursor first asks for an object, after the scan and cursor are set up,
+// and neither may change until the iterator is detached, which stops it.
+// The slot of the current object stays untouched until the cursor moves on.
+//
+// Each index also counts the events of its stream. When the cursor has
+// object bounds, both scans sum the counts of an object's streams and take
+// its span from the first and last timestamps before the cursor is pointed
+// at it, and skip objects with too few events or too short a span. Streams
+// without a count, such as those written before indexes had one or trimmed
+// by retention, are walked for it without decoding their events.
+
+
+//==============================================================================
+//
+// Constants
+//
+//==============================================================================
+
+#define SKY_OBJECT_CHUNK_MARKER       0x00
+#define SKY_OBJECT_CHUNK_SUFFIX_SIZE  9
+#define SKY_OBJECT_STATE_MARKER       0x01
+#define SKY_OBJECT_FAMILY_MARKER      0x02
+
+#define SKY_EVENT_INDEX_VERSION       2
+#define SKY_EVENT_INDEX_HEADER_SIZE   25
+#define SKY_EVENT_INDEX_ENTRY_SIZE    12
+#define SKY_EVENT_INDEX_NO_COUNT      0xFFFFFFFF
+
+// Version 1 indexes have no event count in their header.
+#define SKY_EVENT_INDEX_V1_VERSION     1
+#define SKY_EVENT_INDEX_V1_HEADER_SIZE 21
+
+#define SKY_FROZEN_INDEX_ENTRY_SIZE   16
+
+
+//==============================================================================
+//
+// Typedefs
+//
+//==============================================================================
+
+// A key range that the scan seeks past. A NULL end runs to the end of the
+// table.
+typedef struct {
+    void *start;
+    size_t start_sz;
+    void *end;
+    size_t end_sz;
+} sky_object_scan_range;
+
+// The name of a property family that the scan reads.
+typedef struct {
+    void *name;
+    size_t sz;
+} sky_object_scan_family;
+
+// An event stream of the current object and its index, if it has one.
+typedef struct {
+    const uint8_t *ptr;
+    size_t sz;
+    bool has_index;
+    int64_t first_ts;
+    int64_t last_ts;
+    const uint8_t *entries;
+    uint32_t entry_count;
+    bool has_count;
+    uint32_t event_count;
+} sky_object_scan_piece;
+
+// A copy of an object read ahead by a pipelined scan. The buffer holds the
+// object's key, its state and events and then its family streams, back to
+// back.
+typedef struct {
+    uint8_t *buffer;
+    size_t buffer_capacity;
+    size_t key_sz;
+    size_t sz;
+    size_t *family_szs;
+    uint32_t family_count;
+    uint32_t family_capacity;
+} sky_object_scan_slot;
+
+typedef struct sky_object_scan {
+    leveldb_iterator_t *iterator;
+    void *prefix;
+    size_t prefix_sz;
+    void *end_key;
+    size_t end_key_sz;
+
+    sky_object_scan_range *skip_ranges;
+    uint32_t skip_range_count;
+    uint32_t skip_index;
+
+    bool has_families;
+    sky_object_scan_family *families;
+    uint32_t family_count;
+
+    void *head_key;
+    size_t head_key_capacity;
+    sky_object_scan_piece *pieces;
+    uint32_t piece_capacity;
+    void *buffer;
+    size_t buffer_capacity;
+
+    // The object read last, which the cursor is pointed at. Its key is the
+    // head key.
+    const void *object_ptr;
+    size_t object_sz;
+    size_t object_key_sz;
+    sky_cursor_family *family_streams;
+    uint32_t family_stream_count;
+    uint32_t family_stream_capacity;
+
+    // The ring of a pipelined scan. The producer fills slots up to the
+    // produced count and the cursor frees them up to the consumed count.
+    // Either side spins briefly and then sleeps on the condition when the
+    // other is behind, after flagging that it waits.
+    uint32_t pipeline_depth;
+    sky_object_scan_slot *slots;
+    sky_cursor *pipeline_cursor;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool running;
+    bool finished;
+    bool holding;
+    uint64_t produced;
+    uint64_t consumed;
+    bool produced_all;
+    bool stopping;
+    bool producer_waiting;
+    bool consumer_waiting;
+} sky_object_scan;
+
+typedef struct sky_frozen_scan {
+    const uint8_t *data;
+    const uint8_t *index;
+    const uint8_t *keys;
+    size_t keys_sz;
+    uint32_t count;
+    uint32_t next;
+    uint32_t end;
+} sky_frozen_scan;
+
+
+//==============================================================================
+//
+// Functions
+//
+//==============================================================================
+
+//--------------------------------------
+// Lifecycle
+//--------------------------------------
+
+sky_object_scan *sky_object_scan_new();
+
+void sky_object_scan_free(sky_object_scan *scan);
+
+
+//--------------------------------------
+// Configuration
+//--------------------------------------
+
+int sky_object_scan_set_prefix(sky_object_scan *scan, const void *prefix, size_t sz);
+
+int sky_object_scan_set_end_key(sky_object_scan *scan, const void *key, size_t sz);
+
+int sky_object_scan_add_skip_range(sky_object_scan *scan,
+  const void *start, size_t start_sz, const void *end, size_t end_sz);
+
+void sky_object_scan_clear_skip_ranges(sky_object_scan *scan);
+
+void sky_object_scan_set_has_families(sky_object_scan *scan, bool has_families);
+
+int sky_object_scan_add_family(sky_object_scan *scan, const void *name, size_t sz);
+
+void sky_object_scan_clear_families(sky_object_scan *scan);
+
+int sky_object_scan_set_pipeline_depth(sky_object_scan *scan, uint32_t depth);
+
+void sky_object_scan_set_iterator(sky_object_scan *scan, leveldb_iterator_t *iterator);
+
+void sky_cursor_set_object_scan(sky_cursor *cursor, sky_object_scan *scan);
+
+
+//--------------------------------------
+// Object Iteration
+//--------------------------------------
+
+int sky_object_scan_next_object(void *cursor);
+
+
+//--------------------------------------
+// Frozen Scans
+//--------------------------------------
+
+sky_frozen_scan *sky_frozen_scan_new();
+
+void sky_frozen_scan_free(sky_frozen_scan *scan);
+
+void sky_frozen_scan_set_range(sky_frozen_scan *scan,
+  const void *data, const void *index, uint32_t first, uint32_t end);
+
+void sky_frozen_scan_set_keys(sky_frozen_scan *scan,
+  const void *keys, size_t sz, uint32_t count);
+
+void sky_cursor_set_frozen_scan(sky_cursor *cursor, sky_frozen_scan *scan);
+
+int sky_frozen_scan_next_object(void *cursor);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef _sky_sketch_h
+#define _sky_sketch_h
+
+#include <inttypes.h>
+
+//==============================================================================
+//
+// Overview
+//
+//==============================================================================
+
+// Sketches are fixed-size summaries of a stream of values that are built by
+// the generated aggregate functions and merged across servlets. Every sketch
+// starts with a type byte and a version byte so that it can be sized and
+// merged without knowing what created it. All integers are stored little
+// endian.
+//
+//   HYPERLOGLOG (distinct count)
+//     uint8   type          (SKY_SKETCH_TYPE_HLL)
+//     uint8   version       (SKY_SKETCH_VERSION)
+//     uint8   register[SKY_HLL_REGISTER_COUNT]
+//
+//   QUANTILE (log-bucketed histogram)
+//     uint8   type          (SKY_SKETCH_TYPE_QUANTILE)
+//     uint8   version       (SKY_SKETCH_VERSION)
+//     uint64  zero count
+//     uint32  negative[SKY_QUANTILE_BUCKET_COUNT]
+//     uint32  positive[SKY_QUANTILE_BUCKET_COUNT]
+//
+//   HISTOGRAM (fixed-width buckets)
+//     uint8   type          (SKY_SKETCH_TYPE_HISTOGRAM)
+//     uint8   version       (SKY_SKETCH_VERSION)
+//     uint32  bucket count
+//     double  min
+//     double  max
+//     uint32  count[bucket count]
+//
+// Unlike the other sketches a histogram's size depends on its bucket count
+// and only histograms with the same range and bucket count can be merged.
+// Each histogram bucket covers an equal part of [min, max) and values
+// outside of the range are counted in the first or last bucket.
+//
+// A quantile bucket i holds the values whose magnitude is in
+// (gamma^(i-o-1), gamma^(i-o)] where o is half the bucket count and gamma
+// is (1+a)/(1-a) for the relative accuracy a. Magnitudes outside of the
+// bucket range are counted in the first or last bucket.
+
+
+//==============================================================================
+//
+// Constants
+//
+//==============================================================================
+
+#define SKY_SKETCH_TYPE_HLL       1
+#define SKY_SKETCH_TYPE_QUANTILE  2
+#define SKY_SKETCH_TYPE_HISTOGRAM 3
+#define SKY_SKETCH_VERSION        1
+#define SKY_SKETCH_HEADER_SZ      2
+
+#define SKY_HLL_PRECISION         12
+#define SKY_HLL_REGISTER_COUNT    (1 << SKY_HLL_PRECISION)
+#define SKY_HLL_SZ                (SKY_SKETCH_HEADER_SZ + SKY_HLL_REGISTER_COUNT)
+
+#define SKY_QUANTILE_ACCURACY     0.02
+#define SKY_QUANTILE_LOG_GAMMA    0.040005334613699   // log((1+a)/(1-a))
+#define SKY_QUANTILE_BUCKET_COUNT 1024
+#define SKY_QUANTILE_SZ           (SKY_SKETCH_HEADER_SZ + 8 + (8 * SKY_QUANTILE_BUCKET_COUNT))
+
+#define SKY_HISTOGRAM_HEADER_SZ   (SKY_SKETCH_HEADER_SZ + 4 + 8 + 8)
+#define SKY_HISTOGRAM_MAX_BUCKETS 4096
+#define SKY_HISTOGRAM_SZ(BUCKETS) (SKY_HISTOGRAM_HEADER_SZ + (4 * (BUCKETS)))
+
+
+//==============================================================================
+//
+// Functions
+//
+//==============================================================================
+
+//--------------------------------------
+// Sketches
+//--------------------------------------
+
+uint32_t sky_sketch_type_sz(uint8_t type);
+
+uint32_t sky_sketch_sz(const void *sketch);
+
+int sky_sketch_init(void *sketch, uint8_t type);
+
+int sky_sketch_merge(void *dest, const void *src);
+
+
+//--------------------------------------
+// HyperLogLog
+//--------------------------------------
+
+void sky_hll_add_double(void *sketch, double value);
+
+void sky_hll_add_string(void *sketch, const char *value, int32_t length);
+
+
+//--------------------------------------
+// Quantiles
+//--------------------------------------
+
+void sky_quantile_add(void *sketch, double value);
+
+
+//--------------------------------------
+// Histograms
+//--------------------------------------
+
+uint32_t sky_histogram_sz(uint32_t buckets);
+
+int sky_histogram_init(void *sketch, double min, double max, uint32_t buckets);
+
+void sky_histogram_add(void *sketch, double value);
+
+#endif
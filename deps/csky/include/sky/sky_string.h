@@ -7,8 +7,12 @@
 //
 //==============================================================================
 
+// Strings read from a block dictionary have a code that's unique to their
+// dictionary entry for the life of the cursor so that callers can cache
+// anything derived from the string by code. Other strings have a zero code.
 typedef struct {
   int32_t length;
+  uint32_t code;
   char *data;
 } sky_string;
 
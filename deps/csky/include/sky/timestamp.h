@@ -19,5 +19,17 @@ int64_t sky_timestamp_unshift(int64_t value);
 
 int64_t sky_timestamp_to_seconds(int64_t value);
 
+//--------------------------------------
+// Bucketing
+//--------------------------------------
+
+int64_t sky_timestamp_bucket(int64_t value, int64_t interval, int64_t offset);
+
+//--------------------------------------
+// Clock
+//--------------------------------------
+
+double sky_clock_ns();
+
 #endif
 
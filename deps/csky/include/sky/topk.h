@@ -0,0 +1,62 @@
+#ifndef _sky_topk_h
+#define _sky_topk_h
+
+#include <inttypes.h>
+
+//==============================================================================
+//
+// Overview
+//
+//==============================================================================
+
+// A top-k tracks the heaviest keys of a stream in a fixed number of slots
+// using the space-saving algorithm. The keys themselves are kept by the
+// caller and mapped to slots. When every slot is taken, a new key replaces
+// the key in the lightest slot and inherits its weight so that the weight
+// of a slot never underestimates the weight of its key.
+//
+// Slots are kept in a min-heap ordered by weight so that the lightest slot
+// can be found in constant time.
+
+
+//==============================================================================
+//
+// Typedefs
+//
+//==============================================================================
+
+typedef struct sky_topk {
+    uint32_t capacity;
+    uint32_t count;
+    double *weights;
+    uint32_t *heap;
+    uint32_t *positions;
+} sky_topk;
+
+
+//==============================================================================
+//
+// Functions
+//
+//==============================================================================
+
+//--------------------------------------
+// Lifecycle
+//--------------------------------------
+
+sky_topk *sky_topk_new(uint32_t capacity);
+
+void sky_topk_free(sky_topk *topk);
+
+
+//--------------------------------------
+// Weights
+//--------------------------------------
+
+uint32_t sky_topk_insert(sky_topk *topk, double weight);
+
+void sky_topk_add(sky_topk *topk, uint32_t slot, double weight);
+
+double sky_topk_weight(sky_topk *topk, uint32_t slot);
+
+#endif
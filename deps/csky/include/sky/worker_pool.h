@@ -0,0 +1,110 @@
+#ifndef _sky_worker_pool_h
+#define _sky_worker_pool_h
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+//==============================================================================
+//
+// Overview
+//
+//==============================================================================
+
+// A worker pool runs tasks on native threads that the caller's runtime
+// doesn't schedule. Tasks are pushed onto a bounded lock-free ring that the
+// workers take from, and the ids of finished tasks are pushed onto a second
+// ring that the caller drains. The pool's file descriptor becomes readable
+// once finished tasks are waiting so that the caller can block on it
+// instead of on each task.
+//
+// Both rings are multi-producer, multi-consumer queues where each slot
+// carries a sequence number that tells producers and consumers whether the
+// slot is theirs. Workers spin briefly on an empty ring before sleeping so
+// that bursts of tasks don't pay for a wakeup each.
+//
+// Workers can be pinned to a list of CPUs, one after another, so that a
+// task's working set stays in one core's caches. Pools bound to a NUMA
+// node also make their workers prefer memory from the node so that what
+// tasks allocate is local to the CPUs that read it.
+
+
+//==============================================================================
+//
+// Typedefs
+//
+//==============================================================================
+
+typedef void (*sky_worker_task_func)(void *arg);
+
+typedef struct sky_worker_ring_slot {
+    uint64_t sequence;
+    sky_worker_task_func func;
+    void *arg;
+    uint64_t id;
+} sky_worker_ring_slot;
+
+typedef struct sky_worker_ring {
+    uint32_t mask;
+    sky_worker_ring_slot *slots;
+    char pad0[64];
+    uint64_t head;
+    char pad1[64];
+    uint64_t tail;
+    char pad2[64];
+} sky_worker_ring;
+
+typedef struct sky_worker_pool {
+    uint32_t thread_count;
+    uint32_t started_count;
+    uint32_t next_thread;
+    pthread_t *threads;
+    int *cpus;
+    uint32_t cpu_count;
+    int node;
+    sky_worker_ring tasks;
+    sky_worker_ring completions;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t sleepers;
+    bool stopping;
+    bool stopped;
+    uint32_t notified;
+    int fds[2];
+} sky_worker_pool;
+
+
+//==============================================================================
+//
+// Functions
+//
+//==============================================================================
+
+//--------------------------------------
+// Lifecycle
+//--------------------------------------
+
+sky_worker_pool *sky_worker_pool_new(uint32_t thread_count, uint32_t capacity,
+    bool pinned);
+
+sky_worker_pool *sky_worker_pool_new_bound(uint32_t thread_count,
+    uint32_t capacity, const int *cpus, uint32_t cpu_count, int node);
+
+void sky_worker_pool_stop(sky_worker_pool *pool);
+
+void sky_worker_pool_free(sky_worker_pool *pool);
+
+
+//--------------------------------------
+// Tasks
+//--------------------------------------
+
+int sky_worker_pool_submit(sky_worker_pool *pool, sky_worker_task_func func,
+    void *arg, uint64_t id);
+
+uint32_t sky_worker_pool_drain(sky_worker_pool *pool, uint64_t *ids,
+    uint32_t count);
+
+int sky_worker_pool_fd(sky_worker_pool *pool);
+
+#endif
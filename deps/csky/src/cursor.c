@@ -1,21 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "sky/cursor.h"
+#include "sky/event_block.h"
 #include "sky/mem.h"
 #include "sky/timestamp.h"
 #include "sky/minipack.h"
 #include "sky/sky_string.h"
 #include "sky/dbg.h"
 
-//==============================================================================
-//
-// Constants
-//
-//==============================================================================
-
-#define SKY_PROPERTY_DESCRIPTOR_PADDING  32
-
-
 //==============================================================================
 //
 // Macros
@@ -44,8 +36,16 @@ void sky_set_noop(void *target, void *value, size_t *sz);
 
 void sky_set_string(void *target, void *value, size_t *sz);
 
+void sky_set_int8(void *target, void *value, size_t *sz);
+
+void sky_set_int16(void *target, void *value, size_t *sz);
+
 void sky_set_int(void *target, void *value, size_t *sz);
 
+void sky_set_int64(void *target, void *value, size_t *sz);
+
+void sky_set_float(void *target, void *value, size_t *sz);
+
 void sky_set_double(void *target, void *value, size_t *sz);
 
 void sky_set_boolean(void *target, void *value, size_t *sz);
@@ -57,13 +57,92 @@ void sky_set_boolean(void *target, void *value, size_t *sz);
 
 void sky_clear_string(void *target);
 
+void sky_clear_int8(void *target);
+
+void sky_clear_int16(void *target);
+
 void sky_clear_int(void *target);
 
+void sky_clear_int64(void *target);
+
+void sky_clear_float(void *target);
+
 void sky_clear_double(void *target);
 
 void sky_clear_boolean(void *target);
 
 
+//--------------------------------------
+// Descriptor Management
+//--------------------------------------
+
+static void sky_cursor_resize_property_descriptors(sky_cursor *cursor,
+  int64_t min_property_id, int64_t max_property_id);
+
+
+//--------------------------------------
+// Batch Iteration
+//--------------------------------------
+
+static void sky_cursor_free_batch(sky_cursor *cursor);
+
+
+//--------------------------------------
+// Event Iteration
+//--------------------------------------
+
+static void sky_cursor_read_event(sky_cursor *cursor);
+
+static void sky_cursor_set_event_timestamp(sky_cursor *cursor, int64_t ts, uint32_t timestamp);
+
+static void *sky_cursor_read_data_map(sky_cursor *cursor, void *ptr, void *endptr, bool decode);
+
+
+//--------------------------------------
+// Rewinding
+//--------------------------------------
+
+static void sky_cursor_clear_rewind(sky_cursor *cursor);
+
+static int sky_cursor_push_rewind(sky_cursor *cursor);
+
+static void sky_cursor_replay_event(sky_cursor *cursor, uint32_t index);
+
+
+//--------------------------------------
+// Families
+//--------------------------------------
+
+static void sky_cursor_read_families(sky_cursor *cursor, int64_t ts);
+
+
+//--------------------------------------
+// Filtering
+//--------------------------------------
+
+static bool sky_cursor_filter_matches(sky_cursor *cursor);
+
+
+//--------------------------------------
+// Event Blocks
+//--------------------------------------
+
+static void sky_cursor_open_block(sky_cursor *cursor, void *ptr);
+
+static void sky_cursor_next_block_event(sky_cursor *cursor);
+
+static void sky_cursor_read_block_value(sky_cursor *cursor, sky_cursor_block_column *column, uint32_t index);
+
+static bool sky_cursor_block_group_fails_filter(sky_cursor *cursor, uint32_t index);
+
+
+//--------------------------------------
+// Heavy Objects
+//--------------------------------------
+
+static void sky_cursor_weigh_object(sky_cursor *cursor);
+
+
 //==============================================================================
 //
 // Functions
@@ -74,36 +153,53 @@ void sky_clear_boolean(void *target);
 // Lifecycle
 //--------------------------------------
 
-// Creates a reference to a cursor.
+// Creates a reference to a cursor. Descriptors are only allocated for the
+// given range of property ids so callers should pass the range of the
+// properties that are actually referenced. Values for properties outside the
+// range are skipped while decoding.
 sky_cursor *sky_cursor_new(int32_t min_property_id,
                            int32_t max_property_id)
 {
     sky_cursor *cursor = calloc(1, sizeof(sky_cursor));
+    sky_cursor_resize_property_descriptors(cursor, min_property_id, max_property_id);
+    cursor->next_dict_code = 1;
+    return cursor;
+}
 
-    // Add one property to account for the zero descriptor.
-    min_property_id -= SKY_PROPERTY_DESCRIPTOR_PADDING;
-    max_property_id += SKY_PROPERTY_DESCRIPTOR_PADDING;
-    int32_t property_count = (max_property_id - min_property_id) + 1;
+// Resizes the descriptor array to cover a range of property ids. Existing
+// descriptors are kept and property zero is always included so that it can
+// be used as the base of the array.
+static void sky_cursor_resize_property_descriptors(sky_cursor *cursor,
+                                                   int64_t min_property_id,
+                                                   int64_t max_property_id)
+{
+    if(min_property_id > 0) min_property_id = 0;
+    if(max_property_id < 0) max_property_id = 0;
+    if(cursor->property_descriptors != NULL) {
+        if(cursor->min_property_id < min_property_id) min_property_id = cursor->min_property_id;
+        if(cursor->max_property_id > max_property_id) max_property_id = cursor->max_property_id;
+    }
+    uint32_t property_count = (uint32_t)(max_property_id - min_property_id) + 1;
 
-    // Allocate memory for the descriptors.
-    cursor->property_descriptors = calloc(property_count, sizeof(sky_property_descriptor));
-    cursor->property_count = property_count;
-    cursor->property_zero_descriptor = NULL;
-    
-    // Initialize all property descriptors to noop.
-    int32_t i;
+    // Initialize all property descriptors to noop and copy over any that
+    // were previously set.
+    sky_property_descriptor *property_descriptors = calloc(property_count, sizeof(sky_property_descriptor));
+    uint32_t i;
     for(i=0; i<property_count; i++) {
-        int64_t property_id = min_property_id + (int64_t)i;
-        cursor->property_descriptors[i].property_id = property_id;
-        cursor->property_descriptors[i].set_func = sky_set_noop;
-        
-        // Save a pointer to the descriptor that points to property zero.
-        if(property_id == 0) {
-            cursor->property_zero_descriptor = &cursor->property_descriptors[i];
-        }
+        property_descriptors[i].property_id = min_property_id + (int64_t)i;
+        property_descriptors[i].set_func = sky_set_noop;
+    }
+    if(cursor->property_descriptors != NULL) {
+        memcpy(&property_descriptors[cursor->min_property_id - min_property_id],
+            cursor->property_descriptors, cursor->property_count * sizeof(sky_property_descriptor));
+        free(cursor->property_descriptors);
     }
 
-    return cursor;
+    cursor->property_descriptors = property_descriptors;
+    cursor->property_count = property_count;
+    cursor->min_property_id = min_property_id;
+    cursor->max_property_id = max_property_id;
+    cursor->property_zero_descriptor = &property_descriptors[-min_property_id];
 }
 
 // Removes a cursor reference from memory.
@@ -115,6 +211,16 @@ void sky_cursor_free(sky_cursor *cursor)
         cursor->property_count = 0;
 
         if(cursor->data != NULL) free(cursor->data);
+        if(cursor->block_columns != NULL) free(cursor->block_columns);
+        free(cursor->block_packed);
+        free(cursor->families);
+        free(cursor->rewind);
+        free(cursor->rewind_session_indexes);
+        if(cursor->filter != NULL) free(cursor->filter);
+        sky_cursor_free_batch(cursor);
+        sky_cursor_clear_members(cursor);
+        free(cursor->marks);
+        sky_cursor_set_heavy_capacity(cursor, 0);
 
         free(cursor);
     }
@@ -125,22 +231,81 @@ void sky_cursor_free(sky_cursor *cursor)
 // Data Management
 //--------------------------------------
 
+// Returns the descriptor for a property id or NULL if it's out of range.
+static inline sky_property_descriptor *sky_cursor_get_property_descriptor(sky_cursor *cursor, int64_t property_id)
+{
+    if(property_id < cursor->min_property_id || property_id > cursor->max_property_id) {
+        return NULL;
+    }
+    return &cursor->property_zero_descriptor[property_id];
+}
+
 void sky_cursor_set_value(sky_cursor *cursor, void *target,
                           int64_t property_id, void *ptr, size_t *sz)
 {
-    sky_property_descriptor *property_descriptor = &cursor->property_zero_descriptor[property_id];
+    sky_property_descriptor *property_descriptor = sky_cursor_get_property_descriptor(cursor, property_id);
+    if(property_descriptor == NULL) {
+        sky_set_noop(target, ptr, sz);
+        return;
+    }
     property_descriptor->set_func(target + property_descriptor->offset, ptr, sz);
 }
 
+// Writes an integer into a property value with the given number of bytes.
+// Values that don't fit are truncated like a C cast.
+static inline void sky_write_int(void *target, uint8_t sz, int64_t value)
+{
+    switch(sz) {
+        case 1: *((int8_t*)target) = (int8_t)value; break;
+        case 2: *((int16_t*)target) = (int16_t)value; break;
+        case 8: *((int64_t*)target) = value; break;
+        default: *((int32_t*)target) = (int32_t)value; break;
+    }
+}
+
+static inline int64_t sky_read_int(void *target, uint8_t sz)
+{
+    switch(sz) {
+        case 1: return *((int8_t*)target);
+        case 2: return *((int16_t*)target);
+        case 8: return *((int64_t*)target);
+        default: return *((int32_t*)target);
+    }
+}
+
+// Writes a floating point number into a property value with the given
+// number of bytes.
+static inline void sky_write_double(void *target, uint8_t sz, double value)
+{
+    if(sz == sizeof(float)) {
+        *((float*)target) = (float)value;
+    } else {
+        *((double*)target) = value;
+    }
+}
+
+static inline double sky_read_double(void *target, uint8_t sz)
+{
+    return (sz == sizeof(float) ? *((float*)target) : *((double*)target));
+}
+
 
 //--------------------------------------
 // Descriptor Management
 //--------------------------------------
 
+// Sets the size of the decoded event data. Events kept for rewinding are
+// dropped since they have the old size.
 void sky_cursor_set_data_sz(sky_cursor *cursor, uint32_t sz) {
     cursor->data_sz = sz;
     if(cursor->data != NULL) free(cursor->data);
     cursor->data = calloc(1, sz);
+    free(cursor->rewind);
+    free(cursor->rewind_session_indexes);
+    cursor->rewind = NULL;
+    cursor->rewind_session_indexes = NULL;
+    cursor->rewind_capacity = 0;
+    sky_cursor_clear_rewind(cursor);
 }
 
 void sky_cursor_set_timestamp_offset(sky_cursor *cursor, uint32_t offset) {
@@ -151,36 +316,84 @@ void sky_cursor_set_ts_offset(sky_cursor *cursor, uint32_t offset) {
     cursor->timestamp_descriptor.ts_offset = offset;
 }
 
+// Sets the offset in the data where the timestamp of the object's previous
+// event is written. The first event of each object has a previous
+// timestamp of zero.
+void sky_cursor_set_prev_timestamp_offset(sky_cursor *cursor, uint32_t offset) {
+    cursor->timestamp_descriptor.prev_timestamp_offset = offset;
+    cursor->timestamp_descriptor.has_prev_timestamp = true;
+}
+
 // Sets the data type and offset for a given property id.
 void sky_cursor_set_property(sky_cursor *cursor, int64_t property_id,
                              uint32_t offset, uint32_t sz, const char *data_type)
 {
-    sky_property_descriptor *property_descriptor = &cursor->property_zero_descriptor[property_id];
+    sky_property_descriptor *property_descriptor = sky_cursor_get_property_descriptor(cursor, property_id);
+    if(property_descriptor == NULL) {
+        sky_cursor_resize_property_descriptors(cursor, property_id, property_id);
+        property_descriptor = sky_cursor_get_property_descriptor(cursor, property_id);
+    }
     
-    // Set the offset and set_func function on the descriptor.
+    // Set the offset, value size and set_func function on the descriptor.
     property_descriptor->offset = offset;
     if(strlen(data_type) == 0) {
+        property_descriptor->data_type = SKY_DATA_TYPE_NONE;
         property_descriptor->set_func = sky_set_noop;
+        property_descriptor->sz = 0;
         property_descriptor->clear_func = NULL;
     }
     else if(strcmp(data_type, "string") == 0) {
+        property_descriptor->data_type = SKY_DATA_TYPE_STRING;
         property_descriptor->set_func = sky_set_string;
+        property_descriptor->sz = sizeof(sky_string);
         property_descriptor->clear_func = sky_clear_string;
     }
-    else if(strcmp(data_type, "factor") == 0 || strcmp(data_type, "integer") == 0) {
+    else if(strcmp(data_type, "factor") == 0 || strcmp(data_type, "integer") == 0 || strcmp(data_type, "int32") == 0) {
+        property_descriptor->data_type = SKY_DATA_TYPE_INT;
         property_descriptor->set_func = sky_set_int;
+        property_descriptor->sz = sizeof(int32_t);
         property_descriptor->clear_func = sky_clear_int;
     }
+    else if(strcmp(data_type, "int8") == 0) {
+        property_descriptor->data_type = SKY_DATA_TYPE_INT;
+        property_descriptor->set_func = sky_set_int8;
+        property_descriptor->sz = sizeof(int8_t);
+        property_descriptor->clear_func = sky_clear_int8;
+    }
+    else if(strcmp(data_type, "int16") == 0) {
+        property_descriptor->data_type = SKY_DATA_TYPE_INT;
+        property_descriptor->set_func = sky_set_int16;
+        property_descriptor->sz = sizeof(int16_t);
+        property_descriptor->clear_func = sky_clear_int16;
+    }
+    else if(strcmp(data_type, "int64") == 0) {
+        property_descriptor->data_type = SKY_DATA_TYPE_INT;
+        property_descriptor->set_func = sky_set_int64;
+        property_descriptor->sz = sizeof(int64_t);
+        property_descriptor->clear_func = sky_clear_int64;
+    }
     else if(strcmp(data_type, "float") == 0) {
+        property_descriptor->data_type = SKY_DATA_TYPE_DOUBLE;
         property_descriptor->set_func = sky_set_double;
+        property_descriptor->sz = sizeof(double);
         property_descriptor->clear_func = sky_clear_double;
     }
+    else if(strcmp(data_type, "float32") == 0) {
+        property_descriptor->data_type = SKY_DATA_TYPE_DOUBLE;
+        property_descriptor->set_func = sky_set_float;
+        property_descriptor->sz = sizeof(float);
+        property_descriptor->clear_func = sky_clear_float;
+    }
     else if(strcmp(data_type, "boolean") == 0) {
+        property_descriptor->data_type = SKY_DATA_TYPE_BOOLEAN;
         property_descriptor->set_func = sky_set_boolean;
+        property_descriptor->sz = sizeof(bool);
         property_descriptor->clear_func = sky_clear_boolean;
     }
     else {
+        property_descriptor->data_type = SKY_DATA_TYPE_BOOLEAN;
         property_descriptor->set_func = sky_set_boolean;
+        property_descriptor->sz = sizeof(bool);
         property_descriptor->clear_func = sky_clear_boolean;
     }
     
@@ -195,9 +408,21 @@ void sky_cursor_set_property(sky_cursor *cursor, int64_t property_id,
 // Object Iteration
 //--------------------------------------
 
-// Moves the cursor to point to the next object.
+// Moves the cursor to point to the next object. A cancelled cursor has no
+// more objects.
 bool sky_cursor_next_object(sky_cursor *cursor)
 {
+    if(__atomic_load_n(&cursor->cancelled, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    if(cursor->heavy != NULL) {
+        sky_cursor_weigh_object(cursor);
+        bool ret = (bool)cursor->next_object_func(cursor);
+        cursor->heavy_key = (ret ? cursor->object_key : NULL);
+        cursor->heavy_key_sz = cursor->object_key_sz;
+        cursor->object_start_event_count = cursor->event_count;
+        return ret;
+    }
     return (bool)cursor->next_object_func(cursor);
 }
 
@@ -206,6 +431,39 @@ bool sky_cursor_next_object(sky_cursor *cursor)
 // Event Iteration
 //--------------------------------------
 
+// Calculates the size of a msgpack element and its data. The common types
+// are resolved inline and everything else falls back to minipack.
+static inline size_t sky_cursor_sizeof_elem(void *ptr)
+{
+    uint8_t *p = (uint8_t*)ptr;
+    uint8_t type = *p;
+    if(type <= 0x7F || type >= 0xE0) return 1;
+    if((type & 0xE0) == 0xA0) return 1 + (type & 0x1F);
+
+    switch(type) {
+        case 0xC0: case 0xC2: case 0xC3: return 1;
+        case 0xCC: case 0xD0: return 2;
+        case 0xCD: case 0xD1: return 3;
+        case 0xCA: case 0xCE: case 0xD2: return 5;
+        case 0xCB: case 0xCF: case 0xD3: return 9;
+        case 0xDA: return 3 + (((size_t)p[1] << 8) | p[2]);
+        case 0xDB: return 5 + (((size_t)p[1] << 24) | ((size_t)p[2] << 16) | ((size_t)p[3] << 8) | p[4]);
+    }
+    return minipack_sizeof_elem_and_data(ptr);
+}
+
+// Moves the cursor past the end of the current object.
+static void sky_cursor_set_eof(sky_cursor *cursor)
+{
+    cursor->eof        = true;
+    cursor->in_session = false;
+    cursor->in_block   = false;
+    cursor->ptr        = NULL;
+    cursor->startptr   = NULL;
+    cursor->nextptr    = NULL;
+    cursor->endptr     = NULL;
+}
+
 void sky_cursor_set_ptr(sky_cursor *cursor, void *ptr, size_t sz)
 {
     // Set the start of the path and the length of the data.
@@ -215,27 +473,110 @@ void sky_cursor_set_ptr(sky_cursor *cursor, void *ptr, size_t sz)
     cursor->ptr        = NULL;
     cursor->in_session = true;
     cursor->last_timestamp      = 0;
-    cursor->session_idle_in_sec = 0;
     cursor->session_event_index = -1;
+    cursor->pending_ptr = NULL;
+    cursor->in_block   = false;
+    cursor->family_count = 0;
     cursor->eof        = !(ptr != NULL && cursor->startptr < cursor->endptr);
+    sky_cursor_clear_rewind(cursor);
+    if(ptr != NULL) {
+        cursor->object_count++;
+        cursor->byte_count += sz;
+    }
     
     // Clear the data object if set.
     memset(cursor->data, 0, cursor->data_sz);
     
-    // The first item is the current state so skip it.
+    // The first item is the current state so skip it. It can be followed by
+    // an index of the events, which is also skipped.
     if(cursor->startptr != NULL && minipack_is_raw(cursor->startptr)) {
         cursor->startptr += minipack_sizeof_elem_and_data(cursor->startptr);
+        if(cursor->startptr < cursor->endptr && minipack_is_raw(cursor->startptr)) {
+            cursor->startptr += minipack_sizeof_elem_and_data(cursor->startptr);
+        }
         cursor->nextptr = cursor->startptr;
     }
 }
 
+// Moves the cursor to the next event in the session. Events outside of the
+// time range or that don't match the filter are skipped. Skipped events
+// still count toward session boundaries. Events after a restored mark are
+// replayed until the cursor is back on the last decoded event, and events
+// decoded while a mark is outstanding are kept for rewinding.
 void sky_cursor_next_event(sky_cursor *cursor)
+{
+    if(cursor->replaying) {
+        if(cursor->rewind_pos + 1 < cursor->rewind_count) {
+            sky_cursor_replay_event(cursor, cursor->rewind_pos + 1);
+            return;
+        }
+        cursor->replaying  = false;
+        cursor->in_session = cursor->live_in_session;
+        cursor->eof        = cursor->live_eof;
+    }
+
+    while(true) {
+        sky_cursor_read_event(cursor);
+        if(cursor->eof || !cursor->in_session) {
+            return;
+        }
+
+        // Events are in time order so the object ends at the first event
+        // past the time range.
+        if(cursor->has_time_range) {
+            int64_t ts = *((int64_t*)(cursor->data + cursor->timestamp_descriptor.ts_offset));
+            if(ts >= cursor->max_ts) {
+                sky_cursor_set_eof(cursor);
+                return;
+            }
+            if(ts < cursor->min_ts) {
+                cursor->session_event_index--;
+                continue;
+            }
+        }
+
+        if(cursor->filter != NULL && (cursor->event_skipped || !sky_cursor_filter_matches(cursor))) {
+            cursor->session_event_index--;
+            continue;
+        }
+        if(cursor->mark_depth > 0 && !cursor->rewind_overflow) {
+            sky_cursor_push_rewind(cursor);
+        }
+        return;
+    }
+}
+
+// Writes an event's timestamps into the cursor's data. The timestamp of the
+// previous event is carried over first when the cursor tracks it.
+static void sky_cursor_set_event_timestamp(sky_cursor *cursor, int64_t ts, uint32_t timestamp)
+{
+    uint32_t *data_timestamp = (uint32_t*)(cursor->data + cursor->timestamp_descriptor.timestamp_offset);
+    if(cursor->timestamp_descriptor.has_prev_timestamp) {
+        *((uint32_t*)(cursor->data + cursor->timestamp_descriptor.prev_timestamp_offset)) = *data_timestamp;
+    }
+    *((int64_t*)(cursor->data + cursor->timestamp_descriptor.ts_offset)) = ts;
+    *data_timestamp = timestamp;
+}
+
+// Decodes the next event into the cursor's data.
+static void sky_cursor_read_event(sky_cursor *cursor)
 {
     // Ignore any calls when the cursor is out of session or EOF.
     if(cursor->eof || !cursor->in_session) {
         return;
     }
 
+    // Keep reading from the current event block until it runs out and then
+    // continue with whatever follows it.
+    if(cursor->in_block) {
+        if(cursor->block_event_index < cursor->block_event_count) {
+            sky_cursor_next_block_event(cursor);
+            return;
+        }
+        cursor->in_block = false;
+        cursor->nextptr  = cursor->block_endptr;
+    }
+
     // Move the pointer to the next position.
     void *prevptr = cursor->ptr;
     cursor->ptr = cursor->nextptr;
@@ -243,35 +584,69 @@ void sky_cursor_next_event(sky_cursor *cursor)
 
     // If pointer is beyond the last event then set eof.
     if(cursor->ptr >= cursor->endptr) {
-        cursor->eof        = true;
-        cursor->in_session = false;
-        cursor->ptr        = NULL;
-        cursor->startptr   = NULL;
-        cursor->nextptr    = NULL;
-        cursor->endptr     = NULL;
+        sky_cursor_set_eof(cursor);
     }
     // Otherwise update the event object with data.
     else {
         sky_event_flag_t flag = *((sky_event_flag_t*)ptr);
+
+        // Event blocks are decoded column-wise instead of through msgpack.
+        if(flag == SKY_EVENT_BLOCK_FLAG) {
+            sky_cursor_open_block(cursor, ptr);
+            if(!cursor->eof) {
+                sky_cursor_read_event(cursor);
+            }
+            return;
+        }
+
+        // A checkpoint's values are only read when the object starts at it
+        // since they're already set once the events before it are read.
+        if(flag == SKY_EVENT_CHECKPOINT_FLAG) {
+            size_t sz;
+            ptr += sizeof(sky_event_flag_t);
+            if(ptr >= cursor->endptr || *((sky_event_flag_t*)ptr) != EVENT_FLAG) badcursordata("checkpoint", cursor->ptr);
+            ptr += sizeof(sky_event_flag_t);
+            minipack_unpack_int(ptr, &sz);
+            if(sz == 0) badcursordata("checkpoint timestamp", cursor->ptr);
+            ptr = sky_cursor_read_data_map(cursor, ptr + sz, cursor->endptr, prevptr == NULL);
+            if(ptr == NULL) badcursordata("checkpoint datamap", cursor->ptr);
+            cursor->nextptr = ptr;
+            sky_cursor_read_event(cursor);
+            return;
+        }
         
         // If flag isn't correct then report and exit.
         if(flag != EVENT_FLAG) badcursordata("eflag", ptr);
         ptr += sizeof(sky_event_flag_t);
         
-        // Read timestamp.
+        // Read timestamp. The first event of a session has already been
+        // read once when the previous session ended so its timestamp is
+        // reused instead of being decoded again.
         size_t sz;
-        int64_t ts = minipack_unpack_int(ptr, &sz);
-        if(sz == 0) badcursordata("timestamp", ptr);
+        int64_t ts;
+        if(cursor->pending_ptr == cursor->ptr) {
+            ts  = cursor->pending_ts;
+            ptr = cursor->pending_dataptr;
+            cursor->pending_ptr = NULL;
+        }
+        else {
+            ts = minipack_unpack_int(ptr, &sz);
+            if(sz == 0) badcursordata("timestamp", ptr);
+            ptr += sz;
+        }
         uint32_t timestamp = sky_timestamp_to_seconds(ts);
-        ptr += sz;
 
         // Check for session boundry. This only applies if this is not the
         // first event in the session and a session idle time has been set.
         if(cursor->last_timestamp > 0 && cursor->session_idle_in_sec > 0) {
             // If the elapsed time is greater than the idle time then rewind
             // back to the event we started on at the beginning of the function
-            // and mark the cursor as being "out of session".
+            // and mark the cursor as being "out of session". The decoded
+            // timestamp is kept for when the next session starts.
             if(timestamp - cursor->last_timestamp >= cursor->session_idle_in_sec) {
+                cursor->pending_ptr = cursor->ptr;
+                cursor->pending_dataptr = ptr;
+                cursor->pending_ts = ts;
                 cursor->ptr = prevptr;
                 cursor->in_session = false;
             }
@@ -281,48 +656,98 @@ void sky_cursor_next_event(sky_cursor *cursor)
         // Only process the event if we're still in session.
         if(cursor->in_session) {
             cursor->session_event_index++;
+            cursor->event_count++;
+            cursor->event_skipped = false;
             
             // Set timestamp.
-            int64_t *data_ts = (int64_t*)(cursor->data + cursor->timestamp_descriptor.ts_offset);
-            uint32_t *data_timestamp = (uint32_t*)(cursor->data + cursor->timestamp_descriptor.timestamp_offset);
-            *data_ts = ts;
-            *data_timestamp = timestamp;
+            sky_cursor_set_event_timestamp(cursor, ts, timestamp);
             
             // Clear old action data.
             if(cursor->action_data_sz > 0) {
               memset(cursor->data, 0, cursor->action_data_sz);
             }
 
-            // Read msgpack map!
-            uint32_t count = minipack_unpack_map(ptr, &sz);
-            if(sz == 0) {
-              minipack_unpack_nil(ptr, &sz);
-              if(sz == 0) {
-                badcursordata("datamap", ptr);
-              }
+            // Read msgpack map and then the values the object's property
+            // families hold for the event.
+            ptr = sky_cursor_read_data_map(cursor, ptr, cursor->endptr, true);
+            if(ptr == NULL) badcursordata("datamap", cursor->ptr);
+            cursor->nextptr = ptr;
+            if(cursor->family_count > 0) {
+                sky_cursor_read_families(cursor, ts);
             }
-            ptr += sz;
+        }
+    }
+}
 
-            // Loop over key/value pairs.
-            uint32_t i;
-            for(i=0; i<count; i++) {
-                // Read property id (key).
-                int64_t property_id = minipack_unpack_int(ptr, &sz);
-                if(sz == 0) badcursordata("key", ptr);
-                ptr += sz;
-
-                // Read property value and set it on the data object.
-                sky_cursor_set_value(cursor, cursor->data, property_id, ptr, &sz);
-                if(sz == 0) {
-                  debug("[invalid read, skipping]");
-                  sz = minipack_sizeof_elem_and_data(ptr);
-                }
-                ptr += sz;
+// Decodes a msgpack map of property ids to values into the cursor's data.
+// The values are only skipped over when the map isn't decoded.
+//
+// Returns a pointer past the map or NULL if the map is malformed.
+static void *sky_cursor_read_data_map(sky_cursor *cursor, void *ptr, void *endptr, bool decode)
+{
+    size_t sz;
+    uint32_t count = minipack_unpack_map(ptr, &sz);
+    if(sz == 0) {
+        minipack_unpack_nil(ptr, &sz);
+        if(sz == 0) return NULL;
+    }
+    ptr += sz;
+
+    // Maps where every key and value is a fixnum are common since factors
+    // and small integers pack into a single byte. When the whole map is one
+    // run of fixnums, each pair is two bytes and integers are read straight
+    // from their tags.
+    uint32_t i;
+    size_t pairs_sz = (size_t)count * 2;
+    if(count > 0 && ptr + pairs_sz <= endptr && minipack_fixnum_run(ptr, pairs_sz) == pairs_sz) {
+        if(!decode) return ptr + pairs_sz;
+        for(i=0; i<count; i++, ptr += 2) {
+            int64_t property_id = (int64_t)(int8_t)((uint8_t*)ptr)[0];
+            sky_property_descriptor *descriptor = sky_cursor_get_property_descriptor(cursor, property_id);
+            if(descriptor == NULL || descriptor->data_type == SKY_DATA_TYPE_NONE) {
+                continue;
             }
 
-            cursor->nextptr = ptr;
+            void *target = cursor->data + descriptor->offset;
+            switch(descriptor->data_type) {
+                case SKY_DATA_TYPE_INT: sky_write_int(target, descriptor->sz, (int8_t)((uint8_t*)ptr)[1]); break;
+                case SKY_DATA_TYPE_STRING: sky_set_string(target, ptr + 1, &sz); break;
+                case SKY_DATA_TYPE_DOUBLE: sky_write_double(target, descriptor->sz, minipack_unpack_double(ptr + 1, &sz)); break;
+                default: sky_set_boolean(target, ptr + 1, &sz); break;
+            }
         }
+        return ptr;
     }
+
+    // Loop over key/value pairs.
+    for(i=0; i<count; i++) {
+        // Read property id (key).
+        int64_t property_id = minipack_unpack_int(ptr, &sz);
+        if(sz == 0) return NULL;
+        ptr += sz;
+
+        // Skip values for unreferenced properties by their tag length and
+        // decode referenced values directly by type.
+        sky_property_descriptor *descriptor = (decode ? sky_cursor_get_property_descriptor(cursor, property_id) : NULL);
+        if(descriptor == NULL || descriptor->data_type == SKY_DATA_TYPE_NONE) {
+            sz = sky_cursor_sizeof_elem(ptr);
+        }
+        else {
+            void *target = cursor->data + descriptor->offset;
+            switch(descriptor->data_type) {
+                case SKY_DATA_TYPE_STRING: sky_set_string(target, ptr, &sz); break;
+                case SKY_DATA_TYPE_INT: sky_write_int(target, descriptor->sz, minipack_unpack_int(ptr, &sz)); break;
+                case SKY_DATA_TYPE_DOUBLE: sky_write_double(target, descriptor->sz, minipack_unpack_double(ptr, &sz)); break;
+                default: sky_set_boolean(target, ptr, &sz); break;
+            }
+            if(sz == 0) {
+              debug("[invalid read, skipping]");
+              sz = sky_cursor_sizeof_elem(ptr);
+            }
+        }
+        ptr += sz;
+    }
+    return ptr;
 }
 
 bool sky_lua_cursor_next_event(sky_cursor *cursor)
@@ -341,6 +766,8 @@ bool sky_cursor_eos(sky_cursor *cursor)
     return !cursor->in_session;
 }
 
+// Sets the idle time that splits an object's events into sessions. The idle
+// time is kept for every object that the cursor moves to.
 void sky_cursor_set_session_idle(sky_cursor *cursor, uint32_t seconds)
 {
     // Save the idle value.
@@ -366,56 +793,1487 @@ bool sky_lua_cursor_next_session(sky_cursor *cursor)
 }
 
 
+//--------------------------------------
+// Rewinding
+//--------------------------------------
+
+// Marks the event that the cursor is on so that it can be moved back to it
+// with sky_cursor_restore(), which lets a condition look ahead of an event
+// and then let the steps after it carry on from that event. The events read
+// after the first outstanding mark are kept in their decoded form so they
+// aren't decoded again when the cursor moves back over them. Marks nest and
+// each one should be restored once.
+//
+// cursor - The cursor.
+//
+// Returns the mark or -1 if the cursor isn't on an event or the events
+// after the first outstanding mark no longer fit.
+int32_t sky_cursor_mark(sky_cursor *cursor)
+{
+    if(cursor->eof || !cursor->in_session || cursor->session_event_index < 0) {
+        return -1;
+    }
+
+    // The kept events start over at the first mark unless the cursor is
+    // still replaying them.
+    if(cursor->mark_depth == 0 && !cursor->replaying) {
+        cursor->rewind_count = 0;
+        cursor->rewind_overflow = false;
+        if(sky_cursor_push_rewind(cursor) != 0) return -1;
+    }
+    if(cursor->rewind_overflow) return -1;
+    cursor->mark_depth++;
+    return (int32_t)cursor->rewind_pos;
+}
+
+// Moves the cursor back onto the event it was on when a mark was made and
+// releases the mark. The events after it are replayed from their decoded
+// form as the cursor moves forward again.
+//
+// cursor - The cursor.
+// mark   - The mark returned by sky_cursor_mark().
+//
+// Returns true if the cursor was moved back or false if more events were
+// read after the mark than could be kept, in which case the cursor stays
+// where it is.
+bool sky_cursor_restore(sky_cursor *cursor, int32_t mark)
+{
+    if(cursor->mark_depth > 0) cursor->mark_depth--;
+    if(mark < 0 || cursor->rewind_overflow || (uint32_t)mark >= cursor->rewind_count) {
+        return false;
+    }
+
+    // Keep where decoding stopped for when the replay catches up with it.
+    if(!cursor->replaying) {
+        cursor->live_in_session = cursor->in_session;
+        cursor->live_eof = cursor->eof;
+        cursor->replaying = true;
+    }
+    sky_cursor_replay_event(cursor, (uint32_t)mark);
+    return true;
+}
+
+// Drops any marks and the events kept for them.
+static void sky_cursor_clear_rewind(sky_cursor *cursor)
+{
+    cursor->rewind_count = 0;
+    cursor->rewind_pos = 0;
+    cursor->mark_depth = 0;
+    cursor->rewind_overflow = false;
+    cursor->replaying = false;
+}
+
+// Keeps a copy of the event that the cursor is on, growing the kept events
+// up to SKY_CURSOR_REWIND_MAX. Past it the outstanding marks are lost.
+//
+// Returns 0 if successful, otherwise returns -1.
+static int sky_cursor_push_rewind(sky_cursor *cursor)
+{
+    if(cursor->rewind_count == cursor->rewind_capacity) {
+        uint32_t capacity = (cursor->rewind_capacity > 0 ? cursor->rewind_capacity * 2 : 16);
+        if(capacity > SKY_CURSOR_REWIND_MAX) {
+            cursor->rewind_overflow = true;
+            return -1;
+        }
+        uint8_t *rewind = realloc(cursor->rewind, (size_t)capacity * cursor->data_sz);
+        if(rewind == NULL) {
+            cursor->rewind_overflow = true;
+            return -1;
+        }
+        cursor->rewind = rewind;
+        int32_t *indexes = realloc(cursor->rewind_session_indexes, (size_t)capacity * sizeof(*indexes));
+        if(indexes == NULL) {
+            cursor->rewind_overflow = true;
+            return -1;
+        }
+        cursor->rewind_session_indexes = indexes;
+        cursor->rewind_capacity = capacity;
+    }
+
+    memcpy(cursor->rewind + (size_t)cursor->rewind_count * cursor->data_sz, cursor->data, cursor->data_sz);
+    cursor->rewind_session_indexes[cursor->rewind_count] = cursor->session_event_index;
+    cursor->rewind_pos = cursor->rewind_count++;
+    return 0;
+}
+
+// Puts a kept event back into the cursor's data.
+static void sky_cursor_replay_event(sky_cursor *cursor, uint32_t index)
+{
+    memcpy(cursor->data, cursor->rewind + (size_t)index * cursor->data_sz, cursor->data_sz);
+    cursor->session_event_index = cursor->rewind_session_indexes[index];
+    cursor->rewind_pos = index;
+    cursor->in_session = true;
+    cursor->eof = false;
+}
+
+// Limits the events returned by the cursor to the shifted timestamps in
+// [min_ts, max_ts).
+void sky_cursor_set_time_range(sky_cursor *cursor, int64_t min_ts, int64_t max_ts)
+{
+    cursor->has_time_range = true;
+    cursor->min_ts = min_ts;
+    cursor->max_ts = max_ts;
+}
+
+// Removes the time range from the cursor.
+void sky_cursor_clear_time_range(sky_cursor *cursor)
+{
+    cursor->has_time_range = false;
+    cursor->min_ts = 0;
+    cursor->max_ts = 0;
+}
+
+
 
 //--------------------------------------
-// Setters
+// Batch Iteration
 //--------------------------------------
 
-void sky_set_noop(void *target, void *value, size_t *sz)
+// Frees the batch and all of its columns.
+static void sky_cursor_free_batch(sky_cursor *cursor)
 {
-    ((void)(target));
-    *sz = minipack_sizeof_elem_and_data(value);
+    uint32_t i;
+    for(i=0; i<cursor->batch_column_count; i++) {
+        free(cursor->batch_columns[i].values);
+    }
+    if(cursor->batch_columns != NULL) free(cursor->batch_columns);
+    cursor->batch_columns = NULL;
+    cursor->batch_column_count = 0;
+
+    if(cursor->batch != NULL) {
+        free(cursor->batch->ts);
+        free(cursor->batch->timestamp);
+        free(cursor->batch->session_start);
+        free(cursor->batch->prev_timestamp);
+        free(cursor->batch);
+        cursor->batch = NULL;
+    }
 }
 
-void sky_set_string(void *target, void *value, size_t *sz)
+// Allocates a batch that can hold up to a given number of events. The size
+// is the size of the caller's batch struct which must begin with the fields
+// of sky_cursor_batch. Any previous batch and its columns are freed.
+//
+// Returns a pointer to the batch.
+void *sky_cursor_set_batch(sky_cursor *cursor, uint32_t sz, uint32_t capacity)
 {
-    size_t _sz;
-    sky_string *string = (sky_string*)target;
-    string->length = minipack_unpack_raw(value, &_sz);
-    string->data = (_sz > 0 ? value + _sz : NULL);
-    *sz = _sz + string->length;
+    sky_cursor_free_batch(cursor);
+    if(sz < sizeof(sky_cursor_batch)) sz = sizeof(sky_cursor_batch);
+
+    cursor->batch = calloc(1, sz);
+    cursor->batch->capacity = capacity;
+    cursor->batch->ts = calloc(capacity, sizeof(int64_t));
+    cursor->batch->timestamp = calloc(capacity, sizeof(uint32_t));
+    cursor->batch->session_start = calloc(capacity, sizeof(bool));
+    cursor->batch->prev_timestamp = calloc(capacity, sizeof(uint32_t));
+    return cursor->batch;
 }
 
-void sky_set_int(void *target, void *value, size_t *sz)
+// Adds a column to the batch for a property. The property must already be
+// set on the cursor. A pointer to the column's values is written into the
+// batch at the given offset.
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_cursor_set_batch_column(sky_cursor *cursor, int64_t property_id, uint32_t offset)
 {
-    *((int32_t*)target) = (int32_t)minipack_unpack_int(value, sz);
+    sky_property_descriptor *descriptor = sky_cursor_get_property_descriptor(cursor, property_id);
+    if(cursor->batch == NULL || descriptor == NULL || descriptor->data_type == SKY_DATA_TYPE_NONE) {
+        return -1;
+    }
+
+    cursor->batch_columns = realloc(cursor->batch_columns, (cursor->batch_column_count + 1) * sizeof(sky_cursor_batch_column));
+    sky_cursor_batch_column *column = &cursor->batch_columns[cursor->batch_column_count++];
+    column->offset = descriptor->offset;
+    column->sz = descriptor->sz;
+    column->values = calloc(cursor->batch->capacity, column->sz);
+    *((void**)(((uint8_t*)cursor->batch) + offset)) = column->values;
+    return 0;
 }
 
-void sky_set_double(void *target, void *value, size_t *sz)
+// Finds the values of the batch column for a property along with its data
+// type and the number of bytes in each value.
+//
+// Returns a pointer to the values or NULL if the property has no column.
+void *sky_cursor_batch_column_values(sky_cursor *cursor, int64_t property_id, uint8_t *data_type, uint8_t *sz)
 {
-    *((double*)target) = minipack_unpack_double(value, sz);
+    sky_property_descriptor *descriptor = sky_cursor_get_property_descriptor(cursor, property_id);
+    if(descriptor == NULL || descriptor->data_type == SKY_DATA_TYPE_NONE) {
+        return NULL;
+    }
+
+    uint32_t i;
+    for(i=0; i<cursor->batch_column_count; i++) {
+        if(cursor->batch_columns[i].offset == descriptor->offset) {
+            if(data_type != NULL) *data_type = descriptor->data_type;
+            if(sz != NULL) *sz = descriptor->sz;
+            return cursor->batch_columns[i].values;
+        }
+    }
+    return NULL;
 }
 
-void sky_set_boolean(void *target, void *value, size_t *sz)
+// Decodes up to the batch capacity of events from the current object into
+// the batch columns. Session boundaries don't stop the batch. Instead, the
+// first event of each session is flagged in the batch.
+//
+// Returns the number of events in the batch.
+uint32_t sky_cursor_next_batch(sky_cursor *cursor)
 {
-    *((bool*)target) = minipack_unpack_bool(value, sz);
+    sky_cursor_batch *batch = cursor->batch;
+    if(batch == NULL) return 0;
+
+    uint32_t count = 0;
+    while(count < batch->capacity && !cursor->eof) {
+        if(!sky_lua_cursor_next_event(cursor)) {
+            sky_cursor_next_session(cursor);
+            continue;
+        }
+
+        // Copy the event into the batch.
+        batch->ts[count] = *((int64_t*)(cursor->data + cursor->timestamp_descriptor.ts_offset));
+        batch->timestamp[count] = *((uint32_t*)(cursor->data + cursor->timestamp_descriptor.timestamp_offset));
+        batch->session_start[count] = (cursor->session_event_index == 0);
+        batch->prev_timestamp[count] = (cursor->timestamp_descriptor.has_prev_timestamp ? *((uint32_t*)(cursor->data + cursor->timestamp_descriptor.prev_timestamp_offset)) : 0);
+
+        uint32_t i;
+        for(i=0; i<cursor->batch_column_count; i++) {
+            sky_cursor_batch_column *column = &cursor->batch_columns[i];
+            memcpy(column->values + ((size_t)count * column->sz), cursor->data + column->offset, column->sz);
+        }
+        count++;
+    }
+
+    batch->count = count;
+    return count;
 }
 
 
 //--------------------------------------
-// Clear Functions
+// Families
 //--------------------------------------
 
-void sky_clear_string(void *target)
+// Adds an event stream holding the values of a property family to the
+// object the cursor is on. Streams are cleared when the cursor moves to the
+// next object so scans add them after sky_cursor_set_ptr().
+//
+// cursor - The cursor.
+// ptr    - The family's event stream.
+// sz     - The size of the stream.
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_cursor_add_family(sky_cursor *cursor, void *ptr, size_t sz)
 {
-    sky_string *string = (sky_string*)target;
-    string->length = 0;
-    string->data = NULL;
+    if(cursor->family_count == cursor->family_capacity) {
+        uint32_t capacity = (cursor->family_capacity > 0 ? cursor->family_capacity * 2 : 4);
+        sky_cursor_family *families = realloc(cursor->families, capacity * sizeof(*families));
+        if(families == NULL) return -1;
+        cursor->families = families;
+        cursor->family_capacity = capacity;
+    }
+    sky_cursor_family *family = &cursor->families[cursor->family_count++];
+    family->ptr = ptr;
+    family->endptr = ptr + sz;
+    cursor->byte_count += sz;
+    return 0;
 }
 
-void sky_clear_int(void *target)
+// Decodes the values that the object's family streams hold for the event
+// at a timestamp. Each stream is in time order and only has events where
+// the object does, so the events before the timestamp belong to events the
+// cursor has already passed and are skipped.
+static void sky_cursor_read_families(sky_cursor *cursor, int64_t ts)
 {
-    *((int32_t*)target) = 0;
+    uint32_t i;
+    for(i=0; i<cursor->family_count; i++) {
+        sky_cursor_family *family = &cursor->families[i];
+        while(family->ptr < family->endptr) {
+            void *ptr = family->ptr;
+            if(*((sky_event_flag_t*)ptr) != EVENT_FLAG) badcursordata("family eflag", ptr);
+
+            size_t sz;
+            int64_t family_ts = minipack_unpack_int(ptr + sizeof(sky_event_flag_t), &sz);
+            if(sz == 0) badcursordata("family timestamp", ptr);
+            if(family_ts > ts) break;
+
+            ptr = sky_cursor_read_data_map(cursor, ptr + sizeof(sky_event_flag_t) + sz, family->endptr, family_ts == ts);
+            if(ptr == NULL) badcursordata("family datamap", family->ptr);
+            family->ptr = ptr;
+        }
+    }
+}
+
+
+//--------------------------------------
+// Filtering
+//--------------------------------------
+
+// Reads a little endian value from unaligned filter code.
+static inline int64_t sky_filter_read_int64(uint8_t *ptr)
+{
+    uint64_t value = 0;
+    int i;
+    for(i=7; i>=0; i--) value = (value << 8) | ptr[i];
+    return (int64_t)value;
+}
+
+static inline uint32_t sky_filter_read_uint32(uint8_t *ptr)
+{
+    return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) |
+           ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+// Returns the size of the filter instruction at the given position or zero
+// if it runs past the end of the code.
+static uint32_t sky_filter_sizeof_op(uint8_t *code, uint32_t index, uint32_t sz)
+{
+    switch(code[index]) {
+        case SKY_FILTER_OP_TRUE:
+        case SKY_FILTER_OP_FALSE:
+        case SKY_FILTER_OP_AND:
+        case SKY_FILTER_OP_OR:
+            return 1;
+        case SKY_FILTER_OP_CMP: {
+            if(sz - index < 11) return 0;
+            uint32_t op_sz = 11;
+            switch(code[index+2]) {
+                case SKY_FILTER_VALUE_NUMBER: op_sz += 8; break;
+                case SKY_FILTER_VALUE_BOOLEAN: op_sz += 1; break;
+                case SKY_FILTER_VALUE_STRING:
+                    if(sz - index < op_sz + 4) return 0;
+                    op_sz += 4 + sky_filter_read_uint32(code + index + op_sz);
+                    break;
+                default: return 0;
+            }
+            if(code[index+1] < SKY_FILTER_CMP_EQ || code[index+1] > SKY_FILTER_CMP_GE) return 0;
+            return (op_sz <= sz - index ? op_sz : 0);
+        }
+    }
+    return 0;
+}
+
+// Sets the filter that events must match to be returned by the cursor. The
+// code is copied and validated so that it can be evaluated without bounds
+// checks. Passing a NULL or empty filter removes the current filter.
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_cursor_set_filter(sky_cursor *cursor, const void *code, uint32_t sz)
+{
+    if(cursor->filter != NULL) free(cursor->filter);
+    cursor->filter = NULL;
+    cursor->filter_sz = 0;
+    if(code == NULL || sz == 0) {
+        return 0;
+    }
+
+    // Make sure every instruction is well formed and that the program
+    // leaves exactly one result without overflowing the stack.
+    uint8_t *ptr = (uint8_t*)code;
+    uint32_t index = 0;
+    int32_t depth = 0;
+    while(index < sz) {
+        uint32_t op_sz = sky_filter_sizeof_op(ptr, index, sz);
+        if(op_sz == 0) return -1;
+        if(ptr[index] == SKY_FILTER_OP_AND || ptr[index] == SKY_FILTER_OP_OR) {
+            if(depth < 2) return -1;
+            depth--;
+        }
+        else if(++depth > SKY_FILTER_MAX_DEPTH) {
+            return -1;
+        }
+        index += op_sz;
+    }
+    if(depth != 1) return -1;
+
+    cursor->filter = malloc(sz);
+    memcpy(cursor->filter, code, sz);
+    cursor->filter_sz = sz;
+    return 0;
+}
+
+// Compares two values and returns whether they satisfy the comparison.
+static inline bool sky_filter_compare(uint8_t cmp, int c)
+{
+    switch(cmp) {
+        case SKY_FILTER_CMP_EQ: return c == 0;
+        case SKY_FILTER_CMP_NE: return c != 0;
+        case SKY_FILTER_CMP_LT: return c < 0;
+        case SKY_FILTER_CMP_LE: return c <= 0;
+        case SKY_FILTER_CMP_GT: return c > 0;
+        case SKY_FILTER_CMP_GE: return c >= 0;
+    }
+    return false;
+}
+
+// Evaluates a single comparison against the cursor's current event data.
+static bool sky_filter_eval_cmp(sky_cursor *cursor, uint8_t *op)
+{
+    uint8_t cmp = op[1];
+    uint8_t value_type = op[2];
+    sky_property_descriptor *descriptor = sky_cursor_get_property_descriptor(cursor, sky_filter_read_int64(op + 3));
+    if(descriptor == NULL || descriptor->data_type == SKY_DATA_TYPE_NONE) {
+        return false;
+    }
+    void *target = cursor->data + descriptor->offset;
+    uint8_t *value = op + 11;
+
+    switch(value_type) {
+        case SKY_FILTER_VALUE_NUMBER: {
+            double x;
+            int64_t bits = sky_filter_read_int64(value);
+            memcpy(&x, &bits, sizeof(x));
+            double v;
+            switch(descriptor->data_type) {
+                case SKY_DATA_TYPE_INT: v = (double)sky_read_int(target, descriptor->sz); break;
+                case SKY_DATA_TYPE_DOUBLE: v = sky_read_double(target, descriptor->sz); break;
+                default: return false;
+            }
+            return sky_filter_compare(cmp, (v < x ? -1 : (v > x ? 1 : 0)));
+        }
+        case SKY_FILTER_VALUE_BOOLEAN: {
+            if(descriptor->data_type != SKY_DATA_TYPE_BOOLEAN) return false;
+            bool v = *((bool*)target);
+            return sky_filter_compare(cmp, (int)v - (int)(value[0] != 0));
+        }
+        case SKY_FILTER_VALUE_STRING: {
+            if(descriptor->data_type != SKY_DATA_TYPE_STRING) return false;
+            sky_string *v = (sky_string*)target;
+            uint32_t length = sky_filter_read_uint32(value);
+            uint32_t v_length = (v->data != NULL && v->length > 0 ? (uint32_t)v->length : 0);
+            uint32_t n = (v_length < length ? v_length : length);
+            int c = (n > 0 ? memcmp(v->data, value + 4, n) : 0);
+            if(c == 0) c = (v_length < length ? -1 : (v_length > length ? 1 : 0));
+            return sky_filter_compare(cmp, c);
+        }
+    }
+    return false;
+}
+
+// Evaluates the cursor's filter against the current event.
+static bool sky_cursor_filter_matches(sky_cursor *cursor)
+{
+    bool stack[SKY_FILTER_MAX_DEPTH];
+    int32_t depth = 0;
+    uint32_t index = 0;
+    while(index < cursor->filter_sz) {
+        uint8_t *op = cursor->filter + index;
+        switch(*op) {
+            case SKY_FILTER_OP_TRUE: stack[depth++] = true; break;
+            case SKY_FILTER_OP_FALSE: stack[depth++] = false; break;
+            case SKY_FILTER_OP_AND: depth--; stack[depth-1] = stack[depth-1] && stack[depth]; break;
+            case SKY_FILTER_OP_OR: depth--; stack[depth-1] = stack[depth-1] || stack[depth]; break;
+            case SKY_FILTER_OP_CMP: stack[depth++] = sky_filter_eval_cmp(cursor, op); break;
+        }
+        index += sky_filter_sizeof_op(cursor->filter, index, cursor->filter_sz);
+    }
+    return stack[0];
+}
+
+
+//--------------------------------------
+// Stats
+//--------------------------------------
+
+// Resets the object, byte and event counters of the cursor.
+//
+// cursor - The cursor.
+void sky_cursor_clear_stats(sky_cursor *cursor)
+{
+    cursor->object_count = 0;
+    cursor->byte_count = 0;
+    cursor->event_count = 0;
+    cursor->object_start_event_count = 0;
+}
+
+
+//--------------------------------------
+// Cancellation
+//--------------------------------------
+
+// Stops the cursor's scan at the next object. This can be called from a
+// thread other than the one scanning.
+//
+// cursor - The cursor.
+void sky_cursor_cancel(sky_cursor *cursor)
+{
+    __atomic_store_n(&cursor->cancelled, true, __ATOMIC_RELAXED);
+}
+
+// Returns whether the cursor has been cancelled.
+//
+// cursor - The cursor.
+bool sky_cursor_is_cancelled(sky_cursor *cursor)
+{
+    return __atomic_load_n(&cursor->cancelled, __ATOMIC_RELAXED);
+}
+
+// Lets a cancelled cursor scan again.
+//
+// cursor - The cursor.
+void sky_cursor_clear_cancel(sky_cursor *cursor)
+{
+    __atomic_store_n(&cursor->cancelled, false, __ATOMIC_RELAXED);
+}
+
+
+//--------------------------------------
+// Sampling
+//--------------------------------------
+
+// Makes object scans pass on only a fraction of the objects. Objects are
+// picked by a hash of their key so the same objects are picked by every
+// query with the same ratio. A ratio of zero or one turns sampling off.
+//
+// cursor - The cursor.
+// ratio  - The fraction of objects to keep.
+void sky_cursor_set_sample(sky_cursor *cursor, double ratio)
+{
+    sky_cursor_set_sample_range(cursor, 0, (ratio > 0 ? ratio : 1));
+}
+
+// Makes object scans pass on only the objects whose key hash falls in a
+// slice of the hash space from start up to, but not including, end. Both
+// are fractions of the space. Slices that follow each other split the
+// objects between them, so a scan can read a sample and then grow it
+// without reading any object twice. A slice of [0, 1) turns sampling off.
+//
+// cursor - The cursor.
+// start  - The fraction where the slice starts.
+// end    - The fraction where the slice ends.
+void sky_cursor_set_sample_range(sky_cursor *cursor, double start, double end)
+{
+    cursor->has_sample = (start > 0 || end < 1);
+    cursor->sample_ceiling = (end < 1);
+    cursor->sample_floor = (start > 0 ? (uint64_t)(start * 18446744073709551616.0) : 0);
+    cursor->sample_threshold = (cursor->sample_ceiling && end > 0 ? (uint64_t)(end * 18446744073709551616.0) : 0);
+}
+
+// Returns whether the object stored under a key is in the cursor's sample.
+// The key is hashed with FNV-1a and then mixed so that its high bits are
+// evenly spread.
+//
+// cursor - The cursor.
+// key    - The object's key.
+// sz     - The size of the key.
+bool sky_cursor_sample_key(sky_cursor *cursor, const void *key, size_t sz)
+{
+    if(!cursor->has_sample) return true;
+
+    const uint8_t *p = (const uint8_t*)key;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+    for(i=0; i<sz; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash >= cursor->sample_floor && (!cursor->sample_ceiling || hash < cursor->sample_threshold);
+}
+
+
+//--------------------------------------
+// States
+//--------------------------------------
+
+// Makes object scans pass on the current state of each object instead of
+// its events. The state holds the latest value of every permanent property
+// and is read as a single event at the time of the object's last event.
+//
+// cursor     - The cursor.
+// state_only - Whether only states are read.
+void sky_cursor_set_state_only(sky_cursor *cursor, bool state_only)
+{
+    cursor->state_only = state_only;
+}
+
+
+//--------------------------------------
+// Object Bounds
+//--------------------------------------
+
+// Makes object scans pass on only the objects with at least a number of
+// events and whose first and last events are at least a span apart. Scans
+// judge objects by the event counts and timestamps of their indexes before
+// any of their events are read. Zero for both turns the bounds off.
+//
+// cursor     - The cursor.
+// min_events - The fewest events an object must have.
+// min_span   - The shortest shifted span of an object's events.
+void sky_cursor_set_object_bounds(sky_cursor *cursor, uint32_t min_events, int64_t min_span)
+{
+    cursor->has_object_bounds = (min_events > 0 || min_span > 0);
+    cursor->min_object_events = min_events;
+    cursor->min_object_span = (min_span > 0 ? min_span : 0);
+}
+
+// Returns whether an object with a number of events spanning a shifted
+// duration is within the cursor's object bounds.
+//
+// cursor      - The cursor.
+// event_count - The number of events of the object.
+// span        - The shifted time between its first and last events.
+bool sky_cursor_object_in_bounds(sky_cursor *cursor, uint64_t event_count, int64_t span)
+{
+    if(!cursor->has_object_bounds) return true;
+    return event_count >= cursor->min_object_events && span >= cursor->min_object_span;
+}
+
+
+//--------------------------------------
+// Members
+//--------------------------------------
+
+// Restricts object scans to a set of objects, such as the members of a
+// cohort. The keys and their offsets are copied. Offsets must be in key
+// order and each key runs up to the next one.
+//
+// cursor  - The cursor.
+// keys    - The sorted member keys stored back to back.
+// sz      - The total size of the keys.
+// offsets - The offset of each member into the keys.
+// count   - The number of members.
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_cursor_set_members(sky_cursor *cursor, const void *keys, size_t sz,
+                           const uint32_t *offsets, uint32_t count)
+{
+    sky_cursor_clear_members(cursor);
+    cursor->member_keys = malloc(sz > 0 ? sz : 1);
+    cursor->members = malloc(count > 0 ? count * sizeof(uint32_t) : 1);
+    if(cursor->member_keys == NULL || cursor->members == NULL) {
+        sky_cursor_clear_members(cursor);
+        return -1;
+    }
+    if(sz > 0) memcpy(cursor->member_keys, keys, sz);
+    if(count > 0) memcpy(cursor->members, offsets, count * sizeof(uint32_t));
+    cursor->member_keys_sz = sz;
+    cursor->member_count = count;
+    cursor->has_members = true;
+    return 0;
+}
+
+// Lets object scans pass on every object again.
+//
+// cursor - The cursor.
+void sky_cursor_clear_members(sky_cursor *cursor)
+{
+    free(cursor->member_keys);
+    free(cursor->members);
+    cursor->member_keys = NULL;
+    cursor->members = NULL;
+    cursor->member_keys_sz = 0;
+    cursor->member_count = 0;
+    cursor->has_members = false;
+}
+
+// Returns whether the object stored under a key is one of the cursor's
+// members. Every object is a member when the cursor has none.
+//
+// cursor - The cursor.
+// key    - The object's key.
+// sz     - The size of the key.
+bool sky_cursor_member_key(sky_cursor *cursor, const void *key, size_t sz)
+{
+    if(!cursor->has_members) return true;
+
+    uint32_t lo = 0, hi = cursor->member_count;
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        size_t start = cursor->members[mid];
+        size_t end = (mid + 1 < cursor->member_count ? cursor->members[mid + 1] : cursor->member_keys_sz);
+        size_t member_sz = end - start;
+        int rc = memcmp(cursor->member_keys + start, key, (member_sz < sz ? member_sz : sz));
+        if(rc == 0) {
+            if(member_sz == sz) return true;
+            rc = (member_sz < sz ? -1 : 1);
+        }
+        if(rc < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+
+//--------------------------------------
+// Marks
+//--------------------------------------
+
+// Sets the key of the object that the cursor is being pointed at. Scans
+// call this for each object before passing it on. The key is not copied
+// and is only used until the next object.
+//
+// cursor - The cursor.
+// key    - The object's key or NULL if it isn't known.
+// sz     - The size of the key.
+void sky_cursor_set_object_key(sky_cursor *cursor, const void *key, size_t sz)
+{
+    cursor->object_key = key;
+    cursor->object_key_sz = sz;
+    cursor->object_marked = false;
+}
+
+// Adds the key of the current object to the cursor's marks, such as when
+// the object is found to belong to a cohort. Objects are marked at most
+// once and objects without a known key are ignored.
+//
+// cursor - The cursor.
+void sky_cursor_mark_object(sky_cursor *cursor)
+{
+    if(cursor->object_marked || cursor->object_key == NULL) return;
+
+    size_t sz = cursor->marks_sz + 4 + cursor->object_key_sz;
+    if(sz > cursor->marks_capacity) {
+        size_t capacity = (cursor->marks_capacity > 0 ? cursor->marks_capacity * 2 : 1024);
+        if(capacity < sz) capacity = sz;
+        uint8_t *marks = realloc(cursor->marks, capacity);
+        if(marks == NULL) return;
+        cursor->marks = marks;
+        cursor->marks_capacity = capacity;
+    }
+
+    uint8_t *ptr = cursor->marks + cursor->marks_sz;
+    uint32_t key_sz = (uint32_t)cursor->object_key_sz;
+    ptr[0] = (uint8_t)key_sz;
+    ptr[1] = (uint8_t)(key_sz >> 8);
+    ptr[2] = (uint8_t)(key_sz >> 16);
+    ptr[3] = (uint8_t)(key_sz >> 24);
+    memcpy(ptr + 4, cursor->object_key, cursor->object_key_sz);
+    cursor->marks_sz = sz;
+    cursor->object_marked = true;
+}
+
+// Returns the keys of the marked objects, each after its little endian
+// uint32 size.
+//
+// cursor - The cursor.
+// sz     - Set to the size of the marks.
+const void *sky_cursor_marks(sky_cursor *cursor, size_t *sz)
+{
+    *sz = cursor->marks_sz;
+    return cursor->marks;
+}
+
+// Forgets the marked objects but keeps the memory for the next scan.
+//
+// cursor - The cursor.
+void sky_cursor_clear_marks(sky_cursor *cursor)
+{
+    cursor->marks_sz = 0;
+    cursor->object_marked = false;
+}
+
+
+//--------------------------------------
+// Heavy Objects
+//--------------------------------------
+
+// Starts tracking the objects with the most events decoded from them, up to
+// a number of objects, and forgets any tracked so far. A capacity of zero
+// stops tracking them.
+//
+// cursor   - The cursor.
+// capacity - The number of objects to keep.
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_cursor_set_heavy_capacity(sky_cursor *cursor, uint32_t capacity)
+{
+    uint32_t i;
+    for(i=0; i<cursor->heavy_capacity; i++) {
+        free(cursor->heavy[i].key);
+    }
+    free(cursor->heavy);
+    cursor->heavy = NULL;
+    cursor->heavy_capacity = 0;
+    cursor->heavy_count = 0;
+    if(capacity == 0) return 0;
+
+    cursor->heavy = calloc(capacity, sizeof(*cursor->heavy));
+    if(cursor->heavy == NULL) return -1;
+    cursor->heavy_capacity = capacity;
+    cursor->heavy_key = NULL;
+    return 0;
+}
+
+// Returns the number of heavy objects tracked.
+//
+// cursor - The cursor.
+uint32_t sky_cursor_heavy_count(sky_cursor *cursor)
+{
+    return cursor->heavy_count;
+}
+
+// Returns the key of a tracked heavy object, in no particular order, and
+// the number of events decoded from it.
+//
+// cursor      - The cursor.
+// index       - The index of the object, below sky_cursor_heavy_count().
+// sz          - Set to the size of the key.
+// event_count - Set to the object's events.
+const void *sky_cursor_heavy_object_key(sky_cursor *cursor, uint32_t index, size_t *sz,
+  uint64_t *event_count)
+{
+    sky_cursor_heavy_object *object = &cursor->heavy[index];
+    *sz = object->key_sz;
+    *event_count = object->event_count;
+    return object->key;
+}
+
+// Forgets the tracked objects but keeps their memory for the next scan.
+// The object the cursor is on isn't weighed since its scan may be replaced
+// before the cursor moves on.
+//
+// cursor - The cursor.
+void sky_cursor_clear_heavy(sky_cursor *cursor)
+{
+    cursor->heavy_count = 0;
+    cursor->heavy_key = NULL;
+}
+
+// Offers the object the cursor is leaving to the heavy objects. It replaces
+// the lightest one if they're full and it's heavier. The key of the object
+// is still valid since the scan hasn't moved on yet.
+static void sky_cursor_weigh_object(sky_cursor *cursor)
+{
+    if(cursor->heavy_key == NULL) return;
+    uint64_t event_count = cursor->event_count - cursor->object_start_event_count;
+    if(event_count == 0) return;
+
+    sky_cursor_heavy_object *heap = cursor->heavy;
+    uint32_t index;
+    bool added = false;
+    if(cursor->heavy_count < cursor->heavy_capacity) {
+        index = cursor->heavy_count++;
+        added = true;
+    } else if(event_count > heap[0].event_count) {
+        index = 0;
+    } else {
+        return;
+    }
+
+    sky_cursor_heavy_object object = heap[index];
+    if(cursor->heavy_key_sz > object.key_capacity) {
+        void *key = realloc(object.key, cursor->heavy_key_sz);
+        if(key == NULL) {
+            if(added) cursor->heavy_count--;
+            return;
+        }
+        object.key = key;
+        object.key_capacity = cursor->heavy_key_sz;
+    }
+    memcpy(object.key, cursor->heavy_key, cursor->heavy_key_sz);
+    object.key_sz = cursor->heavy_key_sz;
+    object.event_count = event_count;
+
+    // New objects sift up from the end and replacements sift down from the
+    // root.
+    if(index > 0) {
+        while(index > 0 && heap[(index - 1) / 2].event_count > object.event_count) {
+            heap[index] = heap[(index - 1) / 2];
+            index = (index - 1) / 2;
+        }
+    } else {
+        while(true) {
+            uint32_t child = index * 2 + 1;
+            if(child >= cursor->heavy_count) break;
+            if(child + 1 < cursor->heavy_count && heap[child + 1].event_count < heap[child].event_count) child++;
+            if(heap[child].event_count >= object.event_count) break;
+            heap[index] = heap[child];
+            index = child;
+        }
+    }
+    heap[index] = object;
+}
+
+
+//--------------------------------------
+// Event Blocks
+//--------------------------------------
+
+// Reads little endian integers from a block. These are unaligned so they
+// are copied out rather than dereferenced.
+static inline uint16_t sky_block_read_uint16(uint8_t *ptr)
+{
+    return (uint16_t)ptr[0] | ((uint16_t)ptr[1] << 8);
+}
+
+static inline uint32_t sky_block_read_uint32(uint8_t *ptr)
+{
+    return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) |
+           ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static inline int64_t sky_block_read_int64(uint8_t *ptr)
+{
+    uint64_t value = (uint64_t)sky_block_read_uint32(ptr) |
+                     ((uint64_t)sky_block_read_uint32(ptr + 4) << 32);
+    return (int64_t)value;
+}
+
+static inline double sky_block_read_double(uint8_t *ptr)
+{
+    double value;
+    int64_t bits = sky_block_read_int64(ptr);
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Reads a zigzag encoded varint from a block and returns the pointer after
+// it, or NULL if it runs past the end pointer.
+static inline uint8_t *sky_block_read_varint(uint8_t *ptr, uint8_t *endptr, int64_t *value)
+{
+    uint64_t bits = 0;
+    uint32_t shift;
+    for(shift=0; shift<64 && ptr < endptr; shift+=7) {
+        uint8_t byte = *(ptr++);
+        bits |= (uint64_t)(byte & 0x7F) << shift;
+        if((byte & 0x80) == 0) {
+            *value = (int64_t)(bits >> 1) ^ -(int64_t)(bits & 1);
+            return ptr;
+        }
+    }
+    return NULL;
+}
+
+// Checks whether a column of the given type can be written into a property
+// of the given data type.
+static bool sky_block_column_is_compatible(uint8_t type, uint8_t data_type)
+{
+    switch(type) {
+        case SKY_EVENT_BLOCK_TYPE_STRING:
+        case SKY_EVENT_BLOCK_TYPE_DICT:
+            return data_type == SKY_DATA_TYPE_STRING;
+        case SKY_EVENT_BLOCK_TYPE_INT:
+        case SKY_EVENT_BLOCK_TYPE_PACKED:
+        case SKY_EVENT_BLOCK_TYPE_DOUBLE:
+            return data_type == SKY_DATA_TYPE_INT || data_type == SKY_DATA_TYPE_DOUBLE;
+        case SKY_EVENT_BLOCK_TYPE_BOOLEAN:
+            return data_type == SKY_DATA_TYPE_BOOLEAN;
+    }
+    return false;
+}
+
+// Unpacks a group of bit packed values that are each a given number of bits
+// wide and adds them to a reference. The packed values are copied into a
+// padded buffer first so every value can be read with whole words and the
+// loops have no branches for the compiler to vectorize around.
+static void sky_block_unpack(uint8_t *ptr, uint8_t width, int64_t reference, int64_t *values)
+{
+    uint32_t i;
+    if(width == 0) {
+        for(i=0; i<SKY_EVENT_BLOCK_GROUP_SZ; i++) {
+            values[i] = reference;
+        }
+        return;
+    }
+
+    uint8_t buffer[(SKY_EVENT_BLOCK_GROUP_SZ * 8) + 16];
+    size_t sz = (size_t)width * (SKY_EVENT_BLOCK_GROUP_SZ / 8);
+    memcpy(buffer, ptr, sz);
+    memset(buffer + sz, 0, sizeof(buffer) - sz);
+
+    // Values of up to 56 bits fit in the word that starts at their first
+    // byte. Wider values take the rest of their bits from the next byte.
+    uint64_t mask = (width == 64 ? UINT64_MAX : (((uint64_t)1 << width) - 1));
+    if(width <= 56) {
+        for(i=0; i<SKY_EVENT_BLOCK_GROUP_SZ; i++) {
+            uint32_t bit = i * width;
+            uint64_t word = (uint64_t)sky_block_read_int64(buffer + (bit >> 3));
+            values[i] = (int64_t)((uint64_t)reference + ((word >> (bit & 7)) & mask));
+        }
+    }
+    else {
+        for(i=0; i<SKY_EVENT_BLOCK_GROUP_SZ; i++) {
+            uint32_t bit = i * width;
+            uint32_t shift = bit & 7;
+            uint64_t word = (uint64_t)sky_block_read_int64(buffer + (bit >> 3)) >> shift;
+            if(shift > 0) {
+                word |= (uint64_t)buffer[(bit >> 3) + 8] << (64 - shift);
+            }
+            values[i] = (int64_t)((uint64_t)reference + (word & mask));
+        }
+    }
+}
+
+// Finds a group of a packed column and reads its reference and width.
+//
+// Returns a pointer to the packed values or NULL if the group is invalid.
+static uint8_t *sky_block_packed_group(sky_cursor_block_column *column, uint32_t group, int64_t *reference, uint8_t *width)
+{
+    uint32_t start = sky_block_read_uint32(column->values + ((size_t)group * 4));
+    uint32_t end   = sky_block_read_uint32(column->values + ((size_t)(group + 1) * 4));
+    if(start > end || end > (size_t)(column->groups_endptr - column->groups) || end - start < SKY_EVENT_BLOCK_GROUP_HEADER_SZ) {
+        return NULL;
+    }
+    uint8_t *ptr = column->groups + start;
+    *reference = sky_block_read_int64(ptr);
+    *width = ptr[8];
+    if(*width > 64 || end - start < SKY_EVENT_BLOCK_GROUP_HEADER_SZ + ((uint32_t)*width * (SKY_EVENT_BLOCK_GROUP_SZ / 8))) {
+        return NULL;
+    }
+    return ptr + SKY_EVENT_BLOCK_GROUP_HEADER_SZ;
+}
+
+// Unpacks a group of a packed column into the column's buffer.
+static void sky_cursor_unpack_block_group(sky_cursor *cursor, sky_cursor_block_column *column, uint32_t group)
+{
+    int64_t reference;
+    uint8_t width;
+    uint8_t *ptr = sky_block_packed_group(column, group, &reference, &width);
+    if(ptr == NULL) badcursordata("block packed group", column->values);
+    sky_block_unpack(ptr, width, reference, column->packed);
+    column->packed_group = group;
+}
+
+// Compares the range of values in a group of a packed column against a
+// filter comparison. Every event in the group must have a value.
+//
+// Returns 0 if no value in the group can satisfy the comparison or 2 if
+// some might.
+static uint8_t sky_cursor_block_group_cmp(sky_cursor *cursor, uint8_t *op, uint32_t start, uint32_t end)
+{
+    if(op[2] != SKY_FILTER_VALUE_NUMBER) return 2;
+    sky_property_descriptor *descriptor = sky_cursor_get_property_descriptor(cursor, sky_filter_read_int64(op + 3));
+    if(descriptor == NULL || descriptor->sz != 8) return 2;
+    sky_cursor_block_column *column = NULL;
+    uint32_t i;
+    for(i=0; i<cursor->block_column_count; i++) {
+        if(cursor->block_columns[i].type == SKY_EVENT_BLOCK_TYPE_PACKED && cursor->block_columns[i].offset == descriptor->offset) {
+            column = &cursor->block_columns[i];
+            break;
+        }
+    }
+    if(column == NULL) return 2;
+    for(i=start; i<end; i++) {
+        if((column->bitmap[i >> 3] & (1 << (i & 7))) == 0) return 2;
+    }
+
+    int64_t reference;
+    uint8_t width;
+    if(sky_block_packed_group(column, start / SKY_EVENT_BLOCK_GROUP_SZ, &reference, &width) == NULL || width > 62) {
+        return 2;
+    }
+    int64_t max = (int64_t)((uint64_t)reference + (((uint64_t)1 << width) - 1));
+    if(max < reference) return 2;
+
+    double x;
+    int64_t bits = sky_filter_read_int64(op + 11);
+    memcpy(&x, &bits, sizeof(x));
+    double lo = (double)reference, hi = (double)max;
+    switch(op[1]) {
+        case SKY_FILTER_CMP_EQ: return (x < lo || x > hi ? 0 : 2);
+        case SKY_FILTER_CMP_NE: return (lo == hi && x == lo ? 0 : 2);
+        case SKY_FILTER_CMP_LT: return (lo >= x ? 0 : 2);
+        case SKY_FILTER_CMP_LE: return (lo > x ? 0 : 2);
+        case SKY_FILTER_CMP_GT: return (hi <= x ? 0 : 2);
+        case SKY_FILTER_CMP_GE: return (hi < x ? 0 : 2);
+    }
+    return 2;
+}
+
+// Evaluates the filter against the value ranges of the packed groups that
+// start at an event index. Comparisons that can't be decided from the
+// ranges are unknown, which is neither true nor false.
+//
+// Returns true if no event in the groups can match the filter.
+static bool sky_cursor_block_group_fails_filter(sky_cursor *cursor, uint32_t index)
+{
+    uint32_t end = index + SKY_EVENT_BLOCK_GROUP_SZ;
+    if(end > cursor->block_event_count) end = cursor->block_event_count;
+
+    // Results are 0 for false, 1 for true and 2 for unknown.
+    uint8_t stack[SKY_FILTER_MAX_DEPTH];
+    int32_t depth = 0;
+    uint32_t offset = 0;
+    while(offset < cursor->filter_sz) {
+        uint8_t *op = cursor->filter + offset;
+        switch(*op) {
+            case SKY_FILTER_OP_TRUE: stack[depth++] = 1; break;
+            case SKY_FILTER_OP_FALSE: stack[depth++] = 0; break;
+            case SKY_FILTER_OP_AND: {
+                depth--;
+                uint8_t a = stack[depth-1], b = stack[depth];
+                stack[depth-1] = (a == 0 || b == 0 ? 0 : (a == 1 && b == 1 ? 1 : 2));
+                break;
+            }
+            case SKY_FILTER_OP_OR: {
+                depth--;
+                uint8_t a = stack[depth-1], b = stack[depth];
+                stack[depth-1] = (a == 1 || b == 1 ? 1 : (a == 0 && b == 0 ? 0 : 2));
+                break;
+            }
+            case SKY_FILTER_OP_CMP: stack[depth++] = sky_cursor_block_group_cmp(cursor, op, index, end); break;
+            default: return false;
+        }
+        offset += sky_filter_sizeof_op(cursor->filter, offset, cursor->filter_sz);
+    }
+    return (depth > 0 && stack[0] == 0);
+}
+
+// Validates the block header at the given pointer and binds each column
+// that maps to a property the query references. Unreferenced columns are
+// skipped entirely so they're never touched during iteration.
+static void sky_cursor_open_block(sky_cursor *cursor, void *ptr)
+{
+    uint8_t *block = (uint8_t*)ptr;
+    if((uint8_t*)cursor->endptr - block < SKY_EVENT_BLOCK_HEADER_SZ) badcursordata("block header", ptr);
+    if(block[1] != SKY_EVENT_BLOCK_VERSION && block[1] != SKY_EVENT_BLOCK_FIXED_TS_VERSION) badcursordata("block version", ptr);
+
+    // Older blocks have a fixed size delta for each timestamp.
+    uint16_t column_count = sky_block_read_uint16(block + 2);
+    uint32_t event_count  = sky_block_read_uint32(block + 4);
+    uint32_t block_sz     = sky_block_read_uint32(block + 8);
+    uint64_t ts_sz        = sky_block_read_uint32(block + 12);
+    if(block[1] == SKY_EVENT_BLOCK_FIXED_TS_VERSION) {
+        ts_sz = (uint64_t)event_count * 8;
+    }
+    uint8_t *endptr = block + block_sz;
+    if(block_sz < SKY_EVENT_BLOCK_HEADER_SZ + ts_sz || endptr > (uint8_t*)cursor->endptr) {
+        badcursordata("block size", ptr);
+    }
+
+    cursor->block_base_ts     = sky_block_read_int64(block + 16);
+    cursor->block_ts_deltas   = (block[1] == SKY_EVENT_BLOCK_FIXED_TS_VERSION ? block + SKY_EVENT_BLOCK_HEADER_SZ : NULL);
+    cursor->block_ts_ptr      = block + SKY_EVENT_BLOCK_HEADER_SZ;
+    cursor->block_ts_endptr   = cursor->block_ts_ptr + ts_sz;
+    cursor->block_prev_ts     = cursor->block_base_ts;
+    cursor->block_prev_delta  = 0;
+    cursor->block_event_count = event_count;
+    cursor->block_event_index = 0;
+    cursor->block_endptr      = endptr;
+    cursor->block_has_packed  = false;
+    cursor->block_skip_end    = 0;
+
+    // Make sure there's room to bind every column.
+    if(column_count > cursor->block_column_capacity) {
+        cursor->block_columns = realloc(cursor->block_columns, column_count * sizeof(sky_cursor_block_column));
+        cursor->block_packed = realloc(cursor->block_packed, (size_t)column_count * SKY_EVENT_BLOCK_GROUP_SZ * sizeof(int64_t));
+        cursor->block_column_capacity = column_count;
+    }
+    cursor->block_column_count = 0;
+
+    uint32_t bitmap_sz = (event_count + 7) / 8;
+    uint8_t *colptr = cursor->block_ts_endptr;
+
+    uint32_t i;
+    for(i=0; i<column_count; i++) {
+        if(endptr - colptr < SKY_EVENT_BLOCK_COLUMN_HEADER_SZ) badcursordata("block column", colptr);
+        int64_t property_id = sky_block_read_int64(colptr);
+        uint8_t type        = colptr[8];
+        uint32_t column_sz  = sky_block_read_uint32(colptr + 12);
+        if(column_sz < SKY_EVENT_BLOCK_COLUMN_HEADER_SZ + bitmap_sz || column_sz > (uint32_t)(endptr - colptr)) {
+            badcursordata("block column size", colptr);
+        }
+
+        // Only bind columns with a compatible, referenced property.
+        sky_property_descriptor *descriptor = sky_cursor_get_property_descriptor(cursor, property_id);
+        if(descriptor != NULL) {
+            if(sky_block_column_is_compatible(type, descriptor->data_type)) {
+                sky_cursor_block_column *column = &cursor->block_columns[cursor->block_column_count++];
+                column->type      = type;
+                column->data_type = descriptor->data_type;
+                column->sz        = descriptor->sz;
+                column->offset    = descriptor->offset;
+                column->bitmap    = colptr + SKY_EVENT_BLOCK_COLUMN_HEADER_SZ;
+                column->values    = column->bitmap + bitmap_sz;
+
+                // Dictionary entries are given codes from a range that's
+                // never reused by the cursor. Codes are left as zero once
+                // the range runs out.
+                if(type == SKY_EVENT_BLOCK_TYPE_DICT) {
+                    uint64_t codes_sz = (uint64_t)event_count * 4;
+                    if(column_sz < SKY_EVENT_BLOCK_COLUMN_HEADER_SZ + bitmap_sz + codes_sz + 4) {
+                        badcursordata("block dictionary", colptr);
+                    }
+                    column->dict_count   = sky_block_read_uint32(column->values + codes_sz);
+                    column->dict_offsets = column->values + codes_sz + 4;
+                    if(column_sz < SKY_EVENT_BLOCK_COLUMN_HEADER_SZ + bitmap_sz + codes_sz + 4 + (((uint64_t)column->dict_count + 1) * 4)) {
+                        badcursordata("block dictionary size", colptr);
+                    }
+                    if(cursor->next_dict_code > 0 && UINT32_MAX - cursor->next_dict_code >= column->dict_count) {
+                        column->dict_code = cursor->next_dict_code;
+                        cursor->next_dict_code += column->dict_count;
+                    }
+                    else {
+                        column->dict_code = 0;
+                        cursor->next_dict_code = 0;
+                    }
+                }
+
+                // Packed groups are checked as they're unpacked.
+                if(type == SKY_EVENT_BLOCK_TYPE_PACKED) {
+                    uint64_t group_count = ((uint64_t)event_count + SKY_EVENT_BLOCK_GROUP_SZ - 1) / SKY_EVENT_BLOCK_GROUP_SZ;
+                    uint64_t offsets_sz = (group_count + 1) * 4;
+                    if(column_sz < SKY_EVENT_BLOCK_COLUMN_HEADER_SZ + bitmap_sz + offsets_sz) {
+                        badcursordata("block packed offsets", colptr);
+                    }
+                    column->groups        = column->values + offsets_sz;
+                    column->groups_endptr = colptr + column_sz;
+                    column->packed_group  = UINT32_MAX;
+                    column->packed        = cursor->block_packed + ((size_t)(cursor->block_column_count - 1) * SKY_EVENT_BLOCK_GROUP_SZ);
+                    cursor->block_has_packed = true;
+                }
+            }
+        }
+
+        colptr += column_sz;
+    }
+
+    cursor->in_block = true;
+}
+
+// Moves the cursor to the next event in the current block.
+static void sky_cursor_next_block_event(sky_cursor *cursor)
+{
+    // Timestamps are decoded from the previous one unless the block has a
+    // fixed delta for each event.
+    uint32_t index = cursor->block_event_index;
+    int64_t ts, delta = 0;
+    uint8_t *ts_ptr = NULL;
+    if(cursor->block_ts_deltas != NULL) {
+        ts = cursor->block_base_ts + sky_block_read_int64(cursor->block_ts_deltas + ((size_t)index * 8));
+    }
+    else {
+        int64_t delta_of_delta;
+        ts_ptr = sky_block_read_varint(cursor->block_ts_ptr, cursor->block_ts_endptr, &delta_of_delta);
+        if(ts_ptr == NULL) badcursordata("block timestamp", cursor->block_ts_ptr);
+        delta = cursor->block_prev_delta + delta_of_delta;
+        ts = cursor->block_prev_ts + delta;
+    }
+    uint32_t timestamp = sky_timestamp_to_seconds(ts);
+
+    // Check for session boundry. The index isn't advanced when the session
+    // ends so the same event is read again by the next session.
+    if(cursor->last_timestamp > 0 && cursor->session_idle_in_sec > 0) {
+        if(timestamp - cursor->last_timestamp >= cursor->session_idle_in_sec) {
+            cursor->in_session = false;
+        }
+    }
+    cursor->last_timestamp = timestamp;
+    if(!cursor->in_session) {
+        return;
+    }
+
+    cursor->session_event_index++;
+    cursor->block_event_index++;
+    cursor->event_count++;
+    if(ts_ptr != NULL) {
+        cursor->block_ts_ptr = ts_ptr;
+        cursor->block_prev_ts = ts;
+        cursor->block_prev_delta = delta;
+    }
+
+    // Set timestamp.
+    sky_cursor_set_event_timestamp(cursor, ts, timestamp);
+
+    // Clear old action data.
+    if(cursor->action_data_sz > 0) {
+        memset(cursor->data, 0, cursor->action_data_sz);
+    }
+
+    // Groups of packed values that can't match the filter are skipped. Only
+    // the last value of each permanent property in the group is copied so
+    // it still carries over to the events after it.
+    if(index % SKY_EVENT_BLOCK_GROUP_SZ == 0 && cursor->block_has_packed && cursor->filter != NULL) {
+        if(sky_cursor_block_group_fails_filter(cursor, index)) {
+            cursor->block_skip_end = index + SKY_EVENT_BLOCK_GROUP_SZ;
+        }
+    }
+    uint32_t i;
+    cursor->event_skipped = (index < cursor->block_skip_end);
+    if(cursor->event_skipped) {
+        if(index + 1 == cursor->block_skip_end || index + 1 == cursor->block_event_count) {
+            uint32_t start = index - (index % SKY_EVENT_BLOCK_GROUP_SZ);
+            for(i=0; i<cursor->block_column_count; i++) {
+                sky_cursor_block_column *column = &cursor->block_columns[i];
+                if(column->offset < cursor->action_data_sz) {
+                    continue;
+                }
+                uint32_t j;
+                for(j=index+1; j>start; j--) {
+                    if(column->bitmap[(j-1) >> 3] & (1 << ((j-1) & 7))) {
+                        sky_cursor_read_block_value(cursor, column, j-1);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // Copy in the values that are present for this event.
+    else {
+        uint8_t mask = (uint8_t)(1 << (index & 7));
+        for(i=0; i<cursor->block_column_count; i++) {
+            sky_cursor_block_column *column = &cursor->block_columns[i];
+            if((column->bitmap[index >> 3] & mask) != 0) {
+                sky_cursor_read_block_value(cursor, column, index);
+            }
+        }
+    }
+
+    if(cursor->family_count > 0) {
+        sky_cursor_read_families(cursor, ts);
+    }
+}
+
+
+// Copies the value of a column at an event index into the cursor's data.
+static void sky_cursor_read_block_value(sky_cursor *cursor, sky_cursor_block_column *column, uint32_t index)
+{
+    void *target = cursor->data + column->offset;
+    switch(column->type) {
+        case SKY_EVENT_BLOCK_TYPE_STRING: {
+            uint32_t start = sky_block_read_uint32(column->values + ((size_t)index * 4));
+            uint32_t end   = sky_block_read_uint32(column->values + ((size_t)(index + 1) * 4));
+            uint8_t *heap  = column->values + (((size_t)cursor->block_event_count + 1) * 4);
+            ((sky_string*)target)->length = (int32_t)(end - start);
+            ((sky_string*)target)->code = 0;
+            ((sky_string*)target)->data = (char*)(heap + start);
+            break;
+        }
+        case SKY_EVENT_BLOCK_TYPE_DICT: {
+            uint32_t code = sky_block_read_uint32(column->values + ((size_t)index * 4));
+            if(code >= column->dict_count) badcursordata("block dictionary code", column->values);
+            uint32_t start = sky_block_read_uint32(column->dict_offsets + ((size_t)code * 4));
+            uint32_t end   = sky_block_read_uint32(column->dict_offsets + ((size_t)(code + 1) * 4));
+            uint8_t *heap  = column->dict_offsets + (((size_t)column->dict_count + 1) * 4);
+            ((sky_string*)target)->length = (int32_t)(end - start);
+            ((sky_string*)target)->code = (column->dict_code > 0 ? column->dict_code + code : 0);
+            ((sky_string*)target)->data = (char*)(heap + start);
+            break;
+        }
+        case SKY_EVENT_BLOCK_TYPE_PACKED:
+        case SKY_EVENT_BLOCK_TYPE_INT: {
+            int64_t value;
+            if(column->type == SKY_EVENT_BLOCK_TYPE_PACKED) {
+                uint32_t group = index / SKY_EVENT_BLOCK_GROUP_SZ;
+                if(column->packed_group != group) {
+                    sky_cursor_unpack_block_group(cursor, column, group);
+                    if(column->packed_group != group) return;
+                }
+                value = column->packed[index % SKY_EVENT_BLOCK_GROUP_SZ];
+            }
+            else {
+                value = sky_block_read_int64(column->values + ((size_t)index * 8));
+            }
+            if(column->data_type == SKY_DATA_TYPE_DOUBLE) {
+                sky_write_double(target, column->sz, (double)value);
+            } else {
+                sky_write_int(target, column->sz, value);
+            }
+            break;
+        }
+        case SKY_EVENT_BLOCK_TYPE_DOUBLE: {
+            double value = sky_block_read_double(column->values + ((size_t)index * 8));
+            if(column->data_type == SKY_DATA_TYPE_INT) {
+                sky_write_int(target, column->sz, (int64_t)value);
+            } else {
+                sky_write_double(target, column->sz, value);
+            }
+            break;
+        }
+        case SKY_EVENT_BLOCK_TYPE_BOOLEAN:
+            *((bool*)target) = (column->values[index] != 0);
+            break;
+    }
+}
+
+
+//--------------------------------------
+// Setters
+//--------------------------------------
+
+void sky_set_noop(void *target, void *value, size_t *sz)
+{
+    ((void)(target));
+    *sz = minipack_sizeof_elem_and_data(value);
+}
+
+void sky_set_string(void *target, void *value, size_t *sz)
+{
+    size_t _sz;
+    sky_string *string = (sky_string*)target;
+    string->length = minipack_unpack_raw(value, &_sz);
+    string->code = 0;
+    string->data = (_sz > 0 ? value + _sz : NULL);
+    *sz = _sz + string->length;
+}
+
+void sky_set_int8(void *target, void *value, size_t *sz)
+{
+    *((int8_t*)target) = (int8_t)minipack_unpack_int(value, sz);
+}
+
+void sky_set_int16(void *target, void *value, size_t *sz)
+{
+    *((int16_t*)target) = (int16_t)minipack_unpack_int(value, sz);
+}
+
+void sky_set_int(void *target, void *value, size_t *sz)
+{
+    *((int32_t*)target) = (int32_t)minipack_unpack_int(value, sz);
+}
+
+void sky_set_int64(void *target, void *value, size_t *sz)
+{
+    *((int64_t*)target) = minipack_unpack_int(value, sz);
+}
+
+void sky_set_float(void *target, void *value, size_t *sz)
+{
+    *((float*)target) = (float)minipack_unpack_double(value, sz);
+}
+
+void sky_set_double(void *target, void *value, size_t *sz)
+{
+    *((double*)target) = minipack_unpack_double(value, sz);
+}
+
+void sky_set_boolean(void *target, void *value, size_t *sz)
+{
+    *((bool*)target) = minipack_unpack_bool(value, sz);
+}
+
+
+//--------------------------------------
+// Clear Functions
+//--------------------------------------
+
+void sky_clear_string(void *target)
+{
+    sky_string *string = (sky_string*)target;
+    string->length = 0;
+    string->code = 0;
+    string->data = NULL;
+}
+
+void sky_clear_int8(void *target)
+{
+    *((int8_t*)target) = 0;
+}
+
+void sky_clear_int16(void *target)
+{
+    *((int16_t*)target) = 0;
+}
+
+void sky_clear_int(void *target)
+{
+    *((int32_t*)target) = 0;
+}
+
+void sky_clear_int64(void *target)
+{
+    *((int64_t*)target) = 0;
+}
+
+void sky_clear_float(void *target)
+{
+    *((float*)target) = 0;
 }
 
 void sky_clear_double(void *target)
@@ -0,0 +1,314 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "sky/kernel.h"
+
+//==============================================================================
+//
+// Forward Declarations
+//
+//==============================================================================
+
+static int64_t sky_kernel_group_slot(sky_kernel *kernel, sky_kernel_group *group, uint64_t key);
+
+static int sky_kernel_group_resize(sky_kernel *kernel, sky_kernel_group *group, uint32_t capacity);
+
+
+//==============================================================================
+//
+// Functions
+//
+//==============================================================================
+
+//--------------------------------------
+// Lifecycle
+//--------------------------------------
+
+// Creates a kernel without any groups. Returns NULL if memory cannot be
+// allocated.
+sky_kernel *sky_kernel_new()
+{
+    return calloc(1, sizeof(sky_kernel));
+}
+
+void sky_kernel_free(sky_kernel *kernel)
+{
+    if(kernel) {
+        uint32_t i;
+        for(i=0; i<kernel->group_count; i++) {
+            sky_kernel_group *group = &kernel->groups[i];
+            free(group->field_ids);
+            free(group->field_types);
+            free(group->field_sizes);
+            free(group->fields);
+            free(group->keys);
+            free(group->used);
+            free(group->values);
+        }
+        free(kernel->groups);
+        free(kernel);
+    }
+}
+
+
+//--------------------------------------
+// Groups
+//--------------------------------------
+
+// Adds a group that counts events and sums fields by up to two factors.
+// The factor and field properties are looked up when the kernel is bound.
+//
+// Returns the index of the group or -1 if it can't be added.
+int sky_kernel_add_group(sky_kernel *kernel,
+                         uint32_t dimension_count, const int64_t *dimension_ids,
+                         uint32_t field_count, const int64_t *field_ids)
+{
+    if(dimension_count > SKY_KERNEL_MAX_DIMENSIONS) return -1;
+
+    sky_kernel_group *groups = realloc(kernel->groups, (kernel->group_count + 1) * sizeof(sky_kernel_group));
+    if(groups == NULL) return -1;
+    kernel->groups = groups;
+
+    sky_kernel_group *group = &kernel->groups[kernel->group_count];
+    memset(group, 0, sizeof(*group));
+    group->dimension_count = dimension_count;
+    if(dimension_count > 0) {
+        memcpy(group->dimension_ids, dimension_ids, dimension_count * sizeof(int64_t));
+    }
+    group->field_count = field_count;
+    if(field_count > 0) {
+        group->field_ids = calloc(field_count, sizeof(*group->field_ids));
+        group->field_types = calloc(field_count, sizeof(*group->field_types));
+        group->field_sizes = calloc(field_count, sizeof(*group->field_sizes));
+        group->fields = calloc(field_count, sizeof(*group->fields));
+        if(group->field_ids == NULL || group->field_types == NULL || group->field_sizes == NULL || group->fields == NULL) {
+            free(group->field_ids);
+            free(group->field_types);
+            free(group->field_sizes);
+            free(group->fields);
+            return -1;
+        }
+        memcpy(group->field_ids, field_ids, field_count * sizeof(int64_t));
+    }
+    return kernel->group_count++;
+}
+
+// Points each group at the batch columns of its factors and fields. Factors
+// must be 32-bit integer columns and fields must be integer or float columns
+// of any width.
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_kernel_bind(sky_kernel *kernel, sky_cursor *cursor)
+{
+    uint32_t i, j;
+    for(i=0; i<kernel->group_count; i++) {
+        sky_kernel_group *group = &kernel->groups[i];
+        for(j=0; j<group->dimension_count; j++) {
+            uint8_t data_type = SKY_DATA_TYPE_NONE, sz = 0;
+            group->dimensions[j] = sky_cursor_batch_column_values(cursor, group->dimension_ids[j], &data_type, &sz);
+            if(group->dimensions[j] == NULL || data_type != SKY_DATA_TYPE_INT || sz != sizeof(int32_t)) {
+                return -1;
+            }
+        }
+        for(j=0; j<group->field_count; j++) {
+            group->fields[j] = sky_cursor_batch_column_values(cursor, group->field_ids[j], &group->field_types[j], &group->field_sizes[j]);
+            if(group->fields[j] == NULL || (group->field_types[j] != SKY_DATA_TYPE_INT && group->field_types[j] != SKY_DATA_TYPE_DOUBLE)) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Sets the most memory in bytes that the groups of a kernel can use. A run
+// that needs more fails. A zero limit leaves the kernel unbounded.
+void sky_kernel_set_memory_limit(sky_kernel *kernel, size_t limit)
+{
+    kernel->memory_limit = limit;
+}
+
+// Splits the key of a group back into the sequences of its factors.
+void sky_kernel_group_key_dimensions(sky_kernel_group *group, uint64_t key,
+                                     int32_t *dimensions)
+{
+    switch(group->dimension_count) {
+        case 1:
+            dimensions[0] = (int32_t)(uint32_t)key;
+            break;
+        case 2:
+            dimensions[0] = (int32_t)(uint32_t)(key >> 32);
+            dimensions[1] = (int32_t)(uint32_t)key;
+            break;
+    }
+}
+
+// Returns the number of bytes used by a slot of a group.
+static inline size_t sky_kernel_group_slot_sz(sky_kernel_group *group)
+{
+    return sizeof(uint64_t) + sizeof(bool) + (group->field_count + 1) * sizeof(double);
+}
+
+// Moves the groups into a table with a new capacity, which must be a power
+// of two that holds all of them.
+//
+// Returns 0 if successful, otherwise returns -1.
+static int sky_kernel_group_resize(sky_kernel *kernel, sky_kernel_group *group, uint32_t capacity)
+{
+    uint32_t stride = group->field_count + 1;
+    size_t slot_sz = sky_kernel_group_slot_sz(group);
+    size_t memory_used = kernel->memory_used - (group->capacity * slot_sz) + (capacity * slot_sz);
+    if(kernel->memory_limit > 0 && memory_used > kernel->memory_limit) {
+        return -1;
+    }
+
+    uint64_t *keys = calloc(capacity, sizeof(*keys));
+    bool *used = calloc(capacity, sizeof(*used));
+    double *values = calloc((size_t)capacity * stride, sizeof(*values));
+    if(keys == NULL || used == NULL || values == NULL) {
+        free(keys);
+        free(used);
+        free(values);
+        return -1;
+    }
+
+    uint32_t mask = capacity - 1;
+    uint32_t i;
+    for(i=0; i<group->capacity; i++) {
+        if(!group->used[i]) continue;
+        uint32_t index = (uint32_t)((group->keys[i] * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+        while(used[index]) index = (index + 1) & mask;
+        used[index] = true;
+        keys[index] = group->keys[i];
+        memcpy(&values[(size_t)index * stride], &group->values[(size_t)i * stride], stride * sizeof(double));
+    }
+
+    free(group->keys);
+    free(group->used);
+    free(group->values);
+    group->keys = keys;
+    group->used = used;
+    group->values = values;
+    group->capacity = capacity;
+    kernel->memory_used = memory_used;
+    return 0;
+}
+
+// Finds the slot of a key, adding the key if it's new. The table is kept
+// at most half full.
+//
+// Returns the slot or -1 if the table can't grow.
+static int64_t sky_kernel_group_slot(sky_kernel *kernel, sky_kernel_group *group, uint64_t key)
+{
+    uint32_t mask = group->capacity - 1;
+    uint32_t index = (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+    if(group->capacity > 0) {
+        while(group->used[index]) {
+            if(group->keys[index] == key) return index;
+            index = (index + 1) & mask;
+        }
+    }
+
+    // Grow the table before adding a key that would fill more than half.
+    if((group->count + 1) * 2 > group->capacity) {
+        if(sky_kernel_group_resize(kernel, group, (group->capacity == 0 ? 16 : group->capacity * 2)) != 0) {
+            return -1;
+        }
+        mask = group->capacity - 1;
+        index = (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+        while(group->used[index]) index = (index + 1) & mask;
+    }
+
+    group->used[index] = true;
+    group->keys[index] = key;
+    group->count++;
+    return index;
+}
+
+
+//--------------------------------------
+// Execution
+//--------------------------------------
+
+// Reads the value of a field for an event in the batch as a double.
+static inline double sky_kernel_field_value(sky_kernel_group *group, uint32_t field, uint32_t index)
+{
+    void *values = group->fields[field];
+    if(group->field_types[field] == SKY_DATA_TYPE_INT) {
+        switch(group->field_sizes[field]) {
+            case 1: return (double)((int8_t*)values)[index];
+            case 2: return (double)((int16_t*)values)[index];
+            case 8: return (double)((int64_t*)values)[index];
+            default: return (double)((int32_t*)values)[index];
+        }
+    }
+    if(group->field_sizes[field] == sizeof(float)) {
+        return (double)((float*)values)[index];
+    }
+    return ((double*)values)[index];
+}
+
+// Adds the events of the cursor's current batch to a group. Neighboring
+// events usually fall in the same group so the last slot is reused
+// without a lookup.
+//
+// Returns 0 if successful, otherwise returns -1.
+static int sky_kernel_group_add_batch(sky_kernel *kernel, sky_kernel_group *group, uint32_t count)
+{
+    uint32_t stride = group->field_count + 1;
+    uint64_t last_key = 0;
+    int64_t slot = -1;
+
+    uint32_t i, j;
+    for(i=0; i<count; i++) {
+        uint64_t key = 0;
+        if(group->dimension_count > 0) key = (uint32_t)group->dimensions[0][i];
+        if(group->dimension_count > 1) key = (key << 32) | (uint32_t)group->dimensions[1][i];
+        if(slot < 0 || key != last_key) {
+            slot = sky_kernel_group_slot(kernel, group, key);
+            if(slot < 0) return -1;
+            last_key = key;
+        }
+
+        double *values = &group->values[(size_t)slot * stride];
+        values[0] += 1;
+        for(j=0; j<group->field_count; j++) {
+            values[j+1] += sky_kernel_field_value(group, j, i);
+        }
+    }
+    return 0;
+}
+
+// Reads every object of the cursor in batches and adds their events to
+// each group. Groups accumulate across runs until the kernel is reset.
+//
+// Returns 0 if successful or -1 if the groups run out of memory.
+int sky_kernel_run(sky_kernel *kernel, sky_cursor *cursor)
+{
+    while(sky_cursor_next_object(cursor)) {
+        uint32_t count;
+        while((count = sky_cursor_next_batch(cursor)) > 0) {
+            uint32_t i;
+            for(i=0; i<kernel->group_count; i++) {
+                if(sky_kernel_group_add_batch(kernel, &kernel->groups[i], count) != 0) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// Clears the groups so the kernel can be run again. Tables keep their
+// capacity since the next run usually sees the same groups.
+void sky_kernel_reset(sky_kernel *kernel)
+{
+    uint32_t i;
+    for(i=0; i<kernel->group_count; i++) {
+        sky_kernel_group *group = &kernel->groups[i];
+        if(group->capacity > 0) {
+            memset(group->used, 0, group->capacity * sizeof(*group->used));
+            memset(group->values, 0, (size_t)group->capacity * (group->field_count + 1) * sizeof(*group->values));
+        }
+        group->count = 0;
+    }
+}
@@ -5,6 +5,14 @@
 #include <sys/types.h>
 #include <arpa/inet.h>
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define MINIPACK_X86_64
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MINIPACK_NEON
+#endif
+
 //==============================================================================
 //
 // Constants
@@ -157,6 +165,48 @@
 #define MAP32_MAXSIZE           4294967295
 
 
+//==============================================================================
+//
+// Tags
+//
+//==============================================================================
+
+// The class of each element tag. Integers include both signed and unsigned
+// encodings since either can be read as a signed integer.
+#define TAG_INVALID             0
+#define TAG_INT                 1
+#define TAG_SCALAR              2
+#define TAG_RAW                 3
+
+typedef struct {
+    uint8_t class;
+    uint8_t size;
+} minipack_tag;
+
+// The class and header size of every tag byte. Raw headers don't include
+// the length of their data. Maps, arrays and unused tags are invalid.
+static const minipack_tag minipack_tags[256] = {
+    [0x00 ... 0x7F] = {TAG_INT, POS_FIXNUM_SIZE},
+    [0xA0 ... 0xBF] = {TAG_RAW, FIXRAW_SIZE},
+    [NIL_TYPE]      = {TAG_SCALAR, NIL_SIZE},
+    [FALSE_TYPE]    = {TAG_SCALAR, BOOL_SIZE},
+    [TRUE_TYPE]     = {TAG_SCALAR, BOOL_SIZE},
+    [FLOAT_TYPE]    = {TAG_SCALAR, FLOAT_SIZE},
+    [DOUBLE_TYPE]   = {TAG_SCALAR, DOUBLE_SIZE},
+    [UINT8_TYPE]    = {TAG_INT, UINT8_SIZE},
+    [UINT16_TYPE]   = {TAG_INT, UINT16_SIZE},
+    [UINT32_TYPE]   = {TAG_INT, UINT32_SIZE},
+    [UINT64_TYPE]   = {TAG_INT, UINT64_SIZE},
+    [INT8_TYPE]     = {TAG_INT, INT8_SIZE},
+    [INT16_TYPE]    = {TAG_INT, INT16_SIZE},
+    [INT32_TYPE]    = {TAG_INT, INT32_SIZE},
+    [INT64_TYPE]    = {TAG_INT, INT64_SIZE},
+    [RAW16_TYPE]    = {TAG_RAW, RAW16_SIZE},
+    [RAW32_TYPE]    = {TAG_RAW, RAW32_SIZE},
+    [0xE0 ... 0xFF] = {TAG_INT, NEG_FIXNUM_SIZE},
+};
+
+
 //==============================================================================
 //
 // Byte Order
@@ -213,30 +263,87 @@ uint64_t bswap64(uint64_t value)
 // Returns the number of bytes needed for the element and the element's data.
 size_t minipack_sizeof_elem_and_data(void *ptr)
 {
+    uint8_t type = *((uint8_t*)ptr);
+    const minipack_tag *tag = &minipack_tags[type];
+    if(tag->class != TAG_RAW) return tag->size;
+
     size_t sz;
-    
-    // Integer.
-    sz = minipack_sizeof_int_elem(ptr);
-    if(sz > 0) return sz;
-    
-    // Unsigned Integer.
-    sz = minipack_sizeof_uint_elem(ptr);
-    if(sz > 0) return sz;
-    
-    // Float & Double
-    if(minipack_is_float(ptr)) return minipack_sizeof_float();
-    if(minipack_is_double(ptr)) return minipack_sizeof_double();
+    uint32_t length = minipack_unpack_raw(ptr, &sz);
+    return sz + length;
+}
 
-    // Nil & Boolean.
-    if(minipack_is_nil(ptr)) return minipack_sizeof_nil();
-    if(minipack_is_bool(ptr)) return minipack_sizeof_bool();
+// Checks the bytes of a fixnum run one at a time starting from an index.
+static size_t minipack_fixnum_run_scalar(uint8_t *ptr, size_t index, size_t len)
+{
+    while(index < len && (int8_t)ptr[index] >= NEG_FIXNUM_MIN) {
+        index++;
+    }
+    return index;
+}
 
-    // Raw
-    uint32_t length = minipack_unpack_raw(ptr, &sz);
-    if(sz > 0) return sz + length;
-    
-    // Map, Array and other data returns 0.
-    return 0;
+#if defined(MINIPACK_X86_64)
+static size_t minipack_fixnum_run_sse2(uint8_t *ptr, size_t index, size_t len)
+{
+    __m128i min = _mm_set1_epi8(NEG_FIXNUM_MIN - 1);
+    for(; index + 16 <= len; index += 16) {
+        __m128i chunk = _mm_loadu_si128((__m128i*)(ptr + index));
+        uint32_t mask = ~(uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi8(chunk, min)) & 0xFFFF;
+        if(mask != 0) return index + __builtin_ctz(mask);
+    }
+    return minipack_fixnum_run_scalar(ptr, index, len);
+}
+
+__attribute__((target("avx2")))
+static size_t minipack_fixnum_run_avx2(uint8_t *ptr, size_t index, size_t len)
+{
+    __m256i min = _mm256_set1_epi8(NEG_FIXNUM_MIN - 1);
+    for(; index + 32 <= len; index += 32) {
+        __m256i chunk = _mm256_loadu_si256((__m256i*)(ptr + index));
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(chunk, min));
+        if(mask != 0) return index + __builtin_ctz(mask);
+    }
+    return minipack_fixnum_run_sse2(ptr, index, len);
+}
+#elif defined(MINIPACK_NEON)
+static size_t minipack_fixnum_run_neon(uint8_t *ptr, size_t index, size_t len)
+{
+    int8x16_t min = vdupq_n_s8(NEG_FIXNUM_MIN);
+    for(; index + 16 <= len; index += 16) {
+        uint8x16_t fixnums = vcgeq_s8(vld1q_s8((int8_t*)(ptr + index)), min);
+        if(vminvq_u8(fixnums) != 0xFF) break;
+    }
+    return minipack_fixnum_run_scalar(ptr, index, len);
+}
+#endif
+
+// Finds the number of leading bytes that are each a positive or negative
+// fixnum. A run of these is a run of whole elements, such as the keys and
+// values of a map of small integers, so it can be read without decoding
+// each tag.
+//
+// ptr - A pointer to the first element.
+// len - The number of bytes to check.
+//
+// Returns the length of the run.
+size_t minipack_fixnum_run(void *ptr, size_t len)
+{
+#if defined(MINIPACK_X86_64)
+    // SSE2 is always available on x86-64 but AVX2 has to be checked. The
+    // check is cached and racing threads all store the same answer.
+    static int avx2 = -1;
+    if(avx2 < 0) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    if(avx2) {
+        return minipack_fixnum_run_avx2(ptr, 0, len);
+    }
+    return minipack_fixnum_run_sse2(ptr, 0, len);
+#elif defined(MINIPACK_NEON)
+    return minipack_fixnum_run_neon(ptr, 0, len);
+#else
+    return minipack_fixnum_run_scalar(ptr, 0, len);
+#endif
 }
 
 
@@ -699,40 +806,8 @@ size_t minipack_sizeof_int(int64_t value)
 // Returns the number of bytes needed for the element.
 size_t minipack_sizeof_int_elem(void *ptr)
 {
-    if(minipack_is_pos_fixnum(ptr)) {
-        return POS_FIXNUM_SIZE;
-    }
-    else if(minipack_is_neg_fixnum(ptr)) {
-        return NEG_FIXNUM_SIZE;
-    }
-    else if(minipack_is_int8(ptr)) {
-        return INT8_SIZE;
-    }
-    else if(minipack_is_int16(ptr)) {
-        return INT16_SIZE;
-    }
-    else if(minipack_is_int32(ptr)) {
-        return INT32_SIZE;
-    }
-    else if(minipack_is_int64(ptr)) {
-        return INT64_SIZE;
-    }
-    // Fallback to unsigned ints.
-    else if(minipack_is_uint8(ptr)) {
-        return UINT8_SIZE;
-    }
-    else if(minipack_is_uint16(ptr)) {
-        return UINT16_SIZE;
-    }
-    else if(minipack_is_uint32(ptr)) {
-        return UINT32_SIZE;
-    }
-    else if(minipack_is_uint64(ptr)) {
-        return UINT64_SIZE;
-    }
-    else {
-        return 0;
-    }
+    const minipack_tag *tag = &minipack_tags[*((uint8_t*)ptr)];
+    return (tag->class == TAG_INT ? tag->size : 0);
 }
 
 // Reads a signed integer from a given memory address.
@@ -743,41 +818,29 @@ size_t minipack_sizeof_int_elem(void *ptr)
 // Returns the value of the element
 int64_t minipack_unpack_int(void *ptr, size_t *sz)
 {
-    if(minipack_is_pos_fixnum(ptr)) {
-        return (int64_t)minipack_unpack_pos_fixnum(ptr, sz);
-    }
-    if(minipack_is_neg_fixnum(ptr)) {
-        return (int64_t)minipack_unpack_neg_fixnum(ptr, sz);
-    }
-    else if(minipack_is_int8(ptr)) {
-        return (int64_t)minipack_unpack_int8(ptr, sz);
-    }
-    else if(minipack_is_int16(ptr)) {
-        return (int64_t)minipack_unpack_int16(ptr, sz);
+    uint8_t type = *((uint8_t*)ptr);
+    if(type <= POS_FIXNUM_MAX) {
+        *sz = POS_FIXNUM_SIZE;
+        return (int64_t)type;
     }
-    else if(minipack_is_int32(ptr)) {
-        return (int64_t)minipack_unpack_int32(ptr, sz);
-    }
-    else if(minipack_is_int64(ptr)) {
-        return minipack_unpack_int64(ptr, sz);
-    }
-    // Fallback to unsigned ints.
-    else if(minipack_is_uint8(ptr)) {
-        return (int64_t)minipack_unpack_uint8(ptr, sz);
-    }
-    else if(minipack_is_uint16(ptr)) {
-        return (int64_t)minipack_unpack_uint16(ptr, sz);
+    if(type >= NEG_FIXNUM_TYPE) {
+        *sz = NEG_FIXNUM_SIZE;
+        return (int64_t)(int8_t)type;
     }
-    else if(minipack_is_uint32(ptr)) {
-        return (int64_t)minipack_unpack_uint32(ptr, sz);
-    }
-    else if(minipack_is_uint64(ptr)) {
-        return minipack_unpack_uint64(ptr, sz);
-    }
-    else {
-        *sz = 0;
-        return 0;
+
+    // Unsigned ints are a fallback for values written by other packers.
+    switch(type) {
+        case INT8_TYPE: return (int64_t)minipack_unpack_int8(ptr, sz);
+        case INT16_TYPE: return (int64_t)minipack_unpack_int16(ptr, sz);
+        case INT32_TYPE: return (int64_t)minipack_unpack_int32(ptr, sz);
+        case INT64_TYPE: return minipack_unpack_int64(ptr, sz);
+        case UINT8_TYPE: return (int64_t)minipack_unpack_uint8(ptr, sz);
+        case UINT16_TYPE: return (int64_t)minipack_unpack_uint16(ptr, sz);
+        case UINT32_TYPE: return (int64_t)minipack_unpack_uint32(ptr, sz);
+        case UINT64_TYPE: return minipack_unpack_uint64(ptr, sz);
     }
+    *sz = 0;
+    return 0;
 }
 
 // Writes a signed integer to a given memory address.
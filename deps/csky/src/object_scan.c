@@ -0,0 +1,1211 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sky/object_scan.h"
+#include "sky/event_block.h"
+#include "sky/minipack.h"
+
+//==============================================================================
+//
+// Constants
+//
+//==============================================================================
+
+// The number of times either side of a pipelined scan polls the ring before
+// it sleeps.
+#define SKY_OBJECT_SCAN_SPIN_COUNT 1024
+
+// The bytes at the start of the next object of a pipelined scan that are
+// prefetched while the cursor is on the current one.
+#define SKY_OBJECT_SCAN_PREFETCH_SZ 256
+
+
+//==============================================================================
+//
+// Forward Declarations
+//
+//==============================================================================
+
+static int sky_object_scan_copy(void **dest, size_t *dest_sz, const void *src, size_t sz);
+
+static int sky_object_scan_add_piece(sky_object_scan *scan, uint32_t *count,
+  const uint8_t *ptr, size_t sz);
+
+static void sky_object_scan_split_piece(sky_object_scan_piece *piece,
+  const uint8_t *ptr, size_t sz);
+
+static int sky_object_scan_start(sky_object_scan *scan, sky_cursor *cursor);
+
+static void sky_object_scan_stop(sky_object_scan *scan);
+
+static int sky_object_scan_next_pipelined(sky_object_scan *scan, sky_cursor *cursor);
+
+
+//==============================================================================
+//
+// Functions
+//
+//==============================================================================
+
+//--------------------------------------
+// Utility
+//--------------------------------------
+
+// Reads unaligned little endian integers from an event index.
+static inline uint32_t sky_object_scan_read_uint32(const uint8_t *ptr)
+{
+    return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) |
+           ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static inline int64_t sky_object_scan_read_int64(const uint8_t *ptr)
+{
+    uint64_t value = (uint64_t)sky_object_scan_read_uint32(ptr) |
+                     ((uint64_t)sky_object_scan_read_uint32(ptr + 4) << 32);
+    return (int64_t)value;
+}
+
+// Returns the size of the header of the msgpack raw value at the beginning
+// of the data. Strings and binaries are both read as raws.
+static size_t sky_object_scan_raw_header_size(const uint8_t *ptr)
+{
+    if(ptr[0] >= 0xa0 && ptr[0] <= 0xbf) return 1;
+    if(ptr[0] == 0xd9 || ptr[0] == 0xc4) return 2;
+    if(ptr[0] == 0xda || ptr[0] == 0xc5) return 3;
+    return 5;
+}
+
+// Returns the size of the msgpack raw value at the beginning of the data,
+// including its header, or zero if the data doesn't start with a raw.
+static size_t sky_object_scan_raw_size(const uint8_t *ptr, size_t sz)
+{
+    if(sz == 0) return 0;
+
+    size_t n = 0;
+    uint8_t b = ptr[0];
+    if(b >= 0xa0 && b <= 0xbf) {
+        n = 1 + (b & 0x1f);
+    }
+    else if((b == 0xd9 || b == 0xc4) && sz >= 2) {
+        n = 2 + ptr[1];
+    }
+    else if((b == 0xda || b == 0xc5) && sz >= 3) {
+        n = 3 + (((size_t)ptr[1] << 8) | ptr[2]);
+    }
+    else if((b == 0xdb || b == 0xc6) && sz >= 5) {
+        n = 5 + (((size_t)ptr[1] << 24) | ((size_t)ptr[2] << 16) | ((size_t)ptr[3] << 8) | ptr[4]);
+    }
+    return (n > sz ? 0 : n);
+}
+
+static inline void sky_object_scan_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static int sky_object_scan_compare(const void *a, size_t a_sz, const void *b, size_t b_sz)
+{
+    int rc = memcmp(a, b, (a_sz < b_sz ? a_sz : b_sz));
+    if(rc != 0) return rc;
+    return (a_sz < b_sz ? -1 : (a_sz > b_sz ? 1 : 0));
+}
+
+// Replaces a copy of a key. A NULL source clears it.
+//
+// Returns 0 if successful, otherwise returns -1.
+static int sky_object_scan_copy(void **dest, size_t *dest_sz, const void *src, size_t sz)
+{
+    free(*dest);
+    *dest = NULL;
+    *dest_sz = 0;
+    if(src == NULL) return 0;
+
+    *dest = malloc(sz > 0 ? sz : 1);
+    if(*dest == NULL) return -1;
+    memcpy(*dest, src, sz);
+    *dest_sz = sz;
+    return 0;
+}
+
+
+//--------------------------------------
+// Lifecycle
+//--------------------------------------
+
+sky_object_scan *sky_object_scan_new()
+{
+    sky_object_scan *scan = calloc(1, sizeof(sky_object_scan));
+    if(scan == NULL) return NULL;
+    pthread_mutex_init(&scan->mutex, NULL);
+    pthread_cond_init(&scan->cond, NULL);
+    return scan;
+}
+
+// Frees the slots of a pipelined scan's ring.
+static void sky_object_scan_free_slots(sky_object_scan *scan)
+{
+    uint32_t i;
+    for(i=0; i<scan->pipeline_depth; i++) {
+        free(scan->slots[i].buffer);
+        free(scan->slots[i].family_szs);
+    }
+    free(scan->slots);
+    scan->slots = NULL;
+    scan->pipeline_depth = 0;
+}
+
+void sky_object_scan_free(sky_object_scan *scan)
+{
+    if(scan) {
+        sky_object_scan_stop(scan);
+        sky_object_scan_free_slots(scan);
+        sky_object_scan_clear_skip_ranges(scan);
+        sky_object_scan_clear_families(scan);
+        free(scan->prefix);
+        free(scan->end_key);
+        free(scan->head_key);
+        free(scan->pieces);
+        free(scan->buffer);
+        free(scan->family_streams);
+        pthread_mutex_destroy(&scan->mutex);
+        pthread_cond_destroy(&scan->cond);
+        free(scan);
+    }
+}
+
+
+//--------------------------------------
+// Configuration
+//--------------------------------------
+
+// Sets the table prefix that every key of the scan starts with.
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_object_scan_set_prefix(sky_object_scan *scan, const void *prefix, size_t sz)
+{
+    return sky_object_scan_copy(&scan->prefix, &scan->prefix_sz, prefix, sz);
+}
+
+// Sets the key that the scan stops at. A NULL key leaves the scan bound
+// only by the table prefix.
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_object_scan_set_end_key(sky_object_scan *scan, const void *key, size_t sz)
+{
+    return sky_object_scan_copy(&scan->end_key, &scan->end_key_sz, key, sz);
+}
+
+// Adds a key range that the scan seeks past because none of its objects can
+// match. Ranges must be added in key order.
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_object_scan_add_skip_range(sky_object_scan *scan,
+                                   const void *start, size_t start_sz,
+                                   const void *end, size_t end_sz)
+{
+    sky_object_scan_range *ranges = realloc(scan->skip_ranges, (scan->skip_range_count + 1) * sizeof(*ranges));
+    if(ranges == NULL) return -1;
+    scan->skip_ranges = ranges;
+
+    sky_object_scan_range *range = &ranges[scan->skip_range_count];
+    memset(range, 0, sizeof(*range));
+    if(sky_object_scan_copy(&range->start, &range->start_sz, start, start_sz) != 0 ||
+       sky_object_scan_copy(&range->end, &range->end_sz, end, end_sz) != 0)
+    {
+        free(range->start);
+        free(range->end);
+        return -1;
+    }
+    scan->skip_range_count++;
+    return 0;
+}
+
+void sky_object_scan_clear_skip_ranges(sky_object_scan *scan)
+{
+    uint32_t i;
+    for(i=0; i<scan->skip_range_count; i++) {
+        free(scan->skip_ranges[i].start);
+        free(scan->skip_ranges[i].end);
+    }
+    free(scan->skip_ranges);
+    scan->skip_ranges = NULL;
+    scan->skip_range_count = 0;
+    scan->skip_index = 0;
+}
+
+// Sets whether the table has property families whose keys follow the state
+// of each object. The scan seeks past them unless they're added to it.
+void sky_object_scan_set_has_families(sky_object_scan *scan, bool has_families)
+{
+    scan->has_families = has_families;
+}
+
+// Adds a property family whose values are passed on to the cursor with each
+// object. Families must be added in name order.
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_object_scan_add_family(sky_object_scan *scan, const void *name, size_t sz)
+{
+    sky_object_scan_family *families = realloc(scan->families, (scan->family_count + 1) * sizeof(*families));
+    if(families == NULL) return -1;
+    scan->families = families;
+
+    sky_object_scan_family *family = &families[scan->family_count];
+    memset(family, 0, sizeof(*family));
+    if(sky_object_scan_copy(&family->name, &family->sz, name, sz) != 0) {
+        return -1;
+    }
+    scan->family_count++;
+    scan->has_families = true;
+    return 0;
+}
+
+void sky_object_scan_clear_families(sky_object_scan *scan)
+{
+    uint32_t i;
+    for(i=0; i<scan->family_count; i++) {
+        free(scan->families[i].name);
+    }
+    free(scan->families);
+    scan->families = NULL;
+    scan->family_count = 0;
+    scan->has_families = false;
+}
+
+// Sets the number of objects in the ring of a pipelined scan, including the
+// one the cursor is on, so that up to one less are read ahead of the cursor.
+// A depth under two reads objects on the cursor's thread.
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_object_scan_set_pipeline_depth(sky_object_scan *scan, uint32_t depth)
+{
+    sky_object_scan_stop(scan);
+    sky_object_scan_free_slots(scan);
+    if(depth < 2) return 0;
+
+    scan->slots = calloc(depth, sizeof(*scan->slots));
+    if(scan->slots == NULL) return -1;
+    scan->pipeline_depth = depth;
+    return 0;
+}
+
+// Sets the iterator that objects are read from. The iterator is positioned
+// by the caller and is not owned by the scan. The producer of a pipelined
+// scan is stopped first, so the caller can move or free the old iterator
+// afterwards.
+void sky_object_scan_set_iterator(sky_object_scan *scan, leveldb_iterator_t *iterator)
+{
+    sky_object_scan_stop(scan);
+    scan->iterator = iterator;
+    scan->skip_index = 0;
+    scan->finished = false;
+}
+
+// Makes the scan the source of the cursor's objects.
+void sky_cursor_set_object_scan(sky_cursor *cursor, sky_object_scan *scan)
+{
+    cursor->context = scan;
+    cursor->next_object_func = sky_object_scan_next_object;
+}
+
+
+//--------------------------------------
+// Object Iteration
+//--------------------------------------
+
+// Returns the skip range containing a key. Keys are visited in order so
+// ranges that end before the key are dropped.
+static sky_object_scan_range *sky_object_scan_skip_range(sky_object_scan *scan,
+                                                         const char *key, size_t sz)
+{
+    while(scan->skip_index < scan->skip_range_count) {
+        sky_object_scan_range *range = &scan->skip_ranges[scan->skip_index];
+        if(range->end != NULL && sky_object_scan_compare(key, sz, range->end, range->end_sz) >= 0) {
+            scan->skip_index++;
+            continue;
+        }
+        if(sky_object_scan_compare(key, sz, range->start, range->start_sz) >= 0) {
+            return range;
+        }
+        return NULL;
+    }
+    return NULL;
+}
+
+// Splits the index off the front of an event stream. A stream with a
+// malformed index is read in full.
+static void sky_object_scan_split_piece(sky_object_scan_piece *piece,
+                                        const uint8_t *ptr, size_t sz)
+{
+    memset(piece, 0, sizeof(*piece));
+    piece->ptr = ptr;
+    piece->sz = sz;
+
+    size_t n = sky_object_scan_raw_size(ptr, sz);
+    if(n == 0) return;
+    piece->ptr = ptr + n;
+    piece->sz = sz - n;
+
+    // Older indexes have no event count.
+    const uint8_t *index = ptr + sky_object_scan_raw_header_size(ptr);
+    size_t index_sz = n - (index - ptr);
+    size_t header_sz = 0;
+    if(index_sz > 0 && index[0] == SKY_EVENT_INDEX_VERSION) {
+        header_sz = SKY_EVENT_INDEX_HEADER_SIZE;
+    }
+    else if(index_sz > 0 && index[0] == SKY_EVENT_INDEX_V1_VERSION) {
+        header_sz = SKY_EVENT_INDEX_V1_HEADER_SIZE;
+    }
+    if(header_sz == 0 || index_sz < header_sz) {
+        return;
+    }
+    uint32_t entry_count = sky_object_scan_read_uint32(index + 17);
+    if(index_sz != header_sz + ((size_t)entry_count * SKY_EVENT_INDEX_ENTRY_SIZE)) {
+        return;
+    }
+    piece->has_index = true;
+    piece->first_ts = sky_object_scan_read_int64(index + 1);
+    piece->last_ts = sky_object_scan_read_int64(index + 9);
+    piece->entries = index + header_sz;
+    piece->entry_count = entry_count;
+    if(header_sz == SKY_EVENT_INDEX_HEADER_SIZE) {
+        piece->event_count = sky_object_scan_read_uint32(index + 21);
+        piece->has_count = (piece->event_count != SKY_EVENT_INDEX_NO_COUNT);
+    }
+}
+
+// Adds an event stream to the pieces of the current object.
+//
+// Returns 0 if successful, otherwise returns -1.
+static int sky_object_scan_add_piece(sky_object_scan *scan, uint32_t *count,
+                                     const uint8_t *ptr, size_t sz)
+{
+    if(*count == scan->piece_capacity) {
+        uint32_t capacity = (scan->piece_capacity > 0 ? scan->piece_capacity * 2 : 8);
+        sky_object_scan_piece *pieces = realloc(scan->pieces, capacity * sizeof(*pieces));
+        if(pieces == NULL) return -1;
+        scan->pieces = pieces;
+        scan->piece_capacity = capacity;
+    }
+    sky_object_scan_split_piece(&scan->pieces[(*count)++], ptr, sz);
+    return 0;
+}
+
+// Checks whether any event of an indexed piece falls in the cursor's time
+// range. Pieces without an index always may.
+static bool sky_object_scan_piece_overlaps(sky_object_scan_piece *piece, sky_cursor *cursor)
+{
+    return !piece->has_index ||
+           (piece->last_ts >= cursor->min_ts && piece->first_ts < cursor->max_ts);
+}
+
+// Finds the latest checkpoint of an indexed piece at or before a shifted
+// timestamp. A checkpoint has the timestamp of the event after it and
+// starts an index entry.
+//
+// Returns true and sets the checkpoint's offset if the piece has one.
+static bool sky_object_scan_piece_checkpoint(sky_object_scan_piece *piece, int64_t ts,
+                                             size_t *offset)
+{
+    bool found = false;
+    uint32_t i;
+    for(i=0; i<piece->entry_count; i++) {
+        const uint8_t *entry = piece->entries + (i * SKY_EVENT_INDEX_ENTRY_SIZE);
+        if(sky_object_scan_read_int64(entry) > ts) {
+            break;
+        }
+        size_t o = sky_object_scan_read_uint32(entry + 8);
+        if(o < piece->sz && piece->ptr[o] == SKY_EVENT_CHECKPOINT_FLAG) {
+            *offset = o;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Reads the timestamp of the msgpack event at the start of the data and
+// returns its size, or zero if the data doesn't start with an event. Event
+// data maps only hold scalar values.
+static size_t sky_object_scan_event_size(const uint8_t *ptr, const uint8_t *endptr, int64_t *ts)
+{
+    size_t sz;
+    if(endptr - ptr < 3 || ptr[0] != EVENT_FLAG) return 0;
+    const uint8_t *p = ptr + 1;
+    *ts = minipack_unpack_int((void*)p, &sz);
+    if(sz == 0) return 0;
+    p += sz;
+    if(p >= endptr || !minipack_is_map((void*)p)) return 0;
+    uint32_t i, count = minipack_unpack_map((void*)p, &sz);
+    for(p += sz, i=0; i<count*2 && p < endptr; i++) {
+        if(minipack_is_map((void*)p) || minipack_is_array((void*)p)) return 0;
+        sz = minipack_sizeof_elem_and_data((void*)p);
+        if(sz == 0) return 0;
+        p += sz;
+    }
+    return (i < count*2 || p > endptr ? 0 : (size_t)(p - ptr));
+}
+
+// Reads the event count and the last timestamp of the event block at the
+// start of the data and returns its size, or zero if it's malformed. The
+// timestamps of newer blocks are varints that are summed to reach the
+// last one.
+static size_t sky_object_scan_block_size(const uint8_t *ptr, const uint8_t *endptr,
+                                         uint32_t *count, int64_t *last_ts)
+{
+    if(endptr - ptr < SKY_EVENT_BLOCK_HEADER_SZ) return 0;
+    size_t sz = sky_object_scan_read_uint32(ptr + 8);
+    *count = sky_object_scan_read_uint32(ptr + 4);
+    if(*count == 0 || sz < SKY_EVENT_BLOCK_HEADER_SZ || sz > (size_t)(endptr - ptr)) return 0;
+
+    int64_t ts = sky_object_scan_read_int64(ptr + 16);
+    const uint8_t *p = ptr + SKY_EVENT_BLOCK_HEADER_SZ;
+    if(ptr[1] == SKY_EVENT_BLOCK_FIXED_TS_VERSION) {
+        if(SKY_EVENT_BLOCK_HEADER_SZ + ((size_t)*count * 8) > sz) return 0;
+        *last_ts = ts + sky_object_scan_read_int64(p + ((size_t)(*count - 1) * 8));
+        return sz;
+    }
+
+    const uint8_t *ts_endptr = p + sky_object_scan_read_uint32(ptr + 12);
+    if(ts_endptr > ptr + sz) return 0;
+    int64_t delta = 0;
+    uint32_t i;
+    for(i=0; i<*count; i++) {
+        uint64_t bits = 0;
+        uint32_t shift;
+        bool done = false;
+        for(shift=0; shift<64 && p < ts_endptr && !done; shift+=7) {
+            uint8_t byte = *(p++);
+            bits |= (uint64_t)(byte & 0x7F) << shift;
+            done = ((byte & 0x80) == 0);
+        }
+        if(!done) return 0;
+        delta += (int64_t)(bits >> 1) ^ -(int64_t)(bits & 1);
+        ts += delta;
+    }
+    *last_ts = ts;
+    return sz;
+}
+
+// Counts the events of a piece whose index has no count, and reads their
+// first and last timestamps if it has no index, by walking its events,
+// event blocks and checkpoints. Only the timestamps are read.
+//
+// Returns 0 if successful, otherwise returns -1 if the piece is malformed.
+static int sky_object_scan_count_piece(sky_object_scan_piece *piece)
+{
+    const uint8_t *ptr = piece->ptr;
+    const uint8_t *endptr = piece->ptr + piece->sz;
+    uint64_t count = 0;
+    while(ptr < endptr) {
+        bool checkpoint = (ptr[0] == SKY_EVENT_CHECKPOINT_FLAG);
+        if(checkpoint) ptr++;
+
+        int64_t first_ts, last_ts;
+        uint32_t n = 1;
+        size_t sz;
+        if(!checkpoint && ptr[0] == SKY_EVENT_BLOCK_FLAG) {
+            sz = sky_object_scan_block_size(ptr, endptr, &n, &last_ts);
+            first_ts = (sz > 0 ? sky_object_scan_read_int64(ptr + 16) : 0);
+        }
+        else {
+            sz = sky_object_scan_event_size(ptr, endptr, &first_ts);
+            last_ts = first_ts;
+        }
+        if(sz == 0) return -1;
+        ptr += sz;
+        if(checkpoint) continue;
+
+        if(!piece->has_index) {
+            if(count == 0) piece->first_ts = first_ts;
+            piece->last_ts = last_ts;
+        }
+        count += n;
+    }
+    if(count >= SKY_EVENT_INDEX_NO_COUNT) return -1;
+    piece->event_count = (uint32_t)count;
+    piece->has_count = true;
+    return 0;
+}
+
+// Checks whether an object made up of pieces is within the cursor's object
+// bounds. Pieces are in time order so the object spans from the first event
+// of its first piece with events to the last event of its last one. Objects
+// with malformed pieces are passed on for the cursor to report.
+static bool sky_object_scan_in_bounds(sky_cursor *cursor, sky_object_scan_piece *pieces,
+                                      uint32_t piece_count)
+{
+    if(!cursor->has_object_bounds) return true;
+
+    uint64_t count = 0;
+    int64_t first_ts = 0, last_ts = 0;
+    uint32_t i;
+    for(i=0; i<piece_count; i++) {
+        sky_object_scan_piece *piece = &pieces[i];
+        if(piece->sz == 0) continue;
+        if(!piece->has_count && sky_object_scan_count_piece(piece) != 0) return true;
+        if(piece->event_count == 0) continue;
+        if(count == 0) first_ts = piece->first_ts;
+        last_ts = piece->last_ts;
+        count += piece->event_count;
+    }
+    return sky_cursor_object_in_bounds(cursor, count, last_ts - first_ts);
+}
+
+// Reads the state of the object whose head the iterator is on as its single
+// event and leaves the iterator past the object's chunks. Older
+// objects keep their state at the front of their head. The state of newer
+// ones is stored under its own key after their chunks, behind the varint
+// size of their tail.
+//
+// Returns 1 if the object has a state, otherwise returns 0.
+static int sky_object_scan_next_state(sky_object_scan *scan, size_t head_key_sz)
+{
+    leveldb_iterator_t *iterator = scan->iterator;
+    uint8_t *head_key = (uint8_t*)scan->head_key;
+
+    size_t value_sz;
+    const uint8_t *value = (const uint8_t*)leveldb_iter_value(iterator, &value_sz);
+    size_t state_sz = sky_object_scan_raw_size(value, value_sz);
+    const uint8_t *ptr = NULL;
+    size_t sz = 0;
+    if(state_sz > 0) {
+        size_t header_sz = sky_object_scan_raw_header_size(value);
+        ptr = value + header_sz;
+        sz = state_sz - header_sz;
+    }
+
+    // Seek past the chunks rather than reading them.
+    leveldb_iter_next(iterator);
+    size_t key_sz;
+    const uint8_t *key = NULL;
+    if(leveldb_iter_valid(iterator)) {
+        key = (const uint8_t*)leveldb_iter_key(iterator, &key_sz);
+        if(key_sz == head_key_sz + SKY_OBJECT_CHUNK_SUFFIX_SIZE &&
+           key[head_key_sz] == SKY_OBJECT_CHUNK_MARKER &&
+           memcmp(key, head_key, head_key_sz) == 0)
+        {
+            head_key[head_key_sz] = SKY_OBJECT_STATE_MARKER;
+            leveldb_iter_seek(iterator, (const char*)head_key, head_key_sz + 1);
+            key = NULL;
+            if(leveldb_iter_valid(iterator)) {
+                key = (const uint8_t*)leveldb_iter_key(iterator, &key_sz);
+            }
+        }
+    }
+
+    if(sz == 0 && key != NULL && key_sz == head_key_sz + 1 &&
+       key[head_key_sz] == SKY_OBJECT_STATE_MARKER &&
+       memcmp(key, head_key, head_key_sz) == 0)
+    {
+        value = (const uint8_t*)leveldb_iter_value(iterator, &value_sz);
+        size_t i = 0;
+        while(i < value_sz && (value[i] & 0x80)) i++;
+        if(i < value_sz) {
+            ptr = value + i + 1;
+            sz = value_sz - i - 1;
+        }
+    }
+    if(sz == 0) return 0;
+
+    scan->object_ptr = ptr;
+    scan->object_sz = sz;
+    scan->family_stream_count = 0;
+    return 1;
+}
+
+// Reads the streams of the families that the scan reads for the object
+// whose head key is kept by the scan and leaves the iterator past the
+// object's family keys. The values are pinned so they stay valid after
+// seeking.
+//
+// Returns 0 if successful, otherwise returns -1.
+static int sky_object_scan_next_families(sky_object_scan *scan, size_t head_key_sz)
+{
+    leveldb_iterator_t *iterator = scan->iterator;
+    uint32_t i;
+    for(i=0; i<scan->family_count; i++) {
+        sky_object_scan_family *family = &scan->families[i];
+        size_t key_sz = head_key_sz + 1 + family->sz;
+        if(key_sz > scan->head_key_capacity) {
+            void *head_key = realloc(scan->head_key, key_sz);
+            if(head_key == NULL) return -1;
+            scan->head_key = head_key;
+            scan->head_key_capacity = key_sz;
+        }
+        uint8_t *family_key = (uint8_t*)scan->head_key;
+        family_key[head_key_sz] = SKY_OBJECT_FAMILY_MARKER;
+        memcpy(family_key + head_key_sz + 1, family->name, family->sz);
+
+        leveldb_iter_seek(iterator, (const char*)family_key, key_sz);
+        if(!leveldb_iter_valid(iterator)) break;
+        size_t found_sz;
+        const char *found = leveldb_iter_key(iterator, &found_sz);
+        if(found_sz != key_sz || memcmp(found, family_key, key_sz) != 0) {
+            continue;
+        }
+
+        // Drop the empty state and the index in front of the events.
+        size_t value_sz;
+        const uint8_t *value = (const uint8_t*)leveldb_iter_value(iterator, &value_sz);
+        size_t state_sz = sky_object_scan_raw_size(value, value_sz);
+        sky_object_scan_piece piece;
+        sky_object_scan_split_piece(&piece, value + state_sz, value_sz - state_sz);
+        if(piece.sz == 0) continue;
+        if(scan->family_stream_count == scan->family_stream_capacity) {
+            uint32_t capacity = (scan->family_stream_capacity > 0 ? scan->family_stream_capacity * 2 : 4);
+            sky_cursor_family *streams = realloc(scan->family_streams, capacity * sizeof(*streams));
+            if(streams == NULL) return -1;
+            scan->family_streams = streams;
+            scan->family_stream_capacity = capacity;
+        }
+        sky_cursor_family *stream = &scan->family_streams[scan->family_stream_count++];
+        stream->ptr = (void*)piece.ptr;
+        stream->endptr = (void*)(piece.ptr + piece.sz);
+    }
+
+    uint8_t *head_key = (uint8_t*)scan->head_key;
+    head_key[head_key_sz] = SKY_OBJECT_FAMILY_MARKER + 1;
+    leveldb_iter_seek(iterator, (const char*)head_key, head_key_sz + 1);
+    return 0;
+}
+
+// Reads the next object of the scan that the cursor would be pointed at. The
+// object's state and event streams are left in place when it is stored in a
+// single piece and are otherwise stitched into the scan's buffer. Only the
+// cursor's settings are read, so the cursor can be on an earlier object.
+//
+// Returns 1 if an object was read or 0 at the end of the scan.
+static int sky_object_scan_read_object(sky_object_scan *scan, sky_cursor *cursor)
+{
+    leveldb_iterator_t *iterator = scan->iterator;
+    bool next = false;
+    while(true) {
+        if(next) leveldb_iter_next(iterator);
+        next = true;
+        if(!leveldb_iter_valid(iterator)) return 0;
+
+        // Stop at the end of the table or of the scan's key range.
+        size_t key_sz;
+        const char *key = leveldb_iter_key(iterator, &key_sz);
+        if(key_sz < scan->prefix_sz || memcmp(key, scan->prefix, scan->prefix_sz) != 0) {
+            return 0;
+        }
+        if(scan->end_key != NULL && sky_object_scan_compare(key, key_sz, scan->end_key, scan->end_key_sz) >= 0) {
+            return 0;
+        }
+
+        // Seek past key ranges that can't match the query.
+        sky_object_scan_range *range = sky_object_scan_skip_range(scan, key, key_sz);
+        if(range != NULL) {
+            if(range->end == NULL) return 0;
+            leveldb_iter_seek(iterator, range->end, range->end_sz);
+            next = false;
+            continue;
+        }
+
+        // Skip the chunks and states of objects whose head is outside of the
+        // key range.
+        size_t object_key_sz = sky_object_scan_raw_size((const uint8_t*)key + scan->prefix_sz, key_sz - scan->prefix_sz);
+        if(object_key_sz == 0 || scan->prefix_sz + object_key_sz != key_sz) {
+            continue;
+        }
+
+        // Objects outside of the sample or the members are passed over
+        // before their value is read. Their chunks are skipped as heads
+        // without objects.
+        if(!sky_cursor_sample_key(cursor, key, key_sz) || !sky_cursor_member_key(cursor, key, key_sz)) {
+            continue;
+        }
+
+        // Keys are only valid until the iterator moves so keep the head key
+        // to match chunks against. It has room for the state marker.
+        if(key_sz + 1 > scan->head_key_capacity) {
+            void *head_key = realloc(scan->head_key, key_sz + 1);
+            if(head_key == NULL) return 0;
+            scan->head_key = head_key;
+            scan->head_key_capacity = key_sz + 1;
+        }
+        memcpy(scan->head_key, key, key_sz);
+        size_t head_key_sz = key_sz;
+        scan->object_key_sz = head_key_sz;
+
+        if(cursor->state_only) {
+            if(sky_object_scan_next_state(scan, head_key_sz)) return 1;
+            next = false;
+            continue;
+        }
+
+        // Collect the tail and any chunks that follow the head. Chunks come
+        // first since they hold the older events. The loop stops on the
+        // entry after the object, which is read again at the top.
+        size_t value_sz;
+        const uint8_t *value = (const uint8_t*)leveldb_iter_value(iterator, &value_sz);
+        size_t state_sz = sky_object_scan_raw_size(value, value_sz);
+        uint32_t piece_count = 0;
+        while(true) {
+            leveldb_iter_next(iterator);
+            if(!leveldb_iter_valid(iterator)) break;
+
+            size_t chunk_key_sz, chunk_sz;
+            const char *chunk_key = leveldb_iter_key(iterator, &chunk_key_sz);
+            if(chunk_key_sz != head_key_sz + SKY_OBJECT_CHUNK_SUFFIX_SIZE ||
+               (uint8_t)chunk_key[head_key_sz] != SKY_OBJECT_CHUNK_MARKER ||
+               memcmp(chunk_key, scan->head_key, head_key_sz) != 0)
+            {
+                break;
+            }
+            const uint8_t *chunk = (const uint8_t*)leveldb_iter_value(iterator, &chunk_sz);
+            if(sky_object_scan_add_piece(scan, &piece_count, chunk, chunk_sz) != 0) return 0;
+        }
+        next = false;
+        if(sky_object_scan_add_piece(scan, &piece_count, value + state_sz, value_sz - state_sz) != 0) return 0;
+
+        // Skip objects outside of the cursor's object bounds before any of
+        // their events are read.
+        if(!sky_object_scan_in_bounds(cursor, scan->pieces, piece_count)) continue;
+
+        // Use the indices to drop the parts of the object after the time
+        // range and to start from the latest checkpoint at its start, so that
+        // the permanent values are set without reading the events before
+        // the checkpoint. Objects without one are read from their first
+        // event. Objects outside of the range are skipped entirely.
+        if(cursor->has_time_range) {
+            uint32_t i, first, start, selected = 0;
+            for(first=0; first<piece_count; first++) {
+                if(scan->pieces[first].sz > 0 && sky_object_scan_piece_overlaps(&scan->pieces[first], cursor)) break;
+            }
+            if(first == piece_count) continue;
+
+            size_t offset = 0;
+            start = first;
+            while(!sky_object_scan_piece_checkpoint(&scan->pieces[start], cursor->min_ts, &offset) && start > 0) {
+                start--;
+            }
+            for(i=start; i<piece_count; i++) {
+                sky_object_scan_piece piece = scan->pieces[i];
+                if(piece.sz == 0) continue;
+                if(i > first && !sky_object_scan_piece_overlaps(&piece, cursor)) continue;
+                if(i == start) {
+                    piece.ptr += offset;
+                    piece.sz -= offset;
+                }
+                scan->pieces[selected++] = piece;
+            }
+            piece_count = selected;
+        }
+
+        // Stitch the pieces in between the state and the events so the
+        // cursor sees a single event stream.
+        const uint8_t *ptr = value;
+        size_t sz = value_sz;
+        if(piece_count > 1 || cursor->has_time_range) {
+            uint32_t i;
+            sz = state_sz;
+            for(i=0; i<piece_count; i++) {
+                sz += scan->pieces[i].sz;
+            }
+            if(sz > scan->buffer_capacity) {
+                void *buffer = realloc(scan->buffer, sz);
+                if(buffer == NULL) return 0;
+                scan->buffer = buffer;
+                scan->buffer_capacity = sz;
+            }
+            uint8_t *dest = (uint8_t*)scan->buffer;
+            memcpy(dest, value, state_sz);
+            dest += state_sz;
+            for(i=0; i<piece_count; i++) {
+                memcpy(dest, scan->pieces[i].ptr, scan->pieces[i].sz);
+                dest += scan->pieces[i].sz;
+            }
+            ptr = (const uint8_t*)scan->buffer;
+        }
+        if(sz == 0) continue;
+
+        scan->object_ptr = ptr;
+        scan->object_sz = sz;
+        scan->family_stream_count = 0;
+        if(scan->has_families && sky_object_scan_next_families(scan, head_key_sz) != 0) {
+            return 0;
+        }
+        return 1;
+    }
+}
+
+// Points the cursor at the object that the scan read last, in place.
+//
+// Returns 1 if successful, otherwise returns 0.
+static int sky_object_scan_point_cursor(sky_object_scan *scan, sky_cursor *cursor)
+{
+    sky_cursor_set_object_key(cursor, scan->head_key, scan->object_key_sz);
+    sky_cursor_set_ptr(cursor, (void*)scan->object_ptr, scan->object_sz);
+    uint32_t i;
+    for(i=0; i<scan->family_stream_count; i++) {
+        sky_cursor_family *stream = &scan->family_streams[i];
+        size_t sz = (uint8_t*)stream->endptr - (uint8_t*)stream->ptr;
+        if(sky_cursor_add_family(cursor, stream->ptr, sz) != 0) return 0;
+    }
+    return 1;
+}
+
+
+// Moves the cursor to the next object of the scan. Objects are read on the
+// cursor's thread unless the scan is pipelined, in which case its producer
+// is started by the first call.
+//
+// Returns 1 if the cursor is on a new object or 0 at the end of the scan.
+int sky_object_scan_next_object(void *_cursor)
+{
+    sky_cursor *cursor = (sky_cursor*)_cursor;
+    sky_object_scan *scan = (sky_object_scan*)cursor->context;
+    if(scan->iterator == NULL || scan->finished) return 0;
+
+    // A scan whose producer can't be started reads the object itself and
+    // tries again for the next one.
+    if(scan->pipeline_depth > 0 && (scan->running || sky_object_scan_start(scan, cursor) == 0)) {
+        return sky_object_scan_next_pipelined(scan, cursor);
+    }
+
+    // The cursor is done with the previous object so the blocks it was
+    // read from can be dropped.
+    leveldb_iter_release_pinned_data(scan->iterator);
+    if(!sky_object_scan_read_object(scan, cursor)) return 0;
+    return sky_object_scan_point_cursor(scan, cursor);
+}
+
+
+//--------------------------------------
+// Pipelining
+//--------------------------------------
+
+// Copies the object that the scan read last into a slot of the ring.
+//
+// Returns 0 if successful, otherwise returns -1.
+static int sky_object_scan_fill_slot(sky_object_scan *scan, sky_object_scan_slot *slot)
+{
+    uint32_t i;
+    size_t sz = scan->object_key_sz + scan->object_sz;
+    for(i=0; i<scan->family_stream_count; i++) {
+        sz += (uint8_t*)scan->family_streams[i].endptr - (uint8_t*)scan->family_streams[i].ptr;
+    }
+    if(sz > slot->buffer_capacity) {
+        uint8_t *buffer = realloc(slot->buffer, sz);
+        if(buffer == NULL) return -1;
+        slot->buffer = buffer;
+        slot->buffer_capacity = sz;
+    }
+    if(scan->family_stream_count > slot->family_capacity) {
+        size_t *szs = realloc(slot->family_szs, scan->family_stream_count * sizeof(*szs));
+        if(szs == NULL) return -1;
+        slot->family_szs = szs;
+        slot->family_capacity = scan->family_stream_count;
+    }
+
+    uint8_t *dest = slot->buffer;
+    memcpy(dest, scan->head_key, scan->object_key_sz);
+    dest += scan->object_key_sz;
+    memcpy(dest, scan->object_ptr, scan->object_sz);
+    dest += scan->object_sz;
+    for(i=0; i<scan->family_stream_count; i++) {
+        size_t n = (uint8_t*)scan->family_streams[i].endptr - (uint8_t*)scan->family_streams[i].ptr;
+        memcpy(dest, scan->family_streams[i].ptr, n);
+        dest += n;
+        slot->family_szs[i] = n;
+    }
+    slot->key_sz = scan->object_key_sz;
+    slot->sz = scan->object_sz;
+    slot->family_count = scan->family_stream_count;
+    return 0;
+}
+
+// Wakes the other side of the ring if it flagged that it's waiting. The flag
+// is set before the waiter checks the ring one last time, so either it sees
+// the change or its flag is seen here.
+static void sky_object_scan_wake(sky_object_scan *scan, bool *waiting)
+{
+    if(__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&scan->mutex);
+        pthread_cond_signal(&scan->cond);
+        pthread_mutex_unlock(&scan->mutex);
+    }
+}
+
+// Checks whether the producer has a free slot to fill.
+static inline bool sky_object_scan_has_free_slot(sky_object_scan *scan)
+{
+    return scan->produced - __atomic_load_n(&scan->consumed, __ATOMIC_SEQ_CST) < scan->pipeline_depth;
+}
+
+// Waits until the ring has a free slot.
+//
+// Returns true if the producer can go on or false if the scan is stopping.
+static bool sky_object_scan_wait_for_slot(sky_object_scan *scan)
+{
+    uint32_t i;
+    for(i=0; i<SKY_OBJECT_SCAN_SPIN_COUNT; i++) {
+        if(__atomic_load_n(&scan->stopping, __ATOMIC_SEQ_CST)) return false;
+        if(sky_object_scan_has_free_slot(scan)) return true;
+        sky_object_scan_relax();
+    }
+
+    pthread_mutex_lock(&scan->mutex);
+    __atomic_store_n(&scan->producer_waiting, true, __ATOMIC_SEQ_CST);
+    while(!__atomic_load_n(&scan->stopping, __ATOMIC_SEQ_CST) && !sky_object_scan_has_free_slot(scan)) {
+        pthread_cond_wait(&scan->cond, &scan->mutex);
+    }
+    __atomic_store_n(&scan->producer_waiting, false, __ATOMIC_SEQ_CST);
+    bool stopping = __atomic_load_n(&scan->stopping, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&scan->mutex);
+    return !stopping;
+}
+
+// Reads objects into the ring until the end of the scan or until the scan
+// is stopped. The pins of each object are released once it's copied.
+static void *sky_object_scan_produce(void *arg)
+{
+    sky_object_scan *scan = (sky_object_scan*)arg;
+    sky_cursor *cursor = scan->pipeline_cursor;
+    while(sky_object_scan_wait_for_slot(scan)) {
+        sky_object_scan_slot *slot = &scan->slots[scan->produced % scan->pipeline_depth];
+        int rc = sky_object_scan_read_object(scan, cursor);
+        if(rc) rc = (sky_object_scan_fill_slot(scan, slot) == 0);
+        leveldb_iter_release_pinned_data(scan->iterator);
+        if(!rc) break;
+        __atomic_store_n(&scan->produced, scan->produced + 1, __ATOMIC_SEQ_CST);
+        sky_object_scan_wake(scan, &scan->consumer_waiting);
+    }
+    __atomic_store_n(&scan->produced_all, true, __ATOMIC_SEQ_CST);
+    sky_object_scan_wake(scan, &scan->consumer_waiting);
+    return NULL;
+}
+
+// Checks whether the producer has filled the slot after the ones the cursor
+// has consumed.
+static inline bool sky_object_scan_has_object(sky_object_scan *scan)
+{
+    return __atomic_load_n(&scan->produced, __ATOMIC_SEQ_CST) > scan->consumed;
+}
+
+// Waits until the producer has filled the next slot.
+//
+// Returns true if it has or false if the producer read every object.
+static bool sky_object_scan_wait_for_object(sky_object_scan *scan)
+{
+    uint32_t i;
+    for(i=0; i<SKY_OBJECT_SCAN_SPIN_COUNT; i++) {
+        if(sky_object_scan_has_object(scan)) return true;
+        if(__atomic_load_n(&scan->produced_all, __ATOMIC_SEQ_CST)) {
+            return sky_object_scan_has_object(scan);
+        }
+        sky_object_scan_relax();
+    }
+
+    pthread_mutex_lock(&scan->mutex);
+    __atomic_store_n(&scan->consumer_waiting, true, __ATOMIC_SEQ_CST);
+    while(!sky_object_scan_has_object(scan) && !__atomic_load_n(&scan->produced_all, __ATOMIC_SEQ_CST)) {
+        pthread_cond_wait(&scan->cond, &scan->mutex);
+    }
+    __atomic_store_n(&scan->consumer_waiting, false, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&scan->mutex);
+    return sky_object_scan_has_object(scan);
+}
+
+// Starts the producer of a pipelined scan at the iterator's position.
+//
+// Returns 0 if successful, otherwise returns -1.
+static int sky_object_scan_start(sky_object_scan *scan, sky_cursor *cursor)
+{
+    scan->pipeline_cursor = cursor;
+    if(pthread_create(&scan->thread, NULL, sky_object_scan_produce, scan) != 0) {
+        return -1;
+    }
+    scan->running = true;
+    return 0;
+}
+
+// Stops the producer of a pipelined scan, waits for it to exit and empties
+// the ring. The iterator is left wherever the producer stopped.
+static void sky_object_scan_stop(sky_object_scan *scan)
+{
+    if(scan->running) {
+        pthread_mutex_lock(&scan->mutex);
+        __atomic_store_n(&scan->stopping, true, __ATOMIC_SEQ_CST);
+        pthread_cond_broadcast(&scan->cond);
+        pthread_mutex_unlock(&scan->mutex);
+        pthread_join(scan->thread, NULL);
+        scan->running = false;
+    }
+    scan->stopping = false;
+    scan->produced_all = false;
+    scan->produced = 0;
+    scan->consumed = 0;
+    scan->holding = false;
+}
+
+// Moves the cursor to the next object of a pipelined scan, handing the slot
+// of the previous object back to the producer, and prefetches the start of
+// the object after it if it's been read.
+//
+// Returns 1 if the cursor is on a new object or 0 at the end of the scan.
+static int sky_object_scan_next_pipelined(sky_object_scan *scan, sky_cursor *cursor)
+{
+    if(scan->holding) {
+        scan->holding = false;
+        __atomic_store_n(&scan->consumed, scan->consumed + 1, __ATOMIC_SEQ_CST);
+        sky_object_scan_wake(scan, &scan->producer_waiting);
+    }
+    if(!sky_object_scan_wait_for_object(scan)) {
+        sky_object_scan_stop(scan);
+        scan->finished = true;
+        return 0;
+    }
+
+    sky_object_scan_slot *slot = &scan->slots[scan->consumed % scan->pipeline_depth];
+    uint8_t *ptr = slot->buffer;
+    scan->holding = true;
+    sky_cursor_set_object_key(cursor, ptr, slot->key_sz);
+    ptr += slot->key_sz;
+    sky_cursor_set_ptr(cursor, ptr, slot->sz);
+    ptr += slot->sz;
+    uint32_t i;
+    for(i=0; i<slot->family_count; i++) {
+        if(sky_cursor_add_family(cursor, ptr, slot->family_szs[i]) != 0) {
+            sky_object_scan_stop(scan);
+            scan->finished = true;
+            return 0;
+        }
+        ptr += slot->family_szs[i];
+    }
+
+    if(__atomic_load_n(&scan->produced, __ATOMIC_SEQ_CST) > scan->consumed + 1) {
+        sky_object_scan_slot *next = &scan->slots[(scan->consumed + 1) % scan->pipeline_depth];
+        size_t sz = next->key_sz + next->sz;
+        if(sz > SKY_OBJECT_SCAN_PREFETCH_SZ) sz = SKY_OBJECT_SCAN_PREFETCH_SZ;
+        size_t offset;
+        for(offset=0; offset<sz; offset+=64) {
+            __builtin_prefetch(next->buffer + offset);
+        }
+    }
+    return 1;
+}
+
+
+//--------------------------------------
+// Frozen Scans
+//--------------------------------------
+
+sky_frozen_scan *sky_frozen_scan_new()
+{
+    return calloc(1, sizeof(sky_frozen_scan));
+}
+
+void sky_frozen_scan_free(sky_frozen_scan *scan)
+{
+    free(scan);
+}
+
+// Sets the objects [first, end) of a frozen file's index to be scanned. The
+// file's memory is not owned by the scan and must outlive it.
+void sky_frozen_scan_set_range(sky_frozen_scan *scan,
+                               const void *data, const void *index,
+                               uint32_t first, uint32_t end)
+{
+    scan->data = (const uint8_t*)data;
+    scan->index = (const uint8_t*)index;
+    scan->keys = NULL;
+    scan->keys_sz = 0;
+    scan->count = 0;
+    scan->next = first;
+    scan->end = end;
+}
+
+// Sets the keys section of the frozen file whose range is scanned, along
+// with the number of objects in the whole file, so that objects can be
+// sampled by key. Without keys every object is passed on. This must be set
+// after the range.
+void sky_frozen_scan_set_keys(sky_frozen_scan *scan,
+                              const void *keys, size_t sz, uint32_t count)
+{
+    scan->keys = (const uint8_t*)keys;
+    scan->keys_sz = sz;
+    scan->count = count;
+}
+
+// Returns the key of the object at an index position, or NULL if the scan
+// has no keys. Each key runs up to the next object's key.
+static const uint8_t *sky_frozen_scan_key(sky_frozen_scan *scan, const uint8_t *entry,
+                                          uint32_t position, size_t *sz)
+{
+    if(scan->keys == NULL) return NULL;
+
+    size_t start = sky_object_scan_read_uint32(entry + 12);
+    size_t end = scan->keys_sz;
+    if(position + 1 < scan->count) {
+        end = sky_object_scan_read_uint32(entry + SKY_FROZEN_INDEX_ENTRY_SIZE + 12);
+    }
+    if(start > end || end > scan->keys_sz) return NULL;
+    *sz = end - start;
+    return scan->keys + start;
+}
+
+// Makes the frozen scan the source of the cursor's objects.
+void sky_cursor_set_frozen_scan(sky_cursor *cursor, sky_frozen_scan *scan)
+{
+    cursor->context = scan;
+    cursor->next_object_func = sky_frozen_scan_next_object;
+}
+
+// Moves the cursor to the next object of a frozen scan.
+//
+// Returns 1 if the cursor is on a new object or 0 at the end of the range.
+int sky_frozen_scan_next_object(void *_cursor)
+{
+    sky_cursor *cursor = (sky_cursor*)_cursor;
+    sky_frozen_scan *scan = (sky_frozen_scan*)cursor->context;
+
+    while(scan->next < scan->end) {
+        const uint8_t *entry = scan->index + ((size_t)scan->next * SKY_FROZEN_INDEX_ENTRY_SIZE);
+        uint32_t position = scan->next++;
+        uint64_t offset = (uint64_t)sky_object_scan_read_uint32(entry) |
+                          ((uint64_t)sky_object_scan_read_uint32(entry + 4) << 32);
+        size_t sz = sky_object_scan_read_uint32(entry + 8);
+        const uint8_t *ptr = scan->data + offset;
+        if(sz == 0) continue;
+
+        // Objects outside of the sample or the members are skipped by their
+        // key. Every object is passed on when the file has no keys.
+        size_t key_sz = 0;
+        const uint8_t *key = sky_frozen_scan_key(scan, entry, position, &key_sz);
+        if(key != NULL && (!sky_cursor_sample_key(cursor, key, key_sz) || !sky_cursor_member_key(cursor, key, key_sz))) {
+            continue;
+        }
+        sky_cursor_set_object_key(cursor, key, key_sz);
+
+        // Frozen objects keep their state at their front.
+        if(cursor->state_only) {
+            size_t state_sz = sky_object_scan_raw_size(ptr, sz);
+            size_t header_sz = (state_sz > 0 ? sky_object_scan_raw_header_size(ptr) : 0);
+            if(state_sz <= header_sz) continue;
+            sky_cursor_set_ptr(cursor, (void*)(ptr + header_sz), state_sz - header_sz);
+            return 1;
+        }
+
+        // Skip objects whose events are all outside of the time range or
+        // that are outside of the object bounds.
+        if(cursor->has_time_range || cursor->has_object_bounds) {
+            size_t state_sz = sky_object_scan_raw_size(ptr, sz);
+            sky_object_scan_piece piece;
+            sky_object_scan_split_piece(&piece, ptr + state_sz, sz - state_sz);
+            if(cursor->has_time_range && !sky_object_scan_piece_overlaps(&piece, cursor)) {
+                continue;
+            }
+            if(!sky_object_scan_in_bounds(cursor, &piece, 1)) {
+                continue;
+            }
+        }
+
+        sky_cursor_set_ptr(cursor, (void*)ptr, sz);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,280 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sky/sketch.h"
+
+//==============================================================================
+//
+// Functions
+//
+//==============================================================================
+
+//--------------------------------------
+// Utility
+//--------------------------------------
+
+// Reads and writes unaligned little endian integers.
+static inline uint32_t sky_sketch_read_uint32(const uint8_t *ptr)
+{
+    return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) |
+           ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static inline void sky_sketch_write_uint32(uint8_t *ptr, uint32_t value)
+{
+    ptr[0] = (uint8_t)value;
+    ptr[1] = (uint8_t)(value >> 8);
+    ptr[2] = (uint8_t)(value >> 16);
+    ptr[3] = (uint8_t)(value >> 24);
+}
+
+static inline uint64_t sky_sketch_read_uint64(const uint8_t *ptr)
+{
+    return (uint64_t)sky_sketch_read_uint32(ptr) | ((uint64_t)sky_sketch_read_uint32(ptr + 4) << 32);
+}
+
+static inline void sky_sketch_write_uint64(uint8_t *ptr, uint64_t value)
+{
+    sky_sketch_write_uint32(ptr, (uint32_t)value);
+    sky_sketch_write_uint32(ptr + 4, (uint32_t)(value >> 32));
+}
+
+static inline double sky_sketch_read_double(const uint8_t *ptr)
+{
+    double value;
+    uint64_t bits = sky_sketch_read_uint64(ptr);
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline void sky_sketch_write_double(uint8_t *ptr, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    sky_sketch_write_uint64(ptr, bits);
+}
+
+// Mixes the bits of a 64-bit value so that similar inputs hash far apart.
+static inline uint64_t sky_sketch_mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+
+//--------------------------------------
+// Sketches
+//--------------------------------------
+
+// Returns the size of a sketch of a given type or zero if the type is
+// unknown.
+uint32_t sky_sketch_type_sz(uint8_t type)
+{
+    switch(type) {
+        case SKY_SKETCH_TYPE_HLL: return SKY_HLL_SZ;
+        case SKY_SKETCH_TYPE_QUANTILE: return SKY_QUANTILE_SZ;
+    }
+    return 0;
+}
+
+// Returns the size of a sketch from its header or zero if it isn't a valid
+// sketch.
+uint32_t sky_sketch_sz(const void *sketch)
+{
+    const uint8_t *ptr = (const uint8_t*)sketch;
+    if(ptr == NULL || ptr[1] != SKY_SKETCH_VERSION) {
+        return 0;
+    }
+    if(ptr[0] == SKY_SKETCH_TYPE_HISTOGRAM) {
+        return sky_histogram_sz(sky_sketch_read_uint32(ptr + SKY_SKETCH_HEADER_SZ));
+    }
+    return sky_sketch_type_sz(ptr[0]);
+}
+
+// Initializes an empty sketch. The sketch must be at least the size of its
+// type.
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_sketch_init(void *sketch, uint8_t type)
+{
+    uint32_t sz = sky_sketch_type_sz(type);
+    if(sz == 0) {
+        return -1;
+    }
+    memset(sketch, 0, sz);
+    ((uint8_t*)sketch)[0] = type;
+    ((uint8_t*)sketch)[1] = SKY_SKETCH_VERSION;
+    return 0;
+}
+
+// Merges one sketch into another of the same type. Histograms must also
+// have the same range and bucket count.
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_sketch_merge(void *dest, const void *src)
+{
+    uint8_t *d = (uint8_t*)dest;
+    const uint8_t *s = (const uint8_t*)src;
+    if(sky_sketch_sz(dest) == 0 || d[0] != s[0] || d[1] != s[1]) {
+        return -1;
+    }
+    if(d[0] == SKY_SKETCH_TYPE_HISTOGRAM && memcmp(d, s, SKY_HISTOGRAM_HEADER_SZ) != 0) {
+        return -1;
+    }
+
+    uint32_t i;
+    switch(d[0]) {
+        case SKY_SKETCH_TYPE_HLL: {
+            for(i=SKY_SKETCH_HEADER_SZ; i<SKY_HLL_SZ; i++) {
+                if(s[i] > d[i]) d[i] = s[i];
+            }
+            break;
+        }
+        case SKY_SKETCH_TYPE_QUANTILE: {
+            uint8_t *ptr = d + SKY_SKETCH_HEADER_SZ;
+            sky_sketch_write_uint64(ptr, sky_sketch_read_uint64(ptr) + sky_sketch_read_uint64(s + SKY_SKETCH_HEADER_SZ));
+            for(i=SKY_SKETCH_HEADER_SZ+8; i<SKY_QUANTILE_SZ; i+=4) {
+                uint64_t count = (uint64_t)sky_sketch_read_uint32(d + i) + sky_sketch_read_uint32(s + i);
+                sky_sketch_write_uint32(d + i, (count > UINT32_MAX ? UINT32_MAX : (uint32_t)count));
+            }
+            break;
+        }
+        case SKY_SKETCH_TYPE_HISTOGRAM: {
+            uint32_t sz = sky_sketch_sz(dest);
+            for(i=SKY_HISTOGRAM_HEADER_SZ; i<sz; i+=4) {
+                uint64_t count = (uint64_t)sky_sketch_read_uint32(d + i) + sky_sketch_read_uint32(s + i);
+                sky_sketch_write_uint32(d + i, (count > UINT32_MAX ? UINT32_MAX : (uint32_t)count));
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+
+//--------------------------------------
+// HyperLogLog
+//--------------------------------------
+
+// Adds a hashed value to a HyperLogLog sketch. The top bits of the hash
+// select the register and the register keeps the longest run of leading
+// zeros seen in the rest.
+static void sky_hll_add_hash(void *sketch, uint64_t hash)
+{
+    uint8_t *registers = (uint8_t*)sketch + SKY_SKETCH_HEADER_SZ;
+    uint32_t index = (uint32_t)(hash >> (64 - SKY_HLL_PRECISION));
+    uint64_t rest = (hash << SKY_HLL_PRECISION) | (1ULL << (SKY_HLL_PRECISION - 1));
+    uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+    if(rank > registers[index]) {
+        registers[index] = rank;
+    }
+}
+
+// Adds a number to a HyperLogLog sketch. Negative zero is counted as zero.
+void sky_hll_add_double(void *sketch, double value)
+{
+    uint64_t bits;
+    if(value == 0) value = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    sky_hll_add_hash(sketch, sky_sketch_mix(bits));
+}
+
+// Adds a string to a HyperLogLog sketch.
+void sky_hll_add_string(void *sketch, const char *value, int32_t length)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    int32_t i;
+    for(i=0; i<length; i++) {
+        hash ^= (uint8_t)value[i];
+        hash *= 0x100000001B3ULL;
+    }
+    sky_hll_add_hash(sketch, sky_sketch_mix(hash));
+}
+
+
+//--------------------------------------
+// Quantiles
+//--------------------------------------
+
+// Adds a number to a quantile sketch. NaN values are ignored.
+void sky_quantile_add(void *sketch, double value)
+{
+    uint8_t *ptr = (uint8_t*)sketch + SKY_SKETCH_HEADER_SZ;
+    if(isnan(value)) {
+        return;
+    }
+    if(value == 0) {
+        sky_sketch_write_uint64(ptr, sky_sketch_read_uint64(ptr) + 1);
+        return;
+    }
+
+    // Find the bucket for the value's magnitude.
+    double index = ceil(log(fabs(value)) / SKY_QUANTILE_LOG_GAMMA) + (SKY_QUANTILE_BUCKET_COUNT / 2);
+    uint32_t bucket = (index < 0 ? 0 : (index >= SKY_QUANTILE_BUCKET_COUNT ? SKY_QUANTILE_BUCKET_COUNT - 1 : (uint32_t)index));
+
+    uint8_t *counts = ptr + 8 + (value < 0 ? 0 : 4 * SKY_QUANTILE_BUCKET_COUNT);
+    uint32_t count = sky_sketch_read_uint32(counts + (4 * bucket));
+    if(count < UINT32_MAX) {
+        sky_sketch_write_uint32(counts + (4 * bucket), count + 1);
+    }
+}
+
+
+//--------------------------------------
+// Histograms
+//--------------------------------------
+
+// Returns the size of a histogram with a given number of buckets or zero if
+// the bucket count isn't supported.
+uint32_t sky_histogram_sz(uint32_t buckets)
+{
+    if(buckets == 0 || buckets > SKY_HISTOGRAM_MAX_BUCKETS) {
+        return 0;
+    }
+    return SKY_HISTOGRAM_SZ(buckets);
+}
+
+// Initializes an empty histogram over [min, max). The sketch must be at
+// least the size returned by sky_histogram_sz().
+//
+// Returns 0 if successful, otherwise returns -1.
+int sky_histogram_init(void *sketch, double min, double max, uint32_t buckets)
+{
+    uint32_t sz = sky_histogram_sz(buckets);
+    if(sz == 0 || !(min < max) || isinf(min) || isinf(max)) {
+        return -1;
+    }
+    uint8_t *ptr = (uint8_t*)sketch;
+    memset(ptr, 0, sz);
+    ptr[0] = SKY_SKETCH_TYPE_HISTOGRAM;
+    ptr[1] = SKY_SKETCH_VERSION;
+    sky_sketch_write_uint32(ptr + SKY_SKETCH_HEADER_SZ, buckets);
+    sky_sketch_write_double(ptr + SKY_SKETCH_HEADER_SZ + 4, min);
+    sky_sketch_write_double(ptr + SKY_SKETCH_HEADER_SZ + 12, max);
+    return 0;
+}
+
+// Adds a number to a histogram. NaN values are ignored.
+void sky_histogram_add(void *sketch, double value)
+{
+    uint8_t *ptr = (uint8_t*)sketch;
+    if(isnan(value)) {
+        return;
+    }
+    uint32_t buckets = sky_sketch_read_uint32(ptr + SKY_SKETCH_HEADER_SZ);
+    double min = sky_sketch_read_double(ptr + SKY_SKETCH_HEADER_SZ + 4);
+    double max = sky_sketch_read_double(ptr + SKY_SKETCH_HEADER_SZ + 12);
+
+    double index = floor((value - min) / (max - min) * buckets);
+    uint32_t bucket = (index < 0 ? 0 : (index >= buckets ? buckets - 1 : (uint32_t)index));
+
+    uint8_t *counts = ptr + SKY_HISTOGRAM_HEADER_SZ;
+    uint32_t count = sky_sketch_read_uint32(counts + (4 * bucket));
+    if(count < UINT32_MAX) {
+        sky_sketch_write_uint32(counts + (4 * bucket), count + 1);
+    }
+}
@@ -1,5 +1,7 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "sky/timestamp.h"
 
@@ -68,3 +70,44 @@ int64_t sky_timestamp_to_seconds(int64_t value)
     return (value >> SECONDS_BIT_OFFSET);
 }
 
+
+
+//--------------------------------------
+// Bucketing
+//--------------------------------------
+
+// Rounds a bit-shifted Sky timestamp down to the start of its time bucket
+// so that events can be grouped by hour, day or week. Buckets are counted
+// from an offset from the epoch, such as a Monday for weeks, and times
+// before the epoch fall into the buckets before it.
+//
+// value    - Sky timestamp.
+// interval - The length of a bucket in seconds.
+// offset   - The start of any one bucket in seconds since the epoch.
+//
+// Returns the start of the bucket in seconds since the Unix epoch.
+int64_t sky_timestamp_bucket(int64_t value, int64_t interval, int64_t offset)
+{
+    int64_t sec = sky_timestamp_to_seconds(value) - offset;
+    int64_t mod = sec % interval;
+    if(mod < 0) {
+        mod += interval;
+    }
+    return sec - mod + offset;
+}
+
+
+//--------------------------------------
+// Clock
+//--------------------------------------
+
+// Reads the monotonic clock for timing generated query code. It's returned
+// as a double so that Lua can add up differences without boxing them.
+//
+// Returns the nanoseconds since an arbitrary point in the past.
+double sky_clock_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
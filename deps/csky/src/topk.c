@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include "sky/topk.h"
+
+//==============================================================================
+//
+// Forward Declarations
+//
+//==============================================================================
+
+static void sky_topk_sift_up(sky_topk *topk, uint32_t index);
+
+static void sky_topk_sift_down(sky_topk *topk, uint32_t index);
+
+
+//==============================================================================
+//
+// Functions
+//
+//==============================================================================
+
+//--------------------------------------
+// Lifecycle
+//--------------------------------------
+
+// Creates a top-k with a fixed number of slots. Returns NULL if the
+// capacity is zero or memory cannot be allocated.
+sky_topk *sky_topk_new(uint32_t capacity)
+{
+    if(capacity == 0) return NULL;
+
+    sky_topk *topk = calloc(1, sizeof(sky_topk));
+    if(topk == NULL) return NULL;
+    topk->capacity = capacity;
+    topk->weights = calloc(capacity, sizeof(*topk->weights));
+    topk->heap = calloc(capacity, sizeof(*topk->heap));
+    topk->positions = calloc(capacity, sizeof(*topk->positions));
+    if(topk->weights == NULL || topk->heap == NULL || topk->positions == NULL) {
+        sky_topk_free(topk);
+        return NULL;
+    }
+    return topk;
+}
+
+void sky_topk_free(sky_topk *topk)
+{
+    if(topk) {
+        free(topk->weights);
+        free(topk->heap);
+        free(topk->positions);
+        free(topk);
+    }
+}
+
+
+//--------------------------------------
+// Weights
+//--------------------------------------
+
+// Assigns a slot to a key that isn't being tracked and adds its weight. A
+// free slot is used until the top-k is full. After that the lightest slot
+// is returned and the caller must drop the key that previously held it.
+uint32_t sky_topk_insert(sky_topk *topk, double weight)
+{
+    if(topk->count < topk->capacity) {
+        uint32_t slot = topk->count++;
+        topk->weights[slot] = weight;
+        topk->heap[slot] = slot;
+        topk->positions[slot] = slot;
+        sky_topk_sift_up(topk, slot);
+        return slot;
+    }
+
+    uint32_t slot = topk->heap[0];
+    sky_topk_add(topk, slot, weight);
+    return slot;
+}
+
+// Adds weight to a slot that is already assigned.
+void sky_topk_add(sky_topk *topk, uint32_t slot, double weight)
+{
+    if(slot >= topk->count) return;
+    topk->weights[slot] += weight;
+    if(weight < 0) {
+        sky_topk_sift_up(topk, topk->positions[slot]);
+    } else {
+        sky_topk_sift_down(topk, topk->positions[slot]);
+    }
+}
+
+// Returns the weight of a slot. This is an upper bound of the weight of the
+// key that holds it.
+double sky_topk_weight(sky_topk *topk, uint32_t slot)
+{
+    if(slot >= topk->count) return 0;
+    return topk->weights[slot];
+}
+
+// Restores the heap order above an index after its weight has shrunk.
+static void sky_topk_sift_up(sky_topk *topk, uint32_t index)
+{
+    uint32_t slot = topk->heap[index];
+    double weight = topk->weights[slot];
+    while(index > 0) {
+        uint32_t parent = (index - 1) / 2;
+        if(topk->weights[topk->heap[parent]] <= weight) break;
+        topk->heap[index] = topk->heap[parent];
+        topk->positions[topk->heap[index]] = index;
+        index = parent;
+    }
+    topk->heap[index] = slot;
+    topk->positions[slot] = index;
+}
+
+// Restores the heap order below an index after its weight has grown.
+static void sky_topk_sift_down(sky_topk *topk, uint32_t index)
+{
+    uint32_t slot = topk->heap[index];
+    double weight = topk->weights[slot];
+    while(true) {
+        uint32_t child = (2 * index) + 1;
+        if(child >= topk->count) break;
+        if(child + 1 < topk->count && topk->weights[topk->heap[child + 1]] < topk->weights[topk->heap[child]]) {
+            child++;
+        }
+        if(topk->weights[topk->heap[child]] >= weight) break;
+        topk->heap[index] = topk->heap[child];
+        topk->positions[topk->heap[index]] = index;
+        index = child;
+    }
+    topk->heap[index] = slot;
+    topk->positions[slot] = index;
+}
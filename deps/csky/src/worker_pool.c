@@ -0,0 +1,392 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "sky/worker_pool.h"
+
+//==============================================================================
+//
+// Constants
+//
+//==============================================================================
+
+// The number of times a worker polls an empty ring before it sleeps.
+#define SKY_WORKER_SPIN_COUNT 1024
+
+// The most CPUs that an unbound pool's workers are spread over.
+#define SKY_WORKER_MAX_CPUS 1024
+
+// The memory policy that prefers a node, from <numaif.h>, which would add a
+// dependency on libnuma.
+#define SKY_WORKER_MPOL_PREFERRED 1
+
+
+//==============================================================================
+//
+// Forward Declarations
+//
+//==============================================================================
+
+static void *sky_worker_pool_run(void *arg);
+
+static void sky_worker_pool_bind(sky_worker_pool *pool);
+
+
+//==============================================================================
+//
+// Functions
+//
+//==============================================================================
+
+//--------------------------------------
+// Utility
+//--------------------------------------
+
+static inline void sky_worker_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+
+//--------------------------------------
+// Ring
+//--------------------------------------
+
+// Allocates the slots of a ring. The capacity is rounded up to a power of
+// two so that positions wrap with a mask.
+static int sky_worker_ring_init(sky_worker_ring *ring, uint32_t capacity)
+{
+    uint32_t size = 1;
+    while(size < capacity) size <<= 1;
+    ring->slots = calloc(size, sizeof(*ring->slots));
+    if(ring->slots == NULL) return -1;
+    ring->mask = size - 1;
+    ring->head = ring->tail = 0;
+    uint32_t i;
+    for(i=0; i<size; i++) {
+        ring->slots[i].sequence = i;
+    }
+    return 0;
+}
+
+// Pushes an entry onto a ring. Returns false if the ring is full.
+static bool sky_worker_ring_push(sky_worker_ring *ring,
+                                 sky_worker_task_func func, void *arg,
+                                 uint64_t id)
+{
+    sky_worker_ring_slot *slot;
+    uint64_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    for(;;) {
+        slot = &ring->slots[pos & ring->mask];
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)sequence - (int64_t)pos;
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if(diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->func = func;
+    slot->arg = arg;
+    slot->id = id;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Pops the oldest entry from a ring. Returns false if the ring is empty.
+static bool sky_worker_ring_pop(sky_worker_ring *ring,
+                                sky_worker_task_func *func, void **arg,
+                                uint64_t *id)
+{
+    sky_worker_ring_slot *slot;
+    uint64_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    for(;;) {
+        slot = &ring->slots[pos & ring->mask];
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)sequence - (int64_t)(pos + 1);
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if(diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    if(func != NULL) *func = slot->func;
+    if(arg != NULL) *arg = slot->arg;
+    if(id != NULL) *id = slot->id;
+    __atomic_store_n(&slot->sequence, pos + ring->mask + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Checks whether a ring has no entries to pop.
+static bool sky_worker_ring_is_empty(sky_worker_ring *ring)
+{
+    uint64_t pos = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    sky_worker_ring_slot *slot = &ring->slots[pos & ring->mask];
+    return __atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST) != pos + 1;
+}
+
+
+//--------------------------------------
+// Lifecycle
+//--------------------------------------
+
+// Creates a pool of worker threads whose rings hold a number of tasks. The
+// capacity bounds the tasks that can be submitted and not yet drained, so
+// callers must not have more than that outstanding. Pinned workers are
+// spread over the CPUs that the process may run on. Returns NULL if the
+// thread count or capacity is zero or the pool cannot be started.
+sky_worker_pool *sky_worker_pool_new(uint32_t thread_count, uint32_t capacity,
+                                     bool pinned)
+{
+    int cpus[SKY_WORKER_MAX_CPUS];
+    uint32_t cpu_count = 0;
+#ifdef __linux__
+    cpu_set_t allowed;
+    if(pinned && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        int cpu;
+        for(cpu=0; cpu<CPU_SETSIZE && cpu_count<SKY_WORKER_MAX_CPUS; cpu++) {
+            if(CPU_ISSET(cpu, &allowed)) cpus[cpu_count++] = cpu;
+        }
+    }
+#else
+    (void)pinned;
+#endif
+    return sky_worker_pool_new_bound(thread_count, capacity, cpus, cpu_count, -1);
+}
+
+// Creates a pool like sky_worker_pool_new() whose workers are pinned to a
+// list of CPUs in turn. A node that isn't negative is the NUMA node that
+// the workers prefer to allocate memory from.
+sky_worker_pool *sky_worker_pool_new_bound(uint32_t thread_count,
+                                           uint32_t capacity, const int *cpus,
+                                           uint32_t cpu_count, int node)
+{
+    if(thread_count == 0 || capacity == 0) return NULL;
+
+    sky_worker_pool *pool = calloc(1, sizeof(sky_worker_pool));
+    if(pool == NULL) return NULL;
+    pool->fds[0] = pool->fds[1] = -1;
+    pool->thread_count = thread_count;
+    pool->node = node;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    if(cpu_count > 0) {
+        pool->cpus = calloc(cpu_count, sizeof(*pool->cpus));
+        if(pool->cpus == NULL) goto error;
+        memcpy(pool->cpus, cpus, cpu_count * sizeof(*cpus));
+        pool->cpu_count = cpu_count;
+    }
+
+    // The write end never blocks a worker. The read end blocks the caller
+    // until a task finishes.
+    if(pipe(pool->fds) != 0) goto error;
+    fcntl(pool->fds[1], F_SETFL, fcntl(pool->fds[1], F_GETFL) | O_NONBLOCK);
+    fcntl(pool->fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pool->fds[1], F_SETFD, FD_CLOEXEC);
+
+    if(sky_worker_ring_init(&pool->tasks, capacity) != 0) goto error;
+    if(sky_worker_ring_init(&pool->completions, capacity) != 0) goto error;
+
+    pool->threads = calloc(thread_count, sizeof(*pool->threads));
+    if(pool->threads == NULL) goto error;
+    for(pool->started_count=0; pool->started_count<thread_count; pool->started_count++) {
+        if(pthread_create(&pool->threads[pool->started_count], NULL, sky_worker_pool_run, pool) != 0) {
+            goto error;
+        }
+    }
+    return pool;
+
+error:
+    sky_worker_pool_free(pool);
+    return NULL;
+}
+
+// Stops the workers once they have run every task that was submitted and
+// closes the write end of the pool's descriptor so that a caller blocked
+// on it reads the end of the file after the last completion.
+void sky_worker_pool_stop(sky_worker_pool *pool)
+{
+    if(pool->stopped) return;
+    pool->stopped = true;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    uint32_t i;
+    for(i=0; i<pool->started_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    if(pool->fds[1] != -1) {
+        close(pool->fds[1]);
+        pool->fds[1] = -1;
+    }
+}
+
+// Stops the pool if it's running and releases it.
+void sky_worker_pool_free(sky_worker_pool *pool)
+{
+    if(pool) {
+        sky_worker_pool_stop(pool);
+        if(pool->fds[0] != -1) close(pool->fds[0]);
+        pthread_mutex_destroy(&pool->mutex);
+        pthread_cond_destroy(&pool->cond);
+        free(pool->tasks.slots);
+        free(pool->completions.slots);
+        free(pool->threads);
+        free(pool->cpus);
+        free(pool);
+    }
+}
+
+// Pins the calling worker to the next of the pool's CPUs and makes it
+// prefer memory from the pool's node. Both are hints that are ignored if
+// the system refuses them.
+static void sky_worker_pool_bind(sky_worker_pool *pool)
+{
+#ifdef __linux__
+    uint32_t index = __atomic_fetch_add(&pool->next_thread, 1, __ATOMIC_RELAXED);
+    if(pool->cpu_count > 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(pool->cpus[index % pool->cpu_count], &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    if(pool->node >= 0 && pool->node < 64) {
+        unsigned long mask = 1UL << pool->node;
+        syscall(SYS_set_mempolicy, SKY_WORKER_MPOL_PREFERRED, &mask, 64);
+    }
+#else
+    (void)pool;
+#endif
+}
+
+
+//--------------------------------------
+// Tasks
+//--------------------------------------
+
+// Queues a task to run on a worker. The id is returned by
+// sky_worker_pool_drain() once the task has finished. Returns -1 if the
+// ring is full or the pool is stopped.
+int sky_worker_pool_submit(sky_worker_pool *pool, sky_worker_task_func func,
+                           void *arg, uint64_t id)
+{
+    if(pool->stopped) return -1;
+    if(!sky_worker_ring_push(&pool->tasks, func, arg, id)) return -1;
+
+    // A worker counts itself as a sleeper before it checks the ring for the
+    // last time so either it sees the task or it's woken here.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    return 0;
+}
+
+// Copies the ids of up to a number of finished tasks and removes them from
+// the pool. The caller should read everything available from the pool's
+// descriptor first since new completions are only signaled after a drain.
+uint32_t sky_worker_pool_drain(sky_worker_pool *pool, uint64_t *ids,
+                               uint32_t count)
+{
+    __atomic_store_n(&pool->notified, 0, __ATOMIC_SEQ_CST);
+
+    uint32_t n = 0;
+    while(n < count && sky_worker_ring_pop(&pool->completions, NULL, NULL, &ids[n])) {
+        n++;
+    }
+    return n;
+}
+
+// The descriptor that becomes readable when finished tasks can be drained.
+int sky_worker_pool_fd(sky_worker_pool *pool)
+{
+    return pool->fds[0];
+}
+
+
+//--------------------------------------
+// Workers
+//--------------------------------------
+
+// Records a finished task and wakes the caller unless it was already woken
+// and hasn't drained since.
+static void sky_worker_pool_complete(sky_worker_pool *pool, uint64_t id)
+{
+    // The caller keeps fewer tasks outstanding than the ring holds, so a
+    // full ring only waits for a drain that's already underway.
+    while(!sky_worker_ring_push(&pool->completions, NULL, NULL, id)) {
+        sched_yield();
+    }
+    if(__atomic_exchange_n(&pool->notified, 1, __ATOMIC_SEQ_CST) == 0) {
+        char c = 0;
+        while(write(pool->fds[1], &c, 1) == -1 && errno == EINTR);
+    }
+}
+
+// Takes the next task from the ring, spinning and then sleeping until one
+// is submitted. Returns false once the pool is stopping and the ring is
+// empty.
+static bool sky_worker_pool_next(sky_worker_pool *pool,
+                                 sky_worker_task_func *func, void **arg,
+                                 uint64_t *id)
+{
+    for(;;) {
+        int i;
+        for(i=0; i<SKY_WORKER_SPIN_COUNT; i++) {
+            if(sky_worker_ring_pop(&pool->tasks, func, arg, id)) return true;
+            sky_worker_relax();
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        while(!pool->stopping && sky_worker_ring_is_empty(&pool->tasks)) {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        }
+        __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        bool stopping = pool->stopping;
+        pthread_mutex_unlock(&pool->mutex);
+
+        if(stopping) {
+            return sky_worker_ring_pop(&pool->tasks, func, arg, id);
+        }
+    }
+}
+
+static void *sky_worker_pool_run(void *arg)
+{
+    sky_worker_pool *pool = arg;
+    sky_worker_pool_bind(pool);
+
+    sky_worker_task_func func;
+    void *task_arg;
+    uint64_t id;
+    while(sky_worker_pool_next(pool, &func, &task_arg, &id)) {
+        func(task_arg);
+        sky_worker_pool_complete(pool, id);
+    }
+    return NULL;
+}
@@ -75,6 +75,86 @@ char *DATA5 = "\xA0"
   "\x92" "\xD3\x00\x00\x00\x00\x00\xA0\x00\x00" "\x81" "\x01\x14"
 ;
 
+int WIDTH_DATA_LENGTH = 53;
+char *WIDTH_DATA = "\xA0"
+  // 1970-01-01T00:00:00Z, {1:5, 2:1000, 3:5000000000, 4:1.5}
+  "\x92" "\xD3\x00\x00\x00\x00\x00\x00\x00\x00" "\x84" "\x01\x05" "\x02\xD1\x03\xE8" "\x03\xD3\x00\x00\x00\x01\x2A\x05\xF2\x00" "\x04\xCB\x3F\xF8\x00\x00\x00\x00\x00\x00"
+  // 1970-01-01T00:00:01Z, {1:-7, 2:9}
+  "\x92" "\xD3\x00\x00\x00\x00\x00\x10\x00\x00" "\x82" "\x01\xF9" "\x02\x09"
+;
+
+// The same events as DATA0 stored as a single version 1 event block.
+int BLOCK_DATA0_LENGTH = 436;
+char *BLOCK_DATA0 = "\xA0"
+  // Header: 9 columns, 4 events, 435 bytes, base ts 0
+  "\xC1\x01\x09\x00\x04\x00\x00\x00\xB3\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+  // Timestamp deltas
+  "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x10\x00\x00\x00\x00\x00\x00\x00\x20\x00\x00\x00\x00\x00\x00\x00\x30\x00\x00\x00\x00\x00"
+  // -5 boolean: [-, true, -, -]
+  "\xFB\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x04\x00\x00\x00\x15\x00\x00\x00"
+  "\x02\x00\x01\x00\x00"
+  // -4 double: [-, 100, -, -]
+  "\xFC\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x03\x00\x00\x00\x31\x00\x00\x00"
+  "\x02\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x59\x40\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+  // -3 int: [-, 21, -, -]
+  "\xFD\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x02\x00\x00\x00\x31\x00\x00\x00"
+  "\x02\x00\x00\x00\x00\x00\x00\x00\x00\x15\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+  // -2 string: [-, "super", -, -]
+  "\xFE\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x01\x00\x00\x00\x2A\x00\x00\x00"
+  "\x02\x00\x00\x00\x00\x00\x00\x00\x00\x05\x00\x00\x00\x05\x00\x00\x00\x05\x00\x00\x00\x73\x75\x70\x65\x72"
+  // -1 string: [-, "A1", "A2", -]
+  "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x01\x00\x00\x00\x29\x00\x00\x00"
+  "\x06\x00\x00\x00\x00\x00\x00\x00\x00\x02\x00\x00\x00\x04\x00\x00\x00\x04\x00\x00\x00\x41\x31\x41\x32"
+  // 1 string: ["john doe", -, -, "frank sinatra"]
+  "\x01\x00\x00\x00\x00\x00\x00\x00\x01\x00\x00\x00\x3A\x00\x00\x00"
+  "\x09\x00\x00\x00\x00\x08\x00\x00\x00\x08\x00\x00\x00\x08\x00\x00\x00\x15\x00\x00\x00\x6A\x6F\x68\x6E\x20\x64\x6F\x65\x66\x72\x61\x6E\x6B\x20\x73\x69\x6E\x61\x74\x72\x61"
+  // 2 int: [1000, -, -, 20]
+  "\x02\x00\x00\x00\x00\x00\x00\x00\x02\x00\x00\x00\x31\x00\x00\x00"
+  "\x09\xE8\x03\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x14\x00\x00\x00\x00\x00\x00\x00"
+  // 3 double: [100.2, -, -, -100]
+  "\x03\x00\x00\x00\x00\x00\x00\x00\x03\x00\x00\x00\x31\x00\x00\x00"
+  "\x09\xCD\xCC\xCC\xCC\xCC\x0C\x59\x40\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x59\xC0"
+  // 4 boolean: [true, -, -, false]
+  "\x04\x00\x00\x00\x00\x00\x00\x00\x04\x00\x00\x00\x15\x00\x00\x00"
+  "\x09\x01\x00\x00\x00"
+;
+
+// Four events with a dictionary encoded action column.
+int BLOCK_DATA2_LENGTH = 85;
+char *BLOCK_DATA2 = "\xA0"
+  // Header: 1 column, 4 events, 84 bytes, 7 bytes of timestamps, base ts 0
+  "\xC1\x02\x01\x00\x04\x00\x00\x00\x54\x00\x00\x00\x07\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+  // Timestamp delta of deltas: [0, +1s, 0, 0]
+  "\x00" "\x80\x80\x80\x01" "\x00" "\x00"
+  // -1 dictionary: ["A1", "A2", "A1", "A1"]
+  "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x05\x00\x00\x00\x35\x00\x00\x00"
+  "\x0F" "\x00\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+  "\x02\x00\x00\x00" "\x00\x00\x00\x00\x02\x00\x00\x00\x04\x00\x00\x00" "A1A2"
+;
+
+// The first four events of DATA1 stored as an event block followed by the
+// last two events in the msgpack format.
+int BLOCK_DATA1_LENGTH = 219;
+char *BLOCK_DATA1 = "\xA0"
+  // Header: 3 columns, 4 events, 180 bytes, 13 bytes of timestamps, base ts 0
+  "\xC1\x02\x03\x00\x04\x00\x00\x00\xB4\x00\x00\x00\x0D\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+  // Timestamp delta of deltas: [0, +1s, +8s, +1s]
+  "\x00" "\x80\x80\x80\x01" "\x80\x80\x80\x08" "\x80\x80\x80\x01"
+  // -2 int: [-, 100, 200, 300]
+  "\xFE\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x02\x00\x00\x00\x31\x00\x00\x00"
+  "\x0E\x00\x00\x00\x00\x00\x00\x00\x00\x64\x00\x00\x00\x00\x00\x00\x00\xC8\x00\x00\x00\x00\x00\x00\x00\x2C\x01\x00\x00\x00\x00\x00\x00"
+  // -1 string: ["A1", "A2", "A3", "A1"]
+  "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x01\x00\x00\x00\x2D\x00\x00\x00"
+  "\x0F\x00\x00\x00\x00\x02\x00\x00\x00\x04\x00\x00\x00\x06\x00\x00\x00\x08\x00\x00\x00\x41\x31\x41\x32\x41\x33\x41\x31"
+  // 1 int: [1000, -, -, -]
+  "\x01\x00\x00\x00\x00\x00\x00\x00\x02\x00\x00\x00\x31\x00\x00\x00"
+  "\x01\xE8\x03\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+  // 1970-01-01T00:01:00Z, {-1:"A1", 1:2000}
+  "\x92" "\xD3\x00\x00\x00\x00\x03\xC0\x00\x00" "\x82" "\xFF\xA2""A1" "\x01\xD1\x07\xD0"
+  // 1970-01-01T00:01:03Z, {-1:"A2", -2:400}
+  "\x92" "\xD3\x00\x00\x00\x00\x03\xF0\x00\x00" "\x82" "\xFF\xA2""A2" "\xFE\xD1\x01\x90"
+;
+
 
 //==============================================================================
 //
@@ -119,6 +199,7 @@ typedef struct {
     bool       object_boolean;
     uint32_t timestamp;
     int64_t ts;
+    uint32_t prev_timestamp;
 } test_t;
 
 typedef struct {
@@ -131,6 +212,15 @@ typedef struct {
     int64_t ts;
 } test2_t;
 
+typedef struct {
+    int64_t ts;
+    uint32_t timestamp;
+    int8_t int8_value;
+    int16_t int16_value;
+    int64_t int64_value;
+    float float_value;
+} test3_t;
+
 //==============================================================================
 //
 // Test Cases
@@ -229,10 +319,12 @@ int test_sky_cursor_sessionize() {
     mu_assert_int_equals(cursor->session_event_index, 2);
     ASSERT_OBJ_STATE2(cursor->data, 10, "A3", 1000LL, 200LL);
     
-    // Prevent next session!
+    // Prevent next session! The timestamp of the next event is kept.
     mu_assert_bool(sky_lua_cursor_next_event(cursor) == false);
     mu_assert_int_equals(cursor->session_event_index, 2);
     ASSERT_OBJ_STATE2(cursor->data, 10, "A3", 1000LL, 200LL);
+    mu_assert_bool(cursor->pending_ptr == cursor->nextptr);
+    mu_assert_int64_equals(cursor->pending_ts, 20LL << 20);
     
 
     // Session 2 (Single Event)
@@ -240,6 +332,7 @@ int test_sky_cursor_sessionize() {
     mu_assert_bool(sky_lua_cursor_next_event(cursor));
     mu_assert_int_equals(cursor->session_event_index, 0);
     ASSERT_OBJ_STATE2(cursor->data, 20, "A1", 1000LL, 300LL);
+    mu_assert_bool(cursor->pending_ptr == NULL);
     mu_assert_bool(sky_lua_cursor_next_event(cursor) == false);
 
 
@@ -266,9 +359,10 @@ int test_sky_cursor_sessionize() {
     mu_assert_bool(cursor->eof == true);
     mu_assert_bool(cursor->in_session == false);
 
-    // Reuse cursor.
+    // Reuse cursor. The idle time carries over to the next object.
     sky_cursor_set_ptr(cursor, DATA1, DATA1_LENGTH);
     mu_assert_int_equals(cursor->session_event_index, -1);
+    mu_assert_int_equals(cursor->session_idle_in_sec, 10);
     mu_assert_bool(sky_lua_cursor_next_event(cursor));
     mu_assert_int_equals(cursor->session_event_index, 0);
     ASSERT_OBJ_STATE2(cursor->data, 0, "A1", 1000LL, 0LL);
@@ -278,6 +372,554 @@ int test_sky_cursor_sessionize() {
 }
 
 
+//--------------------------------------
+// Referenced Properties
+//--------------------------------------
+
+int test_sky_cursor_unreferenced_properties() {
+    // Only allocate descriptors for properties 2 & 3.
+    sky_cursor *cursor = sky_cursor_new(2, 3);
+    mu_assert_int_equals(cursor->property_count, 4);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, 2, offsetof(test_t, object_int), sizeof(int32_t), "integer");
+    sky_cursor_set_property(cursor, 3, offsetof(test_t, object_double), sizeof(double), "float");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+
+    sky_cursor_set_ptr(cursor, DATA0, DATA0_LENGTH);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE(cursor->data, 0LL, 0, "", "", 1000LL, 100.2, false, "", 0LL, 0, false);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE(cursor->data, sky_timestamp_shift(2000000LL), 2, "", "", 1000LL, 100.2, false, "", 0LL, 0, false);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE(cursor->data, sky_timestamp_shift(3000000LL), 3, "", "", 20LL, -100, false, "", 0LL, 0, false);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+
+//--------------------------------------
+// Fixnum Maps
+//--------------------------------------
+
+char DATA_FIXNUM[] = "\xA0"
+  // 1970-01-01T00:00:00Z, {-3:-27, 2:100, 5..20:127/-16}
+  "\x92" "\xD3\x00\x00\x00\x00\x00\x00\x00\x00" "\xDE\x00\x12" "\xFD\xE5" "\x02\x64"
+    "\x05\x7F" "\x06\xF0" "\x07\x7F" "\x08\xF0" "\x09\x7F" "\x0A\xF0" "\x0B\x7F" "\x0C\xF0"
+    "\x0D\x7F" "\x0E\xF0" "\x0F\x7F" "\x10\xF0" "\x11\x7F" "\x12\xF0" "\x13\x7F" "\x14\xF0"
+  // 1970-01-01T00:00:01Z, {2:1000}
+  "\x92" "\xD3\x00\x00\x00\x00\x00\x10\x00\x00" "\x81" "\x02\xD1\x03\xE8"
+;
+
+int test_sky_cursor_fixnum_map() {
+    sky_cursor *cursor = sky_cursor_new(-3, 20);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, -3, offsetof(test_t, action_int), sizeof(int32_t), "integer");
+    sky_cursor_set_property(cursor, 2, offsetof(test_t, object_int), sizeof(int32_t), "integer");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+
+    sky_cursor_set_ptr(cursor, DATA_FIXNUM, sizeof(DATA_FIXNUM) - 1);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE(cursor->data, 0LL, 0, "", "", 100LL, 0, false, "", -27LL, 0, false);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE(cursor->data, sky_timestamp_shift(1000000LL), 1, "", "", 1000LL, 0, false, "", 0LL, 0, false);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+
+//--------------------------------------
+// Filtering
+//--------------------------------------
+
+int test_sky_cursor_filter() {
+    sky_cursor *cursor = sky_cursor_new(-4, 4);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, -1, offsetof(test_t, action), sizeof(sky_string), "string");
+    sky_cursor_set_property(cursor, 2, offsetof(test_t, object_int), sizeof(int32_t), "integer");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+
+    // action == "A1" or object_int < 100
+    char filter[] =
+        "\x10\x01\x02" "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF" "\x02\x00\x00\x00""A1"
+        "\x10\x03\x01" "\x02\x00\x00\x00\x00\x00\x00\x00" "\x00\x00\x00\x00\x00\x00\x59\x40"
+        "\x04";
+    mu_assert_int_equals(sky_cursor_set_filter(cursor, filter, sizeof(filter) - 1), 0);
+
+    sky_cursor_set_ptr(cursor, DATA0, DATA0_LENGTH);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(((test_t*)cursor->data)->timestamp, 1);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(((test_t*)cursor->data)->timestamp, 3);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+
+    // Malformed programs are rejected.
+    mu_assert_int_equals(sky_cursor_set_filter(cursor, "\x01\x01", 2), -1);
+    mu_assert_int_equals(sky_cursor_set_filter(cursor, "\x03", 1), -1);
+    mu_assert_int_equals(sky_cursor_set_filter(cursor, filter, sizeof(filter) - 2), -1);
+    mu_assert_int_equals(sky_cursor_set_filter(cursor, NULL, 0), 0);
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+
+//--------------------------------------
+// Time Range
+//--------------------------------------
+
+int test_sky_cursor_time_range() {
+    sky_cursor *cursor = sky_cursor_new(-4, 4);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, -1, offsetof(test_t, action), sizeof(sky_string), "string");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+
+    sky_cursor_set_time_range(cursor, sky_timestamp_shift(1000000LL), sky_timestamp_shift(3000000LL));
+    sky_cursor_set_ptr(cursor, DATA0, DATA0_LENGTH);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(((test_t*)cursor->data)->timestamp, 1);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(((test_t*)cursor->data)->timestamp, 2);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(sky_cursor_eof(cursor));
+
+    // An index after the state is skipped.
+    sky_cursor_clear_time_range(cursor);
+    char data[] = "\xA0" "\xA3""idx" "\x92" "\xD3\x00\x00\x00\x00\x00\x10\x00\x00" "\x81" "\xFF\xA2""A1";
+    sky_cursor_set_ptr(cursor, data, sizeof(data) - 1);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(((test_t*)cursor->data)->timestamp, 1);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+int test_sky_cursor_checkpoint() {
+    sky_cursor *cursor = sky_cursor_new(-3, 20);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, -3, offsetof(test_t, action_int), sizeof(int32_t), "integer");
+    sky_cursor_set_property(cursor, 2, offsetof(test_t, object_int), sizeof(int32_t), "integer");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+
+    // A stream that starts at a checkpoint takes its values.
+    char data[] = "\xA0"
+      "\xC7" "\x92" "\xD3\x00\x00\x00\x00\x00\x10\x00\x00" "\x81" "\x02\x07"
+      "\x92" "\xD3\x00\x00\x00\x00\x00\x10\x00\x00" "\x81" "\xFD\x01"
+      "\xC7" "\x92" "\xD3\x00\x00\x00\x00\x00\x20\x00\x00" "\x81" "\x02\x09"
+      "\x92" "\xD3\x00\x00\x00\x00\x00\x20\x00\x00" "\x81" "\xFD\x02";
+    sky_cursor_set_ptr(cursor, data, sizeof(data) - 1);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(((test_t*)cursor->data)->timestamp, 1);
+    mu_assert_int_equals(((test_t*)cursor->data)->action_int, 1);
+    mu_assert_int_equals(((test_t*)cursor->data)->object_int, 7);
+
+    // Later checkpoints are skipped since the events before them are read.
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(((test_t*)cursor->data)->timestamp, 2);
+    mu_assert_int_equals(((test_t*)cursor->data)->object_int, 7);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(sky_cursor_eof(cursor));
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+
+//--------------------------------------
+// Event Blocks
+//--------------------------------------
+
+int test_sky_cursor_block_set_data() {
+    sky_cursor *cursor = sky_cursor_new(-4, 4);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, -5, offsetof(test_t, action_boolean), sizeof(bool), "boolean");
+    sky_cursor_set_property(cursor, -4, offsetof(test_t, action_double), sizeof(double), "float");
+    sky_cursor_set_property(cursor, -3, offsetof(test_t, action_int), sizeof(int32_t), "integer");
+    sky_cursor_set_property(cursor, -2, offsetof(test_t, action_string), sizeof(sky_string), "string");
+    sky_cursor_set_property(cursor, -1, offsetof(test_t, action), sizeof(sky_string), "string");
+    sky_cursor_set_property(cursor, 1, offsetof(test_t, object_string), sizeof(sky_string), "string");
+    sky_cursor_set_property(cursor, 2, offsetof(test_t, object_int), sizeof(int32_t), "integer");
+    sky_cursor_set_property(cursor, 3, offsetof(test_t, object_double), sizeof(double), "float");
+    sky_cursor_set_property(cursor, 4, offsetof(test_t, object_boolean), sizeof(bool), "boolean");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+
+    sky_cursor_set_ptr(cursor, BLOCK_DATA0, BLOCK_DATA0_LENGTH);
+    ASSERT_OBJ_STATE(cursor->data, 0LL, 0, "", "", 0LL, 0, false, "", 0LL, 0, false);
+
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE(cursor->data, 0LL, 0, "", "john doe", 1000LL, 100.2, true, "", 0LL, 0, false);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE(cursor->data, sky_timestamp_shift(1000000LL), 1, "A1", "john doe", 1000LL, 100.2, true, "super", 21LL, 100, true);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE(cursor->data, sky_timestamp_shift(2000000LL), 2, "A2", "john doe", 1000LL, 100.2, true, "", 0LL, 0, false);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE(cursor->data, sky_timestamp_shift(3000000LL), 3, "", "frank sinatra", 20LL, -100, false, "", 0LL, 0, false);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+int test_sky_cursor_block_unreferenced_columns() {
+    sky_cursor *cursor = sky_cursor_new(-1, 2);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, 2, offsetof(test_t, object_int), sizeof(int32_t), "integer");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+
+    sky_cursor_set_ptr(cursor, BLOCK_DATA0, BLOCK_DATA0_LENGTH);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(cursor->block_column_count, 1);
+    ASSERT_OBJ_STATE(cursor->data, 0LL, 0, "", "", 1000LL, 0, false, "", 0LL, 0, false);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE(cursor->data, sky_timestamp_shift(3000000LL), 3, "", "", 20LL, 0, false, "", 0LL, 0, false);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+int test_sky_cursor_block_dictionary() {
+    sky_cursor *cursor = sky_cursor_new(-1, 0);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, -1, offsetof(test_t, action), sizeof(sky_string), "string");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+    sky_string *action = &((test_t*)cursor->data)->action;
+
+    sky_cursor_set_ptr(cursor, BLOCK_DATA2, BLOCK_DATA2_LENGTH);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(action->length, 2);
+    mu_assert_bool(memcmp(action->data, "A1", 2) == 0);
+    uint32_t code = action->code;
+    mu_assert_bool(code > 0);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(memcmp(action->data, "A2", 2) == 0);
+    mu_assert_int_equals(action->code, code + 1);
+    mu_assert_int_equals(((test_t*)cursor->data)->timestamp, 1);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(memcmp(action->data, "A1", 2) == 0);
+    mu_assert_int_equals(action->code, code);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+
+    // Codes aren't reused when the block is read again.
+    sky_cursor_set_ptr(cursor, BLOCK_DATA2, BLOCK_DATA2_LENGTH);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(memcmp(action->data, "A1", 2) == 0);
+    mu_assert_int_equals(action->code, code + 2);
+
+    // Strings decoded from msgpack have no code.
+    sky_cursor_set_ptr(cursor, DATA1, DATA1_LENGTH);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(action->code, 0);
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+// Writes a little endian integer into a test block.
+static void test_write_le(uint8_t *ptr, uint64_t value, uint32_t sz) {
+    uint32_t i;
+    for(i=0; i<sz; i++) ptr[i] = (uint8_t)(value >> (i * 8));
+}
+
+// Writes a packed integer column into a test block and returns its size.
+static uint32_t test_write_packed_column(uint8_t *ptr, int64_t property_id, uint32_t count, int64_t *values, bool *present) {
+    uint32_t bitmap_sz = (count + 7) / 8;
+    uint32_t group_count = (count + 127) / 128;
+    uint8_t *bitmap = ptr + 16;
+    uint8_t *offsets = bitmap + bitmap_sz;
+    uint8_t *groups = offsets + ((group_count + 1) * 4);
+    memset(bitmap, 0, bitmap_sz);
+
+    uint32_t i, g, sz = 0;
+    for(i=0; i<count; i++) {
+        if(present[i]) bitmap[i >> 3] |= 1 << (i & 7);
+    }
+    for(g=0; g<group_count; g++) {
+        test_write_le(offsets + (g * 4), sz, 4);
+        int64_t min = 0, max = 0;
+        bool found = false;
+        for(i=g*128; i<count && i<(g+1)*128; i++) {
+            if(!present[i]) continue;
+            if(!found || values[i] < min) min = values[i];
+            if(!found || values[i] > max) max = values[i];
+            found = true;
+        }
+        uint8_t width = 0;
+        while(width < 64 && ((uint64_t)(max - min) >> width) > 0) width++;
+        uint8_t *group = groups + sz;
+        test_write_le(group, (uint64_t)min, 8);
+        group[8] = width;
+        memset(group + 9, 0, width * 16);
+        for(i=0; i<128; i++) {
+            uint32_t index = (g * 128) + i;
+            uint64_t delta = (index < count && present[index] ? (uint64_t)(values[index] - min) : 0);
+            uint32_t b;
+            for(b=0; b<width; b++) {
+                uint32_t bit = (i * width) + b;
+                if((delta >> b) & 1) group[9 + (bit >> 3)] |= 1 << (bit & 7);
+            }
+        }
+        sz += 9 + (width * 16);
+    }
+    test_write_le(offsets + (group_count * 4), sz, 4);
+
+    uint32_t column_sz = (uint32_t)(groups + sz - ptr);
+    test_write_le(ptr, (uint64_t)property_id, 8);
+    ptr[8] = 6;
+    memset(ptr + 9, 0, 3);
+    test_write_le(ptr + 12, column_sz, 4);
+    return column_sz;
+}
+
+int test_sky_cursor_block_packed() {
+    sky_cursor *cursor = sky_cursor_new(-4, 3);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, -4, offsetof(test_t, action_double), sizeof(double), "float");
+    sky_cursor_set_property(cursor, 3, offsetof(test_t, object_double), sizeof(double), "float");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+    test_t *data = (test_t*)cursor->data;
+
+    // 200 events at the same time. The transient values are in a narrow
+    // range for each group and the permanent values change three times.
+    uint32_t i, count = 200;
+    int64_t actions[200], objects[200];
+    bool all[200], some[200];
+    for(i=0; i<count; i++) {
+        actions[i] = (i < 128 ? 1000 + (i % 4) : 5000 + (i % 8));
+        objects[i] = (i == 0 ? 7 : (i == 100 ? 9 : 11));
+        all[i] = true;
+        some[i] = (i == 0 || i == 100 || i == 150);
+    }
+    uint8_t *block = calloc(1, 4096);
+    block[0] = 0xA0;
+    uint8_t *header = block + 1;
+    uint8_t *ptr = header + 24 + count;
+    ptr += test_write_packed_column(ptr, -4, count, actions, all);
+    ptr += test_write_packed_column(ptr, 3, count, objects, some);
+    header[0] = 0xC1;
+    header[1] = 2;
+    test_write_le(header + 2, 2, 2);
+    test_write_le(header + 4, count, 4);
+    test_write_le(header + 8, (uint64_t)(ptr - header), 4);
+    test_write_le(header + 12, count, 4);
+    size_t sz = (size_t)(ptr - block);
+
+    // Every value is unpacked.
+    sky_cursor_set_ptr(cursor, block, sz);
+    for(i=0; i<count; i++) {
+        mu_assert_bool(sky_lua_cursor_next_event(cursor));
+        mu_assert_bool(data->action_double == (double)actions[i]);
+        mu_assert_bool(data->object_double == (i < 100 ? 7 : (i < 150 ? 9 : 11)));
+    }
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+
+    // action_double == 5003. The first group is skipped without reading its
+    // values but the permanent value it ends with still carries over.
+    char filter[] = "\x10\x01\x01" "\xFC\xFF\xFF\xFF\xFF\xFF\xFF\xFF" "\x00\x00\x00\x00\x00\x8B\xB3\x40";
+    mu_assert_int_equals(sky_cursor_set_filter(cursor, filter, sizeof(filter) - 1), 0);
+    sky_cursor_set_ptr(cursor, block, sz);
+    for(i=131; i<count; i+=8) {
+        mu_assert_bool(sky_lua_cursor_next_event(cursor));
+        mu_assert_bool(data->action_double == 5003);
+        mu_assert_bool(data->object_double == (i < 150 ? 9 : 11));
+    }
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+    mu_assert_int64_equals(cursor->event_count, count * 2);
+
+    sky_cursor_free(cursor);
+    free(block);
+    return 0;
+}
+
+int test_sky_cursor_block_sessionize() {
+    sky_cursor *cursor = sky_cursor_new(-2, 1);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, -2, offsetof(test_t, action_int), sizeof(int32_t), "integer");
+    sky_cursor_set_property(cursor, -1, offsetof(test_t, action), sizeof(sky_string), "string");
+    sky_cursor_set_property(cursor, 1, offsetof(test_t, object_int), sizeof(int32_t), "integer");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+
+    sky_cursor_set_ptr(cursor, BLOCK_DATA1, BLOCK_DATA1_LENGTH);
+    sky_cursor_set_session_idle(cursor, 10);
+
+    // Session 1 (block)
+    mu_assert_bool(sky_lua_cursor_next_session(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE2(cursor->data, 0, "A1", 1000LL, 0LL);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE2(cursor->data, 1, "A2", 1000LL, 100LL);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(cursor->session_event_index, 2);
+    ASSERT_OBJ_STATE2(cursor->data, 10, "A3", 1000LL, 200LL);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor) == false);
+
+    // Session 2 (last block event)
+    mu_assert_bool(sky_lua_cursor_next_session(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(cursor->session_event_index, 0);
+    ASSERT_OBJ_STATE2(cursor->data, 20, "A1", 1000LL, 300LL);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor) == false);
+
+    // Session 3 (msgpack events after the block)
+    mu_assert_bool(sky_lua_cursor_next_session(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE2(cursor->data, 60, "A1", 2000LL, 0LL);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE2(cursor->data, 63, "A2", 2000LL, 400LL);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor) == false);
+    mu_assert_bool(sky_lua_cursor_next_session(cursor) == false);
+    mu_assert_bool(cursor->eof == true);
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+
+//--------------------------------------
+// Families
+//--------------------------------------
+
+// The values of property -4 at 1s, 20s and 63s with an event at 5s that the
+// object doesn't have.
+char FAMILY_DATA[] =
+  "\x92" "\xD3\x00\x00\x00\x00\x00\x10\x00\x00" "\x81" "\xFC\xCB\x3F\xF8\x00\x00\x00\x00\x00\x00"
+  "\x92" "\xD3\x00\x00\x00\x00\x00\x50\x00\x00" "\x81" "\xFC\xCB\x40\x14\x00\x00\x00\x00\x00\x00"
+  "\x92" "\xD3\x00\x00\x00\x00\x01\x40\x00\x00" "\x82" "\xFC\xCB\x40\x04\x00\x00\x00\x00\x00\x00" "\xFB\xC3"
+  "\x92" "\xD3\x00\x00\x00\x00\x03\xF0\x00\x00" "\x81" "\xFC\xCB\xC0\x08\x00\x00\x00\x00\x00\x00"
+;
+
+int test_sky_cursor_families() {
+    sky_cursor *cursor = sky_cursor_new(-4, 1);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, -4, offsetof(test_t, action_double), sizeof(double), "float");
+    sky_cursor_set_property(cursor, -2, offsetof(test_t, action_int), sizeof(int32_t), "integer");
+    sky_cursor_set_property(cursor, -1, offsetof(test_t, action), sizeof(sky_string), "string");
+    sky_cursor_set_property(cursor, 1, offsetof(test_t, object_int), sizeof(int32_t), "integer");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+
+    // Family values are merged into the events that share their timestamp
+    // and cleared with the rest of the action data.
+    double expected[] = {0, 1.5, 0, 2.5, 0, -3};
+    char *streams[] = {DATA1, BLOCK_DATA1};
+    size_t lengths[] = {DATA1_LENGTH, BLOCK_DATA1_LENGTH};
+    int i, j;
+    for(i=0; i<2; i++) {
+        sky_cursor_set_ptr(cursor, streams[i], lengths[i]);
+        mu_assert_int_equals(sky_cursor_add_family(cursor, FAMILY_DATA, sizeof(FAMILY_DATA) - 1), 0);
+        for(j=0; j<6; j++) {
+            mu_assert_bool(sky_lua_cursor_next_event(cursor));
+            mu_assert_bool(((test_t*)cursor->data)->action_double == expected[j]);
+        }
+        mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+    }
+
+    // Families are dropped when the cursor moves to the next object.
+    sky_cursor_set_ptr(cursor, DATA1, DATA1_LENGTH);
+    mu_assert_int_equals(cursor->family_count, 0);
+    for(j=0; j<6; j++) {
+        mu_assert_bool(sky_lua_cursor_next_event(cursor));
+        mu_assert_bool(((test_t*)cursor->data)->action_double == 0);
+    }
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+
+//--------------------------------------
+// Batch Iteration
+//--------------------------------------
+
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+    int64_t *ts;
+    uint32_t *timestamp;
+    bool *session_start;
+    uint32_t *prev_timestamp;
+    sky_string *action;
+    int32_t *action_int;
+    int32_t *object_int;
+} test_batch_t;
+
+int test_sky_cursor_next_batch() {
+    sky_cursor *cursor = sky_cursor_new(-2, 1);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_prev_timestamp_offset(cursor, offsetof(test_t, prev_timestamp));
+    sky_cursor_set_property(cursor, -2, offsetof(test_t, action_int), sizeof(int32_t), "integer");
+    sky_cursor_set_property(cursor, -1, offsetof(test_t, action), sizeof(sky_string), "string");
+    sky_cursor_set_property(cursor, 1, offsetof(test_t, object_int), sizeof(int32_t), "integer");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+
+    test_batch_t *batch = sky_cursor_set_batch(cursor, sizeof(test_batch_t), 4);
+    mu_assert_int_equals(sky_cursor_set_batch_column(cursor, -1, offsetof(test_batch_t, action)), 0);
+    mu_assert_int_equals(sky_cursor_set_batch_column(cursor, -2, offsetof(test_batch_t, action_int)), 0);
+    mu_assert_int_equals(sky_cursor_set_batch_column(cursor, 1, offsetof(test_batch_t, object_int)), 0);
+    mu_assert_int_equals(sky_cursor_set_batch_column(cursor, 2, offsetof(test_batch_t, object_int)), -1);
+
+    // Sessions don't end the batch but are flagged instead.
+    sky_cursor_set_ptr(cursor, DATA1, DATA1_LENGTH);
+    sky_cursor_set_session_idle(cursor, 10);
+    mu_assert_int_equals(sky_cursor_next_batch(cursor), 4);
+    mu_assert_int_equals(batch->count, 4);
+    mu_assert_int_equals(batch->timestamp[0], 0);
+    mu_assert_int_equals(batch->timestamp[3], 20);
+    mu_assert_int64_equals(batch->ts[1], sky_timestamp_shift(1000000LL));
+    mu_assert_bool(batch->session_start[0] && !batch->session_start[1] && !batch->session_start[2] && batch->session_start[3]);
+    mu_assert_int_equals(batch->prev_timestamp[0], 0);
+    mu_assert_int_equals(batch->prev_timestamp[1], batch->timestamp[0]);
+    mu_assert_int_equals(batch->prev_timestamp[3], batch->timestamp[2]);
+    mu_assert_int_equals(batch->action[2].length, 2);
+    mu_assert_bool(memcmp(batch->action[2].data, "A3", 2) == 0);
+    mu_assert_int_equals(batch->action_int[0], 0);
+    mu_assert_int_equals(batch->action_int[3], 300);
+    mu_assert_int_equals(batch->object_int[3], 1000);
+
+    mu_assert_int_equals(sky_cursor_next_batch(cursor), 2);
+    mu_assert_bool(batch->session_start[0] && !batch->session_start[1]);
+    mu_assert_int_equals(batch->timestamp[1], 63);
+    mu_assert_int_equals(batch->prev_timestamp[0], 20);
+    mu_assert_int_equals(batch->action_int[0], 0);
+    mu_assert_int_equals(batch->action_int[1], 400);
+    mu_assert_int_equals(batch->object_int[1], 2000);
+    mu_assert_int_equals(sky_cursor_next_batch(cursor), 0);
+
+    // Blocks produce the same batches.
+    sky_cursor_set_ptr(cursor, BLOCK_DATA1, BLOCK_DATA1_LENGTH);
+    mu_assert_int_equals(sky_cursor_next_batch(cursor), 4);
+    mu_assert_int_equals(batch->action_int[3], 300);
+    mu_assert_int_equals(batch->prev_timestamp[0], 0);
+    mu_assert_int_equals(batch->prev_timestamp[3], batch->timestamp[2]);
+    mu_assert_int_equals(sky_cursor_next_batch(cursor), 2);
+    mu_assert_int_equals(batch->prev_timestamp[0], 20);
+    mu_assert_int_equals(batch->object_int[1], 2000);
+    mu_assert_int_equals(sky_cursor_next_batch(cursor), 0);
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+
 //--------------------------------------
 // Object Iteration
 //--------------------------------------
@@ -335,6 +977,190 @@ int test_sky_cursor_object_iteration() {
     return 0;
 }
 
+int test_sky_cursor_stats() {
+    sky_cursor *cursor = sky_cursor_new(0, 1);
+    cursor->next_object_func = next_obj;
+    sky_cursor_set_ts_offset(cursor, offsetof(test2_t, ts));
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test2_t, timestamp));
+    sky_cursor_set_property(cursor, 1, offsetof(test2_t, int_value), sizeof(int32_t), "integer");
+    sky_cursor_set_data_sz(cursor, sizeof(test2_t));
+
+    while(sky_cursor_next_object(cursor)) {
+        while(sky_lua_cursor_next_event(cursor)) {}
+    }
+    mu_assert_int64_equals((int64_t)cursor->object_count, 2LL);
+    mu_assert_int64_equals((int64_t)cursor->byte_count, (int64_t)(DATA3_LENGTH + DATA4_LENGTH));
+    mu_assert_int64_equals((int64_t)cursor->event_count, 3LL);
+
+    sky_cursor_clear_stats(cursor);
+    mu_assert_int64_equals((int64_t)cursor->object_count, 0LL);
+    mu_assert_int64_equals((int64_t)cursor->byte_count, 0LL);
+    mu_assert_int64_equals((int64_t)cursor->event_count, 0LL);
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+int test_sky_cursor_cancel() {
+    sky_cursor *cursor = sky_cursor_new(0, 1);
+    cursor->next_object_func = next_obj;
+    sky_cursor_set_ts_offset(cursor, offsetof(test2_t, ts));
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test2_t, timestamp));
+    sky_cursor_set_property(cursor, 1, offsetof(test2_t, int_value), sizeof(int32_t), "integer");
+    sky_cursor_set_data_sz(cursor, sizeof(test2_t));
+
+    // Stop after the first object.
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    sky_cursor_cancel(cursor);
+    mu_assert_bool(sky_cursor_is_cancelled(cursor));
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+    mu_assert_int64_equals((int64_t)cursor->object_count, 1LL);
+
+    // Clearing the cancel resumes with the next object.
+    sky_cursor_clear_cancel(cursor);
+    mu_assert_bool(!sky_cursor_is_cancelled(cursor));
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_int64_equals((int64_t)cursor->object_count, 2LL);
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+int test_sky_cursor_sample() {
+    sky_cursor *cursor = sky_cursor_new(0, 1);
+    char key[16];
+    int i, count;
+
+    // Every key is kept without a sample.
+    mu_assert_bool(sky_cursor_sample_key(cursor, "a", 1));
+
+    // About a quarter of the keys are kept, the same ones every time.
+    sky_cursor_set_sample(cursor, 0.25);
+    for(i=0, count=0; i<10000; i++) {
+        int sz = snprintf(key, sizeof(key), "obj%d", i);
+        bool kept = sky_cursor_sample_key(cursor, key, sz);
+        mu_assert_bool(kept == sky_cursor_sample_key(cursor, key, sz));
+        if(kept) count++;
+    }
+    mu_assert_bool(count > 2300 && count < 2700);
+
+    // Slices that follow each other keep every key exactly once, and the
+    // first slice keeps the same keys as the sample of its size.
+    for(i=0, count=0; i<10000; i++) {
+        int sz = snprintf(key, sizeof(key), "obj%d", i);
+        int kept = 0;
+        sky_cursor_set_sample_range(cursor, 0, 0.25);
+        if(sky_cursor_sample_key(cursor, key, sz)) kept++;
+        sky_cursor_set_sample(cursor, 0.25);
+        mu_assert_bool((kept == 1) == sky_cursor_sample_key(cursor, key, sz));
+        sky_cursor_set_sample_range(cursor, 0.25, 0.5);
+        if(sky_cursor_sample_key(cursor, key, sz)) kept++;
+        sky_cursor_set_sample_range(cursor, 0.5, 1);
+        if(sky_cursor_sample_key(cursor, key, sz)) kept++;
+        mu_assert_int_equals(kept, 1);
+    }
+
+    // A ratio of one turns sampling off.
+    sky_cursor_set_sample(cursor, 1);
+    mu_assert_bool(!cursor->has_sample);
+    sky_cursor_set_sample_range(cursor, 0, 1);
+    mu_assert_bool(!cursor->has_sample);
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+
+//--------------------------------------
+// Rewinding
+//--------------------------------------
+
+int test_sky_cursor_mark_restore() {
+    sky_cursor *cursor = sky_cursor_new(-2, 1);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, -2, offsetof(test_t, action_int), sizeof(int32_t), "integer");
+    sky_cursor_set_property(cursor, -1, offsetof(test_t, action), sizeof(sky_string), "string");
+    sky_cursor_set_property(cursor, 1, offsetof(test_t, object_int), sizeof(int32_t), "integer");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+    sky_cursor_set_ptr(cursor, DATA1, DATA1_LENGTH);
+
+    // Nothing to mark before the first event.
+    mu_assert_bool(sky_lua_cursor_next_session(cursor));
+    mu_assert_int_equals(sky_cursor_mark(cursor), -1);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE2(cursor->data, 0, "A1", 1000LL, 0LL);
+
+    // Look ahead from the second event and from the third inside of it.
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    int32_t outer = sky_cursor_mark(cursor);
+    mu_assert_int_equals(outer, 0);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    int32_t inner = sky_cursor_mark(cursor);
+    mu_assert_int_equals(inner, 1);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE2(cursor->data, 60, "A1", 2000LL, 0LL);
+    mu_assert_int64_equals((int64_t)cursor->event_count, 5LL);
+
+    mu_assert_bool(sky_cursor_restore(cursor, inner));
+    ASSERT_OBJ_STATE2(cursor->data, 10, "A3", 1000LL, 200LL);
+    mu_assert_int_equals(cursor->session_event_index, 2);
+    mu_assert_bool(sky_cursor_restore(cursor, outer));
+    ASSERT_OBJ_STATE2(cursor->data, 1, "A2", 1000LL, 100LL);
+    mu_assert_int_equals(cursor->session_event_index, 1);
+
+    // The events after the mark are replayed without decoding them again.
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE2(cursor->data, 10, "A3", 1000LL, 200LL);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE2(cursor->data, 20, "A1", 1000LL, 300LL);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE2(cursor->data, 60, "A1", 2000LL, 0LL);
+    mu_assert_int_equals(cursor->session_event_index, 4);
+    mu_assert_int64_equals((int64_t)cursor->event_count, 5LL);
+
+    // Decoding carries on after the last replayed event.
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    ASSERT_OBJ_STATE2(cursor->data, 63, "A2", 2000LL, 400LL);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(sky_cursor_eof(cursor));
+    mu_assert_int64_equals((int64_t)cursor->event_count, 6LL);
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+int test_sky_cursor_restore_overflow() {
+    sky_cursor *cursor = sky_cursor_new(-1, 0);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, -1, offsetof(test_t, action), sizeof(sky_string), "string");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+    sky_cursor_set_ptr(cursor, DATA1, DATA1_LENGTH);
+    mu_assert_bool(sky_lua_cursor_next_session(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+
+    // Pretend the kept events are full so the next one doesn't fit.
+    int32_t mark = sky_cursor_mark(cursor);
+    mu_assert_int_equals(mark, 0);
+    cursor->rewind_capacity = cursor->rewind_count = SKY_CURSOR_REWIND_MAX;
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(cursor->rewind_overflow);
+    mu_assert_int_equals(sky_cursor_mark(cursor), -1);
+    mu_assert_bool(!sky_cursor_restore(cursor, mark));
+    mu_assert_int_equals(cursor->session_event_index, 1);
+
+    // The next object starts over.
+    cursor->rewind_capacity = cursor->rewind_count = 0;
+    sky_cursor_set_ptr(cursor, DATA1, DATA1_LENGTH);
+    mu_assert_bool(!cursor->rewind_overflow);
+    mu_assert_int_equals(cursor->mark_depth, 0);
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
 
 //--------------------------------------
 // Property Management
@@ -353,6 +1179,34 @@ int test_sky_cursor_set_integer() {
     return 0;
 }
 
+int test_sky_cursor_property_widths() {
+    sky_cursor *cursor = sky_cursor_new(1, 4);
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test3_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test3_t, ts));
+    sky_cursor_set_property(cursor, 1, offsetof(test3_t, int8_value), sizeof(int8_t), "int8");
+    sky_cursor_set_property(cursor, 2, offsetof(test3_t, int16_value), sizeof(int16_t), "int16");
+    sky_cursor_set_property(cursor, 3, offsetof(test3_t, int64_value), sizeof(int64_t), "int64");
+    sky_cursor_set_property(cursor, 4, offsetof(test3_t, float_value), sizeof(float), "float32");
+    sky_cursor_set_data_sz(cursor, sizeof(test3_t));
+    test3_t *obj = (test3_t*)cursor->data;
+
+    sky_cursor_set_ptr(cursor, WIDTH_DATA, WIDTH_DATA_LENGTH);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int8_value, 5);
+    mu_assert_int_equals(obj->int16_value, 1000);
+    mu_assert_int64_equals(obj->int64_value, 5000000000LL);
+    mu_assert_bool(obj->float_value == 1.5f);
+
+    // Fixnum maps are written at the property width too.
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int8_value, -7);
+    mu_assert_int_equals(obj->int16_value, 9);
+    mu_assert_int64_equals(obj->int64_value, 5000000000LL);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+    sky_cursor_free(cursor);
+    return 0;
+}
+
 int test_sky_cursor_set_double() {
     size_t sz;
     sky_cursor *cursor = sky_cursor_new(-1, 0);
@@ -408,8 +1262,27 @@ int all_tests() {
     mu_run_test(test_sky_cursor_set_data);
     mu_run_test(test_sky_cursor_sessionize);
     mu_run_test(test_sky_cursor_object_iteration);
+    mu_run_test(test_sky_cursor_stats);
+    mu_run_test(test_sky_cursor_cancel);
+    mu_run_test(test_sky_cursor_sample);
+    mu_run_test(test_sky_cursor_unreferenced_properties);
+    mu_run_test(test_sky_cursor_fixnum_map);
+    mu_run_test(test_sky_cursor_filter);
+    mu_run_test(test_sky_cursor_time_range);
+    mu_run_test(test_sky_cursor_checkpoint);
+
+    mu_run_test(test_sky_cursor_block_set_data);
+    mu_run_test(test_sky_cursor_block_unreferenced_columns);
+    mu_run_test(test_sky_cursor_block_dictionary);
+    mu_run_test(test_sky_cursor_block_packed);
+    mu_run_test(test_sky_cursor_block_sessionize);
+    mu_run_test(test_sky_cursor_families);
+    mu_run_test(test_sky_cursor_next_batch);
+    mu_run_test(test_sky_cursor_mark_restore);
+    mu_run_test(test_sky_cursor_restore_overflow);
     
     mu_run_test(test_sky_cursor_set_integer);
+    mu_run_test(test_sky_cursor_property_widths);
     mu_run_test(test_sky_cursor_set_double);
     mu_run_test(test_sky_cursor_set_boolean);
     mu_run_test(test_sky_cursor_set_string);
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+#include <sky/cursor.h>
+#include <sky/kernel.h>
+
+#include "minunit.h"
+
+//==============================================================================
+//
+// Fixtures
+//
+//==============================================================================
+
+int DATA1_LENGTH = 112;
+char *DATA1 = "\xA0"
+  // 1970-01-01T00:00:00Z, {-1:"A1", 1:1000}
+  "\x92" "\xD3\x00\x00\x00\x00\x00\x00\x00\x00" "\x82" "\xFF\xA2""A1" "\x01\xD1\x03\xE8"
+  // 1970-01-01T00:00:01Z, {-1:"A2", -2:100}
+  "\x92" "\xD3\x00\x00\x00\x00\x00\x10\x00\x00" "\x82" "\xFF\xA2""A2" "\xFE\x64"
+  // 1970-01-01T00:00:10Z, {-1:"A3", -2:200}
+  "\x92" "\xD3\x00\x00\x00\x00\x00\xA0\x00\x00" "\x82" "\xFF\xA2""A3" "\xFE\xD1\x00\xC8"
+  // 1970-01-01T00:00:20Z, {-1:"A1", -2:300}
+  "\x92" "\xD3\x00\x00\x00\x00\x01\x40\x00\x00" "\x82" "\xFF\xA2""A1" "\xFE\xD1\x01\x2C"
+  // 1970-01-01T00:01:00Z, {-1:"A1", 1:2000}
+  "\x92" "\xD3\x00\x00\x00\x00\x03\xC0\x00\x00" "\x82" "\xFF\xA2""A1" "\x01\xD1\x07\xD0"
+  // 1970-01-01T00:01:00Z, {-1:"A1", 1:2000}
+  "\x92" "\xD3\x00\x00\x00\x00\x03\xF0\x00\x00" "\x82" "\xFF\xA2""A2" "\xFE\xD1\x01\x90"
+;
+
+typedef struct {
+    int32_t action_int;
+    double action_double;
+    int32_t object_int;
+    uint32_t timestamp;
+    int64_t ts;
+} test_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+    int64_t *ts;
+    uint32_t *timestamp;
+    bool *session_start;
+    uint32_t *prev_timestamp;
+    int32_t *action_int;
+    int32_t *object_int;
+} test_batch_t;
+
+// Returns DATA1 as the only object.
+int next_obj(void *_cursor) {
+    sky_cursor *cursor = (sky_cursor*)_cursor;
+    if(cursor->context != NULL) return 0;
+    cursor->context = DATA1;
+    sky_cursor_set_ptr(cursor, DATA1, DATA1_LENGTH);
+    return 1;
+}
+
+// Creates a cursor over DATA1 with integer batch columns for the action
+// (-2) and the object (1).
+sky_cursor *test_cursor() {
+    sky_cursor *cursor = sky_cursor_new(-2, 1);
+    cursor->next_object_func = next_obj;
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_property(cursor, -2, offsetof(test_t, action_int), sizeof(int32_t), "factor");
+    sky_cursor_set_property(cursor, 1, offsetof(test_t, object_int), sizeof(int32_t), "integer");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+    sky_cursor_set_batch(cursor, sizeof(test_batch_t), 4);
+    sky_cursor_set_batch_column(cursor, -2, offsetof(test_batch_t, action_int));
+    sky_cursor_set_batch_column(cursor, 1, offsetof(test_batch_t, object_int));
+    return cursor;
+}
+
+// Returns the values of the group with the given factors or NULL.
+double *test_group_values(sky_kernel_group *group, int32_t a, int32_t b) {
+    uint32_t i;
+    for(i=0; i<group->capacity; i++) {
+        int32_t dimensions[SKY_KERNEL_MAX_DIMENSIONS] = {0, 0};
+        if(!group->used[i]) continue;
+        sky_kernel_group_key_dimensions(group, group->keys[i], dimensions);
+        if(dimensions[0] == a && dimensions[1] == b) {
+            return &group->values[i * (group->field_count + 1)];
+        }
+    }
+    return NULL;
+}
+
+
+//==============================================================================
+//
+// Test Cases
+//
+//==============================================================================
+
+//--------------------------------------
+// Groups
+//--------------------------------------
+
+int test_sky_kernel_bind() {
+    sky_cursor *cursor = test_cursor();
+    int64_t dimension_ids[] = {-2, 1, -1};
+    int64_t field_ids[] = {1};
+
+    // Groups need integer factor columns that are in the batch.
+    sky_kernel *kernel = sky_kernel_new();
+    mu_assert_int_equals(sky_kernel_add_group(kernel, 3, dimension_ids, 0, NULL), -1);
+    mu_assert_int_equals(sky_kernel_add_group(kernel, 2, dimension_ids, 1, field_ids), 0);
+    mu_assert_int_equals(sky_kernel_bind(kernel, cursor), 0);
+    mu_assert_int_equals(sky_kernel_add_group(kernel, 1, &dimension_ids[2], 0, NULL), 1);
+    mu_assert_int_equals(sky_kernel_bind(kernel, cursor), -1);
+    sky_kernel_free(kernel);
+
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+
+//--------------------------------------
+// Execution
+//--------------------------------------
+
+int test_sky_kernel_run() {
+    sky_cursor *cursor = test_cursor();
+    int64_t dimension_ids[] = {-2, 1};
+    int64_t field_ids[] = {1};
+    sky_kernel *kernel = sky_kernel_new();
+    sky_kernel_add_group(kernel, 0, NULL, 1, field_ids);
+    sky_kernel_add_group(kernel, 1, dimension_ids, 1, field_ids);
+    sky_kernel_add_group(kernel, 2, dimension_ids, 0, NULL);
+    mu_assert_int_equals(sky_kernel_bind(kernel, cursor), 0);
+
+    int run;
+    for(run=0; run<2; run++) {
+        cursor->context = NULL;
+        mu_assert_int_equals(sky_kernel_run(kernel, cursor), 0);
+
+        // Totals.
+        mu_assert_int_equals(kernel->groups[0].count, 1);
+        double *values = test_group_values(&kernel->groups[0], 0, 0);
+        mu_assert_bool(values != NULL && values[0] == 6 && values[1] == 8000);
+
+        // By action.
+        mu_assert_int_equals(kernel->groups[1].count, 5);
+        values = test_group_values(&kernel->groups[1], 0, 0);
+        mu_assert_bool(values != NULL && values[0] == 2 && values[1] == 3000);
+        values = test_group_values(&kernel->groups[1], 400, 0);
+        mu_assert_bool(values != NULL && values[0] == 1 && values[1] == 2000);
+
+        // By action and object.
+        mu_assert_int_equals(kernel->groups[2].count, 6);
+        values = test_group_values(&kernel->groups[2], 0, 2000);
+        mu_assert_bool(values != NULL && values[0] == 1);
+        values = test_group_values(&kernel->groups[2], 300, 1000);
+        mu_assert_bool(values != NULL && values[0] == 1);
+
+        sky_kernel_reset(kernel);
+        mu_assert_int_equals(kernel->groups[2].count, 0);
+    }
+
+    sky_kernel_free(kernel);
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+int test_sky_kernel_memory_limit() {
+    sky_cursor *cursor = test_cursor();
+    int64_t dimension_ids[] = {-2};
+    sky_kernel *kernel = sky_kernel_new();
+    sky_kernel_add_group(kernel, 1, dimension_ids, 0, NULL);
+    mu_assert_int_equals(sky_kernel_bind(kernel, cursor), 0);
+    sky_kernel_set_memory_limit(kernel, 64);
+    mu_assert_int_equals(sky_kernel_run(kernel, cursor), -1);
+    sky_kernel_free(kernel);
+    sky_cursor_free(cursor);
+    return 0;
+}
+
+
+//==============================================================================
+//
+// Setup
+//
+//==============================================================================
+
+int all_tests() {
+    mu_run_test(test_sky_kernel_bind);
+    mu_run_test(test_sky_kernel_run);
+    mu_run_test(test_sky_kernel_memory_limit);
+    return 0;
+}
+
+RUN_TESTS()
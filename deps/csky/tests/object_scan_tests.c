@@ -0,0 +1,608 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <leveldb/c.h>
+
+#include <sky/cursor.h>
+#include <sky/object_scan.h>
+#include <sky/timestamp.h>
+
+#include "minunit.h"
+
+//==============================================================================
+//
+// Fixtures
+//
+//==============================================================================
+
+typedef struct {
+    int32_t int_value;
+    uint32_t timestamp;
+    int64_t ts;
+} test_t;
+
+#define EVENT_AT_0(V)  "\x92" "\xD3\x00\x00\x00\x00\x00\x00\x00\x00" "\x81" "\x01" V
+#define EVENT_AT_1(V)  "\x92" "\xD3\x00\x00\x00\x00\x00\x10\x00\x00" "\x81" "\x01" V
+
+// Events holding a value of property -1, which is stored in a family.
+#define FAMILY_AT_0(V)  "\x92" "\xD3\x00\x00\x00\x00\x00\x00\x00\x00" "\x81" "\xFF" V
+#define FAMILY_AT_1(V)  "\x92" "\xD3\x00\x00\x00\x00\x00\x10\x00\x00" "\x81" "\xFF" V
+
+// Event indices holding only the first and last shifted timestamps.
+#define INDEX_AT_0  "\xDA\x00\x15" "\x01" "\x00\x00\x00\x00\x00\x00\x00\x00" "\x00\x00\x00\x00\x00\x00\x00\x00" "\x00\x00\x00\x00"
+#define INDEX_AT_1  "\xDA\x00\x15" "\x01" "\x00\x00\x10\x00\x00\x00\x00\x00" "\x00\x00\x10\x00\x00\x00\x00\x00" "\x00\x00\x00\x00"
+
+// A checkpoint of property 1 in front of an event and an index with an
+// entry for it.
+#define CHECKPOINT_AT_1(V)  "\xC7" "\x92" "\xD3\x00\x00\x00\x00\x00\x10\x00\x00" "\x81" "\x01" V
+#define CHECKPOINT_INDEX_AT_1  "\xDA\x00\x21" "\x01" "\x00\x00\x10\x00\x00\x00\x00\x00" "\x00\x00\x10\x00\x00\x00\x00\x00" "\x01\x00\x00\x00" \
+                               "\x00\x00\x10\x00\x00\x00\x00\x00" "\x00\x00\x00\x00"
+
+// A version 2 index has the number of events of its stream.
+#define INDEX2_AT_0(N)  "\xDA\x00\x19" "\x02" "\x00\x00\x00\x00\x00\x00\x00\x00" "\x00\x00\x00\x00\x00\x00\x00\x00" "\x00\x00\x00\x00" \
+                        N "\x00\x00\x00"
+
+#define PUT(DB, K, V) do {\
+    char *err = NULL;\
+    leveldb_writeoptions_t *wo = leveldb_writeoptions_create();\
+    leveldb_put(DB, wo, K, sizeof(K) - 1, V, sizeof(V) - 1, &err);\
+    leveldb_writeoptions_destroy(wo);\
+    mu_assert_with_msg(err == NULL, "Put failed: %s", err);\
+} while(0)
+
+// Writes a table "P" with a single piece object, a chunked object, an object
+// in a skipped range and a last object, followed by a key of another table.
+// The first two objects have their state stored under its own key and the
+// last one keeps it in its head.
+leveldb_t *open_fixture_db() {
+    char *err = NULL;
+    leveldb_options_t *options = leveldb_options_create();
+    leveldb_options_set_create_if_missing(options, 1);
+    leveldb_t *db = leveldb_open(options, "tmp/object_scan", &err);
+    leveldb_options_destroy(options);
+    if(err != NULL) {
+        fprintf(stderr, "Open failed: %s\n", err);
+        return NULL;
+    }
+    return db;
+}
+
+int write_fixture(leveldb_t *db) {
+    PUT(db, "P\xA1" "a", "\xA0" "\xA0" EVENT_AT_0("\x02"));
+    PUT(db, "P\xA1" "a" "\x01", "\x0C" EVENT_AT_0("\x08"));
+    PUT(db, "P\xA1" "b", "\xA0" CHECKPOINT_INDEX_AT_1 CHECKPOINT_AT_1("\x03") EVENT_AT_1("\x04"));
+    PUT(db, "P\xA1" "b" "\x00" "\x80\x00\x00\x00\x00\x00\x00\x00", INDEX_AT_0 EVENT_AT_0("\x03"));
+    PUT(db, "P\xA1" "b" "\x01", "\x0C" EVENT_AT_1("\x09"));
+    PUT(db, "P\xA1" "c", "\xA0" "\xA0" EVENT_AT_0("\x05"));
+    PUT(db, "P\xA1" "d", "\xAD" EVENT_AT_1("\x0A") "\xA0" EVENT_AT_0("\x06"));
+    PUT(db, "Q\xA1" "a", "\xA0" "\xA0" EVENT_AT_0("\x07"));
+    leveldb_compact_range(db, NULL, 0, NULL, 0);
+    return 0;
+}
+
+leveldb_iterator_t *create_iterator(leveldb_t *db) {
+    leveldb_readoptions_t *ro = leveldb_readoptions_create();
+    leveldb_readoptions_set_fill_cache(ro, 0);
+    leveldb_readoptions_set_pin_data(ro, 1);
+    leveldb_iterator_t *iterator = leveldb_create_iterator(db, ro);
+    leveldb_readoptions_destroy(ro);
+    leveldb_iter_seek(iterator, "P", 1);
+    return iterator;
+}
+
+sky_cursor *create_cursor(sky_object_scan *scan) {
+    sky_cursor *cursor = sky_cursor_new(0, 1);
+    sky_cursor_set_ts_offset(cursor, offsetof(test_t, ts));
+    sky_cursor_set_timestamp_offset(cursor, offsetof(test_t, timestamp));
+    sky_cursor_set_property(cursor, 1, offsetof(test_t, int_value), sizeof(int32_t), "integer");
+    sky_cursor_set_data_sz(cursor, sizeof(test_t));
+    if(scan != NULL) sky_cursor_set_object_scan(cursor, scan);
+    return cursor;
+}
+
+
+//==============================================================================
+//
+// Test Cases
+//
+//==============================================================================
+
+int test_sky_object_scan_next_object() {
+    leveldb_t *db = open_fixture_db();
+    mu_assert_bool(db != NULL);
+    mu_assert_int_equals(write_fixture(db), 0);
+
+    sky_object_scan *scan = sky_object_scan_new();
+    sky_object_scan_set_prefix(scan, "P", 1);
+    sky_object_scan_add_skip_range(scan, "P\xA1" "c", 3, "P\xA1" "d", 3);
+    leveldb_iterator_t *iterator = create_iterator(db);
+    sky_object_scan_set_iterator(scan, iterator);
+    sky_cursor *cursor = create_cursor(scan);
+    test_t *obj = (test_t*)cursor->data;
+
+    // A single piece is read in place.
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(scan->buffer == NULL);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 2);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+
+    // Chunks come before the tail.
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 3);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 4);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+
+    // The skipped object is passed over and the scan ends with the table.
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 6);
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+
+    sky_cursor_free(cursor);
+    sky_object_scan_free(scan);
+    leveldb_iter_destroy(iterator);
+    leveldb_close(db);
+    return 0;
+}
+
+int test_sky_object_scan_time_range() {
+    leveldb_t *db = open_fixture_db();
+    mu_assert_bool(db != NULL);
+    mu_assert_int_equals(write_fixture(db), 0);
+
+    sky_object_scan *scan = sky_object_scan_new();
+    sky_object_scan_set_prefix(scan, "P", 1);
+    sky_object_scan_set_end_key(scan, "P\xA1" "c", 3);
+    leveldb_iterator_t *iterator = create_iterator(db);
+    sky_object_scan_set_iterator(scan, iterator);
+    sky_cursor *cursor = create_cursor(scan);
+    sky_cursor_set_time_range(cursor, sky_timestamp_shift(1000000LL), sky_timestamp_shift(2000000LL));
+    test_t *obj = (test_t*)cursor->data;
+
+    // Streams without an index are read and filtered by the cursor.
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+
+    // The chunk before the range is dropped since the tail starts with a
+    // checkpoint.
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    uint64_t event_count = cursor->event_count;
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 4);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals((int)(cursor->event_count - event_count), 1);
+
+    // The scan stops at the end key.
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+
+    sky_cursor_free(cursor);
+    sky_object_scan_free(scan);
+    leveldb_iter_destroy(iterator);
+    leveldb_close(db);
+    return 0;
+}
+
+int test_sky_object_scan_object_bounds() {
+    leveldb_t *db = open_fixture_db();
+    mu_assert_bool(db != NULL);
+    mu_assert_int_equals(write_fixture(db), 0);
+    PUT(db, "P\xA1" "e", "\xA0" INDEX2_AT_0("\x03") EVENT_AT_0("\x0B"));
+
+    sky_object_scan *scan = sky_object_scan_new();
+    sky_object_scan_set_prefix(scan, "P", 1);
+    leveldb_iterator_t *iterator = create_iterator(db);
+    sky_object_scan_set_iterator(scan, iterator);
+    sky_cursor *cursor = create_cursor(scan);
+    sky_cursor_set_object_bounds(cursor, 2, 0);
+    test_t *obj = (test_t*)cursor->data;
+
+    // The chunked object is counted by walking its streams since their
+    // indexes have no count. The last object is taken at its index's word.
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 3);
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 11);
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+    mu_assert_int_equals((int)cursor->object_count, 2);
+
+    // Only the chunked object spans a second.
+    sky_cursor_set_object_bounds(cursor, 0, sky_timestamp_shift(1000000LL));
+    leveldb_iter_seek(iterator, "P", 1);
+    sky_object_scan_set_iterator(scan, iterator);
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 3);
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+
+    sky_cursor_free(cursor);
+    sky_object_scan_free(scan);
+    leveldb_iter_destroy(iterator);
+    char *err = NULL;
+    leveldb_writeoptions_t *wo = leveldb_writeoptions_create();
+    leveldb_delete(db, wo, "P\xA1" "e", 3, &err);
+    leveldb_writeoptions_destroy(wo);
+    mu_assert_bool(err == NULL);
+    leveldb_close(db);
+    return 0;
+}
+
+int test_sky_object_scan_sample() {
+    leveldb_t *db = open_fixture_db();
+    mu_assert_bool(db != NULL);
+    mu_assert_int_equals(write_fixture(db), 0);
+
+    sky_object_scan *scan = sky_object_scan_new();
+    sky_object_scan_set_prefix(scan, "P", 1);
+    leveldb_iterator_t *iterator = create_iterator(db);
+    sky_object_scan_set_iterator(scan, iterator);
+    sky_cursor *cursor = create_cursor(scan);
+    sky_cursor_set_sample(cursor, 0.5);
+    test_t *obj = (test_t*)cursor->data;
+
+    // Only the objects whose keys are in the sample are read, chunks
+    // included.
+    const char *keys[] = {"P\xA1" "a", "P\xA1" "b", "P\xA1" "c", "P\xA1" "d"};
+    int32_t values[] = {2, 3, 5, 6};
+    int i;
+    for(i=0; i<4; i++) {
+        if(!sky_cursor_sample_key(cursor, keys[i], 3)) continue;
+        mu_assert_bool(sky_cursor_next_object(cursor));
+        mu_assert_bool(sky_lua_cursor_next_event(cursor));
+        mu_assert_int_equals(obj->int_value, values[i]);
+    }
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+
+    sky_cursor_free(cursor);
+    sky_object_scan_free(scan);
+    leveldb_iter_destroy(iterator);
+    leveldb_close(db);
+    return 0;
+}
+
+int test_sky_object_scan_state_only() {
+    leveldb_t *db = open_fixture_db();
+    mu_assert_bool(db != NULL);
+    mu_assert_int_equals(write_fixture(db), 0);
+
+    sky_object_scan *scan = sky_object_scan_new();
+    sky_object_scan_set_prefix(scan, "P", 1);
+    leveldb_iterator_t *iterator = create_iterator(db);
+    sky_object_scan_set_iterator(scan, iterator);
+    sky_cursor *cursor = create_cursor(scan);
+    sky_cursor_set_state_only(cursor, true);
+    test_t *obj = (test_t*)cursor->data;
+
+    // States stored under their own key are read past any chunks.
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 8);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 9);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+
+    // Objects without a state are passed over and older objects are read
+    // from the front of their head.
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 10);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+
+    // Frozen objects are read from the front of their value.
+    uint8_t data[] = "\xAD" EVENT_AT_0("\x0B") INDEX_AT_0 EVENT_AT_0("\x02");
+    uint8_t index[SKY_FROZEN_INDEX_ENTRY_SIZE];
+    memset(index, 0, sizeof(index));
+    index[8] = (uint8_t)(sizeof(data) - 1);
+    sky_frozen_scan *frozen_scan = sky_frozen_scan_new();
+    sky_frozen_scan_set_range(frozen_scan, data, index, 0, 1);
+    sky_cursor_set_frozen_scan(cursor, frozen_scan);
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 11);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+
+    sky_cursor_free(cursor);
+    sky_frozen_scan_free(frozen_scan);
+    sky_object_scan_free(scan);
+    leveldb_iter_destroy(iterator);
+    leveldb_close(db);
+    return 0;
+}
+
+int test_sky_object_scan_members() {
+    leveldb_t *db = open_fixture_db();
+    mu_assert_bool(db != NULL);
+    mu_assert_int_equals(write_fixture(db), 0);
+
+    sky_object_scan *scan = sky_object_scan_new();
+    sky_object_scan_set_prefix(scan, "P", 1);
+    leveldb_iterator_t *iterator = create_iterator(db);
+    sky_object_scan_set_iterator(scan, iterator);
+    sky_cursor *cursor = create_cursor(scan);
+    test_t *obj = (test_t*)cursor->data;
+
+    // Only members are read, chunks included, and each marked object's key
+    // is kept once.
+    uint32_t offsets[] = {0, 3, 6};
+    mu_assert_int_equals(sky_cursor_set_members(cursor, "P\xA1" "bP\xA1" "dP\xA1" "e", 9, offsets, 3), 0);
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 3);
+    sky_cursor_mark_object(cursor);
+    sky_cursor_mark_object(cursor);
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 6);
+    sky_cursor_mark_object(cursor);
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+
+    size_t sz;
+    const char *marks = (const char*)sky_cursor_marks(cursor, &sz);
+    mu_assert_int_equals((int)sz, 14);
+    mu_assert_bool(memcmp(marks, "\x03\x00\x00\x00" "P\xA1" "b" "\x03\x00\x00\x00" "P\xA1" "d", 14) == 0);
+    sky_cursor_clear_marks(cursor);
+    sky_cursor_marks(cursor, &sz);
+    mu_assert_int_equals((int)sz, 0);
+
+    // Members aren't matched by their prefixes.
+    mu_assert_bool(!sky_cursor_member_key(cursor, "P\xA1", 2));
+    mu_assert_bool(!sky_cursor_member_key(cursor, "P\xA1" "d" "\x00", 4));
+    sky_cursor_clear_members(cursor);
+    mu_assert_bool(sky_cursor_member_key(cursor, "P\xA1", 2));
+
+    sky_cursor_free(cursor);
+    sky_object_scan_free(scan);
+    leveldb_iter_destroy(iterator);
+    leveldb_close(db);
+    return 0;
+}
+
+int test_sky_object_scan_heavy() {
+    leveldb_t *db = open_fixture_db();
+    mu_assert_bool(db != NULL);
+    mu_assert_int_equals(write_fixture(db), 0);
+
+    sky_object_scan *scan = sky_object_scan_new();
+    sky_object_scan_set_prefix(scan, "P", 1);
+    leveldb_iterator_t *iterator = create_iterator(db);
+    sky_object_scan_set_iterator(scan, iterator);
+    sky_cursor *cursor = create_cursor(scan);
+
+    // Objects are weighed by the events read from them as the cursor moves
+    // past them. Lighter objects don't replace ones of the same weight.
+    mu_assert_int_equals(sky_cursor_set_heavy_capacity(cursor, 2), 0);
+    while(sky_cursor_next_object(cursor)) {
+        while(sky_lua_cursor_next_event(cursor));
+    }
+    mu_assert_int_equals(sky_cursor_heavy_count(cursor), 2);
+    uint32_t i;
+    bool found_a = false, found_b = false;
+    for(i=0; i<2; i++) {
+        size_t sz;
+        uint64_t event_count;
+        const char *key = (const char*)sky_cursor_heavy_object_key(cursor, i, &sz, &event_count);
+        mu_assert_int_equals((int)sz, 3);
+        if(memcmp(key, "P\xA1" "a", 3) == 0) {
+            mu_assert_int_equals((int)event_count, 1);
+            found_a = true;
+        } else if(memcmp(key, "P\xA1" "b", 3) == 0) {
+            mu_assert_int_equals((int)event_count, 2);
+            found_b = true;
+        }
+    }
+    mu_assert_bool(found_a && found_b);
+    sky_cursor_clear_heavy(cursor);
+    mu_assert_int_equals(sky_cursor_heavy_count(cursor), 0);
+
+    sky_cursor_free(cursor);
+    sky_object_scan_free(scan);
+    leveldb_iter_destroy(iterator);
+    leveldb_close(db);
+    return 0;
+}
+
+int test_sky_object_scan_families() {
+    leveldb_t *db = open_fixture_db();
+    mu_assert_bool(db != NULL);
+    mu_assert_int_equals(write_fixture(db), 0);
+    PUT(db, "P\xA1" "a" "\x02" "cold", "\xA0" "\xA0" FAMILY_AT_0("\x0C"));
+    PUT(db, "P\xA1" "a" "\x02" "other", "\xA0" "\xA0" FAMILY_AT_0("\x0E"));
+    PUT(db, "P\xA1" "b" "\x02" "cold", "\xA0" INDEX_AT_1 FAMILY_AT_1("\x0D"));
+    leveldb_compact_range(db, NULL, 0, NULL, 0);
+
+    sky_object_scan *scan = sky_object_scan_new();
+    sky_object_scan_set_prefix(scan, "P", 1);
+    mu_assert_int_equals(sky_object_scan_add_family(scan, "cold", 4), 0);
+    leveldb_iterator_t *iterator = create_iterator(db);
+    sky_object_scan_set_iterator(scan, iterator);
+    sky_cursor *cursor = create_cursor(scan);
+    sky_cursor_set_property(cursor, -1, offsetof(test_t, int_value), sizeof(int32_t), "integer");
+    test_t *obj = (test_t*)cursor->data;
+
+    // Only the families added to the scan are read and their values are
+    // decoded after the object's own.
+    int expected[] = {12, -1, 3, 13, -1, 5, -1, 6, -1};
+    int i;
+    for(i=0; i<9; i++) {
+        if(expected[i] < 0) {
+            mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+            continue;
+        }
+        if(i == 0 || expected[i-1] < 0) {
+            mu_assert_bool(sky_cursor_next_object(cursor));
+        }
+        mu_assert_bool(sky_lua_cursor_next_event(cursor));
+        mu_assert_int_equals(obj->int_value, expected[i]);
+    }
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+
+    // Scans that read no families seek past all of them.
+    sky_object_scan_clear_families(scan);
+    sky_object_scan_set_has_families(scan, true);
+    leveldb_iter_seek(iterator, "P", 1);
+    sky_object_scan_set_iterator(scan, iterator);
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 2);
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 3);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 4);
+
+    sky_cursor_free(cursor);
+    sky_object_scan_free(scan);
+    leveldb_iter_destroy(iterator);
+    leveldb_close(db);
+    return 0;
+}
+
+int test_sky_object_scan_pipelined() {
+    leveldb_t *db = open_fixture_db();
+    mu_assert_bool(db != NULL);
+    mu_assert_int_equals(write_fixture(db), 0);
+    PUT(db, "P\xA1" "b" "\x02" "hot", "\xA0" INDEX_AT_1 FAMILY_AT_1("\x0D"));
+    leveldb_compact_range(db, NULL, 0, NULL, 0);
+
+    sky_object_scan *scan = sky_object_scan_new();
+    sky_object_scan_set_prefix(scan, "P", 1);
+    sky_object_scan_add_skip_range(scan, "P\xA1" "c", 3, "P\xA1" "d", 3);
+    mu_assert_int_equals(sky_object_scan_add_family(scan, "hot", 3), 0);
+    mu_assert_int_equals(sky_object_scan_set_pipeline_depth(scan, 2), 0);
+    leveldb_iterator_t *iterator = create_iterator(db);
+    sky_object_scan_set_iterator(scan, iterator);
+    sky_cursor *cursor = create_cursor(scan);
+    sky_cursor_set_property(cursor, -1, offsetof(test_t, int_value), sizeof(int32_t), "integer");
+    test_t *obj = (test_t*)cursor->data;
+
+    // Objects are copied into the ring with their keys and families.
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(scan->running);
+    mu_assert_int_equals((int)cursor->object_key_sz, 3);
+    mu_assert_bool(memcmp(cursor->object_key, "P\xA1" "a", 3) == 0);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 2);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(memcmp(cursor->object_key, "P\xA1" "b", 3) == 0);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 3);
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 13);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 6);
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+    mu_assert_bool(!scan->running);
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+
+    // Detaching the iterator mid-scan stops the producer.
+    leveldb_iter_seek(iterator, "P", 1);
+    sky_object_scan_set_iterator(scan, iterator);
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 2);
+    sky_object_scan_set_iterator(scan, NULL);
+    mu_assert_bool(!scan->running);
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+
+    sky_cursor_free(cursor);
+    sky_object_scan_free(scan);
+    leveldb_iter_destroy(iterator);
+    leveldb_close(db);
+    return 0;
+}
+
+int test_sky_frozen_scan_next_object() {
+    // Two objects back to back, the first one indexed at timestamp zero and
+    // the second at timestamp one, followed by an entry of size zero.
+    uint8_t data[] = "\xA0" INDEX_AT_0 EVENT_AT_0("\x02") "\xA0" INDEX_AT_1 EVENT_AT_1("\x04");
+    size_t object_sz = (sizeof(data) - 1) / 2;
+    uint8_t index[SKY_FROZEN_INDEX_ENTRY_SIZE * 3];
+    memset(index, 0, sizeof(index));
+    index[0] = 0;
+    index[8] = (uint8_t)object_sz;
+    index[16] = (uint8_t)object_sz;
+    index[24] = (uint8_t)object_sz;
+
+    sky_frozen_scan *scan = sky_frozen_scan_new();
+    sky_frozen_scan_set_range(scan, data, index, 0, 3);
+    sky_cursor *cursor = create_cursor(NULL);
+    sky_cursor_set_frozen_scan(cursor, scan);
+    test_t *obj = (test_t*)cursor->data;
+
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 2);
+    mu_assert_bool(!sky_lua_cursor_next_event(cursor));
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 4);
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+
+    // Objects outside of the time range are skipped by their index.
+    sky_frozen_scan_set_range(scan, data, index, 0, 3);
+    sky_cursor_set_time_range(cursor, sky_timestamp_shift(1000000LL), sky_timestamp_shift(2000000LL));
+    mu_assert_bool(sky_cursor_next_object(cursor));
+    mu_assert_bool(sky_lua_cursor_next_event(cursor));
+    mu_assert_int_equals(obj->int_value, 4);
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+
+    // Objects outside of the sample are skipped by their key.
+    uint8_t keys[] = "P\xA1" "aP\xA1" "cP\xA1" "d";
+    index[12] = 0;
+    index[28] = 3;
+    index[44] = 6;
+    sky_cursor_clear_time_range(cursor);
+    sky_cursor_set_sample(cursor, 0.5);
+    sky_frozen_scan_set_range(scan, data, index, 0, 2);
+    sky_frozen_scan_set_keys(scan, keys, sizeof(keys) - 1, 3);
+    if(sky_cursor_sample_key(cursor, keys, 3)) {
+        mu_assert_bool(sky_cursor_next_object(cursor));
+        mu_assert_bool(sky_lua_cursor_next_event(cursor));
+        mu_assert_int_equals(obj->int_value, 2);
+    }
+    if(sky_cursor_sample_key(cursor, keys + 3, 3)) {
+        mu_assert_bool(sky_cursor_next_object(cursor));
+        mu_assert_bool(sky_lua_cursor_next_event(cursor));
+        mu_assert_int_equals(obj->int_value, 4);
+    }
+    mu_assert_bool(!sky_cursor_next_object(cursor));
+
+    sky_cursor_free(cursor);
+    sky_frozen_scan_free(scan);
+    return 0;
+}
+
+
+//==============================================================================
+//
+// Setup
+//
+//==============================================================================
+
+int all_tests() {
+    mu_run_test(test_sky_object_scan_next_object);
+    mu_run_test(test_sky_object_scan_time_range);
+    mu_run_test(test_sky_object_scan_object_bounds);
+    mu_run_test(test_sky_object_scan_sample);
+    mu_run_test(test_sky_object_scan_state_only);
+    mu_run_test(test_sky_object_scan_members);
+    mu_run_test(test_sky_object_scan_heavy);
+    mu_run_test(test_sky_object_scan_families);
+    mu_run_test(test_sky_object_scan_pipelined);
+    mu_run_test(test_sky_frozen_scan_next_object);
+    return 0;
+}
+
+RUN_TESTS()
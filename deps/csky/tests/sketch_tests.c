@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <sky/sketch.h>
+
+#include "minunit.h"
+
+//==============================================================================
+//
+// Test Cases
+//
+//==============================================================================
+
+//--------------------------------------
+// Sketches
+//--------------------------------------
+
+int test_sky_sketch_init() {
+    uint8_t hll[SKY_HLL_SZ];
+    uint8_t quantile[SKY_QUANTILE_SZ];
+    mu_assert_int_equals(sky_sketch_init(hll, SKY_SKETCH_TYPE_HLL), 0);
+    mu_assert_int_equals(sky_sketch_init(quantile, SKY_SKETCH_TYPE_QUANTILE), 0);
+    mu_assert_int_equals(sky_sketch_init(hll, 0), -1);
+    mu_assert_int_equals(sky_sketch_sz(hll), SKY_HLL_SZ);
+    mu_assert_int_equals(sky_sketch_sz(quantile), SKY_QUANTILE_SZ);
+    mu_assert_int_equals(sky_sketch_merge(hll, quantile), -1);
+    return 0;
+}
+
+
+//--------------------------------------
+// HyperLogLog
+//--------------------------------------
+
+int test_sky_hll_add() {
+    uint8_t a[SKY_HLL_SZ], b[SKY_HLL_SZ], c[SKY_HLL_SZ];
+    sky_sketch_init(a, SKY_SKETCH_TYPE_HLL);
+    sky_sketch_init(b, SKY_SKETCH_TYPE_HLL);
+    sky_sketch_init(c, SKY_SKETCH_TYPE_HLL);
+
+    // Duplicates don't change the sketch.
+    sky_hll_add_string(a, "foo", 3);
+    memcpy(c, a, SKY_HLL_SZ);
+    sky_hll_add_string(a, "foo", 3);
+    mu_assert_bool(memcmp(a, c, SKY_HLL_SZ) == 0);
+    sky_hll_add_double(a, 0);
+    sky_hll_add_double(c, -0.0);
+    mu_assert_bool(memcmp(a, c, SKY_HLL_SZ) == 0);
+
+    // Merging is the same as adding everything to one sketch.
+    int i;
+    for(i=0; i<1000; i++) {
+        sky_hll_add_double((i < 500 ? a : b), (double)i);
+        sky_hll_add_double(c, (double)i);
+    }
+    mu_assert_int_equals(sky_sketch_merge(a, b), 0);
+    mu_assert_bool(memcmp(a, c, SKY_HLL_SZ) == 0);
+    return 0;
+}
+
+
+//--------------------------------------
+// Quantiles
+//--------------------------------------
+
+int test_sky_quantile_add() {
+    uint8_t a[SKY_QUANTILE_SZ], b[SKY_QUANTILE_SZ];
+    sky_sketch_init(a, SKY_SKETCH_TYPE_QUANTILE);
+    sky_sketch_init(b, SKY_SKETCH_TYPE_QUANTILE);
+
+    sky_quantile_add(a, 0);
+    sky_quantile_add(a, 1);
+    sky_quantile_add(a, 1.01);
+    sky_quantile_add(b, -1);
+    sky_quantile_add(b, 1e300);
+    sky_quantile_add(b, NAN);
+    mu_assert_int_equals(sky_sketch_merge(a, b), 0);
+
+    // Values within the accuracy share a bucket and extremes are clamped.
+    uint8_t *zero = a + SKY_SKETCH_HEADER_SZ;
+    uint8_t *negative = zero + 8;
+    uint8_t *positive = negative + (4 * SKY_QUANTILE_BUCKET_COUNT);
+    mu_assert_int_equals(zero[0], 1);
+    mu_assert_int_equals(negative[4 * (SKY_QUANTILE_BUCKET_COUNT / 2)], 1);
+    mu_assert_int_equals(positive[4 * (SKY_QUANTILE_BUCKET_COUNT / 2)], 1);
+    mu_assert_int_equals(positive[4 * ((SKY_QUANTILE_BUCKET_COUNT / 2) + 1)], 1);
+    mu_assert_int_equals(positive[4 * (SKY_QUANTILE_BUCKET_COUNT - 1)], 1);
+    return 0;
+}
+
+
+//--------------------------------------
+// Histograms
+//--------------------------------------
+
+int test_sky_histogram_add() {
+    uint8_t a[SKY_HISTOGRAM_SZ(4)], b[SKY_HISTOGRAM_SZ(4)], c[SKY_HISTOGRAM_SZ(2)];
+    mu_assert_int_equals(sky_histogram_init(a, 0, 100, 4), 0);
+    mu_assert_int_equals(sky_histogram_init(b, 0, 100, 4), 0);
+    mu_assert_int_equals(sky_histogram_init(c, 0, 100, 2), 0);
+    mu_assert_int_equals(sky_histogram_init(c, 100, 0, 2), -1);
+    mu_assert_int_equals(sky_histogram_init(c, 0, 100, 0), -1);
+    mu_assert_int_equals(sky_sketch_sz(a), SKY_HISTOGRAM_SZ(4));
+
+    sky_histogram_add(a, 0);
+    sky_histogram_add(a, 24.9);
+    sky_histogram_add(a, 25);
+    sky_histogram_add(b, -10);
+    sky_histogram_add(b, 100);
+    sky_histogram_add(b, NAN);
+    mu_assert_int_equals(sky_sketch_merge(a, b), 0);
+    mu_assert_int_equals(sky_sketch_merge(a, c), -1);
+
+    // Values outside of the range are clamped into the end buckets.
+    uint8_t *counts = a + SKY_HISTOGRAM_HEADER_SZ;
+    mu_assert_int_equals(counts[0], 3);
+    mu_assert_int_equals(counts[4], 1);
+    mu_assert_int_equals(counts[8], 0);
+    mu_assert_int_equals(counts[12], 1);
+    return 0;
+}
+
+
+//==============================================================================
+//
+// Setup
+//
+//==============================================================================
+
+int all_tests() {
+    mu_run_test(test_sky_sketch_init);
+    mu_run_test(test_sky_hll_add);
+    mu_run_test(test_sky_quantile_add);
+    mu_run_test(test_sky_histogram_add);
+    return 0;
+}
+
+RUN_TESTS()
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sky/timestamp.h>
+
+#include "minunit.h"
+
+//==============================================================================
+//
+// Test Cases
+//
+//==============================================================================
+
+//--------------------------------------
+// Bucketing
+//--------------------------------------
+
+int test_sky_timestamp_bucket() {
+    // 2012-01-04T13:45:10.5Z is a Wednesday.
+    int64_t ts = sky_timestamp_shift(1325684710500000LL);
+    mu_assert_int64_equals(sky_timestamp_bucket(ts, 3600, 0), 1325682000LL);
+    mu_assert_int64_equals(sky_timestamp_bucket(ts, 86400, 0), 1325635200LL);
+    mu_assert_int64_equals(sky_timestamp_bucket(ts, 604800, 345600), 1325462400LL);
+
+    // Times before the epoch round down too.
+    mu_assert_int64_equals(sky_timestamp_bucket(sky_timestamp_shift(-1000000LL), 3600, 0), -3600LL);
+    mu_assert_int64_equals(sky_timestamp_bucket(sky_timestamp_shift(-3600000000LL), 3600, 0), -3600LL);
+    return 0;
+}
+
+
+//--------------------------------------
+// Clock
+//--------------------------------------
+
+int test_sky_clock_ns() {
+    double a = sky_clock_ns();
+    double b = sky_clock_ns();
+    mu_assert_bool(a > 0);
+    mu_assert_bool(b >= a);
+    return 0;
+}
+
+
+//==============================================================================
+//
+// Setup
+//
+//==============================================================================
+
+int all_tests() {
+    mu_run_test(test_sky_timestamp_bucket);
+    mu_run_test(test_sky_clock_ns);
+    return 0;
+}
+
+RUN_TESTS()
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sky/topk.h>
+
+#include "minunit.h"
+
+//==============================================================================
+//
+// Test Cases
+//
+//==============================================================================
+
+//--------------------------------------
+// Weights
+//--------------------------------------
+
+int test_sky_topk_insert() {
+    sky_topk *topk = sky_topk_new(3);
+    mu_assert_int_equals(sky_topk_insert(topk, 5), 0);
+    mu_assert_int_equals(sky_topk_insert(topk, 1), 1);
+    mu_assert_int_equals(sky_topk_insert(topk, 3), 2);
+    mu_assert_int_equals(topk->heap[0], 1);
+
+    // A full top-k replaces the lightest slot and keeps its weight.
+    mu_assert_int_equals(sky_topk_insert(topk, 1), 1);
+    mu_assert_bool(sky_topk_weight(topk, 1) == 2);
+    mu_assert_int_equals(sky_topk_insert(topk, 2), 1);
+    mu_assert_bool(sky_topk_weight(topk, 1) == 4);
+    mu_assert_int_equals(topk->heap[0], 2);
+    sky_topk_free(topk);
+    return 0;
+}
+
+int test_sky_topk_add() {
+    sky_topk *topk = sky_topk_new(4);
+    sky_topk_insert(topk, 1);
+    sky_topk_insert(topk, 2);
+    sky_topk_insert(topk, 3);
+    sky_topk_insert(topk, 4);
+    sky_topk_add(topk, 0, 10);
+    mu_assert_int_equals(topk->heap[0], 1);
+    sky_topk_add(topk, 3, -4);
+    mu_assert_int_equals(topk->heap[0], 3);
+    mu_assert_bool(sky_topk_weight(topk, 0) == 11);
+    mu_assert_bool(sky_topk_weight(topk, 9) == 0);
+    mu_assert_bool(sky_topk_new(0) == NULL);
+    sky_topk_free(topk);
+    return 0;
+}
+
+
+//==============================================================================
+//
+// Setup
+//
+//==============================================================================
+
+int all_tests() {
+    mu_run_test(test_sky_topk_insert);
+    mu_run_test(test_sky_topk_add);
+    return 0;
+}
+
+RUN_TESTS()
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sky/worker_pool.h>
+
+#include "minunit.h"
+
+//==============================================================================
+//
+// Helpers
+//
+//==============================================================================
+
+static void increment(void *arg)
+{
+    __atomic_add_fetch((uint32_t*)arg, 1, __ATOMIC_SEQ_CST);
+}
+
+// Waits for the pool's descriptor and drains until a number of tasks have
+// finished. Returns the sum of their ids.
+static uint64_t wait_for(sky_worker_pool *pool, uint32_t count)
+{
+    uint64_t sum = 0;
+    uint64_t ids[16];
+    char buf[16];
+    while(count > 0) {
+        if(read(sky_worker_pool_fd(pool), buf, sizeof(buf)) <= 0) break;
+        uint32_t n;
+        while((n = sky_worker_pool_drain(pool, ids, 16)) > 0) {
+            uint32_t i;
+            for(i=0; i<n; i++) sum += ids[i];
+            count -= n;
+        }
+    }
+    return sum;
+}
+
+
+//==============================================================================
+//
+// Test Cases
+//
+//==============================================================================
+
+//--------------------------------------
+// Tasks
+//--------------------------------------
+
+int test_sky_worker_pool_submit() {
+    uint32_t counter = 0;
+    sky_worker_pool *pool = sky_worker_pool_new(4, 16, true);
+    mu_assert_bool(pool != NULL);
+
+    uint32_t round, i;
+    for(round=0; round<100; round++) {
+        uint64_t expected = 0;
+        for(i=1; i<=16; i++) {
+            mu_assert_int_equals(sky_worker_pool_submit(pool, increment, &counter, round * 16 + i), 0);
+            expected += round * 16 + i;
+        }
+        mu_assert_bool(wait_for(pool, 16) == expected);
+    }
+    mu_assert_int_equals(counter, 1600);
+    sky_worker_pool_free(pool);
+    return 0;
+}
+
+int test_sky_worker_pool_new_bound() {
+    uint32_t counter = 0;
+    int cpus[] = {0};
+    sky_worker_pool *pool = sky_worker_pool_new_bound(2, 16, cpus, 1, 0);
+    mu_assert_bool(pool != NULL);
+    uint32_t i;
+    for(i=0; i<16; i++) {
+        sky_worker_pool_submit(pool, increment, &counter, 1);
+    }
+    mu_assert_bool(wait_for(pool, 16) == 16);
+    mu_assert_int_equals(counter, 16);
+    sky_worker_pool_free(pool);
+    return 0;
+}
+
+int test_sky_worker_pool_stop() {
+    uint32_t counter = 0;
+    sky_worker_pool *pool = sky_worker_pool_new(2, 64, false);
+    uint32_t i;
+    for(i=0; i<64; i++) {
+        sky_worker_pool_submit(pool, increment, &counter, 1);
+    }
+
+    // Stopping runs every submitted task and ends the descriptor after the
+    // last completion.
+    sky_worker_pool_stop(pool);
+    mu_assert_int_equals(counter, 64);
+    mu_assert_bool(wait_for(pool, 64) == 64);
+    char c;
+    mu_assert_int_equals((int)read(sky_worker_pool_fd(pool), &c, 1), 0);
+    mu_assert_int_equals(sky_worker_pool_submit(pool, increment, &counter, 1), -1);
+    sky_worker_pool_free(pool);
+
+    mu_assert_bool(sky_worker_pool_new(0, 16, false) == NULL);
+    mu_assert_bool(sky_worker_pool_new(1, 0, false) == NULL);
+    return 0;
+}
+
+
+//==============================================================================
+//
+// Setup
+//
+//==============================================================================
+
+int all_tests() {
+    mu_run_test(test_sky_worker_pool_submit);
+    mu_run_test(test_sky_worker_pool_new_bound);
+    mu_run_test(test_sky_worker_pool_stop);
+    return 0;
+}
+
+RUN_TESTS()
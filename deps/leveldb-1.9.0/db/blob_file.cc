@@ -0,0 +1,136 @@
+// Copyright (c) 2013 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/blob_file.h"
+
+#include "db/filename.h"
+#include "leveldb/env.h"
+#include "leveldb/options.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
+
+namespace leveldb {
+
+void BlobIndex::EncodeTo(std::string* dst) const {
+  PutVarint64(dst, file_number);
+  PutVarint64(dst, offset);
+  PutVarint64(dst, size);
+}
+
+Status BlobIndex::DecodeFrom(const Slice& input) {
+  Slice in = input;
+  if (GetVarint64(&in, &file_number) &&
+      GetVarint64(&in, &offset) &&
+      GetVarint64(&in, &size) &&
+      in.empty()) {
+    return Status::OK();
+  }
+  return Status::Corruption("bad blob index");
+}
+
+BlobFileBuilder::BlobFileBuilder(uint64_t file_number, WritableFile* file)
+    : file_number_(file_number),
+      file_(file),
+      offset_(0) {
+}
+
+Status BlobFileBuilder::Add(const Slice& value, std::string* index) {
+  char trailer[kBlobTrailerSize];
+  EncodeFixed32(trailer, crc32c::Mask(crc32c::Value(value.data(),
+                                                    value.size())));
+  Status s = file_->Append(value);
+  if (s.ok()) {
+    s = file_->Append(Slice(trailer, kBlobTrailerSize));
+  }
+  if (s.ok()) {
+    BlobIndex blob;
+    blob.file_number = file_number_;
+    blob.offset = offset_;
+    blob.size = value.size();
+    index->clear();
+    blob.EncodeTo(index);
+    offset_ += blob.record_size();
+  }
+  return s;
+}
+
+Status BlobFileBuilder::Finish() {
+  return file_->Sync();
+}
+
+void BlobCache::DeleteEntry(const Slice& key, void* value) {
+  delete reinterpret_cast<RandomAccessFile*>(value);
+}
+
+BlobCache::BlobCache(const std::string& dbname,
+                     const Options* options,
+                     int entries)
+    : env_(options->env),
+      dbname_(dbname),
+      cache_(NewLRUCache(entries)) {
+}
+
+BlobCache::~BlobCache() {
+  delete cache_;
+}
+
+Status BlobCache::Get(bool verify_checksum, const Slice& index,
+                      std::string* value) {
+  BlobIndex blob;
+  Status s = blob.DecodeFrom(index);
+  if (!s.ok()) {
+    return s;
+  }
+
+  char buf[sizeof(blob.file_number)];
+  EncodeFixed64(buf, blob.file_number);
+  Slice key(buf, sizeof(buf));
+  Cache::Handle* handle = cache_->Lookup(key);
+  if (handle == NULL) {
+    RandomAccessFile* file;
+    s = env_->NewRandomAccessFile(BlobFileName(dbname_, blob.file_number),
+                                  &file);
+    if (!s.ok()) {
+      // Errors are not cached so that a transient one goes away.
+      return s;
+    }
+    handle = cache_->Insert(key, file, 1, &DeleteEntry);
+  }
+  RandomAccessFile* file =
+      reinterpret_cast<RandomAccessFile*>(cache_->Value(handle));
+
+  // Read the record straight into *value, unless the file hands back
+  // memory of its own.
+  const size_t n = static_cast<size_t>(blob.record_size());
+  value->resize(n);
+  Slice record;
+  s = file->Read(blob.offset, n, &record, &(*value)[0]);
+  if (s.ok() && record.size() != n) {
+    s = Status::Corruption("truncated blob record");
+  }
+  if (s.ok() && verify_checksum) {
+    const uint32_t expected = crc32c::Unmask(
+        DecodeFixed32(record.data() + blob.size));
+    if (crc32c::Value(record.data(), blob.size) != expected) {
+      s = Status::Corruption("blob checksum mismatch");
+    }
+  }
+  if (!s.ok()) {
+    value->clear();
+  } else if (record.data() != value->data()) {
+    value->assign(record.data(), blob.size);
+  } else {
+    value->resize(blob.size);
+  }
+  cache_->Release(handle);
+  return s;
+}
+
+void BlobCache::Evict(uint64_t file_number) {
+  char buf[sizeof(file_number)];
+  EncodeFixed64(buf, file_number);
+  cache_->Erase(Slice(buf, sizeof(buf)));
+}
+
+}  // namespace leveldb
@@ -0,0 +1,111 @@
+// Copyright (c) 2013 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// Values of at least Options::min_blob_size are written by flushes and
+// compactions to blob files instead of into their tables, which keep an
+// entry of type kTypeBlobIndex that points at the value.  A blob file is
+// a sequence of records that is appended to once and never rewritten:
+//
+//    value: uint8[n]
+//    crc: fixed32      // Masked crc32c of value
+//
+// Compactions copy the index entries instead of the values, so a large
+// value is written once however many levels its key moves through.  The
+// bytes of the records whose entries a compaction drops are counted as
+// garbage of their blob file (see VersionEdit::AddBlobGarbage()), and a
+// blob file leaves the version once all of it is garbage.  Compactions
+// copy the live values out of blob files with too much garbage into new
+// ones, so that the old ones become all garbage too.
+
+#ifndef STORAGE_LEVELDB_DB_BLOB_FILE_H_
+#define STORAGE_LEVELDB_DB_BLOB_FILE_H_
+
+#include <stdint.h>
+#include <string>
+#include "leveldb/cache.h"
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class Env;
+struct Options;
+class WritableFile;
+
+// Size of the checksum that follows each value.
+static const size_t kBlobTrailerSize = 4;
+
+// The location of a value in a blob file, which is the value of its
+// kTypeBlobIndex entry.
+struct BlobIndex {
+  uint64_t file_number;
+  uint64_t offset;
+  uint64_t size;          // Size of the value, without its trailer
+
+  BlobIndex() : file_number(0), offset(0), size(0) { }
+
+  // Bytes of the blob file taken by the record.
+  uint64_t record_size() const { return size + kBlobTrailerSize; }
+
+  void EncodeTo(std::string* dst) const;
+  Status DecodeFrom(const Slice& input);
+};
+
+// Appends values to a new blob file.  Not thread-safe.
+class BlobFileBuilder {
+ public:
+  // Appends to "*file", which is owned by the caller and must stay open
+  // until Finish() has been called.
+  BlobFileBuilder(uint64_t file_number, WritableFile* file);
+
+  // Append "value" to the file and store the index that points to it in
+  // "*index".
+  Status Add(const Slice& value, std::string* index);
+
+  // Sync the records to the file.  The file is not closed.
+  Status Finish();
+
+  uint64_t file_number() const { return file_number_; }
+
+  // Size of the file so far.
+  uint64_t FileSize() const { return offset_; }
+
+ private:
+  const uint64_t file_number_;
+  WritableFile* const file_;
+  uint64_t offset_;
+
+  // No copying allowed
+  BlobFileBuilder(const BlobFileBuilder&);
+  void operator=(const BlobFileBuilder&);
+};
+
+// Keeps blob files open for reads.  Thread-safe.
+class BlobCache {
+ public:
+  BlobCache(const std::string& dbname, const Options* options, int entries);
+  ~BlobCache();
+
+  // Store in "*value" the value that the blob index "index" points to.
+  // The value's checksum is verified if "verify_checksum" is true.
+  Status Get(bool verify_checksum, const Slice& index, std::string* value);
+
+  // Close the specified blob file if it is open.
+  void Evict(uint64_t file_number);
+
+ private:
+  Env* const env_;
+  const std::string dbname_;
+  Cache* cache_;
+
+  static void DeleteEntry(const Slice& key, void* value);
+
+  // No copying allowed
+  BlobCache(const BlobCache&);
+  void operator=(const BlobCache&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_BLOB_FILE_H_
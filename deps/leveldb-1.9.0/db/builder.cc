@@ -4,6 +4,7 @@
 
 #include "db/builder.h"
 
+#include "db/blob_file.h"
 #include "db/filename.h"
 #include "db/dbformat.h"
 #include "db/table_cache.h"
@@ -19,28 +20,80 @@ Status BuildTable(const std::string& dbname,
                   const Options& options,
                   TableCache* table_cache,
                   Iterator* iter,
-                  FileMetaData* meta) {
+                  FileMetaData* meta,
+                  uint64_t blob_number,
+                  uint64_t* blob_size) {
   Status s;
   meta->file_size = 0;
+  meta->oldest_blob = 0;
+  if (blob_size != NULL) {
+    *blob_size = 0;
+  }
   iter->SeekToFirst();
 
   std::string fname = TableFileName(dbname, meta->number);
+  std::string blob_fname;
+  WritableFile* blob_file = NULL;
+  BlobFileBuilder* blob_builder = NULL;
+  if (blob_number != 0 && options.min_blob_size > 0) {
+    blob_fname = BlobFileName(dbname, blob_number);
+  }
   if (iter->Valid()) {
     WritableFile* file;
-    s = env->NewWritableFile(fname, &file);
+    s = env->NewBackgroundWritableFile(fname, &file);
     if (!s.ok()) {
       return s;
     }
 
     TableBuilder* builder = new TableBuilder(options, file);
     meta->smallest.DecodeFrom(iter->key());
+    meta->smallest_seq = kMaxSequenceNumber;
     for (; iter->Valid(); iter->Next()) {
       Slice key = iter->key();
       meta->largest.DecodeFrom(key);
-      builder->Add(key, iter->value());
+      const SequenceNumber seq = ExtractSequence(key);
+      if (seq < meta->smallest_seq) {
+        meta->smallest_seq = seq;
+      }
+      const Slice value = iter->value();
+      if (!blob_fname.empty() && value.size() >= options.min_blob_size &&
+          ExtractValueType(key) == kTypeValue) {
+        // Leave the value in the blob file and its index in the table.
+        if (blob_builder == NULL) {
+          s = env->NewBackgroundWritableFile(blob_fname, &blob_file);
+          if (!s.ok()) {
+            break;
+          }
+          blob_builder = new BlobFileBuilder(blob_number, blob_file);
+          meta->oldest_blob = blob_number;
+        }
+        std::string index;
+        s = blob_builder->Add(value, &index);
+        if (!s.ok()) {
+          break;
+        }
+        std::string blob_key;
+        AppendInternalKey(&blob_key, ParsedInternalKey(ExtractUserKey(key),
+                                                       seq, kTypeBlobIndex));
+        builder->Add(blob_key, index);
+      } else {
+        builder->Add(key, value);
+      }
     }
 
     // Finish and check for builder errors
+    if (s.ok() && blob_builder != NULL) {
+      s = blob_builder->Finish();
+      if (s.ok()) {
+        s = blob_file->Close();
+      }
+      if (s.ok() && blob_size != NULL) {
+        *blob_size = blob_builder->FileSize();
+      }
+    }
+    delete blob_builder;
+    delete blob_file;
+    blob_file = NULL;
     if (s.ok()) {
       s = builder->Finish();
       if (s.ok()) {
@@ -81,6 +134,13 @@ Status BuildTable(const std::string& dbname,
     // Keep it
   } else {
     env->DeleteFile(fname);
+    if (meta->oldest_blob != 0) {
+      env->DeleteFile(blob_fname);
+      meta->oldest_blob = 0;
+      if (blob_size != NULL) {
+        *blob_size = 0;
+      }
+    }
   }
   return s;
 }
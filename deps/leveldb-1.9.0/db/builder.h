@@ -22,12 +22,19 @@ class VersionEdit;
 // *meta will be filled with metadata about the generated table.
 // If no data is present in *iter, meta->file_size will be set to
 // zero, and no Table file will be produced.
+//
+// If "blob_number" is non-zero, values of at least options.min_blob_size
+// are written to the blob file of that number instead of the table, and
+// the size of the blob file is stored in *blob_size.  No blob file is
+// produced if *blob_size is zero.
 extern Status BuildTable(const std::string& dbname,
                          Env* env,
                          const Options& options,
                          TableCache* table_cache,
                          Iterator* iter,
-                         FileMetaData* meta);
+                         FileMetaData* meta,
+                         uint64_t blob_number = 0,
+                         uint64_t* blob_size = NULL);
 
 }  // namespace leveldb
 
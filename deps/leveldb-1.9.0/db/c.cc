@@ -6,37 +6,54 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include "helpers/memenv/memenv.h"
 #include "leveldb/cache.h"
+#include "leveldb/compaction_filter.h"
 #include "leveldb/comparator.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/iterator.h"
+#include "leveldb/merge_operator.h"
 #include "leveldb/options.h"
+#include "leveldb/slice_transform.h"
 #include "leveldb/status.h"
 #include "leveldb/write_batch.h"
 
 using leveldb::Cache;
+using leveldb::CompactionFilter;
+using leveldb::CompactionStyle;
 using leveldb::Comparator;
 using leveldb::CompressionType;
 using leveldb::DB;
 using leveldb::Env;
 using leveldb::FileLock;
 using leveldb::FilterPolicy;
+using leveldb::HugePages;
 using leveldb::Iterator;
 using leveldb::kMajorVersion;
 using leveldb::kMinorVersion;
 using leveldb::Logger;
+using leveldb::MemTableRepType;
+using leveldb::MergeOperator;
+using leveldb::NewAppendOperator;
+using leveldb::NewBlockedBloomFilterPolicy;
 using leveldb::NewBloomFilterPolicy;
+using leveldb::NewClockCache;
+using leveldb::NewFixedPrefixTransform;
 using leveldb::NewLRUCache;
+using leveldb::NewScanResistantLRUCache;
 using leveldb::Options;
 using leveldb::RandomAccessFile;
 using leveldb::Range;
 using leveldb::ReadOptions;
+using leveldb::ReadStats;
 using leveldb::SequentialFile;
+using leveldb::SliceTransform;
 using leveldb::Slice;
 using leveldb::Snapshot;
 using leveldb::Status;
+using leveldb::TableWriter;
 using leveldb::WritableFile;
 using leveldb::WriteBatch;
 using leveldb::WriteOptions;
@@ -47,7 +64,8 @@ struct leveldb_t              { DB*               rep; };
 struct leveldb_iterator_t     { Iterator*         rep; };
 struct leveldb_writebatch_t   { WriteBatch        rep; };
 struct leveldb_snapshot_t     { const Snapshot*   rep; };
-struct leveldb_readoptions_t  { ReadOptions       rep; };
+struct leveldb_tablewriter_t  { TableWriter*      rep; };
+struct leveldb_readstats_t    { ReadStats         rep; };
 struct leveldb_writeoptions_t { WriteOptions      rep; };
 struct leveldb_options_t      { Options           rep; };
 struct leveldb_cache_t        { Cache*            rep; };
@@ -57,6 +75,12 @@ struct leveldb_writablefile_t { WritableFile*     rep; };
 struct leveldb_logger_t       { Logger*           rep; };
 struct leveldb_filelock_t     { FileLock*         rep; };
 
+struct leveldb_readoptions_t {
+  ReadOptions rep;
+  std::string upper_bound;  // Storage for rep.iterate_upper_bound
+  Slice upper_bound_slice;
+};
+
 struct leveldb_comparator_t : public Comparator {
   void* state_;
   void (*destructor_)(void*);
@@ -124,6 +148,105 @@ struct leveldb_filterpolicy_t : public FilterPolicy {
   }
 };
 
+struct leveldb_mergeoperator_t : public MergeOperator {
+  void* state_;
+  void (*destructor_)(void*);
+  const char* (*name_)(void*);
+  char* (*merge_)(
+      void*,
+      const char* key, size_t key_length,
+      const char* existing, size_t existing_length,
+      const char* value, size_t value_length,
+      unsigned char* success, size_t* new_value_length);
+
+  virtual ~leveldb_mergeoperator_t() {
+    (*destructor_)(state_);
+  }
+
+  virtual const char* Name() const {
+    return (*name_)(state_);
+  }
+
+  virtual bool Merge(const Slice& key, const Slice* existing_value,
+                     const Slice& value, std::string* new_value) const {
+    unsigned char success = 1;
+    size_t len = 0;
+    char* result = (*merge_)(
+        state_, key.data(), key.size(),
+        existing_value != NULL ? existing_value->data() : NULL,
+        existing_value != NULL ? existing_value->size() : 0,
+        value.data(), value.size(), &success, &len);
+    if (success) {
+      new_value->assign(result, len);
+    }
+    free(result);
+    return success;
+  }
+};
+
+struct leveldb_compactionfilter_t : public CompactionFilter {
+  void* state_;
+  void (*destructor_)(void*);
+  const char* (*name_)(void*);
+  unsigned char (*filter_)(
+      void*,
+      int level,
+      const char* key, size_t key_length,
+      const char* existing_value, size_t value_length,
+      char** new_value, size_t* new_value_length,
+      unsigned char* value_changed);
+
+  virtual ~leveldb_compactionfilter_t() {
+    (*destructor_)(state_);
+  }
+
+  virtual const char* Name() const {
+    return (*name_)(state_);
+  }
+
+  virtual bool Filter(int level, const Slice& key,
+                      const Slice& existing_value, std::string* new_value,
+                      bool* value_changed) const {
+    char* result = NULL;
+    size_t len = 0;
+    unsigned char changed = 0;
+    unsigned char remove = (*filter_)(
+        state_, level, key.data(), key.size(),
+        existing_value.data(), existing_value.size(),
+        &result, &len, &changed);
+    if (!remove && changed) {
+      new_value->assign(result, len);
+      *value_changed = true;
+    }
+    free(result);
+    return remove;
+  }
+};
+
+struct leveldb_slicetransform_t : public SliceTransform {
+  void* state_;
+  void (*destructor_)(void*);
+  const char* (*name_)(void*);
+  size_t (*transform_)(void*, const char* key, size_t length);
+  unsigned char (*in_domain_)(void*, const char* key, size_t length);
+
+  virtual ~leveldb_slicetransform_t() {
+    (*destructor_)(state_);
+  }
+
+  virtual const char* Name() const {
+    return (*name_)(state_);
+  }
+
+  virtual bool InDomain(const Slice& key) const {
+    return (*in_domain_)(state_, key.data(), key.size());
+  }
+
+  virtual Slice Transform(const Slice& key) const {
+    return Slice(key.data(), (*transform_)(state_, key.data(), key.size()));
+  }
+};
+
 struct leveldb_env_t {
   Env* rep;
   bool is_default;
@@ -185,6 +308,27 @@ void leveldb_delete(
   SaveError(errptr, db->rep->Delete(options->rep, Slice(key, keylen)));
 }
 
+void leveldb_merge(
+    leveldb_t* db,
+    const leveldb_writeoptions_t* options,
+    const char* key, size_t keylen,
+    const char* val, size_t vallen,
+    char** errptr) {
+  SaveError(errptr,
+            db->rep->Merge(options->rep, Slice(key, keylen), Slice(val, vallen)));
+}
+
+void leveldb_delete_range(
+    leveldb_t* db,
+    const leveldb_writeoptions_t* options,
+    const char* start_key, size_t start_keylen,
+    const char* limit_key, size_t limit_keylen,
+    char** errptr) {
+  SaveError(errptr, db->rep->DeleteRange(options->rep,
+                                         Slice(start_key, start_keylen),
+                                         Slice(limit_key, limit_keylen)));
+}
+
 
 void leveldb_write(
     leveldb_t* db,
@@ -215,6 +359,36 @@ char* leveldb_get(
   return result;
 }
 
+void leveldb_multi_get(
+    leveldb_t* db,
+    const leveldb_readoptions_t* options,
+    size_t num_keys,
+    const char* const* keys, const size_t* keylens,
+    char** values, size_t* vallens,
+    char** errptr) {
+  std::vector<Slice> key_slices(num_keys);
+  for (size_t i = 0; i < num_keys; i++) {
+    key_slices[i] = Slice(keys[i], keylens[i]);
+  }
+  std::vector<std::string> tmp;
+  std::vector<Status> statuses = db->rep->MultiGet(options->rep, key_slices,
+                                                   &tmp);
+  bool failed = false;
+  for (size_t i = 0; i < num_keys; i++) {
+    if (statuses[i].ok()) {
+      vallens[i] = tmp[i].size();
+      values[i] = CopyString(tmp[i]);
+    } else {
+      vallens[i] = 0;
+      values[i] = NULL;
+      if (!statuses[i].IsNotFound() && !failed) {
+        SaveError(errptr, statuses[i]);
+        failed = true;
+      }
+    }
+  }
+}
+
 leveldb_iterator_t* leveldb_create_iterator(
     leveldb_t* db,
     const leveldb_readoptions_t* options) {
@@ -275,6 +449,85 @@ void leveldb_compact_range(
       (limit_key ? (b = Slice(limit_key, limit_key_len), &b) : NULL));
 }
 
+void leveldb_flush_memtable(leveldb_t* db, char** errptr) {
+  SaveError(errptr, db->rep->FlushMemTable());
+}
+
+void leveldb_create_checkpoint(
+    leveldb_t* db,
+    const char* dir,
+    char** errptr) {
+  SaveError(errptr, db->rep->CreateCheckpoint(dir));
+}
+
+char* leveldb_get_cached_blocks(
+    leveldb_t* db,
+    size_t* len,
+    char** errptr) {
+  char* result = NULL;
+  std::string blocks;
+  Status s = db->rep->GetCachedBlocks(&blocks);
+  if (s.ok()) {
+    *len = blocks.size();
+    result = CopyString(blocks);
+  } else {
+    *len = 0;
+    SaveError(errptr, s);
+  }
+  return result;
+}
+
+void leveldb_warm_cache(
+    leveldb_t* db,
+    const char* blocks, size_t len,
+    uint64_t bytes_per_second,
+    char** errptr) {
+  SaveError(errptr, db->rep->WarmCache(Slice(blocks, len), bytes_per_second));
+}
+
+void leveldb_ingest_table(
+    leveldb_t* db,
+    const char* fname,
+    char** errptr) {
+  SaveError(errptr, db->rep->IngestTable(fname));
+}
+
+leveldb_tablewriter_t* leveldb_tablewriter_create(
+    leveldb_t* db,
+    const char* fname,
+    char** errptr) {
+  TableWriter* writer;
+  if (SaveError(errptr, db->rep->NewTableWriter(fname, &writer))) {
+    return NULL;
+  }
+  leveldb_tablewriter_t* result = new leveldb_tablewriter_t;
+  result->rep = writer;
+  return result;
+}
+
+void leveldb_tablewriter_destroy(leveldb_tablewriter_t* writer) {
+  delete writer->rep;
+  delete writer;
+}
+
+void leveldb_tablewriter_add(
+    leveldb_tablewriter_t* writer,
+    const char* key, size_t keylen,
+    const char* val, size_t vallen,
+    char** errptr) {
+  SaveError(errptr, writer->rep->Add(Slice(key, keylen), Slice(val, vallen)));
+}
+
+void leveldb_tablewriter_finish(
+    leveldb_tablewriter_t* writer,
+    char** errptr) {
+  SaveError(errptr, writer->rep->Finish());
+}
+
+uint64_t leveldb_tablewriter_file_size(leveldb_tablewriter_t* writer) {
+  return writer->rep->FileSize();
+}
+
 void leveldb_destroy_db(
     const leveldb_options_t* options,
     const char* name,
@@ -334,6 +587,10 @@ void leveldb_iter_get_error(const leveldb_iterator_t* iter, char** errptr) {
   SaveError(errptr, iter->rep->status());
 }
 
+void leveldb_iter_release_pinned_data(leveldb_iterator_t* iter) {
+  iter->rep->ReleasePinnedData();
+}
+
 leveldb_writebatch_t* leveldb_writebatch_create() {
   return new leveldb_writebatch_t;
 }
@@ -359,6 +616,21 @@ void leveldb_writebatch_delete(
   b->rep.Delete(Slice(key, klen));
 }
 
+void leveldb_writebatch_delete_range(
+    leveldb_writebatch_t* b,
+    const char* start_key, size_t start_klen,
+    const char* limit_key, size_t limit_klen) {
+  b->rep.DeleteRange(Slice(start_key, start_klen),
+                     Slice(limit_key, limit_klen));
+}
+
+void leveldb_writebatch_merge(
+    leveldb_writebatch_t* b,
+    const char* key, size_t klen,
+    const char* val, size_t vlen) {
+  b->rep.Merge(Slice(key, klen), Slice(val, vlen));
+}
+
 void leveldb_writebatch_iterate(
     leveldb_writebatch_t* b,
     void* state,
@@ -403,6 +675,24 @@ void leveldb_options_set_filter_policy(
   opt->rep.filter_policy = policy;
 }
 
+void leveldb_options_set_prefix_extractor(
+    leveldb_options_t* opt,
+    leveldb_slicetransform_t* prefix_extractor) {
+  opt->rep.prefix_extractor = prefix_extractor;
+}
+
+void leveldb_options_set_merge_operator(
+    leveldb_options_t* opt,
+    leveldb_mergeoperator_t* merge_operator) {
+  opt->rep.merge_operator = merge_operator;
+}
+
+void leveldb_options_set_compaction_filter(
+    leveldb_options_t* opt,
+    leveldb_compactionfilter_t* compaction_filter) {
+  opt->rep.compaction_filter = compaction_filter;
+}
+
 void leveldb_options_set_create_if_missing(
     leveldb_options_t* opt, unsigned char v) {
   opt->rep.create_if_missing = v;
@@ -434,10 +724,140 @@ void leveldb_options_set_max_open_files(leveldb_options_t* opt, int n) {
   opt->rep.max_open_files = n;
 }
 
+void leveldb_options_set_max_background_compactions(
+    leveldb_options_t* opt, int n) {
+  opt->rep.max_background_compactions = n;
+}
+
+void leveldb_options_set_max_subcompactions(leveldb_options_t* opt, int n) {
+  opt->rep.max_subcompactions = n;
+}
+
+void leveldb_options_set_repair_threads(leveldb_options_t* opt, int n) {
+  opt->rep.repair_threads = n;
+}
+
+void leveldb_options_set_compaction_style(leveldb_options_t* opt, int style) {
+  opt->rep.compaction_style = static_cast<CompactionStyle>(style);
+}
+
+void leveldb_options_set_tiered_size_ratio(leveldb_options_t* opt, int n) {
+  opt->rep.tiered_size_ratio = n;
+}
+
+void leveldb_options_set_tiered_max_fan_in(leveldb_options_t* opt, int n) {
+  opt->rep.tiered_max_fan_in = n;
+}
+
+void leveldb_options_set_level0_file_num_compaction_trigger(
+    leveldb_options_t* opt, int n) {
+  opt->rep.level0_file_num_compaction_trigger = n;
+}
+
+void leveldb_options_set_level0_slowdown_writes_trigger(
+    leveldb_options_t* opt, int n) {
+  opt->rep.level0_slowdown_writes_trigger = n;
+}
+
+void leveldb_options_set_level0_stop_writes_trigger(
+    leveldb_options_t* opt, int n) {
+  opt->rep.level0_stop_writes_trigger = n;
+}
+
+void leveldb_options_set_target_file_size_base(
+    leveldb_options_t* opt, uint64_t n) {
+  opt->rep.target_file_size_base = n;
+}
+
+void leveldb_options_set_target_file_size_multiplier(
+    leveldb_options_t* opt, int n) {
+  opt->rep.target_file_size_multiplier = n;
+}
+
+void leveldb_options_set_max_bytes_for_level_base(
+    leveldb_options_t* opt, uint64_t n) {
+  opt->rep.max_bytes_for_level_base = n;
+}
+
+void leveldb_options_set_max_bytes_for_level_multiplier(
+    leveldb_options_t* opt, int n) {
+  opt->rep.max_bytes_for_level_multiplier = n;
+}
+
+void leveldb_options_set_level_compaction_dynamic_level_bytes(
+    leveldb_options_t* opt, unsigned char v) {
+  opt->rep.level_compaction_dynamic_level_bytes = v;
+}
+
+void leveldb_options_set_use_direct_io_for_compaction(
+    leveldb_options_t* opt, unsigned char v) {
+  opt->rep.use_direct_io_for_compaction = v;
+}
+
+void leveldb_options_set_compaction_readahead_size(
+    leveldb_options_t* opt, size_t n) {
+  opt->rep.compaction_readahead_size = n;
+}
+
+void leveldb_options_set_min_blob_size(leveldb_options_t* opt, size_t n) {
+  opt->rep.min_blob_size = n;
+}
+
+void leveldb_options_set_blob_file_min_live_ratio(
+    leveldb_options_t* opt, double ratio) {
+  opt->rep.blob_file_min_live_ratio = ratio;
+}
+
+void leveldb_options_set_blob_file_size(leveldb_options_t* opt, uint64_t n) {
+  opt->rep.blob_file_size = n;
+}
+
+void leveldb_options_set_allow_concurrent_memtable_write(
+    leveldb_options_t* opt, unsigned char v) {
+  opt->rep.allow_concurrent_memtable_write = v;
+}
+
+void leveldb_options_set_enable_pipelined_write(
+    leveldb_options_t* opt, unsigned char v) {
+  opt->rep.enable_pipelined_write = v;
+}
+
+void leveldb_options_set_log_compression(leveldb_options_t* opt, int t) {
+  opt->rep.log_compression = static_cast<CompressionType>(t);
+}
+
+void leveldb_options_set_log_sync_interval(
+    leveldb_options_t* opt, uint64_t micros) {
+  opt->rep.log_sync_interval_micros = micros;
+}
+
+void leveldb_options_set_arena_block_size(leveldb_options_t* opt, size_t n) {
+  opt->rep.arena_block_size = n;
+}
+
+void leveldb_options_set_huge_pages(leveldb_options_t* opt, int n) {
+  opt->rep.huge_pages = static_cast<HugePages>(n);
+}
+
+void leveldb_options_set_memtable_rep(leveldb_options_t* opt, int n) {
+  opt->rep.memtable_rep = static_cast<MemTableRepType>(n);
+}
+
+void leveldb_options_set_memtable_prefix_extractor(
+    leveldb_options_t* opt,
+    leveldb_slicetransform_t* prefix_extractor) {
+  opt->rep.memtable_prefix_extractor = prefix_extractor;
+}
+
 void leveldb_options_set_cache(leveldb_options_t* opt, leveldb_cache_t* c) {
   opt->rep.block_cache = c->rep;
 }
 
+void leveldb_options_set_compressed_cache(
+    leveldb_options_t* opt, leveldb_cache_t* c) {
+  opt->rep.block_cache_compressed = c->rep;
+}
+
 void leveldb_options_set_block_size(leveldb_options_t* opt, size_t s) {
   opt->rep.block_size = s;
 }
@@ -446,10 +866,48 @@ void leveldb_options_set_block_restart_interval(leveldb_options_t* opt, int n) {
   opt->rep.block_restart_interval = n;
 }
 
+void leveldb_options_set_uncompressed_block_keys(leveldb_options_t* opt,
+                                                 unsigned char v) {
+  opt->rep.uncompressed_block_keys = v;
+}
+
+void leveldb_options_set_index_partition_size(leveldb_options_t* opt,
+                                              size_t s) {
+  opt->rep.index_partition_size = s;
+}
+
+void leveldb_options_set_pinned_metadata_size(leveldb_options_t* opt,
+                                              size_t s) {
+  opt->rep.pinned_metadata_size = s;
+}
+
+void leveldb_options_set_data_block_hash_index(leveldb_options_t* opt,
+                                               unsigned char v) {
+  opt->rep.data_block_hash_index = v;
+}
+
 void leveldb_options_set_compression(leveldb_options_t* opt, int t) {
   opt->rep.compression = static_cast<CompressionType>(t);
 }
 
+void leveldb_options_set_compression_per_level(
+    leveldb_options_t* opt, const int* levels, size_t num_levels) {
+  opt->rep.compression_per_level.clear();
+  for (size_t i = 0; i < num_levels; i++) {
+    opt->rep.compression_per_level.push_back(
+        static_cast<CompressionType>(levels[i]));
+  }
+}
+
+void leveldb_options_set_compression_dictionary(
+    leveldb_options_t* opt, const char* dict, size_t dictlen) {
+  opt->rep.compression_dictionary = Slice(dict, dictlen);
+}
+
+void leveldb_options_set_compression_threads(leveldb_options_t* opt, int n) {
+  opt->rep.compression_threads = n;
+}
+
 leveldb_comparator_t* leveldb_comparator_create(
     void* state,
     void (*destructor)(void*),
@@ -496,10 +954,9 @@ void leveldb_filterpolicy_destroy(leveldb_filterpolicy_t* filter) {
   delete filter;
 }
 
-leveldb_filterpolicy_t* leveldb_filterpolicy_create_bloom(int bits_per_key) {
-  // Make a leveldb_filterpolicy_t, but override all of its methods so
-  // they delegate to a NewBloomFilterPolicy() instead of user
-  // supplied C functions.
+// Make a leveldb_filterpolicy_t, but override all of its methods so
+// they delegate to "rep" instead of user supplied C functions.
+static leveldb_filterpolicy_t* WrapFilterPolicy(const FilterPolicy* rep) {
   struct Wrapper : public leveldb_filterpolicy_t {
     const FilterPolicy* rep_;
     ~Wrapper() { delete rep_; }
@@ -513,12 +970,124 @@ leveldb_filterpolicy_t* leveldb_filterpolicy_create_bloom(int bits_per_key) {
     static void DoNothing(void*) { }
   };
   Wrapper* wrapper = new Wrapper;
-  wrapper->rep_ = NewBloomFilterPolicy(bits_per_key);
+  wrapper->rep_ = rep;
+  wrapper->state_ = NULL;
+  wrapper->destructor_ = &Wrapper::DoNothing;
+  return wrapper;
+}
+
+leveldb_filterpolicy_t* leveldb_filterpolicy_create_bloom(int bits_per_key) {
+  return WrapFilterPolicy(NewBloomFilterPolicy(bits_per_key));
+}
+
+leveldb_filterpolicy_t* leveldb_filterpolicy_create_blocked_bloom(
+    int bits_per_key) {
+  return WrapFilterPolicy(NewBlockedBloomFilterPolicy(bits_per_key));
+}
+
+leveldb_slicetransform_t* leveldb_slicetransform_create(
+    void* state,
+    void (*destructor)(void*),
+    size_t (*transform)(void*, const char* key, size_t length),
+    unsigned char (*in_domain)(void*, const char* key, size_t length),
+    const char* (*name)(void*)) {
+  leveldb_slicetransform_t* result = new leveldb_slicetransform_t;
+  result->state_ = state;
+  result->destructor_ = destructor;
+  result->transform_ = transform;
+  result->in_domain_ = in_domain;
+  result->name_ = name;
+  return result;
+}
+
+void leveldb_slicetransform_destroy(leveldb_slicetransform_t* st) {
+  delete st;
+}
+
+leveldb_slicetransform_t* leveldb_slicetransform_create_fixed_prefix(
+    size_t prefix_len) {
+  // Delegates to a NewFixedPrefixTransform(), as the bloom filter policy
+  // above does.
+  struct Wrapper : public leveldb_slicetransform_t {
+    const SliceTransform* rep_;
+    ~Wrapper() { delete rep_; }
+    const char* Name() const { return rep_->Name(); }
+    bool InDomain(const Slice& key) const { return rep_->InDomain(key); }
+    Slice Transform(const Slice& key) const { return rep_->Transform(key); }
+    static void DoNothing(void*) { }
+  };
+  Wrapper* wrapper = new Wrapper;
+  wrapper->rep_ = NewFixedPrefixTransform(prefix_len);
+  wrapper->state_ = NULL;
+  wrapper->destructor_ = &Wrapper::DoNothing;
+  return wrapper;
+}
+
+leveldb_mergeoperator_t* leveldb_mergeoperator_create(
+    void* state,
+    void (*destructor)(void*),
+    char* (*merge)(
+        void*,
+        const char* key, size_t key_length,
+        const char* existing, size_t existing_length,
+        const char* value, size_t value_length,
+        unsigned char* success, size_t* new_value_length),
+    const char* (*name)(void*)) {
+  leveldb_mergeoperator_t* result = new leveldb_mergeoperator_t;
+  result->state_ = state;
+  result->destructor_ = destructor;
+  result->merge_ = merge;
+  result->name_ = name;
+  return result;
+}
+
+void leveldb_mergeoperator_destroy(leveldb_mergeoperator_t* op) {
+  delete op;
+}
+
+leveldb_mergeoperator_t* leveldb_mergeoperator_create_append() {
+  // Delegates to a NewAppendOperator(), as the bloom filter policy above
+  // does.
+  struct Wrapper : public leveldb_mergeoperator_t {
+    const MergeOperator* rep_;
+    ~Wrapper() { delete rep_; }
+    const char* Name() const { return rep_->Name(); }
+    bool Merge(const Slice& key, const Slice* existing_value,
+               const Slice& value, std::string* new_value) const {
+      return rep_->Merge(key, existing_value, value, new_value);
+    }
+    static void DoNothing(void*) { }
+  };
+  Wrapper* wrapper = new Wrapper;
+  wrapper->rep_ = NewAppendOperator();
   wrapper->state_ = NULL;
   wrapper->destructor_ = &Wrapper::DoNothing;
   return wrapper;
 }
 
+leveldb_compactionfilter_t* leveldb_compactionfilter_create(
+    void* state,
+    void (*destructor)(void*),
+    unsigned char (*filter)(
+        void*,
+        int level,
+        const char* key, size_t key_length,
+        const char* existing_value, size_t value_length,
+        char** new_value, size_t* new_value_length,
+        unsigned char* value_changed),
+    const char* (*name)(void*)) {
+  leveldb_compactionfilter_t* result = new leveldb_compactionfilter_t;
+  result->state_ = state;
+  result->destructor_ = destructor;
+  result->filter_ = filter;
+  result->name_ = name;
+  return result;
+}
+
+void leveldb_compactionfilter_destroy(leveldb_compactionfilter_t* filter) {
+  delete filter;
+}
+
 leveldb_readoptions_t* leveldb_readoptions_create() {
   return new leveldb_readoptions_t;
 }
@@ -538,12 +1107,102 @@ void leveldb_readoptions_set_fill_cache(
   opt->rep.fill_cache = v;
 }
 
+void leveldb_readoptions_set_sequential_scan(
+    leveldb_readoptions_t* opt, unsigned char v) {
+  opt->rep.sequential_scan = v;
+}
+
+void leveldb_readoptions_set_readahead_size(
+    leveldb_readoptions_t* opt, size_t n) {
+  opt->rep.readahead_size = n;
+}
+
+void leveldb_readoptions_set_prefetch_blocks(
+    leveldb_readoptions_t* opt, int n) {
+  opt->rep.prefetch_blocks = n;
+}
+
+void leveldb_readoptions_set_prefix_same_as_start(
+    leveldb_readoptions_t* opt, unsigned char v) {
+  opt->rep.prefix_same_as_start = v;
+}
+
+void leveldb_readoptions_set_iterate_upper_bound(
+    leveldb_readoptions_t* opt,
+    const char* key, size_t keylen) {
+  if (key == NULL) {
+    opt->upper_bound.clear();
+    opt->rep.iterate_upper_bound = NULL;
+  } else {
+    opt->upper_bound.assign(key, keylen);
+    opt->upper_bound_slice = opt->upper_bound;
+    opt->rep.iterate_upper_bound = &opt->upper_bound_slice;
+  }
+}
+
+void leveldb_readoptions_set_pin_data(
+    leveldb_readoptions_t* opt, unsigned char v) {
+  opt->rep.pin_data = v;
+}
+
 void leveldb_readoptions_set_snapshot(
     leveldb_readoptions_t* opt,
     const leveldb_snapshot_t* snap) {
   opt->rep.snapshot = (snap ? snap->rep : NULL);
 }
 
+void leveldb_readoptions_set_stats(
+    leveldb_readoptions_t* opt, leveldb_readstats_t* stats) {
+  opt->rep.stats = (stats ? &stats->rep : NULL);
+}
+
+leveldb_readstats_t* leveldb_readstats_create() {
+  return new leveldb_readstats_t;
+}
+
+void leveldb_readstats_destroy(leveldb_readstats_t* stats) {
+  delete stats;
+}
+
+void leveldb_readstats_reset(leveldb_readstats_t* stats) {
+  stats->rep.Reset();
+}
+
+uint64_t leveldb_readstats_block_cache_hits(const leveldb_readstats_t* stats) {
+  return stats->rep.block_cache_hits;
+}
+
+uint64_t leveldb_readstats_block_cache_misses(
+    const leveldb_readstats_t* stats) {
+  return stats->rep.block_cache_misses;
+}
+
+uint64_t leveldb_readstats_block_read_bytes(const leveldb_readstats_t* stats) {
+  return stats->rep.block_read_bytes;
+}
+
+uint64_t leveldb_readstats_block_uncompressed_bytes(
+    const leveldb_readstats_t* stats) {
+  return stats->rep.block_uncompressed_bytes;
+}
+
+uint64_t leveldb_readstats_block_read_micros(const leveldb_readstats_t* stats) {
+  return stats->rep.block_read_micros;
+}
+
+uint64_t leveldb_readstats_memtable_hits(const leveldb_readstats_t* stats) {
+  return stats->rep.memtable_hits;
+}
+
+uint64_t leveldb_readstats_table_gets(const leveldb_readstats_t* stats) {
+  return stats->rep.table_gets;
+}
+
+uint64_t leveldb_readstats_internal_keys_skipped(
+    const leveldb_readstats_t* stats) {
+  return stats->rep.internal_keys_skipped;
+}
+
 leveldb_writeoptions_t* leveldb_writeoptions_create() {
   return new leveldb_writeoptions_t;
 }
@@ -563,6 +1222,19 @@ leveldb_cache_t* leveldb_cache_create_lru(size_t capacity) {
   return c;
 }
 
+leveldb_cache_t* leveldb_cache_create_scan_resistant_lru(size_t capacity) {
+  leveldb_cache_t* c = new leveldb_cache_t;
+  c->rep = NewScanResistantLRUCache(capacity);
+  return c;
+}
+
+leveldb_cache_t* leveldb_cache_create_clock(size_t capacity,
+                                            int num_shard_bits) {
+  leveldb_cache_t* c = new leveldb_cache_t;
+  c->rep = NewClockCache(capacity, num_shard_bits);
+  return c;
+}
+
 void leveldb_cache_destroy(leveldb_cache_t* cache) {
   delete cache->rep;
   delete cache;
@@ -575,6 +1247,54 @@ leveldb_env_t* leveldb_create_default_env() {
   return result;
 }
 
+leveldb_env_t* leveldb_create_bound_env(
+    const int* cpus, size_t num_cpus, int node) {
+  leveldb_env_t* result = new leveldb_env_t;
+  result->rep = NewBoundEnv(Env::Default(),
+                            std::vector<int>(cpus, cpus + num_cpus), node);
+  result->is_default = false;
+  return result;
+}
+
+leveldb_env_t* leveldb_create_mem_env() {
+  leveldb_env_t* result = new leveldb_env_t;
+  result->rep = NewMemEnv(Env::Default());
+  result->is_default = false;
+  return result;
+}
+
+uint64_t leveldb_mem_env_usage(leveldb_env_t* env) {
+  return GetMemEnvUsage(env->rep);
+}
+
+void leveldb_env_set_background_threads(leveldb_env_t* env, int n) {
+  env->rep->SetBackgroundThreads(n);
+}
+
+void leveldb_env_set_flush_threads(leveldb_env_t* env, int n) {
+  env->rep->SetFlushThreads(n);
+}
+
+void leveldb_env_set_bytes_per_sync(leveldb_env_t* env, uint64_t bytes) {
+  env->rep->SetBytesPerSync(bytes);
+}
+
+void leveldb_env_set_use_mmap_writes(leveldb_env_t* env, unsigned char v) {
+  env->rep->SetUseMmapWrites(v);
+}
+
+void leveldb_env_set_mmap_limit(leveldb_env_t* env, int n) {
+  env->rep->SetMmapLimit(n);
+}
+
+void leveldb_env_set_write_rate_limits(
+    leveldb_env_t* env,
+    uint64_t foreground_bytes_per_second,
+    uint64_t background_bytes_per_second) {
+  env->rep->SetWriteRateLimits(foreground_bytes_per_second,
+                               background_bytes_per_second);
+}
+
 void leveldb_env_destroy(leveldb_env_t* env) {
   if (!env->is_default) delete env->rep;
   delete env;
@@ -154,6 +154,70 @@ unsigned char FilterKeyMatch(
   return fake_filter_result;
 }
 
+// Custom prefix extractor: the first two bytes
+static void TransformDestroy(void* arg) { }
+static const char* TransformName(void* arg) {
+  return "TestTransform";
+}
+static size_t TransformPrefix(void* arg, const char* key, size_t length) {
+  return 2;
+}
+static unsigned char TransformInDomain(void* arg, const char* key,
+                                       size_t length) {
+  return length >= 2;
+}
+
+// Custom merge operator: adds a single digit operand to a digit value
+static void MergeDestroy(void* arg) { }
+static const char* MergeName(void* arg) {
+  return "TestMerge";
+}
+static char* MergeAdd(
+    void* arg,
+    const char* key, size_t key_length,
+    const char* existing, size_t existing_length,
+    const char* value, size_t value_length,
+    unsigned char* success, size_t* new_value_length) {
+  int sum = value[0] - '0';
+  if (existing != NULL) {
+    sum += existing[0] - '0';
+  }
+  if (value_length != 1 || sum > 9) {
+    *success = 0;
+    return NULL;
+  }
+  char* result = malloc(1);
+  result[0] = '0' + sum;
+  *new_value_length = 1;
+  *success = 1;
+  return result;
+}
+
+// Custom compaction filter: removes keys starting with "x" and replaces
+// the value of "c"
+static void CompactionFilterDestroy(void* arg) { }
+static const char* CompactionFilterName(void* arg) {
+  return "TestCompactionFilter";
+}
+static unsigned char CompactionFilterKeep(
+    void* arg,
+    int level,
+    const char* key, size_t key_length,
+    const char* existing_value, size_t value_length,
+    char** new_value, size_t* new_value_length,
+    unsigned char* value_changed) {
+  if (key_length > 0 && key[0] == 'x') {
+    return 1;
+  }
+  if (key_length == 1 && key[0] == 'c') {
+    *new_value = malloc(3);
+    memcpy(*new_value, "new", 3);
+    *new_value_length = 3;
+    *value_changed = 1;
+  }
+  return 0;
+}
+
 int main(int argc, char** argv) {
   leveldb_t* db;
   leveldb_comparator_t* cmp;
@@ -176,24 +240,42 @@ int main(int argc, char** argv) {
   StartPhase("create_objects");
   cmp = leveldb_comparator_create(NULL, CmpDestroy, CmpCompare, CmpName);
   env = leveldb_create_default_env();
+  leveldb_env_set_background_threads(env, 2);
   cache = leveldb_cache_create_lru(100000);
 
   options = leveldb_options_create();
   leveldb_options_set_comparator(options, cmp);
   leveldb_options_set_error_if_exists(options, 1);
   leveldb_options_set_cache(options, cache);
+  leveldb_options_set_compressed_cache(options, cache);
   leveldb_options_set_env(options, env);
   leveldb_options_set_info_log(options, NULL);
   leveldb_options_set_write_buffer_size(options, 100000);
   leveldb_options_set_paranoid_checks(options, 1);
   leveldb_options_set_max_open_files(options, 10);
+  leveldb_options_set_max_background_compactions(options, 2);
+  leveldb_options_set_max_subcompactions(options, 2);
+  leveldb_options_set_target_file_size_base(options, 1 << 20);
+  leveldb_options_set_level_compaction_dynamic_level_bytes(options, 1);
+  leveldb_options_set_allow_concurrent_memtable_write(options, 1);
+  leveldb_options_set_enable_pipelined_write(options, 1);
+  leveldb_options_set_arena_block_size(options, 8192);
   leveldb_options_set_block_size(options, 1024);
   leveldb_options_set_block_restart_interval(options, 8);
   leveldb_options_set_compression(options, leveldb_no_compression);
+  {
+    static const char dict[] = "bar box foo hello leveldb_c_test";
+    const int levels[2] = { leveldb_lz4_compression,
+                            leveldb_zstd_compression };
+    leveldb_options_set_compression_per_level(options, levels, 2);
+    leveldb_options_set_compression_dictionary(options, dict, sizeof(dict));
+  }
 
   roptions = leveldb_readoptions_create();
   leveldb_readoptions_set_verify_checksums(roptions, 1);
   leveldb_readoptions_set_fill_cache(roptions, 0);
+  leveldb_readoptions_set_sequential_scan(roptions, 1);
+  leveldb_readoptions_set_prefetch_blocks(roptions, 2);
 
   woptions = leveldb_writeoptions_create();
   leveldb_writeoptions_set_sync(woptions, 1);
@@ -251,6 +333,24 @@ int main(int argc, char** argv) {
     leveldb_writebatch_destroy(wb);
   }
 
+  StartPhase("multiget");
+  {
+    const char* keys[4] = { "foo", "bar", "box", "foo" };
+    size_t keylens[4] = { 3, 3, 3, 3 };
+    char* vals[4];
+    size_t vallens[4];
+    int i;
+    leveldb_multi_get(db, roptions, 4, keys, keylens, vals, vallens, &err);
+    CheckNoError(err);
+    CheckEqual("hello", vals[0], vallens[0]);
+    CheckEqual(NULL, vals[1], vallens[1]);
+    CheckEqual("c", vals[2], vallens[2]);
+    CheckEqual("hello", vals[3], vallens[3]);
+    for (i = 0; i < 4; i++) {
+      Free(&vals[i]);
+    }
+  }
+
   StartPhase("iter");
   {
     leveldb_iterator_t* iter = leveldb_create_iterator(db, roptions);
@@ -273,6 +373,24 @@ int main(int argc, char** argv) {
     leveldb_iter_destroy(iter);
   }
 
+  StartPhase("pinned_iter");
+  {
+    const char* val;
+    size_t len;
+    leveldb_readoptions_t* pin_roptions = leveldb_readoptions_create();
+    leveldb_readoptions_set_pin_data(pin_roptions, 1);
+    leveldb_iterator_t* iter = leveldb_create_iterator(db, pin_roptions);
+    leveldb_iter_seek_to_first(iter);
+    val = leveldb_iter_value(iter, &len);
+    leveldb_iter_next(iter);
+    CheckEqual("c", val, len);
+    CheckIter(iter, "foo", "hello");
+    leveldb_iter_release_pinned_data(iter);
+    CheckIter(iter, "foo", "hello");
+    leveldb_iter_destroy(iter);
+    leveldb_readoptions_destroy(pin_roptions);
+  }
+
   StartPhase("approximate_sizes");
   {
     int i;
@@ -297,6 +415,26 @@ int main(int argc, char** argv) {
     CheckCondition(sizes[1] > 0);
   }
 
+  StartPhase("read_stats");
+  {
+    leveldb_readstats_t* stats = leveldb_readstats_create();
+    leveldb_readoptions_t* stats_roptions = leveldb_readoptions_create();
+    leveldb_readoptions_set_stats(stats_roptions, stats);
+    leveldb_iterator_t* iter = leveldb_create_iterator(db, stats_roptions);
+    for (leveldb_iter_seek_to_first(iter); leveldb_iter_valid(iter);
+         leveldb_iter_next(iter)) {
+    }
+    leveldb_iter_destroy(iter);
+    CheckCondition(leveldb_readstats_block_cache_hits(stats) +
+                   leveldb_readstats_block_cache_misses(stats) > 0);
+    CheckCondition(leveldb_readstats_block_cache_misses(stats) == 0 ||
+                   leveldb_readstats_block_read_bytes(stats) > 0);
+    leveldb_readstats_reset(stats);
+    CheckCondition(leveldb_readstats_block_cache_hits(stats) == 0);
+    leveldb_readoptions_destroy(stats_roptions);
+    leveldb_readstats_destroy(stats);
+  }
+
   StartPhase("property");
   {
     char* prop = leveldb_property_value(db, "nosuchprop");
@@ -319,6 +457,27 @@ int main(int argc, char** argv) {
     leveldb_release_snapshot(db, snap);
   }
 
+  StartPhase("deleterange");
+  {
+    leveldb_put(db, woptions, "r1", 2, "a", 1, &err);
+    CheckNoError(err);
+    leveldb_put(db, woptions, "r2", 2, "b", 1, &err);
+    CheckNoError(err);
+    leveldb_put(db, woptions, "r3", 2, "c", 1, &err);
+    CheckNoError(err);
+    leveldb_writebatch_t* wb = leveldb_writebatch_create();
+    leveldb_writebatch_delete_range(wb, "r1", 2, "r3", 2);
+    leveldb_write(db, woptions, wb, &err);
+    CheckNoError(err);
+    leveldb_writebatch_destroy(wb);
+    CheckGet(db, roptions, "r1", NULL);
+    CheckGet(db, roptions, "r2", NULL);
+    CheckGet(db, roptions, "r3", "c");
+    leveldb_delete_range(db, woptions, "r3", 2, "r4", 2, &err);
+    CheckNoError(err);
+    CheckGet(db, roptions, "r3", NULL);
+  }
+
   StartPhase("repair");
   {
     leveldb_close(db);
@@ -336,15 +495,17 @@ int main(int argc, char** argv) {
   }
 
   StartPhase("filter");
-  for (run = 0; run < 2; run++) {
-    // First run uses custom filter, second run uses bloom filter
+  for (run = 0; run < 3; run++) {
+    // First run uses custom filter, the others bloom filters
     CheckNoError(err);
     leveldb_filterpolicy_t* policy;
     if (run == 0) {
       policy = leveldb_filterpolicy_create(
           NULL, FilterDestroy, FilterCreate, FilterKeyMatch, FilterName);
-    } else {
+    } else if (run == 1) {
       policy = leveldb_filterpolicy_create_bloom(10);
+    } else {
+      policy = leveldb_filterpolicy_create_blocked_bloom(10);
     }
 
     // Create new database
@@ -376,6 +537,135 @@ int main(int argc, char** argv) {
     leveldb_filterpolicy_destroy(policy);
   }
 
+  StartPhase("prefix");
+  for (run = 0; run < 2; run++) {
+    // First run uses custom extractor, second run uses fixed prefix
+    leveldb_slicetransform_t* prefix;
+    if (run == 0) {
+      prefix = leveldb_slicetransform_create(
+          NULL, TransformDestroy, TransformPrefix, TransformInDomain,
+          TransformName);
+    } else {
+      prefix = leveldb_slicetransform_create_fixed_prefix(2);
+    }
+    leveldb_filterpolicy_t* policy = leveldb_filterpolicy_create_bloom(10);
+
+    leveldb_close(db);
+    leveldb_destroy_db(options, dbname, &err);
+    leveldb_options_set_filter_policy(options, policy);
+    leveldb_options_set_prefix_extractor(options, prefix);
+    db = leveldb_open(options, dbname, &err);
+    CheckNoError(err);
+    leveldb_put(db, woptions, "aa1", 3, "v1", 2, &err);
+    CheckNoError(err);
+    leveldb_put(db, woptions, "aa2", 3, "v2", 2, &err);
+    CheckNoError(err);
+    leveldb_put(db, woptions, "ab1", 3, "v3", 2, &err);
+    CheckNoError(err);
+    leveldb_compact_range(db, NULL, 0, NULL, 0);
+
+    leveldb_readoptions_t* prefix_roptions = leveldb_readoptions_create();
+    leveldb_readoptions_set_prefix_same_as_start(prefix_roptions, 1);
+    leveldb_iterator_t* iter = leveldb_create_iterator(db, prefix_roptions);
+    leveldb_iter_seek(iter, "aa", 2);
+    CheckCondition(leveldb_iter_valid(iter));
+    CheckIter(iter, "aa1", "v1");
+    leveldb_iter_next(iter);
+    CheckIter(iter, "aa2", "v2");
+    leveldb_iter_next(iter);
+    CheckCondition(!leveldb_iter_valid(iter));
+    leveldb_iter_seek(iter, "ac", 2);
+    CheckCondition(!leveldb_iter_valid(iter));
+    leveldb_iter_get_error(iter, &err);
+    CheckNoError(err);
+    leveldb_iter_destroy(iter);
+    leveldb_readoptions_destroy(prefix_roptions);
+
+    // The extractor must outlive the database using it
+    leveldb_close(db);
+    leveldb_destroy_db(options, dbname, &err);
+    leveldb_options_set_prefix_extractor(options, NULL);
+    leveldb_options_set_filter_policy(options, NULL);
+    db = leveldb_open(options, dbname, &err);
+    CheckNoError(err);
+    leveldb_slicetransform_destroy(prefix);
+    leveldb_filterpolicy_destroy(policy);
+  }
+
+  StartPhase("merge");
+  for (run = 0; run < 2; run++) {
+    // First run uses custom operator, second run uses append
+    leveldb_mergeoperator_t* op;
+    if (run == 0) {
+      op = leveldb_mergeoperator_create(NULL, MergeDestroy, MergeAdd,
+                                        MergeName);
+    } else {
+      op = leveldb_mergeoperator_create_append();
+    }
+
+    leveldb_close(db);
+    leveldb_destroy_db(options, dbname, &err);
+    leveldb_options_set_merge_operator(options, op);
+    db = leveldb_open(options, dbname, &err);
+    CheckNoError(err);
+    leveldb_put(db, woptions, "m", 1, "1", 1, &err);
+    CheckNoError(err);
+    leveldb_merge(db, woptions, "m", 1, "2", 1, &err);
+    CheckNoError(err);
+    leveldb_writebatch_t* wb = leveldb_writebatch_create();
+    leveldb_writebatch_merge(wb, "m", 1, "3", 1);
+    leveldb_write(db, woptions, wb, &err);
+    CheckNoError(err);
+    leveldb_writebatch_destroy(wb);
+    CheckGet(db, roptions, "m", run == 0 ? "6" : "123");
+    leveldb_compact_range(db, NULL, 0, NULL, 0);
+    CheckGet(db, roptions, "m", run == 0 ? "6" : "123");
+
+    // The operator must outlive the database using it
+    leveldb_close(db);
+    leveldb_destroy_db(options, dbname, &err);
+    leveldb_options_set_merge_operator(options, NULL);
+    db = leveldb_open(options, dbname, &err);
+    CheckNoError(err);
+    leveldb_mergeoperator_destroy(op);
+  }
+
+  StartPhase("compactionfilter");
+  {
+    leveldb_compactionfilter_t* filter = leveldb_compactionfilter_create(
+        NULL, CompactionFilterDestroy, CompactionFilterKeep,
+        CompactionFilterName);
+    leveldb_close(db);
+    leveldb_destroy_db(options, dbname, &err);
+    leveldb_options_set_compaction_filter(options, filter);
+    db = leveldb_open(options, dbname, &err);
+    CheckNoError(err);
+    leveldb_put(db, woptions, "c", 1, "old", 3, &err);
+    CheckNoError(err);
+    leveldb_put(db, woptions, "x1", 2, "gone", 4, &err);
+    CheckNoError(err);
+    leveldb_put(db, woptions, "y", 1, "kept", 4, &err);
+    CheckNoError(err);
+    leveldb_compact_range(db, NULL, 0, NULL, 0);
+    CheckGet(db, roptions, "x1", "gone");
+
+    // The first range compaction only flushes the memtable
+    leveldb_put(db, woptions, "d", 1, "kept", 4, &err);
+    CheckNoError(err);
+    leveldb_compact_range(db, NULL, 0, NULL, 0);
+    CheckGet(db, roptions, "c", "new");
+    CheckGet(db, roptions, "x1", NULL);
+    CheckGet(db, roptions, "y", "kept");
+
+    // The filter must outlive the database using it
+    leveldb_close(db);
+    leveldb_destroy_db(options, dbname, &err);
+    leveldb_options_set_compaction_filter(options, NULL);
+    db = leveldb_open(options, dbname, &err);
+    CheckNoError(err);
+    leveldb_compactionfilter_destroy(filter);
+  }
+
   StartPhase("cleanup");
   leveldb_close(db);
   leveldb_options_destroy(options);
@@ -17,6 +17,7 @@
 #include "db/log_format.h"
 #include "db/version_set.h"
 #include "util/logging.h"
+#include "util/mutexlock.h"
 #include "util/testharness.h"
 #include "util/testutil.h"
 
@@ -253,6 +254,69 @@ TEST(CorruptionTest, MissingDescriptor) {
   Check(1000, 1000);
 }
 
+// Fails the installation of a new descriptor, as if a repair were
+// interrupted just before it finished, and counts the tables opened.
+class InterruptingEnv : public EnvWrapper {
+ public:
+  bool interrupt_;
+
+  InterruptingEnv() : EnvWrapper(Env::Default()), interrupt_(true),
+                      tables_opened_(0) { }
+
+  virtual Status NewRandomAccessFile(const std::string& f,
+                                     RandomAccessFile** r) {
+    uint64_t number;
+    FileType type;
+    const size_t slash = f.rfind('/');
+    if (ParseFileName(f.substr(slash + 1), &number, &type) &&
+        type == kTableFile) {
+      MutexLock l(&mu_);
+      tables_opened_++;
+    }
+    return target()->NewRandomAccessFile(f, r);
+  }
+
+  virtual Status RenameFile(const std::string& s, const std::string& t) {
+    if (interrupt_ && t.find("MANIFEST") != std::string::npos) {
+      return Status::IOError(t, "interrupted");
+    }
+    return target()->RenameFile(s, t);
+  }
+
+  int TablesOpened() {
+    MutexLock l(&mu_);
+    return tables_opened_;
+  }
+
+ private:
+  port::Mutex mu_;  // Tables are opened by several threads
+  int tables_opened_;
+};
+
+TEST(CorruptionTest, ParallelRepairResumes) {
+  Build(10000);  // Enough to build multiple Tables, and leave a log
+  delete db_;
+  db_ = NULL;
+
+  InterruptingEnv env;
+  Options options = options_;
+  options.env = &env;
+  options.repair_threads = 4;
+  ASSERT_TRUE(!::leveldb::RepairDB(dbname_, options).ok());
+  ASSERT_TRUE(env.FileExists(RepairFileName(dbname_)));
+  ASSERT_GT(env.TablesOpened(), 1);
+
+  // The log was converted and every table scanned, so the resumed repair
+  // opens no tables.
+  env.interrupt_ = false;
+  const int opened = env.TablesOpened();
+  ASSERT_OK(::leveldb::RepairDB(dbname_, options));
+  ASSERT_EQ(opened, env.TablesOpened());
+  ASSERT_TRUE(!env.FileExists(RepairFileName(dbname_)));
+  Reopen();
+  Check(10000, 10000);
+}
+
 TEST(CorruptionTest, SequenceNumberRecovery) {
   ASSERT_OK(db_->Put(WriteOptions(), "foo", "v1"));
   ASSERT_OK(db_->Put(WriteOptions(), "foo", "v2"));
@@ -33,6 +33,12 @@
 //      readmissing   -- read N missing keys in random order
 //      readhot       -- read N times in random order from 1% section of DB
 //      seekrandom    -- N random seeks
+//      appendrandom  -- append an event to the value of N random objects
+//                       with a Get() and a Put() of the grown value
+//      hotobject     -- appendrandom for N/10 objects picked with a skew
+//                       towards a few hot ones
+//      prefixscan    -- N/100 scans of the objects under a random prefix
+//      ingestscan    -- prefixscan while another thread keeps appending
 //      crc32c        -- repeated crc32c of 4K of data
 //      acquireload   -- load N*1000 times
 //   Meta operations:
@@ -83,6 +89,9 @@ static bool FLAGS_histogram = false;
 // (initialized to default value by "main")
 static int FLAGS_write_buffer_size = 0;
 
+// Memtable representation: 0 = skiplist, 1 = vector, 2 = hash linked list
+static int FLAGS_memtable_rep = 0;
+
 // Number of bytes to use as a cache of uncompressed data.
 // Negative means use default settings.
 static int FLAGS_cache_size = -1;
@@ -94,6 +103,9 @@ static int FLAGS_open_files = 0;
 // Negative means use default settings.
 static int FLAGS_bloom_bits = -1;
 
+// If true, bloom filters keep the probes of a key within one cache line.
+static bool FLAGS_blocked_bloom = false;
+
 // If true, do not destroy the existing database.  If you set this
 // flag and also specify a benchmark that wants a fresh database, that
 // benchmark will fail.
@@ -102,6 +114,14 @@ static bool FLAGS_use_existing_db = false;
 // Use the db with the following name.
 static const char* FLAGS_db = NULL;
 
+// Size of each event appended to an object by appendrandom, hotobject and
+// ingestscan.
+static int FLAGS_event_size = 40;
+
+// Objects whose value would grow past this size start over empty, as if
+// their older events had been moved out.
+static int FLAGS_max_object_size = 256 * 1024;
+
 namespace leveldb {
 
 namespace {
@@ -388,9 +408,10 @@ class Benchmark {
  public:
   Benchmark()
   : cache_(FLAGS_cache_size >= 0 ? NewLRUCache(FLAGS_cache_size) : NULL),
-    filter_policy_(FLAGS_bloom_bits >= 0
-                   ? NewBloomFilterPolicy(FLAGS_bloom_bits)
-                   : NULL),
+    filter_policy_(FLAGS_bloom_bits < 0 ? NULL
+                   : FLAGS_blocked_bloom
+                   ? NewBlockedBloomFilterPolicy(FLAGS_bloom_bits)
+                   : NewBloomFilterPolicy(FLAGS_bloom_bits)),
     db_(NULL),
     num_(FLAGS_num),
     value_size_(FLAGS_value_size),
@@ -487,6 +508,20 @@ class Benchmark {
       } else if (name == Slice("readwhilewriting")) {
         num_threads++;  // Add extra thread for writing
         method = &Benchmark::ReadWhileWriting;
+      } else if (name == Slice("appendrandom")) {
+        fresh_db = true;
+        method = &Benchmark::AppendRandom;
+      } else if (name == Slice("hotobject")) {
+        fresh_db = true;
+        num_ /= 10;
+        method = &Benchmark::AppendHot;
+      } else if (name == Slice("prefixscan")) {
+        reads_ /= 100;
+        method = &Benchmark::PrefixScan;
+      } else if (name == Slice("ingestscan")) {
+        num_threads++;  // Add extra thread for appending
+        reads_ /= 100;
+        method = &Benchmark::IngestScan;
       } else if (name == Slice("compact")) {
         method = &Benchmark::Compact;
       } else if (name == Slice("crc32c")) {
@@ -693,6 +728,7 @@ class Benchmark {
     options.create_if_missing = !FLAGS_use_existing_db;
     options.block_cache = cache_;
     options.write_buffer_size = FLAGS_write_buffer_size;
+    options.memtable_rep = static_cast<MemTableRepType>(FLAGS_memtable_rep);
     options.max_open_files = FLAGS_open_files;
     options.filter_policy = filter_policy_;
     Status s = DB::Open(options, FLAGS_db, &db_);
@@ -887,6 +923,123 @@ class Benchmark {
     }
   }
 
+  // Sky stores all the events of an object in one value under a msgpack
+  // string key, so objects are written by reading their value back and
+  // putting it with the new event appended.  Keys are 16 digit strings with
+  // a fixstr header and objects whose keys share all but their last two
+  // digits are scanned together, like the objects of a table.
+  static const int kObjectsPerScan = 100;
+
+  static void ObjectKey(int k, char* key, size_t size) {
+    snprintf(key, size, "\xb0%016d", k);
+  }
+
+  // Appends an event to an object and returns the bytes read and written.
+  int64_t AppendEvent(int k, RandomGenerator* gen, std::string* value) {
+    char key[100];
+    ObjectKey(k, key, sizeof(key));
+    Status s = db_->Get(ReadOptions(), key, value);
+    if (s.IsNotFound()) {
+      value->clear();
+    } else if (!s.ok()) {
+      fprintf(stderr, "get error: %s\n", s.ToString().c_str());
+      exit(1);
+    }
+    const int64_t read = value->size();
+    if (value->size() + FLAGS_event_size > FLAGS_max_object_size) {
+      value->clear();
+    }
+    Slice event = gen->Generate(FLAGS_event_size);
+    value->append(event.data(), event.size());
+    s = db_->Put(write_options_, key, *value);
+    if (!s.ok()) {
+      fprintf(stderr, "put error: %s\n", s.ToString().c_str());
+      exit(1);
+    }
+    return read + value->size() + strlen(key);
+  }
+
+  void DoAppend(ThreadState* thread, bool skewed) {
+    if (num_ != FLAGS_num) {
+      char msg[100];
+      snprintf(msg, sizeof(msg), "(%d ops)", num_);
+      thread->stats.AddMessage(msg);
+    }
+
+    // Skewed picks pick a power of two below the number of objects and
+    // then an object below it, so the first few objects take most appends.
+    int max_log = 0;
+    while (max_log < 30 && (1 << (max_log + 1)) <= FLAGS_num) {
+      max_log++;
+    }
+    RandomGenerator gen;
+    std::string value;
+    int64_t bytes = 0;
+    for (int i = 0; i < num_; i++) {
+      const int k = skewed ? (thread->rand.Skewed(max_log) % FLAGS_num)
+                           : (thread->rand.Next() % FLAGS_num);
+      bytes += AppendEvent(k, &gen, &value);
+      thread->stats.FinishedSingleOp();
+    }
+    thread->stats.AddBytes(bytes);
+  }
+
+  void AppendRandom(ThreadState* thread) {
+    DoAppend(thread, false);
+  }
+
+  void AppendHot(ThreadState* thread) {
+    DoAppend(thread, true);
+  }
+
+  void PrefixScan(ThreadState* thread) {
+    ReadOptions options;
+    int64_t bytes = 0;
+    int64_t found = 0;
+    for (int i = 0; i < reads_; i++) {
+      char key[100];
+      const int k = thread->rand.Next() % FLAGS_num;
+      ObjectKey(k - k % kObjectsPerScan, key, sizeof(key));
+      const Slice prefix(key, strlen(key) - 2);
+      Iterator* iter = db_->NewIterator(options);
+      for (iter->Seek(prefix); iter->Valid(); iter->Next()) {
+        if (!iter->key().starts_with(prefix)) break;
+        bytes += iter->key().size() + iter->value().size();
+        found++;
+      }
+      delete iter;
+      thread->stats.FinishedSingleOp();
+    }
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%lld objects scanned)",
+             static_cast<long long>(found));
+    thread->stats.AddMessage(msg);
+    thread->stats.AddBytes(bytes);
+  }
+
+  void IngestScan(ThreadState* thread) {
+    if (thread->tid > 0) {
+      PrefixScan(thread);
+    } else {
+      // Special thread that keeps appending until other threads are done.
+      RandomGenerator gen;
+      std::string value;
+      while (true) {
+        {
+          MutexLock l(&thread->shared->mu);
+          if (thread->shared->num_done + 1 >= thread->shared->num_initialized) {
+            // Other threads have finished
+            break;
+          }
+        }
+        AppendEvent(thread->rand.Next() % FLAGS_num, &gen, &value);
+      }
+
+      // Do not count any of the preceding work/delay in stats.
+      thread->stats.Start();
+    }
+  }
+
   void Compact(ThreadState* thread) {
     db_->CompactRange(NULL, NULL);
   }
@@ -952,12 +1105,21 @@ int main(int argc, char** argv) {
       FLAGS_value_size = n;
     } else if (sscanf(argv[i], "--write_buffer_size=%d%c", &n, &junk) == 1) {
       FLAGS_write_buffer_size = n;
+    } else if (sscanf(argv[i], "--memtable_rep=%d%c", &n, &junk) == 1) {
+      FLAGS_memtable_rep = n;
     } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
       FLAGS_cache_size = n;
     } else if (sscanf(argv[i], "--bloom_bits=%d%c", &n, &junk) == 1) {
       FLAGS_bloom_bits = n;
+    } else if (sscanf(argv[i], "--blocked_bloom=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_blocked_bloom = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
       FLAGS_open_files = n;
+    } else if (sscanf(argv[i], "--event_size=%d%c", &n, &junk) == 1) {
+      FLAGS_event_size = n;
+    } else if (sscanf(argv[i], "--max_object_size=%d%c", &n, &junk) == 1) {
+      FLAGS_max_object_size = n;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {
       FLAGS_db = argv[i] + 5;
     } else {
@@ -5,11 +5,13 @@
 #include "db/db_impl.h"
 
 #include <algorithm>
+#include <map>
 #include <set>
 #include <string>
 #include <stdint.h>
 #include <stdio.h>
 #include <vector>
+#include "db/blob_file.h"
 #include "db/builder.h"
 #include "db/db_iter.h"
 #include "db/dbformat.h"
@@ -17,9 +19,12 @@
 #include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "db/memtable.h"
+#include "db/merge_helper.h"
+#include "db/range_del.h"
 #include "db/table_cache.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/compaction_filter.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/status.h"
@@ -30,6 +35,7 @@
 #include "table/merger.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
+#include "util/huge_page.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
 
@@ -43,7 +49,20 @@ struct DBImpl::Writer {
   bool done;
   port::CondVar cv;
 
-  explicit Writer(port::Mutex* mu) : cv(mu) { }
+  // Set by the group leader when this writer should insert its own batch
+  // into "mem" in parallel with the rest of the group.
+  MemTable* insert_into;
+  Writer* leader;
+  int pending_inserts;          // Leader only: followers still inserting
+
+  // With pipelined writes, links the writers of a group once the
+  // group has left writers_ for memtable_writers_.
+  Writer* next;
+  SequenceNumber last_sequence;   // Leader only: last sequence of the group
+
+  explicit Writer(port::Mutex* mu)
+      : cv(mu), insert_into(NULL), leader(NULL), pending_inserts(0),
+        next(NULL) { }
 };
 
 struct DBImpl::CompactionState {
@@ -60,6 +79,8 @@ struct DBImpl::CompactionState {
     uint64_t number;
     uint64_t file_size;
     InternalKey smallest, largest;
+    SequenceNumber smallest_seq;
+    uint64_t oldest_blob;         // Zero if no entry points into a blob file
   };
   std::vector<Output> outputs;
 
@@ -67,7 +88,27 @@ struct DBImpl::CompactionState {
   WritableFile* outfile;
   TableBuilder* builder;
 
+  // Blob files produced by compaction, and the one being generated
+  struct BlobOutput {
+    uint64_t number;
+    uint64_t file_size;
+  };
+  std::vector<BlobOutput> blob_outputs;
+  WritableFile* blob_outfile;
+  BlobFileBuilder* blob_builder;
+
+  // Bytes of each blob file whose entries the compaction drops
+  std::map<uint64_t, uint64_t> blob_garbage;
+
   uint64_t total_bytes;
+  int64_t imm_micros;  // Micros spent doing imm_ compactions
+  int64_t num_filtered;  // Values removed or changed by the compaction filter
+
+  // User keys bounding the range [start, end) that this state compacts
+  // when the compaction is split into subcompactions.  An empty key
+  // means the range is unbounded on that side.
+  std::string start;
+  std::string end;
 
   Output* current_output() { return &outputs[outputs.size()-1]; }
 
@@ -75,7 +116,11 @@ struct DBImpl::CompactionState {
       : compaction(c),
         outfile(NULL),
         builder(NULL),
-        total_bytes(0) {
+        blob_outfile(NULL),
+        blob_builder(NULL),
+        total_bytes(0),
+        imm_micros(0),
+        num_filtered(0) {
   }
 };
 
@@ -88,13 +133,36 @@ static void ClipToRange(T* ptr, V minvalue, V maxvalue) {
 Options SanitizeOptions(const std::string& dbname,
                         const InternalKeyComparator* icmp,
                         const InternalFilterPolicy* ipolicy,
+                        const InternalSliceTransform* iprefix,
                         const Options& src) {
   Options result = src;
   result.comparator = icmp;
   result.filter_policy = (src.filter_policy != NULL) ? ipolicy : NULL;
+  result.prefix_extractor = (src.prefix_extractor != NULL) ? iprefix : NULL;
   ClipToRange(&result.max_open_files,            20,     50000);
+  ClipToRange(&result.max_background_compactions, 1,     config::kNumLevels/2);
+  ClipToRange(&result.max_subcompactions,        1,      16);
+  ClipToRange(&result.repair_threads,            1,      64);
+  ClipToRange(&result.compression_threads,       1,      32);
+  ClipToRange(&result.tiered_size_ratio,         0,      1000);
+  ClipToRange(&result.tiered_max_fan_in,         2,      1000);
+  ClipToRange(&result.level0_file_num_compaction_trigger, 1, 1000);
+  ClipToRange(&result.level0_slowdown_writes_trigger,
+              result.level0_file_num_compaction_trigger, 1000);
+  ClipToRange(&result.level0_stop_writes_trigger,
+              result.level0_slowdown_writes_trigger, 1000);
+  ClipToRange(&result.target_file_size_base,     64<<10, 1<<30);
+  ClipToRange(&result.target_file_size_multiplier, 1,    100);
+  ClipToRange(&result.max_bytes_for_level_base,
+              static_cast<uint64_t>(1)<<20, static_cast<uint64_t>(1)<<40);
+  ClipToRange(&result.max_bytes_for_level_multiplier, 2, 100);
   ClipToRange(&result.write_buffer_size,         64<<10, 1<<30);
   ClipToRange(&result.block_size,                1<<10,  4<<20);
+  ClipToRange(&result.compaction_readahead_size, 0,      64<<20);
+  ClipToRange(&result.arena_block_size,          4<<10,  1<<30);
+  if (result.arena_block_size > result.write_buffer_size / 8) {
+    result.arena_block_size = result.write_buffer_size / 8;
+  }
   if (result.info_log == NULL) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -115,38 +183,57 @@ DBImpl::DBImpl(const Options& options, const std::string& dbname)
     : env_(options.env),
       internal_comparator_(options.comparator),
       internal_filter_policy_(options.filter_policy),
-      options_(SanitizeOptions(
-          dbname, &internal_comparator_, &internal_filter_policy_, options)),
+      internal_prefix_extractor_(options.prefix_extractor),
+      options_(SanitizeOptions(dbname, &internal_comparator_,
+                               &internal_filter_policy_,
+                               &internal_prefix_extractor_, options)),
       owns_info_log_(options_.info_log != options.info_log),
       owns_cache_(options_.block_cache != options.block_cache),
       dbname_(dbname),
       db_lock_(NULL),
       shutting_down_(NULL),
       bg_cv_(&mutex_),
-      mem_(new MemTable(internal_comparator_)),
+      mem_(NewMemTable()),
       imm_(NULL),
       logfile_(NULL),
       logfile_number_(0),
       log_(NULL),
+      last_log_sync_micros_(0),
       tmp_batch_(new WriteBatch),
-      bg_compaction_scheduled_(false),
-      manual_compaction_(NULL) {
+      bg_compactions_scheduled_(0),
+      running_compactions_(0),
+      flushing_imm_(false),
+      bg_flush_scheduled_(false),
+      applying_edit_(false),
+      apply_cv_(&mutex_),
+      manual_compaction_(NULL),
+      seed_(0) {
+  for (int level = 0; level < config::kNumLevels; level++) {
+    compacting_levels_[level] = false;
+  }
   mem_->Ref();
   has_imm_.Release_Store(NULL);
+  get_latency_.Clear();
+  compaction_latency_.Clear();
 
   // Reserve ten files or so for other uses and give the rest to TableCache.
   const int table_cache_size = options.max_open_files - 10;
   table_cache_ = new TableCache(dbname_, &options_, table_cache_size);
+  // Blob files are few and large, so they get a small share of that.
+  blob_cache_ = new BlobCache(dbname_, &options_,
+                              std::max(table_cache_size / 8, 8));
 
-  versions_ = new VersionSet(dbname_, &options_, table_cache_,
+  versions_ = new VersionSet(dbname_, &options_, table_cache_, blob_cache_,
                              &internal_comparator_);
+
+  env_->SetBackgroundThreads(options_.max_background_compactions);
 }
 
 DBImpl::~DBImpl() {
   // Wait for background work to finish
   mutex_.Lock();
   shutting_down_.Release_Store(this);  // Any non-NULL value is ok
-  while (bg_compaction_scheduled_) {
+  while (bg_compactions_scheduled_ > 0 || bg_flush_scheduled_) {
     bg_cv_.Wait();
   }
   mutex_.Unlock();
@@ -162,6 +249,7 @@ DBImpl::~DBImpl() {
   delete log_;
   delete logfile_;
   delete table_cache_;
+  delete blob_cache_;
 
   if (owns_info_log_) {
     delete options_.info_log;
@@ -212,6 +300,23 @@ void DBImpl::MaybeIgnoreError(Status* s) const {
   }
 }
 
+MemTable* DBImpl::NewMemTable() const {
+  MemTableOptions options;
+  options.arena_block_size = options_.arena_block_size;
+  options.huge_pages = options_.huge_pages;
+  // An arena on huge pages holds at least one 2MB block, so a small
+  // write buffer would be full as soon as it is created.
+  if (options_.write_buffer_size < 8 * kHugePageSize) {
+    options.huge_pages = kNoHugePages;
+  }
+  options.rep = options_.memtable_rep;
+  options.prefix_extractor = options_.memtable_prefix_extractor;
+  // About one bucket per 256 bytes of entries, so that the heads take a
+  // thirty-second of the write buffer.
+  options.hash_buckets = options_.write_buffer_size / 256;
+  return new MemTable(internal_comparator_, options);
+}
+
 void DBImpl::DeleteObsoleteFiles() {
   // Make a set of all of the live files
   std::set<uint64_t> live = pending_outputs_;
@@ -235,6 +340,7 @@ void DBImpl::DeleteObsoleteFiles() {
           keep = (number >= versions_->ManifestFileNumber());
           break;
         case kTableFile:
+        case kBlobFile:
           keep = (live.find(number) != live.end());
           break;
         case kTempFile:
@@ -245,6 +351,7 @@ void DBImpl::DeleteObsoleteFiles() {
         case kCurrentFile:
         case kDBLockFile:
         case kInfoLogFile:
+        case kRepairFile:
           keep = true;
           break;
       }
@@ -252,6 +359,8 @@ void DBImpl::DeleteObsoleteFiles() {
       if (!keep) {
         if (type == kTableFile) {
           table_cache_->Evict(number);
+        } else if (type == kBlobFile) {
+          blob_cache_->Evict(number);
         }
         Log(options_.info_log, "Delete type=%d #%lld\n",
             int(type),
@@ -399,7 +508,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number,
     WriteBatchInternal::SetContents(&batch, record);
 
     if (mem == NULL) {
-      mem = new MemTable(internal_comparator_);
+      mem = NewMemTable();
       mem->Ref();
     }
     status = WriteBatchInternal::InsertInto(&batch, mem);
@@ -415,7 +524,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number,
     }
 
     if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
-      status = WriteLevel0Table(mem, edit, NULL);
+      status = WriteLevel0Table(mem, edit, NULL, NULL);
       if (!status.ok()) {
         // Reflect errors immediately so that conditions like full
         // file-systems cause the DB::Open() to fail.
@@ -427,7 +536,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number,
   }
 
   if (status.ok() && mem != NULL) {
-    status = WriteLevel0Table(mem, edit, NULL);
+    status = WriteLevel0Table(mem, edit, NULL, NULL);
     // Reflect errors immediately so that conditions like full
     // file-systems cause the DB::Open() to fail.
   }
@@ -437,13 +546,33 @@ Status DBImpl::RecoverLogFile(uint64_t log_number,
   return status;
 }
 
+// Return the options for writing a table to "level".  Memtables are
+// always written with the level-0 options.
+Options DBImpl::OptionsForLevel(int level) const {
+  Options result = options_;
+  const std::vector<CompressionType>& per_level =
+      options_.compression_per_level;
+  if (!per_level.empty()) {
+    result.compression =
+        per_level[std::min(static_cast<size_t>(level), per_level.size() - 1)];
+  }
+  return result;
+}
+
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
-                                Version* base) {
+                                Version* base, std::vector<uint64_t>* pending) {
   mutex_.AssertHeld();
   const uint64_t start_micros = env_->NowMicros();
   FileMetaData meta;
   meta.number = versions_->NewFileNumber();
   pending_outputs_.insert(meta.number);
+  uint64_t blob_number = 0;
+  uint64_t blob_size = 0;
+  if (options_.min_blob_size > 0) {
+    blob_number = versions_->NewFileNumber();
+    pending_outputs_.insert(blob_number);
+  }
+  mem->MarkImmutable();   // Recovered memtables are not marked yet
   Iterator* iter = mem->NewIterator();
   Log(options_.info_log, "Level-0 table #%llu: started",
       (unsigned long long) meta.number);
@@ -451,7 +580,8 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
   Status s;
   {
     mutex_.Unlock();
-    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    s = BuildTable(dbname_, env_, OptionsForLevel(0), table_cache_, iter,
+                   &meta, blob_number, &blob_size);
     mutex_.Lock();
   }
 
@@ -459,8 +589,21 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
       (unsigned long long) meta.number,
       (unsigned long long) meta.file_size,
       s.ToString().c_str());
+  if (blob_size > 0) {
+    Log(options_.info_log, "Level-0 blob file #%llu: %lld bytes",
+        (unsigned long long) blob_number,
+        (unsigned long long) blob_size);
+  }
   delete iter;
-  pending_outputs_.erase(meta.number);
+  if (pending != NULL) {
+    pending->push_back(meta.number);
+    if (blob_number != 0) {
+      pending->push_back(blob_number);
+    }
+  } else {
+    pending_outputs_.erase(meta.number);
+    pending_outputs_.erase(blob_number);
+  }
 
 
   // Note that if file_size is zero, the file has been deleted and
@@ -469,29 +612,51 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
   if (s.ok() && meta.file_size > 0) {
     const Slice min_user_key = meta.smallest.user_key();
     const Slice max_user_key = meta.largest.user_key();
-    if (base != NULL) {
+    // Each level-0 table is a run of its own under tiered compaction.
+    if (base != NULL && options_.compaction_style == kCompactionStyleLevel) {
       level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
     }
     edit->AddFile(level, meta.number, meta.file_size,
-                  meta.smallest, meta.largest);
+                  meta.smallest, meta.largest, meta.smallest_seq,
+                  meta.oldest_blob);
+    if (blob_size > 0) {
+      edit->AddBlobFile(blob_number, blob_size);
+    }
+  }
+
+  // The memtable's range deletions move into the version with its table
+  if (s.ok() && mem->HasRangeDeletions()) {
+    std::vector<RangeTombstone> range_dels;
+    mem->GetRangeDeletions(&range_dels);
+    for (size_t i = 0; i < range_dels.size(); i++) {
+      edit->AddRangeDeletion(range_dels[i]);
+    }
   }
 
   CompactionStats stats;
   stats.micros = env_->NowMicros() - start_micros;
-  stats.bytes_written = meta.file_size;
+  stats.bytes_written = meta.file_size + blob_size;
   stats_[level].Add(stats);
+  compaction_latency_.Add(stats.micros);
   return s;
 }
 
-Status DBImpl::CompactMemTable() {
+Status DBImpl::CompactMemTable(bool inside_compaction) {
   mutex_.AssertHeld();
   assert(imm_ != NULL);
+  assert(!flushing_imm_);
+  flushing_imm_ = true;
+  has_imm_.Release_Store(NULL);  // Nothing for other threads to flush
 
-  // Save the contents of the memtable as a new Table
+  // Save the contents of the memtable as a new Table.  If a compaction is
+  // running on another thread, "base" may be stale by the time the table
+  // is installed, so do not push the table past level-0.
   VersionEdit edit;
   Version* base = versions_->current();
   base->Ref();
-  Status s = WriteLevel0Table(imm_, &edit, base);
+  const int others = running_compactions_ - (inside_compaction ? 1 : 0);
+  std::vector<uint64_t> numbers;
+  Status s = WriteLevel0Table(imm_, &edit, others > 0 ? NULL : base, &numbers);
   base->Unref();
 
   if (s.ok() && shutting_down_.Acquire_Load()) {
@@ -502,17 +667,36 @@ Status DBImpl::CompactMemTable() {
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
     edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
-    s = versions_->LogAndApply(&edit, &mutex_);
+    s = LogAndApply(&edit);
+  }
+  // The table was protected from DeleteObsoleteFiles() running on other
+  // threads until it became part of the current version.
+  for (size_t i = 0; i < numbers.size(); i++) {
+    pending_outputs_.erase(numbers[i]);
   }
 
   if (s.ok()) {
     // Commit to the new state
     imm_->Unref();
     imm_ = NULL;
-    has_imm_.Release_Store(NULL);
     DeleteObsoleteFiles();
+  } else {
+    has_imm_.Release_Store(imm_);
   }
 
+  flushing_imm_ = false;
+  return s;
+}
+
+Status DBImpl::LogAndApply(VersionEdit* edit) {
+  mutex_.AssertHeld();
+  while (applying_edit_) {
+    apply_cv_.Wait();
+  }
+  applying_edit_ = true;
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  applying_edit_ = false;
+  apply_cv_.SignalAll();
   return s;
 }
 
@@ -533,6 +717,432 @@ void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
   }
 }
 
+// Copy the file "src" to "target".
+static Status CopyFile(Env* env, const std::string& src,
+                       const std::string& target) {
+  SequentialFile* in;
+  Status s = env->NewSequentialFile(src, &in);
+  if (!s.ok()) {
+    return s;
+  }
+  WritableFile* out;
+  s = env->NewWritableFile(target, &out);
+  if (!s.ok()) {
+    delete in;
+    return s;
+  }
+  const size_t kBufferSize = 65536;
+  char* buffer = new char[kBufferSize];
+  while (s.ok()) {
+    Slice fragment;
+    s = in->Read(kBufferSize, &fragment, buffer);
+    if (!s.ok() || fragment.empty()) {
+      break;
+    }
+    s = out->Append(fragment);
+  }
+  delete[] buffer;
+  delete in;
+  if (s.ok()) {
+    s = out->Sync();
+  }
+  if (s.ok()) {
+    s = out->Close();
+  }
+  delete out;
+  if (!s.ok()) {
+    env->DeleteFile(target);
+  }
+  return s;
+}
+
+Status DBImpl::CreateCheckpoint(const std::string& dir) {
+  // Flush the memtable so that the tables hold every earlier write and the
+  // checkpoint doesn't need a log.
+  Status s = TEST_CompactMemTable();
+  if (!s.ok()) {
+    return s;
+  }
+
+  // The reference keeps the version's tables from being deleted while
+  // they're linked.
+  Version* base;
+  uint64_t manifest_number;
+  std::string record;
+  std::vector<uint64_t> files, blob_files;
+  {
+    MutexLock l(&mutex_);
+    base = versions_->current();
+    base->Ref();
+    manifest_number = versions_->NewFileNumber();
+    versions_->EncodeCheckpoint(manifest_number + 1, &record, &files,
+                                &blob_files);
+  }
+
+  env_->CreateDir(dir);  // Ignore error in case directory already exists
+  std::set<uint64_t> live(files.begin(), files.end());
+  live.insert(blob_files.begin(), blob_files.end());
+  std::vector<std::string> filenames;
+  s = env_->GetChildren(dir, &filenames);
+
+  // Remove the tables and blob files of an earlier checkpoint that are no
+  // longer live along with its descriptors and any logs left by opening it.
+  uint64_t number;
+  FileType type;
+  for (size_t i = 0; s.ok() && i < filenames.size(); i++) {
+    if (ParseFileName(filenames[i], &number, &type) &&
+        ((type == kTableFile && live.count(number) == 0) ||
+         (type == kBlobFile && live.count(number) == 0) ||
+         type == kDescriptorFile || type == kLogFile || type == kTempFile)) {
+      s = env_->DeleteFile(dir + "/" + filenames[i]);
+    }
+  }
+
+  // Link the tables and blob files that aren't in the directory yet.
+  for (size_t i = 0; s.ok() && i < files.size() + blob_files.size(); i++) {
+    const bool blob = (i >= files.size());
+    const uint64_t file = blob ? blob_files[i - files.size()] : files[i];
+    const std::string src = blob ? BlobFileName(dbname_, file)
+                                 : TableFileName(dbname_, file);
+    const std::string target = blob ? BlobFileName(dir, file)
+                                    : TableFileName(dir, file);
+    if (env_->FileExists(target)) {
+      continue;
+    }
+    s = env_->LinkFile(src, target);
+    if (!s.ok()) {
+      s = CopyFile(env_, src, target);
+    }
+  }
+
+  // Describe the tables in a new descriptor and point CURRENT at it.
+  if (s.ok()) {
+    const std::string manifest = DescriptorFileName(dir, manifest_number);
+    WritableFile* file;
+    s = env_->NewWritableFile(manifest, &file);
+    if (s.ok()) {
+      log::Writer log(file);
+      s = log.AddRecord(record);
+      if (s.ok()) {
+        s = file->Sync();
+      }
+      if (s.ok()) {
+        s = file->Close();
+      }
+      delete file;
+    }
+    if (s.ok()) {
+      s = SetCurrentFile(env_, dir, manifest_number);
+    }
+  }
+
+  MutexLock l(&mutex_);
+  base->Unref();
+  return s;
+}
+
+Status DBImpl::GetCachedBlocks(std::string* blocks) {
+  std::vector<std::pair<uint64_t, uint64_t> > list;
+  table_cache_->GetCachedBlocks(&list);
+  std::sort(list.begin(), list.end());
+  blocks->clear();
+  for (size_t i = 0; i < list.size(); i++) {
+    PutVarint64(blocks, list[i].first);
+    PutVarint64(blocks, list[i].second);
+  }
+  return Status::OK();
+}
+
+// The number of blocks that WarmCache() reads between checks of its rate.
+static const size_t kWarmCacheBatch = 64;
+
+Status DBImpl::WarmCache(const Slice& blocks, uint64_t bytes_per_second) {
+  std::vector<std::pair<uint64_t, uint64_t> > list;
+  Slice input = blocks;
+  while (!input.empty()) {
+    uint64_t number, offset;
+    if (!GetVarint64(&input, &number) || !GetVarint64(&input, &offset)) {
+      return Status::Corruption("bad cached block list");
+    }
+    list.push_back(std::make_pair(number, offset));
+  }
+  std::sort(list.begin(), list.end());
+
+  // The reference keeps the version's tables from being deleted while
+  // they're read.
+  Version* base;
+  std::map<uint64_t, uint64_t> sizes;
+  {
+    MutexLock l(&mutex_);
+    base = versions_->current();
+    base->Ref();
+    base->GetFileSizes(&sizes);
+  }
+
+  ReadStats stats;
+  const uint64_t start = env_->NowMicros();
+  std::vector<uint64_t> offsets;
+  Status s;
+  for (size_t i = 0; s.ok() && i < list.size(); ) {
+    const uint64_t number = list[i].first;
+    offsets.clear();
+    for (; i < list.size() && list[i].first == number; i++) {
+      offsets.push_back(list[i].second);
+    }
+    std::map<uint64_t, uint64_t>::const_iterator f = sizes.find(number);
+    if (f == sizes.end()) {
+      continue;  // Compacted away since the list was made
+    }
+    for (size_t j = 0; s.ok() && j < offsets.size(); j += kWarmCacheBatch) {
+      const size_t n = std::min(kWarmCacheBatch, offsets.size() - j);
+      s = table_cache_->WarmBlocks(number, f->second, &offsets[j], n,
+                                   &stats);
+      if (bytes_per_second > 0) {
+        const uint64_t due =
+            start + stats.block_read_bytes * 1000000 / bytes_per_second;
+        const uint64_t now = env_->NowMicros();
+        if (due > now) {
+          env_->SleepForMicroseconds(due - now);
+        }
+      }
+    }
+  }
+
+  MutexLock l(&mutex_);
+  base->Unref();
+  return s;
+}
+
+namespace {
+
+// Writes a table whose entries have the internal keys that a memtable
+// flush would give them.  Every entry gets sequence number zero so that
+// the table can be ingested at any point in the database's history.
+class DBTableWriter : public TableWriter {
+ public:
+  DBTableWriter(const Options& options, const Comparator* ucmp,
+                WritableFile* file)
+      : options_(options),
+        ucmp_(ucmp),
+        file_(file),
+        builder_(new TableBuilder(options_, file)),
+        finished_(false) {
+  }
+
+  virtual ~DBTableWriter() {
+    if (!finished_) {
+      builder_->Abandon();
+    }
+    delete builder_;
+    delete file_;
+  }
+
+  virtual Status Add(const Slice& key, const Slice& value) {
+    if (finished_) {
+      return Status::InvalidArgument("table writer is finished");
+    }
+    if (builder_->NumEntries() > 0 && ucmp_->Compare(key, last_key_) <= 0) {
+      return Status::InvalidArgument("keys added out of order", key);
+    }
+    last_key_.assign(key.data(), key.size());
+    InternalKey ikey(key, 0, kTypeValue);
+    builder_->Add(ikey.Encode(), value);
+    return builder_->status();
+  }
+
+  virtual Status Finish() {
+    if (finished_) {
+      return Status::InvalidArgument("table writer is finished");
+    }
+    finished_ = true;
+    Status s = builder_->Finish();
+    if (s.ok()) {
+      s = file_->Sync();
+    }
+    if (s.ok()) {
+      s = file_->Close();
+    }
+    return s;
+  }
+
+  virtual uint64_t NumEntries() const { return builder_->NumEntries(); }
+  virtual uint64_t FileSize() const { return builder_->FileSize(); }
+
+ private:
+  const Options options_;
+  const Comparator* ucmp_;
+  WritableFile* file_;
+  TableBuilder* builder_;
+  std::string last_key_;
+  bool finished_;
+};
+
+// Store the first and last internal keys of the table file "fname" in
+// *smallest and *largest.
+Status ReadTableRange(const Options& options, Env* env,
+                      const std::string& fname, uint64_t file_size,
+                      InternalKey* smallest, InternalKey* largest) {
+  RandomAccessFile* file;
+  Status s = env->NewRandomAccessFile(fname, &file);
+  if (!s.ok()) {
+    return s;
+  }
+  Table* table = NULL;
+  s = Table::Open(options, file, file_size, &table);
+  if (s.ok()) {
+    ReadOptions ro;
+    ro.fill_cache = false;
+    Iterator* iter = table->NewIterator(ro);
+    ParsedInternalKey first, last;
+    iter->SeekToFirst();
+    if (iter->Valid() && !ParseInternalKey(iter->key(), &first)) {
+      s = Status::Corruption("bad internal key in table", fname);
+    } else if (iter->Valid()) {
+      smallest->DecodeFrom(iter->key());
+      iter->SeekToLast();
+      if (!iter->Valid() || !ParseInternalKey(iter->key(), &last)) {
+        s = Status::Corruption("bad internal key in table", fname);
+      } else {
+        largest->DecodeFrom(iter->key());
+        if (first.sequence != 0 || last.sequence != 0) {
+          s = Status::InvalidArgument("table was not written by a TableWriter",
+                                      fname);
+        }
+      }
+    } else if (iter->status().ok()) {
+      s = Status::InvalidArgument("table has no entries", fname);
+    }
+    if (s.ok()) {
+      s = iter->status();
+    }
+    delete iter;
+  }
+  delete table;
+  delete file;
+  return s;
+}
+
+}  // namespace
+
+Status DBImpl::NewTableWriter(const std::string& fname,
+                              TableWriter** result) {
+  *result = NULL;
+  WritableFile* file;
+  Status s = env_->NewWritableFile(fname, &file);
+  if (s.ok()) {
+    *result = new DBTableWriter(OptionsForLevel(config::kNumLevels - 1),
+                                user_comparator(), file);
+  }
+  return s;
+}
+
+Status DBImpl::IngestTable(const std::string& fname) {
+  uint64_t file_size;
+  InternalKey smallest, largest;
+  Status s = env_->GetFileSize(fname, &file_size);
+  if (s.ok()) {
+    s = ReadTableRange(options_, env_, fname, file_size, &smallest, &largest);
+  }
+  if (!s.ok()) {
+    return s;
+  }
+
+  // The entries get sequence number zero, so they must not share a key
+  // with any entry, deletion or range deletion in the database.  Later
+  // writes get larger sequence numbers and shadow them as they should.
+  const Comparator* ucmp = user_comparator();
+  const Slice begin = smallest.user_key();
+  const Slice end = largest.user_key();
+  {
+    SequenceNumber ignored;
+    Iterator* iter = NewInternalIterator(ReadOptions(), &ignored, NULL);
+    iter->Seek(InternalKey(begin, kMaxSequenceNumber,
+                           kValueTypeForSeek).Encode());
+    if (iter->Valid() && ucmp->Compare(ExtractUserKey(iter->key()), end) <= 0) {
+      s = Status::InvalidArgument("table overlaps the keys of the database",
+                                  fname);
+    } else {
+      s = iter->status();
+    }
+    delete iter;
+  }
+  if (!s.ok()) {
+    return s;
+  }
+
+  MutexLock l(&mutex_);
+  std::vector<RangeTombstone> range_dels = versions_->current()->range_dels();
+  mem_->GetRangeDeletions(&range_dels);
+  if (imm_ != NULL) {
+    imm_->GetRangeDeletions(&range_dels);
+  }
+  for (size_t i = 0; i < range_dels.size(); i++) {
+    if (ucmp->Compare(range_dels[i].start, end) <= 0 &&
+        ucmp->Compare(range_dels[i].end, begin) > 0) {
+      return Status::InvalidArgument("table overlaps a range deletion", fname);
+    }
+  }
+
+  // Add the table to the deepest level where no table spans its range so
+  // that compactions don't rewrite it.  The level is claimed like a
+  // compaction would so that no compaction writes a table there that spans
+  // the range while it's added.  Memtable flushes can go as deep as
+  // kMaxMemCompactLevel without claiming a level, so the table goes no
+  // higher than the level below, or else to level-0, where tables may
+  // overlap.
+  int level;
+  for (;;) {
+    Version* base = versions_->current();
+    level = config::kNumLevels - 1;
+    while (level > config::kMaxMemCompactLevel &&
+           base->OverlapInLevel(level, &begin, &end)) {
+      level--;
+    }
+    if (level == config::kMaxMemCompactLevel) {
+      level = 0;
+    }
+    if (level == 0 || !compacting_levels_[level]) {
+      break;
+    }
+    if (!bg_error_.ok()) {
+      return bg_error_;
+    }
+    bg_cv_.Wait();
+  }
+  if (level > 0) {
+    compacting_levels_[level] = true;
+  }
+
+  const uint64_t number = versions_->NewFileNumber();
+  pending_outputs_.insert(number);
+  const std::string target = TableFileName(dbname_, number);
+  mutex_.Unlock();
+  s = env_->LinkFile(fname, target);
+  if (!s.ok()) {
+    s = CopyFile(env_, fname, target);
+  }
+  mutex_.Lock();
+  if (s.ok()) {
+    VersionEdit edit;
+    edit.AddFile(level, number, file_size, smallest, largest, 0);
+    s = LogAndApply(&edit);
+  }
+  pending_outputs_.erase(number);
+  Log(options_.info_log, "Ingested %s as #%llu to level-%d: %lld bytes %s",
+      fname.c_str(), (unsigned long long) number, level,
+      (unsigned long long) file_size, s.ToString().c_str());
+  if (!s.ok()) {
+    DeleteObsoleteFiles();
+  }
+
+  if (level > 0) {
+    compacting_levels_[level] = false;
+  }
+  MaybeScheduleCompaction();
+  bg_cv_.SignalAll();
+  return s;
+}
+
 void DBImpl::TEST_CompactRange(int level, const Slice* begin,const Slice* end) {
   assert(level >= 0);
   assert(level + 1 < config::kNumLevels);
@@ -542,6 +1152,7 @@ void DBImpl::TEST_CompactRange(int level, const Slice* begin,const Slice* end) {
   ManualCompaction manual;
   manual.level = level;
   manual.done = false;
+  manual.in_progress = false;
   if (begin == NULL) {
     manual.begin = NULL;
   } else {
@@ -569,6 +1180,10 @@ void DBImpl::TEST_CompactRange(int level, const Slice* begin,const Slice* end) {
 }
 
 Status DBImpl::TEST_CompactMemTable() {
+  return FlushMemTable();
+}
+
+Status DBImpl::FlushMemTable() {
   // NULL batch means just wait for earlier writes to be done
   Status s = Write(WriteOptions(), NULL);
   if (s.ok()) {
@@ -584,29 +1199,57 @@ Status DBImpl::TEST_CompactMemTable() {
   return s;
 }
 
+bool DBImpl::HasPendingCompaction() {
+  mutex_.AssertHeld();
+  if (manual_compaction_ != NULL && !manual_compaction_->in_progress &&
+      !compacting_levels_[manual_compaction_->level] &&
+      !compacting_levels_[manual_compaction_->level + 1]) {
+    return true;
+  }
+  return versions_->NeedsCompaction(compacting_levels_);
+}
+
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
-  if (bg_compaction_scheduled_) {
-    // Already scheduled
-  } else if (shutting_down_.Acquire_Load()) {
-    // DB is being deleted; no more background compactions
-  } else if (imm_ == NULL &&
-             manual_compaction_ == NULL &&
-             !versions_->NeedsCompaction()) {
-    // No work to be done
-  } else {
-    bg_compaction_scheduled_ = true;
+  // Memtable flushes have a lane of their own so that writers waiting on
+  // imm_ are not held up behind long level compactions.
+  if (imm_ != NULL && !flushing_imm_ && !bg_flush_scheduled_ &&
+      !shutting_down_.Acquire_Load()) {
+    bg_flush_scheduled_ = true;
+    env_->ScheduleFlush(&DBImpl::BGFlushWork, this);
+  }
+
+  // Work items don't claim a compaction until they run, so this may
+  // schedule a few more items than there is work; extra ones find
+  // nothing to do and exit.
+  while (bg_compactions_scheduled_ < options_.max_background_compactions) {
+    if (shutting_down_.Acquire_Load()) {
+      // DB is being deleted; no more background compactions
+      break;
+    } else if (!HasPendingCompaction()) {
+      // No work to be done
+      break;
+    }
+    bg_compactions_scheduled_++;
     env_->Schedule(&DBImpl::BGWork, this);
   }
 }
 
+void DBImpl::MarkCompactingLevels(const Compaction* c, bool busy) {
+  mutex_.AssertHeld();
+  for (int level = c->start_level(); level <= c->level() + 1; level++) {
+    compacting_levels_[level] = busy;
+  }
+  running_compactions_ += busy ? 1 : -1;
+}
+
 void DBImpl::BGWork(void* db) {
   reinterpret_cast<DBImpl*>(db)->BackgroundCall();
 }
 
 void DBImpl::BackgroundCall() {
   MutexLock l(&mutex_);
-  assert(bg_compaction_scheduled_);
+  assert(bg_compactions_scheduled_ > 0);
   if (!shutting_down_.Acquire_Load()) {
     Status s = BackgroundCompaction();
     if (s.ok()) {
@@ -627,7 +1270,7 @@ void DBImpl::BackgroundCall() {
     }
   }
 
-  bg_compaction_scheduled_ = false;
+  bg_compactions_scheduled_--;
 
   // Previous compaction may have produced too many files in a level,
   // so reschedule another compaction if needed.
@@ -635,18 +1278,46 @@ void DBImpl::BackgroundCall() {
   bg_cv_.SignalAll();
 }
 
-Status DBImpl::BackgroundCompaction() {
-  mutex_.AssertHeld();
+void DBImpl::BGFlushWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundFlushCall();
+}
 
-  if (imm_ != NULL) {
-    return CompactMemTable();
+void DBImpl::BackgroundFlushCall() {
+  MutexLock l(&mutex_);
+  assert(bg_flush_scheduled_);
+  // A running compaction may have flushed imm_ already
+  if (!shutting_down_.Acquire_Load() && imm_ != NULL && !flushing_imm_) {
+    Status s = CompactMemTable(false);
+    if (!s.ok() && !shutting_down_.Acquire_Load()) {
+      // Wait a little bit before retrying, as for compaction errors
+      bg_cv_.SignalAll();
+      Log(options_.info_log, "Waiting after memtable flush error: %s",
+          s.ToString().c_str());
+      mutex_.Unlock();
+      env_->SleepForMicroseconds(1000000);
+      mutex_.Lock();
+    }
   }
 
+  bg_flush_scheduled_ = false;
+
+  // The new level-0 file may need compacting, and a failed flush needs
+  // to be retried.
+  MaybeScheduleCompaction();
+  bg_cv_.SignalAll();
+}
+
+Status DBImpl::BackgroundCompaction() {
+  mutex_.AssertHeld();
+
   Compaction* c;
-  bool is_manual = (manual_compaction_ != NULL);
+  ManualCompaction* m = manual_compaction_;
+  bool is_manual = (m != NULL && !m->in_progress &&
+                    !compacting_levels_[m->level] &&
+                    !compacting_levels_[m->level + 1]);
   InternalKey manual_end;
   if (is_manual) {
-    ManualCompaction* m = manual_compaction_;
+    m->in_progress = true;
     c = versions_->CompactRange(m->level, m->begin, m->end);
     m->done = (c == NULL);
     if (c != NULL) {
@@ -659,7 +1330,11 @@ Status DBImpl::BackgroundCompaction() {
         (m->end ? m->end->DebugString().c_str() : "(end)"),
         (m->done ? "(end)" : manual_end.DebugString().c_str()));
   } else {
-    c = versions_->PickCompaction();
+    c = versions_->PickCompaction(compacting_levels_);
+  }
+
+  if (c != NULL) {
+    MarkCompactingLevels(c, true);
   }
 
   Status status;
@@ -671,8 +1346,9 @@ Status DBImpl::BackgroundCompaction() {
     FileMetaData* f = c->input(0, 0);
     c->edit()->DeleteFile(c->level(), f->number);
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size,
-                       f->smallest, f->largest);
-    status = versions_->LogAndApply(c->edit(), &mutex_);
+                       f->smallest, f->largest, f->smallest_seq,
+                       f->oldest_blob);
+    status = LogAndApply(c->edit());
     VersionSet::LevelSummaryStorage tmp;
     Log(options_.info_log, "Moved #%lld to level-%d %lld bytes %s: %s\n",
         static_cast<unsigned long long>(f->number),
@@ -686,6 +1362,12 @@ Status DBImpl::BackgroundCompaction() {
     CleanupCompaction(compact);
     c->ReleaseInputs();
     DeleteObsoleteFiles();
+    if (status.ok()) {
+      status = DropObsoleteRangeDeletions();
+    }
+  }
+  if (c != NULL) {
+    MarkCompactingLevels(c, false);
   }
   delete c;
 
@@ -702,7 +1384,8 @@ Status DBImpl::BackgroundCompaction() {
   }
 
   if (is_manual) {
-    ManualCompaction* m = manual_compaction_;
+    assert(m == manual_compaction_);
+    m->in_progress = false;
     if (!status.ok()) {
       m->done = true;
     }
@@ -727,10 +1410,15 @@ void DBImpl::CleanupCompaction(CompactionState* compact) {
     assert(compact->outfile == NULL);
   }
   delete compact->outfile;
+  delete compact->blob_builder;
+  delete compact->blob_outfile;
   for (size_t i = 0; i < compact->outputs.size(); i++) {
     const CompactionState::Output& out = compact->outputs[i];
     pending_outputs_.erase(out.number);
   }
+  for (size_t i = 0; i < compact->blob_outputs.size(); i++) {
+    pending_outputs_.erase(compact->blob_outputs[i].number);
+  }
   delete compact;
 }
 
@@ -746,15 +1434,20 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
     out.number = file_number;
     out.smallest.Clear();
     out.largest.Clear();
+    out.smallest_seq = kMaxSequenceNumber;
+    out.oldest_blob = 0;
     compact->outputs.push_back(out);
     mutex_.Unlock();
   }
 
   // Make the output file
   std::string fname = TableFileName(dbname_, file_number);
-  Status s = env_->NewWritableFile(fname, &compact->outfile);
+  Status s = options_.use_direct_io_for_compaction ?
+      env_->NewDirectWritableFile(fname, &compact->outfile) :
+      env_->NewBackgroundWritableFile(fname, &compact->outfile);
   if (s.ok()) {
-    compact->builder = new TableBuilder(options_, compact->outfile);
+    compact->builder = new TableBuilder(
+        OptionsForLevel(compact->compaction->level() + 1), compact->outfile);
   }
   return s;
 }
@@ -810,39 +1503,206 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
   return s;
 }
 
+Status DBImpl::OpenCompactionBlobFile(CompactionState* compact) {
+  assert(compact->blob_builder == NULL);
+  uint64_t file_number;
+  {
+    mutex_.Lock();
+    file_number = versions_->NewFileNumber();
+    pending_outputs_.insert(file_number);
+    CompactionState::BlobOutput out;
+    out.number = file_number;
+    out.file_size = 0;
+    compact->blob_outputs.push_back(out);
+    mutex_.Unlock();
+  }
 
-Status DBImpl::InstallCompactionResults(CompactionState* compact) {
-  mutex_.AssertHeld();
-  Log(options_.info_log,  "Compacted %d@%d + %d@%d files => %lld bytes",
-      compact->compaction->num_input_files(0),
-      compact->compaction->level(),
-      compact->compaction->num_input_files(1),
-      compact->compaction->level() + 1,
-      static_cast<long long>(compact->total_bytes));
-
-  // Add compaction outputs
+  std::string fname = BlobFileName(dbname_, file_number);
+  Status s = env_->NewBackgroundWritableFile(fname, &compact->blob_outfile);
+  if (s.ok()) {
+    compact->blob_builder = new BlobFileBuilder(file_number,
+                                                compact->blob_outfile);
+  }
+  return s;
+}
+
+Status DBImpl::FinishCompactionBlobFile(CompactionState* compact) {
+  assert(compact->blob_builder != NULL);
+  Status s = compact->blob_builder->Finish();
+  if (s.ok()) {
+    s = compact->blob_outfile->Close();
+  }
+  const uint64_t bytes = compact->blob_builder->FileSize();
+  compact->blob_outputs.back().file_size = bytes;
+  delete compact->blob_builder;
+  compact->blob_builder = NULL;
+  delete compact->blob_outfile;
+  compact->blob_outfile = NULL;
+  if (s.ok()) {
+    Log(options_.info_log, "Generated blob file #%llu: %lld bytes",
+        (unsigned long long) compact->blob_outputs.back().number,
+        (unsigned long long) bytes);
+  }
+  return s;
+}
+
+void DBImpl::AddBlobGarbage(CompactionState* compact, const Slice& index) {
+  BlobIndex blob;
+  if (blob.DecodeFrom(index).ok()) {
+    compact->blob_garbage[blob.file_number] += blob.record_size();
+  }
+}
+
+Status DBImpl::InstallCompactionResults(CompactionState* compact) {
+  mutex_.AssertHeld();
+  Log(options_.info_log,  "Compacted %d@%d + %d@%d files => %lld bytes",
+      compact->compaction->num_input_files(0),
+      compact->compaction->start_level(),
+      compact->compaction->num_input_files(1),
+      compact->compaction->level() + 1,
+      static_cast<long long>(compact->total_bytes));
+
+  // Add compaction outputs
   compact->compaction->AddInputDeletions(compact->compaction->edit());
   const int level = compact->compaction->level();
+  // No tombstone up to "applied" deletes anything in the outputs, so they
+  // do not keep those tombstones alive (see GetObsoleteRangeDeletions()).
+  const SequenceNumber applied =
+      compact->compaction->MaxAppliedRangeDeletion(compact->smallest_snapshot);
   for (size_t i = 0; i < compact->outputs.size(); i++) {
     const CompactionState::Output& out = compact->outputs[i];
     compact->compaction->edit()->AddFile(
         level + 1,
-        out.number, out.file_size, out.smallest, out.largest);
+        out.number, out.file_size, out.smallest, out.largest,
+        std::max(out.smallest_seq, applied), out.oldest_blob);
+  }
+  for (size_t i = 0; i < compact->blob_outputs.size(); i++) {
+    const CompactionState::BlobOutput& out = compact->blob_outputs[i];
+    compact->compaction->edit()->AddBlobFile(out.number, out.file_size);
+  }
+  for (std::map<uint64_t, uint64_t>::const_iterator iter =
+           compact->blob_garbage.begin();
+       iter != compact->blob_garbage.end();
+       ++iter) {
+    compact->compaction->edit()->AddBlobGarbage(iter->first, iter->second);
+  }
+  return LogAndApply(compact->compaction->edit());
+}
+
+Status DBImpl::DropObsoleteRangeDeletions() {
+  mutex_.AssertHeld();
+  std::vector<SequenceNumber> obsolete;
+  versions_->current()->GetObsoleteRangeDeletions(&obsolete);
+  if (obsolete.empty()) {
+    return Status::OK();
+  }
+  VersionEdit edit;
+  for (size_t i = 0; i < obsolete.size(); i++) {
+    edit.DeleteRangeDeletion(obsolete[i]);
+  }
+  Status s = LogAndApply(&edit);
+  Log(options_.info_log, "Dropped %d range deletions: %s",
+      static_cast<int>(obsolete.size()), s.ToString().c_str());
+  return s;
+}
+
+namespace {
+struct UserKeyLess {
+  const Comparator* ucmp;
+  explicit UserKeyLess(const Comparator* c) : ucmp(c) { }
+  bool operator()(const Slice& a, const Slice& b) const {
+    return ucmp->Compare(a, b) < 0;
+  }
+};
+}  // namespace
+
+struct DBImpl::Subcompaction {
+  DBImpl* db;
+  CompactionState* state;
+  Status status;
+  bool done;                    // Protected by db->mutex_
+};
+
+void DBImpl::SplitCompaction(CompactionState* compact,
+                             std::vector<Subcompaction*>* subs) {
+  mutex_.AssertHeld();
+  Compaction* c = compact->compaction;
+  uint64_t input_bytes = 0;
+  std::vector<Slice> bounds;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < c->num_input_files(which); i++) {
+      const FileMetaData* f = c->input(which, i);
+      input_bytes += f->file_size;
+      bounds.push_back(f->smallest.user_key());
+      bounds.push_back(f->largest.user_key());
+    }
+  }
+
+  // Give each subcompaction at least a couple of output files worth of
+  // input so that splitting pays for the extra threads.
+  int n = options_.max_subcompactions;
+  const uint64_t min_bytes = 2 * c->MaxOutputFileSize();
+  if (input_bytes / min_bytes < static_cast<uint64_t>(n)) {
+    n = static_cast<int>(input_bytes / min_bytes);
+  }
+  if (n <= 1) {
+    return;
+  }
+
+  // Split at input file boundaries.  All entries for a user key fall in
+  // one range, so each subcompaction can drop obsolete entries on its own.
+  const Comparator* ucmp = user_comparator();
+  std::sort(bounds.begin(), bounds.end(), UserKeyLess(ucmp));
+  std::vector<std::string> splits;
+  for (int i = 1; i < n; i++) {
+    const Slice& key = bounds[i * bounds.size() / n];
+    if (ucmp->Compare(key, bounds[0]) > 0 &&
+        (splits.empty() || ucmp->Compare(key, splits.back()) > 0)) {
+      splits.push_back(key.ToString());
+    }
+  }
+  if (splits.empty()) {
+    return;
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+
+  compact->end = splits[0];
+  for (size_t i = 0; i < splits.size(); i++) {
+    CompactionState* state = new CompactionState(c->NewSubcompaction());
+    state->smallest_snapshot = compact->smallest_snapshot;
+    state->start = splits[i];
+    if (i + 1 < splits.size()) {
+      state->end = splits[i + 1];
+    }
+    Subcompaction* sub = new Subcompaction;
+    sub->db = this;
+    sub->state = state;
+    sub->done = false;
+    subs->push_back(sub);
+  }
+  Log(options_.info_log, "Compaction split into %d subcompactions",
+      static_cast<int>(splits.size() + 1));
+}
+
+void DBImpl::BGSubcompaction(void* arg) {
+  Subcompaction* sub = reinterpret_cast<Subcompaction*>(arg);
+  DBImpl* db = sub->db;
+  Status s = db->ProcessCompactionRange(sub->state, false);
+  MutexLock l(&db->mutex_);
+  sub->status = s;
+  sub->done = true;
+  db->bg_cv_.SignalAll();
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
   const uint64_t start_micros = env_->NowMicros();
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
 
   Log(options_.info_log,  "Compacting %d@%d + %d@%d files",
       compact->compaction->num_input_files(0),
-      compact->compaction->level(),
+      compact->compaction->start_level(),
       compact->compaction->num_input_files(1),
       compact->compaction->level() + 1);
 
-  assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
+  assert(versions_->NumLevelFiles(compact->compaction->start_level()) > 0);
   assert(compact->builder == NULL);
   assert(compact->outfile == NULL);
   if (snapshots_.empty()) {
@@ -851,11 +1711,89 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     compact->smallest_snapshot = snapshots_.oldest()->number_;
   }
 
+  std::vector<Subcompaction*> subs;
+  SplitCompaction(compact, &subs);
+
   // Release mutex while we're actually doing the compaction work
   mutex_.Unlock();
 
+  for (size_t i = 0; i < subs.size(); i++) {
+    env_->StartThread(&DBImpl::BGSubcompaction, subs[i]);
+  }
+  Status status = ProcessCompactionRange(compact, true);
+
+  mutex_.Lock();
+  for (size_t i = 0; i < subs.size(); i++) {
+    Subcompaction* sub = subs[i];
+    while (!sub->done) {
+      bg_cv_.Wait();
+    }
+    CompactionState* state = sub->state;
+    if (status.ok()) {
+      status = sub->status;
+    }
+    // Hand the outputs to the parent so that they are installed, or
+    // released from pending_outputs_, together with its own.
+    compact->outputs.insert(compact->outputs.end(),
+                            state->outputs.begin(), state->outputs.end());
+    compact->blob_outputs.insert(compact->blob_outputs.end(),
+                                 state->blob_outputs.begin(),
+                                 state->blob_outputs.end());
+    for (std::map<uint64_t, uint64_t>::const_iterator iter =
+             state->blob_garbage.begin();
+         iter != state->blob_garbage.end();
+         ++iter) {
+      compact->blob_garbage[iter->first] += iter->second;
+    }
+    compact->total_bytes += state->total_bytes;
+    compact->num_filtered += state->num_filtered;
+    state->outputs.clear();
+    state->blob_outputs.clear();
+    Compaction* c = state->compaction;
+    CleanupCompaction(state);
+    delete c;
+    delete sub;
+  }
+
+  CompactionStats stats;
+  stats.micros = env_->NowMicros() - start_micros - compact->imm_micros;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
+      stats.bytes_read += compact->compaction->input(which, i)->file_size;
+    }
+  }
+  for (size_t i = 0; i < compact->outputs.size(); i++) {
+    stats.bytes_written += compact->outputs[i].file_size;
+  }
+  for (size_t i = 0; i < compact->blob_outputs.size(); i++) {
+    stats.bytes_written += compact->blob_outputs[i].file_size;
+  }
+
+  stats_[compact->compaction->level() + 1].Add(stats);
+  compaction_latency_.Add(stats.micros);
+  if (compact->num_filtered > 0) {
+    Log(options_.info_log, "Filtered %lld values",
+        static_cast<long long>(compact->num_filtered));
+  }
+
+  if (status.ok()) {
+    status = InstallCompactionResults(compact);
+  }
+  VersionSet::LevelSummaryStorage tmp;
+  Log(options_.info_log,
+      "compacted to: %s", versions_->LevelSummary(&tmp));
+  return status;
+}
+
+Status DBImpl::ProcessCompactionRange(CompactionState* compact,
+                                      bool flush_imm) {
   Iterator* input = versions_->MakeInputIterator(compact->compaction);
-  input->SeekToFirst();
+  if (compact->start.empty()) {
+    input->SeekToFirst();
+  } else {
+    InternalKey start(compact->start, kMaxSequenceNumber, kValueTypeForSeek);
+    input->Seek(start.Encode());
+  }
   Status status;
   ParsedInternalKey ikey;
   std::string current_user_key;
@@ -863,18 +1801,23 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
     // Prioritize immutable compaction work
-    if (has_imm_.NoBarrier_Load() != NULL) {
+    if (flush_imm && has_imm_.NoBarrier_Load() != NULL) {
       const uint64_t imm_start = env_->NowMicros();
       mutex_.Lock();
-      if (imm_ != NULL) {
-        CompactMemTable();
+      if (imm_ != NULL && !flushing_imm_) {
+        CompactMemTable(true);
         bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
       }
       mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
+      compact->imm_micros += (env_->NowMicros() - imm_start);
     }
 
     Slice key = input->key();
+    if (!compact->end.empty() && ParseInternalKey(key, &ikey) &&
+        user_comparator()->Compare(ikey.user_key, compact->end) >= 0) {
+      // Rest of the input belongs to the next subcompaction
+      break;
+    }
     if (compact->compaction->ShouldStopBefore(key) &&
         compact->builder != NULL) {
       status = FinishCompactionOutputFile(compact, input);
@@ -885,6 +1828,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 
     // Handle key/value, add to state, etc.
     bool drop = false;
+    bool merge = false;
     if (!ParseInternalKey(key, &ikey)) {
       // Do not hide error keys
       current_user_key.clear();
@@ -914,9 +1858,28 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         //     few iterations of this loop (by rule (A) above).
         // Therefore this deletion marker is obsolete and can be dropped.
         drop = true;
+      } else if (compact->compaction->IsRangeDeleted(
+                     ikey.user_key, ikey.sequence,
+                     compact->smallest_snapshot)) {
+        // Deleted by a range tombstone that every snapshot sees.  The
+        // tombstone outlives the entry (see GetObsoleteRangeDeletions()),
+        // so older entries for this key in other levels stay hidden.
+        drop = true;
+      } else if (ikey.type == kTypeMerge &&
+                 ikey.sequence <= compact->smallest_snapshot &&
+                 options_.merge_operator != NULL) {
+        // Every snapshot sees the operand and the entries under it, so
+        // they fold into one entry.  The entries left under it, if any,
+        // are dropped by rule (A).
+        merge = true;
       }
 
-      last_sequence_for_key = ikey.sequence;
+      if (ikey.type == kTypeMerge && options_.merge_operator == NULL) {
+        // The operand does not hide the entries under it.
+        last_sequence_for_key = kMaxSequenceNumber;
+      } else {
+        last_sequence_for_key = ikey.sequence;
+      }
     }
 #if 0
     Log(options_.info_log,
@@ -928,6 +1891,88 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         (int)last_sequence_for_key, (int)compact->smallest_snapshot);
 #endif
 
+    // The blob index of the input entry, whose record becomes garbage
+    // unless the entry is written out as it is.
+    Slice input_blob;
+    if (has_current_user_key && ikey.type == kTypeBlobIndex) {
+      input_blob = input->value();
+    }
+
+    std::string merged_key, merged_value;
+    Slice value = input->value();
+    if (merge) {
+      status = MergeCompactionEntries(compact, input, &merged_key,
+                                      &merged_value);
+      if (!status.ok()) {
+        break;
+      }
+      key = merged_key;
+      value = merged_value;
+    }
+
+    std::string filtered_key, filtered_value;
+    if (!drop && options_.compaction_filter != NULL &&
+        has_current_user_key && ikey.sequence <= compact->smallest_snapshot) {
+      // The key is parsed again since a merge moves the input past it.
+      ParsedInternalKey entry;
+      bool changed = false;
+      std::string blob_value;
+      if (ParseInternalKey(key, &entry) &&
+          (entry.type == kTypeValue || entry.type == kTypeBlobIndex)) {
+        Slice existing_value = value;
+        if (entry.type == kTypeBlobIndex) {
+          status = blob_cache_->Get(options_.paranoid_checks, value,
+                                    &blob_value);
+          if (!status.ok()) {
+            break;
+          }
+          existing_value = blob_value;
+        }
+        if (options_.compaction_filter->Filter(compact->compaction->level(),
+                                               entry.user_key, existing_value,
+                                               &filtered_value, &changed)) {
+          // Older entries in the levels under the output would show
+          // through if the key were simply dropped.
+          compact->num_filtered++;
+          if (compact->compaction->IsBaseLevelForKey(entry.user_key)) {
+            drop = true;
+          } else {
+            AppendInternalKey(&filtered_key,
+                              ParsedInternalKey(entry.user_key,
+                                                entry.sequence,
+                                                kTypeDeletion));
+            key = filtered_key;
+            value = Slice();
+          }
+        } else if (changed) {
+          compact->num_filtered++;
+          value = filtered_value;
+          if (entry.type == kTypeBlobIndex) {
+            AppendInternalKey(&filtered_key,
+                              ParsedInternalKey(entry.user_key,
+                                                entry.sequence,
+                                                kTypeValue));
+            key = filtered_key;
+          }
+        }
+      }
+    }
+
+    std::string blob_key, blob_value, blob_index;
+    uint64_t output_blob = 0;
+    if (!drop && has_current_user_key) {
+      status = SeparateCompactionValue(compact, &key, &value, &blob_key,
+                                       &blob_value, &blob_index,
+                                       &output_blob);
+      if (!status.ok()) {
+        break;
+      }
+    }
+    if (!input_blob.empty() &&
+        (drop || output_blob == 0 || value != input_blob)) {
+      AddBlobGarbage(compact, input_blob);
+    }
+
     if (!drop) {
       // Open output file if necessary
       if (compact->builder == NULL) {
@@ -940,7 +1985,17 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         compact->current_output()->smallest.DecodeFrom(key);
       }
       compact->current_output()->largest.DecodeFrom(key);
-      compact->builder->Add(key, input->value());
+      // Unparsable keys are kept, and count as the oldest entries
+      const SequenceNumber seq = has_current_user_key ? ikey.sequence : 0;
+      if (seq < compact->current_output()->smallest_seq) {
+        compact->current_output()->smallest_seq = seq;
+      }
+      uint64_t* oldest_blob = &compact->current_output()->oldest_blob;
+      if (output_blob != 0 &&
+          (*oldest_blob == 0 || output_blob < *oldest_blob)) {
+        *oldest_blob = output_blob;
+      }
+      compact->builder->Add(key, value);
 
       // Close output file if it is big enough
       if (compact->builder->FileSize() >=
@@ -952,7 +2007,9 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       }
     }
 
-    input->Next();
+    if (!merge) {
+      input->Next();
+    }
   }
 
   if (status.ok() && shutting_down_.Acquire_Load()) {
@@ -961,33 +2018,141 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   if (status.ok() && compact->builder != NULL) {
     status = FinishCompactionOutputFile(compact, input);
   }
+  if (status.ok() && compact->blob_builder != NULL) {
+    status = FinishCompactionBlobFile(compact);
+  }
   if (status.ok()) {
     status = input->status();
   }
   delete input;
-  input = NULL;
+  return status;
+}
 
-  CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
-  for (int which = 0; which < 2; which++) {
-    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
-      stats.bytes_read += compact->compaction->input(which, i)->file_size;
+Status DBImpl::SeparateCompactionValue(CompactionState* compact,
+                                       Slice* key, Slice* value,
+                                       std::string* key_buf,
+                                       std::string* value_buf,
+                                       std::string* index_buf,
+                                       uint64_t* blob_number) {
+  ParsedInternalKey entry;
+  if (!ParseInternalKey(*key, &entry)) {
+    return Status::OK();
+  }
+  Status s;
+  if (entry.type == kTypeBlobIndex) {
+    BlobIndex blob;
+    s = blob.DecodeFrom(*value);
+    if (!s.ok()) {
+      return s;
     }
+    if (!compact->compaction->ShouldRelocateBlob(blob.file_number)) {
+      *blob_number = blob.file_number;
+      return s;
+    }
+    // Copy the value out of a blob file with too much garbage.
+    s = blob_cache_->Get(options_.paranoid_checks, *value, value_buf);
+    if (!s.ok()) {
+      return s;
+    }
+    *value = *value_buf;
+    AppendInternalKey(key_buf, ParsedInternalKey(entry.user_key,
+                                                 entry.sequence,
+                                                 kTypeValue));
+    *key = *key_buf;
+  } else if (entry.type != kTypeValue) {
+    return s;
   }
-  for (size_t i = 0; i < compact->outputs.size(); i++) {
-    stats.bytes_written += compact->outputs[i].file_size;
+
+  if (options_.min_blob_size == 0 || value->size() < options_.min_blob_size) {
+    return s;
+  }
+  if (compact->blob_builder == NULL) {
+    s = OpenCompactionBlobFile(compact);
+    if (!s.ok()) {
+      return s;
+    }
   }
+  s = compact->blob_builder->Add(*value, index_buf);
+  if (!s.ok()) {
+    return s;
+  }
+  *blob_number = compact->blob_builder->file_number();
+  // The user key may be in *key_buf already.
+  std::string blob_key;
+  AppendInternalKey(&blob_key, ParsedInternalKey(entry.user_key,
+                                                 entry.sequence,
+                                                 kTypeBlobIndex));
+  key_buf->swap(blob_key);
+  *key = *key_buf;
+  *value = *index_buf;
+  if (compact->blob_builder->FileSize() >= options_.blob_file_size) {
+    s = FinishCompactionBlobFile(compact);
+  }
+  return s;
+}
 
-  mutex_.Lock();
-  stats_[compact->compaction->level() + 1].Add(stats);
+Status DBImpl::MergeCompactionEntries(CompactionState* compact,
+                                      Iterator* input,
+                                      std::string* key,
+                                      std::string* value) {
+  ParsedInternalKey ikey;
+  ParseInternalKey(input->key(), &ikey);
+  const std::string user_key = ikey.user_key.ToString();
+  const SequenceNumber sequence = ikey.sequence;
+  std::vector<std::string> operands;
+  operands.push_back(input->value().ToString());
+
+  // Collect the operands down to the value or deletion that ends them.
+  bool done = false;
+  bool found = false;
+  for (input->Next(); input->Valid(); input->Next()) {
+    if (!ParseInternalKey(input->key(), &ikey) ||
+        user_comparator()->Compare(ikey.user_key, user_key) != 0) {
+      break;
+    }
+    if (compact->compaction->IsRangeDeleted(ikey.user_key, ikey.sequence,
+                                            compact->smallest_snapshot)) {
+      done = true;
+    } else if (ikey.type == kTypeMerge) {
+      operands.push_back(input->value().ToString());
+      continue;
+    } else if (ikey.type == kTypeValue) {
+      Slice v = input->value();
+      value->assign(v.data(), v.size());
+      found = done = true;
+    } else if (ikey.type == kTypeBlobIndex) {
+      Status s = blob_cache_->Get(options_.paranoid_checks, input->value(),
+                                  value);
+      if (!s.ok()) {
+        return s;
+      }
+      found = done = true;
+    } else {
+      done = true;
+    }
+    break;
+  }
+  if (!done && compact->compaction->IsBaseLevelForKey(user_key)) {
+    // No older entries for the key in the levels under the output.
+    done = true;
+  }
 
-  if (status.ok()) {
-    status = InstallCompactionResults(compact);
+  Status s;
+  key->clear();
+  if (done) {
+    AppendInternalKey(key, ParsedInternalKey(user_key, sequence, kTypeValue));
+    s = ApplyMergeOperands(options_.merge_operator, user_key, operands,
+                           found, value);
+  } else {
+    // Combine the operands into one, which relies on the operator being
+    // associative, and leave it to be applied to the older entries.
+    AppendInternalKey(key, ParsedInternalKey(user_key, sequence, kTypeMerge));
+    value->swap(operands.back());
+    operands.pop_back();
+    s = ApplyMergeOperands(options_.merge_operator, user_key, operands,
+                           true, value);
   }
-  VersionSet::LevelSummaryStorage tmp;
-  Log(options_.info_log,
-      "compacted to: %s", versions_->LevelSummary(&tmp));
-  return status;
+  return s;
 }
 
 namespace {
@@ -996,10 +2161,14 @@ struct IterState {
   Version* version;
   MemTable* mem;
   MemTable* imm;
+  RangeDelMap* range_dels;      // Owned, or NULL
+  std::string upper_bound;      // Internal key form of iterate_upper_bound
+  Slice upper_bound_slice;
 };
 
 static void CleanupIteratorState(void* arg1, void* arg2) {
   IterState* state = reinterpret_cast<IterState*>(arg1);
+  delete state->range_dels;
   state->mu->Lock();
   state->mem->Unref();
   if (state->imm != NULL) state->imm->Unref();
@@ -1010,10 +2179,28 @@ static void CleanupIteratorState(void* arg1, void* arg2) {
 }  // namespace
 
 Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
-                                      SequenceNumber* latest_snapshot) {
+                                      SequenceNumber* latest_snapshot,
+                                      const RangeDelMap** range_dels,
+                                      uint32_t* seed) {
   IterState* cleanup = new IterState;
+
+  // The tables compare internal keys, so they are given the smallest
+  // internal key of the bound, which the caller need not keep around.
+  ReadOptions read_options = options;
+  if (options.iterate_upper_bound != NULL) {
+    AppendInternalKey(&cleanup->upper_bound,
+                      ParsedInternalKey(*options.iterate_upper_bound,
+                                        kMaxSequenceNumber,
+                                        kValueTypeForSeek));
+    cleanup->upper_bound_slice = cleanup->upper_bound;
+    read_options.iterate_upper_bound = &cleanup->upper_bound_slice;
+  }
+
   mutex_.Lock();
   *latest_snapshot = versions_->LastSequence();
+  if (seed != NULL) {
+    *seed = ++seed_;
+  }
 
   // Collect together all needed child iterators
   std::vector<Iterator*> list;
@@ -1023,7 +2210,7 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
     list.push_back(imm_->NewIterator());
     imm_->Ref();
   }
-  versions_->current()->AddIterators(options, &list);
+  versions_->current()->AddIterators(read_options, &list);
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list[0], list.size());
   versions_->current()->Ref();
@@ -1032,15 +2219,38 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
   cleanup->mem = mem_;
   cleanup->imm = imm_;
   cleanup->version = versions_->current();
+  cleanup->range_dels = NULL;
   internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, NULL);
 
   mutex_.Unlock();
+
+  // The memtables and version are pinned, so their range tombstones can
+  // be gathered without the lock.  Memtables rarely hold any, so the
+  // version's index is usually enough.
+  if (range_dels != NULL) {
+    const Version* v = cleanup->version;
+    if (cleanup->mem->HasRangeDeletions() ||
+        (cleanup->imm != NULL && cleanup->imm->HasRangeDeletions())) {
+      std::vector<RangeTombstone> tombstones = v->range_dels();
+      cleanup->mem->GetRangeDeletions(&tombstones);
+      if (cleanup->imm != NULL) {
+        cleanup->imm->GetRangeDeletions(&tombstones);
+      }
+      cleanup->range_dels = new RangeDelMap(user_comparator());
+      cleanup->range_dels->Build(tombstones);
+      *range_dels = cleanup->range_dels;
+    } else if (!v->range_del_map().empty()) {
+      *range_dels = &v->range_del_map();
+    } else {
+      *range_dels = NULL;
+    }
+  }
   return internal_iter;
 }
 
 Iterator* DBImpl::TEST_NewInternalIterator() {
   SequenceNumber ignored;
-  return NewInternalIterator(ReadOptions(), &ignored);
+  return NewInternalIterator(ReadOptions(), &ignored, NULL);
 }
 
 int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
@@ -1052,6 +2262,7 @@ Status DBImpl::Get(const ReadOptions& options,
                    const Slice& key,
                    std::string* value) {
   Status s;
+  const uint64_t start_micros = env_->NowMicros();
   MutexLock l(&mutex_);
   SequenceNumber snapshot;
   if (options.snapshot != NULL) {
@@ -1073,18 +2284,11 @@ Status DBImpl::Get(const ReadOptions& options,
   // Unlock while reading from files and memtables
   {
     mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
-      // Done
-    } else if (imm != NULL && imm->Get(lkey, value, &s)) {
-      // Done
-    } else {
-      s = current->Get(options, lkey, value, &stats);
-      have_stat_update = true;
-    }
+    s = GetFromVersion(options, key, snapshot, mem, imm, current, value,
+                       &have_stat_update, &stats);
     mutex_.Lock();
   }
+  get_latency_.Add(env_->NowMicros() - start_micros);
 
   if (have_stat_update && current->UpdateStats(stats)) {
     MaybeScheduleCompaction();
@@ -1095,14 +2299,163 @@ Status DBImpl::Get(const ReadOptions& options,
   return s;
 }
 
+namespace {
+
+// Orders the positions of MultiGet() keys by key.
+struct MultiGetOrder {
+  const Comparator* cmp;
+  const std::vector<Slice>* keys;
+  bool operator()(size_t a, size_t b) const {
+    return cmp->Compare((*keys)[a], (*keys)[b]) < 0;
+  }
+};
+
+}  // namespace
+
+std::vector<Status> DBImpl::MultiGet(const ReadOptions& options,
+                                     const std::vector<Slice>& keys,
+                                     std::vector<std::string>* values) {
+  std::vector<Status> statuses(keys.size());
+  values->resize(keys.size());
+
+  // The mutex is taken and the version referenced once for every key.
+  MutexLock l(&mutex_);
+  SequenceNumber snapshot;
+  if (options.snapshot != NULL) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  MemTable* mem = mem_;
+  MemTable* imm = imm_;
+  Version* current = versions_->current();
+  mem->Ref();
+  if (imm != NULL) imm->Ref();
+  current->Ref();
+
+  // Keys are read in order so that keys sharing a table or a block find
+  // its index, filter and data blocks already in the caches.  Only the
+  // first seek charged to a file is kept, as it would be for one Get().
+  bool schedule = false;
+  {
+    mutex_.Unlock();
+    std::vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      order[i] = i;
+    }
+    MultiGetOrder less = { user_comparator(), &keys };
+    std::stable_sort(order.begin(), order.end(), less);
+
+    bool have_stat_update = false;
+    Version::GetStats stats;
+    for (size_t i = 0; i < order.size(); i++) {
+      const size_t k = order[i];
+      if (i > 0 && user_comparator()->Compare(keys[k], keys[order[i-1]]) == 0) {
+        statuses[k] = statuses[order[i-1]];
+        (*values)[k] = (*values)[order[i-1]];
+        continue;
+      }
+      bool key_stat_update = false;
+      Version::GetStats key_stats;
+      statuses[k] = GetFromVersion(options, keys[k], snapshot, mem, imm,
+                                   current, &(*values)[k], &key_stat_update,
+                                   &key_stats);
+      if (key_stat_update && key_stats.seek_file != NULL &&
+          !have_stat_update) {
+        have_stat_update = true;
+        stats = key_stats;
+      }
+    }
+    mutex_.Lock();
+    schedule = have_stat_update && current->UpdateStats(stats);
+  }
+
+  if (schedule) {
+    MaybeScheduleCompaction();
+  }
+  mem->Unref();
+  if (imm != NULL) imm->Unref();
+  current->Unref();
+  return statuses;
+}
+
+Status DBImpl::GetFromVersion(const ReadOptions& options, const Slice& key,
+                              SequenceNumber snapshot, MemTable* mem,
+                              MemTable* imm, Version* current,
+                              std::string* value, bool* have_stat_update,
+                              Version::GetStats* stats) {
+  Status s;
+
+  // The newest range tombstone that covers key hides older entries.
+  SequenceNumber range_del = std::max(
+      mem->MaxCoveringRangeDeletion(key, snapshot),
+      current->range_del_map().MaxCoveringSequence(key, snapshot));
+  if (imm != NULL) {
+    range_del = std::max(range_del,
+                         imm->MaxCoveringRangeDeletion(key, snapshot));
+  }
+
+  // First look in the memtable, then in the immutable memtable (if any).
+  // Merge operands are collected on the way down to the value.
+  LookupKey lkey(key, snapshot);
+  SequenceNumber seq = 0;
+  MergeContext merge;
+  if (mem->Get(lkey, value, &s, &seq, &merge) ||
+      (imm != NULL && imm->Get(lkey, value, &s, &seq, &merge))) {
+    if (options.stats != NULL) {
+      options.stats->memtable_hits++;
+    }
+  } else {
+    s = current->Get(options, lkey, value, &seq, &merge, stats);
+    *have_stat_update = true;
+  }
+  if (s.ok() && seq < range_del) {
+    s = Status::NotFound(Slice());
+  }
+  if (!merge.empty() && (s.ok() || s.IsNotFound())) {
+    merge.DropBefore(range_del);
+    if (!merge.empty()) {
+      s = ApplyMergeOperands(options_.merge_operator, key, merge.operands,
+                             s.ok(), value);
+    }
+  }
+  return s;
+}
+
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
-  Iterator* internal_iter = NewInternalIterator(options, &latest_snapshot);
+  const RangeDelMap* range_dels;
+  uint32_t seed;
+  Iterator* internal_iter = NewInternalIterator(options, &latest_snapshot,
+                                                &range_dels, &seed);
   return NewDBIterator(
       &dbname_, env_, user_comparator(), internal_iter,
       (options.snapshot != NULL
        ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
-       : latest_snapshot));
+       : latest_snapshot),
+      (options.prefix_same_as_start
+       ? internal_prefix_extractor_.user_transform() : NULL),
+      range_dels, options.iterate_upper_bound, options_.merge_operator,
+      options.pin_data, blob_cache_, options.verify_checksums,
+      options.stats, this, seed);
+}
+
+void DBImpl::RecordReadSample(const Slice& key, uint64_t skipped) {
+  MutexLock l(&mutex_);
+  int files;
+  const bool compact =
+      versions_->current()->RecordReadSample(key, skipped, &files);
+  read_samples_.samples++;
+  read_samples_.skipped += skipped;
+  if (files > 1) {
+    read_samples_.merged_samples++;
+    read_samples_.files += files;
+  }
+  if (compact) {
+    read_samples_.compactions++;
+    MaybeScheduleCompaction();
+  }
 }
 
 const Snapshot* DBImpl::GetSnapshot() {
@@ -1124,7 +2477,18 @@ Status DBImpl::Delete(const WriteOptions& options, const Slice& key) {
   return DB::Delete(options, key);
 }
 
+Status DBImpl::DeleteRange(const WriteOptions& options,
+                           const Slice& begin_key, const Slice& end_key) {
+  return DB::DeleteRange(options, begin_key, end_key);
+}
+
+Status DBImpl::Merge(const WriteOptions& options,
+                     const Slice& key, const Slice& value) {
+  return DB::Merge(options, key, value);
+}
+
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
+  const uint64_t start_micros = env_->NowMicros();
   Writer w(&mutex_);
   w.batch = my_batch;
   w.sync = options.sync;
@@ -1132,20 +2496,77 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
 
   MutexLock l(&mutex_);
   writers_.push_back(&w);
-  while (!w.done && &w != writers_.front()) {
+  if (writers_.size() > write_stats_.max_queued_writers) {
+    write_stats_.max_queued_writers = writers_.size();
+  }
+  // A pipelined follower may have left writers_ before it is done.
+  while (!w.done && (writers_.empty() || &w != writers_.front())) {
+    if (w.insert_into != NULL) {
+      // Our batch is already in the log; add it to the memtable while
+      // the leader and the rest of the group add theirs.
+      MemTable* mem = w.insert_into;
+      w.insert_into = NULL;
+      mutex_.Unlock();
+      Status s = WriteBatchInternal::InsertIntoConcurrently(my_batch, mem);
+      mutex_.Lock();
+      Writer* leader = w.leader;
+      if (!s.ok() && leader->status.ok()) {
+        leader->status = s;
+      }
+      if (--leader->pending_inserts == 0) {
+        leader->cv.Signal();
+      }
+      continue;
+    }
     w.cv.Wait();
   }
   if (w.done) {
+    write_stats_.latency.Add(env_->NowMicros() - start_micros);
     return w.status;
   }
 
+  if (w.sync && my_batch != NULL && options_.log_sync_interval_micros > 0) {
+    // Hold the sync back until the interval since the last one has
+    // passed, so that the writers queued meanwhile share it.
+    const uint64_t now = env_->NowMicros();
+    const uint64_t next = last_log_sync_micros_ +
+                          options_.log_sync_interval_micros;
+    if (now < next) {
+      mutex_.Unlock();
+      env_->SleepForMicroseconds(static_cast<int>(next - now));
+      mutex_.Lock();
+    }
+  }
+
   // May temporarily unlock and wait.
   Status status = MakeRoomForWrite(my_batch == NULL);
   uint64_t last_sequence = versions_->LastSequence();
+  if (!memtable_writers_.empty()) {
+    // Earlier groups are in the log but not yet visible.
+    last_sequence = memtable_writers_.back()->last_sequence;
+  }
   Writer* last_writer = &w;
   if (status.ok() && my_batch != NULL) {  // NULL batch is for compactions
     WriteBatch* updates = BuildBatchGroup(&last_writer);
     WriteBatchInternal::SetSequence(updates, last_sequence + 1);
+    write_stats_.bytes_written += WriteBatchInternal::ByteSize(updates);
+    const bool pipelined = options_.enable_pipelined_write;
+    const bool parallel = options_.allow_concurrent_memtable_write &&
+                          !pipelined && updates == tmp_batch_;
+    if (parallel) {
+      // Give every batch in the group the sequence numbers it has in
+      // "updates" so that each writer can insert its own batch.
+      SequenceNumber seq = last_sequence + 1;
+      for (std::deque<Writer*>::iterator iter = writers_.begin();
+           ; ++iter) {
+        Writer* f = *iter;
+        if (f->batch != NULL) {
+          WriteBatchInternal::SetSequence(f->batch, seq);
+          seq += WriteBatchInternal::Count(f->batch);
+        }
+        if (f == last_writer) break;
+      }
+    }
     last_sequence += WriteBatchInternal::Count(updates);
 
     // Add to log and apply to memtable.  We can release the lock
@@ -1158,11 +2579,31 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
       if (status.ok() && options.sync) {
         status = logfile_->Sync();
       }
-      if (status.ok()) {
+      if (status.ok() && !parallel && !pipelined) {
         status = WriteBatchInternal::InsertInto(updates, mem_);
       }
       mutex_.Lock();
     }
+    if (options.sync) {
+      last_log_sync_micros_ = env_->NowMicros();
+    }
+    if (pipelined) {
+      // The group keeps its own copy of a merged batch since the next
+      // group may build one in tmp_batch_ while this one applies it.
+      WriteBatch group_batch;
+      if (updates == tmp_batch_) {
+        WriteBatchInternal::Swap(&group_batch, tmp_batch_);
+        tmp_batch_->Clear();
+        updates = &group_batch;
+      }
+      w.last_sequence = last_sequence;
+      status = ApplyPipelined(&w, last_writer, updates, status);
+      write_stats_.latency.Add(env_->NowMicros() - start_micros);
+      return status;
+    }
+    if (status.ok() && parallel) {
+      status = InsertGroupConcurrently(&w, last_writer);
+    }
     if (updates == tmp_batch_) tmp_batch_->Clear();
 
     versions_->SetLastSequence(last_sequence);
@@ -1184,9 +2625,93 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
     writers_.front()->cv.Signal();
   }
 
+  if (my_batch != NULL) {
+    write_stats_.latency.Add(env_->NowMicros() - start_micros);
+  }
+  return status;
+}
+
+// Hand the log over to the next group and then, in log order, apply the
+// already logged batch "updates" of the group from "leader" to
+// "last_writer" to mem_ and make it visible.
+Status DBImpl::ApplyPipelined(Writer* leader, Writer* last_writer,
+                              WriteBatch* updates, Status status) {
+  mutex_.AssertHeld();
+  assert(leader == writers_.front());
+  MemTable* mem = mem_;   // Not switched while memtable_writers_ is busy
+  Writer* tail = leader;
+  while (true) {
+    Writer* ready = writers_.front();
+    writers_.pop_front();
+    if (ready != leader) {
+      tail->next = ready;
+      tail = ready;
+    }
+    if (ready == last_writer) break;
+  }
+  tail->next = NULL;
+  memtable_writers_.push_back(leader);
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+
+  while (leader != memtable_writers_.front()) {
+    leader->cv.Wait();
+  }
+  if (status.ok()) {
+    mutex_.Unlock();
+    status = WriteBatchInternal::InsertInto(updates, mem);
+    mutex_.Lock();
+  }
+  versions_->SetLastSequence(leader->last_sequence);
+  memtable_writers_.pop_front();
+  if (!memtable_writers_.empty()) {
+    memtable_writers_.front()->cv.Signal();
+  } else {
+    bg_cv_.SignalAll();   // MakeRoomForWrite may be waiting to switch mem_
+  }
+
+  for (Writer* f = leader->next; f != NULL; f = f->next) {
+    f->status = status;
+    f->done = true;
+    f->cv.Signal();
+  }
   return status;
 }
 
+// Insert the batches of the group led by "leader" and ending with
+// "last_writer" into mem_, with each follower inserting its own batch.
+// REQUIRES: the group's log record has been written.
+Status DBImpl::InsertGroupConcurrently(Writer* leader, Writer* last_writer) {
+  mutex_.AssertHeld();
+  assert(leader == writers_.front());
+  MemTable* mem = mem_;
+  leader->status = Status::OK();
+  leader->pending_inserts = 0;
+  for (std::deque<Writer*>::iterator iter = writers_.begin() + 1;
+       iter != writers_.end(); ++iter) {
+    Writer* f = *iter;
+    if (f->batch != NULL) {
+      f->insert_into = mem;
+      f->leader = leader;
+      leader->pending_inserts++;
+      f->cv.Signal();
+    }
+    if (f == last_writer) break;
+  }
+
+  mutex_.Unlock();
+  Status s = WriteBatchInternal::InsertIntoConcurrently(leader->batch, mem);
+  mutex_.Lock();
+  while (leader->pending_inserts > 0) {
+    leader->cv.Wait();
+  }
+  if (s.ok()) {
+    s = leader->status;
+  }
+  return s;
+}
+
 // REQUIRES: Writer list must be non-empty
 // REQUIRES: First writer must have a non-NULL batch
 WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
@@ -1206,6 +2731,7 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
   }
 
   *last_writer = first;
+  int group_size = 1;
   std::deque<Writer*>::iterator iter = writers_.begin();
   ++iter;  // Advance past "first"
   for (; iter != writers_.end(); ++iter) {
@@ -1232,7 +2758,9 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
       WriteBatchInternal::Append(result, w->batch);
     }
     *last_writer = w;
+    group_size++;
   }
+  write_stats_.group_size.Add(group_size);
   return result;
 }
 
@@ -1250,17 +2778,21 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       break;
     } else if (
         allow_delay &&
-        versions_->NumLevelFiles(0) >= config::kL0_SlowdownWritesTrigger) {
+        versions_->NumLevelFiles(0) >=
+            options_.level0_slowdown_writes_trigger) {
       // We are getting close to hitting a hard limit on the number of
       // L0 files.  Rather than delaying a single write by several
       // seconds when we hit the hard limit, start delaying each
       // individual write by 1ms to reduce latency variance.  Also,
       // this delay hands over some CPU to the compaction thread in
       // case it is sharing the same core as the writer.
+      const uint64_t stall_start = env_->NowMicros();
       mutex_.Unlock();
       env_->SleepForMicroseconds(1000);
       allow_delay = false;  // Do not delay a single write more than once
       mutex_.Lock();
+      write_stats_.AddStall(kStallL0Slowdown,
+                            env_->NowMicros() - stall_start);
     } else if (!force &&
                (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
       // There is room in current memtable
@@ -1268,10 +2800,19 @@ Status DBImpl::MakeRoomForWrite(bool force) {
     } else if (imm_ != NULL) {
       // We have filled up the current memtable, but the previous
       // one is still being compacted, so we wait.
+      const uint64_t stall_start = env_->NowMicros();
       bg_cv_.Wait();
-    } else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
+      write_stats_.AddStall(kStallMemtable, env_->NowMicros() - stall_start);
+    } else if (versions_->NumLevelFiles(0) >=
+               options_.level0_stop_writes_trigger) {
       // There are too many level-0 files.
       Log(options_.info_log, "waiting...\n");
+      const uint64_t stall_start = env_->NowMicros();
+      bg_cv_.Wait();
+      write_stats_.AddStall(kStallL0Stop, env_->NowMicros() - stall_start);
+    } else if (!memtable_writers_.empty()) {
+      // Earlier pipelined groups are still applying to mem_ and their
+      // records are in the current log, so wait before switching both.
       bg_cv_.Wait();
     } else {
       // Attempt to switch to a new memtable and trigger compaction of old
@@ -1288,10 +2829,11 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       delete logfile_;
       logfile_ = lfile;
       logfile_number_ = new_log_number;
-      log_ = new log::Writer(lfile);
+      log_ = new log::Writer(lfile, options_.log_compression);
       imm_ = mem_;
+      imm_->MarkImmutable();
       has_imm_.Release_Store(imm_);
-      mem_ = new MemTable(internal_comparator_);
+      mem_ = NewMemTable();
       mem_->Ref();
       force = false;   // Do not force another compaction if have room
       MaybeScheduleCompaction();
@@ -1349,6 +2891,139 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
+  } else if (in == "write-stats") {
+    static const char* kStallNames[kNumStallCauses] = {
+      "L0 slowdown", "Memtable", "L0 stop"
+    };
+    char buf[200];
+    snprintf(buf, sizeof(buf),
+             "Stall           Count Time(sec)\n"
+             "--------------------------------\n");
+    value->append(buf);
+    for (int i = 0; i < kNumStallCauses; i++) {
+      snprintf(buf, sizeof(buf), "%-12s %8lld %9.3f\n",
+               kStallNames[i],
+               static_cast<long long>(write_stats_.stall_count[i]),
+               write_stats_.stall_micros[i] / 1e6);
+      value->append(buf);
+    }
+    snprintf(buf, sizeof(buf), "Writers queued: %d (max %d)\n",
+             static_cast<int>(writers_.size()),
+             static_cast<int>(write_stats_.max_queued_writers));
+    value->append(buf);
+    value->append("Batch group size:\n");
+    value->append(write_stats_.group_size.ToString());
+    value->append("Write latency (micros):\n");
+    value->append(write_stats_.latency.ToString());
+    return true;
+  } else if (in == "latency") {
+    const Histogram* histograms[3] = {
+      &get_latency_, &write_stats_.latency, &compaction_latency_
+    };
+    static const char* kNames[3] = { "get", "write", "compaction" };
+    char buf[200];
+    snprintf(buf, sizeof(buf),
+             "Op              Count       P50       P99      P999\n"
+             "--------------------------------------------------\n");
+    value->append(buf);
+    for (int i = 0; i < 3; i++) {
+      snprintf(buf, sizeof(buf), "%-10s %10.0f %9.0f %9.0f %9.0f\n",
+               kNames[i],
+               histograms[i]->Count(),
+               histograms[i]->Percentile(50),
+               histograms[i]->Percentile(99),
+               histograms[i]->Percentile(99.9));
+      value->append(buf);
+    }
+    return true;
+  } else if (in == "read-samples") {
+    const ReadSampleStats& r = read_samples_;
+    char buf[200];
+    snprintf(buf, sizeof(buf),
+             "Samples: %lld (%lld merged, %.1f files each)\n"
+             "Entries skipped: %lld\n"
+             "Seek compactions: %lld\n",
+             static_cast<long long>(r.samples),
+             static_cast<long long>(r.merged_samples),
+             r.merged_samples > 0
+                 ? static_cast<double>(r.files) / r.merged_samples : 0.0,
+             static_cast<long long>(r.skipped),
+             static_cast<long long>(r.compactions));
+    *value = buf;
+    return true;
+  } else if (in == "compaction-backlog") {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu",
+             static_cast<unsigned long long>(
+                 versions_->CompactionBacklogBytes()));
+    *value = buf;
+    return true;
+  } else if (in == "running-compactions") {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%d", running_compactions_);
+    *value = buf;
+    return true;
+  } else if (in == "bytes-written") {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu",
+             static_cast<unsigned long long>(write_stats_.bytes_written));
+    *value = buf;
+    return true;
+  } else if (in == "compaction-bytes-written") {
+    int64_t bytes = 0;
+    for (int level = 0; level < config::kNumLevels; level++) {
+      bytes += stats_[level].bytes_written;
+    }
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(bytes));
+    *value = buf;
+    return true;
+  } else if (in == "stall-micros") {
+    int64_t micros = 0;
+    for (int i = 0; i < kNumStallCauses; i++) {
+      micros += write_stats_.stall_micros[i];
+    }
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(micros));
+    *value = buf;
+    return true;
+  } else if (in == "approximate-memory-usage") {
+    size_t total = mem_->ApproximateMemoryUsage();
+    if (imm_ != NULL) {
+      total += imm_->ApproximateMemoryUsage();
+    }
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(total));
+    *value = buf;
+    return true;
+  } else if (in == "pinned-metadata-usage") {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(
+        table_cache_->PinnedMetadataUsage()));
+    *value = buf;
+    return true;
+  } else if (in == "num-range-deletions") {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%d",
+             static_cast<int>(versions_->current()->range_dels().size()));
+    *value = buf;
+    return true;
+  } else if (in == "blob-files") {
+    const std::map<uint64_t, BlobFileMetaData>& blob_files =
+        versions_->current()->blob_files();
+    value->clear();
+    for (std::map<uint64_t, BlobFileMetaData>::const_iterator iter =
+             blob_files.begin();
+         iter != blob_files.end();
+         ++iter) {
+      char buf[100];
+      snprintf(buf, sizeof(buf), "%llu %llu %llu\n",
+               static_cast<unsigned long long>(iter->first),
+               static_cast<unsigned long long>(iter->second.file_size),
+               static_cast<unsigned long long>(iter->second.garbage_bytes));
+      value->append(buf);
+    }
+    return true;
   }
 
   return false;
@@ -1394,6 +3069,58 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+Status DB::DeleteRange(const WriteOptions& opt,
+                       const Slice& begin_key, const Slice& end_key) {
+  WriteBatch batch;
+  batch.DeleteRange(begin_key, end_key);
+  return Write(opt, &batch);
+}
+
+Status DB::Merge(const WriteOptions& opt,
+                 const Slice& key, const Slice& value) {
+  WriteBatch batch;
+  batch.Merge(key, value);
+  return Write(opt, &batch);
+}
+
+std::vector<Status> DB::MultiGet(const ReadOptions& options,
+                                 const std::vector<Slice>& keys,
+                                 std::vector<std::string>* values) {
+  std::vector<Status> statuses(keys.size());
+  values->resize(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    statuses[i] = Get(options, keys[i], &(*values)[i]);
+  }
+  return statuses;
+}
+
+Status DB::FlushMemTable() {
+  return Status::NotSupported("FlushMemTable");
+}
+
+Status DB::CreateCheckpoint(const std::string& dir) {
+  return Status::NotSupported("CreateCheckpoint", dir);
+}
+
+Status DB::GetCachedBlocks(std::string* blocks) {
+  return Status::NotSupported("GetCachedBlocks");
+}
+
+Status DB::WarmCache(const Slice& blocks, uint64_t bytes_per_second) {
+  return Status::NotSupported("WarmCache");
+}
+
+Status DB::NewTableWriter(const std::string& fname, TableWriter** result) {
+  *result = NULL;
+  return Status::NotSupported("NewTableWriter", fname);
+}
+
+Status DB::IngestTable(const std::string& fname) {
+  return Status::NotSupported("IngestTable", fname);
+}
+
+TableWriter::~TableWriter() { }
+
 DB::~DB() { }
 
 Status DB::Open(const Options& options, const std::string& dbname,
@@ -1413,7 +3140,7 @@ Status DB::Open(const Options& options, const std::string& dbname,
       edit.SetLogNumber(new_log_number);
       impl->logfile_ = lfile;
       impl->logfile_number_ = new_log_number;
-      impl->log_ = new log::Writer(lfile);
+      impl->log_ = new log::Writer(lfile, impl->options_.log_compression);
       s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
     }
     if (s.ok()) {
@@ -7,17 +7,23 @@
 
 #include <deque>
 #include <set>
+#include <vector>
 #include "db/dbformat.h"
 #include "db/log_writer.h"
 #include "db/snapshot.h"
+#include "db/version_set.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "port/port.h"
 #include "port/thread_annotations.h"
+#include "util/histogram.h"
 
 namespace leveldb {
 
+class BlobCache;
+class Compaction;
 class MemTable;
+class RangeDelMap;
 class TableCache;
 class Version;
 class VersionEdit;
@@ -31,16 +37,30 @@ class DBImpl : public DB {
   // Implementations of the DB interface
   virtual Status Put(const WriteOptions&, const Slice& key, const Slice& value);
   virtual Status Delete(const WriteOptions&, const Slice& key);
+  virtual Status DeleteRange(const WriteOptions&, const Slice& begin_key,
+                             const Slice& end_key);
+  virtual Status Merge(const WriteOptions&, const Slice& key,
+                       const Slice& value);
   virtual Status Write(const WriteOptions& options, WriteBatch* updates);
   virtual Status Get(const ReadOptions& options,
                      const Slice& key,
                      std::string* value);
+  virtual std::vector<Status> MultiGet(const ReadOptions& options,
+                                       const std::vector<Slice>& keys,
+                                       std::vector<std::string>* values);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
   virtual bool GetProperty(const Slice& property, std::string* value);
   virtual void GetApproximateSizes(const Range* range, int n, uint64_t* sizes);
   virtual void CompactRange(const Slice* begin, const Slice* end);
+  virtual Status FlushMemTable();
+  virtual Status CreateCheckpoint(const std::string& dir);
+  virtual Status GetCachedBlocks(std::string* blocks);
+  virtual Status WarmCache(const Slice& blocks, uint64_t bytes_per_second);
+  virtual Status NewTableWriter(const std::string& fname,
+                                TableWriter** result);
+  virtual Status IngestTable(const std::string& fname);
 
   // Extra methods (for testing) that are not in the public DB interface
 
@@ -59,16 +79,37 @@ class DBImpl : public DB {
   // file at a level >= 1.
   int64_t TEST_MaxNextLevelOverlappingBytes();
 
+  // Record a sample of bytes read at the specified internal key after an
+  // iterator stepped over "skipped" entries without returning them, and
+  // schedule a compaction if the files that overlap the key have been
+  // merged through often enough (see Version::RecordReadSample).
+  void RecordReadSample(const Slice& key, uint64_t skipped);
+
  private:
   friend class DB;
   struct CompactionState;
   struct Writer;
 
+  // If "range_dels" is non-NULL, *range_dels is set to the range
+  // tombstones that apply to the returned iterator, or NULL if there are
+  // none.  The iterator owns them.  If "seed" is non-NULL, it is set to a
+  // new seed for the iterator's read sampling.
   Iterator* NewInternalIterator(const ReadOptions&,
-                                SequenceNumber* latest_snapshot);
+                                SequenceNumber* latest_snapshot,
+                                const RangeDelMap** range_dels,
+                                uint32_t* seed = NULL);
 
   Status NewDB();
 
+  // Look up "key" as of "snapshot" in the memtables and then the files of
+  // "current", all of which the caller has referenced.  Called without
+  // the mutex held.  Sets *have_stat_update if *stats should be passed to
+  // current->UpdateStats().
+  Status GetFromVersion(const ReadOptions& options, const Slice& key,
+                        SequenceNumber snapshot, MemTable* mem,
+                        MemTable* imm, Version* current, std::string* value,
+                        bool* have_stat_update, Version::GetStats* stats);
+
   // Recover the descriptor from persistent storage.  May do a significant
   // amount of work to recover recently logged updates.  Any changes to
   // be made to the descriptor are added to *edit.
@@ -76,35 +117,92 @@ class DBImpl : public DB {
 
   void MaybeIgnoreError(Status* s) const;
 
+  // Return a new memtable whose arena follows options_.
+  MemTable* NewMemTable() const;
+
   // Delete any unneeded files and stale in-memory entries.
   void DeleteObsoleteFiles();
 
   // Compact the in-memory write buffer to disk.  Switches to a new
   // log-file/memtable and writes a new descriptor iff successful.
-  Status CompactMemTable()
+  // "inside_compaction" is true when called from the middle of a
+  // table compaction run by the calling thread.
+  Status CompactMemTable(bool inside_compaction)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Apply *edit to the current version.  Waits for any edit being
+  // applied by another background thread to finish first.
+  Status LogAndApply(VersionEdit* edit) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   Status RecoverLogFile(uint64_t log_number,
                         VersionEdit* edit,
                         SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
+  Options OptionsForLevel(int level) const;
+
+  // If "pending" is non-NULL the new table and blob file stay in
+  // pending_outputs_ and their numbers are added to *pending; the caller
+  // must erase them once the edit has been applied.
+  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base,
+                          std::vector<uint64_t>* pending)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   WriteBatch* BuildBatchGroup(Writer** last_writer);
+  Status ApplyPipelined(Writer* leader, Writer* last_writer,
+                        WriteBatch* updates, Status status)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status InsertGroupConcurrently(Writer* leader, Writer* last_writer)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  bool HasPendingCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void MarkCompactingLevels(const Compaction* c, bool busy)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   static void BGWork(void* db);
   void BackgroundCall();
+  static void BGFlushWork(void* db);
+  void BackgroundFlushCall();
   Status BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void CleanupCompaction(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Remove the range tombstones that no longer delete anything from the
+  // current version.
+  Status DropObsoleteRangeDeletions() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Subcompactions split one compaction's key range across threads.
+  struct Subcompaction;
+  void SplitCompaction(CompactionState* compact,
+                       std::vector<Subcompaction*>* subs)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGSubcompaction(void* arg);
+  Status ProcessCompactionRange(CompactionState* compact, bool flush_imm);
+  // Fold the merge operand at "*input" that every snapshot sees with the
+  // entries of its key under it into one entry in *key and *value,
+  // leaving "*input" past the operands.
+  Status MergeCompactionEntries(CompactionState* compact, Iterator* input,
+                                std::string* key, std::string* value);
+  // Write the value of the entry in *key and *value to a blob file if it
+  // is large enough, or copy it out of a blob file with too much garbage,
+  // and point *key and *value at the entry to output, whose storage may be
+  // in the "*_buf" strings.  Stores the number of the blob file that the
+  // output entry points into in *blob_number, if any.
+  Status SeparateCompactionValue(CompactionState* compact,
+                                 Slice* key, Slice* value,
+                                 std::string* key_buf,
+                                 std::string* value_buf,
+                                 std::string* index_buf,
+                                 uint64_t* blob_number);
+  // Count the record that the blob index "index" points to as garbage.
+  void AddBlobGarbage(CompactionState* compact, const Slice& index);
+  Status OpenCompactionBlobFile(CompactionState* compact);
+  Status FinishCompactionBlobFile(CompactionState* compact);
+
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
   Status InstallCompactionResults(CompactionState* compact)
@@ -114,13 +212,15 @@ class DBImpl : public DB {
   Env* const env_;
   const InternalKeyComparator internal_comparator_;
   const InternalFilterPolicy internal_filter_policy_;
+  const InternalSliceTransform internal_prefix_extractor_;
   const Options options_;  // options_.comparator == &internal_comparator_
   bool owns_info_log_;
   bool owns_cache_;
   const std::string dbname_;
 
-  // table_cache_ provides its own synchronization
+  // table_cache_ and blob_cache_ provide their own synchronization
   TableCache* table_cache_;
+  BlobCache* blob_cache_;
 
   // Lock over the persistent DB state.  Non-NULL iff successfully acquired.
   FileLock* db_lock_;
@@ -131,28 +231,50 @@ class DBImpl : public DB {
   port::CondVar bg_cv_;          // Signalled when background work finishes
   MemTable* mem_;
   MemTable* imm_;                // Memtable being compacted
-  port::AtomicPointer has_imm_;  // So bg thread can detect non-NULL imm_
+  port::AtomicPointer has_imm_;  // So bg thread can detect imm_ to flush
   WritableFile* logfile_;
   uint64_t logfile_number_;
   log::Writer* log_;
+  uint64_t last_log_sync_micros_;  // When the log was last synced
 
   // Queue of writers.
   std::deque<Writer*> writers_;
+  std::deque<Writer*> memtable_writers_;  // Logged groups, by leader
   WriteBatch* tmp_batch_;
 
   SnapshotList snapshots_;
 
-  // Set of table files to protect from deletion because they are
-  // part of ongoing compactions.
+  // Set of table and blob files to protect from deletion because they
+  // are part of ongoing compactions.
   std::set<uint64_t> pending_outputs_;
 
-  // Has a background compaction been scheduled or is running?
-  bool bg_compaction_scheduled_;
+  // Number of background compactions that are scheduled or running.
+  // Bounded by options_.max_background_compactions.
+  int bg_compactions_scheduled_;
+
+  // Levels that are the input or output of a running compaction.  Other
+  // background threads only pick compactions on levels that are free.
+  bool compacting_levels_[config::kNumLevels];
+  int running_compactions_;
+
+  // Is a background thread currently writing imm_ to a table?
+  bool flushing_imm_;
+
+  // Is a flush of imm_ scheduled on the Env's flush threads or running?
+  // Flushes are not counted in bg_compactions_scheduled_ so that they
+  // never wait for a compaction slot.
+  bool bg_flush_scheduled_;
+
+  // VersionSet::LogAndApply() releases mutex_ while writing the MANIFEST
+  // and must not be entered by two threads at once.
+  bool applying_edit_;
+  port::CondVar apply_cv_;       // Signalled when applying_edit_ is cleared
 
   // Information for a manual compaction
   struct ManualCompaction {
     int level;
     bool done;
+    bool in_progress;           // Being run by a background thread
     const InternalKey* begin;   // NULL means beginning of key range
     const InternalKey* end;     // NULL means end of key range
     InternalKey tmp_storage;    // Used to keep track of compaction progress
@@ -181,6 +303,59 @@ class DBImpl : public DB {
   };
   CompactionStats stats_[config::kNumLevels];
 
+  // Write path stats, reported by the "leveldb.write-stats" property.
+  enum StallCause {
+    kStallL0Slowdown,   // Delayed 1ms for too many level-0 files
+    kStallMemtable,     // Waited for the immutable memtable to be flushed
+    kStallL0Stop,       // Waited for level-0 files to be compacted
+    kNumStallCauses
+  };
+  struct WriteStats {
+    int64_t stall_micros[kNumStallCauses];
+    int64_t stall_count[kNumStallCauses];
+    size_t max_queued_writers;
+    uint64_t bytes_written;     // Bytes of write batches added to the log
+    Histogram group_size;       // Writers committed per batch group
+    Histogram latency;          // Micros spent in Write()
+
+    WriteStats() : max_queued_writers(0), bytes_written(0) {
+      for (int i = 0; i < kNumStallCauses; i++) {
+        stall_micros[i] = 0;
+        stall_count[i] = 0;
+      }
+      group_size.Clear();
+      latency.Clear();
+    }
+
+    void AddStall(StallCause cause, int64_t micros) {
+      stall_micros[cause] += micros;
+      stall_count[cause]++;
+    }
+  };
+  WriteStats write_stats_;
+
+  // Latencies in micros of Get() calls and of memtable flushes and
+  // compactions, reported with Write() latencies by the "leveldb.latency"
+  // property.  Recorded with mutex_ held.
+  Histogram get_latency_;
+  Histogram compaction_latency_;
+
+  // Samples of the keys that iterators read, reported by the
+  // "leveldb.read-samples" property.
+  struct ReadSampleStats {
+    int64_t samples;
+    int64_t merged_samples;     // Samples of keys in more than one file
+    int64_t files;              // Files that the sampled keys were in
+    int64_t skipped;            // Entries stepped over before the samples
+    int64_t compactions;        // Seek compactions the samples triggered
+
+    ReadSampleStats()
+        : samples(0), merged_samples(0), files(0), skipped(0),
+          compactions(0) { }
+  };
+  ReadSampleStats read_samples_;
+  uint32_t seed_;               // For iterator read sampling
+
   // No copying allowed
   DBImpl(const DBImpl&);
   void operator=(const DBImpl&);
@@ -195,6 +370,7 @@ class DBImpl : public DB {
 extern Options SanitizeOptions(const std::string& db,
                                const InternalKeyComparator* icmp,
                                const InternalFilterPolicy* ipolicy,
+                               const InternalSliceTransform* iprefix,
                                const Options& src);
 
 }  // namespace leveldb
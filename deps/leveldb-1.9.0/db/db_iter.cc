@@ -4,13 +4,21 @@
 
 #include "db/db_iter.h"
 
+#include <list>
+#include "db/blob_file.h"
+#include "db/db_impl.h"
 #include "db/filename.h"
 #include "db/dbformat.h"
+#include "db/merge_helper.h"
+#include "db/range_del.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
+#include "leveldb/merge_operator.h"
+#include "leveldb/slice_transform.h"
 #include "port/port.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
+#include "util/random.h"
 
 namespace leveldb {
 
@@ -38,7 +46,9 @@ class DBIter: public Iterator {
  public:
   // Which direction is the iterator currently moving?
   // (1) When moving forward, the internal iterator is positioned at
-  //     the exact entry that yields this->key(), this->value()
+  //     the exact entry that yields this->key(), this->value(), or
+  //     just past the merge operands that yield them if merged_, or at
+  //     the blob index whose value was read if merged_
   // (2) When moving backwards, the internal iterator is positioned
   //     just before all entries whose user key == this->key().
   enum Direction {
@@ -47,14 +57,43 @@ class DBIter: public Iterator {
   };
 
   DBIter(const std::string* dbname, Env* env,
-         const Comparator* cmp, Iterator* iter, SequenceNumber s)
+         const Comparator* cmp, Iterator* iter, SequenceNumber s,
+         const SliceTransform* prefix_extractor,
+         const RangeDelMap* range_dels,
+         const Slice* upper_bound,
+         const MergeOperator* merge_operator,
+         bool pin_data,
+         BlobCache* blob_cache,
+         bool verify_blobs,
+         ReadStats* stats,
+         DBImpl* db,
+         uint32_t seed)
       : dbname_(dbname),
         env_(env),
         user_comparator_(cmp),
         iter_(iter),
         sequence_(s),
+        prefix_extractor_(prefix_extractor),
+        range_dels_(range_dels),
+        has_upper_bound_(upper_bound != NULL),
+        merge_operator_(merge_operator),
+        pin_data_(pin_data),
+        blob_cache_(blob_cache),
+        verify_blobs_(verify_blobs),
+        stats_(stats),
+        db_(db),
+        rnd_(seed),
+        bytes_until_sample_(RandomPeriod()),
+        skipped_since_sample_(0),
         direction_(kForward),
-        valid_(false) {
+        valid_(false),
+        merged_(false),
+        saved_is_blob_(false),
+        at_blob_(false),
+        prefix_mode_(false) {
+    if (has_upper_bound_) {
+      upper_bound_.assign(upper_bound->data(), upper_bound->size());
+    }
   }
   virtual ~DBIter() {
     delete iter_;
@@ -62,11 +101,25 @@ class DBIter: public Iterator {
   virtual bool Valid() const { return valid_; }
   virtual Slice key() const {
     assert(valid_);
-    return (direction_ == kForward) ? ExtractUserKey(iter_->key()) : saved_key_;
+    if (direction_ == kReverse || merged_) {
+      return saved_key_;
+    }
+    return ExtractUserKey(iter_->key());
   }
   virtual Slice value() const {
     assert(valid_);
-    return (direction_ == kForward) ? iter_->value() : saved_value_;
+    if (direction_ == kReverse) {
+      return saved_value_;
+    }
+    return merged_ ? merged_values_.back() : iter_->value();
+  }
+  virtual void ReleasePinnedData() {
+    iter_->ReleasePinnedData();
+    if (merged_) {
+      merged_values_.erase(merged_values_.begin(), --merged_values_.end());
+    } else {
+      merged_values_.clear();
+    }
   }
   virtual Status status() const {
     if (status_.ok()) {
@@ -85,7 +138,39 @@ class DBIter: public Iterator {
  private:
   void FindNextUserEntry(bool skipping, std::string* skip);
   void FindPrevUserEntry();
+  bool MergeForward(const ParsedInternalKey& ikey);
+  bool ReadBlobForward(const ParsedInternalKey& ikey);
+  bool ReadBlob(const Slice& index, std::string* value);
   bool ParseKey(ParsedInternalKey* key);
+  void SampleRead(const Slice& key);
+
+  // Pick a gap in bytes until the next sample, averaging
+  // config::kReadBytesPeriod.
+  inline ssize_t RandomPeriod() {
+    return rnd_.Uniform(2*config::kReadBytesPeriod);
+  }
+
+  // Return the type of "ikey", treating values and merge operands hidden
+  // by a range tombstone as deletions.
+  inline ValueType EffectiveType(const ParsedInternalKey& ikey) const {
+    if (ikey.type != kTypeDeletion && range_dels_ != NULL &&
+        range_dels_->ShouldDelete(ikey.user_key, ikey.sequence, sequence_)) {
+      return kTypeDeletion;
+    }
+    return ikey.type;
+  }
+
+  // Does "user_key" have the prefix of the last Seek() target?
+  inline bool HasSeekPrefix(const Slice& user_key) const {
+    return prefix_extractor_->InDomain(user_key) &&
+           prefix_extractor_->Transform(user_key) == Slice(prefix_);
+  }
+
+  // Is "user_key" at or after the iterate_upper_bound?
+  inline bool PastUpperBound(const Slice& user_key) const {
+    return has_upper_bound_ &&
+           user_comparator_->Compare(user_key, upper_bound_) >= 0;
+  }
 
   inline void SaveKey(const Slice& k, std::string* dst) {
     dst->assign(k.data(), k.size());
@@ -105,12 +190,34 @@ class DBIter: public Iterator {
   const Comparator* const user_comparator_;
   Iterator* const iter_;
   SequenceNumber const sequence_;
+  const SliceTransform* const prefix_extractor_;  // prefix_same_as_start
+  const RangeDelMap* const range_dels_;           // NULL if none
+  const bool has_upper_bound_;
+  std::string upper_bound_;   // iterate_upper_bound if has_upper_bound_
+  const MergeOperator* const merge_operator_;     // NULL if none
+  const bool pin_data_;
+  BlobCache* const blob_cache_;
+  const bool verify_blobs_;
+  ReadStats* const stats_;                        // NULL if none
+  DBImpl* const db_;                              // NULL if not sampling
+  Random rnd_;
+  ssize_t bytes_until_sample_;
+  uint64_t skipped_since_sample_;  // Entries stepped over since the sample
 
   Status status_;
   std::string saved_key_;     // == current key when direction_==kReverse
+                              //    or merged_
   std::string saved_value_;   // == current raw value when direction_==kReverse
+  // Values merged while moving forward.  The current one is last; the
+  // ones before it are kept for pin_data until ReleasePinnedData().
+  std::list<std::string> merged_values_;
   Direction direction_;
   bool valid_;
+  bool merged_;               // Current forward entry was merged
+  bool saved_is_blob_;        // saved_value_ holds a blob index
+  bool at_blob_;              // merged_ entry was read from a blob index
+  bool prefix_mode_;          // Stop at the first key without prefix_
+  std::string prefix_;        // Prefix of the last Seek() target
 
   // No copying allowed
   DBIter(const DBIter&);
@@ -118,7 +225,14 @@ class DBIter: public Iterator {
 };
 
 inline bool DBIter::ParseKey(ParsedInternalKey* ikey) {
-  if (!ParseInternalKey(iter_->key(), ikey)) {
+  Slice k = iter_->key();
+  if (db_ != NULL) {
+    bytes_until_sample_ -= k.size() + iter_->value().size();
+    if (bytes_until_sample_ < 0) {
+      SampleRead(k);
+    }
+  }
+  if (!ParseInternalKey(k, ikey)) {
     status_ = Status::Corruption("corrupted internal key in DBIter");
     return false;
   } else {
@@ -126,6 +240,16 @@ inline bool DBIter::ParseKey(ParsedInternalKey* ikey) {
   }
 }
 
+// Report the key at the end of a period to the DB, once however many
+// periods the entry spans.
+void DBIter::SampleRead(const Slice& key) {
+  while (bytes_until_sample_ < 0) {
+    bytes_until_sample_ += RandomPeriod();
+  }
+  db_->RecordReadSample(key, skipped_since_sample_);
+  skipped_since_sample_ = 0;
+}
+
 void DBIter::Next() {
   assert(valid_);
 
@@ -146,9 +270,33 @@ void DBIter::Next() {
     }
   }
 
-  // Temporarily use saved_key_ as storage for key to skip.
+  if (merged_) {
+    // iter_ is already past the operands, or at the blob index, and
+    // saved_key_ holds their key.
+    if (at_blob_) {
+      iter_->Next();
+    }
+    if (!iter_->Valid()) {
+      valid_ = false;
+      merged_ = false;
+      saved_key_.clear();
+      return;
+    }
+    FindNextUserEntry(true, &saved_key_);
+    return;
+  }
+
+  // Temporarily use saved_key_ as storage for key to skip.  The current
+  // entry is stepped past first so that only the entries skipped after it
+  // are counted.
   std::string* skip = &saved_key_;
   SaveKey(ExtractUserKey(iter_->key()), skip);
+  iter_->Next();
+  if (!iter_->Valid()) {
+    valid_ = false;
+    skip->clear();
+    return;
+  }
   FindNextUserEntry(true, skip);
 }
 
@@ -156,10 +304,20 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   // Loop until we hit an acceptable entry to yield
   assert(iter_->Valid());
   assert(direction_ == kForward);
+  merged_ = false;
   do {
     ParsedInternalKey ikey;
-    if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
-      switch (ikey.type) {
+    const bool parsed = ParseKey(&ikey);
+    if (parsed && prefix_mode_ && !HasSeekPrefix(ikey.user_key)) {
+      // The sstables may have skipped the keys past the prefix.
+      break;
+    }
+    if (parsed && PastUpperBound(ikey.user_key)) {
+      // Likewise for the keys past the upper bound.
+      break;
+    }
+    if (parsed && ikey.sequence <= sequence_) {
+      switch (EffectiveType(ikey)) {
         case kTypeDeletion:
           // Arrange to skip all upcoming entries for this key since
           // they are hidden by this deletion.
@@ -167,27 +325,146 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
           skipping = true;
           break;
         case kTypeValue:
+        case kTypeBlobIndex:
           if (skipping &&
               user_comparator_->Compare(ikey.user_key, *skip) <= 0) {
             // Entry hidden
+          } else if (ikey.type == kTypeBlobIndex) {
+            valid_ = ReadBlobForward(ikey);
+            return;
           } else {
             valid_ = true;
             saved_key_.clear();
             return;
           }
           break;
+        case kTypeMerge:
+          if (skipping &&
+              user_comparator_->Compare(ikey.user_key, *skip) <= 0) {
+            // Entry hidden
+          } else {
+            valid_ = MergeForward(ikey);
+            return;
+          }
+          break;
       }
     }
+    if (stats_ != NULL) {
+      stats_->internal_keys_skipped++;
+    }
+    skipped_since_sample_++;
     iter_->Next();
   } while (iter_->Valid());
   saved_key_.clear();
   valid_ = false;
 }
 
+// Apply the merge operand at iter_ and the operands under it to the value
+// of their key, leaving iter_ past the operands.  Returns false if the
+// merge failed.
+bool DBIter::MergeForward(const ParsedInternalKey& ikey) {
+  SaveKey(ikey.user_key, &saved_key_);
+  std::vector<std::string> operands;
+  operands.push_back(iter_->value().ToString());
+  if (!pin_data_) {
+    merged_values_.clear();
+  }
+  merged_values_.push_back(std::string());
+  std::string* value = &merged_values_.back();
+
+  bool found = false;
+  for (iter_->Next(); iter_->Valid(); iter_->Next()) {
+    ParsedInternalKey next;
+    if (!ParseKey(&next)) {
+      break;
+    }
+    if (user_comparator_->Compare(next.user_key, saved_key_) != 0) {
+      break;
+    }
+    ValueType type = EffectiveType(next);
+    if (type == kTypeMerge) {
+      operands.push_back(iter_->value().ToString());
+    } else {
+      if (type == kTypeValue) {
+        Slice v = iter_->value();
+        value->assign(v.data(), v.size());
+        found = true;
+      } else if (type == kTypeBlobIndex) {
+        found = ReadBlob(iter_->value(), value);
+      }
+      break;
+    }
+  }
+
+  Status s;
+  if (status_.ok()) {
+    s = ApplyMergeOperands(merge_operator_, saved_key_, operands, found,
+                           value);
+  }
+  if (!status_.ok() || !s.ok()) {
+    if (status_.ok()) {
+      status_ = s;
+    }
+    merged_values_.pop_back();
+    saved_key_.clear();
+    return false;
+  }
+  merged_ = true;
+  at_blob_ = false;
+  return true;
+}
+
+// Read the value that the blob index at iter_ points to, leaving iter_ at
+// the index.  Returns false if the read failed.
+bool DBIter::ReadBlobForward(const ParsedInternalKey& ikey) {
+  SaveKey(ikey.user_key, &saved_key_);
+  if (!pin_data_) {
+    merged_values_.clear();
+  }
+  merged_values_.push_back(std::string());
+  if (!ReadBlob(iter_->value(), &merged_values_.back())) {
+    merged_values_.pop_back();
+    saved_key_.clear();
+    return false;
+  }
+  merged_ = true;
+  at_blob_ = true;
+  return true;
+}
+
+// Store the value that the blob index "index" points to in *value.  Sets
+// status_ and returns false if it cannot be read.
+bool DBIter::ReadBlob(const Slice& index, std::string* value) {
+  Status s;
+  if (blob_cache_ == NULL) {
+    s = Status::NotSupported("blob index without blob files");
+  } else {
+    s = blob_cache_->Get(verify_blobs_, index, value);
+  }
+  if (!s.ok()) {
+    if (status_.ok()) {
+      status_ = s;
+    }
+    return false;
+  }
+  return true;
+}
+
 void DBIter::Prev() {
   assert(valid_);
 
-  if (direction_ == kForward) {  // Switch directions?
+  if (direction_ == kForward && merged_) {
+    // iter_ is past the operands of saved_key_.  Scan back before them.
+    if (!iter_->Valid()) {
+      iter_->SeekToLast();
+    }
+    while (iter_->Valid() &&
+           user_comparator_->Compare(ExtractUserKey(iter_->key()),
+                                     saved_key_) >= 0) {
+      iter_->Prev();
+    }
+    direction_ = kReverse;
+  } else if (direction_ == kForward) {  // Switch directions?
     // iter_ is pointing at the current entry.  Scan backwards until
     // the key changes so we can use the normal reverse scanning code.
     assert(iter_->Valid());  // Otherwise valid_ would have been false
@@ -214,6 +491,7 @@ void DBIter::Prev() {
 void DBIter::FindPrevUserEntry() {
   assert(direction_ == kReverse);
 
+  merged_ = false;
   ValueType value_type = kTypeDeletion;
   if (iter_->Valid()) {
     do {
@@ -224,10 +502,39 @@ void DBIter::FindPrevUserEntry() {
           // We encountered a non-deleted value in entries for previous keys,
           break;
         }
-        value_type = ikey.type;
+        // Entries of a key are visited oldest first, so a merge operand
+        // applies to the value saved from the entries before it.
+        const bool have_value = (value_type != kTypeDeletion);
+        value_type = EffectiveType(ikey);
         if (value_type == kTypeDeletion) {
           saved_key_.clear();
           ClearSavedValue();
+          saved_is_blob_ = false;
+        } else if (value_type == kTypeMerge) {
+          if (have_value && saved_is_blob_) {
+            const std::string index = saved_value_;
+            if (!ReadBlob(index, &saved_value_)) {
+              value_type = kTypeDeletion;
+              break;
+            }
+            saved_is_blob_ = false;
+          }
+          Slice existing(saved_value_);
+          std::string merged;
+          if (merge_operator_ == NULL) {
+            status_ = Status::NotSupported(
+                "merge operand without a merge operator");
+          } else if (!merge_operator_->Merge(ikey.user_key,
+                                             have_value ? &existing : NULL,
+                                             iter_->value(), &merged)) {
+            status_ = Status::Corruption("merge failed for ", ikey.user_key);
+          }
+          if (!status_.ok()) {
+            value_type = kTypeDeletion;
+            break;
+          }
+          SaveKey(ikey.user_key, &saved_key_);
+          saved_value_.swap(merged);
         } else {
           Slice raw_value = iter_->value();
           if (saved_value_.capacity() > raw_value.size() + 1048576) {
@@ -236,17 +543,27 @@ void DBIter::FindPrevUserEntry() {
           }
           SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
           saved_value_.assign(raw_value.data(), raw_value.size());
+          saved_is_blob_ = (value_type == kTypeBlobIndex);
         }
       }
       iter_->Prev();
     } while (iter_->Valid());
   }
 
-  if (value_type == kTypeDeletion) {
+  if (value_type != kTypeDeletion && status_.ok() && saved_is_blob_) {
+    const std::string index = saved_value_;
+    if (!ReadBlob(index, &saved_value_)) {
+      value_type = kTypeDeletion;
+    }
+    saved_is_blob_ = false;
+  }
+
+  if (value_type == kTypeDeletion || !status_.ok()) {
     // End
     valid_ = false;
     saved_key_.clear();
     ClearSavedValue();
+    saved_is_blob_ = false;
     direction_ = kForward;
   } else {
     valid_ = true;
@@ -255,7 +572,14 @@ void DBIter::FindPrevUserEntry() {
 
 void DBIter::Seek(const Slice& target) {
   direction_ = kForward;
+  merged_ = false;
   ClearSavedValue();
+  prefix_mode_ = (prefix_extractor_ != NULL &&
+                  prefix_extractor_->InDomain(target));
+  if (prefix_mode_) {
+    Slice prefix = prefix_extractor_->Transform(target);
+    prefix_.assign(prefix.data(), prefix.size());
+  }
   saved_key_.clear();
   AppendInternalKey(
       &saved_key_, ParsedInternalKey(target, sequence_, kValueTypeForSeek));
@@ -269,6 +593,8 @@ void DBIter::Seek(const Slice& target) {
 
 void DBIter::SeekToFirst() {
   direction_ = kForward;
+  merged_ = false;
+  prefix_mode_ = false;
   ClearSavedValue();
   iter_->SeekToFirst();
   if (iter_->Valid()) {
@@ -280,8 +606,23 @@ void DBIter::SeekToFirst() {
 
 void DBIter::SeekToLast() {
   direction_ = kReverse;
+  prefix_mode_ = false;
   ClearSavedValue();
-  iter_->SeekToLast();
+  if (has_upper_bound_) {
+    // Start from the last entry before the bound.
+    saved_key_.clear();
+    AppendInternalKey(&saved_key_, ParsedInternalKey(
+        upper_bound_, kMaxSequenceNumber, kValueTypeForSeek));
+    iter_->Seek(saved_key_);
+    saved_key_.clear();
+    if (iter_->Valid()) {
+      iter_->Prev();
+    } else {
+      iter_->SeekToLast();
+    }
+  } else {
+    iter_->SeekToLast();
+  }
   FindPrevUserEntry();
 }
 
@@ -292,8 +633,21 @@ Iterator* NewDBIterator(
     Env* env,
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
-    const SequenceNumber& sequence) {
-  return new DBIter(dbname, env, user_key_comparator, internal_iter, sequence);
+    const SequenceNumber& sequence,
+    const SliceTransform* prefix_extractor,
+    const RangeDelMap* range_dels,
+    const Slice* upper_bound,
+    const MergeOperator* merge_operator,
+    bool pin_data,
+    BlobCache* blob_cache,
+    bool verify_blobs,
+    ReadStats* stats,
+    DBImpl* db,
+    uint32_t seed) {
+  return new DBIter(dbname, env, user_key_comparator, internal_iter, sequence,
+                    prefix_extractor, range_dels, upper_bound,
+                    merge_operator, pin_data, blob_cache, verify_blobs,
+                    stats, db, seed);
 }
 
 }  // namespace leveldb
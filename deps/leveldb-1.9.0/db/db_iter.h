@@ -11,15 +11,43 @@
 
 namespace leveldb {
 
+class MergeOperator;
+class BlobCache;
+class DBImpl;
+class RangeDelMap;
+
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number
-// into appropriate user keys.
+// into appropriate user keys.  If "prefix_extractor" is non-NULL, after
+// a Seek() the iterator stops at the first key without the prefix of the
+// target (see ReadOptions::prefix_same_as_start).  If "range_dels" is
+// non-NULL, entries deleted by its tombstones are skipped; it must outlive
+// the iterator.  If "upper_bound" is non-NULL, the iterator only yields
+// user keys before it; the bound is copied.  Merge operands are applied
+// with "merge_operator"; values merged while "pin_data" is set stay valid
+// until ReleasePinnedData() like the ones pinned by "*internal_iter".
+// Values kept in blob files are read through "blob_cache", verifying
+// their checksums if "verify_blobs" is set.  If "stats" is non-NULL, the
+// entries stepped over are counted in it.  If "db" is non-NULL, the keys
+// read are sampled about once every config::kReadBytesPeriod bytes and
+// reported to it along with the entries stepped over since the last
+// sample (see DBImpl::RecordReadSample).
 extern Iterator* NewDBIterator(
     const std::string* dbname,
     Env* env,
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
-    const SequenceNumber& sequence);
+    const SequenceNumber& sequence,
+    const SliceTransform* prefix_extractor = NULL,
+    const RangeDelMap* range_dels = NULL,
+    const Slice* upper_bound = NULL,
+    const MergeOperator* merge_operator = NULL,
+    bool pin_data = false,
+    BlobCache* blob_cache = NULL,
+    bool verify_blobs = false,
+    ReadStats* stats = NULL,
+    DBImpl* db = NULL,
+    uint32_t seed = 0);
 
 }  // namespace leveldb
 
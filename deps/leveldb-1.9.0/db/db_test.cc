@@ -3,7 +3,10 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "leveldb/db.h"
+#include "leveldb/compaction_filter.h"
 #include "leveldb/filter_policy.h"
+#include "leveldb/merge_operator.h"
+#include "leveldb/slice_transform.h"
 #include "db/db_impl.h"
 #include "db/filename.h"
 #include "db/version_set.h"
@@ -68,6 +71,10 @@ class SpecialEnv : public EnvWrapper {
   bool count_random_reads_;
   AtomicCounter random_read_counter_;
 
+  // Copy random reads into the caller's buffer like files that aren't
+  // mmapped so that uncompressed blocks are cached
+  bool copy_random_reads_;
+
   AtomicCounter sleep_counter_;
 
   explicit SpecialEnv(Env* base) : EnvWrapper(base) {
@@ -75,6 +82,7 @@ class SpecialEnv : public EnvWrapper {
     no_space_.Release_Store(NULL);
     non_writable_.Release_Store(NULL);
     count_random_reads_ = false;
+    copy_random_reads_ = false;
     manifest_sync_error_.Release_Store(NULL);
     manifest_write_error_.Release_Store(NULL);
   }
@@ -153,21 +161,31 @@ class SpecialEnv : public EnvWrapper {
      private:
       RandomAccessFile* target_;
       AtomicCounter* counter_;
+      bool copy_;
      public:
-      CountingFile(RandomAccessFile* target, AtomicCounter* counter)
-          : target_(target), counter_(counter) {
+      CountingFile(RandomAccessFile* target, AtomicCounter* counter, bool copy)
+          : target_(target), counter_(counter), copy_(copy) {
       }
       virtual ~CountingFile() { delete target_; }
       virtual Status Read(uint64_t offset, size_t n, Slice* result,
                           char* scratch) const {
-        counter_->Increment();
-        return target_->Read(offset, n, result, scratch);
+        if (counter_ != NULL) {
+          counter_->Increment();
+        }
+        Status s = target_->Read(offset, n, result, scratch);
+        if (s.ok() && copy_ && result->data() != scratch) {
+          memcpy(scratch, result->data(), result->size());
+          *result = Slice(scratch, result->size());
+        }
+        return s;
       }
     };
 
     Status s = target()->NewRandomAccessFile(f, r);
-    if (s.ok() && count_random_reads_) {
-      *r = new CountingFile(*r, &random_read_counter_);
+    if (s.ok() && (count_random_reads_ || copy_random_reads_)) {
+      *r = new CountingFile(*r,
+                            count_random_reads_ ? &random_read_counter_ : NULL,
+                            copy_random_reads_);
     }
     return s;
   }
@@ -181,12 +199,25 @@ class SpecialEnv : public EnvWrapper {
 class DBTest {
  private:
   const FilterPolicy* filter_policy_;
+  const FilterPolicy* blocked_filter_policy_;
+  const MergeOperator* merge_operator_;
+  const SliceTransform* memtable_prefix_;
 
   // Sequence of option configurations to try
   enum OptionConfig {
     kDefault,
     kFilter,
+    kBlockedFilter,
     kUncompressed,
+    kConcurrentCompactions,
+    kConcurrentMemtable,
+    kPipelinedWrite,
+    kBlockHashIndex,
+    kHugePages,
+    kVectorMemTable,
+    kHashMemTable,
+    kCompressionThreads,
+    kDynamicLevels,
     kEnd
   };
   int option_config_;
@@ -201,6 +232,9 @@ class DBTest {
   DBTest() : option_config_(kDefault),
              env_(new SpecialEnv(Env::Default())) {
     filter_policy_ = NewBloomFilterPolicy(10);
+    blocked_filter_policy_ = NewBlockedBloomFilterPolicy(10);
+    merge_operator_ = NewAppendOperator();
+    memtable_prefix_ = NewFixedPrefixTransform(2);
     dbname_ = test::TmpDir() + "/db_test";
     DestroyDB(dbname_, Options());
     db_ = NULL;
@@ -212,6 +246,9 @@ class DBTest {
     DestroyDB(dbname_, Options());
     delete env_;
     delete filter_policy_;
+    delete blocked_filter_policy_;
+    delete merge_operator_;
+    delete memtable_prefix_;
   }
 
   // Switch to a fresh database with the next option configuration to
@@ -233,9 +270,47 @@ class DBTest {
       case kFilter:
         options.filter_policy = filter_policy_;
         break;
+      case kBlockedFilter:
+        options.filter_policy = blocked_filter_policy_;
+        break;
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kConcurrentCompactions:
+        options.max_background_compactions = 3;
+        break;
+      case kConcurrentMemtable:
+        options.allow_concurrent_memtable_write = true;
+        break;
+      case kPipelinedWrite:
+        options.enable_pipelined_write = true;
+        break;
+      case kBlockHashIndex:
+        options.data_block_hash_index = true;
+        break;
+      case kHugePages:
+        options.huge_pages = kTransparentHugePages;
+        break;
+      case kVectorMemTable:
+        options.memtable_rep = kVectorRep;
+        break;
+      case kHashMemTable:
+        options.memtable_rep = kHashLinkListRep;
+        options.memtable_prefix_extractor = memtable_prefix_;
+        options.allow_concurrent_memtable_write = true;
+        break;
+      case kCompressionThreads:
+        options.compression_threads = 4;
+        options.filter_policy = filter_policy_;
+        options.index_partition_size = 256;
+        break;
+      case kDynamicLevels:
+        options.level_compaction_dynamic_level_bytes = true;
+        options.max_bytes_for_level_base = 1<<20;
+        options.max_bytes_for_level_multiplier = 4;
+        options.target_file_size_base = 256<<10;
+        options.target_file_size_multiplier = 2;
+        break;
       default:
         break;
     }
@@ -285,6 +360,23 @@ class DBTest {
     return db_->Delete(WriteOptions(), k);
   }
 
+  Status Merge(const std::string& k, const std::string& v) {
+    return db_->Merge(WriteOptions(), k, v);
+  }
+
+  // Return the current options with the append operator.
+  Options MergeOptions() {
+    Options options = CurrentOptions();
+    options.create_if_missing = true;
+    options.merge_operator = merge_operator_;
+    return options;
+  }
+
+  void DestroyAndReopenWithMerge() {
+    Options options = MergeOptions();
+    DestroyAndReopen(&options);
+  }
+
   std::string Get(const std::string& k, const Snapshot* snapshot = NULL) {
     ReadOptions options;
     options.snapshot = snapshot;
@@ -354,6 +446,12 @@ class DBTest {
             case kTypeDeletion:
               result += "DEL";
               break;
+            case kTypeMerge:
+              result += "MERGE(" + iter->value().ToString() + ")";
+              break;
+            case kTypeBlobIndex:
+              result += "BLOB";
+              break;
           }
         }
         iter->Next();
@@ -578,6 +676,56 @@ TEST(DBTest, GetPicksCorrectFile) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, MultiGet) {
+  do {
+    ASSERT_OK(Put("a", "va"));
+    Compact("a", "b");
+    ASSERT_OK(Put("x", "vx"));
+    ASSERT_OK(Put("d", "vd"));
+    Compact("d", "y");
+    ASSERT_OK(Put("f", "vf"));
+    ASSERT_OK(Delete("d"));
+    const Snapshot* snapshot = db_->GetSnapshot();
+    ASSERT_OK(Put("x", "vx2"));
+
+    std::vector<Slice> keys;
+    keys.push_back("x");
+    keys.push_back("missing");
+    keys.push_back("a");
+    keys.push_back("d");
+    keys.push_back("f");
+    keys.push_back("x");
+    std::vector<std::string> values;
+    std::vector<Status> s = db_->MultiGet(ReadOptions(), keys, &values);
+    ASSERT_EQ(6, s.size());
+    ASSERT_EQ(6, values.size());
+    ASSERT_OK(s[0]);
+    ASSERT_EQ("vx2", values[0]);
+    ASSERT_TRUE(s[1].IsNotFound());
+    ASSERT_OK(s[2]);
+    ASSERT_EQ("va", values[2]);
+    ASSERT_TRUE(s[3].IsNotFound());
+    ASSERT_OK(s[4]);
+    ASSERT_EQ("vf", values[4]);
+    ASSERT_OK(s[5]);
+    ASSERT_EQ("vx2", values[5]);
+
+    ReadOptions options;
+    options.snapshot = snapshot;
+    s = db_->MultiGet(options, keys, &values);
+    ASSERT_OK(s[0]);
+    ASSERT_EQ("vx", values[0]);
+    ASSERT_TRUE(s[3].IsNotFound());
+    ASSERT_EQ("vf", values[4]);
+    db_->ReleaseSnapshot(snapshot);
+
+    // An empty request finds nothing.
+    s = db_->MultiGet(ReadOptions(), std::vector<Slice>(), &values);
+    ASSERT_TRUE(s.empty());
+    ASSERT_TRUE(values.empty());
+  } while (ChangeOptions());
+}
+
 TEST(DBTest, GetEncountersEmptyLevel) {
   do {
     // Arrange for the following to happen:
@@ -842,6 +990,34 @@ TEST(DBTest, RecoveryWithEmptyLog) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, FlushMemTableLeavesEmptyLog) {
+  do {
+    ASSERT_OK(Put("foo", "v1"));
+    ASSERT_OK(Put("bar", "v2"));
+    ASSERT_OK(db_->FlushMemTable());
+
+    // Only the new, empty log is left for the next open to replay.
+    std::vector<std::string> filenames;
+    ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+    uint64_t number;
+    FileType type;
+    int logs = 0;
+    for (size_t i = 0; i < filenames.size(); i++) {
+      if (ParseFileName(filenames[i], &number, &type) && type == kLogFile) {
+        uint64_t size;
+        ASSERT_OK(env_->GetFileSize(dbname_ + "/" + filenames[i], &size));
+        ASSERT_EQ(0, size);
+        logs++;
+      }
+    }
+    ASSERT_EQ(1, logs);
+
+    Reopen();
+    ASSERT_EQ("v1", Get("foo"));
+    ASSERT_EQ("v2", Get("bar"));
+  } while (ChangeOptions());
+}
+
 // Check that writes done during a memtable compaction are recovered
 // if the database is shutdown during the memtable compaction.
 TEST(DBTest, RecoverDuringMemtableCompaction) {
@@ -896,6 +1072,38 @@ TEST(DBTest, MinorCompactionsHappen) {
   }
 }
 
+TEST(DBTest, IterSamplingCompactsMergedFiles) {
+  // Place overlapping sstables in levels 1 and 2 so that every key read
+  // by an iterator is merged from both of them.
+  Random rnd(301);
+  const std::string big = RandomString(&rnd, 10000);
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(Put(Key(i), big));
+  }
+  dbfull()->TEST_CompactMemTable();
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(Put(Key(i), big));
+  }
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("0,1,1", FilesPerLevel());
+
+  // Scan until the samples charge level 1 enough seeks to compact it.
+  for (int i = 0; i < 200 && NumTableFilesAtLevel(1) > 0; i++) {
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) { }
+    ASSERT_OK(iter->status());
+    delete iter;
+    env_->SleepForMicroseconds(1000);
+  }
+  env_->SleepForMicroseconds(100000);
+  ASSERT_EQ("0,0,1", FilesPerLevel());
+
+  std::string samples;
+  ASSERT_TRUE(db_->GetProperty("leveldb.read-samples", &samples));
+  ASSERT_TRUE(samples.find("Seek compactions: 1\n") != std::string::npos)
+      << samples;
+}
+
 TEST(DBTest, RecoverWithLargeLog) {
   {
     Options options = CurrentOptions();
@@ -946,6 +1154,208 @@ TEST(DBTest, CompactionsGenerateMultipleFiles) {
   }
 }
 
+TEST(DBTest, DirectIOCompaction) {
+  Options options = CurrentOptions();
+  options.env = Env::Default();  // SpecialEnv has no direct files
+  options.write_buffer_size = 100000000;        // Large write buffer
+  options.use_direct_io_for_compaction = true;
+  options.compaction_readahead_size = 100 << 10;
+  Reopen(&options);
+
+  // Merge a level-0 file into level-1 files written with direct I/O
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 80; i++) {
+    values.push_back(RandomString(&rnd, 100000));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  Reopen(&options);
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  for (int i = 0; i < 80; i += 3) {
+    values[i] = RandomString(&rnd, 1000);
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  Reopen(&options);
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  ASSERT_GT(NumTableFilesAtLevel(1), 1);
+  for (int i = 0; i < 80; i++) {
+    ASSERT_EQ(Get(Key(i)), values[i]);
+  }
+  Reopen(&options);
+  for (int i = 0; i < 80; i++) {
+    ASSERT_EQ(Get(Key(i)), values[i]);
+  }
+}
+
+TEST(DBTest, ConcurrentCompactions) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.max_background_compactions = 3;
+  Reopen(&options);
+
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.running-compactions", &property));
+  ASSERT_EQ("0", property);
+
+  // Write enough data to fill several levels while compactions run.
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 2000; i++) {
+    values.push_back(RandomString(&rnd, 5000));
+    ASSERT_OK(Put(Key(i % 500), values[i]));
+  }
+  for (int i = 0; i < 500; i++) {
+    ASSERT_EQ(Get(Key(i)), values[1500 + i]);
+  }
+
+  db_->CompactRange(NULL, NULL);
+  ASSERT_TRUE(db_->GetProperty("leveldb.compaction-backlog", &property));
+  ASSERT_EQ("0", property);
+  for (int i = 0; i < 500; i++) {
+    ASSERT_EQ(Get(Key(i)), values[1500 + i]);
+  }
+
+  // Survives a reopen with the default single compaction.
+  Reopen();
+  for (int i = 0; i < 500; i++) {
+    ASSERT_EQ(Get(Key(i)), values[1500 + i]);
+  }
+}
+
+TEST(DBTest, Subcompactions) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000000;        // Large write buffer
+  options.max_subcompactions = 4;
+  Reopen(&options);
+
+  // Build level-1 out of several files, then compact an overlapping
+  // level-0 file into it so that the compaction has split points.
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 80; i++) {
+    values.push_back(RandomString(&rnd, 100000));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  Reopen(&options);
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_GT(NumTableFilesAtLevel(1), 1);
+
+  for (int i = 0; i < 80; i += 2) {
+    values[i] = RandomString(&rnd, 100000);
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  ASSERT_OK(Delete(Key(79)));
+  Reopen(&options);
+  ASSERT_EQ(NumTableFilesAtLevel(0), 1);
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  ASSERT_GT(NumTableFilesAtLevel(1), 1);
+  for (int i = 0; i < 79; i++) {
+    ASSERT_EQ(Get(Key(i)), values[i]);
+  }
+  ASSERT_EQ("NOT_FOUND", Get(Key(79)));
+
+  // Output files of different subcompactions must not overlap.
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_EQ(Key(count), iter->key().ToString());
+    count++;
+  }
+  ASSERT_EQ(79, count);
+  delete iter;
+  Reopen(&options);
+  ASSERT_EQ(Get(Key(40)), values[40]);
+}
+
+TEST(DBTest, TieredCompaction) {
+  Options options = CurrentOptions();
+  options.compaction_style = kCompactionStyleTiered;
+  options.tiered_size_ratio = 20;
+  Reopen(&options);
+
+  // Memtables are flushed to level-0 even when nothing overlaps them.
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 100; i++) {
+    values.push_back(RandomString(&rnd, 1000));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ("1", FilesPerLevel());
+
+  // Four runs of similar size merge into the last level.
+  for (int i = 100; i < 400; i++) {
+    values.push_back(RandomString(&rnd, 1000));
+    ASSERT_OK(Put(Key(i), values[i]));
+    if (i % 100 == 99) {
+      ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    }
+  }
+  for (int i = 0; i < 100 && NumTableFilesAtLevel(0) > 0; i++) {
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ("0,0,0,0,0,0,1", FilesPerLevel());
+
+  // Much smaller runs merge into a new run above it.  Three of them make
+  // enough runs, so no flush races the compaction.
+  for (int i = 0; i < 30; i++) {
+    values[i] = RandomString(&rnd, 1000);
+    ASSERT_OK(Put(Key(i), values[i]));
+    if (i % 10 == 9) {
+      ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    }
+  }
+  for (int i = 0; i < 100 && NumTableFilesAtLevel(0) > 0; i++) {
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ("0,0,0,0,0,1,1", FilesPerLevel());
+  for (int i = 0; i < 400; i++) {
+    ASSERT_EQ(Get(Key(i)), values[i]);
+  }
+
+  // The runs are readable and compactable with leveled compaction.
+  Reopen();
+  for (int i = 0; i < 400; i++) {
+    ASSERT_EQ(Get(Key(i)), values[i]);
+  }
+  db_->CompactRange(NULL, NULL);
+  ASSERT_EQ("0,0,0,0,0,0,1", FilesPerLevel());
+  for (int i = 0; i < 400; i++) {
+    ASSERT_EQ(Get(Key(i)), values[i]);
+  }
+}
+
+TEST(DBTest, TargetFileSize) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.compression = kNoCompression;
+  options.write_buffer_size = 1<<20;
+  options.target_file_size_base = 100<<10;
+  DestroyAndReopen(&options);
+
+  // About 2MB of data, written twice so that the tables overlap and are
+  // merged, is compacted into tables of about 100KB.
+  Random rnd(301);
+  for (int i = 0; i < 4000; i++) {
+    ASSERT_OK(Put(Key(i % 2000), RandomString(&rnd, 1000)));
+  }
+  db_->CompactRange(NULL, NULL);
+  ASSERT_GE(TotalTableFiles(), 18);
+  ASSERT_LE(TotalTableFiles(), 24);
+
+  options.target_file_size_base = 1<<20;
+  DestroyAndReopen(&options);
+  for (int i = 0; i < 4000; i++) {
+    ASSERT_OK(Put(Key(i % 2000), RandomString(&rnd, 1000)));
+  }
+  db_->CompactRange(NULL, NULL);
+  ASSERT_LE(TotalTableFiles(), 3);
+}
+
 TEST(DBTest, RepeatedWritesToSameKey) {
   Options options = CurrentOptions();
   options.env = env_;
@@ -953,8 +1363,8 @@ TEST(DBTest, RepeatedWritesToSameKey) {
   Reopen(&options);
 
   // We must have at most one file per level except for level-0,
-  // which may have up to kL0_StopWritesTrigger files.
-  const int kMaxFiles = config::kNumLevels + config::kL0_StopWritesTrigger;
+  // which may have up to level0_stop_writes_trigger files.
+  const int kMaxFiles = config::kNumLevels + options.level0_stop_writes_trigger;
 
   Random rnd(301);
   std::string value = RandomString(&rnd, 2 * options.write_buffer_size);
@@ -1016,6 +1426,175 @@ static bool Between(uint64_t val, uint64_t low, uint64_t high) {
   return result;
 }
 
+TEST(DBTest, WriteStats) {
+  std::string stats;
+  ASSERT_TRUE(db_->GetProperty("leveldb.write-stats", &stats));
+  ASSERT_TRUE(stats.find("Writers queued: 0 (max 0)") != std::string::npos);
+
+  for (int i = 0; i < 10; i++) {
+    ASSERT_OK(Put(Key(i), "v"));
+  }
+  ASSERT_TRUE(db_->GetProperty("leveldb.write-stats", &stats));
+  ASSERT_TRUE(stats.find("Writers queued: 0 (max 1)") != std::string::npos)
+      << stats;
+  // One batch group and one latency sample per write
+  size_t group = stats.find("Batch group size:\nCount: 10 ");
+  size_t latency = stats.find("Write latency (micros):\nCount: 10 ");
+  ASSERT_TRUE(group != std::string::npos) << stats;
+  ASSERT_TRUE(latency != std::string::npos) << stats;
+  ASSERT_TRUE(stats.find("L0 stop             0") != std::string::npos)
+      << stats;
+}
+
+// Returns the count and percentiles of an op in the "leveldb.latency"
+// property.
+static bool LatencyOf(const std::string& stats, const std::string& op,
+                      double* count, double* p50, double* p999) {
+  size_t pos = stats.find("\n" + op + " ");
+  double p99;
+  return pos != std::string::npos &&
+         sscanf(stats.c_str() + pos + 1 + op.size(), "%lf %lf %lf %lf",
+                count, p50, &p99, p999) == 4 &&
+         *p50 <= p99 && p99 <= *p999;
+}
+
+TEST(DBTest, LatencyProperty) {
+  std::string stats;
+  double count, p50, p999;
+  ASSERT_TRUE(db_->GetProperty("leveldb.latency", &stats));
+  ASSERT_TRUE(LatencyOf(stats, "get", &count, &p50, &p999)) << stats;
+  ASSERT_EQ(0, count);
+  ASSERT_EQ(0, p999);
+
+  for (int i = 0; i < 10; i++) {
+    ASSERT_OK(Put(Key(i), "v"));
+  }
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQ("v", Get(Key(i)));
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_TRUE(db_->GetProperty("leveldb.latency", &stats));
+  ASSERT_TRUE(LatencyOf(stats, "get", &count, &p50, &p999)) << stats;
+  ASSERT_EQ(4, count);
+  ASSERT_TRUE(LatencyOf(stats, "write", &count, &p50, &p999)) << stats;
+  ASSERT_EQ(10, count);
+  ASSERT_TRUE(LatencyOf(stats, "compaction", &count, &p50, &p999)) << stats;
+  ASSERT_EQ(1, count);
+}
+
+TEST(DBTest, WriteAmplificationProperties) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Small write buffer
+  Reopen(&options);
+
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.bytes-written", &property));
+  ASSERT_EQ("0", property);
+  ASSERT_TRUE(db_->GetProperty("leveldb.compaction-bytes-written", &property));
+  ASSERT_EQ("0", property);
+  ASSERT_TRUE(db_->GetProperty("leveldb.stall-micros", &property));
+
+  Random rnd(301);
+  for (int i = 0; i < 200; i++) {
+    ASSERT_OK(Put(Key(i), RandomString(&rnd, 1000)));
+  }
+  ASSERT_TRUE(db_->GetProperty("leveldb.bytes-written", &property));
+  const uint64_t written = strtoull(property.c_str(), NULL, 10);
+  ASSERT_TRUE(Between(written, 200 * 1000, 200 * 1100));
+
+  // Flushed memtables count as compaction output.
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_TRUE(db_->GetProperty("leveldb.compaction-bytes-written", &property));
+  ASSERT_GT(strtoull(property.c_str(), NULL, 10), 0ull);
+}
+
+TEST(DBTest, ApproximateMemoryUsage) {
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.approximate-memory-usage", &property));
+  const uint64_t empty = strtoull(property.c_str(), NULL, 10);
+
+  Random rnd(301);
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(Put(Key(i), RandomString(&rnd, 1000)));
+  }
+  ASSERT_TRUE(db_->GetProperty("leveldb.approximate-memory-usage", &property));
+  ASSERT_GE(strtoull(property.c_str(), NULL, 10), empty + 100 * 1000);
+
+  // Flushing the memtable releases its memory.
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_TRUE(db_->GetProperty("leveldb.approximate-memory-usage", &property));
+  ASSERT_LT(strtoull(property.c_str(), NULL, 10), empty + 100 * 1000);
+}
+
+TEST(DBTest, ReadStats) {
+  Options options = CurrentOptions();
+  options.block_size = 1024;
+  options.block_cache = NewLRUCache(1 << 20);
+  Reopen(&options);
+
+  Random rnd(301);
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(Put(Key(i), RandomString(&rnd, 500)));
+  }
+  dbfull()->TEST_CompactMemTable();
+
+  // Both scans need every block.  Blocks of mmapped tables aren't cached,
+  // so the second scan may have to read them again.
+  ReadStats stats;
+  ReadOptions read_options;
+  read_options.stats = &stats;
+  uint64_t blocks = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    stats.Reset();
+    Iterator* iter = db_->NewIterator(read_options);
+    int count = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      count++;
+    }
+    ASSERT_EQ(100, count);
+    delete iter;
+    ASSERT_EQ(0, stats.internal_keys_skipped);
+    if (pass == 0) {
+      ASSERT_EQ(0, stats.block_cache_hits);
+      ASSERT_GT(stats.block_cache_misses, 10);
+      ASSERT_GT(stats.block_read_bytes, 100 * 500);
+      ASSERT_GT(stats.block_uncompressed_bytes, 100 * 500);
+      blocks = stats.block_cache_misses;
+    } else {
+      ASSERT_EQ(blocks, stats.block_cache_hits + stats.block_cache_misses);
+    }
+  }
+
+  // Gets count where they found their key, and scans count the deletion
+  // and the overwritten value they step over.
+  ASSERT_OK(Put(Key(1), "v1"));
+  ASSERT_OK(Delete(Key(2)));
+  stats.Reset();
+  std::string value;
+  ASSERT_OK(db_->Get(read_options, Key(1), &value));
+  ASSERT_EQ(1, stats.memtable_hits);
+  ASSERT_EQ(0, stats.table_gets);
+  ASSERT_OK(db_->Get(read_options, Key(3), &value));
+  ASSERT_EQ(1, stats.memtable_hits);
+  ASSERT_GE(stats.table_gets, 1);
+  stats.Reset();
+  Iterator* iter = db_->NewIterator(read_options);
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  delete iter;
+  ASSERT_EQ(99, count);
+  ASSERT_EQ(3, stats.internal_keys_skipped);
+
+  // Reads without stats are not counted.
+  stats.Reset();
+  ASSERT_EQ(Get(Key(1)).size(), 2);
+  ASSERT_EQ(0, stats.block_cache_hits);
+  ASSERT_EQ(0, stats.memtable_hits);
+  delete options.block_cache;
+}
+
 TEST(DBTest, ApproximateSizes) {
   do {
     Options options = CurrentOptions();
@@ -1126,6 +1705,46 @@ TEST(DBTest, IteratorPinsRef) {
   delete iter;
 }
 
+TEST(DBTest, IteratorPinData) {
+  do {
+    // Spread the values over the memtable and several tables
+    for (int i = 0; i < 200; i++) {
+      ASSERT_OK(Put(Key(i), Key(i) + std::string(1000, 'v')));
+      if (i == 100) {
+        Compact(Key(0), Key(100));
+      } else if (i == 150) {
+        dbfull()->TEST_CompactMemTable();
+      }
+    }
+
+    for (int scan = 0; scan < 2; scan++) {
+      // Blocks read without filling the cache are freed as soon as the
+      // iterator leaves them, unless they are pinned
+      ReadOptions ropts;
+      ropts.fill_cache = false;
+      ropts.sequential_scan = (scan == 1);
+      ropts.pin_data = true;
+      Iterator* iter = db_->NewIterator(ropts);
+      std::vector<Slice> values;
+      for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        values.push_back(iter->value());
+      }
+      ASSERT_OK(iter->status());
+      ASSERT_EQ(200, values.size());
+      for (int i = 0; i < 200; i++) {
+        ASSERT_EQ(Key(i) + std::string(1000, 'v'), values[i].ToString());
+      }
+
+      // After a release the current value is still readable
+      iter->Seek(Key(50));
+      iter->ReleasePinnedData();
+      ASSERT_TRUE(iter->Valid());
+      ASSERT_EQ(Key(50) + std::string(1000, 'v'), iter->value().ToString());
+      delete iter;
+    }
+  } while (ChangeOptions());
+}
+
 TEST(DBTest, Snapshot) {
   do {
     Put("foo", "v1");
@@ -1241,12 +1860,466 @@ TEST(DBTest, DeletionMarkers2) {
   ASSERT_EQ(AllEntriesFor("foo"), "[ ]");
 }
 
-TEST(DBTest, OverlapInLevel0) {
+TEST(DBTest, DeleteRange) {
   do {
-    ASSERT_EQ(config::kMaxMemCompactLevel, 2) << "Fix test to match config";
-
-    // Fill levels 1 and 2 to disable the pushing of new memtables to levels > 0.
-    ASSERT_OK(Put("100", "v100"));
+    ASSERT_OK(Put("a", "va"));
+    ASSERT_OK(Put("b", "vb"));
+    ASSERT_OK(Put("c", "vc"));
+    ASSERT_OK(Put("d", "vd"));
+    ASSERT_OK(db_->DeleteRange(WriteOptions(), "b", "d"));
+    ASSERT_EQ("va", Get("a"));
+    ASSERT_EQ("NOT_FOUND", Get("b"));
+    ASSERT_EQ("NOT_FOUND", Get("c"));
+    ASSERT_EQ("vd", Get("d"));
+    ASSERT_EQ("(a->va)(d->vd)", Contents());
+
+    // Writes after the tombstone are visible
+    ASSERT_OK(Put("c", "vc2"));
+    ASSERT_EQ("vc2", Get("c"));
+    ASSERT_EQ("(a->va)(c->vc2)(d->vd)", Contents());
+
+    // The tombstone survives a memtable flush and a reopen
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    ASSERT_EQ("(a->va)(c->vc2)(d->vd)", Contents());
+    Reopen();
+    ASSERT_EQ("NOT_FOUND", Get("b"));
+    ASSERT_EQ("(a->va)(c->vc2)(d->vd)", Contents());
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, DeleteRangeSnapshot) {
+  ASSERT_OK(Put("foo", "v1"));
+  const Snapshot* s1 = db_->GetSnapshot();
+  ASSERT_OK(db_->DeleteRange(WriteOptions(), "a", "z"));
+  ASSERT_EQ("NOT_FOUND", Get("foo"));
+  ASSERT_EQ("v1", Get("foo", s1));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ("NOT_FOUND", Get("foo"));
+  ASSERT_EQ("v1", Get("foo", s1));
+  db_->ReleaseSnapshot(s1);
+}
+
+TEST(DBTest, DeleteRangeCompaction) {
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(Put(Key(i), "v"));
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(db_->DeleteRange(WriteOptions(), Key(10), Key(90)));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-range-deletions", &property));
+  ASSERT_EQ("1", property);
+  ASSERT_EQ("[ v ]", AllEntriesFor(Key(50)));
+  ASSERT_EQ("NOT_FOUND", Get(Key(50)));
+
+  // Compacting the table drops the covered keys and then the tombstone
+  const int last = config::kMaxMemCompactLevel;
+  ASSERT_EQ(1, NumTableFilesAtLevel(last));
+  dbfull()->TEST_CompactRange(last, NULL, NULL);
+  ASSERT_EQ("[ ]", AllEntriesFor(Key(50)));
+  ASSERT_EQ("[ v ]", AllEntriesFor(Key(9)));
+  ASSERT_EQ("[ v ]", AllEntriesFor(Key(90)));
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-range-deletions", &property));
+  ASSERT_EQ("0", property);
+  Reopen();
+  ASSERT_EQ("NOT_FOUND", Get(Key(50)));
+  ASSERT_EQ("v", Get(Key(90)));
+}
+
+TEST(DBTest, Merge) {
+  do {
+    DestroyAndReopenWithMerge();
+    ASSERT_OK(Merge("a", "1"));
+    ASSERT_EQ("1", Get("a"));
+    ASSERT_OK(Put("b", "x"));
+    ASSERT_OK(Merge("b", "y"));
+    ASSERT_OK(Merge("b", "z"));
+    ASSERT_EQ("xyz", Get("b"));
+    ASSERT_OK(Delete("b"));
+    ASSERT_OK(Merge("b", "w"));
+    ASSERT_EQ("w", Get("b"));
+    ASSERT_EQ("(a->1)(b->w)", Contents());
+
+    // Operands are applied to values in the immutable memtable and tables
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    ASSERT_OK(Merge("a", "2"));
+    ASSERT_EQ("12", Get("a"));
+    ASSERT_OK(Merge("c", "1"));
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    ASSERT_OK(Merge("c", "2"));
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    ASSERT_OK(Merge("c", "3"));
+    ASSERT_EQ("123", Get("c"));
+    ASSERT_EQ("(a->12)(b->w)(c->123)", Contents());
+
+    // Several operands of a key in one table
+    ASSERT_OK(Merge("d", "1"));
+    ASSERT_OK(Merge("d", "2"));
+    ASSERT_OK(Merge("d", "3"));
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    ASSERT_EQ("123", Get("d"));
+
+    Options options = last_options_;
+    Reopen(&options);
+    ASSERT_EQ("(a->12)(b->w)(c->123)(d->123)", Contents());
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, MergeIterator) {
+  DestroyAndReopenWithMerge();
+  ASSERT_OK(Put("a", "va"));
+  ASSERT_OK(Put("b", "vb"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(Merge("b", "1"));
+  ASSERT_OK(Merge("c", "1"));
+  ASSERT_OK(Merge("c", "2"));
+  ASSERT_OK(Put("d", "vd"));
+  ASSERT_OK(Merge("e", "1"));
+
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "a->va");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "b->vb1");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "c->12");
+  iter->Prev();
+  ASSERT_EQ(IterStatus(iter), "b->vb1");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "c->12");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "d->vd");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "e->1");
+  iter->Prev();
+  ASSERT_EQ(IterStatus(iter), "d->vd");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "e->1");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "(invalid)");
+
+  iter->Seek("c");
+  ASSERT_EQ(IterStatus(iter), "c->12");
+  iter->Prev();
+  ASSERT_EQ(IterStatus(iter), "b->vb1");
+  iter->Prev();
+  ASSERT_EQ(IterStatus(iter), "a->va");
+  iter->SeekToLast();
+  ASSERT_EQ(IterStatus(iter), "e->1");
+  iter->Prev();
+  iter->Prev();
+  ASSERT_EQ(IterStatus(iter), "c->12");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "d->vd");
+  delete iter;
+
+  // Merged values are pinned like the others
+  ReadOptions ropts;
+  ropts.pin_data = true;
+  iter = db_->NewIterator(ropts);
+  std::vector<Slice> values;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    values.push_back(iter->value());
+  }
+  ASSERT_EQ(5, values.size());
+  ASSERT_EQ("vb1", values[1].ToString());
+  ASSERT_EQ("12", values[2].ToString());
+  iter->Seek("c");
+  iter->ReleasePinnedData();
+  ASSERT_EQ(IterStatus(iter), "c->12");
+  delete iter;
+}
+
+TEST(DBTest, MergeCompaction) {
+  DestroyAndReopenWithMerge();
+  ASSERT_OK(Put("foo", "v"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(Merge("foo", "1"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(Merge("foo", "2"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ("[ MERGE(2), MERGE(1), v ]", AllEntriesFor("foo"));
+
+  // Operands are combined when the value is in a level under the output
+  const int last = config::kMaxMemCompactLevel;
+  ASSERT_EQ(1, NumTableFilesAtLevel(last));
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ("[ v12 ]", AllEntriesFor("foo"));
+  ASSERT_EQ("v12", Get("foo"));
+
+  // Operands newer than a snapshot are kept
+  ASSERT_OK(Merge("foo", "3"));
+  const Snapshot* s1 = db_->GetSnapshot();
+  ASSERT_OK(Merge("foo", "4"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ("[ MERGE(4), v123 ]", AllEntriesFor("foo"));
+  ASSERT_EQ("v123", Get("foo", s1));
+  ASSERT_EQ("v1234", Get("foo"));
+  db_->ReleaseSnapshot(s1);
+  dbfull()->TEST_CompactRange(last, NULL, NULL);
+  ASSERT_EQ("[ v1234 ]", AllEntriesFor("foo"));
+}
+
+TEST(DBTest, MergePartialCompaction) {
+  DestroyAndReopenWithMerge();
+  ASSERT_OK(Put("foo", "v"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(Merge("foo", "1"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(Merge("foo", "2"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(1, NumTableFilesAtLevel(0));
+  ASSERT_EQ(1, NumTableFilesAtLevel(1));
+  ASSERT_EQ(1, NumTableFilesAtLevel(2));
+
+  // The value is under the output level so the operands are combined
+  // into one
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ("[ MERGE(12), v ]", AllEntriesFor("foo"));
+  ASSERT_EQ("v12", Get("foo"));
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ("[ v12 ]", AllEntriesFor("foo"));
+}
+
+TEST(DBTest, MergeDeleteRange) {
+  DestroyAndReopenWithMerge();
+  ASSERT_OK(Put("foo", "v"));
+  ASSERT_OK(Merge("foo", "1"));
+  ASSERT_OK(db_->DeleteRange(WriteOptions(), "a", "z"));
+  ASSERT_EQ("NOT_FOUND", Get("foo"));
+  ASSERT_OK(Merge("foo", "2"));
+  ASSERT_EQ("2", Get("foo"));
+  ASSERT_EQ("(foo->2)", Contents());
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ("2", Get("foo"));
+  ASSERT_EQ("(foo->2)", Contents());
+  dbfull()->TEST_CompactRange(config::kMaxMemCompactLevel, NULL, NULL);
+  ASSERT_EQ("[ 2 ]", AllEntriesFor("foo"));
+}
+
+TEST(DBTest, MergeWithoutOperator) {
+  ASSERT_OK(Put("foo", "v"));
+  ASSERT_OK(Merge("foo", "1"));
+  std::string value;
+  ASSERT_TRUE(db_->Get(ReadOptions(), "foo", &value).IsNotSupported());
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  iter->SeekToFirst();
+  ASSERT_TRUE(!iter->Valid());
+  ASSERT_TRUE(iter->status().IsNotSupported());
+  delete iter;
+
+  // The operands and the values under them are kept
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(config::kMaxMemCompactLevel, NULL, NULL);
+  ASSERT_EQ("[ MERGE(1), v ]", AllEntriesFor("foo"));
+  Options options = MergeOptions();
+  Reopen(&options);
+  ASSERT_EQ("v1", Get("foo"));
+}
+
+namespace {
+// Removes values starting with "expired" and renames values starting with
+// "old" to "new".
+class ExpiryFilter : public CompactionFilter {
+ public:
+  virtual const char* Name() const { return "ExpiryFilter"; }
+  virtual bool Filter(int level, const Slice& key,
+                      const Slice& existing_value, std::string* new_value,
+                      bool* value_changed) const {
+    if (existing_value.starts_with("expired")) {
+      return true;
+    }
+    if (existing_value.starts_with("old")) {
+      *new_value = "new" + existing_value.ToString().substr(3);
+      *value_changed = true;
+    }
+    return false;
+  }
+};
+}
+
+TEST(DBTest, CompactionFilter) {
+  ExpiryFilter filter;
+  Options options = MergeOptions();
+  options.compaction_filter = &filter;
+  DestroyAndReopen(&options);
+  ASSERT_OK(Put("a", "keep"));
+  ASSERT_OK(Put("b", "expired"));
+  ASSERT_OK(Put("c", "old"));
+  ASSERT_OK(Put("d", "v1"));
+
+  // Flushes don't filter
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  const int last = config::kMaxMemCompactLevel;
+  ASSERT_EQ(1, NumTableFilesAtLevel(last));
+  ASSERT_EQ("[ expired ]", AllEntriesFor("b"));
+  dbfull()->TEST_CompactRange(last, NULL, NULL);
+  ASSERT_EQ("[ ]", AllEntriesFor("b"));
+  ASSERT_EQ("new", Get("c"));
+  ASSERT_EQ("keep", Get("a"));
+
+  // Keys removed above older entries are written as deletions
+  dbfull()->TEST_CompactRange(last + 1, NULL, NULL);
+  ASSERT_EQ(1, NumTableFilesAtLevel(last + 2));
+  ASSERT_OK(Put("d", "expired"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(1, NumTableFilesAtLevel(last));
+  dbfull()->TEST_CompactRange(last, NULL, NULL);
+  ASSERT_EQ("[ DEL, v1 ]", AllEntriesFor("d"));
+  ASSERT_EQ("NOT_FOUND", Get("d"));
+
+  // Merged values are filtered once their operands are folded in
+  ASSERT_OK(Merge("c", "-1"));
+  ASSERT_OK(Merge("e", "expired"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(last, NULL, NULL);
+  ASSERT_EQ("new-1", Get("c"));
+  ASSERT_EQ("NOT_FOUND", Get("e"));
+
+  // Values newer than the oldest snapshot are kept
+  const Snapshot* s1 = db_->GetSnapshot();
+  ASSERT_OK(Put("f", "expired"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(last, NULL, NULL);
+  ASSERT_EQ("expired", Get("f"));
+  db_->ReleaseSnapshot(s1);
+  dbfull()->TEST_CompactRange(last + 1, NULL, NULL);
+  ASSERT_EQ("NOT_FOUND", Get("f"));
+
+  // The filter must outlive the database
+  Close();
+}
+
+// Returns the numbers of the blob files in the "leveldb.blob-files"
+// property of "db", in order.
+static std::string BlobFiles(DB* db) {
+  std::string property, result;
+  ASSERT_TRUE(db->GetProperty("leveldb.blob-files", &property));
+  Slice in(property);
+  while (!in.empty()) {
+    const char* end = strchr(in.data(), '\n');
+    Slice line(in.data(), end - in.data());
+    in.remove_prefix(line.size() + 1);
+    if (!result.empty()) {
+      result += ",";
+    }
+    result += line.ToString().substr(0, line.ToString().find(' '));
+  }
+  return result;
+}
+
+TEST(DBTest, BlobValues) {
+  ExpiryFilter filter;
+  Options options = MergeOptions();
+  options.min_blob_size = 100;
+  DestroyAndReopen(&options);
+  const std::string big1(200, '1'), big2(300, '2'), big3(400, '3');
+  ASSERT_OK(Put("a", "small"));
+  ASSERT_OK(Put("b", big1));
+  ASSERT_OK(Put("c", big2));
+  ASSERT_OK(Merge("d", "x"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+
+  // Large values are left in a blob file by flushes
+  const std::string blob1 = BlobFiles(db_);
+  ASSERT_TRUE(!blob1.empty());
+  ASSERT_EQ("[ small ]", AllEntriesFor("a"));
+  ASSERT_EQ("[ BLOB ]", AllEntriesFor("b"));
+  ASSERT_EQ(big1, Get("b"));
+  ASSERT_EQ("(a->small)(b->" + big1 + ")(c->" + big2 + ")(d->x)",
+            Contents());
+
+  // Merge operands apply to the values in blob files
+  ASSERT_OK(Merge("b", "+"));
+  ASSERT_EQ(big1 + "+", Get("b"));
+  ASSERT_EQ("(a->small)(b->" + big1 + "+)(c->" + big2 + ")(d->x)",
+            Contents());
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ("[ BLOB ]", AllEntriesFor("b"));
+  ASSERT_EQ(big1 + "+", Get("b"));
+
+  Reopen(&options);
+  ASSERT_EQ(big1 + "+", Get("b"));
+  ASSERT_EQ(big2, Get("c"));
+
+  // Compactions copy the live values out of a blob file with too much
+  // garbage, after which it is deleted
+  ASSERT_OK(Put("b", "small"));
+  ASSERT_OK(Put("c", "small"));
+  ASSERT_OK(Put("e", big3));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  for (int level = 0; level < config::kNumLevels - 1; level++) {
+    dbfull()->TEST_CompactRange(level, NULL, NULL);
+  }
+  ASSERT_TRUE(("," + BlobFiles(db_) + ",").find("," + blob1 + ",") ==
+              std::string::npos);
+  ASSERT_EQ("(a->small)(b->small)(c->small)(d->x)(e->" + big3 + ")",
+            Contents());
+  Reopen(&options);
+  ASSERT_EQ(big3, Get("e"));
+
+  // Values that are still live are copied to a new blob file
+  ASSERT_OK(Put("h", big1));
+  ASSERT_OK(Put("i", big2));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  const std::string files = BlobFiles(db_);
+  const std::string blob2 = files.substr(files.rfind(',') + 1);
+  ASSERT_OK(Put("i", "small"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  for (int level = 0; level < config::kNumLevels - 1; level++) {
+    dbfull()->TEST_CompactRange(level, NULL, NULL);
+  }
+  ASSERT_TRUE(("," + BlobFiles(db_) + ",").find("," + blob2 + ",") ==
+              std::string::npos);
+  ASSERT_EQ("[ BLOB ]", AllEntriesFor("h"));
+  ASSERT_EQ(big1, Get("h"));
+
+  // The compaction filter sees the values in blob files
+  options.compaction_filter = &filter;
+  Reopen(&options);
+  ASSERT_OK(Put("f", "expired" + big3));
+  ASSERT_OK(Put("g", "old" + big3));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  const int last = config::kMaxMemCompactLevel;
+  dbfull()->TEST_CompactRange(last, NULL, NULL);
+  ASSERT_EQ("NOT_FOUND", Get("f"));
+  ASSERT_EQ("new" + big3, Get("g"));
+  ASSERT_EQ("[ BLOB ]", AllEntriesFor("g"));
+
+  // Once every value is overwritten no blob files are left
+  ASSERT_OK(Put("b", "small"));
+  ASSERT_OK(Put("e", "small"));
+  ASSERT_OK(Put("h", "small"));
+  ASSERT_OK(Put("g", "small"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  for (int level = 0; level < config::kNumLevels - 1; level++) {
+    dbfull()->TEST_CompactRange(level, NULL, NULL);
+  }
+  ASSERT_EQ("", BlobFiles(db_));
+  std::vector<std::string> filenames;
+  ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+  uint64_t number;
+  FileType type;
+  for (size_t i = 0; i < filenames.size(); i++) {
+    ASSERT_TRUE(!ParseFileName(filenames[i], &number, &type) ||
+                type != kBlobFile);
+  }
+  Close();
+}
+
+TEST(DBTest, OverlapInLevel0) {
+  do {
+    ASSERT_EQ(config::kMaxMemCompactLevel, 2) << "Fix test to match config";
+
+    // Fill levels 1 and 2 to disable the pushing of new memtables to levels > 0.
+    ASSERT_OK(Put("100", "v100"));
     ASSERT_OK(Put("999", "v999"));
     dbfull()->TEST_CompactMemTable();
     ASSERT_OK(Delete("100"));
@@ -1578,6 +2651,127 @@ TEST(DBTest, FilesDeletedAfterCompaction) {
   ASSERT_EQ(CountFiles(), num_files);
 }
 
+TEST(DBTest, Checkpoint) {
+  const std::string dir = test::TmpDir() + "/db_checkpoint";
+  DestroyDB(dir, Options());
+
+  ASSERT_OK(Put("a", "va"));
+  ASSERT_OK(Put("b", "vb"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(Put("c", "vc"));
+  ASSERT_OK(db_->DeleteRange(WriteOptions(), "b", "c"));
+  ASSERT_OK(db_->CreateCheckpoint(dir));
+  ASSERT_OK(Put("d", "vd"));
+
+  // The checkpoint has every write before it and none after.
+  Options options = CurrentOptions();
+  DB* copy;
+  ASSERT_OK(DB::Open(options, dir, &copy));
+  std::string value;
+  ASSERT_OK(copy->Get(ReadOptions(), "a", &value));
+  ASSERT_EQ("va", value);
+  ASSERT_TRUE(copy->Get(ReadOptions(), "b", &value).IsNotFound());
+  ASSERT_OK(copy->Get(ReadOptions(), "c", &value));
+  ASSERT_EQ("vc", value);
+  ASSERT_TRUE(copy->Get(ReadOptions(), "d", &value).IsNotFound());
+  delete copy;
+
+  // A later checkpoint in the same directory adds the new tables and
+  // drops the ones compacted away.
+  Compact("a", "z");
+  ASSERT_OK(db_->CreateCheckpoint(dir));
+  ASSERT_OK(DB::Open(options, dir, &copy));
+  ASSERT_OK(copy->Get(ReadOptions(), "d", &value));
+  ASSERT_EQ("vd", value);
+  ASSERT_TRUE(copy->Get(ReadOptions(), "b", &value).IsNotFound());
+  delete copy;
+
+  std::vector<std::string> filenames;
+  ASSERT_OK(env_->GetChildren(dir, &filenames));
+  int tables = 0;
+  uint64_t number;
+  FileType type;
+  for (size_t i = 0; i < filenames.size(); i++) {
+    if (ParseFileName(filenames[i], &number, &type) && type == kTableFile) {
+      tables++;
+    }
+  }
+  int live = 0;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    live += NumTableFilesAtLevel(level);
+  }
+  ASSERT_EQ(live, tables);
+  DestroyDB(dir, Options());
+}
+
+TEST(DBTest, IngestTable) {
+  const std::string fname = test::TmpDir() + "/db_ingest_table";
+  ASSERT_OK(Put("a", "va"));
+  ASSERT_OK(Put("z", "vz"));
+  const Snapshot* snapshot = db_->GetSnapshot();
+
+  // Keys must be added in order.
+  TableWriter* writer;
+  ASSERT_OK(db_->NewTableWriter(fname, &writer));
+  ASSERT_OK(writer->Add("m", "vm"));
+  ASSERT_OK(writer->Add("n", "vn"));
+  ASSERT_TRUE(!writer->Add("n", "vn2").ok());
+  ASSERT_OK(writer->Add("o", "vo"));
+  ASSERT_OK(writer->Finish());
+  ASSERT_EQ(3, static_cast<int>(writer->NumEntries()));
+  delete writer;
+
+  // The table lands in the bottom level without going through the log.
+  ASSERT_OK(db_->IngestTable(fname));
+  env_->DeleteFile(fname);
+  ASSERT_EQ(1, NumTableFilesAtLevel(config::kNumLevels - 1));
+  ASSERT_EQ("vn", Get("n"));
+  ASSERT_EQ("vn", Get("n", snapshot));
+  ASSERT_EQ("(a->va)(m->vm)(n->vn)(o->vo)(z->vz)", Contents());
+  db_->ReleaseSnapshot(snapshot);
+
+  // Later writes replace ingested entries.
+  ASSERT_OK(Put("n", "vn3"));
+  ASSERT_EQ("vn3", Get("n"));
+
+  // Tables that overlap the database's keys or range deletions aren't
+  // added.
+  ASSERT_OK(db_->NewTableWriter(fname, &writer));
+  ASSERT_OK(writer->Add("b", "vb"));
+  ASSERT_OK(writer->Add("o", "vo2"));
+  ASSERT_OK(writer->Finish());
+  delete writer;
+  ASSERT_TRUE(!db_->IngestTable(fname).ok());
+  ASSERT_EQ("vo", Get("o"));
+
+  ASSERT_OK(db_->DeleteRange(WriteOptions(), "c", "e"));
+  ASSERT_OK(db_->NewTableWriter(fname, &writer));
+  ASSERT_OK(writer->Add("d", "vd"));
+  ASSERT_OK(writer->Finish());
+  delete writer;
+  ASSERT_TRUE(!db_->IngestTable(fname).ok());
+  ASSERT_EQ("NOT_FOUND", Get("d"));
+  env_->DeleteFile(fname);
+
+  // Ingested tables survive a reopen and compactions.
+  Reopen();
+  ASSERT_EQ("vm", Get("m"));
+  Compact("a", "z");
+  ASSERT_EQ("(a->va)(m->vm)(n->vn3)(o->vo)(z->vz)", Contents());
+
+  // A table within the range of a bottom level table goes to the level
+  // above it.
+  ASSERT_EQ("0,0,0,0,0,0,1", FilesPerLevel());
+  ASSERT_OK(db_->NewTableWriter(fname, &writer));
+  ASSERT_OK(writer->Add("p", "vp"));
+  ASSERT_OK(writer->Finish());
+  delete writer;
+  ASSERT_OK(db_->IngestTable(fname));
+  env_->DeleteFile(fname);
+  ASSERT_EQ("0,0,0,0,0,1,1", FilesPerLevel());
+  ASSERT_EQ("(a->va)(m->vm)(n->vn3)(o->vo)(p->vp)(z->vz)", Contents());
+}
+
 TEST(DBTest, BloomFilter) {
   env_->count_random_reads_ = true;
   Options options = CurrentOptions();
@@ -1625,6 +2819,245 @@ TEST(DBTest, BloomFilter) {
   delete options.filter_policy;
 }
 
+TEST(DBTest, PinnedMetadata) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(0);  // Prevent cache hits
+  options.filter_policy = NewBloomFilterPolicy(10);
+  options.block_size = 1024;
+  options.index_partition_size = 256;
+  options.pinned_metadata_size = 1 << 20;
+  Reopen(&options);
+
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.pinned-metadata-usage", &property));
+  ASSERT_EQ("0", property);
+
+  // A table in level 2 that covers the table pushed to level 1 below
+  ASSERT_OK(Put("a", "va"));
+  ASSERT_OK(Put("z", "vz"));
+  dbfull()->TEST_CompactMemTable();
+  const int N = 1000;
+  for (int i = 0; i < N; i++) {
+    ASSERT_OK(Put(Key(i), std::string(100, 'x')));
+  }
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("0,1,1", FilesPerLevel());
+
+  // Only the first lookup reads the index partitions of the level-1
+  // table; the rest read just their data block.
+  env_->random_read_counter_.Reset();
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(std::string(100, 'x'), Get(Key(i)));
+  }
+  int reads = env_->random_read_counter_.Read();
+  fprintf(stderr, "%d present => %d reads\n", N, reads);
+  ASSERT_LE(reads, N + N/50 + 20);
+  ASSERT_TRUE(db_->GetProperty("leveldb.pinned-metadata-usage", &property));
+  ASSERT_GT(strtoull(property.c_str(), NULL, 10), 0);
+
+  // Tables compacted out of level 1 are unpinned.
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ(0, NumTableFilesAtLevel(1));
+  ASSERT_TRUE(db_->GetProperty("leveldb.pinned-metadata-usage", &property));
+  ASSERT_EQ("0", property);
+  for (int i = 0; i < N; i += 100) {
+    ASSERT_EQ(std::string(100, 'x'), Get(Key(i)));
+  }
+  ASSERT_TRUE(db_->GetProperty("leveldb.pinned-metadata-usage", &property));
+  ASSERT_EQ("0", property);
+
+  Close();
+  delete options.block_cache;
+  delete options.filter_policy;
+}
+
+static std::string PrefixKey(int prefix, int i) {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "p%03d/%06d", prefix, i);
+  return std::string(buf);
+}
+
+TEST(DBTest, PrefixSeek) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(0);  // Prevent cache hits
+  options.filter_policy = NewBloomFilterPolicy(10);
+  options.prefix_extractor = NewFixedPrefixTransform(5);  // "pNNN/"
+  Reopen(&options);
+
+  // Populate multiple layers with the even prefixes only
+  const int kPrefixes = 100;
+  const int kKeys = 50;
+  for (int p = 0; p < kPrefixes; p += 2) {
+    for (int i = 0; i < kKeys; i++) {
+      ASSERT_OK(Put(PrefixKey(p, i), PrefixKey(p, i)));
+    }
+  }
+  Compact("a", "z");
+  for (int p = 0; p < kPrefixes; p += 20) {
+    ASSERT_OK(Put(PrefixKey(p, kKeys), "new"));
+  }
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Delete(PrefixKey(0, 1)));
+
+  // Prevent auto compactions triggered by seeks
+  env_->delay_sstable_sync_.Release_Store(env_);
+
+  ReadOptions ropts;
+  ropts.prefix_same_as_start = true;
+  Iterator* iter = db_->NewIterator(ropts);
+
+  // Seeks to present prefixes see exactly the keys with the prefix
+  for (int p = 0; p < kPrefixes; p += 2) {
+    const std::string prefix = PrefixKey(p, 0).substr(0, 5);
+    int count = 0;
+    for (iter->Seek(prefix); iter->Valid(); iter->Next()) {
+      ASSERT_TRUE(iter->key().starts_with(prefix));
+      count++;
+    }
+    ASSERT_OK(iter->status());
+    ASSERT_EQ(kKeys + (p % 20 == 0 ? 1 : 0) - (p == 0 ? 1 : 0), count);
+  }
+
+  // Seeks to missing prefixes should rarely read from either sstable
+  env_->random_read_counter_.Reset();
+  for (int p = 1; p < kPrefixes; p += 2) {
+    iter->Seek(PrefixKey(p, 0));
+    ASSERT_TRUE(!iter->Valid());
+    ASSERT_OK(iter->status());
+  }
+  int reads = env_->random_read_counter_.Read();
+  fprintf(stderr, "%d missing prefixes => %d reads\n", kPrefixes / 2, reads);
+  ASSERT_LE(reads, 2 * 3 * kPrefixes / 100 + 2);
+
+  // Other positioning methods leave prefix mode
+  iter->SeekToFirst();
+  ASSERT_EQ(PrefixKey(0, 0), iter->key().ToString());
+  int total = 0;
+  for (; iter->Valid(); iter->Next()) total++;
+  ASSERT_EQ(kPrefixes / 2 * kKeys + kPrefixes / 20 - 1, total);
+  delete iter;
+
+  env_->delay_sstable_sync_.Release_Store(NULL);
+  Close();
+  delete options.block_cache;
+  delete options.filter_policy;
+  delete options.prefix_extractor;
+}
+
+TEST(DBTest, WarmCache) {
+  env_->copy_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(1 << 20);
+  Reopen(&options);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_OK(Put(Key(i), std::string(100, 'v')));
+  }
+  dbfull()->TEST_CompactMemTable();
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(std::string(100, 'v'), Get(Key(i)));
+  }
+  std::string blocks;
+  ASSERT_OK(db_->GetCachedBlocks(&blocks));
+  ASSERT_TRUE(!blocks.empty());
+
+  // Reopen with a cold cache and read the hot blocks back
+  Close();
+  delete options.block_cache;
+  options.block_cache = NewLRUCache(1 << 20);
+  Reopen(&options);
+  ASSERT_OK(db_->WarmCache(blocks, 0));
+  ReadStats stats;
+  ReadOptions ropts;
+  ropts.stats = &stats;
+  std::string value;
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(db_->Get(ropts, Key(i), &value));
+  }
+  ASSERT_GT(stats.block_cache_hits, 0);
+  ASSERT_EQ(0, stats.block_cache_misses);
+
+  // Blocks of the other tables are not read
+  stats.Reset();
+  ASSERT_OK(db_->Get(ropts, Key(999), &value));
+  ASSERT_EQ(1, stats.block_cache_misses);
+
+  ASSERT_TRUE(db_->WarmCache("\xff", 0).IsCorruption());
+  Close();
+  delete options.block_cache;
+}
+
+TEST(DBTest, IterateUpperBound) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(0);  // Prevent cache hits
+  Reopen(&options);
+
+  const int kKeys = 1000;
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_OK(Put(Key(i), std::string(1000, 'v')));
+  }
+  Compact("a", "z");
+  ASSERT_OK(Put(Key(50), "new"));
+
+  // Deleting everything after the bound leaves a long run of hidden
+  // entries that an unbounded scan has to read through.
+  for (int i = 100; i < kKeys; i++) {
+    ASSERT_OK(Delete(Key(i)));
+  }
+
+  env_->delay_sstable_sync_.Release_Store(env_);
+  ReadOptions ropts;
+  env_->random_read_counter_.Reset();
+  Iterator* iter = db_->NewIterator(ropts);
+  int count = 0;
+  for (iter->Seek(Key(0)); iter->Valid(); iter->Next()) count++;
+  ASSERT_EQ(100, count);
+  delete iter;
+  const int unbounded_reads = env_->random_read_counter_.Read();
+
+  // The bound is copied, so it need not outlive the iterator.
+  std::string bound = Key(100);
+  Slice bound_slice = bound;
+  ropts.iterate_upper_bound = &bound_slice;
+  env_->random_read_counter_.Reset();
+  iter = db_->NewIterator(ropts);
+  bound = "garbage";
+  count = 0;
+  for (iter->Seek(Key(0)); iter->Valid(); iter->Next()) {
+    ASSERT_LT(iter->key().ToString(), Key(100));
+    count++;
+  }
+  ASSERT_OK(iter->status());
+  ASSERT_EQ(100, count);
+  const int bounded_reads = env_->random_read_counter_.Read();
+  fprintf(stderr, "%d bounded reads, %d unbounded reads\n",
+          bounded_reads, unbounded_reads);
+  ASSERT_LT(bounded_reads, unbounded_reads / 2);
+
+  iter->Seek(Key(100));
+  ASSERT_TRUE(!iter->Valid());
+  iter->Seek(Key(50));
+  ASSERT_EQ("new", iter->value().ToString());
+  iter->SeekToLast();
+  ASSERT_EQ(Key(99), iter->key().ToString());
+  iter->Prev();
+  ASSERT_EQ(Key(98), iter->key().ToString());
+  iter->Next();
+  iter->Next();
+  ASSERT_TRUE(!iter->Valid());
+  delete iter;
+
+  env_->delay_sstable_sync_.Release_Store(NULL);
+  Close();
+  delete options.block_cache;
+}
+
 // Multi-threaded test:
 namespace {
 
@@ -1723,6 +3156,88 @@ TEST(DBTest, MultiThreaded) {
   } while (ChangeOptions());
 }
 
+namespace {
+struct PipelinedWriter {
+  DB* db;
+  int id;
+  port::AtomicPointer done;
+};
+
+static void PipelinedWriterBody(void* arg) {
+  PipelinedWriter* t = reinterpret_cast<PipelinedWriter*>(arg);
+  WriteOptions sync;
+  sync.sync = true;
+  char key[100];
+  for (int i = 0; i < 1000; i++) {
+    snprintf(key, sizeof(key), "%d.%d", t->id, i);
+    const std::string value(1000, 'a' + (i % 26));
+    ASSERT_OK(t->db->Put((i % 10 == 0) ? sync : WriteOptions(), key, value));
+  }
+  t->done.Release_Store(t);
+}
+}  // namespace
+
+TEST(DBTest, PipelinedWrite) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Switch memtables mid-pipeline
+  options.enable_pipelined_write = true;
+  Reopen(&options);
+
+  PipelinedWriter writers[kNumThreads];
+  for (int id = 0; id < kNumThreads; id++) {
+    writers[id].db = db_;
+    writers[id].id = id;
+    writers[id].done.Release_Store(NULL);
+    env_->StartThread(PipelinedWriterBody, &writers[id]);
+  }
+  for (int id = 0; id < kNumThreads; id++) {
+    while (writers[id].done.Acquire_Load() == NULL) {
+      env_->SleepForMicroseconds(10000);
+    }
+  }
+
+  for (int pass = 0; pass < 2; pass++) {
+    char key[100];
+    for (int id = 0; id < kNumThreads; id++) {
+      for (int i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "%d.%d", id, i);
+        ASSERT_EQ(std::string(1000, 'a' + (i % 26)), Get(key));
+      }
+    }
+    Reopen(&options);
+  }
+}
+
+TEST(DBTest, CompressedLogWithSyncInterval) {
+  Options options = CurrentOptions();
+  options.log_compression = kSnappyCompression;
+  options.log_sync_interval_micros = 1000;
+  Reopen(&options);
+
+  PipelinedWriter writers[kNumThreads];
+  for (int id = 0; id < kNumThreads; id++) {
+    writers[id].db = db_;
+    writers[id].id = id;
+    writers[id].done.Release_Store(NULL);
+    env_->StartThread(PipelinedWriterBody, &writers[id]);
+  }
+  for (int id = 0; id < kNumThreads; id++) {
+    while (writers[id].done.Acquire_Load() == NULL) {
+      env_->SleepForMicroseconds(10000);
+    }
+  }
+
+  // The writes are recovered from the log on reopen.
+  Reopen(&options);
+  char key[100];
+  for (int id = 0; id < kNumThreads; id++) {
+    for (int i = 0; i < 1000; i++) {
+      snprintf(key, sizeof(key), "%d.%d", id, i);
+      ASSERT_EQ(std::string(1000, 'a' + (i % 26)), Get(key));
+    }
+  }
+}
+
 namespace {
 typedef std::map<std::string, std::string> KVMap;
 }
@@ -1777,6 +3292,10 @@ class ModelDB: public DB {
       virtual void Delete(const Slice& key) {
         map_->erase(key.ToString());
       }
+      virtual void DeleteRange(const Slice& begin_key, const Slice& end_key) {
+        map_->erase(map_->lower_bound(begin_key.ToString()),
+                    map_->lower_bound(end_key.ToString()));
+      }
     };
     Handler handler;
     handler.map_ = &map_;
@@ -1923,7 +3442,14 @@ TEST(DBTest, Randomized) {
             // Periodically re-use the same key from the previous iter, so
             // we have multiple entries in the write batch for the same key
           }
-          if (rnd.OneIn(2)) {
+          if (rnd.OneIn(20)) {
+            std::string limit = RandomKey(&rnd);
+            if (limit < k) {
+              b.DeleteRange(limit, k);
+            } else {
+              b.DeleteRange(k, limit);
+            }
+          } else if (rnd.OneIn(2)) {
             v = RandomString(&rnd, rnd.Uniform(10));
             b.Put(k, v);
           } else {
@@ -1982,14 +3508,14 @@ void BM_LogAndApply(int iters, int num_base_files) {
 
   InternalKeyComparator cmp(BytewiseComparator());
   Options options;
-  VersionSet vset(dbname, &options, NULL, &cmp);
+  VersionSet vset(dbname, &options, NULL, NULL, &cmp);
   ASSERT_OK(vset.Recover());
   VersionEdit vbase;
   uint64_t fnum = 1;
   for (int i = 0; i < num_base_files; i++) {
     InternalKey start(MakeKey(2*fnum), 1, kTypeValue);
     InternalKey limit(MakeKey(2*fnum+1), 1, kTypeDeletion);
-    vbase.AddFile(2, fnum++, 1 /* file size */, start, limit);
+    vbase.AddFile(2, fnum++, 1 /* file size */, start, limit, 1);
   }
   ASSERT_OK(vset.LogAndApply(&vbase, &mu));
 
@@ -2000,7 +3526,7 @@ void BM_LogAndApply(int iters, int num_base_files) {
     vedit.DeleteFile(2, fnum);
     InternalKey start(MakeKey(2*fnum), 1, kTypeValue);
     InternalKey limit(MakeKey(2*fnum+1), 1, kTypeDeletion);
-    vedit.AddFile(2, fnum++, 1 /* file size */, start, limit);
+    vedit.AddFile(2, fnum++, 1 /* file size */, start, limit, 1);
     vset.LogAndApply(&vedit, &mu);
   }
   uint64_t stop_micros = env->NowMicros();
@@ -2,7 +2,9 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <assert.h>
 #include <stdio.h>
+#include <algorithm>
 #include "db/dbformat.h"
 #include "port/port.h"
 #include "util/coding.h"
@@ -98,6 +100,14 @@ void InternalKeyComparator::FindShortSuccessor(std::string* key) const {
   }
 }
 
+namespace {
+struct SliceLess {
+  bool operator()(const Slice& a, const Slice& b) const {
+    return a.compare(b) < 0;
+  }
+};
+}  // namespace
+
 const char* InternalFilterPolicy::Name() const {
   return user_policy_->Name();
 }
@@ -109,8 +119,11 @@ void InternalFilterPolicy::CreateFilter(const Slice* keys, int n,
   Slice* mkey = const_cast<Slice*>(keys);
   for (int i = 0; i < n; i++) {
     mkey[i] = ExtractUserKey(keys[i]);
-    // TODO(sanjay): Suppress dups?
   }
+  // Several versions of a user key, and the prefix entries added for a
+  // prefix_extractor, reduce to the same user key: add each only once.
+  std::sort(mkey, mkey + n, SliceLess());
+  n = std::unique(mkey, mkey + n) - mkey;
   user_policy_->CreateFilter(keys, n, dst);
 }
 
@@ -118,6 +131,20 @@ bool InternalFilterPolicy::KeyMayMatch(const Slice& key, const Slice& f) const {
   return user_policy_->KeyMayMatch(ExtractUserKey(key), f);
 }
 
+const char* InternalSliceTransform::Name() const {
+  return user_transform_->Name();
+}
+
+bool InternalSliceTransform::InDomain(const Slice& key) const {
+  return user_transform_->InDomain(ExtractUserKey(key));
+}
+
+Slice InternalSliceTransform::Transform(const Slice& key) const {
+  Slice prefix = user_transform_->Transform(ExtractUserKey(key));
+  assert(prefix.data() == key.data());
+  return Slice(key.data(), prefix.size() + 8);
+}
+
 LookupKey::LookupKey(const Slice& user_key, SequenceNumber s) {
   size_t usize = user_key.size();
   size_t needed = usize + 13;  // A conservative estimate
@@ -9,6 +9,7 @@
 #include "leveldb/comparator.h"
 #include "leveldb/db.h"
 #include "leveldb/filter_policy.h"
+#include "leveldb/slice_transform.h"
 #include "leveldb/slice.h"
 #include "leveldb/table_builder.h"
 #include "util/coding.h"
@@ -21,15 +22,6 @@ namespace leveldb {
 namespace config {
 static const int kNumLevels = 7;
 
-// Level-0 compaction is started when we hit this many files.
-static const int kL0_CompactionTrigger = 4;
-
-// Soft limit on number of level-0 files.  We slow down writes at this point.
-static const int kL0_SlowdownWritesTrigger = 8;
-
-// Maximum number of level-0 files.  We stop writes at this point.
-static const int kL0_StopWritesTrigger = 12;
-
 // Maximum level to which a new compacted memtable is pushed if it
 // does not create overlap.  We try to push to level 2 to avoid the
 // relatively expensive level 0=>1 compactions and to avoid some
@@ -38,6 +30,14 @@ static const int kL0_StopWritesTrigger = 12;
 // space if the same key space is being repeatedly overwritten.
 static const int kMaxMemCompactLevel = 2;
 
+// Approximate gap in bytes between samples of data read during iteration.
+static const int kReadBytesPeriod = 1048576;
+
+// Entries that iterators step over without returning them, such as
+// deletion markers and the entries they hide, are charged to the sampled
+// file as one seek per this many.
+static const int kSkippedEntriesPerSeek = 64;
+
 }  // namespace config
 
 class InternalKey;
@@ -47,7 +47,15 @@ class InternalKey;
 // data structures.
 enum ValueType {
   kTypeDeletion = 0x0,
-  kTypeValue = 0x1
+  kTypeValue = 0x1,
+  // Tags a range deletion in write batches.  Range tombstones are kept
+  // apart from the keys (see MemTable and Version), so this type never
+  // appears in an internal key.
+  kTypeRangeDeletion = 0x2,
+  kTypeMerge = 0x3,
+  // A value kept in a blob file.  The entry holds a BlobIndex that points
+  // to it (see db/blob_file.h).  Only tables hold entries of this type.
+  kTypeBlobIndex = 0x4
 };
 // kValueTypeForSeek defines the ValueType that should be passed when
 // constructing a ParsedInternalKey object for seeking to a particular
@@ -55,7 +63,7 @@ enum ValueType {
 // and the value type is embedded as the low 8 bits in the sequence
 // number in internal keys, we need to use the highest-numbered
 // ValueType, not the lowest).
-static const ValueType kValueTypeForSeek = kTypeValue;
+static const ValueType kValueTypeForSeek = kTypeBlobIndex;
 
 typedef uint64_t SequenceNumber;
 
@@ -105,6 +113,12 @@ inline ValueType ExtractValueType(const Slice& internal_key) {
   return static_cast<ValueType>(c);
 }
 
+inline SequenceNumber ExtractSequence(const Slice& internal_key) {
+  assert(internal_key.size() >= 8);
+  const size_t n = internal_key.size();
+  return DecodeFixed64(internal_key.data() + n - 8) >> 8;
+}
+
 // A comparator for internal keys that uses a specified comparator for
 // the user key portion and breaks ties by decreasing sequence number.
 class InternalKeyComparator : public Comparator {
@@ -135,6 +149,22 @@ class InternalFilterPolicy : public FilterPolicy {
   virtual bool KeyMayMatch(const Slice& key, const Slice& filter) const;
 };
 
+// Prefix extractor wrapper that converts from internal keys to user keys.
+// The prefix of an internal key is the user key's prefix followed by the
+// next 8 bytes of the internal key, so that InternalFilterPolicy, which
+// drops the last 8 bytes of every key, sees the user key's prefix.
+class InternalSliceTransform : public SliceTransform {
+ private:
+  const SliceTransform* const user_transform_;
+ public:
+  explicit InternalSliceTransform(const SliceTransform* t)
+      : user_transform_(t) { }
+  const SliceTransform* user_transform() const { return user_transform_; }
+  virtual const char* Name() const;
+  virtual bool InDomain(const Slice& key) const;
+  virtual Slice Transform(const Slice& key) const;
+};
+
 // Modules in this directory should keep internal keys wrapped inside
 // the following class instead of plain strings so that we do not
 // incorrectly use string comparisons instead of an InternalKeyComparator.
@@ -179,7 +209,9 @@ inline bool ParseInternalKey(const Slice& internal_key,
   result->sequence = num >> 8;
   result->type = static_cast<ValueType>(c);
   result->user_key = Slice(internal_key.data(), n - 8);
-  return (c <= static_cast<unsigned char>(kTypeValue));
+  return (c <= static_cast<unsigned char>(kTypeValue) ||
+          c == static_cast<unsigned char>(kTypeMerge) ||
+          c == static_cast<unsigned char>(kTypeBlobIndex));
 }
 
 // A helper class useful for DBImpl::Get()
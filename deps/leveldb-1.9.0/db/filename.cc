@@ -34,6 +34,11 @@ std::string TableFileName(const std::string& name, uint64_t number) {
   return MakeFileName(name, number, "sst");
 }
 
+std::string BlobFileName(const std::string& name, uint64_t number) {
+  assert(number > 0);
+  return MakeFileName(name, number, "blob");
+}
+
 std::string DescriptorFileName(const std::string& dbname, uint64_t number) {
   assert(number > 0);
   char buf[100];
@@ -50,6 +55,10 @@ std::string LockFileName(const std::string& dbname) {
   return dbname + "/LOCK";
 }
 
+std::string RepairFileName(const std::string& dbname) {
+  return dbname + "/REPAIR";
+}
+
 std::string TempFileName(const std::string& dbname, uint64_t number) {
   assert(number > 0);
   return MakeFileName(dbname, number, "dbtmp");
@@ -71,7 +80,7 @@ std::string OldInfoLogFileName(const std::string& dbname) {
 //    dbname/LOG
 //    dbname/LOG.old
 //    dbname/MANIFEST-[0-9]+
-//    dbname/[0-9]+.(log|sst)
+//    dbname/[0-9]+.(log|sst|blob)
 bool ParseFileName(const std::string& fname,
                    uint64_t* number,
                    FileType* type) {
@@ -85,6 +94,9 @@ bool ParseFileName(const std::string& fname,
   } else if (rest == "LOG" || rest == "LOG.old") {
     *number = 0;
     *type = kInfoLogFile;
+  } else if (rest == "REPAIR") {
+    *number = 0;
+    *type = kRepairFile;
   } else if (rest.starts_with("MANIFEST-")) {
     rest.remove_prefix(strlen("MANIFEST-"));
     uint64_t num;
@@ -110,6 +122,8 @@ bool ParseFileName(const std::string& fname,
       *type = kTableFile;
     } else if (suffix == Slice(".dbtmp")) {
       *type = kTempFile;
+    } else if (suffix == Slice(".blob")) {
+      *type = kBlobFile;
     } else {
       return false;
     }
@@ -24,7 +24,9 @@ enum FileType {
   kDescriptorFile,
   kCurrentFile,
   kTempFile,
-  kInfoLogFile  // Either the current one, or an old one
+  kInfoLogFile,  // Either the current one, or an old one
+  kRepairFile,
+  kBlobFile
 };
 
 // Return the name of the log file with the specified number
@@ -37,6 +39,10 @@ extern std::string LogFileName(const std::string& dbname, uint64_t number);
 // "dbname".
 extern std::string TableFileName(const std::string& dbname, uint64_t number);
 
+// Return the name of the blob file with the specified number in the db
+// named by "dbname".  The result will be prefixed with "dbname".
+extern std::string BlobFileName(const std::string& dbname, uint64_t number);
+
 // Return the name of the descriptor file for the db named by
 // "dbname" and the specified incarnation number.  The result will be
 // prefixed with "dbname".
@@ -52,6 +58,10 @@ extern std::string CurrentFileName(const std::string& dbname);
 // "dbname".  The result will be prefixed with "dbname".
 extern std::string LockFileName(const std::string& dbname);
 
+// Return the name of the file that records the progress of a repair of
+// the db named by "dbname".  The result will be prefixed with "dbname".
+extern std::string RepairFileName(const std::string& dbname);
+
 // Return the name of a temporary file owned by the db named "dbname".
 // The result will be prefixed with "dbname".
 extern std::string TempFileName(const std::string& dbname, uint64_t number);
@@ -20,9 +20,16 @@ enum RecordType {
   // For fragments
   kFirstType = 2,
   kMiddleType = 3,
-  kLastType = 4
+  kLastType = 4,
+
+  // Like kFullType and kFirstType, for records whose data is compressed
+  // and followed by the one byte CompressionType, as table blocks are.
+  // The middle and last fragments of a compressed record keep their
+  // usual types.
+  kCompressedFullType = 5,
+  kCompressedFirstType = 6
 };
-static const int kMaxRecordType = kLastType;
+static const int kMaxRecordType = kCompressedFirstType;
 
 static const int kBlockSize = 32768;
 
@@ -6,8 +6,10 @@
 
 #include <stdio.h>
 #include "leveldb/env.h"
+#include "table/format.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
+#include "util/huge_page.h"
 
 namespace leveldb {
 namespace log {
@@ -66,6 +68,7 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
   scratch->clear();
   record->clear();
   bool in_fragmented_record = false;
+  bool compressed_record = false;
   // Record offset of the logical record that we're reading
   // 0 is a dummy value to make compilers happy
   uint64_t prospective_record_offset = 0;
@@ -76,6 +79,7 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
     const unsigned int record_type = ReadPhysicalRecord(&fragment);
     switch (record_type) {
       case kFullType:
+      case kCompressedFullType:
         if (in_fragmented_record) {
           // Handle bug in earlier versions of log::Writer where
           // it could emit an empty kFirstType record at the tail end
@@ -90,10 +94,14 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
         prospective_record_offset = physical_record_offset;
         scratch->clear();
         *record = fragment;
+        if (record_type == kCompressedFullType && !Uncompress(record)) {
+          break;
+        }
         last_record_offset_ = prospective_record_offset;
         return true;
 
       case kFirstType:
+      case kCompressedFirstType:
         if (in_fragmented_record) {
           // Handle bug in earlier versions of log::Writer where
           // it could emit an empty kFirstType record at the tail end
@@ -108,6 +116,7 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
         prospective_record_offset = physical_record_offset;
         scratch->assign(fragment.data(), fragment.size());
         in_fragmented_record = true;
+        compressed_record = (record_type == kCompressedFirstType);
         break;
 
       case kMiddleType:
@@ -126,6 +135,11 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
         } else {
           scratch->append(fragment.data(), fragment.size());
           *record = Slice(*scratch);
+          in_fragmented_record = false;
+          if (compressed_record && !Uncompress(record)) {
+            scratch->clear();
+            break;
+          }
           last_record_offset_ = prospective_record_offset;
           return true;
         }
@@ -161,6 +175,26 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
   return false;
 }
 
+bool Reader::Uncompress(Slice* record) {
+  BlockContents contents;
+  Status s;
+  if (record->empty()) {
+    s = Status::Corruption("empty compressed record");
+  } else {
+    s = UncompressBlock(*record, NULL, Slice(), &contents, kNoHugePages);
+  }
+  if (!s.ok()) {
+    ReportDrop(record->size(), s);
+    return false;
+  }
+  uncompressed_.assign(contents.data.data(), contents.data.size());
+  if (contents.heap_allocated) {
+    DeleteBlockBuffer(contents.data.data());
+  }
+  *record = Slice(uncompressed_);
+  return true;
+}
+
 uint64_t Reader::LastRecordOffset() {
   return last_record_offset_;
 }
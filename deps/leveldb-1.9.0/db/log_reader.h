@@ -73,6 +73,9 @@ class Reader {
   // Offset at which to start looking for the first record to return
   uint64_t const initial_offset_;
 
+  // The uncompressed data of the last compressed record returned
+  std::string uncompressed_;
+
   // Extend record types with the following special values
   enum {
     kEof = kMaxRecordType + 1,
@@ -92,6 +95,10 @@ class Reader {
   // Return type, or one of the preceding special values
   unsigned int ReadPhysicalRecord(Slice* result);
 
+  // Replace the compressed data in *record with its uncompressed form in
+  // uncompressed_.  Returns false and reports a drop if it is corrupt.
+  bool Uncompress(Slice* record);
+
   // Reports dropped bytes to the reporter.
   // buffer_ must be updated to remove the dropped bytes prior to invocation.
   void ReportCorruption(size_t bytes, const char* reason);
@@ -5,10 +5,12 @@
 #include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "leveldb/env.h"
+#include "port/port.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
 #include "util/random.h"
 #include "util/testharness.h"
+#include "util/testutil.h"
 
 namespace leveldb {
 namespace log {
@@ -104,7 +106,7 @@ class LogTest {
   StringSource source_;
   ReportCollector report_;
   bool reading_;
-  Writer writer_;
+  Writer* writer_;
   Reader reader_;
 
   // Record metadata for testing initial offset functionality
@@ -113,14 +115,25 @@ class LogTest {
 
  public:
   LogTest() : reading_(false),
-              writer_(&dest_),
+              writer_(new Writer(&dest_)),
               reader_(&source_, &report_, true/*checksum*/,
                       0/*initial_offset*/) {
   }
 
+  ~LogTest() {
+    delete writer_;
+  }
+
+  // Compress the records written from now on with "type".
+  void SetCompression(CompressionType type) {
+    ASSERT_EQ(0, WrittenBytes()) << "SetCompression() after writing";
+    delete writer_;
+    writer_ = new Writer(&dest_, type);
+  }
+
   void Write(const std::string& msg) {
     ASSERT_TRUE(!reading_) << "Write() after starting to read";
-    writer_.AddRecord(Slice(msg));
+    writer_->AddRecord(Slice(msg));
   }
 
   size_t WrittenBytes() const {
@@ -351,6 +364,41 @@ TEST(LogTest, BadRecordType) {
   ASSERT_EQ("OK", MatchError("unknown record type"));
 }
 
+TEST(LogTest, CompressedRecords) {
+  // Records are written uncompressed if compression isn't supported.
+  std::string compressed;
+  const bool supported = port::Snappy_Compress("aaaaaaaaaa", 10, &compressed);
+  SetCompression(kSnappyCompression);
+  Random rnd(301);
+  std::string big;
+  test::CompressibleString(&rnd, 0.25, 3 * kBlockSize, &big);
+  Write("foo");
+  Write(big);
+  Write("");
+  Write(BigString("bar", 1000));
+  if (supported) {
+    ASSERT_LT(WrittenBytes(), 3 + big.size() / 2 + 1000 + 4 * kHeaderSize);
+  }
+  ASSERT_EQ("foo", Read());
+  ASSERT_EQ(big, Read());
+  ASSERT_EQ("", Read());
+  ASSERT_EQ(BigString("bar", 1000), Read());
+  ASSERT_EQ("EOF", Read());
+  ASSERT_EQ(0, DroppedBytes());
+}
+
+TEST(LogTest, BadCompressedRecord) {
+  Write("foo");
+  Write("bar");
+  // Mark the first record compressed with the unknown compression 'o'.
+  IncrementByte(6, kCompressedFullType - kFullType);
+  FixChecksum(0, 3);
+  ASSERT_EQ("bar", Read());
+  ASSERT_EQ("EOF", Read());
+  ASSERT_EQ(3, DroppedBytes());
+  ASSERT_EQ("OK", MatchError("bad block type"));
+}
+
 TEST(LogTest, TruncatedTrailingRecord) {
   Write("foo");
   ShrinkSize(4);   // Drop all payload as well as a header byte
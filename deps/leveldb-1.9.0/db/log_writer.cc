@@ -6,15 +6,17 @@
 
 #include <stdint.h>
 #include "leveldb/env.h"
+#include "table/block_compressor.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
 
 namespace leveldb {
 namespace log {
 
-Writer::Writer(WritableFile* dest)
+Writer::Writer(WritableFile* dest, CompressionType compression)
     : dest_(dest),
-      block_offset_(0) {
+      block_offset_(0),
+      compression_(compression) {
   for (int i = 0; i <= kMaxRecordType; i++) {
     char t = static_cast<char>(i);
     type_crc_[i] = crc32c::Value(&t, 1);
@@ -28,6 +30,21 @@ Status Writer::AddRecord(const Slice& slice) {
   const char* ptr = slice.data();
   size_t left = slice.size();
 
+  // Compressed records end with their compression type and start with a
+  // fragment of a type of their own.
+  bool compressed = false;
+  if (compression_ != kNoCompression && !slice.empty()) {
+    compressed_.clear();
+    CompressionType type;
+    CompressBlock(slice, compression_, Slice(), &compressed_, &type);
+    if (type != kNoCompression) {
+      compressed_.push_back(static_cast<char>(type));
+      ptr = compressed_.data();
+      left = compressed_.size();
+      compressed = true;
+    }
+  }
+
   // Fragment the record if necessary and emit it.  Note that if slice
   // is empty, we still want to iterate once to emit a single
   // zero-length record
@@ -55,9 +72,9 @@ Status Writer::AddRecord(const Slice& slice) {
     RecordType type;
     const bool end = (left == fragment_length);
     if (begin && end) {
-      type = kFullType;
+      type = compressed ? kCompressedFullType : kFullType;
     } else if (begin) {
-      type = kFirstType;
+      type = compressed ? kCompressedFirstType : kFirstType;
     } else if (end) {
       type = kLastType;
     } else {
@@ -69,6 +86,10 @@ Status Writer::AddRecord(const Slice& slice) {
     left -= fragment_length;
     begin = false;
   } while (s.ok() && left > 0);
+  if (compressed_.capacity() > 1048576) {
+    std::string empty;
+    compressed_.swap(empty);
+  }
   return s;
 }
 
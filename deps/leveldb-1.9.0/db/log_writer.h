@@ -6,7 +6,9 @@
 #define STORAGE_LEVELDB_DB_LOG_WRITER_H_
 
 #include <stdint.h>
+#include <string>
 #include "db/log_format.h"
+#include "leveldb/options.h"
 #include "leveldb/slice.h"
 #include "leveldb/status.h"
 
@@ -21,7 +23,10 @@ class Writer {
   // Create a writer that will append data to "*dest".
   // "*dest" must be initially empty.
   // "*dest" must remain live while this Writer is in use.
-  explicit Writer(WritableFile* dest);
+  // Records are compressed with "compression" when that saves at least
+  // 12.5% (see CompressBlock()).
+  explicit Writer(WritableFile* dest,
+                  CompressionType compression = kNoCompression);
   ~Writer();
 
   Status AddRecord(const Slice& slice);
@@ -29,6 +34,8 @@ class Writer {
  private:
   WritableFile* dest_;
   int block_offset_;       // Current offset in block
+  CompressionType compression_;
+  std::string compressed_;  // Scratch space for compressed records
 
   // crc32c values for all supported record types.  These are
   // pre-computed to reduce the overhead of computing the crc of the
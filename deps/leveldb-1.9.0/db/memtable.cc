@@ -4,6 +4,7 @@
 
 #include "db/memtable.h"
 #include "db/dbformat.h"
+#include "db/merge_helper.h"
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
@@ -18,17 +19,74 @@ static Slice GetLengthPrefixedSlice(const char* data) {
   return Slice(p, len);
 }
 
+MemTableOptions::MemTableOptions()
+    : arena_block_size(4096),
+      huge_pages(kNoHugePages),
+      rep(kSkipListRep),
+      prefix_extractor(NULL),
+      hash_buckets(1 << 14) {
+}
+
 MemTable::MemTable(const InternalKeyComparator& cmp)
     : comparator_(cmp),
       refs_(0),
-      table_(comparator_, &arena_) {
+      rep_(NewSkipListRep(comparator_, &arena_)),
+      range_dels_(NULL) {
+}
+
+MemTable::MemTable(const InternalKeyComparator& cmp,
+                   const MemTableOptions& options)
+    : comparator_(cmp),
+      refs_(0),
+      arena_(options.arena_block_size, options.huge_pages),
+      rep_(NULL),
+      range_dels_(NULL) {
+  switch (options.rep) {
+    case kVectorRep:
+      rep_ = NewVectorRep(comparator_);
+      break;
+    case kHashLinkListRep:
+      rep_ = NewHashLinkListRep(comparator_, &arena_,
+                                options.prefix_extractor,
+                                options.hash_buckets);
+      break;
+    default:
+      rep_ = NewSkipListRep(comparator_, &arena_);
+      break;
+  }
 }
 
 MemTable::~MemTable() {
   assert(refs_ == 0);
+  delete rep_;
 }
 
-size_t MemTable::ApproximateMemoryUsage() { return arena_.MemoryUsage(); }
+size_t MemTable::ApproximateMemoryUsage() {
+  return arena_.MemoryUsage() + rep_->ApproximateMemoryUsage();
+}
+
+void MemTable::MarkImmutable() { rep_->MarkImmutable(); }
+
+MemTable::KeyComparator::KeyComparator(const InternalKeyComparator& c)
+    : comparator(c),
+      bytewise(c.user_comparator() == BytewiseComparator()) {
+}
+
+uint64_t MemTable::KeyComparator::Prefix(const char* entry) const {
+  if (!bytewise) {
+    return 0;
+  }
+  Slice key = GetLengthPrefixedSlice(entry);
+  const size_t n = key.size() - 8;  // Without the sequence and type
+  uint64_t prefix = 0;
+  for (size_t i = 0; i < 8; i++) {
+    prefix <<= 8;
+    if (i < n) {
+      prefix |= static_cast<unsigned char>(key[i]);
+    }
+  }
+  return prefix;
+}
 
 int MemTable::KeyComparator::operator()(const char* aptr, const char* bptr)
     const {
@@ -50,24 +108,25 @@ static const char* EncodeKey(std::string* scratch, const Slice& target) {
 
 class MemTableIterator: public Iterator {
  public:
-  explicit MemTableIterator(MemTable::Table* table) : iter_(table) { }
-
-  virtual bool Valid() const { return iter_.Valid(); }
-  virtual void Seek(const Slice& k) { iter_.Seek(EncodeKey(&tmp_, k)); }
-  virtual void SeekToFirst() { iter_.SeekToFirst(); }
-  virtual void SeekToLast() { iter_.SeekToLast(); }
-  virtual void Next() { iter_.Next(); }
-  virtual void Prev() { iter_.Prev(); }
-  virtual Slice key() const { return GetLengthPrefixedSlice(iter_.key()); }
+  explicit MemTableIterator(MemTableRep* rep) : iter_(rep->NewIterator()) { }
+  virtual ~MemTableIterator() { delete iter_; }
+
+  virtual bool Valid() const { return iter_->Valid(); }
+  virtual void Seek(const Slice& k) { iter_->Seek(EncodeKey(&tmp_, k)); }
+  virtual void SeekToFirst() { iter_->SeekToFirst(); }
+  virtual void SeekToLast() { iter_->SeekToLast(); }
+  virtual void Next() { iter_->Next(); }
+  virtual void Prev() { iter_->Prev(); }
+  virtual Slice key() const { return GetLengthPrefixedSlice(iter_->key()); }
   virtual Slice value() const {
-    Slice key_slice = GetLengthPrefixedSlice(iter_.key());
+    Slice key_slice = GetLengthPrefixedSlice(iter_->key());
     return GetLengthPrefixedSlice(key_slice.data() + key_slice.size());
   }
 
   virtual Status status() const { return Status::OK(); }
 
  private:
-  MemTable::Table::Iterator iter_;
+  MemTableRep::Iterator* iter_;
   std::string tmp_;       // For passing to EncodeKey
 
   // No copying allowed
@@ -76,12 +135,17 @@ class MemTableIterator: public Iterator {
 };
 
 Iterator* MemTable::NewIterator() {
-  return new MemTableIterator(&table_);
+  return new MemTableIterator(rep_);
 }
 
-void MemTable::Add(SequenceNumber s, ValueType type,
-                   const Slice& key,
-                   const Slice& value) {
+size_t MemTable::EntryLength(const Slice& key, const Slice& value) {
+  size_t internal_key_size = key.size() + 8;
+  return VarintLength(internal_key_size) + internal_key_size +
+      VarintLength(value.size()) + value.size();
+}
+
+void MemTable::EncodeEntry(char* buf, SequenceNumber s, ValueType type,
+                           const Slice& key, const Slice& value) {
   // Format of an entry is concatenation of:
   //  key_size     : varint32 of internal_key.size()
   //  key bytes    : char[internal_key.size()]
@@ -90,10 +154,6 @@ void MemTable::Add(SequenceNumber s, ValueType type,
   size_t key_size = key.size();
   size_t val_size = value.size();
   size_t internal_key_size = key_size + 8;
-  const size_t encoded_len =
-      VarintLength(internal_key_size) + internal_key_size +
-      VarintLength(val_size) + val_size;
-  char* buf = arena_.Allocate(encoded_len);
   char* p = EncodeVarint32(buf, internal_key_size);
   memcpy(p, key.data(), key_size);
   p += key_size;
@@ -101,45 +161,171 @@ void MemTable::Add(SequenceNumber s, ValueType type,
   p += 8;
   p = EncodeVarint32(p, val_size);
   memcpy(p, value.data(), val_size);
-  assert((p + val_size) - buf == encoded_len);
-  table_.Insert(buf);
-}
-
-bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
-  Slice memkey = key.memtable_key();
-  Table::Iterator iter(&table_);
-  iter.Seek(memkey.data());
-  if (iter.Valid()) {
-    // entry format is:
-    //    klength  varint32
-    //    userkey  char[klength]
-    //    tag      uint64
-    //    vlength  varint32
-    //    value    char[vlength]
-    // Check that it belongs to same user key.  We do not check the
-    // sequence number since the Seek() call above should have skipped
-    // all entries with overly large sequence numbers.
-    const char* entry = iter.key();
-    uint32_t key_length;
-    const char* key_ptr = GetVarint32Ptr(entry, entry+5, &key_length);
-    if (comparator_.comparator.user_comparator()->Compare(
-            Slice(key_ptr, key_length - 8),
-            key.user_key()) == 0) {
-      // Correct user key
-      const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
-      switch (static_cast<ValueType>(tag & 0xff)) {
-        case kTypeValue: {
-          Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
-          value->assign(v.data(), v.size());
-          return true;
-        }
-        case kTypeDeletion:
-          *s = Status::NotFound(Slice());
-          return true;
-      }
+  assert((p + val_size) - buf == EntryLength(key, value));
+}
+
+void MemTable::Add(SequenceNumber s, ValueType type,
+                   const Slice& key,
+                   const Slice& value) {
+  if (type == kTypeRangeDeletion) {
+    AddRangeDeletion(s, key, value);
+    return;
+  }
+  char* buf = arena_.Allocate(EntryLength(key, value));
+  EncodeEntry(buf, s, type, key, value);
+  rep_->Insert(buf);
+}
+
+void MemTable::AddConcurrently(SequenceNumber s, ValueType type,
+                               const Slice& key,
+                               const Slice& value) {
+  if (type == kTypeRangeDeletion) {
+    AddRangeDeletionConcurrently(s, key, value);
+    return;
+  }
+  char* buf = arena_.AllocateConcurrently(EntryLength(key, value));
+  EncodeEntry(buf, s, type, key, value);
+  rep_->InsertConcurrently(buf);
+}
+
+MemTable::RangeDelNode* MemTable::NewRangeDelNode(bool concurrent,
+                                                  SequenceNumber s,
+                                                  const Slice& start,
+                                                  const Slice& end) {
+  const size_t bytes = sizeof(RangeDelNode) + start.size() + end.size();
+  char* mem = concurrent ? arena_.AllocateAlignedConcurrently(bytes)
+                         : arena_.AllocateAligned(bytes);
+  RangeDelNode* node = reinterpret_cast<RangeDelNode*>(mem);
+  char* p = mem + sizeof(RangeDelNode);
+  memcpy(p, start.data(), start.size());
+  memcpy(p + start.size(), end.data(), end.size());
+  node->sequence = s;
+  node->start = Slice(p, start.size());
+  node->end = Slice(p + start.size(), end.size());
+  return node;
+}
+
+void MemTable::AddRangeDeletion(SequenceNumber s, const Slice& start,
+                                const Slice& end) {
+  RangeDelNode* node = NewRangeDelNode(false, s, start, end);
+  node->next = reinterpret_cast<RangeDelNode*>(range_dels_.NoBarrier_Load());
+  range_dels_.Release_Store(node);
+}
+
+void MemTable::AddRangeDeletionConcurrently(SequenceNumber s,
+                                            const Slice& start,
+                                            const Slice& end) {
+  RangeDelNode* node = NewRangeDelNode(true, s, start, end);
+  do {
+    node->next = reinterpret_cast<RangeDelNode*>(range_dels_.Acquire_Load());
+  } while (!range_dels_.CompareAndSwap(node->next, node));
+}
+
+void MemTable::GetRangeDeletions(
+    std::vector<RangeTombstone>* tombstones) const {
+  for (const RangeDelNode* node =
+           reinterpret_cast<RangeDelNode*>(range_dels_.Acquire_Load());
+       node != NULL;
+       node = node->next) {
+    tombstones->push_back(
+        RangeTombstone(node->start, node->end, node->sequence));
+  }
+}
+
+SequenceNumber MemTable::MaxCoveringRangeDeletion(
+    const Slice& user_key, SequenceNumber snapshot) const {
+  const Comparator* ucmp = comparator_.comparator.user_comparator();
+  SequenceNumber result = 0;
+  for (const RangeDelNode* node =
+           reinterpret_cast<RangeDelNode*>(range_dels_.Acquire_Load());
+       node != NULL;
+       node = node->next) {
+    if (node->sequence <= snapshot && node->sequence > result &&
+        ucmp->Compare(user_key, node->start) >= 0 &&
+        ucmp->Compare(user_key, node->end) < 0) {
+      result = node->sequence;
     }
   }
-  return false;
+  return result;
+}
+
+namespace {
+struct GetState {
+  const Comparator* user_comparator;
+  Slice user_key;
+  std::string* value;
+  Status* status;
+  SequenceNumber* seq;
+  MergeContext* merge;
+  bool found;
+};
+}
+
+// Called on each entry at or after the key being looked up, until it
+// returns false.
+static bool SaveValue(void* arg, const char* entry) {
+  GetState* state = reinterpret_cast<GetState*>(arg);
+  // entry format is:
+  //    klength  varint32
+  //    userkey  char[klength]
+  //    tag      uint64
+  //    vlength  varint32
+  //    value    char[vlength]
+  // Check that it belongs to same user key.  We do not check the
+  // sequence number since the rep skipped all entries with overly
+  // large sequence numbers.
+  uint32_t key_length;
+  const char* key_ptr = GetVarint32Ptr(entry, entry+5, &key_length);
+  if (state->user_comparator->Compare(Slice(key_ptr, key_length - 8),
+                                      state->user_key) != 0) {
+    return false;
+  }
+  // Correct user key
+  const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+  if (state->seq != NULL) {
+    *state->seq = tag >> 8;
+  }
+  switch (static_cast<ValueType>(tag & 0xff)) {
+    case kTypeValue: {
+      Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
+      state->value->assign(v.data(), v.size());
+      state->found = true;
+      return false;
+    }
+    case kTypeDeletion:
+      *state->status = Status::NotFound(Slice());
+      state->found = true;
+      return false;
+    case kTypeMerge:
+      if (state->merge == NULL) {
+        *state->status =
+            Status::NotSupported("merge operand without a merge operator");
+        state->found = true;
+        return false;
+      }
+      // Keep looking for the value under the operand
+      state->merge->Add(tag >> 8,
+                        GetLengthPrefixedSlice(key_ptr + key_length));
+      return true;
+    default:
+      *state->status = Status::Corruption("unknown entry type in memtable");
+      state->found = true;
+      return false;
+  }
+}
+
+bool MemTable::Get(const LookupKey& key, std::string* value, Status* s,
+                   SequenceNumber* seq, MergeContext* merge) {
+  GetState state;
+  state.user_comparator = comparator_.comparator.user_comparator();
+  state.user_key = key.user_key();
+  state.value = value;
+  state.status = s;
+  state.seq = seq;
+  state.merge = merge;
+  state.found = false;
+  rep_->Get(key.memtable_key().data(), &state, &SaveValue);
+  return state.found;
 }
 
 }  // namespace leveldb
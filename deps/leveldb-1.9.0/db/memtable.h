@@ -6,16 +6,39 @@
 #define STORAGE_LEVELDB_DB_MEMTABLE_H_
 
 #include <string>
+#include <vector>
 #include "leveldb/db.h"
 #include "db/dbformat.h"
-#include "db/skiplist.h"
+#include "db/range_del.h"
 #include "util/arena.h"
 
 namespace leveldb {
 
 class InternalKeyComparator;
+struct MergeContext;
 class Mutex;
 class MemTableIterator;
+class MemTableRep;
+class SliceTransform;
+
+// How a memtable allocates and holds its entries.
+struct MemTableOptions {
+  // The arena allocates blocks of this many bytes, backed by huge pages
+  // as huge_pages asks.
+  size_t arena_block_size;
+  HugePages huge_pages;
+
+  // The representation that holds the entries.
+  MemTableRepType rep;
+
+  // For kHashLinkListRep: the transform that takes the prefix that
+  // entries are hashed by from user keys, or NULL to hash whole user
+  // keys, and the number of hash buckets.
+  const SliceTransform* prefix_extractor;
+  size_t hash_buckets;
+
+  MemTableOptions();
+};
 
 class MemTable {
  public:
@@ -23,6 +46,9 @@ class MemTable {
   // is zero and the caller must call Ref() at least once.
   explicit MemTable(const InternalKeyComparator& comparator);
 
+  MemTable(const InternalKeyComparator& comparator,
+           const MemTableOptions& options);
+
   // Increase reference count.
   void Ref() { ++refs_; }
 
@@ -42,6 +68,10 @@ class MemTable {
   // operations on the same MemTable.
   size_t ApproximateMemoryUsage();
 
+  // Tell the memtable that no more entries will be added, so that it
+  // can prepare for the reads made while it is flushed.
+  void MarkImmutable();
+
   // Return an iterator that yields the contents of the memtable.
   //
   // The caller must ensure that the underlying MemTable remains live
@@ -52,40 +82,168 @@ class MemTable {
 
   // Add an entry into memtable that maps key to value at the
   // specified sequence number and with the specified type.
-  // Typically value will be empty if type==kTypeDeletion.
+  // Typically value will be empty if type==kTypeDeletion.  If
+  // type==kTypeRangeDeletion, key and value are the start and end of the
+  // deleted range, which is kept apart from the other entries and is not
+  // yielded by NewIterator().
   void Add(SequenceNumber seq, ValueType type,
            const Slice& key,
            const Slice& value);
 
+  // Like Add(), but may be called from several threads at once.
+  // REQUIRES: no concurrent calls to Add().
+  void AddConcurrently(SequenceNumber seq, ValueType type,
+                       const Slice& key,
+                       const Slice& value);
+
   // If memtable contains a value for key, store it in *value and return true.
   // If memtable contains a deletion for key, store a NotFound() error
   // in *status and return true.
   // Else, return false.
-  bool Get(const LookupKey& key, std::string* value, Status* s);
+  // Merge operands above the value or deletion are added to *merge; if
+  // merge is NULL, an operand is returned as a NotSupported() error.
+  // If seq is non-NULL, it is set to the sequence number of the entry found.
+  // Range deletions are not consulted.
+  bool Get(const LookupKey& key, std::string* value, Status* s,
+           SequenceNumber* seq, MergeContext* merge);
+
+  // Returns true iff the memtable holds any range deletions.
+  bool HasRangeDeletions() const {
+    return range_dels_.Acquire_Load() != NULL;
+  }
 
- private:
-  ~MemTable();  // Private since only Unref() should be used to delete it
+  // Append the range deletions in the memtable to *tombstones.
+  void GetRangeDeletions(std::vector<RangeTombstone>* tombstones) const;
 
+  // Return the largest sequence number <= snapshot of a range deletion
+  // in the memtable that covers user_key, or zero if there is none.
+  SequenceNumber MaxCoveringRangeDeletion(const Slice& user_key,
+                                          SequenceNumber snapshot) const;
+
+  // Orders the entries of a memtable, which are length-prefixed internal
+  // keys followed by length-prefixed values.
   struct KeyComparator {
     const InternalKeyComparator comparator;
-    explicit KeyComparator(const InternalKeyComparator& c) : comparator(c) { }
+    const bool bytewise;  // Whether user keys are ordered bytewise
+    explicit KeyComparator(const InternalKeyComparator& c);
     int operator()(const char* a, const char* b) const;
+
+    // The first eight bytes of the user key, big-endian and padded with
+    // zeros, which orders entries bytewise.  Zero for other orders.
+    uint64_t Prefix(const char* entry) const;
   };
+
+ private:
+  ~MemTable();  // Private since only Unref() should be used to delete it
+
   friend class MemTableIterator;
-  friend class MemTableBackwardIterator;
 
-  typedef SkipList<const char*, KeyComparator> Table;
+  // Range deletions are few, so they are kept in a list in order of
+  // insertion, newest first.  Nodes live in arena_.
+  struct RangeDelNode {
+    SequenceNumber sequence;
+    Slice start;
+    Slice end;
+    RangeDelNode* next;
+  };
 
   KeyComparator comparator_;
   int refs_;
   Arena arena_;
-  Table table_;
+  MemTableRep* rep_;
+  port::AtomicPointer range_dels_;    // Head of the RangeDelNode list
+
+  RangeDelNode* NewRangeDelNode(bool concurrent, SequenceNumber s,
+                                const Slice& start, const Slice& end);
+  void AddRangeDeletion(SequenceNumber s, const Slice& start,
+                        const Slice& end);
+  void AddRangeDeletionConcurrently(SequenceNumber s, const Slice& start,
+                                    const Slice& end);
+
+  // Encode an entry into "buf", which holds EntryLength() bytes.
+  static size_t EntryLength(const Slice& key, const Slice& value);
+  static void EncodeEntry(char* buf, SequenceNumber s, ValueType type,
+                          const Slice& key, const Slice& value);
 
   // No copying allowed
   MemTable(const MemTable&);
   void operator=(const MemTable&);
 };
 
+// A MemTableRep holds the entries of a memtable in the order of its
+// KeyComparator.  Entries are allocated by the memtable and never
+// removed; a rep only keeps pointers to them.  Reads may run at the same
+// time as inserts, and the calls that insert follow the same rules as
+// MemTable::Add() and MemTable::AddConcurrently().
+class MemTableRep {
+ public:
+  MemTableRep() { }
+  virtual ~MemTableRep();
+
+  // Insert an entry.  Nothing equal to it may be in the rep.
+  virtual void Insert(const char* entry) = 0;
+  virtual void InsertConcurrently(const char* entry) = 0;
+
+  // Called once no more entries will be inserted.
+  virtual void MarkImmutable() { }
+
+  // Bytes of memory in use by the rep outside of the memtable's arena.
+  virtual size_t ApproximateMemoryUsage() { return 0; }
+
+  // Call callback(arg, entry) on the entries at or after "key", an entry
+  // or the memtable key of a LookupKey, in order, until it returns false
+  // or the entries with the user key of "key" run out.  Entries with
+  // other user keys may be passed before that.
+  virtual void Get(const char* key, void* arg,
+                   bool (*callback)(void* arg, const char* entry)) = 0;
+
+  // Iterates over the entries of a rep.  Like SkipList::Iterator, an
+  // iterator sees the entries inserted before it was created and may or
+  // may not see later ones.
+  class Iterator {
+   public:
+    Iterator() { }
+    virtual ~Iterator();
+    virtual bool Valid() const = 0;
+    virtual const char* key() const = 0;
+    virtual void Next() = 0;
+    virtual void Prev() = 0;
+    virtual void Seek(const char* target) = 0;
+    virtual void SeekToFirst() = 0;
+    virtual void SeekToLast() = 0;
+
+   private:
+    // No copying allowed
+    Iterator(const Iterator&);
+    void operator=(const Iterator&);
+  };
+
+  // Return an iterator over every entry of the rep.
+  virtual Iterator* NewIterator() = 0;
+
+ private:
+  // No copying allowed
+  MemTableRep(const MemTableRep&);
+  void operator=(const MemTableRep&);
+};
+
+// Return a rep that keeps its entries in a skiplist allocated from
+// "arena".
+extern MemTableRep* NewSkipListRep(const MemTable::KeyComparator& cmp,
+                                   Arena* arena);
+
+// Return a rep that appends entries to an array and sorts it before it
+// is read.
+extern MemTableRep* NewVectorRep(const MemTable::KeyComparator& cmp);
+
+// Return a rep that hashes entries into "buckets" sorted lists allocated
+// from "arena", by the prefix that "prefix_extractor" takes from their
+// user keys or by the whole user key if it is NULL.
+extern MemTableRep* NewHashLinkListRep(const MemTable::KeyComparator& cmp,
+                                       Arena* arena,
+                                       const SliceTransform* prefix_extractor,
+                                       size_t buckets);
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_DB_MEMTABLE_H_
@@ -0,0 +1,370 @@
+// Copyright (c) 2013 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <algorithm>
+#include <new>
+#include <vector>
+#include "db/memtable.h"
+#include "db/skiplist.h"
+#include "leveldb/slice_transform.h"
+#include "port/port.h"
+#include "util/arena.h"
+#include "util/coding.h"
+#include "util/hash.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+MemTableRep::~MemTableRep() { }
+
+MemTableRep::Iterator::~Iterator() { }
+
+namespace {
+
+typedef MemTable::KeyComparator KeyComparator;
+
+class SkipListRep : public MemTableRep {
+ private:
+  typedef SkipList<const char*, KeyComparator> Table;
+
+ public:
+  SkipListRep(const KeyComparator& cmp, Arena* arena)
+      : table_(cmp, arena) {
+  }
+
+  virtual void Insert(const char* entry) { table_.Insert(entry); }
+
+  virtual void InsertConcurrently(const char* entry) {
+    table_.InsertConcurrently(entry);
+  }
+
+  virtual void Get(const char* key, void* arg,
+                   bool (*callback)(void* arg, const char* entry)) {
+    Table::Iterator iter(&table_);
+    for (iter.Seek(key); iter.Valid() && (*callback)(arg, iter.key());
+         iter.Next()) {
+    }
+  }
+
+  class Iterator : public MemTableRep::Iterator {
+   public:
+    explicit Iterator(const Table* table) : iter_(table) { }
+    virtual bool Valid() const { return iter_.Valid(); }
+    virtual const char* key() const { return iter_.key(); }
+    virtual void Next() { iter_.Next(); }
+    virtual void Prev() { iter_.Prev(); }
+    virtual void Seek(const char* target) { iter_.Seek(target); }
+    virtual void SeekToFirst() { iter_.SeekToFirst(); }
+    virtual void SeekToLast() { iter_.SeekToLast(); }
+
+   private:
+    Table::Iterator iter_;
+  };
+
+  virtual MemTableRep::Iterator* NewIterator() {
+    return new Iterator(&table_);
+  }
+
+ private:
+  Table table_;
+};
+
+struct EntryLess {
+  const KeyComparator& compare;
+  explicit EntryLess(const KeyComparator& c) : compare(c) { }
+  bool operator()(const char* a, const char* b) const {
+    return compare(a, b) < 0;
+  }
+};
+
+// Iterates over a sorted array of entries.  The array is either shared
+// with a rep that no longer changes it or a copy owned by the iterator.
+class SortedIterator : public MemTableRep::Iterator {
+ public:
+  // Iterate over *shared, or over copy() if shared is NULL.
+  SortedIterator(const KeyComparator& cmp,
+                 const std::vector<const char*>* shared)
+      : compare_(cmp),
+        entries_(shared != NULL ? shared : &copy_),
+        pos_(kInvalid) {
+  }
+
+  // The entries to iterate over, to be filled in and sorted before the
+  // iterator is used.
+  std::vector<const char*>* copy() { return &copy_; }
+
+  virtual bool Valid() const { return pos_ < entries_->size(); }
+
+  virtual const char* key() const {
+    assert(Valid());
+    return (*entries_)[pos_];
+  }
+
+  virtual void Next() {
+    assert(Valid());
+    pos_++;
+  }
+
+  virtual void Prev() {
+    assert(Valid());
+    pos_ = (pos_ == 0) ? kInvalid : pos_ - 1;
+  }
+
+  virtual void Seek(const char* target) {
+    pos_ = std::lower_bound(entries_->begin(), entries_->end(), target,
+                            EntryLess(compare_)) - entries_->begin();
+  }
+
+  virtual void SeekToFirst() { pos_ = 0; }
+
+  virtual void SeekToLast() {
+    pos_ = entries_->empty() ? kInvalid : entries_->size() - 1;
+  }
+
+ private:
+  static const size_t kInvalid = ~static_cast<size_t>(0);
+
+  const KeyComparator& compare_;
+  std::vector<const char*> copy_;
+  const std::vector<const char*>* entries_;
+  size_t pos_;  // Not valid if >= entries_->size()
+};
+
+// Entries are appended to an array, and the entries appended since the
+// last read are sorted and merged into the rest before the next one.
+// Reads of a rep that is still written hold mu_ or copy the array.  Once
+// the rep is immutable the array no longer changes and is read without
+// the lock.
+class VectorRep : public MemTableRep {
+ public:
+  explicit VectorRep(const KeyComparator& cmp)
+      : compare_(cmp),
+        sorted_(0),
+        immutable_(false) {
+  }
+
+  virtual void Insert(const char* entry) {
+    MutexLock l(&mu_);
+    assert(!immutable_);
+    entries_.push_back(entry);
+  }
+
+  virtual void InsertConcurrently(const char* entry) { Insert(entry); }
+
+  virtual void MarkImmutable() {
+    MutexLock l(&mu_);
+    SortLocked();
+    immutable_ = true;
+  }
+
+  virtual size_t ApproximateMemoryUsage() {
+    MutexLock l(&mu_);
+    return entries_.capacity() * sizeof(const char*);
+  }
+
+  virtual void Get(const char* key, void* arg,
+                   bool (*callback)(void* arg, const char* entry)) {
+    mu_.Lock();
+    SortLocked();
+    const bool immutable = immutable_;
+    if (immutable) {
+      mu_.Unlock();
+    }
+    std::vector<const char*>::const_iterator iter =
+        std::lower_bound(entries_.begin(), entries_.end(), key,
+                         EntryLess(compare_));
+    for (; iter != entries_.end() && (*callback)(arg, *iter); ++iter) {
+    }
+    if (!immutable) {
+      mu_.Unlock();
+    }
+  }
+
+  virtual MemTableRep::Iterator* NewIterator() {
+    MutexLock l(&mu_);
+    SortLocked();
+    if (immutable_) {
+      return new SortedIterator(compare_, &entries_);
+    }
+    SortedIterator* iter = new SortedIterator(compare_, NULL);
+    iter->copy()->assign(entries_.begin(), entries_.end());
+    return iter;
+  }
+
+ private:
+  const KeyComparator& compare_;
+  port::Mutex mu_;
+  std::vector<const char*> entries_;
+  size_t sorted_;    // entries_[0, sorted_) are in order
+  bool immutable_;
+
+  // REQUIRES: mu_ held
+  void SortLocked() {
+    if (sorted_ < entries_.size()) {
+      EntryLess less(compare_);
+      std::sort(entries_.begin() + sorted_, entries_.end(), less);
+      std::inplace_merge(entries_.begin(), entries_.begin() + sorted_,
+                         entries_.end(), less);
+      sorted_ = entries_.size();
+    }
+  }
+};
+
+// Entries are hashed into buckets, each a sorted linked list that is
+// written like a single level of a SkipList: readers need no lock, and
+// concurrent inserts link their nodes in with a compare-and-swap.
+class HashLinkListRep : public MemTableRep {
+ public:
+  HashLinkListRep(const KeyComparator& cmp, Arena* arena,
+                  const SliceTransform* prefix_extractor, size_t buckets)
+      : compare_(cmp),
+        arena_(arena),
+        prefix_extractor_(prefix_extractor),
+        num_buckets_(std::max(buckets, static_cast<size_t>(1))),
+        immutable_(false),
+        sorted_valid_(false) {
+    char* mem = arena_->AllocateAligned(
+        sizeof(port::AtomicPointer) * num_buckets_);
+    buckets_ = reinterpret_cast<port::AtomicPointer*>(mem);
+    for (size_t i = 0; i < num_buckets_; i++) {
+      new (&buckets_[i]) port::AtomicPointer(NULL);
+    }
+  }
+
+  virtual void Insert(const char* entry) {
+    char* mem = arena_->AllocateAligned(sizeof(Node));
+    Node* node = new (mem) Node(entry);
+    port::AtomicPointer* link = Bucket(entry);
+    Node* next = FindGreaterOrEqual(entry, &link);
+    assert(next == NULL || compare_(next->entry, entry) != 0);
+    node->next.NoBarrier_Store(next);
+    link->Release_Store(node);
+  }
+
+  virtual void InsertConcurrently(const char* entry) {
+    char* mem = arena_->AllocateAlignedConcurrently(sizeof(Node));
+    Node* node = new (mem) Node(entry);
+    port::AtomicPointer* link = Bucket(entry);
+    Node* next;
+    do {
+      // Nodes inserted by other threads after a failed swap follow the
+      // node that "link" belongs to, so the search picks up from there.
+      next = FindGreaterOrEqual(entry, &link);
+      node->next.NoBarrier_Store(next);
+    } while (!link->CompareAndSwap(next, node));
+  }
+
+  virtual void MarkImmutable() {
+    MutexLock l(&mu_);
+    immutable_ = true;
+  }
+
+  virtual size_t ApproximateMemoryUsage() {
+    MutexLock l(&mu_);
+    return sorted_.capacity() * sizeof(const char*);
+  }
+
+  virtual void Get(const char* key, void* arg,
+                   bool (*callback)(void* arg, const char* entry)) {
+    port::AtomicPointer* link = Bucket(key);
+    for (Node* node = FindGreaterOrEqual(key, &link);
+         node != NULL && (*callback)(arg, node->entry);
+         node = node->Next()) {
+    }
+  }
+
+  virtual MemTableRep::Iterator* NewIterator() {
+    MutexLock l(&mu_);
+    if (immutable_) {
+      // Sort the entries once for every iterator of the flush.
+      if (!sorted_valid_) {
+        Collect(&sorted_);
+        sorted_valid_ = true;
+      }
+      return new SortedIterator(compare_, &sorted_);
+    }
+    SortedIterator* iter = new SortedIterator(compare_, NULL);
+    Collect(iter->copy());
+    return iter;
+  }
+
+ private:
+  struct Node {
+    const char* const entry;
+    port::AtomicPointer next;
+
+    explicit Node(const char* e) : entry(e) { }
+    Node* Next() const {
+      return reinterpret_cast<Node*>(next.Acquire_Load());
+    }
+  };
+
+  const KeyComparator& compare_;
+  Arena* const arena_;
+  const SliceTransform* const prefix_extractor_;
+  const size_t num_buckets_;
+  port::AtomicPointer* buckets_;   // Heads of the lists, in arena_
+
+  port::Mutex mu_;
+  bool immutable_;
+  bool sorted_valid_;
+  std::vector<const char*> sorted_;  // Every entry once immutable_
+
+  // Return the head of the list that holds entries with the user key of
+  // "entry".
+  port::AtomicPointer* Bucket(const char* entry) const {
+    uint32_t len;
+    const char* p = GetVarint32Ptr(entry, entry + 5, &len);
+    Slice key(p, len - 8);
+    if (prefix_extractor_ != NULL && prefix_extractor_->InDomain(key)) {
+      key = prefix_extractor_->Transform(key);
+    }
+    return &buckets_[Hash(key.data(), key.size(), 0) % num_buckets_];
+  }
+
+  // Return the first node at or after *link that is >= key, or NULL if
+  // there is none, and set *link to the link that points to it.
+  Node* FindGreaterOrEqual(const char* key,
+                           port::AtomicPointer** link) const {
+    for (;;) {
+      Node* next = reinterpret_cast<Node*>((*link)->Acquire_Load());
+      if (next == NULL || compare_(next->entry, key) >= 0) {
+        return next;
+      }
+      *link = &next->next;
+    }
+  }
+
+  // Store every entry in *entries, in order.
+  void Collect(std::vector<const char*>* entries) const {
+    for (size_t i = 0; i < num_buckets_; i++) {
+      for (Node* node = reinterpret_cast<Node*>(buckets_[i].Acquire_Load());
+           node != NULL;
+           node = node->Next()) {
+        entries->push_back(node->entry);
+      }
+    }
+    std::sort(entries->begin(), entries->end(), EntryLess(compare_));
+  }
+};
+
+}  // namespace
+
+MemTableRep* NewSkipListRep(const MemTable::KeyComparator& cmp,
+                            Arena* arena) {
+  return new SkipListRep(cmp, arena);
+}
+
+MemTableRep* NewVectorRep(const MemTable::KeyComparator& cmp) {
+  return new VectorRep(cmp);
+}
+
+MemTableRep* NewHashLinkListRep(const MemTable::KeyComparator& cmp,
+                                Arena* arena,
+                                const SliceTransform* prefix_extractor,
+                                size_t buckets) {
+  return new HashLinkListRep(cmp, arena, prefix_extractor, buckets);
+}
+
+}  // namespace leveldb
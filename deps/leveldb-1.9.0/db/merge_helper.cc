@@ -0,0 +1,45 @@
+// Copyright (c) 2013 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/merge_helper.h"
+
+#include "leveldb/merge_operator.h"
+
+namespace leveldb {
+
+Status ApplyMergeOperands(const MergeOperator* merge_operator,
+                          const Slice& user_key,
+                          const std::vector<std::string>& operands,
+                          bool found,
+                          std::string* value) {
+  if (merge_operator == NULL) {
+    return Status::NotSupported("merge operand without a merge operator");
+  }
+  if (operands.empty()) {
+    return Status::OK();
+  }
+
+  // Combine the operands before applying them so that a large value is
+  // only copied once.  The operator is associative so this is the same
+  // as applying them one at a time.
+  std::string combined = operands.back();
+  std::string result;
+  for (size_t i = operands.size() - 1; i > 0; i--) {
+    Slice existing(combined);
+    if (!merge_operator->Merge(user_key, &existing, operands[i - 1],
+                               &result)) {
+      return Status::Corruption("merge failed for ", user_key);
+    }
+    combined.swap(result);
+  }
+  Slice existing(*value);
+  if (!merge_operator->Merge(user_key, found ? &existing : NULL, combined,
+                             &result)) {
+    return Status::Corruption("merge failed for ", user_key);
+  }
+  value->swap(result);
+  return Status::OK();
+}
+
+}  // namespace leveldb
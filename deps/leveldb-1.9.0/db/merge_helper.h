@@ -0,0 +1,55 @@
+// Copyright (c) 2013 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// Merge operands are stored as entries of type kTypeMerge above the value
+// of their key.  Reads collect the operands of a key from the newest down
+// to its value, a deletion or the oldest entry, and apply them from the
+// oldest up (see MergeOperator).
+
+#ifndef STORAGE_LEVELDB_DB_MERGE_HELPER_H_
+#define STORAGE_LEVELDB_DB_MERGE_HELPER_H_
+
+#include <string>
+#include <vector>
+#include "db/dbformat.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class MergeOperator;
+
+// Store in "*value" the result of applying "operands", which are ordered
+// newest first, to the value in "*value" if "found" is true or to no value
+// otherwise.
+extern Status ApplyMergeOperands(const MergeOperator* merge_operator,
+                                 const Slice& user_key,
+                                 const std::vector<std::string>& operands,
+                                 bool found,
+                                 std::string* value);
+
+// The merge operands that a point lookup found above the value of its key.
+struct MergeContext {
+  std::vector<std::string> operands;      // Newest first
+  std::vector<SequenceNumber> sequences;  // Sequence of each operand
+
+  void Add(SequenceNumber sequence, const Slice& operand) {
+    operands.push_back(operand.ToString());
+    sequences.push_back(sequence);
+  }
+
+  // Drop the operands older than "sequence", such as the ones hidden by a
+  // range deletion.
+  void DropBefore(SequenceNumber sequence) {
+    while (!sequences.empty() && sequences.back() < sequence) {
+      operands.pop_back();
+      sequences.pop_back();
+    }
+  }
+
+  bool empty() const { return operands.empty(); }
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_MERGE_HELPER_H_
@@ -0,0 +1,119 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/range_del.h"
+
+#include <algorithm>
+#include <functional>
+#include "leveldb/comparator.h"
+
+namespace leveldb {
+
+namespace {
+struct UserKeyLess {
+  const Comparator* ucmp;
+  explicit UserKeyLess(const Comparator* c) : ucmp(c) { }
+  bool operator()(const std::string& a, const std::string& b) const {
+    return ucmp->Compare(a, b) < 0;
+  }
+};
+}  // namespace
+
+void RangeDelMap::Build(const std::vector<RangeTombstone>& tombstones) {
+  fragments_.clear();
+
+  // Every start and end key is a fragment boundary
+  std::vector<std::string> bounds;
+  for (size_t i = 0; i < tombstones.size(); i++) {
+    const RangeTombstone& t = tombstones[i];
+    if (ucmp_->Compare(t.start, t.end) < 0) {
+      bounds.push_back(t.start);
+      bounds.push_back(t.end);
+    }
+  }
+  if (bounds.empty()) {
+    return;
+  }
+  UserKeyLess less(ucmp_);
+  std::sort(bounds.begin(), bounds.end(), less);
+  size_t n = 1;
+  for (size_t i = 1; i < bounds.size(); i++) {
+    if (ucmp_->Compare(bounds[i], bounds[n - 1]) != 0) {
+      bounds[n++].swap(bounds[i]);
+    }
+  }
+  bounds.resize(n);
+
+  std::vector<Fragment> fragments(n - 1);
+  for (size_t i = 0; i + 1 < n; i++) {
+    fragments[i].start.swap(bounds[i]);
+    fragments[i].end = bounds[i + 1];
+  }
+
+  // Record each tombstone in the fragments it spans
+  for (size_t i = 0; i < tombstones.size(); i++) {
+    const RangeTombstone& t = tombstones[i];
+    if (ucmp_->Compare(t.start, t.end) >= 0) {
+      continue;
+    }
+    // The fragments are contiguous, so one starts exactly at t.start
+    size_t left = 0;
+    size_t right = fragments.size();
+    while (left < right) {
+      size_t mid = (left + right) / 2;
+      if (ucmp_->Compare(fragments[mid].start, t.start) < 0) {
+        left = mid + 1;
+      } else {
+        right = mid;
+      }
+    }
+    for (size_t f = left;
+         f < fragments.size() && ucmp_->Compare(fragments[f].end, t.end) <= 0;
+         f++) {
+      fragments[f].sequences.push_back(t.sequence);
+    }
+  }
+
+  for (size_t f = 0; f < fragments.size(); f++) {
+    Fragment* frag = &fragments[f];
+    if (!frag->sequences.empty()) {
+      std::sort(frag->sequences.begin(), frag->sequences.end(),
+                std::greater<SequenceNumber>());
+      fragments_.push_back(Fragment());
+      fragments_.back().start.swap(frag->start);
+      fragments_.back().end.swap(frag->end);
+      fragments_.back().sequences.swap(frag->sequences);
+    }
+  }
+}
+
+SequenceNumber RangeDelMap::MaxCoveringSequence(
+    const Slice& user_key, SequenceNumber snapshot) const {
+  // Find the last fragment that starts at or before user_key
+  size_t left = 0;
+  size_t right = fragments_.size();
+  while (left < right) {
+    size_t mid = (left + right) / 2;
+    if (ucmp_->Compare(fragments_[mid].start, user_key) <= 0) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  if (left == 0) {
+    return 0;
+  }
+  const Fragment& frag = fragments_[left - 1];
+  if (ucmp_->Compare(user_key, frag.end) >= 0) {
+    return 0;
+  }
+  for (size_t i = 0; i < frag.sequences.size(); i++) {
+    if (frag.sequences[i] <= snapshot) {
+      return frag.sequences[i];
+    }
+  }
+  return 0;
+}
+
+}  // namespace leveldb
@@ -0,0 +1,71 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A range tombstone deletes every key in [start, end) written before it,
+// i.e. every entry whose sequence number is smaller than the tombstone's.
+// Tombstones are not stored next to the keys they delete: a memtable keeps
+// its tombstones in a list of their own, and flushing the memtable moves
+// them into the current Version, which records them in the MANIFEST.
+
+#ifndef STORAGE_LEVELDB_DB_RANGE_DEL_H_
+#define STORAGE_LEVELDB_DB_RANGE_DEL_H_
+
+#include <string>
+#include <vector>
+#include "db/dbformat.h"
+
+namespace leveldb {
+
+struct RangeTombstone {
+  std::string start;          // First user key deleted
+  std::string end;            // First user key past the deleted range
+  SequenceNumber sequence;
+
+  RangeTombstone() : sequence(0) { }
+  RangeTombstone(const Slice& s, const Slice& e, SequenceNumber seq)
+      : start(s.data(), s.size()), end(e.data(), e.size()), sequence(seq) { }
+};
+
+// An index over a fixed set of range tombstones that answers, for a user
+// key, which tombstones cover it.  The tombstones are cut at every start
+// and end key into disjoint fragments, so a lookup is a binary search.
+//
+// Multiple threads can invoke const methods on a RangeDelMap without
+// external synchronization.
+class RangeDelMap {
+ public:
+  explicit RangeDelMap(const Comparator* ucmp) : ucmp_(ucmp) { }
+
+  // Replace the contents of the map with "tombstones".
+  void Build(const std::vector<RangeTombstone>& tombstones);
+
+  bool empty() const { return fragments_.empty(); }
+
+  // Return the largest sequence number <= "snapshot" of a tombstone that
+  // covers "user_key", or zero if there is none.
+  SequenceNumber MaxCoveringSequence(const Slice& user_key,
+                                     SequenceNumber snapshot) const;
+
+  // Returns true iff the entry for "user_key" at "sequence" is deleted by
+  // a tombstone visible at "snapshot".
+  bool ShouldDelete(const Slice& user_key, SequenceNumber sequence,
+                    SequenceNumber snapshot) const {
+    return !fragments_.empty() &&
+           MaxCoveringSequence(user_key, snapshot) > sequence;
+  }
+
+ private:
+  struct Fragment {
+    std::string start;
+    std::string end;
+    std::vector<SequenceNumber> sequences;  // Decreasing
+  };
+
+  const Comparator* ucmp_;
+  std::vector<Fragment> fragments_;   // Sorted and disjoint
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_RANGE_DEL_H_
@@ -6,7 +6,7 @@
 // (1) Any log files are first converted to tables
 // (2) We scan every table to compute
 //     (a) smallest/largest for the table
-//     (b) largest sequence number in the table
+//     (b) smallest and largest sequence number in the table
 // (3) We generate descriptor contents:
 //      - log number is set to zero
 //      - next-file-number is set to 1 + largest file number we found
@@ -14,6 +14,15 @@
 //        all tables (see 2c)
 //      - compaction pointers are cleared
 //      - every table file is added at level 0
+//      - range deletions found in the logs are kept; those recorded
+//        only in the old descriptor are lost
+//
+// Logs are converted, and tables scanned, on options.repair_threads
+// threads.  Each converted log and scanned table is recorded in the
+// REPAIR file, so a repair that is interrupted picks up where it left
+// off: converted logs were archived, and their range deletions are read
+// back, and scanned tables are not scanned again.  The file is removed
+// once the new descriptor is installed.
 //
 // Possible optimization 1:
 //   (a) Compute total size and use to pick appropriate max-level M
@@ -24,6 +33,8 @@
 //   Store per-table metadata (smallest, largest, largest-seq#, ...)
 //   in the table's meta section to speed up ScanTable.
 
+#include <algorithm>
+#include <map>
 #include "db/builder.h"
 #include "db/db_impl.h"
 #include "db/dbformat.h"
@@ -37,6 +48,9 @@
 #include "leveldb/comparator.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "port/port.h"
+#include "util/coding.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
@@ -49,15 +63,21 @@ class Repairer {
         env_(options.env),
         icmp_(options.comparator),
         ipolicy_(options.filter_policy),
-        options_(SanitizeOptions(dbname, &icmp_, &ipolicy_, options)),
+        iprefix_(options.prefix_extractor),
+        options_(SanitizeOptions(dbname, &icmp_, &ipolicy_, &iprefix_,
+                                 options)),
         owns_info_log_(options_.info_log != options.info_log),
         owns_cache_(options_.block_cache != options.block_cache),
-        next_file_number_(1) {
+        next_file_number_(1),
+        checkpoint_file_(NULL),
+        checkpoint_log_(NULL) {
     // TableCache can be small since we expect each table to be opened once.
-    table_cache_ = new TableCache(dbname_, &options_, 10);
+    table_cache_ = new TableCache(dbname_, &options_,
+                                  10 + options_.repair_threads);
   }
 
   ~Repairer() {
+    CloseCheckpoint();
     delete table_cache_;
     if (owns_info_log_) {
       delete options_.info_log;
@@ -69,12 +89,17 @@ class Repairer {
 
   Status Run() {
     Status status = FindFiles();
+    if (status.ok()) {
+      status = OpenCheckpoint();
+    }
     if (status.ok()) {
       ConvertLogFilesToTables();
       ExtractMetaData();
       status = WriteDescriptor();
     }
     if (status.ok()) {
+      CloseCheckpoint();
+      env_->DeleteFile(RepairFileName(dbname_));
       unsigned long long bytes = 0;
       for (size_t i = 0; i < tables_.size(); i++) {
         bytes += tables_[i].meta.file_size;
@@ -97,10 +122,17 @@ class Repairer {
     SequenceNumber max_sequence;
   };
 
+  // Tags of the records of the REPAIR file.
+  enum CheckpointTag {
+    kScannedTable = 1,
+    kConvertedLog = 2
+  };
+
   std::string const dbname_;
   Env* const env_;
   InternalKeyComparator const icmp_;
   InternalFilterPolicy const ipolicy_;
+  InternalSliceTransform const iprefix_;
   Options const options_;
   bool owns_info_log_;
   bool owns_cache_;
@@ -109,10 +141,198 @@ class Repairer {
 
   std::vector<std::string> manifests_;
   std::vector<uint64_t> table_numbers_;
+  std::vector<uint64_t> blob_numbers_;
   std::vector<uint64_t> logs_;
   std::vector<TableInfo> tables_;
+  std::vector<TableInfo> scanned_tables_;  // By index in table_numbers_
+  std::vector<bool> scanned_ok_;
+  std::vector<RangeTombstone> range_dels_;
   uint64_t next_file_number_;
 
+  // Tables scanned by an interrupted repair, by number
+  std::map<uint64_t, TableInfo> scanned_;
+
+  // Guards the members above and the checkpoint while logs are converted
+  // and tables scanned in parallel
+  port::Mutex mu_;
+  WritableFile* checkpoint_file_;
+  log::Writer* checkpoint_log_;
+
+  // Call (this->*work)(i) for every i in [0, n), on up to
+  // options_.repair_threads threads including the calling one.
+  struct Parallel {
+    Repairer* repairer;
+    void (Repairer::*work)(size_t);
+    size_t n;
+    size_t next;
+    int running;
+    port::Mutex mu;
+    port::CondVar cv;
+    Parallel() : cv(&mu) { }
+  };
+
+  void RunParallel(size_t n, void (Repairer::*work)(size_t)) {
+    Parallel p;
+    p.repairer = this;
+    p.work = work;
+    p.n = n;
+    p.next = 0;
+    p.running = 1;
+    const int threads = std::min<size_t>(options_.repair_threads, n);
+    for (int i = 1; i < threads; i++) {
+      p.running++;
+      env_->StartThread(&Repairer::ParallelWorker, &p);
+    }
+    ParallelWorker(&p);
+    MutexLock l(&p.mu);
+    while (p.running > 0) {
+      p.cv.Wait();
+    }
+  }
+
+  static void ParallelWorker(void* arg) {
+    Parallel* p = reinterpret_cast<Parallel*>(arg);
+    p->mu.Lock();
+    while (p->next < p->n) {
+      const size_t i = p->next++;
+      p->mu.Unlock();
+      (p->repairer->*p->work)(i);
+      p->mu.Lock();
+    }
+    p->running--;
+    p->cv.SignalAll();
+    p->mu.Unlock();
+  }
+
+  // Read the progress recorded by an interrupted repair, if any, and start
+  // a new REPAIR file that holds it.
+  Status OpenCheckpoint() {
+    std::vector<std::string> records;
+    const std::string fname = RepairFileName(dbname_);
+    if (env_->FileExists(fname)) {
+      Status status = ReadCheckpoint(fname, &records);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+
+    // The records are written to a new file that replaces the old one, so
+    // that they are never lost to an interrupted rewrite.
+    const std::string tmp = TempFileName(dbname_, 2);
+    Status status = env_->NewWritableFile(tmp, &checkpoint_file_);
+    if (!status.ok()) {
+      return status;
+    }
+    checkpoint_log_ = new log::Writer(checkpoint_file_);
+    for (size_t i = 0; i < records.size() && status.ok(); i++) {
+      status = checkpoint_log_->AddRecord(records[i]);
+    }
+    if (status.ok()) {
+      status = checkpoint_file_->Sync();
+    }
+    if (status.ok()) {
+      status = env_->RenameFile(tmp, fname);
+    }
+    if (!status.ok()) {
+      CloseCheckpoint();
+      env_->DeleteFile(tmp);
+    }
+    return status;
+  }
+
+  Status ReadCheckpoint(const std::string& fname,
+                        std::vector<std::string>* records) {
+    struct CheckpointReporter : public log::Reader::Reporter {
+      Logger* info_log;
+      virtual void Corruption(size_t bytes, const Status& s) {
+        Log(info_log, "REPAIR: dropping %d bytes; %s",
+            static_cast<int>(bytes), s.ToString().c_str());
+      }
+    };
+
+    SequentialFile* file;
+    Status status = env_->NewSequentialFile(fname, &file);
+    if (!status.ok()) {
+      return status;
+    }
+    CheckpointReporter reporter;
+    reporter.info_log = options_.info_log;
+    log::Reader reader(file, &reporter, true/*checksum*/, 0/*initial_offset*/);
+    std::string scratch;
+    Slice record;
+    int tables = 0;
+    int logs = 0;
+    while (reader.ReadRecord(&record, &scratch)) {
+      Slice input = record;
+      if (input.empty()) {
+        continue;
+      }
+      const int tag = input[0];
+      input.remove_prefix(1);
+      if (tag == kScannedTable) {
+        TableInfo t;
+        Slice smallest, largest;
+        if (GetVarint64(&input, &t.meta.number) &&
+            GetVarint64(&input, &t.meta.file_size) &&
+            GetLengthPrefixedSlice(&input, &smallest) &&
+            GetLengthPrefixedSlice(&input, &largest) &&
+            GetVarint64(&input, &t.meta.smallest_seq) &&
+            GetVarint64(&input, &t.max_sequence)) {
+          t.meta.smallest.DecodeFrom(smallest);
+          t.meta.largest.DecodeFrom(largest);
+          scanned_[t.meta.number] = t;
+          records->push_back(record.ToString());
+          tables++;
+        }
+      } else if (tag == kConvertedLog) {
+        uint64_t log;
+        uint32_t count;
+        std::vector<RangeTombstone> range_dels;
+        bool ok = GetVarint64(&input, &log) && GetVarint32(&input, &count);
+        for (uint32_t i = 0; ok && i < count; i++) {
+          Slice start, end;
+          RangeTombstone t;
+          ok = GetLengthPrefixedSlice(&input, &start) &&
+               GetLengthPrefixedSlice(&input, &end) &&
+               GetVarint64(&input, &t.sequence);
+          t.start = start.ToString();
+          t.end = end.ToString();
+          range_dels.push_back(t);
+        }
+        if (ok) {
+          range_dels_.insert(range_dels_.end(),
+                             range_dels.begin(), range_dels.end());
+          records->push_back(record.ToString());
+          logs++;
+        }
+      }
+    }
+    delete file;
+    Log(options_.info_log, "REPAIR: resuming with %d logs and %d tables done",
+        logs, tables);
+    return Status::OK();
+  }
+
+  // Append a record to the REPAIR file and sync it.
+  // REQUIRES: mu_ held.
+  Status AddCheckpointRecord(const std::string& record) {
+    Status status = checkpoint_log_->AddRecord(record);
+    if (status.ok()) {
+      status = checkpoint_file_->Sync();
+    }
+    return status;
+  }
+
+  void CloseCheckpoint() {
+    delete checkpoint_log_;
+    checkpoint_log_ = NULL;
+    if (checkpoint_file_ != NULL) {
+      checkpoint_file_->Close();
+      delete checkpoint_file_;
+      checkpoint_file_ = NULL;
+    }
+  }
+
   Status FindFiles() {
     std::vector<std::string> filenames;
     Status status = env_->GetChildren(dbname_, &filenames);
@@ -137,6 +357,8 @@ class Repairer {
             logs_.push_back(number);
           } else if (type == kTableFile) {
             table_numbers_.push_back(number);
+          } else if (type == kBlobFile) {
+            blob_numbers_.push_back(number);
           } else {
             // Ignore other files
           }
@@ -147,16 +369,18 @@ class Repairer {
   }
 
   void ConvertLogFilesToTables() {
-    for (size_t i = 0; i < logs_.size(); i++) {
-      std::string logname = LogFileName(dbname_, logs_[i]);
-      Status status = ConvertLogToTable(logs_[i]);
-      if (!status.ok()) {
-        Log(options_.info_log, "Log #%llu: ignoring conversion error: %s",
-            (unsigned long long) logs_[i],
-            status.ToString().c_str());
-      }
-      ArchiveFile(logname);
+    RunParallel(logs_.size(), &Repairer::ConvertLogFile);
+  }
+
+  void ConvertLogFile(size_t i) {
+    std::string logname = LogFileName(dbname_, logs_[i]);
+    Status status = ConvertLogToTable(logs_[i]);
+    if (!status.ok()) {
+      Log(options_.info_log, "Log #%llu: ignoring conversion error: %s",
+          (unsigned long long) logs_[i],
+          status.ToString().c_str());
     }
+    ArchiveFile(logname);
   }
 
   Status ConvertLogToTable(uint64_t log) {
@@ -222,16 +446,41 @@ class Repairer {
     // Do not record a version edit for this conversion to a Table
     // since ExtractMetaData() will also generate edits.
     FileMetaData meta;
+    mu_.Lock();
     meta.number = next_file_number_++;
+    mu_.Unlock();
     Iterator* iter = mem->NewIterator();
     status = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
     delete iter;
+
+    // Range deletions from the log are kept, but those that had already
+    // been flushed were recorded in the discarded descriptor and are lost.
+    // They are recorded before the log is archived so that a resumed
+    // repair keeps them too.
+    std::vector<RangeTombstone> range_dels;
+    mem->GetRangeDeletions(&range_dels);
     mem->Unref();
     mem = NULL;
-    if (status.ok()) {
-      if (meta.file_size > 0) {
+    std::string progress;
+    progress.push_back(static_cast<char>(kConvertedLog));
+    PutVarint64(&progress, log);
+    PutVarint32(&progress, range_dels.size());
+    for (size_t i = 0; i < range_dels.size(); i++) {
+      PutLengthPrefixedSlice(&progress, range_dels[i].start);
+      PutLengthPrefixedSlice(&progress, range_dels[i].end);
+      PutVarint64(&progress, range_dels[i].sequence);
+    }
+    {
+      MutexLock l(&mu_);
+      range_dels_.insert(range_dels_.end(),
+                         range_dels.begin(), range_dels.end());
+      if (status.ok() && meta.file_size > 0) {
         table_numbers_.push_back(meta.number);
       }
+      Status s = AddCheckpointRecord(progress);
+      if (status.ok()) {
+        status = s;
+      }
     }
     Log(options_.info_log, "Log #%llu: %d ops saved to Table #%llu %s",
         (unsigned long long) log,
@@ -242,23 +491,59 @@ class Repairer {
   }
 
   void ExtractMetaData() {
-    std::vector<TableInfo> kept;
+    scanned_tables_.resize(table_numbers_.size());
+    scanned_ok_.resize(table_numbers_.size());
+    RunParallel(table_numbers_.size(), &Repairer::ExtractTableMetaData);
     for (size_t i = 0; i < table_numbers_.size(); i++) {
-      TableInfo t;
-      t.meta.number = table_numbers_[i];
-      Status status = ScanTable(&t);
-      if (!status.ok()) {
-        std::string fname = TableFileName(dbname_, table_numbers_[i]);
-        Log(options_.info_log, "Table #%llu: ignoring %s",
-            (unsigned long long) table_numbers_[i],
-            status.ToString().c_str());
-        ArchiveFile(fname);
-      } else {
-        tables_.push_back(t);
+      if (scanned_ok_[i]) {
+        tables_.push_back(scanned_tables_[i]);
       }
     }
   }
 
+  void ExtractTableMetaData(size_t i) {
+    TableInfo t;
+    t.meta.number = table_numbers_[i];
+    std::string fname = TableFileName(dbname_, table_numbers_[i]);
+
+    // A table scanned by an interrupted repair is used as it was found,
+    // unless it has changed since.
+    std::map<uint64_t, TableInfo>::const_iterator resumed =
+        scanned_.find(t.meta.number);
+    uint64_t file_size;
+    if (resumed != scanned_.end() &&
+        env_->GetFileSize(fname, &file_size).ok() &&
+        file_size == resumed->second.meta.file_size) {
+      MutexLock l(&mu_);
+      scanned_tables_[i] = resumed->second;
+      scanned_ok_[i] = true;
+      return;
+    }
+
+    Status status = ScanTable(&t);
+    if (!status.ok()) {
+      Log(options_.info_log, "Table #%llu: ignoring %s",
+          (unsigned long long) table_numbers_[i],
+          status.ToString().c_str());
+      ArchiveFile(fname);
+      return;
+    }
+
+    std::string record;
+    record.push_back(static_cast<char>(kScannedTable));
+    PutVarint64(&record, t.meta.number);
+    PutVarint64(&record, t.meta.file_size);
+    PutLengthPrefixedSlice(&record, t.meta.smallest.Encode());
+    PutLengthPrefixedSlice(&record, t.meta.largest.Encode());
+    PutVarint64(&record, t.meta.smallest_seq);
+    PutVarint64(&record, t.max_sequence);
+    MutexLock l(&mu_);
+    scanned_tables_[i] = t;
+    scanned_ok_[i] = true;
+    // Losing the record only costs a resumed repair another scan.
+    AddCheckpointRecord(record);
+  }
+
   Status ScanTable(TableInfo* t) {
     std::string fname = TableFileName(dbname_, t->meta.number);
     int counter = 0;
@@ -269,6 +554,7 @@ class Repairer {
       bool empty = true;
       ParsedInternalKey parsed;
       t->max_sequence = 0;
+      t->meta.smallest_seq = kMaxSequenceNumber;
       for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
         Slice key = iter->key();
         if (!ParseInternalKey(key, &parsed)) {
@@ -287,6 +573,9 @@ class Repairer {
         if (parsed.sequence > t->max_sequence) {
           t->max_sequence = parsed.sequence;
         }
+        if (parsed.sequence < t->meta.smallest_seq) {
+          t->meta.smallest_seq = parsed.sequence;
+        }
       }
       if (!iter->status().ok()) {
         status = iter->status();
@@ -314,6 +603,12 @@ class Repairer {
         max_sequence = tables_[i].max_sequence;
       }
     }
+    for (size_t i = 0; i < range_dels_.size(); i++) {
+      if (max_sequence < range_dels_[i].sequence) {
+        max_sequence = range_dels_[i].sequence;
+      }
+      edit_.AddRangeDeletion(range_dels_[i]);
+    }
 
     edit_.SetComparatorName(icmp_.user_comparator()->Name());
     edit_.SetLogNumber(0);
@@ -324,7 +619,17 @@ class Repairer {
       // TODO(opt): separate out into multiple levels
       const TableInfo& t = tables_[i];
       edit_.AddFile(0, t.meta.number, t.meta.file_size,
-                    t.meta.smallest, t.meta.largest);
+                    t.meta.smallest, t.meta.largest, t.meta.smallest_seq);
+    }
+
+    // Which records of a blob file are still pointed to is not known, so
+    // none are counted as garbage; compactions count the ones they drop.
+    for (size_t i = 0; i < blob_numbers_.size(); i++) {
+      uint64_t file_size;
+      if (env_->GetFileSize(BlobFileName(dbname_, blob_numbers_[i]),
+                            &file_size).ok() && file_size > 0) {
+        edit_.AddBlobFile(blob_numbers_[i], file_size);
+      }
     }
 
     //fprintf(stderr, "NewDescriptor:\n%s\n", edit_.DebugString().c_str());
@@ -5,8 +5,9 @@
 // Thread safety
 // -------------
 //
-// Writes require external synchronization, most likely a mutex.
-// Reads require a guarantee that the SkipList will not be destroyed
+// Writes require external synchronization, most likely a mutex, except
+// that any number of threads may call InsertConcurrently() at once as
+// long as nobody calls Insert() at the same time.  Reads require a guarantee that the SkipList will not be destroyed
 // while the read is in progress.  Apart from that, reads progress
 // without any internal locking or synchronization.
 //
@@ -23,17 +24,34 @@
 // more lists.
 //
 // ... prev vs. next pointer ordering ...
+//
+// Node layout
+// -----------
+//
+// Besides the key, each node stores Comparator::Prefix(key), a 64-bit
+// value that orders keys the way the comparator does wherever two
+// prefixes differ.  Searches compare prefixes first and only call the
+// comparator, which may have to chase the key into other memory, when
+// the prefixes are equal.  While a search compares a node it prefetches
+// the node that follows it on the same level.
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include "port/port.h"
 #include "util/arena.h"
+#include "util/hash.h"
 #include "util/random.h"
 
 namespace leveldb {
 
 class Arena;
 
+// Comparator must provide
+//   int operator()(const Key& a, const Key& b) const;
+//   uint64_t Prefix(const Key& k) const;
+// where Prefix(a) < Prefix(b) implies a < b.  A comparator without a
+// useful prefix can return a constant.
 template<typename Key, class Comparator>
 class SkipList {
  private:
@@ -49,6 +67,13 @@ class SkipList {
   // REQUIRES: nothing that compares equal to key is currently in the list.
   void Insert(const Key& key);
 
+  // Like Insert(), but may run concurrently with other calls to
+  // InsertConcurrently().  Links are published with compare-and-swap,
+  // and nodes are allocated with Arena::AllocateAlignedConcurrently().
+  // REQUIRES: nothing that compares equal to key is in the list or is
+  // being inserted by another thread.
+  void InsertConcurrently(const Key& key);
+
   // Returns true iff an entry that compares equal to key is in the list.
   bool Contains(const Key& key) const;
 
@@ -112,12 +137,18 @@ class SkipList {
   // Read/written only by Insert().
   Random rnd_;
 
-  Node* NewNode(const Key& key, int height);
+  // Bumped atomically by InsertConcurrently() to pick node heights.
+  uint32_t concurrent_seed_;
+
+  Node* NewNode(const Key& key, uint64_t prefix, int height);
+  Node* NewNodeConcurrently(const Key& key, uint64_t prefix, int height);
   int RandomHeight();
+  int RandomHeightConcurrently();
   bool Equal(const Key& a, const Key& b) const { return (compare_(a, b) == 0); }
 
-  // Return true if key is greater than the data stored in "n"
-  bool KeyIsAfterNode(const Key& key, Node* n) const;
+  // Return true if key, whose prefix is "prefix", is greater than the
+  // data stored in "n"
+  bool KeyIsAfterNode(const Key& key, uint64_t prefix, Node* n) const;
 
   // Return the earliest node that comes at or after key.
   // Return NULL if there is no such node.
@@ -142,9 +173,10 @@ class SkipList {
 // Implementation details follow
 template<typename Key, class Comparator>
 struct SkipList<Key,Comparator>::Node {
-  explicit Node(const Key& k) : key(k) { }
+  Node(const Key& k, uint64_t p) : key(k), prefix(p) { }
 
   Key const key;
+  uint64_t const prefix;  // Comparator::Prefix(key)
 
   // Accessors/mutators for links.  Wrapped in methods so we can
   // add the appropriate barriers as necessary.
@@ -171,6 +203,12 @@ struct SkipList<Key,Comparator>::Node {
     next_[n].NoBarrier_Store(x);
   }
 
+  // Set the link to x if it is still "expected".  Implies a full barrier.
+  bool CASNext(int n, Node* expected, Node* x) {
+    assert(n >= 0);
+    return next_[n].CompareAndSwap(expected, x);
+  }
+
  private:
   // Array of length equal to the node height.  next_[0] is lowest level link.
   port::AtomicPointer next_[1];
@@ -178,10 +216,20 @@ struct SkipList<Key,Comparator>::Node {
 
 template<typename Key, class Comparator>
 typename SkipList<Key,Comparator>::Node*
-SkipList<Key,Comparator>::NewNode(const Key& key, int height) {
+SkipList<Key,Comparator>::NewNode(const Key& key, uint64_t prefix,
+                                  int height) {
   char* mem = arena_->AllocateAligned(
       sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1));
-  return new (mem) Node(key);
+  return new (mem) Node(key, prefix);
+}
+
+template<typename Key, class Comparator>
+typename SkipList<Key,Comparator>::Node*
+SkipList<Key,Comparator>::NewNodeConcurrently(const Key& key,
+                                              uint64_t prefix, int height) {
+  char* mem = arena_->AllocateAlignedConcurrently(
+      sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1));
+  return new (mem) Node(key, prefix);
 }
 
 template<typename Key, class Comparator>
@@ -250,19 +298,47 @@ int SkipList<Key,Comparator>::RandomHeight() {
 }
 
 template<typename Key, class Comparator>
-bool SkipList<Key,Comparator>::KeyIsAfterNode(const Key& key, Node* n) const {
+int SkipList<Key,Comparator>::RandomHeightConcurrently() {
+  // rnd_ can't be shared between threads, so hash a counter instead.
+  // Each pair of low bits is zero with probability 1 in 4.
+  const uint32_t n = __sync_fetch_and_add(&concurrent_seed_, 1);
+  uint32_t bits = Hash(reinterpret_cast<const char*>(&n), sizeof(n),
+                       0xdeadbeef);
+  int height = 1;
+  while (height < kMaxHeight && (bits & 3) == 0) {
+    bits >>= 2;
+    height++;
+  }
+  return height;
+}
+
+template<typename Key, class Comparator>
+bool SkipList<Key,Comparator>::KeyIsAfterNode(const Key& key,
+                                              uint64_t prefix,
+                                              Node* n) const {
   // NULL n is considered infinite
-  return (n != NULL) && (compare_(n->key, key) < 0);
+  if (n == NULL) {
+    return false;
+  } else if (n->prefix != prefix) {
+    return n->prefix < prefix;
+  }
+  return compare_(n->key, key) < 0;
 }
 
 template<typename Key, class Comparator>
 typename SkipList<Key,Comparator>::Node* SkipList<Key,Comparator>::FindGreaterOrEqual(const Key& key, Node** prev)
     const {
+  const uint64_t prefix = compare_.Prefix(key);
   Node* x = head_;
   int level = GetMaxHeight() - 1;
   while (true) {
     Node* next = x->Next(level);
-    if (KeyIsAfterNode(key, next)) {
+    if (next != NULL) {
+      // The search usually moves past "next", so start loading the node
+      // after it while "next" is compared.
+      port::Prefetch(next->NoBarrier_Next(level));
+    }
+    if (KeyIsAfterNode(key, prefix, next)) {
       // Keep searching in this list
       x = next;
     } else {
@@ -280,12 +356,16 @@ typename SkipList<Key,Comparator>::Node* SkipList<Key,Comparator>::FindGreaterOr
 template<typename Key, class Comparator>
 typename SkipList<Key,Comparator>::Node*
 SkipList<Key,Comparator>::FindLessThan(const Key& key) const {
+  const uint64_t prefix = compare_.Prefix(key);
   Node* x = head_;
   int level = GetMaxHeight() - 1;
   while (true) {
     assert(x == head_ || compare_(x->key, key) < 0);
     Node* next = x->Next(level);
-    if (next == NULL || compare_(next->key, key) >= 0) {
+    if (next != NULL) {
+      port::Prefetch(next->NoBarrier_Next(level));
+    }
+    if (!KeyIsAfterNode(key, prefix, next)) {
       if (level == 0) {
         return x;
       } else {
@@ -322,9 +402,10 @@ template<typename Key, class Comparator>
 SkipList<Key,Comparator>::SkipList(Comparator cmp, Arena* arena)
     : compare_(cmp),
       arena_(arena),
-      head_(NewNode(0 /* any key will do */, kMaxHeight)),
+      head_(NewNode(0 /* any key will do */, 0, kMaxHeight)),
       max_height_(reinterpret_cast<void*>(1)),
-      rnd_(0xdeadbeef) {
+      rnd_(0xdeadbeef),
+      concurrent_seed_(0) {
   for (int i = 0; i < kMaxHeight; i++) {
     head_->SetNext(i, NULL);
   }
@@ -357,7 +438,7 @@ void SkipList<Key,Comparator>::Insert(const Key& key) {
     max_height_.NoBarrier_Store(reinterpret_cast<void*>(height));
   }
 
-  x = NewNode(key, height);
+  x = NewNode(key, compare_.Prefix(key), height);
   for (int i = 0; i < height; i++) {
     // NoBarrier_SetNext() suffices since we will add a barrier when
     // we publish a pointer to "x" in prev[i].
@@ -366,6 +447,46 @@ void SkipList<Key,Comparator>::Insert(const Key& key) {
   }
 }
 
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::InsertConcurrently(const Key& key) {
+  const int height = RandomHeightConcurrently();
+  intptr_t max_height = GetMaxHeight();
+  while (height > max_height) {
+    // Readers that see the new height before the head links are set
+    // drop down a level, as with Insert().
+    if (max_height_.CompareAndSwap(reinterpret_cast<void*>(max_height),
+                                   reinterpret_cast<void*>(height))) {
+      break;
+    }
+    max_height = GetMaxHeight();
+  }
+
+  // prev[i] precedes key at every level below height since the list
+  // height is at least "height" now.
+  Node* prev[kMaxHeight];
+  FindGreaterOrEqual(key, prev);
+
+  const uint64_t prefix = compare_.Prefix(key);
+  Node* x = NewNodeConcurrently(key, prefix, height);
+  for (int i = 0; i < height; i++) {
+    while (true) {
+      // Other threads may have linked nodes after prev[i] since it was
+      // found.  Nodes are never removed, so walk forward past those that
+      // sort before key and retry the link there.
+      Node* next = prev[i]->Next(i);
+      while (KeyIsAfterNode(key, prefix, next)) {
+        prev[i] = next;
+        next = prev[i]->Next(i);
+      }
+      assert(next == NULL || !Equal(key, next->key));
+      x->NoBarrier_SetNext(i, next);
+      if (prev[i]->CASNext(i, next, x)) {
+        break;
+      }
+    }
+  }
+}
+
 template<typename Key, class Comparator>
 bool SkipList<Key,Comparator>::Contains(const Key& key) const {
   Node* x = FindGreaterOrEqual(key, NULL);
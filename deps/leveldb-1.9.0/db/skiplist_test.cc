@@ -7,6 +7,7 @@
 #include "leveldb/env.h"
 #include "util/arena.h"
 #include "util/hash.h"
+#include "util/mutexlock.h"
 #include "util/random.h"
 #include "util/testharness.h"
 
@@ -24,6 +25,12 @@ struct Comparator {
       return 0;
     }
   }
+
+  // Coarse enough that neighbouring keys share a prefix, so searches
+  // exercise both the prefix and the full comparison.
+  uint64_t Prefix(const Key& k) const {
+    return k >> 8;
+  }
 };
 
 class SkipTest { };
@@ -371,6 +378,73 @@ TEST(SkipTest, Concurrent3) { RunConcurrent(3); }
 TEST(SkipTest, Concurrent4) { RunConcurrent(4); }
 TEST(SkipTest, Concurrent5) { RunConcurrent(5); }
 
+namespace {
+struct InserterState {
+  SkipList<Key, Comparator>* list;
+  int thread;
+  int num_threads;
+  int num_keys;
+  port::Mutex* mu;
+  port::CondVar* cv;
+  int* done;
+};
+
+static void ConcurrentInserter(void* arg) {
+  InserterState* state = reinterpret_cast<InserterState*>(arg);
+  // Interleave every thread's keys so that they race for the same links
+  for (int i = state->thread; i < state->num_keys; i += state->num_threads) {
+    state->list->InsertConcurrently(i);
+  }
+  MutexLock l(state->mu);
+  (*state->done)++;
+  state->cv->Signal();
+}
+}  // namespace
+
+TEST(SkipTest, InsertConcurrently) {
+  const int kThreads = 4;
+  const int kKeys = 20000;
+  Arena arena;
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp, &arena);
+  port::Mutex mu;
+  port::CondVar cv(&mu);
+  int done = 0;
+  InserterState state[kThreads];
+  for (int t = 0; t < kThreads; t++) {
+    state[t].list = &list;
+    state[t].thread = t;
+    state[t].num_threads = kThreads;
+    state[t].num_keys = kKeys;
+    state[t].mu = &mu;
+    state[t].cv = &cv;
+    state[t].done = &done;
+    Env::Default()->StartThread(ConcurrentInserter, &state[t]);
+  }
+  {
+    MutexLock l(&mu);
+    while (done < kThreads) {
+      cv.Wait();
+    }
+  }
+
+  SkipList<Key, Comparator>::Iterator iter(&list);
+  iter.SeekToFirst();
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(i, iter.key());
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+  for (int i = 0; i < kKeys; i += 7) {
+    ASSERT_TRUE(list.Contains(i));
+    iter.Seek(i);
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(i, iter.key());
+  }
+  ASSERT_TRUE(!list.Contains(kKeys));
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
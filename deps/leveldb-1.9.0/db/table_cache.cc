@@ -4,23 +4,48 @@
 
 #include "db/table_cache.h"
 
+#include <map>
 #include "db/filename.h"
 #include "leveldb/env.h"
 #include "leveldb/table.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
 struct TableAndFile {
   RandomAccessFile* file;
   Table* table;
+  TableCache* owner;
+
+  // Guarded by owner->pin_mu_
+  int cache_refs;       // Entries of owner->cache_ that hold it
+  bool pinned;          // In owner->pinned_
+  size_t pinned_size;   // Charged to options->pinned_metadata_size
 };
 
-static void DeleteEntry(const Slice& key, void* value) {
+void TableCache::DeleteEntry(const Slice& key, void* value) {
   TableAndFile* tf = reinterpret_cast<TableAndFile*>(value);
-  delete tf->table;
-  delete tf->file;
-  delete tf;
+  tf->owner->Unref(tf);
+}
+
+void TableCache::Unref(TableAndFile* tf) {
+  bool unused;
+  {
+    MutexLock l(&pin_mu_);
+    tf->cache_refs--;
+    unused = (tf->cache_refs == 0 && !tf->pinned);
+  }
+  if (unused) {
+    delete tf->table;
+    delete tf->file;
+    delete tf;
+  }
+}
+
+static void DeleteTableAndFile(void* arg1, void* arg2) {
+  delete reinterpret_cast<Table*>(arg1);
+  delete reinterpret_cast<RandomAccessFile*>(arg2);
 }
 
 static void UnrefEntry(void* arg1, void* arg2) {
@@ -35,44 +60,138 @@ TableCache::TableCache(const std::string& dbname,
     : env_(options->env),
       dbname_(dbname),
       options_(options),
-      cache_(NewLRUCache(entries)) {
+      cache_(NewLRUCache(entries)),
+      pinned_usage_(0) {
 }
 
 TableCache::~TableCache() {
   delete cache_;
+  for (PinnedMap::iterator it = pinned_.begin(); it != pinned_.end(); ++it) {
+    TableAndFile* tf = it->second;
+    assert(tf->cache_refs == 0);
+    delete tf->table;
+    delete tf->file;
+    delete tf;
+  }
 }
 
 Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
-                             Cache::Handle** handle) {
+                             Cache::Handle** handle, bool pin) {
   Status s;
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
   Slice key(buf, sizeof(buf));
   *handle = cache_->Lookup(key);
   if (*handle == NULL) {
-    std::string fname = TableFileName(dbname_, file_number);
-    RandomAccessFile* file = NULL;
-    Table* table = NULL;
-    s = env_->NewRandomAccessFile(fname, &file);
-    if (s.ok()) {
-      s = Table::Open(*options_, file, file_size, &table);
+    TableAndFile* tf = NULL;
+    {
+      // A pinned table that fell out of cache_ goes back in as it is.
+      MutexLock l(&pin_mu_);
+      PinnedMap::iterator it = pinned_.find(file_number);
+      if (it != pinned_.end()) {
+        tf = it->second;
+        tf->cache_refs++;
+      }
     }
 
-    if (!s.ok()) {
-      assert(table == NULL);
-      delete file;
-      // We do not cache error results so that if the error is transient,
-      // or somebody repairs the file, we recover automatically.
-    } else {
-      TableAndFile* tf = new TableAndFile;
-      tf->file = file;
-      tf->table = table;
+    if (tf == NULL) {
+      std::string fname = TableFileName(dbname_, file_number);
+      RandomAccessFile* file = NULL;
+      Table* table = NULL;
+      s = env_->NewRandomAccessFile(fname, &file);
+      if (s.ok()) {
+        s = Table::Open(*options_, file, file_size, &table);
+      }
+
+      if (!s.ok()) {
+        assert(table == NULL);
+        delete file;
+        // We do not cache error results so that if the error is transient,
+        // or somebody repairs the file, we recover automatically.
+      } else {
+        tf = new TableAndFile;
+        tf->file = file;
+        tf->table = table;
+        tf->owner = this;
+        tf->cache_refs = 1;
+        tf->pinned = false;
+        tf->pinned_size = 0;
+      }
+    }
+    if (tf != NULL) {
       *handle = cache_->Insert(key, tf, 1, &DeleteEntry);
     }
   }
+  if (s.ok() && pin && options_->pinned_metadata_size > 0) {
+    Pin(file_number, reinterpret_cast<TableAndFile*>(cache_->Value(*handle)));
+  }
   return s;
 }
 
+void TableCache::Pin(uint64_t file_number, TableAndFile* tf) {
+  MutexLock l(&pin_mu_);
+  if (tf->pinned || pinned_usage_ >= options_->pinned_metadata_size) {
+    return;
+  }
+  const size_t size = tf->table->MetadataSize();
+  if (pinned_usage_ + size > options_->pinned_metadata_size) {
+    return;
+  }
+  // Pinning is rare, once per table, so reading the partitions under
+  // pin_mu_ only briefly holds up the lookups that miss cache_.
+  if (!tf->table->PinIndexPartitions().ok()) {
+    return;
+  }
+  tf->pinned = true;
+  tf->pinned_size = size;
+  pinned_usage_ += size;
+  pinned_[file_number] = tf;
+}
+
+void TableCache::Unpin(uint64_t file_number) {
+  TableAndFile* unused = NULL;
+  {
+    MutexLock l(&pin_mu_);
+    PinnedMap::iterator it = pinned_.find(file_number);
+    if (it == pinned_.end()) {
+      return;
+    }
+    TableAndFile* tf = it->second;
+    pinned_.erase(it);
+    tf->pinned = false;
+    pinned_usage_ -= tf->pinned_size;
+    if (tf->cache_refs == 0) {
+      unused = tf;
+    }
+  }
+  if (unused != NULL) {
+    delete unused->table;
+    delete unused->file;
+    delete unused;
+  }
+}
+
+void TableCache::RetainPinned(const std::set<uint64_t>& files) {
+  std::vector<uint64_t> unpin;
+  {
+    MutexLock l(&pin_mu_);
+    for (PinnedMap::const_iterator it = pinned_.begin();
+         it != pinned_.end(); ++it) {
+      if (files.find(it->first) == files.end()) {
+        unpin.push_back(it->first);
+      }
+    }
+  }
+  for (size_t i = 0; i < unpin.size(); i++) {
+    Unpin(unpin[i]);
+  }
+}
+
+size_t TableCache::PinnedMetadataUsage() {
+  MutexLock l(&pin_mu_);
+  return pinned_usage_;
+}
+
 Iterator* TableCache::NewIterator(const ReadOptions& options,
                                   uint64_t file_number,
                                   uint64_t file_size,
@@ -96,14 +215,36 @@ Iterator* TableCache::NewIterator(const ReadOptions& options,
   return result;
 }
 
+Iterator* TableCache::NewDirectIterator(const ReadOptions& options,
+                                        uint64_t file_number,
+                                        uint64_t file_size) {
+  std::string fname = TableFileName(dbname_, file_number);
+  RandomAccessFile* file = NULL;
+  Table* table = NULL;
+  Status s = env_->NewDirectRandomAccessFile(fname, &file);
+  if (s.ok()) {
+    s = Table::Open(*options_, file, file_size, &table);
+  }
+  if (!s.ok()) {
+    assert(table == NULL);
+    delete file;
+    return NewErrorIterator(s);
+  }
+  // The cleanup runs after the iterator and its blocks are gone
+  Iterator* result = table->NewIterator(options);
+  result->RegisterCleanup(&DeleteTableAndFile, table, file);
+  return result;
+}
+
 Status TableCache::Get(const ReadOptions& options,
                        uint64_t file_number,
                        uint64_t file_size,
                        const Slice& k,
                        void* arg,
-                       void (*saver)(void*, const Slice&, const Slice&)) {
+                       void (*saver)(void*, const Slice&, const Slice&),
+                       bool pin) {
   Cache::Handle* handle = NULL;
-  Status s = FindTable(file_number, file_size, &handle);
+  Status s = FindTable(file_number, file_size, &handle, pin);
   if (s.ok()) {
     Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
     s = t->InternalGet(options, k, arg, saver);
@@ -112,7 +253,82 @@ Status TableCache::Get(const ReadOptions& options,
   return s;
 }
 
+bool TableCache::PrefixMayMatch(uint64_t file_number,
+                                uint64_t file_size,
+                                const Slice& k) {
+  Cache::Handle* handle = NULL;
+  Status s = FindTable(file_number, file_size, &handle);
+  if (!s.ok()) {
+    // Let the iterator report the error.
+    return true;
+  }
+  Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+  const bool may_match = t->PrefixMayMatch(k);
+  cache_->Release(handle);
+  return may_match;
+}
+
+namespace {
+typedef std::map<uint64_t, uint64_t> FileNumberMap;
+
+struct CachedBlocks {
+  FileNumberMap files;  // Block cache id => file number
+  std::vector<std::pair<uint64_t, uint64_t> >* blocks;
+};
+
+void AddOpenTable(void* arg, const Slice& key, void* value) {
+  FileNumberMap* files = reinterpret_cast<FileNumberMap*>(arg);
+  const Table* table = reinterpret_cast<TableAndFile*>(value)->table;
+  (*files)[table->BlockCacheId()] = DecodeFixed64(key.data());
+}
+
+void AddCachedBlock(void* arg, const Slice& key, void* value) {
+  CachedBlocks* cached = reinterpret_cast<CachedBlocks*>(arg);
+  if (key.size() != 16) {
+    return;
+  }
+  FileNumberMap::const_iterator it =
+      cached->files.find(DecodeFixed64(key.data()));
+  if (it != cached->files.end()) {
+    cached->blocks->push_back(
+        std::make_pair(it->second, DecodeFixed64(key.data() + 8)));
+  }
+}
+}  // namespace
+
+void TableCache::GetCachedBlocks(
+    std::vector<std::pair<uint64_t, uint64_t> >* blocks) {
+  if (options_->block_cache == NULL) {
+    return;
+  }
+  // Blocks are keyed by an id that each open table is given, so the
+  // blocks of this database are found through its open tables.
+  CachedBlocks cached;
+  cached.blocks = blocks;
+  cache_->VisitEntries(&AddOpenTable, &cached.files);
+  cached.files.erase(0);
+  if (!cached.files.empty()) {
+    options_->block_cache->VisitEntries(&AddCachedBlock, &cached);
+  }
+}
+
+Status TableCache::WarmBlocks(uint64_t file_number,
+                              uint64_t file_size,
+                              const uint64_t* offsets,
+                              size_t n,
+                              ReadStats* stats) {
+  Cache::Handle* handle = NULL;
+  Status s = FindTable(file_number, file_size, &handle);
+  if (s.ok()) {
+    Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+    s = t->WarmBlocks(offsets, n, stats);
+    cache_->Release(handle);
+  }
+  return s;
+}
+
 void TableCache::Evict(uint64_t file_number) {
+  Unpin(file_number);
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
   cache_->Erase(Slice(buf, sizeof(buf)));
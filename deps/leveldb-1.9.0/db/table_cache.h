@@ -7,7 +7,11 @@
 #ifndef STORAGE_LEVELDB_DB_TABLE_CACHE_H_
 #define STORAGE_LEVELDB_DB_TABLE_CACHE_H_
 
+#include <map>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 #include <stdint.h>
 #include "db/dbformat.h"
 #include "leveldb/cache.h"
@@ -17,6 +21,7 @@
 namespace leveldb {
 
 class Env;
+struct TableAndFile;
 
 class TableCache {
  public:
@@ -35,25 +40,72 @@ class TableCache {
                         uint64_t file_size,
                         Table** tableptr = NULL);
 
+  // Like NewIterator(), but the table is opened on a file from
+  // Env::NewDirectRandomAccessFile() just for the returned iterator,
+  // bypassing both this cache and the operating system's page cache.
+  Iterator* NewDirectIterator(const ReadOptions& options,
+                              uint64_t file_number,
+                              uint64_t file_size);
+
   // If a seek to internal key "k" in specified file finds an entry,
-  // call (*handle_result)(arg, found_key, found_value).
+  // call (*handle_result)(arg, found_key, found_value).  If "pin" is
+  // true and options->pinned_metadata_size has room for it, the table is
+  // kept open with its metadata in memory until Unpin() or Evict().
   Status Get(const ReadOptions& options,
              uint64_t file_number,
              uint64_t file_size,
              const Slice& k,
              void* arg,
-             void (*handle_result)(void*, const Slice&, const Slice&));
+             void (*handle_result)(void*, const Slice&, const Slice&),
+             bool pin = false);
+
+  // Returns false if the prefix filters of the specified file say it
+  // holds no key at or after internal key "k" with the prefix of "k".
+  bool PrefixMayMatch(uint64_t file_number,
+                      uint64_t file_size,
+                      const Slice& k);
 
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
+  // Stop pinning the tables of every file not in "files".
+  void RetainPinned(const std::set<uint64_t>& files);
+
+  // Returns the bytes of filter and index blocks held by pinned tables.
+  size_t PinnedMetadataUsage();
+
+  // Append the file number and offset of every block of the tables open
+  // in this cache that is in options->block_cache to "*blocks".
+  void GetCachedBlocks(std::vector<std::pair<uint64_t, uint64_t> >* blocks);
+
+  // Read the data blocks of the specified file that start at the "n"
+  // ascending "offsets" into the block cache, counting the blocks that
+  // had to be read in "*stats".
+  Status WarmBlocks(uint64_t file_number,
+                    uint64_t file_size,
+                    const uint64_t* offsets,
+                    size_t n,
+                    ReadStats* stats);
+
  private:
   Env* const env_;
   const std::string dbname_;
   const Options* options_;
   Cache* cache_;
 
-  Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**);
+  // Tables pinned by Get(), which stay open while they are out of cache_.
+  // A table is deleted once it is neither pinned nor in cache_.
+  typedef std::map<uint64_t, TableAndFile*> PinnedMap;
+  port::Mutex pin_mu_;
+  PinnedMap pinned_;        // Guarded by pin_mu_
+  size_t pinned_usage_;     // Guarded by pin_mu_
+
+  Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**,
+                   bool pin = false);
+  void Pin(uint64_t file_number, TableAndFile* tf);
+  void Unpin(uint64_t file_number);
+  void Unref(TableAndFile* tf);
+  static void DeleteEntry(const Slice& key, void* value);
 };
 
 }  // namespace leveldb
@@ -20,7 +20,13 @@ enum Tag {
   kDeletedFile          = 6,
   kNewFile              = 7,
   // 8 was used for large value refs
-  kPrevLogNumber        = 9
+  kPrevLogNumber        = 9,
+  kNewFileWithSequence  = 10,
+  kRangeDeletion        = 11,
+  kDeletedRangeDeletion = 12,
+  kNewFileWithBlob      = 13,
+  kNewBlobFile          = 14,
+  kBlobGarbage          = 15
 };
 
 void VersionEdit::Clear() {
@@ -36,6 +42,10 @@ void VersionEdit::Clear() {
   has_last_sequence_ = false;
   deleted_files_.clear();
   new_files_.clear();
+  deleted_range_dels_.clear();
+  new_range_dels_.clear();
+  new_blob_files_.clear();
+  blob_garbage_.clear();
 }
 
 void VersionEdit::EncodeTo(std::string* dst) const {
@@ -76,12 +86,51 @@ void VersionEdit::EncodeTo(std::string* dst) const {
 
   for (size_t i = 0; i < new_files_.size(); i++) {
     const FileMetaData& f = new_files_[i].second;
-    PutVarint32(dst, kNewFile);
+    // Tables without blobs keep the older tag for older readers.
+    PutVarint32(dst, f.oldest_blob != 0 ? kNewFileWithBlob
+                                        : kNewFileWithSequence);
     PutVarint32(dst, new_files_[i].first);  // level
     PutVarint64(dst, f.number);
     PutVarint64(dst, f.file_size);
     PutLengthPrefixedSlice(dst, f.smallest.Encode());
     PutLengthPrefixedSlice(dst, f.largest.Encode());
+    PutVarint64(dst, f.smallest_seq);
+    if (f.oldest_blob != 0) {
+      PutVarint64(dst, f.oldest_blob);
+    }
+  }
+
+  for (std::set<SequenceNumber>::const_iterator iter =
+           deleted_range_dels_.begin();
+       iter != deleted_range_dels_.end();
+       ++iter) {
+    PutVarint32(dst, kDeletedRangeDeletion);
+    PutVarint64(dst, *iter);
+  }
+
+  for (size_t i = 0; i < new_range_dels_.size(); i++) {
+    const RangeTombstone& t = new_range_dels_[i];
+    PutVarint32(dst, kRangeDeletion);
+    PutVarint64(dst, t.sequence);
+    PutLengthPrefixedSlice(dst, t.start);
+    PutLengthPrefixedSlice(dst, t.end);
+  }
+
+  for (size_t i = 0; i < new_blob_files_.size(); i++) {
+    const BlobFileMetaData& b = new_blob_files_[i].second;
+    PutVarint32(dst, kNewBlobFile);
+    PutVarint64(dst, new_blob_files_[i].first);
+    PutVarint64(dst, b.file_size);
+    PutVarint64(dst, b.garbage_bytes);
+  }
+
+  for (std::map<uint64_t, uint64_t>::const_iterator iter =
+           blob_garbage_.begin();
+       iter != blob_garbage_.end();
+       ++iter) {
+    PutVarint32(dst, kBlobGarbage);
+    PutVarint64(dst, iter->first);
+    PutVarint64(dst, iter->second);
   }
 }
 
@@ -117,7 +166,11 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
   uint64_t number;
   FileMetaData f;
   Slice str;
+  Slice str2;
   InternalKey key;
+  SequenceNumber seq;
+  BlobFileMetaData b;
+  uint64_t bytes;
 
   while (msg == NULL && GetVarint32(&input, &tag)) {
     switch (tag) {
@@ -186,12 +239,79 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
             GetVarint64(&input, &f.file_size) &&
             GetInternalKey(&input, &f.smallest) &&
             GetInternalKey(&input, &f.largest)) {
+          f.smallest_seq = 0;
+          f.oldest_blob = 0;
+          new_files_.push_back(std::make_pair(level, f));
+        } else {
+          msg = "new-file entry";
+        }
+        break;
+
+      case kNewFileWithSequence:
+        if (GetLevel(&input, &level) &&
+            GetVarint64(&input, &f.number) &&
+            GetVarint64(&input, &f.file_size) &&
+            GetInternalKey(&input, &f.smallest) &&
+            GetInternalKey(&input, &f.largest) &&
+            GetVarint64(&input, &f.smallest_seq)) {
+          f.oldest_blob = 0;
+          new_files_.push_back(std::make_pair(level, f));
+        } else {
+          msg = "new-file entry";
+        }
+        break;
+
+      case kNewFileWithBlob:
+        if (GetLevel(&input, &level) &&
+            GetVarint64(&input, &f.number) &&
+            GetVarint64(&input, &f.file_size) &&
+            GetInternalKey(&input, &f.smallest) &&
+            GetInternalKey(&input, &f.largest) &&
+            GetVarint64(&input, &f.smallest_seq) &&
+            GetVarint64(&input, &f.oldest_blob)) {
           new_files_.push_back(std::make_pair(level, f));
         } else {
           msg = "new-file entry";
         }
         break;
 
+      case kNewBlobFile:
+        if (GetVarint64(&input, &number) &&
+            GetVarint64(&input, &b.file_size) &&
+            GetVarint64(&input, &b.garbage_bytes)) {
+          new_blob_files_.push_back(std::make_pair(number, b));
+        } else {
+          msg = "blob file";
+        }
+        break;
+
+      case kBlobGarbage:
+        if (GetVarint64(&input, &number) &&
+            GetVarint64(&input, &bytes)) {
+          blob_garbage_[number] += bytes;
+        } else {
+          msg = "blob garbage";
+        }
+        break;
+
+      case kDeletedRangeDeletion:
+        if (GetVarint64(&input, &seq)) {
+          deleted_range_dels_.insert(seq);
+        } else {
+          msg = "deleted range deletion";
+        }
+        break;
+
+      case kRangeDeletion:
+        if (GetVarint64(&input, &seq) &&
+            GetLengthPrefixedSlice(&input, &str) &&
+            GetLengthPrefixedSlice(&input, &str2)) {
+          new_range_dels_.push_back(RangeTombstone(str, str2, seq));
+        } else {
+          msg = "range deletion";
+        }
+        break;
+
       default:
         msg = "unknown tag";
         break;
@@ -258,6 +378,47 @@ std::string VersionEdit::DebugString() const {
     r.append(f.smallest.DebugString());
     r.append(" .. ");
     r.append(f.largest.DebugString());
+    r.append(" seq ");
+    AppendNumberTo(&r, f.smallest_seq);
+    if (f.oldest_blob != 0) {
+      r.append(" blob ");
+      AppendNumberTo(&r, f.oldest_blob);
+    }
+  }
+  for (std::set<SequenceNumber>::const_iterator iter =
+           deleted_range_dels_.begin();
+       iter != deleted_range_dels_.end();
+       ++iter) {
+    r.append("\n  DeleteRangeDeletion: ");
+    AppendNumberTo(&r, *iter);
+  }
+  for (size_t i = 0; i < new_range_dels_.size(); i++) {
+    const RangeTombstone& t = new_range_dels_[i];
+    r.append("\n  AddRangeDeletion: ");
+    AppendNumberTo(&r, t.sequence);
+    r.append(" '");
+    r.append(EscapeString(t.start));
+    r.append("' .. '");
+    r.append(EscapeString(t.end));
+    r.append("'");
+  }
+  for (size_t i = 0; i < new_blob_files_.size(); i++) {
+    const BlobFileMetaData& b = new_blob_files_[i].second;
+    r.append("\n  AddBlobFile: ");
+    AppendNumberTo(&r, new_blob_files_[i].first);
+    r.append(" ");
+    AppendNumberTo(&r, b.file_size);
+    r.append(" garbage ");
+    AppendNumberTo(&r, b.garbage_bytes);
+  }
+  for (std::map<uint64_t, uint64_t>::const_iterator iter =
+           blob_garbage_.begin();
+       iter != blob_garbage_.end();
+       ++iter) {
+    r.append("\n  BlobGarbage: ");
+    AppendNumberTo(&r, iter->first);
+    r.append(" ");
+    AppendNumberTo(&r, iter->second);
   }
   r.append("\n}\n");
   return r;
@@ -5,10 +5,12 @@
 #ifndef STORAGE_LEVELDB_DB_VERSION_EDIT_H_
 #define STORAGE_LEVELDB_DB_VERSION_EDIT_H_
 
+#include <map>
 #include <set>
 #include <utility>
 #include <vector>
 #include "db/dbformat.h"
+#include "db/range_del.h"
 
 namespace leveldb {
 
@@ -21,8 +23,28 @@ struct FileMetaData {
   uint64_t file_size;         // File size in bytes
   InternalKey smallest;       // Smallest internal key served by table
   InternalKey largest;        // Largest internal key served by table
+  // Range tombstones up to this sequence number delete nothing in the
+  // table: the smallest sequence number in it, raised by compaction to the
+  // newest tombstone it applied.  Zero if unknown.
+  SequenceNumber smallest_seq;
+  // The smallest number of the blob files that entries in the table point
+  // into, or zero if none do or it is unknown.
+  uint64_t oldest_blob;
+
+  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0),
+                   smallest_seq(0), oldest_blob(0) { }
+};
+
+struct BlobFileMetaData {
+  uint64_t file_size;         // File size in bytes
+  uint64_t garbage_bytes;     // Bytes of records no table points to
+
+  BlobFileMetaData() : file_size(0), garbage_bytes(0) { }
 
-  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0) { }
+  // Bytes of records that tables still point to.
+  uint64_t live_bytes() const {
+    return garbage_bytes < file_size ? file_size - garbage_bytes : 0;
+  }
 };
 
 class VersionEdit {
@@ -59,15 +81,21 @@ class VersionEdit {
   // Add the specified file at the specified number.
   // REQUIRES: This version has not been saved (see VersionSet::SaveTo)
   // REQUIRES: "smallest" and "largest" are smallest and largest keys in file
+  // REQUIRES: No range tombstone up to "smallest_seq" deletes a key in file
+  // REQUIRES: No entry in file points into a blob file before "oldest_blob"
   void AddFile(int level, uint64_t file,
                uint64_t file_size,
                const InternalKey& smallest,
-               const InternalKey& largest) {
+               const InternalKey& largest,
+               SequenceNumber smallest_seq,
+               uint64_t oldest_blob = 0) {
     FileMetaData f;
     f.number = file;
     f.file_size = file_size;
     f.smallest = smallest;
     f.largest = largest;
+    f.smallest_seq = smallest_seq;
+    f.oldest_blob = oldest_blob;
     new_files_.push_back(std::make_pair(level, f));
   }
 
@@ -76,6 +104,31 @@ class VersionEdit {
     deleted_files_.insert(std::make_pair(level, file));
   }
 
+  // Add the specified range tombstone.
+  void AddRangeDeletion(const RangeTombstone& tombstone) {
+    new_range_dels_.push_back(tombstone);
+  }
+
+  // Delete the range tombstone with the specified sequence number.
+  void DeleteRangeDeletion(SequenceNumber sequence) {
+    deleted_range_dels_.insert(sequence);
+  }
+
+  // Add the specified blob file, which has "garbage_bytes" of garbage.
+  void AddBlobFile(uint64_t file, uint64_t file_size,
+                   uint64_t garbage_bytes = 0) {
+    BlobFileMetaData b;
+    b.file_size = file_size;
+    b.garbage_bytes = garbage_bytes;
+    new_blob_files_.push_back(std::make_pair(file, b));
+  }
+
+  // Count "bytes" more of the specified blob file as garbage.  A blob file
+  // is dropped from the version once all of it is garbage.
+  void AddBlobGarbage(uint64_t file, uint64_t bytes) {
+    blob_garbage_[file] += bytes;
+  }
+
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(const Slice& src);
 
@@ -100,6 +153,10 @@ class VersionEdit {
   std::vector< std::pair<int, InternalKey> > compact_pointers_;
   DeletedFileSet deleted_files_;
   std::vector< std::pair<int, FileMetaData> > new_files_;
+  std::set<SequenceNumber> deleted_range_dels_;
+  std::vector<RangeTombstone> new_range_dels_;
+  std::vector< std::pair<uint64_t, BlobFileMetaData> > new_blob_files_;
+  std::map<uint64_t, uint64_t> blob_garbage_;
 };
 
 }  // namespace leveldb
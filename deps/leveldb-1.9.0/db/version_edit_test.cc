@@ -27,9 +27,18 @@ TEST(VersionEditTest, EncodeDecode) {
     TestEncodeDecode(edit);
     edit.AddFile(3, kBig + 300 + i, kBig + 400 + i,
                  InternalKey("foo", kBig + 500 + i, kTypeValue),
-                 InternalKey("zoo", kBig + 600 + i, kTypeDeletion));
+                 InternalKey("zoo", kBig + 600 + i, kTypeDeletion),
+                 kBig + 500 + i);
     edit.DeleteFile(4, kBig + 700 + i);
+    edit.AddRangeDeletion(RangeTombstone("bar", "baz", kBig + 800 + i));
+    edit.DeleteRangeDeletion(kBig + 850 + i);
     edit.SetCompactPointer(i, InternalKey("x", kBig + 900 + i, kTypeValue));
+    edit.AddFile(5, kBig + 1100 + i, kBig + 1200 + i,
+                 InternalKey("goo", kBig + 1300 + i, kTypeBlobIndex),
+                 InternalKey("moo", kBig + 1400 + i, kTypeValue),
+                 kBig + 1300 + i, kBig + 1500 + i);
+    edit.AddBlobFile(kBig + 1600 + i, kBig + 1700 + i, kBig + i);
+    edit.AddBlobGarbage(kBig + 1800 + i, kBig + 1900 + i);
   }
 
   edit.SetComparatorName("foo");
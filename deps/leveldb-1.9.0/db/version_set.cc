@@ -6,44 +6,56 @@
 
 #include <algorithm>
 #include <stdio.h>
+#include "db/blob_file.h"
 #include "db/filename.h"
 #include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "db/memtable.h"
+#include "db/merge_helper.h"
 #include "db/table_cache.h"
 #include "leveldb/env.h"
 #include "leveldb/table_builder.h"
 #include "table/merger.h"
+#include "table/prefix_filter_iterator.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
 #include "util/logging.h"
 
 namespace leveldb {
 
-static const int kTargetFileSize = 2 * 1048576;
+// Maximum bytes of overlaps in grandparent (i.e., level+2), in target
+// file sizes, before we stop building a single file in a level->level+1
+// compaction.
+static const int64_t kMaxGrandParentOverlapFiles = 10;
 
-// Maximum bytes of overlaps in grandparent (i.e., level+2) before we
-// stop building a single file in a level->level+1 compaction.
-static const int64_t kMaxGrandParentOverlapBytes = 10 * kTargetFileSize;
+// Maximum number of bytes in all compacted files, in target file sizes.
+// We avoid expanding the lower level file set of a compaction if it would
+// make the total compaction cover more than this many bytes.
+static const int64_t kExpandedCompactionByteSizeFiles = 25;
 
-// Maximum number of bytes in all compacted files.  We avoid expanding
-// the lower level file set of a compaction if it would make the
-// total compaction cover more than this many bytes.
-static const int64_t kExpandedCompactionByteSizeLimit = 25 * kTargetFileSize;
+// Point lookups pin the metadata of the tables of levels below this one
+// (see Options::pinned_metadata_size).
+static const int kPinnedMetadataLevels = 2;
 
-static double MaxBytesForLevel(int level) {
+static double MaxBytesForLevel(const Options* options, int level) {
   // Note: the result for level zero is not really used since we set
   // the level-0 compaction threshold based on number of files.
-  double result = 10 * 1048576.0;  // Result for both level-0 and level-1
+  double result = options->max_bytes_for_level_base;  // Level-0 and level-1
   while (level > 1) {
-    result *= 10;
+    result *= options->max_bytes_for_level_multiplier;
     level--;
   }
   return result;
 }
 
-static uint64_t MaxFileSizeForLevel(int level) {
-  return kTargetFileSize;  // We could vary per level to reduce number of files?
+// Size of the files built by compactions out of "level".
+static uint64_t MaxFileSizeForLevel(const Options* options, int level) {
+  uint64_t result = options->target_file_size_base;  // Written to level-1
+  while (level > 0) {
+    result *= options->target_file_size_multiplier;
+    level--;
+  }
+  return result;
 }
 
 static int64_t TotalFileSize(const std::vector<FileMetaData*>& files) {
@@ -68,6 +80,18 @@ std::string IntSetToString(const std::set<uint64_t>& s) {
 }
 }  // namespace
 
+Version::Version(VersionSet* vset)
+    : vset_(vset), next_(this), prev_(this), refs_(0),
+      range_del_map_(vset->icmp_.user_comparator()),
+      file_to_compact_(NULL),
+      file_to_compact_level_(-1),
+      compaction_score_(-1),
+      compaction_level_(-1) {
+  for (int level = 0; level < config::kNumLevels; level++) {
+    compaction_scores_[level] = -1;
+  }
+}
+
 Version::~Version() {
   assert(refs_ == 0);
 
@@ -229,11 +253,62 @@ static Iterator* GetFileIterator(void* arg,
   }
 }
 
+// Like GetFileIterator(), for compaction inputs read with direct I/O.
+static Iterator* GetDirectFileIterator(void* arg,
+                                       const ReadOptions& options,
+                                       const Slice& file_value) {
+  TableCache* cache = reinterpret_cast<TableCache*>(arg);
+  if (file_value.size() != 16) {
+    return NewErrorIterator(
+        Status::Corruption("FileReader invoked with unexpected value"));
+  } else {
+    return cache->NewDirectIterator(options,
+                                    DecodeFixed64(file_value.data()),
+                                    DecodeFixed64(file_value.data() + 8));
+  }
+}
+
+// The prefix_same_as_start check of a concatenating iterator: only the
+// file a seek lands in can hold the first key at or after the target, so
+// if its filters rule out the prefix there is no need to move on to the
+// following files.
+namespace {
+struct LevelPrefixCheck {
+  TableCache* table_cache;
+  const InternalKeyComparator* icmp;
+  const std::vector<FileMetaData*>* files;
+};
+
+bool LevelPrefixMayMatch(void* arg, const Slice& target) {
+  const LevelPrefixCheck* check = reinterpret_cast<LevelPrefixCheck*>(arg);
+  const uint32_t index = FindFile(*check->icmp, *check->files, target);
+  if (index >= check->files->size()) {
+    return false;
+  }
+  const FileMetaData* f = (*check->files)[index];
+  return check->table_cache->PrefixMayMatch(f->number, f->file_size, target);
+}
+
+void DeleteLevelPrefixCheck(void* arg, void* ignored) {
+  delete reinterpret_cast<LevelPrefixCheck*>(arg);
+}
+}  // namespace
+
 Iterator* Version::NewConcatenatingIterator(const ReadOptions& options,
                                             int level) const {
-  return NewTwoLevelIterator(
+  Iterator* iter = NewTwoLevelIterator(
       new LevelFileNumIterator(vset_->icmp_, &files_[level]),
-      &GetFileIterator, vset_->table_cache_, options);
+      &GetFileIterator, vset_->table_cache_, options, &vset_->icmp_);
+  if (options.prefix_same_as_start &&
+      vset_->options_->prefix_extractor != NULL) {
+    LevelPrefixCheck* check = new LevelPrefixCheck;
+    check->table_cache = vset_->table_cache_;
+    check->icmp = &vset_->icmp_;
+    check->files = &files_[level];
+    iter = NewPrefixFilterIterator(iter, &LevelPrefixMayMatch, check);
+    iter->RegisterCleanup(&DeleteLevelPrefixCheck, check, NULL);
+  }
+  return iter;
 }
 
 void Version::AddIterators(const ReadOptions& options,
@@ -262,12 +337,17 @@ enum SaverState {
   kFound,
   kDeleted,
   kCorrupt,
+  kMerge,
+  kNoMergeOperator,
 };
 struct Saver {
   SaverState state;
   const Comparator* ucmp;
   Slice user_key;
   std::string* value;
+  SequenceNumber sequence;
+  MergeContext* merge;
+  bool is_blob;                 // *value holds a blob index
 };
 }
 static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
@@ -277,9 +357,25 @@ static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
     s->state = kCorrupt;
   } else {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
-      s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
-      if (s->state == kFound) {
-        s->value->assign(v.data(), v.size());
+      s->sequence = parsed_key.sequence;
+      switch (parsed_key.type) {
+        case kTypeValue:
+        case kTypeBlobIndex:
+          s->state = kFound;
+          s->is_blob = (parsed_key.type == kTypeBlobIndex);
+          s->value->assign(v.data(), v.size());
+          break;
+        case kTypeMerge:
+          if (s->merge == NULL) {
+            s->state = kNoMergeOperator;
+          } else {
+            s->state = kMerge;
+            s->merge->Add(parsed_key.sequence, v);
+          }
+          break;
+        default:
+          s->state = kDeleted;
+          break;
       }
     }
   }
@@ -292,6 +388,8 @@ static bool NewestFirst(FileMetaData* a, FileMetaData* b) {
 Status Version::Get(const ReadOptions& options,
                     const LookupKey& k,
                     std::string* value,
+                    SequenceNumber* seq,
+                    MergeContext* merge,
                     GetStats* stats) {
   Slice ikey = k.internal_key();
   Slice user_key = k.user_key();
@@ -365,15 +463,38 @@ Status Version::Get(const ReadOptions& options,
       saver.ucmp = ucmp;
       saver.user_key = user_key;
       saver.value = value;
+      saver.merge = merge;
+      saver.is_blob = false;
+      if (options.stats != NULL) {
+        options.stats->table_gets++;
+      }
       s = vset_->table_cache_->Get(options, f->number, f->file_size,
-                                   ikey, &saver, SaveValue);
+                                   ikey, &saver, SaveValue,
+                                   level < kPinnedMetadataLevels);
+      // A merge operand may sit above more entries of the key in the
+      // same file, so look again just below it.
+      while (s.ok() && saver.state == kMerge && saver.sequence > 0) {
+        LookupKey below(user_key, saver.sequence - 1);
+        saver.state = kNotFound;
+        s = vset_->table_cache_->Get(options, f->number, f->file_size,
+                                     below.internal_key(), &saver, SaveValue,
+                                     level < kPinnedMetadataLevels);
+      }
       if (!s.ok()) {
         return s;
       }
       switch (saver.state) {
         case kNotFound:
+        case kMerge:
           break;      // Keep searching in other files
         case kFound:
+          if (seq != NULL) {
+            *seq = saver.sequence;
+          }
+          if (saver.is_blob) {
+            const std::string index = *value;
+            s = vset_->blob_cache_->Get(options.verify_checksums, index, value);
+          }
           return s;
         case kDeleted:
           s = Status::NotFound(Slice());  // Use empty error message for speed
@@ -381,6 +502,9 @@ Status Version::Get(const ReadOptions& options,
         case kCorrupt:
           s = Status::Corruption("corrupted key for ", user_key);
           return s;
+        case kNoMergeOperator:
+          s = Status::NotSupported("merge operand without a merge operator");
+          return s;
       }
     }
   }
@@ -388,10 +512,10 @@ Status Version::Get(const ReadOptions& options,
   return Status::NotFound(Slice());  // Use an empty error message for speed
 }
 
-bool Version::UpdateStats(const GetStats& stats) {
+bool Version::UpdateStats(const GetStats& stats, int seeks) {
   FileMetaData* f = stats.seek_file;
   if (f != NULL) {
-    f->allowed_seeks--;
+    f->allowed_seeks -= seeks;
     if (f->allowed_seeks <= 0 && file_to_compact_ == NULL) {
       file_to_compact_ = f;
       file_to_compact_level_ = stats.seek_file_level;
@@ -401,6 +525,58 @@ bool Version::UpdateStats(const GetStats& stats) {
   return false;
 }
 
+bool Version::RecordReadSample(const Slice& internal_key, uint64_t skipped,
+                               int* files) {
+  *files = 0;
+  ParsedInternalKey ikey;
+  if (!ParseInternalKey(internal_key, &ikey)) {
+    return false;
+  }
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+
+  // Find the files that overlap the key, charging the newest level-0 file
+  // or else the file of the lowest numbered level.
+  GetStats stats;
+  stats.seek_file = NULL;
+  stats.seek_file_level = -1;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    const std::vector<FileMetaData*>& level_files = files_[level];
+    if (level == 0) {
+      for (size_t i = 0; i < level_files.size(); i++) {
+        FileMetaData* f = level_files[i];
+        if (ucmp->Compare(ikey.user_key, f->smallest.user_key()) >= 0 &&
+            ucmp->Compare(ikey.user_key, f->largest.user_key()) <= 0) {
+          if (stats.seek_file == NULL || NewestFirst(f, stats.seek_file)) {
+            stats.seek_file = f;
+            stats.seek_file_level = 0;
+          }
+          ++*files;
+        }
+      }
+    } else {
+      uint32_t index = FindFile(vset_->icmp_, level_files, internal_key);
+      if (index < level_files.size() &&
+          ucmp->Compare(ikey.user_key,
+                        level_files[index]->smallest.user_key()) >= 0) {
+        if (stats.seek_file == NULL) {
+          stats.seek_file = level_files[index];
+          stats.seek_file_level = level;
+        }
+        ++*files;
+      }
+    }
+  }
+
+  // A key in a single file costs nothing to merge, and compacting the file
+  // would not make the read cheaper.
+  if (*files < 2) {
+    return false;
+  }
+  const int seeks = (*files - 1) +
+      static_cast<int>(skipped / config::kSkippedEntriesPerSeek);
+  return UpdateStats(stats, seeks);
+}
+
 void Version::Ref() {
   ++refs_;
 }
@@ -414,6 +590,30 @@ void Version::Unref() {
   }
 }
 
+void Version::GetObsoleteRangeDeletions(
+    std::vector<SequenceNumber>* obsolete) const {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  for (size_t i = 0; i < range_dels_.size(); i++) {
+    const RangeTombstone& t = range_dels_[i];
+    bool live = false;
+    for (int level = 0; !live && level < config::kNumLevels; level++) {
+      const std::vector<FileMetaData*>& files = files_[level];
+      for (size_t j = 0; j < files.size(); j++) {
+        const FileMetaData* f = files[j];
+        if (f->smallest_seq < t.sequence &&
+            ucmp->Compare(f->largest.user_key(), t.start) >= 0 &&
+            ucmp->Compare(f->smallest.user_key(), t.end) < 0) {
+          live = true;
+          break;
+        }
+      }
+    }
+    if (!live) {
+      obsolete->push_back(t.sequence);
+    }
+  }
+}
+
 bool Version::OverlapInLevel(int level,
                              const Slice* smallest_user_key,
                              const Slice* largest_user_key) {
@@ -437,7 +637,9 @@ int Version::PickLevelForMemTableOutput(
       }
       GetOverlappingInputs(level + 2, &start, &limit, &overlaps);
       const int64_t sum = TotalFileSize(overlaps);
-      if (sum > kMaxGrandParentOverlapBytes) {
+      if (sum > kMaxGrandParentOverlapFiles *
+                static_cast<int64_t>(MaxFileSizeForLevel(vset_->options_,
+                                                         level))) {
         break;
       }
       level++;
@@ -488,6 +690,25 @@ void Version::GetOverlappingInputs(
   }
 }
 
+bool Version::NeedsBlobRelocation(uint64_t blob_number) const {
+  std::map<uint64_t, BlobFileMetaData>::const_iterator iter =
+      blob_files_.find(blob_number);
+  if (iter == blob_files_.end()) {
+    return false;
+  }
+  const BlobFileMetaData& b = iter->second;
+  return b.live_bytes() <
+      vset_->options_->blob_file_min_live_ratio * b.file_size;
+}
+
+void Version::GetFileSizes(std::map<uint64_t, uint64_t>* sizes) const {
+  for (int level = 0; level < config::kNumLevels; level++) {
+    for (size_t i = 0; i < files_[level].size(); i++) {
+      (*sizes)[files_[level][i]->number] = files_[level][i]->file_size;
+    }
+  }
+}
+
 std::string Version::DebugString() const {
   std::string r;
   for (int level = 0; level < config::kNumLevels; level++) {
@@ -543,12 +764,16 @@ class VersionSet::Builder {
   VersionSet* vset_;
   Version* base_;
   LevelState levels_[config::kNumLevels];
+  std::set<SequenceNumber> deleted_range_dels_;
+  std::vector<RangeTombstone> added_range_dels_;
+  std::map<uint64_t, BlobFileMetaData> blob_files_;
 
  public:
   // Initialize a builder with the files from *base and other info from *vset
   Builder(VersionSet* vset, Version* base)
       : vset_(vset),
-        base_(base) {
+        base_(base),
+        blob_files_(base->blob_files_) {
     base_->Ref();
     BySmallestKey cmp;
     cmp.internal_comparator = &vset_->icmp_;
@@ -622,6 +847,30 @@ class VersionSet::Builder {
       levels_[level].deleted_files.erase(f->number);
       levels_[level].added_files->insert(f);
     }
+
+    // Update range tombstones
+    deleted_range_dels_.insert(edit->deleted_range_dels_.begin(),
+                               edit->deleted_range_dels_.end());
+    added_range_dels_.insert(added_range_dels_.end(),
+                             edit->new_range_dels_.begin(),
+                             edit->new_range_dels_.end());
+
+    // Update blob files.  Garbage of a blob file that is already gone
+    // is ignored.
+    for (size_t i = 0; i < edit->new_blob_files_.size(); i++) {
+      blob_files_[edit->new_blob_files_[i].first] =
+          edit->new_blob_files_[i].second;
+    }
+    for (std::map<uint64_t, uint64_t>::const_iterator iter =
+             edit->blob_garbage_.begin();
+         iter != edit->blob_garbage_.end();
+         ++iter) {
+      std::map<uint64_t, BlobFileMetaData>::iterator b =
+          blob_files_.find(iter->first);
+      if (b != blob_files_.end()) {
+        b->second.garbage_bytes += iter->second;
+      }
+    }
   }
 
   // Save the current state in *v.
@@ -671,6 +920,34 @@ class VersionSet::Builder {
       }
 #endif
     }
+
+    if (deleted_range_dels_.empty() && added_range_dels_.empty()) {
+      v->range_dels_ = base_->range_dels_;
+      v->range_del_map_ = base_->range_del_map_;
+    } else {
+      MaybeAddRangeDeletions(v, base_->range_dels_);
+      MaybeAddRangeDeletions(v, added_range_dels_);
+      v->range_del_map_.Build(v->range_dels_);
+    }
+
+    // A blob file that is all garbage has no tables left pointing into it.
+    for (std::map<uint64_t, BlobFileMetaData>::const_iterator iter =
+             blob_files_.begin();
+         iter != blob_files_.end();
+         ++iter) {
+      if (iter->second.live_bytes() > 0) {
+        v->blob_files_.insert(*iter);
+      }
+    }
+  }
+
+  void MaybeAddRangeDeletions(Version* v,
+                              const std::vector<RangeTombstone>& tombstones) {
+    for (size_t i = 0; i < tombstones.size(); i++) {
+      if (deleted_range_dels_.count(tombstones[i].sequence) == 0) {
+        v->range_dels_.push_back(tombstones[i]);
+      }
+    }
   }
 
   void MaybeAddFile(Version* v, int level, FileMetaData* f) {
@@ -692,11 +969,13 @@ class VersionSet::Builder {
 VersionSet::VersionSet(const std::string& dbname,
                        const Options* options,
                        TableCache* table_cache,
+                       BlobCache* blob_cache,
                        const InternalKeyComparator* cmp)
     : env_(options->env),
       dbname_(dbname),
       options_(options),
       table_cache_(table_cache),
+      blob_cache_(blob_cache),
       icmp_(*cmp),
       next_file_number_(2),
       manifest_file_number_(0),  // Filled by Recover()
@@ -732,6 +1011,17 @@ void VersionSet::AppendVersion(Version* v) {
   v->next_ = &dummy_versions_;
   v->prev_->next_ = v;
   v->next_->prev_ = v;
+
+  if (options_->pinned_metadata_size > 0) {
+    // Tables stay pinned only while they are in the pinned levels.
+    std::set<uint64_t> files;
+    for (int level = 0; level < kPinnedMetadataLevels; level++) {
+      for (size_t i = 0; i < v->files_[level].size(); i++) {
+        files.insert(v->files_[level][i]->number);
+      }
+    }
+    table_cache_->RetainPinned(files);
+  }
 }
 
 Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
@@ -948,7 +1238,33 @@ void VersionSet::MarkFileNumberUsed(uint64_t number) {
   }
 }
 
+void VersionSet::ComputeMaxBytesForLevels(Version* v) const {
+  for (int level = 0; level < config::kNumLevels; level++) {
+    v->max_bytes_for_level_[level] = MaxBytesForLevel(options_, level);
+  }
+  if (!options_->level_compaction_dynamic_level_bytes) {
+    return;
+  }
+
+  // Scale the limits of the levels above the deepest non-empty one down
+  // from its size.  The deepest level keeps its static limit, so that it
+  // spills into the next one once it is full.
+  int last = config::kNumLevels - 1;
+  while (last > 1 && v->files_[last].empty()) {
+    last--;
+  }
+  double limit = TotalFileSize(v->files_[last]);
+  for (int level = last - 1; level >= 1; level--) {
+    limit /= options_->max_bytes_for_level_multiplier;
+    const double base = options_->max_bytes_for_level_base;
+    v->max_bytes_for_level_[level] =
+        std::min(v->max_bytes_for_level_[level], std::max(limit, base));
+  }
+}
+
 void VersionSet::Finalize(Version* v) {
+  ComputeMaxBytesForLevels(v);
+
   // Precomputed best level for next compaction
   int best_level = -1;
   double best_score = -1;
@@ -968,12 +1284,13 @@ void VersionSet::Finalize(Version* v) {
       // setting, or very high compression ratios, or lots of
       // overwrites/deletions).
       score = v->files_[level].size() /
-          static_cast<double>(config::kL0_CompactionTrigger);
+          static_cast<double>(options_->level0_file_num_compaction_trigger);
     } else {
       // Compute the ratio of current size to size limit.
       const uint64_t level_bytes = TotalFileSize(v->files_[level]);
-      score = static_cast<double>(level_bytes) / MaxBytesForLevel(level);
+      score = static_cast<double>(level_bytes) / v->max_bytes_for_level_[level];
     }
+    v->compaction_scores_[level] = score;
 
     if (score > best_score) {
       best_level = level;
@@ -983,21 +1300,72 @@ void VersionSet::Finalize(Version* v) {
 
   v->compaction_level_ = best_level;
   v->compaction_score_ = best_score;
+
+  // Compact a table that points into a blob file with too much garbage,
+  // which copies its values out, once there is nothing better to do.
+  // Tables at the last level are left to the compactions that reach them.
+  if (v->file_to_compact_ == NULL && !v->blob_files_.empty()) {
+    for (int level = 0;
+         level < config::kNumLevels-1 && v->file_to_compact_ == NULL;
+         level++) {
+      const std::vector<FileMetaData*>& files = v->files_[level];
+      for (size_t i = 0; i < files.size(); i++) {
+        if (files[i]->oldest_blob != 0 &&
+            v->NeedsBlobRelocation(files[i]->oldest_blob)) {
+          v->file_to_compact_ = files[i];
+          v->file_to_compact_level_ = level;
+          break;
+        }
+      }
+    }
+  }
 }
 
 Status VersionSet::WriteSnapshot(log::Writer* log) {
   // TODO: Break up into multiple records to reduce memory usage on recovery?
+  VersionEdit edit;
+  EncodeSnapshot(&edit);
 
-  // Save metadata
+  std::string record;
+  edit.EncodeTo(&record);
+  return log->AddRecord(record);
+}
+
+void VersionSet::EncodeCheckpoint(uint64_t next_file, std::string* record,
+                                  std::vector<uint64_t>* files,
+                                  std::vector<uint64_t>* blob_files) {
   VersionEdit edit;
-  edit.SetComparatorName(icmp_.user_comparator()->Name());
+  EncodeSnapshot(&edit);
+  edit.SetLogNumber(0);
+  edit.SetPrevLogNumber(0);
+  edit.SetNextFile(next_file);
+  edit.SetLastSequence(last_sequence_);
+  edit.EncodeTo(record);
+
+  for (int level = 0; level < config::kNumLevels; level++) {
+    const std::vector<FileMetaData*>& level_files = current_->files_[level];
+    for (size_t i = 0; i < level_files.size(); i++) {
+      files->push_back(level_files[i]->number);
+    }
+  }
+  for (std::map<uint64_t, BlobFileMetaData>::const_iterator iter =
+           current_->blob_files_.begin();
+       iter != current_->blob_files_.end();
+       ++iter) {
+    blob_files->push_back(iter->first);
+  }
+}
+
+void VersionSet::EncodeSnapshot(VersionEdit* edit) {
+  // Save metadata
+  edit->SetComparatorName(icmp_.user_comparator()->Name());
 
   // Save compaction pointers
   for (int level = 0; level < config::kNumLevels; level++) {
     if (!compact_pointer_[level].empty()) {
       InternalKey key;
       key.DecodeFrom(compact_pointer_[level]);
-      edit.SetCompactPointer(level, key);
+      edit->SetCompactPointer(level, key);
     }
   }
 
@@ -1006,13 +1374,24 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
     const std::vector<FileMetaData*>& files = current_->files_[level];
     for (size_t i = 0; i < files.size(); i++) {
       const FileMetaData* f = files[i];
-      edit.AddFile(level, f->number, f->file_size, f->smallest, f->largest);
+      edit->AddFile(level, f->number, f->file_size, f->smallest, f->largest,
+                    f->smallest_seq, f->oldest_blob);
     }
   }
 
-  std::string record;
-  edit.EncodeTo(&record);
-  return log->AddRecord(record);
+  // Save range tombstones
+  for (size_t i = 0; i < current_->range_dels_.size(); i++) {
+    edit->AddRangeDeletion(current_->range_dels_[i]);
+  }
+
+  // Save blob files
+  for (std::map<uint64_t, BlobFileMetaData>::const_iterator iter =
+           current_->blob_files_.begin();
+       iter != current_->blob_files_.end();
+       ++iter) {
+    edit->AddBlobFile(iter->first, iter->second.file_size,
+                      iter->second.garbage_bytes);
+  }
 }
 
 int VersionSet::NumLevelFiles(int level) const {
@@ -1103,6 +1482,12 @@ void VersionSet::AddLiveFiles(std::set<uint64_t>* live) {
         live->insert(files[i]->number);
       }
     }
+    for (std::map<uint64_t, BlobFileMetaData>::const_iterator iter =
+             v->blob_files_.begin();
+         iter != v->blob_files_.end();
+         ++iter) {
+      live->insert(iter->first);
+    }
   }
 }
 
@@ -1170,26 +1555,50 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
   ReadOptions options;
   options.verify_checksums = options_->paranoid_checks;
   options.fill_cache = false;
+  options.sequential_scan = true;
+  options.readahead_size = options_->compaction_readahead_size;
+
+  // With direct I/O every input table is opened just for this compaction
+  const bool direct = options_->use_direct_io_for_compaction;
+  Iterator* (*file_function)(void*, const ReadOptions&, const Slice&) =
+      direct ? &GetDirectFileIterator : &GetFileIterator;
 
   // Level-0 files have to be merged together.  For other levels,
   // we will make a concatenating iterator per level.
   // TODO(opt): use concatenating iterator for level-0 if there is no overlap
-  const int space = (c->level() == 0 ? c->inputs_[0].size() + 1 : 2);
+  const int space = (c->level() == 0 || !c->input_levels_.empty() ?
+                     c->inputs_[0].size() + 1 : 2);
   Iterator** list = new Iterator*[space];
   int num = 0;
   for (int which = 0; which < 2; which++) {
     if (!c->inputs_[which].empty()) {
-      if (c->level() + which == 0) {
+      if (which == 0 && !c->input_levels_.empty()) {
+        // Tiered compactions read some level-0 files and whole levels, so
+        // each level past level-0 is concatenated from the input version.
+        const std::vector<FileMetaData*>& files = c->inputs_[0];
+        for (size_t i = 0; i < files.size(); i++) {
+          const int level = c->input_levels_[i];
+          if (level == 0) {
+            list[num++] = NewTableIterator(
+                options, direct, files[i]->number, files[i]->file_size);
+          } else if (i == 0 || c->input_levels_[i - 1] != level) {
+            list[num++] = NewTwoLevelIterator(
+                new Version::LevelFileNumIterator(
+                    icmp_, &c->input_version_->files_[level]),
+                file_function, table_cache_, options);
+          }
+        }
+      } else if (c->level() + which == 0) {
         const std::vector<FileMetaData*>& files = c->inputs_[which];
         for (size_t i = 0; i < files.size(); i++) {
-          list[num++] = table_cache_->NewIterator(
-              options, files[i]->number, files[i]->file_size);
+          list[num++] = NewTableIterator(
+              options, direct, files[i]->number, files[i]->file_size);
         }
       } else {
         // Create concatenating iterator for the files from this level
         list[num++] = NewTwoLevelIterator(
             new Version::LevelFileNumIterator(icmp_, &c->inputs_[which]),
-            &GetFileIterator, table_cache_, options);
+            file_function, table_cache_, options);
       }
     }
   }
@@ -1199,19 +1608,222 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
   return result;
 }
 
-Compaction* VersionSet::PickCompaction() {
-  Compaction* c;
-  int level;
+Iterator* VersionSet::NewTableIterator(const ReadOptions& options, bool direct,
+                                       uint64_t number, uint64_t size) {
+  if (direct) {
+    return table_cache_->NewDirectIterator(options, number, size);
+  }
+  return table_cache_->NewIterator(options, number, size);
+}
+
+static bool LevelsFree(const bool* busy, int level) {
+  if (busy == NULL) {
+    return true;
+  }
+  return !busy[level] && (level + 1 >= config::kNumLevels || !busy[level + 1]);
+}
+
+int VersionSet::PickLevel(const bool* busy, bool* is_seek) const {
+  const Version* v = current_;
+  if (is_seek != NULL) {
+    *is_seek = false;
+  }
 
   // We prefer compactions triggered by too much data in a level over
   // the compactions triggered by seeks.
-  const bool size_compaction = (current_->compaction_score_ >= 1);
-  const bool seek_compaction = (current_->file_to_compact_ != NULL);
-  if (size_compaction) {
-    level = current_->compaction_level_;
-    assert(level >= 0);
+  if (v->compaction_score_ >= 1 && LevelsFree(busy, v->compaction_level_)) {
+    return v->compaction_level_;
+  }
+  if (busy != NULL) {
+    // The best level is busy; fall back to the best free one.
+    int best_level = -1;
+    double best_score = 1;
+    for (int level = 0; level < config::kNumLevels-1; level++) {
+      if (v->compaction_scores_[level] >= best_score &&
+          LevelsFree(busy, level)) {
+        best_level = level;
+        best_score = v->compaction_scores_[level];
+      }
+    }
+    if (best_level >= 0) {
+      return best_level;
+    }
+  }
+  if (v->file_to_compact_ != NULL &&
+      LevelsFree(busy, v->file_to_compact_level_)) {
+    if (is_seek != NULL) {
+      *is_seek = true;
+    }
+    return v->file_to_compact_level_;
+  }
+  return -1;
+}
+
+uint64_t VersionSet::CompactionBacklogBytes() const {
+  const Version* v = current_;
+  uint64_t backlog = 0;
+  if (options_->compaction_style == kCompactionStyleTiered) {
+    // Only the next merge is known ahead of time.
+    TieredRuns runs;
+    if (PickTieredRuns(NULL, &runs)) {
+      std::vector<FileMetaData*> level0 = v->files_[0];
+      std::sort(level0.begin(), level0.end(), NewestFirst);
+      for (size_t i = level0.size() - runs.num_level0; i < level0.size(); i++) {
+        backlog += level0[i]->file_size;
+      }
+      for (int level = std::max(runs.first_level, 1);
+           level <= runs.output_level; level++) {
+        backlog += TotalFileSize(v->files_[level]);
+      }
+    }
+    return backlog;
+  }
+  if (v->files_[0].size() >=
+      static_cast<size_t>(options_->level0_file_num_compaction_trigger)) {
+    backlog += TotalFileSize(v->files_[0]);
+  }
+  for (int level = 1; level < config::kNumLevels-1; level++) {
+    const uint64_t level_bytes = TotalFileSize(v->files_[level]);
+    const double limit = v->max_bytes_for_level_[level];
+    if (level_bytes > limit) {
+      backlog += level_bytes - static_cast<uint64_t>(limit);
+    }
+  }
+  return backlog;
+}
+
+bool VersionSet::PickTieredRuns(const bool* busy, TieredRuns* runs) const {
+  const Version* v = current_;
+
+  // List the sorted runs from newest to oldest: each level-0 file, then
+  // each non-empty level.
+  std::vector<FileMetaData*> level0 = v->files_[0];
+  std::sort(level0.begin(), level0.end(), NewestFirst);
+  std::vector<int> levels;
+  std::vector<uint64_t> sizes;
+  for (size_t i = 0; i < level0.size(); i++) {
+    levels.push_back(0);
+    sizes.push_back(level0[i]->file_size);
+  }
+  for (int level = 1; level < config::kNumLevels; level++) {
+    if (!v->files_[level].empty()) {
+      levels.push_back(level);
+      sizes.push_back(TotalFileSize(v->files_[level]));
+    }
+  }
+  const int n = levels.size();
+  const int n0 = level0.size();
+  if (n < options_->level0_file_num_compaction_trigger) {
+    return false;
+  }
+
+  // Try the runs starting at each one in turn, adding the older runs that
+  // are not much larger than those before them.  If no runs have similar
+  // sizes, all of level-0 is merged so that it does not grow without
+  // bound.
+  for (int i = 0; i <= n; i++) {
+    int first = i;
+    int last = i;
+    if (i < n) {
+      uint64_t total = sizes[first];
+      while (last + 1 < n &&
+             last + 2 - first <= options_->tiered_max_fan_in &&
+             sizes[last + 1] * 100 <=
+                 total * (100 + options_->tiered_size_ratio)) {
+        last++;
+        total += sizes[last];
+      }
+      if (last == first) {
+        continue;
+      }
+    } else if (n0 >= 2) {
+      first = 0;
+      last = n0 - 1;
+    } else {
+      break;
+    }
+
+    // Level-0 files that stay must be newer than the output, which is the
+    // oldest run merged, or else the empty level above the newest level
+    // that keeps its run.  Level-1 is merged if there is no such level.
+    if (first < n0 && last < n0 - 1) {
+      continue;
+    }
+    int output;
+    if (last >= n0) {
+      output = levels[last];
+    } else {
+      output = (n0 < n ? levels[n0] : config::kNumLevels) - 1;
+      if (output == 0) {
+        last = n0;
+        output = levels[last];
+      }
+    }
+
+    // Empty levels in between are claimed too, so that no other
+    // compaction puts a run there meanwhile.
+    const int first_level = levels[first];
+    bool free = true;
+    for (int level = first_level; busy != NULL && level <= output; level++) {
+      free = free && !busy[level];
+    }
+    if (!free) {
+      continue;
+    }
+    if (runs != NULL) {
+      runs->num_level0 = (first < n0 ? n0 - first : 0);
+      runs->first_level = first_level;
+      runs->output_level = output;
+    }
+    return true;
+  }
+  return false;
+}
+
+Compaction* VersionSet::PickTieredCompaction(const bool* busy) {
+  TieredRuns runs;
+  if (!PickTieredRuns(busy, &runs)) {
+    return NULL;
+  }
+  Compaction* c = new Compaction(options_, runs.output_level - 1);
+  c->start_level_ = runs.first_level;
+  c->input_version_ = current_;
+  c->input_version_->Ref();
+
+  std::vector<FileMetaData*> level0 = current_->files_[0];
+  std::sort(level0.begin(), level0.end(), NewestFirst);
+  for (size_t i = level0.size() - runs.num_level0; i < level0.size(); i++) {
+    c->inputs_[0].push_back(level0[i]);
+    c->input_levels_.push_back(0);
+  }
+  for (int level = std::max(runs.first_level, 1);
+       level < runs.output_level; level++) {
+    const std::vector<FileMetaData*>& files = current_->files_[level];
+    for (size_t i = 0; i < files.size(); i++) {
+      c->inputs_[0].push_back(files[i]);
+      c->input_levels_.push_back(level);
+    }
+  }
+  c->inputs_[1] = current_->files_[runs.output_level];
+  Log(options_->info_log,
+      "Tiered compaction of %d level-0 files and levels %d..%d\n",
+      runs.num_level0, std::max(runs.first_level, 1), runs.output_level);
+  return c;
+}
+
+Compaction* VersionSet::PickCompaction(const bool* busy) {
+  if (options_->compaction_style == kCompactionStyleTiered) {
+    return PickTieredCompaction(busy);
+  }
+
+  Compaction* c;
+  bool seek_compaction;
+  int level = PickLevel(busy, &seek_compaction);
+
+  if (level >= 0 && !seek_compaction) {
+    assert(level+1 < config::kNumLevels);
     assert(level+1 < config::kNumLevels);
-    c = new Compaction(level);
+    c = new Compaction(options_, level);
 
     // Pick the first file that comes after compact_pointer_[level]
     for (size_t i = 0; i < current_->files_[level].size(); i++) {
@@ -1226,9 +1838,8 @@ Compaction* VersionSet::PickCompaction() {
       // Wrap-around to the beginning of the key space
       c->inputs_[0].push_back(current_->files_[level][0]);
     }
-  } else if (seek_compaction) {
-    level = current_->file_to_compact_level_;
-    c = new Compaction(level);
+  } else if (level >= 0) {
+    c = new Compaction(options_, level);
     c->inputs_[0].push_back(current_->file_to_compact_);
   } else {
     return NULL;
@@ -1273,7 +1884,9 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
     const int64_t inputs1_size = TotalFileSize(c->inputs_[1]);
     const int64_t expanded0_size = TotalFileSize(expanded0);
     if (expanded0.size() > c->inputs_[0].size() &&
-        inputs1_size + expanded0_size < kExpandedCompactionByteSizeLimit) {
+        inputs1_size + expanded0_size <
+            kExpandedCompactionByteSizeFiles *
+            static_cast<int64_t>(c->MaxOutputFileSize())) {
       InternalKey new_start, new_limit;
       GetRange(expanded0, &new_start, &new_limit);
       std::vector<FileMetaData*> expanded1;
@@ -1331,7 +1944,7 @@ Compaction* VersionSet::CompactRange(
   }
 
   // Avoid compacting too much in one shot in case the range is large.
-  const uint64_t limit = MaxFileSizeForLevel(level);
+  const uint64_t limit = MaxFileSizeForLevel(options_, level);
   uint64_t total = 0;
   for (size_t i = 0; i < inputs.size(); i++) {
     uint64_t s = inputs[i]->file_size;
@@ -1342,7 +1955,7 @@ Compaction* VersionSet::CompactRange(
     }
   }
 
-  Compaction* c = new Compaction(level);
+  Compaction* c = new Compaction(options_, level);
   c->input_version_ = current_;
   c->input_version_->Ref();
   c->inputs_[0] = inputs;
@@ -1350,9 +1963,12 @@ Compaction* VersionSet::CompactRange(
   return c;
 }
 
-Compaction::Compaction(int level)
+Compaction::Compaction(const Options* options, int level)
     : level_(level),
-      max_output_file_size_(MaxFileSizeForLevel(level)),
+      start_level_(level),
+      max_output_file_size_(MaxFileSizeForLevel(options, level)),
+      max_grandparent_overlap_bytes_(kMaxGrandParentOverlapFiles *
+                                     max_output_file_size_),
       input_version_(NULL),
       grandparent_index_(0),
       seen_key_(false),
@@ -1368,19 +1984,57 @@ Compaction::~Compaction() {
   }
 }
 
+Compaction* Compaction::NewSubcompaction() const {
+  Compaction* c = new Compaction(input_version_->vset_->options_, level_);
+  c->start_level_ = start_level_;
+  c->input_version_ = input_version_;
+  c->input_version_->Ref();
+  c->inputs_[0] = inputs_[0];
+  c->inputs_[1] = inputs_[1];
+  c->input_levels_ = input_levels_;
+  c->grandparents_ = grandparents_;
+  return c;
+}
+
+bool Compaction::IsRangeDeleted(const Slice& user_key,
+                                SequenceNumber sequence,
+                                SequenceNumber smallest_snapshot) const {
+  return input_version_->range_del_map_.ShouldDelete(user_key, sequence,
+                                                     smallest_snapshot);
+}
+
+SequenceNumber Compaction::MaxAppliedRangeDeletion(
+    SequenceNumber smallest_snapshot) const {
+  SequenceNumber result = 0;
+  const std::vector<RangeTombstone>& range_dels = input_version_->range_dels_;
+  for (size_t i = 0; i < range_dels.size(); i++) {
+    const SequenceNumber seq = range_dels[i].sequence;
+    if (seq <= smallest_snapshot && seq > result) {
+      result = seq;
+    }
+  }
+  return result;
+}
+
 bool Compaction::IsTrivialMove() const {
   // Avoid a move if there is lots of overlapping grandparent data.
   // Otherwise, the move could create a parent file that will require
   // a very expensive merge later on.
+  // A table that points into a blob file with too much garbage is
+  // rewritten so that its values are copied out.
   return (num_input_files(0) == 1 &&
           num_input_files(1) == 0 &&
-          TotalFileSize(grandparents_) <= kMaxGrandParentOverlapBytes);
+          TotalFileSize(grandparents_) <= max_grandparent_overlap_bytes_ &&
+          (inputs_[0][0]->oldest_blob == 0 ||
+           !ShouldRelocateBlob(inputs_[0][0]->oldest_blob)));
 }
 
 void Compaction::AddInputDeletions(VersionEdit* edit) {
   for (int which = 0; which < 2; which++) {
     for (size_t i = 0; i < inputs_[which].size(); i++) {
-      edit->DeleteFile(level_ + which, inputs_[which][i]->number);
+      const int level = (which == 0 && !input_levels_.empty() ?
+                         input_levels_[i] : level_ + which);
+      edit->DeleteFile(level, inputs_[which][i]->number);
     }
   }
 }
@@ -1419,7 +2073,7 @@ bool Compaction::ShouldStopBefore(const Slice& internal_key) {
   }
   seen_key_ = true;
 
-  if (overlapped_bytes_ > kMaxGrandParentOverlapBytes) {
+  if (overlapped_bytes_ > max_grandparent_overlap_bytes_) {
     // Too much overlap for current output; start new output
     overlapped_bytes_ = 0;
     return true;
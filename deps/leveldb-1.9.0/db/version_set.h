@@ -19,7 +19,9 @@
 #include <set>
 #include <vector>
 #include "db/dbformat.h"
+#include "db/range_del.h"
 #include "db/version_edit.h"
+#include "leveldb/options.h"
 #include "port/port.h"
 #include "port/thread_annotations.h"
 
@@ -27,9 +29,11 @@ namespace leveldb {
 
 namespace log { class Writer; }
 
+class BlobCache;
 class Compaction;
 class Iterator;
 class MemTable;
+struct MergeContext;
 class TableBuilder;
 class TableCache;
 class Version;
@@ -63,20 +67,37 @@ class Version {
   // REQUIRES: This version has been saved (see VersionSet::SaveTo)
   void AddIterators(const ReadOptions&, std::vector<Iterator*>* iters);
 
-  // Lookup the value for key.  If found, store it in *val and
-  // return OK.  Else return a non-OK status.  Fills *stats.
+  // Lookup the value for key.  If found, store it in *val and its
+  // sequence number in *seq (if seq is non-NULL), and return OK.  Else
+  // return a non-OK status.  Merge operands above the value are added to
+  // *merge (see MemTable::Get).  Fills *stats.  Range deletions are not
+  // consulted.
   // REQUIRES: lock is not held
   struct GetStats {
     FileMetaData* seek_file;
     int seek_file_level;
   };
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
-             GetStats* stats);
+             SequenceNumber* seq, MergeContext* merge, GetStats* stats);
 
-  // Adds "stats" into the current state.  Returns true if a new
-  // compaction may need to be triggered, false otherwise.
+  // Adds "stats" into the current state, charging "seeks" seeks to the
+  // file.  Returns true if a new compaction may need to be triggered,
+  // false otherwise.
   // REQUIRES: lock is held
-  bool UpdateStats(const GetStats& stats);
+  bool UpdateStats(const GetStats& stats, int seeks = 1);
+
+  // Record a sample of bytes read at the specified internal key after
+  // iterators stepped over "skipped" entries without returning them.
+  // Samples are taken approximately once every config::kReadBytesPeriod
+  // bytes.  If more than one file overlaps the key, the newest is charged
+  // a seek for each extra file merged and for every
+  // config::kSkippedEntriesPerSeek entries skipped, so that the ranges
+  // that scans merge through are compacted like those that point lookups
+  // probe.  Sets *files to the number of files that overlap the key.
+  // Returns true if a new compaction may need to be triggered.
+  // REQUIRES: lock is held
+  bool RecordReadSample(const Slice& internal_key, uint64_t skipped,
+                        int* files);
 
   // Reference count management (so Versions do not disappear out from
   // under live iterators)
@@ -104,6 +125,32 @@ class Version {
 
   int NumFiles(int level) const { return files_[level].size(); }
 
+  // The range tombstones in effect in this version, i.e. those that
+  // have been flushed out of the memtables.
+  const std::vector<RangeTombstone>& range_dels() const {
+    return range_dels_;
+  }
+  const RangeDelMap& range_del_map() const { return range_del_map_; }
+
+  // Store in *obsolete the sequence numbers of the range tombstones that
+  // no longer delete anything: every file that overlaps their range only
+  // holds entries newer than the tombstone.
+  void GetObsoleteRangeDeletions(std::vector<SequenceNumber>* obsolete) const;
+
+  // Store the size of every table file in this version in "*sizes",
+  // keyed by file number.
+  void GetFileSizes(std::map<uint64_t, uint64_t>* sizes) const;
+
+  // The blob files that tables of this version point into, keyed by
+  // file number.
+  const std::map<uint64_t, BlobFileMetaData>& blob_files() const {
+    return blob_files_;
+  }
+
+  // Returns true iff the specified blob file has so much garbage that
+  // compactions should copy its live values to a new blob file.
+  bool NeedsBlobRelocation(uint64_t blob_number) const;
+
   // Return a human readable string that describes this version's contents.
   std::string DebugString() const;
 
@@ -122,6 +169,13 @@ class Version {
   // List of files per level
   std::vector<FileMetaData*> files_[config::kNumLevels];
 
+  // Range tombstones, and an index over them built by VersionSet::SaveTo
+  std::vector<RangeTombstone> range_dels_;
+  RangeDelMap range_del_map_;
+
+  // Blob files, keyed by file number
+  std::map<uint64_t, BlobFileMetaData> blob_files_;
+
   // Next file to compact based on seek stats.
   FileMetaData* file_to_compact_;
   int file_to_compact_level_;
@@ -132,13 +186,15 @@ class Version {
   double compaction_score_;
   int compaction_level_;
 
-  explicit Version(VersionSet* vset)
-      : vset_(vset), next_(this), prev_(this), refs_(0),
-        file_to_compact_(NULL),
-        file_to_compact_level_(-1),
-        compaction_score_(-1),
-        compaction_level_(-1) {
-  }
+  // Per-level compaction scores, also computed by Finalize().  Used to
+  // pick the best level among those not busy with another compaction.
+  double compaction_scores_[config::kNumLevels];
+
+  // The number of bytes each level may hold before it is compacted, also
+  // computed by Finalize().
+  double max_bytes_for_level_[config::kNumLevels];
+
+  explicit Version(VersionSet* vset);
 
   ~Version();
 
@@ -152,6 +208,7 @@ class VersionSet {
   VersionSet(const std::string& dbname,
              const Options* options,
              TableCache* table_cache,
+             BlobCache* blob_cache,
              const InternalKeyComparator*);
   ~VersionSet();
 
@@ -213,7 +270,11 @@ class VersionSet {
   // Returns NULL if there is no compaction to be done.
   // Otherwise returns a pointer to a heap-allocated object that
   // describes the compaction.  Caller should delete the result.
-  Compaction* PickCompaction();
+  //
+  // If "busy" is non-NULL it points to kNumLevels flags; levels whose
+  // flag is set are being compacted by another thread and a compaction
+  // is only picked if neither its level nor the next one is busy.
+  Compaction* PickCompaction(const bool* busy = NULL);
 
   // Return a compaction object for compacting the range [begin,end] in
   // the specified level.  Returns NULL if there is nothing in that
@@ -232,12 +293,32 @@ class VersionSet {
   // The caller should delete the iterator when no longer needed.
   Iterator* MakeInputIterator(Compaction* c);
 
-  // Returns true iff some level needs a compaction.
-  bool NeedsCompaction() const {
+  // Returns true iff some level needs a compaction.  "busy" has the
+  // same meaning as for PickCompaction().
+  bool NeedsCompaction(const bool* busy = NULL) const {
     Version* v = current_;
-    return (v->compaction_score_ >= 1) || (v->file_to_compact_ != NULL);
+    if (options_->compaction_style == kCompactionStyleTiered) {
+      return PickTieredRuns(busy, NULL);
+    }
+    if (busy == NULL) {
+      return (v->compaction_score_ >= 1) || (v->file_to_compact_ != NULL);
+    }
+    return PickLevel(busy, NULL) >= 0;
   }
 
+  // Return an estimate of the number of bytes that compactions must
+  // rewrite before every level of the current version is within its
+  // size limit.
+  uint64_t CompactionBacklogBytes() const;
+
+  // Store in *record a MANIFEST record that describes the current version
+  // on its own, with "next_file" as the next file number and no log, and
+  // store the numbers of the version's table files in *files and those of
+  // its blob files in *blob_files.
+  void EncodeCheckpoint(uint64_t next_file, std::string* record,
+                        std::vector<uint64_t>* files,
+                        std::vector<uint64_t>* blob_files);
+
   // Add all files listed in any live version to *live.
   // May also mutate some internal state.
   void AddLiveFiles(std::set<uint64_t>* live);
@@ -259,8 +340,39 @@ class VersionSet {
   friend class Compaction;
   friend class Version;
 
+  // Return the level PickCompaction() would compact while avoiding the
+  // levels flagged in "busy", or -1 if there is none.  Sets *is_seek to
+  // true if the level was chosen because of seek statistics.
+  int PickLevel(const bool* busy, bool* is_seek) const;
+
+  // The sorted runs that a tiered compaction merges: the oldest
+  // "num_level0" level-0 files and every level in [first_level,
+  // output_level], which are either empty or hold one run each.
+  struct TieredRuns {
+    int num_level0;
+    int first_level;
+    int output_level;
+  };
+
+  // Pick the runs of the current version that the next tiered compaction
+  // merges while avoiding the levels flagged in "busy", store them in
+  // *runs (if non-NULL) and return true, or return false if none need
+  // merging.
+  bool PickTieredRuns(const bool* busy, TieredRuns* runs) const;
+
+  Compaction* PickTieredCompaction(const bool* busy);
+
+  // Return an iterator over a compaction input table, opened with direct
+  // I/O if "direct" is true.
+  Iterator* NewTableIterator(const ReadOptions& options, bool direct,
+                             uint64_t number, uint64_t size);
+
   void Finalize(Version* v);
 
+  // Store in v->max_bytes_for_level_ the number of bytes each level of
+  // "v" may hold.
+  void ComputeMaxBytesForLevels(Version* v) const;
+
   void GetRange(const std::vector<FileMetaData*>& inputs,
                 InternalKey* smallest,
                 InternalKey* largest);
@@ -273,6 +385,10 @@ class VersionSet {
   void SetupOtherInputs(Compaction* c);
 
   // Save current contents to *log
+  // Add the comparator, compaction pointers, files and range tombstones
+  // of the current version to *edit.
+  void EncodeSnapshot(VersionEdit* edit);
+
   Status WriteSnapshot(log::Writer* log);
 
   void AppendVersion(Version* v);
@@ -283,6 +399,7 @@ class VersionSet {
   const std::string dbname_;
   const Options* const options_;
   TableCache* const table_cache_;
+  BlobCache* const blob_cache_;
   const InternalKeyComparator icmp_;
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
@@ -314,6 +431,12 @@ class Compaction {
   // and "level+1" will be merged to produce a set of "level+1" files.
   int level() const { return level_; }
 
+  // Return the lowest level that inputs are read from.  Tiered
+  // compactions merge the runs of several levels into "level+1", and the
+  // first set of inputs then holds the files of levels [start_level,
+  // level]; otherwise this is level().
+  int start_level() const { return start_level_; }
+
   // Return the object that holds the edits to the descriptor done
   // by this compaction.
   VersionEdit* edit() { return &edit_; }
@@ -339,6 +462,23 @@ class Compaction {
   // in levels greater than "level+1".
   bool IsBaseLevelForKey(const Slice& user_key);
 
+  // Returns true iff a range tombstone of the input version deletes the
+  // entry for "user_key" at "sequence" in every snapshot, i.e. the
+  // tombstone is newer than the entry but not newer than "smallest_snapshot".
+  bool IsRangeDeleted(const Slice& user_key, SequenceNumber sequence,
+                      SequenceNumber smallest_snapshot) const;
+
+  // Returns the sequence number of the newest range tombstone of the input
+  // version that is not newer than "smallest_snapshot", or zero if there is
+  // none.  Compaction drops every entry such tombstones delete.
+  SequenceNumber MaxAppliedRangeDeletion(SequenceNumber smallest_snapshot) const;
+
+  // Returns true iff the compaction should copy the value that an entry
+  // points to in the specified blob file into a new blob file.
+  bool ShouldRelocateBlob(uint64_t blob_number) const {
+    return input_version_->NeedsBlobRelocation(blob_number);
+  }
+
   // Returns true iff we should stop building the current output
   // before processing "internal_key".
   bool ShouldStopBefore(const Slice& internal_key);
@@ -347,20 +487,33 @@ class Compaction {
   // is successful.
   void ReleaseInputs();
 
+  // Return a new compaction over the same inputs for use by one
+  // subcompaction.  IsBaseLevelForKey() and ShouldStopBefore() expect
+  // keys in increasing order, so each subcompaction needs its own copy.
+  // REQUIRES: the DB mutex is held (the input version is ref'd), and it
+  // must be held again when the result is deleted.
+  Compaction* NewSubcompaction() const;
+
  private:
   friend class Version;
   friend class VersionSet;
 
-  explicit Compaction(int level);
+  Compaction(const Options* options, int level);
 
   int level_;
+  int start_level_;
   uint64_t max_output_file_size_;
+  int64_t max_grandparent_overlap_bytes_;
   Version* input_version_;
   VersionEdit edit_;
 
   // Each compaction reads inputs from "level_" and "level_+1"
   std::vector<FileMetaData*> inputs_[2];      // The two sets of inputs
 
+  // The level of each file in inputs_[0] if the compaction is tiered,
+  // otherwise empty
+  std::vector<int> input_levels_;
+
   // State used to check for number of of overlapping grandparent files
   // (parent == level_ + 1, grandparent == level_ + 2)
   std::vector<FileMetaData*> grandparents_;
@@ -38,8 +38,16 @@ class WriteBatchInternal {
 
   static void SetContents(WriteBatch* batch, const Slice& contents);
 
+  // Exchange the contents of "a" and "b".
+  static void Swap(WriteBatch* a, WriteBatch* b);
+
   static Status InsertInto(const WriteBatch* batch, MemTable* memtable);
 
+  // Like InsertInto(), but may run concurrently with other calls to
+  // InsertIntoConcurrently() for the same memtable.
+  static Status InsertIntoConcurrently(const WriteBatch* batch,
+                                       MemTable* memtable);
+
   static void Append(WriteBatch* dst, const WriteBatch* src);
 };
 
@@ -38,11 +38,30 @@ static std::string PrintContents(WriteBatch* b) {
         state.append(")");
         count++;
         break;
+      case kTypeMerge:
+        state.append("Merge(");
+        state.append(ikey.user_key.ToString());
+        state.append(", ");
+        state.append(iter->value().ToString());
+        state.append(")");
+        count++;
+        break;
     }
     state.append("@");
     state.append(NumberToString(ikey.sequence));
   }
   delete iter;
+  std::vector<RangeTombstone> range_dels;
+  mem->GetRangeDeletions(&range_dels);
+  for (size_t i = 0; i < range_dels.size(); i++) {
+    state.append("DeleteRange(");
+    state.append(range_dels[i].start);
+    state.append(", ");
+    state.append(range_dels[i].end);
+    state.append(")@");
+    state.append(NumberToString(range_dels[i].sequence));
+    count++;
+  }
   if (!s.ok()) {
     state.append("ParseError()");
   } else if (count != WriteBatchInternal::Count(b)) {
@@ -74,6 +93,32 @@ TEST(WriteBatchTest, Multiple) {
             PrintContents(&batch));
 }
 
+TEST(WriteBatchTest, DeleteRange) {
+  WriteBatch batch;
+  batch.Put(Slice("foo"), Slice("bar"));
+  batch.DeleteRange(Slice("a"), Slice("g"));
+  batch.Delete(Slice("box"));
+  WriteBatchInternal::SetSequence(&batch, 100);
+  ASSERT_EQ(3, WriteBatchInternal::Count(&batch));
+  ASSERT_EQ("Delete(box)@102"
+            "Put(foo, bar)@100"
+            "DeleteRange(a, g)@101",
+            PrintContents(&batch));
+}
+
+TEST(WriteBatchTest, Merge) {
+  WriteBatch batch;
+  batch.Put(Slice("foo"), Slice("bar"));
+  batch.Merge(Slice("foo"), Slice("baz"));
+  batch.Merge(Slice("box"), Slice("boo"));
+  WriteBatchInternal::SetSequence(&batch, 100);
+  ASSERT_EQ(3, WriteBatchInternal::Count(&batch));
+  ASSERT_EQ("Merge(box, boo)@102"
+            "Merge(foo, baz)@101"
+            "Put(foo, bar)@100",
+            PrintContents(&batch));
+}
+
 TEST(WriteBatchTest, Corruption) {
   WriteBatch batch;
   batch.Put(Slice("foo"), Slice("bar"));
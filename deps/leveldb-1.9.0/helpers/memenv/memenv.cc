@@ -17,11 +17,31 @@ namespace leveldb {
 
 namespace {
 
+// The bytes of file blocks allocated by an environment.
+class MemUsage {
+ public:
+  MemUsage() : bytes_(0) {}
+
+  void Add(int64_t delta) {
+    MutexLock lock(&mutex_);
+    bytes_ += delta;
+  }
+
+  uint64_t Bytes() {
+    MutexLock lock(&mutex_);
+    return bytes_;
+  }
+
+ private:
+  port::Mutex mutex_;
+  uint64_t bytes_;  // Protected by mutex_
+};
+
 class FileState {
  public:
   // FileStates are reference counted. The initial reference count is zero
   // and the caller must call Ref() at least once.
-  FileState() : refs_(0), size_(0) {}
+  explicit FileState(MemUsage* usage) : refs_(0), size_(0), usage_(usage) {}
 
   // Increase the reference count.
   void Ref() {
@@ -105,6 +125,7 @@ class FileState {
       } else {
         // No room in the last block; push new one.
         blocks_.push_back(new char[kBlockSize]);
+        usage_->Add(kBlockSize);
         avail = kBlockSize;
       }
 
@@ -127,6 +148,7 @@ class FileState {
          ++i) {
       delete [] *i;
     }
+    usage_->Add(-static_cast<int64_t>(blocks_.size()) * kBlockSize);
   }
 
   // No copying allowed.
@@ -141,6 +163,7 @@ class FileState {
   // to writable files.
   std::vector<char*> blocks_;
   uint64_t size_;
+  MemUsage* usage_;
 
   enum { kBlockSize = 8 * 1024 };
 };
@@ -268,7 +291,7 @@ class InMemoryEnv : public EnvWrapper {
       DeleteFileInternal(fname);
     }
 
-    FileState* file = new FileState();
+    FileState* file = new FileState(&usage_);
     file->Ref();
     file_map_[fname] = file;
 
@@ -348,6 +371,20 @@ class InMemoryEnv : public EnvWrapper {
     return Status::OK();
   }
 
+  // Links share the contents of the file, like hard links on disk.
+  virtual Status LinkFile(const std::string& src,
+                          const std::string& target) {
+    MutexLock lock(&mutex_);
+    if (file_map_.find(src) == file_map_.end()) {
+      return Status::IOError(src, "File not found");
+    }
+
+    DeleteFileInternal(target);
+    file_map_[target] = file_map_[src];
+    file_map_[target]->Ref();
+    return Status::OK();
+  }
+
   virtual Status LockFile(const std::string& fname, FileLock** lock) {
     *lock = new FileLock;
     return Status::OK();
@@ -368,11 +405,14 @@ class InMemoryEnv : public EnvWrapper {
     return Status::OK();
   }
 
+  uint64_t Usage() { return usage_.Bytes(); }
+
  private:
   // Map from filenames to FileState objects, representing a simple file system.
   typedef std::map<std::string, FileState*> FileSystem;
   port::Mutex mutex_;
   FileSystem file_map_;  // Protected by mutex_.
+  MemUsage usage_;
 };
 
 }  // namespace
@@ -381,4 +421,8 @@ Env* NewMemEnv(Env* base_env) {
   return new InMemoryEnv(base_env);
 }
 
+uint64_t GetMemEnvUsage(Env* mem_env) {
+  return static_cast<InMemoryEnv*>(mem_env)->Usage();
+}
+
 }  // namespace leveldb
@@ -5,6 +5,8 @@
 #ifndef STORAGE_LEVELDB_HELPERS_MEMENV_MEMENV_H_
 #define STORAGE_LEVELDB_HELPERS_MEMENV_MEMENV_H_
 
+#include <stdint.h>
+
 namespace leveldb {
 
 class Env;
@@ -15,6 +17,11 @@ class Env;
 // *base_env must remain live while the result is in use.
 Env* NewMemEnv(Env* base_env);
 
+// Returns the bytes of memory that the files of an environment returned by
+// NewMemEnv() take up.  Deleted files stop counting once no open file
+// refers to them.
+uint64_t GetMemEnvUsage(Env* mem_env);
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_HELPERS_MEMENV_MEMENV_H_
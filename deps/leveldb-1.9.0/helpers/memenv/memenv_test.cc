@@ -182,6 +182,28 @@ TEST(MemEnvTest, LargeWrite) {
   delete [] scratch;
 }
 
+TEST(MemEnvTest, LinksAndUsage) {
+  ASSERT_EQ(0, GetMemEnvUsage(env_));
+
+  WritableFile* writable_file;
+  ASSERT_OK(env_->NewWritableFile("/dir/f", &writable_file));
+  ASSERT_OK(writable_file->Append(std::string(20000, 'x')));
+  delete writable_file;
+  const uint64_t usage = GetMemEnvUsage(env_);
+  ASSERT_GE(usage, 20000);
+
+  // A link shares the file's blocks, which are freed with the last name.
+  ASSERT_OK(env_->LinkFile("/dir/f", "/dir/g"));
+  ASSERT_EQ(usage, GetMemEnvUsage(env_));
+  ASSERT_OK(env_->DeleteFile("/dir/f"));
+  uint64_t file_size;
+  ASSERT_OK(env_->GetFileSize("/dir/g", &file_size));
+  ASSERT_EQ(20000, file_size);
+  ASSERT_EQ(usage, GetMemEnvUsage(env_));
+  ASSERT_OK(env_->DeleteFile("/dir/g"));
+  ASSERT_EQ(0, GetMemEnvUsage(env_));
+}
+
 TEST(MemEnvTest, DBTest) {
   Options options;
   options.create_if_missing = true;
@@ -53,17 +53,22 @@ extern "C" {
 
 typedef struct leveldb_t               leveldb_t;
 typedef struct leveldb_cache_t         leveldb_cache_t;
+typedef struct leveldb_compactionfilter_t leveldb_compactionfilter_t;
 typedef struct leveldb_comparator_t    leveldb_comparator_t;
 typedef struct leveldb_env_t           leveldb_env_t;
 typedef struct leveldb_filelock_t      leveldb_filelock_t;
 typedef struct leveldb_filterpolicy_t  leveldb_filterpolicy_t;
 typedef struct leveldb_iterator_t      leveldb_iterator_t;
 typedef struct leveldb_logger_t        leveldb_logger_t;
+typedef struct leveldb_mergeoperator_t leveldb_mergeoperator_t;
 typedef struct leveldb_options_t       leveldb_options_t;
 typedef struct leveldb_randomfile_t    leveldb_randomfile_t;
 typedef struct leveldb_readoptions_t   leveldb_readoptions_t;
+typedef struct leveldb_readstats_t     leveldb_readstats_t;
 typedef struct leveldb_seqfile_t       leveldb_seqfile_t;
 typedef struct leveldb_snapshot_t      leveldb_snapshot_t;
+typedef struct leveldb_slicetransform_t leveldb_slicetransform_t;
+typedef struct leveldb_tablewriter_t   leveldb_tablewriter_t;
 typedef struct leveldb_writablefile_t  leveldb_writablefile_t;
 typedef struct leveldb_writebatch_t    leveldb_writebatch_t;
 typedef struct leveldb_writeoptions_t  leveldb_writeoptions_t;
@@ -90,6 +95,20 @@ extern void leveldb_delete(
     const char* key, size_t keylen,
     char** errptr);
 
+extern void leveldb_merge(
+    leveldb_t* db,
+    const leveldb_writeoptions_t* options,
+    const char* key, size_t keylen,
+    const char* val, size_t vallen,
+    char** errptr);
+
+extern void leveldb_delete_range(
+    leveldb_t* db,
+    const leveldb_writeoptions_t* options,
+    const char* start_key, size_t start_keylen,
+    const char* limit_key, size_t limit_keylen,
+    char** errptr);
+
 extern void leveldb_write(
     leveldb_t* db,
     const leveldb_writeoptions_t* options,
@@ -105,6 +124,18 @@ extern char* leveldb_get(
     size_t* vallen,
     char** errptr);
 
+/* Looks up num_keys keys from the same state of the database.  Sets
+   values[i] to NULL if keys[i] is not found and to a malloc()ed array
+   otherwise, storing its length in vallens[i].  The first error other
+   than not found is stored in *errptr and its key's value is NULL. */
+extern void leveldb_multi_get(
+    leveldb_t* db,
+    const leveldb_readoptions_t* options,
+    size_t num_keys,
+    const char* const* keys, const size_t* keylens,
+    char** values, size_t* vallens,
+    char** errptr);
+
 extern leveldb_iterator_t* leveldb_create_iterator(
     leveldb_t* db,
     const leveldb_readoptions_t* options);
@@ -134,6 +165,57 @@ extern void leveldb_compact_range(
     const char* start_key, size_t start_key_len,
     const char* limit_key, size_t limit_key_len);
 
+/* Writes the memtable to a table so that reopening the db doesn't replay
+   its log. */
+extern void leveldb_flush_memtable(leveldb_t* db, char** errptr);
+
+/* Creates a copy of the db in "dir" by linking its table files. */
+extern void leveldb_create_checkpoint(
+    leveldb_t* db,
+    const char* dir,
+    char** errptr);
+
+/* Returns a malloc()ed list of the db's blocks in the block cache, to be
+   passed to leveldb_warm_cache() after a restart. */
+extern char* leveldb_get_cached_blocks(
+    leveldb_t* db,
+    size_t* len,
+    char** errptr);
+
+/* Reads a list of blocks into the block cache at most bytes_per_second
+   bytes a second, or as fast as possible if it is 0. */
+extern void leveldb_warm_cache(
+    leveldb_t* db,
+    const char* blocks, size_t len,
+    uint64_t bytes_per_second,
+    char** errptr);
+
+/* Adds a table file finished by a leveldb_tablewriter_t of the db to its
+   bottom level without writing its entries to the log. */
+extern void leveldb_ingest_table(
+    leveldb_t* db,
+    const char* fname,
+    char** errptr);
+
+/* Table writers */
+
+/* Creates a writer for a table file that leveldb_ingest_table() can add
+   to the db.  Keys must be added in increasing order. */
+extern leveldb_tablewriter_t* leveldb_tablewriter_create(
+    leveldb_t* db,
+    const char* fname,
+    char** errptr);
+extern void leveldb_tablewriter_destroy(leveldb_tablewriter_t*);
+extern void leveldb_tablewriter_add(
+    leveldb_tablewriter_t*,
+    const char* key, size_t keylen,
+    const char* val, size_t vallen,
+    char** errptr);
+extern void leveldb_tablewriter_finish(
+    leveldb_tablewriter_t*,
+    char** errptr);
+extern uint64_t leveldb_tablewriter_file_size(leveldb_tablewriter_t*);
+
 /* Management operations */
 
 extern void leveldb_destroy_db(
@@ -158,6 +240,7 @@ extern void leveldb_iter_prev(leveldb_iterator_t*);
 extern const char* leveldb_iter_key(const leveldb_iterator_t*, size_t* klen);
 extern const char* leveldb_iter_value(const leveldb_iterator_t*, size_t* vlen);
 extern void leveldb_iter_get_error(const leveldb_iterator_t*, char** errptr);
+extern void leveldb_iter_release_pinned_data(leveldb_iterator_t*);
 
 /* Write batch */
 
@@ -171,6 +254,14 @@ extern void leveldb_writebatch_put(
 extern void leveldb_writebatch_delete(
     leveldb_writebatch_t*,
     const char* key, size_t klen);
+extern void leveldb_writebatch_delete_range(
+    leveldb_writebatch_t*,
+    const char* start_key, size_t start_klen,
+    const char* limit_key, size_t limit_klen);
+extern void leveldb_writebatch_merge(
+    leveldb_writebatch_t*,
+    const char* key, size_t klen,
+    const char* val, size_t vlen);
 extern void leveldb_writebatch_iterate(
     leveldb_writebatch_t*,
     void* state,
@@ -187,6 +278,15 @@ extern void leveldb_options_set_comparator(
 extern void leveldb_options_set_filter_policy(
     leveldb_options_t*,
     leveldb_filterpolicy_t*);
+extern void leveldb_options_set_prefix_extractor(
+    leveldb_options_t*,
+    leveldb_slicetransform_t*);
+extern void leveldb_options_set_merge_operator(
+    leveldb_options_t*,
+    leveldb_mergeoperator_t*);
+extern void leveldb_options_set_compaction_filter(
+    leveldb_options_t*,
+    leveldb_compactionfilter_t*);
 extern void leveldb_options_set_create_if_missing(
     leveldb_options_t*, unsigned char);
 extern void leveldb_options_set_error_if_exists(
@@ -197,15 +297,96 @@ extern void leveldb_options_set_env(leveldb_options_t*, leveldb_env_t*);
 extern void leveldb_options_set_info_log(leveldb_options_t*, leveldb_logger_t*);
 extern void leveldb_options_set_write_buffer_size(leveldb_options_t*, size_t);
 extern void leveldb_options_set_max_open_files(leveldb_options_t*, int);
+extern void leveldb_options_set_max_background_compactions(
+    leveldb_options_t*, int);
+extern void leveldb_options_set_max_subcompactions(leveldb_options_t*, int);
+extern void leveldb_options_set_repair_threads(leveldb_options_t*, int);
+
+enum {
+  leveldb_level_compaction = 0,
+  leveldb_tiered_compaction = 1
+};
+extern void leveldb_options_set_compaction_style(leveldb_options_t*, int);
+extern void leveldb_options_set_tiered_size_ratio(leveldb_options_t*, int);
+extern void leveldb_options_set_tiered_max_fan_in(leveldb_options_t*, int);
+extern void leveldb_options_set_level0_file_num_compaction_trigger(
+    leveldb_options_t*, int);
+extern void leveldb_options_set_level0_slowdown_writes_trigger(
+    leveldb_options_t*, int);
+extern void leveldb_options_set_level0_stop_writes_trigger(
+    leveldb_options_t*, int);
+extern void leveldb_options_set_target_file_size_base(
+    leveldb_options_t*, uint64_t);
+extern void leveldb_options_set_target_file_size_multiplier(
+    leveldb_options_t*, int);
+extern void leveldb_options_set_max_bytes_for_level_base(
+    leveldb_options_t*, uint64_t);
+extern void leveldb_options_set_max_bytes_for_level_multiplier(
+    leveldb_options_t*, int);
+extern void leveldb_options_set_level_compaction_dynamic_level_bytes(
+    leveldb_options_t*, unsigned char);
+extern void leveldb_options_set_use_direct_io_for_compaction(
+    leveldb_options_t*, unsigned char);
+extern void leveldb_options_set_compaction_readahead_size(
+    leveldb_options_t*, size_t);
+extern void leveldb_options_set_min_blob_size(leveldb_options_t*, size_t);
+extern void leveldb_options_set_blob_file_min_live_ratio(
+    leveldb_options_t*, double);
+extern void leveldb_options_set_blob_file_size(leveldb_options_t*, uint64_t);
+
+extern void leveldb_options_set_allow_concurrent_memtable_write(
+    leveldb_options_t*, unsigned char);
+extern void leveldb_options_set_enable_pipelined_write(
+    leveldb_options_t*, unsigned char);
+extern void leveldb_options_set_log_compression(leveldb_options_t*, int);
+extern void leveldb_options_set_log_sync_interval(
+    leveldb_options_t*, uint64_t micros);
+extern void leveldb_options_set_arena_block_size(leveldb_options_t*, size_t);
+
+enum {
+  leveldb_no_huge_pages = 0,
+  leveldb_transparent_huge_pages = 1,
+  leveldb_explicit_huge_pages = 2
+};
+extern void leveldb_options_set_huge_pages(leveldb_options_t*, int);
+
+enum {
+  leveldb_skiplist_memtable = 0,
+  leveldb_vector_memtable = 1,
+  leveldb_hash_linklist_memtable = 2
+};
+extern void leveldb_options_set_memtable_rep(leveldb_options_t*, int);
+extern void leveldb_options_set_memtable_prefix_extractor(
+    leveldb_options_t*,
+    leveldb_slicetransform_t*);
 extern void leveldb_options_set_cache(leveldb_options_t*, leveldb_cache_t*);
+extern void leveldb_options_set_compressed_cache(
+    leveldb_options_t*, leveldb_cache_t*);
 extern void leveldb_options_set_block_size(leveldb_options_t*, size_t);
 extern void leveldb_options_set_block_restart_interval(leveldb_options_t*, int);
+extern void leveldb_options_set_uncompressed_block_keys(
+    leveldb_options_t*, unsigned char);
+extern void leveldb_options_set_index_partition_size(
+    leveldb_options_t*, size_t);
+extern void leveldb_options_set_pinned_metadata_size(
+    leveldb_options_t*, size_t);
+extern void leveldb_options_set_data_block_hash_index(
+    leveldb_options_t*, unsigned char);
 
 enum {
   leveldb_no_compression = 0,
-  leveldb_snappy_compression = 1
+  leveldb_snappy_compression = 1,
+  leveldb_lz4_compression = 2,
+  leveldb_zstd_compression = 3
 };
 extern void leveldb_options_set_compression(leveldb_options_t*, int);
+extern void leveldb_options_set_compression_per_level(
+    leveldb_options_t*, const int* levels, size_t num_levels);
+/* The dictionary is not copied and must outlive every DB opened with
+   these options. */
+extern void leveldb_options_set_compression_dictionary(
+    leveldb_options_t*, const char* dict, size_t dictlen);
+extern void leveldb_options_set_compression_threads(leveldb_options_t*, int);
 
 /* Comparator */
 
@@ -238,6 +419,61 @@ extern void leveldb_filterpolicy_destroy(leveldb_filterpolicy_t*);
 
 extern leveldb_filterpolicy_t* leveldb_filterpolicy_create_bloom(
     int bits_per_key);
+extern leveldb_filterpolicy_t* leveldb_filterpolicy_create_blocked_bloom(
+    int bits_per_key);
+
+/* Prefix extractor */
+
+/* transform returns the length of the prefix of the key, which must be
+   in the domain of the extractor */
+extern leveldb_slicetransform_t* leveldb_slicetransform_create(
+    void* state,
+    void (*destructor)(void*),
+    size_t (*transform)(void*, const char* key, size_t length),
+    unsigned char (*in_domain)(void*, const char* key, size_t length),
+    const char* (*name)(void*));
+extern void leveldb_slicetransform_destroy(leveldb_slicetransform_t*);
+
+extern leveldb_slicetransform_t* leveldb_slicetransform_create_fixed_prefix(
+    size_t prefix_len);
+
+/* Merge operator */
+
+/* merge returns the malloc()ed result of applying the operand in
+   "value" to "existing", which is NULL if the key has no value, and
+   sets *success to 0 if the operands could not be merged.  It must be
+   associative (see leveldb/merge_operator.h). */
+extern leveldb_mergeoperator_t* leveldb_mergeoperator_create(
+    void* state,
+    void (*destructor)(void*),
+    char* (*merge)(
+        void*,
+        const char* key, size_t key_length,
+        const char* existing, size_t existing_length,
+        const char* value, size_t value_length,
+        unsigned char* success, size_t* new_value_length),
+    const char* (*name)(void*));
+extern void leveldb_mergeoperator_destroy(leveldb_mergeoperator_t*);
+
+extern leveldb_mergeoperator_t* leveldb_mergeoperator_create_append();
+
+/* Compaction filter */
+
+/* filter returns 1 to remove the key.  Otherwise it may set *new_value
+   to a malloc()ed replacement of the value and *value_changed to 1 (see
+   leveldb/compaction_filter.h). */
+extern leveldb_compactionfilter_t* leveldb_compactionfilter_create(
+    void* state,
+    void (*destructor)(void*),
+    unsigned char (*filter)(
+        void*,
+        int level,
+        const char* key, size_t key_length,
+        const char* existing_value, size_t value_length,
+        char** new_value, size_t* new_value_length,
+        unsigned char* value_changed),
+    const char* (*name)(void*));
+extern void leveldb_compactionfilter_destroy(leveldb_compactionfilter_t*);
 
 /* Read options */
 
@@ -248,9 +484,43 @@ extern void leveldb_readoptions_set_verify_checksums(
     unsigned char);
 extern void leveldb_readoptions_set_fill_cache(
     leveldb_readoptions_t*, unsigned char);
+extern void leveldb_readoptions_set_sequential_scan(
+    leveldb_readoptions_t*, unsigned char);
+extern void leveldb_readoptions_set_readahead_size(
+    leveldb_readoptions_t*, size_t);
+extern void leveldb_readoptions_set_prefetch_blocks(
+    leveldb_readoptions_t*, int);
+extern void leveldb_readoptions_set_prefix_same_as_start(
+    leveldb_readoptions_t*, unsigned char);
+extern void leveldb_readoptions_set_iterate_upper_bound(
+    leveldb_readoptions_t*, const char* key, size_t keylen);
+extern void leveldb_readoptions_set_pin_data(
+    leveldb_readoptions_t*, unsigned char);
 extern void leveldb_readoptions_set_snapshot(
     leveldb_readoptions_t*,
     const leveldb_snapshot_t*);
+extern void leveldb_readoptions_set_stats(
+    leveldb_readoptions_t*, leveldb_readstats_t*);
+
+/* Read stats */
+
+extern leveldb_readstats_t* leveldb_readstats_create();
+extern void leveldb_readstats_destroy(leveldb_readstats_t*);
+extern void leveldb_readstats_reset(leveldb_readstats_t*);
+extern uint64_t leveldb_readstats_block_cache_hits(
+    const leveldb_readstats_t*);
+extern uint64_t leveldb_readstats_block_cache_misses(
+    const leveldb_readstats_t*);
+extern uint64_t leveldb_readstats_block_read_bytes(
+    const leveldb_readstats_t*);
+extern uint64_t leveldb_readstats_block_uncompressed_bytes(
+    const leveldb_readstats_t*);
+extern uint64_t leveldb_readstats_block_read_micros(
+    const leveldb_readstats_t*);
+extern uint64_t leveldb_readstats_memtable_hits(const leveldb_readstats_t*);
+extern uint64_t leveldb_readstats_table_gets(const leveldb_readstats_t*);
+extern uint64_t leveldb_readstats_internal_keys_skipped(
+    const leveldb_readstats_t*);
 
 /* Write options */
 
@@ -262,11 +532,33 @@ extern void leveldb_writeoptions_set_sync(
 /* Cache */
 
 extern leveldb_cache_t* leveldb_cache_create_lru(size_t capacity);
+extern leveldb_cache_t* leveldb_cache_create_scan_resistant_lru(
+    size_t capacity);
+extern leveldb_cache_t* leveldb_cache_create_clock(
+    size_t capacity, int num_shard_bits);
 extern void leveldb_cache_destroy(leveldb_cache_t* cache);
 
 /* Env */
 
 extern leveldb_env_t* leveldb_create_default_env();
+/* Runs the background work of the DBs it's set on on threads bound to
+   the given CPUs that prefer memory from a NUMA node (if node >= 0). */
+extern leveldb_env_t* leveldb_create_bound_env(
+    const int* cpus, size_t num_cpus, int node);
+/* Stores the files of the DBs it's set on in memory.  Their contents are
+   lost when the env is destroyed. */
+extern leveldb_env_t* leveldb_create_mem_env();
+/* Returns the bytes of memory that the files of a mem env take up. */
+extern uint64_t leveldb_mem_env_usage(leveldb_env_t*);
+extern void leveldb_env_set_background_threads(leveldb_env_t*, int);
+extern void leveldb_env_set_flush_threads(leveldb_env_t*, int);
+extern void leveldb_env_set_bytes_per_sync(leveldb_env_t*, uint64_t);
+extern void leveldb_env_set_use_mmap_writes(leveldb_env_t*, unsigned char);
+extern void leveldb_env_set_mmap_limit(leveldb_env_t*, int);
+extern void leveldb_env_set_write_rate_limits(
+    leveldb_env_t*,
+    uint64_t foreground_bytes_per_second,
+    uint64_t background_bytes_per_second);
 extern void leveldb_env_destroy(leveldb_env_t*);
 
 /* Utility */
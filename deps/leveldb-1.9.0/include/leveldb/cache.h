@@ -29,6 +29,18 @@ class Cache;
 // of Cache uses a least-recently-used eviction policy.
 extern Cache* NewLRUCache(size_t capacity);
 
+// Create a new cache with a fixed size capacity that uses midpoint
+// insertion.  New entries must be looked up a second time before they can
+// displace frequently used entries, so a large scan can't flush the
+// working set.
+extern Cache* NewScanResistantLRUCache(size_t capacity);
+
+// Create a new cache with a fixed size capacity split over
+// 2^num_shard_bits shards (at most 2^16).  This implementation uses CLOCK
+// eviction, and a lookup that hits only increments a reference count
+// instead of taking the shard lock, so it suits many concurrent readers.
+extern Cache* NewClockCache(size_t capacity, int num_shard_bits);
+
 class Cache {
  public:
   Cache() { }
@@ -81,6 +93,15 @@ class Cache {
   // its cache keys.
   virtual uint64_t NewId() = 0;
 
+  // Call (*visitor)(arg, key, value) for every entry in the cache.  The
+  // visitor runs while parts of the cache are locked, so it must not call
+  // back into the cache.  Entries inserted or erased during the visit may
+  // or may not be visited.
+  //
+  // The default implementation visits nothing.
+  virtual void VisitEntries(
+      void (*visitor)(void* arg, const Slice& key, void* value), void* arg);
+
  private:
   void LRU_Remove(Handle* e);
   void LRU_Append(Handle* e);
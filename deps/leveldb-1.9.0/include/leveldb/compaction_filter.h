@@ -0,0 +1,45 @@
+// Copyright (c) 2013 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A database can be configured with a CompactionFilter that rewrites or
+// removes values as compactions copy them into new tables.  Filtering
+// costs no I/O beyond the compaction itself, so it suits data that ages
+// out, at the price of taking effect only once a key is compacted.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
+#define STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
+
+#include <string>
+
+namespace leveldb {
+
+class Slice;
+
+class CompactionFilter {
+ public:
+  virtual ~CompactionFilter();
+
+  // Return the name of this filter.
+  virtual const char* Name() const = 0;
+
+  // Called for a value that a compaction of "level" into the level below
+  // it keeps and that is no newer than the oldest snapshot, including the
+  // result of folding merge operands into a value.  Return true to remove
+  // the key.  Otherwise, to replace the value, store the new value in
+  // "*new_value" and set "*value_changed" to true.  Snapshots that see
+  // the value see the result.
+  //
+  // Removed keys are written as deletions unless no level under the
+  // compaction holds the key, so that older entries stay hidden.  Filters
+  // must be thread-safe since compactions may run concurrently.
+  virtual bool Filter(int level,
+                      const Slice& key,
+                      const Slice& existing_value,
+                      std::string* new_value,
+                      bool* value_changed) const = 0;
+};
+
+}
+
+#endif  // STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
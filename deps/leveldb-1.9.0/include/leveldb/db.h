@@ -6,6 +6,7 @@
 #define STORAGE_LEVELDB_INCLUDE_DB_H_
 
 #include <stdint.h>
+#include <vector>
 #include <stdio.h>
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
@@ -20,6 +21,7 @@ struct Options;
 struct ReadOptions;
 struct WriteOptions;
 class WriteBatch;
+class TableWriter;
 
 // Abstract handle to particular state of a DB.
 // A Snapshot is an immutable object and can therefore be safely
@@ -68,6 +70,22 @@ class DB {
   // Note: consider setting options.sync = true.
   virtual Status Delete(const WriteOptions& options, const Slice& key) = 0;
 
+  // Remove every database entry whose key is in ["begin_key", "end_key").
+  // Returns OK on success, and a non-OK status on error.  The cost does
+  // not depend on the number of entries removed: a single range tombstone
+  // hides them, and compactions discard them later.
+  // Note: consider setting options.sync = true.
+  virtual Status DeleteRange(const WriteOptions& options,
+                             const Slice& begin_key, const Slice& end_key);
+
+  // Add "value" as a merge operand of "key".  Reads of "key" see the
+  // result of Options::merge_operator applied to the operands written
+  // since its last value.  Returns OK on success, and a non-OK status on
+  // error.
+  // Note: consider setting options.sync = true.
+  virtual Status Merge(const WriteOptions& options,
+                       const Slice& key, const Slice& value);
+
   // Apply the specified updates to the database.
   // Returns OK on success, non-OK on failure.
   // Note: consider setting options.sync = true.
@@ -83,6 +101,16 @@ class DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) = 0;
 
+  // Look up several keys at once.  (*values)[i] and the i'th returned
+  // status are set as Get() would set them for keys[i], and every key is
+  // read from the same state of the database.  Keys may be given in any
+  // order and may repeat.
+  //
+  // The default implementation calls Get() for each key.
+  virtual std::vector<Status> MultiGet(const ReadOptions& options,
+                                       const std::vector<Slice>& keys,
+                                       std::vector<std::string>* values);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -115,6 +143,39 @@ class DB {
   //     about the internal operation of the DB.
   //  "leveldb.sstables" - returns a multi-line string that describes all
   //     of the sstables that make up the db contents.
+  //  "leveldb.write-stats" - returns a multi-line string that describes
+  //     write stalls by cause, queued writers, batch group sizes and
+  //     write latencies.
+  //  "leveldb.latency" - returns a multi-line string with the count and
+  //     the 50th, 99th and 99.9th percentile latencies in micros of Get()
+  //     calls, Write() calls and memtable flushes and compactions.
+  //  "leveldb.read-samples" - returns a multi-line string that describes
+  //     the keys that iterators sampled about once a megabyte read: how
+  //     many were in more than one file and how many files they were in
+  //     on average, the entries skipped before them, and the compactions
+  //     of the files they were in that they triggered.
+  //  "leveldb.compaction-backlog" - returns the estimated number of bytes
+  //     compactions must rewrite before every level is within its limit.
+  //  "leveldb.running-compactions" - returns the number of table
+  //     compactions currently running for this db.
+  //  "leveldb.bytes-written" - returns the number of bytes of write
+  //     batches written to the log since the db was opened.
+  //  "leveldb.compaction-bytes-written" - returns the number of bytes of
+  //     tables written by memtable flushes and compactions since the db
+  //     was opened.  Together with "leveldb.bytes-written" this gives the
+  //     write amplification.
+  //  "leveldb.stall-micros" - returns the total time that writes have
+  //     been delayed or stopped, in microseconds.
+  //  "leveldb.approximate-memory-usage" - returns the approximate number
+  //     of bytes held by the db's memtables.  The block cache is not
+  //     included since it can be shared between dbs.
+  //  "leveldb.pinned-metadata-usage" - returns the number of bytes of
+  //     filter and index blocks pinned in memory for the tables of levels
+  //     0 and 1 (see Options::pinned_metadata_size).
+  //  "leveldb.num-range-deletions" - returns the number of range
+  //     tombstones that have been flushed and not yet dropped by compaction.
+  //  "leveldb.blob-files" - returns a line per blob file with its number,
+  //     size and bytes of garbage (see Options::min_blob_size).
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
@@ -140,12 +201,101 @@ class DB {
   //    db->CompactRange(NULL, NULL);
   virtual void CompactRange(const Slice* begin, const Slice* end) = 0;
 
+  // Write the memtable to a table file and switch to a new log, so that
+  // reopening the database doesn't replay the writes made so far.  Waits
+  // for earlier writes and for the table to be written.
+  //
+  // The default implementation returns a NotSupported status.
+  virtual Status FlushMemTable();
+
+  // Create a copy of the database in the directory "dir" that can be
+  // opened as a database of its own.  The memtable is flushed and the
+  // table files of the current version are hard linked into "dir", or
+  // copied if they can't be linked, along with a new MANIFEST that
+  // describes them.  The copy holds every write made before the call.
+  //
+  // Table files are never modified, so a table that is already in "dir"
+  // is kept as it is and tables that are no longer live are removed.
+  // Creating a checkpoint in the directory of an earlier one therefore
+  // only adds the tables written since.
+  //
+  // The default implementation returns a NotSupported status.
+  virtual Status CreateCheckpoint(const std::string& dir);
+
+  // Store in "*blocks" the location of every block of this database that
+  // is in the block cache, in file and offset order, so that a later
+  // WarmCache() can read them back into the cache after a restart.
+  //
+  // The default implementation returns a NotSupported status.
+  virtual Status GetCachedBlocks(std::string* blocks);
+
+  // Read the blocks listed by an earlier GetCachedBlocks() into the block
+  // cache, in order and at most "bytes_per_second" bytes a second, or as
+  // fast as possible if it is 0.  Blocks of tables that have since been
+  // compacted away are skipped.
+  //
+  // The default implementation returns a NotSupported status.
+  virtual Status WarmCache(const Slice& blocks, uint64_t bytes_per_second);
+
+  // Create a writer for a new table file named "fname" that IngestTable()
+  // can add to this database.  The table is written with the options that
+  // the database writes its bottom level with.  On success, stores a
+  // pointer to the heap-allocated writer in *result; the caller should
+  // delete it before the database.
+  //
+  // The default implementation returns a NotSupported status.
+  virtual Status NewTableWriter(const std::string& fname,
+                                TableWriter** result);
+
+  // Add a table file finished by a TableWriter of this database to its
+  // bottom level without writing the entries to the log or the memtable
+  // or compacting them.  The memtable is flushed first, and the table is
+  // only added if none of the database's tables or range deletions
+  // overlap its key range; otherwise an InvalidArgument status is
+  // returned and the database is left unchanged.  The entries are
+  // visible to every snapshot, including ones taken before the call.
+  //
+  // The file is hard linked into the database, or copied if it can't be
+  // linked, so "fname" can be deleted once the call returns.
+  //
+  // The default implementation returns a NotSupported status.
+  virtual Status IngestTable(const std::string& fname);
+
  private:
   // No copying allowed
   DB(const DB&);
   void operator=(const DB&);
 };
 
+// Writes the entries of a table file for DB::IngestTable() in increasing
+// key order.  Deleting a writer before Finish() leaves a partial file
+// behind that can't be ingested.
+class TableWriter {
+ public:
+  TableWriter() { }
+  virtual ~TableWriter();
+
+  // Add an entry to the table.  Returns an InvalidArgument status unless
+  // "key" is after every key added before, according to the database's
+  // comparator.
+  virtual Status Add(const Slice& key, const Slice& value) = 0;
+
+  // Write the rest of the table and sync the file.  A table needs at
+  // least one entry to be ingested.
+  virtual Status Finish() = 0;
+
+  // Number of entries added so far.
+  virtual uint64_t NumEntries() const = 0;
+
+  // Size of the file written so far, or of the whole table after Finish().
+  virtual uint64_t FileSize() const = 0;
+
+ private:
+  // No copying allowed
+  TableWriter(const TableWriter&);
+  void operator=(const TableWriter&);
+};
+
 // Destroy the contents of the specified database.
 // Be very careful using this method.
 Status DestroyDB(const std::string& name, const Options& options);
@@ -154,6 +304,11 @@ Status DestroyDB(const std::string& name, const Options& options);
 // resurrect as much of the contents of the database as possible.
 // Some data may be lost, so be careful when calling this function
 // on a database that contains important information.
+//
+// Logs and tables are processed on options.repair_threads threads.  The
+// progress of a repair is recorded in the database directory, so calling
+// this again after a repair was interrupted does not scan the tables
+// that were already scanned.
 Status RepairDB(const std::string& dbname, const Options& options);
 
 }  // namespace leveldb
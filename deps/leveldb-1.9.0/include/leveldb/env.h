@@ -69,6 +69,24 @@ class Env {
   virtual Status NewWritableFile(const std::string& fname,
                                  WritableFile** result) = 0;
 
+  // Like NewWritableFile(), but for files written by background work
+  // (memtable flushes and compaction output), so that implementations can
+  // account their writes against the background I/O budget.  The default
+  // implementation calls NewWritableFile().
+  virtual Status NewBackgroundWritableFile(const std::string& fname,
+                                           WritableFile** result);
+
+  // Like NewRandomAccessFile() and NewBackgroundWritableFile(), but the
+  // files bypass the operating system's page cache if the implementation
+  // supports it.  Meant for files that are read or written once in large
+  // sequential pieces, such as compaction inputs and outputs.  The
+  // default implementations call NewRandomAccessFile() and
+  // NewBackgroundWritableFile().
+  virtual Status NewDirectRandomAccessFile(const std::string& fname,
+                                           RandomAccessFile** result);
+  virtual Status NewDirectWritableFile(const std::string& fname,
+                                       WritableFile** result);
+
   // Returns true iff the named file exists.
   virtual bool FileExists(const std::string& fname) = 0;
 
@@ -94,6 +112,11 @@ class Env {
   virtual Status RenameFile(const std::string& src,
                             const std::string& target) = 0;
 
+  // Create target as a hard link to the existing file src.  The default
+  // implementation returns a NotSupported status, in which case callers
+  // should copy the file instead.
+  virtual Status LinkFile(const std::string& src, const std::string& target);
+
   // Lock the specified file.  Used to prevent concurrent access to
   // the same db by multiple processes.  On failure, stores NULL in
   // *lock and returns non-OK.
@@ -125,6 +148,51 @@ class Env {
       void (*function)(void* arg),
       void* arg) = 0;
 
+  // Allow up to "n" threads to run work items queued by Schedule().
+  // Items are picked up in FIFO order, so work from several DBs sharing
+  // this Env is interleaved fairly.  Implementations may never shrink the
+  // pool.  The default implementation ignores the request.
+  virtual void SetBackgroundThreads(int n);
+
+  // Arrange to run "function(arg)" once in a background thread, like
+  // Schedule(), for short work that foreground threads wait on such as
+  // memtable flushes.  Implementations should run these items on threads
+  // of their own so that they never queue behind long-running Schedule()
+  // items.  The default implementation calls Schedule().
+  virtual void ScheduleFlush(void (*function)(void* arg), void* arg);
+
+  // Allow up to "n" threads to run work items queued by ScheduleFlush().
+  // The default implementation ignores the request.
+  virtual void SetFlushThreads(int n);
+
+  // Start writing back files from NewWritableFile() and
+  // NewBackgroundWritableFile() every "bytes" bytes appended to them, so
+  // that syncing a large file does not write it all at once.  Zero only
+  // writes files back when they are synced or when the OS decides to.
+  // Applies to files created afterwards.  The default implementation
+  // ignores the request.
+  virtual void SetBytesPerSync(uint64_t bytes);
+
+  // Whether files from NewWritableFile() and NewBackgroundWritableFile()
+  // are written through a memory mapping or with buffered write calls.
+  // Applies to files created afterwards.  The default implementation
+  // ignores the request.
+  virtual void SetUseMmapWrites(bool use_mmap);
+
+  // Allow up to "n" files from NewRandomAccessFile() to be read through a
+  // memory mapping at once; the rest are read with pread().  A negative
+  // "n" allows any number.  Applies to files opened afterwards.  The
+  // default implementation ignores the request.
+  virtual void SetMmapLimit(int n);
+
+  // Limit the rate at which files from NewWritableFile() and
+  // NewBackgroundWritableFile() are written to the given number of bytes
+  // per second.  Zero means unlimited.  The limits may be changed at any
+  // time and apply to files that are already open.  The default
+  // implementation ignores the request.
+  virtual void SetWriteRateLimits(uint64_t foreground_bytes_per_second,
+                                  uint64_t background_bytes_per_second);
+
   // Start a new thread, invoking "function(arg)" within the new thread.
   // When "function(arg)" returns, the thread will be destroyed.
   virtual void StartThread(void (*function)(void* arg), void* arg) = 0;
@@ -200,6 +268,13 @@ class RandomAccessFile {
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
 
+  // Hint that "[offset, offset+n)" will be read soon so that the
+  // implementation can start fetching it in the background.  The default
+  // implementation does nothing.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual void Readahead(uint64_t offset, size_t n) const;
+
  private:
   // No copying allowed
   RandomAccessFile(const RandomAccessFile&);
@@ -289,6 +364,10 @@ class EnvWrapper : public Env {
   Status NewWritableFile(const std::string& f, WritableFile** r) {
     return target_->NewWritableFile(f, r);
   }
+  // NewBackgroundWritableFile() and the direct file calls are deliberately
+  // not forwarded: the Env defaults route them through NewWritableFile()
+  // and NewRandomAccessFile() so that wrappers which override only those
+  // still see every file.
   bool FileExists(const std::string& f) { return target_->FileExists(f); }
   Status GetChildren(const std::string& dir, std::vector<std::string>* r) {
     return target_->GetChildren(dir, r);
@@ -302,6 +381,9 @@ class EnvWrapper : public Env {
   Status RenameFile(const std::string& s, const std::string& t) {
     return target_->RenameFile(s, t);
   }
+  Status LinkFile(const std::string& s, const std::string& t) {
+    return target_->LinkFile(s, t);
+  }
   Status LockFile(const std::string& f, FileLock** l) {
     return target_->LockFile(f, l);
   }
@@ -309,6 +391,27 @@ class EnvWrapper : public Env {
   void Schedule(void (*f)(void*), void* a) {
     return target_->Schedule(f, a);
   }
+  void SetBackgroundThreads(int n) {
+    return target_->SetBackgroundThreads(n);
+  }
+  void ScheduleFlush(void (*f)(void*), void* a) {
+    return target_->ScheduleFlush(f, a);
+  }
+  void SetFlushThreads(int n) {
+    return target_->SetFlushThreads(n);
+  }
+  void SetBytesPerSync(uint64_t bytes) {
+    return target_->SetBytesPerSync(bytes);
+  }
+  void SetUseMmapWrites(bool use_mmap) {
+    return target_->SetUseMmapWrites(use_mmap);
+  }
+  void SetMmapLimit(int n) {
+    return target_->SetMmapLimit(n);
+  }
+  void SetWriteRateLimits(uint64_t foreground, uint64_t background) {
+    return target_->SetWriteRateLimits(foreground, background);
+  }
   void StartThread(void (*f)(void*), void* a) {
     return target_->StartThread(f, a);
   }
@@ -328,6 +431,15 @@ class EnvWrapper : public Env {
   Env* target_;
 };
 
+// Returns an Env that runs the work items of Schedule() and
+// ScheduleFlush() on threads of its own that are bound to "cpus", and
+// forwards everything else to *base.  If "node" is not negative the
+// threads also prefer memory from that NUMA node, so that the memtables
+// and cached blocks they fill stay local to the CPUs.  The pools start
+// with one thread each and grow like those of the default Env.  The
+// caller must delete the result after every DB using it is closed.
+extern Env* NewBoundEnv(Env* base, const std::vector<int>& cpus, int node);
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_INCLUDE_ENV_H_
@@ -67,6 +67,11 @@ class Iterator {
   // If an error has occurred, return it.  Else return an ok status.
   virtual Status status() const = 0;
 
+  // Drop the blocks kept alive for an iterator created with
+  // ReadOptions::pin_data.  Values returned before this call become
+  // invalid, except the one at the current position.
+  virtual void ReleasePinnedData() { }
+
   // Clients are allowed to register function/arg1/arg2 triples that
   // will be invoked when this iterator is destroyed.
   //
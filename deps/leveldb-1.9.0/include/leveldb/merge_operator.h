@@ -0,0 +1,51 @@
+// Copyright (c) 2013 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A database can be configured with a MergeOperator that combines the
+// operands written with WriteBatch::Merge() with the value of their key.
+// A merge is only a write: the operands are combined with the value when
+// the key is read and, to keep reads short, when they are compacted.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_MERGE_OPERATOR_H_
+#define STORAGE_LEVELDB_INCLUDE_MERGE_OPERATOR_H_
+
+#include <string>
+
+namespace leveldb {
+
+class Slice;
+
+class MergeOperator {
+ public:
+  virtual ~MergeOperator();
+
+  // Return the name of this operator.  Operands are stored as they were
+  // written, so the name must change if the operator changes in a way
+  // that would combine existing operands differently.
+  virtual const char* Name() const = 0;
+
+  // Store in "*new_value" the result of applying "value" to
+  // "existing_value", which is NULL if the key has no value or was
+  // deleted.  Return false if the values can't be combined, in which
+  // case reads of the key fail with a Corruption status.
+  //
+  // The operator must be associative: reads and compactions combine runs
+  // of operands by passing the older one as "existing_value" and then
+  // apply the result to the value under them, or to NULL if there is
+  // none, as if the operands had been applied one at a time.
+  virtual bool Merge(const Slice& key,
+                     const Slice* existing_value,
+                     const Slice& value,
+                     std::string* new_value) const = 0;
+};
+
+// Return a new operator whose operands are appended to the existing value.
+//
+// Callers must delete the result after any database that is using the
+// result has been closed.
+extern const MergeOperator* NewAppendOperator();
+
+}
+
+#endif  // STORAGE_LEVELDB_INCLUDE_MERGE_OPERATOR_H_
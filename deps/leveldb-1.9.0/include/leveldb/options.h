@@ -6,14 +6,20 @@
 #define STORAGE_LEVELDB_INCLUDE_OPTIONS_H_
 
 #include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "leveldb/slice.h"
 
 namespace leveldb {
 
 class Cache;
+class CompactionFilter;
 class Comparator;
 class Env;
 class FilterPolicy;
 class Logger;
+class MergeOperator;
+class SliceTransform;
 class Snapshot;
 
 // DB contents are stored in a set of blocks, each of which holds a
@@ -24,7 +30,62 @@ enum CompressionType {
   // NOTE: do not change the values of existing entries, as these are
   // part of the persistent format on disk.
   kNoCompression     = 0x0,
-  kSnappyCompression = 0x1
+  kSnappyCompression = 0x1,
+  kLZ4Compression    = 0x2,
+  kZstdCompression   = 0x3
+};
+
+// How compactions arrange the tables of a database into levels.
+enum CompactionStyle {
+  // Each level holds at most ten times the bytes of the level above it,
+  // and compactions merge a few tables at a time into the next level.
+  // Reads touch few tables, but data is rewritten about ten times per
+  // level it moves down.
+  kCompactionStyleLevel = 0,
+
+  // Each level-0 table, and each non-empty level below, is a sorted run.
+  // Compactions merge adjacent runs of similar size into one, so data is
+  // rewritten only when its run merges with another of similar size.
+  // Writes cost much less, at the price of reads checking more runs.
+  kCompactionStyleTiered = 1
+};
+
+// How memory that is read often, such as memtables and cached blocks, is
+// mapped.  Huge pages cover 2MB each, so a large working set takes far
+// fewer TLB entries than with the default 4KB pages.
+enum HugePages {
+  kNoHugePages = 0,
+
+  // Memory is mapped in 2MB aligned chunks that the kernel is asked to
+  // back with transparent huge pages.  Needs transparent huge pages set
+  // to "madvise" or "always".
+  kTransparentHugePages = 1,
+
+  // Memory comes from the huge pages reserved in vm.nr_hugepages, and
+  // from transparent huge pages once they run out.
+  kExplicitHugePages = 2
+};
+
+// How a memtable holds its entries until they are written to a table.
+enum MemTableRepType {
+  // A skiplist that keeps entries in order as they are inserted.  Suits
+  // any mix of writes, reads and scans.
+  kSkipListRep = 0,
+
+  // An array that entries are appended to and that is sorted when the
+  // memtable is read or flushed.  Inserts are far cheaper, but a read of
+  // the memtable being written sorts the entries added since the last
+  // one.  Suits bulk loads that read little until they are done.
+  kVectorRep = 1,
+
+  // A hash table of sorted lists, keyed by the prefix that
+  // memtable_prefix_extractor takes from each key (or by the whole key
+  // without one).  Inserts and
+  // point reads only walk the entries that hash alike, but iterators
+  // sort every entry of the memtable.  Suits writes and point reads of
+  // many small groups of keys, such as the most recent events of many
+  // objects.
+  kHashLinkListRep = 2
 };
 
 // Options to control the behavior of a database (passed to DB::Open)
@@ -89,6 +150,173 @@ struct Options {
   // Default: 1000
   int max_open_files;
 
+  // Maximum number of compactions of this DB that may run at once on
+  // env's background threads.  Concurrent compactions always work on
+  // disjoint levels.  Opening a DB grows env's background thread pool
+  // to at least this many threads; the pool is shared by all DBs using
+  // the same env.
+  //
+  // Default: 1
+  int max_background_compactions;
+
+  // Maximum number of threads a single large compaction is split across.
+  // Each thread merges a disjoint range of keys, chosen from the input
+  // file boundaries, into its own output tables.  Small compactions are
+  // not split.
+  //
+  // Default: 1
+  int max_subcompactions;
+
+  // Number of threads RepairDB() converts logs to tables and scans tables
+  // on.
+  //
+  // Default: 1
+  int repair_threads;
+
+  // How compactions arrange tables into levels (see CompactionStyle).
+  // May be changed between opens of a DB.
+  //
+  // Default: kCompactionStyleLevel
+  CompactionStyle compaction_style;
+
+  // With kCompactionStyleTiered, a run is merged with the newer runs next
+  // to it if it is at most this many percent larger than their total size.
+  //
+  // Default: 1
+  int tiered_size_ratio;
+
+  // With kCompactionStyleTiered, the most runs merged by one compaction.
+  //
+  // Default: 10
+  int tiered_max_fan_in;
+
+  // Level-0 compaction is started when level-0 has this many files.
+  //
+  // Default: 4
+  int level0_file_num_compaction_trigger;
+
+  // Writes are slowed down by 1ms each when level-0 has this many files.
+  //
+  // Default: 8
+  int level0_slowdown_writes_trigger;
+
+  // Writes stop until a compaction finishes when level-0 has this many
+  // files.
+  //
+  // Default: 12
+  int level0_stop_writes_trigger;
+
+  // Target size of the tables written by compactions into level-1.  Each
+  // deeper level multiplies it by target_file_size_multiplier.  Larger
+  // tables mean fewer open files and compactions that each do more work.
+  //
+  // Default: 2MB
+  uint64_t target_file_size_base;
+
+  // Default: 1
+  int target_file_size_multiplier;
+
+  // Level-1 is compacted once it holds more than this many bytes.  Each
+  // deeper level may hold max_bytes_for_level_multiplier times as many
+  // bytes as the one above it.
+  //
+  // Default: 10MB
+  uint64_t max_bytes_for_level_base;
+
+  // Default: 10
+  int max_bytes_for_level_multiplier;
+
+  // If true, the size limits of the levels are derived from the size of
+  // the deepest non-empty level, each level above it holding
+  // max_bytes_for_level_multiplier times fewer bytes, but never less than
+  // max_bytes_for_level_base nor more than the static limit above.  This
+  // keeps the space taken by stale versions of keys in the upper levels
+  // proportional to the data, whatever its size.
+  //
+  // Default: false
+  bool level_compaction_dynamic_level_bytes;
+
+  // If true, compactions read their input tables and write their output
+  // tables with direct I/O that bypasses the operating system's page
+  // cache, so background work does not evict the pages that reads use.
+  // Input tables are opened separately from the table cache for this.
+  // Envs without direct I/O use regular files.
+  //
+  // Default: false
+  bool use_direct_io_for_compaction;
+
+  // The size of each read of a compaction input table.  With direct I/O
+  // there is no readahead by the operating system, so this should be
+  // large.  Zero reads in a window that grows as the table is read.
+  //
+  // Default: 2MB
+  size_t compaction_readahead_size;
+
+  // If true, writers whose batches are grouped into a single log record
+  // insert their own batches into the memtable in parallel instead of
+  // the group leader inserting all of them.  Helps when many threads
+  // write to the same DB at once.
+  //
+  // Default: false
+  bool allow_concurrent_memtable_write;
+
+  // If true, a group of writers hands the log over to the next group as
+  // soon as its record is written, and applies its batch to the memtable
+  // while the next group writes (and syncs) its own record.  Batches
+  // still become visible in log order.  Mostly helps WriteOptions::sync
+  // writers.  Takes precedence over allow_concurrent_memtable_write.
+  //
+  // Default: false
+  bool enable_pipelined_write;
+
+  // Compress each record of the write-ahead log with this type, using the
+  // same compressors as table blocks.  Records that don't shrink by at
+  // least 1/8th are stored uncompressed.  Logs with compressed records
+  // can't be read by versions that don't know about them.
+  //
+  // Default: kNoCompression
+  CompressionType log_compression;
+
+  // If non-zero, a WriteOptions::sync write waits until this many
+  // microseconds have passed since the last sync of the log before it
+  // syncs, so that the writes queued meanwhile are synced with it.
+  // Trades the latency of sync writes for fewer syncs when many threads
+  // write at once.
+  //
+  // Default: 0
+  uint64_t log_sync_interval_micros;
+
+  // Memtables allocate their entries from blocks of this many bytes.
+  // Larger blocks mean fewer allocations and better locality when a
+  // memtable is large.  Clipped to an eighth of write_buffer_size.
+  //
+  // Default: 4K
+  size_t arena_block_size;
+
+  // Whether memtables and the blocks read into block_cache are backed by
+  // huge pages.  Memtable blocks are then rounded up to 2MB, and only
+  // memtables with a write_buffer_size of at least 16MB use them.  Memory
+  // for cached blocks is carved out of 2MB chunks and kept by the process
+  // for later blocks once they are evicted.
+  //
+  // Default: kNoHugePages
+  HugePages huge_pages;
+
+  // How memtables hold their entries.  Every representation flushes the
+  // same tables; they differ in the cost of inserts and of reads from
+  // the memtables.
+  //
+  // Default: kSkipListRep
+  MemTableRepType memtable_rep;
+
+  // If non-NULL and memtable_rep is kHashLinkListRep, memtable entries
+  // are hashed by the prefix this takes from their keys, so that the
+  // entries of keys with the same prefix share a sorted list.  Otherwise
+  // they are hashed by their whole key.  Independent of prefix_extractor.
+  //
+  // Default: NULL
+  const SliceTransform* memtable_prefix_extractor;
+
   // Control over blocks (user data is stored in a set of blocks, and
   // a block is the unit of reading from disk).
 
@@ -97,6 +325,15 @@ struct Options {
   // Default: NULL
   Cache* block_cache;
 
+  // If non-NULL, a second tier below block_cache that holds compressed
+  // blocks as they are stored in the file.  A block that misses
+  // block_cache but hits here is uncompressed without a file read, and
+  // since compressed blocks are smaller more of the data fits in the
+  // same memory.  Uncompressed blocks are never put in this cache.  It
+  // may be shared by several DBs.
+  // Default: NULL
+  Cache* block_cache_compressed;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -112,6 +349,50 @@ struct Options {
   // Default: 16
   int block_restart_interval;
 
+  // If true, data blocks store every key whole instead of only the part
+  // that differs from the previous key.  Blocks grow by the bytes keys
+  // share, but iterators return keys that point into the block instead
+  // of rebuilding each one, which makes scans cheaper.  Suits keys that
+  // share little beyond a short prefix, such as hashed keys.  Blocks
+  // written either way are read the same way.
+  //
+  // Default: false
+  bool uncompressed_block_keys;
+
+  // If non-zero, the index of each table is split into partitions of
+  // about this many bytes, and only a small top-level index over the
+  // partitions stays in memory while the table is open.  Partitions are
+  // read through block_cache like data blocks, so the memory used by the
+  // indexes of a large DB is bounded by the cache instead of growing
+  // with the number of open tables.  Tables whose index fits in a
+  // single partition keep a plain index.
+  //
+  // Default: 0
+  size_t index_partition_size;
+
+  // If non-zero, the tables of levels 0 and 1 are kept open with their
+  // filter and index blocks, including every index partition, in memory
+  // until they leave those levels, up to about this many bytes of
+  // metadata.  Point lookups probe every level-0 table, so their filter
+  // and index reads then never go to disk however many other tables are
+  // open.  The memory is in addition to block_cache and the tables held
+  // open for max_open_files.  The "leveldb.pinned-metadata-usage"
+  // property reports how much is in use.
+  //
+  // Default: 0
+  size_t pinned_metadata_size;
+
+  // If true, each data block also stores a hash index from the user keys
+  // in it to their restart points, so Get() finds a key in a block
+  // without a binary search over the restart points.  Costs about one
+  // byte per user key.  Blocks with more than 254 restart points (see
+  // block_restart_interval) are written without one.  Only useful for
+  // tables written by a DB, whose keys end in an 8-byte sequence number
+  // and type.
+  //
+  // Default: false
+  bool data_block_hash_index;
+
   // Compress blocks using the specified compression algorithm.  This
   // parameter can be changed dynamically.
   //
@@ -126,8 +407,39 @@ struct Options {
   // worth switching to kNoCompression.  Even if the input data is
   // incompressible, the kSnappyCompression implementation will
   // efficiently detect that and will switch to uncompressed mode.
+  //
+  // kLZ4Compression compresses and decompresses faster than Snappy;
+  // kZstdCompression is slower but much denser, especially with a
+  // compression_dictionary.  Blocks are stored uncompressed if this
+  // build lacks the library for the chosen type.
   CompressionType compression;
 
+  // If non-empty, tables written to level L use compression_per_level[L],
+  // or the last entry for levels past the end, instead of "compression".
+  // This allows, e.g., kLZ4Compression for the levels that take new
+  // writes and kZstdCompression for the large bottom levels.
+  //
+  // Default: empty
+  std::vector<CompressionType> compression_per_level;
+
+  // If non-empty, a dictionary (e.g. one produced by "zstd --train" from
+  // sample values) used to compress kZstdCompression blocks.  Each table
+  // stores a copy of the dictionary it was written with, so it may be
+  // changed between opens.  The bytes must stay alive while the DB is
+  // open.
+  //
+  // Default: empty
+  Slice compression_dictionary;
+
+  // If greater than one, tables are written with their data blocks
+  // compressed on a pool of background threads shared by the process,
+  // with up to this many blocks of a table in flight at once.  Blocks are
+  // still written in order.  Helps when flushes and compactions are
+  // limited by the speed of compression, as with kZstdCompression.
+  //
+  // Default: 1
+  int compression_threads;
+
   // If non-NULL, use the specified filter policy to reduce disk reads.
   // Many applications will benefit from passing the result of
   // NewBloomFilterPolicy() here.
@@ -135,10 +447,102 @@ struct Options {
   // Default: NULL
   const FilterPolicy* filter_policy;
 
+  // If non-NULL, and filter_policy is non-NULL too, the prefix of every
+  // key is added to the filters along with the key.  Iterators created
+  // with ReadOptions::prefix_same_as_start then skip the tables and
+  // blocks that hold no key with the prefix of their Seek() target.
+  //
+  // Default: NULL
+  const SliceTransform* prefix_extractor;
+
+  // If non-NULL, combines the operands written with WriteBatch::Merge()
+  // with the values of their keys.  Reads of a key with operands fail
+  // with a NotSupported status if it is NULL.
+  //
+  // Default: NULL
+  const MergeOperator* merge_operator;
+
+  // If non-NULL, compactions pass the values they keep through the filter,
+  // which may rewrite or remove them (see leveldb/compaction_filter.h).
+  //
+  // Default: NULL
+  const CompactionFilter* compaction_filter;
+
+  // If non-zero, flushes and compactions write values of at least this
+  // many bytes to blob files of their own and leave only a pointer in the
+  // table, so that compactions do not rewrite them.  Reads of such values
+  // take an extra read from the blob file.  With a compaction_filter,
+  // compactions read the values that they keep back from the blob files.
+  //
+  // Default: 0
+  size_t min_blob_size;
+
+  // Compactions copy the live values out of a blob file once less than
+  // this fraction of it is still pointed to, so that the file can be
+  // deleted.  Blob files are read by compactions of the tables that point
+  // into them, so the files that only tables of the last level point into
+  // wait for the compactions that reach them.
+  //
+  // Default: 0.5
+  double blob_file_min_live_ratio;
+
+  // Compactions start a new blob file once their current one is this
+  // large.  Each flush writes a single blob file.
+  //
+  // Default: 256MB
+  uint64_t blob_file_size;
+
   // Create an Options object with default values for all fields.
   Options();
 };
 
+// Counters of the work that reads did, to attribute their time.  A
+// ReadStats is not synchronized, so it must only be shared by reads made
+// from one thread, such as the reads of a single iterator.  Reads without
+// one count nothing.
+struct ReadStats {
+  // Blocks found in the block cache.
+  uint64_t block_cache_hits;
+
+  // Blocks that had to be read, either because they were not in the block
+  // cache or because there is none.
+  uint64_t block_cache_misses;
+
+  // Bytes of the blocks that had to be read, as stored in the table.
+  uint64_t block_read_bytes;
+
+  // Bytes of the blocks that had to be read once uncompressed.
+  uint64_t block_uncompressed_bytes;
+
+  // Microseconds spent reading, checksumming and uncompressing the blocks
+  // that had to be read, including waits for blocks being prefetched.
+  uint64_t block_read_micros;
+
+  // Gets answered by the memtable or the immutable memtable.
+  uint64_t memtable_hits;
+
+  // Table files that Gets looked in.
+  uint64_t table_gets;
+
+  // Entries that iterators stepped over without returning them: deletion
+  // markers, the older entries that they or newer values hide, and
+  // entries newer than the iterator's snapshot.
+  uint64_t internal_keys_skipped;
+
+  ReadStats() { Reset(); }
+
+  void Reset() {
+    block_cache_hits = 0;
+    block_cache_misses = 0;
+    block_read_bytes = 0;
+    block_uncompressed_bytes = 0;
+    block_read_micros = 0;
+    memtable_hits = 0;
+    table_gets = 0;
+    internal_keys_skipped = 0;
+  }
+};
+
 // Options that control read operations
 struct ReadOptions {
   // If true, all data read from underlying storage will be
@@ -151,6 +555,49 @@ struct ReadOptions {
   // Default: true
   bool fill_cache;
 
+  // Hint that this read is a scan over a large part of the key space.
+  // Iterators then read each table through a readahead buffer that grows
+  // while the scan moves forward, and ask the operating system to fetch
+  // the next part of the file in the background.
+  // Default: false
+  bool sequential_scan;
+
+  // If positive, sequential_scan iterators read each table in windows of
+  // this many bytes instead of a window that grows as the scan moves on.
+  // Default: 0
+  size_t readahead_size;
+
+  // If positive, iterators read up to this many data blocks ahead of the
+  // current one on a shared pool of background threads, so the next block
+  // is usually read and checksummed by the time it is needed.  Blocks
+  // skipped by a seek are discarded.
+  // Default: 0
+  int prefetch_blocks;
+
+  // If true, after Seek(target) the iterator only returns keys with the
+  // same Options::prefix_extractor prefix as "target", and becomes
+  // invalid at the first key without it.  Tables whose filters rule out
+  // the prefix are not read at all.  Only Seek() and Next() may be used.
+  // Has no effect without a prefix_extractor.
+  // Default: false
+  bool prefix_same_as_start;
+
+  // If non-NULL, iterators become invalid at the first key at or after
+  // "*iterate_upper_bound" and stop reading the blocks and tables that
+  // only hold keys past it.  DB iterators copy the bound when they are
+  // created; iterators over a single Table keep pointing at it.
+  // Default: NULL
+  const Slice* iterate_upper_bound;
+
+  // If true, the value returned by an iterator stays valid after the
+  // iterator moves forward with Next() or Seek(): the blocks it points
+  // into are kept alive until Iterator::ReleasePinnedData() is called or
+  // the iterator is deleted.  This lets a reader keep several consecutive
+  // values without copying them.  Keys are not pinned, and neither are
+  // values returned while moving backward.
+  // Default: false
+  bool pin_data;
+
   // If "snapshot" is non-NULL, read as of the supplied snapshot
   // (which must belong to the DB that is being read and which must
   // not have been released).  If "snapshot" is NULL, use an impliicit
@@ -158,10 +605,23 @@ struct ReadOptions {
   // Default: NULL
   const Snapshot* snapshot;
 
+  // If non-NULL, the work done by reads made with these options is
+  // counted in "*stats", which must outlive every iterator created with
+  // them.
+  // Default: NULL
+  ReadStats* stats;
+
   ReadOptions()
       : verify_checksums(false),
         fill_cache(true),
-        snapshot(NULL) {
+        sequential_scan(false),
+        readahead_size(0),
+        prefetch_blocks(0),
+        prefix_same_as_start(false),
+        iterate_upper_bound(NULL),
+        pin_data(false),
+        snapshot(NULL),
+        stats(NULL) {
   }
 };
 
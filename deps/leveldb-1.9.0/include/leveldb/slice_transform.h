@@ -0,0 +1,52 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A database can be configured with a SliceTransform that extracts a
+// prefix from each key.  When the database also has a FilterPolicy, the
+// prefixes are added to the filters so that an iterator created with
+// ReadOptions::prefix_same_as_start can skip every table, and every
+// block, that holds no key with the prefix of its Seek() target.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_SLICE_TRANSFORM_H_
+#define STORAGE_LEVELDB_INCLUDE_SLICE_TRANSFORM_H_
+
+#include <stddef.h>
+
+namespace leveldb {
+
+class Slice;
+
+class SliceTransform {
+ public:
+  virtual ~SliceTransform();
+
+  // Return the name of this transform.  Tables record the name of the
+  // transform their filters were built with, and only use the prefixes
+  // in them if it matches.  If the transform changes in an incompatible
+  // way, the name returned by this method must be changed.
+  virtual const char* Name() const = 0;
+
+  // Return true if "key" has a prefix.  Keys without one are not added
+  // to the filters as prefixes and seeks to them are never skipped.
+  virtual bool InDomain(const Slice& key) const = 0;
+
+  // Return the prefix of "key", which must be a leading part of "key".
+  // REQUIRES: InDomain(key)
+  //
+  // Keys that share a prefix must be contiguous in the comparator's
+  // order, as they are for any prefix of bytes under the default
+  // comparator.
+  virtual Slice Transform(const Slice& key) const = 0;
+};
+
+// Return a new transform whose prefix is the first "prefix_length" bytes
+// of a key.  Shorter keys have no prefix.
+//
+// Callers must delete the result after any database that is using the
+// result has been closed.
+extern const SliceTransform* NewFixedPrefixTransform(size_t prefix_length);
+
+}
+
+#endif  // STORAGE_LEVELDB_INCLUDE_SLICE_TRANSFORM_H_
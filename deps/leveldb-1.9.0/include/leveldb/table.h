@@ -11,11 +11,13 @@
 namespace leveldb {
 
 class Block;
+struct BlockContents;
 class BlockHandle;
 class Footer;
 struct Options;
 class RandomAccessFile;
 struct ReadOptions;
+struct ReadStats;
 class TableCache;
 
 // A Table is a sorted map from strings to strings.  Tables are
@@ -55,12 +57,44 @@ class Table {
   // be close to the file length.
   uint64_t ApproximateOffsetOf(const Slice& key) const;
 
+  // Returns the id that the block cache keys of the table's blocks start
+  // with, or 0 if there is no block cache.
+  uint64_t BlockCacheId() const;
+
  private:
   struct Rep;
   Rep* rep_;
 
   explicit Table(Rep* rep) { rep_ = rep; }
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
+  static Iterator* ScanBlockReader(void*, const ReadOptions&, const Slice&);
+  static Iterator* IndexPartitionReader(void*, const ReadOptions&,
+                                        const Slice&);
+
+  // Returns an iterator over the index entries of every data block,
+  // reading index partitions as needed.
+  Iterator* NewIndexIterator(const ReadOptions& options) const;
+
+  // Per-iterator state of iterators made for sequential scans or that
+  // prefetch blocks.
+  struct ScanState;
+  static void DeleteScanState(void* arg, void* ignored);
+
+  static Iterator* ReadBlockIterator(Table* table,
+                                     ScanState* state,
+                                     const ReadOptions&,
+                                     const Slice&,
+                                     const Slice* get_target = NULL);
+  static Status ReadTableBlock(Table* table,
+                               ScanState* state,
+                               const ReadOptions& options,
+                               const BlockHandle& handle,
+                               BlockContents* contents);
+  static Status ReadCompressedCachedBlock(Table* table,
+                                          RandomAccessFile* file,
+                                          const ReadOptions& options,
+                                          const BlockHandle& handle,
+                                          BlockContents* contents);
 
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
@@ -72,8 +106,28 @@ class Table {
       void (*handle_result)(void* arg, const Slice& k, const Slice& v));
 
 
+  // Returns false if the prefix filters say the table holds no key at or
+  // after "target" with the prefix of "target".
+  bool PrefixMayMatch(const Slice& target) const;
+  static bool PrefixMayMatchThunk(void* arg, const Slice& target);
+
+  // Reads the data blocks that start at the "n" ascending "offsets" into
+  // the block cache.  Offsets that no block starts at are skipped.
+  Status WarmBlocks(const uint64_t* offsets, size_t n, ReadStats* stats);
+
+  // Returns the approximate bytes of the filter and index blocks of the
+  // table, counting every index partition.
+  size_t MetadataSize() const;
+
+  // Reads every index partition into memory, where reads of the table
+  // find them instead of going through the block cache.  Does nothing if
+  // the index is not partitioned or is already pinned.
+  // REQUIRES: External synchronization between calls.
+  Status PinIndexPartitions();
+
   void ReadMeta(const Footer& footer);
   void ReadFilter(const Slice& filter_handle_value);
+  void ReadDictionary(const Slice& dictionary_handle_value);
 
   // No copying allowed
   Table(const Table&);
@@ -77,6 +77,13 @@ class TableBuilder {
  private:
   bool ok() const { return status().ok(); }
   void WriteBlock(BlockBuilder* block, BlockHandle* handle);
+  void AddIndexEntry(const std::string& key, const BlockHandle& handle);
+  void AddFilterKey(const Slice& key);
+  void SubmitDataBlock();
+  void WritePendingBlock();
+  void WritePendingBlocks();
+  void DiscardPendingBlocks();
+  void FlushIndexPartition();
   void WriteRawBlock(const Slice& data, CompressionType, BlockHandle* handle);
 
   struct Rep;
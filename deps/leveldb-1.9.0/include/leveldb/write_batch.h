@@ -39,6 +39,14 @@ class WriteBatch {
   // If the database contains a mapping for "key", erase it.  Else do nothing.
   void Delete(const Slice& key);
 
+  // Erase every database entry whose key is in ["begin_key", "end_key").
+  // Does nothing if "begin_key" is not before "end_key".
+  void DeleteRange(const Slice& begin_key, const Slice& end_key);
+
+  // Combine "value" with the database's value for "key" using the
+  // merge_operator of the options the database was opened with.
+  void Merge(const Slice& key, const Slice& value);
+
   // Clear all updates buffered in this batch.
   void Clear();
 
@@ -48,6 +56,10 @@ class WriteBatch {
     virtual ~Handler();
     virtual void Put(const Slice& key, const Slice& value) = 0;
     virtual void Delete(const Slice& key) = 0;
+    // The default implementation ignores range deletions.
+    virtual void DeleteRange(const Slice& begin_key, const Slice& end_key);
+    // The default implementation ignores merges.
+    virtual void Merge(const Slice& key, const Slice& value);
   };
   Status Iterate(Handler* handler) const;
 
@@ -123,6 +123,9 @@ class AtomicPointer {
     MemoryBarrier();
     rep_ = v;
   }
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return __sync_bool_compare_and_swap(&rep_, expected, v);
+  }
 };
 
 // AtomicPointer based on <cstdatomic>
@@ -145,6 +148,9 @@ class AtomicPointer {
   inline void NoBarrier_Store(void* v) {
     rep_.store(v, std::memory_order_relaxed);
   }
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return rep_.compare_exchange_strong(expected, v);
+  }
 };
 
 // Atomic pointer based on sparc memory barriers
@@ -175,6 +181,9 @@ class AtomicPointer {
   }
   inline void* NoBarrier_Load() const { return rep_; }
   inline void NoBarrier_Store(void* v) { rep_ = v; }
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return __sync_bool_compare_and_swap(&rep_, expected, v);
+  }
 };
 
 // Atomic pointer based on ia64 acq/rel
@@ -205,6 +214,9 @@ class AtomicPointer {
   }
   inline void* NoBarrier_Load() const { return rep_; }
   inline void NoBarrier_Store(void* v) { rep_ = v; }
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return __sync_bool_compare_and_swap(&rep_, expected, v);
+  }
 };
 
 // We have neither MemoryBarrier(), nor <cstdatomic>
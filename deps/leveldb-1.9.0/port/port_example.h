@@ -122,6 +122,37 @@ extern bool Snappy_GetUncompressedLength(const char* input, size_t length,
 extern bool Snappy_Uncompress(const char* input_data, size_t input_length,
                               char* output);
 
+// Store the LZ4 compression of "input[0,input_length-1]" in *output.
+// The output does not record the uncompressed length, so callers must.
+// Returns false if LZ4 is not supported by this port.
+extern bool LZ4_Compress(const char* input, size_t input_length,
+                         std::string* output);
+
+// Attempt to LZ4 uncompress input[0,input_length-1] into
+// output[0,output_length-1].  Returns true if successful and the data
+// uncompresses to exactly output_length bytes.
+extern bool LZ4_Uncompress(const char* input, size_t input_length,
+                           char* output, size_t output_length);
+
+// Store the Zstd compression of "input[0,input_length-1]" in *output,
+// using the dictionary "dict[0,dict_length-1]" if dict_length > 0.
+// Returns false if Zstd is not supported by this port.
+extern bool Zstd_Compress(const char* input, size_t input_length,
+                          const char* dict, size_t dict_length,
+                          std::string* output);
+
+// If input[0,input_length-1] looks like Zstd compressed data, store the
+// size of the uncompressed data in *result and return true.
+extern bool Zstd_GetUncompressedLength(const char* input, size_t length,
+                                       size_t* result);
+
+// Attempt to Zstd uncompress input[0,input_length-1] into
+// output[0,output_length-1] with the dictionary it was compressed with.
+// Returns true if successful.
+extern bool Zstd_Uncompress(const char* input, size_t input_length,
+                            const char* dict, size_t dict_length,
+                            char* output, size_t output_length);
+
 // ------------------ Miscellaneous -------------------
 
 // If heap profiling is not supported, returns false.
@@ -129,6 +160,14 @@ extern bool Snappy_Uncompress(const char* input_data, size_t input_length,
 // The concatenation of all "data[0,n-1]" fragments is the heap profile.
 extern bool GetHeapProfile(void (*func)(void*, const char*, int), void* arg);
 
+// Extend the CRC to include the first n bytes of buf using instructions
+// of the CPU. If the CPU has no such instructions, returns 0 instead.
+extern uint32_t AcceleratedCRC32C(uint32_t crc, const char* buf, size_t size);
+
+// Hint that the memory at "addr" will be read soon.  May do nothing.
+// "addr" need not point to valid memory.
+extern void Prefetch(const void* addr);
+
 }  // namespace port
 }  // namespace leveldb
 
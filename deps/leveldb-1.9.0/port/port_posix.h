@@ -45,6 +45,12 @@
 #ifdef SNAPPY
 #include <snappy.h>
 #endif
+#ifdef LZ4
+#include <lz4.h>
+#endif
+#ifdef ZSTD
+#include <zstd.h>
+#endif
 #include <stdint.h>
 #include <string>
 #include "port/atomic_pointer.h"
@@ -147,10 +153,102 @@ inline bool Snappy_Uncompress(const char* input, size_t length,
 #endif
 }
 
+inline bool LZ4_Compress(const char* input, size_t length,
+                         ::std::string* output) {
+#ifdef LZ4
+  output->resize(LZ4_compressBound(static_cast<int>(length)));
+  int outlen = LZ4_compress_default(input, &(*output)[0],
+                                    static_cast<int>(length),
+                                    static_cast<int>(output->size()));
+  if (outlen <= 0) {
+    return false;
+  }
+  output->resize(outlen);
+  return true;
+#endif
+
+  return false;
+}
+
+inline bool LZ4_Uncompress(const char* input, size_t length,
+                           char* output, size_t output_length) {
+#ifdef LZ4
+  int n = LZ4_decompress_safe(input, output, static_cast<int>(length),
+                              static_cast<int>(output_length));
+  return n >= 0 && static_cast<size_t>(n) == output_length;
+#else
+  return false;
+#endif
+}
+
+inline bool Zstd_Compress(const char* input, size_t length,
+                          const char* dict, size_t dict_length,
+                          ::std::string* output) {
+#ifdef ZSTD
+  output->resize(ZSTD_compressBound(length));
+  ZSTD_CCtx* ctx = ZSTD_createCCtx();
+  if (ctx == NULL) {
+    return false;
+  }
+  const int kLevel = 3;   // Zstd's default level
+  size_t outlen = ZSTD_compress_usingDict(ctx, &(*output)[0], output->size(),
+                                          input, length,
+                                          dict, dict_length, kLevel);
+  ZSTD_freeCCtx(ctx);
+  if (ZSTD_isError(outlen)) {
+    return false;
+  }
+  output->resize(outlen);
+  return true;
+#endif
+
+  return false;
+}
+
+inline bool Zstd_GetUncompressedLength(const char* input, size_t length,
+                                       size_t* result) {
+#ifdef ZSTD
+  unsigned long long n = ZSTD_getFrameContentSize(input, length);
+  if (n == ZSTD_CONTENTSIZE_UNKNOWN || n == ZSTD_CONTENTSIZE_ERROR) {
+    return false;
+  }
+  *result = static_cast<size_t>(n);
+  return true;
+#else
+  return false;
+#endif
+}
+
+inline bool Zstd_Uncompress(const char* input, size_t length,
+                            const char* dict, size_t dict_length,
+                            char* output, size_t output_length) {
+#ifdef ZSTD
+  ZSTD_DCtx* ctx = ZSTD_createDCtx();
+  if (ctx == NULL) {
+    return false;
+  }
+  size_t n = ZSTD_decompress_usingDict(ctx, output, output_length,
+                                       input, length, dict, dict_length);
+  ZSTD_freeDCtx(ctx);
+  return !ZSTD_isError(n) && n == output_length;
+#else
+  return false;
+#endif
+}
+
 inline bool GetHeapProfile(void (*func)(void*, const char*, int), void* arg) {
   return false;
 }
 
+inline void Prefetch(const void* addr) {
+#if defined(__GNUC__)
+  __builtin_prefetch(addr, 0, 3);
+#endif
+}
+
+// Implemented in port_posix_crc32c.cc.
+uint32_t AcceleratedCRC32C(uint32_t crc, const char* buf, size_t size);
+
 } // namespace port
 } // namespace leveldb
 
@@ -0,0 +1,207 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A hardware-accelerated implementation of crc32c using the SSE4.2 crc32
+// instruction on x86-64 and the CRC32C instructions of ARMv8. Support is
+// detected at runtime so the library still runs on CPUs without them.
+//
+// Large buffers are split into three streams whose CRCs are computed at
+// the same time to hide the latency of the instruction, and are then
+// combined by shifting each CRC past the streams that follow it.
+
+#include "port/port.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define LEVELDB_CRC32C_X86
+#elif defined(__aarch64__) && defined(__linux__) && defined(__GNUC__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define LEVELDB_CRC32C_ARM
+#endif
+
+namespace leveldb {
+namespace port {
+
+#if defined(LEVELDB_CRC32C_X86) || defined(LEVELDB_CRC32C_ARM)
+
+#if defined(LEVELDB_CRC32C_X86)
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#define CRC32C_U8(crc, p) _mm_crc32_u8((crc), *(p))
+#define CRC32C_U64(crc, p) static_cast<uint32_t>(_mm_crc32_u64((crc), LoadU64(p)))
+#elif defined(__clang__)
+#define CRC32C_TARGET __attribute__((target("crc")))
+#define CRC32C_U8(crc, p) __crc32cb((crc), *(p))
+#define CRC32C_U64(crc, p) __crc32cd((crc), LoadU64(p))
+#else
+#define CRC32C_TARGET __attribute__((target("+crc")))
+#define CRC32C_U8(crc, p) __crc32cb((crc), *(p))
+#define CRC32C_U64(crc, p) __crc32cd((crc), LoadU64(p))
+#endif
+
+namespace {
+
+// The reflected crc32c polynomial.
+static const uint32_t kPoly = 0x82f63b78;
+
+// The lengths of each of the three streams for large and medium buffers.
+// Both must be powers of two and multiples of eight.
+static const size_t kLongStream = 8192;
+static const size_t kShortStream = 256;
+
+// Tables that append kLongStream or kShortStream zero bytes to a crc, one
+// byte of the crc at a time.
+static uint32_t long_shifts[4][256];
+static uint32_t short_shifts[4][256];
+
+static OnceType once = LEVELDB_ONCE_INIT;
+static bool accelerated = false;
+
+static inline uint64_t LoadU64(const uint8_t* p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+// Multiplies a 32x32 matrix over GF(2) by a vector.
+static uint32_t MatrixTimes(const uint32_t* matrix, uint32_t vector) {
+  uint32_t sum = 0;
+  for (; vector != 0; vector >>= 1, matrix++) {
+    if (vector & 1) {
+      sum ^= *matrix;
+    }
+  }
+  return sum;
+}
+
+static void MatrixSquare(uint32_t* square, const uint32_t* matrix) {
+  for (int n = 0; n < 32; n++) {
+    square[n] = MatrixTimes(matrix, matrix[n]);
+  }
+}
+
+// Builds the tables that append len zero bytes to a crc. len must be a
+// power of two.
+static void BuildShifts(uint32_t shifts[4][256], size_t len) {
+  // Start with the operator for a single zero bit and square it up to
+  // one zero byte, then keep squaring until it covers len bytes.
+  uint32_t op[32], square[32];
+  op[0] = kPoly;
+  for (int n = 1; n < 32; n++) {
+    op[n] = 1u << (n - 1);
+  }
+  for (int bits = 1; bits < 8; bits <<= 1) {
+    MatrixSquare(square, op);
+    memcpy(op, square, sizeof(op));
+  }
+  for (; len > 1; len >>= 1) {
+    MatrixSquare(square, op);
+    memcpy(op, square, sizeof(op));
+  }
+
+  for (uint32_t n = 0; n < 256; n++) {
+    shifts[0][n] = MatrixTimes(op, n);
+    shifts[1][n] = MatrixTimes(op, n << 8);
+    shifts[2][n] = MatrixTimes(op, n << 16);
+    shifts[3][n] = MatrixTimes(op, n << 24);
+  }
+}
+
+static inline uint32_t Shift(uint32_t shifts[4][256], uint32_t crc) {
+  return shifts[0][crc & 0xff] ^
+         shifts[1][(crc >> 8) & 0xff] ^
+         shifts[2][(crc >> 16) & 0xff] ^
+         shifts[3][crc >> 24];
+}
+
+static void InitCRC32C() {
+#if defined(LEVELDB_CRC32C_X86)
+  __builtin_cpu_init();
+  accelerated = __builtin_cpu_supports("sse4.2");
+#else
+  accelerated = (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+  if (accelerated) {
+    BuildShifts(long_shifts, kLongStream);
+    BuildShifts(short_shifts, kShortStream);
+  }
+}
+
+// Computes three streams of len bytes at a time while at least that much
+// of the buffer is left.
+CRC32C_TARGET
+static inline uint32_t ExtendStreams(uint32_t crc0, const uint8_t** p,
+                                     size_t* size, size_t len,
+                                     uint32_t shifts[4][256]) {
+  while (*size >= len * 3) {
+    uint32_t crc1 = 0;
+    uint32_t crc2 = 0;
+    const uint8_t* next = *p;
+    const uint8_t* end = next + len;
+    do {
+      crc0 = CRC32C_U64(crc0, next);
+      crc1 = CRC32C_U64(crc1, next + len);
+      crc2 = CRC32C_U64(crc2, next + len * 2);
+      next += 8;
+    } while (next < end);
+    crc0 = Shift(shifts, crc0) ^ crc1;
+    crc0 = Shift(shifts, crc0) ^ crc2;
+    *p += len * 3;
+    *size -= len * 3;
+  }
+  return crc0;
+}
+
+CRC32C_TARGET
+static uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(buf);
+  uint32_t l = crc ^ 0xffffffffu;
+
+  // Process bytes until p is 8-byte aligned.
+  while (size > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+    l = CRC32C_U8(l, p);
+    p++;
+    size--;
+  }
+
+  l = ExtendStreams(l, &p, &size, kLongStream, long_shifts);
+  l = ExtendStreams(l, &p, &size, kShortStream, short_shifts);
+
+  // Process the rest 8 bytes at a time and then the last few bytes.
+  for (; size >= 8; p += 8, size -= 8) {
+    l = CRC32C_U64(l, p);
+  }
+  for (; size > 0; p++, size--) {
+    l = CRC32C_U8(l, p);
+  }
+  return l ^ 0xffffffffu;
+}
+
+}  // namespace
+
+uint32_t AcceleratedCRC32C(uint32_t crc, const char* buf, size_t size) {
+  InitOnce(&once, InitCRC32C);
+  if (!accelerated) {
+    return 0;
+  }
+  return Extend(crc, buf, size);
+}
+
+#undef CRC32C_TARGET
+#undef CRC32C_U8
+#undef CRC32C_U64
+
+#else
+
+uint32_t AcceleratedCRC32C(uint32_t crc, const char* buf, size_t size) {
+  return 0;
+}
+
+#endif
+
+}  // namespace port
+}  // namespace leveldb
@@ -6,39 +6,62 @@
 
 #include "table/block.h"
 
+#include <string.h>
 #include <vector>
 #include <algorithm>
 #include "leveldb/comparator.h"
+#include "table/block_builder.h"
 #include "table/format.h"
 #include "util/coding.h"
+#include "util/huge_page.h"
 #include "util/logging.h"
 
 namespace leveldb {
 
 inline uint32_t Block::NumRestarts() const {
   assert(size_ >= 2*sizeof(uint32_t));
-  return DecodeFixed32(data_ + size_ - sizeof(uint32_t));
+  return DecodeFixed32(data_ + size_ - sizeof(uint32_t)) & ~kBlockHashIndexFlag;
 }
 
 Block::Block(const BlockContents& contents)
     : data_(contents.data.data()),
       size_(contents.data.size()),
+      hash_buckets_(NULL),
+      num_buckets_(0),
       owned_(contents.heap_allocated) {
   if (size_ < sizeof(uint32_t)) {
     size_ = 0;  // Error marker
-  } else {
-    restart_offset_ = size_ - (1 + NumRestarts()) * sizeof(uint32_t);
-    if (restart_offset_ > size_ - sizeof(uint32_t)) {
-      // The size is too small for NumRestarts() and therefore
-      // restart_offset_ wrapped around.
+    return;
+  }
+  size_t trailer = size_ - sizeof(uint32_t);  // Offset of num_restarts
+  if (DecodeFixed32(data_ + trailer) & kBlockHashIndexFlag) {
+    if (trailer < 2) {
+      size_ = 0;
+      return;
+    }
+    const unsigned char* n =
+        reinterpret_cast<const unsigned char*>(data_ + trailer - 2);
+    num_buckets_ = n[0] | (static_cast<uint32_t>(n[1]) << 8);
+    if (num_buckets_ == 0 || trailer - 2 < num_buckets_) {
       size_ = 0;
+      return;
     }
+    trailer -= 2 + num_buckets_;
+    hash_buckets_ = data_ + trailer;
+  }
+  const uint64_t restarts_size =
+      static_cast<uint64_t>(NumRestarts()) * sizeof(uint32_t);
+  if (restarts_size > trailer) {
+    // The size is too small for NumRestarts()
+    size_ = 0;
+  } else {
+    restart_offset_ = trailer - restarts_size;
   }
 }
 
 Block::~Block() {
   if (owned_) {
-    delete[] data_;
+    DeleteBlockBuffer(data_);
   }
 }
 
@@ -60,6 +83,9 @@ static inline const char* DecodeEntry(const char* p, const char* limit,
   if ((*shared | *non_shared | *value_length) < 128) {
     // Fast path: all three values are encoded in one byte each
     p += 3;
+  } else if ((*shared | *non_shared) < 128) {
+    // Only the value is long, as in blocks of large values
+    if ((p = GetVarint32Ptr(p + 2, limit, value_length)) == NULL) return NULL;
   } else {
     if ((p = GetVarint32Ptr(p, limit, shared)) == NULL) return NULL;
     if ((p = GetVarint32Ptr(p, limit, non_shared)) == NULL) return NULL;
@@ -72,6 +98,74 @@ static inline const char* DecodeEntry(const char* p, const char* limit,
   return p;
 }
 
+// The current key of a Block::Iter.  A key stored whole, as at restart
+// points, is returned from the block itself; a key that shares a prefix
+// with the previous key is rebuilt in a buffer that is only reallocated
+// when a longer key needs it.
+class BlockKey {
+ public:
+  BlockKey()
+      : data_(space_), size_(0), buf_(space_), capacity_(sizeof(space_)) {
+  }
+
+  ~BlockKey() {
+    if (buf_ != space_) {
+      delete[] buf_;
+    }
+  }
+
+  Slice slice() const { return Slice(data_, size_); }
+  size_t size() const { return size_; }
+
+  void Clear() {
+    data_ = buf_;
+    size_ = 0;
+  }
+
+  // Set the key to the "n" bytes at "p", which outlive the key.
+  void SetPinned(const char* p, size_t n) {
+    data_ = p;
+    size_ = n;
+  }
+
+  // Keep the first "shared" bytes of the key and append the "n" bytes at
+  // "p" to them.
+  void TrimAppend(size_t shared, const char* p, size_t n) {
+    assert(shared <= size_);
+    const size_t total = shared + n;
+    if (total > capacity_) {
+      Grow(total, shared);
+    } else if (data_ != buf_) {
+      memcpy(buf_, data_, shared);
+    }
+    memcpy(buf_ + shared, p, n);
+    data_ = buf_;
+    size_ = total;
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+  char* buf_;          // space_ or a heap buffer of capacity_ bytes
+  size_t capacity_;
+  char space_[64];
+
+  void Grow(size_t n, size_t keep) {
+    const size_t capacity = std::max(n, 2 * capacity_);
+    char* buf = new char[capacity];
+    memcpy(buf, data_, keep);
+    if (buf_ != space_) {
+      delete[] buf_;
+    }
+    buf_ = buf;
+    capacity_ = capacity;
+  }
+
+  // No copying allowed
+  BlockKey(const BlockKey&);
+  void operator=(const BlockKey&);
+};
+
 class Block::Iter : public Iterator {
  private:
   const Comparator* const comparator_;
@@ -82,7 +176,7 @@ class Block::Iter : public Iterator {
   // current_ is offset in data_ of current entry.  >= restarts_ if !Valid
   uint32_t current_;
   uint32_t restart_index_;  // Index of restart block in which current_ falls
-  std::string key_;
+  BlockKey key_;
   Slice value_;
   Status status_;
 
@@ -101,7 +195,7 @@ class Block::Iter : public Iterator {
   }
 
   void SeekToRestartPoint(uint32_t index) {
-    key_.clear();
+    key_.Clear();
     restart_index_ = index;
     // current_ will be fixed by ParseNextKey();
 
@@ -128,7 +222,7 @@ class Block::Iter : public Iterator {
   virtual Status status() const { return status_; }
   virtual Slice key() const {
     assert(Valid());
-    return key_;
+    return key_.slice();
   }
   virtual Slice value() const {
     assert(Valid());
@@ -195,12 +289,42 @@ class Block::Iter : public Iterator {
       if (!ParseNextKey()) {
         return;
       }
-      if (Compare(key_, target) >= 0) {
+      if (Compare(key_.slice(), target) >= 0) {
         return;
       }
     }
   }
 
+  // Seek(target) using the hash index "buckets" to find the restart
+  // point to scan from.
+  void SeekForGet(const Slice& target, const char* buckets,
+                  uint32_t num_buckets) {
+    if (target.size() < 8) {
+      Seek(target);
+      return;
+    }
+    const Slice user_key(target.data(), target.size() - 8);
+    const uint8_t bucket = static_cast<uint8_t>(
+        buckets[BlockHashIndexHash(user_key) % num_buckets]);
+    if (bucket == kBlockHashNoEntry) {
+      // No entry for user_key in this block
+      current_ = restarts_;
+      restart_index_ = num_restarts_;
+      return;
+    }
+    if (bucket == kBlockHashCollision || bucket >= num_restarts_) {
+      Seek(target);
+      return;
+    }
+
+    // The entries for user_key start after restart point "bucket", and
+    // any keys before them are smaller than target
+    SeekToRestartPoint(bucket);
+    while (ParseNextKey() && Compare(key_.slice(), target) < 0) {
+      // Keep skipping
+    }
+  }
+
   virtual void SeekToFirst() {
     SeekToRestartPoint(0);
     ParseNextKey();
@@ -218,7 +342,7 @@ class Block::Iter : public Iterator {
     current_ = restarts_;
     restart_index_ = num_restarts_;
     status_ = Status::Corruption("bad entry in block");
-    key_.clear();
+    key_.Clear();
     value_.clear();
   }
 
@@ -240,8 +364,11 @@ class Block::Iter : public Iterator {
       CorruptionError();
       return false;
     } else {
-      key_.resize(shared);
-      key_.append(p, non_shared);
+      if (shared == 0) {
+        key_.SetPinned(p, non_shared);
+      } else {
+        key_.TrimAppend(shared, p, non_shared);
+      }
       value_ = Slice(p + non_shared, value_length);
       while (restart_index_ + 1 < num_restarts_ &&
              GetRestartPoint(restart_index_ + 1) < current_) {
@@ -264,4 +391,17 @@ Iterator* Block::NewIterator(const Comparator* cmp) {
   }
 }
 
+Iterator* Block::NewIteratorForGet(const Comparator* cmp,
+                                   const Slice& target) {
+  Iterator* iter = NewIterator(cmp);
+  if (hash_buckets_ != NULL && size_ >= 2*sizeof(uint32_t) &&
+      NumRestarts() > 0) {
+    static_cast<Iter*>(iter)->SeekForGet(target, hash_buckets_,
+                                         num_buckets_);
+  } else {
+    iter->Seek(target);
+  }
+  return iter;
+}
+
 }  // namespace leveldb
@@ -24,13 +24,24 @@ class Block {
   size_t size() const { return size_; }
   Iterator* NewIterator(const Comparator* comparator);
 
+  // Returns an iterator for a point lookup of the internal key "target".
+  // If the block holds an entry for the user key of "target" at or after
+  // "target", the iterator is positioned at the first such entry, as
+  // Seek(target) would position it.  Otherwise it is either invalid or
+  // positioned at an entry for another user key.  Uses the block's hash
+  // index, if any, instead of a binary search.
+  Iterator* NewIteratorForGet(const Comparator* comparator,
+                              const Slice& target);
+
  private:
   uint32_t NumRestarts() const;
 
   const char* data_;
   size_t size_;
   uint32_t restart_offset_;     // Offset in data_ of restart array
-  bool owned_;                  // Block owns data_[]
+  const char* hash_buckets_;    // Hash index buckets, or NULL if none
+  uint32_t num_buckets_;
+  bool owned_;                  // Block owns data_ (a NewBlockBuffer())
 
   // No copying allowed
   Block(const Block&);
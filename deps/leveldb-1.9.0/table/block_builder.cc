@@ -19,12 +19,22 @@
 //     value_length: varint32
 //     key_delta: char[unshared_bytes]
 //     value: char[value_length]
-// shared_bytes == 0 for restart points.
+// shared_bytes == 0 for restart points, and for every entry with
+// Options::uncompressed_block_keys.
 //
 // The trailer of the block has the form:
 //     restarts: uint32[num_restarts]
 //     num_restarts: uint32
 // restarts[i] contains the offset within the block of the ith restart point.
+//
+// With Options::data_block_hash_index, the restarts are followed by a
+// hash index for point lookups, and the trailer has the form:
+//     restarts: uint32[num_restarts]
+//     buckets: uint8[num_buckets]
+//     num_buckets: uint16
+//     num_restarts | kBlockHashIndexFlag: uint32
+// buckets[BlockHashIndexHash(user_key) % num_buckets] is the index of the
+// restart point at or before the first entry for user_key.
 
 #include "table/block_builder.h"
 
@@ -33,14 +43,23 @@
 #include "leveldb/comparator.h"
 #include "leveldb/table_builder.h"
 #include "util/coding.h"
+#include "util/hash.h"
 
 namespace leveldb {
 
+// Restart points that a bucket can hold, below the two markers
+static const size_t kMaxHashedRestarts = kBlockHashCollision;
+
+uint32_t BlockHashIndexHash(const Slice& user_key) {
+  return Hash(user_key.data(), user_key.size(), 0x5a8e3c1f);
+}
+
 BlockBuilder::BlockBuilder(const Options* options)
     : options_(options),
       restarts_(),
       counter_(0),
-      finished_(false) {
+      finished_(false),
+      hashable_(true) {
   assert(options->block_restart_interval >= 1);
   restarts_.push_back(0);       // First restart point is at offset 0
 }
@@ -52,12 +71,15 @@ void BlockBuilder::Reset() {
   counter_ = 0;
   finished_ = false;
   last_key_.clear();
+  hashes_.clear();
+  hashable_ = true;
 }
 
 size_t BlockBuilder::CurrentSizeEstimate() const {
   return (buffer_.size() +                        // Raw data buffer
           restarts_.size() * sizeof(uint32_t) +   // Restart array
-          sizeof(uint32_t));                      // Restart array length
+          sizeof(uint32_t) +                      // Restart array length
+          hashes_.size() * 4 / 3);                // Hash index buckets
 }
 
 Slice BlockBuilder::Finish() {
@@ -65,7 +87,28 @@ Slice BlockBuilder::Finish() {
   for (size_t i = 0; i < restarts_.size(); i++) {
     PutFixed32(&buffer_, restarts_[i]);
   }
-  PutFixed32(&buffer_, restarts_.size());
+  uint32_t num_restarts = restarts_.size();
+  if (options_->data_block_hash_index && hashable_ && !hashes_.empty() &&
+      restarts_.size() <= kMaxHashedRestarts) {
+    // Buckets at most 3/4 full keep collisions rare
+    const size_t num_buckets =
+        std::min<size_t>(hashes_.size() * 4 / 3 + 1, 0xffff);
+    std::string buckets(num_buckets, static_cast<char>(kBlockHashNoEntry));
+    for (size_t i = 0; i < hashes_.size(); i++) {
+      char* bucket = &buckets[hashes_[i].first % num_buckets];
+      const uint8_t restart = static_cast<uint8_t>(hashes_[i].second);
+      if (static_cast<uint8_t>(*bucket) == kBlockHashNoEntry) {
+        *bucket = static_cast<char>(restart);
+      } else if (static_cast<uint8_t>(*bucket) != restart) {
+        *bucket = static_cast<char>(kBlockHashCollision);
+      }
+    }
+    buffer_.append(buckets);
+    buffer_.push_back(static_cast<char>(num_buckets & 0xff));
+    buffer_.push_back(static_cast<char>(num_buckets >> 8));
+    num_restarts |= kBlockHashIndexFlag;
+  }
+  PutFixed32(&buffer_, num_restarts);
   finished_ = true;
   return Slice(buffer_);
 }
@@ -77,7 +120,14 @@ void BlockBuilder::Add(const Slice& key, const Slice& value) {
   assert(buffer_.empty() // No values yet?
          || options_->comparator->Compare(key, last_key_piece) > 0);
   size_t shared = 0;
-  if (counter_ < options_->block_restart_interval) {
+  if (options_->uncompressed_block_keys) {
+    // Keys are stored whole, but restart points still bound the scan
+    // after the binary search.
+    if (counter_ >= options_->block_restart_interval) {
+      restarts_.push_back(buffer_.size());
+      counter_ = 0;
+    }
+  } else if (counter_ < options_->block_restart_interval) {
     // See how much sharing to do with previous string
     const size_t min_length = std::min(last_key_piece.size(), key.size());
     while ((shared < min_length) && (last_key_piece[shared] == key[shared])) {
@@ -90,6 +140,20 @@ void BlockBuilder::Add(const Slice& key, const Slice& value) {
   }
   const size_t non_shared = key.size() - shared;
 
+  if (options_->data_block_hash_index && hashable_) {
+    if (key.size() < 8) {
+      hashable_ = false;
+    } else {
+      Slice user_key(key.data(), key.size() - 8);
+      if (buffer_.empty() || last_key_piece.size() < 8 ||
+          Slice(last_key_piece.data(), last_key_piece.size() - 8) !=
+          user_key) {
+        hashes_.push_back(std::make_pair(BlockHashIndexHash(user_key),
+                                         restarts_.size() - 1));
+      }
+    }
+  }
+
   // Add "<shared><non_shared><value_size>" to buffer_
   PutVarint32(&buffer_, shared);
   PutVarint32(&buffer_, non_shared);
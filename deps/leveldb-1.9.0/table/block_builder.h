@@ -14,6 +14,17 @@ namespace leveldb {
 
 struct Options;
 
+// The hash index of a block maps each hash bucket to the restart point
+// of the first entry whose user key (the key minus its 8-byte sequence
+// number and type) hashes to the bucket, or to one of these markers.
+// Blocks that have one set kBlockHashIndexFlag in num_restarts.
+static const uint32_t kBlockHashIndexFlag = 0x80000000u;
+static const uint8_t kBlockHashNoEntry = 255;
+static const uint8_t kBlockHashCollision = 254;
+
+// Hash of "user_key" used by block hash indexes.
+extern uint32_t BlockHashIndexHash(const Slice& user_key);
+
 class BlockBuilder {
  public:
   explicit BlockBuilder(const Options* options);
@@ -47,6 +58,10 @@ class BlockBuilder {
   bool                  finished_;    // Has Finish() been called?
   std::string           last_key_;
 
+  // For the hash index: the hash and restart point of each user key
+  std::vector<std::pair<uint32_t, uint32_t> > hashes_;
+  bool                  hashable_;    // Every key has a user key
+
   // No copying allowed
   BlockBuilder(const BlockBuilder&);
   void operator=(const BlockBuilder&);
@@ -0,0 +1,186 @@
+// Copyright (c) 2013 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/block_compressor.h"
+
+#include <algorithm>
+#include "leveldb/env.h"
+#include "util/coding.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+// The most threads the default compressor starts.
+static const int kMaxCompressionThreads = 32;
+
+Slice CompressBlock(const Slice& raw, CompressionType type,
+                    const Slice& dictionary, std::string* compressed,
+                    CompressionType* stored_type) {
+  bool ok = false;
+  switch (type) {
+    case kNoCompression:
+      break;
+
+    case kSnappyCompression:
+      ok = port::Snappy_Compress(raw.data(), raw.size(), compressed);
+      break;
+
+    case kLZ4Compression: {
+      // LZ4 does not record the uncompressed length, so prefix it.
+      std::string lz4;
+      if (port::LZ4_Compress(raw.data(), raw.size(), &lz4)) {
+        PutVarint32(compressed, static_cast<uint32_t>(raw.size()));
+        compressed->append(lz4);
+        ok = true;
+      }
+      break;
+    }
+
+    case kZstdCompression:
+      ok = port::Zstd_Compress(raw.data(), raw.size(),
+                               dictionary.data(), dictionary.size(),
+                               compressed);
+      break;
+  }
+  if (ok && compressed->size() < raw.size() - (raw.size() / 8u)) {
+    *stored_type = type;
+    return *compressed;
+  }
+  // Compression not requested or not supported, or compressed less
+  // than 12.5%, so just store uncompressed form
+  *stored_type = kNoCompression;
+  return raw;
+}
+
+struct BlockCompressor::Request {
+  enum State { kQueued, kRunning, kDone };
+
+  std::string raw;
+  CompressionType type;
+  Slice dictionary;
+  State state;
+  std::string compressed;
+  CompressionType stored_type;
+
+  // Compress raw, leaving the contents to write in compressed.
+  void Run() {
+    CompressBlock(raw, type, dictionary, &compressed, &stored_type);
+    if (stored_type == kNoCompression) {
+      compressed.swap(raw);
+    }
+  }
+};
+
+static port::OnceType once = LEVELDB_ONCE_INIT;
+static BlockCompressor* default_compressor;
+
+void BlockCompressor::InitDefault() {
+  default_compressor = new BlockCompressor;
+}
+
+BlockCompressor* BlockCompressor::Default(int num_threads) {
+  port::InitOnce(&once, &BlockCompressor::InitDefault);
+  default_compressor->AddThreads(num_threads);
+  return default_compressor;
+}
+
+BlockCompressor::BlockCompressor()
+    : work_cv_(&mu_),
+      done_cv_(&mu_),
+      num_threads_(0) {
+}
+
+BlockCompressor::~BlockCompressor() {
+  // The default compressor lives for the whole process.
+}
+
+void BlockCompressor::AddThreads(int num_threads) {
+  num_threads = std::min(num_threads, kMaxCompressionThreads);
+  MutexLock l(&mu_);
+  while (num_threads_ < num_threads) {
+    Env::Default()->StartThread(&BlockCompressor::BGThreadWrapper, this);
+    num_threads_++;
+  }
+}
+
+void BlockCompressor::BGThreadWrapper(void* arg) {
+  reinterpret_cast<BlockCompressor*>(arg)->BGThread();
+}
+
+void BlockCompressor::BGThread() {
+  MutexLock l(&mu_);
+  while (true) {
+    while (queue_.empty()) {
+      work_cv_.Wait();
+    }
+    Request* r = queue_.front();
+    queue_.pop_front();
+    r->state = Request::kRunning;
+
+    mu_.Unlock();
+    r->Run();
+    mu_.Lock();
+
+    r->state = Request::kDone;
+    done_cv_.SignalAll();
+  }
+}
+
+BlockCompressor::Request* BlockCompressor::Submit(
+    std::string* raw, CompressionType type, const Slice& dictionary) {
+  Request* r = new Request;
+  r->raw.swap(*raw);
+  r->type = type;
+  r->dictionary = dictionary;
+  r->state = Request::kQueued;
+  MutexLock l(&mu_);
+  queue_.push_back(r);
+  work_cv_.Signal();
+  return r;
+}
+
+bool BlockCompressor::Dequeue(Request* request) {
+  if (request->state != Request::kQueued) {
+    return false;
+  }
+  std::deque<Request*>::iterator it =
+      std::find(queue_.begin(), queue_.end(), request);
+  assert(it != queue_.end());
+  queue_.erase(it);
+  return true;
+}
+
+void BlockCompressor::Wait(Request* request, std::string* contents,
+                           CompressionType* type) {
+  bool dequeued;
+  {
+    MutexLock l(&mu_);
+    dequeued = Dequeue(request);
+    if (!dequeued) {
+      while (request->state != Request::kDone) {
+        done_cv_.Wait();
+      }
+    }
+  }
+  if (dequeued) {
+    request->Run();
+  }
+  contents->swap(request->compressed);
+  *type = request->stored_type;
+  delete request;
+}
+
+void BlockCompressor::Cancel(Request* request) {
+  {
+    MutexLock l(&mu_);
+    if (!Dequeue(request)) {
+      while (request->state != Request::kDone) {
+        done_cv_.Wait();
+      }
+    }
+  }
+  delete request;
+}
+
+}  // namespace leveldb
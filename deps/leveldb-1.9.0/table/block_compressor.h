@@ -0,0 +1,80 @@
+// Copyright (c) 2013 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_TABLE_BLOCK_COMPRESSOR_H_
+#define STORAGE_LEVELDB_TABLE_BLOCK_COMPRESSOR_H_
+
+#include <deque>
+#include <string>
+#include "leveldb/options.h"
+#include "leveldb/slice.h"
+#include "port/port.h"
+
+namespace leveldb {
+
+// Compress "raw" with "type", using "dictionary" for kZstdCompression,
+// and return the contents to store: *compressed, or "raw" if the type is
+// not supported or saves less than 12.5%.  Sets *stored_type to the type
+// of the returned contents.
+extern Slice CompressBlock(const Slice& raw, CompressionType type,
+                           const Slice& dictionary, std::string* compressed,
+                           CompressionType* stored_type);
+
+// A pool of background threads that compress the data blocks of table
+// builders, so that a builder is not limited to the speed at which one
+// thread compresses.  Builders write the blocks in order as they finish.
+//
+// Every submitted request must be passed to exactly one of Wait() or
+// Cancel().
+class BlockCompressor {
+ public:
+  struct Request;
+
+  // Return the compressor shared by every table builder in the process,
+  // with at least "num_threads" threads.
+  static BlockCompressor* Default(int num_threads);
+
+  // Queue the compression of the block in *raw, which is taken over by
+  // the request and left empty.  "dictionary" must outlive the request.
+  Request* Submit(std::string* raw, CompressionType type,
+                  const Slice& dictionary);
+
+  // Wait for "request" and store the contents to write in *contents and
+  // their type in *type.  A request that no worker has started yet is
+  // compressed by the calling thread instead.  Deletes "request".
+  void Wait(Request* request, std::string* contents, CompressionType* type);
+
+  // Discard "request".  Deletes "request".
+  void Cancel(Request* request);
+
+ private:
+  BlockCompressor();
+  ~BlockCompressor();
+
+  static void InitDefault();
+
+  // Start threads until there are at least "num_threads".
+  void AddThreads(int num_threads);
+
+  static void BGThreadWrapper(void* arg);
+  void BGThread();
+
+  // Remove "request" from queue_ if no worker has taken it.
+  // REQUIRES: mu_ held.
+  bool Dequeue(Request* request);
+
+  port::Mutex mu_;
+  port::CondVar work_cv_;  // Signalled when a request is queued
+  port::CondVar done_cv_;  // Signalled when a worker finishes a request
+  std::deque<Request*> queue_;
+  int num_threads_;
+
+  // No copying allowed
+  BlockCompressor(const BlockCompressor&);
+  void operator=(const BlockCompressor&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_BLOCK_COMPRESSOR_H_
@@ -0,0 +1,146 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/block_prefetcher.h"
+
+#include <algorithm>
+#include "leveldb/env.h"
+#include "util/huge_page.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+// The number of threads of the default prefetcher, which is also the
+// number of blocks that it reads at once.
+static const int kPrefetchThreads = 4;
+
+struct BlockPrefetcher::Request {
+  enum State { kQueued, kRunning, kDone };
+
+  RandomAccessFile* file;
+  ReadOptions options;
+  BlockHandle handle;
+  Slice dictionary;
+  HugePages huge_pages;
+  State state;
+  Status status;
+  BlockContents contents;
+};
+
+static port::OnceType once = LEVELDB_ONCE_INIT;
+static BlockPrefetcher* default_prefetcher;
+
+void BlockPrefetcher::InitDefault() {
+  default_prefetcher = new BlockPrefetcher(kPrefetchThreads);
+}
+
+BlockPrefetcher* BlockPrefetcher::Default() {
+  port::InitOnce(&once, &BlockPrefetcher::InitDefault);
+  return default_prefetcher;
+}
+
+BlockPrefetcher::BlockPrefetcher(int num_threads)
+    : work_cv_(&mu_),
+      done_cv_(&mu_) {
+  for (int i = 0; i < num_threads; i++) {
+    Env::Default()->StartThread(&BlockPrefetcher::BGThreadWrapper, this);
+  }
+}
+
+BlockPrefetcher::~BlockPrefetcher() {
+  // The default prefetcher lives for the whole process.
+}
+
+void BlockPrefetcher::BGThreadWrapper(void* arg) {
+  reinterpret_cast<BlockPrefetcher*>(arg)->BGThread();
+}
+
+void BlockPrefetcher::BGThread() {
+  MutexLock l(&mu_);
+  while (true) {
+    while (queue_.empty()) {
+      work_cv_.Wait();
+    }
+    Request* r = queue_.front();
+    queue_.pop_front();
+    r->state = Request::kRunning;
+
+    mu_.Unlock();
+    BlockContents contents;
+    Status s = ReadBlock(r->file, r->options, r->handle, &contents,
+                         r->dictionary, r->huge_pages);
+    mu_.Lock();
+
+    r->status = s;
+    r->contents = contents;
+    r->state = Request::kDone;
+    done_cv_.SignalAll();
+  }
+}
+
+BlockPrefetcher::Request* BlockPrefetcher::Submit(
+    RandomAccessFile* file, const ReadOptions& options,
+    const BlockHandle& handle, const Slice& dictionary,
+    HugePages huge_pages) {
+  Request* r = new Request;
+  r->file = file;
+  r->options = options;
+  r->handle = handle;
+  r->dictionary = dictionary;
+  r->huge_pages = huge_pages;
+  r->state = Request::kQueued;
+  MutexLock l(&mu_);
+  queue_.push_back(r);
+  work_cv_.Signal();
+  return r;
+}
+
+bool BlockPrefetcher::Dequeue(Request* request) {
+  if (request->state != Request::kQueued) {
+    return false;
+  }
+  std::deque<Request*>::iterator it =
+      std::find(queue_.begin(), queue_.end(), request);
+  assert(it != queue_.end());
+  queue_.erase(it);
+  return true;
+}
+
+Status BlockPrefetcher::Wait(Request* request, BlockContents* contents) {
+  Status s;
+  {
+    MutexLock l(&mu_);
+    if (!Dequeue(request)) {
+      while (request->state != Request::kDone) {
+        done_cv_.Wait();
+      }
+      s = request->status;
+      *contents = request->contents;
+      delete request;
+      return s;
+    }
+  }
+  s = ReadBlock(request->file, request->options, request->handle, contents,
+                request->dictionary, request->huge_pages);
+  delete request;
+  return s;
+}
+
+void BlockPrefetcher::Cancel(Request* request) {
+  {
+    MutexLock l(&mu_);
+    if (!Dequeue(request)) {
+      while (request->state != Request::kDone) {
+        done_cv_.Wait();
+      }
+    }
+  }
+  if (request->state == Request::kDone && request->status.ok() &&
+      request->contents.heap_allocated) {
+    DeleteBlockBuffer(request->contents.data.data());
+  }
+  delete request;
+}
+
+}  // namespace leveldb
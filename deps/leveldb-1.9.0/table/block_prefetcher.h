@@ -0,0 +1,72 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_TABLE_BLOCK_PREFETCHER_H_
+#define STORAGE_LEVELDB_TABLE_BLOCK_PREFETCHER_H_
+
+#include <deque>
+#include "leveldb/options.h"
+#include "port/port.h"
+#include "table/format.h"
+
+namespace leveldb {
+
+class RandomAccessFile;
+
+// A pool of background threads that read and decode table blocks ahead of
+// scanning iterators, so that the disk read of the next block overlaps
+// with the caller's work on the current one.
+//
+// Every submitted request must be passed to exactly one of Wait() or
+// Cancel().  Both wait for a read that a worker has already started, so
+// "file" only has to stay live until then.
+class BlockPrefetcher {
+ public:
+  struct Request;
+
+  // Return the prefetcher shared by every table in the process.  Its
+  // threads are started on first use.
+  static BlockPrefetcher* Default();
+
+  // Queue a read of the block identified by "handle" from "file".
+  // "dictionary" and "huge_pages" are passed on to ReadBlock, and
+  // "dictionary" must outlive the request.
+  Request* Submit(RandomAccessFile* file, const ReadOptions& options,
+                  const BlockHandle& handle, const Slice& dictionary,
+                  HugePages huge_pages);
+
+  // Wait for "request" and store the block in *contents.  A request that
+  // no worker has started yet is read by the calling thread instead.
+  // Deletes "request".
+  Status Wait(Request* request, BlockContents* contents);
+
+  // Discard "request" and any block it read.  Deletes "request".
+  void Cancel(Request* request);
+
+ private:
+  explicit BlockPrefetcher(int num_threads);
+  ~BlockPrefetcher();
+
+  static void InitDefault();
+
+  static void BGThreadWrapper(void* arg);
+  void BGThread();
+
+  // Remove "request" from queue_ if no worker has taken it.
+  // REQUIRES: mu_ held.
+  bool Dequeue(Request* request);
+
+  port::Mutex mu_;
+  port::CondVar work_cv_;  // Signalled when a request is queued
+  port::CondVar done_cv_;  // Signalled when a worker finishes a request
+  std::deque<Request*> queue_;
+
+  // No copying allowed
+  BlockPrefetcher(const BlockPrefetcher&);
+  void operator=(const BlockPrefetcher&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_BLOCK_PREFETCHER_H_
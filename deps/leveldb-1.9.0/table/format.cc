@@ -4,11 +4,13 @@
 
 #include "table/format.h"
 
+#include <assert.h>
 #include "leveldb/env.h"
 #include "port/port.h"
 #include "table/block.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
+#include "util/huge_page.h"
 
 namespace leveldb {
 
@@ -66,23 +68,43 @@ Status Footer::DecodeFrom(Slice* input) {
 Status ReadBlock(RandomAccessFile* file,
                  const ReadOptions& options,
                  const BlockHandle& handle,
-                 BlockContents* result) {
+                 BlockContents* result,
+                 const Slice& dictionary,
+                 HugePages huge_pages) {
   result->data = Slice();
   result->cachable = false;
   result->heap_allocated = false;
 
+  Slice stored;
+  char* buf;
+  Status s = ReadStoredBlock(file, options, handle, &stored, &buf,
+                             huge_pages);
+  if (!s.ok()) {
+    return s;
+  }
+  return UncompressBlock(stored, buf, dictionary, result, huge_pages);
+}
+
+Status ReadStoredBlock(RandomAccessFile* file,
+                       const ReadOptions& options,
+                       const BlockHandle& handle,
+                       Slice* stored,
+                       char** buf_result,
+                       HugePages huge_pages) {
+  *buf_result = NULL;
+
   // Read the block contents as well as the type/crc footer.
   // See table_builder.cc for the code that built this structure.
   size_t n = static_cast<size_t>(handle.size());
-  char* buf = new char[n + kBlockTrailerSize];
+  char* buf = NewBlockBuffer(n + kBlockTrailerSize, huge_pages);
   Slice contents;
   Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf);
   if (!s.ok()) {
-    delete[] buf;
+    DeleteBlockBuffer(buf);
     return s;
   }
   if (contents.size() != n + kBlockTrailerSize) {
-    delete[] buf;
+    DeleteBlockBuffer(buf);
     return Status::Corruption("truncated block read");
   }
 
@@ -92,19 +114,35 @@ Status ReadBlock(RandomAccessFile* file,
     const uint32_t crc = crc32c::Unmask(DecodeFixed32(data + n + 1));
     const uint32_t actual = crc32c::Value(data, n + 1);
     if (actual != crc) {
-      delete[] buf;
+      DeleteBlockBuffer(buf);
       s = Status::Corruption("block checksum mismatch");
       return s;
     }
   }
 
+  *stored = Slice(data, n + 1);
+  *buf_result = buf;
+  return Status::OK();
+}
+
+Status UncompressBlock(const Slice& stored, char* buf,
+                       const Slice& dictionary,
+                       BlockContents* result,
+                       HugePages huge_pages) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+
+  assert(!stored.empty());
+  const char* data = stored.data();
+  const size_t n = stored.size() - 1;
   switch (data[n]) {
     case kNoCompression:
       if (data != buf) {
         // File implementation gave us pointer to some other data.
         // Use it directly under the assumption that it will be live
         // while the file is open.
-        delete[] buf;
+        DeleteBlockBuffer(buf);
         result->data = Slice(data, n);
         result->heap_allocated = false;
         result->cachable = false;  // Do not double-cache
@@ -119,23 +157,62 @@ Status ReadBlock(RandomAccessFile* file,
     case kSnappyCompression: {
       size_t ulength = 0;
       if (!port::Snappy_GetUncompressedLength(data, n, &ulength)) {
-        delete[] buf;
+        DeleteBlockBuffer(buf);
         return Status::Corruption("corrupted compressed block contents");
       }
-      char* ubuf = new char[ulength];
+      char* ubuf = NewBlockBuffer(ulength, huge_pages);
       if (!port::Snappy_Uncompress(data, n, ubuf)) {
-        delete[] buf;
-        delete[] ubuf;
+        DeleteBlockBuffer(buf);
+        DeleteBlockBuffer(ubuf);
+        return Status::Corruption("corrupted compressed block contents");
+      }
+      DeleteBlockBuffer(buf);
+      result->data = Slice(ubuf, ulength);
+      result->heap_allocated = true;
+      result->cachable = true;
+      break;
+    }
+    case kLZ4Compression: {
+      // LZ4 data is preceded by the varint32 uncompressed length.
+      Slice input(data, n);
+      uint32_t ulength = 0;
+      if (!GetVarint32(&input, &ulength)) {
+        DeleteBlockBuffer(buf);
+        return Status::Corruption("corrupted compressed block contents");
+      }
+      char* ubuf = NewBlockBuffer(ulength, huge_pages);
+      if (!port::LZ4_Uncompress(input.data(), input.size(), ubuf, ulength)) {
+        DeleteBlockBuffer(buf);
+        DeleteBlockBuffer(ubuf);
+        return Status::Corruption("corrupted compressed block contents");
+      }
+      DeleteBlockBuffer(buf);
+      result->data = Slice(ubuf, ulength);
+      result->heap_allocated = true;
+      result->cachable = true;
+      break;
+    }
+    case kZstdCompression: {
+      size_t ulength = 0;
+      if (!port::Zstd_GetUncompressedLength(data, n, &ulength)) {
+        DeleteBlockBuffer(buf);
+        return Status::Corruption("corrupted compressed block contents");
+      }
+      char* ubuf = NewBlockBuffer(ulength, huge_pages);
+      if (!port::Zstd_Uncompress(data, n, dictionary.data(), dictionary.size(),
+                                 ubuf, ulength)) {
+        DeleteBlockBuffer(buf);
+        DeleteBlockBuffer(ubuf);
         return Status::Corruption("corrupted compressed block contents");
       }
-      delete[] buf;
+      DeleteBlockBuffer(buf);
       result->data = Slice(ubuf, ulength);
       result->heap_allocated = true;
       result->cachable = true;
       break;
     }
     default:
-      delete[] buf;
+      DeleteBlockBuffer(buf);
       return Status::Corruption("bad block type");
   }
 
@@ -83,18 +83,50 @@ static const uint64_t kTableMagicNumber = 0xdb4775248b80fb57ull;
 // 1-byte type + 32-bit crc
 static const size_t kBlockTrailerSize = 5;
 
+// Name in the metaindex block of the block that holds the dictionary
+// the table's kZstdCompression blocks were compressed with.
+static const char kCompressionDictionaryName[] = "compression.dictionary";
+
+// Name in the metaindex block that marks a table whose index block is a
+// top-level index over index partitions rather than over data blocks.
+static const char kPartitionedIndexName[] = "index.partitioned";
+
 struct BlockContents {
   Slice data;           // Actual contents of data
   bool cachable;        // True iff data can be cached
-  bool heap_allocated;  // True iff caller should delete[] data.data()
+  bool heap_allocated;  // True iff caller should DeleteBlockBuffer() data
 };
 
-// Read the block identified by "handle" from "file".  On failure
+// Read the block identified by "handle" from "file", uncompressing it
+// with "dictionary" if it is a kZstdCompression block.  The block is
+// read into a buffer from NewBlockBuffer(..., huge_pages).  On failure
 // return non-OK.  On success fill *result and return OK.
 extern Status ReadBlock(RandomAccessFile* file,
                         const ReadOptions& options,
                         const BlockHandle& handle,
-                        BlockContents* result);
+                        BlockContents* result,
+                        const Slice& dictionary = Slice(),
+                        HugePages huge_pages = kNoHugePages);
+
+// The two halves of ReadBlock().  ReadStoredBlock() reads the block
+// identified by "handle" as it is stored in "file" and checks its crc.
+// On success *stored refers to the possibly compressed contents followed
+// by the one byte compression type, and holds either inside *buf (from
+// NewBlockBuffer()) or elsewhere in memory the file keeps alive.
+extern Status ReadStoredBlock(RandomAccessFile* file,
+                              const ReadOptions& options,
+                              const BlockHandle& handle,
+                              Slice* stored,
+                              char** buf,
+                              HugePages huge_pages);
+
+// Fill *result with the uncompressed form of "stored", taking ownership
+// of "buf" (which may be NULL).  An uncompressed block that isn't in
+// "buf" refers to "stored", which must then outlive *result.
+extern Status UncompressBlock(const Slice& stored, char* buf,
+                              const Slice& dictionary,
+                              BlockContents* result,
+                              HugePages huge_pages);
 
 // Implementation details follow.  Clients should ignore,
 
@@ -32,6 +32,13 @@ class IteratorWrapper {
     }
   }
 
+  // Returns the wrapped iterator and gives up ownership of it.
+  Iterator* Release() {
+    Iterator* iter = iter_;
+    iter_ = NULL;
+    valid_ = false;
+    return iter;
+  }
 
   // Iterator interface methods
   bool Valid() const        { return valid_; }
@@ -17,6 +17,8 @@ class MergingIterator : public Iterator {
       : comparator_(comparator),
         children_(new IteratorWrapper[n]),
         n_(n),
+        heap_(new IteratorWrapper*[n]),
+        heap_size_(0),
         current_(NULL),
         direction_(kForward) {
     for (int i = 0; i < n; i++) {
@@ -25,6 +27,7 @@ class MergingIterator : public Iterator {
   }
 
   virtual ~MergingIterator() {
+    delete[] heap_;
     delete[] children_;
   }
 
@@ -36,24 +39,24 @@ class MergingIterator : public Iterator {
     for (int i = 0; i < n_; i++) {
       children_[i].SeekToFirst();
     }
-    FindSmallest();
     direction_ = kForward;
+    BuildHeap();
   }
 
   virtual void SeekToLast() {
     for (int i = 0; i < n_; i++) {
       children_[i].SeekToLast();
     }
-    FindLargest();
     direction_ = kReverse;
+    BuildHeap();
   }
 
   virtual void Seek(const Slice& target) {
     for (int i = 0; i < n_; i++) {
       children_[i].Seek(target);
     }
-    FindSmallest();
     direction_ = kForward;
+    BuildHeap();
   }
 
   virtual void Next() {
@@ -76,10 +79,13 @@ class MergingIterator : public Iterator {
         }
       }
       direction_ = kForward;
+      current_->Next();
+      BuildHeap();
+      return;
     }
 
     current_->Next();
-    FindSmallest();
+    ReplaceTop();
   }
 
   virtual void Prev() {
@@ -105,10 +111,13 @@ class MergingIterator : public Iterator {
         }
       }
       direction_ = kReverse;
+      current_->Prev();
+      BuildHeap();
+      return;
     }
 
     current_->Prev();
-    FindLargest();
+    ReplaceTop();
   }
 
   virtual Slice key() const {
@@ -121,6 +130,12 @@ class MergingIterator : public Iterator {
     return current_->value();
   }
 
+  virtual void ReleasePinnedData() {
+    for (int i = 0; i < n_; i++) {
+      children_[i].iter()->ReleasePinnedData();
+    }
+  }
+
   virtual Status status() const {
     Status status;
     for (int i = 0; i < n_; i++) {
@@ -133,15 +148,31 @@ class MergingIterator : public Iterator {
   }
 
  private:
-  void FindSmallest();
-  void FindLargest();
+  // Returns true if child "a" comes before child "b" in the current
+  // direction.  Children with equal keys are ordered by position so the
+  // merge is stable.
+  bool Before(IteratorWrapper* a, IteratorWrapper* b) const {
+    const int r = comparator_->Compare(a->key(), b->key());
+    if (direction_ == kForward) {
+      return r < 0 || (r == 0 && a < b);
+    } else {
+      return r > 0 || (r == 0 && a > b);
+    }
+  }
+
+  void BuildHeap();
+  void ReplaceTop();
+  void SiftDown(int i);
 
-  // We might want to use a heap in case there are lots of children.
-  // For now we use a simple array since we expect a very small number
-  // of children in leveldb.
+  // The valid children are kept in a binary heap ordered by the current
+  // direction with current_ at its root, so each step costs a number of
+  // comparisons logarithmic in the number of children.  Scans over many
+  // level-0 files are the common case with a high fan-in.
   const Comparator* comparator_;
   IteratorWrapper* children_;
   int n_;
+  IteratorWrapper** heap_;
+  int heap_size_;
   IteratorWrapper* current_;
 
   // Which direction is the iterator moving?
@@ -152,34 +183,51 @@ class MergingIterator : public Iterator {
   Direction direction_;
 };
 
-void MergingIterator::FindSmallest() {
-  IteratorWrapper* smallest = NULL;
+void MergingIterator::BuildHeap() {
+  heap_size_ = 0;
   for (int i = 0; i < n_; i++) {
-    IteratorWrapper* child = &children_[i];
-    if (child->Valid()) {
-      if (smallest == NULL) {
-        smallest = child;
-      } else if (comparator_->Compare(child->key(), smallest->key()) < 0) {
-        smallest = child;
-      }
+    if (children_[i].Valid()) {
+      heap_[heap_size_++] = &children_[i];
     }
   }
-  current_ = smallest;
+  for (int i = heap_size_ / 2 - 1; i >= 0; i--) {
+    SiftDown(i);
+  }
+  current_ = (heap_size_ > 0) ? heap_[0] : NULL;
 }
 
-void MergingIterator::FindLargest() {
-  IteratorWrapper* largest = NULL;
-  for (int i = n_-1; i >= 0; i--) {
-    IteratorWrapper* child = &children_[i];
-    if (child->Valid()) {
-      if (largest == NULL) {
-        largest = child;
-      } else if (comparator_->Compare(child->key(), largest->key()) > 0) {
-        largest = child;
-      }
+// Restores the heap after the child at its root has moved.  A child that
+// stays ahead of the others costs one or two comparisons, which is the
+// common case when consecutive keys come from the same file.
+void MergingIterator::ReplaceTop() {
+  if (!heap_[0]->Valid()) {
+    heap_[0] = heap_[--heap_size_];
+  }
+  if (heap_size_ > 0) {
+    SiftDown(0);
+    current_ = heap_[0];
+  } else {
+    current_ = NULL;
+  }
+}
+
+void MergingIterator::SiftDown(int i) {
+  IteratorWrapper* child = heap_[i];
+  for (;;) {
+    int next = 2 * i + 1;
+    if (next >= heap_size_) {
+      break;
+    }
+    if (next + 1 < heap_size_ && Before(heap_[next + 1], heap_[next])) {
+      next++;
+    }
+    if (!Before(heap_[next], child)) {
+      break;
     }
+    heap_[i] = heap_[next];
+    i = next;
   }
-  current_ = largest;
+  heap_[i] = child;
 }
 }  // namespace
 
@@ -0,0 +1,83 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/prefix_filter_iterator.h"
+
+#include <assert.h>
+
+namespace leveldb {
+
+namespace {
+
+typedef bool (*MayMatchFunction)(void*, const Slice&);
+
+class PrefixFilterIterator: public Iterator {
+ public:
+  PrefixFilterIterator(Iterator* iter, MayMatchFunction may_match, void* arg)
+      : iter_(iter),
+        may_match_(may_match),
+        arg_(arg),
+        filtered_(false) {
+  }
+
+  virtual ~PrefixFilterIterator() {
+    delete iter_;
+  }
+
+  virtual bool Valid() const {
+    return !filtered_ && iter_->Valid();
+  }
+  virtual void Seek(const Slice& target) {
+    filtered_ = !(*may_match_)(arg_, target);
+    if (!filtered_) {
+      iter_->Seek(target);
+    }
+  }
+  virtual void SeekToFirst() {
+    filtered_ = false;
+    iter_->SeekToFirst();
+  }
+  virtual void SeekToLast() {
+    filtered_ = false;
+    iter_->SeekToLast();
+  }
+  virtual void Next() {
+    assert(Valid());
+    iter_->Next();
+  }
+  virtual void Prev() {
+    assert(Valid());
+    iter_->Prev();
+  }
+  virtual Slice key() const {
+    assert(Valid());
+    return iter_->key();
+  }
+  virtual Slice value() const {
+    assert(Valid());
+    return iter_->value();
+  }
+  virtual void ReleasePinnedData() {
+    iter_->ReleasePinnedData();
+  }
+  virtual Status status() const {
+    return filtered_ ? Status::OK() : iter_->status();
+  }
+
+ private:
+  Iterator* iter_;
+  MayMatchFunction may_match_;
+  void* arg_;
+  bool filtered_;  // The last Seek() was ruled out by may_match_
+};
+
+}  // namespace
+
+Iterator* NewPrefixFilterIterator(Iterator* iter,
+                                  MayMatchFunction may_match,
+                                  void* arg) {
+  return new PrefixFilterIterator(iter, may_match, arg);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,25 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_TABLE_PREFIX_FILTER_ITERATOR_H_
+#define STORAGE_LEVELDB_TABLE_PREFIX_FILTER_ITERATOR_H_
+
+#include "leveldb/iterator.h"
+
+namespace leveldb {
+
+// Return a new iterator that yields the entries of "iter", except that
+// Seek(target) leaves it invalid without touching "iter" when
+// (*may_match)(arg, target) returns false, i.e. when the prefix filters
+// say no entry at or after "target" has the prefix of "target".  The
+// other positioning methods are passed through.  Takes ownership of
+// "iter" and will delete it when no longer needed.
+extern Iterator* NewPrefixFilterIterator(
+    Iterator* iter,
+    bool (*may_match)(void* arg, const Slice& target),
+    void* arg);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_PREFIX_FILTER_ITERATOR_H_
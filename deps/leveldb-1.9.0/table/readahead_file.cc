@@ -0,0 +1,93 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/readahead_file.h"
+
+#include <string.h>
+
+namespace leveldb {
+
+const size_t ReadaheadFile::kInitialReadahead;
+const size_t ReadaheadFile::kMaxReadahead;
+
+ReadaheadFile::ReadaheadFile(const RandomAccessFile* file, uint64_t file_size,
+                             size_t readahead)
+    : file_(file),
+      file_size_(file_size),
+      buffer_(NULL),
+      capacity_(0),
+      window_offset_(0),
+      readahead_(readahead > 0 ? readahead : kInitialReadahead),
+      fixed_(readahead > 0) {
+}
+
+ReadaheadFile::~ReadaheadFile() {
+  delete[] buffer_;
+}
+
+Status ReadaheadFile::Read(uint64_t offset, size_t n, Slice* result,
+                           char* scratch) const {
+  const uint64_t window_end = window_offset_ + window_.size();
+  if (offset >= window_offset_ && offset + n <= window_end) {
+    Serve(window_.data() + (offset - window_offset_), n, result, scratch);
+    return Status::OK();
+  }
+
+  // Blocks found in the block cache aren't read so a forward scan can skip
+  // a little past the window and still count as sequential.
+  if (fixed_) {
+    // Every refill reads readahead_ bytes
+  } else if (!window_.empty() && offset >= window_offset_ &&
+             offset <= window_end + readahead_) {
+    readahead_ *= 2;
+    if (readahead_ > kMaxReadahead) {
+      readahead_ = kMaxReadahead;
+    }
+  } else {
+    readahead_ = kInitialReadahead;
+  }
+
+  size_t len = (n > readahead_ ? n : readahead_);
+  if (offset < file_size_ && len > file_size_ - offset) {
+    len = file_size_ - offset;
+  }
+  if (len < n) {
+    len = n;
+  }
+  if (capacity_ < len) {
+    delete[] buffer_;
+    buffer_ = new char[len];
+    capacity_ = len;
+  }
+
+  Status s = file_->Read(offset, len, &window_, buffer_);
+  if (!s.ok()) {
+    window_.clear();
+    *result = Slice();
+    return s;
+  }
+  window_offset_ = offset;
+  if (window_.size() == len && offset + len < file_size_) {
+    file_->Readahead(offset + len, readahead_);
+  }
+
+  const size_t avail = (window_.size() < n ? window_.size() : n);
+  Serve(window_.data(), avail, result, scratch);
+  return s;
+}
+
+void ReadaheadFile::Serve(const char* data, size_t n, Slice* result,
+                         char* scratch) const {
+  // Data in the file's own memory, e.g. an mmapped region, stays live
+  // while the file is open, so it's handed out without a copy and the
+  // block built from it isn't copied into the block cache either.
+  if (window_.data() != buffer_) {
+    *result = Slice(data, n);
+  } else {
+    memcpy(scratch, data, n);
+    *result = Slice(scratch, n);
+  }
+}
+
+}  // namespace leveldb
@@ -0,0 +1,69 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_TABLE_READAHEAD_FILE_H_
+#define STORAGE_LEVELDB_TABLE_READAHEAD_FILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "leveldb/env.h"
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+// A RandomAccessFile wrapper used by scanning table iterators.  Reads are
+// served from a buffer that is refilled with one large read of the
+// underlying file.  The size of that read starts at kInitialReadahead and
+// doubles on every refill that continues forward from the previous one, up
+// to kMaxReadahead.  A read elsewhere in the file resets it.  After each
+// refill the following window is handed to file->Readahead() so that the
+// operating system can fetch it while the buffer is consumed.  A non-zero
+// "readahead" passed to the constructor fixes the size of every refill
+// instead.
+//
+// Reads of a file that returns data from its own memory, e.g. an mmapped
+// region, are served from that memory without a copy.
+//
+// Unlike other RandomAccessFile implementations a ReadaheadFile is not
+// safe for concurrent use.  It belongs to a single iterator.
+class ReadaheadFile : public RandomAccessFile {
+ public:
+  static const size_t kInitialReadahead = 64 << 10;
+  static const size_t kMaxReadahead = 2 << 20;
+
+  // Does not take ownership of "file", which must remain live while this
+  // is in use.  Reads are never issued past "file_size".
+  ReadaheadFile(const RandomAccessFile* file, uint64_t file_size,
+                size_t readahead = 0);
+  virtual ~ReadaheadFile();
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const;
+
+ private:
+  // Store in *result the "n" bytes of the window at "data", copied to
+  // "scratch" unless the window is in the file's own memory.
+  void Serve(const char* data, size_t n, Slice* result, char* scratch) const;
+
+  const RandomAccessFile* file_;
+  const uint64_t file_size_;
+
+  // The buffered bytes are window_, which starts at window_offset_ in the
+  // file.  It points into buffer_ unless the file returned data from its
+  // own memory, e.g. an mmapped region.
+  mutable char* buffer_;
+  mutable size_t capacity_;
+  mutable Slice window_;
+  mutable uint64_t window_offset_;
+  mutable size_t readahead_;
+  const bool fixed_;  // Is readahead_ fixed by the constructor?
+
+  // No copying allowed
+  ReadaheadFile(const ReadaheadFile&);
+  void operator=(const ReadaheadFile&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_READAHEAD_FILE_H_
@@ -9,30 +9,62 @@
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/options.h"
+#include "leveldb/slice_transform.h"
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include "port/port.h"
 #include "table/block.h"
+#include "table/block_prefetcher.h"
 #include "table/filter_block.h"
 #include "table/format.h"
+#include "table/prefix_filter_iterator.h"
+#include "table/readahead_file.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
+#include "util/huge_page.h"
 
 namespace leveldb {
 
+// Index partitions held by the table, by offset.
+typedef std::vector<std::pair<uint64_t, Block*> > PinnedPartitions;
+
 struct Table::Rep {
   ~Rep() {
     delete filter;
-    delete [] filter_data;
+    DeleteBlockBuffer(filter_data);
+    DeleteBlockBuffer(dictionary_data);
     delete index_block;
+    PinnedPartitions* partitions =
+        reinterpret_cast<PinnedPartitions*>(pinned_partitions.NoBarrier_Load());
+    if (partitions != NULL) {
+      for (size_t i = 0; i < partitions->size(); i++) {
+        delete (*partitions)[i].second;
+      }
+      delete partitions;
+    }
   }
 
   Options options;
   Status status;
   RandomAccessFile* file;
+  uint64_t file_size;
   uint64_t cache_id;
+  uint64_t compressed_cache_id;
   FilterBlockReader* filter;
   const char* filter_data;
+  size_t filter_size;
+  bool prefix_filtered;         // "filter" holds prefix_extractor's prefixes
+  Slice dictionary;             // For kZstdCompression data blocks
+  const char* dictionary_data;  // Heap copy backing "dictionary", if any
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
   Block* index_block;
+  bool partitioned_index;  // index_block points at index partitions
+
+  // The PinnedPartitions read by PinIndexPartitions(), or NULL.  Set once
+  // while the table is in use.
+  port::AtomicPointer pinned_partitions;
 };
 
 Status Table::Open(const Options& options,
@@ -58,7 +90,8 @@ Status Table::Open(const Options& options,
   BlockContents contents;
   Block* index_block = NULL;
   if (s.ok()) {
-    s = ReadBlock(file, ReadOptions(), footer.index_handle(), &contents);
+    s = ReadBlock(file, ReadOptions(), footer.index_handle(), &contents,
+                  Slice(), options.huge_pages);
     if (s.ok()) {
       index_block = new Block(contents);
     }
@@ -70,11 +103,19 @@ Status Table::Open(const Options& options,
     Rep* rep = new Table::Rep;
     rep->options = options;
     rep->file = file;
+    rep->file_size = size;
     rep->metaindex_handle = footer.metaindex_handle();
     rep->index_block = index_block;
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
+    rep->compressed_cache_id = (options.block_cache_compressed ?
+                                options.block_cache_compressed->NewId() : 0);
     rep->filter_data = NULL;
     rep->filter = NULL;
+    rep->filter_size = 0;
+    rep->pinned_partitions.NoBarrier_Store(NULL);
+    rep->prefix_filtered = false;
+    rep->partitioned_index = false;
+    rep->dictionary_data = NULL;
     *table = new Table(rep);
     (*table)->ReadMeta(footer);
   } else {
@@ -85,10 +126,6 @@ Status Table::Open(const Options& options,
 }
 
 void Table::ReadMeta(const Footer& footer) {
-  if (rep_->options.filter_policy == NULL) {
-    return;  // Do not need any metadata
-  }
-
   // TODO(sanjay): Skip this if footer.metaindex_handle() size indicates
   // it is an empty block.
   ReadOptions opt;
@@ -100,16 +137,51 @@ void Table::ReadMeta(const Footer& footer) {
   Block* meta = new Block(contents);
 
   Iterator* iter = meta->NewIterator(BytewiseComparator());
-  std::string key = "filter.";
-  key.append(rep_->options.filter_policy->Name());
-  iter->Seek(key);
-  if (iter->Valid() && iter->key() == Slice(key)) {
-    ReadFilter(iter->value());
+  iter->Seek(kCompressionDictionaryName);
+  if (iter->Valid() && iter->key() == Slice(kCompressionDictionaryName)) {
+    ReadDictionary(iter->value());
+  }
+  iter->Seek(kPartitionedIndexName);
+  rep_->partitioned_index =
+      (iter->Valid() && iter->key() == Slice(kPartitionedIndexName));
+  if (rep_->options.filter_policy != NULL) {
+    std::string key = "filter.";
+    key.append(rep_->options.filter_policy->Name());
+    iter->Seek(key);
+    if (iter->Valid() && iter->key() == Slice(key)) {
+      ReadFilter(iter->value());
+    }
+    if (rep_->filter != NULL && rep_->options.prefix_extractor != NULL) {
+      key = "prefix.";
+      key.append(rep_->options.prefix_extractor->Name());
+      iter->Seek(key);
+      rep_->prefix_filtered = (iter->Valid() && iter->key() == Slice(key));
+    }
   }
   delete iter;
   delete meta;
 }
 
+void Table::ReadDictionary(const Slice& dictionary_handle_value) {
+  Slice v = dictionary_handle_value;
+  BlockHandle dictionary_handle;
+  if (!dictionary_handle.DecodeFrom(&v).ok()) {
+    return;
+  }
+
+  // Without the dictionary the data blocks that use it fail to
+  // uncompress, which reports the corruption.
+  ReadOptions opt;
+  BlockContents block;
+  if (!ReadBlock(rep_->file, opt, dictionary_handle, &block).ok()) {
+    return;
+  }
+  if (block.heap_allocated) {
+    rep_->dictionary_data = block.data.data();  // Will need to delete later
+  }
+  rep_->dictionary = block.data;
+}
+
 void Table::ReadFilter(const Slice& filter_handle_value) {
   Slice v = filter_handle_value;
   BlockHandle filter_handle;
@@ -128,6 +200,7 @@ void Table::ReadFilter(const Slice& filter_handle_value) {
     rep_->filter_data = block.data.data();     // Will need to delete later
   }
   rep_->filter = new FilterBlockReader(rep_->options.filter_policy, block.data);
+  rep_->filter_size = block.data.size();
 }
 
 Table::~Table() {
@@ -143,19 +216,250 @@ static void DeleteCachedBlock(const Slice& key, void* value) {
   delete block;
 }
 
+static void DeleteCachedStoredBlock(const Slice& key, void* value) {
+  delete reinterpret_cast<std::string*>(value);
+}
+
 static void ReleaseBlock(void* arg, void* h) {
   Cache* cache = reinterpret_cast<Cache*>(arg);
   Cache::Handle* handle = reinterpret_cast<Cache::Handle*>(h);
   cache->Release(handle);
 }
 
-// Convert an index iterator value (i.e., an encoded BlockHandle)
-// into an iterator over the contents of the corresponding block.
+// Fill buf[0..15] with the block cache key of the block at "offset".
+static Slice BlockCacheKey(uint64_t cache_id, uint64_t offset, char* buf) {
+  EncodeFixed64(buf, cache_id);
+  EncodeFixed64(buf+8, offset);
+  return Slice(buf, 16);
+}
+
+// The block function argument of a scanning iterator.
+//
+// Without prefetching, blocks that miss the cache are read through the
+// iterator's own readahead buffer.  With prefetching, every time a block
+// is read the following blocks up to "prefetch" ahead of it are submitted
+// to the shared BlockPrefetcher, and a block whose read was submitted is
+// taken from its request.  Submitted blocks that the iterator skips over
+// are cancelled.
+struct Table::ScanState {
+  Table* table;
+  ReadaheadFile file;
+  const int prefetch;
+  std::vector<BlockHandle> handles;  // Every data block, in file order
+  size_t next;                       // Index of next handle to submit
+  std::deque<std::pair<uint64_t, BlockPrefetcher::Request*> > pending;
+
+  ScanState(Table* t, int prefetch_blocks, size_t readahead)
+      : table(t),
+        file(t->rep_->file, t->rep_->file_size, readahead),
+        prefetch(prefetch_blocks),
+        next(0) {
+    if (prefetch <= 0) {
+      return;
+    }
+    Iterator* iter = t->NewIndexIterator(ReadOptions());
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      Slice input = iter->value();
+      BlockHandle handle;
+      if (handle.DecodeFrom(&input).ok()) {
+        handles.push_back(handle);
+      }
+    }
+    delete iter;
+  }
+
+  ~ScanState() {
+    CancelPending();
+  }
+
+  void CancelPending() {
+    for (size_t i = 0; i < pending.size(); i++) {
+      BlockPrefetcher::Default()->Cancel(pending[i].second);
+    }
+    pending.clear();
+  }
+
+  Status Read(const ReadOptions& options, const BlockHandle& handle,
+              BlockContents* contents) {
+    if (prefetch <= 0) {
+      return ReadBlock(&file, options, handle, contents,
+                       table->rep_->dictionary,
+                       table->rep_->options.huge_pages);
+    }
+
+    // Skip past requests for blocks that the iterator didn't need.
+    BlockPrefetcher::Request* request = NULL;
+    while (!pending.empty() && pending.front().first <= handle.offset()) {
+      if (pending.front().first == handle.offset()) {
+        request = pending.front().second;
+      } else {
+        BlockPrefetcher::Default()->Cancel(pending.front().second);
+      }
+      pending.pop_front();
+      if (request != NULL) {
+        break;
+      }
+    }
+    if (request == NULL) {
+      // Not a forward step from the prefetched blocks, e.g. a seek.
+      CancelPending();
+    }
+
+    Status s;
+    if (request != NULL) {
+      s = BlockPrefetcher::Default()->Wait(request, contents);
+    } else {
+      s = ReadBlock(table->rep_->file, options, handle, contents,
+                    table->rep_->dictionary, table->rep_->options.huge_pages);
+    }
+    Submit(options, handle);
+    return s;
+  }
+
+  // Submit reads for the blocks following "handle" that aren't already
+  // pending or cached.
+  void Submit(const ReadOptions& options, const BlockHandle& handle) {
+    size_t lo = 0, hi = handles.size();
+    while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (handles[mid].offset() < handle.offset()) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    const size_t index = lo;
+    if (pending.empty() || next <= index) {
+      next = index + 1;
+    }
+
+    Cache* block_cache = table->rep_->options.block_cache;
+    char buf[16];
+    for (; next < handles.size() && next <= index + prefetch; next++) {
+      if (block_cache != NULL) {
+        Cache::Handle* h = block_cache->Lookup(BlockCacheKey(
+            table->rep_->cache_id, handles[next].offset(), buf));
+        if (h != NULL) {
+          block_cache->Release(h);
+          continue;
+        }
+      }
+      pending.push_back(std::make_pair(
+          handles[next].offset(),
+          BlockPrefetcher::Default()->Submit(
+              table->rep_->file, options, handles[next],
+              table->rep_->dictionary, table->rep_->options.huge_pages)));
+    }
+  }
+};
+
+Status Table::ReadTableBlock(Table* table, ScanState* state,
+                             const ReadOptions& options,
+                             const BlockHandle& handle,
+                             BlockContents* contents) {
+  Cache* compressed_cache = table->rep_->options.block_cache_compressed;
+  if (compressed_cache != NULL && (state == NULL || state->prefetch <= 0)) {
+    return ReadCompressedCachedBlock(
+        table, (state != NULL) ? &state->file : table->rep_->file,
+        options, handle, contents);
+  }
+  if (state != NULL) {
+    return state->Read(options, handle, contents);
+  }
+  return ReadBlock(table->rep_->file, options, handle, contents,
+                   table->rep_->dictionary, table->rep_->options.huge_pages);
+}
+
+// Read a block through the block_cache_compressed tier: a hit is only
+// uncompressed, and a compressed block read from "file" is added to it.
+Status Table::ReadCompressedCachedBlock(Table* table, RandomAccessFile* file,
+                                        const ReadOptions& options,
+                                        const BlockHandle& handle,
+                                        BlockContents* contents) {
+  Cache* compressed_cache = table->rep_->options.block_cache_compressed;
+  char cache_key_buffer[16];
+  Slice key = BlockCacheKey(table->rep_->compressed_cache_id, handle.offset(),
+                            cache_key_buffer);
+  Cache::Handle* h = compressed_cache->Lookup(key);
+  if (h != NULL) {
+    const std::string* stored =
+        reinterpret_cast<std::string*>(compressed_cache->Value(h));
+    Status s = UncompressBlock(*stored, NULL, table->rep_->dictionary,
+                               contents, table->rep_->options.huge_pages);
+    compressed_cache->Release(h);
+    return s;
+  }
+
+  Slice stored;
+  char* buf;
+  Status s = ReadStoredBlock(file, options, handle, &stored, &buf,
+                             table->rep_->options.huge_pages);
+  if (!s.ok()) {
+    return s;
+  }
+  if (options.fill_cache && stored[stored.size() - 1] != kNoCompression) {
+    std::string* value = new std::string(stored.data(), stored.size());
+    compressed_cache->Release(compressed_cache->Insert(
+        key, value, value->size(), &DeleteCachedStoredBlock));
+  }
+  return UncompressBlock(stored, buf, table->rep_->dictionary, contents,
+                         table->rep_->options.huge_pages);
+}
+
+void Table::DeleteScanState(void* arg, void* ignored) {
+  delete reinterpret_cast<ScanState*>(arg);
+}
+
+// Count a block read that is about to start and return its start time,
+// or 0 if reads are not being counted.
+static uint64_t CountBlockRead(const ReadOptions& options,
+                               const BlockHandle& handle, Env* env) {
+  if (options.stats == NULL) {
+    return 0;
+  }
+  options.stats->block_cache_misses++;
+  options.stats->block_read_bytes += handle.size();
+  return env->NowMicros();
+}
+
+// Add the time a block read took since "start" and the size of the
+// block it produced.
+static void CountBlockReadDone(const ReadOptions& options, Env* env,
+                               uint64_t start, const Status& s,
+                               const BlockContents& contents) {
+  if (options.stats != NULL) {
+    options.stats->block_read_micros += env->NowMicros() - start;
+    if (s.ok()) {
+      options.stats->block_uncompressed_bytes += contents.data.size();
+    }
+  }
+}
+
 Iterator* Table::BlockReader(void* arg,
                              const ReadOptions& options,
                              const Slice& index_value) {
   Table* table = reinterpret_cast<Table*>(arg);
+  return ReadBlockIterator(table, NULL, options, index_value);
+}
+
+Iterator* Table::ScanBlockReader(void* arg,
+                                 const ReadOptions& options,
+                                 const Slice& index_value) {
+  ScanState* state = reinterpret_cast<ScanState*>(arg);
+  return ReadBlockIterator(state->table, state, options, index_value);
+}
+
+// Convert an index iterator value (i.e., an encoded BlockHandle)
+// into an iterator over the contents of the corresponding block.  If
+// "get_target" is non-NULL, the iterator is positioned for a point lookup
+// of it (see Block::NewIteratorForGet()).
+Iterator* Table::ReadBlockIterator(Table* table,
+                                   ScanState* state,
+                                   const ReadOptions& options,
+                                   const Slice& index_value,
+                                   const Slice* get_target) {
   Cache* block_cache = table->rep_->options.block_cache;
+  Env* env = table->rep_->options.env;
   Block* block = NULL;
   Cache::Handle* cache_handle = NULL;
 
@@ -169,14 +473,18 @@ Iterator* Table::BlockReader(void* arg,
     BlockContents contents;
     if (block_cache != NULL) {
       char cache_key_buffer[16];
-      EncodeFixed64(cache_key_buffer, table->rep_->cache_id);
-      EncodeFixed64(cache_key_buffer+8, handle.offset());
-      Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+      Slice key = BlockCacheKey(table->rep_->cache_id, handle.offset(),
+                                cache_key_buffer);
       cache_handle = block_cache->Lookup(key);
       if (cache_handle != NULL) {
         block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
+        if (options.stats != NULL) {
+          options.stats->block_cache_hits++;
+        }
       } else {
-        s = ReadBlock(table->rep_->file, options, handle, &contents);
+        const uint64_t start = CountBlockRead(options, handle, env);
+        s = ReadTableBlock(table, state, options, handle, &contents);
+        CountBlockReadDone(options, env, start, s, contents);
         if (s.ok()) {
           block = new Block(contents);
           if (contents.cachable && options.fill_cache) {
@@ -186,7 +494,9 @@ Iterator* Table::BlockReader(void* arg,
         }
       }
     } else {
-      s = ReadBlock(table->rep_->file, options, handle, &contents);
+      const uint64_t start = CountBlockRead(options, handle, env);
+      s = ReadTableBlock(table, state, options, handle, &contents);
+      CountBlockReadDone(options, env, start, s, contents);
       if (s.ok()) {
         block = new Block(contents);
       }
@@ -195,7 +505,10 @@ Iterator* Table::BlockReader(void* arg,
 
   Iterator* iter;
   if (block != NULL) {
-    iter = block->NewIterator(table->rep_->options.comparator);
+    const Comparator* comparator = table->rep_->options.comparator;
+    iter = (get_target == NULL)
+        ? block->NewIterator(comparator)
+        : block->NewIteratorForGet(comparator, *get_target);
     if (cache_handle == NULL) {
       iter->RegisterCleanup(&DeleteBlock, block, NULL);
     } else {
@@ -207,17 +520,99 @@ Iterator* Table::BlockReader(void* arg,
   return iter;
 }
 
+Iterator* Table::IndexPartitionReader(void* arg,
+                                      const ReadOptions& options,
+                                      const Slice& index_value) {
+  Table* table = reinterpret_cast<Table*>(arg);
+  const PinnedPartitions* pinned = reinterpret_cast<PinnedPartitions*>(
+      table->rep_->pinned_partitions.Acquire_Load());
+  BlockHandle handle;
+  Slice input = index_value;
+  if (pinned != NULL && handle.DecodeFrom(&input).ok()) {
+    PinnedPartitions::const_iterator it = std::lower_bound(
+        pinned->begin(), pinned->end(),
+        std::make_pair(handle.offset(), static_cast<Block*>(NULL)));
+    if (it != pinned->end() && it->first == handle.offset()) {
+      return it->second->NewIterator(table->rep_->options.comparator);
+    }
+  }
+
+  // Partitions are shared by every read of the table, so cache them even
+  // for reads that do not cache the data blocks they scan.
+  ReadOptions partition_options = options;
+  partition_options.fill_cache = true;
+  return ReadBlockIterator(table, NULL, partition_options, index_value);
+}
+
+Iterator* Table::NewIndexIterator(const ReadOptions& options) const {
+  Iterator* iter = rep_->index_block->NewIterator(rep_->options.comparator);
+  if (rep_->partitioned_index) {
+    // Nothing points into the index partitions once the iterator moves
+    ReadOptions index_options = options;
+    index_options.pin_data = false;
+    iter = NewTwoLevelIterator(iter, &Table::IndexPartitionReader,
+                               const_cast<Table*>(this), index_options,
+                               rep_->options.comparator);
+  }
+  return iter;
+}
+
 Iterator* Table::NewIterator(const ReadOptions& options) const {
-  return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+  Iterator* index_iter = NewIndexIterator(options);
+  Iterator* iter;
+  if (!options.sequential_scan && options.prefetch_blocks <= 0) {
+    iter = NewTwoLevelIterator(
+        index_iter, &Table::BlockReader, const_cast<Table*>(this), options,
+        rep_->options.comparator);
+  } else {
+    ScanState* state = new ScanState(const_cast<Table*>(this),
+                                     options.prefetch_blocks,
+                                     options.readahead_size);
+    iter = NewTwoLevelIterator(
+        index_iter, &Table::ScanBlockReader, state, options,
+        rep_->options.comparator);
+    iter->RegisterCleanup(&DeleteScanState, state, NULL);
+  }
+  if (options.prefix_same_as_start && rep_->prefix_filtered) {
+    iter = NewPrefixFilterIterator(iter, &Table::PrefixMayMatchThunk,
+                                   const_cast<Table*>(this));
+  }
+  return iter;
+}
+
+bool Table::PrefixMayMatchThunk(void* arg, const Slice& target) {
+  return reinterpret_cast<Table*>(arg)->PrefixMayMatch(target);
+}
+
+// The keys with the prefix of "target" that sort at or after it follow
+// "target" directly, so the first of them is in the block the index
+// points "target" to, or at the start of the next block when "target"
+// falls after the last key of that block.
+bool Table::PrefixMayMatch(const Slice& target) const {
+  const SliceTransform* prefix_extractor = rep_->options.prefix_extractor;
+  if (!rep_->prefix_filtered || !prefix_extractor->InDomain(target)) {
+    return true;
+  }
+  const Slice prefix = prefix_extractor->Transform(target);
+  Iterator* iiter = NewIndexIterator(ReadOptions());
+  iiter->Seek(target);
+  bool may_match = !iiter->status().ok();
+  for (int i = 0; i < 2 && !may_match && iiter->Valid(); i++) {
+    Slice handle_value = iiter->value();
+    BlockHandle handle;
+    may_match = (!handle.DecodeFrom(&handle_value).ok() ||
+                 rep_->filter->KeyMayMatch(handle.offset(), prefix));
+    iiter->Next();
+  }
+  delete iiter;
+  return may_match;
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k,
                           void* arg,
                           void (*saver)(void*, const Slice&, const Slice&)) {
   Status s;
-  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* iiter = NewIndexIterator(options);
   iiter->Seek(k);
   if (iiter->Valid()) {
     Slice handle_value = iiter->value();
@@ -228,9 +623,8 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
         !filter->KeyMayMatch(handle.offset(), k)) {
       // Not found
     } else {
-      Slice handle = iiter->value();
-      Iterator* block_iter = BlockReader(this, options, iiter->value());
-      block_iter->Seek(k);
+      Iterator* block_iter = ReadBlockIterator(this, NULL, options,
+                                               iiter->value(), &k);
       if (block_iter->Valid()) {
         (*saver)(arg, block_iter->key(), block_iter->value());
       }
@@ -246,9 +640,101 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
 }
 
 
+uint64_t Table::BlockCacheId() const {
+  return rep_->cache_id;
+}
+
+Status Table::WarmBlocks(const uint64_t* offsets, size_t n,
+                         ReadStats* stats) {
+  ReadOptions options;
+  options.stats = stats;
+  Iterator* iiter = NewIndexIterator(options);
+  size_t i = 0;
+  Status s;
+  for (iiter->SeekToFirst(); iiter->Valid() && i < n && s.ok();
+       iiter->Next()) {
+    Slice handle_value = iiter->value();
+    BlockHandle handle;
+    s = handle.DecodeFrom(&handle_value);
+    if (!s.ok()) {
+      break;
+    }
+    while (i < n && offsets[i] < handle.offset()) {
+      i++;
+    }
+    if (i < n && offsets[i] == handle.offset()) {
+      Iterator* block_iter = ReadBlockIterator(this, NULL, options,
+                                               iiter->value());
+      s = block_iter->status();
+      delete block_iter;
+      i++;
+    }
+  }
+  if (s.ok()) {
+    s = iiter->status();
+  }
+  delete iiter;
+  return s;
+}
+
+size_t Table::MetadataSize() const {
+  size_t size = rep_->index_block->size() + rep_->filter_size;
+  if (rep_->partitioned_index) {
+    // Count the partitions by their size in the file, so that they need
+    // not be read.
+    Iterator* iter = rep_->index_block->NewIterator(rep_->options.comparator);
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      Slice input = iter->value();
+      BlockHandle handle;
+      if (handle.DecodeFrom(&input).ok()) {
+        size += handle.size();
+      }
+    }
+    delete iter;
+  }
+  return size;
+}
+
+Status Table::PinIndexPartitions() {
+  if (!rep_->partitioned_index ||
+      rep_->pinned_partitions.Acquire_Load() != NULL) {
+    return Status::OK();
+  }
+  PinnedPartitions* partitions = new PinnedPartitions;
+  Iterator* iter = rep_->index_block->NewIterator(rep_->options.comparator);
+  Status s;
+  for (iter->SeekToFirst(); iter->Valid() && s.ok(); iter->Next()) {
+    Slice input = iter->value();
+    BlockHandle handle;
+    s = handle.DecodeFrom(&input);
+    BlockContents contents;
+    if (s.ok()) {
+      s = ReadBlock(rep_->file, ReadOptions(), handle, &contents,
+                    rep_->dictionary, rep_->options.huge_pages);
+    }
+    if (s.ok()) {
+      partitions->push_back(std::make_pair(handle.offset(),
+                                           new Block(contents)));
+    }
+  }
+  if (s.ok()) {
+    s = iter->status();
+  }
+  delete iter;
+  if (!s.ok()) {
+    for (size_t i = 0; i < partitions->size(); i++) {
+      delete (*partitions)[i].second;
+    }
+    delete partitions;
+    return s;
+  }
+  // Partitions are written in order, so they are sorted by offset.
+  rep_->pinned_partitions.Release_Store(partitions);
+  return s;
+}
+
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
-  Iterator* index_iter =
-      rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* index_iter = NewIndexIterator(ReadOptions());
   index_iter->Seek(key);
   uint64_t result;
   if (index_iter->Valid()) {
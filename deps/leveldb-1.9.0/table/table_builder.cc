@@ -5,11 +5,14 @@
 #include "leveldb/table_builder.h"
 
 #include <assert.h>
+#include <deque>
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/options.h"
+#include "leveldb/slice_transform.h"
 #include "table/block_builder.h"
+#include "table/block_compressor.h"
 #include "table/filter_block.h"
 #include "table/format.h"
 #include "util/coding.h"
@@ -24,11 +27,15 @@ struct TableBuilder::Rep {
   uint64_t offset;
   Status status;
   BlockBuilder data_block;
-  BlockBuilder index_block;
+  BlockBuilder index_block;      // Current partition if partitioned
+  BlockBuilder top_index_block;  // Index over the written partitions
+  std::string last_index_key;    // Last key added to index_block
   std::string last_key;
   int64_t num_entries;
   bool closed;          // Either Finish() or Abandon() has been called.
   FilterBlockBuilder* filter_block;
+  bool add_prefixes;        // Prefixes of keys go into filter_block too
+  std::string last_prefix;  // Last prefix added for the current block
 
   // We do not emit the index entry for a block until we have seen the
   // first key for the next data block.  This allows us to use shorter
@@ -43,6 +50,26 @@ struct TableBuilder::Rep {
   BlockHandle pending_handle;  // Handle to add to index block
 
   std::string compressed_output;
+  bool used_dictionary;  // Some data block was compressed with the dictionary
+
+  // With options.compression_threads > 1, data blocks are compressed by
+  // the threads of "compressor" and written once every block before them
+  // is.  The offset of a block, which its filter is keyed by, is only
+  // known then, so the keys for the filter are kept with the block until
+  // it is written.
+  struct PendingBlock {
+    BlockCompressor::Request* request;
+    size_t raw_size;
+    bool has_index_key;
+    std::string index_key;          // Separator after the block's keys
+    std::string filter_keys;        // Flattened keys for filter_block
+    std::vector<size_t> filter_key_starts;
+  };
+  BlockCompressor* compressor;      // NULL to compress blocks inline
+  PendingBlock* current_block;      // The block data_block is building
+  std::deque<PendingBlock*> pending_blocks;
+  uint64_t pending_bytes;           // Uncompressed bytes in pending_blocks
+  std::string raw_block;
 
   Rep(const Options& opt, WritableFile* f)
       : options(opt),
@@ -51,12 +78,21 @@ struct TableBuilder::Rep {
         offset(0),
         data_block(&options),
         index_block(&index_block_options),
+        top_index_block(&index_block_options),
         num_entries(0),
         closed(false),
         filter_block(opt.filter_policy == NULL ? NULL
                      : new FilterBlockBuilder(opt.filter_policy)),
-        pending_index_entry(false) {
+        add_prefixes(filter_block != NULL && opt.prefix_extractor != NULL),
+        pending_index_entry(false),
+        used_dictionary(false),
+        compressor(opt.compression_threads > 1
+                   ? BlockCompressor::Default(opt.compression_threads)
+                   : NULL),
+        current_block(NULL),
+        pending_bytes(0) {
     index_block_options.block_restart_interval = 1;
+    index_block_options.data_block_hash_index = false;
   }
 };
 
@@ -69,6 +105,7 @@ TableBuilder::TableBuilder(const Options& options, WritableFile* file)
 
 TableBuilder::~TableBuilder() {
   assert(rep_->closed);  // Catch errors where caller forgot to call Finish()
+  delete rep_->current_block;
   delete rep_->filter_block;
   delete rep_;
 }
@@ -80,12 +117,17 @@ Status TableBuilder::ChangeOptions(const Options& options) {
   if (options.comparator != rep_->options.comparator) {
     return Status::InvalidArgument("changing comparator while building table");
   }
+  if (options.prefix_extractor != rep_->options.prefix_extractor) {
+    return Status::InvalidArgument(
+        "changing prefix extractor while building table");
+  }
 
   // Note that any live BlockBuilders point to rep_->options and therefore
   // will automatically pick up the updated options.
   rep_->options = options;
   rep_->index_block_options = options;
   rep_->index_block_options.block_restart_interval = 1;
+  rep_->index_block_options.data_block_hash_index = false;
   return Status::OK();
 }
 
@@ -100,14 +142,34 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
   if (r->pending_index_entry) {
     assert(r->data_block.empty());
     r->options.comparator->FindShortestSeparator(&r->last_key, key);
-    std::string handle_encoding;
-    r->pending_handle.EncodeTo(&handle_encoding);
-    r->index_block.Add(r->last_key, Slice(handle_encoding));
+    if (r->compressor != NULL) {
+      // The block is still being compressed
+      Rep::PendingBlock* block = r->pending_blocks.back();
+      block->has_index_key = true;
+      block->index_key = r->last_key;
+    } else {
+      AddIndexEntry(r->last_key, r->pending_handle);
+    }
     r->pending_index_entry = false;
   }
 
+  if (r->compressor != NULL && r->current_block == NULL) {
+    Rep::PendingBlock* block = new Rep::PendingBlock;
+    block->request = NULL;
+    block->raw_size = 0;
+    block->has_index_key = false;
+    r->current_block = block;
+  }
+
   if (r->filter_block != NULL) {
-    r->filter_block->AddKey(key);
+    AddFilterKey(key);
+    if (r->add_prefixes && r->options.prefix_extractor->InDomain(key)) {
+      Slice prefix = r->options.prefix_extractor->Transform(key);
+      if (prefix != Slice(r->last_prefix)) {
+        AddFilterKey(prefix);
+        r->last_prefix.assign(prefix.data(), prefix.size());
+      }
+    }
   }
 
   r->last_key.assign(key.data(), key.size());
@@ -120,12 +182,44 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
   }
 }
 
+// Add the entry for a written data block to the index.  "key" is >= every
+// key in the block and < every key after it.
+void TableBuilder::AddIndexEntry(const std::string& key,
+                                 const BlockHandle& handle) {
+  Rep* r = rep_;
+  std::string handle_encoding;
+  handle.EncodeTo(&handle_encoding);
+  r->index_block.Add(key, Slice(handle_encoding));
+  if (r->options.index_partition_size > 0 &&
+      r->index_block.CurrentSizeEstimate() >=
+      r->options.index_partition_size) {
+    r->last_index_key = key;
+    FlushIndexPartition();
+  }
+}
+
+void TableBuilder::AddFilterKey(const Slice& key) {
+  Rep* r = rep_;
+  if (r->compressor == NULL) {
+    r->filter_block->AddKey(key);
+    return;
+  }
+  Rep::PendingBlock* block = r->current_block;
+  block->filter_key_starts.push_back(block->filter_keys.size());
+  block->filter_keys.append(key.data(), key.size());
+}
+
 void TableBuilder::Flush() {
   Rep* r = rep_;
   assert(!r->closed);
   if (!ok()) return;
   if (r->data_block.empty()) return;
   assert(!r->pending_index_entry);
+  if (r->compressor != NULL) {
+    SubmitDataBlock();
+    r->last_prefix.clear();
+    return;
+  }
   WriteBlock(&r->data_block, &r->pending_handle);
   if (ok()) {
     r->pending_index_entry = true;
@@ -133,7 +227,89 @@ void TableBuilder::Flush() {
   }
   if (r->filter_block != NULL) {
     r->filter_block->StartBlock(r->offset);
+    r->last_prefix.clear();
+  }
+}
+
+// Hand data_block to the compression threads, and write the oldest
+// pending blocks until no more than options.compression_threads are left.
+void TableBuilder::SubmitDataBlock() {
+  Rep* r = rep_;
+  Rep::PendingBlock* block = r->current_block;
+  r->current_block = NULL;
+  r->pending_blocks.push_back(block);
+  Slice raw = r->data_block.Finish();
+  block->raw_size = raw.size();
+  r->raw_block.assign(raw.data(), raw.size());
+  r->data_block.Reset();
+  block->request = r->compressor->Submit(
+      &r->raw_block, r->options.compression,
+      r->options.compression_dictionary);
+  r->pending_bytes += block->raw_size;
+  r->pending_index_entry = true;
+  while (ok() && r->pending_blocks.size() >
+         static_cast<size_t>(r->options.compression_threads)) {
+    WritePendingBlock();
+  }
+}
+
+// Write the oldest pending block and add it to the index and filter.
+void TableBuilder::WritePendingBlock() {
+  Rep* r = rep_;
+  Rep::PendingBlock* block = r->pending_blocks.front();
+  r->pending_blocks.pop_front();
+  r->pending_bytes -= block->raw_size;
+
+  std::string contents;
+  CompressionType type;
+  r->compressor->Wait(block->request, &contents, &type);
+  if (type == kZstdCompression &&
+      !r->options.compression_dictionary.empty()) {
+    r->used_dictionary = true;
+  }
+  if (r->filter_block != NULL) {
+    // StartBlock() was called with the offset the block is written at
+    const std::vector<size_t>& starts = block->filter_key_starts;
+    for (size_t i = 0; i < starts.size(); i++) {
+      const size_t limit = (i + 1 < starts.size()) ? starts[i + 1]
+                                                   : block->filter_keys.size();
+      r->filter_block->AddKey(Slice(block->filter_keys.data() + starts[i],
+                                    limit - starts[i]));
+    }
+  }
+
+  BlockHandle handle;
+  WriteRawBlock(contents, type, &handle);
+  if (ok()) {
+    r->status = r->file->Flush();
+  }
+  if (ok() && block->has_index_key) {
+    AddIndexEntry(block->index_key, handle);
+  }
+  if (r->filter_block != NULL) {
+    r->filter_block->StartBlock(r->offset);
+  }
+  delete block;
+}
+
+// Write every pending block, or discard them after an error.
+void TableBuilder::WritePendingBlocks() {
+  Rep* r = rep_;
+  while (ok() && !r->pending_blocks.empty()) {
+    WritePendingBlock();
+  }
+  DiscardPendingBlocks();
+}
+
+void TableBuilder::DiscardPendingBlocks() {
+  Rep* r = rep_;
+  while (!r->pending_blocks.empty()) {
+    Rep::PendingBlock* block = r->pending_blocks.front();
+    r->pending_blocks.pop_front();
+    r->compressor->Cancel(block->request);
+    delete block;
   }
+  r->pending_bytes = 0;
 }
 
 void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
@@ -145,27 +321,15 @@ void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
   Rep* r = rep_;
   Slice raw = block->Finish();
 
-  Slice block_contents;
-  CompressionType type = r->options.compression;
-  // TODO(postrelease): Support more compression options: zlib?
-  switch (type) {
-    case kNoCompression:
-      block_contents = raw;
-      break;
-
-    case kSnappyCompression: {
-      std::string* compressed = &r->compressed_output;
-      if (port::Snappy_Compress(raw.data(), raw.size(), compressed) &&
-          compressed->size() < raw.size() - (raw.size() / 8u)) {
-        block_contents = *compressed;
-      } else {
-        // Snappy not supported, or compressed less than 12.5%, so just
-        // store uncompressed form
-        block_contents = raw;
-        type = kNoCompression;
-      }
-      break;
-    }
+  // Only data blocks, which are all written before Finish() closes the
+  // table, use the dictionary: the index and metaindex blocks are needed
+  // to find it.
+  Slice dict = r->closed ? Slice() : r->options.compression_dictionary;
+  CompressionType type;
+  Slice block_contents = CompressBlock(raw, r->options.compression, dict,
+                                       &r->compressed_output, &type);
+  if (type == kZstdCompression && !dict.empty()) {
+    r->used_dictionary = true;
   }
   WriteRawBlock(block_contents, type, handle);
   r->compressed_output.clear();
@@ -192,6 +356,25 @@ void TableBuilder::WriteRawBlock(const Slice& block_contents,
   }
 }
 
+// Write index_block as a partition and point top_index_block at it.
+// last_index_key, the last key of the partition, is >= every key in the
+// partition's data blocks and < every key after them.
+void TableBuilder::FlushIndexPartition() {
+  Rep* r = rep_;
+  BlockHandle handle;
+  WriteBlock(&r->index_block, &handle);
+  if (ok()) {
+    std::string handle_encoding;
+    handle.EncodeTo(&handle_encoding);
+    r->top_index_block.Add(r->last_index_key, Slice(handle_encoding));
+  }
+  if (r->filter_block != NULL) {
+    // Filters are found by the offset of their data block, and the next
+    // data block starts after the partition.
+    r->filter_block->StartBlock(r->offset);
+  }
+}
+
 Status TableBuilder::status() const {
   return rep_->status;
 }
@@ -203,6 +386,40 @@ Status TableBuilder::Finish() {
   r->closed = true;
 
   BlockHandle filter_block_handle, metaindex_block_handle, index_block_handle;
+  BlockHandle dictionary_block_handle;
+
+  if (ok() && r->pending_index_entry) {
+    r->options.comparator->FindShortSuccessor(&r->last_key);
+    if (r->compressor != NULL) {
+      Rep::PendingBlock* block = r->pending_blocks.back();
+      block->has_index_key = true;
+      block->index_key = r->last_key;
+    } else {
+      std::string handle_encoding;
+      r->pending_handle.EncodeTo(&handle_encoding);
+      r->index_block.Add(r->last_key, Slice(handle_encoding));
+    }
+    r->last_index_key = r->last_key;
+    r->pending_index_entry = false;
+  }
+  if (r->compressor != NULL) {
+    // The index entries of the pending blocks may fill and write index
+    // partitions, so the last one is only known after them.
+    WritePendingBlocks();
+    r->last_index_key = r->last_key;
+  }
+
+  // Write the last index partition, unless the whole index fits in one
+  const bool partitioned = !r->top_index_block.empty();
+  if (ok() && partitioned && !r->index_block.empty()) {
+    FlushIndexPartition();
+  }
+
+  // Write the dictionary the data blocks were compressed with
+  if (ok() && r->used_dictionary) {
+    WriteRawBlock(r->options.compression_dictionary, kNoCompression,
+                  &dictionary_block_handle);
+  }
 
   // Write filter block
   if (ok() && r->filter_block != NULL) {
@@ -212,7 +429,15 @@ Status TableBuilder::Finish() {
 
   // Write metaindex block
   if (ok()) {
-    BlockBuilder meta_index_block(&r->options);
+    Options meta_index_options = r->options;
+    meta_index_options.data_block_hash_index = false;
+    BlockBuilder meta_index_block(&meta_index_options);
+    if (r->used_dictionary) {
+      // Sorts before "filter.Name"
+      std::string handle_encoding;
+      dictionary_block_handle.EncodeTo(&handle_encoding);
+      meta_index_block.Add(kCompressionDictionaryName, handle_encoding);
+    }
     if (r->filter_block != NULL) {
       // Add mapping from "filter.Name" to location of filter data
       std::string key = "filter.";
@@ -221,6 +446,17 @@ Status TableBuilder::Finish() {
       filter_block_handle.EncodeTo(&handle_encoding);
       meta_index_block.Add(key, handle_encoding);
     }
+    if (partitioned) {
+      // Sorts between "filter.Name" and "prefix.Name"
+      meta_index_block.Add(kPartitionedIndexName, Slice());
+    }
+    if (r->add_prefixes) {
+      // Sorts after "filter.Name": records that the filters also hold
+      // the prefixes produced by "Name".
+      std::string key = "prefix.";
+      key.append(r->options.prefix_extractor->Name());
+      meta_index_block.Add(key, Slice());
+    }
 
     // TODO(postrelease): Add stats and other meta blocks
     WriteBlock(&meta_index_block, &metaindex_block_handle);
@@ -228,14 +464,8 @@ Status TableBuilder::Finish() {
 
   // Write index block
   if (ok()) {
-    if (r->pending_index_entry) {
-      r->options.comparator->FindShortSuccessor(&r->last_key);
-      std::string handle_encoding;
-      r->pending_handle.EncodeTo(&handle_encoding);
-      r->index_block.Add(r->last_key, Slice(handle_encoding));
-      r->pending_index_entry = false;
-    }
-    WriteBlock(&r->index_block, &index_block_handle);
+    WriteBlock(partitioned ? &r->top_index_block : &r->index_block,
+               &index_block_handle);
   }
 
   // Write footer
@@ -257,6 +487,9 @@ void TableBuilder::Abandon() {
   Rep* r = rep_;
   assert(!r->closed);
   r->closed = true;
+  if (r->compressor != NULL) {
+    DiscardPendingBlocks();
+  }
 }
 
 uint64_t TableBuilder::NumEntries() const {
@@ -264,7 +497,8 @@ uint64_t TableBuilder::NumEntries() const {
 }
 
 uint64_t TableBuilder::FileSize() const {
-  return rep_->offset;
+  // Blocks still being compressed are counted at their uncompressed size
+  return rep_->offset + rep_->pending_bytes;
 }
 
 }  // namespace leveldb
@@ -9,6 +9,7 @@
 #include "db/dbformat.h"
 #include "db/memtable.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
@@ -16,6 +17,7 @@
 #include "table/block.h"
 #include "table/block_builder.h"
 #include "table/format.h"
+#include "util/logging.h"
 #include "util/random.h"
 #include "util/testharness.h"
 #include "util/testutil.h"
@@ -104,21 +106,24 @@ class StringSink: public WritableFile {
 
  private:
   std::string contents_;
+  mutable int reads_;
 };
 
 
 class StringSource: public RandomAccessFile {
  public:
   StringSource(const Slice& contents)
-      : contents_(contents.data(), contents.size()) {
+      : contents_(contents.data(), contents.size()), reads_(0) {
   }
 
   virtual ~StringSource() { }
 
   uint64_t Size() const { return contents_.size(); }
+  int reads() const { return reads_; }
 
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                        char* scratch) const {
+    reads_++;
     if (offset > contents_.size()) {
       return Status::InvalidArgument("invalid Read offset");
     }
@@ -132,6 +137,7 @@ class StringSource: public RandomAccessFile {
 
  private:
   std::string contents_;
+  mutable int reads_;
 };
 
 typedef std::map<std::string, std::string, STLLessThan> KVMap;
@@ -247,6 +253,8 @@ class TableConstructor: public Constructor {
     source_ = new StringSource(sink.contents());
     Options table_options;
     table_options.comparator = options.comparator;
+    table_options.block_cache = options.block_cache;
+    table_options.block_cache_compressed = options.block_cache_compressed;
     return Table::Open(table_options, source_, sink.contents().size(), &table_);
   }
 
@@ -258,6 +266,9 @@ class TableConstructor: public Constructor {
     return table_->ApproximateOffsetOf(key);
   }
 
+  Table* table() const { return table_; }
+  StringSource* source() const { return source_; }
+
  private:
   void Reset() {
     delete table_;
@@ -315,10 +326,12 @@ class KeyConvertingIterator: public Iterator {
 
 class MemTableConstructor: public Constructor {
  public:
-  explicit MemTableConstructor(const Comparator* cmp)
+  MemTableConstructor(const Comparator* cmp, MemTableRepType rep)
       : Constructor(cmp),
         internal_comparator_(cmp) {
-    memtable_ = new MemTable(internal_comparator_);
+    options_.rep = rep;
+    options_.hash_buckets = 16;
+    memtable_ = new MemTable(internal_comparator_, options_);
     memtable_->Ref();
   }
   ~MemTableConstructor() {
@@ -326,7 +339,7 @@ class MemTableConstructor: public Constructor {
   }
   virtual Status FinishImpl(const Options& options, const KVMap& data) {
     memtable_->Unref();
-    memtable_ = new MemTable(internal_comparator_);
+    memtable_ = new MemTable(internal_comparator_, options_);
     memtable_->Ref();
     int seq = 1;
     for (KVMap::const_iterator it = data.begin();
@@ -343,6 +356,7 @@ class MemTableConstructor: public Constructor {
 
  private:
   InternalKeyComparator internal_comparator_;
+  MemTableOptions options_;
   MemTable* memtable_;
 };
 
@@ -400,6 +414,8 @@ enum TestType {
   TABLE_TEST,
   BLOCK_TEST,
   MEMTABLE_TEST,
+  VECTOR_MEMTABLE_TEST,
+  HASH_MEMTABLE_TEST,
   DB_TEST
 };
 
@@ -407,6 +423,10 @@ struct TestArgs {
   TestType type;
   bool reverse_compare;
   int restart_interval;
+  size_t index_partition_size;  // Zero for a single index block
+  bool hash_index;
+  int compression_threads;
+  bool uncompressed_keys;
 };
 
 static const TestArgs kTestArgList[] = {
@@ -417,20 +437,40 @@ static const TestArgs kTestArgList[] = {
   { TABLE_TEST, true, 1 },
   { TABLE_TEST, true, 1024 },
 
+  // Tiny index partitions so that most tables have several
+  { TABLE_TEST, false, 16, 64 },
+  { TABLE_TEST, true, 1, 64 },
+
+  // Data blocks compressed on background threads
+  { TABLE_TEST, false, 16, 0, false, 4 },
+  { TABLE_TEST, true, 1, 64, false, 2 },
+
   { BLOCK_TEST, false, 16 },
   { BLOCK_TEST, false, 1 },
   { BLOCK_TEST, false, 1024 },
   { BLOCK_TEST, true, 16 },
   { BLOCK_TEST, true, 1 },
   { BLOCK_TEST, true, 1024 },
+  { BLOCK_TEST, false, 16, 0, true },
+
+  // Keys stored whole
+  { TABLE_TEST, false, 16, 0, false, 0, true },
+  { BLOCK_TEST, true, 16, 0, false, 0, true },
+  { BLOCK_TEST, false, 1024, 0, true, 0, true },
 
   // Restart interval does not matter for memtables
   { MEMTABLE_TEST, false, 16 },
   { MEMTABLE_TEST, true, 16 },
+  { VECTOR_MEMTABLE_TEST, false, 16 },
+  { VECTOR_MEMTABLE_TEST, true, 16 },
+  { HASH_MEMTABLE_TEST, false, 16 },
+  { HASH_MEMTABLE_TEST, true, 16 },
 
   // Do not bother with restart interval variations for DB
   { DB_TEST, false, 16 },
   { DB_TEST, true, 16 },
+  { DB_TEST, false, 16, 64 },
+  { DB_TEST, false, 16, 0, true },
 };
 static const int kNumTestArgs = sizeof(kTestArgList) / sizeof(kTestArgList[0]);
 
@@ -444,6 +484,10 @@ class Harness {
     options_ = Options();
 
     options_.block_restart_interval = args.restart_interval;
+    options_.index_partition_size = args.index_partition_size;
+    options_.data_block_hash_index = args.hash_index;
+    options_.compression_threads = args.compression_threads;
+    options_.uncompressed_block_keys = args.uncompressed_keys;
     // Use shorter block size for tests to exercise block boundary
     // conditions more.
     options_.block_size = 256;
@@ -458,7 +502,16 @@ class Harness {
         constructor_ = new BlockConstructor(options_.comparator);
         break;
       case MEMTABLE_TEST:
-        constructor_ = new MemTableConstructor(options_.comparator);
+        constructor_ = new MemTableConstructor(options_.comparator,
+                                               kSkipListRep);
+        break;
+      case VECTOR_MEMTABLE_TEST:
+        constructor_ = new MemTableConstructor(options_.comparator,
+                                               kVectorRep);
+        break;
+      case HASH_MEMTABLE_TEST:
+        constructor_ = new MemTableConstructor(options_.comparator,
+                                               kHashLinkListRep);
         break;
       case DB_TEST:
         constructor_ = new DBConstructor(options_.comparator);
@@ -797,6 +850,219 @@ TEST(TableTest, ApproximateOffsetOfPlain) {
 
 }
 
+static std::string BuildInternalKeyBlock(bool hash_index) {
+  Options options;
+  options.block_restart_interval = 4;
+  options.data_block_hash_index = hash_index;
+  BlockBuilder builder(&options);
+  char user_key[16];
+  for (int i = 0; i < 200; i++) {
+    snprintf(user_key, sizeof(user_key), "k%04d", i);
+    // Up to three versions of each key, newest first
+    for (int seq = 30; seq > 30 - 10 * (1 + i % 3); seq -= 10) {
+      std::string key;
+      AppendInternalKey(&key, ParsedInternalKey(user_key, seq, kTypeValue));
+      builder.Add(key, NumberToString(seq));
+    }
+  }
+  return builder.Finish().ToString();
+}
+
+TEST(TableTest, BlockHashIndexGet) {
+  const std::string plain = BuildInternalKeyBlock(false);
+  const std::string data = BuildInternalKeyBlock(true);
+  ASSERT_GT(data.size(), plain.size());
+
+  BlockContents contents;
+  contents.data = data;
+  contents.cachable = false;
+  contents.heap_allocated = false;
+  Block block(contents);
+  InternalKeyComparator cmp(BytewiseComparator());
+  Iterator* seek_iter = block.NewIterator(&cmp);
+
+  char user_key[16];
+  for (int i = 0; i < 200; i++) {
+    for (int snapshot = 5; snapshot <= 35; snapshot += 10) {
+      snprintf(user_key, sizeof(user_key), "k%04d", i);
+      std::string target;
+      AppendInternalKey(&target,
+                        ParsedInternalKey(user_key, snapshot, kTypeValue));
+      seek_iter->Seek(target);
+      Iterator* get_iter = block.NewIteratorForGet(&cmp, target);
+      if (seek_iter->Valid() &&
+          ExtractUserKey(seek_iter->key()) == Slice(user_key)) {
+        ASSERT_TRUE(get_iter->Valid());
+        ASSERT_EQ(seek_iter->key().ToString(), get_iter->key().ToString());
+        ASSERT_EQ(seek_iter->value().ToString(),
+                  get_iter->value().ToString());
+      } else {
+        ASSERT_TRUE(!get_iter->Valid() ||
+                    ExtractUserKey(get_iter->key()) != Slice(user_key));
+      }
+      delete get_iter;
+
+      // A user key missing from the block is not found
+      snprintf(user_key, sizeof(user_key), "k%04da", i);
+      target.clear();
+      AppendInternalKey(&target,
+                        ParsedInternalKey(user_key, snapshot, kTypeValue));
+      get_iter = block.NewIteratorForGet(&cmp, target);
+      ASSERT_TRUE(!get_iter->Valid() ||
+                  ExtractUserKey(get_iter->key()) != Slice(user_key));
+      ASSERT_TRUE(get_iter->status().ok());
+      delete get_iter;
+    }
+  }
+  delete seek_iter;
+}
+
+TEST(TableTest, ApproximateOffsetOfPartitionedIndex) {
+  TableConstructor c(BytewiseComparator());
+  c.Add("k01", "hello");
+  c.Add("k02", "hello2");
+  c.Add("k03", std::string(10000, 'x'));
+  c.Add("k04", std::string(200000, 'x'));
+  c.Add("k05", std::string(300000, 'x'));
+  c.Add("k06", "hello3");
+  c.Add("k07", std::string(100000, 'x'));
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  options.index_partition_size = 1;  // One index entry per partition
+  c.Finish(options, &keys, &kvmap);
+
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("abc"),       0,      0));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k01"),       0,      0));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k03"),       0,      0));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k04"),   10000,  11000));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k05"),  210000, 211000));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("k07"),  510000, 511000));
+  ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"),  610000, 612000));
+}
+
+TEST(TableTest, PartitionedIndexUsesBlockCache) {
+  TableConstructor c(BytewiseComparator());
+  char key[16];
+  for (int i = 0; i < 2000; i++) {
+    snprintf(key, sizeof(key), "k%06d", i);
+    c.Add(key, std::string(100, 'a' + (i % 26)));
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  options.index_partition_size = 256;
+  options.block_cache = NewLRUCache(1 << 20);
+  c.Finish(options, &keys, &kvmap);
+
+  // The first seek reads an index partition and a data block, and a
+  // second seek finds both in the cache.
+  for (int pass = 0; pass < 2; pass++) {
+    const int reads_before = c.source()->reads();
+    Iterator* iter = c.table()->NewIterator(ReadOptions());
+    iter->Seek("k001234");
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ("k001234", iter->key().ToString());
+    delete iter;
+    ASSERT_EQ(pass == 0 ? 2 : 0, c.source()->reads() - reads_before);
+  }
+  delete options.block_cache;
+}
+
+TEST(TableTest, SequentialScanReadsAhead) {
+  TableConstructor c(BytewiseComparator());
+  char key[16];
+  for (int i = 0; i < 2000; i++) {
+    snprintf(key, sizeof(key), "k%06d", i);
+    c.Add(key, std::string(100, 'a' + (i % 26)));
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  c.Finish(options, &keys, &kvmap);
+
+  ReadOptions ro;
+  ro.sequential_scan = true;
+  const int reads_before = c.source()->reads();
+  Iterator* iter = c.table()->NewIterator(ro);
+  KVMap::const_iterator model = kvmap.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++model) {
+    ASSERT_TRUE(model != kvmap.end());
+    ASSERT_EQ(model->first, iter->key().ToString());
+    ASSERT_EQ(model->second, iter->value().ToString());
+  }
+  ASSERT_TRUE(model == kvmap.end());
+  ASSERT_TRUE(iter->status().ok());
+  delete iter;
+
+  // Every block of about 1KB was served from a few large reads.
+  const int reads = c.source()->reads() - reads_before;
+  const int blocks = (2000 * 100) / 1024;
+  ASSERT_GT(reads, 0);
+  ASSERT_LT(reads, blocks / 10);
+
+  // Seeking backwards still returns the right blocks.
+  iter = c.table()->NewIterator(ro);
+  iter->Seek("k001500");
+  ASSERT_EQ("k001500", iter->key().ToString());
+  iter->Seek("k000010");
+  ASSERT_EQ("k000010", iter->key().ToString());
+  iter->SeekToLast();
+  ASSERT_EQ("k001999", iter->key().ToString());
+  delete iter;
+}
+
+TEST(TableTest, PrefetchBlocks) {
+  TableConstructor c(BytewiseComparator());
+  char key[16];
+  for (int i = 0; i < 2000; i++) {
+    snprintf(key, sizeof(key), "k%06d", i);
+    c.Add(key, std::string(100, 'a' + (i % 26)));
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  c.Finish(options, &keys, &kvmap);
+
+  ReadOptions ro;
+  ro.prefetch_blocks = 4;
+  Iterator* iter = c.table()->NewIterator(ro);
+  KVMap::const_iterator model = kvmap.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++model) {
+    ASSERT_TRUE(model != kvmap.end());
+    ASSERT_EQ(model->first, iter->key().ToString());
+    ASSERT_EQ(model->second, iter->value().ToString());
+  }
+  ASSERT_TRUE(model == kvmap.end());
+  ASSERT_TRUE(iter->status().ok());
+
+  // Seeks in both directions discard the blocks read ahead.
+  iter->Seek("k001500");
+  ASSERT_EQ("k001500", iter->key().ToString());
+  iter->Next();
+  ASSERT_EQ("k001501", iter->key().ToString());
+  iter->Seek("k000010");
+  ASSERT_EQ("k000010", iter->key().ToString());
+  iter->Seek("k000500");
+  ASSERT_EQ("k000500", iter->key().ToString());
+  iter->SeekToLast();
+  ASSERT_EQ("k001999", iter->key().ToString());
+  iter->Prev();
+  ASSERT_EQ("k001998", iter->key().ToString());
+
+  // Deleting the iterator with blocks still being read is safe.
+  iter->SeekToFirst();
+  delete iter;
+}
+
 static bool SnappyCompressionSupported() {
   std::string out;
   Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
@@ -831,6 +1097,124 @@ TEST(TableTest, ApproximateOffsetOfCompressed) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"),    4000,   6000));
 }
 
+// Build a table of compressible values with "options", check that it came
+// out smaller than the raw data, and read it back through an iterator.
+static void CheckCompressedTable(const Options& options) {
+  Random rnd(301);
+  TableConstructor c(BytewiseComparator());
+  std::string tmp;
+  size_t raw_size = 0;
+  for (int i = 0; i < 100; i++) {
+    char key[10];
+    snprintf(key, sizeof(key), "k%03d", i);
+    test::CompressibleString(&rnd, 0.25, 1000, &tmp);
+    raw_size += tmp.size();
+    c.Add(key, tmp);
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  c.Finish(options, &keys, &kvmap);
+  ASSERT_LT(c.ApproximateOffsetOf("xyz"), raw_size / 2);
+
+  Iterator* iter = c.NewIterator();
+  KVMap::const_iterator model = kvmap.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++model) {
+    ASSERT_TRUE(model != kvmap.end());
+    ASSERT_EQ(model->first, iter->key().ToString());
+    ASSERT_EQ(model->second, iter->value().ToString());
+  }
+  ASSERT_TRUE(model == kvmap.end());
+  ASSERT_OK(iter->status());
+  delete iter;
+}
+
+TEST(TableTest, LZ4Compression) {
+  std::string out;
+  Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+  if (!port::LZ4_Compress(in.data(), in.size(), &out)) {
+    fprintf(stderr, "skipping LZ4 compression tests\n");
+    return;
+  }
+  Options options;
+  options.block_size = 1024;
+  options.compression = kLZ4Compression;
+  CheckCompressedTable(options);
+}
+
+TEST(TableTest, ZstdCompressionWithDictionary) {
+  std::string out;
+  Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+  if (!port::Zstd_Compress(in.data(), in.size(), NULL, 0, &out)) {
+    fprintf(stderr, "skipping Zstd compression tests\n");
+    return;
+  }
+  Options options;
+  options.block_size = 1024;
+  options.compression = kZstdCompression;
+  CheckCompressedTable(options);
+
+  // The table is opened without the dictionary, so it must find its own.
+  Random rnd(302);
+  std::string dict;
+  test::CompressibleString(&rnd, 0.25, 4096, &dict);
+  options.compression_dictionary = dict;
+  CheckCompressedTable(options);
+}
+
+TEST(TableTest, CompressedBlockCache) {
+  CompressionType type = kNoCompression;
+  std::string out;
+  Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+  if (port::Snappy_Compress(in.data(), in.size(), &out)) {
+    type = kSnappyCompression;
+  } else if (port::LZ4_Compress(in.data(), in.size(), &out)) {
+    type = kLZ4Compression;
+  } else if (port::Zstd_Compress(in.data(), in.size(), NULL, 0, &out)) {
+    type = kZstdCompression;
+  } else {
+    fprintf(stderr, "skipping compressed block cache tests\n");
+    return;
+  }
+
+  Random rnd(301);
+  TableConstructor c(BytewiseComparator());
+  std::string tmp;
+  char key[16];
+  for (int i = 0; i < 200; i++) {
+    snprintf(key, sizeof(key), "k%06d", i);
+    c.Add(key, test::CompressibleString(&rnd, 0.25, 1000, &tmp));
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 1024;
+  options.compression = type;
+  options.block_cache_compressed = NewLRUCache(1 << 20);
+  c.Finish(options, &keys, &kvmap);
+
+  // The first pass reads every block from the file and the second pass
+  // finds them all in the compressed cache.
+  for (int pass = 0; pass < 2; pass++) {
+    const int reads_before = c.source()->reads();
+    Iterator* iter = c.NewIterator();
+    KVMap::const_iterator model = kvmap.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++model) {
+      ASSERT_TRUE(model != kvmap.end());
+      ASSERT_EQ(model->first, iter->key().ToString());
+      ASSERT_EQ(model->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(model == kvmap.end());
+    ASSERT_OK(iter->status());
+    delete iter;
+    if (pass == 0) {
+      ASSERT_GT(c.source()->reads(), reads_before);
+    } else {
+      ASSERT_EQ(reads_before, c.source()->reads());
+    }
+  }
+  delete options.block_cache_compressed;
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -4,6 +4,8 @@
 
 #include "table/two_level_iterator.h"
 
+#include <vector>
+#include "leveldb/comparator.h"
 #include "leveldb/table.h"
 #include "table/block.h"
 #include "table/format.h"
@@ -21,7 +23,8 @@ class TwoLevelIterator: public Iterator {
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options);
+    const ReadOptions& options,
+    const Comparator* comparator);
 
   virtual ~TwoLevelIterator();
 
@@ -42,6 +45,7 @@ class TwoLevelIterator: public Iterator {
     assert(Valid());
     return data_iter_.value();
   }
+  virtual void ReleasePinnedData();
   virtual Status status() const {
     // It'd be nice if status() returned a const Status& instead of a Status
     if (!index_iter_.status().ok()) {
@@ -59,33 +63,51 @@ class TwoLevelIterator: public Iterator {
   }
   void SkipEmptyDataBlocksForward();
   void SkipEmptyDataBlocksBackward();
+  bool PastUpperBound() const;
   void SetDataIterator(Iterator* data_iter);
   void InitDataBlock();
 
   BlockFunction block_function_;
   void* arg_;
   const ReadOptions options_;
+  const Comparator* comparator_;  // NULL if upper bounds aren't checked
   Status status_;
   IteratorWrapper index_iter_;
   IteratorWrapper data_iter_; // May be NULL
   // If data_iter_ is non-NULL, then "data_block_handle_" holds the
   // "index_value" passed to block_function_ to create the data_iter_.
   std::string data_block_handle_;
+  // Data iterators left behind while options_.pin_data is set.  They hold
+  // the blocks that earlier values point into.
+  std::vector<Iterator*> pinned_;
 };
 
 TwoLevelIterator::TwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options)
+    const ReadOptions& options,
+    const Comparator* comparator)
     : block_function_(block_function),
       arg_(arg),
       options_(options),
+      comparator_(options.iterate_upper_bound != NULL ? comparator : NULL),
       index_iter_(index_iter),
       data_iter_(NULL) {
 }
 
 TwoLevelIterator::~TwoLevelIterator() {
+  for (size_t i = 0; i < pinned_.size(); i++) {
+    delete pinned_[i];
+  }
+}
+
+void TwoLevelIterator::ReleasePinnedData() {
+  for (size_t i = 0; i < pinned_.size(); i++) {
+    delete pinned_[i];
+  }
+  pinned_.clear();
+  if (data_iter_.iter() != NULL) data_iter_.iter()->ReleasePinnedData();
 }
 
 void TwoLevelIterator::Seek(const Slice& target) {
@@ -125,7 +147,7 @@ void TwoLevelIterator::Prev() {
 void TwoLevelIterator::SkipEmptyDataBlocksForward() {
   while (data_iter_.iter() == NULL || !data_iter_.Valid()) {
     // Move to next block
-    if (!index_iter_.Valid()) {
+    if (!index_iter_.Valid() || PastUpperBound()) {
       SetDataIterator(NULL);
       return;
     }
@@ -148,8 +170,22 @@ void TwoLevelIterator::SkipEmptyDataBlocksBackward() {
   }
 }
 
+// Returns true if the blocks after the current one only hold keys past the
+// upper bound.  The current block's index key is at or after all of its
+// keys and before all keys of the blocks that follow.
+bool TwoLevelIterator::PastUpperBound() const {
+  return comparator_ != NULL &&
+         comparator_->Compare(index_iter_.key(),
+                              *options_.iterate_upper_bound) >= 0;
+}
+
 void TwoLevelIterator::SetDataIterator(Iterator* data_iter) {
-  if (data_iter_.iter() != NULL) SaveError(data_iter_.status());
+  Iterator* old = data_iter_.iter();
+  if (old != NULL) SaveError(data_iter_.status());
+  if (options_.pin_data && old != NULL && old->status().ok()) {
+    // Keep the old iterator, and with it the block, alive
+    pinned_.push_back(data_iter_.Release());
+  }
   data_iter_.Set(data_iter);
 }
 
@@ -175,8 +211,10 @@ Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options) {
-  return new TwoLevelIterator(index_iter, block_function, arg, options);
+    const ReadOptions& options,
+    const Comparator* comparator) {
+  return new TwoLevelIterator(index_iter, block_function, arg, options,
+                              comparator);
 }
 
 }  // namespace leveldb
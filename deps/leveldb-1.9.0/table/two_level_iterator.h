@@ -9,6 +9,7 @@
 
 namespace leveldb {
 
+class Comparator;
 struct ReadOptions;
 
 // Return a new two level iterator.  A two-level iterator contains an
@@ -20,6 +21,11 @@ struct ReadOptions;
 //
 // Uses a supplied function to convert an index_iter value into
 // an iterator over the contents of the corresponding block.
+//
+// If "comparator" is non-NULL, it orders the index keys, each of which
+// must be at or after every key of its block and before every key of the
+// following blocks.  The iterator then stops instead of moving on to a
+// block past options.iterate_upper_bound.
 extern Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     Iterator* (*block_function)(
@@ -27,7 +33,8 @@ extern Iterator* NewTwoLevelIterator(
         const ReadOptions& options,
         const Slice& index_value),
     void* arg,
-    const ReadOptions& options);
+    const ReadOptions& options,
+    const Comparator* comparator = NULL);
 
 }  // namespace leveldb
 
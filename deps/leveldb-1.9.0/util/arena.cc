@@ -4,12 +4,28 @@
 
 #include "util/arena.h"
 #include <assert.h>
+#include "util/huge_page.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
-static const int kBlockSize = 4096;
+static const size_t kBlockSize = 4096;
 
 Arena::Arena() {
+  Init(kBlockSize, kNoHugePages);
+}
+
+Arena::Arena(size_t block_size, HugePages huge_pages) {
+  Init(block_size, huge_pages);
+}
+
+void Arena::Init(size_t block_size, HugePages huge_pages) {
+  assert(block_size > 0);
+  block_size_ = block_size;
+  huge_pages_ = huge_pages;
+  if (huge_pages_ != kNoHugePages) {
+    block_size_ = (block_size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  }
   blocks_memory_ = 0;
   alloc_ptr_ = NULL;  // First allocation will allocate a block
   alloc_bytes_remaining_ = 0;
@@ -19,10 +35,13 @@ Arena::~Arena() {
   for (size_t i = 0; i < blocks_.size(); i++) {
     delete[] blocks_[i];
   }
+  for (size_t i = 0; i < huge_blocks_.size(); i++) {
+    FreeHugePages(huge_blocks_[i], block_size_);
+  }
 }
 
 char* Arena::AllocateFallback(size_t bytes) {
-  if (bytes > kBlockSize / 4) {
+  if (bytes > block_size_ / 4) {
     // Object is more than a quarter of our block size.  Allocate it separately
     // to avoid wasting too much space in leftover bytes.
     char* result = AllocateNewBlock(bytes);
@@ -30,8 +49,18 @@ char* Arena::AllocateFallback(size_t bytes) {
   }
 
   // We waste the remaining space in the current block.
-  alloc_ptr_ = AllocateNewBlock(kBlockSize);
-  alloc_bytes_remaining_ = kBlockSize;
+  alloc_ptr_ = NULL;
+  if (huge_pages_ != kNoHugePages) {
+    alloc_ptr_ = AllocateHugePages(block_size_, huge_pages_);
+    if (alloc_ptr_ != NULL) {
+      blocks_memory_ += block_size_;
+      huge_blocks_.push_back(alloc_ptr_);
+    }
+  }
+  if (alloc_ptr_ == NULL) {
+    alloc_ptr_ = AllocateNewBlock(block_size_);
+  }
+  alloc_bytes_remaining_ = block_size_;
 
   char* result = alloc_ptr_;
   alloc_ptr_ += bytes;
@@ -58,6 +87,16 @@ char* Arena::AllocateAligned(size_t bytes) {
   return result;
 }
 
+char* Arena::AllocateConcurrently(size_t bytes) {
+  MutexLock l(&mu_);
+  return Allocate(bytes);
+}
+
+char* Arena::AllocateAlignedConcurrently(size_t bytes) {
+  MutexLock l(&mu_);
+  return AllocateAligned(bytes);
+}
+
 char* Arena::AllocateNewBlock(size_t block_bytes) {
   char* result = new char[block_bytes];
   blocks_memory_ += block_bytes;
@@ -9,12 +9,19 @@
 #include <vector>
 #include <assert.h>
 #include <stdint.h>
+#include "leveldb/options.h"
+#include "port/port.h"
 
 namespace leveldb {
 
 class Arena {
  public:
   Arena();
+
+  // An arena that allocates memory in blocks of "block_size" bytes.  With
+  // huge pages, blocks are rounded up to a multiple of 2MB and mapped
+  // with huge pages as "huge_pages" asks.
+  Arena(size_t block_size, HugePages huge_pages);
   ~Arena();
 
   // Return a pointer to a newly allocated memory block of "bytes" bytes.
@@ -23,16 +30,28 @@ class Arena {
   // Allocate memory with the normal alignment guarantees provided by malloc
   char* AllocateAligned(size_t bytes);
 
+  // Like Allocate() and AllocateAligned(), but may be called from several
+  // threads at once.  REQUIRES: no concurrent calls to the unsynchronized
+  // variants.
+  char* AllocateConcurrently(size_t bytes);
+  char* AllocateAlignedConcurrently(size_t bytes);
+
   // Returns an estimate of the total memory usage of data allocated
   // by the arena (including space allocated but not yet used for user
   // allocations).
   size_t MemoryUsage() const {
-    return blocks_memory_ + blocks_.capacity() * sizeof(char*);
+    return blocks_memory_ +
+        (blocks_.capacity() + huge_blocks_.capacity()) * sizeof(char*);
   }
 
  private:
   char* AllocateFallback(size_t bytes);
   char* AllocateNewBlock(size_t block_bytes);
+  void Init(size_t block_size, HugePages huge_pages);
+
+  // Size of the blocks that small allocations are carved out of
+  size_t block_size_;
+  HugePages huge_pages_;
 
   // Allocation state
   char* alloc_ptr_;
@@ -41,9 +60,15 @@ class Arena {
   // Array of new[] allocated memory blocks
   std::vector<char*> blocks_;
 
+  // Array of block_size_ blocks mapped with huge pages
+  std::vector<char*> huge_blocks_;
+
   // Bytes of memory in blocks allocated so far
   size_t blocks_memory_;
 
+  // Serializes the *Concurrently() allocation methods
+  port::Mutex mu_;
+
   // No copying allowed
   Arena(const Arena&);
   void operator=(const Arena&);
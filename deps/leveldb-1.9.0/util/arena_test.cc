@@ -4,6 +4,7 @@
 
 #include "util/arena.h"
 
+#include "util/huge_page.h"
 #include "util/random.h"
 #include "util/testharness.h"
 
@@ -61,6 +62,59 @@ TEST(ArenaTest, Simple) {
   }
 }
 
+TEST(ArenaTest, BlockSize) {
+  Arena arena(64 << 10, kNoHugePages);
+
+  // Allocations past a quarter of a block get a block of their own.
+  char* r = arena.Allocate(20 << 10);
+  memset(r, 1, 20 << 10);
+  ASSERT_GE(arena.MemoryUsage(), 20 << 10);
+  ASSERT_LT(arena.MemoryUsage(), 64 << 10);
+
+  arena.Allocate(100);
+  ASSERT_GE(arena.MemoryUsage(), (64 << 10) + (20 << 10));
+  ASSERT_LT(arena.MemoryUsage(), 2 * (64 << 10));
+}
+
+TEST(ArenaTest, HugePages) {
+  // Blocks are rounded up to a huge page, whether or not the platform
+  // can map them.
+  Arena arena(4096, kTransparentHugePages);
+  char* r = arena.AllocateAligned(1000);
+  memset(r, 1, 1000);
+  ASSERT_GE(arena.MemoryUsage(), kHugePageSize);
+  for (int i = 0; i < 4000; i++) {
+    memset(arena.Allocate(1000), i % 256, 1000);
+  }
+  ASSERT_GE(arena.MemoryUsage(), 2 * kHugePageSize);
+  ASSERT_EQ(int(r[999]), 1);
+}
+
+TEST(ArenaTest, BlockBuffers) {
+  HugePages modes[] = { kNoHugePages, kTransparentHugePages };
+  for (int m = 0; m < 2; m++) {
+    std::vector<char*> buffers;
+    for (int i = 0; i < 100; i++) {
+      const size_t n = (i % 2 == 0) ? (64 << 10) + 5 : 3 << 20;
+      char* buf = NewBlockBuffer(n, modes[m]);
+      ASSERT_EQ(reinterpret_cast<uintptr_t>(buf) % 16, 0);
+      buf[0] = i;
+      buf[n - 1] = i;
+      buffers.push_back(buf);
+    }
+    for (size_t i = 0; i < buffers.size(); i++) {
+      ASSERT_EQ(int(buffers[i][0]), i);
+      DeleteBlockBuffer(buffers[i]);
+    }
+    DeleteBlockBuffer(NULL);
+
+    // Freed buffers are handed out again.
+    char* buf = NewBlockBuffer(64 << 10, modes[m]);
+    memset(buf, 0, 64 << 10);
+    DeleteBlockBuffer(buf);
+  }
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -5,6 +5,7 @@
 #include "leveldb/filter_policy.h"
 
 #include "leveldb/slice.h"
+#include "util/coding.h"
 #include "util/hash.h"
 
 namespace leveldb {
@@ -14,14 +15,57 @@ static uint32_t BloomHash(const Slice& key) {
   return Hash(key.data(), key.size(), 0xbc9f1d34);
 }
 
+// A blocked filter is an array of 64-byte lines followed by the number
+// of probes and kBlockedMarker.  Filters of the original format end with
+// their number of probes, at most 30, and readers of that format take any
+// larger value as a match, so both formats share a name.
+static const size_t kLineBytes = 64;
+static const size_t kLineBits = kLineBytes * 8;
+static const char kBlockedMarker = static_cast<char>(0xff);
+
+// Return the line of "num_lines" that hash "h" falls in.
+static inline size_t BlockedLine(uint32_t h, size_t num_lines) {
+  return static_cast<size_t>((static_cast<uint64_t>(h) * num_lines) >> 32);
+}
+
+// Return the next bit within a line to probe for hash "*h".
+static inline uint32_t BlockedProbe(uint32_t* h) {
+  *h *= 0x9e3779b9;  // Golden ratio, so every probe mixes in all bits
+  return *h >> 23;   // Top 9 bits, a bit of the 512 in a line
+}
+
+static bool BlockedMayMatch(uint32_t h, const char* array, size_t len) {
+  const size_t num_lines = (len - 2) / kLineBytes;
+  const size_t k = static_cast<unsigned char>(array[len-2]);
+  if (num_lines == 0 || k > 30) {
+    return true;
+  }
+  const char* line = array + BlockedLine(h, num_lines) * kLineBytes;
+
+  // Gather every probe into a mask of the line before reading it, so the
+  // comparison is one pass over the line with no branch per probe.
+  uint64_t mask[kLineBytes / 8] = { 0 };
+  for (size_t j = 0; j < k; j++) {
+    const uint32_t bitpos = BlockedProbe(&h);
+    mask[bitpos / 64] |= static_cast<uint64_t>(1) << (bitpos % 64);
+  }
+  uint64_t missing = 0;
+  for (size_t i = 0; i < kLineBytes / 8; i++) {
+    missing |= mask[i] & ~DecodeFixed64(line + i * 8);
+  }
+  return missing == 0;
+}
+
 class BloomFilterPolicy : public FilterPolicy {
  private:
   size_t bits_per_key_;
   size_t k_;
+  bool blocked_;
 
  public:
-  explicit BloomFilterPolicy(int bits_per_key)
-      : bits_per_key_(bits_per_key) {
+  BloomFilterPolicy(int bits_per_key, bool blocked)
+      : bits_per_key_(bits_per_key),
+        blocked_(blocked) {
     // We intentionally round down to reduce probing cost a little bit
     k_ = static_cast<size_t>(bits_per_key * 0.69);  // 0.69 =~ ln(2)
     if (k_ < 1) k_ = 1;
@@ -40,6 +84,11 @@ class BloomFilterPolicy : public FilterPolicy {
     // by enforcing a minimum bloom filter length.
     if (bits < 64) bits = 64;
 
+    if (blocked_) {
+      CreateBlockedFilter(keys, n, bits, dst);
+      return;
+    }
+
     size_t bytes = (bits + 7) / 8;
     bits = bytes * 8;
 
@@ -65,6 +114,9 @@ class BloomFilterPolicy : public FilterPolicy {
     if (len < 2) return false;
 
     const char* array = bloom_filter.data();
+    if (array[len-1] == kBlockedMarker) {
+      return BlockedMayMatch(BloomHash(key), array, len);
+    }
     const size_t bits = (len - 1) * 8;
 
     // Use the encoded k so that we can read filters generated by
@@ -85,11 +137,36 @@ class BloomFilterPolicy : public FilterPolicy {
     }
     return true;
   }
+
+ private:
+  void CreateBlockedFilter(const Slice* keys, int n, size_t bits,
+                           std::string* dst) const {
+    const size_t num_lines = (bits + kLineBits - 1) / kLineBits;
+    const size_t bytes = num_lines * kLineBytes;
+
+    const size_t init_size = dst->size();
+    dst->resize(init_size + bytes, 0);
+    dst->push_back(static_cast<char>(k_));
+    dst->push_back(kBlockedMarker);
+    char* array = &(*dst)[init_size];
+    for (size_t i = 0; i < n; i++) {
+      uint32_t h = BloomHash(keys[i]);
+      char* line = array + BlockedLine(h, num_lines) * kLineBytes;
+      for (size_t j = 0; j < k_; j++) {
+        const uint32_t bitpos = BlockedProbe(&h);
+        line[bitpos/8] |= (1 << (bitpos % 8));
+      }
+    }
+  }
 };
 }
 
 const FilterPolicy* NewBloomFilterPolicy(int bits_per_key) {
-  return new BloomFilterPolicy(bits_per_key);
+  return new BloomFilterPolicy(bits_per_key, false);
+}
+
+const FilterPolicy* NewBlockedBloomFilterPolicy(int bits_per_key) {
+  return new BloomFilterPolicy(bits_per_key, true);
 }
 
 }  // namespace leveldb
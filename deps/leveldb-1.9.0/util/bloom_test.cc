@@ -27,6 +27,8 @@ class BloomTest {
  public:
   BloomTest() : policy_(NewBloomFilterPolicy(10)) { }
 
+  explicit BloomTest(const FilterPolicy* policy) : policy_(policy) { }
+
   ~BloomTest() {
     delete policy_;
   }
@@ -153,6 +155,99 @@ TEST(BloomTest, VaryingLengths) {
 
 // Different bits-per-byte
 
+class BlockedBloomTest : public BloomTest {
+ public:
+  BlockedBloomTest() : BloomTest(NewBlockedBloomFilterPolicy(10)) { }
+};
+
+TEST(BlockedBloomTest, BlockedEmptyFilter) {
+  ASSERT_TRUE(! Matches("hello"));
+  ASSERT_TRUE(! Matches("world"));
+}
+
+TEST(BlockedBloomTest, BlockedSmall) {
+  Add("hello");
+  Add("world");
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(! Matches("x"));
+  ASSERT_TRUE(! Matches("foo"));
+}
+
+TEST(BlockedBloomTest, BlockedVaryingLengths) {
+  char buffer[sizeof(int)];
+
+  // Keeping the probes in one line costs a little accuracy, so the
+  // limits are looser than for the original filter.
+  int mediocre_filters = 0;
+  int good_filters = 0;
+
+  for (int length = 1; length <= 10000; length = NextLength(length)) {
+    Reset();
+    for (int i = 0; i < length; i++) {
+      Add(Key(i, buffer));
+    }
+    Build();
+
+    ASSERT_LE(FilterSize(), (length * 10 / 8) + 64 + 2) << length;
+
+    // All added keys must match
+    for (int i = 0; i < length; i++) {
+      ASSERT_TRUE(Matches(Key(i, buffer)))
+          << "Length " << length << "; key " << i;
+    }
+
+    // Check false positive rate
+    double rate = FalsePositiveRate();
+    if (kVerbose >= 1) {
+      fprintf(stderr, "False positives: %5.2f%% @ length = %6d ; bytes = %6d\n",
+              rate*100.0, length, static_cast<int>(FilterSize()));
+    }
+    ASSERT_LE(rate, 0.03);   // Must not be over 3%
+    if (rate > 0.02) mediocre_filters++;  // Allowed, but not too often
+    else good_filters++;
+  }
+  if (kVerbose >= 1) {
+    fprintf(stderr, "Filters: %d good, %d mediocre\n",
+            good_filters, mediocre_filters);
+  }
+  ASSERT_LE(mediocre_filters, good_filters/5);
+}
+
+TEST(BlockedBloomTest, ReadsEitherFormat) {
+  char buffer[sizeof(int)];
+  std::vector<std::string> keys;
+  for (int i = 0; i < 1000; i++) {
+    keys.push_back(Key(i, buffer).ToString());
+  }
+  std::vector<Slice> key_slices(keys.begin(), keys.end());
+
+  const FilterPolicy* legacy = NewBloomFilterPolicy(10);
+  const FilterPolicy* blocked = NewBlockedBloomFilterPolicy(10);
+  ASSERT_EQ(std::string(legacy->Name()), std::string(blocked->Name()));
+
+  std::string legacy_filter, blocked_filter;
+  legacy->CreateFilter(&key_slices[0], key_slices.size(), &legacy_filter);
+  blocked->CreateFilter(&key_slices[0], key_slices.size(), &blocked_filter);
+
+  int false_positives = 0;
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_TRUE(legacy->KeyMayMatch(key_slices[i], blocked_filter)) << i;
+    ASSERT_TRUE(blocked->KeyMayMatch(key_slices[i], legacy_filter)) << i;
+    if (legacy->KeyMayMatch(Key(i + 1000000000, buffer), blocked_filter)) {
+      false_positives++;
+    }
+    if (blocked->KeyMayMatch(Key(i + 1000000000, buffer), legacy_filter)) {
+      false_positives++;
+    }
+  }
+  // Each policy filters with the other's filters rather than matching all
+  ASSERT_LE(false_positives, 60);
+
+  delete legacy;
+  delete blocked;
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
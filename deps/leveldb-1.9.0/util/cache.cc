@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <vector>
 
 #include "leveldb/cache.h"
 #include "port/port.h"
@@ -16,6 +17,10 @@ namespace leveldb {
 Cache::~Cache() {
 }
 
+void Cache::VisitEntries(
+    void (*visitor)(void* arg, const Slice& key, void* value), void* arg) {
+}
+
 namespace {
 
 // LRU cache implementation
@@ -32,6 +37,7 @@ struct LRUHandle {
   size_t key_length;
   uint32_t refs;
   uint32_t hash;      // Hash of key(); used for fast sharding and comparisons
+  bool in_protected;  // Whether entry is on the protected list
   char key_data[1];   // Beginning of key
 
   Slice key() const {
@@ -133,6 +139,13 @@ class HandleTable {
 };
 
 // A single shard of sharded cache.
+//
+// When a protected capacity is set the shard uses midpoint insertion: new
+// entries go on a probationary list and are only moved to the protected
+// list when they are looked up again.  Entries are evicted from the
+// probationary list first and the oldest protected entries are moved back
+// to it when the protected list is over its capacity.  A scan that touches
+// each block once can then only displace other probationary entries.
 class LRUCache {
  public:
   LRUCache();
@@ -140,6 +153,7 @@ class LRUCache {
 
   // Separate from constructor so caller can easily make an array of LRUCache
   void SetCapacity(size_t capacity) { capacity_ = capacity; }
+  void SetProtectedCapacity(size_t capacity) { protected_capacity_ = capacity; }
 
   // Like Cache methods, but with an extra "hash" parameter.
   Cache::Handle* Insert(const Slice& key, uint32_t hash,
@@ -148,41 +162,55 @@ class LRUCache {
   Cache::Handle* Lookup(const Slice& key, uint32_t hash);
   void Release(Cache::Handle* handle);
   void Erase(const Slice& key, uint32_t hash);
+  void VisitEntries(void (*visitor)(void*, const Slice&, void*), void* arg);
 
  private:
   void LRU_Remove(LRUHandle* e);
-  void LRU_Append(LRUHandle* e);
+  void LRU_Append(LRUHandle* list, LRUHandle* e);
   void Unref(LRUHandle* e);
 
   // Initialized before use.
   size_t capacity_;
+  size_t protected_capacity_;  // Zero for a plain LRU
 
   // mutex_ protects the following state.
   port::Mutex mutex_;
   size_t usage_;
+  size_t protected_usage_;
   uint64_t last_id_;
 
-  // Dummy head of LRU list.
+  // Dummy head of LRU list.  This is the probationary list when a
+  // protected capacity is set.
   // lru.prev is newest entry, lru.next is oldest entry.
   LRUHandle lru_;
 
+  // Dummy head of the protected list.  Ordered like lru_.
+  LRUHandle protected_;
+
   HandleTable table_;
 };
 
 LRUCache::LRUCache()
-    : usage_(0),
+    : protected_capacity_(0),
+      usage_(0),
+      protected_usage_(0),
       last_id_(0) {
-  // Make empty circular linked list
+  // Make empty circular linked lists
   lru_.next = &lru_;
   lru_.prev = &lru_;
+  protected_.next = &protected_;
+  protected_.prev = &protected_;
 }
 
 LRUCache::~LRUCache() {
-  for (LRUHandle* e = lru_.next; e != &lru_; ) {
-    LRUHandle* next = e->next;
-    assert(e->refs == 1);  // Error if caller has an unreleased handle
-    Unref(e);
-    e = next;
+  LRUHandle* lists[] = { &lru_, &protected_ };
+  for (int i = 0; i < 2; i++) {
+    for (LRUHandle* e = lists[i]->next; e != lists[i]; ) {
+      LRUHandle* next = e->next;
+      assert(e->refs == 1);  // Error if caller has an unreleased handle
+      Unref(e);
+      e = next;
+    }
   }
 }
 
@@ -199,14 +227,22 @@ void LRUCache::Unref(LRUHandle* e) {
 void LRUCache::LRU_Remove(LRUHandle* e) {
   e->next->prev = e->prev;
   e->prev->next = e->next;
+  if (e->in_protected) {
+    protected_usage_ -= e->charge;
+    e->in_protected = false;
+  }
 }
 
-void LRUCache::LRU_Append(LRUHandle* e) {
-  // Make "e" newest entry by inserting just before lru_
-  e->next = &lru_;
-  e->prev = lru_.prev;
+void LRUCache::LRU_Append(LRUHandle* list, LRUHandle* e) {
+  // Make "e" newest entry by inserting just before the list head
+  e->next = list;
+  e->prev = list->prev;
   e->prev->next = e;
   e->next->prev = e;
+  if (list == &protected_) {
+    protected_usage_ += e->charge;
+    e->in_protected = true;
+  }
 }
 
 Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
@@ -215,7 +251,19 @@ Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
   if (e != NULL) {
     e->refs++;
     LRU_Remove(e);
-    LRU_Append(e);
+    if (protected_capacity_ == 0) {
+      LRU_Append(&lru_, e);
+    } else {
+      // A second reference promotes the entry.  Demote the oldest
+      // protected entries to make room but always keep the new one.
+      LRU_Append(&protected_, e);
+      while (protected_usage_ > protected_capacity_ &&
+             protected_.next != e) {
+        LRUHandle* old = protected_.next;
+        LRU_Remove(old);
+        LRU_Append(&lru_, old);
+      }
+    }
   }
   return reinterpret_cast<Cache::Handle*>(e);
 }
@@ -238,8 +286,9 @@ Cache::Handle* LRUCache::Insert(
   e->key_length = key.size();
   e->hash = hash;
   e->refs = 2;  // One from LRUCache, one for the returned handle
+  e->in_protected = false;
   memcpy(e->key_data, key.data(), key.size());
-  LRU_Append(e);
+  LRU_Append(&lru_, e);
   usage_ += charge;
 
   LRUHandle* old = table_.Insert(e);
@@ -248,8 +297,15 @@ Cache::Handle* LRUCache::Insert(
     Unref(old);
   }
 
-  while (usage_ > capacity_ && lru_.next != &lru_) {
+  // Evict probationary entries before protected ones.
+  while (usage_ > capacity_) {
     LRUHandle* old = lru_.next;
+    if (old == &lru_) {
+      old = protected_.next;
+      if (old == &protected_) {
+        break;
+      }
+    }
     LRU_Remove(old);
     table_.Remove(old->key(), old->hash);
     Unref(old);
@@ -267,9 +323,24 @@ void LRUCache::Erase(const Slice& key, uint32_t hash) {
   }
 }
 
+void LRUCache::VisitEntries(void (*visitor)(void*, const Slice&, void*),
+                            void* arg) {
+  MutexLock l(&mutex_);
+  LRUHandle* lists[] = { &protected_, &lru_ };
+  for (int i = 0; i < 2; i++) {
+    for (LRUHandle* e = lists[i]->prev; e != lists[i]; e = e->prev) {
+      (*visitor)(arg, e->key(), e->value);
+    }
+  }
+}
+
 static const int kNumShardBits = 4;
 static const int kNumShards = 1 << kNumShardBits;
 
+// The share of a scan resistant cache that entries have to be referenced
+// twice to stay in.
+static const int kProtectedPercent = 75;
+
 class ShardedLRUCache : public Cache {
  private:
   LRUCache shard_[kNumShards];
@@ -285,11 +356,12 @@ class ShardedLRUCache : public Cache {
   }
 
  public:
-  explicit ShardedLRUCache(size_t capacity)
+  ShardedLRUCache(size_t capacity, int protected_percent)
       : last_id_(0) {
     const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
     for (int s = 0; s < kNumShards; s++) {
       shard_[s].SetCapacity(per_shard);
+      shard_[s].SetProtectedCapacity(per_shard * protected_percent / 100);
     }
   }
   virtual ~ShardedLRUCache() { }
@@ -317,12 +389,415 @@ class ShardedLRUCache : public Cache {
     MutexLock l(&id_mutex_);
     return ++(last_id_);
   }
+  virtual void VisitEntries(
+      void (*visitor)(void* arg, const Slice& key, void* value), void* arg) {
+    for (int s = 0; s < kNumShards; s++) {
+      shard_[s].VisitEntries(visitor, arg);
+    }
+  }
+};
+
+// CLOCK cache implementation
+//
+// Lookups walk the hash table and pin an entry with one atomic increment
+// of its reference count, without taking the shard mutex.  Insert, Erase
+// and eviction still serialize on the mutex.  Unlocked readers may hold a
+// pointer to any handle or bucket array, so neither is freed while the
+// cache is alive: an evicted handle is detached from the table, and once
+// its last reference is dropped its value is deleted and the handle is
+// kept on a free list to be reused by a later Insert.
+//
+// Eviction sweeps a clock hand over every handle.  A lookup sets the
+// handle's referenced bit and the hand clears it, so an entry that was
+// read since the last sweep gets a second chance.  Pinned entries are
+// never chosen.
+
+// State bits kept above the reference count in ClockHandle::refs.
+static const uint32_t kDetached = 1u << 31;  // Not reachable from the table
+static const uint32_t kFreed = 1u << 30;     // Value deleted, on free list
+
+// A reader following a chain that is being relinked under it can be sent
+// into another chain.  That is harmless but to guarantee a lookup always
+// terminates it gives up after this many steps and reports a miss.
+static const int kMaxProbes = 1024;
+
+struct ClockHandle {
+  void* value;
+  void (*deleter)(const Slice&, void* value);
+  port::AtomicPointer next_hash;
+  ClockHandle* next_free;
+  size_t charge;
+  char* key_data;
+  size_t key_length;
+  size_t key_capacity;
+  volatile uint32_t refs;    // External references plus the bits above
+  volatile uint32_t hash;
+  volatile bool referenced;  // Set by lookups, cleared by the clock hand
+
+  Slice key() const { return Slice(key_data, key_length); }
+};
+
+// A bucket array.  Arrays replaced by a resize are retired rather than
+// freed since a concurrent Lookup may still be reading them.
+struct ClockTable {
+  uint32_t length;
+  port::AtomicPointer list[1];
+};
+
+// A single shard of a sharded CLOCK cache.
+class ClockCache {
+ public:
+  ClockCache();
+  ~ClockCache();
+
+  // Separate from constructor so caller can easily make an array of
+  // ClockCache
+  void SetCapacity(size_t capacity) { capacity_ = capacity; }
+
+  // Like Cache methods, but with an extra "hash" parameter.
+  Cache::Handle* Insert(const Slice& key, uint32_t hash,
+                        void* value, size_t charge,
+                        void (*deleter)(const Slice& key, void* value));
+  Cache::Handle* Lookup(const Slice& key, uint32_t hash);
+  void Release(Cache::Handle* handle);
+  void Erase(const Slice& key, uint32_t hash);
+  void VisitEntries(void (*visitor)(void*, const Slice&, void*), void* arg);
+
+ private:
+  static ClockTable* NewTable(uint32_t length);
+  ClockTable* table() const {
+    return reinterpret_cast<ClockTable*>(table_.Acquire_Load());
+  }
+
+  // All of the following REQUIRE: mutex_ held.
+  port::AtomicPointer* FindPointer(const Slice& key, uint32_t hash);
+  ClockHandle* Remove(const Slice& key, uint32_t hash);
+  void Detach(ClockHandle* e);
+  void Free(ClockHandle* e);
+  void Resize();
+  void EvictToCapacity();
+
+  void Unref(ClockHandle* e);
+
+  // Initialized before use.
+  size_t capacity_;
+
+  // Published with a release store so that Lookup can read it unlocked.
+  port::AtomicPointer table_;
+
+  // mutex_ protects the following state.
+  port::Mutex mutex_;
+  size_t usage_;
+  uint32_t elems_;
+  ClockHandle* free_list_;
+  std::vector<ClockHandle*> handles_;  // Every handle, in clock order
+  size_t hand_;
+  std::vector<ClockTable*> retired_;
+};
+
+ClockCache::ClockCache()
+    : capacity_(0),
+      usage_(0),
+      elems_(0),
+      free_list_(NULL),
+      hand_(0) {
+  table_.Release_Store(NewTable(4));
+}
+
+ClockCache::~ClockCache() {
+  for (size_t i = 0; i < handles_.size(); i++) {
+    ClockHandle* e = handles_[i];
+    if ((e->refs & kDetached) == 0) {
+      assert(e->refs == 0);  // Error if caller has an unreleased handle
+      (*e->deleter)(e->key(), e->value);
+    }
+    delete[] e->key_data;
+    delete e;
+  }
+  for (size_t i = 0; i < retired_.size(); i++) {
+    free(retired_[i]);
+  }
+  free(table());
+}
+
+ClockTable* ClockCache::NewTable(uint32_t length) {
+  ClockTable* t = reinterpret_cast<ClockTable*>(
+      malloc(sizeof(ClockTable) + sizeof(port::AtomicPointer) * (length - 1)));
+  t->length = length;
+  for (uint32_t i = 0; i < length; i++) {
+    t->list[i].NoBarrier_Store(NULL);
+  }
+  return t;
+}
+
+Cache::Handle* ClockCache::Lookup(const Slice& key, uint32_t hash) {
+  ClockTable* t = table();
+  ClockHandle* e = reinterpret_cast<ClockHandle*>(
+      t->list[hash & (t->length - 1)].Acquire_Load());
+  for (int probes = 0; e != NULL && probes < kMaxProbes; probes++) {
+    if (e->hash == hash) {
+      // Pin before looking at the key.  A pinned handle that is still in
+      // the table can't be freed or reused, so its key is stable.
+      const uint32_t refs = __sync_add_and_fetch(&e->refs, 1);
+      if ((refs & kDetached) == 0 && e->hash == hash && key == e->key()) {
+        if (!e->referenced) {
+          e->referenced = true;
+        }
+        return reinterpret_cast<Cache::Handle*>(e);
+      }
+      Unref(e);
+    }
+    e = reinterpret_cast<ClockHandle*>(e->next_hash.Acquire_Load());
+  }
+  return NULL;
+}
+
+void ClockCache::Release(Cache::Handle* handle) {
+  Unref(reinterpret_cast<ClockHandle*>(handle));
+}
+
+void ClockCache::Unref(ClockHandle* e) {
+  // Whoever drops the last reference to a detached handle frees it.  The
+  // compare-and-swap settles races with readers that pinned it briefly.
+  if (__sync_sub_and_fetch(&e->refs, 1) == kDetached &&
+      __sync_bool_compare_and_swap(&e->refs, kDetached, kDetached | kFreed)) {
+    MutexLock l(&mutex_);
+    Free(e);
+  }
+}
+
+port::AtomicPointer* ClockCache::FindPointer(const Slice& key, uint32_t hash) {
+  ClockTable* t = table();
+  port::AtomicPointer* ptr = &t->list[hash & (t->length - 1)];
+  ClockHandle* e;
+  while ((e = reinterpret_cast<ClockHandle*>(ptr->NoBarrier_Load())) != NULL &&
+         (e->hash != hash || key != e->key())) {
+    ptr = &e->next_hash;
+  }
+  return ptr;
+}
+
+ClockHandle* ClockCache::Remove(const Slice& key, uint32_t hash) {
+  port::AtomicPointer* ptr = FindPointer(key, hash);
+  ClockHandle* e = reinterpret_cast<ClockHandle*>(ptr->NoBarrier_Load());
+  if (e != NULL) {
+    // The removed handle keeps its successor so that a reader standing on
+    // it can continue down the chain.
+    ptr->Release_Store(e->next_hash.NoBarrier_Load());
+    --elems_;
+  }
+  return e;
+}
+
+void ClockCache::Detach(ClockHandle* e) {
+  if (__sync_add_and_fetch(&e->refs, kDetached) == kDetached &&
+      __sync_bool_compare_and_swap(&e->refs, kDetached, kDetached | kFreed)) {
+    Free(e);
+  }
+}
+
+void ClockCache::Free(ClockHandle* e) {
+  usage_ -= e->charge;
+  (*e->deleter)(e->key(), e->value);
+  e->next_free = free_list_;
+  free_list_ = e;
+}
+
+void ClockCache::Resize() {
+  ClockTable* old = table();
+  uint32_t new_length = 4;
+  while (new_length < elems_) {
+    new_length *= 2;
+  }
+  ClockTable* t = NewTable(new_length);
+  for (uint32_t i = 0; i < old->length; i++) {
+    ClockHandle* e = reinterpret_cast<ClockHandle*>(old->list[i].NoBarrier_Load());
+    while (e != NULL) {
+      ClockHandle* next = reinterpret_cast<ClockHandle*>(e->next_hash.NoBarrier_Load());
+      port::AtomicPointer* ptr = &t->list[e->hash & (new_length - 1)];
+      e->next_hash.Release_Store(ptr->NoBarrier_Load());
+      ptr->NoBarrier_Store(e);
+      e = next;
+    }
+  }
+  table_.Release_Store(t);
+  retired_.push_back(old);
+}
+
+void ClockCache::EvictToCapacity() {
+  // Two full sweeps without finding a victim means every entry is pinned.
+  // The shard then stays over capacity until handles are released.
+  for (size_t steps = 0; usage_ > capacity_ && steps < 2 * handles_.size();
+       steps++) {
+    ClockHandle* e = handles_[hand_];
+    hand_ = (hand_ + 1) % handles_.size();
+    if (e->refs != 0) {
+      continue;  // Pinned by a caller or not in the table
+    }
+    if (e->referenced) {
+      e->referenced = false;
+      continue;
+    }
+    Remove(e->key(), e->hash);
+    Detach(e);
+  }
+}
+
+Cache::Handle* ClockCache::Insert(
+    const Slice& key, uint32_t hash, void* value, size_t charge,
+    void (*deleter)(const Slice& key, void* value)) {
+  MutexLock l(&mutex_);
+
+  ClockHandle* old = Remove(key, hash);
+  if (old != NULL) {
+    Detach(old);
+  }
+
+  ClockHandle* e = free_list_;
+  if (e != NULL) {
+    free_list_ = e->next_free;
+  } else {
+    e = new ClockHandle;
+    e->next_hash.NoBarrier_Store(NULL);
+    e->key_data = NULL;
+    e->key_capacity = 0;
+    e->refs = kDetached | kFreed;
+    handles_.push_back(e);
+  }
+
+  // The handle is detached, so no reader looks at its fields until the
+  // state bits are cleared below.
+  if (e->key_capacity < key.size()) {
+    delete[] e->key_data;
+    e->key_data = new char[key.size()];
+    e->key_capacity = key.size();
+  }
+  memcpy(e->key_data, key.data(), key.size());
+  e->key_length = key.size();
+  e->value = value;
+  e->deleter = deleter;
+  e->charge = charge;
+  e->hash = hash;
+  e->referenced = false;
+
+  // Take the reference for the returned handle and then publish it.
+  // Readers that pinned the old incarnation keep their counts.
+  __sync_add_and_fetch(&e->refs, 1);
+  __sync_sub_and_fetch(&e->refs, kDetached | kFreed);
+  usage_ += charge;
+
+  port::AtomicPointer* head = &table()->list[hash & (table()->length - 1)];
+  e->next_hash.Release_Store(head->NoBarrier_Load());
+  head->Release_Store(e);
+  if (++elems_ > table()->length) {
+    // Since each cache entry is fairly large, we aim for a small
+    // average linked list length (<= 1).
+    Resize();
+  }
+
+  EvictToCapacity();
+  return reinterpret_cast<Cache::Handle*>(e);
+}
+
+void ClockCache::Erase(const Slice& key, uint32_t hash) {
+  MutexLock l(&mutex_);
+  ClockHandle* e = Remove(key, hash);
+  if (e != NULL) {
+    Detach(e);
+  }
+}
+
+void ClockCache::VisitEntries(void (*visitor)(void*, const Slice&, void*),
+                              void* arg) {
+  MutexLock l(&mutex_);
+  for (size_t i = 0; i < handles_.size(); i++) {
+    ClockHandle* e = handles_[i];
+    if ((e->refs & kDetached) == 0) {
+      (*visitor)(arg, e->key(), e->value);
+    }
+  }
+}
+
+static const int kMaxClockShardBits = 16;
+
+class ShardedClockCache : public Cache {
+ private:
+  ClockCache* shard_;
+  const int num_shard_bits_;
+  port::Mutex id_mutex_;
+  uint64_t last_id_;
+
+  static inline uint32_t HashSlice(const Slice& s) {
+    return Hash(s.data(), s.size(), 0);
+  }
+
+  uint32_t Shard(uint32_t hash) const {
+    return num_shard_bits_ > 0 ? hash >> (32 - num_shard_bits_) : 0;
+  }
+
+ public:
+  ShardedClockCache(size_t capacity, int num_shard_bits)
+      : num_shard_bits_(num_shard_bits), last_id_(0) {
+    const int num_shards = 1 << num_shard_bits_;
+    const size_t per_shard = (capacity + (num_shards - 1)) / num_shards;
+    shard_ = new ClockCache[num_shards];
+    for (int s = 0; s < num_shards; s++) {
+      shard_[s].SetCapacity(per_shard);
+    }
+  }
+  virtual ~ShardedClockCache() {
+    delete[] shard_;
+  }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter);
+  }
+  virtual Handle* Lookup(const Slice& key) {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].Lookup(key, hash);
+  }
+  virtual void Release(Handle* handle) {
+    ClockHandle* h = reinterpret_cast<ClockHandle*>(handle);
+    shard_[Shard(h->hash)].Release(handle);
+  }
+  virtual void Erase(const Slice& key) {
+    const uint32_t hash = HashSlice(key);
+    shard_[Shard(hash)].Erase(key, hash);
+  }
+  virtual void* Value(Handle* handle) {
+    return reinterpret_cast<ClockHandle*>(handle)->value;
+  }
+  virtual uint64_t NewId() {
+    MutexLock l(&id_mutex_);
+    return ++(last_id_);
+  }
+  virtual void VisitEntries(
+      void (*visitor)(void* arg, const Slice& key, void* value), void* arg) {
+    const int num_shards = 1 << num_shard_bits_;
+    for (int s = 0; s < num_shards; s++) {
+      shard_[s].VisitEntries(visitor, arg);
+    }
+  }
 };
 
 }  // end anonymous namespace
 
 Cache* NewLRUCache(size_t capacity) {
-  return new ShardedLRUCache(capacity);
+  return new ShardedLRUCache(capacity, 0);
+}
+
+Cache* NewScanResistantLRUCache(size_t capacity) {
+  return new ShardedLRUCache(capacity, kProtectedPercent);
+}
+
+Cache* NewClockCache(size_t capacity, int num_shard_bits) {
+  if (num_shard_bits < 0) {
+    num_shard_bits = 0;
+  } else if (num_shard_bits > kMaxClockShardBits) {
+    num_shard_bits = kMaxClockShardBits;
+  }
+  return new ShardedClockCache(capacity, num_shard_bits);
 }
 
 }  // namespace leveldb
@@ -5,7 +5,10 @@
 #include "leveldb/cache.h"
 
 #include <vector>
+#include "leveldb/env.h"
+#include "port/port.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
 #include "util/testharness.h"
 
 namespace leveldb {
@@ -173,6 +176,158 @@ TEST(CacheTest, HeavyEntries) {
   ASSERT_LE(cached_weight, kCacheSize + kCacheSize/10);
 }
 
+TEST(CacheTest, ScanResistance) {
+  delete cache_;
+  cache_ = NewScanResistantLRUCache(kCacheSize);
+
+  // Entries that are looked up again are protected from a scan that
+  // inserts many entries once.
+  for (int i = 0; i < 100; i++) {
+    Insert(i, 1000+i);
+    ASSERT_EQ(1000+i, Lookup(i));
+  }
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    Insert(10000+i, 20000+i);
+  }
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(1000+i, Lookup(i));
+  }
+  ASSERT_EQ(-1, Lookup(10000));
+  ASSERT_EQ(20000 + 10 * kCacheSize - 1, Lookup(10000 + 10 * kCacheSize - 1));
+}
+
+TEST(CacheTest, ClockHitMissAndPinning) {
+  delete cache_;
+  cache_ = NewClockCache(kCacheSize, 2);
+
+  ASSERT_EQ(-1, Lookup(100));
+  Insert(100, 101);
+  Insert(200, 201);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  Cache::Handle* h1 = cache_->Lookup(EncodeKey(100));
+  Insert(100, 102);
+  ASSERT_EQ(102, Lookup(100));
+  ASSERT_EQ(0, deleted_keys_.size());
+  cache_->Release(h1);
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(101, deleted_values_[0]);
+
+  Erase(200);
+  ASSERT_EQ(-1, Lookup(200));
+  ASSERT_EQ(2, deleted_keys_.size());
+  ASSERT_EQ(201, deleted_values_[1]);
+
+  // Freed handles are reused for new keys.
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    Insert(1000+i, 2000+i);
+    ASSERT_EQ(2000+i, Lookup(1000+i));
+  }
+}
+
+TEST(CacheTest, ClockEvictionPolicy) {
+  delete cache_;
+  cache_ = NewClockCache(kCacheSize, 0);
+
+  Insert(100, 101);
+  Insert(200, 201);
+
+  // An entry read between sweeps of the clock hand is kept around
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    Insert(1000+i, 2000+i);
+    ASSERT_EQ(101, Lookup(100));
+  }
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+}
+
+TEST(CacheTest, ClockHeavyEntries) {
+  delete cache_;
+  cache_ = NewClockCache(kCacheSize, 4);
+
+  int added = 0;
+  int index = 0;
+  while (added < 2*kCacheSize) {
+    const int weight = (index & 1) ? 1 : 10;
+    Insert(index, 1000+index, weight);
+    added += weight;
+    index++;
+  }
+  int cached_weight = 0;
+  for (int i = 0; i < index; i++) {
+    int r = Lookup(i);
+    if (r >= 0) {
+      cached_weight += (i & 1) ? 1 : 10;
+      ASSERT_EQ(1000+i, r);
+    }
+  }
+  ASSERT_LE(cached_weight, kCacheSize + kCacheSize/10);
+}
+
+namespace {
+
+struct ClockThreadState {
+  Cache* cache;
+  int id;
+  port::Mutex mu;
+  int done;
+  bool ok;
+};
+
+static void NoopDeleter(const Slice& key, void* v) {
+}
+
+static void ClockThreadBody(void* arg) {
+  ClockThreadState* state = reinterpret_cast<ClockThreadState*>(arg);
+  bool ok = true;
+  int id;
+  {
+    MutexLock l(&state->mu);
+    id = state->id++;
+  }
+  for (int i = 0; i < 20000; i++) {
+    const int k = (i * 7 + id) % 300;
+    Cache::Handle* h = state->cache->Lookup(EncodeKey(k));
+    if (h == NULL) {
+      h = state->cache->Insert(EncodeKey(k), EncodeValue(k + 1000), 1,
+                               &NoopDeleter);
+    }
+    if (DecodeValue(state->cache->Value(h)) != k + 1000) {
+      ok = false;
+    }
+    state->cache->Release(h);
+  }
+  MutexLock l(&state->mu);
+  state->done++;
+  state->ok = state->ok && ok;
+}
+
+}  // namespace
+
+TEST(CacheTest, ClockConcurrentLookups) {
+  const int kThreads = 8;
+  ClockThreadState state;
+  state.cache = NewClockCache(100, 2);
+  state.id = 0;
+  state.done = 0;
+  state.ok = true;
+  for (int i = 0; i < kThreads; i++) {
+    Env::Default()->StartThread(&ClockThreadBody, &state);
+  }
+  while (true) {
+    {
+      MutexLock l(&state.mu);
+      if (state.done == kThreads) {
+        break;
+      }
+    }
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  ASSERT_TRUE(state.ok);
+  delete state.cache;
+}
+
 TEST(CacheTest, NewId) {
   uint64_t a = cache_->NewId();
   uint64_t b = cache_->NewId();
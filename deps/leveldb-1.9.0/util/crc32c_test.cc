@@ -56,6 +56,24 @@ TEST(CRC, Extend) {
             Extend(Value("hello ", 6), "world", 5));
 }
 
+TEST(CRC, LargeBuffers) {
+  // Large enough to be split into streams of every length, and read from
+  // an unaligned start so the leading bytes are handled separately.
+  std::string data(100001, '\0');
+  for (size_t i = 0; i < data.size() - 1; i++) {
+    data[i + 1] = static_cast<char>((i * 7) % 251);
+  }
+  const char* buf = data.data() + 1;
+  const size_t n = data.size() - 1;
+  ASSERT_EQ(0xef3b5935, Value(buf, n));
+
+  const size_t splits[] = { 1, 7, 255, 769, 8193, 24577, 50000, 99999 };
+  for (size_t i = 0; i < sizeof(splits) / sizeof(splits[0]); i++) {
+    ASSERT_EQ(0xef3b5935,
+              Extend(Value(buf, splits[i]), buf + splits[i], n - splits[i]));
+  }
+}
+
 TEST(CRC, Mask) {
   uint32_t crc = Value("foo", 3);
   ASSERT_NE(crc, Mask(crc));
@@ -9,12 +9,57 @@ namespace leveldb {
 Env::~Env() {
 }
 
+Status Env::NewBackgroundWritableFile(const std::string& fname,
+                                     WritableFile** result) {
+  return NewWritableFile(fname, result);
+}
+
+Status Env::NewDirectRandomAccessFile(const std::string& fname,
+                                     RandomAccessFile** result) {
+  return NewRandomAccessFile(fname, result);
+}
+
+Status Env::NewDirectWritableFile(const std::string& fname,
+                                 WritableFile** result) {
+  return NewBackgroundWritableFile(fname, result);
+}
+
+void Env::SetBackgroundThreads(int n) {
+}
+
+void Env::ScheduleFlush(void (*function)(void*), void* arg) {
+  Schedule(function, arg);
+}
+
+void Env::SetFlushThreads(int n) {
+}
+
+void Env::SetBytesPerSync(uint64_t bytes) {
+}
+
+void Env::SetUseMmapWrites(bool use_mmap) {
+}
+
+void Env::SetMmapLimit(int n) {
+}
+
+void Env::SetWriteRateLimits(uint64_t foreground_bytes_per_second,
+                             uint64_t background_bytes_per_second) {
+}
+
+Status Env::LinkFile(const std::string& src, const std::string& target) {
+  return Status::NotSupported("LinkFile", src);
+}
+
 SequentialFile::~SequentialFile() {
 }
 
 RandomAccessFile::~RandomAccessFile() {
 }
 
+void RandomAccessFile::Readahead(uint64_t offset, size_t n) const {
+}
+
 WritableFile::~WritableFile() {
 }
 
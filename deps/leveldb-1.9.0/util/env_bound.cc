@@ -0,0 +1,182 @@
+// Copyright (c) 2013 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <deque>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#if defined(OS_LINUX)
+#include <sys/syscall.h>
+#endif
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+
+#if defined(OS_LINUX)
+// From <numaif.h>, which would add a dependency on libnuma.
+static const int kPreferredPolicy = 1;  // MPOL_PREFERRED
+#endif
+
+// Binds the calling thread to a set of CPUs and, if "node" is not
+// negative, makes it prefer memory from that node.  Both are hints:
+// failures leave the thread where the scheduler put it.
+static void BindCurrentThread(const std::vector<int>& cpus, int node) {
+#if defined(OS_LINUX)
+  if (!cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < cpus.size(); i++) {
+      if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE) CPU_SET(cpus[i], &set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+  if (node >= 0 && node < 64) {
+    unsigned long mask = 1UL << node;
+    syscall(SYS_set_mempolicy, kPreferredPolicy, &mask, 64);
+  }
+#else
+  (void)cpus;
+  (void)node;
+#endif
+}
+
+class BoundEnv : public EnvWrapper {
+ public:
+  BoundEnv(Env* base, const std::vector<int>& cpus, int node);
+  virtual ~BoundEnv();
+
+  // The file calls that EnvWrapper routes through NewWritableFile() are
+  // forwarded as they are since this Env only changes where work runs.
+  virtual Status NewBackgroundWritableFile(const std::string& f,
+                                           WritableFile** r) {
+    return target()->NewBackgroundWritableFile(f, r);
+  }
+  virtual Status NewDirectRandomAccessFile(const std::string& f,
+                                           RandomAccessFile** r) {
+    return target()->NewDirectRandomAccessFile(f, r);
+  }
+  virtual Status NewDirectWritableFile(const std::string& f,
+                                       WritableFile** r) {
+    return target()->NewDirectWritableFile(f, r);
+  }
+
+  virtual void Schedule(void (*function)(void*), void* arg) {
+    SchedulePool(&bg_pool_, function, arg);
+  }
+  virtual void SetBackgroundThreads(int n) { SetPoolThreads(&bg_pool_, n); }
+  virtual void ScheduleFlush(void (*function)(void*), void* arg) {
+    SchedulePool(&flush_pool_, function, arg);
+  }
+  virtual void SetFlushThreads(int n) { SetPoolThreads(&flush_pool_, n); }
+
+ private:
+  struct Item { void* arg; void (*function)(void*); };
+
+  // A FIFO queue of work items and the threads that run them.  The
+  // threads of both pools share mu_.
+  struct Pool {
+    BoundEnv* env;
+    port::CondVar signal;
+    int threads;
+    std::vector<pthread_t> started;
+    std::deque<Item> queue;
+    explicit Pool(BoundEnv* e, port::Mutex* mu)
+        : env(e), signal(mu), threads(1) { }
+  };
+
+  void SchedulePool(Pool* pool, void (*function)(void*), void* arg);
+  void SetPoolThreads(Pool* pool, int n);
+  void Run(Pool* pool);
+  static void* RunWrapper(void* arg) {
+    Pool* pool = reinterpret_cast<Pool*>(arg);
+    pool->env->Run(pool);
+    return NULL;
+  }
+
+  const std::vector<int> cpus_;
+  const int node_;
+  port::Mutex mu_;
+  bool shutting_down_;
+  Pool bg_pool_;
+  Pool flush_pool_;
+};
+
+BoundEnv::BoundEnv(Env* base, const std::vector<int>& cpus, int node)
+    : EnvWrapper(base),
+      cpus_(cpus),
+      node_(node),
+      shutting_down_(false),
+      bg_pool_(this, &mu_),
+      flush_pool_(this, &mu_) {
+}
+
+BoundEnv::~BoundEnv() {
+  mu_.Lock();
+  shutting_down_ = true;
+  bg_pool_.signal.SignalAll();
+  flush_pool_.signal.SignalAll();
+  mu_.Unlock();
+  Pool* pools[] = { &bg_pool_, &flush_pool_ };
+  for (int i = 0; i < 2; i++) {
+    for (size_t j = 0; j < pools[i]->started.size(); j++) {
+      pthread_join(pools[i]->started[j], NULL);
+    }
+  }
+}
+
+void BoundEnv::SchedulePool(Pool* pool, void (*function)(void*), void* arg) {
+  MutexLock l(&mu_);
+
+  // Start threads if necessary
+  while (static_cast<int>(pool->started.size()) < pool->threads) {
+    pthread_t t;
+    if (pthread_create(&t, NULL, &BoundEnv::RunWrapper, pool) != 0) {
+      break;
+    }
+    pool->started.push_back(t);
+  }
+
+  pool->queue.push_back(Item());
+  pool->queue.back().function = function;
+  pool->queue.back().arg = arg;
+  pool->signal.Signal();
+}
+
+void BoundEnv::SetPoolThreads(Pool* pool, int n) {
+  MutexLock l(&mu_);
+  if (n > pool->threads) {
+    pool->threads = n;
+  }
+}
+
+void BoundEnv::Run(Pool* pool) {
+  BindCurrentThread(cpus_, node_);
+  mu_.Lock();
+  while (true) {
+    while (pool->queue.empty() && !shutting_down_) {
+      pool->signal.Wait();
+    }
+    if (pool->queue.empty()) {
+      break;
+    }
+    Item item = pool->queue.front();
+    pool->queue.pop_front();
+    mu_.Unlock();
+    (*item.function)(item.arg);
+    mu_.Lock();
+  }
+  mu_.Unlock();
+}
+
+}  // namespace
+
+Env* NewBoundEnv(Env* base, const std::vector<int>& cpus, int node) {
+  return new BoundEnv(base, cpus, node);
+}
+
+}  // namespace leveldb
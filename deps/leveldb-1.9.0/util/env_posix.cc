@@ -26,6 +26,7 @@
 #include "util/logging.h"
 #include "util/mutexlock.h"
 #include "util/posix_logger.h"
+#include "util/rate_limiter.h"
 
 namespace leveldb {
 
@@ -35,6 +36,24 @@ static Status IOError(const std::string& context, int err_number) {
   return Status::IOError(context, strerror(err_number));
 }
 
+// Allocate disk space for [offset,offset+len) of a file being written
+// without changing its size, so that it is laid out contiguously.  This is
+// only a hint and failures are ignored.
+static void Preallocate(int fd, uint64_t offset, uint64_t len) {
+#if defined(OS_LINUX)
+  fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, len);
+#endif
+}
+
+// Start writing back [offset,offset+nbytes) of a file without waiting, so
+// that the final sync of a large file has little left to write and does
+// not stall the disk.  This is only a hint and failures are ignored.
+static void RangeSync(int fd, uint64_t offset, uint64_t nbytes) {
+#if defined(OS_LINUX)
+  sync_file_range(fd, offset, nbytes, SYNC_FILE_RANGE_WRITE);
+#endif
+}
+
 class PosixSequentialFile: public SequentialFile {
  private:
   std::string filename_;
@@ -90,6 +109,12 @@ class PosixRandomAccessFile: public RandomAccessFile {
     }
     return s;
   }
+
+  virtual void Readahead(uint64_t offset, size_t n) const {
+#if defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(fd_, static_cast<off_t>(offset), n, POSIX_FADV_WILLNEED);
+#endif
+  }
 };
 
 // Helper class to limit mmap file usage so that we do not end up
@@ -97,9 +122,19 @@ class PosixRandomAccessFile: public RandomAccessFile {
 // problems for very large databases.
 class MmapLimiter {
  public:
-  // Up to 1000 mmaps for 64-bit binaries; none for smaller pointer sizes.
-  MmapLimiter() {
-    SetAllowed(sizeof(void*) >= 8 ? 1000 : 0);
+  // Any number of mmaps for 64-bit binaries, which have the address space
+  // for every table; none for smaller pointer sizes.
+  MmapLimiter() : limit_(sizeof(void*) >= 8 ? kUnlimited : 0) {
+    SetAllowed(limit_);
+  }
+
+  // Allow up to "n" mmaps at once, or any number if "n" is negative.
+  // Slots that are already acquired count against the new limit.
+  void SetLimit(int n) {
+    MutexLock l(&mu_);
+    const intptr_t limit = (n < 0 ? kUnlimited : n);
+    SetAllowed(GetAllowed() + (limit - limit_));
+    limit_ = limit;
   }
 
   // If another mmap slot is available, acquire it and return true.
@@ -125,8 +160,13 @@ class MmapLimiter {
   }
 
  private:
+  // Large enough never to run out, small enough not to overflow.
+  static const intptr_t kUnlimited =
+      static_cast<intptr_t>(1) << (sizeof(intptr_t) * 8 - 2);
+
   port::Mutex mu_;
   port::AtomicPointer allowed_;
+  intptr_t limit_;  // Protected by mu_
 
   intptr_t GetAllowed() const {
     return reinterpret_cast<intptr_t>(allowed_.Acquire_Load());
@@ -141,6 +181,8 @@ class MmapLimiter {
   void operator=(const MmapLimiter&);
 };
 
+const intptr_t MmapLimiter::kUnlimited;
+
 // mmap() based random-access
 class PosixMmapReadableFile: public RandomAccessFile {
  private:
@@ -173,6 +215,20 @@ class PosixMmapReadableFile: public RandomAccessFile {
     }
     return s;
   }
+
+  virtual void Readahead(uint64_t offset, size_t n) const {
+    if (offset >= length_) {
+      return;
+    }
+    if (n > length_ - offset) {
+      n = length_ - offset;
+    }
+    // madvise() needs a page aligned address.
+    const uint64_t page = static_cast<uint64_t>(getpagesize());
+    const uint64_t start = offset - offset % page;
+    madvise(reinterpret_cast<char*>(mmapped_region_) + start,
+            n + (offset - start), MADV_WILLNEED);
+  }
 };
 
 // We preallocate up to an extra megabyte and use memcpy to append new
@@ -190,6 +246,9 @@ class PosixMmapFile : public WritableFile {
   char* dst_;             // Where to write next  (in range [base_,limit_])
   char* last_sync_;       // Where have we synced up to
   uint64_t file_offset_;  // Offset of base_ in file
+  RateLimiter* limiter_;  // Write budget this file draws on
+  uint64_t bytes_per_sync_;  // Start writeback this often (0 for never)
+  uint64_t range_synced_;    // Offset that RangeSync() has reached
 
   // Have we done an munmap of unsynced data?
   bool pending_sync_;
@@ -231,6 +290,7 @@ class PosixMmapFile : public WritableFile {
 
   bool MapNewRegion() {
     assert(base_ == NULL);
+    Preallocate(fd_, file_offset_, map_size_);
     if (ftruncate(fd_, file_offset_ + map_size_) < 0) {
       return false;
     }
@@ -247,7 +307,8 @@ class PosixMmapFile : public WritableFile {
   }
 
  public:
-  PosixMmapFile(const std::string& fname, int fd, size_t page_size)
+  PosixMmapFile(const std::string& fname, int fd, size_t page_size,
+                RateLimiter* limiter, uint64_t bytes_per_sync)
       : filename_(fname),
         fd_(fd),
         page_size_(page_size),
@@ -257,6 +318,9 @@ class PosixMmapFile : public WritableFile {
         dst_(NULL),
         last_sync_(NULL),
         file_offset_(0),
+        limiter_(limiter),
+        bytes_per_sync_(bytes_per_sync),
+        range_synced_(0),
         pending_sync_(false) {
     assert((page_size & (page_size - 1)) == 0);
   }
@@ -269,6 +333,7 @@ class PosixMmapFile : public WritableFile {
   }
 
   virtual Status Append(const Slice& data) {
+    limiter_->Request(data.size());
     const char* src = data.data();
     size_t left = data.size();
     while (left > 0) {
@@ -288,6 +353,12 @@ class PosixMmapFile : public WritableFile {
       src += n;
       left -= n;
     }
+
+    const uint64_t offset = file_offset_ + (dst_ - base_);
+    if (bytes_per_sync_ > 0 && offset - range_synced_ >= bytes_per_sync_) {
+      RangeSync(fd_, range_synced_, offset - range_synced_);
+      range_synced_ = offset;
+    }
     return Status::OK();
   }
 
@@ -345,6 +416,300 @@ class PosixMmapFile : public WritableFile {
   }
 };
 
+// pwrite() based writes through a buffer.  Used instead of PosixMmapFile
+// when mmap writes are disabled; the data goes through the page cache the
+// same way but without page faults or a growing mapping.
+class PosixWritableFile : public WritableFile {
+ private:
+  static const size_t kBufferSize = 65536;
+  static const uint64_t kPreallocateSize = 1 << 20;
+
+  std::string filename_;
+  int fd_;
+  std::string buf_;          // Appended data not yet written to fd_
+  uint64_t file_offset_;     // Bytes written to fd_
+  uint64_t preallocated_;    // Bytes allocated with Preallocate()
+  RateLimiter* limiter_;     // Write budget this file draws on
+  uint64_t bytes_per_sync_;  // Start writeback this often (0 for never)
+  uint64_t range_synced_;    // Offset that RangeSync() has reached
+
+  Status WriteRaw(const char* data, size_t n) {
+    if (file_offset_ + n > preallocated_) {
+      const uint64_t end = file_offset_ + n + kPreallocateSize;
+      Preallocate(fd_, preallocated_, end - preallocated_);
+      preallocated_ = end;
+    }
+    while (n > 0) {
+      ssize_t r = pwrite(fd_, data, n, static_cast<off_t>(file_offset_));
+      if (r < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return IOError(filename_, errno);
+      }
+      data += r;
+      n -= r;
+      file_offset_ += r;
+    }
+    if (bytes_per_sync_ > 0 &&
+        file_offset_ - range_synced_ >= bytes_per_sync_) {
+      RangeSync(fd_, range_synced_, file_offset_ - range_synced_);
+      range_synced_ = file_offset_;
+    }
+    return Status::OK();
+  }
+
+ public:
+  PosixWritableFile(const std::string& fname, int fd, RateLimiter* limiter,
+                    uint64_t bytes_per_sync)
+      : filename_(fname),
+        fd_(fd),
+        file_offset_(0),
+        preallocated_(0),
+        limiter_(limiter),
+        bytes_per_sync_(bytes_per_sync),
+        range_synced_(0) {
+  }
+
+  ~PosixWritableFile() {
+    if (fd_ >= 0) {
+      PosixWritableFile::Close();
+    }
+  }
+
+  virtual Status Append(const Slice& data) {
+    limiter_->Request(data.size());
+    if (buf_.size() + data.size() > kBufferSize) {
+      Status s = Flush();
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    if (data.size() >= kBufferSize) {
+      return WriteRaw(data.data(), data.size());
+    }
+    buf_.append(data.data(), data.size());
+    return Status::OK();
+  }
+
+  virtual Status Close() {
+    Status s = Flush();
+    // Release the space preallocated past the end of the file
+    if (s.ok() && preallocated_ > file_offset_ &&
+        ftruncate(fd_, file_offset_) < 0) {
+      s = IOError(filename_, errno);
+    }
+    if (close(fd_) < 0) {
+      if (s.ok()) {
+        s = IOError(filename_, errno);
+      }
+    }
+    fd_ = -1;
+    return s;
+  }
+
+  virtual Status Flush() {
+    Status s;
+    if (!buf_.empty()) {
+      s = WriteRaw(buf_.data(), buf_.size());
+      buf_.clear();
+    }
+    return s;
+  }
+
+  virtual Status Sync() {
+    Status s = Flush();
+    if (s.ok() && fdatasync(fd_) < 0) {
+      s = IOError(filename_, errno);
+    }
+    return s;
+  }
+};
+
+#if defined(O_DIRECT)
+// Direct I/O needs the file offset, the length and the memory of every
+// read and write aligned to the logical block size of the device.
+static const size_t kDirectIOAlignment = 4096;
+
+static uint64_t AlignUp(uint64_t x) {
+  return (x + kDirectIOAlignment - 1) & ~(kDirectIOAlignment - 1);
+}
+
+static char* NewAlignedBuffer(size_t n) {
+  void* ptr;
+  if (posix_memalign(&ptr, kDirectIOAlignment, n) != 0) {
+    return NULL;
+  }
+  return reinterpret_cast<char*>(ptr);
+}
+
+// pread() based random-access that bypasses the page cache.  Each read is
+// widened to aligned boundaries and goes through a temporary aligned
+// buffer, so callers should read in large pieces.
+class PosixDirectRandomAccessFile: public RandomAccessFile {
+ private:
+  std::string filename_;
+  int fd_;
+
+ public:
+  PosixDirectRandomAccessFile(const std::string& fname, int fd)
+      : filename_(fname), fd_(fd) { }
+  virtual ~PosixDirectRandomAccessFile() { close(fd_); }
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const {
+    const uint64_t start = offset & ~(kDirectIOAlignment - 1);
+    const size_t skip = offset - start;
+    const size_t len = AlignUp(offset + n) - start;
+    char* buf = NewAlignedBuffer(len);
+    if (buf == NULL) {
+      *result = Slice();
+      return IOError(filename_, ENOMEM);
+    }
+    Status s;
+    ssize_t r;
+    do {
+      r = pread(fd_, buf, len, static_cast<off_t>(start));
+    } while (r < 0 && errno == EINTR);
+    size_t avail = 0;
+    if (r < 0) {
+      // An error: return a non-ok status
+      s = IOError(filename_, errno);
+    } else if (static_cast<size_t>(r) > skip) {
+      // A short read means the end of the file
+      avail = static_cast<size_t>(r) - skip;
+      if (avail > n) {
+        avail = n;
+      }
+      memcpy(scratch, buf + skip, avail);
+    }
+    free(buf);
+    *result = Slice(scratch, avail);
+    return s;
+  }
+};
+
+// pwrite() based writes that bypass the page cache.  Data is written in
+// aligned pieces from an aligned buffer; the partial piece at the end is
+// written padded by Sync() and Close(), and Close() trims the padding.
+class PosixDirectWritableFile : public WritableFile {
+ private:
+  static const size_t kBufferSize = 1 << 20;
+
+  std::string filename_;
+  int fd_;
+  char* buf_;              // kBufferSize aligned bytes
+  size_t buf_len_;         // Bytes of buf_ holding data
+  uint64_t buf_offset_;    // File offset of buf_[0], always aligned
+  uint64_t preallocated_;  // Bytes allocated with Preallocate()
+  RateLimiter* limiter_;   // Write budget this file draws on
+
+  // Write buf_ to the file, padding the last piece to the alignment.
+  Status WriteBuffer() {
+    const size_t len = AlignUp(buf_len_);
+    memset(buf_ + buf_len_, 0, len - buf_len_);
+    if (buf_offset_ + len > preallocated_) {
+      const uint64_t end = buf_offset_ + len + kBufferSize;
+      Preallocate(fd_, preallocated_, end - preallocated_);
+      preallocated_ = end;
+    }
+    size_t done = 0;
+    while (done < len) {
+      ssize_t r = pwrite(fd_, buf_ + done, len - done,
+                         static_cast<off_t>(buf_offset_ + done));
+      if (r < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return IOError(filename_, errno);
+      }
+      done += r;
+    }
+    return Status::OK();
+  }
+
+ public:
+  PosixDirectWritableFile(const std::string& fname, int fd, char* buf,
+                          RateLimiter* limiter)
+      : filename_(fname),
+        fd_(fd),
+        buf_(buf),
+        buf_len_(0),
+        buf_offset_(0),
+        preallocated_(0),
+        limiter_(limiter) {
+  }
+
+  ~PosixDirectWritableFile() {
+    if (fd_ >= 0) {
+      PosixDirectWritableFile::Close();
+    }
+    free(buf_);
+  }
+
+  static size_t BufferSize() { return kBufferSize; }
+
+  virtual Status Append(const Slice& data) {
+    limiter_->Request(data.size());
+    const char* src = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+      size_t n = kBufferSize - buf_len_;
+      if (n > left) {
+        n = left;
+      }
+      memcpy(buf_ + buf_len_, src, n);
+      buf_len_ += n;
+      src += n;
+      left -= n;
+      if (buf_len_ == kBufferSize) {
+        Status s = WriteBuffer();
+        if (!s.ok()) {
+          return s;
+        }
+        buf_offset_ += kBufferSize;
+        buf_len_ = 0;
+      }
+    }
+    return Status::OK();
+  }
+
+  virtual Status Close() {
+    Status s;
+    if (buf_len_ > 0) {
+      s = WriteBuffer();
+    }
+    if (s.ok() && ftruncate(fd_, buf_offset_ + buf_len_) < 0) {
+      s = IOError(filename_, errno);
+    }
+    if (close(fd_) < 0) {
+      if (s.ok()) {
+        s = IOError(filename_, errno);
+      }
+    }
+    fd_ = -1;
+    return s;
+  }
+
+  virtual Status Flush() {
+    // A partial piece can only be written padded, so it waits for Sync()
+    return Status::OK();
+  }
+
+  virtual Status Sync() {
+    // The padded piece is written again once more data fills it
+    Status s;
+    if (buf_len_ > 0) {
+      s = WriteBuffer();
+    }
+    if (s.ok() && fdatasync(fd_) < 0) {
+      s = IOError(filename_, errno);
+    }
+    return s;
+  }
+};
+#endif  // defined(O_DIRECT)
+
 static int LockOrUnlock(int fd, bool lock) {
   errno = 0;
   struct flock f;
@@ -409,18 +774,27 @@ class PosixEnv : public Env {
       s = IOError(fname, errno);
     } else if (mmap_limit_.Acquire()) {
       uint64_t size;
+      void* base = MAP_FAILED;
       s = GetFileSize(fname, &size);
-      if (s.ok()) {
-        void* base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
-        if (base != MAP_FAILED) {
-          *result = new PosixMmapReadableFile(fname, base, size, &mmap_limit_);
-        } else {
-          s = IOError(fname, errno);
-        }
+      if (s.ok() && size > 0) {
+        base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
       }
-      close(fd);
-      if (!s.ok()) {
+      if (base != MAP_FAILED) {
+        // Point reads only touch the pages of their blocks, so faults
+        // shouldn't read around them.  Scans ask for the pages ahead of
+        // them through Readahead().
+        madvise(base, size, MADV_RANDOM);
+        *result = new PosixMmapReadableFile(fname, base, size, &mmap_limit_);
+        close(fd);
+      } else {
+        // Empty files can't be mapped, and mappings can run out before
+        // the limit does (e.g. at vm.max_map_count), so read with pread().
         mmap_limit_.Release();
+        if (s.ok()) {
+          *result = new PosixRandomAccessFile(fname, fd);
+        } else {
+          close(fd);
+        }
       }
     } else {
       *result = new PosixRandomAccessFile(fname, fd);
@@ -428,17 +802,52 @@ class PosixEnv : public Env {
     return s;
   }
 
-  virtual Status NewWritableFile(const std::string& fname,
-                                 WritableFile** result) {
-    Status s;
-    const int fd = open(fname.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
-    if (fd < 0) {
+  virtual Status NewDirectRandomAccessFile(const std::string& fname,
+                                           RandomAccessFile** result) {
+#if defined(O_DIRECT)
+    int fd = open(fname.c_str(), O_RDONLY | O_DIRECT);
+    if (fd >= 0) {
+      *result = new PosixDirectRandomAccessFile(fname, fd);
+      return Status::OK();
+    } else if (errno != EINVAL) {
       *result = NULL;
-      s = IOError(fname, errno);
-    } else {
-      *result = new PosixMmapFile(fname, fd, page_size_);
+      return IOError(fname, errno);
     }
-    return s;
+    // The file system does not support direct I/O
+#endif
+    return NewRandomAccessFile(fname, result);
+  }
+
+  virtual Status NewDirectWritableFile(const std::string& fname,
+                                       WritableFile** result) {
+#if defined(O_DIRECT)
+    int fd = open(fname.c_str(), O_CREAT | O_RDWR | O_TRUNC | O_DIRECT, 0644);
+    if (fd >= 0) {
+      char* buf = NewAlignedBuffer(PosixDirectWritableFile::BufferSize());
+      if (buf == NULL) {
+        close(fd);
+        *result = NULL;
+        return IOError(fname, ENOMEM);
+      }
+      *result = new PosixDirectWritableFile(fname, fd, buf, &background_limit_);
+      return Status::OK();
+    } else if (errno != EINVAL) {
+      *result = NULL;
+      return IOError(fname, errno);
+    }
+    // The file system does not support direct I/O
+#endif
+    return NewBackgroundWritableFile(fname, result);
+  }
+
+  virtual Status NewWritableFile(const std::string& fname,
+                                 WritableFile** result) {
+    return NewWriter(fname, &foreground_limit_, result);
+  }
+
+  virtual Status NewBackgroundWritableFile(const std::string& fname,
+                                           WritableFile** result) {
+    return NewWriter(fname, &background_limit_, result);
   }
 
   virtual bool FileExists(const std::string& fname) {
@@ -504,6 +913,14 @@ class PosixEnv : public Env {
     return result;
   }
 
+  virtual Status LinkFile(const std::string& src, const std::string& target) {
+    Status result;
+    if (link(src.c_str(), target.c_str()) != 0) {
+      result = IOError(src, errno);
+    }
+    return result;
+  }
+
   virtual Status LockFile(const std::string& fname, FileLock** lock) {
     *lock = NULL;
     Status result;
@@ -540,6 +957,8 @@ class PosixEnv : public Env {
 
   virtual void Schedule(void (*function)(void*), void* arg);
 
+  virtual void ScheduleFlush(void (*function)(void*), void* arg);
+
   virtual void StartThread(void (*function)(void* arg), void* arg);
 
   virtual Status GetTestDirectory(std::string* result) {
@@ -584,7 +1003,55 @@ class PosixEnv : public Env {
     usleep(micros);
   }
 
+  virtual void SetBackgroundThreads(int n);
+
+  virtual void SetFlushThreads(int n);
+
+  virtual void SetBytesPerSync(uint64_t bytes) {
+    PthreadCall("lock", pthread_mutex_lock(&mu_));
+    bytes_per_sync_ = bytes;
+    PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+  }
+
+  virtual void SetMmapLimit(int n) {
+    mmap_limit_.SetLimit(n);
+  }
+
+  virtual void SetUseMmapWrites(bool use_mmap) {
+    PthreadCall("lock", pthread_mutex_lock(&mu_));
+    use_mmap_writes_ = use_mmap;
+    PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+  }
+
+  virtual void SetWriteRateLimits(uint64_t foreground_bytes_per_second,
+                                  uint64_t background_bytes_per_second) {
+    foreground_limit_.SetRate(foreground_bytes_per_second);
+    background_limit_.SetRate(background_bytes_per_second);
+  }
+
  private:
+  Status NewWriter(const std::string& fname, RateLimiter* limiter,
+                   WritableFile** result) {
+    Status s;
+    const int fd = open(fname.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+      *result = NULL;
+      s = IOError(fname, errno);
+    } else {
+      PthreadCall("lock", pthread_mutex_lock(&mu_));
+      const uint64_t bytes_per_sync = bytes_per_sync_;
+      const bool use_mmap = use_mmap_writes_;
+      PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+      if (use_mmap) {
+        *result = new PosixMmapFile(fname, fd, page_size_, limiter,
+                                    bytes_per_sync);
+      } else {
+        *result = new PosixWritableFile(fname, fd, limiter, bytes_per_sync);
+      }
+    }
+    return s;
+  }
+
   void PthreadCall(const char* label, int result) {
     if (result != 0) {
       fprintf(stderr, "pthread %s: %s\n", label, strerror(result));
@@ -592,70 +1059,125 @@ class PosixEnv : public Env {
     }
   }
 
-  // BGThread() is the body of the background thread
-  void BGThread();
+  // Entry per Schedule() call
+  struct BGItem { void* arg; void (*function)(void*); };
+  typedef std::deque<BGItem> BGQueue;
+
+  // A FIFO queue of work items and the threads that run them.  The
+  // threads of every pool share mu_.
+  struct BGPool {
+    PosixEnv* env;
+    pthread_cond_t signal;
+    int threads;          // Threads requested for the pool
+    int started_threads;  // Threads actually running (grows lazily)
+    BGQueue queue;
+  };
+
+  void InitPool(BGPool* pool, int threads);
+  void SchedulePool(BGPool* pool, void (*function)(void*), void* arg);
+  void SetPoolThreads(BGPool* pool, int n);
+
+  // BGThread() is the body of the threads of a pool
+  void BGThread(BGPool* pool);
   static void* BGThreadWrapper(void* arg) {
-    reinterpret_cast<PosixEnv*>(arg)->BGThread();
+    BGPool* pool = reinterpret_cast<BGPool*>(arg);
+    pool->env->BGThread(pool);
     return NULL;
   }
 
   size_t page_size_;
   pthread_mutex_t mu_;
-  pthread_cond_t bgsignal_;
-  pthread_t bgthread_;
-  bool started_bgthread_;
-
-  // Entry per Schedule() call
-  struct BGItem { void* arg; void (*function)(void*); };
-  typedef std::deque<BGItem> BGQueue;
-  BGQueue queue_;
+  uint64_t bytes_per_sync_;  // Set by SetBytesPerSync()
+  bool use_mmap_writes_;     // Set by SetUseMmapWrites()
+  BGPool bg_pool_;     // Items from Schedule()
+  BGPool flush_pool_;  // Items from ScheduleFlush()
 
   PosixLockTable locks_;
   MmapLimiter mmap_limit_;
+  RateLimiter foreground_limit_;
+  RateLimiter background_limit_;
 };
 
 PosixEnv::PosixEnv() : page_size_(getpagesize()),
-                       started_bgthread_(false) {
+                       bytes_per_sync_(0),
+                       use_mmap_writes_(true),
+                       foreground_limit_(this),
+                       background_limit_(this) {
   PthreadCall("mutex_init", pthread_mutex_init(&mu_, NULL));
-  PthreadCall("cvar_init", pthread_cond_init(&bgsignal_, NULL));
+  InitPool(&bg_pool_, 1);
+  InitPool(&flush_pool_, 1);
+}
+
+void PosixEnv::InitPool(BGPool* pool, int threads) {
+  pool->env = this;
+  PthreadCall("cvar_init", pthread_cond_init(&pool->signal, NULL));
+  pool->threads = threads;
+  pool->started_threads = 0;
 }
 
 void PosixEnv::Schedule(void (*function)(void*), void* arg) {
+  SchedulePool(&bg_pool_, function, arg);
+}
+
+void PosixEnv::ScheduleFlush(void (*function)(void*), void* arg) {
+  SchedulePool(&flush_pool_, function, arg);
+}
+
+void PosixEnv::SchedulePool(BGPool* pool, void (*function)(void*),
+                            void* arg) {
   PthreadCall("lock", pthread_mutex_lock(&mu_));
 
-  // Start background thread if necessary
-  if (!started_bgthread_) {
-    started_bgthread_ = true;
+  // Start background threads if necessary
+  while (pool->started_threads < pool->threads) {
+    pool->started_threads++;
+    pthread_t t;
     PthreadCall(
         "create thread",
-        pthread_create(&bgthread_, NULL,  &PosixEnv::BGThreadWrapper, this));
+        pthread_create(&t, NULL,  &PosixEnv::BGThreadWrapper, pool));
+    PthreadCall("detach thread", pthread_detach(t));
   }
 
-  // If the queue is currently empty, the background thread may currently be
-  // waiting.
-  if (queue_.empty()) {
-    PthreadCall("signal", pthread_cond_signal(&bgsignal_));
-  }
+  // Wake up one waiting background thread.  With several threads some may
+  // be idle even when the queue is non-empty, so always signal.
+  PthreadCall("signal", pthread_cond_signal(&pool->signal));
 
   // Add to priority queue
-  queue_.push_back(BGItem());
-  queue_.back().function = function;
-  queue_.back().arg = arg;
+  pool->queue.push_back(BGItem());
+  pool->queue.back().function = function;
+  pool->queue.back().arg = arg;
+
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
+
+void PosixEnv::SetBackgroundThreads(int n) {
+  SetPoolThreads(&bg_pool_, n);
+}
 
+void PosixEnv::SetFlushThreads(int n) {
+  SetPoolThreads(&flush_pool_, n);
+}
+
+void PosixEnv::SetPoolThreads(BGPool* pool, int n) {
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+  // The pool only grows; extra threads are started by the next item
+  // scheduled on it.
+  if (n > pool->threads) {
+    pool->threads = n;
+  }
   PthreadCall("unlock", pthread_mutex_unlock(&mu_));
 }
 
-void PosixEnv::BGThread() {
+void PosixEnv::BGThread(BGPool* pool) {
   while (true) {
     // Wait until there is an item that is ready to run
     PthreadCall("lock", pthread_mutex_lock(&mu_));
-    while (queue_.empty()) {
-      PthreadCall("wait", pthread_cond_wait(&bgsignal_, &mu_));
+    while (pool->queue.empty()) {
+      PthreadCall("wait", pthread_cond_wait(&pool->signal, &mu_));
     }
 
-    void (*function)(void*) = queue_.front().function;
-    void* arg = queue_.front().arg;
-    queue_.pop_front();
+    void (*function)(void*) = pool->queue.front().function;
+    void* arg = pool->queue.front().arg;
+    pool->queue.pop_front();
 
     PthreadCall("unlock", pthread_mutex_unlock(&mu_));
     (*function)(arg);
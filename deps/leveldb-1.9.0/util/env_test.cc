@@ -4,6 +4,7 @@
 
 #include "leveldb/env.h"
 
+#include <sched.h>
 #include "port/port.h"
 #include "util/testharness.h"
 
@@ -32,6 +33,29 @@ TEST(EnvPosixTest, RunImmediately) {
   ASSERT_TRUE(called.NoBarrier_Load() != NULL);
 }
 
+static void WaitForBool(void* ptr) {
+  port::AtomicPointer* released = reinterpret_cast<port::AtomicPointer*>(ptr);
+  while (released->Acquire_Load() == NULL) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+}
+
+TEST(EnvPosixTest, FlushBypassesBackgroundQueue) {
+  // Occupy the only background thread; flushes must still run.
+  port::AtomicPointer released(NULL);
+  port::AtomicPointer blocked(NULL);
+  port::AtomicPointer flushed(NULL);
+  env_->Schedule(&WaitForBool, &released);
+  env_->Schedule(&SetBool, &blocked);
+  env_->ScheduleFlush(&SetBool, &flushed);
+  Env::Default()->SleepForMicroseconds(kDelayMicros);
+  ASSERT_TRUE(flushed.NoBarrier_Load() != NULL);
+  ASSERT_TRUE(blocked.NoBarrier_Load() == NULL);
+  released.Release_Store(&released);
+  Env::Default()->SleepForMicroseconds(kDelayMicros);
+  ASSERT_TRUE(blocked.NoBarrier_Load() != NULL);
+}
+
 TEST(EnvPosixTest, RunMany) {
   port::AtomicPointer last_id (NULL);
 
@@ -78,6 +102,34 @@ static void ThreadBody(void* arg) {
   s->mu.Unlock();
 }
 
+#if defined(OS_LINUX)
+static void RecordCPU(void* ptr) {
+  reinterpret_cast<port::AtomicPointer*>(ptr)->Release_Store(
+      reinterpret_cast<void*>(static_cast<intptr_t>(sched_getcpu() + 1)));
+}
+#endif
+
+TEST(EnvPosixTest, BoundEnv) {
+  std::vector<int> cpus;
+#if defined(OS_LINUX)
+  cpus.push_back(sched_getcpu());
+#endif
+  Env* env = NewBoundEnv(env_, cpus, -1);
+  port::AtomicPointer flushed(NULL);
+  env->ScheduleFlush(&SetBool, &flushed);
+#if defined(OS_LINUX)
+  port::AtomicPointer cpu(NULL);
+  env->Schedule(&RecordCPU, &cpu);
+#endif
+
+  // Deleting the env runs the queued items before stopping its threads.
+  delete env;
+  ASSERT_TRUE(flushed.NoBarrier_Load() != NULL);
+#if defined(OS_LINUX)
+  ASSERT_EQ(cpus[0] + 1, reinterpret_cast<intptr_t>(cpu.Acquire_Load()));
+#endif
+}
+
 TEST(EnvPosixTest, StartThread) {
   State state;
   state.val = 0;
@@ -97,6 +149,128 @@ TEST(EnvPosixTest, StartThread) {
   ASSERT_EQ(state.val, 3);
 }
 
+static uint64_t TimedWrite(Env* env, bool background, size_t bytes) {
+  std::string dir;
+  ASSERT_OK(env->GetTestDirectory(&dir));
+  const std::string fname = dir + "/rate_limit_test";
+  WritableFile* file;
+  if (background) {
+    ASSERT_OK(env->NewBackgroundWritableFile(fname, &file));
+  } else {
+    ASSERT_OK(env->NewWritableFile(fname, &file));
+  }
+  const std::string block(10000, 'x');
+  const uint64_t start = env->NowMicros();
+  for (size_t written = 0; written < bytes; written += block.size()) {
+    ASSERT_OK(file->Append(block));
+  }
+  const uint64_t elapsed = env->NowMicros() - start;
+  ASSERT_OK(file->Close());
+  delete file;
+  env->DeleteFile(fname);
+  return elapsed;
+}
+
+static void CheckWriteRead(Env* env, bool direct = false) {
+  std::string dir;
+  ASSERT_OK(env->GetTestDirectory(&dir));
+  const std::string fname = dir + "/write_read_test";
+  std::string expected;
+  WritableFile* file;
+  if (direct) {
+    ASSERT_OK(env->NewDirectWritableFile(fname, &file));
+  } else {
+    ASSERT_OK(env->NewBackgroundWritableFile(fname, &file));
+  }
+  for (int i = 0; i < 1000; i++) {
+    // Sizes straddle both the write buffer and the mapped regions
+    const std::string piece(i * 131 % 70000, 'a' + i % 26);
+    ASSERT_OK(file->Append(piece));
+    expected += piece;
+    if (i % 100 == 0) {
+      ASSERT_OK(file->Sync());
+    }
+  }
+  ASSERT_OK(file->Close());
+  delete file;
+  uint64_t size;
+  ASSERT_OK(env->GetFileSize(fname, &size));
+  ASSERT_EQ(expected.size(), size);
+  std::string contents;
+  ASSERT_OK(ReadFileToString(env, fname, &contents));
+  ASSERT_TRUE(contents == expected);
+
+  // Unaligned reads of many sizes, up to the end of the file
+  RandomAccessFile* reader;
+  if (direct) {
+    ASSERT_OK(env->NewDirectRandomAccessFile(fname, &reader));
+  } else {
+    ASSERT_OK(env->NewRandomAccessFile(fname, &reader));
+  }
+  std::string scratch(100000, '\0');
+  for (uint64_t offset = 0; offset < size; offset += 99991) {
+    size_t n = 1 + offset % scratch.size();
+    if (n > size - offset) {
+      n = size - offset;
+    }
+    Slice result;
+    ASSERT_OK(reader->Read(offset, n, &result, &scratch[0]));
+    ASSERT_TRUE(result == Slice(expected.data() + offset, n));
+  }
+  delete reader;
+  env->DeleteFile(fname);
+}
+
+TEST(EnvPosixTest, WriteModes) {
+  env_->SetBytesPerSync(1 << 20);
+  CheckWriteRead(env_);
+  env_->SetUseMmapWrites(false);
+  CheckWriteRead(env_);
+  env_->SetBytesPerSync(0);
+  CheckWriteRead(env_);
+  env_->SetUseMmapWrites(true);
+  CheckWriteRead(env_, true);
+}
+
+// Returns whether reads of a file come from a mapping rather than being
+// copied into the caller's scratch space.
+static bool ReadsMapped(Env* env) {
+  std::string dir;
+  ASSERT_OK(env->GetTestDirectory(&dir));
+  const std::string fname = dir + "/mmap_limit_test";
+  ASSERT_OK(WriteStringToFile(env, "hello world", fname));
+  RandomAccessFile* reader;
+  ASSERT_OK(env->NewRandomAccessFile(fname, &reader));
+  char scratch[5];
+  Slice result;
+  ASSERT_OK(reader->Read(6, 5, &result, scratch));
+  ASSERT_EQ("world", result.ToString());
+  const bool mapped = (result.data() != scratch);
+  delete reader;
+  env->DeleteFile(fname);
+  return mapped;
+}
+
+TEST(EnvPosixTest, MmapLimit) {
+  ASSERT_EQ(sizeof(void*) >= 8, ReadsMapped(env_));
+  env_->SetMmapLimit(0);
+  ASSERT_TRUE(!ReadsMapped(env_));
+  env_->SetMmapLimit(1);
+  ASSERT_TRUE(ReadsMapped(env_));
+  env_->SetMmapLimit(-1);
+  ASSERT_TRUE(ReadsMapped(env_));
+}
+
+TEST(EnvPosixTest, WriteRateLimits) {
+  // The bucket starts empty, so 300KB at 1MB/s takes close to 300ms;
+  // the unlimited foreground budget is not slowed down.
+  env_->SetWriteRateLimits(0, 1 << 20);
+  ASSERT_GE(TimedWrite(env_, true, 300000), 200000);
+  ASSERT_LT(TimedWrite(env_, false, 300000), 200000);
+  env_->SetWriteRateLimits(0, 0);
+  ASSERT_LT(TimedWrite(env_, true, 300000), 200000);
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
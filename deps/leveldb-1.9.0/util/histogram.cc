@@ -4,6 +4,7 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <algorithm>
 #include "port/port.h"
 #include "util/histogram.h"
 
@@ -42,11 +43,10 @@ void Histogram::Clear() {
 }
 
 void Histogram::Add(double value) {
-  // Linear search is fast enough for our usage in db_bench
-  int b = 0;
-  while (b < kNumBuckets - 1 && kBucketLimit[b] <= value) {
-    b++;
-  }
+  // Binary search since the db records every read and write, not just
+  // db_bench.  The last limit is never exceeded.
+  const int b = std::upper_bound(kBucketLimit, kBucketLimit + kNumBuckets - 1,
+                                 value) - kBucketLimit;
   buckets_[b] += 1.0;
   if (min_ > value) min_ = value;
   if (max_ < value) max_ = value;
@@ -71,6 +71,7 @@ double Histogram::Median() const {
 }
 
 double Histogram::Percentile(double p) const {
+  if (num_ == 0.0) return 0;
   double threshold = num_ * (p / 100.0);
   double sum = 0;
   for (int b = 0; b < kNumBuckets; b++) {
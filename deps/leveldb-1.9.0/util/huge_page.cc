@@ -0,0 +1,175 @@
+// Copyright (c) 2013 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/huge_page.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+#if defined(OS_LINUX)
+#include <sys/mman.h>
+#endif
+#include "port/port.h"
+#include "util/coding.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+char* AllocateHugePages(size_t bytes, HugePages mode) {
+  assert(bytes % kHugePageSize == 0);
+#if defined(OS_LINUX)
+  if (mode == kNoHugePages) {
+    return NULL;
+  }
+#if defined(MAP_HUGETLB)
+  if (mode == kExplicitHugePages) {
+    void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      return reinterpret_cast<char*>(p);
+    }
+    // The reserved huge pages have run out.
+  }
+#endif
+
+  // Transparent huge pages only back ranges aligned to a huge page, so
+  // map one more than needed and trim the ends to an aligned range.
+  const size_t len = bytes + kHugePageSize;
+  void* p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+  const uintptr_t start = reinterpret_cast<uintptr_t>(p);
+  const uintptr_t aligned = (start + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  if (aligned > start) {
+    munmap(p, aligned - start);
+  }
+  if (start + len > aligned + bytes) {
+    munmap(reinterpret_cast<void*>(aligned + bytes),
+           start + len - (aligned + bytes));
+  }
+#if defined(MADV_HUGEPAGE)
+  madvise(reinterpret_cast<void*>(aligned), bytes, MADV_HUGEPAGE);
+#endif
+  return reinterpret_cast<char*>(aligned);
+#else
+  (void)mode;
+  return NULL;
+#endif
+}
+
+void FreeHugePages(char* ptr, size_t bytes) {
+#if defined(OS_LINUX)
+  munmap(ptr, bytes);
+#else
+  (void)ptr;
+  (void)bytes;
+#endif
+}
+
+namespace {
+
+// Every block buffer starts with a header that holds its size class, or
+// kHeapBuffer if it was allocated with new[].  The header keeps the data
+// 16-byte aligned.
+static const size_t kBufferHeader = 16;
+static const uint32_t kHeapBuffer = 0xffffffffu;
+
+// Huge page buffers are sized in multiples of kClassSize up to 1MB.
+static const size_t kClassSize = 4096;
+static const uint32_t kNumClasses = 256;
+
+// Carves block buffers out of chunks of huge pages.  A freed buffer goes
+// on the free list of its size for the next block of that size, so the
+// chunks stay mapped while the process runs.  The block cache bounds how
+// many buffers are in use at once, and the blocks of a DB are mostly of
+// one or two sizes, so little memory sits on the other lists.
+class HugePageBufferPool {
+ public:
+  HugePageBufferPool() : chunk_(NULL), chunk_remaining_(0) { }
+
+  char* Allocate(uint32_t size_class, HugePages mode) {
+    const size_t bytes = (size_class + 1) * kClassSize;
+    MutexLock l(&mu_);
+    std::vector<char*>* free_list = &free_[size_class];
+    if (!free_list->empty()) {
+      char* result = free_list->back();
+      free_list->pop_back();
+      return result;
+    }
+    if (bytes > chunk_remaining_) {
+      char* chunk = AllocateHugePages(kHugePageSize, mode);
+      if (chunk == NULL) {
+        return NULL;
+      }
+      // Keep what is left of the last chunk for smaller buffers.
+      if (chunk_remaining_ >= kClassSize) {
+        free_[chunk_remaining_ / kClassSize - 1].push_back(chunk_);
+      }
+      chunk_ = chunk;
+      chunk_remaining_ = kHugePageSize;
+    }
+    char* result = chunk_;
+    chunk_ += bytes;
+    chunk_remaining_ -= bytes;
+    return result;
+  }
+
+  void Free(char* buf, uint32_t size_class) {
+    MutexLock l(&mu_);
+    free_[size_class].push_back(buf);
+  }
+
+ private:
+  port::Mutex mu_;
+  char* chunk_;
+  size_t chunk_remaining_;
+  std::vector<char*> free_[kNumClasses];
+};
+
+static port::OnceType once = LEVELDB_ONCE_INIT;
+static HugePageBufferPool* buffer_pool;
+
+static void InitBufferPool() {
+  buffer_pool = new HugePageBufferPool;
+}
+
+static HugePageBufferPool* BufferPool() {
+  port::InitOnce(&once, InitBufferPool);
+  return buffer_pool;
+}
+
+}  // namespace
+
+char* NewBlockBuffer(size_t bytes, HugePages mode) {
+  const size_t total = bytes + kBufferHeader;
+  uint32_t size_class = kHeapBuffer;
+  char* buf = NULL;
+  if (mode != kNoHugePages && total <= kNumClasses * kClassSize) {
+    size_class = static_cast<uint32_t>((total - 1) / kClassSize);
+    buf = BufferPool()->Allocate(size_class, mode);
+  }
+  if (buf == NULL) {
+    size_class = kHeapBuffer;
+    buf = new char[total];
+  }
+  EncodeFixed32(buf, size_class);
+  return buf + kBufferHeader;
+}
+
+void DeleteBlockBuffer(const char* data) {
+  if (data == NULL) {
+    return;
+  }
+  char* buf = const_cast<char*>(data) - kBufferHeader;
+  const uint32_t size_class = DecodeFixed32(buf);
+  if (size_class == kHeapBuffer) {
+    delete[] buf;
+  } else {
+    BufferPool()->Free(buf, size_class);
+  }
+}
+
+}  // namespace leveldb
@@ -0,0 +1,37 @@
+// Copyright (c) 2013 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// Memory backed by 2MB huge pages, for memtable arenas and the blocks
+// that tables read into the block cache.
+
+#ifndef STORAGE_LEVELDB_UTIL_HUGE_PAGE_H_
+#define STORAGE_LEVELDB_UTIL_HUGE_PAGE_H_
+
+#include <stddef.h>
+#include "leveldb/options.h"
+
+namespace leveldb {
+
+static const size_t kHugePageSize = 2 << 20;
+
+// Map "bytes" of memory, a multiple of kHugePageSize aligned to it, and
+// back it with huge pages as "mode" asks.  Returns NULL if "mode" is
+// kNoHugePages, the platform has no huge pages or the mapping fails.
+extern char* AllocateHugePages(size_t bytes, HugePages mode);
+
+// Unmap memory returned by AllocateHugePages(bytes, ...).
+extern void FreeHugePages(char* ptr, size_t bytes);
+
+// Return a buffer of "bytes" bytes for a block read from a table.  With
+// huge pages, buffers of up to 1MB come from chunks of huge pages shared
+// by the whole process.  Must be freed with DeleteBlockBuffer().
+extern char* NewBlockBuffer(size_t bytes, HugePages mode);
+
+// Free a buffer returned by NewBlockBuffer().  Does nothing if "buf" is
+// NULL.
+extern void DeleteBlockBuffer(const char* buf);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_HUGE_PAGE_H_
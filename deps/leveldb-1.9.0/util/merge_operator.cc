@@ -0,0 +1,39 @@
+// Copyright (c) 2013 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/merge_operator.h"
+
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+MergeOperator::~MergeOperator() { }
+
+namespace {
+class AppendOperator : public MergeOperator {
+ public:
+  virtual const char* Name() const {
+    return "leveldb.Append";
+  }
+
+  virtual bool Merge(const Slice& key,
+                     const Slice* existing_value,
+                     const Slice& value,
+                     std::string* new_value) const {
+    new_value->clear();
+    if (existing_value != NULL) {
+      new_value->reserve(existing_value->size() + value.size());
+      new_value->assign(existing_value->data(), existing_value->size());
+    }
+    new_value->append(value.data(), value.size());
+    return true;
+  }
+};
+}
+
+const MergeOperator* NewAppendOperator() {
+  return new AppendOperator;
+}
+
+}  // namespace leveldb
@@ -18,11 +18,47 @@ Options::Options()
       info_log(NULL),
       write_buffer_size(4<<20),
       max_open_files(1000),
+      max_background_compactions(1),
+      max_subcompactions(1),
+      repair_threads(1),
+      compaction_style(kCompactionStyleLevel),
+      tiered_size_ratio(1),
+      tiered_max_fan_in(10),
+      level0_file_num_compaction_trigger(4),
+      level0_slowdown_writes_trigger(8),
+      level0_stop_writes_trigger(12),
+      target_file_size_base(2<<20),
+      target_file_size_multiplier(1),
+      max_bytes_for_level_base(10<<20),
+      max_bytes_for_level_multiplier(10),
+      level_compaction_dynamic_level_bytes(false),
+      use_direct_io_for_compaction(false),
+      compaction_readahead_size(2<<20),
+      allow_concurrent_memtable_write(false),
+      enable_pipelined_write(false),
+      log_compression(kNoCompression),
+      log_sync_interval_micros(0),
+      arena_block_size(4096),
+      huge_pages(kNoHugePages),
+      memtable_rep(kSkipListRep),
+      memtable_prefix_extractor(NULL),
       block_cache(NULL),
+      block_cache_compressed(NULL),
       block_size(4096),
       block_restart_interval(16),
+      uncompressed_block_keys(false),
+      index_partition_size(0),
+      pinned_metadata_size(0),
+      data_block_hash_index(false),
       compression(kSnappyCompression),
-      filter_policy(NULL) {
+      compression_threads(1),
+      filter_policy(NULL),
+      prefix_extractor(NULL),
+      merge_operator(NULL),
+      compaction_filter(NULL),
+      min_blob_size(0),
+      blob_file_min_live_ratio(0.5),
+      blob_file_size(256<<20) {
 }
 
 
@@ -0,0 +1,64 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/rate_limiter.h"
+
+#include "leveldb/env.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+RateLimiter::RateLimiter(Env* env)
+    : env_(env),
+      rate_(0),
+      available_(0),
+      last_refill_(0) {
+}
+
+void RateLimiter::SetRate(uint64_t bytes_per_second) {
+  MutexLock l(&mu_);
+  rate_ = bytes_per_second;
+  available_ = 0;
+  last_refill_ = env_->NowMicros();
+}
+
+uint64_t RateLimiter::GetRate() {
+  MutexLock l(&mu_);
+  return rate_;
+}
+
+void RateLimiter::Request(size_t n) {
+  uint64_t wait_micros = 0;
+  {
+    MutexLock l(&mu_);
+    if (rate_ == 0) {
+      return;
+    }
+    // Refill for the time elapsed since the last request.  The bucket
+    // holds at most a tenth of a second worth of writes so that an idle
+    // period does not let a large burst through.
+    const uint64_t now = env_->NowMicros();
+    if (now > last_refill_) {
+      available_ += static_cast<double>(now - last_refill_) * rate_ / 1e6;
+      const double burst = static_cast<double>(rate_) / 10;
+      if (available_ > burst) {
+        available_ = burst;
+      }
+    }
+    last_refill_ = now;
+    available_ -= n;
+    if (available_ < 0) {
+      wait_micros = static_cast<uint64_t>(-available_ * 1e6 / rate_);
+    }
+  }
+  // Sleep outside the lock so that concurrent writers queue up behind the
+  // debt instead of behind each other's sleeps.
+  while (wait_micros > 0) {
+    const int chunk = wait_micros > 1000000 ? 1000000 : wait_micros;
+    env_->SleepForMicroseconds(chunk);
+    wait_micros -= chunk;
+  }
+}
+
+}  // namespace leveldb
@@ -0,0 +1,47 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// Token bucket used by Env implementations to bound the write rate of
+// a class of files.
+
+#ifndef STORAGE_LEVELDB_UTIL_RATE_LIMITER_H_
+#define STORAGE_LEVELDB_UTIL_RATE_LIMITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "port/port.h"
+
+namespace leveldb {
+
+class Env;
+
+class RateLimiter {
+ public:
+  explicit RateLimiter(Env* env);
+
+  // Set the allowed rate in bytes per second.  Zero disables limiting.
+  void SetRate(uint64_t bytes_per_second);
+  uint64_t GetRate();
+
+  // Account for "n" bytes about to be written, sleeping as needed to keep
+  // the average rate at or below the configured limit.  A request larger
+  // than the bucket runs into debt that later requests pay off, so writes
+  // are never split.
+  void Request(size_t n);
+
+ private:
+  Env* const env_;
+  port::Mutex mu_;
+  uint64_t rate_;        // Bytes per second, or 0 if unlimited
+  double available_;     // Tokens in the bucket; negative while in debt
+  uint64_t last_refill_;  // NowMicros() of the last refill
+
+  // No copying allowed
+  RateLimiter(const RateLimiter&);
+  void operator=(const RateLimiter&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_RATE_LIMITER_H_
@@ -0,0 +1,45 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/slice_transform.h"
+
+#include <stdio.h>
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+SliceTransform::~SliceTransform() { }
+
+namespace {
+class FixedPrefixTransform : public SliceTransform {
+ private:
+  size_t prefix_length_;
+  char name_[40];
+
+ public:
+  explicit FixedPrefixTransform(size_t prefix_length)
+      : prefix_length_(prefix_length) {
+    snprintf(name_, sizeof(name_), "leveldb.FixedPrefix.%llu",
+             static_cast<unsigned long long>(prefix_length));
+  }
+
+  virtual const char* Name() const {
+    return name_;
+  }
+
+  virtual bool InDomain(const Slice& key) const {
+    return key.size() >= prefix_length_;
+  }
+
+  virtual Slice Transform(const Slice& key) const {
+    return Slice(key.data(), prefix_length_);
+  }
+};
+}
+
+const SliceTransform* NewFixedPrefixTransform(size_t prefix_length) {
+  return new FixedPrefixTransform(prefix_length);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,68 @@
+package main
+
+import (
+	"../skyd"
+	"flag"
+	"fmt"
+	"os"
+	"runtime"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+const (
+	hostUsage  = "the host:port of the server to replay the trace against"
+	speedUsage = "how many times faster than recorded to make the calls"
+)
+
+//------------------------------------------------------------------------------
+//
+// Variables
+//
+//------------------------------------------------------------------------------
+
+var options skyd.ReplayOptions
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Initialization
+//--------------------------------------
+
+func init() {
+	flag.StringVar(&options.Host, "host", "localhost:8585", hostUsage)
+	flag.Float64Var(&options.Speed, "speed", 1, speedUsage)
+}
+
+//--------------------------------------
+// Main
+//--------------------------------------
+
+func main() {
+	runtime.GOMAXPROCS(runtime.NumCPU())
+	flag.Parse()
+	if flag.NArg() != 1 {
+		fmt.Fprintln(os.Stderr, "usage: sky_replay [options] <trace>")
+		flag.PrintDefaults()
+		os.Exit(1)
+	}
+
+	file, err := os.Open(flag.Arg(0))
+	if err != nil {
+		fmt.Fprintln(os.Stderr, err)
+		os.Exit(1)
+	}
+	defer file.Close()
+	if _, err := skyd.ReplayTrace(file, options, os.Stdout); err != nil {
+		fmt.Fprintln(os.Stderr, err)
+		os.Exit(1)
+	}
+}
@@ -8,6 +8,9 @@ import (
 	"os"
 	"os/signal"
 	"runtime"
+	"strconv"
+	"strings"
+	"time"
 )
 
 //------------------------------------------------------------------------------
@@ -24,6 +27,94 @@ const (
 const (
 	portUsage = "the port to listen on"
 	dataDirUsage = "the data directory"
+	eventBlocksUsage = "write events in the columnar block format"
+	partitionMonthsUsage = "split each servlet into a database per this many months of events (0 to disable); queries reading partitions can only select events by time and transient properties, so state queries, conditions and sessions fail"
+	objectBufferSizeUsage = "the memory each servlet keeps recently written objects in before writing them, in MB (0 to disable)"
+	objectBufferDelayUsage = "the longest time an object is kept in the object buffer, in milliseconds"
+	cacheSizeUsage = "the block cache size shared by servlets, in MB"
+	scanResistantCacheUsage = "keep blocks read once by scans from evicting the servlet working set"
+	clockCacheUsage = "use a CLOCK block cache whose lookups don't lock (overrides -scan-resistant-cache)"
+	cacheShardBitsUsage = "the CLOCK block cache is split into 2^n shards"
+	bloomBitsUsage = "the bloom filter bits per key for servlets (0 to disable)"
+	blockedBloomUsage = "keep the bloom filter probes of a key within one cache line"
+	blockSizeUsage = "the servlet block size, in KB"
+	blockHashIndexUsage = "store a hash index in each servlet table block for faster point reads"
+	uncompressedBlockKeysUsage = "store servlet table block keys whole for faster scans of hashed keys"
+	indexPartitionSizeUsage = "the size of servlet table index partitions read through the block cache, in KB (0 for whole index blocks)"
+	pinnedMetadataSizeUsage = "the memory each servlet keeps level 0 and 1 filter and index blocks in, in MB (0 to disable)"
+	writeBufferSizeUsage = "the servlet write buffer size, in MB"
+	arenaBlockSizeUsage = "the size of the blocks that servlet memtables allocate from, in KB (0 for the LevelDB default)"
+	hugePagesUsage = "back memtables, cached blocks and large Lua heap blocks with 2MB huge pages (0 for none, 1 for transparent, 2 for explicit)"
+	memTableRepUsage = "how servlet memtables hold events (0 for a skiplist, 1 for a vector sorted on read, 2 for hashed lists per object)"
+	maxOpenFilesUsage = "the maximum open files per servlet (0 for the LevelDB default)"
+	prefetchBlocksUsage = "the table blocks that query scans read ahead in the background (0 to disable)"
+	scanPipelineUsage = "the objects that a thread of each query scan reads ahead of the aggregation (0 to read them on the aggregation's thread)"
+	maxCompactionsUsage = "the compactions that can run at once per servlet"
+	compactionThreadsUsage = "the compaction threads shared by all databases"
+	flushThreadsUsage = "the memtable flush threads shared by all databases, which never wait behind compactions"
+	bytesPerSyncUsage = "start writing back table and log files every this many KB written, so syncs don't stall the disk (0 to leave it to the OS)"
+	bufferedWritesUsage = "write table and log files with buffered writes instead of mmap"
+	mmapLimitUsage = "the table files that all databases read through mmap at once (0 for every file on 64-bit, negative for none)"
+	foregroundWriteRateUsage = "the rate that all databases write logs and manifests at, in MB/s (0 for no limit)"
+	backgroundWriteRateUsage = "the rate that all databases write flushed and compacted tables at, in MB/s (0 for no limit)"
+	maxSubcompactionsUsage = "the threads that a large servlet compaction is split across"
+	tieredCompactionUsage = "merge servlet tables in sorted runs of similar size, which rewrites ingested events less often but slows reads"
+	tieredSizeRatioUsage = "how many percent larger than the newer runs a run can be and merge with them (0 for the LevelDB default)"
+	tieredFanInUsage = "the most runs that a tiered compaction merges at once (0 for the LevelDB default)"
+	targetFileSizeUsage = "the size of the tables servlet compactions write into level 1, in MB (0 for the LevelDB default)"
+	targetFileSizeMultiplierUsage = "the factor servlet table sizes grow by for each deeper level (0 for the LevelDB default)"
+	levelBaseSizeUsage = "the size of servlet level 1 before it is compacted, in MB (0 for the LevelDB default)"
+	levelSizeMultiplierUsage = "the factor servlet level sizes grow by for each deeper level (0 for the LevelDB default)"
+	dynamicLevelBytesUsage = "derive servlet level sizes from the size of the deepest level"
+	l0CompactionTriggerUsage = "the servlet level 0 tables that start a compaction (0 for the LevelDB default)"
+	l0SlowdownTriggerUsage = "the servlet level 0 tables at which writes slow down (0 for the LevelDB default)"
+	l0StopTriggerUsage = "the servlet level 0 tables at which writes stop (0 for the LevelDB default)"
+	repairServletsUsage = "the servlets to repair before they're opened, comma separated (e.g. 3,7)"
+	repairThreadsUsage = "the threads that a servlet repair scans tables on"
+	ingestPortUsage = "the port that collectors write events to over persistent TCP connections with the ingest protocol (0 to disable)"
+	compressionThresholdUsage = "the size that responses are gzip or deflate compressed from when the client accepts it, in KB (0 to disable)"
+	directCompactionUsage = "read and write servlet compaction tables with direct I/O so compactions don't evict the pages queries read"
+	compactionReadaheadUsage = "the size of each read of a servlet compaction input, in KB (0 for the LevelDB default)"
+	blobSizeUsage = "the size from which servlet event values are kept in blob files outside the tables, in KB (0 to disable)"
+	concurrentWritesUsage = "let batched servlet writers insert into the memtable in parallel"
+	pipelinedWritesUsage = "let servlet writers write the log while the previous writers apply to the memtable"
+	logCompressionUsage = "the compression of servlet log records (0 for none, 1 for snappy, 2 for lz4, 3 for zstd)"
+	logSyncIntervalUsage = "the time synced servlet writes wait after the last log sync so later writes share the sync, in microseconds (0 to sync at once)"
+	compressionDictUsage = "a Zstd dictionary file for servlet tables (e.g. from zstd --train)"
+	compressionThreadsUsage = "the servlet table blocks compressed at once on background threads (0 to compress inline)"
+	compressedCacheSizeUsage = "the compressed block cache size shared by servlets, in MB (0 to disable)"
+	prefixFilterUsage = "add the table prefix of servlet keys to the bloom filters so seeks skip files without the table"
+	factorsCacheSizeUsage = "the factors database block cache size, in MB"
+	jitMaxTraceUsage = "the maximum LuaJIT traces per query engine (0 for the LuaJIT default)"
+	jitMaxMcodeUsage = "the maximum LuaJIT machine code per query engine, in KB (0 for the LuaJIT default)"
+	jitHotLoopUsage = "the loop iterations before LuaJIT traces a loop (0 for the LuaJIT default)"
+	gcPauseUsage = "the Lua heap growth between collections, in percent (0 for the Lua default)"
+	gcStepMulUsage = "the Lua collector speed relative to allocation, in percent (0 for the Lua default)"
+	gcStopBudgetUsage = "stop the Lua collector during aggregations until the heap reaches this size, in MB (0 to disable)"
+	memoryLimitUsage = "fail aggregations whose Lua heap grows past this size, in MB (0 to disable)"
+	spillBudgetUsage = "the Lua heap growth at which aggregations of queries that spill write their partial results to disk, in MB (0 for half the memory limit or 64MB)"
+	queryWorkersUsage = "the query sub-scans that run at once across all queries (0 for one per core)"
+	queryThreadsUsage = "the native threads that aggregations run on outside the Go scheduler (0 to run them on query goroutines)"
+	pinQueryThreadsUsage = "pin each aggregation thread to a CPU"
+	numaUsage = "place servlets on NUMA nodes in turn with node-local cache, compaction and aggregation threads"
+	interactiveQueriesUsage = "the interactive queries that run at once, others wait (0 for no limit)"
+	batchQueriesUsage = "the batch queries that run at once, others wait (0 for no limit)"
+	queryMemoryUsage = "the Lua heap shared by the engines of a query, in MB (0 to disable)"
+	queryCPUTimeUsage = "fail queries whose sub-scans run longer than this in total, in ms (0 to disable)"
+	memoryBudgetUsage = "reject queries whose memory doesn't fit in this server-wide budget after caches and buffers, in MB (0 to disable)"
+	slowQueryTimeUsage = "log queries that take longer than this with their plan, profile and resource usage, in ms (0 to disable)"
+	slowQueryLogUsage = "the file that slow queries are logged to, rotated as it grows (the server log if empty)"
+	slowQueryLogSizeUsage = "the size that the slow query log is rotated at, in MB"
+	sharedScanWindowUsage = "the time that queries of only selections wait for others to share one scan of the servlets, in ms (0 to disable)"
+	peersUsage = "the peers that queries run across, comma separated with replicas of a peer separated by | (e.g. a:8585|b:8585,c:8585)"
+	hedgeDelayUsage = "the time to wait on a peer replica before also querying the next one, in ms"
+	primaryUsage = "run as a read replica of the server at this host:port (the replica shouldn't take writes)"
+	maxStalenessUsage = "fail queries on a replica that has been behind its primary for longer than this, in ms (0 to disable)"
+	warmupIntervalUsage = "how often the blocks in the cache are recorded to be read back after a restart, in seconds (0 to only record them on shutdown)"
+	warmupRateUsage = "the rate that recorded blocks are read back into the cache after a restart, in MB/s (0 for no limit)"
+	tracePathUsage = "record a sample of the API calls to this file, which sky_replay replays against another server"
+	traceSampleRateUsage = "the fraction of API calls recorded to the trace file"
+	compactionWindowUsage = "the daily off-peak time that scheduled table compactions run in, as HH:MM-HH:MM in local time"
 )
 
 const (
@@ -38,6 +129,38 @@ const (
 
 var port uint
 var dataDir string
+var eventBlocks bool
+var partitionMonths int
+var objectBufferSize int
+var objectBufferDelay int
+var compressionDictPath string
+var servletStorage = skyd.DefaultServletStorageOptions()
+var factorsStorage = skyd.DefaultFactorsStorageOptions()
+var engineOptions skyd.EngineOptions
+var schedulerOptions skyd.QuerySchedulerOptions
+var queryCPUTime int
+var memoryBudget int
+var queryThreads int
+var pinQueryThreads bool
+var numa bool
+var hugePages int
+var sharedScanWindow int
+var logSyncInterval int
+var slowQueryTime int
+var slowQueryLog string
+var slowQueryLogSize int
+var compactionWindow string
+var peers string
+var repairServlets string
+var compressionThreshold int
+var ingestPort uint
+var hedgeDelay int
+var replicationOptions skyd.ReplicationOptions
+var maxStaleness int
+var warmupInterval int
+var warmupRate int
+var traceOptions skyd.TraceOptions
+var writeRates skyd.WriteRateLimits
 
 //------------------------------------------------------------------------------
 //
@@ -54,6 +177,94 @@ func init() {
 	flag.UintVar(&port, "p", defaultPort, portUsage+"(shorthand)")
 	flag.StringVar(&dataDir, "data-dir", defaultDataDir, dataDirUsage)
 	flag.StringVar(&dataDir, "d", defaultDataDir, dataDirUsage+"(shorthand)")
+	flag.BoolVar(&eventBlocks, "event-blocks", false, eventBlocksUsage)
+	flag.IntVar(&partitionMonths, "partition-months", 0, partitionMonthsUsage)
+	flag.IntVar(&objectBufferSize, "object-buffer-size", 0, objectBufferSizeUsage)
+	flag.IntVar(&objectBufferDelay, "object-buffer-delay", int(skyd.DefaultObjectBufferDelay / time.Millisecond), objectBufferDelayUsage)
+	flag.IntVar(&servletStorage.CacheSize, "cache-size", servletStorage.CacheSize >> 20, cacheSizeUsage)
+	flag.BoolVar(&servletStorage.ScanResistantCache, "scan-resistant-cache", servletStorage.ScanResistantCache, scanResistantCacheUsage)
+	flag.BoolVar(&servletStorage.ClockCache, "clock-cache", servletStorage.ClockCache, clockCacheUsage)
+	flag.IntVar(&servletStorage.CacheShardBits, "cache-shard-bits", servletStorage.CacheShardBits, cacheShardBitsUsage)
+	flag.IntVar(&servletStorage.BloomFilterBits, "bloom-bits", servletStorage.BloomFilterBits, bloomBitsUsage)
+	flag.BoolVar(&servletStorage.BlockedBloomFilter, "blocked-bloom", servletStorage.BlockedBloomFilter, blockedBloomUsage)
+	flag.IntVar(&servletStorage.BlockSize, "block-size", servletStorage.BlockSize >> 10, blockSizeUsage)
+	flag.BoolVar(&servletStorage.BlockHashIndex, "block-hash-index", servletStorage.BlockHashIndex, blockHashIndexUsage)
+	flag.BoolVar(&servletStorage.UncompressedBlockKeys, "uncompressed-block-keys", servletStorage.UncompressedBlockKeys, uncompressedBlockKeysUsage)
+	flag.IntVar(&servletStorage.IndexPartitionSize, "index-partition-size", servletStorage.IndexPartitionSize >> 10, indexPartitionSizeUsage)
+	flag.IntVar(&servletStorage.PinnedMetadataSize, "pinned-metadata-size", servletStorage.PinnedMetadataSize >> 20, pinnedMetadataSizeUsage)
+	flag.IntVar(&servletStorage.WriteBufferSize, "write-buffer-size", servletStorage.WriteBufferSize >> 20, writeBufferSizeUsage)
+	flag.IntVar(&servletStorage.ArenaBlockSize, "arena-block-size", servletStorage.ArenaBlockSize >> 10, arenaBlockSizeUsage)
+	flag.IntVar(&hugePages, "huge-pages", skyd.NoHugePages, hugePagesUsage)
+	flag.IntVar(&servletStorage.MemTableRep, "memtable-rep", servletStorage.MemTableRep, memTableRepUsage)
+	flag.IntVar(&servletStorage.MaxOpenFiles, "max-open-files", servletStorage.MaxOpenFiles, maxOpenFilesUsage)
+	flag.IntVar(&servletStorage.PrefetchBlocks, "prefetch-blocks", servletStorage.PrefetchBlocks, prefetchBlocksUsage)
+	flag.IntVar(&servletStorage.ScanPipelineDepth, "scan-pipeline", servletStorage.ScanPipelineDepth, scanPipelineUsage)
+	flag.IntVar(&servletStorage.MaxBackgroundCompactions, "max-compactions", servletStorage.MaxBackgroundCompactions, maxCompactionsUsage)
+	flag.IntVar(&servletStorage.CompactionThreads, "compaction-threads", servletStorage.CompactionThreads, compactionThreadsUsage)
+	flag.IntVar(&servletStorage.FlushThreads, "flush-threads", servletStorage.FlushThreads, flushThreadsUsage)
+	flag.IntVar(&servletStorage.BytesPerSync, "bytes-per-sync", servletStorage.BytesPerSync >> 10, bytesPerSyncUsage)
+	flag.BoolVar(&servletStorage.BufferedWrites, "buffered-writes", servletStorage.BufferedWrites, bufferedWritesUsage)
+	flag.IntVar(&servletStorage.MmapLimit, "mmap-limit", servletStorage.MmapLimit, mmapLimitUsage)
+	flag.IntVar(&writeRates.Foreground, "foreground-write-rate", 0, foregroundWriteRateUsage)
+	flag.IntVar(&writeRates.Background, "background-write-rate", 0, backgroundWriteRateUsage)
+	flag.IntVar(&servletStorage.MaxSubcompactions, "max-subcompactions", servletStorage.MaxSubcompactions, maxSubcompactionsUsage)
+	flag.BoolVar(&servletStorage.TieredCompaction, "tiered-compaction", servletStorage.TieredCompaction, tieredCompactionUsage)
+	flag.IntVar(&servletStorage.TieredSizeRatio, "tiered-size-ratio", servletStorage.TieredSizeRatio, tieredSizeRatioUsage)
+	flag.IntVar(&servletStorage.TieredMaxFanIn, "tiered-fan-in", servletStorage.TieredMaxFanIn, tieredFanInUsage)
+	flag.IntVar(&servletStorage.TargetFileSize, "target-file-size", servletStorage.TargetFileSize >> 20, targetFileSizeUsage)
+	flag.IntVar(&servletStorage.TargetFileSizeMultiplier, "target-file-size-multiplier", servletStorage.TargetFileSizeMultiplier, targetFileSizeMultiplierUsage)
+	flag.IntVar(&servletStorage.MaxBytesForLevelBase, "level-base-size", servletStorage.MaxBytesForLevelBase >> 20, levelBaseSizeUsage)
+	flag.IntVar(&servletStorage.LevelSizeMultiplier, "level-size-multiplier", servletStorage.LevelSizeMultiplier, levelSizeMultiplierUsage)
+	flag.BoolVar(&servletStorage.DynamicLevelBytes, "dynamic-level-bytes", servletStorage.DynamicLevelBytes, dynamicLevelBytesUsage)
+	flag.IntVar(&servletStorage.L0CompactionTrigger, "l0-compaction-trigger", servletStorage.L0CompactionTrigger, l0CompactionTriggerUsage)
+	flag.IntVar(&servletStorage.L0SlowdownTrigger, "l0-slowdown-trigger", servletStorage.L0SlowdownTrigger, l0SlowdownTriggerUsage)
+	flag.IntVar(&servletStorage.L0StopTrigger, "l0-stop-trigger", servletStorage.L0StopTrigger, l0StopTriggerUsage)
+	flag.StringVar(&repairServlets, "repair-servlets", "", repairServletsUsage)
+	flag.IntVar(&servletStorage.RepairThreads, "repair-threads", servletStorage.RepairThreads, repairThreadsUsage)
+	flag.UintVar(&ingestPort, "ingest-port", 0, ingestPortUsage)
+	flag.IntVar(&compressionThreshold, "compression-threshold", skyd.DefaultCompressionThreshold >> 10, compressionThresholdUsage)
+	flag.BoolVar(&servletStorage.DirectCompaction, "direct-compaction", servletStorage.DirectCompaction, directCompactionUsage)
+	flag.IntVar(&servletStorage.CompactionReadahead, "compaction-readahead", servletStorage.CompactionReadahead >> 10, compactionReadaheadUsage)
+	flag.IntVar(&servletStorage.MinBlobSize, "blob-size", servletStorage.MinBlobSize >> 10, blobSizeUsage)
+	flag.BoolVar(&servletStorage.ConcurrentMemtableWrites, "concurrent-writes", servletStorage.ConcurrentMemtableWrites, concurrentWritesUsage)
+	flag.BoolVar(&servletStorage.PipelinedWrites, "pipelined-writes", servletStorage.PipelinedWrites, pipelinedWritesUsage)
+	flag.IntVar(&servletStorage.LogCompression, "log-compression", servletStorage.LogCompression, logCompressionUsage)
+	flag.IntVar(&logSyncInterval, "log-sync-interval", 0, logSyncIntervalUsage)
+	flag.StringVar(&compressionDictPath, "compression-dict", "", compressionDictUsage)
+	flag.IntVar(&servletStorage.CompressionThreads, "compression-threads", servletStorage.CompressionThreads, compressionThreadsUsage)
+	flag.IntVar(&servletStorage.CompressedCacheSize, "compressed-cache-size", servletStorage.CompressedCacheSize >> 20, compressedCacheSizeUsage)
+	flag.BoolVar(&servletStorage.TablePrefixFilter, "prefix-filter", servletStorage.TablePrefixFilter, prefixFilterUsage)
+	flag.IntVar(&factorsStorage.CacheSize, "factors-cache-size", factorsStorage.CacheSize >> 20, factorsCacheSizeUsage)
+	flag.IntVar(&engineOptions.MaxTrace, "jit-maxtrace", 0, jitMaxTraceUsage)
+	flag.IntVar(&engineOptions.MaxMcode, "jit-maxmcode", 0, jitMaxMcodeUsage)
+	flag.IntVar(&engineOptions.HotLoop, "jit-hotloop", 0, jitHotLoopUsage)
+	flag.IntVar(&engineOptions.GCPause, "gc-pause", 0, gcPauseUsage)
+	flag.IntVar(&engineOptions.GCStepMul, "gc-stepmul", 0, gcStepMulUsage)
+	flag.IntVar(&engineOptions.GCStopBudget, "gc-stop-budget", 0, gcStopBudgetUsage)
+	flag.IntVar(&engineOptions.MemoryLimit, "memory-limit", 0, memoryLimitUsage)
+	flag.IntVar(&engineOptions.SpillBudget, "spill-budget", 0, spillBudgetUsage)
+	flag.IntVar(&schedulerOptions.Workers, "query-workers", 0, queryWorkersUsage)
+	flag.IntVar(&queryThreads, "query-threads", runtime.NumCPU(), queryThreadsUsage)
+	flag.BoolVar(&pinQueryThreads, "pin-query-threads", true, pinQueryThreadsUsage)
+	flag.BoolVar(&numa, "numa", false, numaUsage)
+	flag.IntVar(&schedulerOptions.InteractiveQueries, "interactive-queries", 0, interactiveQueriesUsage)
+	flag.IntVar(&schedulerOptions.BatchQueries, "batch-queries", 0, batchQueriesUsage)
+	flag.IntVar(&schedulerOptions.QueryMemory, "query-memory", 0, queryMemoryUsage)
+	flag.IntVar(&queryCPUTime, "query-cpu-time", 0, queryCPUTimeUsage)
+	flag.IntVar(&memoryBudget, "memory-budget", 0, memoryBudgetUsage)
+	flag.IntVar(&sharedScanWindow, "shared-scan-window", 0, sharedScanWindowUsage)
+	flag.IntVar(&slowQueryTime, "slow-query-time", 0, slowQueryTimeUsage)
+	flag.StringVar(&slowQueryLog, "slow-query-log", "", slowQueryLogUsage)
+	flag.IntVar(&slowQueryLogSize, "slow-query-log-size", skyd.DefaultSlowQueryLogSize >> 20, slowQueryLogSizeUsage)
+	flag.StringVar(&peers, "peers", "", peersUsage)
+	flag.IntVar(&hedgeDelay, "hedge-delay", int(skyd.DefaultClusterHedgeDelay / time.Millisecond), hedgeDelayUsage)
+	flag.StringVar(&replicationOptions.Primary, "primary", "", primaryUsage)
+	flag.IntVar(&maxStaleness, "max-staleness", 0, maxStalenessUsage)
+	flag.IntVar(&warmupInterval, "warmup-interval", int(skyd.DefaultWarmupInterval / time.Second), warmupIntervalUsage)
+	flag.IntVar(&warmupRate, "warmup-rate", skyd.DefaultWarmupRate >> 20, warmupRateUsage)
+	flag.StringVar(&traceOptions.Path, "trace-path", "", tracePathUsage)
+	flag.Float64Var(&traceOptions.SampleRate, "trace-sample-rate", 0.01, traceSampleRateUsage)
+	flag.StringVar(&compactionWindow, "compaction-window", "", compactionWindowUsage)
 }
 
 //--------------------------------------
@@ -69,12 +280,87 @@ func main() {
 	
 	// Initialize
 	server := skyd.NewServer(port, dataDir)
+	server.SetEventBlocksEnabled(eventBlocks)
+	server.SetNUMAEnabled(numa)
+	server.SetPartitionMonths(partitionMonths)
+	server.SetObjectBufferOptions(skyd.ObjectBufferOptions{Size: objectBufferSize << 20, Delay: time.Duration(objectBufferDelay) * time.Millisecond})
+	servletStorage.CacheSize <<= 20
+	servletStorage.CompressedCacheSize <<= 20
+	servletStorage.BlockSize <<= 10
+	servletStorage.IndexPartitionSize <<= 10
+	servletStorage.PinnedMetadataSize <<= 20
+	servletStorage.WriteBufferSize <<= 20
+	servletStorage.ArenaBlockSize <<= 10
+	servletStorage.HugePages = hugePages
+	servletStorage.BytesPerSync <<= 10
+	servletStorage.CompactionReadahead <<= 10
+	servletStorage.MinBlobSize <<= 10
+	servletStorage.TargetFileSize <<= 20
+	servletStorage.MaxBytesForLevelBase <<= 20
+	servletStorage.LogSyncInterval = time.Duration(logSyncInterval) * time.Microsecond
+	factorsStorage.CacheSize <<= 20
+	if compressionDictPath != "" {
+		dict, err := ioutil.ReadFile(compressionDictPath)
+		if err != nil {
+			fmt.Printf("%v\n", err)
+			return
+		}
+		servletStorage.CompressionDictionary = dict
+	}
+	if repairServlets != "" {
+		var indexes []int
+		for _, field := range strings.Split(repairServlets, ",") {
+			index, err := strconv.Atoi(strings.TrimSpace(field))
+			if err != nil {
+				fmt.Printf("Invalid servlet to repair: %s\n", field)
+				return
+			}
+			indexes = append(indexes, index)
+		}
+		server.SetRepairServlets(indexes)
+	}
+	server.SetCompressionThreshold(compressionThreshold << 10)
+	server.SetIngestPort(ingestPort)
+	server.SetServletStorageOptions(servletStorage)
+	server.SetFactorsStorageOptions(factorsStorage)
+	server.SetWriteRateLimits(skyd.WriteRateLimits{Foreground: writeRates.Foreground << 20, Background: writeRates.Background << 20})
+	engineOptions.GCStopBudget <<= 20
+	engineOptions.MemoryLimit <<= 20
+	engineOptions.SpillBudget <<= 20
+	engineOptions.HugePages = hugePages
+	server.SetEngineOptions(engineOptions)
+	schedulerOptions.QueryMemory <<= 20
+	schedulerOptions.QueryCPUTime = time.Duration(queryCPUTime) * time.Millisecond
+	server.SetQuerySchedulerOptions(schedulerOptions)
+	server.MemoryAccountant().SetBudget(int64(memoryBudget) << 20)
+	server.SetSharedScanWindow(time.Duration(sharedScanWindow) * time.Millisecond)
+	if err := server.SetQueryThreads(queryThreads, pinQueryThreads); err != nil {
+		fmt.Printf("%v\n", err)
+		return
+	}
+	server.SetClusterOptions(skyd.ClusterOptions{Peers: skyd.ParseClusterPeers(peers), HedgeDelay: time.Duration(hedgeDelay) * time.Millisecond})
+	replicationOptions.MaxStaleness = time.Duration(maxStaleness) * time.Millisecond
+	server.SetReplicationOptions(replicationOptions)
+	server.SetSlowQueryLogOptions(skyd.SlowQueryLogOptions{
+		Threshold: time.Duration(slowQueryTime) * time.Millisecond,
+		Path:      slowQueryLog,
+		MaxSize:   int64(slowQueryLogSize) << 20,
+		MaxFiles:  skyd.DefaultSlowQueryLogFiles,
+	})
+	server.SetWarmupOptions(skyd.WarmupOptions{Interval: time.Duration(warmupInterval) * time.Second, Rate: warmupRate << 20})
+	server.SetTraceOptions(traceOptions)
+	window, err := skyd.ParseCompactionWindow(compactionWindow)
+	if err != nil {
+		fmt.Printf("%v\n", err)
+		return
+	}
+	server.SetCompactionWindow(window)
 	writePidFile()
 	//setupSignalHandlers(server)
 	
 	// Start the server up!
 	c := make(chan bool)
-	err := server.ListenAndServe(c)
+	err = server.ListenAndServe(c)
 	if err != nil {
 		fmt.Printf("%v\n", err)
 		cleanup(server)
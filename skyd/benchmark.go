@@ -0,0 +1,570 @@
+package skyd
+
+import (
+	"encoding/json"
+	"fmt"
+	"io"
+	"math/rand"
+	"path/filepath"
+	"runtime"
+	"sort"
+	"strconv"
+	"strings"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The workloads run by the benchmark harness, in the order they run.
+var benchmarkQueries = []struct {
+	name  string
+	query string
+}{
+	{"count", `{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`},
+	{"groupby", `{"steps":[{"type":"selection","dimensions":["action"],"fields":[{"name":"count","expression":"count()"},{"name":"sum","expression":"sum(price)"}]}]}`},
+	{"funnel", `{"steps":[{"type":"condition","expression":"action == 'A0'","steps":[{"type":"condition","expression":"action == 'A1'","within":[1,5],"steps":[{"type":"selection","dimensions":["action"],"fields":[{"name":"count","expression":"count()"}]}]}]}]}`},
+	{"session", `{"sessionIdleTime":1800,"steps":[{"type":"condition","expression":"action == 'A0'","steps":[{"type":"condition","expression":"action == 'A1'","within":[1,5],"steps":[{"type":"selection","dimensions":["action"],"fields":[{"name":"count","expression":"count()"}]}]}]}]}`},
+}
+
+// The orders that the ingest workloads replay events in. "inorder" appends
+// every event to its object, "outoforder" shuffles the events of each
+// object so that most writes rewrite it and "late" holds back a tenth of
+// the events until the rest of their objects have been written.
+var ingestOrders = []string{"inorder", "outoforder", "late"}
+
+// The number of events written to a servlet at once.
+const benchmarkBatchSize = 1000
+
+// The number of objects whose events an ingest writer interleaves.
+const ingestWindowSize = 100
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// The shape of the synthetic clickstream table and the workloads that the
+// benchmark harness runs against it. Ingest workloads run once for each
+// servlet count with a number of concurrent writers.
+type BenchmarkOptions struct {
+	Objects           int
+	EventsPerObject   int
+	Properties        int
+	FactorCardinality int
+	Iterations        int
+	Benchmarks        []string
+	EventBlocks       bool
+	Seed              int64
+	Writers           int
+	IngestServlets    []int
+}
+
+// The measurements of a single workload. Query workloads fill in the query
+// fields and ingest workloads fill in the write fields.
+type BenchmarkResult struct {
+	Name                   string
+	Queries                int
+	EventsPerQuery         int
+	EventsPerSecondPerCore float64
+	P50                    time.Duration
+	P99                    time.Duration
+	AllocsPerQuery         uint64
+	BytesPerQuery          uint64
+
+	Servlets           int
+	Events             int
+	Elapsed            time.Duration
+	EventsPerSecond    float64
+	WriteAmplification float64
+	StallTime          time.Duration
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Returns the options that the benchmark harness runs with by default.
+func DefaultBenchmarkOptions() BenchmarkOptions {
+	return BenchmarkOptions{
+		Objects:           10000,
+		EventsPerObject:   100,
+		Properties:        4,
+		FactorCardinality: 20,
+		Iterations:        20,
+		Benchmarks:        []string{"count", "groupby", "funnel", "session", "ingest-inorder", "ingest-outoforder", "ingest-late"},
+		Seed:              301,
+		Writers:           runtime.NumCPU(),
+		IngestServlets:    []int{1, runtime.NumCPU()},
+	}
+}
+
+// Generates a synthetic clickstream table in a new server at a given path,
+// runs each requested workload and writes a report line per workload in the
+// style of db_bench. Query workloads run through RunQuery against a table
+// loaded up front, with the query cache disabled so that every query scans
+// the table. Ingest workloads replay events into new servlets.
+func RunBenchmarks(path string, options BenchmarkOptions, w io.Writer) ([]*BenchmarkResult, error) {
+	s := NewServer(0, path)
+	s.Silence()
+	s.SetEventBlocksEnabled(options.EventBlocks)
+	s.queryCache = NewQueryCache(0)
+	if err := s.open(); err != nil {
+		return nil, err
+	}
+	defer s.close()
+
+	fmt.Fprintf(w, "Objects:    %d\n", options.Objects)
+	fmt.Fprintf(w, "Events:     %d per object\n", options.EventsPerObject)
+	fmt.Fprintf(w, "Properties: %d (action cardinality %d)\n", options.Properties, options.FactorCardinality)
+	fmt.Fprintf(w, "Servlets:   %d\n", len(s.servlets))
+	fmt.Fprintf(w, "Writers:    %d\n", options.Writers)
+	fmt.Fprintf(w, "Cores:      %d\n", runtime.GOMAXPROCS(0))
+	fmt.Fprintf(w, "------------------------------------------------\n")
+
+	table, properties, err := s.createBenchmarkTable(options)
+	if err != nil {
+		return nil, err
+	}
+
+	results := make([]*BenchmarkResult, 0)
+	loaded := false
+	for _, name := range options.Benchmarks {
+		// Ingest workloads run once per servlet count.
+		if order := strings.TrimPrefix(name, "ingest-"); order != name {
+			if !isIngestOrder(order) {
+				return results, fmt.Errorf("skyd.Benchmark: Unknown benchmark: %s", name)
+			}
+			for _, servletCount := range options.IngestServlets {
+				result, err := s.runIngestBenchmark(table, properties, order, servletCount, options)
+				if err != nil {
+					return results, err
+				}
+				results = append(results, result)
+				fmt.Fprintf(w, "%-24s : %11.3f micros/event; %9.2f K events/s; %6.2f write amp; %8.3f s stalled\n",
+					fmt.Sprintf("%s/%d", result.Name, result.Servlets),
+					float64(result.Elapsed)/1e3/float64(result.Events),
+					result.EventsPerSecond/1e3,
+					result.WriteAmplification,
+					result.StallTime.Seconds())
+			}
+			continue
+		}
+
+		var source string
+		for _, q := range benchmarkQueries {
+			if q.name == name {
+				source = q.query
+			}
+		}
+		if source == "" {
+			return results, fmt.Errorf("skyd.Benchmark: Unknown benchmark: %s", name)
+		}
+		if !loaded {
+			if err := s.loadBenchmarkTable(table, properties, options, w); err != nil {
+				return results, err
+			}
+			loaded = true
+		}
+		result, err := s.runBenchmarkQuery(table, name, source, options)
+		if err != nil {
+			return results, err
+		}
+		results = append(results, result)
+		fmt.Fprintf(w, "%-24s : %11.3f ms/query; %7.2f MM events/core/s; p50 %.3f ms; p99 %.3f ms; %d allocs/query; %d bytes/query\n",
+			result.Name,
+			float64(totalDuration(result))/float64(result.Queries)/1e6,
+			result.EventsPerSecondPerCore/1e6,
+			float64(result.P50)/1e6,
+			float64(result.P99)/1e6,
+			result.AllocsPerQuery,
+			result.BytesPerQuery)
+	}
+	return results, nil
+}
+
+// Checks if a name is one of the ingest orders.
+func isIngestOrder(order string) bool {
+	for _, o := range ingestOrders {
+		if o == order {
+			return true
+		}
+	}
+	return false
+}
+
+// The estimated total time spent on a workload's queries.
+func totalDuration(result *BenchmarkResult) time.Duration {
+	if result.EventsPerSecondPerCore == 0 {
+		return 0
+	}
+	events := float64(result.EventsPerQuery) * float64(result.Queries)
+	return time.Duration(events / result.EventsPerSecondPerCore / float64(runtime.GOMAXPROCS(0)) * 1e9)
+}
+
+// Returns the given percentile of a sorted list of durations.
+func percentile(durations []time.Duration, p float64) time.Duration {
+	if len(durations) == 0 {
+		return 0
+	}
+	i := int(float64(len(durations)-1) * p)
+	return durations[i]
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// Creates the benchmark table with an action factor, a float price and
+// integer properties for the rest of the property count.
+func (s *Server) createBenchmarkTable(options BenchmarkOptions) (*Table, []*Property, error) {
+	table := NewTable("bench", s.TablePath("bench"))
+	if err := table.Create(); err != nil {
+		return nil, nil, err
+	}
+	table, err := s.OpenTable("bench")
+	if err != nil {
+		return nil, nil, err
+	}
+	properties := make([]*Property, 0)
+	for i := 0; i < options.Properties; i++ {
+		var p *Property
+		switch i {
+		case 0:
+			p, err = table.CreateProperty("action", false, FactorDataType)
+		case 1:
+			p, err = table.CreateProperty("price", true, FloatDataType)
+		default:
+			p, err = table.CreateProperty(fmt.Sprintf("p%d", i), true, IntegerDataType)
+		}
+		if err != nil {
+			return nil, nil, err
+		}
+		properties = append(properties, p)
+	}
+	return table, properties, nil
+}
+
+// Generates the factorized events of an object in time order. Every object
+// starts at the same time and its events are a random number of seconds
+// apart, up to ten minutes, so that sessions split on idle time.
+func (s *Server) generateBenchmarkEvents(table *Table, properties []*Property, r *rand.Rand, options BenchmarkOptions) ([]*Event, error) {
+	events := make([]*Event, 0, options.EventsPerObject)
+	timestamp := time.Date(2012, 1, 1, 0, 0, 0, 0, time.UTC)
+	for j := 0; j < options.EventsPerObject; j++ {
+		timestamp = timestamp.Add(time.Duration(1+r.Intn(600)) * time.Second)
+		event := &Event{Timestamp: timestamp, Data: map[int64]interface{}{}}
+		for _, p := range properties {
+			switch p.DataType {
+			case FactorDataType:
+				event.Data[p.Id] = fmt.Sprintf("A%d", r.Intn(options.FactorCardinality))
+			case FloatDataType:
+				event.Data[p.Id] = float64(r.Intn(10000)) / 100
+			default:
+				event.Data[p.Id] = int64(r.Intn(1000))
+			}
+		}
+		if err := table.FactorizeEvent(event, s.factors, true); err != nil {
+			return nil, err
+		}
+		events = append(events, event)
+	}
+	return events, nil
+}
+
+// Fills the benchmark table with events, written in batches per servlet.
+func (s *Server) loadBenchmarkTable(table *Table, properties []*Property, options BenchmarkOptions, w io.Writer) error {
+	startTime := time.Now()
+	r := rand.New(rand.NewSource(options.Seed))
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+	batches := make([]*bulkImportBatch, len(s.servlets))
+	flush := func(index int) error {
+		batch := batches[index]
+		batches[index] = nil
+		if batch == nil {
+			return nil
+		}
+		return s.servlets[index].PutEvents(table, batch.objectIds, batch.events, true)
+	}
+	for i := 0; i < options.Objects; i++ {
+		objectId := fmt.Sprintf("o%d", i)
+		index, err := s.GetObjectServletIndex(table, objectId)
+		if err != nil {
+			return err
+		}
+		events, err := s.generateBenchmarkEvents(table, properties, r, options)
+		if err != nil {
+			return err
+		}
+		for _, event := range events {
+			if batches[index] == nil {
+				batches[index] = &bulkImportBatch{}
+			}
+			batches[index].objectIds = append(batches[index].objectIds, objectId)
+			batches[index].events = append(batches[index].events, event)
+			if len(batches[index].events) >= benchmarkBatchSize {
+				if err = flush(int(index)); err != nil {
+					return err
+				}
+			}
+		}
+	}
+	for index := range batches {
+		if err := flush(index); err != nil {
+			return err
+		}
+	}
+
+	elapsed := time.Since(startTime)
+	events := options.Objects * options.EventsPerObject
+	fmt.Fprintf(w, "%-24s : %11.3f micros/event; %9.2f K events/s\n", "load", float64(elapsed)/1e3/float64(events), float64(events)/elapsed.Seconds()/1e3)
+	return nil
+}
+
+// Runs a query once to warm up the engine pool and then a number of times
+// while measuring latency and allocations.
+func (s *Server) runBenchmarkQuery(table *Table, name string, source string, options BenchmarkOptions) (*BenchmarkResult, error) {
+	var params map[string]interface{}
+	if err := json.Unmarshal([]byte(source), &params); err != nil {
+		return nil, err
+	}
+	run := func() error {
+		query := NewQuery(table, s.factors)
+		if err := query.Deserialize(params); err != nil {
+			return err
+		}
+		_, err := s.RunQuery(table, query)
+		return err
+	}
+	if err := run(); err != nil {
+		return nil, err
+	}
+
+	iterations := options.Iterations
+	if iterations < 1 {
+		iterations = 1
+	}
+	durations := make([]time.Duration, 0, iterations)
+	var before, after runtime.MemStats
+	runtime.GC()
+	runtime.ReadMemStats(&before)
+	var total time.Duration
+	for i := 0; i < iterations; i++ {
+		start := time.Now()
+		if err := run(); err != nil {
+			return nil, err
+		}
+		d := time.Since(start)
+		durations = append(durations, d)
+		total += d
+	}
+	runtime.ReadMemStats(&after)
+	sort.Sort(durationList(durations))
+
+	events := options.Objects * options.EventsPerObject
+	result := &BenchmarkResult{
+		Name:           name,
+		Queries:        iterations,
+		EventsPerQuery: events,
+		P50:            percentile(durations, 0.50),
+		P99:            percentile(durations, 0.99),
+		AllocsPerQuery: (after.Mallocs - before.Mallocs) / uint64(iterations),
+		BytesPerQuery:  (after.TotalAlloc - before.TotalAlloc) / uint64(iterations),
+	}
+	if total > 0 {
+		result.EventsPerSecondPerCore = float64(events) * float64(iterations) / total.Seconds() / float64(runtime.GOMAXPROCS(0))
+	}
+	return result, nil
+}
+
+//--------------------------------------
+// Ingest
+//--------------------------------------
+
+// Replays the table's events in a given order into a number of new servlets
+// with concurrent writers and measures the write rate, the LevelDB write
+// amplification and the time that writes stalled. Objects are spread over
+// the writers and the servlets by their index so that each object is only
+// written by one writer.
+func (s *Server) runIngestBenchmark(table *Table, properties []*Property, order string, servletCount int, options BenchmarkOptions) (*BenchmarkResult, error) {
+	dir := filepath.Join(s.path, "ingest", fmt.Sprintf("%s-%d", order, servletCount))
+	servlets := make([]*Servlet, 0, servletCount)
+	defer func() {
+		for _, servlet := range servlets {
+			servlet.Close()
+		}
+	}()
+	for i := 0; i < servletCount; i++ {
+		servlet := NewServlet(filepath.Join(dir, strconv.Itoa(i)), s.factors)
+		servlet.SetEventBlocksEnabled(s.eventBlocks)
+		servlet.setStorage(s.storage)
+		if err := servlet.Open(); err != nil {
+			return nil, err
+		}
+		servlets = append(servlets, servlet)
+	}
+
+	writers := options.Writers
+	if writers < 1 {
+		writers = 1
+	}
+	startTime := time.Now()
+	errs := make(chan error, writers)
+	for k := 0; k < writers; k++ {
+		go func(k int) {
+			errs <- s.runIngestWriter(table, properties, servlets, order, k, writers, options)
+		}(k)
+	}
+	var err error
+	for k := 0; k < writers; k++ {
+		if e := <-errs; e != nil && err == nil {
+			err = e
+		}
+	}
+	elapsed := time.Since(startTime)
+	if err != nil {
+		return nil, err
+	}
+
+	result := &BenchmarkResult{
+		Name:     "ingest-" + order,
+		Servlets: servletCount,
+		Events:   options.Objects * options.EventsPerObject,
+		Elapsed:  elapsed,
+	}
+	if elapsed > 0 {
+		result.EventsPerSecond = float64(result.Events) / elapsed.Seconds()
+	}
+	var written, compacted uint64
+	for _, servlet := range servlets {
+		w, c, stall := servlet.writeStats()
+		written, compacted = written+w, compacted+c
+		result.StallTime += stall
+	}
+	if written > 0 {
+		result.WriteAmplification = float64(written+compacted) / float64(written)
+	}
+	return result, nil
+}
+
+// Writes the events of every nth object in a given order. The events of a
+// window of objects are interleaved the way a live event stream would
+// interleave them. Events are generated and factorized as they're written,
+// like the import handler does.
+func (s *Server) runIngestWriter(table *Table, properties []*Property, servlets []*Servlet, order string, k int, writers int, options BenchmarkOptions) error {
+	r := rand.New(rand.NewSource(options.Seed + int64(k)))
+	batches := make([]*bulkImportBatch, len(servlets))
+	flush := func(index int) error {
+		batch := batches[index]
+		batches[index] = nil
+		if batch == nil {
+			return nil
+		}
+		return servlets[index].PutEvents(table, batch.objectIds, batch.events, true)
+	}
+	add := func(objectIndex int, event *Event) error {
+		index := objectIndex % len(servlets)
+		if batches[index] == nil {
+			batches[index] = &bulkImportBatch{}
+		}
+		batches[index].objectIds = append(batches[index].objectIds, fmt.Sprintf("o%d", objectIndex))
+		batches[index].events = append(batches[index].events, event)
+		if len(batches[index].events) >= benchmarkBatchSize {
+			return flush(index)
+		}
+		return nil
+	}
+
+	// Writes a window of objects round-robin, holding back late events
+	// until the end of the window.
+	type pendingEvent struct {
+		objectIndex int
+		event       *Event
+	}
+	indices := make([]int, 0, ingestWindowSize)
+	window := make([][]*Event, 0, ingestWindowSize)
+	emit := func() error {
+		late := make([]pendingEvent, 0)
+		for j := 0; j < options.EventsPerObject; j++ {
+			for i, events := range window {
+				if order == "late" && j > 0 && r.Intn(10) == 0 {
+					late = append(late, pendingEvent{indices[i], events[j]})
+				} else if err := add(indices[i], events[j]); err != nil {
+					return err
+				}
+			}
+		}
+		for _, p := range late {
+			if err := add(p.objectIndex, p.event); err != nil {
+				return err
+			}
+		}
+		indices, window = indices[:0], window[:0]
+		return nil
+	}
+
+	for i := k; i < options.Objects; i += writers {
+		events, err := s.generateBenchmarkEvents(table, properties, r, options)
+		if err != nil {
+			return err
+		}
+		if order == "outoforder" {
+			shuffled := make([]*Event, len(events))
+			for j, n := range r.Perm(len(events)) {
+				shuffled[j] = events[n]
+			}
+			events = shuffled
+		}
+		indices, window = append(indices, i), append(window, events)
+		if len(window) == ingestWindowSize {
+			if err = emit(); err != nil {
+				return err
+			}
+		}
+	}
+	if err := emit(); err != nil {
+		return err
+	}
+	for index := range batches {
+		if err := flush(index); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// Returns the bytes written to the servlet's LevelDB log, the bytes written
+// by its memtable flushes and compactions and the time its writes stalled.
+func (s *Servlet) writeStats() (uint64, uint64, time.Duration) {
+	written, _ := strconv.ParseUint(s.db.PropertyValue("leveldb.bytes-written"), 10, 64)
+	compacted, _ := strconv.ParseUint(s.db.PropertyValue("leveldb.compaction-bytes-written"), 10, 64)
+	stall, _ := strconv.ParseInt(s.db.PropertyValue("leveldb.stall-micros"), 10, 64)
+	return written, compacted, time.Duration(stall) * time.Microsecond
+}
+
+//--------------------------------------
+// Sorting
+//--------------------------------------
+
+type durationList []time.Duration
+
+func (l durationList) Len() int {
+	return len(l)
+}
+
+func (l durationList) Less(i, j int) bool {
+	return l[i] < l[j]
+}
+
+func (l durationList) Swap(i, j int) {
+	l[i], l[j] = l[j], l[i]
+}
@@ -0,0 +1,45 @@
+package skyd
+
+import (
+	"bytes"
+	"io/ioutil"
+	"os"
+	"testing"
+)
+
+// Ensure that the benchmark harness loads a table and runs every workload.
+func TestRunBenchmarks(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+
+	options := DefaultBenchmarkOptions()
+	options.Objects = 20
+	options.EventsPerObject = 10
+	options.FactorCardinality = 3
+	options.Iterations = 2
+	options.Writers = 2
+	options.IngestServlets = []int{1, 2}
+	var output bytes.Buffer
+	results, err := RunBenchmarks(path, options, &output)
+	if err != nil {
+		t.Fatalf("Unable to run benchmarks: %v", err)
+	}
+	if len(results) != 4+3*2 {
+		t.Fatalf("Wrong result count: exp: %v, got: %v", 4+3*2, len(results))
+	}
+	for _, result := range results[:4] {
+		if result.Queries != 2 || result.EventsPerQuery != 200 || result.P99 < result.P50 {
+			t.Fatalf("Unexpected query result: %v", result)
+		}
+	}
+	for _, result := range results[4:] {
+		if result.Events != 200 || result.WriteAmplification < 1 {
+			t.Fatalf("Unexpected ingest result: %v", result)
+		}
+	}
+
+	options.Benchmarks = []string{"nope"}
+	if _, err = RunBenchmarks(path+"/other", options, &output); err == nil {
+		t.Fatalf("Expected unknown benchmark error")
+	}
+}
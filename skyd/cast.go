@@ -1,12 +1,18 @@
 package skyd
 
 import (
+	"fmt"
 	"reflect"
 )
 
 // Normalizes a value. Int and Uint types are combined into int64 and Float types
-// are combined into float64. All other types are left alone.
+// are combined into float64. All other types are left alone. Values that are
+// already normalized are returned as they are so they aren't boxed again.
 func normalize(value interface{}) interface{} {
+	switch value.(type) {
+	case int64, float64, string, bool, nil:
+		return value
+	}
 	v := reflect.ValueOf(value)
 	switch v.Kind() {
 	case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64:
@@ -18,3 +24,60 @@ func normalize(value interface{}) interface{} {
 	}
 	return value
 }
+
+// Adds two numeric values. Integers stay integers unless either value is a
+// float.
+func addNumbers(a interface{}, b interface{}) (interface{}, error) {
+	a, b = normalize(a), normalize(b)
+	if x, ok := a.(int64); ok {
+		if y, ok := b.(int64); ok {
+			return x + y, nil
+		}
+	}
+	x, xok := toFloat(a)
+	y, yok := toFloat(b)
+	if !xok || !yok {
+		return nil, fmt.Errorf("skyd: Unable to add non-numeric values: %v, %v", a, b)
+	}
+	return x + y, nil
+}
+
+// Compares two numbers or two strings. Returns -1, 0 or 1 if a is less
+// than, equal to or greater than b.
+func compareValues(a interface{}, b interface{}) (int, error) {
+	a, b = normalize(a), normalize(b)
+	if x, ok := a.(string); ok {
+		if y, ok := b.(string); ok {
+			switch {
+			case x < y:
+				return -1, nil
+			case x > y:
+				return 1, nil
+			}
+			return 0, nil
+		}
+	}
+	x, xok := toFloat(a)
+	y, yok := toFloat(b)
+	if !xok || !yok {
+		return 0, fmt.Errorf("skyd: Unable to compare values: %v, %v", a, b)
+	}
+	switch {
+	case x < y:
+		return -1, nil
+	case x > y:
+		return 1, nil
+	}
+	return 0, nil
+}
+
+// Converts a normalized numeric value to a float.
+func toFloat(value interface{}) (float64, bool) {
+	switch v := value.(type) {
+	case int64:
+		return float64(v), true
+	case float64:
+		return v, true
+	}
+	return 0, false
+}
@@ -0,0 +1,249 @@
+package skyd
+
+import (
+	"fmt"
+	"io"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strings"
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A file in a checkpoint. Files that aren't new are held with the same
+// contents by the checkpoint that it was compared against so that backups
+// only have to ship the new ones.
+type CheckpointFile struct {
+	Path string `json:"path"`
+	Size int64  `json:"size"`
+	New  bool   `json:"new"`
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// Writes a copy of the server's data to a directory while reads and writes
+// continue. The data files of each database and the frozen files are hard
+// linked rather than copied so a checkpoint costs little more than a
+// flush. Writing to a directory that holds an earlier checkpoint only adds
+// the files written since and removes the ones that are no longer used.
+//
+// Each database is checkpointed at its own point in time. Servlets are
+// checkpointed before the factors and tables so that every factor and
+// property that their events use is in the checkpoint. Returns the files
+// in the checkpoint, marked new unless the checkpoint at "since" holds the
+// same immutable file.
+func (s *Server) Checkpoint(path string, since string) ([]*CheckpointFile, error) {
+	if path == "" {
+		return nil, fmt.Errorf("skyd.Server: Checkpoint path required")
+	}
+	if rel, err := filepath.Rel(s.path, path); err != nil || !strings.HasPrefix(rel, "..") {
+		return nil, fmt.Errorf("skyd.Server: Checkpoint path must be outside the server path: %s", path)
+	}
+
+	s.checkpointMutex.Lock()
+	defer s.checkpointMutex.Unlock()
+
+	// Objects aren't moved between servlets while they're checkpointed.
+	s.placement.RLock()
+	err := s.checkpointServlets(path)
+	s.placement.RUnlock()
+	if err != nil {
+		return nil, err
+	}
+	if err := createCheckpoint(s.factors.db, filepath.Join(path, "factors")); err != nil {
+		return nil, err
+	}
+	if err := s.checkpointTables(path); err != nil {
+		return nil, err
+	}
+	if err := copyFile(s.PlacementPath(), filepath.Join(path, "data", "placement")); err != nil && !os.IsNotExist(err) {
+		return nil, err
+	}
+	return checkpointFiles(path, since)
+}
+
+// Checkpoints every servlet and its partitions and separate stores under
+// the same relative paths that they have in the server path. Partitions and
+// stores that were dropped since an earlier checkpoint are removed. Memory
+// tables aren't included.
+func (s *Server) checkpointServlets(path string) error {
+	for _, servlet := range s.servlets {
+		checkpointed := make(map[string]bool)
+		err := servlet.eachPartition(func(servlet *Servlet) error {
+			if servlet.inMemory() {
+				return nil
+			}
+			rel, err := filepath.Rel(s.path, servlet.path)
+			if err != nil {
+				return err
+			}
+			checkpointed[rel] = true
+			return servlet.checkpoint(filepath.Join(path, rel))
+		})
+		if err != nil {
+			return err
+		}
+
+		for _, parent := range []string{servlet.partitionPath(), filepath.Join(servlet.path, separateStoreDir)} {
+			rel, err := filepath.Rel(s.path, parent)
+			if err != nil {
+				return err
+			}
+			dir := filepath.Join(path, rel)
+			infos, err := ioutil.ReadDir(dir)
+			if err != nil && !os.IsNotExist(err) {
+				return err
+			}
+			for _, info := range infos {
+				if !checkpointed[filepath.Join(rel, info.Name())] {
+					if err := os.RemoveAll(filepath.Join(dir, info.Name())); err != nil {
+						return err
+					}
+				}
+			}
+		}
+	}
+	return nil
+}
+
+// Copies the properties and settings of every table. Tables are small so
+// they're copied whole.
+func (s *Server) checkpointTables(path string) error {
+	dir := filepath.Join(path, "tables")
+	if err := os.RemoveAll(dir); err != nil {
+		return err
+	}
+	return filepath.Walk(s.TablesPath(), func(src string, info os.FileInfo, err error) error {
+		if err != nil {
+			return err
+		}
+		rel, err := filepath.Rel(s.TablesPath(), src)
+		if err != nil {
+			return err
+		}
+		if info.IsDir() {
+			return os.MkdirAll(filepath.Join(dir, rel), 0700)
+		}
+		return copyFile(src, filepath.Join(dir, rel))
+	})
+}
+
+// Checkpoints the servlet's database along with its frozen files. Freezing
+// waits so that every object is in either the database or a frozen file.
+func (s *Servlet) checkpoint(path string) error {
+	s.frozenMutex.RLock()
+	defer s.frozenMutex.RUnlock()
+	if err := createCheckpoint(s.db, path); err != nil {
+		return err
+	}
+
+	dir := filepath.Join(path, "frozen")
+	names := make(map[string]bool)
+	for _, files := range s.frozen {
+		for _, f := range files {
+			if err := os.MkdirAll(dir, 0700); err != nil {
+				return err
+			}
+			name := filepath.Base(f.path)
+			names[name] = true
+			if _, err := os.Stat(filepath.Join(dir, name)); err == nil {
+				continue
+			}
+			if err := linkFile(f.path, filepath.Join(dir, name)); err != nil {
+				return err
+			}
+		}
+	}
+
+	// Remove the files of tables that were deleted since.
+	infos, err := ioutil.ReadDir(dir)
+	if err != nil && !os.IsNotExist(err) {
+		return err
+	}
+	for _, info := range infos {
+		if !names[info.Name()] {
+			if err := os.Remove(filepath.Join(dir, info.Name())); err != nil {
+				return err
+			}
+		}
+	}
+	return nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Lists the files in a checkpoint. Data files, blob files and frozen files
+// are never rewritten so the ones that the checkpoint at "since" holds with the same
+// size aren't new.
+func checkpointFiles(path string, since string) ([]*CheckpointFile, error) {
+	files := make([]*CheckpointFile, 0)
+	err := filepath.Walk(path, func(p string, info os.FileInfo, err error) error {
+		if err != nil || info.IsDir() {
+			return err
+		}
+		rel, err := filepath.Rel(path, p)
+		if err != nil {
+			return err
+		}
+		file := &CheckpointFile{Path: rel, Size: info.Size(), New: true}
+		if since != "" && (strings.HasSuffix(rel, ".sst") || strings.HasSuffix(rel, ".blob") || strings.HasSuffix(rel, frozenFileExt)) {
+			if prev, err := os.Stat(filepath.Join(since, rel)); err == nil && prev.Size() == info.Size() {
+				file.New = false
+			}
+		}
+		files = append(files, file)
+		return nil
+	})
+	return files, err
+}
+
+// Hard links a file, or copies it where links aren't supported.
+func linkFile(src string, target string) error {
+	if err := os.Link(src, target); err == nil {
+		return nil
+	}
+	return copyFile(src, target)
+}
+
+// Copies a file through a temporary file so that a failed copy doesn't
+// leave a partial file behind.
+func copyFile(src string, target string) error {
+	r, err := os.Open(src)
+	if err != nil {
+		return err
+	}
+	defer r.Close()
+	if err := os.MkdirAll(filepath.Dir(target), 0700); err != nil {
+		return err
+	}
+	w, err := os.OpenFile(target+".tmp", os.O_WRONLY|os.O_CREATE|os.O_TRUNC, 0600)
+	if err != nil {
+		return err
+	}
+	if _, err = io.Copy(w, r); err == nil {
+		err = w.Sync()
+	}
+	if closeErr := w.Close(); err == nil {
+		err = closeErr
+	}
+	if err == nil {
+		err = os.Rename(target+".tmp", target)
+	}
+	if err != nil {
+		os.Remove(target + ".tmp")
+	}
+	return err
+}
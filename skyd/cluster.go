@@ -0,0 +1,246 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/json"
+	"fmt"
+	"github.com/ugorji/go-msgpack"
+	"io/ioutil"
+	"net/http"
+	"net/url"
+	"strings"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The time that a coordinator waits on a replica of a peer before it sends
+// the same request to the next replica.
+const DefaultClusterHedgeDelay = 100 * time.Millisecond
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// The peers that a server coordinates queries across. Each peer owns its
+// own servlets and is listed as the addresses of its replicas, which hold
+// the same data. A server with peers runs each query on its own servlets
+// and on one replica of every peer and merges the partial results.
+type ClusterOptions struct {
+	// The "host:port" addresses of the replicas of each peer.
+	Peers [][]string
+
+	// The time to wait on a replica before also asking the next one. The
+	// first replica to answer is used. Zero uses the default delay.
+	HedgeDelay time.Duration
+}
+
+// The partial result of a peer or the error that it failed with.
+type clusterResult struct {
+	result map[interface{}]interface{}
+	err    error
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Parses a list of peers in the form "host:port|host:port,host:port" where
+// peers are separated by commas and the replicas of a peer by pipes.
+func ParseClusterPeers(value string) [][]string {
+	peers := make([][]string, 0)
+	for _, peer := range strings.Split(value, ",") {
+		replicas := make([]string, 0)
+		for _, replica := range strings.Split(peer, "|") {
+			if replica = strings.TrimSpace(replica); replica != "" {
+				replicas = append(replicas, replica)
+			}
+		}
+		if len(replicas) > 0 {
+			peers = append(peers, replicas)
+		}
+	}
+	return peers
+}
+
+// Converts the numbers in a decoded query result, including map keys, to
+// int64 and float64 so that results decoded from different sources merge
+// into the same groups.
+func normalizeQueryResult(value interface{}) interface{} {
+	if m, ok := value.(map[interface{}]interface{}); ok {
+		result := make(map[interface{}]interface{}, len(m))
+		for k, v := range m {
+			result[normalize(k)] = normalizeQueryResult(v)
+		}
+		return result
+	}
+	return normalize(value)
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Options
+//--------------------------------------
+
+// The peers that queries are coordinated across.
+func (s *Server) ClusterOptions() ClusterOptions {
+	return s.cluster
+}
+
+// Sets the peers that queries are coordinated across.
+func (s *Server) SetClusterOptions(options ClusterOptions) {
+	s.cluster = options
+}
+
+// Whether queries are coordinated across peers.
+func (s *Server) clustered() bool {
+	return len(s.cluster.Peers) > 0
+}
+
+//--------------------------------------
+// Queries
+//--------------------------------------
+
+// Runs a query against the server's own servlets and returns the merged,
+// defactorized result before it's finalized so that it can be merged with
+// the results of other servers.
+func (s *Server) RunQueryPartial(table *Table, query *Query) (map[interface{}]interface{}, error) {
+	var result interface{}
+	err := s.RunQueryPartials(table, query, func(partial map[interface{}]interface{}) error {
+		var err error
+		result, err = query.Merge(result, normalizeQueryResult(partial))
+		return err
+	})
+	if err != nil {
+		return nil, err
+	}
+	if m, ok := result.(map[interface{}]interface{}); ok {
+		return m, nil
+	}
+	return make(map[interface{}]interface{}), nil
+}
+
+// Runs a query on the server's own servlets and on every peer and merges
+// their partial results. Options such as the priority and timeout are
+// passed on to the peers. Each peer's replicas are asked in turn until one
+// answers, with the next one asked as soon as one fails or once the hedge
+// delay passes without an answer.
+func (s *Server) RunClusterQuery(table *Table, query *Query, options url.Values) (interface{}, error) {
+	body, err := json.Marshal(query.Serialize())
+	if err != nil {
+		return nil, err
+	}
+	path := fmt.Sprintf("/tables/%s/query/partial?%s", url.QueryEscape(table.Name), options.Encode())
+
+	rchannel := make(chan interface{}, len(s.cluster.Peers)+1)
+	send := func(result map[interface{}]interface{}, err error) {
+		if err != nil {
+			rchannel <- err
+		} else {
+			rchannel <- result
+		}
+	}
+	go func() {
+		send(s.RunQueryPartial(table, query))
+	}()
+	for _, replicas := range s.cluster.Peers {
+		go func(replicas []string) {
+			send(s.queryPeer(replicas, path, body))
+		}(replicas)
+	}
+
+	var mergeTime int64
+	pending, err := mergeQueryResults(query, rchannel, cap(rchannel), &mergeTime)
+	if err != nil {
+		return nil, err
+	}
+	result, ok := pending.(map[interface{}]interface{})
+	if !ok {
+		result = make(map[interface{}]interface{})
+	}
+	if err = query.Finalize(result); err != nil {
+		return nil, err
+	}
+	return result, nil
+}
+
+// Asks the replicas of a peer for a partial result, hedging slow replicas
+// with the next one. Requests that lose are left to finish on their own.
+func (s *Server) queryPeer(replicas []string, path string, body []byte) (map[interface{}]interface{}, error) {
+	delay := s.cluster.HedgeDelay
+	if delay <= 0 {
+		delay = DefaultClusterHedgeDelay
+	}
+	results := make(chan *clusterResult, len(replicas))
+	next := 0
+	start := func() {
+		address := replicas[next]
+		next++
+		go func() {
+			result, err := queryPeerReplica(address, path, body)
+			results <- &clusterResult{result, err}
+		}()
+	}
+
+	start()
+	timer := time.NewTimer(delay)
+	defer timer.Stop()
+	var err error
+	for pending := 1; pending > 0; {
+		select {
+		case r := <-results:
+			pending--
+			if r.err == nil {
+				return r.result, nil
+			}
+			err = r.err
+			if next < len(replicas) {
+				start()
+				pending++
+			}
+		case <-timer.C:
+			if next < len(replicas) {
+				start()
+				pending++
+				timer.Reset(delay)
+			}
+		}
+	}
+	return nil, err
+}
+
+// Requests a partial result from a single replica.
+func queryPeerReplica(address string, path string, body []byte) (map[interface{}]interface{}, error) {
+	resp, err := http.Post("http://"+address+path, "application/json", bytes.NewReader(body))
+	if err != nil {
+		return nil, err
+	}
+	defer resp.Body.Close()
+	if resp.StatusCode != http.StatusOK {
+		message, _ := ioutil.ReadAll(resp.Body)
+		return nil, fmt.Errorf("skyd.Server: Peer %s failed: %s", address, bytes.TrimSpace(message))
+	}
+
+	var raw interface{}
+	if err := msgpack.NewDecoder(resp.Body, nil).Decode(&raw); err != nil {
+		return nil, fmt.Errorf("skyd.Server: Invalid result from peer %s: %v", address, err)
+	}
+	result, ok := normalizeQueryResult(raw).(map[interface{}]interface{})
+	if !ok {
+		return nil, fmt.Errorf("skyd.Server: Invalid result from peer %s", address)
+	}
+	return result, nil
+}
@@ -0,0 +1,419 @@
+package skyd
+
+import (
+	"errors"
+	"fmt"
+	"github.com/jmhodges/levigo"
+	"sync"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The approximate size of the key ranges that a table is compacted in.
+// Each range is a separate LevelDB compaction, so a table compaction can be
+// paced, paused outside its window and cancelled between them.
+const compactionChunkSize = 64 << 20
+
+// The states of a table compaction.
+const (
+	CompactionWaiting   = "waiting"
+	CompactionRunning   = "running"
+	CompactionDone      = "done"
+	CompactionFailed    = "failed"
+	CompactionCancelled = "cancelled"
+)
+
+//------------------------------------------------------------------------------
+//
+// Errors
+//
+//------------------------------------------------------------------------------
+
+var errCompactionCancelled = errors.New("skyd.Server: Compaction cancelled")
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// CompactionWindow is the off-peak time of each day that scheduled table
+// compactions run in, as offsets from midnight in the server's time zone.
+// A window that ends before it starts runs past midnight. An empty window
+// means that no off-peak time is set.
+type CompactionWindow struct {
+	Start time.Duration
+	End   time.Duration
+}
+
+// A TableCompaction is a manual compaction of the keys of a table in one
+// servlet or in all of them, along with its partitions and table stores.
+// The compaction is paced to a number of bytes a second by the approximate
+// size of each range, on top of the background write rate limit that every
+// compaction's writes are held to.
+type TableCompaction struct {
+	Table        string     `json:"table"`
+	Servlet      int        `json:"servlet"`
+	Rate         int        `json:"rate"`
+	OffPeak      bool       `json:"offPeak"`
+	State        string     `json:"state"`
+	Error        string     `json:"error,omitempty"`
+	Servlets     int        `json:"servlets"`
+	ServletsDone int        `json:"servletsDone"`
+	Bytes        uint64     `json:"bytes"`
+	BytesDone    uint64     `json:"bytesDone"`
+	StartTime    time.Time  `json:"startTime"`
+	EndTime      *time.Time `json:"endTime,omitempty"`
+	stop         chan bool
+	done         chan bool
+}
+
+// The manual compactions of a server's tables. The last compaction of each
+// table is kept so that its outcome can be read after it finishes.
+type compactionSet struct {
+	sync.Mutex
+	compactions map[string]*TableCompaction
+	wait        sync.WaitGroup
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+func newCompactionSet() *compactionSet {
+	return &compactionSet{compactions: make(map[string]*TableCompaction)}
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Parses a window in the "HH:MM-HH:MM" format. An empty string is an empty
+// window.
+func ParseCompactionWindow(str string) (CompactionWindow, error) {
+	var w CompactionWindow
+	if str == "" {
+		return w, nil
+	}
+	var h0, m0, h1, m1 int
+	if n, _ := fmt.Sscanf(str, "%d:%d-%d:%d", &h0, &m0, &h1, &m1); n != 4 || h0 < 0 || h0 > 23 || m0 < 0 || m0 > 59 || h1 < 0 || h1 > 24 || m1 < 0 || m1 > 59 {
+		return w, fmt.Errorf("skyd: Invalid compaction window: %s", str)
+	}
+	w.Start = time.Duration(h0)*time.Hour + time.Duration(m0)*time.Minute
+	w.End = time.Duration(h1)*time.Hour + time.Duration(m1)*time.Minute
+	return w, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Options
+//--------------------------------------
+
+// The daily window that off-peak compactions run in.
+func (s *Server) CompactionWindow() CompactionWindow {
+	return s.compactWindow
+}
+
+// Sets the daily window that off-peak compactions run in. This should be set
+// before the server is opened.
+func (s *Server) SetCompactionWindow(window CompactionWindow) {
+	s.compactWindow = window
+}
+
+//--------------------------------------
+// Server
+//--------------------------------------
+
+// Starts compacting the keys of a table in the background on a servlet, or
+// on every servlet if the index is negative. The compaction is paced to a
+// number of bytes a second, or runs as fast as the background write rate
+// limit allows if it's zero. Off-peak compactions only run during the
+// server's compaction window. A table can only have one compaction running.
+func (s *Server) CompactTable(table *Table, servlet int, rate int, offPeak bool) (*TableCompaction, error) {
+	if servlet >= len(s.servlets) {
+		return nil, fmt.Errorf("skyd.Server: Invalid servlet: %d", servlet)
+	} else if rate < 0 {
+		return nil, fmt.Errorf("skyd.Server: Invalid compaction rate: %d", rate)
+	} else if offPeak && s.compactWindow.Start == s.compactWindow.End {
+		return nil, errors.New("skyd.Server: No compaction window is set")
+	}
+	prefix, err := table.Prefix()
+	if err != nil {
+		return nil, err
+	}
+	servlets := s.servlets
+	if servlet >= 0 {
+		servlets = servlets[servlet : servlet+1]
+	} else {
+		servlet = -1
+	}
+
+	set := s.compactions
+	set.Lock()
+	defer set.Unlock()
+	if c := set.compactions[table.Name]; c != nil && c.EndTime == nil {
+		return nil, fmt.Errorf("skyd.Server: Table is already being compacted: %s", table.Name)
+	}
+	c := &TableCompaction{
+		Table:     table.Name,
+		Servlet:   servlet,
+		Rate:      rate,
+		OffPeak:   offPeak,
+		State:     CompactionWaiting,
+		Servlets:  len(servlets),
+		StartTime: time.Now().UTC(),
+		stop:      make(chan bool),
+		done:      make(chan bool),
+	}
+	for _, servlet := range servlets {
+		size, err := servlet.storedTableSize(prefix)
+		if err != nil {
+			return nil, err
+		}
+		c.Bytes += size
+	}
+	set.compactions[table.Name] = c
+
+	set.wait.Add(1)
+	go func() {
+		defer set.wait.Done()
+		defer close(c.done)
+		err := s.runCompaction(c, servlets, prefix)
+		set.Lock()
+		defer set.Unlock()
+		now := time.Now().UTC()
+		c.EndTime = &now
+		if err == errCompactionCancelled {
+			c.State = CompactionCancelled
+		} else if err != nil {
+			c.State, c.Error = CompactionFailed, err.Error()
+			s.logger.Printf("ERROR Unable to compact %s: %v", c.Table, err)
+		} else {
+			c.State = CompactionDone
+		}
+	}()
+	return c.copy(), nil
+}
+
+// Returns the progress of the last compaction of a table or nil if it
+// hasn't been compacted since the server opened.
+func (s *Server) TableCompaction(table *Table) *TableCompaction {
+	set := s.compactions
+	set.Lock()
+	defer set.Unlock()
+	if c := set.compactions[table.Name]; c != nil {
+		return c.copy()
+	}
+	return nil
+}
+
+// Cancels the compaction of a table between two ranges and waits for it to
+// stop. Returns its progress or nil if it isn't running.
+func (s *Server) CancelTableCompaction(table *Table) *TableCompaction {
+	set := s.compactions
+	set.Lock()
+	c := set.compactions[table.Name]
+	if c == nil || c.EndTime != nil {
+		set.Unlock()
+		return nil
+	}
+	c.cancel()
+	set.Unlock()
+	<-c.done
+	return s.TableCompaction(table)
+}
+
+// Cancels every compaction and waits for them to stop so that the servlets
+// can be closed.
+func (s *Server) stopCompactions() {
+	set := s.compactions
+	set.Lock()
+	for _, c := range set.compactions {
+		if c.EndTime == nil {
+			c.cancel()
+		}
+	}
+	set.Unlock()
+	set.wait.Wait()
+}
+
+// Compacts each servlet in turn, a range at a time, waiting for the window
+// before each range of an off-peak compaction and pacing the ranges to the
+// compaction's rate.
+func (s *Server) runCompaction(c *TableCompaction, servlets []*Servlet, prefix []byte) error {
+	for _, servlet := range servlets {
+		err := servlet.eachPartition(func(servlet *Servlet) error {
+			ranges, sizes, err := servlet.compactionRanges(prefix)
+			if err != nil {
+				return err
+			}
+			for i, r := range ranges {
+				if err := s.waitForCompactionWindow(c); err != nil {
+					return err
+				}
+				t0 := time.Now()
+				servlet.db.CompactRange(r)
+				s.compactions.Lock()
+				c.BytesDone += sizes[i]
+				s.compactions.Unlock()
+				if c.Rate > 0 {
+					if err := c.sleep(time.Duration(sizes[i])*time.Second/time.Duration(c.Rate) - time.Since(t0)); err != nil {
+						return err
+					}
+				}
+			}
+			return nil
+		})
+		if err != nil {
+			return err
+		}
+		s.compactions.Lock()
+		c.ServletsDone++
+		s.compactions.Unlock()
+	}
+	return nil
+}
+
+// Waits until the server's compaction window opens if the compaction is
+// off-peak and marks it as running.
+func (s *Server) waitForCompactionWindow(c *TableCompaction) error {
+	for c.OffPeak {
+		d := s.compactWindow.wait(time.Now())
+		if d <= 0 {
+			break
+		}
+		s.compactions.Lock()
+		c.State = CompactionWaiting
+		s.compactions.Unlock()
+		if err := c.sleep(d); err != nil {
+			return err
+		}
+	}
+	s.compactions.Lock()
+	c.State = CompactionRunning
+	s.compactions.Unlock()
+	return nil
+}
+
+//--------------------------------------
+// Compaction
+//--------------------------------------
+
+// Sleeps for a duration unless the compaction is cancelled first.
+func (c *TableCompaction) sleep(d time.Duration) error {
+	if d <= 0 {
+		select {
+		case <-c.stop:
+			return errCompactionCancelled
+		default:
+			return nil
+		}
+	}
+	timer := time.NewTimer(d)
+	defer timer.Stop()
+	select {
+	case <-c.stop:
+		return errCompactionCancelled
+	case <-timer.C:
+		return nil
+	}
+}
+
+// Stops the compaction before its next range. The compaction set's lock
+// must be held.
+func (c *TableCompaction) cancel() {
+	select {
+	case <-c.stop:
+	default:
+		close(c.stop)
+	}
+}
+
+// Returns a copy of the compaction's progress. The compaction set's lock
+// must be held.
+func (c *TableCompaction) copy() *TableCompaction {
+	other := *c
+	if c.EndTime != nil {
+		end := *c.EndTime
+		other.EndTime = &end
+	}
+	return &other
+}
+
+//--------------------------------------
+// Window
+//--------------------------------------
+
+// Returns how long it is from a time until the window next opens, or zero
+// if the time is within the window.
+func (w CompactionWindow) wait(t time.Time) time.Duration {
+	midnight := time.Date(t.Year(), t.Month(), t.Day(), 0, 0, 0, 0, t.Location())
+	offset := t.Sub(midnight)
+	if w.Start <= w.End {
+		if offset >= w.Start && offset < w.End {
+			return 0
+		}
+	} else if offset >= w.Start || offset < w.End {
+		return 0
+	}
+	d := w.Start - offset
+	if d < 0 {
+		d += 24 * time.Hour
+	}
+	return d
+}
+
+//--------------------------------------
+// Servlet
+//--------------------------------------
+
+// Returns the approximate size on disk of the keys under a prefix in the
+// servlet's database and those of its partitions and table stores.
+func (s *Servlet) storedTableSize(prefix []byte) (uint64, error) {
+	var size uint64
+	err := s.eachPartition(func(servlet *Servlet) error {
+		if servlet.db == nil {
+			return fmt.Errorf("Servlet is not open: %v", servlet.path)
+		}
+		size += servlet.db.GetApproximateSizes([]levigo.Range{{Start: prefix, Limit: incrementKey(prefix)}})[0]
+		return nil
+	})
+	return size, err
+}
+
+// Splits the keys under a prefix in the servlet's database into ranges of
+// about compactionChunkSize and returns them with their approximate sizes.
+// Keys that are only in the memtable are covered by a single range.
+func (s *Servlet) compactionRanges(prefix []byte) ([]levigo.Range, []uint64, error) {
+	limit := incrementKey(prefix)
+	if s.db == nil {
+		return nil, nil, fmt.Errorf("Servlet is not open: %v", s.path)
+	}
+	size := s.db.GetApproximateSizes([]levigo.Range{{Start: prefix, Limit: limit}})[0]
+	boundaries, err := s.SplitKeyRange(prefix, int(size/compactionChunkSize)+1)
+	if err != nil {
+		return nil, nil, err
+	}
+	ranges := make([]levigo.Range, 0, len(boundaries)+1)
+	start := prefix
+	for _, boundary := range boundaries {
+		ranges = append(ranges, levigo.Range{Start: start, Limit: boundary})
+		start = boundary
+	}
+	ranges = append(ranges, levigo.Range{Start: start, Limit: limit})
+	return ranges, s.db.GetApproximateSizes(ranges), nil
+}
@@ -7,3 +7,27 @@ const (
 	FloatDataType   = "float"
 	BooleanDataType = "boolean"
 )
+
+// Integer and float types with an explicit width. The unsized integer and
+// float types are 32-bit and 64-bit respectively.
+const (
+	Int8DataType    = "int8"
+	Int16DataType   = "int16"
+	Int32DataType   = "int32"
+	Int64DataType   = "int64"
+	Float32DataType = "float32"
+)
+
+// Checks whether a data type holds integers of any width.
+func isIntegerDataType(dataType string) bool {
+	switch dataType {
+	case IntegerDataType, Int8DataType, Int16DataType, Int32DataType, Int64DataType:
+		return true
+	}
+	return false
+}
+
+// Checks whether a data type holds integers or floats of any width.
+func isNumericDataType(dataType string) bool {
+	return isIntegerDataType(dataType) || dataType == FloatDataType || dataType == Float32DataType
+}
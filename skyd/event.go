@@ -2,9 +2,11 @@ package skyd
 
 import (
 	"bytes"
+	"encoding/binary"
 	"fmt"
 	"github.com/ugorji/go-msgpack"
 	"io"
+	"math"
 	"time"
 )
 
@@ -14,10 +16,13 @@ import (
 //
 //------------------------------------------------------------------------------
 
-// An Event is a state change that occurs at a particular point in time.
+// An Event is a state change that occurs at a particular point in time. A
+// client can give an event an id so that retried writes of it can be
+// recognized. The id isn't stored.
 type Event struct {
 	Timestamp time.Time
 	Data      map[int64]interface{}
+	Id        string
 }
 
 //------------------------------------------------------------------------------
@@ -39,6 +44,108 @@ func NewEvent(timestamp string, data map[int64]interface{}) *Event {
 	}
 }
 
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Appends a signed integer using its smallest msgpack tag.
+func appendMsgpackInt(b []byte, v int64) []byte {
+	switch {
+	case v >= -32 && v <= math.MaxInt8:
+		return append(b, byte(v))
+	case v >= math.MinInt8 && v <= math.MaxInt8:
+		return append(b, 0xd0, byte(v))
+	case v >= math.MinInt16 && v <= math.MaxInt16:
+		return append(b, 0xd1, byte(v>>8), byte(v))
+	case v >= math.MinInt32 && v <= math.MaxInt32:
+		return append(b, 0xd2, byte(v>>24), byte(v>>16), byte(v>>8), byte(v))
+	}
+	return appendUint64(append(b, 0xd3), uint64(v))
+}
+
+// Appends an unsigned integer using its smallest msgpack tag.
+func appendMsgpackUint(b []byte, v uint64) []byte {
+	switch {
+	case v <= math.MaxInt8:
+		return append(b, byte(v))
+	case v <= math.MaxUint8:
+		return append(b, 0xcc, byte(v))
+	case v <= math.MaxUint16:
+		return append(b, 0xcd, byte(v>>8), byte(v))
+	case v <= math.MaxUint32:
+		return append(b, 0xce, byte(v>>24), byte(v>>16), byte(v>>8), byte(v))
+	}
+	return appendUint64(append(b, 0xcf), v)
+}
+
+// Appends a big endian 64-bit integer.
+func appendUint64(b []byte, v uint64) []byte {
+	var buf [8]byte
+	binary.BigEndian.PutUint64(buf[:], v)
+	return append(b, buf[:]...)
+}
+
+// Appends the header of a raw, array or map with a number of elements. The
+// fixed tag is used for counts up to its mask and the 16 and 32-bit tags
+// follow the given one.
+func appendMsgpackHeader(b []byte, n int, fixed byte, mask int, tag byte) []byte {
+	switch {
+	case n <= mask:
+		return append(b, fixed|byte(n))
+	case n <= math.MaxUint16:
+		return append(b, tag, byte(n>>8), byte(n))
+	}
+	return append(b, tag+1, byte(n>>24), byte(n>>16), byte(n>>8), byte(n))
+}
+
+// Appends a single event value.
+func appendMsgpackValue(b []byte, value interface{}) ([]byte, error) {
+	switch v := value.(type) {
+	case nil:
+		return append(b, 0xc0), nil
+	case bool:
+		if v {
+			return append(b, 0xc3), nil
+		}
+		return append(b, 0xc2), nil
+	case int64:
+		return appendMsgpackInt(b, v), nil
+	case int:
+		return appendMsgpackInt(b, int64(v)), nil
+	case int32:
+		return appendMsgpackInt(b, int64(v)), nil
+	case int16:
+		return appendMsgpackInt(b, int64(v)), nil
+	case int8:
+		return appendMsgpackInt(b, int64(v)), nil
+	case uint64:
+		return appendMsgpackUint(b, v), nil
+	case uint:
+		return appendMsgpackUint(b, uint64(v)), nil
+	case uint32:
+		return appendMsgpackUint(b, uint64(v)), nil
+	case uint16:
+		return appendMsgpackUint(b, uint64(v)), nil
+	case uint8:
+		return appendMsgpackUint(b, uint64(v)), nil
+	case float64:
+		return appendUint64(append(b, 0xcb), math.Float64bits(v)), nil
+	case float32:
+		return appendUint64(append(b, 0xcb), math.Float64bits(float64(v))), nil
+	case string:
+		return append(appendMsgpackHeader(b, len(v), 0xa0, 0x1f, 0xda), v...), nil
+	case []byte:
+		return append(appendMsgpackHeader(b, len(v), 0xa0, 0x1f, 0xda), v...), nil
+	}
+	data, err := msgpack.Marshal(value)
+	if err != nil {
+		return nil, err
+	}
+	return append(b, data...), nil
+}
+
 //------------------------------------------------------------------------------
 //
 // Methods
@@ -51,19 +158,40 @@ func NewEvent(timestamp string, data map[int64]interface{}) *Event {
 
 // Encodes an event to MsgPack format.
 func (e *Event) EncodeRaw(writer io.Writer) error {
-	raw := []interface{}{ShiftTime(e.Timestamp), e.Data}
-	encoder := msgpack.NewEncoder(writer)
-	err := encoder.Encode(raw)
+	b, err := e.AppendRaw(nil)
+	if err != nil {
+		return err
+	}
+	_, err = writer.Write(b)
 	return err
 }
 
 // Encodes an event to MsgPack format and returns the byte array.
 func (e *Event) MarshalRaw() ([]byte, error) {
-	buffer := new(bytes.Buffer)
-	if err := e.EncodeRaw(buffer); err != nil {
-		return nil, err
+	return e.AppendRaw(nil)
+}
+
+// Appends an event in MsgPack format to a byte slice and returns the
+// extended slice. The event is written as a two element array of its
+// shifted timestamp and its data with the same tags that the cursor reads.
+// Integers use their smallest signed tag, floats are always doubles and
+// strings are raws. Values of any other type are passed to the msgpack
+// encoder.
+func (e *Event) AppendRaw(b []byte) ([]byte, error) {
+	b = append(b, 0x92)
+	b = appendMsgpackInt(b, ShiftTime(e.Timestamp))
+	if e.Data == nil {
+		return append(b, 0xc0), nil
+	}
+	b = appendMsgpackHeader(b, len(e.Data), 0x80, 0x0f, 0xde)
+	for k, v := range e.Data {
+		b = appendMsgpackInt(b, k)
+		var err error
+		if b, err = appendMsgpackValue(b, v); err != nil {
+			return nil, err
+		}
 	}
-	return buffer.Bytes(), nil
+	return b, nil
 }
 
 // Decodes an event from MsgPack format.
@@ -0,0 +1,575 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"math"
+	"math/bits"
+	"sort"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// An event block is a fixed-layout, columnar run of events that can be
+// stored in place of msgpack events. See deps/csky/include/sky/event_block.h
+// for a description of the layout.
+const (
+	eventBlockFlag             = 0xC1
+	eventBlockVersion          = 2
+	eventBlockFixedTSVersion   = 1
+	eventBlockHeaderSize       = 24
+	eventBlockColumnHeaderSize = 16
+)
+
+const (
+	eventBlockStringType  = 1
+	eventBlockIntType     = 2
+	eventBlockDoubleType  = 3
+	eventBlockBooleanType = 4
+	eventBlockDictType    = 5
+	eventBlockPackedType  = 6
+)
+
+// Packed integer columns are stored in groups of a fixed number of values
+// that each start with a reference and a bit width.
+const (
+	eventBlockGroupSize       = 128
+	eventBlockGroupHeaderSize = 9
+)
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Encoding
+//--------------------------------------
+
+// Encodes a sorted list of events into a single event block. If any of the
+// values cannot be represented in a block (e.g. nil values or properties
+// with mixed types) then nil is returned and the events should be encoded
+// as msgpack instead.
+func EncodeEventBlock(events []*Event) ([]byte, error) {
+	if len(events) == 0 {
+		return nil, nil
+	}
+
+	// Determine the column type for each property.
+	types := make(map[int64]byte)
+	for _, event := range events {
+		for k, v := range event.Data {
+			typ := eventBlockValueType(normalize(v))
+			if typ == 0 {
+				return nil, nil
+			}
+			if existing, ok := types[k]; ok && existing != typ {
+				return nil, nil
+			}
+			types[k] = typ
+		}
+	}
+	if len(types) > math.MaxUint16 {
+		return nil, nil
+	}
+	ids := make([]int64, 0, len(types))
+	for k := range types {
+		ids = append(ids, k)
+	}
+	sort.Sort(int64Slice(ids))
+
+	// Write the timestamps as the change in the gap between events.
+	count := len(events)
+	buffer := new(bytes.Buffer)
+	buffer.Write(make([]byte, eventBlockHeaderSize))
+	base := ShiftTime(events[0].Timestamp)
+	prev, prevDelta := base, int64(0)
+	varint := make([]byte, binary.MaxVarintLen64)
+	for _, event := range events {
+		ts := ShiftTime(event.Timestamp)
+		n := binary.PutVarint(varint, (ts-prev)-prevDelta)
+		buffer.Write(varint[:n])
+		prev, prevDelta = ts, ts-prev
+	}
+	timestampsSize := buffer.Len() - eventBlockHeaderSize
+
+	// Write each column with its presence bitmap and values.
+	bitmapSize := (count + 7) / 8
+	for _, id := range ids {
+		typ := types[id]
+		column := new(bytes.Buffer)
+		column.Write(make([]byte, eventBlockColumnHeaderSize))
+		bitmap := make([]byte, bitmapSize)
+		for i, event := range events {
+			if _, ok := event.Data[id]; ok {
+				bitmap[i>>3] |= 1 << uint(i&7)
+			}
+		}
+		column.Write(bitmap)
+
+		switch typ {
+		case eventBlockStringType:
+			typ = writeEventBlockStrings(column, events, id)
+		case eventBlockIntType:
+			typ = writeEventBlockInts(column, events, id)
+		case eventBlockDoubleType:
+			for _, event := range events {
+				value, _ := normalize(event.Data[id]).(float64)
+				binary.Write(column, binary.LittleEndian, value)
+			}
+		case eventBlockBooleanType:
+			for _, event := range events {
+				if value, _ := event.Data[id].(bool); value {
+					column.WriteByte(1)
+				} else {
+					column.WriteByte(0)
+				}
+			}
+		}
+
+		b := column.Bytes()
+		binary.LittleEndian.PutUint64(b[0:], uint64(id))
+		b[8] = typ
+		binary.LittleEndian.PutUint32(b[12:], uint32(len(b)))
+		buffer.Write(b)
+	}
+
+	// Fill in the header now that the size is known.
+	b := buffer.Bytes()
+	if int64(len(b)) > math.MaxUint32 {
+		return nil, nil
+	}
+	b[0] = eventBlockFlag
+	b[1] = eventBlockVersion
+	binary.LittleEndian.PutUint16(b[2:], uint16(len(ids)))
+	binary.LittleEndian.PutUint32(b[4:], uint32(count))
+	binary.LittleEndian.PutUint32(b[8:], uint32(len(b)))
+	binary.LittleEndian.PutUint32(b[12:], uint32(timestampsSize))
+	binary.LittleEndian.PutUint64(b[16:], uint64(base))
+
+	return b, nil
+}
+
+// Writes the values of a string column. The distinct strings are written as
+// a dictionary with a code for each event instead when that's smaller.
+// Returns the type of column that was written.
+func writeEventBlockStrings(column *bytes.Buffer, events []*Event, id int64) byte {
+	codes := make([]uint32, len(events))
+	dictionary := make(map[string]uint32)
+	entries := make([]string, 0)
+	size, dictSize := (len(events)+1)*4, len(events)*4+8
+	for i, event := range events {
+		value, ok := event.Data[id].(string)
+		if !ok {
+			continue
+		}
+		size += len(value)
+		code, ok := dictionary[value]
+		if !ok {
+			code = uint32(len(entries))
+			dictionary[value] = code
+			entries = append(entries, value)
+			dictSize += 4 + len(value)
+		}
+		codes[i] = code
+	}
+
+	if dictSize >= size {
+		heap := new(bytes.Buffer)
+		binary.Write(column, binary.LittleEndian, uint32(0))
+		for _, event := range events {
+			if v, ok := event.Data[id]; ok {
+				heap.WriteString(v.(string))
+			}
+			binary.Write(column, binary.LittleEndian, uint32(heap.Len()))
+		}
+		column.Write(heap.Bytes())
+		return eventBlockStringType
+	}
+
+	binary.Write(column, binary.LittleEndian, codes)
+	binary.Write(column, binary.LittleEndian, uint32(len(entries)))
+	offset := uint32(0)
+	binary.Write(column, binary.LittleEndian, offset)
+	for _, entry := range entries {
+		offset += uint32(len(entry))
+		binary.Write(column, binary.LittleEndian, offset)
+	}
+	for _, entry := range entries {
+		column.WriteString(entry)
+	}
+	return eventBlockDictType
+}
+
+// Writes the values of an integer column. The values are bit packed in
+// groups instead when that's smaller. Returns the type of column that was
+// written.
+func writeEventBlockInts(column *bytes.Buffer, events []*Event, id int64) byte {
+	values := make([]int64, len(events))
+	present := make([]bool, len(events))
+	for i, event := range events {
+		if v, ok := event.Data[id]; ok {
+			values[i], _ = normalize(v).(int64)
+			present[i] = true
+		}
+	}
+
+	offsets, groups := packEventBlockGroups(values, present)
+	if len(offsets)*4+len(groups) >= len(values)*8 {
+		binary.Write(column, binary.LittleEndian, values)
+		return eventBlockIntType
+	}
+	binary.Write(column, binary.LittleEndian, offsets)
+	column.Write(groups)
+	return eventBlockPackedType
+}
+
+// Bit packs integers in groups against the smallest value in each group.
+// Values that aren't present are packed as the reference. Returns the
+// offset of each group followed by the size of the groups, and the groups.
+func packEventBlockGroups(values []int64, present []bool) ([]uint32, []byte) {
+	groupCount := (len(values) + eventBlockGroupSize - 1) / eventBlockGroupSize
+	offsets := make([]uint32, groupCount+1)
+	var groups []byte
+	for g := 0; g < groupCount; g++ {
+		offsets[g] = uint32(len(groups))
+		start, end := g*eventBlockGroupSize, (g+1)*eventBlockGroupSize
+		if end > len(values) {
+			end = len(values)
+		}
+		var min, max int64
+		found := false
+		for i := start; i < end; i++ {
+			if present[i] {
+				if !found || values[i] < min {
+					min = values[i]
+				}
+				if !found || values[i] > max {
+					max = values[i]
+				}
+				found = true
+			}
+		}
+		width := bits.Len64(uint64(max) - uint64(min))
+
+		header := make([]byte, eventBlockGroupHeaderSize)
+		binary.LittleEndian.PutUint64(header, uint64(min))
+		header[8] = byte(width)
+		groups = append(groups, header...)
+		packed := make([]byte, width*(eventBlockGroupSize/8))
+		for i := start; i < end && width > 0; i++ {
+			if !present[i] {
+				continue
+			}
+			delta := uint64(values[i]) - uint64(min)
+			for pos, remaining := (i-start)*width, width; remaining > 0; {
+				shift := uint(pos & 7)
+				packed[pos>>3] |= byte(delta << shift)
+				n := 8 - int(shift)
+				if n > remaining {
+					n = remaining
+				}
+				delta >>= uint(n)
+				pos += n
+				remaining -= n
+			}
+		}
+		groups = append(groups, packed...)
+	}
+	offsets[groupCount] = uint32(len(groups))
+	return offsets, groups
+}
+
+// Unpacks a group of a packed column. The values area starts with the group
+// offsets.
+func unpackEventBlockGroup(values []byte, groupCount int, g int) ([]int64, error) {
+	groups := values[(groupCount+1)*4:]
+	start := int(binary.LittleEndian.Uint32(values[g*4:]))
+	end := int(binary.LittleEndian.Uint32(values[(g+1)*4:]))
+	if start > end || end > len(groups) || end-start < eventBlockGroupHeaderSize {
+		return nil, errors.New("skyd.DecodeEventBlock: Invalid packed group offset")
+	}
+	group := groups[start:end]
+	reference := binary.LittleEndian.Uint64(group)
+	width := int(group[8])
+	if width > 64 || len(group) < eventBlockGroupHeaderSize+width*(eventBlockGroupSize/8) {
+		return nil, fmt.Errorf("skyd.DecodeEventBlock: Invalid packed group width: %d", width)
+	}
+	packed := group[eventBlockGroupHeaderSize:]
+	unpacked := make([]int64, eventBlockGroupSize)
+	for i := range unpacked {
+		var delta uint64
+		for pos, shift := i*width, 0; shift < width; {
+			b := uint64(packed[pos>>3]) >> uint(pos&7)
+			n := 8 - (pos & 7)
+			if n > width-shift {
+				n = width - shift
+			}
+			delta |= (b & (1<<uint(n) - 1)) << uint(shift)
+			pos += n
+			shift += n
+		}
+		unpacked[i] = int64(reference + delta)
+	}
+	return unpacked, nil
+}
+
+// Returns the block column type for a normalized value or zero if the value
+// can't be stored in a block.
+func eventBlockValueType(value interface{}) byte {
+	switch value.(type) {
+	case string:
+		return eventBlockStringType
+	case int64:
+		return eventBlockIntType
+	case float64:
+		return eventBlockDoubleType
+	case bool:
+		return eventBlockBooleanType
+	}
+	return 0
+}
+
+//--------------------------------------
+// Decoding
+//--------------------------------------
+
+// Decodes a stream of serialized events. The stream can contain any mix of
+// event blocks and msgpack encoded events. Checkpoints are skipped.
+func DecodeEvents(data []byte) ([]*Event, error) {
+	events := make([]*Event, 0)
+	reader := bytes.NewReader(data)
+	for {
+		flag, err := reader.ReadByte()
+		if err == io.EOF {
+			break
+		} else if err != nil {
+			return nil, err
+		}
+		reader.UnreadByte()
+
+		// Decode either a whole block or a single event.
+		if flag == eventBlockFlag {
+			block, err := DecodeEventBlock(reader)
+			if err != nil {
+				return nil, err
+			}
+			events = append(events, block...)
+		} else if flag == eventCheckpointFlag {
+			reader.ReadByte()
+			if err = (&Event{}).DecodeRaw(reader); err != nil {
+				return nil, err
+			}
+		} else {
+			event := &Event{}
+			if err = event.DecodeRaw(reader); err != nil {
+				return nil, err
+			}
+			events = append(events, event)
+		}
+	}
+
+	return events, nil
+}
+
+// Decodes a single event block from a reader.
+func DecodeEventBlock(reader io.Reader) ([]*Event, error) {
+	header := make([]byte, eventBlockHeaderSize)
+	if _, err := io.ReadFull(reader, header); err != nil {
+		return nil, err
+	}
+	if header[0] != eventBlockFlag {
+		return nil, errors.New("skyd.DecodeEventBlock: Invalid block flag")
+	}
+	columnCount := int(binary.LittleEndian.Uint16(header[2:]))
+	count := int(binary.LittleEndian.Uint32(header[4:]))
+	size := int(binary.LittleEndian.Uint32(header[8:]))
+	if size < eventBlockHeaderSize {
+		return nil, fmt.Errorf("skyd.DecodeEventBlock: Invalid block size: %d", size)
+	}
+	block := make([]byte, size)
+	copy(block, header)
+	if _, err := io.ReadFull(reader, block[eventBlockHeaderSize:]); err != nil {
+		return nil, err
+	}
+
+	// Read timestamps.
+	timestamps, offset, err := eventBlockTimestamps(block)
+	if err != nil {
+		return nil, err
+	}
+	events := make([]*Event, count)
+	for i := range events {
+		events[i] = &Event{Timestamp: UnshiftTime(timestamps[i]).UTC(), Data: map[int64]interface{}{}}
+	}
+	b := block[offset:]
+
+	// Read columns.
+	bitmapSize := (count + 7) / 8
+	for c := 0; c < columnCount; c++ {
+		if len(b) < eventBlockColumnHeaderSize {
+			return nil, errors.New("skyd.DecodeEventBlock: Truncated column")
+		}
+		id := int64(binary.LittleEndian.Uint64(b[0:]))
+		typ := b[8]
+		columnSize := int(binary.LittleEndian.Uint32(b[12:]))
+		if columnSize < eventBlockColumnHeaderSize+bitmapSize || columnSize > len(b) {
+			return nil, fmt.Errorf("skyd.DecodeEventBlock: Invalid column size: %d", columnSize)
+		}
+		bitmap := b[eventBlockColumnHeaderSize : eventBlockColumnHeaderSize+bitmapSize]
+		values := b[eventBlockColumnHeaderSize+bitmapSize : columnSize]
+
+		// Make sure the value area matches the type before reading it.
+		var valuesSize int
+		switch typ {
+		case eventBlockStringType:
+			valuesSize = (count + 1) * 4
+		case eventBlockDictType:
+			valuesSize = (count * 4) + 4
+			if len(values) >= valuesSize {
+				valuesSize += (int(binary.LittleEndian.Uint32(values[count*4:])) + 1) * 4
+			}
+		case eventBlockPackedType:
+			valuesSize = (((count + eventBlockGroupSize - 1) / eventBlockGroupSize) + 1) * 4
+		case eventBlockIntType, eventBlockDoubleType:
+			valuesSize = count * 8
+		case eventBlockBooleanType:
+			valuesSize = count
+		default:
+			return nil, fmt.Errorf("skyd.DecodeEventBlock: Invalid column type: %d", typ)
+		}
+		if len(values) < valuesSize {
+			return nil, errors.New("skyd.DecodeEventBlock: Truncated column values")
+		}
+
+		var packed []int64
+		packedGroup := -1
+		for i, event := range events {
+			if bitmap[i>>3]&(1<<uint(i&7)) == 0 {
+				continue
+			}
+			switch typ {
+			case eventBlockStringType:
+				start := int(binary.LittleEndian.Uint32(values[i*4:]))
+				end := int(binary.LittleEndian.Uint32(values[(i+1)*4:]))
+				heap := values[valuesSize:]
+				if start > end || end > len(heap) {
+					return nil, errors.New("skyd.DecodeEventBlock: Invalid string offset")
+				}
+				event.Data[id] = string(heap[start:end])
+			case eventBlockDictType:
+				code := int(binary.LittleEndian.Uint32(values[i*4:]))
+				offsets := values[(count*4)+4 : valuesSize]
+				if code >= (len(offsets)/4)-1 {
+					return nil, fmt.Errorf("skyd.DecodeEventBlock: Invalid dictionary code: %d", code)
+				}
+				start := int(binary.LittleEndian.Uint32(offsets[code*4:]))
+				end := int(binary.LittleEndian.Uint32(offsets[(code+1)*4:]))
+				heap := values[valuesSize:]
+				if start > end || end > len(heap) {
+					return nil, errors.New("skyd.DecodeEventBlock: Invalid string offset")
+				}
+				event.Data[id] = string(heap[start:end])
+			case eventBlockPackedType:
+				if g := i / eventBlockGroupSize; g != packedGroup {
+					var err error
+					if packed, err = unpackEventBlockGroup(values, (valuesSize/4)-1, g); err != nil {
+						return nil, err
+					}
+					packedGroup = g
+				}
+				event.Data[id] = packed[i%eventBlockGroupSize]
+			case eventBlockIntType:
+				event.Data[id] = int64(binary.LittleEndian.Uint64(values[i*8:]))
+			case eventBlockDoubleType:
+				event.Data[id] = math.Float64frombits(binary.LittleEndian.Uint64(values[i*8:]))
+			case eventBlockBooleanType:
+				event.Data[id] = (values[i] != 0)
+			}
+		}
+
+		b = b[columnSize:]
+	}
+
+	return events, nil
+}
+
+// Reads the shifted timestamps of every event in a block and returns them
+// along with the offset of the first column.
+func eventBlockTimestamps(block []byte) ([]int64, int, error) {
+	count := int(binary.LittleEndian.Uint32(block[4:]))
+	base := int64(binary.LittleEndian.Uint64(block[16:]))
+	timestamps := make([]int64, count)
+
+	switch block[1] {
+	case eventBlockFixedTSVersion:
+		if len(block) < eventBlockHeaderSize+(count*8) {
+			return nil, 0, fmt.Errorf("skyd.DecodeEventBlock: Invalid block size: %d", len(block))
+		}
+		for i := range timestamps {
+			timestamps[i] = base + int64(binary.LittleEndian.Uint64(block[eventBlockHeaderSize+(i*8):]))
+		}
+		return timestamps, eventBlockHeaderSize + (count * 8), nil
+
+	case eventBlockVersion:
+		size := int(binary.LittleEndian.Uint32(block[12:]))
+		if size > len(block)-eventBlockHeaderSize {
+			return nil, 0, fmt.Errorf("skyd.DecodeEventBlock: Invalid timestamps size: %d", size)
+		}
+		b := block[eventBlockHeaderSize : eventBlockHeaderSize+size]
+		prev, prevDelta := base, int64(0)
+		for i := range timestamps {
+			deltaOfDelta, n := binary.Varint(b)
+			if n <= 0 {
+				return nil, 0, errors.New("skyd.DecodeEventBlock: Invalid timestamp")
+			}
+			b = b[n:]
+			prevDelta += deltaOfDelta
+			prev += prevDelta
+			timestamps[i] = prev
+		}
+		return timestamps, eventBlockHeaderSize + size, nil
+	}
+	return nil, 0, fmt.Errorf("skyd.DecodeEventBlock: Unsupported block version: %d", block[1])
+}
+
+// Returns the number of bytes at the end of a serialized event stream that
+// follow the leading event blocks and any checkpoints in between them.
+func eventBlockTailSize(data []byte) int {
+	offset := 0
+	for offset < len(data) {
+		var size int
+		if data[offset] == eventCheckpointFlag {
+			if _, _, n, err := eventStreamElement(data[offset:]); err == nil {
+				size = n
+			}
+		} else if len(data)-offset >= eventBlockHeaderSize && data[offset] == eventBlockFlag {
+			size = int(binary.LittleEndian.Uint32(data[offset+8:]))
+		}
+		if size <= 0 || offset+size > len(data) {
+			break
+		}
+		offset += size
+	}
+	return len(data) - offset
+}
+
+//------------------------------------------------------------------------------
+//
+// Sorting
+//
+//------------------------------------------------------------------------------
+
+type int64Slice []int64
+
+func (p int64Slice) Len() int           { return len(p) }
+func (p int64Slice) Less(i, j int) bool { return p[i] < p[j] }
+func (p int64Slice) Swap(i, j int)      { p[i], p[j] = p[j], p[i] }
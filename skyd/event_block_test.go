@@ -0,0 +1,149 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/binary"
+	"math"
+	"testing"
+	"time"
+)
+
+// Ensure that events can be encoded to a block and decoded back.
+func TestEventBlockEncodeDecode(t *testing.T) {
+	input := []*Event{
+		NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{-1: "A1", 1: "foo", 2: int64(100), 3: 1.5, 4: true}),
+		NewEvent("2012-01-01T00:00:01Z", map[int64]interface{}{-1: "A2", 2: int64(-20)}),
+		NewEvent("2012-01-02T00:00:00Z", map[int64]interface{}{}),
+		NewEvent("2012-01-03T00:00:00Z", map[int64]interface{}{1: "", 4: false}),
+	}
+	block, err := EncodeEventBlock(input)
+	if err != nil || block == nil {
+		t.Fatalf("Unable to encode block: %v", err)
+	}
+	if block[0] != eventBlockFlag {
+		t.Fatalf("Invalid block flag: %x", block[0])
+	}
+	output, err := DecodeEvents(block)
+	if err != nil {
+		t.Fatalf("Unable to decode block: %v", err)
+	}
+	assertEvents(t, input, output)
+}
+
+// Ensure that only the first gap between evenly spaced timestamps takes up
+// more than a byte.
+func TestEventBlockTimestamps(t *testing.T) {
+	input := []*Event{
+		NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{}),
+		NewEvent("2012-01-01T00:00:10Z", map[int64]interface{}{}),
+		NewEvent("2012-01-01T00:00:20Z", map[int64]interface{}{}),
+		NewEvent("2012-01-01T00:00:30Z", map[int64]interface{}{}),
+	}
+	block, _ := EncodeEventBlock(input)
+	if size := len(block) - eventBlockHeaderSize; size != 7 {
+		t.Fatalf("Invalid timestamps size: %v", size)
+	}
+	output, err := DecodeEvents(block)
+	if err != nil {
+		t.Fatalf("Unable to decode block: %v", err)
+	}
+	assertEvents(t, input, output)
+}
+
+// Ensure that blocks and msgpack events can be decoded from the same stream.
+func TestEventBlockDecodeMixed(t *testing.T) {
+	input := []*Event{
+		NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{-1: "A1", 2: int64(100)}),
+		NewEvent("2012-01-01T00:00:01Z", map[int64]interface{}{-1: "A2"}),
+		NewEvent("2012-01-01T00:00:02Z", map[int64]interface{}{-1: "A3", 2: int64(200)}),
+	}
+	block, _ := EncodeEventBlock(input[0:2])
+	buffer := bytes.NewBuffer(block)
+	input[2].EncodeRaw(buffer)
+	if size := eventBlockTailSize(buffer.Bytes()); size != buffer.Len()-len(block) {
+		t.Fatalf("Invalid tail size: %v", size)
+	}
+
+	output, err := DecodeEvents(buffer.Bytes())
+	if err != nil {
+		t.Fatalf("Unable to decode events: %v", err)
+	}
+	assertEvents(t, input, output)
+}
+
+// Ensure that string columns with repeated values are stored as a dictionary.
+func TestEventBlockDictionary(t *testing.T) {
+	input := []*Event{
+		NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{-1: "checkout"}),
+		NewEvent("2012-01-01T00:00:01Z", map[int64]interface{}{-1: "view"}),
+		NewEvent("2012-01-01T00:00:02Z", map[int64]interface{}{-1: "checkout"}),
+		NewEvent("2012-01-01T00:00:03Z", map[int64]interface{}{}),
+		NewEvent("2012-01-01T00:00:04Z", map[int64]interface{}{-1: "checkout"}),
+		NewEvent("2012-01-01T00:00:05Z", map[int64]interface{}{-1: "checkout"}),
+	}
+	block, _ := EncodeEventBlock(input)
+	column := eventBlockHeaderSize + int(binary.LittleEndian.Uint32(block[12:]))
+	if typ := block[column+8]; typ != eventBlockDictType {
+		t.Fatalf("Invalid column type: %v", typ)
+	}
+	output, err := DecodeEvents(block)
+	if err != nil {
+		t.Fatalf("Unable to decode block: %v", err)
+	}
+	assertEvents(t, input, output)
+
+	// Distinct strings are stored inline.
+	block, _ = EncodeEventBlock(input[0:2])
+	column = eventBlockHeaderSize + int(binary.LittleEndian.Uint32(block[12:]))
+	if typ := block[column+8]; typ != eventBlockStringType {
+		t.Fatalf("Invalid column type: %v", typ)
+	}
+}
+
+// Ensure that integer columns in narrow ranges are bit packed.
+func TestEventBlockPacked(t *testing.T) {
+	input := make([]*Event, 0)
+	for i := 0; i < 300; i++ {
+		data := map[int64]interface{}{-1: int64(1000 + (i % 7)), 1: int64(-(i / 100))}
+		if i%5 == 0 {
+			delete(data, -1)
+		}
+		input = append(input, &Event{Timestamp: time.Unix(int64(i), 0).UTC(), Data: data})
+	}
+	block, _ := EncodeEventBlock(input)
+	column := eventBlockHeaderSize + int(binary.LittleEndian.Uint32(block[12:]))
+	if typ := block[column+8]; typ != eventBlockPackedType {
+		t.Fatalf("Invalid column type: %v", typ)
+	}
+	output, err := DecodeEvents(block)
+	if err != nil {
+		t.Fatalf("Unable to decode block: %v", err)
+	}
+	assertEvents(t, input, output)
+
+	// Values spread across the whole range are stored as they are.
+	input = []*Event{
+		NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{-1: int64(math.MinInt64)}),
+		NewEvent("2012-01-01T00:00:01Z", map[int64]interface{}{-1: int64(math.MaxInt64)}),
+	}
+	block, _ = EncodeEventBlock(input)
+	column = eventBlockHeaderSize + int(binary.LittleEndian.Uint32(block[12:]))
+	if typ := block[column+8]; typ != eventBlockIntType {
+		t.Fatalf("Invalid column type: %v", typ)
+	}
+}
+
+// Ensure that events that can't be represented in a block are rejected.
+func TestEventBlockUnsupportedValues(t *testing.T) {
+	mixed := []*Event{
+		NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{1: "foo"}),
+		NewEvent("2012-01-01T00:00:01Z", map[int64]interface{}{1: int64(2)}),
+	}
+	if block, err := EncodeEventBlock(mixed); block != nil || err != nil {
+		t.Fatalf("Expected mixed types to be rejected: %v", err)
+	}
+	null := []*Event{NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{1: nil})}
+	if block, err := EncodeEventBlock(null); block != nil || err != nil {
+		t.Fatalf("Expected nil values to be rejected: %v", err)
+	}
+}
@@ -0,0 +1,122 @@
+package skyd
+
+import (
+	"encoding/binary"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// A checkpoint is a copy of an object's permanent state that is embedded in
+// its event stream in front of an event. Permanent values are deduped
+// against the state when they're written, so the value of a property at a
+// point in time is the last one set before it and finding it otherwise
+// means reading the stream from the start. A checkpoint is the flag
+// followed by a msgpack event with the timestamp of the event after it and
+// the value of every permanent property before that event.
+//
+// Checkpoints aren't events and decoding a stream skips them. Each one
+// starts an entry of the stream's index so that a scan with a time range
+// can start from the latest checkpoint before the range.
+const eventCheckpointFlag = 0xC7
+
+// A checkpoint is added in front of an appended event once this many events
+// follow the last checkpoint of the tail.
+const eventCheckpointInterval = 256
+
+// A checkpoint is also added once the events after the last one span a day
+// of shifted time, as long as there are at least an index interval of them.
+const eventCheckpointSpan = (24 * 60 * 60) << 20
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Appends a checkpoint of the permanent values of a state to a serialized
+// event stream. The timestamp is that of the event that follows it.
+func appendEventCheckpoint(b []byte, timestamp time.Time, state *Event) ([]byte, error) {
+	checkpoint := &Event{Timestamp: timestamp, Data: make(map[int64]interface{}, len(state.Data))}
+	for k, v := range state.Data {
+		if k > 0 {
+			checkpoint.Data[k] = v
+		}
+	}
+	return checkpoint.AppendRaw(append(b, eventCheckpointFlag))
+}
+
+// Returns the shifted timestamp of the last checkpoint in a serialized
+// event stream, or of its first element if it has none, along with the
+// number of events after it.
+func eventCheckpointDistance(data []byte) (int64, int, error) {
+	var start int64
+	count := 0
+	for offset := 0; offset < len(data); {
+		first, _, size, err := eventStreamElement(data[offset:])
+		if err != nil {
+			return 0, 0, err
+		}
+		switch {
+		case data[offset] == eventCheckpointFlag:
+			start, count = first, 0
+		case data[offset] == eventBlockFlag:
+			count += int(binary.LittleEndian.Uint32(data[offset+4:]))
+		default:
+			count++
+		}
+		if offset == 0 {
+			start = first
+		}
+		offset += size
+	}
+	return start, count, nil
+}
+
+// Checks whether an event at a shifted timestamp should be preceded by a
+// checkpoint given the timestamp of the last one and the events after it.
+func eventCheckpointDue(start int64, count int, ts int64) bool {
+	return count >= eventCheckpointInterval || (count >= eventIndexInterval && ts-start >= eventCheckpointSpan)
+}
+
+// Removes the checkpoints from a serialized event stream that may hold
+// stale values of a set of permanent properties after an out-of-order write
+// before the stream. A property's values stop being stale at the first
+// event that sets it, which removes it from the set. Returns the stream and
+// whether any checkpoint was removed.
+func dropEventCheckpoints(data []byte, stale map[int64]bool) ([]byte, bool, error) {
+	result := make([]byte, 0, len(data))
+	dropped := false
+	offset := 0
+	for offset < len(data) && len(stale) > 0 {
+		_, _, size, err := eventStreamElement(data[offset:])
+		if err != nil {
+			return nil, false, err
+		}
+		element := data[offset : offset+size]
+		offset += size
+		if element[0] == eventCheckpointFlag {
+			dropped = true
+			continue
+		}
+		result = append(result, element...)
+
+		events, err := DecodeEvents(element)
+		if err != nil {
+			return nil, false, err
+		}
+		for _, event := range events {
+			for k := range event.Data {
+				delete(stale, k)
+			}
+		}
+	}
+	if !dropped {
+		return data, false, nil
+	}
+	return append(result, data[offset:]...), true, nil
+}
@@ -0,0 +1,409 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"github.com/ugorji/go-msgpack"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// An event index is a small summary of a serialized event stream that is
+// stored as a msgpack raw in front of the stream. It holds the first and
+// last timestamp of the stream and the offset of every Nth event so that
+// readers can skip to a point in time without decoding the events before
+// it. It also counts the events so that scans can skip objects with too few
+// of them. The payload is little endian:
+//
+//	version (1), first ts (8), last ts (8), entry count (4),
+//	event count (4), entries of ts (8) + offset (4)
+//
+// Entries always start at an event, an event block or a checkpoint. Every
+// event block and checkpoint gets its own entry. Version 1 indexes have no
+// event count and neither do indexes whose count is eventIndexNoCount,
+// which retention leaves on the streams it trims.
+const (
+	eventIndexVersion      = 2
+	eventIndexHeaderSize   = 25
+	eventIndexEntrySize    = 12
+	eventIndexNoCount      = 0xFFFFFFFF
+	eventIndexV1Version    = 1
+	eventIndexV1HeaderSize = 21
+)
+
+// The number of events between index entries.
+const eventIndexInterval = 32
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A decoded event index. The event count is -1 if it isn't known.
+type eventIndex struct {
+	first   int64
+	last    int64
+	events  int
+	entries []eventIndexEntry
+}
+
+// The shifted timestamp of an event and its offset within the stream.
+type eventIndexEntry struct {
+	ts     int64
+	offset int
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Encoding
+//--------------------------------------
+
+// Creates the index for a serialized event stream. An empty stream has no
+// index and nil is returned.
+func newEventIndex(data []byte) (*eventIndex, error) {
+	if len(data) == 0 {
+		return nil, nil
+	}
+
+	index := &eventIndex{}
+	count := 0
+	for offset := 0; offset < len(data); {
+		first, last, size, err := eventStreamElement(data[offset:])
+		if err != nil {
+			return nil, err
+		}
+		if offset == 0 {
+			index.first = first
+		}
+		index.last = last
+
+		// Every block starts an entry since it can't be entered midway and
+		// so does every checkpoint since it's where reads can start.
+		flag := data[offset]
+		if flag == eventBlockFlag || flag == eventCheckpointFlag || count%eventIndexInterval == 0 {
+			index.entries = append(index.entries, eventIndexEntry{first, offset})
+		}
+		if flag == eventBlockFlag {
+			index.events += int(binary.LittleEndian.Uint32(data[offset+4:]))
+			count = 0
+		} else if flag != eventCheckpointFlag {
+			index.events++
+			count++
+		}
+		offset += size
+	}
+	return index, nil
+}
+
+// Reads the timestamps and size of the event, event block or checkpoint at
+// the start of a serialized event stream. A checkpoint has the timestamp of
+// the event after it.
+func eventStreamElement(data []byte) (int64, int64, int, error) {
+	if data[0] == eventCheckpointFlag {
+		if len(data) < 2 || data[1] != 0x92 {
+			return 0, 0, 0, errors.New("skyd.EventIndex: Invalid checkpoint")
+		}
+		timestamp, _, size, err := eventStreamElement(data[1:])
+		if err != nil {
+			return 0, 0, 0, err
+		}
+		return timestamp, timestamp, size + 1, nil
+	}
+
+	if data[0] == eventBlockFlag {
+		if len(data) < eventBlockHeaderSize {
+			return 0, 0, 0, errors.New("skyd.EventIndex: Truncated event block")
+		}
+		count := int(binary.LittleEndian.Uint32(data[4:]))
+		size := int(binary.LittleEndian.Uint32(data[8:]))
+		if count == 0 || size < eventBlockHeaderSize || size > len(data) {
+			return 0, 0, 0, fmt.Errorf("skyd.EventIndex: Invalid event block size: %d", size)
+		}
+		timestamps, _, err := eventBlockTimestamps(data[:size])
+		if err != nil {
+			return 0, 0, 0, err
+		}
+		return timestamps[0], timestamps[count-1], size, nil
+	}
+
+	// A msgpack event is a two element array of the timestamp and data.
+	size := msgpackSize(data)
+	if size == 0 || data[0] != 0x92 {
+		return 0, 0, 0, errors.New("skyd.EventIndex: Invalid event")
+	}
+	timestamp, n := msgpackInt(data[1:])
+	if n == 0 {
+		return 0, 0, 0, fmt.Errorf("skyd.EventIndex: Invalid timestamp: %x", data[1])
+	}
+	return timestamp, timestamp, size, nil
+}
+
+// Finds the event at a shifted timestamp in a sorted serialized event
+// stream. Only the event, or the block holding it, is decoded. Checkpoints
+// are passed over. Returns nil if there is no event at the timestamp.
+func findStreamEvent(data []byte, ts int64) (*Event, error) {
+	for offset := 0; offset < len(data); {
+		first, last, size, err := eventStreamElement(data[offset:])
+		if err != nil {
+			return nil, err
+		}
+		element := data[offset : offset+size]
+		offset += size
+		if ts < first {
+			break
+		} else if ts > last || element[0] == eventCheckpointFlag {
+			continue
+		}
+
+		if element[0] != eventBlockFlag {
+			event := &Event{}
+			return event, event.UnmarshalRaw(element)
+		}
+		events, err := DecodeEventBlock(bytes.NewReader(element))
+		if err != nil {
+			return nil, err
+		}
+		for _, event := range events {
+			if ShiftTime(event.Timestamp) == ts {
+				return event, nil
+			}
+		}
+	}
+	return nil, nil
+}
+
+// Reads the msgpack integer at the beginning of the data. Returns the value
+// and its size, or a zero size if the data doesn't start with an integer.
+func msgpackInt(data []byte) (int64, int) {
+	if len(data) == 0 {
+		return 0, 0
+	}
+	b := data[0]
+	switch {
+	case b <= 0x7f:
+		return int64(b), 1
+	case b >= 0xe0:
+		return int64(int8(b)), 1
+	case b == 0xcc && len(data) >= 2:
+		return int64(data[1]), 2
+	case b == 0xcd && len(data) >= 3:
+		return int64(binary.BigEndian.Uint16(data[1:])), 3
+	case b == 0xce && len(data) >= 5:
+		return int64(binary.BigEndian.Uint32(data[1:])), 5
+	case b == 0xcf && len(data) >= 9:
+		return int64(binary.BigEndian.Uint64(data[1:])), 9
+	case b == 0xd0 && len(data) >= 2:
+		return int64(int8(data[1])), 2
+	case b == 0xd1 && len(data) >= 3:
+		return int64(int16(binary.BigEndian.Uint16(data[1:]))), 3
+	case b == 0xd2 && len(data) >= 5:
+		return int64(int32(binary.BigEndian.Uint32(data[1:]))), 5
+	case b == 0xd3 && len(data) >= 9:
+		return int64(binary.BigEndian.Uint64(data[1:])), 9
+	}
+	return 0, 0
+}
+
+// Returns the size of the msgpack element at the beginning of the data,
+// including any nested elements, or zero if it is truncated or invalid.
+func msgpackSize(data []byte) int {
+	if len(data) == 0 {
+		return 0
+	}
+	b := data[0]
+	var header, length, children int
+	switch {
+	case b <= 0x7f || b >= 0xe0:
+		return 1
+	case b >= 0x80 && b <= 0x8f:
+		header, children = 1, 2*int(b&0x0f)
+	case b >= 0x90 && b <= 0x9f:
+		header, children = 1, int(b&0x0f)
+	case b >= 0xa0 && b <= 0xbf:
+		header, length = 1, int(b&0x1f)
+	case b == 0xc0 || b == 0xc2 || b == 0xc3:
+		return 1
+	case b == 0xcc || b == 0xd0:
+		header = 2
+	case b == 0xcd || b == 0xd1:
+		header = 3
+	case b == 0xca || b == 0xce || b == 0xd2:
+		header = 5
+	case b == 0xcb || b == 0xcf || b == 0xd3:
+		header = 9
+	case (b == 0xd9 || b == 0xc4) && len(data) >= 2:
+		header, length = 2, int(data[1])
+	case (b == 0xda || b == 0xc5) && len(data) >= 3:
+		header, length = 3, int(binary.BigEndian.Uint16(data[1:]))
+	case (b == 0xdb || b == 0xc6) && len(data) >= 5:
+		header, length = 5, int(binary.BigEndian.Uint32(data[1:]))
+	case b == 0xdc && len(data) >= 3:
+		header, children = 3, int(binary.BigEndian.Uint16(data[1:]))
+	case b == 0xdd && len(data) >= 5:
+		header, children = 5, int(binary.BigEndian.Uint32(data[1:]))
+	case b == 0xde && len(data) >= 3:
+		header, children = 3, 2*int(binary.BigEndian.Uint16(data[1:]))
+	case b == 0xdf && len(data) >= 5:
+		header, children = 5, 2*int(binary.BigEndian.Uint32(data[1:]))
+	default:
+		return 0
+	}
+
+	size := header + length
+	for i := 0; i < children && size <= len(data); i++ {
+		n := msgpackSize(data[size:])
+		if n == 0 {
+			return 0
+		}
+		size += n
+	}
+	if size > len(data) {
+		return 0
+	}
+	return size
+}
+
+// Encodes an index as the raw msgpack value that is stored in front of the
+// stream it describes. A nil index is encoded as an empty raw.
+func encodeEventIndex(index *eventIndex) ([]byte, error) {
+	b := []byte{}
+	if index != nil {
+		b = make([]byte, eventIndexHeaderSize+(len(index.entries)*eventIndexEntrySize))
+		b[0] = eventIndexVersion
+		binary.LittleEndian.PutUint64(b[1:], uint64(index.first))
+		binary.LittleEndian.PutUint64(b[9:], uint64(index.last))
+		binary.LittleEndian.PutUint32(b[17:], uint32(len(index.entries)))
+		if index.events >= 0 && index.events < eventIndexNoCount {
+			binary.LittleEndian.PutUint32(b[21:], uint32(index.events))
+		} else {
+			binary.LittleEndian.PutUint32(b[21:], eventIndexNoCount)
+		}
+		for i, entry := range index.entries {
+			p := b[eventIndexHeaderSize+(i*eventIndexEntrySize):]
+			binary.LittleEndian.PutUint64(p, uint64(entry.ts))
+			binary.LittleEndian.PutUint32(p[8:], uint32(entry.offset))
+		}
+	}
+	return msgpack.Marshal(b)
+}
+
+// Prefixes a serialized event stream with its index.
+func indexEventStream(data []byte) ([]byte, error) {
+	index, err := newEventIndex(data)
+	if err != nil {
+		return nil, err
+	}
+	b, err := encodeEventIndex(index)
+	if err != nil {
+		return nil, err
+	}
+	return append(b, data...), nil
+}
+
+//--------------------------------------
+// Decoding
+//--------------------------------------
+
+// Splits an index off the front of a serialized event stream. Streams that
+// were written without an index are returned unchanged with a nil index.
+func splitEventIndex(data []byte) (*eventIndex, []byte, error) {
+	n := rawSize(data)
+	if n == 0 {
+		return nil, data, nil
+	}
+	index, err := decodeEventIndex(data[:n])
+	if err != nil {
+		return nil, nil, err
+	}
+	return index, data[n:], nil
+}
+
+// Decodes an index from its raw msgpack value. An empty raw has no index.
+func decodeEventIndex(raw []byte) (*eventIndex, error) {
+	b := raw[rawHeaderSize(raw):]
+	if len(b) == 0 {
+		return nil, nil
+	}
+	headerSize := 0
+	switch b[0] {
+	case eventIndexVersion:
+		headerSize = eventIndexHeaderSize
+	case eventIndexV1Version:
+		headerSize = eventIndexV1HeaderSize
+	}
+	if headerSize == 0 || len(b) < headerSize {
+		return nil, errors.New("skyd.EventIndex: Invalid index header")
+	}
+	count := int(binary.LittleEndian.Uint32(b[17:]))
+	if len(b) != headerSize+(count*eventIndexEntrySize) {
+		return nil, fmt.Errorf("skyd.EventIndex: Invalid index size: %d", len(b))
+	}
+
+	index := &eventIndex{
+		first:   int64(binary.LittleEndian.Uint64(b[1:])),
+		last:    int64(binary.LittleEndian.Uint64(b[9:])),
+		events:  -1,
+		entries: make([]eventIndexEntry, count),
+	}
+	if headerSize == eventIndexHeaderSize {
+		if n := binary.LittleEndian.Uint32(b[21:]); n != eventIndexNoCount {
+			index.events = int(n)
+		}
+	}
+	for i := range index.entries {
+		p := b[headerSize+(i*eventIndexEntrySize):]
+		index.entries[i] = eventIndexEntry{int64(binary.LittleEndian.Uint64(p)), int(binary.LittleEndian.Uint32(p[8:]))}
+	}
+	return index, nil
+}
+
+// Returns the size of the header of the msgpack raw value at the beginning
+// of the data.
+func rawHeaderSize(data []byte) int {
+	switch b := data[0]; {
+	case b >= 0xa0 && b <= 0xbf:
+		return 1
+	case b == 0xd9 || b == 0xc4:
+		return 2
+	case b == 0xda || b == 0xc5:
+		return 3
+	}
+	return 5
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// Checks whether any event in the indexed stream falls in the range of
+// shifted timestamps [start, end).
+func (i *eventIndex) overlaps(start int64, end int64) bool {
+	return i.last >= start && i.first < end
+}
+
+// Returns the offset of the latest entry before a shifted timestamp. Every
+// event before the offset is older than the timestamp.
+func (i *eventIndex) seek(ts int64) int {
+	offset := 0
+	for _, entry := range i.entries {
+		if entry.ts >= ts {
+			break
+		}
+		offset = entry.offset
+	}
+	return offset
+}
@@ -0,0 +1,110 @@
+package skyd
+
+import (
+	"bytes"
+	"github.com/ugorji/go-msgpack"
+	"testing"
+	"time"
+)
+
+// Ensure that an index can be built for a mixed stream and read back.
+func TestEventIndexEncodeDecode(t *testing.T) {
+	buffer := new(bytes.Buffer)
+	events := make([]*Event, 0)
+	for i := 0; i < 100; i++ {
+		event := &Event{Timestamp: time.Unix(int64(1000+i), 0).UTC(), Data: map[int64]interface{}{-1: "A1", 2: []interface{}{int64(i), "x"}}}
+		events = append(events, event)
+		event.EncodeRaw(buffer)
+	}
+	block, _ := EncodeEventBlock([]*Event{NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{-1: "B"})})
+	buffer.Write(block)
+
+	data, err := indexEventStream(buffer.Bytes())
+	if err != nil {
+		t.Fatalf("Unable to index stream: %v", err)
+	}
+	index, stream, err := splitEventIndex(data)
+	if err != nil || !bytes.Equal(stream, buffer.Bytes()) {
+		t.Fatalf("Unable to split index: %v", err)
+	}
+	if index.first != ShiftTime(events[0].Timestamp) || index.last != ShiftTime(NewEvent("2012-01-01T00:00:00Z", nil).Timestamp) {
+		t.Fatalf("Invalid index range: %v..%v", index.first, index.last)
+	}
+	if len(index.entries) != 5 {
+		t.Fatalf("Invalid index entry count: %v", len(index.entries))
+	}
+	if index.events != 101 {
+		t.Fatalf("Invalid index event count: %v", index.events)
+	}
+
+	// Seeking skips whole runs of events before the timestamp.
+	offset := index.seek(ShiftTime(events[70].Timestamp))
+	output, err := DecodeEvents(stream[offset:])
+	if err != nil || !output[0].Timestamp.Equal(events[64].Timestamp) {
+		t.Fatalf("Invalid seek: %v (%v)", offset, err)
+	}
+	if index.overlaps(ShiftTime(time.Unix(0, 0)), ShiftTime(time.Unix(1000, 0))) {
+		t.Fatalf("Unexpected overlap")
+	}
+
+	// Streams without an index are returned as is.
+	if index, stream, err := splitEventIndex(buffer.Bytes()); index != nil || err != nil || !bytes.Equal(stream, buffer.Bytes()) {
+		t.Fatalf("Invalid unindexed split: %v", err)
+	}
+
+	// Version 1 indexes are read without an event count.
+	raw, _ := msgpack.Marshal(append([]byte{eventIndexV1Version}, make([]byte, eventIndexV1HeaderSize-1)...))
+	if index, err := decodeEventIndex(raw); err != nil || index.events != -1 || len(index.entries) != 0 {
+		t.Fatalf("Invalid version 1 index: %v (%v)", index, err)
+	}
+}
+
+// Ensure that checkpoints start their own index entries and are skipped
+// when a stream is decoded.
+func TestEventIndexCheckpoints(t *testing.T) {
+	events := []*Event{
+		&Event{Timestamp: time.Unix(1000, 0).UTC(), Data: map[int64]interface{}{1: "A", -1: int64(10)}},
+		&Event{Timestamp: time.Unix(1001, 0).UTC(), Data: map[int64]interface{}{-1: int64(20)}},
+	}
+	data, _ := events[0].AppendRaw(nil)
+	state := &Event{Data: map[int64]interface{}{1: "A", 2: int64(5), -2: "transient"}}
+	offset := len(data)
+	data, err := appendEventCheckpoint(data, events[1].Timestamp, state)
+	if err != nil {
+		t.Fatalf("Unable to append checkpoint: %v", err)
+	}
+	end := len(data)
+	data, _ = events[1].AppendRaw(data)
+
+	index, err := newEventIndex(data)
+	if err != nil || len(index.entries) != 2 || index.entries[1].offset != offset || index.entries[1].ts != ShiftTime(events[1].Timestamp) {
+		t.Fatalf("Invalid checkpoint entry: %v (%v)", index, err)
+	}
+	output, err := DecodeEvents(data)
+	if err != nil {
+		t.Fatalf("Unable to decode stream: %v", err)
+	}
+	assertEvents(t, events, output)
+	if event, err := findStreamEvent(data, ShiftTime(events[1].Timestamp)); err != nil || event == nil || event.Data[-1] != int64(20) {
+		t.Fatalf("Invalid event found: %v (%v)", event, err)
+	}
+
+	// The checkpoint holds only permanent values and counting starts over
+	// after it.
+	checkpoint := &Event{}
+	if err = checkpoint.UnmarshalRaw(data[offset+1 : end]); err != nil || len(checkpoint.Data) != 2 || checkpoint.Data[2] != int64(5) {
+		t.Fatalf("Invalid checkpoint: %v (%v)", checkpoint, err)
+	}
+	if start, count, err := eventCheckpointDistance(data); err != nil || start != ShiftTime(events[1].Timestamp) || count != 1 {
+		t.Fatalf("Invalid checkpoint distance: %v, %v (%v)", start, count, err)
+	}
+
+	// Checkpoints are dropped until every stale property is set again.
+	stream, dropped, err := dropEventCheckpoints(data, map[int64]bool{2: true})
+	if err != nil || !dropped || len(stream) != len(data)-(end-offset) {
+		t.Fatalf("Checkpoint was not dropped: %v (%v)", dropped, err)
+	}
+	if _, dropped, _ = dropEventCheckpoints(data, map[int64]bool{1: true}); dropped {
+		t.Fatalf("Unexpected dropped checkpoint")
+	}
+}
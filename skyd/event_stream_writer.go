@@ -0,0 +1,406 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/binary"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"github.com/ugorji/go-msgpack"
+	"math"
+	"net/http"
+	"sort"
+	"strconv"
+	"time"
+	"unicode/utf8"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of bytes an event stream writer buffers before writing them
+// to the response.
+const eventStreamBufferSize = 64 * 1024
+
+// The hex digits used to escape JSON strings.
+const jsonHexDigits = "0123456789abcdef"
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// An eventStreamWriter writes the events of a serialized event stream to a
+// response without decoding them. Each msgpack event is walked once, its
+// property ids are mapped to names through the table's property file and
+// its factors are mapped to their values through the factor dictionaries.
+// Events are written as a JSON array or, in msgpack, one map per event,
+// each with the same "data" and "timestamp" as a serialized event.
+type eventStreamWriter struct {
+	w       http.ResponseWriter
+	table   *Table
+	factors *Factors
+	msgpack bool
+	after   int64
+	limit   int
+	count   int
+	started bool
+	buffer  []byte
+	scratch []byte
+	fields  eventStreamFieldList
+	names   map[int64][]byte
+}
+
+// A property of an event being written and its msgpack value.
+type eventStreamField struct {
+	property *Property
+	value    []byte
+}
+
+type eventStreamFieldList []eventStreamField
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates a writer for the events of an object in a table. Every event is
+// written unless a start time or a limit are set.
+func newEventStreamWriter(w http.ResponseWriter, table *Table, factors *Factors, msgpack bool) *eventStreamWriter {
+	return &eventStreamWriter{
+		w:       w,
+		table:   table,
+		factors: factors,
+		msgpack: msgpack,
+		after:   math.MinInt64,
+		names:   make(map[int64][]byte),
+	}
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Appends a string as a JSON string with the same escaping as the JSON
+// encoder.
+func appendJSONString(b []byte, s []byte) []byte {
+	b = append(b, '"')
+	start := 0
+	for i := 0; i < len(s); {
+		if c := s[i]; c < utf8.RuneSelf {
+			if c >= 0x20 && c != '"' && c != '\\' && c != '<' && c != '>' && c != '&' {
+				i++
+				continue
+			}
+			b = append(b, s[start:i]...)
+			switch c {
+			case '"', '\\':
+				b = append(b, '\\', c)
+			case '\n':
+				b = append(b, '\\', 'n')
+			case '\r':
+				b = append(b, '\\', 'r')
+			case '\t':
+				b = append(b, '\\', 't')
+			default:
+				b = append(b, '\\', 'u', '0', '0', jsonHexDigits[c>>4], jsonHexDigits[c&0xf])
+			}
+			i++
+			start = i
+			continue
+		}
+		r, size := utf8.DecodeRune(s[i:])
+		if r == utf8.RuneError && size == 1 {
+			b = append(append(b, s[start:i]...), `\ufffd`...)
+		} else if r == '\u2028' || r == '\u2029' {
+			b = append(append(b, s[start:i]...), '\\', 'u', '2', '0', '2', jsonHexDigits[r&0xf])
+		} else {
+			i += size
+			continue
+		}
+		i += size
+		start = i
+	}
+	b = append(b, s[start:]...)
+	return append(b, '"')
+}
+
+// Returns the contents of the msgpack raw at the beginning of the data or
+// false if it doesn't start with a raw.
+func msgpackRaw(data []byte) ([]byte, bool) {
+	b := data[0]
+	var header, length int
+	switch {
+	case b >= 0xa0 && b <= 0xbf:
+		header, length = 1, int(b&0x1f)
+	case b == 0xd9 || b == 0xc4:
+		header, length = 2, int(data[1])
+	case b == 0xda || b == 0xc5:
+		header, length = 3, int(binary.BigEndian.Uint16(data[1:]))
+	case b == 0xdb || b == 0xc6:
+		header, length = 5, int(binary.BigEndian.Uint32(data[1:]))
+	default:
+		return nil, false
+	}
+	return data[header : header+length], true
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Writing
+//--------------------------------------
+
+// Writes the events of a serialized event stream that are after the start
+// time until the limit is reached and finishes the response. Checkpoints
+// are left out.
+func (sw *eventStreamWriter) write(data []byte) error {
+	if !sw.msgpack {
+		sw.buffer = append(sw.buffer, '[')
+	}
+	for offset := 0; offset < len(data) && (sw.limit == 0 || sw.count < sw.limit); {
+		_, last, size, err := eventStreamElement(data[offset:])
+		if err != nil {
+			return err
+		}
+		element := data[offset : offset+size]
+		offset += size
+		if last <= sw.after || element[0] == eventCheckpointFlag {
+			continue
+		}
+
+		// Blocks are decoded and encoded again as msgpack events.
+		if element[0] == eventBlockFlag {
+			events, err := DecodeEventBlock(bytes.NewReader(element))
+			if err != nil {
+				return err
+			}
+			for _, event := range events {
+				if sw.scratch, err = event.AppendRaw(sw.scratch[:0]); err != nil {
+					return err
+				}
+				if err = sw.writeEvent(sw.scratch); err != nil {
+					return err
+				}
+			}
+		} else if err = sw.writeEvent(element); err != nil {
+			return err
+		}
+	}
+	if !sw.msgpack {
+		sw.buffer = append(sw.buffer, ']', '\n')
+	}
+	return sw.flush()
+}
+
+// Writes a single msgpack event if it's after the start time and the limit
+// hasn't been reached.
+func (sw *eventStreamWriter) writeEvent(data []byte) error {
+	timestamp, n := msgpackInt(data[1:])
+	if n == 0 {
+		return errors.New("skyd.EventStreamWriter: Invalid timestamp")
+	}
+	if timestamp <= sw.after || (sw.limit > 0 && sw.count >= sw.limit) {
+		return nil
+	}
+
+	// Collect the properties so they're written in name order.
+	pos := 1 + n
+	var count int
+	switch b := data[pos]; {
+	case b == 0xc0:
+		pos++
+	case b >= 0x80 && b <= 0x8f:
+		count, pos = int(b&0x0f), pos+1
+	case b == 0xde:
+		count, pos = int(binary.BigEndian.Uint16(data[pos+1:])), pos+3
+	case b == 0xdf:
+		count, pos = int(binary.BigEndian.Uint32(data[pos+1:])), pos+5
+	default:
+		return errors.New("skyd.EventStreamWriter: Invalid event data")
+	}
+	sw.fields = sw.fields[:0]
+	for i := 0; i < count; i++ {
+		id, n := msgpackInt(data[pos:])
+		if n == 0 {
+			return errors.New("skyd.EventStreamWriter: Invalid property key")
+		}
+		pos += n
+		size := msgpackSize(data[pos:])
+		if size == 0 {
+			return errors.New("skyd.EventStreamWriter: Invalid property value")
+		}
+		property := sw.table.propertyFile.GetProperty(id)
+		if property == nil {
+			return fmt.Errorf("skyd.EventStreamWriter: Property not found: %v", id)
+		}
+		sw.fields = append(sw.fields, eventStreamField{property, data[pos : pos+size]})
+		pos += size
+	}
+	sort.Sort(sw.fields)
+
+	ts := []byte(UnshiftTime(timestamp).UTC().Format(time.RFC3339))
+	var err error
+	if sw.msgpack {
+		err = sw.appendMsgpackEvent(ts)
+	} else {
+		err = sw.appendJSONEvent(ts)
+	}
+	if err != nil {
+		return err
+	}
+	sw.count++
+
+	if len(sw.buffer) >= eventStreamBufferSize {
+		return sw.flush()
+	}
+	return nil
+}
+
+// Appends the collected properties of an event as a JSON object.
+func (sw *eventStreamWriter) appendJSONEvent(ts []byte) error {
+	b := sw.buffer
+	if sw.count > 0 {
+		b = append(b, ',')
+	}
+	b = append(b, `{"data":{`...)
+	for i, field := range sw.fields {
+		if i > 0 {
+			b = append(b, ',')
+		}
+		b = append(b, sw.name(field.property)...)
+		b = append(b, ':')
+		var err error
+		if b, err = sw.appendJSONValue(b, field); err != nil {
+			return err
+		}
+	}
+	b = append(b, `},"timestamp":`...)
+	sw.buffer = append(appendJSONString(b, ts), '}')
+	return nil
+}
+
+// Appends the msgpack value of a property as JSON.
+func (sw *eventStreamWriter) appendJSONValue(b []byte, field eventStreamField) ([]byte, error) {
+	value := field.value
+	if i, n := msgpackInt(value); n > 0 {
+		if field.property.DataType == FactorDataType {
+			s, err := sw.factors.Defactorize(sw.table.Name, field.property.Name, uint64(i))
+			if err != nil {
+				return nil, err
+			}
+			return appendJSONString(b, []byte(s)), nil
+		}
+		if value[0] == 0xcf {
+			return strconv.AppendUint(b, binary.BigEndian.Uint64(value[1:]), 10), nil
+		}
+		return strconv.AppendInt(b, i, 10), nil
+	}
+	if raw, ok := msgpackRaw(value); ok {
+		return appendJSONString(b, raw), nil
+	}
+	switch value[0] {
+	case 0xc0:
+		return append(b, "null"...), nil
+	case 0xc2:
+		return append(b, "false"...), nil
+	case 0xc3:
+		return append(b, "true"...), nil
+	}
+
+	// Floats and anything nested go through the JSON encoder.
+	var v interface{}
+	if err := msgpack.NewDecoder(bytes.NewReader(value), nil).Decode(&v); err != nil {
+		return nil, err
+	}
+	data, err := json.Marshal(ConvertToStringKeys(normalize(v)))
+	if err != nil {
+		return nil, err
+	}
+	return append(b, data...), nil
+}
+
+// Appends the collected properties of an event as a msgpack map. Values are
+// copied as they're stored except for factors.
+func (sw *eventStreamWriter) appendMsgpackEvent(ts []byte) error {
+	b := append(sw.buffer, 0x82)
+	b = appendMsgpackHeader(b, 4, 0xa0, 0x1f, 0xda)
+	b = append(b, "data"...)
+	b = appendMsgpackHeader(b, len(sw.fields), 0x80, 0x0f, 0xde)
+	for _, field := range sw.fields {
+		b = append(b, sw.name(field.property)...)
+		if i, n := msgpackInt(field.value); n > 0 && field.property.DataType == FactorDataType {
+			s, err := sw.factors.Defactorize(sw.table.Name, field.property.Name, uint64(i))
+			if err != nil {
+				return err
+			}
+			b = append(appendMsgpackHeader(b, len(s), 0xa0, 0x1f, 0xda), s...)
+		} else {
+			b = append(b, field.value...)
+		}
+	}
+	b = appendMsgpackHeader(b, 9, 0xa0, 0x1f, 0xda)
+	b = append(b, "timestamp"...)
+	b = appendMsgpackHeader(b, len(ts), 0xa0, 0x1f, 0xda)
+	sw.buffer = append(b, ts...)
+	return nil
+}
+
+// Returns the encoded name of a property, which is a JSON string or a
+// msgpack raw depending on the format.
+func (sw *eventStreamWriter) name(property *Property) []byte {
+	if name, ok := sw.names[property.Id]; ok {
+		return name
+	}
+	var name []byte
+	if sw.msgpack {
+		name = append(appendMsgpackHeader(nil, len(property.Name), 0xa0, 0x1f, 0xda), property.Name...)
+	} else {
+		name = appendJSONString(nil, []byte(property.Name))
+	}
+	sw.names[property.Id] = name
+	return name
+}
+
+// Writes the buffered bytes to the response. The content type is set before
+// anything is written.
+func (sw *eventStreamWriter) flush() error {
+	if !sw.started {
+		sw.started = true
+		if sw.msgpack {
+			sw.w.Header().Set("Content-Type", "application/x-msgpack")
+		} else {
+			sw.w.Header().Set("Content-Type", "application/json")
+		}
+	}
+	_, err := sw.w.Write(sw.buffer)
+	sw.buffer = sw.buffer[:0]
+	return err
+}
+
+//--------------------------------------
+// Sorting
+//--------------------------------------
+
+func (l eventStreamFieldList) Len() int {
+	return len(l)
+}
+
+func (l eventStreamFieldList) Less(i, j int) bool {
+	return l[i].property.Name < l[j].property.Name
+}
+
+func (l eventStreamFieldList) Swap(i, j int) {
+	l[i], l[j] = l[j], l[i]
+}
@@ -2,6 +2,7 @@ package skyd
 
 import (
 	"bytes"
+	"strings"
 	"testing"
 	"time"
 )
@@ -31,6 +32,28 @@ func TestEncodeDecode(t *testing.T) {
 	}
 }
 
+// Ensure that events are appended with the tags that the cursor reads.
+func TestEventAppendRaw(t *testing.T) {
+	e := &Event{Timestamp: time.Unix(0, 0).UTC(), Data: map[int64]interface{}{1: int64(300)}}
+	b, err := e.AppendRaw([]byte{0xff})
+	if err != nil || !bytes.Equal(b, []byte{0xff, 0x92, 0x00, 0x81, 0x01, 0xd1, 0x01, 0x2c}) {
+		t.Fatalf("Unexpected encoding: %x (%v)", b, err)
+	}
+
+	e.Data = map[int64]interface{}{-40: int32(-40), 2: uint16(200), 3: 1.5, 4: float32(0.5), 5: true, 6: "foo", 7: strings.Repeat("x", 40), 8: int64(1) << 40}
+	b, err = e.AppendRaw(nil)
+	if err != nil {
+		t.Fatalf("Unable to encode: %v", err)
+	}
+	e2 := &Event{}
+	if err = e2.UnmarshalRaw(b); err != nil {
+		t.Fatalf("Unable to decode: %v", err)
+	}
+	if !e.Equal(e2) {
+		t.Fatalf("Events do not match: %v <=> %v", e, e2)
+	}
+}
+
 // Ensure that two events can be merged together.
 func TestMerge(t *testing.T) {
 	a := NewEvent("1970-01-01T00:00:00Z", map[int64]interface{}{-1: int64(30), -2: "foo"})
@@ -1,24 +1,210 @@
 package skyd
 
 /*
-#cgo LDFLAGS: -lcsky -lluajit-5.1 -lleveldb
+#cgo LDFLAGS: -lcsky -lluajit-5.1 -lleveldb -lm
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <leveldb/c.h>
 #include <sky/cursor.h>
+#include <sky/kernel.h>
+#include <sky/object_scan.h>
+#include <sky/worker_pool.h>
 #include <luajit-2.0/lua.h>
 #include <luajit-2.0/lualib.h>
 #include <luajit-2.0/lauxlib.h>
+#include <luajit-2.0/luajit.h>
 
-int mp_pack(lua_State *L);
-int mp_unpack(lua_State *L);
+int mp_unpack_buffer(lua_State *L, const unsigned char *s, size_t len);
 
-int executionEngine_nextObject(void *cursor);
+// Tracks the memory of a Lua state and refuses allocations that would take
+// it over a limit, which Lua reports as a memory error. A zero limit
+// leaves the state unbounded. With huge pages, blocks of at least a huge
+// page, such as the arrays of large result tables, are mapped on their own
+// and backed by huge pages.
+typedef struct {
+	size_t used;
+	size_t limit;
+	int huge_pages;
+} executionEngine_allocator;
 
-int executionEngine_c_next_object(void *cursor) {
-	return (bool)executionEngine_nextObject(cursor);
+#define EXECUTION_ENGINE_HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+static size_t executionEngine_huge_size(size_t size) {
+	return (size + EXECUTION_ENGINE_HUGE_PAGE_SIZE - 1) & ~(EXECUTION_ENGINE_HUGE_PAGE_SIZE - 1);
+}
+
+// Maps a block of huge pages, or returns NULL. Explicit huge pages fall
+// back to transparent ones, which need a range aligned to a huge page.
+static void *executionEngine_map_huge(size_t size, int huge_pages) {
+	size = executionEngine_huge_size(size);
+#ifdef MAP_HUGETLB
+	if(huge_pages == leveldb_explicit_huge_pages) {
+		void *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if(p != MAP_FAILED) {
+			return p;
+		}
+	}
+#endif
+	size_t len = size + EXECUTION_ENGINE_HUGE_PAGE_SIZE;
+	char *p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED) {
+		return NULL;
+	}
+	char *aligned = (char*)executionEngine_huge_size((size_t)p);
+	if(aligned > p) {
+		munmap(p, aligned - p);
+	}
+	if(p + len > aligned + size) {
+		munmap(aligned + size, (p + len) - (aligned + size));
+	}
+#ifdef MADV_HUGEPAGE
+	madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+	return aligned;
+}
+
+// Lua passes the size of a block back when it's resized or freed, so the
+// size alone tells whether the block was mapped.
+static void *executionEngine_realloc(executionEngine_allocator *a, void *ptr, size_t osize, size_t nsize) {
+	bool huge = a->huge_pages != leveldb_no_huge_pages && nsize >= EXECUTION_ENGINE_HUGE_PAGE_SIZE;
+	bool was_huge = a->huge_pages != leveldb_no_huge_pages && ptr != NULL && osize >= EXECUTION_ENGINE_HUGE_PAGE_SIZE;
+	if(!huge && !was_huge) {
+		return realloc(ptr, nsize);
+	}
+	if(huge && was_huge && executionEngine_huge_size(nsize) == executionEngine_huge_size(osize)) {
+		return ptr;
+	}
+	void *p = huge ? executionEngine_map_huge(nsize, a->huge_pages) : malloc(nsize);
+	if(p == NULL) {
+		return NULL;
+	}
+	if(ptr != NULL) {
+		memcpy(p, ptr, osize < nsize ? osize : nsize);
+		if(was_huge) {
+			munmap(ptr, executionEngine_huge_size(osize));
+		} else {
+			free(ptr);
+		}
+	}
+	return p;
+}
+
+static void *executionEngine_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+	executionEngine_allocator *a = (executionEngine_allocator*)ud;
+	if(nsize == 0) {
+		if(a->huge_pages != leveldb_no_huge_pages && ptr != NULL && osize >= EXECUTION_ENGINE_HUGE_PAGE_SIZE) {
+			munmap(ptr, executionEngine_huge_size(osize));
+		} else {
+			free(ptr);
+		}
+		a->used -= osize;
+		return NULL;
+	}
+	if(a->limit > 0 && nsize > osize && a->used + (nsize - osize) > a->limit) {
+		return NULL;
+	}
+	void *p = executionEngine_realloc(a, ptr, osize, nsize);
+	if(p != NULL) {
+		a->used = a->used - osize + nsize;
+	}
+	return p;
 }
 
-void executionEngine_setNextObjectFunc(void *cursor) {
-	((sky_cursor*)cursor)->next_object_func = executionEngine_c_next_object;
+// Creates a state that allocates through the allocator. 64-bit LuaJIT 2.0
+// only runs on its own allocator and refuses a custom one, in which case
+// the state is created with it and the allocator stays unused.
+static lua_State *executionEngine_newstate(executionEngine_allocator *a) {
+	lua_State *L = lua_newstate(executionEngine_alloc, a);
+	if(L == NULL) {
+		L = luaL_newstate();
+	}
+	return L;
+}
+
+// Collects the bytecode of a dumped function into a growing buffer.
+typedef struct {
+	char *data;
+	size_t sz;
+	size_t capacity;
+} executionEngine_dump_buffer;
+
+static int executionEngine_dump_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+	executionEngine_dump_buffer *b = (executionEngine_dump_buffer*)ud;
+	if(b->sz + sz > b->capacity) {
+		size_t capacity = b->capacity > 0 ? b->capacity : 4096;
+		while(capacity < b->sz + sz) {
+			capacity *= 2;
+		}
+		char *data = realloc(b->data, capacity);
+		if(data == NULL) {
+			return 1;
+		}
+		b->data = data;
+		b->capacity = capacity;
+	}
+	memcpy(b->data + b->sz, p, sz);
+	b->sz += sz;
+	return 0;
+}
+
+// Dumps the function on top of the stack as bytecode. The buffer's data
+// must be freed by the caller.
+static int executionEngine_dump(lua_State *L, executionEngine_dump_buffer *b) {
+	return lua_dump(L, executionEngine_dump_writer, b);
+}
+
+static const char *executionEngine_luajit_version() {
+	return LUAJIT_VERSION;
+}
+
+// An aggregation that can run on a worker thread. The kernel is run if
+// there is one. Otherwise the script's sky_aggregate() is called with the
+// cursor and its result or error is left on the stack.
+typedef struct {
+	lua_State *L;
+	sky_cursor *cursor;
+	sky_kernel *kernel;
+	int rc;
+} executionEngine_task;
+
+static void executionEngine_run_task(void *arg) {
+	executionEngine_task *t = (executionEngine_task*)arg;
+	if(t->kernel != NULL) {
+		t->rc = sky_kernel_run(t->kernel, t->cursor);
+		return;
+	}
+	lua_getfield(t->L, LUA_GLOBALSINDEX, "sky_aggregate");
+	lua_pushlightuserdata(t->L, t->cursor);
+	t->rc = lua_pcall(t->L, 1, 1, 0);
+}
+
+typedef struct {
+	int type;
+	lua_Number number;
+	const char *str;
+	size_t sz;
+} executionEngine_lua_value;
+
+static void executionEngine_read_value(lua_State *L, int index, executionEngine_lua_value *value) {
+	value->type = lua_type(L, index);
+	switch(value->type) {
+		case LUA_TNUMBER: value->number = lua_tonumber(L, index); break;
+		case LUA_TBOOLEAN: value->number = lua_toboolean(L, index); break;
+		case LUA_TSTRING: value->str = lua_tolstring(L, index, &value->sz); break;
+	}
+}
+
+// Advances to the next key/value pair of the table at the given index and
+// reads both in a single call. The value is left on top of the stack.
+int executionEngine_next_pair(lua_State *L, int table, executionEngine_lua_value *key, executionEngine_lua_value *value) {
+	if(!lua_next(L, table)) {
+		return 0;
+	}
+	executionEngine_read_value(L, -2, key);
+	executionEngine_read_value(L, -1, value);
+	return 1;
 }
 
 */
@@ -26,16 +212,34 @@ import "C"
 
 import (
 	"bytes"
+	"encoding/json"
 	"errors"
 	"fmt"
 	"github.com/jmhodges/levigo"
 	"github.com/ugorji/go-msgpack"
+	"math"
 	"regexp"
 	"sort"
+	"strings"
 	"text/template"
+	"time"
 	"unsafe"
 )
 
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The maximum depth of nested tables read from a Lua result. Deeper tables
+// are returned as nil, which also guards against circular references.
+const maxLuaResultDepth = 16
+
+// The heap growth in bytes at which the aggregations of queries that spill
+// hand back their partial results when the engine has no memory limit.
+const DefaultSpillBudget = 64 * 1024 * 1024
+
 //------------------------------------------------------------------------------
 //
 // Typedefs
@@ -44,21 +248,89 @@ import (
 
 // An ExecutionEngine is used to iterate over a series of objects.
 type ExecutionEngine struct {
-	tableName    string
-	iterator     *levigo.Iterator
-	cursor       *C.sky_cursor
-	prefix       []byte
-	state        *C.lua_State
-	header       string
-	source       string
-	fullSource   string
-	propertyFile *PropertyFile
-	propertyRefs []*Property
+	tableName       string
+	iterator        *levigo.Iterator
+	cursor          *C.sky_cursor
+	scan            *C.sky_object_scan
+	frozenScan      *C.sky_frozen_scan
+	frozen          *frozenFile
+	partition       *servletPartition
+	prefix          []byte
+	startKey        []byte
+	endKey          []byte
+	hasTimeRange    bool
+	minTimestamp    int64
+	maxTimestamp    int64
+	skipRanges      []keyRange
+	state           *C.lua_State
+	header          string
+	source          string
+	fullSource      string
+	propertyFile    *PropertyFile
+	propertyVersion uint64
+	schema          *propertySchema
+	propertyRefs    []*Property
+	options         EngineOptions
+	bytecode        *LuaBytecodeCache
+	threads         *QueryThreadPool
+	allocator       *C.executionEngine_allocator
+	memoryLimit     int
+	exhausted       bool
+	compileTime     time.Duration
+	readStats       *C.leveldb_readstats_t
+	kernel          *C.sky_kernel
+	kernelPlan      *queryKernel
+	pipelineDepth   int
+	argumentBuffer  bytes.Buffer
 
 	cprefix    unsafe.Pointer
 	cprefix_sz C.size_t
 }
 
+// EngineOptions tune the LuaJIT compiler and garbage collector of each
+// execution engine. Zero values keep LuaJIT's defaults.
+type EngineOptions struct {
+	// The maximum number of traces in the trace cache. Large generated
+	// aggregations can run out of traces and fall back to the interpreter.
+	MaxTrace int
+
+	// The maximum total size of the machine code of the traces, in KB.
+	MaxMcode int
+
+	// The number of iterations of a loop before it's traced.
+	HotLoop int
+
+	// How much the Lua heap grows after a collection before the next one
+	// starts, in percent.
+	GCPause int
+
+	// How fast incremental collection runs relative to allocation, in
+	// percent.
+	GCStepMul int
+
+	// The collector is stopped while an aggregation runs until the Lua
+	// heap grows past this many bytes so that aggregations that fit in it
+	// never pause. Zero leaves the collector running.
+	GCStopBudget int
+
+	// The most memory in bytes that an engine's Lua state can use. An
+	// aggregation that needs more fails with an error and its engine is
+	// destroyed instead of being reused. Zero leaves states unbounded.
+	MemoryLimit int
+
+	// How many bytes the Lua heap can grow by during the aggregation of a
+	// query that spills before it stops and hands back its partial result
+	// to be written to disk. Zero uses half the memory limit, or DefaultSpillBudget without
+	// one. Budgets over half the memory limit are lowered to it.
+	SpillBudget int
+
+	// Whether the blocks of a Lua heap that are at least a huge page, such
+	// as the arrays of large result tables, are backed by huge pages. One
+	// of the HugePages constants. 64-bit LuaJIT states that refuse the
+	// engine's allocator keep their own.
+	HugePages int
+}
+
 //------------------------------------------------------------------------------
 //
 // Constructor
@@ -66,6 +338,17 @@ type ExecutionEngine struct {
 //------------------------------------------------------------------------------
 
 func NewExecutionEngine(table *Table, source string) (*ExecutionEngine, error) {
+	return NewExecutionEngineWithOptions(table, source, EngineOptions{})
+}
+
+// Creates an engine whose Lua state is tuned with the given options.
+func NewExecutionEngineWithOptions(table *Table, source string, options EngineOptions) (*ExecutionEngine, error) {
+	return newExecutionEngine(table, source, options, nil)
+}
+
+// Creates an engine that loads its script from a bytecode cache, if one is
+// given, and adds it to the cache once it's compiled.
+func newExecutionEngine(table *Table, source string, options EngineOptions, bytecode *LuaBytecodeCache) (*ExecutionEngine, error) {
 	if table == nil {
 		return nil, errors.New("skyd.ExecutionEngine: Table required")
 	}
@@ -73,30 +356,37 @@ func NewExecutionEngine(table *Table, source string) (*ExecutionEngine, error) {
 	if propertyFile == nil {
 		return nil, errors.New("skyd.ExecutionEngine: Property file required")
 	}
+	schema := propertyFile.schema()
 
 	// Find a list of all references properties.
-	propertyRefs, err := extractPropertyReferences(propertyFile, source)
+	propertyRefs, err := extractPropertyReferences(schema, source)
 	if err != nil {
 		return nil, err
 	}
 
 	// Determine table prefix.
-	prefix, err := TablePrefix(table.Name)
+	prefix, err := table.Prefix()
 	if err != nil {
 		return nil, err
 	}
 
 	// Create the engine.
 	e := &ExecutionEngine{
-		tableName:    table.Name,
-		prefix:       prefix,
-		propertyFile: propertyFile,
-		source:       source,
-		propertyRefs: propertyRefs,
+		tableName:       table.Name,
+		prefix:          prefix,
+		propertyFile:    propertyFile,
+		propertyVersion: schema.Version(),
+		schema:          schema,
+		source:          source,
+		propertyRefs:    propertyRefs,
+		options:         options,
+		bytecode:        bytecode,
 	}
 
 	// Initialize the engine.
+	t := time.Now()
 	err = e.init()
+	e.compileTime = time.Since(t)
 	if err != nil {
 		fmt.Printf("%s\n\n", e.FullAnnotatedSource())
 		e.Destroy()
@@ -106,6 +396,64 @@ func NewExecutionEngine(table *Table, source string) (*ExecutionEngine, error) {
 	return e, nil
 }
 
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Generates the Lua that applies engine options to a new state before the
+// script is compiled.
+func (o EngineOptions) luaSource() string {
+	var buffer bytes.Buffer
+	params := make([]string, 0)
+	for _, param := range []struct {
+		name  string
+		value int
+	}{{"maxtrace", o.MaxTrace}, {"maxmcode", o.MaxMcode}, {"hotloop", o.HotLoop}} {
+		if param.value > 0 {
+			params = append(params, fmt.Sprintf("'%s=%d'", param.name, param.value))
+		}
+	}
+	if len(params) > 0 {
+		fmt.Fprintf(&buffer, "jit.opt.start(%s)\n", strings.Join(params, ", "))
+	}
+	if o.GCPause > 0 {
+		fmt.Fprintf(&buffer, "collectgarbage('setpause', %d)\n", o.GCPause)
+	}
+	if o.GCStepMul > 0 {
+		fmt.Fprintf(&buffer, "collectgarbage('setstepmul', %d)\n", o.GCStepMul)
+	}
+	if o.GCStopBudget > 0 {
+		fmt.Fprintf(&buffer, "sky_gc_budget = %d\n", (o.GCStopBudget+1023)/1024)
+	}
+	if o.MemoryLimit > 0 {
+		fmt.Fprintf(&buffer, "sky_memory_limit = %d\n", (o.MemoryLimit+1023)/1024)
+	}
+	return buffer.String()
+}
+
+// Converts a time range into shifted timestamps. A zero time leaves that side
+// of the range unbounded.
+func shiftTimeRange(start time.Time, end time.Time) (int64, int64) {
+	min, max := int64(math.MinInt64), int64(math.MaxInt64)
+	if !start.IsZero() {
+		min = ShiftTime(start)
+	}
+	if !end.IsZero() {
+		max = ShiftTime(end)
+	}
+	return min, max
+}
+
+// Returns a pointer to the first id of a list or nil if the list is empty.
+func int64Ptr(ids []C.int64_t) *C.int64_t {
+	if len(ids) == 0 {
+		return nil
+	}
+	return &ids[0]
+}
+
 //------------------------------------------------------------------------------
 //
 // Properties
@@ -137,19 +485,252 @@ func (e *ExecutionEngine) FullAnnotatedSource() string {
 	})
 }
 
-// Sets the iterator to use.
+// Sets the iterator to use. The cursor's object scan reads objects from it
+// in C, in place, so the iterator must be created with pinned data (see
+// setPinData).
 func (e *ExecutionEngine) SetIterator(iterator *levigo.Iterator) error {
-	// Close the old iterator.
+	// Detach and close the old iterator.
+	if e.scan != nil {
+		C.sky_object_scan_set_iterator(e.scan, nil)
+	}
 	if e.iterator != nil {
 		e.iterator.Close()
 	}
+	if e.partition != nil {
+		e.partition.release()
+		e.partition = nil
+	}
 
 	// Attach the new iterator.
 	e.iterator = iterator
 	if e.iterator != nil {
-		e.iterator.Seek(e.prefix)
+		if e.startKey != nil {
+			e.iterator.Seek(e.startKey)
+		} else {
+			e.iterator.Seek(e.prefix)
+		}
+		if err := e.initScan(); err != nil {
+			return err
+		}
+		C.sky_object_scan_set_iterator(e.scan, *(**C.leveldb_iterator_t)(unsafe.Pointer(e.iterator)))
+		C.sky_cursor_set_object_scan(e.cursor, e.scan)
+	}
+
+	return nil
+}
+
+// Hands the engine a reference to the time partition that its iterator
+// reads from. The reference is released when the iterator is closed so the
+// partition's database stays open for the scan. This must be set after the
+// iterator.
+func (e *ExecutionEngine) SetPartition(partition *servletPartition) {
+	e.partition = partition
+}
+
+// Sets the objects [first, end) of a frozen file to scan instead of an
+// iterator. The objects are read in place from the mapped file, so the
+// engine takes over a reference to the file and releases it when the range
+// is replaced or the engine is reset.
+func (e *ExecutionEngine) SetFrozenRange(file *frozenFile, first int, end int) {
+	if e.frozen != nil {
+		e.frozen.release()
+	}
+	e.frozen = file
+	if e.frozen != nil {
+		index := unsafe.Pointer(nil)
+		if end > first {
+			index = unsafe.Pointer(&file.index[0])
+		}
+		C.sky_frozen_scan_set_range(e.frozenScan, unsafe.Pointer(&file.data[0]), index, C.uint32_t(first), C.uint32_t(end))
+		if len(file.keys) > 0 {
+			C.sky_frozen_scan_set_keys(e.frozenScan, unsafe.Pointer(&file.keys[0]), C.size_t(len(file.keys)), C.uint32_t(file.count))
+		}
+		C.sky_cursor_set_frozen_scan(e.cursor, e.frozenScan)
+	} else if e.frozenScan != nil {
+		C.sky_frozen_scan_set_range(e.frozenScan, nil, nil, 0, 0)
+	}
+}
+
+// Restricts the engine to the objects with keys in [startKey, endKey). A nil
+// key leaves that side of the range bound only by the table prefix. This
+// must be set before the iterator.
+func (e *ExecutionEngine) SetKeyRange(startKey []byte, endKey []byte) {
+	e.startKey = startKey
+	e.endKey = endKey
+}
+
+// Lowers the most memory in bytes that the engine can use below the limit
+// of its options, such as to split the memory budget of a query between its
+// engines. Zero restores the limit of the options.
+func (e *ExecutionEngine) SetMemoryLimit(limit int) {
+	if limit <= 0 || (e.options.MemoryLimit > 0 && limit > e.options.MemoryLimit) {
+		limit = e.options.MemoryLimit
+	}
+	e.memoryLimit = limit
+	if e.allocator != nil {
+		e.allocator.limit = C.size_t(limit)
+	}
+	if e.kernel != nil {
+		C.sky_kernel_set_memory_limit(e.kernel, C.size_t(limit))
+	}
+
+	// The header checks the limit itself on states that can't use the
+	// allocator.
+	if e.state != nil {
+		name := C.CString("sky_memory_limit")
+		defer C.free(unsafe.Pointer(name))
+		if limit > 0 {
+			C.lua_pushnumber(e.state, C.lua_Number((limit+1023)/1024))
+		} else {
+			C.lua_pushnil(e.state)
+		}
+		C.lua_setfield(e.state, -10002, name)
+	}
+}
+
+// Makes the engine's aggregation stop once its Lua heap grows by more than
+// the spill budget, even after a full collection, and return its partial
+// result. Spilled reports whether it stopped early, and aggregating again
+// continues with the next object. The budget is taken from the memory limit
+// in effect so this has to be set after it. Kernels don't spill.
+func (e *ExecutionEngine) SetSpill(enabled bool) {
+	if e.state == nil {
+		return
+	}
+	budget := 0
+	if enabled {
+		budget = e.options.SpillBudget
+		if half := e.memoryLimit / 2; half > 0 && (budget <= 0 || budget > half) {
+			budget = half
+		} else if budget <= 0 {
+			budget = DefaultSpillBudget
+		}
+	}
+
+	name := C.CString("sky_spill_budget")
+	defer C.free(unsafe.Pointer(name))
+	if budget > 0 {
+		C.lua_pushnumber(e.state, C.lua_Number((budget+1023)/1024))
+	} else {
+		C.lua_pushnil(e.state)
+	}
+	C.lua_setfield(e.state, -10002, name)
+}
+
+// Checks whether the last aggregation stopped at the spill budget instead
+// of at the end of the cursor.
+func (e *ExecutionEngine) Spilled() bool {
+	if e.state == nil || e.kernel != nil {
+		return false
+	}
+	name := C.CString("sky_spilled")
+	defer C.free(unsafe.Pointer(name))
+	C.lua_getfield(e.state, -10002, name)
+	spilled := C.lua_toboolean(e.state, -1) != 0
+	C.lua_settop(e.state, -(1)-1) // lua_pop()
+	return spilled
+}
+
+// Restricts the engine to events with timestamps in [start, end). A zero
+// time leaves that side of the range unbounded. Parts of objects outside the
+// range are skipped using their event indices.
+func (e *ExecutionEngine) SetTimeRange(start time.Time, end time.Time) {
+	e.hasTimeRange = !start.IsZero() || !end.IsZero()
+	e.minTimestamp, e.maxTimestamp = shiftTimeRange(start, end)
+	if e.cursor == nil {
+		return
+	}
+	if e.hasTimeRange {
+		C.sky_cursor_set_time_range(e.cursor, C.int64_t(e.minTimestamp), C.int64_t(e.maxTimestamp))
+	} else {
+		C.sky_cursor_clear_time_range(e.cursor)
+	}
+}
+
+// Restricts the engine to a deterministic sample of the objects picked by a
+// hash of their keys. Zero or one reads every object.
+func (e *ExecutionEngine) SetSample(ratio float64) {
+	if e.cursor != nil {
+		C.sky_cursor_set_sample(e.cursor, C.double(ratio))
+	}
+}
+
+// Restricts the engine to the objects whose key hashes fall in a slice of
+// the hash space from start up to end, both fractions of it. Slices that
+// follow each other split the objects of a sample between them. An end of
+// zero runs the slice to the top of the space.
+func (e *ExecutionEngine) SetSampleRange(start float64, end float64) {
+	if end <= 0 {
+		end = 1
+	}
+	if e.cursor != nil {
+		C.sky_cursor_set_sample_range(e.cursor, C.double(start), C.double(end))
+	}
+}
+
+// Restricts the engine to objects with at least a number of events whose
+// first and last events are at least a duration apart. Objects are judged by
+// their event indexes before their events are read. Zero turns either off.
+func (e *ExecutionEngine) SetObjectBounds(minEvents int, minSpan time.Duration) {
+	if e.cursor != nil {
+		span := int64(minSpan/time.Second) << 20
+		C.sky_cursor_set_object_bounds(e.cursor, C.uint32_t(minEvents), C.int64_t(span))
 	}
+}
 
+// Sets the number of objects that the engine's scan reads ahead of the
+// aggregation on a thread of its own. Depths under two read objects on the
+// aggregation's thread. This must be set before the iterator.
+func (e *ExecutionEngine) SetPipelineDepth(depth int) error {
+	if depth < 2 {
+		depth = 0
+	}
+	if e.scan == nil || depth == e.pipelineDepth {
+		return nil
+	}
+	if C.sky_object_scan_set_pipeline_depth(e.scan, C.uint32_t(depth)) != 0 {
+		return errors.New("skyd.ExecutionEngine: Unable to allocate scan pipeline")
+	}
+	e.pipelineDepth = depth
+	return nil
+}
+
+// Makes the engine read only the current state of each object, as a single
+// event at the time of the object's last event, instead of its events.
+func (e *ExecutionEngine) SetStateOnly(stateOnly bool) {
+	if e.cursor != nil {
+		C.sky_cursor_set_state_only(e.cursor, C.bool(stateOnly))
+	}
+}
+
+// Sets the sorted key ranges that the engine seeks past because none of
+// their objects can match the query. This must be set before the iterator.
+func (e *ExecutionEngine) SetSkipRanges(ranges []keyRange) {
+	e.skipRanges = ranges
+}
+
+// Restricts the engine to the members of a cohort. Objects are checked
+// against the members by their key before they're read. Nil reads every
+// object.
+func (e *ExecutionEngine) SetMembers(members *queryCohortMembers) error {
+	if e.cursor == nil {
+		return nil
+	}
+	if members == nil {
+		C.sky_cursor_clear_members(e.cursor)
+		return nil
+	}
+	var keys unsafe.Pointer
+	var offsets *C.uint32_t
+	if len(members.keys) > 0 {
+		keys = unsafe.Pointer(&members.keys[0])
+	}
+	if len(members.offsets) > 0 {
+		offsets = (*C.uint32_t)(unsafe.Pointer(&members.offsets[0]))
+	}
+	if C.sky_cursor_set_members(e.cursor, keys, C.size_t(len(members.keys)), offsets, C.uint32_t(len(members.offsets))) != 0 {
+		return errors.New("skyd.ExecutionEngine: Unable to set cohort members")
+	}
 	return nil
 }
 
@@ -169,13 +750,28 @@ func (e *ExecutionEngine) init() error {
 		return nil
 	}
 
-	// Initialize the state and open the libraries.
-	e.state = C.luaL_newstate()
+	// Initialize the state and open the libraries. The memory limit only
+	// applies once the libraries and script are loaded.
+	e.allocator = (*C.executionEngine_allocator)(C.calloc(1, C.size_t(unsafe.Sizeof(C.executionEngine_allocator{}))))
+	e.allocator.huge_pages = C.int(e.options.HugePages)
+	e.state = C.executionEngine_newstate(e.allocator)
 	if e.state == nil {
+		e.Destroy()
 		return errors.New("Unable to initialize Lua context.")
 	}
 	C.luaL_openlibs(e.state)
 
+	// Tune the compiler and collector before anything is compiled.
+	if options := e.options.luaSource(); options != "" {
+		coptions := C.CString(options)
+		defer C.free(unsafe.Pointer(coptions))
+		if C.luaL_loadstring(e.state, coptions) != 0 || C.lua_pcall(e.state, 0, 0, 0) != 0 {
+			defer e.Destroy()
+			errstring := C.GoString(C.lua_tolstring(e.state, -1, nil))
+			return fmt.Errorf("skyd.ExecutionEngine: Invalid options: %v", errstring)
+		}
+	}
+
 	// Generate the header file.
 	err := e.generateHeader()
 	if err != nil {
@@ -185,17 +781,13 @@ func (e *ExecutionEngine) init() error {
 
 	// Compile the script.
 	e.fullSource = fmt.Sprintf("%v\n%v", e.header, e.source)
-	source := C.CString(e.fullSource)
-	defer C.free(unsafe.Pointer(source))
-	ret := C.luaL_loadstring(e.state, source)
-	if ret != 0 {
-		defer e.Destroy()
-		errstring := C.GoString(C.lua_tolstring(e.state, -1, nil))
-		return fmt.Errorf("skyd.ExecutionEngine: Syntax Error: %v", errstring)
+	if err := e.load(); err != nil {
+		e.Destroy()
+		return err
 	}
 
 	// Run script once to initialize.
-	ret = C.lua_pcall(e.state, 0, 0, 0)
+	ret := C.lua_pcall(e.state, 0, 0, 0)
 	if ret != 0 {
 		defer e.Destroy()
 		errstring := C.GoString(C.lua_tolstring(e.state, -1, nil))
@@ -209,16 +801,107 @@ func (e *ExecutionEngine) init() error {
 		return err
 	}
 
+	// Setup the native kernel, if the query has one.
+	err = e.initKernel()
+	if err != nil {
+		e.Destroy()
+		return err
+	}
+	e.SetMemoryLimit(0)
+
+	return nil
+}
+
+// Pushes the compiled script onto the stack. The bytecode of the script is
+// loaded from the cache if it was compiled before. Otherwise the source is
+// parsed and its bytecode is added to the cache. Bytecode that fails to
+// load is replaced by compiling the source again.
+func (e *ExecutionEngine) load() error {
+	var key string
+	if e.bytecode != nil {
+		key = e.bytecode.key(C.GoString(C.executionEngine_luajit_version()), e.fullSource)
+		if bytecode := e.bytecode.Get(key); len(bytecode) > 0 {
+			name := C.CString("=query")
+			defer C.free(unsafe.Pointer(name))
+			if C.luaL_loadbuffer(e.state, (*C.char)(unsafe.Pointer(&bytecode[0])), C.size_t(len(bytecode)), name) == 0 {
+				return nil
+			}
+			C.lua_settop(e.state, -2)
+		}
+	}
+
+	source := C.CString(e.fullSource)
+	defer C.free(unsafe.Pointer(source))
+	if C.luaL_loadstring(e.state, source) != 0 {
+		errstring := C.GoString(C.lua_tolstring(e.state, -1, nil))
+		return fmt.Errorf("skyd.ExecutionEngine: Syntax Error: %v", errstring)
+	}
+	if e.bytecode != nil {
+		var b C.executionEngine_dump_buffer
+		if C.executionEngine_dump(e.state, &b) == 0 && b.sz > 0 {
+			if err := e.bytecode.Put(key, C.GoBytes(unsafe.Pointer(b.data), C.int(b.sz))); err != nil {
+				fmt.Printf("skyd.ExecutionEngine: Unable to cache bytecode: %v\n", err)
+			}
+		}
+		C.free(unsafe.Pointer(b.data))
+	}
 	return nil
 }
 
 // Initializes the cursor used by the script.
 func (e *ExecutionEngine) initCursor() error {
-	// Create the cursor.
-	minPropertyId, maxPropertyId := e.propertyFile.NextIdentifiers()
+	// Create the cursor with descriptors for only the referenced properties.
+	// Everything else is skipped by the decoder without a lookup.
+	var minPropertyId, maxPropertyId int64
+	for _, property := range e.propertyRefs {
+		if property.Id < minPropertyId {
+			minPropertyId = property.Id
+		}
+		if property.Id > maxPropertyId {
+			maxPropertyId = property.Id
+		}
+	}
 	e.cursor = C.sky_cursor_new((C.int32_t)(minPropertyId), (C.int32_t)(maxPropertyId))
-	e.cursor.context = unsafe.Pointer(e)
-	C.executionEngine_setNextObjectFunc(unsafe.Pointer(e.cursor))
+	if C.sky_cursor_set_heavy_capacity(e.cursor, hotObjectScanSlots) != 0 {
+		return errors.New("skyd.ExecutionEngine: Unable to allocate heavy objects")
+	}
+
+	// Objects are fed to the cursor by a scan that runs in C.
+	e.scan = C.sky_object_scan_new()
+	if e.scan == nil {
+		return errors.New("skyd.ExecutionEngine: Unable to allocate object scan")
+	}
+	C.sky_cursor_set_object_scan(e.cursor, e.scan)
+	if C.sky_object_scan_set_prefix(e.scan, unsafe.Pointer(&e.prefix[0]), C.size_t(len(e.prefix))) != 0 {
+		return errors.New("skyd.ExecutionEngine: Unable to set scan prefix")
+	}
+
+	// Objects of tables with property families have extra keys to skip and
+	// only the families of referenced properties are read.
+	if families := e.schema.Families(); len(families) > 0 {
+		C.sky_object_scan_set_has_families(e.scan, true)
+		referenced := make(map[string]bool)
+		for _, property := range e.propertyRefs {
+			if property.Family != "" {
+				referenced[property.Family] = true
+			}
+		}
+		for _, family := range families {
+			if !referenced[family] {
+				continue
+			}
+			name := C.CString(family)
+			rc := C.sky_object_scan_add_family(e.scan, unsafe.Pointer(name), C.size_t(len(family)))
+			C.free(unsafe.Pointer(name))
+			if rc != 0 {
+				return errors.New("skyd.ExecutionEngine: Unable to add scan family")
+			}
+		}
+	}
+	e.frozenScan = C.sky_frozen_scan_new()
+	if e.frozenScan == nil {
+		return errors.New("skyd.ExecutionEngine: Unable to allocate frozen scan")
+	}
 
 	// Initialize the cursor from within Lua.
 	functionName := C.CString("sky_init_cursor")
@@ -236,38 +919,427 @@ func (e *ExecutionEngine) initCursor() error {
 	return nil
 }
 
+// Creates the native kernel planned by the query and binds it to the batch
+// columns that the Lua header set up on the cursor. Engines whose kernel
+// can't be bound keep aggregating in Lua.
+func (e *ExecutionEngine) initKernel() error {
+	name := C.CString("sky_kernel")
+	defer C.free(unsafe.Pointer(name))
+	C.lua_getfield(e.state, -10002, name)
+	var plan *queryKernel
+	if C.lua_type(e.state, -1) == C.LUA_TSTRING {
+		var sz C.size_t
+		str := C.lua_tolstring(e.state, -1, &sz)
+		plan = &queryKernel{}
+		if err := json.Unmarshal([]byte(C.GoStringN(str, C.int(sz))), plan); err != nil {
+			C.lua_settop(e.state, -(1)-1) // lua_pop()
+			return fmt.Errorf("skyd.ExecutionEngine: Invalid kernel: %v", err)
+		}
+	}
+	C.lua_settop(e.state, -(1)-1) // lua_pop()
+	if plan == nil {
+		return nil
+	}
+
+	e.kernel = C.sky_kernel_new()
+	if e.kernel == nil {
+		return errors.New("skyd.ExecutionEngine: Unable to allocate kernel")
+	}
+	for _, group := range plan.Groups {
+		var dimensionIds, fieldIds []C.int64_t
+		for _, dimension := range group.Dimensions {
+			property := e.schema.GetPropertyByName(dimension)
+			if property == nil {
+				return fmt.Errorf("skyd.ExecutionEngine: Property not found: %s", dimension)
+			}
+			dimensionIds = append(dimensionIds, C.int64_t(property.Id))
+		}
+		for _, field := range group.Fields {
+			if field.Property == "" {
+				continue
+			}
+			property := e.schema.GetPropertyByName(field.Property)
+			if property == nil {
+				return fmt.Errorf("skyd.ExecutionEngine: Property not found: %s", field.Property)
+			}
+			fieldIds = append(fieldIds, C.int64_t(property.Id))
+		}
+		if C.sky_kernel_add_group(e.kernel, C.uint32_t(len(dimensionIds)), int64Ptr(dimensionIds), C.uint32_t(len(fieldIds)), int64Ptr(fieldIds)) < 0 {
+			return errors.New("skyd.ExecutionEngine: Unable to add kernel group")
+		}
+	}
+	if C.sky_kernel_bind(e.kernel, e.cursor) != 0 {
+		C.sky_kernel_free(e.kernel)
+		e.kernel = nil
+		return nil
+	}
+	e.kernelPlan = plan
+	return nil
+}
+
+// Copies the end key and skip ranges to the object scan.
+func (e *ExecutionEngine) initScan() error {
+	var rc C.int
+	if e.endKey != nil {
+		rc = C.sky_object_scan_set_end_key(e.scan, unsafe.Pointer(&e.endKey[0]), C.size_t(len(e.endKey)))
+	} else {
+		rc = C.sky_object_scan_set_end_key(e.scan, nil, 0)
+	}
+	if rc != 0 {
+		return errors.New("skyd.ExecutionEngine: Unable to set scan end key")
+	}
+
+	C.sky_object_scan_clear_skip_ranges(e.scan)
+	for _, r := range e.skipRanges {
+		var end unsafe.Pointer
+		if r.end != nil {
+			end = unsafe.Pointer(&r.end[0])
+		}
+		if C.sky_object_scan_add_skip_range(e.scan, unsafe.Pointer(&r.start[0]), C.size_t(len(r.start)), end, C.size_t(len(r.end))) != 0 {
+			return errors.New("skyd.ExecutionEngine: Unable to add scan skip range")
+		}
+	}
+	return nil
+}
+
+// Releases the iterator and key range so that the compiled engine can be
+// reused for another scan.
+func (e *ExecutionEngine) Reset() {
+	if e.state != nil {
+		C.lua_settop(e.state, 0)
+	}
+	e.SetIterator(nil)
+	e.SetFrozenRange(nil, 0, 0)
+	e.SetKeyRange(nil, nil)
+	e.SetTimeRange(time.Time{}, time.Time{})
+	e.SetSkipRanges(nil)
+	e.SetMembers(nil)
+	e.SetSample(0)
+	e.SetObjectBounds(0, 0)
+	e.SetStateOnly(false)
+	e.SetMemoryLimit(0)
+	e.SetSpill(false)
+	if e.cursor != nil {
+		C.sky_cursor_clear_cancel(e.cursor)
+		C.sky_cursor_clear_marks(e.cursor)
+	}
+}
+
 // Closes the lua context.
 func (e *ExecutionEngine) Destroy() {
 	if e.state != nil {
 		C.lua_close(e.state)
 		e.state = nil
 	}
+	if e.allocator != nil {
+		C.free(unsafe.Pointer(e.allocator))
+		e.allocator = nil
+	}
 	if e.iterator != nil {
 		e.SetIterator(nil)
 	}
+	if e.frozen != nil {
+		e.SetFrozenRange(nil, 0, 0)
+	}
+	if e.scan != nil {
+		C.sky_object_scan_free(e.scan)
+		e.scan = nil
+	}
+	if e.frozenScan != nil {
+		C.sky_frozen_scan_free(e.frozenScan)
+		e.frozenScan = nil
+	}
+	if e.readStats != nil {
+		C.leveldb_readstats_destroy(e.readStats)
+		e.readStats = nil
+	}
+	if e.kernel != nil {
+		C.sky_kernel_free(e.kernel)
+		e.kernel = nil
+	}
 }
 
 //--------------------------------------
 // Execution
 //--------------------------------------
 
-// Executes an aggregation over the iterator.
+// Executes an aggregation over the iterator. An engine set to spill may
+// return after only part of the iterator; see SetSpill.
 func (e *ExecutionEngine) Aggregate() (interface{}, error) {
-	functionName := C.CString("sky_aggregate")
-	defer C.free(unsafe.Pointer(functionName))
+	if e.kernel != nil {
+		return e.aggregateKernel()
+	}
 
-	C.lua_getfield(e.state, -10002, functionName)
-	C.lua_pushlightuserdata(e.state, unsafe.Pointer(e.cursor))
-	rc := C.lua_pcall(e.state, 1, 1, 0)
+	rc := e.runTask()
 	if rc != 0 {
+		// The collector may have been stopped by the aggregation.
+		C.lua_gc(e.state, C.LUA_GCRESTART, 0)
 		luaErrString := C.GoString(C.lua_tolstring(e.state, -1, nil))
+		if rc == C.LUA_ERRMEM || strings.Contains(luaErrString, "query memory limit exceeded") {
+			e.exhausted = true
+			return nil, fmt.Errorf("skyd.ExecutionEngine: Query memory limit of %d bytes exceeded", e.memoryLimit)
+		}
 		fmt.Println(e.FullAnnotatedSource())
 		return nil, fmt.Errorf("skyd.ExecutionEngine: Unable to aggregate: %s", luaErrString)
 	}
+	if C.sky_cursor_is_cancelled(e.cursor) {
+		C.lua_settop(e.state, -(1)-1) // lua_pop()
+		return nil, errors.New("skyd.ExecutionEngine: Query cancelled")
+	}
 
 	return e.decodeResult()
 }
 
+// Stops the engine's aggregation at the next object. The aggregation
+// returns an error instead of its partial result. This can be called while
+// the aggregation runs on another goroutine and lasts until the engine is
+// reset.
+func (e *ExecutionEngine) Cancel() {
+	C.sky_cursor_cancel(e.cursor)
+}
+
+// Returns the keys of the objects that the aggregation marked since the
+// marks were last read and forgets them.
+func (e *ExecutionEngine) Marks() [][]byte {
+	var sz C.size_t
+	ptr := C.sky_cursor_marks(e.cursor, &sz)
+	b := C.GoBytes(ptr, C.int(sz))
+	C.sky_cursor_clear_marks(e.cursor)
+
+	keys := make([][]byte, 0)
+	for len(b) >= 4 {
+		n := int(b[0]) | int(b[1])<<8 | int(b[2])<<16 | int(b[3])<<24
+		if n > len(b)-4 {
+			break
+		}
+		keys = append(keys, b[4:4+n])
+		b = b[4+n:]
+	}
+	return keys
+}
+
+// Returns the encoded keys of the objects that the aggregation decoded the
+// most events from since they were last read, with their event counts, and
+// forgets them.
+func (e *ExecutionEngine) HeavyObjects() map[string]int64 {
+	n := int(C.sky_cursor_heavy_count(e.cursor))
+	objects := make(map[string]int64, n)
+	for i := 0; i < n; i++ {
+		var sz C.size_t
+		var events C.uint64_t
+		ptr := C.sky_cursor_heavy_object_key(e.cursor, C.uint32_t(i), &sz, &events)
+		objects[string(C.GoBytes(ptr, C.int(sz)))] = int64(events)
+	}
+	C.sky_cursor_clear_heavy(e.cursor)
+	return objects
+}
+
+// Runs the engine's kernel or script over its cursor on the engine's
+// thread pool, if it has one and it's open, or on the calling goroutine
+// otherwise. Returns the kernel's or Lua's return code.
+func (e *ExecutionEngine) runTask() C.int {
+	task := (*C.executionEngine_task)(C.calloc(1, C.size_t(unsafe.Sizeof(C.executionEngine_task{}))))
+	defer C.free(unsafe.Pointer(task))
+	task.L, task.cursor, task.kernel = e.state, e.cursor, e.kernel
+
+	if e.threads == nil || !e.threads.run(C.sky_worker_task_func(C.executionEngine_run_task), unsafe.Pointer(task)) {
+		C.executionEngine_run_task(unsafe.Pointer(task))
+	}
+	return task.rc
+}
+
+// Executes the aggregation with the engine's native kernel and converts its
+// groups into the same results that the Lua aggregation returns.
+func (e *ExecutionEngine) aggregateKernel() (interface{}, error) {
+	C.sky_kernel_reset(e.kernel)
+	rc := e.runTask()
+	if rc != 0 {
+		if e.memoryLimit > 0 {
+			e.exhausted = true
+			return nil, fmt.Errorf("skyd.ExecutionEngine: Query memory limit of %d bytes exceeded", e.memoryLimit)
+		}
+		return nil, errors.New("skyd.ExecutionEngine: Unable to allocate kernel groups")
+	}
+	if C.sky_cursor_is_cancelled(e.cursor) {
+		return nil, errors.New("skyd.ExecutionEngine: Query cancelled")
+	}
+
+	data := make(map[interface{}]interface{})
+	count := int(e.kernel.group_count)
+	groups := (*[1 << 20]C.sky_kernel_group)(unsafe.Pointer(e.kernel.groups))[:count:count]
+	for i, plan := range e.kernelPlan.Groups {
+		group := &groups[i]
+		if group.count == 0 {
+			continue
+		}
+		root := data
+		if plan.Name != "" {
+			root = childMap(root, plan.Name)
+		}
+
+		capacity, stride := int(group.capacity), int(group.field_count)+1
+		used := (*[1 << 30]C.bool)(unsafe.Pointer(group.used))[:capacity:capacity]
+		keys := (*[1 << 30]C.uint64_t)(unsafe.Pointer(group.keys))[:capacity:capacity]
+		values := (*[1 << 30]C.double)(unsafe.Pointer(group.values))[: capacity*stride : capacity*stride]
+		for slot := 0; slot < capacity; slot++ {
+			if !used[slot] {
+				continue
+			}
+
+			// Factor sequences are packed into the key with the first
+			// factor in the high bits.
+			m := root
+			for j, dimension := range plan.Dimensions {
+				shift := uint(32 * (len(plan.Dimensions) - j - 1))
+				sequence := int64(int32(uint32(uint64(keys[slot]) >> shift)))
+				m = childMap(childMap(m, dimension), sequence)
+			}
+
+			// Counts are kept first and sums follow in field order.
+			sum := 0
+			for _, field := range plan.Fields {
+				index := 0
+				if field.Property != "" {
+					sum++
+					index = sum
+				}
+				value := luaNumber(float64(values[slot*stride+index]))
+				if existing, ok := m[field.Name]; ok {
+					var err error
+					if value, err = addNumbers(existing, value); err != nil {
+						return nil, err
+					}
+				}
+				m[field.Name] = value
+			}
+		}
+	}
+	return data, nil
+}
+
+// Retrieves the map stored under a key, creating it if it doesn't exist.
+func childMap(m map[interface{}]interface{}, key interface{}) map[interface{}]interface{} {
+	if child, ok := m[key].(map[interface{}]interface{}); ok {
+		return child
+	}
+	child := make(map[interface{}]interface{})
+	m[key] = child
+	return child
+}
+
+// Executes an aggregation and adds the work it did to a servlet profile.
+// The engine's compile time is only added for its first aggregation so
+// that reused engines don't report it again.
+func (e *ExecutionEngine) ProfileAggregate(p *ServletProfile) (interface{}, error) {
+	C.sky_cursor_clear_stats(e.cursor)
+	if e.readStats != nil {
+		C.leveldb_readstats_reset(e.readStats)
+	}
+	e.setTraceAborts(0)
+
+	t := time.Now()
+	result, err := e.Aggregate()
+	p.ScanTime += time.Since(t)
+
+	p.CompileTime += e.compileTime
+	e.compileTime = 0
+	p.Objects += uint64(e.cursor.object_count)
+	p.Events += uint64(e.cursor.event_count)
+	p.Bytes += uint64(e.cursor.byte_count)
+	if e.readStats != nil {
+		p.BlockCacheHits += uint64(C.leveldb_readstats_block_cache_hits(e.readStats))
+		p.BlockCacheMisses += uint64(C.leveldb_readstats_block_cache_misses(e.readStats))
+		p.BlockReadBytes += uint64(C.leveldb_readstats_block_read_bytes(e.readStats))
+		p.BlockUncompressedBytes += uint64(C.leveldb_readstats_block_uncompressed_bytes(e.readStats))
+		p.BlockReadTime += time.Duration(C.leveldb_readstats_block_read_micros(e.readStats)) * time.Microsecond
+		p.KeysSkipped += uint64(C.leveldb_readstats_internal_keys_skipped(e.readStats))
+	}
+	p.TraceAborts += e.traceAborts()
+	if e.kernel != nil {
+		p.KernelScans++
+	}
+	p.LuaHeapBytes += uint64(e.HeapBytes())
+	p.addSteps(e.stepTimes())
+
+	return result, err
+}
+
+// Returns the time spent in each step function of a profiled query since
+// the last call, along with the line of the full annotated source that
+// defines the function. Returns nil for queries that aren't profiled.
+func (e *ExecutionEngine) stepTimes() []QueryStepProfile {
+	name := C.CString("sky_step_times")
+	defer C.free(unsafe.Pointer(name))
+	C.lua_getfield(e.state, -10002, name)
+	if C.lua_type(e.state, -1) != C.LUA_TFUNCTION {
+		C.lua_settop(e.state, -(1)-1) // lua_pop()
+		return nil
+	}
+	if C.lua_pcall(e.state, 0, 1, 0) != 0 {
+		C.lua_settop(e.state, -(1)-1) // lua_pop()
+		return nil
+	}
+	result, _ := e.decodeResult()
+	times, _ := result.(map[interface{}]interface{})
+	steps := make([]QueryStepProfile, 0, len(times))
+	for k, v := range times {
+		function, _ := k.(string)
+		ns, _ := toFloat(v)
+		steps = append(steps, QueryStepProfile{Function: function, Line: e.sourceLine("function " + function + "("), Time: time.Duration(ns)})
+	}
+	return steps
+}
+
+// Returns the line number in the full annotated source of the first line
+// that starts with the given prefix or zero if there isn't one.
+func (e *ExecutionEngine) sourceLine(prefix string) int {
+	if strings.HasPrefix(e.fullSource, prefix) {
+		return 1
+	}
+	index := strings.Index(e.fullSource, "\n"+prefix)
+	if index == -1 {
+		return 0
+	}
+	return strings.Count(e.fullSource[:index], "\n") + 2
+}
+
+// Returns the size of the engine's Lua heap in bytes.
+func (e *ExecutionEngine) HeapBytes() int {
+	if e.state == nil {
+		return 0
+	}
+	return int(C.lua_gc(e.state, C.LUA_GCCOUNT, 0))*1024 + int(C.lua_gc(e.state, C.LUA_GCCOUNTB, 0))
+}
+
+// Returns the counters of the table blocks read by the engine's iterators,
+// creating them the first time. They have to be set on the read options of
+// an iterator with setReadStats before it's created.
+func (e *ExecutionEngine) ReadStats() *C.leveldb_readstats_t {
+	if e.readStats == nil {
+		e.readStats = C.leveldb_readstats_create()
+	}
+	return e.readStats
+}
+
+// Returns the number of traces that LuaJIT has aborted since the counter
+// was last set.
+func (e *ExecutionEngine) traceAborts() int {
+	name := C.CString("sky_trace_aborts")
+	defer C.free(unsafe.Pointer(name))
+	C.lua_getfield(e.state, -10002, name)
+	n := int(C.lua_tonumber(e.state, -1))
+	C.lua_settop(e.state, -(1)-1) // lua_pop()
+	return n
+}
+
+// Sets the number of aborted LuaJIT traces.
+func (e *ExecutionEngine) setTraceAborts(n int) {
+	name := C.CString("sky_trace_aborts")
+	defer C.free(unsafe.Pointer(name))
+	C.lua_pushnumber(e.state, C.lua_Number(n))
+	C.lua_setfield(e.state, -10002, name)
+}
+
 // Executes an merge over the iterator.
 func (e *ExecutionEngine) Merge(results interface{}, data interface{}) (interface{}, error) {
 	functionName := C.CString("sky_merge")
@@ -293,52 +1365,77 @@ func (e *ExecutionEngine) Merge(results interface{}, data interface{}) (interfac
 }
 
 // Encodes a Go object into Msgpack and adds it to the function arguments.
+// The msgpack is encoded into a buffer that the engine keeps for its next
+// argument, so it's only grown until it fits the largest result merged, and
+// it's decoded into Lua straight from the buffer.
 func (e *ExecutionEngine) encodeArgument(value interface{}) error {
-	// Encode Go object into msgpack.
-	buffer := new(bytes.Buffer)
-	encoder := msgpack.NewEncoder(buffer)
-	err := encoder.Encode(value)
-	if err != nil {
+	e.argumentBuffer.Reset()
+	if err := msgpack.NewEncoder(&e.argumentBuffer).Encode(value); err != nil {
 		return err
 	}
-
-	// Push the msgpack data onto the Lua stack.
-	data := buffer.String()
-	cdata := C.CString(data)
-	defer C.free(unsafe.Pointer(cdata))
-	C.lua_pushlstring(e.state, cdata, (C.size_t)(len(data)))
-
-	// Convert the argument from msgpack into Lua.
-	rc := C.mp_unpack(e.state)
-	if rc != 1 {
+	data := e.argumentBuffer.Bytes()
+	if len(data) == 0 || C.mp_unpack_buffer(e.state, (*C.uchar)(unsafe.Pointer(&data[0])), C.size_t(len(data))) != 1 {
 		return errors.New("skyd.ExecutionEngine: Unable to msgpack encode Lua argument")
 	}
-	C.lua_remove(e.state, -2)
-
 	return nil
 }
 
-// Decodes the result from a function into a Go object.
+// Decodes the result on top of the Lua stack into a Go object by walking
+// the Lua table directly and then pops it off the stack.
 func (e *ExecutionEngine) decodeResult() (interface{}, error) {
-	// Encode Lua object into msgpack.
-	rc := C.mp_pack(e.state)
-	if rc != 1 {
-		return nil, errors.New("skyd.ExecutionEngine: Unable to msgpack decode Lua result")
-	}
-	sz := C.size_t(0)
-	ptr := C.lua_tolstring(e.state, -1, (*C.size_t)(&sz))
-	str := C.GoStringN(ptr, (C.int)(sz))
+	ret := e.decodeLuaValue(C.lua_gettop(e.state), 0)
 	C.lua_settop(e.state, -(1)-1) // lua_pop()
+	return ret, nil
+}
 
-	// Decode msgpack into a Go object.
-	var ret interface{}
-	decoder := msgpack.NewDecoder(bytes.NewBufferString(str), nil)
-	err := decoder.Decode(&ret)
-	if err != nil {
-		return nil, err
+// Converts the Lua value at the given stack index into a Go object. Tables
+// are always converted to maps and numbers with no fractional part are
+// converted to integers.
+func (e *ExecutionEngine) decodeLuaValue(index C.int, level int) interface{} {
+	var value C.executionEngine_lua_value
+	C.executionEngine_read_value(e.state, index, &value)
+	if value._type != C.LUA_TTABLE {
+		return convertLuaValue(&value)
+	}
+	if level == maxLuaResultDepth {
+		return nil
 	}
 
-	return ret, nil
+	m := make(map[interface{}]interface{})
+	var k C.executionEngine_lua_value
+	C.lua_pushnil(e.state)
+	for C.executionEngine_next_pair(e.state, index, &k, &value) != 0 {
+		key := convertLuaValue(&k)
+		if value._type == C.LUA_TTABLE {
+			m[key] = e.decodeLuaValue(C.lua_gettop(e.state), level+1)
+		} else {
+			m[key] = convertLuaValue(&value)
+		}
+		C.lua_settop(e.state, -(1)-1) // lua_pop()
+	}
+	return m
+}
+
+// Converts a non-table Lua value into a Go object.
+func convertLuaValue(value *C.executionEngine_lua_value) interface{} {
+	switch value._type {
+	case C.LUA_TNUMBER:
+		return luaNumber(float64(value.number))
+	case C.LUA_TBOOLEAN:
+		return value.number != 0
+	case C.LUA_TSTRING:
+		return C.GoStringN(value.str, (C.int)(value.sz))
+	}
+	return nil
+}
+
+// Converts a Lua number into a Go object. Numbers with no fractional part
+// are converted to integers.
+func luaNumber(n float64) interface{} {
+	if math.Floor(n) != n {
+		return n
+	}
+	return int64(n)
 }
 
 //--------------------------------------
@@ -349,7 +1446,14 @@ func (e *ExecutionEngine) decodeResult() (interface{}, error) {
 func (e *ExecutionEngine) generateHeader() error {
 	// Parse the header template.
 	t := template.New("header.lua")
-	t.Funcs(template.FuncMap{"structdef": propertyStructDef, "metatypedef": metatypeFunctionDef, "initdescriptor": initDescriptorDef})
+	t.Funcs(template.FuncMap{
+		"structdef":        propertyStructDef,
+		"metatypedef":      metatypeFunctionDef,
+		"initdescriptor":   initDescriptorDef,
+		"batchstructdef":   batchStructDef,
+		"batchmetatypedef": batchMetatypeFunctionDef,
+		"initbatchcolumn":  initBatchColumnDef,
+	})
 	_, err := t.Parse(LuaHeader)
 	if err != nil {
 		return err
@@ -369,19 +1473,20 @@ func (e *ExecutionEngine) generateHeader() error {
 }
 
 // Extracts the property references from the source string.
-func extractPropertyReferences(propertyFile *PropertyFile, source string) ([]*Property, error) {
+func extractPropertyReferences(schema *propertySchema, source string) ([]*Property, error) {
 	// Create a list of properties.
 	properties := make([]*Property, 0)
 	lookup := make(map[int64]*Property)
 
-	// Find all the event property references in the script.
-	r, err := regexp.Compile(`\bevent(?:\.|:)(\w+)`)
+	// Find all the event and batch property references in the script,
+	// including the struct fields that optimized code reads directly.
+	r, err := regexp.Compile(`\b(?:event\._|event(?:\.|:)|batch:)(\w+)`)
 	if err != nil {
 		return nil, err
 	}
 	for _, match := range r.FindAllStringSubmatch(source, -1) {
 		name := match[1]
-		property := propertyFile.GetPropertyByName(name)
+		property := schema.GetPropertyByName(name)
 		if property == nil {
 			return nil, fmt.Errorf("Property not found: '%v'", name)
 		}
@@ -403,32 +1508,78 @@ func propertyStructDef(args ...interface{}) string {
 }
 
 func metatypeFunctionDef(args ...interface{}) string {
+	if property, ok := args[0].(*Property); ok {
+		return fmt.Sprintf("%v = function(event) return %s end,", property.Name, codegenPropertyRead(property, "event"))
+	}
+	return ""
+}
+
+// Generates the Lua code that reads a property straight from the struct of
+// an event as a Lua value, without going through the event's metatable.
+func codegenPropertyRead(property *Property, event string) string {
+	switch property.DataType {
+	case StringDataType:
+		return fmt.Sprintf("sky_string(%s._%s)", event, property.Name)
+	case Int64DataType:
+		return fmt.Sprintf("tonumber(%s._%s)", event, property.Name)
+	default:
+		return fmt.Sprintf("%s._%s", event, property.Name)
+	}
+}
+
+func initDescriptorDef(args ...interface{}) string {
+	if property, ok := args[0].(*Property); ok {
+		return fmt.Sprintf("cursor:set_property(%d, ffi.offsetof('sky_lua_event_t', '_%s'), ffi.sizeof('%s'), '%s')", property.Id, property.Name, getPropertyCType(property), property.DataType)
+	}
+	return ""
+}
+
+func batchStructDef(args ...interface{}) string {
+	if property, ok := args[0].(*Property); ok {
+		return fmt.Sprintf("%v *_%v;", getPropertyCType(property), property.Name)
+	}
+	return ""
+}
+
+func batchMetatypeFunctionDef(args ...interface{}) string {
 	if property, ok := args[0].(*Property); ok {
 		switch property.DataType {
 		case StringDataType:
-			return fmt.Sprintf("%v = function(event) return ffi.string(event._%v.data, event._%v.length) end,", property.Name, property.Name, property.Name)
+			return fmt.Sprintf("%v = function(batch, i) return sky_string(batch._%v[i]) end,", property.Name, property.Name)
+		case Int64DataType:
+			return fmt.Sprintf("%v = function(batch, i) return tonumber(batch._%v[i]) end,", property.Name, property.Name)
 		default:
-			return fmt.Sprintf("%v = function(event) return event._%v end,", property.Name, property.Name)
+			return fmt.Sprintf("%v = function(batch, i) return batch._%v[i] end,", property.Name, property.Name)
 		}
 	}
 	return ""
 }
 
-func initDescriptorDef(args ...interface{}) string {
+func initBatchColumnDef(args ...interface{}) string {
 	if property, ok := args[0].(*Property); ok {
-		return fmt.Sprintf("cursor:set_property(%d, ffi.offsetof('sky_lua_event_t', '_%s'), ffi.sizeof('%s'), '%s')", property.Id, property.Name, getPropertyCType(property), property.DataType)
+		return fmt.Sprintf("cursor:set_batch_column(%d, ffi.offsetof('sky_lua_batch_t', '_%s'))", property.Id, property.Name)
 	}
 	return ""
 }
 
+// Returns the C type that a property is decoded into. Int64 values are
+// boxed by LuaJIT so their accessors convert them to Lua numbers.
 func getPropertyCType(property *Property) string {
 	switch property.DataType {
 	case StringDataType:
 		return "sky_string_t"
-	case FactorDataType, IntegerDataType:
+	case FactorDataType, IntegerDataType, Int32DataType:
 		return "int32_t"
+	case Int8DataType:
+		return "int8_t"
+	case Int16DataType:
+		return "int16_t"
+	case Int64DataType:
+		return "int64_t"
 	case FloatDataType:
 		return "double"
+	case Float32DataType:
+		return "float"
 	case BooleanDataType:
 		return "bool"
 	default:
@@ -0,0 +1,238 @@
+package skyd
+
+import (
+	"container/list"
+	"sync"
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// An ExecutionEnginePool holds idle, compiled execution engines so that
+// repeated queries can skip creating the Lua state, generating the header
+// and compiling the source. Engines are keyed by their table, the version of
+// the table's property file and their source. The least recently used idle
+// engine is destroyed when the pool is full. New engines load their
+// scripts from the pool's bytecode cache, if it has one, so that only the
+// first engine of a script parses it. Engines handed out by the pool run
+// their aggregations on its thread pools, if it has any: the pool of the
+// NUMA node that an engine is for, or the first pool otherwise.
+type ExecutionEnginePool struct {
+	sync.Mutex
+	capacity int
+	options  EngineOptions
+	bytecode *LuaBytecodeCache
+	threads  []*QueryThreadPool
+	idle     map[executionEngineKey][]*list.Element
+	lru      *list.List
+}
+
+// The key that identifies interchangeable engines.
+type executionEngineKey struct {
+	propertyFile    *PropertyFile
+	propertyVersion uint64
+	source          string
+}
+
+// An idle engine in the pool.
+type executionEnginePoolEntry struct {
+	key    executionEngineKey
+	engine *ExecutionEngine
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructor
+//
+//------------------------------------------------------------------------------
+
+// Creates a new pool that holds up to a given number of idle engines.
+func NewExecutionEnginePool(capacity int) *ExecutionEnginePool {
+	return &ExecutionEnginePool{
+		capacity: capacity,
+		idle:     make(map[executionEngineKey][]*list.Element),
+		lru:      list.New(),
+	}
+}
+
+//------------------------------------------------------------------------------
+//
+// Properties
+//
+//------------------------------------------------------------------------------
+
+// The maximum number of idle engines held by the pool.
+func (p *ExecutionEnginePool) Capacity() int {
+	return p.capacity
+}
+
+// The options that new engines are created with.
+func (p *ExecutionEnginePool) Options() EngineOptions {
+	p.Lock()
+	defer p.Unlock()
+	return p.options
+}
+
+// Sets the options that new engines are created with. Idle engines created
+// with the old options are destroyed.
+func (p *ExecutionEnginePool) SetOptions(options EngineOptions) {
+	p.Lock()
+	p.options = options
+	p.Unlock()
+	p.Clear()
+}
+
+// The cache that new engines load their compiled scripts from.
+func (p *ExecutionEnginePool) BytecodeCache() *LuaBytecodeCache {
+	p.Lock()
+	defer p.Unlock()
+	return p.bytecode
+}
+
+// Sets the cache that new engines load their compiled scripts from. A nil
+// cache compiles every new engine's script.
+func (p *ExecutionEnginePool) SetBytecodeCache(c *LuaBytecodeCache) {
+	p.Lock()
+	defer p.Unlock()
+	p.bytecode = c
+}
+
+// The native threads that engines run their aggregations on, one pool per
+// NUMA node or a single pool for the machine.
+func (p *ExecutionEnginePool) ThreadPools() []*QueryThreadPool {
+	p.Lock()
+	defer p.Unlock()
+	return p.threads
+}
+
+// Sets the native threads that engines run their aggregations on. No
+// thread pools run aggregations on the goroutines that call them.
+func (p *ExecutionEnginePool) SetThreadPools(threads []*QueryThreadPool) {
+	p.Lock()
+	defer p.Unlock()
+	p.threads = threads
+}
+
+// The number of idle engines currently held by the pool.
+func (p *ExecutionEnginePool) Len() int {
+	p.Lock()
+	defer p.Unlock()
+	return p.lru.Len()
+}
+
+// The bytes held by the Lua heaps of the idle engines in the pool.
+func (p *ExecutionEnginePool) HeapBytes() int64 {
+	p.Lock()
+	defer p.Unlock()
+	var total int64
+	for elem := p.lru.Front(); elem != nil; elem = elem.Next() {
+		total += int64(elem.Value.(*executionEnginePoolEntry).engine.HeapBytes())
+	}
+	return total
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// Retrieves an idle engine for the table and source or creates a new one if
+// there are none available. The engine should be returned with Put() when
+// it is no longer in use.
+func (p *ExecutionEnginePool) Get(table *Table, source string) (*ExecutionEngine, error) {
+	return p.GetOnNode(table, source, -1)
+}
+
+// Retrieves an engine like Get() that runs its aggregations on the threads
+// of a NUMA node. A negative node uses the first thread pool.
+func (p *ExecutionEnginePool) GetOnNode(table *Table, source string, node int) (*ExecutionEngine, error) {
+	p.Lock()
+	options, bytecode := p.options, p.bytecode
+	var threads *QueryThreadPool
+	if node >= 0 && node < len(p.threads) {
+		threads = p.threads[node]
+	} else if len(p.threads) > 0 {
+		threads = p.threads[0]
+	}
+	if table != nil && table.propertyFile != nil {
+		key := executionEngineKey{table.propertyFile, table.propertyFile.Version(), source}
+		if elems := p.idle[key]; len(elems) > 0 {
+			elem := elems[len(elems)-1]
+			p.remove(elem)
+			p.Unlock()
+			e := elem.Value.(*executionEnginePoolEntry).engine
+			e.threads = threads
+			return e, nil
+		}
+	}
+	p.Unlock()
+
+	e, err := newExecutionEngine(table, source, options, bytecode)
+	if err != nil {
+		return nil, err
+	}
+	e.threads = threads
+	return e, nil
+}
+
+// Returns an engine to the pool. The engine's iterator and key range are
+// released and the engine is destroyed if it no longer matches its table's
+// property file, if it ran out of memory or if the pool has no capacity.
+func (p *ExecutionEnginePool) Put(e *ExecutionEngine) {
+	if e == nil {
+		return
+	}
+	e.Reset()
+	if p.capacity <= 0 || e.state == nil || e.exhausted || e.propertyVersion != e.propertyFile.Version() {
+		e.Destroy()
+		return
+	}
+	key := executionEngineKey{e.propertyFile, e.propertyVersion, e.source}
+
+	p.Lock()
+	defer p.Unlock()
+
+	// Evict the least recently used engines to make room.
+	for p.lru.Len() >= p.capacity {
+		elem := p.lru.Back()
+		p.remove(elem)
+		elem.Value.(*executionEnginePoolEntry).engine.Destroy()
+	}
+
+	elem := p.lru.PushFront(&executionEnginePoolEntry{key, e})
+	p.idle[key] = append(p.idle[key], elem)
+}
+
+// Destroys all idle engines in the pool.
+func (p *ExecutionEnginePool) Clear() {
+	p.Lock()
+	defer p.Unlock()
+	for elem := p.lru.Front(); elem != nil; elem = elem.Next() {
+		elem.Value.(*executionEnginePoolEntry).engine.Destroy()
+	}
+	p.idle = make(map[executionEngineKey][]*list.Element)
+	p.lru.Init()
+}
+
+// Removes an element from the LRU list and the idle lookup. The pool must be
+// locked by the caller.
+func (p *ExecutionEnginePool) remove(elem *list.Element) {
+	key := elem.Value.(*executionEnginePoolEntry).key
+	elems := p.idle[key]
+	for i := range elems {
+		if elems[i] == elem {
+			elems = append(elems[:i], elems[i+1:]...)
+			break
+		}
+	}
+	if len(elems) == 0 {
+		delete(p.idle, key)
+	} else {
+		p.idle[key] = elems
+	}
+	p.lru.Remove(elem)
+}
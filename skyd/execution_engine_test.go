@@ -1,6 +1,8 @@
 package skyd
 
 import (
+	"io/ioutil"
+	"os"
 	"testing"
 )
 
@@ -32,3 +34,95 @@ func TestExecutionEngineExtractPropertyReferences(t *testing.T) {
 		t.Fatalf("Expected %v, got %v", p, l.propertyRefs[2])
 	}
 }
+
+// Ensure that pooled engines are reused until the property file changes.
+func TestExecutionEnginePool(t *testing.T) {
+	table := createTempTable(t)
+	table.Open()
+	defer table.Close()
+	table.CreateProperty("name", false, "string")
+
+	pool := NewExecutionEnginePool(2)
+	defer pool.Clear()
+	source := "function aggregate(cursor, data) x = cursor.event:name() end\nfunction merge(results, data) end"
+
+	e0, err := pool.Get(table, source)
+	if err != nil {
+		t.Fatalf("Unable to create execution engine: %v", err)
+	}
+	pool.Put(e0)
+	if e1, _ := pool.Get(table, source); e1 != e0 {
+		t.Fatalf("Expected idle engine to be reused")
+	}
+	if e2, _ := pool.Get(table, source); e2 == e0 {
+		t.Fatalf("Expected a new engine while the idle engine is in use")
+	} else {
+		pool.Put(e2)
+	}
+	if pool.Len() != 1 {
+		t.Fatalf("Expected 1 idle engine, got %v", pool.Len())
+	}
+
+	// Changing the properties invalidates the compiled engine.
+	table.CreateProperty("salary", false, "float")
+	pool.Put(e0)
+	if e3, _ := pool.Get(table, source); e3 == e0 {
+		t.Fatalf("Expected engine to be recompiled after a property change")
+	}
+}
+
+// Ensure that compiled scripts are loaded from the bytecode cache, both from
+// memory and from the files of an earlier cache.
+func TestExecutionEngineBytecodeCache(t *testing.T) {
+	table := createTempTable(t)
+	table.Open()
+	defer table.Close()
+	table.CreateProperty("name", false, "string")
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+
+	source := "function aggregate(cursor, data) data.x = 1 end\nfunction merge(results, data) results.x = 2 end"
+	compile := func(cache *LuaBytecodeCache) {
+		e, err := newExecutionEngine(table, source, EngineOptions{}, cache)
+		if err != nil {
+			t.Fatalf("Unable to create execution engine: %v", err)
+		}
+		e.Destroy()
+	}
+	cache := NewLuaBytecodeCache(path, 1<<20)
+	compile(cache)
+	compile(cache)
+	if hits, misses := cache.Stats(); hits != 1 || misses != 1 {
+		t.Fatalf("Unexpected cache stats: %d hits, %d misses", hits, misses)
+	}
+
+	// A new cache finds the chunk on disk.
+	cache = NewLuaBytecodeCache(path, 1<<20)
+	compile(cache)
+	if hits, misses := cache.Stats(); hits != 1 || misses != 0 {
+		t.Fatalf("Unexpected cache stats after reopening: %d hits, %d misses", hits, misses)
+	}
+}
+
+// Ensure that Lua results are converted into Go objects.
+func TestExecutionEngineDecodeResult(t *testing.T) {
+	table := createTempTable(t)
+	table.Open()
+	defer table.Close()
+
+	e, err := NewExecutionEngine(table, "function aggregate(cursor, data) end\nfunction merge(results, data) results.x = 1.5 results.y = -2 results.n = {a = 'foo', [3] = true} end")
+	if err != nil {
+		t.Fatalf("Unable to create execution engine: %v", err)
+	}
+	defer e.Destroy()
+
+	result, err := e.Merge(map[interface{}]interface{}{}, map[interface{}]interface{}{})
+	if err != nil {
+		t.Fatalf("Unable to merge: %v", err)
+	}
+	m := result.(map[interface{}]interface{})
+	n := m["n"].(map[interface{}]interface{})
+	if m["x"] != 1.5 || m["y"] != int64(-2) || n["a"] != "foo" || n[int64(3)] != true {
+		t.Fatalf("Unexpected result: %v", result)
+	}
+}
@@ -0,0 +1,643 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"github.com/jmhodges/levigo"
+	"math"
+	"sort"
+	"sync"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// A factor index maps each value of an indexed factor property to a
+// roaring bitmap of the objects within a servlet that have had the value
+// in any of their events, so that queries selecting a rare value can seek
+// to those objects instead of scanning the whole table. Objects are given
+// an ordinal within the servlet the first time one of their values is
+// indexed and the bitmaps hold ordinals. Like zones, the bitmaps only ever
+// grow as events are written so they may list objects that no longer have
+// a value.
+//
+// The index is stored under the zone marker of its table followed by a
+// second zero byte, which sorts before every zone but the first, and a byte
+// for the kind of entry:
+//
+//	'b' property id (8) value (8) upper ordinal bits (2)  bitmap container
+//	'k' object key without the table prefix               ordinal (4)
+//	'o' ordinal (4)                                       object key
+//	'p' property id (8)                                   indexed property
+//
+// Integers in keys are big endian so that they sort numerically.
+const factorIndexMarker = 0x00
+
+const (
+	factorIndexContainerKind = 'b'
+	factorIndexObjectKind    = 'k'
+	factorIndexOrdinalKind   = 'o'
+	factorIndexPropertyKind  = 'p'
+)
+
+// The most objects that a query seeks to individually. Filters that select
+// more objects than this are left to the zone maps.
+const factorIndexCandidateLimit = 1 << 16
+
+// The number of objects that are indexed in each batch when a property is
+// first indexed.
+const factorIndexBuildBatchSize = 1024
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// The factor indexes of a single table in a servlet. Properties are only
+// added while the servlet is locked and ordinals are only assigned while
+// commits are locked.
+type factorIndex struct {
+	sync.RWMutex
+	prefix      []byte
+	properties  map[int64]bool
+	nextOrdinal uint32
+}
+
+// The changes that writes to a batch have made to the factor indexes so
+// far. Later writes to the same batch read them back since they aren't in
+// the database until the batch is written, at which point the containers
+// are added to it once each.
+type factorIndexChanges struct {
+	ordinals   map[string]uint32
+	containers map[string]*roaringContainer
+}
+
+type byteSliceList [][]byte
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Generates the start of the keys of a kind of factor index entry.
+func factorIndexKey(prefix []byte, kind byte, size int) []byte {
+	key := make([]byte, 0, len(prefix)+3+size)
+	key = append(key, prefix...)
+	return append(key, zoneMarker, factorIndexMarker, kind)
+}
+
+// Generates the key that marks a property as indexed.
+func factorIndexPropertyKey(prefix []byte, id int64) []byte {
+	key := factorIndexKey(prefix, factorIndexPropertyKind, 8)
+	return appendUint64(key, uint64(id))
+}
+
+// Generates the key that an object's ordinal is stored under.
+func factorIndexObjectKey(prefix []byte, objectKey []byte) []byte {
+	key := factorIndexKey(prefix, factorIndexObjectKind, len(objectKey)-len(prefix))
+	return append(key, objectKey[len(prefix):]...)
+}
+
+// Generates the key that the object with an ordinal is stored under.
+func factorIndexOrdinalKey(prefix []byte, ordinal uint32) []byte {
+	key := factorIndexKey(prefix, factorIndexOrdinalKind, 4)
+	return append(key, byte(ordinal>>24), byte(ordinal>>16), byte(ordinal>>8), byte(ordinal))
+}
+
+// Generates the start of the keys of the containers of a value's bitmap.
+func factorIndexValueKey(prefix []byte, id int64, value int64) []byte {
+	key := factorIndexKey(prefix, factorIndexContainerKind, 18)
+	return appendUint64(appendUint64(key, uint64(id)), uint64(value))
+}
+
+// Generates the key of the container of a value's bitmap that holds an
+// ordinal.
+func factorIndexContainerKey(prefix []byte, id int64, value int64, ordinal uint32) []byte {
+	return append(factorIndexValueKey(prefix, id, value), byte(ordinal>>24), byte(ordinal>>16))
+}
+
+// Checks if a key within a table is part of its factor index.
+func isFactorIndexKey(key []byte, prefixSize int) bool {
+	return len(key) > prefixSize+1 && key[prefixSize] == zoneMarker && key[prefixSize+1] == factorIndexMarker
+}
+
+// Evaluates a cursor filter program against the bitmaps of a factor index.
+// Returns the ordinals of the objects that may match or nil if any object
+// may. A comparison only narrows the objects when it tests an indexed
+// property for equality with a value. Every other comparison may match any
+// object.
+func factorIndexFilter(filter []byte, indexed map[int64]bool, lookup func(id int64, value int64) (*roaringBitmap, error)) (*roaringBitmap, error) {
+	stack := make([]*roaringBitmap, 0, maxQueryFilterDepth)
+	for i := 0; i < len(filter); {
+		switch filter[i] {
+		case queryFilterOpTrue:
+			stack = append(stack, nil)
+			i++
+		case queryFilterOpFalse:
+			stack = append(stack, newRoaringBitmap())
+			i++
+		case queryFilterOpAnd, queryFilterOpOr:
+			if len(stack) < 2 {
+				return nil, nil
+			}
+			lhs, rhs := stack[len(stack)-2], stack[len(stack)-1]
+			stack = stack[:len(stack)-1]
+			if filter[i] == queryFilterOpAnd {
+				if lhs == nil {
+					lhs = rhs
+				} else if rhs != nil {
+					lhs = lhs.and(rhs)
+				}
+			} else if lhs != nil {
+				if rhs == nil {
+					lhs = nil
+				} else {
+					lhs = lhs.or(rhs)
+				}
+			}
+			stack[len(stack)-1] = lhs
+			i++
+		case queryFilterOpCmp:
+			if len(filter) < i+11 {
+				return nil, nil
+			}
+			cmp, valueType := filter[i+1], filter[i+2]
+			id := int64(binary.LittleEndian.Uint64(filter[i+3:]))
+			value := filter[i+11:]
+			var match *roaringBitmap
+			switch valueType {
+			case queryFilterValueNumber:
+				if len(value) < 8 {
+					return nil, nil
+				}
+				// Missing values compare as zero so zero may match any object.
+				number := math.Float64frombits(binary.LittleEndian.Uint64(value))
+				if cmp == queryFilterComparisons["=="] && indexed[id] && number != 0 && number == math.Trunc(number) {
+					var err error
+					if match, err = lookup(id, int64(number)); err != nil {
+						return nil, err
+					}
+				}
+				i += 19
+			case queryFilterValueBoolean:
+				i += 12
+			case queryFilterValueString:
+				if len(value) < 4 {
+					return nil, nil
+				}
+				i += 15 + int(binary.LittleEndian.Uint32(value))
+			default:
+				return nil, nil
+			}
+			stack = append(stack, match)
+		default:
+			return nil, nil
+		}
+	}
+	if len(stack) == 0 {
+		return nil, nil
+	}
+	return stack[0], nil
+}
+
+// Generates the skip ranges of a table that leave only the objects with a
+// sorted list of keys, along with the ranges that are already skipped.
+// Objects in those ranges are left out. Each object's chunks and state sort
+// between its key and the next key after every key it prefixes.
+func objectSkipRanges(prefix []byte, keys [][]byte, skip []keyRange) []keyRange {
+	ranges := make([]keyRange, 0, len(keys)+1)
+	start, j := prefix, 0
+	for i, key := range keys {
+		if i > 0 && bytes.Equal(key, keys[i-1]) {
+			continue
+		}
+		for j < len(skip) && skip[j].end != nil && bytes.Compare(skip[j].end, key) <= 0 {
+			j++
+		}
+		if j < len(skip) && bytes.Compare(skip[j].start, key) <= 0 {
+			continue
+		}
+		if bytes.Compare(start, key) < 0 {
+			ranges = append(ranges, keyRange{start: start, end: key})
+		}
+		start = incrementKey(key)
+	}
+	return append(ranges, keyRange{start: start})
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Batches
+//--------------------------------------
+
+// Returns the factor index changes of a batch, creating them if needed.
+func (b *writeBatch) factorIndexChanges() *factorIndexChanges {
+	if b.index == nil {
+		b.index = &factorIndexChanges{ordinals: make(map[string]uint32), containers: make(map[string]*roaringContainer)}
+	}
+	return b.index
+}
+
+// Adds the changed factor index containers to the batch.
+func (b *writeBatch) putFactorIndexChanges() {
+	if b.index == nil {
+		return
+	}
+	keys := make([]string, 0, len(b.index.containers))
+	for key := range b.index.containers {
+		keys = append(keys, key)
+	}
+	sort.Strings(keys)
+	for _, key := range keys {
+		b.Put([]byte(key), b.index.containers[key].encode())
+	}
+	b.index = nil
+}
+
+//--------------------------------------
+// Servlets
+//--------------------------------------
+
+// Returns the factor index for a table prefix, loading the indexed
+// properties and the next ordinal from the database the first time.
+func (s *Servlet) factorIndex(prefix []byte) (*factorIndex, error) {
+	s.indexMutex.Lock()
+	x := s.indexes[string(prefix)]
+	s.indexMutex.Unlock()
+	if x != nil {
+		return x, nil
+	}
+
+	x = &factorIndex{prefix: prefix, properties: make(map[int64]bool)}
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+	start := factorIndexKey(prefix, factorIndexPropertyKind, 0)
+	for iterator.Seek(start); iterator.Valid(); iterator.Next() {
+		key := iterator.Key()
+		if !bytes.HasPrefix(key, start) {
+			break
+		}
+		if len(key) == len(start)+8 {
+			x.properties[int64(binary.BigEndian.Uint64(key[len(start):]))] = true
+		}
+	}
+	if err := iterator.GetError(); err != nil {
+		return nil, err
+	}
+
+	// The next ordinal follows the last one that was stored.
+	start = factorIndexKey(prefix, factorIndexOrdinalKind, 0)
+	if iterator.Seek(factorIndexKey(prefix, factorIndexOrdinalKind+1, 0)); iterator.Valid() {
+		iterator.Prev()
+	} else {
+		iterator.SeekToLast()
+	}
+	if iterator.Valid() {
+		if key := iterator.Key(); bytes.HasPrefix(key, start) && len(key) == len(start)+4 {
+			x.nextOrdinal = binary.BigEndian.Uint32(key[len(start):]) + 1
+		}
+	}
+	if err := iterator.GetError(); err != nil {
+		return nil, err
+	}
+
+	s.indexMutex.Lock()
+	if s.indexes == nil {
+		s.indexes = make(map[string]*factorIndex)
+	}
+	if other := s.indexes[string(prefix)]; other != nil {
+		x = other
+	} else {
+		s.indexes[string(prefix)] = x
+	}
+	s.indexMutex.Unlock()
+	return x, nil
+}
+
+// Forgets the factor index for a table prefix after its data has been
+// removed.
+func (s *Servlet) dropFactorIndex(prefix []byte) {
+	s.indexMutex.Lock()
+	delete(s.indexes, string(prefix))
+	s.indexMutex.Unlock()
+}
+
+// Adds an object to the bitmaps of the indexed values in the events written
+// to it. The commit mutex or the entire servlet should be locked by the
+// caller.
+func (s *Servlet) updateFactorIndex(prefix []byte, key []byte, events []*Event, batch *writeBatch) error {
+	if len(events) == 0 {
+		return nil
+	}
+	x, err := s.factorIndex(prefix)
+	if err != nil {
+		return err
+	}
+	x.Lock()
+	defer x.Unlock()
+	if len(x.properties) == 0 {
+		return nil
+	}
+	return s.indexEvents(x, x.properties, key, events, batch)
+}
+
+// Adds an object to the bitmaps of the values of a set of properties in a
+// list of events. The index should be locked by the caller.
+func (s *Servlet) indexEvents(x *factorIndex, properties map[int64]bool, key []byte, events []*Event, batch *writeBatch) error {
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	changes := batch.factorIndexChanges()
+	ordinal, assigned := uint32(0), false
+	for _, event := range events {
+		for id, value := range event.Data {
+			if !properties[id] {
+				continue
+			}
+			v, ok := normalize(value).(int64)
+			if !ok {
+				continue
+			}
+
+			// Objects are only given an ordinal once they have a value.
+			if !assigned {
+				var err error
+				if ordinal, err = s.factorIndexOrdinal(x, key, ro, batch); err != nil {
+					return err
+				}
+				assigned = true
+			}
+
+			containerKey := factorIndexContainerKey(x.prefix, id, v, ordinal)
+			c := changes.containers[string(containerKey)]
+			if c == nil {
+				stored, err := s.db.Get(ro, containerKey)
+				if err != nil {
+					return err
+				}
+				if stored == nil {
+					c = newRoaringContainer()
+				} else if c, err = decodeRoaringContainer(stored); err != nil {
+					return err
+				}
+			}
+			if c.add(uint16(ordinal)) {
+				changes.containers[string(containerKey)] = c
+			}
+		}
+	}
+	return nil
+}
+
+// Returns the ordinal of an object, assigning it the next one if it
+// doesn't have one yet. The index should be locked by the caller.
+func (s *Servlet) factorIndexOrdinal(x *factorIndex, key []byte, ro *levigo.ReadOptions, batch *writeBatch) (uint32, error) {
+	changes := batch.factorIndexChanges()
+	if ordinal, ok := changes.ordinals[string(key)]; ok {
+		return ordinal, nil
+	}
+	objectKey := factorIndexObjectKey(x.prefix, key)
+	value, err := s.db.Get(ro, objectKey)
+	if err != nil {
+		return 0, err
+	}
+	if len(value) == 4 {
+		return binary.BigEndian.Uint32(value), nil
+	}
+
+	if x.nextOrdinal == math.MaxUint32 {
+		return 0, errors.New("skyd.FactorIndex: Out of object ordinals")
+	}
+	ordinal := x.nextOrdinal
+	x.nextOrdinal++
+	changes.ordinals[string(key)] = ordinal
+	batch.Put(objectKey, []byte{byte(ordinal >> 24), byte(ordinal >> 16), byte(ordinal >> 8), byte(ordinal)})
+	batch.Put(factorIndexOrdinalKey(x.prefix, ordinal), append([]byte{}, key[len(x.prefix):]...))
+	return ordinal, nil
+}
+
+// Indexes a factor property of a table, adding every object that has had a
+// value of it to the value's bitmap. Writes to the servlet wait until the
+// objects have been indexed.
+func (s *Servlet) indexFactor(prefix []byte, id int64) error {
+	s.Lock()
+	defer s.Unlock()
+	x, err := s.factorIndex(prefix)
+	if err != nil {
+		return err
+	}
+	x.Lock()
+	defer x.Unlock()
+	if x.properties[id] {
+		return nil
+	}
+
+	ro := levigo.NewReadOptions()
+	ro.SetFillCache(false)
+	setSequentialScan(ro)
+	setPrefixSameAsStart(ro)
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+	wo := levigo.NewWriteOptions()
+	defer wo.Close()
+	batch := newWriteBatch()
+	defer func() { batch.Close() }()
+
+	// Chunks and states belong to the object before them. The state is
+	// indexed too since it holds the permanent values that events dedupe.
+	properties := map[int64]bool{id: true}
+	count := 0
+	for iterator.Seek(prefix); iterator.Valid(); iterator.Next() {
+		key := iterator.Key()
+		if !bytes.HasPrefix(key, prefix) {
+			break
+		}
+		n := objectKeySize(key, len(prefix))
+		if isZoneKey(key, len(prefix)) || n == 0 || isObjectFamilyKey(key[:n], key) {
+			continue
+		}
+		var events []*Event
+		switch {
+		case isObjectStateKey(key[:n], key):
+			state, _, err := decodeObjectState(iterator.Value())
+			if err != nil {
+				return err
+			}
+			events = []*Event{state}
+		case n == len(key):
+			state, data, err := decodeObject(iterator.Value())
+			if err != nil {
+				return err
+			}
+			if events, err = DecodeEvents(data); err != nil {
+				return err
+			}
+			if state != nil {
+				events = append(events, state)
+			}
+			if count++; count%factorIndexBuildBatchSize == 0 {
+				if err = s.changes.write(s.db, wo, batch); err != nil {
+					return err
+				}
+				batch.Close()
+				batch = newWriteBatch()
+			}
+		default:
+			_, data, err := splitEventIndex(iterator.Value())
+			if err != nil {
+				return err
+			}
+			if events, err = DecodeEvents(data); err != nil {
+				return err
+			}
+		}
+		if err := s.indexEvents(x, properties, append([]byte{}, key[:n]...), events, batch); err != nil {
+			return err
+		}
+	}
+	if err := iterator.GetError(); err != nil {
+		return err
+	}
+
+	batch.Put(factorIndexPropertyKey(prefix, id), []byte{})
+	if err := s.changes.write(s.db, wo, batch); err != nil {
+		return err
+	}
+	x.properties[id] = true
+	return nil
+}
+
+// Removes the index of a factor property of a table. Objects keep their
+// ordinals for the other indexed properties.
+func (s *Servlet) unindexFactor(prefix []byte, id int64) error {
+	s.Lock()
+	defer s.Unlock()
+	x, err := s.factorIndex(prefix)
+	if err != nil {
+		return err
+	}
+	x.Lock()
+	defer x.Unlock()
+	if !x.properties[id] {
+		return nil
+	}
+
+	wo := levigo.NewWriteOptions()
+	defer wo.Close()
+	start := appendUint64(factorIndexKey(prefix, factorIndexContainerKind, 8), uint64(id))
+	if err := s.changes.deleteRange(s.db, wo, start, incrementKey(start)); err != nil {
+		return err
+	}
+	batch := newWriteBatch()
+	defer batch.Close()
+	batch.Delete(factorIndexPropertyKey(prefix, id))
+	if err := s.changes.write(s.db, wo, batch); err != nil {
+		return err
+	}
+	delete(x.properties, id)
+	return nil
+}
+
+// Reads the bitmap of the objects that have had a value of a property.
+func (s *Servlet) factorIndexBitmap(prefix []byte, id int64, value int64) (*roaringBitmap, error) {
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+
+	b := newRoaringBitmap()
+	start := factorIndexValueKey(prefix, id, value)
+	for iterator.Seek(start); iterator.Valid(); iterator.Next() {
+		key := iterator.Key()
+		if !bytes.HasPrefix(key, start) {
+			break
+		}
+		if len(key) != len(start)+2 {
+			continue
+		}
+		c, err := decodeRoaringContainer(iterator.Value())
+		if err != nil {
+			return nil, err
+		}
+		b.set(binary.BigEndian.Uint16(key[len(start):]), c)
+	}
+	return b, iterator.GetError()
+}
+
+// Returns the key ranges of a table that a query with a cursor filter can
+// seek past because the factor index has none of their objects for the
+// values the filter selects. Objects in a list of key ranges that are
+// already being skipped are left out. Returns nil if the filter doesn't
+// select any indexed values or selects too many objects for seeking to
+// each one to pay off.
+func (s *Servlet) factorIndexSkipRanges(prefix []byte, filter []byte, skip []keyRange) ([]keyRange, error) {
+	x, err := s.factorIndex(prefix)
+	if err != nil {
+		return nil, err
+	}
+	x.RLock()
+	indexed := make(map[int64]bool, len(x.properties))
+	for id := range x.properties {
+		indexed[id] = true
+	}
+	x.RUnlock()
+	if len(indexed) == 0 {
+		return nil, nil
+	}
+
+	b, err := factorIndexFilter(filter, indexed, func(id int64, value int64) (*roaringBitmap, error) {
+		return s.factorIndexBitmap(prefix, id, value)
+	})
+	if b == nil || err != nil || b.cardinality() > factorIndexCandidateLimit {
+		return nil, err
+	}
+
+	// Look up the keys of the objects and put them in key order. Objects
+	// that were removed after they were indexed are left out.
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	keys := make([][]byte, 0, b.cardinality())
+	b.each(func(ordinal uint32) {
+		if err != nil {
+			return
+		}
+		var value []byte
+		if value, err = s.db.Get(ro, factorIndexOrdinalKey(prefix, ordinal)); err == nil && value != nil {
+			keys = append(keys, append(append([]byte{}, prefix...), value...))
+		}
+	})
+	if err != nil {
+		return nil, err
+	}
+	sort.Sort(byteSliceList(keys))
+	return objectSkipRanges(prefix, keys, skip), nil
+}
+
+//--------------------------------------
+// Sorting
+//--------------------------------------
+
+func (l byteSliceList) Len() int {
+	return len(l)
+}
+
+func (l byteSliceList) Less(i, j int) bool {
+	return bytes.Compare(l[i], l[j]) < 0
+}
+
+func (l byteSliceList) Swap(i, j int) {
+	l[i], l[j] = l[j], l[i]
+}
@@ -0,0 +1,115 @@
+package skyd
+
+import (
+	"bytes"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"testing"
+)
+
+// Ensure that bitmaps convert their containers to bitsets as they fill and
+// can be combined and read back.
+func TestRoaringBitmap(t *testing.T) {
+	a, b := newRoaringBitmap(), newRoaringBitmap()
+	for i := uint32(0); i < 10000; i++ {
+		a.add(i * 2)
+		if i%3 == 0 {
+			b.add(i * 2)
+		}
+	}
+	b.add(1 << 20)
+	if a.cardinality() != 10000 || a.containers[0].bits == nil {
+		t.Fatalf("Unexpected bitmap: %v", a.cardinality())
+	}
+	if !a.contains(19998) || a.contains(19999) || !b.contains(1<<20) {
+		t.Fatalf("Unexpected membership")
+	}
+	if n := a.and(b).cardinality(); n != 3334 {
+		t.Fatalf("Unexpected intersection: %v", n)
+	}
+	if n := a.or(b).cardinality(); n != 10001 {
+		t.Fatalf("Unexpected union: %v", n)
+	}
+
+	// Containers are encoded as arrays or bitsets.
+	for _, c := range []*roaringContainer{a.containers[0], b.containers[0]} {
+		other, err := decodeRoaringContainer(c.encode())
+		if err != nil || other.cardinality() != c.cardinality() || (other.bits == nil) != (c.bits == nil) {
+			t.Fatalf("Unable to decode container: %v", err)
+		}
+	}
+	var values []uint32
+	b.each(func(v uint32) { values = append(values, v) })
+	if len(values) != 3335 || values[1] != 6 || values[3334] != 1<<20 {
+		t.Fatalf("Unexpected values: %v", len(values))
+	}
+}
+
+// Ensure that an indexed factor skips every object that never had a value
+// selected by a filter, including objects added after it was indexed.
+func TestFactorIndexSkipRanges(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	prefix, _ := TablePrefix(table.Name)
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	// Every tenth object has an action of 2.
+	objectIds := make([]string, 0)
+	events := make([]*Event, 0)
+	for i := 0; i < 100; i++ {
+		objectIds = append(objectIds, fmt.Sprintf("obj%04d", i))
+		action := uint64(1)
+		if i%10 == 0 {
+			action = 2
+		}
+		events = append(events, NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{1: action}))
+	}
+	if err := servlet.PutEvents(table, objectIds, events, true); err != nil {
+		t.Fatalf("Unable to add events: %v", err)
+	}
+	if err := servlet.indexFactor(prefix, 1); err != nil {
+		t.Fatalf("Unable to index property: %v", err)
+	}
+	if err := servlet.PutEvent(table, "obj0005", NewEvent("2012-01-02T00:00:00Z", map[int64]interface{}{1: uint64(2)}), true); err != nil {
+		t.Fatalf("Unable to add event: %v", err)
+	}
+
+	buffer := new(bytes.Buffer)
+	expr := &queryComparisonExpression{property: &Property{Id: 1, DataType: FactorDataType}, op: "==", value: float64(2)}
+	expr.codegenFilter(buffer)
+	ranges, err := servlet.factorIndexSkipRanges(prefix, buffer.Bytes(), nil)
+	if err != nil || len(ranges) != 12 {
+		t.Fatalf("Unexpected skip ranges: %v (%v)", len(ranges), err)
+	}
+	first, _ := table.EncodeObjectId("obj0000")
+	fifth, _ := table.EncodeObjectId("obj0005")
+	if !bytes.Equal(ranges[0].start, prefix) || !bytes.Equal(ranges[0].end, first) || !bytes.Equal(ranges[1].end, fifth) || ranges[11].end != nil {
+		t.Fatalf("Unexpected skip ranges: %v", ranges)
+	}
+
+	// Objects in ranges that are already skipped are left out.
+	ranges, _ = servlet.factorIndexSkipRanges(prefix, buffer.Bytes(), []keyRange{keyRange{start: first, end: fifth}})
+	if len(ranges) != 11 || !bytes.Equal(ranges[0].end, fifth) {
+		t.Fatalf("Unexpected skip ranges: %v", ranges)
+	}
+
+	// Unindexed properties and removed indexes don't skip anything.
+	expr.property.Id = 2
+	buffer.Reset()
+	expr.codegenFilter(buffer)
+	if ranges, _ = servlet.factorIndexSkipRanges(prefix, buffer.Bytes(), nil); ranges != nil {
+		t.Fatalf("Unexpected skip ranges for an unindexed property: %v", ranges)
+	}
+	if err = servlet.unindexFactor(prefix, 1); err != nil {
+		t.Fatalf("Unable to remove index: %v", err)
+	}
+	servlet.Close()
+	_ = servlet.Open()
+	if x, _ := servlet.factorIndex(prefix); len(x.properties) != 0 || x.nextOrdinal != 100 {
+		t.Fatalf("Unexpected index after reopening: %v", x)
+	}
+}
@@ -0,0 +1,393 @@
+package skyd
+
+import (
+	"bufio"
+	"encoding/binary"
+	"encoding/hex"
+	"fmt"
+	"hash/fnv"
+	"io"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"sort"
+	"strings"
+	"sync"
+	"syscall"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The factors of each namespace/id are also kept in a snapshot file beside
+// the factors database so that they can be looked up as soon as the server
+// starts, without warming the caches from LevelDB. A snapshot is a heap of
+// the values followed by an offset array indexed by sequence for reverse
+// lookups, the sequences sorted by value for forward lookups by binary
+// search, and a footer:
+//
+//	reverse offset (8), forward offset (8), max sequence (8), count (4),
+//	version (4), prefix size (4), padding (4), magic (8)
+//
+// The heap starts with the namespace/id prefix. Factors that are created or
+// read from the database after a snapshot is written are appended to a log
+// beside it. The log is merged into a new snapshot when the factors are
+// closed, or when they're opened after a crash.
+const (
+	factorSnapshotMagic      = 0x54434146594b53 // "SKYFACT"
+	factorSnapshotVersion    = 1
+	factorSnapshotFooterSize = 48
+	factorSnapshotExt        = ".fdict"
+	factorSnapshotLogExt     = ".flog"
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A factorSnapshot is the memory mapped snapshot of a namespace/id along
+// with the log of factors added since it was written.
+type factorSnapshot struct {
+	sync.Mutex
+	path    string
+	prefix  string
+	data    []byte
+	heap    []byte
+	reverse []byte
+	forward []byte
+	count   int
+	maxSeq  uint64
+	log     *os.File
+	logged  map[uint64]bool
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// The path of the snapshot of a namespace/id prefix within a directory.
+func factorSnapshotPath(dir string, prefix string) string {
+	h := fnv.New64a()
+	h.Write([]byte(prefix))
+	return filepath.Join(dir, hex.EncodeToString(h.Sum(nil))+factorSnapshotExt)
+}
+
+// Opens the snapshots in a directory, merging any logs left by a crash
+// first. Snapshots that can't be read are removed since the database holds
+// every factor anyway.
+func openFactorSnapshots(dir string) (map[string]*factorSnapshot, error) {
+	if err := os.MkdirAll(dir, 0700); err != nil {
+		return nil, err
+	}
+	infos, err := ioutil.ReadDir(dir)
+	if err != nil {
+		return nil, err
+	}
+	snapshots := make(map[string]*factorSnapshot)
+	for _, info := range infos {
+		name := info.Name()
+		if strings.HasSuffix(name, factorSnapshotLogExt) {
+			path := filepath.Join(dir, strings.TrimSuffix(name, factorSnapshotLogExt)+factorSnapshotExt)
+			if err := mergeFactorSnapshot(path, ""); err != nil {
+				os.Remove(path)
+				os.Remove(path + factorSnapshotLogExt)
+			}
+		}
+	}
+	if infos, err = ioutil.ReadDir(dir); err != nil {
+		return nil, err
+	}
+	for _, info := range infos {
+		if !strings.HasSuffix(info.Name(), factorSnapshotExt) {
+			continue
+		}
+		path := filepath.Join(dir, info.Name())
+		snapshot, err := openFactorSnapshot(path)
+		if err != nil {
+			os.Remove(path)
+			continue
+		}
+		snapshots[snapshot.prefix] = snapshot
+	}
+	return snapshots, nil
+}
+
+// Maps a snapshot into memory and validates its footer.
+func openFactorSnapshot(path string) (*factorSnapshot, error) {
+	file, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer file.Close()
+	info, err := file.Stat()
+	if err != nil {
+		return nil, err
+	}
+	size := info.Size()
+	if size < factorSnapshotFooterSize {
+		return nil, fmt.Errorf("skyd.Factors: Invalid snapshot size: %v", path)
+	}
+	data, err := syscall.Mmap(int(file.Fd()), 0, int(size), syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		return nil, err
+	}
+
+	s := &factorSnapshot{path: path, data: data}
+	footerOffset := uint64(len(data) - factorSnapshotFooterSize)
+	footer := data[footerOffset:]
+	reverseOffset := binary.LittleEndian.Uint64(footer)
+	forwardOffset := binary.LittleEndian.Uint64(footer[8:])
+	s.maxSeq = binary.LittleEndian.Uint64(footer[16:])
+	s.count = int(binary.LittleEndian.Uint32(footer[24:]))
+	version := binary.LittleEndian.Uint32(footer[28:])
+	prefixSize := uint64(binary.LittleEndian.Uint32(footer[32:]))
+	magic := binary.LittleEndian.Uint64(footer[40:])
+	if magic != factorSnapshotMagic || version != factorSnapshotVersion || prefixSize > reverseOffset ||
+		reverseOffset+(s.maxSeq+1)*8 != forwardOffset || forwardOffset+uint64(s.count)*8 != footerOffset {
+		syscall.Munmap(data)
+		return nil, fmt.Errorf("skyd.Factors: Invalid snapshot footer: %v", path)
+	}
+	s.heap = data[:reverseOffset]
+	s.reverse = data[reverseOffset:forwardOffset]
+	s.forward = data[forwardOffset:footerOffset]
+	s.prefix = string(s.heap[:prefixSize])
+	return s, nil
+}
+
+// Merges the log of a snapshot into a new snapshot and removes the log.
+// The prefix is only used if there's no snapshot yet.
+func mergeFactorSnapshot(path string, prefix string) error {
+	values := make(map[uint64]string)
+	if s, err := openFactorSnapshot(path); err == nil {
+		prefix = s.prefix
+		for sequence := uint64(1); sequence <= s.maxSeq; sequence++ {
+			if value, ok := s.value(sequence); ok {
+				values[sequence] = value
+			}
+		}
+		s.close()
+	} else if !os.IsNotExist(err) {
+		return err
+	}
+
+	// Read the log up to the first partially written record.
+	if file, err := os.Open(path + factorSnapshotLogExt); err == nil {
+		r := bufio.NewReader(file)
+		logPrefix, err := readFactorSnapshotRecord(r)
+		if err == nil && prefix == "" {
+			prefix = logPrefix
+		}
+		for err == nil && logPrefix == prefix {
+			var sequence uint64
+			if sequence, err = binary.ReadUvarint(r); err == nil {
+				var value string
+				if value, err = readFactorSnapshotRecord(r); err == nil && sequence > 0 {
+					values[sequence] = value
+				}
+			}
+		}
+		file.Close()
+	} else if !os.IsNotExist(err) {
+		return err
+	}
+
+	if prefix != "" {
+		if err := writeFactorSnapshot(path, prefix, values); err != nil {
+			return err
+		}
+	}
+	if err := os.Remove(path + factorSnapshotLogExt); err != nil && !os.IsNotExist(err) {
+		return err
+	}
+	return nil
+}
+
+// Writes a snapshot of a namespace/id's factors beside its path and renames
+// it into place.
+func writeFactorSnapshot(path string, prefix string, values map[uint64]string) error {
+	var maxSeq uint64
+	sequences := make([]uint64, 0, len(values))
+	for sequence := range values {
+		sequences = append(sequences, sequence)
+		if sequence > maxSeq {
+			maxSeq = sequence
+		}
+	}
+	sort.Sort(&factorValueSorter{sequences, values})
+
+	file, err := os.OpenFile(path+".tmp", os.O_WRONLY|os.O_CREATE|os.O_TRUNC, 0600)
+	if err != nil {
+		return err
+	}
+	defer file.Close()
+	w := bufio.NewWriter(file)
+
+	// Write the heap and then the offset array indexed by sequence.
+	offsets := make([]byte, (maxSeq+1)*8)
+	w.WriteString(prefix)
+	offset := uint32(len(prefix))
+	for _, sequence := range sequences {
+		value := values[sequence]
+		binary.LittleEndian.PutUint32(offsets[sequence*8:], offset)
+		binary.LittleEndian.PutUint32(offsets[sequence*8+4:], uint32(len(value)))
+		w.WriteString(value)
+		offset += uint32(len(value))
+	}
+	reverseOffset := uint64(offset)
+	w.Write(offsets)
+
+	// Write the sequences in value order and the footer.
+	b := make([]byte, 8)
+	for _, sequence := range sequences {
+		binary.LittleEndian.PutUint64(b, sequence)
+		w.Write(b)
+	}
+	footer := make([]byte, factorSnapshotFooterSize)
+	binary.LittleEndian.PutUint64(footer, reverseOffset)
+	binary.LittleEndian.PutUint64(footer[8:], reverseOffset+uint64(len(offsets)))
+	binary.LittleEndian.PutUint64(footer[16:], maxSeq)
+	binary.LittleEndian.PutUint32(footer[24:], uint32(len(sequences)))
+	binary.LittleEndian.PutUint32(footer[28:], factorSnapshotVersion)
+	binary.LittleEndian.PutUint32(footer[32:], uint32(len(prefix)))
+	binary.LittleEndian.PutUint64(footer[40:], factorSnapshotMagic)
+	w.Write(footer)
+	if err := w.Flush(); err != nil {
+		return err
+	}
+	if err := file.Close(); err != nil {
+		return err
+	}
+	return os.Rename(path+".tmp", path)
+}
+
+// Reads a length prefixed string from a snapshot log.
+func readFactorSnapshotRecord(r *bufio.Reader) (string, error) {
+	size, err := binary.ReadUvarint(r)
+	if err != nil {
+		return "", err
+	}
+	b := make([]byte, size)
+	if _, err := io.ReadFull(r, b); err != nil {
+		return "", err
+	}
+	return string(b), nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// Finds the sequence of a value by binary search.
+func (s *factorSnapshot) sequence(value string) (uint64, bool) {
+	if s.data == nil {
+		return 0, false
+	}
+	i := sort.Search(s.count, func(i int) bool {
+		v, _ := s.value(binary.LittleEndian.Uint64(s.forward[i*8:]))
+		return v >= value
+	})
+	if i == s.count {
+		return 0, false
+	}
+	sequence := binary.LittleEndian.Uint64(s.forward[i*8:])
+	if v, _ := s.value(sequence); v != value {
+		return 0, false
+	}
+	return sequence, true
+}
+
+// Retrieves the value of a sequence from the offset array.
+func (s *factorSnapshot) value(sequence uint64) (string, bool) {
+	if s.data == nil || sequence == 0 || sequence > s.maxSeq {
+		return "", false
+	}
+	offset := binary.LittleEndian.Uint32(s.reverse[sequence*8:])
+	size := binary.LittleEndian.Uint32(s.reverse[sequence*8+4:])
+	if size == 0 {
+		return "", false
+	}
+	return string(s.heap[offset : offset+size]), true
+}
+
+// Appends a factor to the log unless it's in the snapshot or was already
+// logged. Errors leave the factor to be read from the database.
+func (s *factorSnapshot) append(sequence uint64, value string) {
+	if _, ok := s.value(sequence); ok {
+		return
+	}
+	s.Lock()
+	defer s.Unlock()
+	if s.logged[sequence] {
+		return
+	}
+	if s.log == nil {
+		log, err := os.OpenFile(s.path+factorSnapshotLogExt, os.O_WRONLY|os.O_CREATE|os.O_APPEND, 0600)
+		if err != nil {
+			return
+		}
+		s.log, s.logged = log, make(map[uint64]bool)
+		if info, err := log.Stat(); err != nil || info.Size() == 0 {
+			s.log.Write(appendFactorSnapshotString(nil, s.prefix))
+		}
+	}
+	b := make([]byte, binary.MaxVarintLen64, binary.MaxVarintLen64+len(value)+binary.MaxVarintLen64)
+	b = append(b[:binary.PutUvarint(b, sequence)], appendFactorSnapshotString(nil, value)...)
+	if _, err := s.log.Write(b); err == nil {
+		s.logged[sequence] = true
+	}
+}
+
+// Closes the log and unmaps the snapshot. Returns whether anything was
+// logged.
+func (s *factorSnapshot) close() bool {
+	s.Lock()
+	defer s.Unlock()
+	logged := s.log != nil
+	if s.log != nil {
+		s.log.Close()
+		s.log, s.logged = nil, nil
+	}
+	if s.data != nil {
+		syscall.Munmap(s.data)
+		s.data, s.heap, s.reverse, s.forward = nil, nil, nil, nil
+	}
+	return logged
+}
+
+// Adds a length prefixed string to a log record.
+func appendFactorSnapshotString(b []byte, value string) []byte {
+	size := make([]byte, binary.MaxVarintLen64)
+	b = append(b, size[:binary.PutUvarint(size, uint64(len(value)))]...)
+	return append(b, value...)
+}
+
+//--------------------------------------
+// Sorting
+//--------------------------------------
+
+// Sorts sequences by their values.
+type factorValueSorter struct {
+	sequences []uint64
+	values    map[uint64]string
+}
+
+func (s *factorValueSorter) Len() int {
+	return len(s.sequences)
+}
+
+func (s *factorValueSorter) Less(i, j int) bool {
+	return s.values[s.sequences[i]] < s.values[s.sequences[j]]
+}
+
+func (s *factorValueSorter) Swap(i, j int) {
+	s.sequences[i], s.sequences[j] = s.sequences[j], s.sequences[i]
+}
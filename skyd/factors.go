@@ -4,10 +4,36 @@ import (
 	"errors"
 	"fmt"
 	"github.com/jmhodges/levigo"
+	"hash/fnv"
+	"sort"
 	"strconv"
 	"sync"
 )
 
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of independently locked shards in the factor cache.
+const factorCacheShardCount = 16
+
+// The default number of factor values held in memory across all shards.
+const DefaultFactorCacheSize = 1 << 18
+
+// The number of sequence numbers reserved on disk at a time for each
+// namespace/id.
+const factorSequenceBlockSize = 1024
+
+// The number of values missing from the cache from which they're read from
+// the database with a single MultiGet instead of one Get each.
+const factorMultiGetSize = 8
+
+// The highest sequence number held in a factor dictionary. Values above it
+// are cached in the shards instead.
+const maxFactorDictionarySize = 1 << 20
+
 //------------------------------------------------------------------------------
 //
 // Typedefs
@@ -16,11 +42,45 @@ import (
 
 // A Factors object manages the factorization and defactorization of values.
 type Factors struct {
-	db    *levigo.DB
-	ro    *levigo.ReadOptions
-	wo    *levigo.WriteOptions
-	path  string
-	mutex sync.Mutex
+	db             *levigo.DB
+	changes        *changeLog
+	ro             *levigo.ReadOptions
+	wo             *levigo.WriteOptions
+	path           string
+	mutex          sync.Mutex
+	cacheSize      int
+	storageOptions StorageOptions
+	storage        *storage
+	shards         [factorCacheShardCount]factorCacheShard
+	sequences      map[string]*factorSequence
+	dicts          map[string]*factorDictionary
+	snapshots      map[string]*factorSnapshot
+	cacheHits      metricCounter
+	cacheMisses    metricCounter
+}
+
+// A shard of the in-memory factor cache. Each shard holds both lookup
+// directions for the namespace/ids that hash to it.
+type factorCacheShard struct {
+	sync.RWMutex
+	forward map[string]uint64
+	reverse map[string]string
+}
+
+// A dense reverse lookup for a namespace/id indexed by sequence number.
+// Factor values are never blank so an empty string marks a sequence that
+// hasn't been loaded yet.
+type factorDictionary struct {
+	sync.RWMutex
+	values []string
+}
+
+// A block of sequence numbers reserved for a namespace/id. The mutex also
+// serializes the creation of new factors for the namespace/id.
+type factorSequence struct {
+	sync.Mutex
+	next  uint64
+	limit uint64
 }
 
 //------------------------------------------------------------------------------
@@ -53,7 +113,19 @@ func (e *FactorNotFound) Error() string {
 
 // NewFactors returns a new Factors object.
 func NewFactors(path string) *Factors {
-	return &Factors{path: path}
+	f := &Factors{
+		path:           path,
+		changes:        newChangeLog(),
+		cacheSize:      DefaultFactorCacheSize,
+		storageOptions: DefaultFactorsStorageOptions(),
+		sequences:      make(map[string]*factorSequence),
+		dicts:          make(map[string]*factorDictionary),
+	}
+	for i := range f.shards {
+		f.shards[i].forward = make(map[string]uint64)
+		f.shards[i].reverse = make(map[string]string)
+	}
+	return f
 }
 
 //------------------------------------------------------------------------------
@@ -67,6 +139,31 @@ func (f *Factors) Path() string {
 	return f.path
 }
 
+// The maximum number of factor values held in the shard cache.
+func (f *Factors) CacheSize() int {
+	return f.cacheSize
+}
+
+// Sets the maximum number of factor values held in the shard cache. A size
+// of zero disables the cache.
+func (f *Factors) SetCacheSize(size int) {
+	f.cacheSize = size
+	for i := range f.shards {
+		f.shards[i].clear()
+	}
+}
+
+// The options that the database is opened with.
+func (f *Factors) StorageOptions() StorageOptions {
+	return f.storageOptions
+}
+
+// Sets the options that the database is opened with. This should be set
+// before the database is opened.
+func (f *Factors) SetStorageOptions(options StorageOptions) {
+	f.storageOptions = options
+}
+
 //------------------------------------------------------------------------------
 //
 // Methods
@@ -84,9 +181,8 @@ func (f *Factors) Open() error {
 	}
 
 	// Open database.
-	opts := levigo.NewOptions()
-	opts.SetCreateIfMissing(true)
-	db, err := levigo.Open(f.path, opts)
+	f.storage = newStorage(f.storageOptions)
+	db, err := f.storage.open(f.path)
 	if err != nil {
 		f.Close()
 		return fmt.Errorf("skyd.Factors: Unable to open database: %v", err)
@@ -97,6 +193,16 @@ func (f *Factors) Open() error {
 	f.ro = levigo.NewReadOptions()
 	f.wo = levigo.NewWriteOptions()
 
+	// Map the snapshots of the factors.
+	snapshots, err := openFactorSnapshots(f.SnapshotPath())
+	if err != nil {
+		f.Close()
+		return fmt.Errorf("skyd.Factors: Unable to open snapshots: %v", err)
+	}
+	f.mutex.Lock()
+	f.snapshots = snapshots
+	f.mutex.Unlock()
+
 	return nil
 }
 
@@ -111,6 +217,33 @@ func (f *Factors) Close() {
 	if f.wo != nil {
 		f.wo.Close()
 	}
+	if f.storage != nil {
+		f.storage.Close()
+	}
+	f.db, f.ro, f.wo, f.storage = nil, nil, nil, nil
+
+	// Unused ids in reserved blocks are skipped when reopened.
+	f.mutex.Lock()
+	snapshots := f.snapshots
+	f.sequences = make(map[string]*factorSequence)
+	f.dicts = make(map[string]*factorDictionary)
+	f.snapshots = nil
+	f.mutex.Unlock()
+
+	// Merge the factors logged since the snapshots were written.
+	for _, snapshot := range snapshots {
+		if snapshot.close() {
+			mergeFactorSnapshot(snapshot.path, snapshot.prefix)
+		}
+	}
+	for i := range f.shards {
+		f.shards[i].clear()
+	}
+}
+
+// The directory that the snapshots of the factors are kept in.
+func (f *Factors) SnapshotPath() string {
+	return f.path + ".snapshots"
 }
 
 // Returns whether the factors database is open.
@@ -124,17 +257,17 @@ func (f *Factors) IsOpen() bool {
 
 // The key for a given namespace/id/value.
 func (f *Factors) key(namespace string, id string, value string) string {
-	return fmt.Sprintf("%s>%s:%s", namespace, id, value)
+	return f.prefix(namespace, id) + value
 }
 
 // The reverse key for a given namespace/id/value.
 func (f *Factors) revkey(namespace string, id string, value uint64) string {
-	return fmt.Sprintf("%s>%s:%d", namespace, id, value)
+	return f.prefix(namespace, id) + strconv.FormatUint(value, 10)
 }
 
 // The sequence key for a given namespace/id.
 func (f *Factors) seqkey(namespace string, id string) string {
-	return fmt.Sprintf("%s>%s!", namespace, id)
+	return namespace + ">" + id + "!"
 }
 
 //--------------------------------------
@@ -143,108 +276,463 @@ func (f *Factors) seqkey(namespace string, id string) string {
 
 // Converts the defactorized value for a given id in a given namespace to its internal representation.
 func (f *Factors) Factorize(namespace string, id string, value string, createIfMissing bool) (uint64, error) {
-	// Blank is always zero.
-	if value == "" {
-		return 0, nil
-	}
-
-	// Otherwise find it in the LevelDB database.
-	data, err := f.db.Get(f.ro, []byte(f.key(namespace, id, value)))
+	sequences, err := f.FactorizeValues(namespace, []string{id}, []string{value}, createIfMissing)
 	if err != nil {
 		return 0, err
 	}
-	// If key does exist then parse and return it.
-	if data != nil {
-		return strconv.ParseUint(string(data), 10, 64)
+	return sequences[0], nil
+}
+
+// Converts several defactorized values in a namespace to their internal
+// representations. Each value is factorized against the id at the same
+// index. Repeated values are only resolved once, values missing from the
+// cache are read from the database in key order with a single iterator and
+// missing values are created together in a single write if requested.
+func (f *Factors) FactorizeValues(namespace string, ids []string, values []string, createIfMissing bool) ([]uint64, error) {
+	sequences := make([]uint64, len(values))
+
+	// Resolve each distinct value once and copy it to its repeats.
+	var distinct []int
+	var repeats map[int]int
+	seen := make(map[string]int)
+	for i, value := range values {
+		// Blank is always zero.
+		if value == "" {
+			continue
+		}
+		key := f.prefix(namespace, ids[i]) + value
+		if first, ok := seen[key]; ok {
+			if repeats == nil {
+				repeats = make(map[int]int)
+			}
+			repeats[i] = first
+		} else {
+			seen[key] = i
+			distinct = append(distinct, i)
+		}
 	}
 
-	// Create a new factor if requested.
-	if createIfMissing {
-		return f.add(namespace, id, value)
+	// Check the cache first.
+	var misses []int
+	var hits uint64
+	for _, i := range distinct {
+		prefix := f.prefix(namespace, ids[i])
+		if sequence, ok := f.shard(prefix).get(prefix + values[i]); ok {
+			sequences[i] = sequence
+			hits++
+		} else {
+			misses = append(misses, i)
+		}
+	}
+	f.cacheHits.Add(hits)
+	f.cacheMisses.Add(uint64(len(misses)))
+
+	// Then check the snapshots.
+	var unmapped []int
+	for _, i := range misses {
+		prefix := f.prefix(namespace, ids[i])
+		if snapshot := f.snapshot(prefix); snapshot != nil {
+			if sequence, ok := snapshot.sequence(values[i]); ok {
+				sequences[i] = sequence
+				f.cache(f.shard(prefix), prefix, values[i], sequence)
+				continue
+			}
+		}
+		unmapped = append(unmapped, i)
 	}
 
-	err = NewFactorNotFound(fmt.Sprintf("skyd.Factors: Factor not found: %v", f.key(namespace, id, value)))
-	return 0, err
-}
+	// Then read the rest from the LevelDB database and log them to be
+	// added to the snapshots.
+	var missing []int
+	if len(unmapped) > 0 {
+		found, err := f.lookupValues(namespace, ids, values, unmapped, sequences)
+		if err != nil {
+			return nil, err
+		}
+		for _, i := range unmapped {
+			if found[i] {
+				prefix := f.prefix(namespace, ids[i])
+				f.cache(f.shard(prefix), prefix, values[i], sequences[i])
+				if snapshot := f.snapshot(prefix); snapshot != nil {
+					snapshot.append(sequences[i], values[i])
+				}
+			} else {
+				missing = append(missing, i)
+			}
+		}
+	}
 
-// Adds a new factor to the database if it doesn't exist.
-func (f *Factors) add(namespace string, id string, value string) (uint64, error) {
-	// Lock while adding a new value.
-	f.mutex.Lock()
-	defer f.mutex.Unlock()
+	// Create new factors if requested.
+	if len(missing) > 0 {
+		if !createIfMissing {
+			i := missing[0]
+			return nil, NewFactorNotFound(fmt.Sprintf("skyd.Factors: Factor not found: %v", f.key(namespace, ids[i], values[i])))
+		}
+		if err := f.add(namespace, ids, values, sequences, missing); err != nil {
+			return nil, err
+		}
+	}
 
-	// Retry factorize within the context of the lock.
-	sequence, err := f.Factorize(namespace, id, value, false)
-	if err == nil {
-		return sequence, nil
-	} else if _, ok := err.(*FactorNotFound); !ok {
-		return 0, err
+	for i, first := range repeats {
+		sequences[i] = sequences[first]
 	}
+	return sequences, nil
+}
 
-	// Retrieve next id in sequence.
-	sequence, err = f.inc(namespace, id)
-	if err != nil {
-		return 0, err
+// Adds new factors to the database for the values at the given indices if
+// they don't exist. Only factors within the same namespace/id are
+// serialized against each other.
+func (f *Factors) add(namespace string, ids []string, values []string, sequences []uint64, indices []int) error {
+	// Lock the sequence of each id in a consistent order.
+	locked := make(map[string]*factorSequence)
+	prefixes := make([]string, 0, len(indices))
+	for _, index := range indices {
+		prefix := f.prefix(namespace, ids[index])
+		if locked[prefix] == nil {
+			locked[prefix] = f.sequence(prefix)
+			prefixes = append(prefixes, prefix)
+		}
+	}
+	sort.Strings(prefixes)
+	for _, prefix := range prefixes {
+		locked[prefix].Lock()
+		defer locked[prefix].Unlock()
 	}
 
-	// Save lookup and reverse lookup.
-	err = f.db.Put(f.wo, []byte(f.key(namespace, id, value)), []byte(strconv.FormatUint(sequence, 10)))
+	// Retry the lookups within the context of the locks since another
+	// writer may have added the values.
+	found, err := f.lookupValues(namespace, ids, values, indices, sequences)
 	if err != nil {
-		return 0, err
+		return err
 	}
-	err = f.db.Put(f.wo, []byte(f.revkey(namespace, id, sequence)), []byte(value))
-	if err != nil {
-		return 0, err
+
+	batch := newWriteBatch()
+	defer batch.Close()
+
+	// Retrieve next id in sequence and save lookup and reverse lookup.
+	created := make(map[string]uint64)
+	for _, index := range indices {
+		if found[index] {
+			continue
+		}
+		id, value := ids[index], values[index]
+		prefix := f.prefix(namespace, id)
+		sequence, err := f.inc(namespace, id, locked[prefix])
+		if err != nil {
+			return err
+		}
+		batch.Put([]byte(prefix+value), []byte(strconv.FormatUint(sequence, 10)))
+		batch.Put([]byte(f.revkey(namespace, id, sequence)), []byte(value))
+		created[prefix+value] = sequence
+		sequences[index] = sequence
+	}
+	if len(created) == 0 {
+		return nil
+	}
+	if err := f.changes.write(f.db, f.wo, batch); err != nil {
+		return err
 	}
 
-	return sequence, nil
+	// Only cache the new factors once they've been written.
+	for _, index := range indices {
+		prefix := f.prefix(namespace, ids[index])
+		f.cache(f.shard(prefix), prefix, values[index], sequences[index])
+		f.dictionary(prefix).set(sequences[index], values[index])
+		if snapshot := f.snapshot(prefix); snapshot != nil {
+			snapshot.append(sequences[index], values[index])
+		}
+	}
+	return nil
 }
 
 // Converts the factorized value for a given id in a given namespace to its internal representation.
 func (f *Factors) Defactorize(namespace string, id string, value uint64) (string, error) {
-	// Blank is always zero.
-	if value == 0 {
-		return "", nil
+	values, err := f.DefactorizeValues(namespace, id, []uint64{value})
+	if err != nil {
+		return "", err
 	}
+	return values[0], nil
+}
+
+// Converts several factorized values for a given id in a given namespace
+// back to their strings. Values are read from the id's dictionary and only
+// the ones that haven't been loaded yet are looked up in LevelDB.
+func (f *Factors) DefactorizeValues(namespace string, id string, sequences []uint64) ([]string, error) {
+	values := make([]string, len(sequences))
+	prefix := f.prefix(namespace, id)
+	dict := f.dictionary(prefix)
+
+	var missing []int
+	var hits uint64
+	dict.RLock()
+	for i, sequence := range sequences {
+		if sequence < uint64(len(dict.values)) {
+			values[i] = dict.values[sequence]
+		}
+		// Blank is always zero.
+		if values[i] == "" && sequence != 0 {
+			missing = append(missing, i)
+		} else if sequence != 0 {
+			hits++
+		}
+	}
+	dict.RUnlock()
+	f.cacheHits.Add(hits)
 
-	// Find it in LevelDB.
-	data, err := f.db.Get(f.ro, []byte(f.revkey(namespace, id, value)))
+	for _, i := range missing {
+		value, err := f.defactorize(namespace, id, sequences[i])
+		if err != nil {
+			return nil, err
+		}
+		values[i] = value
+		dict.set(sequences[i], value)
+	}
+	return values, nil
+}
+
+// Looks up a factorized value in the shard cache or LevelDB.
+func (f *Factors) defactorize(namespace string, id string, value uint64) (string, error) {
+	// Check the cache.
+	prefix := f.prefix(namespace, id)
+	shard := f.shard(prefix)
+	revkey := f.revkey(namespace, id, value)
+	if str, ok := shard.getReverse(revkey); ok {
+		f.cacheHits.Add(1)
+		return str, nil
+	}
+	f.cacheMisses.Add(1)
+
+	// Then check the snapshot.
+	snapshot := f.snapshot(prefix)
+	if snapshot != nil {
+		if str, ok := snapshot.value(value); ok {
+			f.cache(shard, prefix, str, value)
+			return str, nil
+		}
+	}
+
+	// Otherwise find it in LevelDB.
+	data, err := f.db.Get(f.ro, []byte(revkey))
 	if err != nil {
 		return "", err
 	}
 	if data == nil {
-		return "", fmt.Errorf("skyd.Factors: Value does not exist: %v", f.revkey(namespace, id, value))
+		return "", fmt.Errorf("skyd.Factors: Value does not exist: %v", revkey)
+	}
+	f.cache(shard, prefix, string(data), value)
+	if snapshot != nil {
+		snapshot.append(value, string(data))
 	}
 	return string(data), nil
 }
 
-// Retrieves the next available sequence number within a namespace for an id.
-func (f *Factors) inc(namespace string, id string) (uint64, error) {
-	data, err := f.db.Get(f.ro, []byte(f.seqkey(namespace, id)))
-	if err != nil {
-		return 0, err
+// Finds the sequences of the values at the given indices in the LevelDB
+// database and stores them in sequences. A few values are read with Get.
+// Larger groups are read with a single MultiGet, which takes the database's
+// version once and reads values sharing a block from it once. Returns the
+// indices that were found.
+func (f *Factors) lookupValues(namespace string, ids []string, values []string, indices []int, sequences []uint64) (map[int]bool, error) {
+	found := make(map[int]bool, len(indices))
+	if len(indices) < factorMultiGetSize {
+		for _, i := range indices {
+			sequence, ok, err := f.lookup(f.prefix(namespace, ids[i]), values[i])
+			if err != nil {
+				return nil, err
+			} else if ok {
+				sequences[i], found[i] = sequence, true
+			}
+		}
+		return found, nil
 	}
 
-	// Initialize key if it doesn't exist. Otherwise increment it.
-	if data == nil {
-		err := f.db.Put(f.wo, []byte(f.seqkey(namespace, id)), []byte("1"))
+	keys := make([][]byte, len(indices))
+	for j, i := range indices {
+		keys[j] = []byte(f.prefix(namespace, ids[i]) + values[i])
+	}
+	data, err := multiGet(f.db, f.ro, keys)
+	if err != nil {
+		return nil, err
+	}
+	for j, i := range indices {
+		if data[j] == nil {
+			continue
+		}
+		sequence, err := strconv.ParseUint(string(data[j]), 10, 64)
 		if err != nil {
-			return 0, err
+			return nil, err
 		}
-		return 1, nil
+		sequences[i], found[i] = sequence, true
 	}
+	return found, nil
+}
 
-	// Parse existing sequence.
+// Finds the sequence for a value in the LevelDB database.
+func (f *Factors) lookup(prefix string, value string) (uint64, bool, error) {
+	data, err := f.db.Get(f.ro, []byte(prefix+value))
+	if err != nil || data == nil {
+		return 0, false, err
+	}
 	sequence, err := strconv.ParseUint(string(data), 10, 64)
 	if err != nil {
-		return 0, fmt.Errorf("skyd.Factors: Unable to parse sequence: %v", data)
+		return 0, false, err
+	}
+	return sequence, true, nil
+}
+
+// Retrieves the next available sequence number within a namespace for an id.
+// Sequence numbers are reserved on disk in blocks so most calls don't touch
+// the database. The sequence must be locked by the caller.
+func (f *Factors) inc(namespace string, id string, seq *factorSequence) (uint64, error) {
+	if seq.next < seq.limit {
+		seq.next += 1
+		return seq.next, nil
 	}
 
-	// Increment and save the new value.
-	sequence += 1
-	err = f.db.Put(f.wo, []byte(f.seqkey(namespace, id)), []byte(strconv.FormatUint(sequence, 10)))
+	// Reserve a new block starting after the last reserved number.
+	data, err := f.db.Get(f.ro, []byte(f.seqkey(namespace, id)))
+	if err != nil {
+		return 0, err
+	}
+	var sequence uint64
+	if data != nil {
+		if sequence, err = strconv.ParseUint(string(data), 10, 64); err != nil {
+			return 0, fmt.Errorf("skyd.Factors: Unable to parse sequence: %v", data)
+		}
+	}
+	limit := sequence + factorSequenceBlockSize
+	err = f.db.Put(f.wo, []byte(f.seqkey(namespace, id)), []byte(strconv.FormatUint(limit, 10)))
 	if err != nil {
 		return 0, err
 	}
-	return sequence, nil
+
+	seq.next, seq.limit = sequence+1, limit
+	return seq.next, nil
+}
+
+//--------------------------------------
+// Cache
+//--------------------------------------
+
+// The key prefix shared by all values for a namespace/id.
+func (f *Factors) prefix(namespace string, id string) string {
+	return namespace + ">" + id + ":"
+}
+
+// Retrieves the cache shard for a namespace/id prefix.
+func (f *Factors) shard(prefix string) *factorCacheShard {
+	h := fnv.New32a()
+	h.Write([]byte(prefix))
+	return &f.shards[h.Sum32()%factorCacheShardCount]
+}
+
+// Retrieves the sequence block for a namespace/id prefix.
+func (f *Factors) sequence(prefix string) *factorSequence {
+	f.mutex.Lock()
+	defer f.mutex.Unlock()
+	seq := f.sequences[prefix]
+	if seq == nil {
+		seq = &factorSequence{}
+		f.sequences[prefix] = seq
+	}
+	return seq
+}
+
+// Retrieves the dictionary for a namespace/id prefix.
+func (f *Factors) dictionary(prefix string) *factorDictionary {
+	f.mutex.Lock()
+	defer f.mutex.Unlock()
+	dict := f.dicts[prefix]
+	if dict == nil {
+		dict = &factorDictionary{}
+		f.dicts[prefix] = dict
+	}
+	return dict
+}
+
+// Retrieves the snapshot for a namespace/id prefix. Returns nil if the
+// factors aren't open.
+func (f *Factors) snapshot(prefix string) *factorSnapshot {
+	f.mutex.Lock()
+	defer f.mutex.Unlock()
+	if f.snapshots == nil {
+		return nil
+	}
+	snapshot := f.snapshots[prefix]
+	if snapshot == nil {
+		snapshot = &factorSnapshot{path: factorSnapshotPath(f.SnapshotPath(), prefix), prefix: prefix}
+		f.snapshots[prefix] = snapshot
+	}
+	return snapshot
+}
+
+// Adds a value and its sequence to a cache shard. The reverse direction is
+// only cached for sequences that don't fit in a dictionary.
+func (f *Factors) cache(shard *factorCacheShard, prefix string, value string, sequence uint64) {
+	capacity := f.cacheSize / factorCacheShardCount
+	if capacity <= 0 {
+		return
+	}
+
+	shard.Lock()
+	defer shard.Unlock()
+
+	// Drop the shard once it's full rather than tracking recency on every
+	// read. Hot values are reloaded on their next lookup.
+	if len(shard.forward) >= capacity || len(shard.reverse) >= capacity {
+		shard.forward = make(map[string]uint64)
+		shard.reverse = make(map[string]string)
+	}
+	shard.forward[prefix+value] = sequence
+	if sequence >= maxFactorDictionarySize {
+		shard.reverse[prefix+strconv.FormatUint(sequence, 10)] = value
+	}
+}
+
+// Retrieves a cached sequence by its forward key.
+func (s *factorCacheShard) get(key string) (uint64, bool) {
+	s.RLock()
+	defer s.RUnlock()
+	sequence, ok := s.forward[key]
+	return sequence, ok
+}
+
+// Retrieves a cached value by its reverse key.
+func (s *factorCacheShard) getReverse(key string) (string, bool) {
+	s.RLock()
+	defer s.RUnlock()
+	value, ok := s.reverse[key]
+	return value, ok
+}
+
+// Stores the value for a sequence if it fits in the dictionary. The array
+// grows geometrically so sequences issued in order append cheaply.
+func (d *factorDictionary) set(sequence uint64, value string) {
+	if sequence == 0 || sequence >= maxFactorDictionarySize {
+		return
+	}
+
+	d.Lock()
+	defer d.Unlock()
+	if sequence >= uint64(len(d.values)) {
+		if sequence >= uint64(cap(d.values)) {
+			size := 2*sequence + 1
+			if size > maxFactorDictionarySize {
+				size = maxFactorDictionarySize
+			}
+			values := make([]string, sequence+1, size)
+			copy(values, d.values)
+			d.values = values
+		} else {
+			d.values = d.values[:sequence+1]
+		}
+	}
+	d.values[sequence] = value
+}
+
+// Removes all cached values from the shard.
+func (s *factorCacheShard) clear() {
+	s.Lock()
+	defer s.Unlock()
+	s.forward = make(map[string]uint64)
+	s.reverse = make(map[string]string)
 }
@@ -4,6 +4,7 @@ import (
 	"fmt"
 	"io/ioutil"
 	"os"
+	"sync"
 	"testing"
 )
 
@@ -38,3 +39,221 @@ func TestFactorization(t *testing.T) {
 		t.Fatalf("Wrong defactorization: exp: %v, got: %v (%v)", "/about.html", str, err)
 	}
 }
+
+// Ensure that several values can be factorized at once and that repeated
+// values within a batch share a sequence.
+func TestFactorizeValues(t *testing.T) {
+	path, err := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	path = fmt.Sprintf("%v/factors", path)
+
+	factors := NewFactors(path)
+	defer factors.Close()
+	if err = factors.Open(); err != nil {
+		t.Fatalf("Unable to create factors: %v", err)
+	}
+
+	ids := []string{"bar", "baz", "bar", "bar"}
+	values := []string{"/index.html", "/index.html", "", "/index.html"}
+	if _, err = factors.FactorizeValues("foo", ids, values, false); err == nil {
+		t.Fatalf("Expected factor not found error")
+	}
+	nums, err := factors.FactorizeValues("foo", ids, values, true)
+	if err != nil || fmt.Sprint(nums) != "[1 1 0 1]" {
+		t.Fatalf("Wrong factorization: exp: %v, got: %v (%v)", "[1 1 0 1]", nums, err)
+	}
+	nums, err = factors.FactorizeValues("foo", []string{"bar", "baz"}, []string{"/about.html", "/index.html"}, true)
+	if err != nil || fmt.Sprint(nums) != "[2 1]" {
+		t.Fatalf("Wrong factorization: exp: %v, got: %v (%v)", "[2 1]", nums, err)
+	}
+}
+
+// Ensure that factors are persisted outside the cache and that sequences
+// continue after the reserved block when reopened.
+func TestFactorizationReopen(t *testing.T) {
+	path, err := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	path = fmt.Sprintf("%v/factors", path)
+
+	factors := NewFactors(path)
+	defer factors.Close()
+	if err = factors.Open(); err != nil {
+		t.Fatalf("Unable to create factors: %v", err)
+	}
+	factors.SetCacheSize(0)
+	if num, err := factors.Factorize("foo", "bar", "/index.html", true); err != nil || num != 1 {
+		t.Fatalf("Wrong factorization: exp: %v, got: %v (%v)", 1, num, err)
+	}
+	factors.Close()
+
+	if err = factors.Open(); err != nil {
+		t.Fatalf("Unable to reopen factors: %v", err)
+	}
+	if num, err := factors.Factorize("foo", "bar", "/index.html", false); err != nil || num != 1 {
+		t.Fatalf("Wrong factorization: exp: %v, got: %v (%v)", 1, num, err)
+	}
+	if num, err := factors.Factorize("foo", "bar", "/about.html", true); err != nil || num != factorSequenceBlockSize+1 {
+		t.Fatalf("Wrong factorization: exp: %v, got: %v (%v)", factorSequenceBlockSize+1, num, err)
+	}
+	if str, err := factors.Defactorize("foo", "bar", 1); err != nil || str != "/index.html" {
+		t.Fatalf("Wrong defactorization: exp: %v, got: %v (%v)", "/index.html", str, err)
+	}
+}
+
+// Ensure that large batches missing from the cache are read back from the
+// database in a single pass.
+func TestFactorizeValuesUncached(t *testing.T) {
+	path, err := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	path = fmt.Sprintf("%v/factors", path)
+
+	factors := NewFactors(path)
+	defer factors.Close()
+	if err = factors.Open(); err != nil {
+		t.Fatalf("Unable to create factors: %v", err)
+	}
+	factors.SetCacheSize(0)
+
+	var ids, values []string
+	for i := 0; i < factorMultiGetSize*4; i++ {
+		ids = append(ids, []string{"bar", "baz"}[i%2])
+		values = append(values, fmt.Sprintf("/%d.html", (i*7)%(factorMultiGetSize*2)))
+	}
+	created, err := factors.FactorizeValues("foo", ids, values, true)
+	if err != nil {
+		t.Fatalf("Unable to factorize: %v", err)
+	}
+	factors.SetCacheSize(0)
+	nums, err := factors.FactorizeValues("foo", ids, values, false)
+	if err != nil || fmt.Sprint(nums) != fmt.Sprint(created) {
+		t.Fatalf("Wrong factorization: exp: %v, got: %v (%v)", created, nums, err)
+	}
+	for i := range values {
+		if str, err := factors.Defactorize("foo", ids[i], nums[i]); err != nil || str != values[i] {
+			t.Fatalf("Wrong defactorization: exp: %v, got: %v (%v)", values[i], str, err)
+		}
+	}
+}
+
+// Ensure that factors are served from the snapshots after a restart and
+// that logs left by a crash are merged when the snapshots are opened.
+func TestFactorizationSnapshot(t *testing.T) {
+	path, err := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	path = fmt.Sprintf("%v/factors", path)
+
+	factors := NewFactors(path)
+	defer factors.Close()
+	if err = factors.Open(); err != nil {
+		t.Fatalf("Unable to create factors: %v", err)
+	}
+	factors.FactorizeValues("foo", []string{"bar", "bar"}, []string{"/index.html", "/about.html"}, true)
+	factors.Close()
+
+	if err = factors.Open(); err != nil {
+		t.Fatalf("Unable to reopen factors: %v", err)
+	}
+	snapshot := factors.snapshot(factors.prefix("foo", "bar"))
+	if num, ok := snapshot.sequence("/about.html"); !ok || num != 2 {
+		t.Fatalf("Wrong snapshot sequence: exp: %v, got: %v", 2, num)
+	}
+	if str, ok := snapshot.value(1); !ok || str != "/index.html" {
+		t.Fatalf("Wrong snapshot value: exp: %v, got: %v", "/index.html", str)
+	}
+	if _, ok := snapshot.sequence("/contact.html"); ok {
+		t.Fatalf("Unexpected snapshot sequence")
+	}
+
+	// Leave a log behind as if the server crashed.
+	if num, err := factors.Factorize("foo", "bar", "/contact.html", true); err != nil || num != factorSequenceBlockSize+1 {
+		t.Fatalf("Wrong factorization: exp: %v, got: %v (%v)", factorSequenceBlockSize+1, num, err)
+	}
+	snapshots, err := openFactorSnapshots(factors.SnapshotPath())
+	if err != nil {
+		t.Fatalf("Unable to open snapshots: %v", err)
+	}
+	merged := snapshots[factors.prefix("foo", "bar")]
+	defer merged.close()
+	if num, ok := merged.sequence("/contact.html"); !ok || num != factorSequenceBlockSize+1 {
+		t.Fatalf("Wrong merged sequence: exp: %v, got: %v", factorSequenceBlockSize+1, num)
+	}
+	if str, ok := merged.value(2); !ok || str != "/about.html" {
+		t.Fatalf("Wrong merged value: exp: %v, got: %v", "/about.html", str)
+	}
+}
+
+// Ensure that concurrent writers agree on the sequence for each value.
+func TestFactorizationConcurrent(t *testing.T) {
+	path, err := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	path = fmt.Sprintf("%v/factors", path)
+
+	factors := NewFactors(path)
+	defer factors.Close()
+	if err = factors.Open(); err != nil {
+		t.Fatalf("Unable to create factors: %v", err)
+	}
+
+	var wg sync.WaitGroup
+	results := make([][]uint64, 8)
+	for i := range results {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			for j := 0; j < 100; j++ {
+				num, err := factors.Factorize("foo", "bar", fmt.Sprintf("/%d.html", j), true)
+				if err != nil {
+					t.Errorf("Unable to factorize: %v", err)
+				}
+				results[i] = append(results[i], num)
+			}
+		}(i)
+	}
+	wg.Wait()
+
+	for j := 0; j < 100; j++ {
+		for i := range results {
+			if results[i][j] != results[0][j] {
+				t.Fatalf("Mismatched sequence for /%d.html: %v != %v", j, results[i][j], results[0][j])
+			}
+		}
+		str, err := factors.Defactorize("foo", "bar", results[0][j])
+		if err != nil || str != fmt.Sprintf("/%d.html", j) {
+			t.Fatalf("Wrong defactorization: exp: /%d.html, got: %v (%v)", j, str, err)
+		}
+	}
+}
+
+// Ensure that several values can be defactorized at once, both for values
+// created by this process and ones that are only on disk.
+func TestDefactorizeValues(t *testing.T) {
+	path, err := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	path = fmt.Sprintf("%v/factors", path)
+
+	factors := NewFactors(path)
+	defer factors.Close()
+	if err = factors.Open(); err != nil {
+		t.Fatalf("Unable to create factors: %v", err)
+	}
+	if _, err = factors.FactorizeValues("foo", []string{"bar", "bar"}, []string{"/index.html", "/about.html"}, true); err != nil {
+		t.Fatalf("Unable to factorize: %v", err)
+	}
+	strs, err := factors.DefactorizeValues("foo", "bar", []uint64{2, 0, 1, 2})
+	if err != nil || fmt.Sprintf("%q", strs) != `["/about.html" "" "/index.html" "/about.html"]` {
+		t.Fatalf("Wrong defactorization: got: %q (%v)", strs, err)
+	}
+
+	// Reopen so the values have to be loaded into the dictionary.
+	factors.Close()
+	if err = factors.Open(); err != nil {
+		t.Fatalf("Unable to reopen factors: %v", err)
+	}
+	strs, err = factors.DefactorizeValues("foo", "bar", []uint64{1, 2})
+	if err != nil || fmt.Sprintf("%q", strs) != `["/index.html" "/about.html"]` {
+		t.Fatalf("Wrong defactorization: got: %q (%v)", strs, err)
+	}
+	if _, err = factors.DefactorizeValues("foo", "bar", []uint64{3}); err == nil {
+		t.Fatalf("Expected missing value error")
+	}
+}
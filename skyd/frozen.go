@@ -0,0 +1,620 @@
+package skyd
+
+import (
+	"bufio"
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"github.com/jmhodges/levigo"
+	"io/ioutil"
+	"math"
+	"os"
+	"path/filepath"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"syscall"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// A frozen file holds objects of a single table that were moved out of a
+// servlet's LevelDB database because they no longer change. Each object is
+// stored whole, as its state followed by its indexed event stream, so that
+// the cursor can read it in place from the mapped file. The objects are
+// followed by their keys and an index of fixed size entries sorted by key.
+// Everything is little endian:
+//
+//	objects, keys,
+//	index entries of data offset (8), data size (4), key offset (4),
+//	footer of index offset (8), keys offset (8), count (4), version (4),
+//	first ts (8), last ts (8), magic (8)
+//
+// Frozen files are stored in the "frozen" directory of the servlet and are
+// named after the hex encoded table prefix and a sequence number.
+const (
+	frozenFileVersion    = 1
+	frozenFileMagic      = 0x4e455a4f5246594b
+	frozenFileFooterSize = 48
+	frozenIndexEntrySize = 16
+	frozenFileExt        = ".frz"
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A read-only, memory mapped frozen file. The mapping is reference counted
+// so that a file that's dropped while being scanned stays mapped until the
+// scan releases it.
+type frozenFile struct {
+	sync.Mutex
+	path    string
+	data    []byte
+	index   []byte
+	keys    []byte
+	count   int
+	first   int64
+	last    int64
+	refs    int
+	dropped bool
+}
+
+// Writes a frozen file from objects added in key order.
+type frozenFileWriter struct {
+	file    *os.File
+	writer  *bufio.Writer
+	offset  uint64
+	keys    bytes.Buffer
+	entries bytes.Buffer
+	count   int
+	first   int64
+	last    int64
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Maps a frozen file into memory and validates its footer.
+func openFrozenFile(path string) (*frozenFile, error) {
+	file, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer file.Close()
+	info, err := file.Stat()
+	if err != nil {
+		return nil, err
+	}
+	size := info.Size()
+	if size < frozenFileFooterSize {
+		return nil, fmt.Errorf("skyd.FrozenFile: Invalid file size: %v", path)
+	}
+	data, err := syscall.Mmap(int(file.Fd()), 0, int(size), syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		return nil, err
+	}
+
+	f := &frozenFile{path: path, data: data, refs: 1}
+	footer := data[len(data)-frozenFileFooterSize:]
+	indexOffset := binary.LittleEndian.Uint64(footer)
+	keysOffset := binary.LittleEndian.Uint64(footer[8:])
+	f.count = int(binary.LittleEndian.Uint32(footer[16:]))
+	version := binary.LittleEndian.Uint32(footer[20:])
+	f.first = int64(binary.LittleEndian.Uint64(footer[24:]))
+	f.last = int64(binary.LittleEndian.Uint64(footer[32:]))
+	magic := binary.LittleEndian.Uint64(footer[40:])
+
+	indexEnd := uint64(len(data) - frozenFileFooterSize)
+	if magic != frozenFileMagic || version != frozenFileVersion || keysOffset > indexOffset ||
+		indexOffset+uint64(f.count)*frozenIndexEntrySize != indexEnd {
+		syscall.Munmap(data)
+		return nil, fmt.Errorf("skyd.FrozenFile: Invalid footer: %v", path)
+	}
+	f.keys = data[keysOffset:indexOffset]
+	f.index = data[indexOffset:indexEnd]
+	return f, nil
+}
+
+// Creates a writer for a new frozen file at a given path.
+func newFrozenFileWriter(path string) (*frozenFileWriter, error) {
+	file, err := os.OpenFile(path, os.O_WRONLY|os.O_CREATE|os.O_TRUNC, 0600)
+	if err != nil {
+		return nil, err
+	}
+	return &frozenFileWriter{file: file, writer: bufio.NewWriter(file), first: math.MaxInt64, last: math.MinInt64}, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Frozen File
+//--------------------------------------
+
+// Adds a reference to the mapping. Returns false if the file has already
+// been dropped.
+func (f *frozenFile) acquire() bool {
+	f.Lock()
+	defer f.Unlock()
+	if f.dropped {
+		return false
+	}
+	f.refs++
+	return true
+}
+
+// Adds another reference to the mapping on behalf of a holder of one.
+func (f *frozenFile) retain() {
+	f.Lock()
+	f.refs++
+	f.Unlock()
+}
+
+// Releases a reference to the mapping and unmaps the file once the last one
+// is gone.
+func (f *frozenFile) release() {
+	f.Lock()
+	defer f.Unlock()
+	f.refs--
+	if f.refs == 0 && f.data != nil {
+		syscall.Munmap(f.data)
+		f.data, f.index, f.keys = nil, nil, nil
+	}
+}
+
+// Stops handing out new references and releases the servlet's own.
+func (f *frozenFile) drop() {
+	f.Lock()
+	dropped := f.dropped
+	f.dropped = true
+	f.Unlock()
+	if !dropped {
+		f.release()
+	}
+}
+
+// Checks if any event in the file could fall in a shifted time range.
+func (f *frozenFile) overlaps(start int64, end int64) bool {
+	return f.count > 0 && f.last >= start && f.first < end
+}
+
+// Returns the key of the object at an index position.
+func (f *frozenFile) key(i int) []byte {
+	start := binary.LittleEndian.Uint32(f.index[i*frozenIndexEntrySize+12:])
+	end := uint32(len(f.keys))
+	if i+1 < f.count {
+		end = binary.LittleEndian.Uint32(f.index[(i+1)*frozenIndexEntrySize+12:])
+	}
+	return f.keys[start:end]
+}
+
+// Returns the stored value of the object at an index position.
+func (f *frozenFile) object(i int) []byte {
+	entry := f.index[i*frozenIndexEntrySize:]
+	offset := binary.LittleEndian.Uint64(entry)
+	size := uint64(binary.LittleEndian.Uint32(entry[8:]))
+	return f.data[offset : offset+size]
+}
+
+// Returns the index position of an object key or -1 if the file doesn't
+// hold the object.
+func (f *frozenFile) find(key []byte) int {
+	i := sort.Search(f.count, func(i int) bool { return bytes.Compare(f.key(i), key) >= 0 })
+	if i < f.count && bytes.Equal(f.key(i), key) {
+		return i
+	}
+	return -1
+}
+
+//--------------------------------------
+// Frozen File Writer
+//--------------------------------------
+
+// Appends an object's stored value. Objects must be added in key order.
+func (w *frozenFileWriter) add(key []byte, value []byte, first int64, last int64) error {
+	if len(value) > math.MaxUint32 || w.keys.Len()+len(key) > math.MaxUint32 {
+		return errors.New("skyd.FrozenFile: Object too large")
+	}
+	var entry [frozenIndexEntrySize]byte
+	binary.LittleEndian.PutUint64(entry[:], w.offset)
+	binary.LittleEndian.PutUint32(entry[8:], uint32(len(value)))
+	binary.LittleEndian.PutUint32(entry[12:], uint32(w.keys.Len()))
+	w.entries.Write(entry[:])
+	w.keys.Write(key)
+	if _, err := w.writer.Write(value); err != nil {
+		return err
+	}
+	w.offset += uint64(len(value))
+	w.count++
+	if first < w.first {
+		w.first = first
+	}
+	if last > w.last {
+		w.last = last
+	}
+	return nil
+}
+
+// Writes the keys, the index and the footer and syncs the file to disk.
+func (w *frozenFileWriter) finish() error {
+	defer w.file.Close()
+	keysOffset := w.offset
+	indexOffset := keysOffset + uint64(w.keys.Len())
+	var footer [frozenFileFooterSize]byte
+	binary.LittleEndian.PutUint64(footer[:], indexOffset)
+	binary.LittleEndian.PutUint64(footer[8:], keysOffset)
+	binary.LittleEndian.PutUint32(footer[16:], uint32(w.count))
+	binary.LittleEndian.PutUint32(footer[20:], frozenFileVersion)
+	binary.LittleEndian.PutUint64(footer[24:], uint64(w.first))
+	binary.LittleEndian.PutUint64(footer[32:], uint64(w.last))
+	binary.LittleEndian.PutUint64(footer[40:], frozenFileMagic)
+	for _, b := range [][]byte{w.keys.Bytes(), w.entries.Bytes(), footer[:]} {
+		if _, err := w.writer.Write(b); err != nil {
+			return err
+		}
+	}
+	if err := w.writer.Flush(); err != nil {
+		return err
+	}
+	return w.file.Sync()
+}
+
+// Discards an unfinished file.
+func (w *frozenFileWriter) abort() {
+	w.file.Close()
+	os.Remove(w.file.Name())
+}
+
+//--------------------------------------
+// Servlets
+//--------------------------------------
+
+// The directory that the servlet's frozen files are stored in. LevelDB
+// ignores it since it doesn't parse as one of its own files.
+func (s *Servlet) frozenPath() string {
+	return filepath.Join(s.path, "frozen")
+}
+
+// Maps every frozen file of the servlet when it's opened. Files left behind
+// by an interrupted freeze are removed.
+func (s *Servlet) openFrozenFiles() error {
+	infos, err := ioutil.ReadDir(s.frozenPath())
+	if os.IsNotExist(err) {
+		return nil
+	} else if err != nil {
+		return err
+	}
+
+	s.frozen = make(map[string][]*frozenFile)
+	for _, info := range infos {
+		name := info.Name()
+		if strings.HasSuffix(name, ".tmp") {
+			os.Remove(filepath.Join(s.frozenPath(), name))
+			continue
+		}
+		prefix, seq, ok := parseFrozenFileName(name)
+		if !ok {
+			continue
+		}
+		f, err := openFrozenFile(filepath.Join(s.frozenPath(), name))
+		if err != nil {
+			s.closeFrozenFiles()
+			return err
+		}
+		s.frozen[string(prefix)] = append(s.frozen[string(prefix)], f)
+		if seq >= s.frozenSeq {
+			s.frozenSeq = seq + 1
+		}
+	}
+	return nil
+}
+
+// Releases the servlet's references to its frozen files.
+func (s *Servlet) closeFrozenFiles() {
+	s.frozenMutex.Lock()
+	defer s.frozenMutex.Unlock()
+	for _, files := range s.frozen {
+		for _, f := range files {
+			f.drop()
+		}
+	}
+	s.frozen = nil
+}
+
+// Splits a frozen file name into its table prefix and sequence number.
+func parseFrozenFileName(name string) ([]byte, uint64, bool) {
+	if !strings.HasSuffix(name, frozenFileExt) {
+		return nil, 0, false
+	}
+	parts := strings.Split(strings.TrimSuffix(name, frozenFileExt), "-")
+	if len(parts) != 2 {
+		return nil, 0, false
+	}
+	var prefix []byte
+	if _, err := fmt.Sscanf(parts[0], "%x", &prefix); err != nil {
+		return nil, 0, false
+	}
+	seq, err := strconv.ParseUint(parts[1], 10, 64)
+	if err != nil {
+		return nil, 0, false
+	}
+	return prefix, seq, true
+}
+
+// Takes a snapshot of the servlet's database along with references to the
+// frozen files of a table prefix. Freezing moves objects between the two
+// atomically with respect to this so a scan of both sees every object once.
+// The buffered objects of the table are written first. If that fails they
+// stay in the buffer and the snapshot is taken without them. The snapshot
+// and the files must be released by the caller.
+func (s *Servlet) snapshotFrozen(prefix []byte) (*levigo.Snapshot, []*frozenFile) {
+	s.unbufferTable(prefix)
+	s.frozenMutex.RLock()
+	defer s.frozenMutex.RUnlock()
+	snapshot := s.db.NewSnapshot()
+	files := make([]*frozenFile, 0)
+	for _, f := range s.frozen[string(prefix)] {
+		if f.acquire() {
+			files = append(files, f)
+		}
+	}
+	return snapshot, files
+}
+
+// Returns a copy of the stored value of an object from the frozen files of
+// a table prefix or nil if none of them holds it.
+func (s *Servlet) getFrozenObject(prefix []byte, key []byte) []byte {
+	s.frozenMutex.RLock()
+	defer s.frozenMutex.RUnlock()
+	files := s.frozen[string(prefix)]
+	for i := len(files) - 1; i >= 0; i-- {
+		if index := files[i].find(key); index >= 0 {
+			return append([]byte{}, files[i].object(index)...)
+		}
+	}
+	return nil
+}
+
+// Removes the frozen files of a table prefix. Files that are being scanned
+// are unmapped once their scans finish.
+func (s *Servlet) dropFrozenFiles(prefix []byte) error {
+	s.frozenMutex.Lock()
+	files := s.frozen[string(prefix)]
+	delete(s.frozen, string(prefix))
+	s.frozenMutex.Unlock()
+
+	for _, f := range files {
+		f.drop()
+		if err := os.Remove(f.path); err != nil && !os.IsNotExist(err) {
+			return err
+		}
+	}
+	return nil
+}
+
+// Moves every object of a table whose last event is before a given time
+// into a new frozen file and removes it from the database. A zero time
+// freezes every object. Returns the number of objects frozen.
+//
+// Queries read frozen objects in place from the mapped file. Writes to an
+// object after it's frozen start a new object in the database that queries
+// see separately, so only data that no longer changes should be frozen. A
+// crash between writing the file and removing the objects from the
+// database leaves them in both.
+func (s *Servlet) Freeze(table *Table, before time.Time) (int, error) {
+	if s.db == nil {
+		return 0, fmt.Errorf("Servlet is not open: %v", s.path)
+	}
+
+	// Memory tables aren't written to disk, and stores only hold their own
+	// table.
+	if table.InMemory() {
+		return 0, fmt.Errorf("skyd.Servlet: Memory tables can't be frozen: %s", table.Name)
+	} else if s.storeTable != nil && s.storeTable.Name != table.Name {
+		return 0, nil
+	}
+	prefix, err := table.Prefix()
+	if err != nil {
+		return 0, err
+	}
+
+	s.Lock()
+	defer s.Unlock()
+
+	if err := os.MkdirAll(s.frozenPath(), 0700); err != nil {
+		return 0, err
+	}
+	name := fmt.Sprintf("%x-%d%s", prefix, s.frozenSeq, frozenFileExt)
+	path := filepath.Join(s.frozenPath(), name)
+	w, err := newFrozenFileWriter(path + ".tmp")
+	if err != nil {
+		return 0, err
+	}
+
+	// Gather each object's head and chunks and write them out whole.
+	batch := levigo.NewWriteBatch()
+	defer batch.Close()
+	keys, err := s.freezeObjects(prefix, before, w, batch)
+	if err == nil {
+		err = w.finish()
+	}
+	if err != nil || len(keys) == 0 {
+		w.abort()
+		return 0, err
+	}
+	if err = os.Rename(path+".tmp", path); err != nil {
+		os.Remove(path + ".tmp")
+		return 0, err
+	}
+	f, err := openFrozenFile(path)
+	if err != nil {
+		os.Remove(path)
+		return 0, err
+	}
+
+	// The stored zones are resummarized without the frozen objects. Rollup
+	// rows and table counts are kept since queries still read the frozen
+	// events.
+	batchDeleteRange(batch, append(append([]byte{}, prefix...), zoneMarker), factorIndexKey(prefix, rollupDefinitionKind, 0))
+	batchDeleteRange(batch, incrementKey(factorIndexKey(prefix, tableStatsKind, 0)), append(append([]byte{}, prefix...), zoneMarker+1))
+
+	// Remove the objects and publish the file in one step for queries. The
+	// removal isn't added to the change log so replicas keep serving the
+	// objects from their own databases.
+	s.frozenMutex.Lock()
+	wo := levigo.NewWriteOptions()
+	err = s.db.Write(wo, batch)
+	wo.Close()
+	if err == nil {
+		if s.frozen == nil {
+			s.frozen = make(map[string][]*frozenFile)
+		}
+		s.frozen[string(prefix)] = append(s.frozen[string(prefix)], f)
+		s.frozenSeq++
+	}
+	s.frozenMutex.Unlock()
+	if err != nil {
+		f.drop()
+		os.Remove(path)
+		return 0, err
+	}
+
+	s.dropZoneMap(prefix)
+	s.bumpVersion()
+	return len(keys), nil
+}
+
+// Writes the objects of a table that are older than a given time to a
+// frozen file and adds their removal to a batch. Returns the keys of the
+// frozen objects.
+func (s *Servlet) freezeObjects(prefix []byte, before time.Time, w *frozenFileWriter, batch *levigo.WriteBatch) ([][]byte, error) {
+	ro := levigo.NewReadOptions()
+	ro.SetFillCache(false)
+	setSequentialScan(ro)
+	setPrefixSameAsStart(ro)
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+
+	var keys [][]byte
+	var key, tail []byte
+	var state *Event
+	var stream bytes.Buffer
+	var families [][]byte
+	flush := func() error {
+		if key == nil || state == nil || (!before.IsZero() && !state.Timestamp.Before(before)) {
+			return nil
+		}
+		stream.Write(tail)
+		data := stream.Bytes()
+
+		// Frozen files only hold one stream per object so property families
+		// are merged back into its events.
+		if len(families) > 0 {
+			events, err := DecodeEvents(data)
+			if err != nil {
+				return err
+			}
+			for _, family := range families {
+				if err = mergeFamilyEvents(events, family); err != nil {
+					return err
+				}
+			}
+			if data, err = s.encodeEventData(events); err != nil {
+				return err
+			}
+		}
+		index, err := newEventIndex(data)
+		if err != nil {
+			return err
+		}
+		value, err := encodeObject(state, data)
+		if err != nil {
+			return err
+		}
+		first, last := int64(math.MaxInt64), int64(math.MinInt64)
+		if index != nil {
+			first, last = index.first, index.last
+		}
+		if err = w.add(key, value, first, last); err != nil {
+			return err
+		}
+		batchDeleteRange(batch, append(append([]byte{}, key...), objectChunkMarker), append(append([]byte{}, key...), objectFamilyMarker+1))
+		batch.Delete(key)
+		keys = append(keys, key)
+		return nil
+	}
+
+	for iterator.Seek(prefix); iterator.Valid(); iterator.Next() {
+		k := iterator.Key()
+		if !bytes.HasPrefix(k, prefix) {
+			break
+		}
+		if isZoneKey(k, len(prefix)) {
+			continue
+		}
+
+		// Chunks follow their head in time order and hold the events that
+		// come before its tail.
+		if key != nil && isObjectChunkKey(key, k) {
+			_, data, err := splitEventIndex(iterator.Value())
+			if err != nil {
+				return nil, err
+			}
+			stream.Write(data)
+			continue
+		}
+
+		// The state follows the chunks. Older objects keep it in their head.
+		if key != nil && isObjectStateKey(key, k) {
+			var err error
+			if state, _, err = decodeObjectState(iterator.Value()); err != nil {
+				return nil, err
+			}
+			continue
+		}
+
+		// Property families follow the state.
+		if key != nil && isObjectFamilyKey(key, k) {
+			_, data, err := decodeObject(iterator.Value())
+			if err != nil {
+				return nil, err
+			}
+			families = append(families, data)
+			continue
+		}
+		if err := flush(); err != nil {
+			return nil, err
+		}
+		var err error
+		key = k
+		if state, tail, err = decodeObject(iterator.Value()); err != nil {
+			return nil, err
+		}
+		stream.Reset()
+		families = nil
+	}
+	if err := iterator.GetError(); err != nil {
+		return nil, err
+	}
+	if err := flush(); err != nil {
+		return nil, err
+	}
+	return keys, nil
+}
@@ -0,0 +1,246 @@
+package skyd
+
+import (
+	"container/heap"
+	"encoding/binary"
+	"fmt"
+	"sort"
+	"sync"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of objects tracked by each hot object sketch of a table.
+const hotObjectSlots = 256
+
+// The number of the heaviest objects of each engine's scan that are added
+// to its table's scan sketch.
+const hotObjectScanSlots = 16
+
+// The number of hot objects listed when no count is given.
+const DefaultHotObjectCount = 20
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A HotObject is an object that a large share of a table's writes or scans
+// went to. Its weight never underestimates its share and the error is how
+// much of the weight might belong to objects it replaced in the sketch.
+type HotObject struct {
+	Id     string `json:"id"`
+	Weight int64  `json:"weight"`
+	Error  int64  `json:"error"`
+}
+
+// The hot objects of a table since the server opened it: the events and
+// bytes written to each object and the events that queries decoded from
+// them. Writes are weighed as each object's changes are committed and the
+// bytes include every key rewritten for it, so they show the objects that
+// drive write amplification. Scans only add the heaviest objects of each
+// engine's scan, which are tracked in C by the cursor.
+type tableHotObjects struct {
+	sync.Mutex
+	writes     *spaceSaving
+	writeBytes *spaceSaving
+	scans      *spaceSaving
+}
+
+// Tracks the heaviest keys of a stream in a fixed number of slots with the
+// space-saving algorithm, like csky's sky_topk does for queries. A key that
+// isn't tracked when every slot is taken replaces the key in the lightest
+// slot and inherits its weight as its error.
+type spaceSaving struct {
+	capacity int
+	slots    map[string]*spaceSavingSlot
+	heap     spaceSavingHeap
+}
+
+type spaceSavingSlot struct {
+	key    string
+	weight int64
+	error  int64
+	index  int
+}
+
+// Hot objects ordered heaviest first.
+type hotObjectList []*HotObject
+
+// The slots of a sketch in a min-heap by weight.
+type spaceSavingHeap []*spaceSavingSlot
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+func newTableHotObjects() *tableHotObjects {
+	return &tableHotObjects{
+		writes:     newSpaceSaving(hotObjectSlots),
+		writeBytes: newSpaceSaving(hotObjectSlots),
+		scans:      newSpaceSaving(hotObjectSlots),
+	}
+}
+
+func newSpaceSaving(capacity int) *spaceSaving {
+	return &spaceSaving{capacity: capacity, slots: make(map[string]*spaceSavingSlot)}
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// The key that an object of a scan is tracked under: the index of the
+// servlet it was read from followed by its encoded key, since ids of tables
+// with hashed keys can only be recovered from the object's servlet.
+func hotScanKey(servlet int, key string) string {
+	var b [2]byte
+	binary.BigEndian.PutUint16(b[:], uint16(servlet))
+	return string(b[:]) + key
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Server
+//--------------------------------------
+
+// Returns the heaviest objects of a table by events written, bytes written
+// and events scanned since the table was opened, along with the most
+// frequent values of each property from the table's statistics, which
+// shows the hot factors. Scanned objects whose id can't be recovered are
+// listed by their encoded key in hex.
+func (s *Server) HotObjects(table *Table, n int) (map[string]interface{}, error) {
+	prefix, err := table.Prefix()
+	if err != nil {
+		return nil, err
+	}
+	writes, writeBytes, scans := table.hot.top(n)
+	for _, o := range scans {
+		index, key := int(binary.BigEndian.Uint16([]byte(o.Id))), []byte(o.Id[2:])
+		if index < len(s.servlets) {
+			if id, err := s.servlets[index].scannedObjectId(table, prefix, key); err == nil && id != "" {
+				o.Id = id
+				continue
+			}
+		}
+		o.Id = fmt.Sprintf("%x", key)
+	}
+
+	values := make(map[string]interface{})
+	if stats := table.Statistics(); stats != nil {
+		obj, err := stats.Serialize(table, s.factors)
+		if err != nil {
+			return nil, err
+		}
+		for name, p := range obj["properties"].(map[string]interface{}) {
+			values[name] = p.(map[string]interface{})["frequent"]
+		}
+	}
+	return map[string]interface{}{"writes": writes, "writeBytes": writeBytes, "scans": scans, "values": values}, nil
+}
+
+//--------------------------------------
+// Table
+//--------------------------------------
+
+// Adds the events and bytes committed for an object.
+func (h *tableHotObjects) addWrite(objectId string, events int, bytes int) {
+	h.Lock()
+	defer h.Unlock()
+	h.writes.add(objectId, int64(events))
+	h.writeBytes.add(objectId, int64(bytes))
+}
+
+// Adds the heaviest objects of a scan of a servlet by their encoded keys.
+func (h *tableHotObjects) addScan(servlet int, objects map[string]int64) {
+	if len(objects) == 0 {
+		return
+	}
+	h.Lock()
+	defer h.Unlock()
+	for key, events := range objects {
+		h.scans.add(hotScanKey(servlet, key), events)
+	}
+}
+
+// Returns the heaviest objects by events written, bytes written and events
+// scanned. Scanned objects are listed by servlet index and encoded key.
+func (h *tableHotObjects) top(n int) ([]*HotObject, []*HotObject, []*HotObject) {
+	h.Lock()
+	defer h.Unlock()
+	return h.writes.top(n), h.writeBytes.top(n), h.scans.top(n)
+}
+
+//--------------------------------------
+// Sketch
+//--------------------------------------
+
+// Adds weight to a key.
+func (s *spaceSaving) add(key string, weight int64) {
+	if slot := s.slots[key]; slot != nil {
+		slot.weight += weight
+		heap.Fix(&s.heap, slot.index)
+		return
+	}
+	if len(s.heap) < s.capacity {
+		slot := &spaceSavingSlot{key: key, weight: weight}
+		s.slots[key] = slot
+		heap.Push(&s.heap, slot)
+		return
+	}
+	slot := s.heap[0]
+	delete(s.slots, slot.key)
+	slot.key, slot.error = key, slot.weight
+	slot.weight += weight
+	s.slots[key] = slot
+	heap.Fix(&s.heap, 0)
+}
+
+// Returns the heaviest keys, heaviest first.
+func (s *spaceSaving) top(n int) []*HotObject {
+	objects := make(hotObjectList, 0, len(s.heap))
+	for _, slot := range s.heap {
+		objects = append(objects, &HotObject{Id: slot.key, Weight: slot.weight, Error: slot.error})
+	}
+	sort.Sort(objects)
+	if n < len(objects) {
+		objects = objects[:n]
+	}
+	return objects
+}
+
+func (l hotObjectList) Len() int           { return len(l) }
+func (l hotObjectList) Less(i, j int) bool { return l[i].Weight > l[j].Weight }
+func (l hotObjectList) Swap(i, j int)      { l[i], l[j] = l[j], l[i] }
+
+func (h spaceSavingHeap) Len() int           { return len(h) }
+func (h spaceSavingHeap) Less(i, j int) bool { return h[i].weight < h[j].weight }
+func (h spaceSavingHeap) Swap(i, j int) {
+	h[i], h[j] = h[j], h[i]
+	h[i].index, h[j].index = i, j
+}
+func (h *spaceSavingHeap) Push(x interface{}) {
+	slot := x.(*spaceSavingSlot)
+	slot.index = len(*h)
+	*h = append(*h, slot)
+}
+func (h *spaceSavingHeap) Pop() interface{} {
+	old := *h
+	slot := old[len(old)-1]
+	*h = old[:len(old)-1]
+	return slot
+}
@@ -0,0 +1,265 @@
+package skyd
+
+import (
+	"bytes"
+	"container/list"
+	"crypto/sha1"
+	"encoding/binary"
+	"encoding/hex"
+	"fmt"
+	"hash/crc32"
+	"io/ioutil"
+	"os"
+	"sort"
+	"sync"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of bytes of compiled chunks held in memory by default. The
+// files on disk can take up to four times as much.
+const DefaultLuaBytecodeCacheSize = 64 * 1024 * 1024
+
+// The number of chunks written to disk between checks of the disk's size.
+const luaBytecodePruneInterval = 64
+
+// Marks the files written by the cache. The magic is followed by the
+// checksum of the bytecode so that damaged files are compiled again
+// instead of being run.
+var luaBytecodeMagic = []byte("SKYLUAC1")
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A LuaBytecodeCache keeps the bytecode of compiled query scripts so that
+// new engines load it instead of parsing the header and source again.
+// Chunks are keyed by a hash of the LuaJIT version and the full source,
+// whose header declares the structs of every property that the script
+// reads, so a change to the schema is a different chunk. The most recently
+// used chunks are held in memory and every chunk is written to a directory
+// so that they outlive a restart. The oldest files are removed once the
+// directory grows past four times the memory capacity.
+type LuaBytecodeCache struct {
+	sync.Mutex
+	path     string
+	capacity int
+	size     int
+	entries  map[string]*list.Element
+	lru      *list.List
+	puts     int
+	hits     int
+	misses   int
+}
+
+// A chunk held in memory.
+type luaBytecodeEntry struct {
+	key      string
+	bytecode []byte
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructor
+//
+//------------------------------------------------------------------------------
+
+// Creates a cache that holds up to a number of bytes of chunks in memory
+// and writes them to a directory. An empty path keeps chunks in memory
+// only.
+func NewLuaBytecodeCache(path string, capacity int) *LuaBytecodeCache {
+	return &LuaBytecodeCache{
+		path:     path,
+		capacity: capacity,
+		entries:  make(map[string]*list.Element),
+		lru:      list.New(),
+	}
+}
+
+//------------------------------------------------------------------------------
+//
+// Properties
+//
+//------------------------------------------------------------------------------
+
+// The directory that chunks are written to.
+func (c *LuaBytecodeCache) Path() string {
+	return c.path
+}
+
+// The number of chunks that were found and that had to be compiled.
+func (c *LuaBytecodeCache) Stats() (int, int) {
+	c.Lock()
+	defer c.Unlock()
+	return c.hits, c.misses
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// Generates the key of the chunk compiled from a source by a version of
+// LuaJIT.
+func (c *LuaBytecodeCache) key(version string, source string) string {
+	h := sha1.New()
+	fmt.Fprintf(h, "%s\x00", version)
+	h.Write([]byte(source))
+	return hex.EncodeToString(h.Sum(nil))
+}
+
+// Retrieves the bytecode of a chunk from memory or from disk. Returns nil
+// if the chunk was never compiled.
+func (c *LuaBytecodeCache) Get(key string) []byte {
+	c.Lock()
+	if elem := c.entries[key]; elem != nil {
+		c.lru.MoveToFront(elem)
+		c.hits++
+		c.Unlock()
+		return elem.Value.(*luaBytecodeEntry).bytecode
+	}
+	c.Unlock()
+
+	bytecode := c.read(key)
+
+	c.Lock()
+	defer c.Unlock()
+	if bytecode == nil {
+		c.misses++
+		return nil
+	}
+	c.hits++
+	c.add(key, bytecode)
+	return bytecode
+}
+
+// Adds the bytecode of a chunk to memory and writes it to disk.
+func (c *LuaBytecodeCache) Put(key string, bytecode []byte) error {
+	c.Lock()
+	c.add(key, bytecode)
+	c.puts++
+	prune := c.puts%luaBytecodePruneInterval == 0
+	c.Unlock()
+
+	if c.path == "" {
+		return nil
+	}
+	if err := c.write(key, bytecode); err != nil {
+		return err
+	}
+	if prune {
+		return c.prune()
+	}
+	return nil
+}
+
+// Adds a chunk to memory and evicts the least recently used chunks past
+// the capacity. The cache must be locked by the caller.
+func (c *LuaBytecodeCache) add(key string, bytecode []byte) {
+	if elem := c.entries[key]; elem != nil {
+		c.lru.MoveToFront(elem)
+		return
+	}
+	c.entries[key] = c.lru.PushFront(&luaBytecodeEntry{key, bytecode})
+	c.size += len(bytecode)
+	for c.size > c.capacity && c.lru.Len() > 0 {
+		entry := c.lru.Remove(c.lru.Back()).(*luaBytecodeEntry)
+		delete(c.entries, entry.key)
+		c.size -= len(entry.bytecode)
+	}
+}
+
+//--------------------------------------
+// Files
+//--------------------------------------
+
+// The path of the file of a chunk.
+func (c *LuaBytecodeCache) filePath(key string) string {
+	return fmt.Sprintf("%s/%s.luac", c.path, key)
+}
+
+// Reads a chunk from its file. Files that are missing or damaged read as
+// nil.
+func (c *LuaBytecodeCache) read(key string) []byte {
+	if c.path == "" {
+		return nil
+	}
+	b, err := ioutil.ReadFile(c.filePath(key))
+	if err != nil || len(b) < len(luaBytecodeMagic)+4 || !bytes.HasPrefix(b, luaBytecodeMagic) {
+		return nil
+	}
+	checksum := binary.LittleEndian.Uint32(b[len(luaBytecodeMagic):])
+	bytecode := b[len(luaBytecodeMagic)+4:]
+	if crc32.ChecksumIEEE(bytecode) != checksum {
+		os.Remove(c.filePath(key))
+		return nil
+	}
+	return bytecode
+}
+
+// Writes a chunk to its file. The file is written under a temporary name
+// and renamed so that readers never see part of it.
+func (c *LuaBytecodeCache) write(key string, bytecode []byte) error {
+	if err := os.MkdirAll(c.path, 0700); err != nil {
+		return err
+	}
+	b := make([]byte, len(luaBytecodeMagic)+4, len(luaBytecodeMagic)+4+len(bytecode))
+	copy(b, luaBytecodeMagic)
+	binary.LittleEndian.PutUint32(b[len(luaBytecodeMagic):], crc32.ChecksumIEEE(bytecode))
+	b = append(b, bytecode...)
+
+	tmp := c.filePath(key) + ".tmp"
+	if err := ioutil.WriteFile(tmp, b, 0600); err != nil {
+		return err
+	}
+	return os.Rename(tmp, c.filePath(key))
+}
+
+// Removes the least recently written files until the directory fits in
+// four times the memory capacity.
+func (c *LuaBytecodeCache) prune() error {
+	infos, err := ioutil.ReadDir(c.path)
+	if err != nil {
+		return err
+	}
+	var size int64
+	for _, info := range infos {
+		size += info.Size()
+	}
+	sort.Sort(fileInfosByModTime(infos))
+	for _, info := range infos {
+		if size <= int64(4*c.capacity) {
+			break
+		}
+		if err := os.Remove(fmt.Sprintf("%s/%s", c.path, info.Name())); err != nil && !os.IsNotExist(err) {
+			return err
+		}
+		size -= info.Size()
+	}
+	return nil
+}
+
+//--------------------------------------
+// Sorting
+//--------------------------------------
+
+type fileInfosByModTime []os.FileInfo
+
+func (l fileInfosByModTime) Len() int {
+	return len(l)
+}
+
+func (l fileInfosByModTime) Less(i, j int) bool {
+	return l[i].ModTime().Before(l[j].ModTime())
+}
+
+func (l fileInfosByModTime) Swap(i, j int) {
+	l[i], l[j] = l[j], l[i]
+}
@@ -16,6 +16,8 @@ int mp_pack(lua_State *L);
 
 int mp_unpack(lua_State *L);
 
+int mp_unpack_buffer(lua_State *L, const unsigned char *s, size_t len);
+
 #define LUACMSGPACK_VERSION     "lua-cmsgpack 0.3.0"
 #define LUACMSGPACK_COPYRIGHT   "Copyright (C) 2012, Salvatore Sanfilippo"
 #define LUACMSGPACK_DESCRIPTION "MessagePack C implementation for Lua"
@@ -699,6 +701,25 @@ int mp_unpack(lua_State *L) {
     return 1;
 }
 
+// Decodes msgpack held outside of Lua, such as in Go memory, straight onto
+// the stack without copying it into a Lua string first. Returns 0 and
+// leaves the stack as it was if the data is malformed instead of raising a
+// Lua error, so it can be called outside of a protected call.
+int mp_unpack_buffer(lua_State *L, const unsigned char *s, size_t len) {
+    mp_cur c;
+    int top = lua_gettop(L);
+
+    c.p = s;
+    c.left = len;
+    c.err = MP_CUR_ERROR_NONE;
+    mp_decode_to_lua_type(L,&c);
+    if (c.err != MP_CUR_ERROR_NONE || c.left != 0) {
+        lua_settop(L,top);
+        return 0;
+    }
+    return 1;
+}
+
 static const struct luaL_reg thislib[] = {
     {"pack", mp_pack},
     {"unpack", mp_unpack},
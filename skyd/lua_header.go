@@ -4,18 +4,30 @@ const LuaHeader = `
 -- SKY GENERATED CODE BEGIN --
 local ffi = require('ffi')
 ffi.cdef([[
-typedef struct sky_string_t { int32_t length; char *data; } sky_string_t;
+typedef struct sky_string_t { int32_t length; uint32_t code; char *data; } sky_string_t;
 typedef struct {
   {{range .}}{{structdef .}}
   {{end}}
   int64_t ts;
   uint32_t timestamp;
+  uint32_t prev_timestamp;
 } sky_lua_event_t;
 typedef struct sky_cursor_t { sky_lua_event_t *event; int32_t session_event_index; } sky_cursor_t;
+typedef struct {
+  uint32_t count;
+  uint32_t capacity;
+  int64_t *ts;
+  uint32_t *timestamp;
+  bool *session_start;
+  uint32_t *prev_timestamp;
+  {{range .}}{{batchstructdef .}}
+  {{end}}
+} sky_lua_batch_t;
 
 int sky_cursor_set_data_sz(sky_cursor_t *cursor, uint32_t sz);
 int sky_cursor_set_timestamp_offset(sky_cursor_t *cursor, uint32_t offset);
 int sky_cursor_set_ts_offset(sky_cursor_t *cursor, uint32_t offset);
+int sky_cursor_set_prev_timestamp_offset(sky_cursor_t *cursor, uint32_t offset);
 int sky_cursor_set_property(sky_cursor_t *cursor, int64_t property_id, uint32_t offset, uint32_t sz, const char *data_type);
 
 bool sky_cursor_has_next_object(sky_cursor_t *);
@@ -25,12 +37,40 @@ bool sky_cursor_eos(sky_cursor_t *);
 bool sky_lua_cursor_next_event(sky_cursor_t *);
 bool sky_lua_cursor_next_session(sky_cursor_t *);
 bool sky_cursor_set_session_idle(sky_cursor_t *, uint32_t);
+void *sky_cursor_set_batch(sky_cursor_t *cursor, uint32_t sz, uint32_t capacity);
+int sky_cursor_set_batch_column(sky_cursor_t *cursor, int64_t property_id, uint32_t offset);
+uint32_t sky_cursor_next_batch(sky_cursor_t *cursor);
+int sky_cursor_set_filter(sky_cursor_t *cursor, const char *code, uint32_t sz);
+void sky_cursor_mark_object(sky_cursor_t *cursor);
+int32_t sky_cursor_mark(sky_cursor_t *cursor);
+bool sky_cursor_restore(sky_cursor_t *cursor, int32_t mark);
+
+int64_t sky_timestamp_bucket(int64_t value, int64_t interval, int64_t offset);
+double sky_clock_ns();
+
+uint32_t sky_sketch_type_sz(uint8_t type);
+uint32_t sky_sketch_sz(const void *sketch);
+int sky_sketch_init(void *sketch, uint8_t type);
+int sky_sketch_merge(void *dest, const void *src);
+void sky_hll_add_double(void *sketch, double value);
+void sky_hll_add_string(void *sketch, const char *value, int32_t length);
+void sky_quantile_add(void *sketch, double value);
+uint32_t sky_histogram_sz(uint32_t buckets);
+int sky_histogram_init(void *sketch, double min, double max, uint32_t buckets);
+void sky_histogram_add(void *sketch, double value);
+
+typedef struct sky_topk sky_topk;
+sky_topk *sky_topk_new(uint32_t capacity);
+void sky_topk_free(sky_topk *topk);
+uint32_t sky_topk_insert(sky_topk *topk, double weight);
+void sky_topk_add(sky_topk *topk, uint32_t slot, double weight);
 ]])
 ffi.metatype('sky_cursor_t', {
   __index = {
     set_data_sz = function(cursor, sz) return ffi.C.sky_cursor_set_data_sz(cursor, sz) end,
     set_timestamp_offset = function(cursor, offset) return ffi.C.sky_cursor_set_timestamp_offset(cursor, offset) end,
     set_ts_offset = function(cursor, offset) return ffi.C.sky_cursor_set_ts_offset(cursor, offset) end,
+    set_prev_timestamp_offset = function(cursor, offset) return ffi.C.sky_cursor_set_prev_timestamp_offset(cursor, offset) end,
     set_action_id_offset = function(cursor, offset) return ffi.C.sky_cursor_set_action_id_offset(cursor, offset) end,
     set_property = function(cursor, property_id, offset, sz, data_type) return ffi.C.sky_cursor_set_property(cursor, property_id, offset, sz, data_type) end,
 
@@ -41,6 +81,13 @@ ffi.metatype('sky_cursor_t', {
     next = function(cursor) return ffi.C.sky_lua_cursor_next_event(cursor) end,
     next_session = function(cursor) return ffi.C.sky_lua_cursor_next_session(cursor) end,
     set_session_idle = function(cursor, seconds) return ffi.C.sky_cursor_set_session_idle(cursor, seconds) end,
+    set_batch = function(cursor, sz, capacity) return ffi.C.sky_cursor_set_batch(cursor, sz, capacity) end,
+    set_batch_column = function(cursor, property_id, offset) return ffi.C.sky_cursor_set_batch_column(cursor, property_id, offset) end,
+    next_batch = function(cursor) return ffi.C.sky_cursor_next_batch(cursor) end,
+    set_filter = function(cursor, code, sz) return ffi.C.sky_cursor_set_filter(cursor, code, sz) end,
+    mark = function(cursor) return ffi.C.sky_cursor_mark_object(cursor) end,
+    mark_event = function(cursor) return ffi.C.sky_cursor_mark(cursor) end,
+    restore = function(cursor, mark) return ffi.C.sky_cursor_restore(cursor, mark) end,
   }
 })
 ffi.metatype('sky_lua_event_t', {
@@ -49,6 +96,12 @@ ffi.metatype('sky_lua_event_t', {
   {{end}}
   }
 })
+ffi.metatype('sky_lua_batch_t', {
+  __index = {
+  {{range .}}{{batchmetatypedef .}}
+  {{end}}
+  }
+})
 
 function sky_init_cursor(_cursor)
   cursor = ffi.cast('sky_cursor_t*', _cursor)
@@ -56,18 +109,236 @@ function sky_init_cursor(_cursor)
   {{end}}
   cursor:set_timestamp_offset(ffi.offsetof('sky_lua_event_t', 'timestamp'))
   cursor:set_ts_offset(ffi.offsetof('sky_lua_event_t', 'ts'))
+  cursor:set_prev_timestamp_offset(ffi.offsetof('sky_lua_event_t', 'prev_timestamp'))
   cursor:set_data_sz(ffi.sizeof('sky_lua_event_t'))
+  batch = ffi.cast('sky_lua_batch_t*', cursor:set_batch(ffi.sizeof('sky_lua_batch_t'), 1024))
+  {{range .}}{{initbatchcolumn .}}
+  {{end}}
+  if sky_filter ~= nil and cursor:set_filter(sky_filter, #sky_filter) ~= 0 then
+    error("invalid cursor filter")
+  end
+  if sky_session_idle ~= nil then
+    cursor:set_session_idle(sky_session_idle)
+  end
 end
 
 function sky_aggregate(_cursor)
   cursor = ffi.cast('sky_cursor_t*', _cursor)
   data = {}
+  sky_topks = {}
+  sky_flats = {}
+  sky_gc_stopped = sky_gc_budget ~= nil
+  if sky_gc_stopped then
+    collectgarbage('stop')
+  end
+  sky_spilled = false
+  sky_spill_base = collectgarbage('count')
+  local n = 0
   while cursor:nextObject() do
     aggregate(cursor, data)
+    n = n + 1
+    if n % 64 == 0 then
+      sky_check_memory()
+      if sky_check_spill() then
+        sky_spilled = true
+        break
+      end
+    end
+  end
+  if sky_gc_stopped then
+    collectgarbage('restart')
+  end
+  sky_flush_flats()
+  return sky_sketch_strings(data)
+end
+
+-- Checks the heap every 64 objects of an aggregation. A collector that
+-- was stopped for the aggregation is restarted once the heap grows past
+-- its budget and the aggregation fails once the heap is over the memory
+-- limit even after a full collection. Both are in KB.
+function sky_check_memory()
+  local count = collectgarbage('count')
+  if sky_gc_stopped and count > sky_gc_budget then
+    sky_gc_stopped = false
+    collectgarbage('restart')
+  end
+  if sky_memory_limit ~= nil and count > sky_memory_limit then
+    collectgarbage('collect')
+    if collectgarbage('count') > sky_memory_limit then
+      error('query memory limit exceeded')
+    end
+  end
+end
+
+-- Checks whether an aggregation of a query that spills should stop and
+-- hand back its partial result, which it does once the heap has grown by
+-- more than the spill budget since the aggregation started, even after a
+-- full collection. The budget is in KB.
+function sky_check_spill()
+  if sky_spill_budget == nil or collectgarbage('count') - sky_spill_base <= sky_spill_budget then
+    return false
+  end
+  collectgarbage('collect')
+  return collectgarbage('count') - sky_spill_base > sky_spill_budget
+end
+
+-- Counts the traces that LuaJIT aborts, which fall back to the interpreter,
+-- for query profiles.
+sky_trace_aborts = 0
+jit.attach(function(what)
+  if what == 'abort' then sky_trace_aborts = sky_trace_aborts + 1 end
+end, 'trace')
+
+-- Sketches are fixed-size buffers while aggregating and are returned as
+-- strings so they can be merged.
+function sky_sketch_new(type)
+  local s = ffi.new('uint8_t[?]', ffi.C.sky_sketch_type_sz(type))
+  ffi.C.sky_sketch_init(s, type)
+  return s
+end
+
+function sky_sketch(s)
+  if type(s) ~= 'string' then return s end
+  local copy = ffi.new('uint8_t[?]', #s)
+  ffi.copy(copy, s, #s)
+  return copy
+end
+
+function sky_sketch_strings(data)
+  for k, v in pairs(data) do
+    if type(v) == 'table' then
+      sky_sketch_strings(v)
+    elseif type(v) == 'cdata' then
+      data[k] = ffi.string(v, ffi.C.sky_sketch_sz(v))
+    end
   end
   return data
 end
 
+function sky_count_distinct(s, value)
+  if s == nil then s = sky_sketch_new(1) end
+  if type(value) == 'string' then
+    ffi.C.sky_hll_add_string(s, value, #value)
+  elseif type(value) == 'boolean' then
+    ffi.C.sky_hll_add_double(s, value and 1 or 0)
+  elseif value ~= nil then
+    ffi.C.sky_hll_add_double(s, tonumber(value))
+  end
+  return s
+end
+
+function sky_quantile(s, value)
+  if s == nil then s = sky_sketch_new(2) end
+  if value ~= nil then
+    ffi.C.sky_quantile_add(s, tonumber(value))
+  end
+  return s
+end
+
+function sky_histogram(s, value, min, max, buckets)
+  if s == nil then
+    s = ffi.new('uint8_t[?]', ffi.C.sky_histogram_sz(buckets))
+    ffi.C.sky_histogram_init(s, min, max, buckets)
+  end
+  if value ~= nil then
+    ffi.C.sky_histogram_add(s, tonumber(value))
+  end
+  return s
+end
+
+function sky_sketch_merge(a, b)
+  if b == nil then return a end
+  if a == nil then return b end
+  local s = sky_sketch(a)
+  if ffi.C.sky_sketch_merge(s, sky_sketch(b)) ~= 0 then
+    error("invalid sketch")
+  end
+  return ffi.string(s, ffi.C.sky_sketch_sz(s))
+end
+
+-- Returns a string property as a Lua string. Strings from a block dictionary
+-- are only converted once per dictionary entry and then found by code.
+sky_strings, sky_strings_sz = {}, 0
+function sky_string(s)
+  local code = s.code
+  if code == 0 then
+    return ffi.string(s.data, s.length)
+  end
+  local value = sky_strings[code]
+  if value == nil then
+    if sky_strings_sz >= 4096 then
+      sky_strings, sky_strings_sz = {}, 0
+    end
+    value = ffi.string(s.data, s.length)
+    sky_strings[code] = value
+    sky_strings_sz = sky_strings_sz + 1
+  end
+  return value
+end
+
+-- Returns the seconds since the object's previous event or nil for the
+-- object's first event.
+function sky_delta(timestamp, prev_timestamp)
+  if prev_timestamp == 0 then return nil end
+  return timestamp - prev_timestamp
+end
+
+-- Returns the group for a key of a limited selection. Only a fixed number
+-- of the heaviest groups are kept and the lightest group is evicted when a
+-- new key is seen.
+function sky_topk_group(groups, key, capacity, weight)
+  local state = sky_topks[groups]
+  if state == nil then
+    local topk = ffi.C.sky_topk_new(capacity)
+    if topk == nil then error("unable to allocate top-k") end
+    state = {topk = ffi.gc(topk, ffi.C.sky_topk_free), slots = {}, keys = {}}
+    sky_topks[groups] = state
+  end
+  weight = tonumber(weight) or 0
+  local slot = state.slots[key]
+  if slot ~= nil then
+    ffi.C.sky_topk_add(state.topk, slot, weight)
+    return groups[key]
+  end
+  slot = ffi.C.sky_topk_insert(state.topk, weight)
+  local evicted = state.keys[slot]
+  if evicted ~= nil then
+    groups[evicted] = nil
+    state.slots[evicted] = nil
+  end
+  state.slots[key] = slot
+  state.keys[slot] = key
+  groups[key] = {}
+  return groups[key]
+end
+
+-- Returns the flat aggregate of a selection for a root table. Selections
+-- grouped by a single factor count into a struct array indexed by factor
+-- sequence instead of nested tables. The array is folded into the root
+-- table by the selection's flush function once the aggregation is done.
+function sky_flat(root, ctype, size, flush)
+  local flats = sky_flats[flush]
+  if flats == nil then
+    flats = {}
+    sky_flats[flush] = flats
+  end
+  local flat = flats[root]
+  if flat == nil then
+    flat = ctype(size)
+    flats[root] = flat
+  end
+  return flat
+end
+
+function sky_flush_flats()
+  for flush, flats in pairs(sky_flats) do
+    for root, flat in pairs(flats) do
+      flush(root, flat)
+    end
+  end
+  sky_flats = {}
+end
+
 -- The wrapper for the merge.
 function sky_merge(results, data)
   if data ~= nil then
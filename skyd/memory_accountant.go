@@ -0,0 +1,230 @@
+package skyd
+
+import (
+	"fmt"
+	"runtime"
+	"sync"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The memory that a query reserves under a server memory budget when the
+// scheduler doesn't give queries a memory limit of their own. Its engines
+// are limited to it.
+const DefaultQueryMemoryReservation = 256 << 20
+
+// The size of the write buffer of a database opened without one.
+const leveldbDefaultWriteBufferSize = 4 << 20
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A MemoryAccountant keeps track of the memory of the server's components
+// against a server-wide budget. Caches and buffers reserve what their
+// options let them grow to, and each query reserves its memory limit when
+// it's admitted. Queries that don't fit in what's left of the budget are
+// rejected instead of growing until the process runs out of memory and
+// takes ingest down with it. Components whose usage can be measured report
+// it as well, for metrics.
+type MemoryAccountant struct {
+	sync.Mutex
+	budget     int64
+	components []*memoryComponent
+	queries    int64
+	rejections metricCounter
+}
+
+// A component that memory is accounted to. Either function can be nil.
+type memoryComponent struct {
+	name     string
+	reserved func() int64
+	used     func() int64
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates an accountant without a budget.
+func NewMemoryAccountant() *MemoryAccountant {
+	return &MemoryAccountant{}
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Budget
+//--------------------------------------
+
+// The most memory in bytes that the components and queries can reserve
+// together. Zero leaves the server unbounded.
+func (a *MemoryAccountant) Budget() int64 {
+	a.Lock()
+	defer a.Unlock()
+	return a.budget
+}
+
+// Sets the server's memory budget. Queries that are already running keep
+// their reservations.
+func (a *MemoryAccountant) SetBudget(budget int64) {
+	a.Lock()
+	defer a.Unlock()
+	a.budget = budget
+}
+
+//--------------------------------------
+// Components
+//--------------------------------------
+
+// Registers a component with functions that return the bytes it reserves
+// and the bytes it uses now. Both are called whenever the accountant needs
+// them so they should be cheap and safe to call from any goroutine.
+func (a *MemoryAccountant) Register(name string, reserved func() int64, used func() int64) {
+	a.Lock()
+	defer a.Unlock()
+	a.components = append(a.components, &memoryComponent{name: name, reserved: reserved, used: used})
+}
+
+// The bytes reserved by the components and the running queries.
+func (a *MemoryAccountant) Reserved() int64 {
+	a.Lock()
+	defer a.Unlock()
+	return a.reserved()
+}
+
+func (a *MemoryAccountant) reserved() int64 {
+	total := a.queries
+	for _, c := range a.components {
+		if c.reserved != nil {
+			total += c.reserved()
+		}
+	}
+	return total
+}
+
+//--------------------------------------
+// Queries
+//--------------------------------------
+
+// Reserves the memory of a query with a limit in bytes, which is zero if
+// it has none. Under a budget, queries without a limit reserve
+// DefaultQueryMemoryReservation and a query that doesn't fit is rejected.
+// Returns the bytes reserved, which the query is limited to and has to
+// release when it finishes.
+func (a *MemoryAccountant) reserveQuery(limit int64) (int64, error) {
+	a.Lock()
+	defer a.Unlock()
+	if a.budget <= 0 {
+		a.queries += limit
+		return limit, nil
+	}
+	if limit <= 0 {
+		limit = DefaultQueryMemoryReservation
+	}
+	if available := a.budget - a.reserved(); limit > available {
+		a.rejections.Add(1)
+		return 0, fmt.Errorf("skyd.MemoryAccountant: Server memory budget of %d bytes exceeded: %d bytes available, query needs %d", a.budget, available, limit)
+	}
+	a.queries += limit
+	return limit, nil
+}
+
+// Releases the memory reserved by a query.
+func (a *MemoryAccountant) releaseQuery(reservation int64) {
+	a.Lock()
+	defer a.Unlock()
+	a.queries -= reservation
+}
+
+//--------------------------------------
+// Metrics
+//--------------------------------------
+
+// Writes the budget, the reserved and used bytes of each component and the
+// number of rejected queries.
+func (a *MemoryAccountant) writeMetrics(w *metricWriter) {
+	a.Lock()
+	budget, queries := a.budget, a.queries
+	components := a.components
+	a.Unlock()
+
+	w.Start("sky_memory_budget_bytes", "gauge", "Memory that components and queries can reserve together, zero if unbounded.")
+	w.Sample(budget)
+	w.Start("sky_memory_reserved_bytes", "gauge", "Memory reserved by each component and by running queries.")
+	for _, c := range components {
+		if c.reserved != nil {
+			w.Sample(c.reserved(), "component", c.name)
+		}
+	}
+	w.Sample(queries, "component", "queries")
+	w.Start("sky_memory_used_bytes", "gauge", "Memory used by each component that can be measured.")
+	for _, c := range components {
+		if c.used != nil {
+			w.Sample(c.used(), "component", c.name)
+		}
+	}
+	w.Start("sky_memory_query_rejections_total", "counter", "Queries rejected because they didn't fit in the memory budget.")
+	w.Sample(a.rejections.Value())
+}
+
+//--------------------------------------
+// Server
+//--------------------------------------
+
+// Registers the server's caches and buffers with its accountant. The block
+// caches reserve their capacity. The servlet databases and the factors
+// database each reserve two write buffers, for the memtable being written
+// and the one being flushed, and their pinned metadata. Time partitions
+// aren't reserved for. Idle engines and the Go heap, which holds merge
+// maps, cached results, factors and request buffers, are only measured.
+func (s *Server) registerMemoryComponents() {
+	s.memory.Register("block_cache", func() int64 {
+		return int64(s.servletStorage.CacheSize + s.servletStorage.CompressedCacheSize + s.factorsStorage.CacheSize + s.factorsStorage.CompressedCacheSize)
+	}, nil)
+	s.memory.Register("memtables", func() int64 {
+		return 2 * (int64(len(s.servlets))*storageWriteBufferSize(s.servletStorage) + storageWriteBufferSize(s.factorsStorage))
+	}, func() int64 {
+		var total uint64
+		for _, servlet := range s.servlets {
+			total += servlet.storageMetrics().memtableBytes
+		}
+		return int64(total)
+	})
+	s.memory.Register("pinned_metadata", func() int64 {
+		return int64(len(s.servlets)*s.servletStorage.PinnedMetadataSize + s.factorsStorage.PinnedMetadataSize)
+	}, func() int64 {
+		var total uint64
+		for _, servlet := range s.servlets {
+			total += servlet.storageMetrics().pinnedBytes
+		}
+		return int64(total)
+	})
+	s.memory.Register("idle_engines", nil, s.enginePool.HeapBytes)
+	s.memory.Register("go_heap", nil, func() int64 {
+		var stats runtime.MemStats
+		runtime.ReadMemStats(&stats)
+		return int64(stats.HeapInuse)
+	})
+}
+
+// The write buffer size that databases are opened with under a set of
+// storage options.
+func storageWriteBufferSize(options StorageOptions) int64 {
+	if options.WriteBufferSize > 0 {
+		return int64(options.WriteBufferSize)
+	}
+	return leveldbDefaultWriteBufferSize
+}
@@ -0,0 +1,507 @@
+package skyd
+
+import (
+	"fmt"
+	"io"
+	"sort"
+	"strconv"
+	"strings"
+	"sync/atomic"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of levels in a LevelDB database.
+const leveldbLevels = 7
+
+// The upper bounds of the request latency buckets, in seconds.
+var metricLatencyBuckets = []float64{0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10}
+
+// The request methods that get their own latency histogram. Everything else
+// is counted as "OTHER".
+var metricMethods = []string{"GET", "POST", "PUT", "PATCH", "DELETE", "OTHER"}
+
+// Latency summaries count microseconds in log-linear buckets. The first
+// metricSummarySubBuckets microseconds get a bucket each and every power of
+// two after that is split into metricSummarySubBuckets buckets, so quantiles
+// are within 1/16th of the true latency at any scale. The last bucket holds
+// everything from about 17 days up.
+const metricSummarySubBuckets = 8
+const metricSummaryBuckets = 39 * metricSummarySubBuckets
+
+// The quantiles that latency summaries are reported at.
+var metricQuantiles = []float64{0.5, 0.99, 0.999}
+
+// The phases of a query that latencies are reported for. The scan runs
+// from the start of the engines to the merge of their results and the
+// finalize phase includes defactorizing.
+const (
+	queryPhaseQueue = iota
+	queryPhaseScan
+	queryPhaseFinalize
+	queryPhaseTotal
+	queryPhases
+)
+
+var queryPhaseNames = []string{"queue", "scan", "finalize", "total"}
+
+// The operations of the "leveldb.latency" property, in order.
+var leveldbLatencyOps = []string{"get", "write", "compaction"}
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A metricCounter is a counter that is only ever updated atomically. It's
+// padded to a cache line so that counters updated from different cores
+// don't contend with each other.
+type metricCounter struct {
+	value uint64
+	_     [56]byte
+}
+
+// A metricHistogram counts durations in fixed buckets. Every field is
+// updated atomically, so a histogram being written while it's read can be
+// off by the observations in flight.
+type metricHistogram struct {
+	count  uint64
+	sum    uint64
+	counts []uint64
+}
+
+// A metricSummary counts durations in log-linear buckets that quantiles
+// are read from, for latencies whose tail matters more than where they fall
+// against fixed bounds. Like histograms, its fields are updated atomically
+// and summaries are merged when they're read.
+type metricSummary struct {
+	count  uint64
+	sum    uint64
+	counts [metricSummaryBuckets]uint64
+}
+
+// The request latency histograms of a route, one per method, and the
+// latency summary of every request to it. The map is filled in when the
+// route is registered and only read afterwards.
+type routeMetrics struct {
+	route      string
+	histograms map[string]*metricHistogram
+	latency    metricSummary
+}
+
+// The LevelDB gauges of a servlet summed across its partitions. Latencies
+// are indexed like leveldbLatencyOps.
+type servletStorageMetrics struct {
+	files         []int
+	memtableBytes uint64
+	pinnedBytes   uint64
+	latencies     []leveldbLatency
+}
+
+// The number of calls to a LevelDB operation and its latency quantiles in
+// microseconds, as reported by a database. Partitions are combined by
+// adding their counts and taking the worst of their quantiles.
+type leveldbLatency struct {
+	count     float64
+	quantiles []float64
+}
+
+// Writes samples in the Prometheus text exposition format.
+type metricWriter struct {
+	w    io.Writer
+	err  error
+	name string
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+func newMetricHistogram() *metricHistogram {
+	return &metricHistogram{counts: make([]uint64, len(metricLatencyBuckets))}
+}
+
+func newRouteMetrics(route string) *routeMetrics {
+	m := &routeMetrics{route: route, histograms: make(map[string]*metricHistogram)}
+	for _, method := range metricMethods {
+		m.histograms[method] = newMetricHistogram()
+	}
+	return m
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Counter
+//--------------------------------------
+
+// Adds to the counter.
+func (c *metricCounter) Add(n uint64) {
+	atomic.AddUint64(&c.value, n)
+}
+
+// Returns the current value of the counter.
+func (c *metricCounter) Value() uint64 {
+	return atomic.LoadUint64(&c.value)
+}
+
+//--------------------------------------
+// Histogram
+//--------------------------------------
+
+// Adds a duration to the histogram. Durations beyond the last bucket are
+// only counted in the total.
+func (h *metricHistogram) Observe(d time.Duration) {
+	seconds := d.Seconds()
+	for i, bound := range metricLatencyBuckets {
+		if seconds <= bound {
+			atomic.AddUint64(&h.counts[i], 1)
+			break
+		}
+	}
+	atomic.AddUint64(&h.sum, uint64(d))
+	atomic.AddUint64(&h.count, 1)
+}
+
+// Adds the observations of another histogram to this one.
+func (h *metricHistogram) merge(other *metricHistogram) {
+	for i := range h.counts {
+		h.counts[i] += atomic.LoadUint64(&other.counts[i])
+	}
+	h.sum += atomic.LoadUint64(&other.sum)
+	h.count += atomic.LoadUint64(&other.count)
+}
+
+//--------------------------------------
+// Summary
+//--------------------------------------
+
+// Adds a duration to the summary.
+func (h *metricSummary) Observe(d time.Duration) {
+	micros := d.Nanoseconds() / 1000
+	if micros < 0 {
+		micros = 0
+	}
+	atomic.AddUint64(&h.counts[metricSummaryBucket(uint64(micros))], 1)
+	atomic.AddUint64(&h.sum, uint64(d))
+	atomic.AddUint64(&h.count, 1)
+}
+
+// Adds the observations of another summary to this one.
+func (h *metricSummary) merge(other *metricSummary) {
+	for i := range h.counts {
+		h.counts[i] += atomic.LoadUint64(&other.counts[i])
+	}
+	h.sum += atomic.LoadUint64(&other.sum)
+	h.count += atomic.LoadUint64(&other.count)
+}
+
+// Returns the duration in seconds that a fraction of the observations are
+// at or below, taken from the middle of its bucket. Returns zero for an
+// empty summary.
+func (h *metricSummary) Quantile(q float64) float64 {
+	var count uint64
+	for i := range h.counts {
+		count += atomic.LoadUint64(&h.counts[i])
+	}
+	if count == 0 {
+		return 0
+	}
+	rank := uint64(q*float64(count-1)) + 1
+	var cumulative uint64
+	for i := range h.counts {
+		if cumulative += atomic.LoadUint64(&h.counts[i]); cumulative >= rank {
+			lower, width := metricSummaryBucketRange(i)
+			return (float64(lower) + float64(width-1)/2) / 1e6
+		}
+	}
+	return 0
+}
+
+// Returns the bucket that a latency in microseconds is counted in.
+func metricSummaryBucket(micros uint64) int {
+	if micros < metricSummarySubBuckets {
+		return int(micros)
+	}
+	shift := 0
+	for micros >= 2*metricSummarySubBuckets {
+		micros >>= 1
+		shift++
+	}
+	if i := (shift+1)*metricSummarySubBuckets + int(micros-metricSummarySubBuckets); i < metricSummaryBuckets {
+		return i
+	}
+	return metricSummaryBuckets - 1
+}
+
+// Returns the lowest latency in microseconds of a bucket and the number of
+// microseconds that it spans.
+func metricSummaryBucketRange(i int) (uint64, uint64) {
+	if i < metricSummarySubBuckets {
+		return uint64(i), 1
+	}
+	shift := uint(i/metricSummarySubBuckets - 1)
+	return uint64(metricSummarySubBuckets+i%metricSummarySubBuckets) << shift, 1 << shift
+}
+
+//--------------------------------------
+// Routes
+//--------------------------------------
+
+// Records the latency of a request to the route.
+func (m *routeMetrics) Observe(method string, d time.Duration) {
+	h, ok := m.histograms[method]
+	if !ok {
+		h = m.histograms["OTHER"]
+	}
+	h.Observe(d)
+	m.latency.Observe(d)
+}
+
+//--------------------------------------
+// Writer
+//--------------------------------------
+
+// Starts a metric with its help text and type.
+func (w *metricWriter) Start(name string, typ string, help string) {
+	w.name = name
+	w.printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, typ)
+}
+
+// Writes a sample of the current metric. Labels are given as name/value
+// pairs.
+func (w *metricWriter) Sample(value interface{}, labels ...string) {
+	w.sample(w.name, value, labels...)
+}
+
+// Writes the buckets, sum and count of a histogram as the current metric.
+func (w *metricWriter) Histogram(h *metricHistogram, labels ...string) {
+	var cumulative uint64
+	for i, bound := range metricLatencyBuckets {
+		cumulative += h.counts[i]
+		w.sample(w.name+"_bucket", cumulative, append(labels, "le", fmt.Sprint(bound))...)
+	}
+	w.sample(w.name+"_bucket", h.count, append(labels, "le", "+Inf")...)
+	w.sample(w.name+"_sum", time.Duration(h.sum).Seconds(), labels...)
+	w.sample(w.name+"_count", h.count, labels...)
+}
+
+// Writes the quantiles, sum and count of a summary as the current metric.
+func (w *metricWriter) Summary(h *metricSummary, labels ...string) {
+	for _, q := range metricQuantiles {
+		w.sample(w.name, h.Quantile(q), append(labels, "quantile", fmt.Sprint(q))...)
+	}
+	w.sample(w.name+"_sum", time.Duration(h.sum).Seconds(), labels...)
+	w.sample(w.name+"_count", h.count, labels...)
+}
+
+func (w *metricWriter) sample(name string, value interface{}, labels ...string) {
+	if len(labels) == 0 {
+		w.printf("%s %v\n", name, value)
+		return
+	}
+	pairs := make([]string, 0, len(labels)/2)
+	for i := 0; i+1 < len(labels); i += 2 {
+		pairs = append(pairs, fmt.Sprintf("%s=%q", labels[i], labels[i+1]))
+	}
+	w.printf("%s{%s} %v\n", name, strings.Join(pairs, ","), value)
+}
+
+func (w *metricWriter) printf(format string, args ...interface{}) {
+	if w.err == nil {
+		_, w.err = fmt.Fprintf(w.w, format, args...)
+	}
+}
+
+//--------------------------------------
+// Server
+//--------------------------------------
+
+// Counts a query as running until queryFinished is called.
+func (s *Server) queryStarted() {
+	s.queries.Add(1)
+	atomic.AddInt64(&s.runningQueries, 1)
+}
+
+func (s *Server) queryFinished() {
+	atomic.AddInt64(&s.runningQueries, -1)
+}
+
+// Writes the server's metrics in the Prometheus text format. Routes that
+// are registered more than once, once per method, are reported together.
+func (s *Server) WriteMetrics(out io.Writer) error {
+	w := &metricWriter{w: out}
+
+	// Request latencies by route and method.
+	routes := make(map[string]*routeMetrics)
+	names := make([]string, 0)
+	for _, m := range s.routeMetrics {
+		merged, ok := routes[m.route]
+		if !ok {
+			merged = newRouteMetrics(m.route)
+			routes[m.route] = merged
+			names = append(names, m.route)
+		}
+		for method, h := range m.histograms {
+			merged.histograms[method].merge(h)
+		}
+		merged.latency.merge(&m.latency)
+	}
+	sort.Strings(names)
+	w.Start("sky_http_request_duration_seconds", "histogram", "Latency of API requests by route and method.")
+	for _, name := range names {
+		for _, method := range metricMethods {
+			if h := routes[name].histograms[method]; h.count > 0 {
+				w.Histogram(h, "route", name, "method", method)
+			}
+		}
+	}
+	w.Start("sky_http_request_latency_seconds", "summary", "Latency quantiles of API requests by route.")
+	for _, name := range names {
+		if h := &routes[name].latency; h.count > 0 {
+			w.Summary(h, "route", name)
+		}
+	}
+
+	// Queries.
+	w.Start("sky_queries_total", "counter", "Queries run since the server started.")
+	w.Sample(s.queries.Value())
+	w.Start("sky_queries_running", "gauge", "Queries currently running.")
+	w.Sample(atomic.LoadInt64(&s.runningQueries))
+	w.Start("sky_query_phase_latency_seconds", "summary", "Latency quantiles of the phases of queries.")
+	for phase, name := range queryPhaseNames {
+		w.Summary(&s.queryLatency[phase], "phase", name)
+	}
+
+	// Memory.
+	s.memory.writeMetrics(w)
+
+	// Factor cache.
+	if s.factors != nil {
+		w.Start("sky_factor_cache_hits_total", "counter", "Factor lookups answered from memory.")
+		w.Sample(s.factors.cacheHits.Value())
+		w.Start("sky_factor_cache_misses_total", "counter", "Factor lookups that read LevelDB.")
+		w.Sample(s.factors.cacheMisses.Value())
+	}
+
+	// Servlets. Partitions are included in the totals of their servlet.
+	w.Start("sky_servlet_events_written_total", "counter", "Events written to each servlet.")
+	for i, servlet := range s.servlets {
+		w.Sample(servlet.eventsWritten.Value(), "servlet", fmt.Sprint(i))
+	}
+	w.Start("sky_servlet_duplicate_events_total", "counter", "Retried events with a recently written id that each servlet acknowledged without writing.")
+	for i, servlet := range s.servlets {
+		w.Sample(servlet.duplicateEvents.Value(), "servlet", fmt.Sprint(i))
+	}
+	writes := &metricSummary{}
+	for _, servlet := range s.servlets {
+		writes.merge(&servlet.writeLatency)
+	}
+	w.Start("sky_event_write_latency_seconds", "summary", "Latency quantiles of event writes to the servlets.")
+	w.Summary(writes)
+	stats := make([]servletStorageMetrics, len(s.servlets))
+	for i, servlet := range s.servlets {
+		stats[i] = servlet.storageMetrics()
+	}
+	w.Start("sky_leveldb_files", "gauge", "Table files at each LevelDB level of each servlet.")
+	for i := range s.servlets {
+		for level, n := range stats[i].files {
+			w.Sample(n, "servlet", fmt.Sprint(i), "level", fmt.Sprint(level))
+		}
+	}
+	w.Start("sky_leveldb_memtable_bytes", "gauge", "Approximate memory used by the LevelDB memtables of each servlet.")
+	for i := range s.servlets {
+		w.Sample(stats[i].memtableBytes, "servlet", fmt.Sprint(i))
+	}
+	w.Start("sky_leveldb_pinned_metadata_bytes", "gauge", "Filter and index blocks of level 0 and 1 tables pinned in memory for each servlet.")
+	for i := range s.servlets {
+		w.Sample(stats[i].pinnedBytes, "servlet", fmt.Sprint(i))
+	}
+	w.Start("sky_leveldb_latency_seconds", "summary", "Latency quantiles of LevelDB reads, writes and compactions of each servlet.")
+	for i := range s.servlets {
+		for op, latency := range stats[i].latencies {
+			for j, q := range metricQuantiles {
+				w.Sample(latency.quantiles[j]/1e6, "servlet", fmt.Sprint(i), "op", leveldbLatencyOps[op], "quantile", fmt.Sprint(q))
+			}
+			w.sample(w.name+"_count", latency.count, "servlet", fmt.Sprint(i), "op", leveldbLatencyOps[op])
+		}
+	}
+
+	return w.err
+}
+
+//--------------------------------------
+// Servlet
+//--------------------------------------
+
+// Reads the LevelDB gauges of the servlet's databases.
+func (s *Servlet) storageMetrics() servletStorageMetrics {
+	m := servletStorageMetrics{files: make([]int, leveldbLevels), latencies: make([]leveldbLatency, len(leveldbLatencyOps))}
+	for op := range m.latencies {
+		m.latencies[op].quantiles = make([]float64, len(metricQuantiles))
+	}
+	s.eachPartition(func(servlet *Servlet) error {
+		if servlet.db == nil {
+			return nil
+		}
+		for level := range m.files {
+			if n, err := strconv.Atoi(servlet.db.PropertyValue(fmt.Sprintf("leveldb.num-files-at-level%d", level))); err == nil {
+				m.files[level] += n
+			}
+		}
+		if n, err := strconv.ParseUint(servlet.db.PropertyValue("leveldb.approximate-memory-usage"), 10, 64); err == nil {
+			m.memtableBytes += n
+		}
+		if n, err := strconv.ParseUint(servlet.db.PropertyValue("leveldb.pinned-metadata-usage"), 10, 64); err == nil {
+			m.pinnedBytes += n
+		}
+		parseLeveldbLatencies(servlet.db.PropertyValue("leveldb.latency"), m.latencies)
+		return nil
+	})
+	return m
+}
+
+// Parses the rows of a "leveldb.latency" property, which hold an operation,
+// its count and its 50th, 99th and 99.9th percentiles, into the latencies
+// of a servlet.
+func parseLeveldbLatencies(property string, latencies []leveldbLatency) {
+	for _, line := range strings.Split(property, "\n") {
+		fields := strings.Fields(line)
+		if len(fields) != 2+len(metricQuantiles) {
+			continue
+		}
+		for op, name := range leveldbLatencyOps {
+			if fields[0] != name {
+				continue
+			}
+			values := make([]float64, len(fields)-1)
+			var err error
+			for j := range values {
+				if values[j], err = strconv.ParseFloat(fields[j+1], 64); err != nil {
+					break
+				}
+			}
+			if err != nil {
+				break
+			}
+			latencies[op].count += values[0]
+			for j, v := range values[1:] {
+				if v > latencies[op].quantiles[j] {
+					latencies[op].quantiles[j] = v
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,114 @@
+package skyd
+
+import (
+	"fmt"
+	"io/ioutil"
+	"path/filepath"
+	"sort"
+	"strconv"
+	"strings"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The directory that Linux lists the NUMA nodes of the machine in.
+const numaNodePath = "/sys/devices/system/node"
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A numaNode is a NUMA node of the machine and the CPUs that belong to it.
+type numaNode struct {
+	id   int
+	cpus []int
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Reads the NUMA nodes of the machine that have CPUs, in order of their ids.
+// Machines that don't list their nodes have none.
+func readNUMANodes(path string) []*numaNode {
+	paths, err := filepath.Glob(filepath.Join(path, "node[0-9]*"))
+	if err != nil {
+		return nil
+	}
+	nodes := make([]*numaNode, 0)
+	for _, p := range paths {
+		id, err := strconv.Atoi(strings.TrimPrefix(filepath.Base(p), "node"))
+		if err != nil {
+			continue
+		}
+		b, err := ioutil.ReadFile(filepath.Join(p, "cpulist"))
+		if err != nil {
+			continue
+		}
+		cpus, err := parseCPUList(strings.TrimSpace(string(b)))
+		if err != nil || len(cpus) == 0 {
+			continue
+		}
+		nodes = append(nodes, &numaNode{id: id, cpus: cpus})
+	}
+	sort.Sort(numaNodesById(nodes))
+	return nodes
+}
+
+// Parses a list of CPUs in the kernel's format, which is made of single
+// CPUs and inclusive ranges separated by commas (e.g. "0-3,8,10-11").
+func parseCPUList(list string) ([]int, error) {
+	cpus := make([]int, 0)
+	if list == "" {
+		return cpus, nil
+	}
+	for _, item := range strings.Split(list, ",") {
+		bounds := strings.SplitN(item, "-", 2)
+		first, err := strconv.Atoi(bounds[0])
+		if err != nil {
+			return nil, fmt.Errorf("skyd: Invalid CPU list: %s", list)
+		}
+		last := first
+		if len(bounds) == 2 {
+			if last, err = strconv.Atoi(bounds[1]); err != nil || last < first {
+				return nil, fmt.Errorf("skyd: Invalid CPU list: %s", list)
+			}
+		}
+		for cpu := first; cpu <= last; cpu++ {
+			cpus = append(cpus, cpu)
+		}
+	}
+	return cpus, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Sorting
+//--------------------------------------
+
+type numaNodesById []*numaNode
+
+func (l numaNodesById) Len() int {
+	return len(l)
+}
+
+func (l numaNodesById) Less(i, j int) bool {
+	return l[i].id < l[j].id
+}
+
+func (l numaNodesById) Swap(i, j int) {
+	l[i], l[j] = l[j], l[i]
+}
@@ -0,0 +1,269 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/base64"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"github.com/jmhodges/levigo"
+	"github.com/ugorji/go-msgpack"
+	"sort"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of objects in a page of an object scan when none is given.
+const DefaultObjectScanLimit = 100
+
+// The most objects that a page of an object scan can hold.
+const MaxObjectScanLimit = 10000
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// An ObjectBookmark is the position of an object scan. Servlets are scanned
+// one after another in key order, so the position is the servlet being
+// scanned and the encoded key of the last object read from it. Bookmarks
+// are only valid for the number of servlets they were made with.
+type ObjectBookmark struct {
+	Servlets int
+	Servlet  int
+	Key      []byte
+}
+
+// A ScannedObject is an object read by an object scan along with its events
+// in time order and its current state.
+type ScannedObject struct {
+	Id     string
+	Events []*Event
+	State  *Event
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Decodes a bookmark from the opaque string that's handed to clients.
+func ParseObjectBookmark(value string) (*ObjectBookmark, error) {
+	b, err := base64.URLEncoding.DecodeString(value)
+	if err != nil {
+		return nil, fmt.Errorf("skyd.Server: Invalid bookmark: %s", value)
+	}
+	servlets, n := binary.Uvarint(b)
+	if n <= 0 {
+		return nil, fmt.Errorf("skyd.Server: Invalid bookmark: %s", value)
+	}
+	servlet, m := binary.Uvarint(b[n:])
+	if m <= 0 || servlet >= servlets {
+		return nil, fmt.Errorf("skyd.Server: Invalid bookmark: %s", value)
+	}
+	bookmark := &ObjectBookmark{Servlets: int(servlets), Servlet: int(servlet)}
+	if len(b) > n+m {
+		bookmark.Key = b[n+m:]
+	}
+	return bookmark, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Bookmark
+//--------------------------------------
+
+// Encodes the bookmark as an opaque string.
+func (b *ObjectBookmark) String() string {
+	buf := make([]byte, 2*binary.MaxVarintLen64, 2*binary.MaxVarintLen64+len(b.Key))
+	n := binary.PutUvarint(buf, uint64(b.Servlets))
+	n += binary.PutUvarint(buf[n:], uint64(b.Servlet))
+	return base64.URLEncoding.EncodeToString(append(buf[:n], b.Key...))
+}
+
+//--------------------------------------
+// Servlet
+//--------------------------------------
+
+// Returns the encoded keys of up to a number of objects of a table that
+// sort after a key, in key order. A nil key starts at the first object.
+// Objects are read from the servlet's database, its partitions and its
+// frozen files so that each is returned once wherever its events are.
+func (s *Servlet) scanObjectKeys(prefix []byte, after []byte, limit int) ([][]byte, error) {
+	keys := make([][]byte, 0)
+	start := prefix
+	if after != nil {
+		start = after
+	}
+	err := s.eachPartition(func(db *Servlet) error {
+		if err := db.unbufferTable(prefix); err != nil {
+			return err
+		}
+		ro := levigo.NewReadOptions()
+		defer ro.Close()
+		ro.SetFillCache(false)
+		setPrefixSameAsStart(ro)
+		iterator := db.db.NewIterator(ro)
+		defer iterator.Close()
+		count := 0
+		for iterator.Seek(start); iterator.Valid() && count < limit; iterator.Next() {
+			key := iterator.Key()
+			if isZoneKey(key, len(prefix)) || objectKeySize(key, len(prefix)) != len(key) {
+				continue
+			}
+			if after != nil && bytes.Compare(key, after) <= 0 {
+				continue
+			}
+			keys = append(keys, key)
+			count++
+		}
+		if err := iterator.GetError(); err != nil {
+			return err
+		}
+
+		db.frozenMutex.RLock()
+		defer db.frozenMutex.RUnlock()
+		for _, f := range db.frozen[string(prefix)] {
+			i := sort.Search(f.count, func(i int) bool { return bytes.Compare(f.key(i), after) > 0 })
+			for n := 0; i < f.count && n < limit; i, n = i+1, n+1 {
+				keys = append(keys, append([]byte{}, f.key(i)...))
+			}
+		}
+		return nil
+	})
+	if err != nil {
+		return nil, err
+	}
+
+	// The first keys of the merged sources are among the first keys of
+	// each of them.
+	sort.Sort(byteSliceList(keys))
+	unique := keys[:0]
+	for _, key := range keys {
+		if len(unique) == 0 || !bytes.Equal(unique[len(unique)-1], key) {
+			unique = append(unique, key)
+		}
+	}
+	if len(unique) > limit {
+		unique = unique[:limit]
+	}
+	return unique, nil
+}
+
+// Recovers the id of an object from its encoded key. Tables with hashed
+// keys keep the id in the object's state so it's read from wherever the
+// object is stored.
+func (s *Servlet) scannedObjectId(table *Table, prefix []byte, key []byte) (string, error) {
+	if table.KeyFormat != HashedKeyFormat {
+		var raw interface{}
+		if err := msgpack.NewDecoder(bytes.NewReader(key[len(prefix):]), nil).Decode(&raw); err != nil {
+			return "", err
+		}
+		if id, ok := raw.(string); ok {
+			return id, nil
+		}
+		return "", fmt.Errorf("skyd.Servlet: Invalid object key: %x", key)
+	}
+
+	var state *Event
+	err := s.eachPartition(func(db *Servlet) error {
+		if state != nil && state.Data[storedObjectIdPropertyId] != nil {
+			return nil
+		}
+		o, err := db.loadObject(prefix, key, "", nil)
+		if err != nil {
+			return err
+		}
+		state = o.state
+		if !o.exists {
+			if value := db.getFrozenObject(prefix, key); value != nil {
+				state, _, err = decodeObject(value)
+			}
+		}
+		return err
+	})
+	if err != nil {
+		return "", err
+	}
+	if state != nil {
+		if id, ok := state.Data[storedObjectIdPropertyId].(string); ok {
+			return id, nil
+		}
+	}
+	return "", fmt.Errorf("skyd.Servlet: Object has no stored id: %x", key)
+}
+
+//--------------------------------------
+// Server
+//--------------------------------------
+
+// Reads a page of up to a number of objects of a table along with their
+// events, starting after a bookmark. A nil bookmark starts at the first
+// object. The bookmark of the next page is returned, or nil once every
+// object has been read. Objects written or removed between pages may or
+// may not be seen, but every object that's there throughout the scan is
+// returned exactly once.
+func (s *Server) ScanObjects(table *Table, bookmark *ObjectBookmark, limit int) ([]*ScannedObject, *ObjectBookmark, error) {
+	if limit <= 0 {
+		limit = DefaultObjectScanLimit
+	} else if limit > MaxObjectScanLimit {
+		return nil, nil, fmt.Errorf("skyd.Server: Scan limit is larger than %d: %d", MaxObjectScanLimit, limit)
+	}
+	prefix, err := table.Prefix()
+	if err != nil {
+		return nil, nil, err
+	}
+
+	// Objects can't move between servlets while a page is read.
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+	if s.placement.next != nil {
+		return nil, nil, errors.New("skyd.Server: Objects can't be scanned while resharding")
+	}
+	position := &ObjectBookmark{Servlets: len(s.servlets)}
+	if bookmark != nil {
+		if bookmark.Servlets != len(s.servlets) {
+			return nil, nil, fmt.Errorf("skyd.Server: Bookmark is for %d servlets instead of %d", bookmark.Servlets, len(s.servlets))
+		} else if bookmark.Key != nil && !bytes.HasPrefix(bookmark.Key, prefix) {
+			return nil, nil, fmt.Errorf("skyd.Server: Bookmark is not of table: %s", table.Name)
+		}
+		position.Servlet, position.Key = bookmark.Servlet, bookmark.Key
+	}
+
+	objects := make([]*ScannedObject, 0)
+	for position.Servlet < len(s.servlets) {
+		servlet := s.servlets[position.Servlet]
+		keys, err := servlet.scanObjectKeys(prefix, position.Key, limit-len(objects))
+		if err != nil {
+			return nil, nil, err
+		}
+		for _, key := range keys {
+			id, err := servlet.scannedObjectId(table, prefix, key)
+			if err != nil {
+				return nil, nil, err
+			}
+			events, state, err := servlet.GetEvents(table, id)
+			if err != nil {
+				return nil, nil, err
+			}
+			objects = append(objects, &ScannedObject{Id: id, Events: events, State: state})
+			position.Key = key
+		}
+		if len(objects) == limit {
+			return objects, position, nil
+		}
+		position.Servlet, position.Key = position.Servlet+1, nil
+	}
+	return objects, nil, nil
+}
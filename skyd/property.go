@@ -2,14 +2,24 @@ package skyd
 
 import (
 	"fmt"
+	"regexp"
 )
 
-// A Property is a loose schema column on a Table.
+// The names that property families can have. Family names are part of the
+// keys that their values are stored under.
+var propertyFamilyPattern = regexp.MustCompile(`^\w{1,64}$`)
+
+// A Property is a loose schema column on a Table. Transient properties can
+// be put in a named family, whose values are stored apart from the rest of
+// each object so that queries that don't reference the family don't read
+// them.
 type Property struct {
 	Id        int64  `json:"id"`
 	Name      string `json:"name"`
 	Transient bool   `json:"transient"`
 	DataType  string `json:"dataType"`
+	Indexed   bool   `json:"indexed,omitempty"`
+	Family    string `json:"family,omitempty"`
 }
 
 // NewProperty returns a new Property.
@@ -17,6 +27,7 @@ func NewProperty(id int64, name string, transient bool, dataType string) (*Prope
 	// Validate data type.
 	switch dataType {
 	case FactorDataType, StringDataType, IntegerDataType, FloatDataType, BooleanDataType:
+	case Int8DataType, Int16DataType, Int32DataType, Int64DataType, Float32DataType:
 	default:
 		return nil, fmt.Errorf("Invalid property data type: %v", dataType)
 	}
@@ -28,3 +39,11 @@ func NewProperty(id int64, name string, transient bool, dataType string) (*Prope
 		DataType:  dataType,
 	}, nil
 }
+
+// Checks that a property family name can be stored.
+func validatePropertyFamily(family string) error {
+	if !propertyFamilyPattern.MatchString(family) {
+		return fmt.Errorf("Invalid property family: %v", family)
+	}
+	return nil
+}
@@ -8,6 +8,9 @@ import (
 	"io"
 	"os"
 	"sort"
+	"sync"
+	"sync/atomic"
+	"unsafe"
 )
 
 //------------------------------------------------------------------------------
@@ -17,9 +20,22 @@ import (
 //------------------------------------------------------------------------------
 
 // A PropertyFile manages the serialization of Property objects for a table.
+//
+// The properties are kept in an immutable schema that's replaced whenever a
+// property is added, changed or removed. Ingests and queries read the
+// current schema without locking while changes copy it under the file's
+// mutex and publish the copy. Properties in a published schema are never
+// modified.
 type PropertyFile struct {
-	opened           bool
-	path             string
+	opened  bool
+	path    string
+	mutex   sync.Mutex
+	current unsafe.Pointer
+}
+
+// A propertySchema is a snapshot of the properties of a property file.
+type propertySchema struct {
+	version          uint64
 	properties       map[int64]*Property
 	propertiesByName map[string]*Property
 }
@@ -39,6 +55,15 @@ func NewPropertyFile(path string) *PropertyFile {
 	return p
 }
 
+// Returns an empty schema.
+func newPropertySchema(version uint64) *propertySchema {
+	return &propertySchema{
+		version:          version,
+		properties:       make(map[int64]*Property),
+		propertiesByName: make(map[string]*Property),
+	}
+}
+
 //------------------------------------------------------------------------------
 //
 // Accessors
@@ -58,6 +83,23 @@ func (p *PropertyFile) DbPath() string {
 	return ""
 }
 
+// A counter that changes whenever properties are added, changed, removed or
+// reloaded. Compiled queries are only valid for a single version.
+func (p *PropertyFile) Version() uint64 {
+	return p.schema().version
+}
+
+// The current schema. Callers that look up several properties should use a
+// single schema so that they see a consistent set.
+func (p *PropertyFile) schema() *propertySchema {
+	return (*propertySchema)(atomic.LoadPointer(&p.current))
+}
+
+// Publishes a new schema. The file's mutex should be locked by the caller.
+func (p *PropertyFile) publish(schema *propertySchema) {
+	atomic.StorePointer(&p.current, unsafe.Pointer(schema))
+}
+
 //------------------------------------------------------------------------------
 //
 // Methods
@@ -70,8 +112,26 @@ func (p *PropertyFile) DbPath() string {
 
 // Adds a new property to the property file and generate an identifier for it.
 func (p *PropertyFile) CreateProperty(name string, transient bool, dataType string) (*Property, error) {
+	return p.createProperty(name, transient, dataType, "")
+}
+
+// Adds a new transient property whose values are stored in a property
+// family.
+func (p *PropertyFile) CreateFamilyProperty(name string, dataType string, family string) (*Property, error) {
+	if err := validatePropertyFamily(family); err != nil {
+		return nil, err
+	}
+	return p.createProperty(name, true, dataType, family)
+}
+
+// Adds a new property in a copy of the schema and publishes it.
+func (p *PropertyFile) createProperty(name string, transient bool, dataType string, family string) (*Property, error) {
+	p.mutex.Lock()
+	defer p.mutex.Unlock()
+	schema := p.schema()
+
 	// Don't allow duplicate names.
-	if p.propertiesByName[name] != nil {
+	if schema.propertiesByName[name] != nil {
 		return nil, errors.New("Property already exists.")
 	}
 
@@ -79,25 +139,132 @@ func (p *PropertyFile) CreateProperty(name string, transient bool, dataType stri
 	if err != nil {
 		return nil, err
 	}
+	property.Family = family
 
 	// Find the next object/action identifier.
 	if property.Transient {
-		_, property.Id = p.NextIdentifiers()
+		_, property.Id = schema.NextIdentifiers()
 	} else {
-		property.Id, _ = p.NextIdentifiers()
+		property.Id, _ = schema.NextIdentifiers()
 	}
 
-	// Add to the list.
-	p.properties[property.Id] = property
-	p.propertiesByName[property.Name] = property
+	// Add to a copy of the lookups.
+	schema = schema.clone()
+	schema.properties[property.Id] = property
+	schema.propertiesByName[property.Name] = property
+	p.publish(schema)
 
 	return property, nil
 }
 
+// Changes a copy of a property and publishes it. Returns the changed copy.
+func (p *PropertyFile) UpdateProperty(id int64, update func(property *Property)) (*Property, error) {
+	p.mutex.Lock()
+	defer p.mutex.Unlock()
+	schema := p.schema()
+	existing := schema.properties[id]
+	if existing == nil {
+		return nil, errors.New("Property does not exist.")
+	}
+
+	property := *existing
+	update(&property)
+	if other := schema.propertiesByName[property.Name]; other != nil && other.Id != id {
+		return nil, errors.New("Property already exists.")
+	}
+
+	schema = schema.clone()
+	if existing.Name != "" {
+		delete(schema.propertiesByName, existing.Name)
+	}
+	schema.properties[id] = &property
+	if property.Name != "" {
+		schema.propertiesByName[property.Name] = &property
+	}
+	p.publish(schema)
+	return &property, nil
+}
+
 // Retrieves a list of undeleted properties sorted by id.
 func (p *PropertyFile) GetProperties() []*Property {
+	return p.schema().GetProperties()
+}
+
+// Retrieves a list of all properties sorted by id.
+func (p *PropertyFile) GetAllProperties() []*Property {
+	return p.schema().GetAllProperties()
+}
+
+// Retrieves a single property by id.
+func (p *PropertyFile) GetProperty(id int64) *Property {
+	return p.schema().properties[id]
+}
+
+// Retrieves a single property by name.
+func (p *PropertyFile) GetPropertyByName(name string) *Property {
+	return p.schema().propertiesByName[name]
+}
+
+// Retrieves the family of each property that is stored in one. Returns nil
+// if the table has no property families.
+func (p *PropertyFile) PropertyFamilies() map[int64]string {
+	return p.schema().PropertyFamilies()
+}
+
+// Retrieves the names of the property families sorted by name.
+func (p *PropertyFile) Families() []string {
+	return p.schema().Families()
+}
+
+// Deletes a property.
+func (p *PropertyFile) DeleteProperty(property *Property) {
+	if property == nil || property.Name == "" {
+		return
+	}
+	p.mutex.Lock()
+	defer p.mutex.Unlock()
+	schema := p.schema().clone()
+	delete(schema.properties, property.Id)
+	delete(schema.propertiesByName, property.Name)
+	p.publish(schema)
+}
+
+// Clears out the property file.
+func (p *PropertyFile) Reset() {
+	p.mutex.Lock()
+	defer p.mutex.Unlock()
+	var version uint64
+	if schema := p.schema(); schema != nil {
+		version = schema.version
+	}
+	p.publish(newPropertySchema(version + 1))
+}
+
+//--------------------------------------
+// Schema
+//--------------------------------------
+
+// Returns a copy of the schema with the next version.
+func (s *propertySchema) clone() *propertySchema {
+	other := newPropertySchema(s.version + 1)
+	for id, property := range s.properties {
+		other.properties[id] = property
+	}
+	for name, property := range s.propertiesByName {
+		other.propertiesByName[name] = property
+	}
+	return other
+}
+
+// The version of the property file that the schema was published as.
+func (s *propertySchema) Version() uint64 {
+	return s.version
+}
+
+// Retrieves a list of undeleted properties sorted by id.
+func (s *propertySchema) GetProperties() []*Property {
 	list := make([]*Property, 0)
-	for _, property := range p.propertiesByName {
+	for _, property := range s.propertiesByName {
 		list = append(list, property)
 	}
 	sort.Sort(PropertyList(list))
@@ -105,9 +272,9 @@ func (p *PropertyFile) GetProperties() []*Property {
 }
 
 // Retrieves a list of all properties sorted by id.
-func (p *PropertyFile) GetAllProperties() []*Property {
+func (s *propertySchema) GetAllProperties() []*Property {
 	list := make([]*Property, 0)
-	for _, property := range p.properties {
+	for _, property := range s.properties {
 		list = append(list, property)
 	}
 	sort.Sort(PropertyList(list))
@@ -115,27 +282,57 @@ func (p *PropertyFile) GetAllProperties() []*Property {
 }
 
 // Retrieves a single property by id.
-func (p *PropertyFile) GetProperty(id int64) *Property {
-	return p.properties[id]
+func (s *propertySchema) GetProperty(id int64) *Property {
+	return s.properties[id]
 }
 
 // Retrieves a single property by name.
-func (p *PropertyFile) GetPropertyByName(name string) *Property {
-	return p.propertiesByName[name]
+func (s *propertySchema) GetPropertyByName(name string) *Property {
+	return s.propertiesByName[name]
 }
 
-// Deletes a property.
-func (p *PropertyFile) DeleteProperty(property *Property) {
-	if property != nil && property.Name != "" {
-		delete(p.properties, property.Id)
-		delete(p.propertiesByName, property.Name)
+// Retrieves the family of each property that is stored in one. Returns nil
+// if the schema has no property families.
+func (s *propertySchema) PropertyFamilies() map[int64]string {
+	var families map[int64]string
+	for id, property := range s.properties {
+		if property.Family != "" {
+			if families == nil {
+				families = make(map[int64]string)
+			}
+			families[id] = property.Family
+		}
 	}
+	return families
 }
 
-// Clears out the property file.
-func (p *PropertyFile) Reset() {
-	p.properties = make(map[int64]*Property)
-	p.propertiesByName = make(map[string]*Property)
+// Retrieves the names of the property families sorted by name.
+func (s *propertySchema) Families() []string {
+	lookup := make(map[string]bool)
+	for _, property := range s.properties {
+		if property.Family != "" {
+			lookup[property.Family] = true
+		}
+	}
+	families := make([]string, 0, len(lookup))
+	for family := range lookup {
+		families = append(families, family)
+	}
+	sort.Strings(families)
+	return families
+}
+
+// Finds the next available action and object property identifiers.
+func (s *propertySchema) NextIdentifiers() (int64, int64) {
+	var nextPermanentId, nextTransientId int64 = 1, -1
+	for _, property := range s.properties {
+		if property.Transient && property.Id <= nextTransientId {
+			nextTransientId = property.Id - 1
+		} else if !property.Transient && property.Id >= nextPermanentId {
+			nextPermanentId = property.Id + 1
+		}
+	}
+	return nextPermanentId, nextTransientId
 }
 
 //--------------------------------------
@@ -162,14 +359,17 @@ func (p *PropertyFile) Decode(reader io.Reader) error {
 		return err
 	}
 
-	// Create lookups for the properties.
-	p.Reset()
+	// Create lookups for the properties and publish them.
+	p.mutex.Lock()
+	defer p.mutex.Unlock()
+	schema := newPropertySchema(p.schema().version + 1)
 	for _, property := range list {
-		p.properties[property.Id] = property
+		schema.properties[property.Id] = property
 		if property.Name != "" {
-			p.propertiesByName[property.Name] = property
+			schema.propertiesByName[property.Name] = property
 		}
 	}
+	p.publish(schema)
 
 	return nil
 }
@@ -222,16 +422,21 @@ func (p *PropertyFile) IsOpen() bool {
 // Persistence
 //--------------------------------------
 
-// Saves the property file to disk.
+// Saves the current schema to disk. The file is written beside the old one
+// and renamed over it so that it's never left partially written.
 func (p *PropertyFile) Save() error {
+	p.mutex.Lock()
+	defer p.mutex.Unlock()
+
 	// Open the file for writing.
-	file, err := os.Create(p.path)
+	path := p.path + ".tmp"
+	file, err := os.Create(path)
 	if err != nil {
 		return err
 	}
 	defer file.Close()
 
-	// Then decode it.
+	// Then encode it.
 	w := bufio.NewWriter(file)
 	err = p.Encode(w)
 	if err != nil {
@@ -240,8 +445,10 @@ func (p *PropertyFile) Save() error {
 	if err = w.Flush(); err != nil {
 		return err
 	}
-
-	return nil
+	if err = file.Close(); err != nil {
+		return err
+	}
+	return os.Rename(path, p.path)
 }
 
 //--------------------------------------
@@ -250,10 +457,11 @@ func (p *PropertyFile) Save() error {
 
 // Converts a map with string keys to use property identifier keys.
 func (p *PropertyFile) NormalizeMap(m map[string]interface{}) (map[int64]interface{}, error) {
+	schema := p.schema()
 	clone := make(map[int64]interface{})
 	for k, v := range m {
 		// Look up the property by name and convert it to the ID.
-		property := p.GetPropertyByName(string(k))
+		property := schema.propertiesByName[string(k)]
 		if property != nil {
 			clone[property.Id] = v
 		} else {
@@ -265,10 +473,11 @@ func (p *PropertyFile) NormalizeMap(m map[string]interface{}) (map[int64]interfa
 
 // Converts a map with property identifier keys to use string keys.
 func (p *PropertyFile) DenormalizeMap(m map[int64]interface{}) (map[string]interface{}, error) {
+	schema := p.schema()
 	clone := make(map[string]interface{})
 	for k, v := range m {
 		// Look up the property by ID and convert it to the name.
-		property := p.GetProperty(k)
+		property := schema.properties[k]
 		if property != nil {
 			clone[property.Name] = v
 		} else {
@@ -297,13 +506,5 @@ func (p *PropertyFile) Factorize(property *Property, value interface{}) (interfa
 
 // Finds the next available action and object property identifiers.
 func (p *PropertyFile) NextIdentifiers() (int64, int64) {
-	var nextPermanentId, nextTransientId int64 = 1, -1
-	for _, property := range p.properties {
-		if property.Transient && property.Id <= nextTransientId {
-			nextTransientId = property.Id - 1
-		} else if !property.Transient && property.Id >= nextPermanentId {
-			nextPermanentId = property.Id + 1
-		}
-	}
-	return nextPermanentId, nextTransientId
+	return p.schema().NextIdentifiers()
 }
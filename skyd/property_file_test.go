@@ -35,10 +35,10 @@ func TestPropertyFileDecode(t *testing.T) {
 	if err != nil {
 		t.Fatalf("Unable to decode property file: %v", err)
 	}
-	assertProperty(t, p.properties[-2], -2, "isMember", true, "boolean")
-	assertProperty(t, p.properties[-1], -1, "purchaseAmount", true, "integer")
-	assertProperty(t, p.properties[1], 1, "name", false, "string")
-	assertProperty(t, p.properties[2], 2, "salary", false, "float")
+	assertProperty(t, p.GetProperty(-2), -2, "isMember", true, "boolean")
+	assertProperty(t, p.GetProperty(-1), -1, "purchaseAmount", true, "integer")
+	assertProperty(t, p.GetProperty(1), 1, "name", false, "string")
+	assertProperty(t, p.GetProperty(2), 2, "salary", false, "float")
 }
 
 // Convert a map of string keys into property id keys.
@@ -86,3 +86,31 @@ func TestPropertyFileDenormalizeMap(t *testing.T) {
 		t.Fatalf("ret[\"purchaseAmount\"]: Expected %q, got %q", 12, ret["purchaseAmount"])
 	}
 }
+
+// Ensure that schemas already read aren't changed by later changes.
+func TestPropertyFileSnapshots(t *testing.T) {
+	p := NewPropertyFile("")
+	name, _ := p.CreateProperty("name", false, "string")
+	schema := p.schema()
+	p.CreateProperty("salary", false, "float")
+	if schema.GetPropertyByName("salary") != nil || p.GetPropertyByName("salary") == nil {
+		t.Fatalf("Created property published to the wrong schema.")
+	}
+	if p.Version() != schema.Version()+1 {
+		t.Fatalf("Unexpected version: %d (was %d)", p.Version(), schema.Version())
+	}
+
+	renamed, err := p.UpdateProperty(name.Id, func(property *Property) { property.Name = "fullName" })
+	if err != nil {
+		t.Fatalf("Unable to update property: %v", err)
+	}
+	if name.Name != "name" || schema.GetPropertyByName("name") != name {
+		t.Fatalf("Published property changed: %v", name)
+	}
+	if p.GetPropertyByName("name") != nil || p.GetPropertyByName("fullName") != renamed || p.GetProperty(name.Id) != renamed {
+		t.Fatalf("Renamed property not published: %v", renamed)
+	}
+	if _, err := p.UpdateProperty(name.Id, func(property *Property) { property.Name = "salary" }); err == nil {
+		t.Fatalf("Expected rename to an existing name to fail.")
+	}
+}
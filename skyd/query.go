@@ -5,8 +5,22 @@ import (
 	"encoding/json"
 	"fmt"
 	"io"
+	"math"
+	"strings"
+	"time"
 )
 
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The most objects that a query can list. Listed objects are always sought
+// to individually, so the list is kept to the number of members that a
+// cohort query seeks to.
+const queryObjectsLimit = queryCohortSeekLimit
+
 //------------------------------------------------------------------------------
 //
 // Typedefs
@@ -17,9 +31,25 @@ import (
 type Query struct {
 	table           *Table
 	factors         *Factors
+	snapshotId      string
+	priority        int
+	timeout         time.Duration
+	cancelled       <-chan bool
 	sequence        int
+	marks           *queryCohortMarks
+	sampleFloor     float64
+	profileSteps    bool
 	Steps           QueryStepList
 	SessionIdleTime int
+	TimeRangeStart  time.Time
+	TimeRangeEnd    time.Time
+	Sample          float64
+	MinEvents       int
+	MinSpan         int
+	State           bool
+	Spill           bool
+	Cohort          string
+	Objects         []string
 }
 
 //------------------------------------------------------------------------------
@@ -53,6 +83,55 @@ func (q *Query) Factors() *Factors {
 	return q.factors
 }
 
+// Retrieves the id of the registered snapshot that the query reads. An
+// empty id reads the current data.
+func (q *Query) SnapshotId() string {
+	return q.snapshotId
+}
+
+// Sets the id of the registered snapshot that the query reads.
+func (q *Query) SetSnapshotId(id string) {
+	q.snapshotId = id
+}
+
+// Retrieves the priority class that the query is scheduled with.
+func (q *Query) Priority() int {
+	return q.priority
+}
+
+// Sets the priority class that the query is scheduled with.
+func (q *Query) SetPriority(priority int) {
+	q.priority = priority
+}
+
+// Retrieves the time that the query can run for before it's cancelled.
+func (q *Query) Timeout() time.Duration {
+	return q.timeout
+}
+
+// Sets the time that the query can run for before it's cancelled. Zero
+// leaves the query unbounded.
+func (q *Query) SetTimeout(timeout time.Duration) {
+	q.timeout = timeout
+}
+
+// Retrieves the channel that cancels the query when it receives.
+func (q *Query) Cancelled() <-chan bool {
+	return q.cancelled
+}
+
+// Sets a channel that cancels the query when it receives, such as when the
+// client that sent the query goes away.
+func (q *Query) SetCancelled(cancelled <-chan bool) {
+	q.cancelled = cancelled
+}
+
+// Checks whether the query marks the objects that reach its selections
+// instead of aggregating them, such as to materialize a cohort.
+func (q *Query) marking() bool {
+	return q.marks != nil
+}
+
 //------------------------------------------------------------------------------
 //
 // Methods
@@ -69,6 +148,34 @@ func (q *Query) Serialize() map[string]interface{} {
 		"sessionIdleTime": q.SessionIdleTime,
 		"steps":           q.Steps.Serialize(),
 	}
+	if !q.TimeRangeStart.IsZero() || !q.TimeRangeEnd.IsZero() {
+		obj["timeRange"] = []interface{}{formatQueryTime(q.TimeRangeStart), formatQueryTime(q.TimeRangeEnd)}
+	}
+	if q.sampled() {
+		obj["sample"] = q.Sample
+	}
+	if q.MinEvents > 0 {
+		obj["minEvents"] = q.MinEvents
+	}
+	if q.MinSpan > 0 {
+		obj["minSpan"] = q.MinSpan
+	}
+	if q.State {
+		obj["state"] = true
+	}
+	if q.Spill {
+		obj["spill"] = true
+	}
+	if q.Cohort != "" {
+		obj["cohort"] = q.Cohort
+	}
+	if len(q.Objects) > 0 {
+		objects := make([]interface{}, len(q.Objects))
+		for i, objectId := range q.Objects {
+			objects[i] = objectId
+		}
+		obj["objects"] = objects
+	}
 	return obj
 }
 
@@ -83,13 +190,177 @@ func (q *Query) Deserialize(obj map[string]interface{}) error {
 		return fmt.Errorf("Invalid 'sessionIdleTime': %v", obj["sessionIdleTime"])
 	}
 
+	// Deserialize "time range". Either side can be null to leave it open.
+	q.TimeRangeStart, q.TimeRangeEnd = time.Time{}, time.Time{}
+	if timeRange, ok := obj["timeRange"].([]interface{}); ok && len(timeRange) == 2 {
+		if q.TimeRangeStart, err = parseQueryTime(timeRange[0]); err != nil {
+			return fmt.Errorf("Invalid 'timeRange' start: %v", timeRange[0])
+		}
+		if q.TimeRangeEnd, err = parseQueryTime(timeRange[1]); err != nil {
+			return fmt.Errorf("Invalid 'timeRange' end: %v", timeRange[1])
+		}
+		if !q.TimeRangeStart.IsZero() && !q.TimeRangeEnd.IsZero() && !q.TimeRangeStart.Before(q.TimeRangeEnd) {
+			return fmt.Errorf("Invalid 'timeRange': %v", obj["timeRange"])
+		}
+	} else if obj["timeRange"] != nil {
+		return fmt.Errorf("Invalid 'timeRange': %v", obj["timeRange"])
+	}
+
+	// Deserialize "state". State queries read the current state of each
+	// object as its only event so they can't have a time range.
+	if state, ok := obj["state"].(bool); ok || obj["state"] == nil {
+		q.State = state
+	} else {
+		return fmt.Errorf("Invalid 'state': %v", obj["state"])
+	}
+	if q.State && (!q.TimeRangeStart.IsZero() || !q.TimeRangeEnd.IsZero()) {
+		return fmt.Errorf("Invalid 'timeRange': State queries don't read events")
+	}
+
+	// Deserialize "sample". A ratio of one reads every object.
+	q.Sample = 0
+	if sample, ok := obj["sample"].(float64); ok && sample > 0 && sample <= 1 {
+		if sample < 1 {
+			q.Sample = sample
+		}
+	} else if obj["sample"] != nil {
+		return fmt.Errorf("Invalid 'sample': %v", obj["sample"])
+	}
+
+	// Deserialize "min events" and "min span". Objects with fewer events,
+	// or whose first and last events are fewer seconds apart, are skipped
+	// before their events are read. Both count every event of an object,
+	// whatever the time range.
+	if minEvents, ok := obj["minEvents"].(float64); (ok && minEvents >= 0 && minEvents <= math.MaxUint32) || obj["minEvents"] == nil {
+		q.MinEvents = int(minEvents)
+	} else {
+		return fmt.Errorf("Invalid 'minEvents': %v", obj["minEvents"])
+	}
+	if minSpan, ok := obj["minSpan"].(float64); (ok && minSpan >= 0) || obj["minSpan"] == nil {
+		q.MinSpan = int(minSpan)
+	} else {
+		return fmt.Errorf("Invalid 'minSpan': %v", obj["minSpan"])
+	}
+	if q.State && (q.MinEvents > 0 || q.MinSpan > 0) {
+		return fmt.Errorf("Invalid 'minEvents': State queries don't read events")
+	}
+
+	// Deserialize "cohort". Only the members of a saved cohort are read.
+	if cohort, ok := obj["cohort"].(string); ok || obj["cohort"] == nil {
+		q.Cohort = cohort
+	} else {
+		return fmt.Errorf("Invalid 'cohort': %v", obj["cohort"])
+	}
+
+	// Deserialize "objects". Only the listed objects are read, each by
+	// seeking straight to it.
+	q.Objects = nil
+	if objects, ok := obj["objects"].([]interface{}); ok {
+		if len(objects) > queryObjectsLimit {
+			return fmt.Errorf("Invalid 'objects': More than %d objects", queryObjectsLimit)
+		} else if q.Cohort != "" {
+			return fmt.Errorf("Invalid 'objects': Queries can't list objects and read a cohort")
+		}
+		q.Objects = make([]string, len(objects))
+		for i, objectId := range objects {
+			if q.Objects[i], ok = objectId.(string); !ok || q.Objects[i] == "" {
+				return fmt.Errorf("Invalid 'objects': %v", objectId)
+			}
+		}
+	} else if obj["objects"] != nil {
+		return fmt.Errorf("Invalid 'objects': %v", obj["objects"])
+	}
+
 	q.Steps, err = DeserializeQueryStepList(obj["steps"], q)
 	if err != nil {
 		return err
 	}
+
+	// Deserialize "spill". The partial results of aggregations that outgrow
+	// their budget are written to disk and merged back a group at a time.
+	// Limited selections drop groups as they go so they can't spill.
+	if spill, ok := obj["spill"].(bool); ok || obj["spill"] == nil {
+		q.Spill = spill
+	} else {
+		return fmt.Errorf("Invalid 'spill': %v", obj["spill"])
+	}
+	if q.Spill && queryStepsLimited(q.Steps) {
+		return fmt.Errorf("Invalid 'spill': Selections with a limit can't spill")
+	}
 	return nil
 }
 
+// Returns whether the query reads only a sample of the objects.
+func (q *Query) sampled() bool {
+	return q.Sample > 0 && q.Sample < 1
+}
+
+// Returns the largest margin of error in a finalized sampled result as a
+// share of the estimate it belongs to, and whether the result has any. An
+// estimate of zero with a margin has an infinite share.
+func queryResultError(data map[interface{}]interface{}) (float64, bool) {
+	var max float64
+	found := false
+	for k, v := range data {
+		if m, ok := v.(map[interface{}]interface{}); ok {
+			if e, ok := queryResultError(m); ok {
+				max, found = math.Max(max, e), true
+			}
+			continue
+		}
+		name, ok := k.(string)
+		if !ok || !strings.HasSuffix(name, "_error") {
+			continue
+		}
+		margin, ok := toFloat(normalize(v))
+		value, vok := toFloat(normalize(data[strings.TrimSuffix(name, "_error")]))
+		if !ok || !vok {
+			continue
+		}
+		e := 0.0
+		if value != 0 {
+			e = margin / math.Abs(value)
+		} else if margin > 0 {
+			e = math.Inf(1)
+		}
+		max, found = math.Max(max, e), true
+	}
+	return max, found
+}
+
+// Checks whether any selection in a step list, including nested ones, has
+// a limit.
+func queryStepsLimited(steps QueryStepList) bool {
+	for _, step := range steps {
+		if selection, ok := step.(*QuerySelection); ok && selection.Limit > 0 {
+			return true
+		}
+		if queryStepsLimited(step.GetSteps()) {
+			return true
+		}
+	}
+	return false
+}
+
+// Parses one side of a time range. Null leaves it unbounded.
+func parseQueryTime(value interface{}) (time.Time, error) {
+	if value == nil {
+		return time.Time{}, nil
+	}
+	if str, ok := value.(string); ok {
+		return time.Parse(time.RFC3339, str)
+	}
+	return time.Time{}, fmt.Errorf("Invalid time: %v", value)
+}
+
+// Formats one side of a time range.
+func formatQueryTime(value time.Time) interface{} {
+	if value.IsZero() {
+		return nil
+	}
+	return value.UTC().Format(time.RFC3339)
+}
+
 //--------------------------------------
 // Encoding
 //--------------------------------------
@@ -123,25 +394,126 @@ func (q *Query) Decode(reader io.Reader) error {
 func (q *Query) Codegen() (string, error) {
 	buffer := new(bytes.Buffer)
 
-	// Generate aggregation functions.
-	str, err := q.Steps.CodegenAggregateFunctions()
-	if err != nil {
+	if err := validateQueryElapsedSteps(q.Steps, map[string]bool{}); err != nil {
 		return "", err
 	}
-	buffer.WriteString(str)
-	buffer.WriteString(q.CodegenAggregateFunction())
+
+	// Profiled queries time the step functions that 'aggregate()' calls.
+	if q.profileSteps {
+		codegenStepProfile(buffer, q.stepFunctionNames())
+	}
+
+	// Generate aggregation functions. Queries made up of only selections
+	// read events in batches instead of one at a time.
+	if q.batchable() {
+		str, err := q.codegenBatchAggregateFunctions()
+		if err != nil {
+			return "", err
+		}
+		buffer.WriteString(str)
+	} else {
+		str, err := q.Steps.CodegenAggregateFunctions()
+		if err != nil {
+			return "", err
+		}
+		buffer.WriteString(str)
+		buffer.WriteString(q.CodegenAggregateFunction())
+	}
 
 	// Generate merge functions.
-	str, err = q.Steps.CodegenMergeFunctions()
+	str, err := q.Steps.CodegenMergeFunctions()
 	if err != nil {
 		return "", err
 	}
 	buffer.WriteString(str)
 	buffer.WriteString(q.CodegenMergeFunction())
 
+	// Generate the cursor filter.
+	filter, err := q.CodegenFilter()
+	if err != nil {
+		return "", err
+	}
+	if filter != nil {
+		fmt.Fprintf(buffer, "sky_filter = %s\n", luaQuote(string(filter)))
+	}
+
+	// Queries that can run as a native kernel carry its plan. The Lua
+	// aggregation above is kept for engines that can't bind the kernel.
+	if kernel := q.kernel(); kernel != nil {
+		plan, err := json.Marshal(kernel)
+		if err != nil {
+			return "", err
+		}
+		fmt.Fprintf(buffer, "sky_kernel = %s\n", luaQuote(string(plan)))
+	}
+
+	// The session idle time is set once when the cursor is initialized since
+	// the cursor keeps it for every object.
+	if q.SessionIdleTime > 0 {
+		fmt.Fprintf(buffer, "sky_session_idle = %d\n", q.SessionIdleTime)
+	}
+
 	return buffer.String(), nil
 }
 
+// Checks that every elapsed_since() field names a condition that encloses
+// its selection. The names are those of the enclosing conditions.
+func validateQueryElapsedSteps(steps QueryStepList, names map[string]bool) error {
+	for _, step := range steps {
+		switch step := step.(type) {
+		case *QuerySelection:
+			for _, field := range step.Fields {
+				for _, name := range field.elapsedSteps() {
+					if !names[name] {
+						return fmt.Errorf("skyd.Query: Step not found for %s: %q", field.Name, name)
+					}
+				}
+			}
+		case *QueryCondition:
+			if step.Name == "" {
+				if err := validateQueryElapsedSteps(step.Steps, names); err != nil {
+					return err
+				}
+				continue
+			}
+			inner := map[string]bool{step.Name: true}
+			for name := range names {
+				inner[name] = true
+			}
+			if err := validateQueryElapsedSteps(step.Steps, inner); err != nil {
+				return err
+			}
+		}
+	}
+	return nil
+}
+
+// Generates a filter program that lets the C cursor skip events before they
+// reach Lua. A filter is only generated when every top-level step is a
+// condition on the current event, in which case the filter is the "or" of
+// their expressions. Otherwise nil is returned.
+func (q *Query) CodegenFilter() ([]byte, error) {
+	if len(q.Steps) == 0 {
+		return nil, nil
+	}
+	for _, step := range q.Steps {
+		if condition, ok := step.(*QueryCondition); !ok || !condition.filterable() {
+			return nil, nil
+		}
+	}
+
+	buffer := new(bytes.Buffer)
+	for i, step := range q.Steps {
+		if err := step.(*QueryCondition).CodegenFilter(buffer); err != nil {
+			return nil, err
+		}
+		if i > 0 {
+			buffer.WriteByte(queryFilterOpOr)
+		}
+	}
+	return buffer.Bytes(), nil
+}
+
 // Generates the 'aggregate()' function.
 func (q *Query) CodegenAggregateFunction() string {
 	buffer := new(bytes.Buffer)
@@ -149,18 +521,18 @@ func (q *Query) CodegenAggregateFunction() string {
 	// Generate the function definition.
 	fmt.Fprintln(buffer, "function aggregate(cursor, data)")
 
-	// Set the session idle if one is available.
-	if q.SessionIdleTime > 0 {
-		fmt.Fprintf(buffer, "  cursor:set_session_idle(%d)\n", q.SessionIdleTime)
-	}
-
-	// Begin cursor loop.
+	// Begin cursor loop. An event held by a condition whose time window it
+	// ended is visited again instead of moving past it.
 	fmt.Fprintln(buffer, "  while cursor:next_session() do")
-	fmt.Fprintln(buffer, "    while cursor:next() do")
+	fmt.Fprintln(buffer, "    sky_held = false")
+	fmt.Fprintln(buffer, "    while sky_held or cursor:next() do")
+	fmt.Fprintln(buffer, "      sky_held = false")
 
 	// Call each step function.
-	for _, step := range q.Steps {
-		fmt.Fprintf(buffer, "      %s(cursor, data)\n", step.FunctionName())
+	if q.profileSteps {
+		codegenProfiledStepCalls(buffer, "      ", q.stepFunctionNames(), "(cursor, data)")
+	} else {
+		buffer.WriteString(q.Steps.CodegenAggregateInvoke("      "))
 	}
 
 	// End cursor loop.
@@ -173,6 +545,131 @@ func (q *Query) CodegenAggregateFunction() string {
 	return buffer.String()
 }
 
+// Checks whether every top-level step is a selection. Selections don't
+// depend on the position of the cursor so they can read batches of events.
+// Queries that mark objects need the cursor to be on each object.
+func (q *Query) batchable() bool {
+	if len(q.Steps) == 0 || q.marking() {
+		return false
+	}
+	for _, step := range q.Steps {
+		if _, ok := step.(*QuerySelection); !ok {
+			return false
+		}
+	}
+	return true
+}
+
+// Checks whether the results of the query add up across parts of an object
+// that are scanned apart, like the parts in each time partition of a
+// servlet. Each part only has its own events and state, so only selections
+// of events by their time and transient values count the same as over the
+// whole object. Conditions, sessions, object bounds, time operands,
+// permanent properties, marks and states all depend on the object's other
+// events.
+func (q *Query) partitionable() bool {
+	if !q.batchable() || q.State || q.SessionIdleTime > 0 || q.MinEvents > 0 || q.MinSpan > 0 {
+		return false
+	}
+	for _, step := range q.Steps {
+		selection := step.(*QuerySelection)
+		for _, dimension := range selection.Dimensions {
+			if !isTimeDimension(dimension) && q.permanentProperty(dimension) {
+				return false
+			}
+		}
+		for _, field := range selection.Fields {
+			if field.timeOperand() || q.permanentProperty(field.propertyName()) {
+				return false
+			}
+		}
+	}
+	return true
+}
+
+// Checks whether a property of the query's table is permanent. Unknown
+// properties are reported when the query's engines are created.
+func (q *Query) permanentProperty(name string) bool {
+	if name == "" || q.table == nil || q.table.propertyFile == nil {
+		return false
+	}
+	property := q.table.propertyFile.GetPropertyByName(name)
+	return property != nil && !property.Transient
+}
+
+// Generates the selection functions and an 'aggregate()' function that
+// decodes each object in batches.
+func (q *Query) codegenBatchAggregateFunctions() (string, error) {
+	buffer := new(bytes.Buffer)
+	for _, step := range q.Steps {
+		code, err := step.(*QuerySelection).CodegenBatchAggregateFunction()
+		if err != nil {
+			return "", err
+		}
+		fmt.Fprintln(buffer, code)
+	}
+
+	fmt.Fprintln(buffer, "function aggregate(cursor, data)")
+	fmt.Fprintln(buffer, "  while true do")
+	fmt.Fprintln(buffer, "    local n = cursor:next_batch()")
+	fmt.Fprintln(buffer, "    if n == 0 then break end")
+	if q.profileSteps {
+		codegenProfiledStepCalls(buffer, "    ", q.stepFunctionNames(), "(batch, n, data)")
+	} else {
+		for _, step := range q.Steps {
+			fmt.Fprintf(buffer, "    %s(batch, n, data)\n", step.FunctionName())
+		}
+	}
+	fmt.Fprintln(buffer, "  end")
+	fmt.Fprintln(buffer, "end")
+	fmt.Fprintln(buffer, "")
+
+	return buffer.String(), nil
+}
+
+// Returns the names of the functions that 'aggregate()' calls: one per
+// selection for batched queries and one per run of steps otherwise.
+func (q *Query) stepFunctionNames() []string {
+	names := make([]string, 0, len(q.Steps))
+	if q.batchable() {
+		for _, step := range q.Steps {
+			names = append(names, step.FunctionName())
+		}
+		return names
+	}
+	for _, run := range q.Steps.aggregateRuns() {
+		names = append(names, aggregateRunFunctionName(run))
+	}
+	return names
+}
+
+// Generates the step function calls of a profiled query, which time each
+// call with the cursor's clock and add it to the step's total. The totals
+// are declared in front of the calls by codegenStepProfile().
+func codegenProfiledStepCalls(buffer *bytes.Buffer, indent string, names []string, args string) {
+	fmt.Fprintf(buffer, "%slocal sky_t0 = ffi.C.sky_clock_ns()\n", indent)
+	for i, name := range names {
+		fmt.Fprintf(buffer, "%s%s%s\n", indent, name, args)
+		fmt.Fprintf(buffer, "%slocal sky_t%d = ffi.C.sky_clock_ns()\n", indent, i+1)
+		fmt.Fprintf(buffer, "%ssky_step_ns[%d] = sky_step_ns[%d] + (sky_t%d - sky_t%d)\n", indent, i, i, i+1, i)
+	}
+}
+
+// Generates the step totals of a profiled query and a 'sky_step_times()'
+// function that returns them in nanoseconds by function name and resets
+// them.
+func codegenStepProfile(buffer *bytes.Buffer, names []string) {
+	fmt.Fprintf(buffer, "local sky_step_ns = ffi.new('double[%d]')\n", len(names))
+	fmt.Fprintln(buffer, "function sky_step_times()")
+	fmt.Fprintln(buffer, "  local times = {}")
+	for i, name := range names {
+		fmt.Fprintf(buffer, "  times[%q] = sky_step_ns[%d]\n", name, i)
+	}
+	fmt.Fprintln(buffer, "  ffi.fill(sky_step_ns, ffi.sizeof(sky_step_ns))")
+	fmt.Fprintln(buffer, "  return times")
+	fmt.Fprintln(buffer, "end")
+}
+
 // Generates the 'merge()' function.
 func (q *Query) CodegenMergeFunction() string {
 	buffer := new(bytes.Buffer)
@@ -195,6 +692,79 @@ func (q *Query) NextIdentifier() int {
 	return q.sequence
 }
 
+//--------------------------------------
+// Merging
+//--------------------------------------
+
+// Merges the aggregate results of one scan into another without going
+// through Lua. The merged results are returned and may be either argument.
+func (q *Query) Merge(results interface{}, data interface{}) (interface{}, error) {
+	d, ok := data.(map[interface{}]interface{})
+	if !ok {
+		return results, nil
+	}
+	r, ok := results.(map[interface{}]interface{})
+	if !ok {
+		return d, nil
+	}
+	if err := q.Steps.Merge(r, d); err != nil {
+		return nil, err
+	}
+	return r, nil
+}
+
+//--------------------------------------
+// Finalization
+//--------------------------------------
+
+// Converts merged results into their final values. Sketches built by
+// approximate aggregates are replaced by their estimates.
+func (q *Query) Finalize(data interface{}) error {
+	return q.Steps.Finalize(data)
+}
+
+//--------------------------------------
+// Streaming
+//--------------------------------------
+
+// Splits finalized results into records that can be written out one at a
+// time. Each group of the first dimension of a selection is its own record
+// and whatever is left is the last record. Deep merging the records
+// rebuilds the results. The results are emptied as they're split.
+func (q *Query) Split(data map[interface{}]interface{}, fn func(map[interface{}]interface{}) error) error {
+	return q.splitKeyed(data, func(key string, record map[interface{}]interface{}) error {
+		return fn(record)
+	})
+}
+
+// Splits results into records like Split and passes each one along with a
+// key that names its group. Records of the same group split from different
+// results have the same key, and the last record's key is empty.
+func (q *Query) splitKeyed(data map[interface{}]interface{}, fn func(string, map[interface{}]interface{}) error) error {
+	if err := splitQueryResults(q.Steps, data, fn); err != nil {
+		return err
+	}
+	if len(data) > 0 {
+		return fn("", data)
+	}
+	return nil
+}
+
+// Recursively splits the results of each selection in a step list.
+func splitQueryResults(steps QueryStepList, data map[interface{}]interface{}, fn func(string, map[interface{}]interface{}) error) error {
+	for _, step := range steps {
+		if selection, ok := step.(*QuerySelection); ok {
+			if err := selection.Split(data, fn); err != nil {
+				return err
+			}
+		}
+		if err := splitQueryResults(step.GetSteps(), data, fn); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
 //--------------------------------------
 // Factorization
 //--------------------------------------
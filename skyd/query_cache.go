@@ -0,0 +1,155 @@
+package skyd
+
+import (
+	"container/list"
+	"sync"
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A QueryCache holds the partial results of recent queries for each servlet
+// so that repeated queries only rescan the servlets that have been written
+// to since. Queries are keyed by their table, the version of the table's
+// property file and their serialized form. Each partial is stored with the
+// write version of its servlet at the time of the scan and is only used
+// while the servlet is still at that version. The least recently used query
+// is evicted when the cache is full.
+type QueryCache struct {
+	sync.Mutex
+	capacity int
+	entries  map[string]*list.Element
+	lru      *list.List
+}
+
+// The cached partial results of a single query.
+type queryCacheEntry struct {
+	key      string
+	partials map[int]*queryCachePartial
+}
+
+// The results of a query for a single servlet.
+type queryCachePartial struct {
+	version uint64
+	result  map[interface{}]interface{}
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructor
+//
+//------------------------------------------------------------------------------
+
+// Creates a new cache that holds the results of up to a given number of
+// queries.
+func NewQueryCache(capacity int) *QueryCache {
+	return &QueryCache{
+		capacity: capacity,
+		entries:  make(map[string]*list.Element),
+		lru:      list.New(),
+	}
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Copies the maps and slices of a result so that it can be merged without
+// modifying the original.
+func copyQueryResult(value interface{}) interface{} {
+	switch value := value.(type) {
+	case map[interface{}]interface{}:
+		m := make(map[interface{}]interface{}, len(value))
+		for k, v := range value {
+			m[k] = copyQueryResult(v)
+		}
+		return m
+	case []interface{}:
+		a := make([]interface{}, len(value))
+		for i, v := range value {
+			a[i] = copyQueryResult(v)
+		}
+		return a
+	}
+	return value
+}
+
+//------------------------------------------------------------------------------
+//
+// Properties
+//
+//------------------------------------------------------------------------------
+
+// The maximum number of queries held by the cache.
+func (c *QueryCache) Capacity() int {
+	return c.capacity
+}
+
+// The number of queries currently held by the cache.
+func (c *QueryCache) Len() int {
+	c.Lock()
+	defer c.Unlock()
+	return c.lru.Len()
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// Retrieves a copy of the cached result of a query for a servlet. Nil is
+// returned if there is no result for the servlet's current write version.
+func (c *QueryCache) Get(key string, servlet int, version uint64) map[interface{}]interface{} {
+	c.Lock()
+	defer c.Unlock()
+	elem := c.entries[key]
+	if elem == nil {
+		return nil
+	}
+	c.lru.MoveToFront(elem)
+	partial := elem.Value.(*queryCacheEntry).partials[servlet]
+	if partial == nil || partial.version != version {
+		return nil
+	}
+	return copyQueryResult(partial.result).(map[interface{}]interface{})
+}
+
+// Stores a copy of the result of a query for a servlet at a write version.
+func (c *QueryCache) Put(key string, servlet int, version uint64, result map[interface{}]interface{}) {
+	if c.capacity <= 0 || result == nil {
+		return
+	}
+	partial := &queryCachePartial{version, copyQueryResult(result).(map[interface{}]interface{})}
+
+	c.Lock()
+	defer c.Unlock()
+	if elem := c.entries[key]; elem != nil {
+		c.lru.MoveToFront(elem)
+		elem.Value.(*queryCacheEntry).partials[servlet] = partial
+		return
+	}
+
+	// Evict the least recently used queries to make room.
+	for c.lru.Len() >= c.capacity {
+		elem := c.lru.Back()
+		delete(c.entries, elem.Value.(*queryCacheEntry).key)
+		c.lru.Remove(elem)
+	}
+
+	entry := &queryCacheEntry{key, map[int]*queryCachePartial{servlet: partial}}
+	c.entries[key] = c.lru.PushFront(entry)
+}
+
+// Removes all queries from the cache.
+func (c *QueryCache) Clear() {
+	c.Lock()
+	defer c.Unlock()
+	c.entries = make(map[string]*list.Element)
+	c.lru.Init()
+}
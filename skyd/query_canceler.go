@@ -0,0 +1,110 @@
+package skyd
+
+import (
+	"errors"
+	"fmt"
+	"sync"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A queryCanceler stops the scans of a query's engines once the query runs
+// past its timeout or its cancel channel receives. Cancelled engines stop
+// at their next object so that abandoned queries free their workers
+// quickly.
+type queryCanceler struct {
+	sync.Mutex
+	engines []*ExecutionEngine
+	err     error
+	stopped bool
+	stop    chan bool
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Watches a query's engines until the canceler is closed. The timeout is
+// measured from the start time given. Nothing is watched if the query has
+// neither a timeout nor a cancel channel.
+func newQueryCanceler(query *Query, engines []*ExecutionEngine, start time.Time) *queryCanceler {
+	c := &queryCanceler{engines: engines, stop: make(chan bool)}
+	timeout, cancelled := query.Timeout(), query.Cancelled()
+	if timeout <= 0 && cancelled == nil {
+		return c
+	}
+
+	// Queries whose client is already gone or that used up their time
+	// waiting to start are cancelled right away.
+	timedOut := fmt.Errorf("skyd.Server: Query timed out after %v", timeout)
+	clientGone := errors.New("skyd.Server: Query cancelled by client")
+	remaining := timeout - time.Since(start)
+	select {
+	case <-cancelled:
+		c.cancel(clientGone)
+		return c
+	default:
+	}
+	if timeout > 0 && remaining <= 0 {
+		c.cancel(timedOut)
+		return c
+	}
+
+	var timer *time.Timer
+	var deadline <-chan time.Time
+	if timeout > 0 {
+		timer = time.NewTimer(remaining)
+		deadline = timer.C
+	}
+	go func() {
+		if timer != nil {
+			defer timer.Stop()
+		}
+		select {
+		case <-deadline:
+			c.cancel(timedOut)
+		case <-cancelled:
+			c.cancel(clientGone)
+		case <-c.stop:
+		}
+	}()
+	return c
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// Cancels every engine of the query unless the canceler has been closed.
+func (c *queryCanceler) cancel(err error) {
+	c.Lock()
+	defer c.Unlock()
+	if c.stopped {
+		return
+	}
+	c.err = err
+	for _, e := range c.engines {
+		e.Cancel()
+	}
+}
+
+// Stops watching the query. This must be called before the engines are
+// released. Returns the reason the query was cancelled, if it was.
+func (c *queryCanceler) close() error {
+	c.Lock()
+	defer c.Unlock()
+	if !c.stopped {
+		c.stopped = true
+		close(c.stop)
+	}
+	return c.err
+}
@@ -0,0 +1,397 @@
+package skyd
+
+import (
+	"bufio"
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"os"
+	"path/filepath"
+	"regexp"
+	"sort"
+	"sync"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The most members that a query seeks to individually. Larger cohorts are
+// only checked by key as the scan passes each object.
+const queryCohortSeekLimit = factorIndexCandidateLimit
+
+// The start and version of a saved cohort file.
+const (
+	queryCohortFileMagic   = "SKYC"
+	queryCohortFileVersion = 1
+)
+
+// Cohort names are used as file names so they're kept to a safe set of
+// characters.
+var queryCohortNamePattern = regexp.MustCompile(`^[A-Za-z0-9_][A-Za-z0-9_.\-]*$`)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A QueryCohort is a named set of objects of a table that queries can be
+// restricted to, such as a segment of users that dashboards filter by over
+// and over. It's materialized by running a query that marks the objects
+// that reach any of its selections instead of aggregating them, and the
+// keys of the members found on each servlet are saved in the table's
+// directory. Queries that give the cohort's name only read its members.
+type QueryCohort struct {
+	sync.Mutex
+	name     string
+	table    string
+	version  uint64
+	servlets []*queryCohortMembers
+	all      *queryCohortMembers
+}
+
+// The sorted keys of a set of objects stored back to back. Each member is
+// its offset into the keys and runs up to the next member.
+type queryCohortMembers struct {
+	keys    []byte
+	offsets []uint32
+}
+
+// The keys marked by each servlet of a query that materializes a cohort.
+type queryCohortMarks struct {
+	sync.Mutex
+	servlets map[int][][]byte
+}
+
+// The cohorts of every table by table and name. Saved cohorts are loaded
+// the first time they're used.
+type queryCohortSet struct {
+	sync.Mutex
+	cohorts map[string]*QueryCohort
+	version uint64
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates a cohort of a table from the keys marked on each servlet.
+func newQueryCohort(table string, name string, servlets []*queryCohortMembers) *QueryCohort {
+	return &QueryCohort{table: table, name: name, servlets: servlets}
+}
+
+// Sorts and dedupes a list of keys into members.
+func newQueryCohortMembers(keys [][]byte) (*queryCohortMembers, error) {
+	sort.Sort(byteSliceList(keys))
+	m := &queryCohortMembers{offsets: make([]uint32, 0, len(keys))}
+	var buffer bytes.Buffer
+	for i, key := range keys {
+		if i > 0 && bytes.Equal(key, keys[i-1]) {
+			continue
+		}
+		if buffer.Len()+len(key) > 1<<32-1 {
+			return nil, errors.New("skyd.QueryCohort: Too many members")
+		}
+		m.offsets = append(m.offsets, uint32(buffer.Len()))
+		buffer.Write(key)
+	}
+	m.keys = buffer.Bytes()
+	return m, nil
+}
+
+// Creates an empty set of marks.
+func newQueryCohortMarks() *queryCohortMarks {
+	return &queryCohortMarks{servlets: make(map[int][][]byte)}
+}
+
+// Creates an empty set of cohorts.
+func newQueryCohortSet() *queryCohortSet {
+	return &queryCohortSet{cohorts: make(map[string]*QueryCohort)}
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Checks that a cohort name can be saved.
+func validateQueryCohortName(name string) error {
+	if !queryCohortNamePattern.MatchString(name) {
+		return fmt.Errorf("skyd.QueryCohort: Invalid cohort name: %s", name)
+	}
+	return nil
+}
+
+// The path that a table's cohort is saved to.
+func queryCohortPath(table *Table, name string) string {
+	return filepath.Join(table.Path(), "cohorts", name)
+}
+
+// Reads a cohort saved in a table's directory. Returns nil if there's no
+// such cohort.
+func loadQueryCohort(table *Table, name string) (*QueryCohort, error) {
+	file, err := os.Open(queryCohortPath(table, name))
+	if os.IsNotExist(err) {
+		return nil, nil
+	} else if err != nil {
+		return nil, err
+	}
+	defer file.Close()
+
+	r := bufio.NewReader(file)
+	var header struct {
+		Magic    [4]byte
+		Version  uint32
+		Servlets uint32
+	}
+	if err := binary.Read(r, binary.LittleEndian, &header); err != nil {
+		return nil, err
+	}
+	if string(header.Magic[:]) != queryCohortFileMagic || header.Version != queryCohortFileVersion {
+		return nil, fmt.Errorf("skyd.QueryCohort: Invalid cohort file: %s", name)
+	}
+	servlets := make([]*queryCohortMembers, header.Servlets)
+	for i := range servlets {
+		var sizes struct {
+			Count uint32
+			Size  uint32
+		}
+		if err := binary.Read(r, binary.LittleEndian, &sizes); err != nil {
+			return nil, err
+		}
+		m := &queryCohortMembers{offsets: make([]uint32, sizes.Count), keys: make([]byte, sizes.Size)}
+		if err := binary.Read(r, binary.LittleEndian, m.offsets); err != nil {
+			return nil, err
+		}
+		if _, err := io.ReadFull(r, m.keys); err != nil {
+			return nil, err
+		}
+		servlets[i] = m
+	}
+	return newQueryCohort(table.Name, name, servlets), nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Accessors
+//--------------------------------------
+
+// The name of the cohort.
+func (c *QueryCohort) Name() string {
+	return c.name
+}
+
+// The number of objects in the cohort.
+func (c *QueryCohort) Count() int {
+	count := 0
+	for _, m := range c.servlets {
+		count += m.count()
+	}
+	return count
+}
+
+// Encodes the cohort into an untyped map.
+func (c *QueryCohort) Serialize() map[string]interface{} {
+	return map[string]interface{}{
+		"name":  c.name,
+		"table": c.table,
+		"count": c.Count(),
+	}
+}
+
+//--------------------------------------
+// Members
+//--------------------------------------
+
+// Retrieves the members that a servlet can hold. The members found on each
+// servlet are only used while the servlets are placed as they were when the
+// cohort was materialized. Otherwise every member is used.
+func (c *QueryCohort) members(index int, count int) (*queryCohortMembers, error) {
+	if len(c.servlets) == count && index < count {
+		return c.servlets[index], nil
+	}
+
+	c.Lock()
+	defer c.Unlock()
+	if c.all == nil {
+		keys := make([][]byte, 0)
+		for _, m := range c.servlets {
+			keys = append(keys, m.list()...)
+		}
+		all, err := newQueryCohortMembers(keys)
+		if err != nil {
+			return nil, err
+		}
+		c.all = all
+	}
+	return c.all, nil
+}
+
+// Writes the cohort to a table's directory, replacing any cohort saved
+// under its name.
+func (c *QueryCohort) save(table *Table) error {
+	path := queryCohortPath(table, c.name)
+	if err := os.MkdirAll(filepath.Dir(path), 0700); err != nil {
+		return err
+	}
+	file, err := os.Create(path + ".tmp")
+	if err != nil {
+		return err
+	}
+	defer file.Close()
+
+	w := bufio.NewWriter(file)
+	w.WriteString(queryCohortFileMagic)
+	binary.Write(w, binary.LittleEndian, []uint32{queryCohortFileVersion, uint32(len(c.servlets))})
+	for _, m := range c.servlets {
+		binary.Write(w, binary.LittleEndian, []uint32{uint32(len(m.offsets)), uint32(len(m.keys))})
+		binary.Write(w, binary.LittleEndian, m.offsets)
+		w.Write(m.keys)
+	}
+	if err := w.Flush(); err != nil {
+		return err
+	}
+	if err := file.Sync(); err != nil {
+		return err
+	}
+	return os.Rename(path+".tmp", path)
+}
+
+// The number of members.
+func (m *queryCohortMembers) count() int {
+	return len(m.offsets)
+}
+
+// Returns the key of a member.
+func (m *queryCohortMembers) key(i int) []byte {
+	end := uint32(len(m.keys))
+	if i+1 < len(m.offsets) {
+		end = m.offsets[i+1]
+	}
+	return m.keys[m.offsets[i]:end]
+}
+
+// Returns the keys of every member in order.
+func (m *queryCohortMembers) list() [][]byte {
+	keys := make([][]byte, len(m.offsets))
+	for i := range keys {
+		keys[i] = m.key(i)
+	}
+	return keys
+}
+
+// Generates the skip ranges of a table that leave only the members, along
+// with the ranges that are already skipped. Returns nil if there are too
+// many members to seek to each one.
+func (m *queryCohortMembers) skipRanges(prefix []byte, skip []keyRange) []keyRange {
+	if m.count() > queryCohortSeekLimit {
+		return nil
+	}
+	return objectSkipRanges(prefix, m.list(), skip)
+}
+
+//--------------------------------------
+// Marks
+//--------------------------------------
+
+// Adds the keys marked by one of a servlet's engines.
+func (m *queryCohortMarks) add(index int, keys [][]byte) {
+	m.Lock()
+	defer m.Unlock()
+	m.servlets[index] = append(m.servlets[index], keys...)
+}
+
+// Sorts the keys marked on each of a number of servlets into members.
+func (m *queryCohortMarks) members(count int) ([]*queryCohortMembers, error) {
+	m.Lock()
+	defer m.Unlock()
+	servlets := make([]*queryCohortMembers, count)
+	for i := range servlets {
+		var err error
+		if servlets[i], err = newQueryCohortMembers(m.servlets[i]); err != nil {
+			return nil, err
+		}
+	}
+	return servlets, nil
+}
+
+//--------------------------------------
+// Registration
+//--------------------------------------
+
+// Saves a cohort and registers it under a new version so that results
+// cached for an earlier cohort of the same name aren't reused.
+func (set *queryCohortSet) put(table *Table, c *QueryCohort) error {
+	if err := c.save(table); err != nil {
+		return err
+	}
+	set.Lock()
+	defer set.Unlock()
+	set.version++
+	c.version = set.version
+	set.cohorts[table.Name+"/"+c.name] = c
+	return nil
+}
+
+// Retrieves a cohort of a table, loading it if it isn't registered yet.
+func (set *queryCohortSet) get(table *Table, name string) (*QueryCohort, error) {
+	if err := validateQueryCohortName(name); err != nil {
+		return nil, err
+	}
+	set.Lock()
+	defer set.Unlock()
+	if c := set.cohorts[table.Name+"/"+name]; c != nil {
+		return c, nil
+	}
+	c, err := loadQueryCohort(table, name)
+	if err != nil {
+		return nil, err
+	} else if c == nil {
+		return nil, fmt.Errorf("skyd.Server: Cohort not found: %s", name)
+	}
+	set.version++
+	c.version = set.version
+	set.cohorts[table.Name+"/"+name] = c
+	return c, nil
+}
+
+// Unregisters a cohort and removes its file. Returns false if the table
+// has no such cohort.
+func (set *queryCohortSet) remove(table *Table, name string) (bool, error) {
+	if err := validateQueryCohortName(name); err != nil {
+		return false, err
+	}
+	set.Lock()
+	defer set.Unlock()
+	_, registered := set.cohorts[table.Name+"/"+name]
+	delete(set.cohorts, table.Name+"/"+name)
+	err := os.Remove(queryCohortPath(table, name))
+	if os.IsNotExist(err) {
+		return registered, nil
+	}
+	return err == nil, err
+}
+
+// Unregisters every cohort of a table, such as when it's deleted.
+func (set *queryCohortSet) drop(table string) {
+	set.Lock()
+	defer set.Unlock()
+	for key, c := range set.cohorts {
+		if c.table == table {
+			delete(set.cohorts, key)
+		}
+	}
+}
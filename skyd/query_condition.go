@@ -5,7 +5,6 @@ import (
 	"errors"
 	"fmt"
 	"regexp"
-	"strconv"
 )
 
 //------------------------------------------------------------------------------
@@ -18,22 +17,40 @@ const (
 	QueryConditionUnitSteps    = "steps"
 	QueryConditionUnitSessions = "sessions"
 	QueryConditionUnitSeconds  = "seconds"
+	QueryConditionUnitMinutes  = "minutes"
+	QueryConditionUnitHours    = "hours"
+	QueryConditionUnitDays     = "days"
 )
 
+// The length of each unit of a time window in seconds.
+var queryConditionUnitSeconds = map[string]int{
+	QueryConditionUnitSeconds: 1,
+	QueryConditionUnitMinutes: 60,
+	QueryConditionUnitHours:   3600,
+	QueryConditionUnitDays:    86400,
+}
+
+// Matches the name of a condition step.
+var queryConditionName = regexp.MustCompile(`^\w+$`)
+
 //------------------------------------------------------------------------------
 //
 // Typedefs
 //
 //------------------------------------------------------------------------------
 
-// A condition step made within a query.
+// A condition step made within a query. An overlapping condition moves the
+// cursor back to the event it started from once it's done looking ahead so
+// that matches starting from each of the following events are counted too.
 type QueryCondition struct {
 	query            *Query
 	functionName     string
+	Name             string
 	Expression       string
 	WithinRangeStart int
 	WithinRangeEnd   int
 	WithinUnits      string
+	Overlap          bool
 	Steps            QueryStepList
 }
 
@@ -93,13 +110,20 @@ func (c *QueryCondition) GetSteps() QueryStepList {
 
 // Encodes a query condition into an untyped map.
 func (c *QueryCondition) Serialize() map[string]interface{} {
-	return map[string]interface{}{
+	obj := map[string]interface{}{
 		"type":        QueryStepTypeCondition,
 		"expression":  c.Expression,
 		"within":      []int{c.WithinRangeStart, c.WithinRangeEnd},
 		"withinUnits": c.WithinUnits,
 		"steps":       c.Steps.Serialize(),
 	}
+	if c.Name != "" {
+		obj["name"] = c.Name
+	}
+	if c.Overlap {
+		obj["overlap"] = true
+	}
+	return obj
 }
 
 // Decodes a query condition from an untyped map.
@@ -111,6 +135,15 @@ func (c *QueryCondition) Deserialize(obj map[string]interface{}) error {
 		return fmt.Errorf("skyd.QueryCondition: Invalid step type: %v", obj["type"])
 	}
 
+	// Deserialize "name".
+	if name, ok := obj["name"].(string); ok && queryConditionName.MatchString(name) {
+		c.Name = name
+	} else if obj["name"] == nil {
+		c.Name = ""
+	} else {
+		return fmt.Errorf("skyd.QueryCondition: Invalid name: %v", obj["name"])
+	}
+
 	// Deserialize "expression".
 	if expression, ok := obj["expression"].(string); ok {
 		c.Expression = expression
@@ -146,7 +179,8 @@ func (c *QueryCondition) Deserialize(obj map[string]interface{}) error {
 	// Deserialize "within units".
 	if withinUnits, ok := obj["withinUnits"].(string); ok {
 		switch withinUnits {
-		case QueryConditionUnitSteps, QueryConditionUnitSessions, QueryConditionUnitSeconds:
+		case QueryConditionUnitSteps, QueryConditionUnitSessions, QueryConditionUnitSeconds,
+			QueryConditionUnitMinutes, QueryConditionUnitHours, QueryConditionUnitDays:
 			c.WithinUnits = withinUnits
 		default:
 			return fmt.Errorf("Invalid 'within units': %v", withinUnits)
@@ -159,6 +193,15 @@ func (c *QueryCondition) Deserialize(obj map[string]interface{}) error {
 		}
 	}
 
+	// Deserialize "overlap".
+	if overlap, ok := obj["overlap"].(bool); ok {
+		c.Overlap = overlap
+	} else if obj["overlap"] == nil {
+		c.Overlap = false
+	} else {
+		return fmt.Errorf("skyd.QueryCondition: Invalid 'overlap': %v", obj["overlap"])
+	}
+
 	// Deserialize steps.
 	var err error
 	c.Steps, err = DeserializeQueryStepList(obj["steps"], c.query)
@@ -189,17 +232,38 @@ func (c *QueryCondition) CodegenAggregateFunction() (string, error) {
 	}
 	buffer.WriteString(str)
 
-	// Generate main function.
-	fmt.Fprintf(buffer, "function %s(cursor, data)\n", c.FunctionName())
+	// Generate main function. The condition walks forward from the current
+	// event until its expression matches within the window. Time windows
+	// are measured from the current event's timestamp and the event that
+	// ends a window is held for the caller so that it isn't skipped. Any
+	// earlier hold is dropped since the cursor may move past it.
+	functionName := c.FunctionName()
+	if c.Overlap {
+		functionName += "_scan"
+	}
+	fmt.Fprintf(buffer, "function %s(cursor, data)\n", functionName)
+	fmt.Fprintf(buffer, "  sky_held = false\n")
 	if c.WithinRangeStart > 0 {
 		fmt.Fprintf(buffer, "  if cursor:eos() or cursor:eof() then return false end\n")
 	}
+	unit, timed := queryConditionUnitSeconds[c.WithinUnits]
 	if c.WithinUnits == QueryConditionUnitSteps {
 		fmt.Fprintf(buffer, "  index = 0\n")
+	} else if timed {
+		fmt.Fprintf(buffer, "  local start = cursor.event.timestamp\n")
 	}
 	fmt.Fprintf(buffer, "  repeat\n")
 	if c.WithinUnits == QueryConditionUnitSteps {
 		fmt.Fprintf(buffer, "    if index >= %d and index <= %d then\n", c.WithinRangeStart, c.WithinRangeEnd)
+	} else if timed {
+		fmt.Fprintf(buffer, "    local elapsed = cursor.event.timestamp - start\n")
+		fmt.Fprintf(buffer, "    if elapsed > %d then\n", c.WithinRangeEnd*unit)
+		fmt.Fprintf(buffer, "      sky_held = true\n")
+		fmt.Fprintf(buffer, "      return false\n")
+		fmt.Fprintf(buffer, "    end\n")
+		fmt.Fprintf(buffer, "    if elapsed >= %d then\n", c.WithinRangeStart*unit)
+	} else {
+		fmt.Fprintf(buffer, "    do\n")
 	}
 
 	// Generate conditional expression.
@@ -209,11 +273,14 @@ func (c *QueryCondition) CodegenAggregateFunction() (string, error) {
 	}
 	fmt.Fprintf(buffer, "      if %s then\n", expressionCode)
 
-	// Call each step function.
-	for _, step := range c.Steps {
-		fmt.Fprintf(buffer, "        %s(cursor, data)\n", step.FunctionName())
+	// Mark when a named condition matched for elapsed_since() fields below.
+	if c.Name != "" {
+		fmt.Fprintf(buffer, "        sky_step_%s = cursor.event.timestamp\n", c.Name)
 	}
 
+	// Call each step function.
+	buffer.WriteString(c.Steps.CodegenAggregateInvoke("        "))
+
 	fmt.Fprintf(buffer, "        return true\n")
 	fmt.Fprintf(buffer, "      end\n")
 	fmt.Fprintf(buffer, "    end\n")
@@ -227,6 +294,19 @@ func (c *QueryCondition) CodegenAggregateFunction() (string, error) {
 	// End function definition.
 	fmt.Fprintln(buffer, "end")
 
+	// An overlapping condition scans from a mark and then moves back to it.
+	// The events it looked at are replayed from the cursor rather than
+	// decoded again. If too many were read to move back then the condition
+	// carries on from where the scan stopped.
+	if c.Overlap {
+		fmt.Fprintf(buffer, "function %s(cursor, data)\n", c.FunctionName())
+		fmt.Fprintf(buffer, "  local mark = cursor:mark_event()\n")
+		fmt.Fprintf(buffer, "  local matched = %s(cursor, data)\n", functionName)
+		fmt.Fprintf(buffer, "  if mark >= 0 and cursor:restore(mark) then sky_held = false end\n")
+		fmt.Fprintf(buffer, "  return matched\n")
+		fmt.Fprintln(buffer, "end")
+	}
+
 	return buffer.String(), nil
 }
 
@@ -251,59 +331,61 @@ func (c *QueryCondition) CodegenExpression() (string, error) {
 		return c.Expression, nil
 	}
 
-	// Full expressions should be prepended with cursor's event reference.
-	r, _ := regexp.Compile(`^ *(\w+) *(==) *(?:"([^"]*)"|'([^']*)'|(\d+(?:\.\d+)?)|(true|false)) *$`)
-	m := r.FindSubmatch([]byte(c.Expression))
-	if m == nil {
-		return "", fmt.Errorf("skyd.QueryCondition: Invalid expression: %v", c.Expression)
+	expr, err := parseQueryExpression(c.query, c.Expression)
+	if err != nil {
+		return "", err
 	}
+	return expr.codegenLua(), nil
+}
 
-	// Find the property.
-	property := c.query.table.propertyFile.GetPropertyByName(string(m[1]))
-	if property == nil {
-		return "", fmt.Errorf("skyd.QueryCondition: Property not found: %v", string(m[1]))
+// Generates the cursor filter program for the expression.
+func (c *QueryCondition) CodegenFilter(buffer *bytes.Buffer) error {
+	expr, err := parseQueryExpression(c.query, c.Expression)
+	if err != nil {
+		return err
 	}
+	expr.codegenFilter(buffer)
+	return nil
+}
 
-	// Validate the expression value.
-	var value string
-	switch property.DataType {
-	case FactorDataType, StringDataType:
-		// Validate string value.
-		var stringValue string
-		if m[3] != nil {
-			stringValue = string(m[3])
-		} else if m[4] != nil {
-			stringValue = string(m[4])
-		} else {
-			return "", fmt.Errorf("skyd.QueryCondition: Expression value must be a string literal for string and factor properties: %v", c.Expression)
-		}
-
-		// Convert factors.
-		if property.DataType == FactorDataType {
-			sequence, err := c.query.factors.Factorize(c.query.table.Name, property.Name, stringValue, false)
-			if err != nil {
-				return "", err
-			} else {
-				value = strconv.FormatUint(sequence, 10)
+// Checks whether the condition only looks at the current event. Events that
+// fail the expression of such a condition can be skipped by the cursor
+// without changing the result.
+func (c *QueryCondition) filterable() bool {
+	if c.WithinUnits != QueryConditionUnitSteps || c.WithinRangeStart != 0 || c.WithinRangeEnd != 0 {
+		return false
+	}
+	for _, step := range c.Steps {
+		switch step := step.(type) {
+		case *QuerySelection:
+		case *QueryCondition:
+			if !step.filterable() {
+				return false
 			}
-		} else {
-			value = fmt.Sprintf(`"%s"`, stringValue)
+		default:
+			return false
 		}
+	}
+	return true
+}
 
-	case IntegerDataType, FloatDataType:
-		if m[5] == nil {
-			return "", fmt.Errorf("skyd.QueryCondition: Expression value must be a numeric literal for integer and float properties: %v", c.Expression)
-		}
-		value = string(m[5])
+//--------------------------------------
+// Merging
+//--------------------------------------
 
-	case BooleanDataType:
-		if m[6] == nil {
-			return "", fmt.Errorf("skyd.QueryCondition: Expression value must be a boolean literal for boolean properties: %v", c.Expression)
-		}
-		value = string(m[6])
-	}
+// Conditions don't produce results of their own. Their child steps are
+// merged by the step list.
+func (c *QueryCondition) Merge(results map[interface{}]interface{}, data map[interface{}]interface{}) error {
+	return nil
+}
+
+//--------------------------------------
+// Finalization
+//--------------------------------------
 
-	return fmt.Sprintf("cursor.event:%s() %s %s", m[1], m[2], value), nil
+// Finalizes the results of the condition's child steps.
+func (c *QueryCondition) Finalize(data interface{}) error {
+	return c.Steps.Finalize(data)
 }
 
 //--------------------------------------
@@ -0,0 +1,439 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/binary"
+	"fmt"
+	"math"
+	"regexp"
+	"strconv"
+	"strings"
+	"unicode"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// Filter opcodes understood by the C cursor. These match the SKY_FILTER_*
+// definitions in csky's cursor.h.
+const (
+	queryFilterOpTrue  = 0x01
+	queryFilterOpFalse = 0x02
+	queryFilterOpAnd   = 0x03
+	queryFilterOpOr    = 0x04
+	queryFilterOpCmp   = 0x10
+)
+
+const (
+	queryFilterValueNumber  = 1
+	queryFilterValueString  = 2
+	queryFilterValueBoolean = 3
+)
+
+// The comparison operators and their filter codes.
+var queryFilterComparisons = map[string]byte{
+	"==": 1,
+	"!=": 2,
+	"<":  3,
+	"<=": 4,
+	">":  5,
+	">=": 6,
+}
+
+// The deepest stack a filter can use in the C cursor.
+const maxQueryFilterDepth = 32
+
+// Numeric literals that are valid in both Go and Lua.
+var queryNumberLiteral = regexp.MustCompile(`^-?\d+(?:\.\d+)?$`)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A parsed condition expression. Expressions can generate Lua for the
+// generated aggregate functions and a postfix program that the C cursor
+// evaluates before an event reaches Lua.
+type queryExpression interface {
+	codegenLua() string
+	codegenFilter(buffer *bytes.Buffer)
+	depth() int
+}
+
+// A boolean literal.
+type queryBooleanExpression struct {
+	value bool
+}
+
+// Two expressions joined by "and" or "or".
+type queryBinaryExpression struct {
+	op  string
+	lhs queryExpression
+	rhs queryExpression
+}
+
+// A comparison of a property against a literal. Factor literals are
+// stored as their sequence.
+type queryComparisonExpression struct {
+	property *Property
+	op       string
+	value    interface{}
+	literal  string
+}
+
+// Parses an expression against a query's table and factors.
+type queryExpressionParser struct {
+	query  *Query
+	text   string
+	tokens []string
+	pos    int
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Parses a condition expression. Expressions are comparisons of properties
+// against literals (==, !=, <, <=, >, >=), IN-lists of literals and boolean
+// literals combined with "and", "or" and parentheses.
+func parseQueryExpression(query *Query, text string) (queryExpression, error) {
+	tokens, err := tokenizeQueryExpression(text)
+	if err != nil {
+		return nil, err
+	}
+	p := &queryExpressionParser{query: query, text: text, tokens: tokens}
+	expr, err := p.parseOr()
+	if err != nil {
+		return nil, err
+	}
+	if p.pos < len(p.tokens) {
+		return nil, p.invalid()
+	}
+	if expr.depth() > maxQueryFilterDepth {
+		return nil, fmt.Errorf("skyd.QueryCondition: Expression too complex: %v", text)
+	}
+	return expr, nil
+}
+
+// Splits an expression into identifiers, literals and operators. String
+// literals keep their quotes so they can be told apart from identifiers.
+func tokenizeQueryExpression(text string) ([]string, error) {
+	tokens := make([]string, 0)
+	for i := 0; i < len(text); {
+		ch := rune(text[i])
+		switch {
+		case unicode.IsSpace(ch):
+			i++
+		case ch == '"' || ch == '\'':
+			end := strings.IndexRune(text[i+1:], ch)
+			if end == -1 {
+				return nil, fmt.Errorf("skyd.QueryCondition: Unterminated string literal: %v", text)
+			}
+			tokens = append(tokens, text[i:i+end+2])
+			i += end + 2
+		case ch == '(' || ch == ')' || ch == ',':
+			tokens = append(tokens, text[i:i+1])
+			i++
+		case strings.ContainsRune("=!<>&|", ch):
+			j := i + 1
+			for j < len(text) && strings.ContainsRune("=&|", rune(text[j])) {
+				j++
+			}
+			tokens = append(tokens, text[i:j])
+			i = j
+		case ch == '-' || ch == '.' || ch == '_' || unicode.IsLetter(ch) || unicode.IsDigit(ch):
+			j := i + 1
+			for j < len(text) && (text[j] == '.' || text[j] == '_' || unicode.IsLetter(rune(text[j])) || unicode.IsDigit(rune(text[j]))) {
+				j++
+			}
+			tokens = append(tokens, text[i:j])
+			i = j
+		default:
+			return nil, fmt.Errorf("skyd.QueryCondition: Invalid expression: %v", text)
+		}
+	}
+	return tokens, nil
+}
+
+// Quotes a string as a Lua string literal.
+func luaQuote(s string) string {
+	buffer := new(bytes.Buffer)
+	buffer.WriteByte('"')
+	for i := 0; i < len(s); i++ {
+		if c := s[i]; c == '"' || c == '\\' || c < 0x20 || c >= 0x7F {
+			fmt.Fprintf(buffer, "\\%03d", c)
+		} else {
+			buffer.WriteByte(c)
+		}
+	}
+	buffer.WriteByte('"')
+	return buffer.String()
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Parsing
+//--------------------------------------
+
+// Returns the current token without consuming it.
+func (p *queryExpressionParser) peek() string {
+	if p.pos < len(p.tokens) {
+		return p.tokens[p.pos]
+	}
+	return ""
+}
+
+// Consumes and returns the current token.
+func (p *queryExpressionParser) next() string {
+	token := p.peek()
+	if p.pos < len(p.tokens) {
+		p.pos++
+	}
+	return token
+}
+
+// Returns an error for an expression that can't be parsed.
+func (p *queryExpressionParser) invalid() error {
+	return fmt.Errorf("skyd.QueryCondition: Invalid expression: %v", p.text)
+}
+
+// Parses expressions joined by "or".
+func (p *queryExpressionParser) parseOr() (queryExpression, error) {
+	lhs, err := p.parseAnd()
+	if err != nil {
+		return nil, err
+	}
+	for p.peek() == "or" || p.peek() == "||" {
+		p.next()
+		rhs, err := p.parseAnd()
+		if err != nil {
+			return nil, err
+		}
+		lhs = &queryBinaryExpression{"or", lhs, rhs}
+	}
+	return lhs, nil
+}
+
+// Parses expressions joined by "and".
+func (p *queryExpressionParser) parseAnd() (queryExpression, error) {
+	lhs, err := p.parseTerm()
+	if err != nil {
+		return nil, err
+	}
+	for p.peek() == "and" || p.peek() == "&&" {
+		p.next()
+		rhs, err := p.parseTerm()
+		if err != nil {
+			return nil, err
+		}
+		lhs = &queryBinaryExpression{"and", lhs, rhs}
+	}
+	return lhs, nil
+}
+
+// Parses a parenthesized expression, a boolean literal, a comparison or an
+// IN-list.
+func (p *queryExpressionParser) parseTerm() (queryExpression, error) {
+	token := p.next()
+	switch token {
+	case "(":
+		expr, err := p.parseOr()
+		if err != nil {
+			return nil, err
+		}
+		if p.next() != ")" {
+			return nil, p.invalid()
+		}
+		return expr, nil
+	case "true", "false":
+		return &queryBooleanExpression{token == "true"}, nil
+	case "":
+		return nil, p.invalid()
+	}
+
+	// Find the property.
+	property := p.query.table.propertyFile.GetPropertyByName(token)
+	if property == nil {
+		return nil, fmt.Errorf("skyd.QueryCondition: Property not found: %v", token)
+	}
+
+	// An IN-list is expanded into equality comparisons joined by "or".
+	if p.peek() == "in" {
+		p.next()
+		if p.next() != "(" {
+			return nil, p.invalid()
+		}
+		var expr queryExpression
+		for {
+			cmp, err := p.parseComparison(property, "==", p.next())
+			if err != nil {
+				return nil, err
+			}
+			if expr == nil {
+				expr = cmp
+			} else {
+				expr = &queryBinaryExpression{"or", expr, cmp}
+			}
+			if token := p.next(); token == ")" {
+				break
+			} else if token != "," {
+				return nil, p.invalid()
+			}
+		}
+		return expr, nil
+	}
+
+	op := p.next()
+	if _, ok := queryFilterComparisons[op]; !ok {
+		return nil, p.invalid()
+	}
+	return p.parseComparison(property, op, p.next())
+}
+
+// Validates a literal against a property and creates a comparison.
+func (p *queryExpressionParser) parseComparison(property *Property, op string, literal string) (queryExpression, error) {
+	isString := len(literal) >= 2 && (literal[0] == '"' || literal[0] == '\'')
+	isBoolean := literal == "true" || literal == "false"
+	number, err := strconv.ParseFloat(literal, 64)
+	isNumber := err == nil && queryNumberLiteral.MatchString(literal)
+
+	expr := &queryComparisonExpression{property: property, op: op, literal: literal}
+	switch property.DataType {
+	case FactorDataType, StringDataType:
+		// Validate string value.
+		if !isString {
+			return nil, fmt.Errorf("skyd.QueryCondition: Expression value must be a string literal for string and factor properties: %v", p.text)
+		}
+		stringValue := literal[1 : len(literal)-1]
+
+		// Convert factors. Sequences have no meaningful order.
+		if property.DataType == FactorDataType {
+			if op != "==" && op != "!=" {
+				return nil, fmt.Errorf("skyd.QueryCondition: Factor properties can only be compared with == or !=: %v", p.text)
+			}
+			sequence, err := p.query.factors.Factorize(p.query.table.Name, property.Name, stringValue, false)
+			if err != nil {
+				return nil, err
+			}
+			expr.value = float64(sequence)
+			expr.literal = strconv.FormatUint(sequence, 10)
+		} else {
+			expr.value = stringValue
+			expr.literal = luaQuote(stringValue)
+		}
+
+	case IntegerDataType, FloatDataType, Int8DataType, Int16DataType, Int32DataType, Int64DataType, Float32DataType:
+		if !isNumber {
+			return nil, fmt.Errorf("skyd.QueryCondition: Expression value must be a numeric literal for integer and float properties: %v", p.text)
+		}
+		expr.value = number
+
+	case BooleanDataType:
+		if !isBoolean {
+			return nil, fmt.Errorf("skyd.QueryCondition: Expression value must be a boolean literal for boolean properties: %v", p.text)
+		}
+		if op != "==" && op != "!=" {
+			return nil, fmt.Errorf("skyd.QueryCondition: Boolean properties can only be compared with == or !=: %v", p.text)
+		}
+		expr.value = (literal == "true")
+	}
+
+	return expr, nil
+}
+
+//--------------------------------------
+// Code Generation
+//--------------------------------------
+
+func (e *queryBooleanExpression) codegenLua() string {
+	return strconv.FormatBool(e.value)
+}
+
+func (e *queryBooleanExpression) codegenFilter(buffer *bytes.Buffer) {
+	if e.value {
+		buffer.WriteByte(queryFilterOpTrue)
+	} else {
+		buffer.WriteByte(queryFilterOpFalse)
+	}
+}
+
+func (e *queryBooleanExpression) depth() int {
+	return 1
+}
+
+func (e *queryBinaryExpression) codegenLua() string {
+	return fmt.Sprintf("(%s %s %s)", e.lhs.codegenLua(), e.op, e.rhs.codegenLua())
+}
+
+func (e *queryBinaryExpression) codegenFilter(buffer *bytes.Buffer) {
+	e.lhs.codegenFilter(buffer)
+	e.rhs.codegenFilter(buffer)
+	if e.op == "and" {
+		buffer.WriteByte(queryFilterOpAnd)
+	} else {
+		buffer.WriteByte(queryFilterOpOr)
+	}
+}
+
+// The right side is evaluated while the left side's result is on the stack.
+func (e *queryBinaryExpression) depth() int {
+	lhs, rhs := e.lhs.depth(), e.rhs.depth()+1
+	if lhs > rhs {
+		return lhs
+	}
+	return rhs
+}
+
+func (e *queryComparisonExpression) codegenLua() string {
+	op := e.op
+	if op == "!=" {
+		op = "~="
+	}
+	return fmt.Sprintf("%s %s %s", codegenPropertyRead(e.property, "cursor.event"), op, e.literal)
+}
+
+func (e *queryComparisonExpression) codegenFilter(buffer *bytes.Buffer) {
+	buffer.WriteByte(queryFilterOpCmp)
+	buffer.WriteByte(queryFilterComparisons[e.op])
+
+	var tmp [8]byte
+	switch value := e.value.(type) {
+	case float64:
+		buffer.WriteByte(queryFilterValueNumber)
+		binary.LittleEndian.PutUint64(tmp[:], uint64(e.property.Id))
+		buffer.Write(tmp[:])
+		binary.LittleEndian.PutUint64(tmp[:], math.Float64bits(value))
+		buffer.Write(tmp[:])
+	case bool:
+		buffer.WriteByte(queryFilterValueBoolean)
+		binary.LittleEndian.PutUint64(tmp[:], uint64(e.property.Id))
+		buffer.Write(tmp[:])
+		if value {
+			buffer.WriteByte(1)
+		} else {
+			buffer.WriteByte(0)
+		}
+	case string:
+		buffer.WriteByte(queryFilterValueString)
+		binary.LittleEndian.PutUint64(tmp[:], uint64(e.property.Id))
+		buffer.Write(tmp[:])
+		binary.LittleEndian.PutUint32(tmp[:4], uint32(len(value)))
+		buffer.Write(tmp[:4])
+		buffer.WriteString(value)
+	}
+}
+
+func (e *queryComparisonExpression) depth() int {
+	return 1
+}
@@ -0,0 +1,85 @@
+package skyd
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The most factors that a kernel group can be grouped by. This matches
+// SKY_KERNEL_MAX_DIMENSIONS in csky.
+const queryKernelMaxDimensions = 2
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A queryKernel is the plan of a query that runs as a native aggregation
+// kernel instead of in Lua. It's generated with the query's Lua source so
+// that engines, which only see the source, can find it.
+type queryKernel struct {
+	Groups []*queryKernelGroup `json:"groups"`
+}
+
+// A queryKernelGroup counts events and sums numeric properties by up to
+// two factors for a single selection.
+type queryKernelGroup struct {
+	Name       string              `json:"name,omitempty"`
+	Dimensions []string            `json:"dimensions"`
+	Fields     []*queryKernelField `json:"fields"`
+}
+
+// A field of a kernel group. Fields without a property count events.
+type queryKernelField struct {
+	Name     string `json:"name"`
+	Property string `json:"property,omitempty"`
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// Plans a native kernel for the query. Only queries made up of selections
+// that count events and sum numeric properties by up to two factors can
+// run natively. Everything else runs in Lua.
+func (q *Query) kernel() *queryKernel {
+	if !q.batchable() || q.table == nil || q.table.propertyFile == nil {
+		return nil
+	}
+	kernel := &queryKernel{}
+	for _, step := range q.Steps {
+		group := step.(*QuerySelection).kernelGroup(q.table.propertyFile)
+		if group == nil {
+			return nil
+		}
+		kernel.Groups = append(kernel.Groups, group)
+	}
+	return kernel
+}
+
+// Plans the kernel group of a selection or returns nil if the selection
+// can't run natively.
+func (s *QuerySelection) kernelGroup(propertyFile *PropertyFile) *queryKernelGroup {
+	if s.Limit > 0 || len(s.Dimensions) > queryKernelMaxDimensions {
+		return nil
+	}
+	for _, dimension := range s.Dimensions {
+		if property := propertyFile.GetPropertyByName(dimension); property == nil || property.DataType != FactorDataType {
+			return nil
+		}
+	}
+
+	group := &queryKernelGroup{Name: s.Name, Dimensions: s.Dimensions}
+	for _, field := range s.Fields {
+		property, ok := field.numericAggregate(propertyFile)
+		if !ok {
+			return nil
+		}
+		group.Fields = append(group.Fields, &queryKernelField{Name: field.Name, Property: property})
+	}
+	return group
+}
@@ -0,0 +1,311 @@
+package skyd
+
+import (
+	"encoding/binary"
+	"github.com/jmhodges/levigo"
+	"math"
+	"sort"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The ways that a query can read a table.
+const (
+	QueryPlanScan    = "scan"
+	QueryPlanZone    = "zone"
+	QueryPlanIndex   = "index"
+	QueryPlanRollup  = "rollup"
+	QueryPlanObjects = "objects"
+)
+
+// The largest fraction of a table's events that a filter can match for the
+// scan to seek to the objects listed by the factor indexes. Past it, the
+// seeks cost more than reading the objects in between.
+const queryPlanIndexSelectivity = 0.05
+
+// The largest fraction of a table's events that a query can read for the
+// zone maps to be consulted. Past it, few zones can be skipped.
+const queryPlanZoneSelectivity = 0.8
+
+// The number of events that each key range of a scan is sized to read.
+const queryPlanEventsPerRange = 250000
+
+// The fraction of events assumed to match a comparison whose values aren't
+// tracked by the statistics.
+const queryPlanDefaultSelectivity = 1.0 / 3
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A QueryPlan is the way that a query reads a table, chosen from the
+// table's statistics. It only changes how much of the table is read and in
+// how many pieces, never the result. Without statistics every access path
+// that can apply is tried and each servlet is split as far as the scan
+// parallelism allows.
+type QueryPlan struct {
+	AccessPath      string
+	Events          int64
+	EstimatedEvents int64
+	Ranges          int
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Estimates the fraction of events that a cursor filter matches. Equality
+// comparisons use the counts of the compared values and the other
+// comparisons use a fixed guess. Filters that can't be read are assumed to
+// match everything.
+func filterSelectivity(filter []byte, stats *TableStatistics, total int64) float64 {
+	stack := make([]float64, 0, maxQueryFilterDepth)
+	for i := 0; i < len(filter); {
+		switch filter[i] {
+		case queryFilterOpTrue:
+			stack = append(stack, 1)
+			i++
+		case queryFilterOpFalse:
+			stack = append(stack, 0)
+			i++
+		case queryFilterOpAnd, queryFilterOpOr:
+			if len(stack) < 2 {
+				return 1
+			}
+			lhs, rhs := stack[len(stack)-2], stack[len(stack)-1]
+			stack = stack[:len(stack)-1]
+			if filter[i] == queryFilterOpAnd {
+				stack[len(stack)-1] = lhs * rhs
+			} else {
+				stack[len(stack)-1] = lhs + rhs - lhs*rhs
+			}
+			i++
+		case queryFilterOpCmp:
+			if len(filter) < i+11 {
+				return 1
+			}
+			cmp, valueType := filter[i+1], filter[i+2]
+			id := int64(binary.LittleEndian.Uint64(filter[i+3:]))
+			value := filter[i+11:]
+			var literal interface{}
+			switch valueType {
+			case queryFilterValueNumber:
+				if len(value) < 8 {
+					return 1
+				}
+				// Missing values compare as zero so zero isn't estimated.
+				if number := math.Float64frombits(binary.LittleEndian.Uint64(value)); number != 0 {
+					literal = number
+				}
+				i += 19
+			case queryFilterValueBoolean:
+				i += 12
+			case queryFilterValueString:
+				if len(value) < 4 {
+					return 1
+				}
+				n := int(binary.LittleEndian.Uint32(value))
+				if len(value) < 4+n {
+					return 1
+				}
+				if n > 0 {
+					literal = string(value[4 : 4+n])
+				}
+				i += 15 + n
+			default:
+				return 1
+			}
+			stack = append(stack, comparisonSelectivity(cmp, id, literal, stats, total))
+		default:
+			return 1
+		}
+	}
+	if len(stack) == 0 {
+		return 1
+	}
+	return stack[len(stack)-1]
+}
+
+// Estimates the fraction of events that a single comparison matches.
+func comparisonSelectivity(cmp byte, id int64, literal interface{}, stats *TableStatistics, total int64) float64 {
+	eq, ne := queryFilterComparisons["=="], queryFilterComparisons["!="]
+	if (cmp != eq && cmp != ne) || literal == nil || total <= 0 {
+		return queryPlanDefaultSelectivity
+	}
+	fraction := float64(stats.EventsWithValue(id, literal)) / float64(total)
+	if fraction > 1 {
+		fraction = 1
+	}
+	if cmp == ne {
+		return 1 - fraction
+	}
+	return fraction
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Plan
+//--------------------------------------
+
+// Encodes a query plan into an untyped map.
+func (p *QueryPlan) Serialize() map[string]interface{} {
+	return map[string]interface{}{
+		"accessPath":      p.AccessPath,
+		"events":          p.Events,
+		"estimatedEvents": p.EstimatedEvents,
+		"ranges":          p.Ranges,
+	}
+}
+
+// Whether the scan skips the zones that can't match the query.
+func (p *QueryPlan) usesZones() bool {
+	return p.AccessPath == QueryPlanZone || p.AccessPath == QueryPlanIndex
+}
+
+// Whether the scan seeks to the objects that the factor indexes list. The
+// zones are used instead when an index can't answer the filter.
+func (p *QueryPlan) usesIndex() bool {
+	return p.AccessPath == QueryPlanIndex
+}
+
+// Divides the key ranges that the plan splits each servlet into among the
+// views of a query's servlets in proportion to how much of the table each
+// holds on disk and in frozen files. Object hashing spreads objects evenly
+// but not their events, so the views holding the heaviest objects are cut
+// into more and smaller sub-scans for idle workers to take while the total
+// stays the same. Each view gets at least one range and the rest go by
+// largest remainder. Views of servlets that aren't open keep their own
+// share, views are split evenly when nothing has been written to disk yet
+// and scans of listed objects aren't split.
+func (p *QueryPlan) viewRanges(views map[int][]*querySnapshotView, prefix []byte) map[*querySnapshotView]int {
+	indexes := make([]int, 0, len(views))
+	for index := range views {
+		indexes = append(indexes, index)
+	}
+	sort.Ints(indexes)
+
+	ranges := make(map[*querySnapshotView]int)
+	sizes := make(map[*querySnapshotView]uint64)
+	var sized []*querySnapshotView
+	var total uint64
+	for _, index := range indexes {
+		for _, view := range views[index] {
+			ranges[view] = p.Ranges
+			if view.servlet.db == nil {
+				continue
+			}
+			size := view.servlet.db.GetApproximateSizes([]levigo.Range{{Start: prefix, Limit: incrementKey(prefix)}})[0]
+			for _, f := range view.frozen {
+				size += uint64(len(f.data))
+			}
+			sizes[view] = size
+			sized = append(sized, view)
+			total += size
+		}
+	}
+	if p.AccessPath == QueryPlanObjects || p.Ranges < 1 || len(sized) < 2 || total == 0 {
+		return ranges
+	}
+
+	spare := uint64((p.Ranges - 1) * len(sized))
+	remainders := make(map[*querySnapshotView]uint64)
+	left := spare
+	for _, view := range sized {
+		n := spare * sizes[view] / total
+		ranges[view] = 1 + int(n)
+		remainders[view] = spare * sizes[view] % total
+		left -= n
+	}
+	picked := make(map[*querySnapshotView]bool)
+	for ; left > 0; left-- {
+		var next *querySnapshotView
+		for _, view := range sized {
+			if !picked[view] && (next == nil || remainders[view] > remainders[next]) {
+				next = view
+			}
+		}
+		ranges[next]++
+		picked[next] = true
+	}
+	return ranges
+}
+
+//--------------------------------------
+// Planning
+//--------------------------------------
+
+// Chooses how a query scans a table from the table's statistics. The
+// estimated number of events that the query matches picks the access path
+// and the number of events that the path reads picks how many key ranges
+// each servlet is split into. Rollups are matched before a query is
+// planned since a rollup's rows are always cheaper to read than events.
+func (s *Server) planQuery(table *Table, query *Query, filter []byte) *QueryPlan {
+	// Queries that list their objects seek to each of them, which reads
+	// far less than any scan, so the key range isn't split.
+	if len(query.Objects) > 0 {
+		return &QueryPlan{AccessPath: QueryPlanObjects, Ranges: 1}
+	}
+
+	plan := &QueryPlan{AccessPath: QueryPlanScan, Ranges: s.scanRangesPerServlet()}
+	ranged := !query.TimeRangeStart.IsZero() || !query.TimeRangeEnd.IsZero()
+	stats := table.Statistics()
+	var total int64
+	if stats != nil {
+		total = stats.Events()
+	}
+	if total == 0 {
+		if filter != nil {
+			plan.AccessPath = QueryPlanIndex
+		} else if ranged {
+			plan.AccessPath = QueryPlanZone
+		}
+		return plan
+	}
+
+	plan.Events = total
+	if ranged {
+		plan.Events = stats.EventsInRange(query.TimeRangeStart, query.TimeRangeEnd)
+	}
+	selectivity := 1.0
+	if filter != nil {
+		selectivity = filterSelectivity(filter, stats, total)
+	}
+	plan.EstimatedEvents = int64(float64(plan.Events)*selectivity + 0.5)
+
+	// The zones and index are only read when they skip enough of the
+	// table to pay for themselves.
+	work := total
+	switch {
+	case filter != nil && selectivity <= queryPlanIndexSelectivity:
+		plan.AccessPath, work = QueryPlanIndex, plan.EstimatedEvents
+	case (filter != nil || ranged) && float64(plan.EstimatedEvents) <= queryPlanZoneSelectivity*float64(total):
+		plan.AccessPath, work = QueryPlanZone, plan.EstimatedEvents
+	}
+
+	// Small scans aren't worth splitting across cores.
+	servlets := int64(len(s.servlets))
+	if servlets == 0 {
+		servlets = 1
+	}
+	ranges := int((work/servlets + queryPlanEventsPerRange - 1) / queryPlanEventsPerRange)
+	if ranges < 1 {
+		ranges = 1
+	}
+	if ranges < plan.Ranges {
+		plan.Ranges = ranges
+	}
+	return plan
+}
@@ -0,0 +1,65 @@
+package skyd
+
+import (
+	"fmt"
+	"github.com/jmhodges/levigo"
+	"io/ioutil"
+	"os"
+	"testing"
+	"time"
+)
+
+// Ensure that servlets holding more of a table are split into more ranges
+// without changing the total.
+func TestQueryPlanViewRanges(t *testing.T) {
+	table := NewTable("test", "/tmp/test")
+	prefix, _ := TablePrefix(table.Name)
+	servlets := make([]*Servlet, 3)
+	for i := range servlets {
+		path, _ := ioutil.TempDir("", "")
+		defer os.RemoveAll(path)
+		servlets[i] = NewServlet(path, nil)
+		defer servlets[i].Close()
+	}
+	_ = servlets[0].Open()
+	_ = servlets[1].Open()
+
+	// The first servlet holds far more events than the second and the
+	// third isn't open.
+	for i := 0; i < 100; i++ {
+		objectIds, events := make([]string, 20), make([]*Event, 20)
+		for j := range events {
+			objectIds[j] = fmt.Sprintf("obj%d", i)
+			events[j] = &Event{Timestamp: time.Unix(int64(1000+j), 0).UTC(), Data: map[int64]interface{}{-1: int64(i*1000 + j)}}
+		}
+		if err := servlets[0].PutEvents(table, objectIds, events, true); err != nil {
+			t.Fatalf("Unable to add events: %v", err)
+		}
+	}
+	e := &Event{Timestamp: time.Unix(1000, 0).UTC(), Data: map[int64]interface{}{-1: int64(1)}}
+	if err := servlets[1].PutEvent(table, "obj", e, true); err != nil {
+		t.Fatalf("Unable to add event: %v", err)
+	}
+	servlets[0].db.CompactRange(levigo.Range{})
+	servlets[1].db.CompactRange(levigo.Range{})
+
+	heavy, light, closed := &querySnapshotView{servlet: servlets[0]}, &querySnapshotView{servlet: servlets[1]}, &querySnapshotView{servlet: servlets[2]}
+	views := map[int][]*querySnapshotView{0: {heavy}, 1: {light}, 2: {closed}}
+	for _, n := range []int{2, 4} {
+		plan := &QueryPlan{AccessPath: QueryPlanScan, Ranges: n}
+		ranges := plan.viewRanges(views, prefix)
+		if ranges[heavy]+ranges[light]+ranges[closed] != plan.Ranges*len(views) {
+			t.Fatalf("Unexpected total for %d ranges: %d, %d, %d", n, ranges[heavy], ranges[light], ranges[closed])
+		}
+		if ranges[heavy] <= n || ranges[light] != 1 || ranges[closed] != n {
+			t.Fatalf("Unexpected ranges for %d ranges: %d, %d, %d", n, ranges[heavy], ranges[light], ranges[closed])
+		}
+	}
+
+	// Scans of listed objects aren't split.
+	plan := &QueryPlan{AccessPath: QueryPlanObjects, Ranges: 1}
+	ranges := plan.viewRanges(views, prefix)
+	if ranges[heavy] != 1 || ranges[light] != 1 || ranges[closed] != 1 {
+		t.Fatalf("Unexpected object ranges: %d, %d, %d", ranges[heavy], ranges[light], ranges[closed])
+	}
+}
@@ -0,0 +1,241 @@
+package skyd
+
+import (
+	"sort"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A QueryProfile breaks down where the time of a query went and shows the
+// plan that it ran with. Profiled queries skip the query cache so that
+// every servlet is scanned, apart from those only profiled for the slow
+// query log. The steps are the scan time of each step
+// function summed across servlets and the result size is the number of
+// entries in the merged result, counted at every level, before it's
+// finalized.
+type QueryProfile struct {
+	Source          string
+	Plan            *QueryPlan
+	QueueTime       time.Duration
+	CodegenTime     time.Duration
+	SetupTime       time.Duration
+	MergeTime       time.Duration
+	FinalizeTime    time.Duration
+	DefactorizeTime time.Duration
+	TotalTime       time.Duration
+	ResultSize      int
+	Servlets        []*ServletProfile
+	Steps           []QueryStepProfile
+	logOnly         bool
+}
+
+// A ServletProfile holds the work done to scan a single servlet, including
+// its time partitions and frozen files. The times of its engines are
+// summed, so they can add up to more than the servlet's total time when
+// its key ranges are scanned in parallel.
+//
+// The scan time covers both decoding events in the cursor and running the
+// aggregation in Lua since the two are interleaved call by call. The
+// object, event and byte counts show how much of it was decoding. Scans
+// run by a native kernel don't go through Lua at all. The block read time
+// is the part spent in storage reading, checksumming and uncompressing
+// blocks that weren't cached, and the skipped keys are the deleted and
+// overwritten entries that the iterators stepped over.
+//
+// The steps split the Lua part of the scan time by the step function that
+// the aggregation called. They're measured with a clock call around each
+// step, so they leave out the cursor and include some of the clock's own
+// overhead.
+type ServletProfile struct {
+	Index                  int
+	Engines                int
+	CompileTime            time.Duration
+	SeekTime               time.Duration
+	ScanTime               time.Duration
+	MergeTime              time.Duration
+	TotalTime              time.Duration
+	Objects                uint64
+	Events                 uint64
+	Bytes                  uint64
+	BlockCacheHits         uint64
+	BlockCacheMisses       uint64
+	BlockReadBytes         uint64
+	BlockUncompressedBytes uint64
+	BlockReadTime          time.Duration
+	KeysSkipped            uint64
+	TraceAborts            int
+	LuaHeapBytes           uint64
+	KernelScans            int
+	Steps                  []QueryStepProfile
+}
+
+// A QueryStepProfile is the time spent in one of the generated step
+// functions of a query. The line is where the function is defined in the
+// engine's full annotated source.
+type QueryStepProfile struct {
+	Function string
+	Line     int
+	Time     time.Duration
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Counts the entries of a query result at every level of its groups.
+func queryResultSize(value interface{}) int {
+	m, ok := value.(map[interface{}]interface{})
+	if !ok {
+		return 0
+	}
+	n := len(m)
+	for _, v := range m {
+		n += queryResultSize(v)
+	}
+	return n
+}
+
+// Converts a duration to fractional milliseconds.
+func profileMillis(d time.Duration) float64 {
+	return float64(d) / float64(time.Millisecond)
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// Encodes a query profile into an untyped map. Times are in milliseconds.
+func (p *QueryProfile) Serialize() map[string]interface{} {
+	servlets := make([]interface{}, 0, len(p.Servlets))
+	for _, s := range p.Servlets {
+		servlets = append(servlets, s.Serialize())
+	}
+	var plan interface{}
+	if p.Plan != nil {
+		plan = p.Plan.Serialize()
+	}
+	return map[string]interface{}{
+		"source":          p.Source,
+		"plan":            plan,
+		"queueTime":       profileMillis(p.QueueTime),
+		"codegenTime":     profileMillis(p.CodegenTime),
+		"setupTime":       profileMillis(p.SetupTime),
+		"mergeTime":       profileMillis(p.MergeTime),
+		"finalizeTime":    profileMillis(p.FinalizeTime),
+		"defactorizeTime": profileMillis(p.DefactorizeTime),
+		"totalTime":       profileMillis(p.TotalTime),
+		"resultSize":      p.ResultSize,
+		"servlets":        servlets,
+		"steps":           serializeQuerySteps(p.Steps),
+	}
+}
+
+// Encodes a servlet profile into an untyped map. Times are in milliseconds.
+func (p *ServletProfile) Serialize() map[string]interface{} {
+	return map[string]interface{}{
+		"index":                  p.Index,
+		"engines":                p.Engines,
+		"compileTime":            profileMillis(p.CompileTime),
+		"seekTime":               profileMillis(p.SeekTime),
+		"scanTime":               profileMillis(p.ScanTime),
+		"mergeTime":              profileMillis(p.MergeTime),
+		"totalTime":              profileMillis(p.TotalTime),
+		"objects":                p.Objects,
+		"events":                 p.Events,
+		"bytes":                  p.Bytes,
+		"blockCacheHits":         p.BlockCacheHits,
+		"blockCacheMisses":       p.BlockCacheMisses,
+		"blockReadBytes":         p.BlockReadBytes,
+		"blockUncompressedBytes": p.BlockUncompressedBytes,
+		"blockReadTime":          profileMillis(p.BlockReadTime),
+		"keysSkipped":            p.KeysSkipped,
+		"traceAborts":            p.TraceAborts,
+		"luaHeapBytes":           p.LuaHeapBytes,
+		"kernelScans":            p.KernelScans,
+		"steps":                  serializeQuerySteps(p.Steps),
+	}
+}
+
+// Encodes step profiles into a list of untyped maps. Times are in
+// milliseconds.
+func serializeQuerySteps(steps []QueryStepProfile) []interface{} {
+	ret := make([]interface{}, 0, len(steps))
+	for _, step := range steps {
+		ret = append(ret, map[string]interface{}{
+			"function": step.Function,
+			"line":     step.Line,
+			"time":     profileMillis(step.Time),
+		})
+	}
+	return ret
+}
+
+// Adds the time of each step to the step of the same function, keeping
+// the steps ordered by line.
+func addQuerySteps(dst []QueryStepProfile, steps []QueryStepProfile) []QueryStepProfile {
+	for _, step := range steps {
+		found := false
+		for i := range dst {
+			if dst[i].Function == step.Function {
+				dst[i].Time += step.Time
+				found = true
+				break
+			}
+		}
+		if !found {
+			dst = append(dst, step)
+		}
+	}
+	sort.Sort(queryStepsByLine(dst))
+	return dst
+}
+
+// Adds step times to the servlet's.
+func (p *ServletProfile) addSteps(steps []QueryStepProfile) {
+	p.Steps = addQuerySteps(p.Steps, steps)
+}
+
+// Sums the step times of the query's servlets.
+func (p *QueryProfile) sumSteps() {
+	p.Steps = nil
+	for _, s := range p.Servlets {
+		p.Steps = addQuerySteps(p.Steps, s.Steps)
+	}
+}
+
+type queryStepsByLine []QueryStepProfile
+
+func (s queryStepsByLine) Len() int           { return len(s) }
+func (s queryStepsByLine) Swap(i, j int)      { s[i], s[j] = s[j], s[i] }
+func (s queryStepsByLine) Less(i, j int) bool { return s[i].Line < s[j].Line }
+
+// Adds the work done by each engine of the servlet.
+func (p *ServletProfile) addEngines(engines []ServletProfile) {
+	p.Engines += len(engines)
+	for _, e := range engines {
+		p.CompileTime += e.CompileTime
+		p.ScanTime += e.ScanTime
+		p.Objects += e.Objects
+		p.Events += e.Events
+		p.Bytes += e.Bytes
+		p.BlockCacheHits += e.BlockCacheHits
+		p.BlockCacheMisses += e.BlockCacheMisses
+		p.BlockReadBytes += e.BlockReadBytes
+		p.BlockUncompressedBytes += e.BlockUncompressedBytes
+		p.BlockReadTime += e.BlockReadTime
+		p.KeysSkipped += e.KeysSkipped
+		p.TraceAborts += e.TraceAborts
+		p.LuaHeapBytes += e.LuaHeapBytes
+		p.KernelScans += e.KernelScans
+		p.addSteps(e.Steps)
+	}
+}
@@ -0,0 +1,580 @@
+package skyd
+
+import (
+	"encoding/json"
+	"errors"
+	"fmt"
+	"io/ioutil"
+	"math"
+	"os"
+	"path/filepath"
+	"regexp"
+	"sort"
+	"sync"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The length of a rollup's time buckets in seconds if none is given.
+const DefaultQueryRollupInterval = 3600
+
+// The most dimensions that a rollup can group events by.
+const queryRollupMaxDimensions = 4
+
+// Rollup names are used as file names so they're kept to a safe set of
+// characters.
+var queryRollupNamePattern = regexp.MustCompile(`^[A-Za-z0-9_][A-Za-z0-9_.\-]*$`)
+
+// Returned while answering a query when a database doesn't hold the rows of
+// the rollup that matched it.
+var errQueryRollupNotBuilt = errors.New("skyd.QueryRollup: Rollup is not built")
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A QueryRollup keeps the event count and the sums of a few numeric
+// properties of a table by time bucket and by the values of a few factor
+// properties, such as the events per action per hour. Each database keeps
+// its rows up to date as events are written so that queries made up of
+// selections over the rollup's dimensions and totals, with a time range on
+// bucket boundaries, read a few rows instead of scanning every object.
+//
+// Only transient properties can be rolled up since an event's values of
+// permanent properties can depend on the events before it.
+type QueryRollup struct {
+	name         string
+	table        string
+	prefix       []byte
+	Dimensions   []string
+	Sums         []string
+	Interval     int64
+	dimensionIds []int64
+	sumIds       []int64
+}
+
+// The rollups of every table by table prefix. A table's rollups are loaded
+// from its directory the first time it's opened.
+type queryRollupSet struct {
+	sync.RWMutex
+	rollups map[string][]*QueryRollup
+	loaded  map[string]bool
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates a rollup of a table.
+func NewQueryRollup(table *Table, name string) *QueryRollup {
+	return &QueryRollup{name: name, table: table.Name, Interval: DefaultQueryRollupInterval}
+}
+
+// Creates an empty set of rollups.
+func newQueryRollupSet() *queryRollupSet {
+	return &queryRollupSet{rollups: make(map[string][]*QueryRollup), loaded: make(map[string]bool)}
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Checks that a rollup name can be saved.
+func validateQueryRollupName(name string) error {
+	if !queryRollupNamePattern.MatchString(name) || len(name) > 255 {
+		return fmt.Errorf("skyd.QueryRollup: Invalid rollup name: %s", name)
+	}
+	return nil
+}
+
+// The directory that a table's rollups are saved in.
+func queryRollupPath(table *Table) string {
+	return filepath.Join(table.Path(), "rollups")
+}
+
+// Reads the rollups saved in a table's directory.
+func loadQueryRollups(table *Table) ([]*QueryRollup, error) {
+	infos, err := ioutil.ReadDir(queryRollupPath(table))
+	if os.IsNotExist(err) {
+		return nil, nil
+	} else if err != nil {
+		return nil, err
+	}
+
+	rollups := make([]*QueryRollup, 0)
+	for _, info := range infos {
+		if validateQueryRollupName(info.Name()) != nil {
+			continue
+		}
+		b, err := ioutil.ReadFile(filepath.Join(queryRollupPath(table), info.Name()))
+		if err != nil {
+			return nil, err
+		}
+		var obj map[string]interface{}
+		if err = json.Unmarshal(b, &obj); err != nil {
+			return nil, err
+		}
+		r := NewQueryRollup(table, info.Name())
+		if err = r.Deserialize(obj); err != nil {
+			return nil, err
+		}
+		if err = r.resolve(table); err != nil {
+			return nil, err
+		}
+		rollups = append(rollups, r)
+	}
+	return rollups, nil
+}
+
+// Returns the start of the bucket that a time falls into, in seconds. The
+// seconds are rounded down the same way as shifted timestamps.
+func queryRollupBucket(t time.Time, interval int64) int64 {
+	seconds := ShiftTime(t) >> 20
+	if mod := seconds % interval; mod < 0 {
+		return seconds - mod - interval
+	} else {
+		return seconds - mod
+	}
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Accessors
+//--------------------------------------
+
+// The name of the rollup.
+func (r *QueryRollup) Name() string {
+	return r.name
+}
+
+//--------------------------------------
+// Serialization
+//--------------------------------------
+
+// Encodes a rollup into an untyped map.
+func (r *QueryRollup) Serialize() map[string]interface{} {
+	return map[string]interface{}{
+		"name":       r.name,
+		"table":      r.table,
+		"dimensions": r.Dimensions,
+		"sums":       r.Sums,
+		"interval":   r.Interval,
+	}
+}
+
+// Decodes a rollup from an untyped map.
+func (r *QueryRollup) Deserialize(obj map[string]interface{}) error {
+	var err error
+	if r.Dimensions, err = deserializeQueryRollupNames(obj, "dimensions"); err != nil {
+		return err
+	}
+	if r.Sums, err = deserializeQueryRollupNames(obj, "sums"); err != nil {
+		return err
+	}
+	if len(r.Dimensions) > queryRollupMaxDimensions {
+		return fmt.Errorf("skyd.QueryRollup: A rollup can have at most %d dimensions", queryRollupMaxDimensions)
+	}
+
+	// Deserialize "interval" in seconds.
+	if interval, ok := obj["interval"].(float64); ok && interval >= 1 && interval == float64(int64(interval)) {
+		r.Interval = int64(interval)
+	} else if obj["interval"] == nil {
+		r.Interval = DefaultQueryRollupInterval
+	} else {
+		return fmt.Errorf("skyd.QueryRollup: Invalid interval: %v", obj["interval"])
+	}
+	return nil
+}
+
+// Decodes a list of property names from an untyped map.
+func deserializeQueryRollupNames(obj map[string]interface{}, key string) ([]string, error) {
+	names := []string{}
+	if obj[key] == nil {
+		return names, nil
+	}
+	list, ok := obj[key].([]interface{})
+	if !ok {
+		return nil, fmt.Errorf("skyd.QueryRollup: Invalid %s: %v", key, obj[key])
+	}
+	for _, item := range list {
+		name, ok := item.(string)
+		if !ok {
+			return nil, fmt.Errorf("skyd.QueryRollup: Invalid %s: %v", key, item)
+		}
+		names = append(names, name)
+	}
+	return names, nil
+}
+
+// Looks up the properties of the rollup in its table. Dimensions must be
+// transient factors and sums must be transient numbers. Neither can be in a
+// property family since rollups are only updated from the object's events.
+func (r *QueryRollup) resolve(table *Table) error {
+	prefix, err := table.Prefix()
+	if err != nil {
+		return err
+	}
+	r.prefix = prefix
+	r.dimensionIds, r.sumIds = nil, nil
+	for _, name := range r.Dimensions {
+		property := table.propertyFile.GetPropertyByName(name)
+		if property == nil || property.DataType != FactorDataType || !property.Transient || property.Family != "" {
+			return fmt.Errorf("skyd.QueryRollup: Dimension is not a transient factor: %s", name)
+		}
+		r.dimensionIds = append(r.dimensionIds, property.Id)
+	}
+	for _, name := range r.Sums {
+		property := table.propertyFile.GetPropertyByName(name)
+		if property == nil || !isNumericDataType(property.DataType) || !property.Transient || property.Family != "" {
+			return fmt.Errorf("skyd.QueryRollup: Sum is not a transient number: %s", name)
+		}
+		r.sumIds = append(r.sumIds, property.Id)
+	}
+	return nil
+}
+
+// Writes the rollup to its table's directory, replacing any rollup saved
+// under its name.
+func (r *QueryRollup) save(table *Table) error {
+	path := filepath.Join(queryRollupPath(table), r.name)
+	if err := os.MkdirAll(filepath.Dir(path), 0700); err != nil {
+		return err
+	}
+	b, err := json.Marshal(r.Serialize())
+	if err != nil {
+		return err
+	}
+	if err = ioutil.WriteFile(path+".tmp", b, 0600); err != nil {
+		return err
+	}
+	return os.Rename(path+".tmp", path)
+}
+
+// Removes the rollup's file from its table's directory.
+func (r *QueryRollup) unsave(table *Table) error {
+	err := os.Remove(filepath.Join(queryRollupPath(table), r.name))
+	if os.IsNotExist(err) {
+		return nil
+	}
+	return err
+}
+
+//--------------------------------------
+// Rows
+//--------------------------------------
+
+// Encodes the shape of the rollup's rows. A database only keeps the rows of
+// a rollup whose shape matches the one it was built with.
+func (r *QueryRollup) fingerprint() []byte {
+	b := appendUint64(nil, uint64(r.Interval))
+	b = append(b, byte(len(r.dimensionIds)))
+	for _, id := range r.dimensionIds {
+		b = appendUint64(b, uint64(id))
+	}
+	b = append(b, byte(len(r.sumIds)))
+	for _, id := range r.sumIds {
+		b = appendUint64(b, uint64(id))
+	}
+	return b
+}
+
+// Returns the bucket and the dimension values of the row that an event is
+// rolled up into. Missing values are zero, as they are for the cursor.
+func (r *QueryRollup) rowOf(event *Event) (int64, []int64) {
+	values := make([]int64, len(r.dimensionIds))
+	for i, id := range r.dimensionIds {
+		values[i], _ = normalize(event.Data[id]).(int64)
+	}
+	return queryRollupBucket(event.Timestamp, r.Interval), values
+}
+
+//--------------------------------------
+// Queries
+//--------------------------------------
+
+// Checks if a time is on a bucket boundary. A zero time leaves the range
+// open.
+func (r *QueryRollup) aligned(t time.Time) bool {
+	return t.IsZero() || (ShiftTime(t)&0xFFFFF == 0 && queryRollupBucket(t, r.Interval) == ShiftTime(t)>>20)
+}
+
+// Returns the index of a dimension or -1 if it isn't one of the rollup's.
+func (r *QueryRollup) dimensionIndex(name string) int {
+	for i, dimension := range r.Dimensions {
+		if dimension == name {
+			return i
+		}
+	}
+	return -1
+}
+
+// Returns the index of the sum that a field totals, or -1 for a count.
+// Returns false if the rollup doesn't keep the field's total.
+func (r *QueryRollup) fieldIndex(field *QuerySelectionField, propertyFile *PropertyFile) (int, bool) {
+	name, ok := field.numericAggregate(propertyFile)
+	if !ok {
+		return 0, false
+	} else if name == "" {
+		return -1, true
+	}
+	for i, sum := range r.Sums {
+		if sum == name {
+			return i, true
+		}
+	}
+	return 0, false
+}
+
+// Checks whether a query can be answered from the rollup. The query must
+// be made up of selections of counts and sums that the rollup keeps, by
+// the rollup's dimensions, over every object and a whole number of buckets.
+func (r *QueryRollup) answers(q *Query) bool {
+	if !q.batchable() || q.sampled() || q.MinEvents > 0 || q.MinSpan > 0 || q.State || q.Cohort != "" || len(q.Objects) > 0 || q.snapshotId != "" {
+		return false
+	}
+	if !r.aligned(q.TimeRangeStart) || !r.aligned(q.TimeRangeEnd) {
+		return false
+	}
+	for _, step := range q.Steps {
+		selection := step.(*QuerySelection)
+		for _, dimension := range selection.Dimensions {
+			if r.dimensionIndex(dimension) < 0 {
+				return false
+			}
+		}
+		for _, field := range selection.Fields {
+			if _, ok := r.fieldIndex(field, q.table.propertyFile); !ok {
+				return false
+			}
+		}
+	}
+	return true
+}
+
+// Returns the range of buckets [start, end) that a query reads.
+func (r *QueryRollup) bucketRange(q *Query) (int64, int64) {
+	start, end := int64(math.MinInt64), int64(math.MaxInt64)
+	if !q.TimeRangeStart.IsZero() {
+		start = queryRollupBucket(q.TimeRangeStart, r.Interval)
+	}
+	if !q.TimeRangeEnd.IsZero() {
+		end = queryRollupBucket(q.TimeRangeEnd, r.Interval)
+	}
+	return start, end
+}
+
+// Returns a function that adds a rollup row to the results of each of a
+// query's selections, shaped as the selections' aggregate functions would
+// shape them.
+func (r *QueryRollup) aggregator(q *Query, data map[interface{}]interface{}) func([]int64, *rollupRow) {
+	type field struct {
+		name string
+		sum  int
+	}
+	type plan struct {
+		name       string
+		dimensions []string
+		indexes    []int
+		fields     []field
+	}
+	plans := make([]*plan, 0, len(q.Steps))
+	for _, step := range q.Steps {
+		selection := step.(*QuerySelection)
+		p := &plan{name: selection.Name, dimensions: selection.Dimensions}
+		for _, dimension := range selection.Dimensions {
+			p.indexes = append(p.indexes, r.dimensionIndex(dimension))
+		}
+		for _, f := range selection.Fields {
+			index, _ := r.fieldIndex(f, q.table.propertyFile)
+			p.fields = append(p.fields, field{name: f.Name, sum: index})
+		}
+		plans = append(plans, p)
+	}
+
+	child := func(m map[interface{}]interface{}, key interface{}) map[interface{}]interface{} {
+		inner, ok := m[key].(map[interface{}]interface{})
+		if !ok {
+			inner = make(map[interface{}]interface{})
+			m[key] = inner
+		}
+		return inner
+	}
+	return func(values []int64, row *rollupRow) {
+		for _, p := range plans {
+			m := data
+			if p.name != "" {
+				m = child(m, p.name)
+			}
+			for i, dimension := range p.dimensions {
+				m = child(child(m, dimension), values[p.indexes[i]])
+			}
+			for _, f := range p.fields {
+				if f.sum < 0 {
+					count, _ := m[f.name].(int64)
+					m[f.name] = count + row.count
+				} else {
+					sum, _ := m[f.name].(float64)
+					m[f.name] = sum + row.sums[f.sum]
+				}
+			}
+		}
+	}
+}
+
+//--------------------------------------
+// Registration
+//--------------------------------------
+
+// Returns the rollups of a table prefix.
+func (set *queryRollupSet) list(prefix []byte) []*QueryRollup {
+	if set == nil {
+		return nil
+	}
+	set.RLock()
+	defer set.RUnlock()
+	return set.rollups[string(prefix)]
+}
+
+// Returns the rollups of every table.
+func (set *queryRollupSet) all() []*QueryRollup {
+	if set == nil {
+		return nil
+	}
+	set.RLock()
+	defer set.RUnlock()
+	rollups := make([]*QueryRollup, 0)
+	for _, list := range set.rollups {
+		rollups = append(rollups, list...)
+	}
+	return rollups
+}
+
+// Returns a rollup of a table by name, or nil if there's no such rollup.
+func (set *queryRollupSet) get(table *Table, name string) *QueryRollup {
+	prefix, err := table.Prefix()
+	if err != nil {
+		return nil
+	}
+	for _, r := range set.list(prefix) {
+		if r.name == name {
+			return r
+		}
+	}
+	return nil
+}
+
+// Registers the rollups saved for a table the first time it's opened.
+func (set *queryRollupSet) load(table *Table) error {
+	set.RLock()
+	loaded := set.loaded[table.Name]
+	set.RUnlock()
+	if loaded {
+		return nil
+	}
+	rollups, err := loadQueryRollups(table)
+	if err != nil {
+		return err
+	}
+	prefix, err := table.Prefix()
+	if err != nil {
+		return err
+	}
+	set.Lock()
+	defer set.Unlock()
+	if !set.loaded[table.Name] {
+		set.rollups[string(prefix)] = rollups
+		set.loaded[table.Name] = true
+	}
+	return nil
+}
+
+// Registers a rollup, replacing any rollup of its table with the same name.
+// Returns the rollup that was replaced, if any.
+func (set *queryRollupSet) put(r *QueryRollup) *QueryRollup {
+	set.Lock()
+	defer set.Unlock()
+	list := make([]*QueryRollup, 0)
+	var replaced *QueryRollup
+	for _, other := range set.rollups[string(r.prefix)] {
+		if other.name == r.name {
+			replaced = other
+		} else {
+			list = append(list, other)
+		}
+	}
+	list = append(list, r)
+	sort.Sort(queryRollupList(list))
+	set.rollups[string(r.prefix)] = list
+	return replaced
+}
+
+// Unregisters a rollup.
+func (set *queryRollupSet) remove(r *QueryRollup) {
+	set.Lock()
+	defer set.Unlock()
+	list := make([]*QueryRollup, 0)
+	for _, other := range set.rollups[string(r.prefix)] {
+		if other != r {
+			list = append(list, other)
+		}
+	}
+	set.rollups[string(r.prefix)] = list
+}
+
+// Unregisters every rollup of a table, such as when it's deleted.
+func (set *queryRollupSet) drop(table *Table) {
+	prefix, err := table.Prefix()
+	if err != nil {
+		return
+	}
+	set.Lock()
+	defer set.Unlock()
+	delete(set.rollups, string(prefix))
+	delete(set.loaded, table.Name)
+}
+
+// Returns a rollup of a table that can answer a query, or nil if there
+// isn't one. Rollups with fewer dimensions have fewer rows so they're
+// tried first.
+func (set *queryRollupSet) match(table *Table, q *Query) *QueryRollup {
+	if q.table == nil || q.table.propertyFile == nil {
+		return nil
+	}
+	prefix, err := table.Prefix()
+	if err != nil {
+		return nil
+	}
+	var match *QueryRollup
+	for _, r := range set.list(prefix) {
+		if r.answers(q) && (match == nil || len(r.Dimensions) < len(match.Dimensions)) {
+			match = r
+		}
+	}
+	return match
+}
+
+//--------------------------------------
+// Sorting
+//--------------------------------------
+
+type queryRollupList []*QueryRollup
+
+func (l queryRollupList) Len() int           { return len(l) }
+func (l queryRollupList) Less(i, j int) bool { return l[i].name < l[j].name }
+func (l queryRollupList) Swap(i, j int)      { l[i], l[j] = l[j], l[i] }
@@ -0,0 +1,393 @@
+package skyd
+
+import (
+	"container/heap"
+	"container/list"
+	"fmt"
+	"runtime"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The priority classes of queries. Interactive queries, such as the ones
+// behind dashboards, are scheduled ahead of batch queries.
+const (
+	InteractiveQueryPriority = iota
+	BatchQueryPriority
+	queryPriorityCount
+)
+
+// The number of interactive sub-scans started for each batch sub-scan while
+// both are waiting, so batch queries slow down but never stall.
+const queryInteractiveShare = 4
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// The limits that the query scheduler enforces.
+type QuerySchedulerOptions struct {
+	// The most sub-scans that run at once across every query. Zero runs
+	// one per core.
+	Workers int
+
+	// The most interactive and batch queries that run at once. Queries past
+	// these wait to start. Zero leaves a class unbounded.
+	InteractiveQueries int
+	BatchQueries       int
+
+	// The most memory in bytes that the engines of a query can use
+	// together. Each sub-scan gets an even share, which is further bounded
+	// by the engine memory limit. Zero leaves queries bounded only by the
+	// engine memory limit, or by DefaultQueryMemoryReservation under a
+	// server memory budget.
+	QueryMemory int
+
+	// The most time that the sub-scans of a query can run for in total.
+	// Sub-scans that haven't started once it's used up fail. Zero leaves
+	// queries unbounded.
+	QueryCPUTime time.Duration
+}
+
+// A QueryScheduler runs the sub-scans of every query on a bounded pool of
+// workers. Queries are admitted up to a limit for each priority class.
+// Waiting sub-scans are queued by class and then by table, and idle workers
+// take the next one from the tables of a class in turn so that one table's
+// queries can't crowd out another's. Within a query, idle workers take the
+// sub-scans of the servlet with the most of them left first, so that a
+// servlet holding heavy objects is worked on by every free worker instead
+// of finishing last.
+type QueryScheduler struct {
+	sync.Mutex
+	options  QuerySchedulerOptions
+	memory   *MemoryAccountant
+	admitted [queryPriorityCount]int
+	admit    *sync.Cond
+	lanes    [queryPriorityCount]*querySchedulerLane
+	workers  int
+	picks    int
+}
+
+// The waiting sub-scans of a priority class, queued by table.
+type querySchedulerLane struct {
+	tables map[string]*list.List
+	order  []string
+	next   int
+}
+
+// A QueryJob is an admitted query whose sub-scans are run by the scheduler.
+type QueryJob struct {
+	scheduler *QueryScheduler
+	table     string
+	priority  int
+	options   QuerySchedulerOptions
+	memory    int64
+	elapsed   int64
+	servlets  map[int]*queryServletQueue
+	depths    queryServletHeap
+	submitted uint64
+}
+
+// The waiting sub-scans of one of a query's servlets, oldest first. The
+// servlets of a query are kept in a heap by how many sub-scans they have
+// left so the deepest is found without scanning the table's queue.
+type queryServletQueue struct {
+	servlet int
+	tasks   []*list.Element
+	index   int
+}
+
+// The servlet queues of a query in a max-heap by depth. Servlets with as
+// many sub-scans left go in the order their oldest one was submitted.
+type queryServletHeap []*queryServletQueue
+
+// A sub-scan of a servlet waiting to run. The function is passed an error
+// instead of being run normally if its query's budget is used up.
+type queryTask struct {
+	job     *QueryJob
+	servlet int
+	seq     uint64
+	fn      func(error)
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates a scheduler with one worker per core and no other limits.
+func NewQueryScheduler() *QueryScheduler {
+	s := &QueryScheduler{}
+	s.admit = sync.NewCond(&s.Mutex)
+	for i := range s.lanes {
+		s.lanes[i] = &querySchedulerLane{tables: make(map[string]*list.List)}
+	}
+	return s
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Parses the name of a priority class. An empty name is interactive.
+func ParseQueryPriority(name string) (int, error) {
+	switch name {
+	case "", "interactive":
+		return InteractiveQueryPriority, nil
+	case "batch":
+		return BatchQueryPriority, nil
+	}
+	return 0, fmt.Errorf("skyd.QueryScheduler: Invalid priority: %s", name)
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Options
+//--------------------------------------
+
+// The limits of the scheduler.
+func (s *QueryScheduler) Options() QuerySchedulerOptions {
+	s.Lock()
+	defer s.Unlock()
+	return s.options
+}
+
+// Sets the limits of the scheduler. Queries that are already running keep
+// the budgets they were admitted with.
+func (s *QueryScheduler) SetOptions(options QuerySchedulerOptions) {
+	s.Lock()
+	defer s.Unlock()
+	s.options = options
+	s.admit.Broadcast()
+}
+
+// Sets the accountant that queries reserve their memory budgets from when
+// they're admitted. Without one, queries are only bounded by their
+// budgets.
+func (s *QueryScheduler) SetMemoryAccountant(memory *MemoryAccountant) {
+	s.Lock()
+	defer s.Unlock()
+	s.memory = memory
+}
+
+// The most sub-scans that run at once.
+func (s *QueryScheduler) workerLimit() int {
+	if s.options.Workers > 0 {
+		return s.options.Workers
+	}
+	return runtime.NumCPU()
+}
+
+// The most queries of a priority class that run at once.
+func (s *QueryScheduler) queryLimit(priority int) int {
+	if priority == BatchQueryPriority {
+		return s.options.BatchQueries
+	}
+	return s.options.InteractiveQueries
+}
+
+//--------------------------------------
+// Admission
+//--------------------------------------
+
+// Waits until a query of a priority class can start and then admits it
+// once its memory budget is reserved. Queries whose budget doesn't fit in
+// the server's memory budget are rejected with an error. The job must be
+// finished once the query's sub-scans are done.
+func (s *QueryScheduler) Admit(table string, priority int) (*QueryJob, error) {
+	s.Lock()
+	defer s.Unlock()
+	for limit := s.queryLimit(priority); limit > 0 && s.admitted[priority] >= limit; limit = s.queryLimit(priority) {
+		s.admit.Wait()
+	}
+	memory := int64(s.options.QueryMemory)
+	if s.memory != nil {
+		var err error
+		if memory, err = s.memory.reserveQuery(memory); err != nil {
+			return nil, err
+		}
+	}
+	s.admitted[priority]++
+	return &QueryJob{scheduler: s, table: table, priority: priority, options: s.options, memory: memory, servlets: make(map[int]*queryServletQueue)}, nil
+}
+
+// Ends a query so that a waiting one can start and releases its memory
+// budget.
+func (j *QueryJob) Finish() {
+	s := j.scheduler
+	s.Lock()
+	defer s.Unlock()
+	if s.memory != nil {
+		s.memory.releaseQuery(j.memory)
+	}
+	s.admitted[j.priority]--
+	s.admit.Broadcast()
+}
+
+// The share of the query's memory budget for each of a number of engines.
+// Zero leaves the engines bounded only by the engine memory limit.
+func (j *QueryJob) MemoryLimit(engines int) int {
+	if j.memory <= 0 || engines == 0 {
+		return 0
+	}
+	if limit := int(j.memory) / engines; limit > 0 {
+		return limit
+	}
+	return 1
+}
+
+//--------------------------------------
+// Execution
+//--------------------------------------
+
+// Queues a sub-scan of one of the query's servlets. A worker is started for
+// it if the pool isn't full, otherwise it waits for the next idle worker.
+func (j *QueryJob) Submit(servlet int, fn func(error)) {
+	s := j.scheduler
+	s.Lock()
+	defer s.Unlock()
+	j.submitted++
+	e := s.lanes[j.priority].push(j.table, &queryTask{job: j, servlet: servlet, seq: j.submitted, fn: fn})
+	if q := j.servlets[servlet]; q != nil {
+		q.tasks = append(q.tasks, e)
+		heap.Fix(&j.depths, q.index)
+	} else {
+		q = &queryServletQueue{servlet: servlet, tasks: []*list.Element{e}}
+		j.servlets[servlet] = q
+		heap.Push(&j.depths, q)
+	}
+	if s.workers < s.workerLimit() {
+		s.workers++
+		go s.work()
+	}
+}
+
+// Runs waiting sub-scans until there are none left.
+func (s *QueryScheduler) work() {
+	for {
+		s.Lock()
+		task := s.pop()
+		if task == nil {
+			s.workers--
+			s.Unlock()
+			return
+		}
+		s.Unlock()
+		task.run()
+	}
+}
+
+// Takes the next sub-scan to run. Interactive sub-scans go first but every
+// few picks go to a waiting batch sub-scan.
+func (s *QueryScheduler) pop() *queryTask {
+	if s.workers > s.workerLimit() {
+		return nil
+	}
+	interactive, batch := s.lanes[InteractiveQueryPriority], s.lanes[BatchQueryPriority]
+	if len(batch.order) > 0 && (len(interactive.order) == 0 || s.picks%(queryInteractiveShare+1) == queryInteractiveShare) {
+		s.picks = 0
+		return batch.pop()
+	}
+	if len(interactive.order) > 0 {
+		s.picks++
+		return interactive.pop()
+	}
+	return nil
+}
+
+// Runs a sub-scan and charges its time to its query. Sub-scans of a query
+// that has used up its time fail without running.
+func (t *queryTask) run() {
+	budget := t.job.options.QueryCPUTime
+	if budget > 0 && time.Duration(atomic.LoadInt64(&t.job.elapsed)) >= budget {
+		t.fn(fmt.Errorf("skyd.QueryScheduler: Query CPU time of %v exceeded", budget))
+		return
+	}
+	start := time.Now()
+	t.fn(nil)
+	atomic.AddInt64(&t.job.elapsed, int64(time.Since(start)))
+}
+
+//--------------------------------------
+// Lanes
+//--------------------------------------
+
+// Adds a sub-scan to the end of its table's queue.
+func (l *querySchedulerLane) push(table string, task *queryTask) *list.Element {
+	tasks := l.tables[table]
+	if tasks == nil {
+		tasks = list.New()
+		l.tables[table] = tasks
+		l.order = append(l.order, table)
+	}
+	return tasks.PushBack(task)
+}
+
+// Takes the next sub-scan from the next table in turn. The query at the
+// front of the table's queue goes first, and of its sub-scans the first one
+// of the servlet with the most left is taken.
+func (l *querySchedulerLane) pop() *queryTask {
+	if l.next >= len(l.order) {
+		l.next = 0
+	}
+	table := l.order[l.next]
+	tasks := l.tables[table]
+	job := tasks.Front().Value.(*queryTask).job
+	q := job.depths[0]
+	next := q.tasks[0]
+	q.tasks = q.tasks[1:]
+	if len(q.tasks) == 0 {
+		heap.Pop(&job.depths)
+		delete(job.servlets, q.servlet)
+	} else {
+		heap.Fix(&job.depths, 0)
+	}
+	task := tasks.Remove(next).(*queryTask)
+	if tasks.Len() == 0 {
+		delete(l.tables, table)
+		l.order = append(l.order[:l.next], l.order[l.next+1:]...)
+	} else {
+		l.next++
+	}
+	return task
+}
+
+func (h queryServletHeap) Len() int { return len(h) }
+func (h queryServletHeap) Less(i, j int) bool {
+	if len(h[i].tasks) != len(h[j].tasks) {
+		return len(h[i].tasks) > len(h[j].tasks)
+	}
+	return h[i].tasks[0].Value.(*queryTask).seq < h[j].tasks[0].Value.(*queryTask).seq
+}
+func (h queryServletHeap) Swap(i, j int) {
+	h[i], h[j] = h[j], h[i]
+	h[i].index, h[j].index = i, j
+}
+func (h *queryServletHeap) Push(x interface{}) {
+	q := x.(*queryServletQueue)
+	q.index = len(*h)
+	*h = append(*h, q)
+}
+func (h *queryServletHeap) Pop() interface{} {
+	old := *h
+	q := old[len(old)-1]
+	*h = old[:len(old)-1]
+	return q
+}
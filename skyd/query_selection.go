@@ -4,8 +4,46 @@ import (
 	"bytes"
 	"errors"
 	"fmt"
+	"regexp"
+	"sort"
+	"strings"
 )
 
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of groups tracked by each execution engine for every group that
+// a limited selection returns. Tracking more groups than are returned keeps
+// groups near the limit from being evicted by the noise of light groups.
+const querySelectionTopKFactor = 4
+
+// The number of factor sequences held by the flat aggregate of a selection
+// grouped by a single factor. Sequences are handed out from 1 so the values
+// of a low cardinality factor all fit and the groups of any sequence past
+// the end fall back to nested tables.
+const querySelectionFlatSize = 256
+
+// The most properties that a selection function reads into locals. Lua
+// allows 200 locals in a function and the blocks of the selections need
+// some of their own.
+const queryCodegenMaxLocals = 128
+
+// Dimensions that group events by the hour, day or week of their timestamp
+// instead of by a property. Each group is keyed by the start of its bucket
+// in seconds since the epoch.
+var querySelectionTimeDimension = regexp.MustCompile(`^(hour|day|week)\(timestamp\)$`)
+
+// The length of each kind of time bucket and the start of any one bucket in
+// seconds since the epoch. Weeks start on Monday.
+var querySelectionTimeBuckets = map[string][2]int64{
+	"hour": {3600, 0},
+	"day":  {86400, 0},
+	"week": {7 * 86400, 4 * 86400},
+}
+
 //------------------------------------------------------------------------------
 //
 // Typedefs
@@ -20,8 +58,20 @@ type QuerySelection struct {
 	Name              string
 	Dimensions        []string
 	Fields            []*QuerySelectionField
+	Limit             int
+	OrderBy           string
+}
+
+// A group of a limited selection along with its rank.
+type querySelectionGroup struct {
+	key    interface{}
+	name   string
+	weight float64
 }
 
+// Sorts groups from heaviest to lightest.
+type querySelectionGroups []querySelectionGroup
+
 //------------------------------------------------------------------------------
 //
 // Constructors
@@ -87,6 +137,10 @@ func (s *QuerySelection) Serialize() map[string]interface{} {
 		"dimensions": s.Dimensions,
 		"fields":     fields,
 	}
+	if s.Limit > 0 {
+		obj["limit"] = s.Limit
+		obj["orderBy"] = s.OrderBy
+	}
 	return obj
 }
 
@@ -146,44 +200,410 @@ func (s *QuerySelection) Deserialize(obj map[string]interface{}) error {
 		}
 	}
 
+	// Deserialize "limit" and "orderBy".
+	if limit, ok := obj["limit"].(float64); ok && limit >= 0 && limit == float64(int(limit)) {
+		s.Limit = int(limit)
+	} else if obj["limit"] == nil {
+		s.Limit = 0
+	} else {
+		return fmt.Errorf("skyd.QuerySelection: Invalid limit: %v", obj["limit"])
+	}
+	if orderBy, ok := obj["orderBy"].(string); ok {
+		s.OrderBy = orderBy
+	} else if obj["orderBy"] == nil {
+		s.OrderBy = ""
+	} else {
+		return fmt.Errorf("skyd.QuerySelection: Invalid orderBy: %v", obj["orderBy"])
+	}
+	if s.Limit > 0 {
+		if len(s.Dimensions) == 0 {
+			return errors.New("skyd.QuerySelection: A limit requires a dimension")
+		}
+		if _, err := s.orderField(); err != nil {
+			return err
+		}
+	}
+
 	return nil
 }
 
+// Retrieves the field that a limited selection ranks its groups by. This is
+// the "orderBy" field or the first count() field if none is given. Only
+// count() and sum() fields can be ranked.
+func (s *QuerySelection) orderField() (*QuerySelectionField, error) {
+	for _, field := range s.Fields {
+		weight, ok := field.weightExpression("%s")
+		if s.OrderBy == field.Name {
+			if !ok {
+				return nil, fmt.Errorf("skyd.QuerySelection: Invalid orderBy field: %q", field.Name)
+			}
+			return field, nil
+		} else if s.OrderBy == "" && weight == "1" {
+			return field, nil
+		}
+	}
+	return nil, fmt.Errorf("skyd.QuerySelection: Invalid orderBy: %q", s.OrderBy)
+}
+
+// Generates the Lua code that moves data into the group of the first
+// dimension for a limited selection. Each execution engine tracks a fixed
+// number of the heaviest groups and evicts the lightest ones.
+func (s *QuerySelection) codegenTopKGroup(accessor string) (string, error) {
+	field, err := s.orderField()
+	if err != nil {
+		return "", err
+	}
+	weight, _ := field.weightExpression(accessor)
+	return fmt.Sprintf("data = sky_topk_group(data%s, dimension, %d, %s)", codegenDimensionIndex(s.Dimensions[0]), s.Limit*querySelectionTopKFactor, weight), nil
+}
+
+// Generates the Lua code for the counters that an event adds to a flat
+// aggregate or returns nil if the selection can't be kept flat. A selection
+// is flat when it's grouped by a single factor without a limit and all of
+// its fields are counts or sums of numeric properties.
+func (s *QuerySelection) flatCounters(accessor string) []string {
+	if s.Limit > 0 || len(s.Dimensions) != 1 || s.query.table == nil || s.query.table.propertyFile == nil {
+		return nil
+	}
+	propertyFile := s.query.table.propertyFile
+	if property := propertyFile.GetPropertyByName(s.Dimensions[0]); property == nil || property.DataType != FactorDataType {
+		return nil
+	}
+	counters := make([]string, 0, len(s.Fields))
+	for _, field := range s.Fields {
+		exp, ok := field.flatExpression(accessor, propertyFile)
+		if !ok {
+			return nil
+		}
+		counters = append(counters, exp)
+	}
+	return counters
+}
+
+// Generates the struct type of a flat aggregate and the function that folds
+// it into the nested tables of the aggregate results. The "n" counter marks
+// the slots that were hit.
+func (s *QuerySelection) codegenFlatDefinitions() string {
+	buffer := new(bytes.Buffer)
+	dimension := s.Dimensions[0]
+
+	fmt.Fprintf(buffer, "local %s_flat = ffi.typeof('struct { double n;", s.FunctionName())
+	for i := range s.Fields {
+		fmt.Fprintf(buffer, " double f%d;", i)
+	}
+	fmt.Fprintln(buffer, " }[?]')")
+
+	fmt.Fprintf(buffer, "function %s_flush(root, flat)\n", s.FunctionName())
+	fmt.Fprintf(buffer, "  for k=0,%d do\n", querySelectionFlatSize-1)
+	fmt.Fprintln(buffer, "    local slot = flat[k]")
+	fmt.Fprintln(buffer, "    if slot.n > 0 then")
+	fmt.Fprintf(buffer, "      if root.%s == nil then root.%s = {} end\n", dimension, dimension)
+	fmt.Fprintf(buffer, "      if root.%s[k] == nil then root.%s[k] = {} end\n", dimension, dimension)
+	fmt.Fprintf(buffer, "      local data = root.%s[k]\n", dimension)
+	for i, field := range s.Fields {
+		fmt.Fprintf(buffer, "      data.%s = (data.%s or 0) + slot.f%d\n", field.Name, field.Name, i)
+	}
+	fmt.Fprintln(buffer, "    end")
+	fmt.Fprintln(buffer, "  end")
+	fmt.Fprintln(buffer, "end")
+
+	return buffer.String()
+}
+
+// Generates the Lua code that adds an event to its slot of a flat aggregate.
+func (s *QuerySelection) codegenFlatSlot(buffer *bytes.Buffer, counters []string, flat string, indent string) {
+	fmt.Fprintf(buffer, "%slocal slot = %s[dimension]\n", indent, flat)
+	fmt.Fprintf(buffer, "%sslot.n = slot.n + 1\n", indent)
+	for i, counter := range counters {
+		fmt.Fprintf(buffer, "%sslot.f%d = slot.f%d + %s\n", indent, i, i, counter)
+	}
+}
+
+//--------------------------------------
+// Dimensions
+//--------------------------------------
+
+// Checks whether a dimension groups events by a time bucket.
+func isTimeDimension(dimension string) bool {
+	return querySelectionTimeDimension.MatchString(dimension)
+}
+
+// Generates the Lua code that reads the value of a dimension for an event.
+// Properties are read through the accessor and time buckets are computed
+// natively from the event's shifted timestamp.
+func codegenDimensionValue(dimension string, accessor string, ts string) string {
+	if m := querySelectionTimeDimension.FindStringSubmatch(dimension); m != nil {
+		bucket := querySelectionTimeBuckets[m[1]]
+		return fmt.Sprintf("tonumber(ffi.C.sky_timestamp_bucket(%s, %d, %d))", ts, bucket[0], bucket[1])
+	}
+	return fmt.Sprintf(accessor, dimension)
+}
+
+// Generates the Lua index of a dimension's groups in a table. Time
+// dimensions aren't identifiers so they're quoted.
+func codegenDimensionIndex(dimension string) string {
+	if isTimeDimension(dimension) {
+		return fmt.Sprintf("[%q]", dimension)
+	}
+	return "." + dimension
+}
+
 //--------------------------------------
 // Code Generation
 //--------------------------------------
 
-// Generates Lua code for the selection aggregation.
+// Generates Lua code for the selection aggregation. Queries that mark
+// objects only mark the objects that reach the selection.
 func (s *QuerySelection) CodegenAggregateFunction() (string, error) {
+	return codegenSelectionsFunction(s.FunctionName(), []*QuerySelection{s})
+}
+
+// Generates a function that adds the current event to a run of adjacent
+// selections. The properties that the selections read are loaded straight
+// from the event's struct into locals once and shared by every selection,
+// unless there are too many of them to fit in locals. Each selection runs
+// in its own block so that it walks down from the same root.
+func codegenSelectionsFunction(name string, selections []*QuerySelection) (string, error) {
 	buffer := new(bytes.Buffer)
+	properties := selectionProperties(selections)
+	accessor := "ev_%s"
+	if len(properties) > queryCodegenMaxLocals {
+		accessor = "event:%s()"
+	}
+	for _, s := range selections {
+		if s.query.marking() {
+			continue
+		}
+		if s.flatCounters(accessor) != nil {
+			buffer.WriteString(s.codegenFlatDefinitions())
+		}
+		if s.leafCached() {
+			fmt.Fprintf(buffer, "local %s_leaf = {}\n", s.FunctionName())
+		}
+	}
+
+	fmt.Fprintf(buffer, "function %s(cursor, data)\n", name)
+	fmt.Fprintln(buffer, "  local event = cursor.event")
+	if len(properties) <= queryCodegenMaxLocals {
+		for _, property := range properties {
+			fmt.Fprintf(buffer, "  local ev_%s = %s\n", property, selections[0].codegenPropertyRead(property))
+		}
+	}
+	for _, s := range selections {
+		if err := s.codegenAggregateBlock(buffer, accessor); err != nil {
+			return "", err
+		}
+	}
+	fmt.Fprintln(buffer, "end")
+
+	return buffer.String(), nil
+}
+
+// Retrieves the names of the properties that a run of selections reads, in
+// the order that they're first read. Selections that mark objects don't
+// read any.
+func selectionProperties(selections []*QuerySelection) []string {
+	names := make([]string, 0)
+	seen := make(map[string]bool)
+	for _, s := range selections {
+		if s.query.marking() {
+			continue
+		}
+		for _, name := range s.Dimensions {
+			if !isTimeDimension(name) && !seen[name] {
+				names = append(names, name)
+				seen[name] = true
+			}
+		}
+		for _, field := range s.Fields {
+			if name := field.propertyName(); name != "" && !seen[name] {
+				names = append(names, name)
+				seen[name] = true
+			}
+		}
+	}
+	return names
+}
+
+// Generates the Lua code that reads a property of the current event into a
+// local. Properties that aren't in the table are read through the event's
+// metatable so that the engine reports them when it's created.
+func (s *QuerySelection) codegenPropertyRead(name string) string {
+	if s.query.table != nil && s.query.table.propertyFile != nil {
+		if property := s.query.table.propertyFile.GetPropertyByName(name); property != nil {
+			return codegenPropertyRead(property, "event")
+		}
+	}
+	return fmt.Sprintf("event:%s()", name)
+}
+
+// Checks whether the selection keeps the group of the last event it
+// counted so that events with the same dimension values skip walking the
+// groups. Limited selections can evict groups so they always walk them.
+func (s *QuerySelection) leafCached() bool {
+	return s.Limit == 0 && len(s.Dimensions) > 0
+}
+
+// Generates the block that adds the current event to the selection.
+// Properties are read through the accessor.
+func (s *QuerySelection) codegenAggregateBlock(buffer *bytes.Buffer, accessor string) error {
+	if s.query.marking() {
+		fmt.Fprintln(buffer, "  cursor:mark()")
+		return nil
+	}
+	fmt.Fprintln(buffer, "  do")
+	fmt.Fprintln(buffer, "    local data = data")
+
+	// Add selection name.
+	if s.Name != "" {
+		fmt.Fprintf(buffer, "    if data[\"%s\"] == nil then data[\"%s\"] = {} end\n", s.Name, s.Name)
+		fmt.Fprintf(buffer, "    data = data[\"%s\"]\n", s.Name)
+	}
+
+	// Count factors that fit in the flat aggregate without any tables and
+	// group the rest into tables below.
+	indent := "    "
+	counters := s.flatCounters(accessor)
+	if counters != nil {
+		fmt.Fprintf(buffer, "    local dimension = %s\n", fmt.Sprintf(accessor, s.Dimensions[0]))
+		fmt.Fprintf(buffer, "    if dimension >= 0 and dimension < %d then\n", querySelectionFlatSize)
+		s.codegenFlatSlot(buffer, counters, fmt.Sprintf("sky_flat(data, %s_flat, %d, %s_flush)", s.FunctionName(), querySelectionFlatSize, s.FunctionName()), "      ")
+		fmt.Fprintln(buffer, "    else")
+		indent = "      "
+	}
+
+	// Group by dimension.
+	if s.leafCached() {
+		s.codegenCachedGroup(buffer, accessor, indent)
+	} else if len(s.Dimensions) > 0 {
+		fmt.Fprintf(buffer, "%slocal dimension\n", indent)
+		for i, dimension := range s.Dimensions {
+			index := codegenDimensionIndex(dimension)
+			fmt.Fprintf(buffer, "%sdimension = %s\n", indent, codegenDimensionValue(dimension, accessor, "event.ts"))
+			fmt.Fprintf(buffer, "%sif data%s == nil then data%s = {} end\n", indent, index, index)
+			if i == 0 && s.Limit > 0 {
+				code, err := s.codegenTopKGroup(accessor)
+				if err != nil {
+					return err
+				}
+				fmt.Fprintf(buffer, "%s%s\n", indent, code)
+				continue
+			}
+			fmt.Fprintf(buffer, "%sif data%s[dimension] == nil then data%s[dimension] = {} end\n", indent, index, index)
+			fmt.Fprintf(buffer, "%sdata = data%s[dimension]\n", indent, index)
+		}
+	}
+
+	// Select fields.
+	for _, field := range s.Fields {
+		exp, err := field.codegenExpression(accessor, "event.%s")
+		if err != nil {
+			return err
+		}
+		fmt.Fprintln(buffer, indent+exp)
+	}
+
+	// End blocks.
+	if counters != nil {
+		fmt.Fprintln(buffer, "    end")
+	}
+	fmt.Fprintln(buffer, "  end")
+
+	return nil
+}
+
+// Generates the Lua code that moves data into the group of the event's
+// dimension values. Objects tend to repeat the same values event after
+// event so the group found for the last event is reused while the root and
+// every value match it.
+func (s *QuerySelection) codegenCachedGroup(buffer *bytes.Buffer, accessor string, indent string) {
+	conditions := []string{"leaf.root == data"}
+	fmt.Fprintf(buffer, "%slocal leaf = %s_leaf\n", indent, s.FunctionName())
+	for i, dimension := range s.Dimensions {
+		fmt.Fprintf(buffer, "%slocal d%d = %s\n", indent, i, codegenDimensionValue(dimension, accessor, "event.ts"))
+		conditions = append(conditions, fmt.Sprintf("leaf[%d] == d%d", i, i))
+	}
+	fmt.Fprintf(buffer, "%sif %s then\n", indent, strings.Join(conditions, " and "))
+	fmt.Fprintf(buffer, "%s  data = leaf.data\n", indent)
+	fmt.Fprintf(buffer, "%selse\n", indent)
+	fmt.Fprintf(buffer, "%s  leaf.root = data\n", indent)
+	for i, dimension := range s.Dimensions {
+		index := codegenDimensionIndex(dimension)
+		fmt.Fprintf(buffer, "%s  if data%s == nil then data%s = {} end\n", indent, index, index)
+		fmt.Fprintf(buffer, "%s  if data%s[d%d] == nil then data%s[d%d] = {} end\n", indent, index, i, index, i)
+		fmt.Fprintf(buffer, "%s  data = data%s[d%d]\n", indent, index, i)
+		fmt.Fprintf(buffer, "%s  leaf[%d] = d%d\n", indent, i, i)
+	}
+	fmt.Fprintf(buffer, "%s  leaf.data = data\n", indent)
+	fmt.Fprintf(buffer, "%send\n", indent)
+}
+
+// Generates Lua code for the selection aggregation over a batch of events.
+// The batch is looped over inside the function so that simple selections
+// compile down to a tight loop.
+func (s *QuerySelection) CodegenBatchAggregateFunction() (string, error) {
+	buffer := new(bytes.Buffer)
+	counters := s.flatCounters("batch:%s(i)")
+	if counters != nil {
+		buffer.WriteString(s.codegenFlatDefinitions())
+	}
 
 	// Generate main function.
-	fmt.Fprintf(buffer, "function %s(cursor, data)\n", s.FunctionName())
+	fmt.Fprintf(buffer, "function %s(batch, n, root)\n", s.FunctionName())
 
 	// Add selection name.
 	if s.Name != "" {
-		fmt.Fprintf(buffer, "  if data[\"%s\"] == nil then data[\"%s\"] = {} end\n", s.Name, s.Name)
-		fmt.Fprintf(buffer, "  data = data[\"%s\"]\n\n", s.Name)
+		fmt.Fprintf(buffer, "  if root[\"%s\"] == nil then root[\"%s\"] = {} end\n", s.Name, s.Name)
+		fmt.Fprintf(buffer, "  root = root[\"%s\"]\n\n", s.Name)
+	}
+
+	// Count factors that fit in the flat aggregate without any tables and
+	// group the rest into tables below.
+	indent := "    "
+	if counters != nil {
+		fmt.Fprintf(buffer, "  local flat = sky_flat(root, %s_flat, %d, %s_flush)\n", s.FunctionName(), querySelectionFlatSize, s.FunctionName())
+	}
+	fmt.Fprintln(buffer, "  for i=0,n-1 do")
+	if counters != nil {
+		fmt.Fprintf(buffer, "    dimension = batch:%s(i)\n", s.Dimensions[0])
+		fmt.Fprintf(buffer, "    if dimension >= 0 and dimension < %d then\n", querySelectionFlatSize)
+		s.codegenFlatSlot(buffer, counters, "flat", "      ")
+		fmt.Fprintln(buffer, "    else")
+		indent = "      "
 	}
+	fmt.Fprintln(buffer, indent+"local data = root")
 
 	// Group by dimension.
-	for _, dimension := range s.Dimensions {
-		fmt.Fprintf(buffer, "  dimension = cursor.event:%s()\n", dimension)
-		fmt.Fprintf(buffer, "  if data.%s == nil then data.%s = {} end\n", dimension, dimension)
-		fmt.Fprintf(buffer, "  if data.%s[dimension] == nil then data.%s[dimension] = {} end\n", dimension, dimension)
-		fmt.Fprintf(buffer, "  data = data.%s[dimension]\n\n", dimension)
+	for i, dimension := range s.Dimensions {
+		index := codegenDimensionIndex(dimension)
+		fmt.Fprintf(buffer, "%sdimension = %s\n", indent, codegenDimensionValue(dimension, "batch:%s(i)", "batch.ts[i]"))
+		fmt.Fprintf(buffer, "%sif data%s == nil then data%s = {} end\n", indent, index, index)
+		if i == 0 && s.Limit > 0 {
+			code, err := s.codegenTopKGroup("batch:%s(i)")
+			if err != nil {
+				return "", err
+			}
+			fmt.Fprintf(buffer, "%s%s\n", indent, code)
+			continue
+		}
+		fmt.Fprintf(buffer, "%sif data%s[dimension] == nil then data%s[dimension] = {} end\n", indent, index, index)
+		fmt.Fprintf(buffer, "%sdata = data%s[dimension]\n", indent, index)
 	}
 
 	// Select fields.
 	for _, field := range s.Fields {
-		exp, err := field.CodegenExpression()
+		exp, err := field.CodegenBatchExpression()
 		if err != nil {
 			return "", err
 		}
-		fmt.Fprintln(buffer, "  "+exp)
+		fmt.Fprintln(buffer, indent+exp)
 	}
 
-	// End function definition.
+	// End loop and function definition.
+	if counters != nil {
+		fmt.Fprintln(buffer, "    end")
+	}
+	fmt.Fprintln(buffer, "  end")
 	fmt.Fprintln(buffer, "end")
 
 	return buffer.String(), nil
@@ -230,12 +650,12 @@ func (s *QuerySelection) CodegenInnerMergeFunction(index int) (string, error) {
 	// the leaf merge.
 	fmt.Fprintf(buffer, "function %sn%d(result, data)\n", s.MergeFunctionName(), index)
 	if index < len(s.Dimensions) {
-		dimension := s.Dimensions[index]
-		fmt.Fprintf(buffer, "  if data ~= nil and data.%s ~= nil then\n", dimension)
-		fmt.Fprintf(buffer, "    if result.%s == nil then result.%s = {} end\n", dimension, dimension)
-		fmt.Fprintf(buffer, "    for k,v in pairs(data.%s) do\n", dimension)
-		fmt.Fprintf(buffer, "      if result.%s[k] == nil then result.%s[k] = {} end\n", dimension, dimension)
-		fmt.Fprintf(buffer, "      %sn%d(result.%s[k], v)\n", s.MergeFunctionName(), (index + 1), dimension)
+		dimension := codegenDimensionIndex(s.Dimensions[index])
+		fmt.Fprintf(buffer, "  if data ~= nil and data%s ~= nil then\n", dimension)
+		fmt.Fprintf(buffer, "    if result%s == nil then result%s = {} end\n", dimension, dimension)
+		fmt.Fprintf(buffer, "    for k,v in pairs(data%s) do\n", dimension)
+		fmt.Fprintf(buffer, "      if result%s[k] == nil then result%s[k] = {} end\n", dimension, dimension)
+		fmt.Fprintf(buffer, "      %sn%d(result%s[k], v)\n", s.MergeFunctionName(), (index + 1), dimension)
 		fmt.Fprintf(buffer, "    end\n")
 		fmt.Fprintf(buffer, "  end\n")
 	} else {
@@ -253,6 +673,232 @@ func (s *QuerySelection) CodegenInnerMergeFunction(index int) (string, error) {
 	return buffer.String(), nil
 }
 
+//--------------------------------------
+// Merging
+//--------------------------------------
+
+// Merges the selection's results from one aggregate result into another.
+func (s *QuerySelection) Merge(results map[interface{}]interface{}, data map[interface{}]interface{}) error {
+	if s.Name != "" {
+		inner, ok := data[s.Name].(map[interface{}]interface{})
+		if !ok {
+			return nil
+		}
+		if _, ok := results[s.Name].(map[interface{}]interface{}); !ok {
+			results[s.Name] = map[interface{}]interface{}{}
+		}
+		return s.merge(results[s.Name].(map[interface{}]interface{}), inner, 0)
+	}
+	return s.merge(results, data, 0)
+}
+
+// Recursively merges dimensions and then fields.
+func (s *QuerySelection) merge(results map[interface{}]interface{}, data map[interface{}]interface{}, index int) error {
+	if index >= len(s.Dimensions) {
+		for _, field := range s.Fields {
+			if err := field.Merge(results, data); err != nil {
+				return err
+			}
+		}
+		return nil
+	}
+
+	dimension := s.Dimensions[index]
+	inner, ok := data[dimension].(map[interface{}]interface{})
+	if !ok {
+		return nil
+	}
+	outer, ok := results[dimension].(map[interface{}]interface{})
+	if !ok {
+		outer = map[interface{}]interface{}{}
+		results[dimension] = outer
+	}
+	for k, v := range inner {
+		// Dimension values that only exist on one side are moved over as is.
+		if _, ok := outer[k]; !ok {
+			outer[k] = v
+			continue
+		}
+		r, rok := outer[k].(map[interface{}]interface{})
+		d, dok := v.(map[interface{}]interface{})
+		if rok && dok {
+			if err := s.merge(r, d, index+1); err != nil {
+				return err
+			}
+		}
+	}
+
+	// Limited selections keep the same candidates through merges that each
+	// engine tracks so that servlet results and the partials sent between
+	// nodes stay bounded by the limit rather than the groups read.
+	if index == 0 && s.Limit > 0 {
+		return s.truncate(outer, s.Limit*querySelectionTopKFactor)
+	}
+	return nil
+}
+
+//--------------------------------------
+// Finalization
+//--------------------------------------
+
+// Converts sketch fields into their estimates once results are merged. The
+// counts and sums of sampled queries are scaled up to estimates too.
+func (s *QuerySelection) Finalize(data interface{}) error {
+	m, ok := data.(map[interface{}]interface{})
+	if !ok {
+		return nil
+	}
+	if s.Name != "" {
+		if m, ok = m[s.Name].(map[interface{}]interface{}); !ok {
+			return nil
+		}
+	}
+	return s.finalize(m, 0)
+}
+
+// Recursively finalizes dimensions and then fields.
+func (s *QuerySelection) finalize(data map[interface{}]interface{}, index int) error {
+	if index >= len(s.Dimensions) {
+		for _, field := range s.Fields {
+			if err := field.Finalize(data); err != nil {
+				return err
+			}
+		}
+		if s.query.sampled() {
+			s.scaleSample(data)
+		}
+		return nil
+	}
+
+	inner, ok := data[s.Dimensions[index]].(map[interface{}]interface{})
+	if !ok {
+		return nil
+	}
+	if index == 0 && s.Limit > 0 {
+		if err := s.truncate(inner, s.Limit); err != nil {
+			return err
+		}
+	}
+	for _, v := range inner {
+		if m, ok := v.(map[interface{}]interface{}); ok {
+			if err := s.finalize(m, index+1); err != nil {
+				return err
+			}
+		}
+	}
+	return nil
+}
+
+// Scales the count() and sum() fields of a group of a sampled query up to
+// estimates for every object. The group's sampled event count is read from
+// its first count() field before anything is scaled.
+func (s *QuerySelection) scaleSample(data map[interface{}]interface{}) {
+	var events float64
+	var counted bool
+	for _, field := range s.Fields {
+		if field.isCount() {
+			events, counted = toFloat(normalize(data[field.Name]))
+			break
+		}
+	}
+	for _, field := range s.Fields {
+		field.scaleSample(data, s.query.Sample, events, counted)
+	}
+}
+
+// Removes all but a number of the heaviest groups of the first dimension of
+// a limited selection. Ties are broken by the group's key so results are
+// stable.
+func (s *QuerySelection) truncate(groups map[interface{}]interface{}, n int) error {
+	if len(groups) <= n {
+		return nil
+	}
+	field, err := s.orderField()
+	if err != nil {
+		return err
+	}
+
+	ranked := make(querySelectionGroups, 0, len(groups))
+	for k, v := range groups {
+		ranked = append(ranked, querySelectionGroup{k, fmt.Sprint(k), s.weight(v, field, 1)})
+	}
+	sort.Sort(ranked)
+	for _, group := range ranked[n:] {
+		delete(groups, group.key)
+	}
+	return nil
+}
+
+// Sums the values of a field across the groups of the remaining dimensions.
+func (s *QuerySelection) weight(data interface{}, field *QuerySelectionField, index int) float64 {
+	m, ok := data.(map[interface{}]interface{})
+	if !ok {
+		return 0
+	}
+	if index >= len(s.Dimensions) {
+		value, _ := toFloat(m[field.Name])
+		return value
+	}
+	var total float64
+	if inner, ok := m[s.Dimensions[index]].(map[interface{}]interface{}); ok {
+		for _, v := range inner {
+			total += s.weight(v, field, index+1)
+		}
+	}
+	return total
+}
+
+func (g querySelectionGroups) Len() int      { return len(g) }
+func (g querySelectionGroups) Swap(i, j int) { g[i], g[j] = g[j], g[i] }
+func (g querySelectionGroups) Less(i, j int) bool {
+	if g[i].weight != g[j].weight {
+		return g[i].weight > g[j].weight
+	}
+	return g[i].name < g[j].name
+}
+
+//--------------------------------------
+// Streaming
+//--------------------------------------
+
+// Passes each group of the selection's first dimension to a function as its
+// own record, along with a key made of the selection name, the dimension
+// and the group's value, and removes it from the results.
+func (s *QuerySelection) Split(data map[interface{}]interface{}, fn func(string, map[interface{}]interface{}) error) error {
+	if len(s.Dimensions) == 0 {
+		return nil
+	}
+	m := data
+	if s.Name != "" {
+		var ok bool
+		if m, ok = data[s.Name].(map[interface{}]interface{}); !ok {
+			return nil
+		}
+	}
+	dimension := s.Dimensions[0]
+	groups, ok := m[dimension].(map[interface{}]interface{})
+	if !ok {
+		return nil
+	}
+
+	for k, v := range groups {
+		delete(groups, k)
+		record := map[interface{}]interface{}{dimension: map[interface{}]interface{}{k: v}}
+		if s.Name != "" {
+			record = map[interface{}]interface{}{s.Name: record}
+		}
+		group := normalize(k)
+		if err := fn(fmt.Sprintf("%s\x00%s\x00%T\x00%v", s.Name, dimension, group, group), record); err != nil {
+			return err
+		}
+	}
+	delete(m, dimension)
+	if s.Name != "" && len(m) == 0 {
+		delete(data, s.Name)
+	}
+	return nil
+}
+
 //--------------------------------------
 // Factorization
 //--------------------------------------
@@ -276,46 +922,69 @@ func (s *QuerySelection) Defactorize(data interface{}) error {
 	return nil
 }
 
-// Recursively defactorizes dimensions.
+// Defactorizes dimensions one level at a time. Every factor sequence at a
+// level is converted with a single dictionary lookup.
 func (s *QuerySelection) defactorize(data interface{}, index int) error {
-	if index >= len(s.Dimensions) {
-		return nil
-	}
-	// Ignore any values that are nil or not maps.
-	inner, ok := data.(map[interface{}]interface{})
-	if !ok || data == nil {
-		return nil
-	}
+	levels := []interface{}{data}
+	for ; index < len(s.Dimensions) && len(levels) > 0; index++ {
+		// Retrieve property. Time dimensions are already keyed by time.
+		dimension := s.Dimensions[index]
+		var property *Property
+		if !isTimeDimension(dimension) {
+			if property = s.query.table.propertyFile.GetPropertyByName(dimension); property == nil {
+				return fmt.Errorf("skyd.QuerySelection: Property not found: %s", dimension)
+			}
+		}
 
-	// Retrieve property.
-	dimension := s.Dimensions[index]
-	property := s.query.table.propertyFile.GetPropertyByName(dimension)
-	if property == nil {
-		return fmt.Errorf("skyd.QuerySelection: Property not found: %s", dimension)
-	}
+		// Collect the keys and values of the dimension maps at this level.
+		// Ignore any values that are nil or not maps.
+		var inners []map[interface{}]interface{}
+		var counts []int
+		var keys, next []interface{}
+		for _, level := range levels {
+			inner, ok := level.(map[interface{}]interface{})
+			if !ok {
+				continue
+			}
+			outer, ok := inner[dimension].(map[interface{}]interface{})
+			if !ok {
+				continue
+			}
+			inners = append(inners, inner)
+			counts = append(counts, len(outer))
+			for k, v := range outer {
+				keys = append(keys, k)
+				next = append(next, v)
+			}
+		}
 
-	// Defactorize.
-	if outer, ok := inner[dimension].(map[interface{}]interface{}); ok {
-		copy := map[interface{}]interface{}{}
-		for k, v := range outer {
-			if property.DataType == FactorDataType {
+		// Defactorize all keys at this level at once.
+		if property != nil && property.DataType == FactorDataType {
+			sequences := make([]uint64, len(keys))
+			for i, k := range keys {
 				if sequence, ok := normalize(k).(int64); ok {
-					stringValue, err := s.query.factors.Defactorize(s.query.table.Name, dimension, uint64(sequence))
-					if err != nil {
-						return err
-					}
-					copy[stringValue] = v
+					sequences[i] = uint64(sequence)
 				} else {
 					return fmt.Errorf("Invalid factor sequence: %v", k)
 				}
-			} else {
-				copy[k] = v
+			}
+			values, err := s.query.factors.DefactorizeValues(s.query.table.Name, dimension, sequences)
+			if err != nil {
+				return err
 			}
 
-			// Defactorize next dimension.
-			s.defactorize(v, index+1)
+			offset := 0
+			for i, inner := range inners {
+				copy := make(map[interface{}]interface{}, counts[i])
+				for j := offset; j < offset+counts[i]; j++ {
+					copy[values[j]] = next[j]
+				}
+				inner[dimension] = copy
+				offset += counts[i]
+			}
 		}
-		inner[dimension] = copy
+
+		levels = next
 	}
 
 	return nil
@@ -3,9 +3,31 @@ package skyd
 import (
 	"errors"
 	"fmt"
+	"math"
 	"regexp"
+	"strconv"
 )
 
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The z-score of the 95% margins of error given with sampled estimates.
+const querySampleZ = 1.96
+
+// Matches the supported field expressions: count(), sum/min/max and
+// count_distinct of an operand, the quantile of an operand, the assignment
+// of a property and the histogram of an operand over a range with a number
+// of buckets. Operands are a property, delta() or elapsed_since(step).
+var querySelectionFieldExpression = regexp.MustCompile(`^ *(?:count\(\)|(sum|min|max|count_distinct)\((\w+|delta\(\)|elapsed_since\(\w+\))\)|quantile\((\w+|delta\(\)|elapsed_since\(\w+\)), *(0(?:\.\d+)?|1(?:\.0+)?|\.\d+)\)|(\w+)|histogram\((\w+|delta\(\)|elapsed_since\(\w+\)), *(-?\d+(?:\.\d+)?), *(-?\d+(?:\.\d+)?), *(\d+)\)) *$`)
+
+// Matches an operand that's measured between events instead of read from a
+// property. delta() is the seconds since the object's previous event and
+// elapsed_since(step) is the seconds since the named condition matched.
+var querySelectionFieldTimeOperand = regexp.MustCompile(`^(?:delta\(\)|elapsed_since\((\w+)\))$`)
+
 //------------------------------------------------------------------------------
 //
 // Typedefs
@@ -76,19 +98,44 @@ func (f *QuerySelectionField) Deserialize(obj map[string]interface{}) error {
 
 // Generates Lua code for the expression.
 func (f *QuerySelectionField) CodegenExpression() (string, error) {
-	r, _ := regexp.Compile(`^ *(?:count\(\)|(sum|min|max)\((\w+)\)|(\w+)) *$`)
-	if m := r.FindStringSubmatch(f.Expression); m != nil {
-		if len(m[1]) > 0 { // sum()/min()/max()
+	return f.codegenExpression("cursor.event:%s()", "cursor.event.%s")
+}
+
+// Generates Lua code for the expression against the i-th event of a batch.
+func (f *QuerySelectionField) CodegenBatchExpression() (string, error) {
+	return f.codegenExpression("batch:%s(i)", "batch.%s[i]")
+}
+
+// Generates Lua code for the expression using a format string that accesses
+// a property value by name and one that accesses an event's timestamps.
+func (f *QuerySelectionField) codegenExpression(accessor string, event string) (string, error) {
+	if m := querySelectionFieldExpression.FindStringSubmatch(f.Expression); m != nil {
+		if len(m[1]) > 0 { // sum()/min()/max()/count_distinct()
+			value, wrap := codegenFieldOperand(m[2], accessor, event)
 			switch m[1] {
 			case "sum":
-				return fmt.Sprintf("data.%s = (data.%s or 0) + cursor.event:%s()", f.Name, f.Name, m[2]), nil
+				return wrap(fmt.Sprintf("data.%s = (data.%s or 0) + %s", f.Name, f.Name, value)), nil
 			case "min":
-				return fmt.Sprintf("if(data.%s == nil or data.%s > cursor.event:%s()) then data.%s = cursor.event:%s() end", f.Name, f.Name, m[2], f.Name, m[2]), nil
+				return wrap(fmt.Sprintf("if(data.%s == nil or data.%s > %s) then data.%s = %s end", f.Name, f.Name, value, f.Name, value)), nil
 			case "max":
-				return fmt.Sprintf("if(data.%s == nil or data.%s < cursor.event:%s()) then data.%s = cursor.event:%s() end", f.Name, f.Name, m[2], f.Name, m[2]), nil
+				return wrap(fmt.Sprintf("if(data.%s == nil or data.%s < %s) then data.%s = %s end", f.Name, f.Name, value, f.Name, value)), nil
+			case "count_distinct":
+				return wrap(fmt.Sprintf("data.%s = sky_count_distinct(data.%s, %s)", f.Name, f.Name, value)), nil
+			}
+		} else if len(m[3]) > 0 { // quantile()
+			value, wrap := codegenFieldOperand(m[3], accessor, event)
+			return wrap(fmt.Sprintf("data.%s = sky_quantile(data.%s, %s)", f.Name, f.Name, value)), nil
+		} else if len(m[6]) > 0 { // histogram()
+			min, _ := strconv.ParseFloat(m[7], 64)
+			max, _ := strconv.ParseFloat(m[8], 64)
+			buckets, err := strconv.Atoi(m[9])
+			if err != nil || min >= max || buckets < 1 || buckets > histogramMaxBuckets {
+				return "", fmt.Errorf("skyd.QuerySelectionField: Invalid histogram: %q", f.Expression)
 			}
-		} else if len(m[3]) > 0 { // assignment
-			return fmt.Sprintf("data.%s = cursor.event:%s()", f.Name, m[3]), nil
+			value, wrap := codegenFieldOperand(m[6], accessor, event)
+			return wrap(fmt.Sprintf("data.%s = sky_histogram(data.%s, %s, %s, %s, %d)", f.Name, f.Name, value, m[7], m[8], buckets)), nil
+		} else if len(m[5]) > 0 { // assignment
+			return fmt.Sprintf("data.%s = %s", f.Name, fmt.Sprintf(accessor, m[5])), nil
 		} else { // count()
 			return fmt.Sprintf("data.%s = (data.%s or 0) + 1", f.Name, f.Name), nil
 		}
@@ -97,11 +144,67 @@ func (f *QuerySelectionField) CodegenExpression() (string, error) {
 	return "", fmt.Errorf("skyd.QuerySelectionField: Invalid expression: %q", f.Expression)
 }
 
+// Generates the Lua code for an aggregate's operand along with a function
+// that wraps the aggregate's code. Time operands are computed once into a
+// local and events without a previous event are skipped.
+func codegenFieldOperand(operand string, accessor string, event string) (string, func(string) string) {
+	m := querySelectionFieldTimeOperand.FindStringSubmatch(operand)
+	if m == nil {
+		return fmt.Sprintf(accessor, operand), func(code string) string { return code }
+	}
+
+	var value string
+	if len(m[1]) > 0 {
+		value = fmt.Sprintf("%s - sky_step_%s", fmt.Sprintf(event, "timestamp"), m[1])
+	} else {
+		value = fmt.Sprintf("sky_delta(%s, %s)", fmt.Sprintf(event, "timestamp"), fmt.Sprintf(event, "prev_timestamp"))
+	}
+	return "value", func(code string) string {
+		return fmt.Sprintf("do local value = %s if value ~= nil then %s end end", value, code)
+	}
+}
+
+// Retrieves the names of the condition steps that the field's operand
+// measures from.
+func (f *QuerySelectionField) elapsedSteps() []string {
+	m := querySelectionFieldExpression.FindStringSubmatch(f.Expression)
+	if m == nil {
+		return nil
+	}
+	steps := []string{}
+	for _, operand := range []string{m[2], m[3], m[6]} {
+		if o := querySelectionFieldTimeOperand.FindStringSubmatch(operand); o != nil && len(o[1]) > 0 {
+			steps = append(steps, o[1])
+		}
+	}
+	return steps
+}
+
+// Retrieves the name of the property that the field reads or an empty
+// string if it only counts events or measures time.
+func (f *QuerySelectionField) propertyName() string {
+	m := querySelectionFieldExpression.FindStringSubmatch(f.Expression)
+	if m == nil {
+		return ""
+	}
+	for _, operand := range []string{m[2], m[3], m[5], m[6]} {
+		if len(operand) > 0 && !querySelectionFieldTimeOperand.MatchString(operand) {
+			return operand
+		}
+	}
+	return ""
+}
+
+// Returns whether the field aggregates a time operand instead of a property.
+func (f *QuerySelectionField) timeOperand() bool {
+	m := querySelectionFieldExpression.FindStringSubmatch(f.Expression)
+	return m != nil && (querySelectionFieldTimeOperand.MatchString(m[2]) || querySelectionFieldTimeOperand.MatchString(m[3]) || querySelectionFieldTimeOperand.MatchString(m[6]))
+}
+
 // Generates Lua code for the merge expression.
 func (f *QuerySelectionField) CodegenMergeExpression() (string, error) {
-	r, _ := regexp.Compile(`^ *(?:count\(\)|(sum|min|max)\((\w+)\)|(\w+)) *$`)
-	if m := r.FindStringSubmatch(f.Expression); m != nil {
-		if len(m[1]) > 0 { // sum()/min()/max()
+	if m := querySelectionFieldExpression.FindStringSubmatch(f.Expression); m != nil {
+		if len(m[1]) > 0 { // sum()/min()/max()/count_distinct()
 			switch m[1] {
 			case "sum":
 				return fmt.Sprintf("result.%s = (result.%s or 0) + (data.%s or 0)", f.Name, f.Name, f.Name), nil
@@ -109,8 +212,12 @@ func (f *QuerySelectionField) CodegenMergeExpression() (string, error) {
 				return fmt.Sprintf("if(result.%s == nil or result.%s > data.%s) then result.%s = data.%s end", f.Name, f.Name, f.Name, f.Name, f.Name), nil
 			case "max":
 				return fmt.Sprintf("if(result.%s == nil or result.%s < data.%s) then result.%s = data.%s end", f.Name, f.Name, f.Name, f.Name, f.Name), nil
+			case "count_distinct":
+				return fmt.Sprintf("result.%s = sky_sketch_merge(result.%s, data.%s)", f.Name, f.Name, f.Name), nil
 			}
-		} else if len(m[3]) > 0 { // assignment
+		} else if len(m[3]) > 0 || len(m[6]) > 0 { // quantile()/histogram()
+			return fmt.Sprintf("result.%s = sky_sketch_merge(result.%s, data.%s)", f.Name, f.Name, f.Name), nil
+		} else if len(m[5]) > 0 { // assignment
 			return fmt.Sprintf("result.%s = data.%s", f.Name, f.Name), nil
 		} else { // count()
 			return fmt.Sprintf("result.%s = (result.%s or 0) + (data.%s or 0)", f.Name, f.Name, f.Name), nil
@@ -119,3 +226,180 @@ func (f *QuerySelectionField) CodegenMergeExpression() (string, error) {
 
 	return "", fmt.Errorf("skyd.QuerySelectionField: Invalid merge expression: %q", f.Expression)
 }
+
+// Generates the Lua code for the weight that an event adds to a field that
+// can rank groups. Only count() and sum() fields of properties can rank
+// groups.
+func (f *QuerySelectionField) weightExpression(accessor string) (string, bool) {
+	m := querySelectionFieldExpression.FindStringSubmatch(f.Expression)
+	switch {
+	case m == nil, f.timeOperand():
+		return "", false
+	case len(m[1]) == 0 && len(m[3]) == 0 && len(m[5]) == 0 && len(m[6]) == 0: // count()
+		return "1", true
+	case m[1] == "sum":
+		return fmt.Sprintf(accessor, m[2]), true
+	}
+	return "", false
+}
+
+// Retrieves the property summed by a field that only counts events or sums
+// a numeric property. Counts have no property. These are the fields that
+// can be kept in flat aggregates and run by native kernels.
+func (f *QuerySelectionField) numericAggregate(propertyFile *PropertyFile) (string, bool) {
+	m := querySelectionFieldExpression.FindStringSubmatch(f.Expression)
+	switch {
+	case m == nil, f.timeOperand():
+		return "", false
+	case len(m[1]) == 0 && len(m[3]) == 0 && len(m[5]) == 0 && len(m[6]) == 0: // count()
+		return "", true
+	case m[1] == "sum":
+		property := propertyFile.GetPropertyByName(m[2])
+		if property == nil || !isNumericDataType(property.DataType) {
+			return "", false
+		}
+		return m[2], true
+	}
+	return "", false
+}
+
+// Generates the Lua code for the amount that an event adds to the field's
+// counter in a flat aggregate.
+func (f *QuerySelectionField) flatExpression(accessor string, propertyFile *PropertyFile) (string, bool) {
+	if _, ok := f.numericAggregate(propertyFile); !ok {
+		return "", false
+	}
+	return f.weightExpression(accessor)
+}
+
+//--------------------------------------
+// Merging
+//--------------------------------------
+
+// Merges the field's value from one aggregate result into another. This
+// matches the generated merge expression.
+func (f *QuerySelectionField) Merge(results map[interface{}]interface{}, data map[interface{}]interface{}) error {
+	m := querySelectionFieldExpression.FindStringSubmatch(f.Expression)
+	if m == nil {
+		return fmt.Errorf("skyd.QuerySelectionField: Invalid merge expression: %q", f.Expression)
+	}
+
+	value, ok := data[f.Name]
+	if len(m[5]) > 0 { // assignment
+		results[f.Name] = value
+		return nil
+	}
+	if !ok || value == nil {
+		return nil
+	}
+	existing, exists := results[f.Name]
+	if !exists || existing == nil {
+		results[f.Name] = value
+		return nil
+	}
+
+	switch {
+	case m[1] == "count_distinct" || len(m[3]) > 0 || len(m[6]) > 0:
+		a, aok := existing.(string)
+		b, bok := value.(string)
+		if !aok || !bok {
+			return fmt.Errorf("skyd.QuerySelectionField: Invalid sketch for %q", f.Name)
+		}
+		merged, err := mergeSketches(a, b)
+		if err != nil {
+			return err
+		}
+		results[f.Name] = merged
+	case m[1] == "min" || m[1] == "max":
+		c, err := compareValues(existing, value)
+		if err != nil {
+			return err
+		}
+		if (m[1] == "min" && c > 0) || (m[1] == "max" && c < 0) {
+			results[f.Name] = value
+		}
+	default: // sum()/count()
+		sum, err := addNumbers(existing, value)
+		if err != nil {
+			return err
+		}
+		results[f.Name] = sum
+	}
+	return nil
+}
+
+//--------------------------------------
+// Finalization
+//--------------------------------------
+
+// Replaces the sketch built by a count_distinct(), quantile() or histogram()
+// field with its estimate or bucket counts. This is done once after all
+// results have been merged.
+func (f *QuerySelectionField) Finalize(data map[interface{}]interface{}) error {
+	m := querySelectionFieldExpression.FindStringSubmatch(f.Expression)
+	if m == nil || (m[1] != "count_distinct" && len(m[3]) == 0 && len(m[6]) == 0) {
+		return nil
+	}
+	sketch, ok := data[f.Name].(string)
+	if !ok {
+		return nil
+	}
+
+	if len(m[3]) > 0 {
+		q, _ := strconv.ParseFloat(m[4], 64)
+		value, err := quantileValue(sketch, q)
+		if err != nil {
+			return err
+		}
+		data[f.Name] = value
+		return nil
+	}
+	if len(m[6]) > 0 {
+		counts, err := histogramCounts(sketch)
+		if err != nil {
+			return err
+		}
+		data[f.Name] = counts
+		return nil
+	}
+
+	estimate, err := hllEstimate(sketch)
+	if err != nil {
+		return err
+	}
+	data[f.Name] = estimate
+	return nil
+}
+
+// Returns whether the field is a count() field.
+func (f *QuerySelectionField) isCount() bool {
+	m := querySelectionFieldExpression.FindStringSubmatch(f.Expression)
+	return m != nil && len(m[1]) == 0 && len(m[3]) == 0 && len(m[5]) == 0 && len(m[6]) == 0
+}
+
+// Scales a count() or sum() field of a group read from a sample of the
+// objects up to an estimate for every object, and adds the estimate's 95%
+// margin of error under "<name>_error". The margin treats the sampled
+// events as independent so it's a guide rather than a bound when objects
+// hold many events. Sums take the relative margin of the group's sampled
+// event count and get no margin if the selection doesn't count events.
+func (f *QuerySelectionField) scaleSample(data map[interface{}]interface{}, sample float64, events float64, counted bool) {
+	m := querySelectionFieldExpression.FindStringSubmatch(f.Expression)
+	if m == nil || (m[1] != "sum" && !f.isCount()) {
+		return
+	}
+	value, ok := toFloat(normalize(data[f.Name]))
+	if !ok {
+		return
+	}
+
+	if m[1] != "sum" {
+		data[f.Name] = int64(math.Floor(value/sample + 0.5))
+		data[f.Name+"_error"] = querySampleZ * math.Sqrt(value*(1-sample)) / sample
+		return
+	}
+	data[f.Name] = value / sample
+	if counted && events > 0 {
+		data[f.Name+"_error"] = math.Abs(value/sample) * querySampleZ * math.Sqrt((1-sample)/events)
+	}
+}
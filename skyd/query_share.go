@@ -0,0 +1,249 @@
+package skyd
+
+import (
+	"errors"
+	"fmt"
+	"sync"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The most queries that share one scan. Full batches start right away
+// instead of waiting out the window.
+const querySharedBatchMax = 64
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A querySharer collects the queries that arrive within a short window,
+// such as the tiles of a dashboard that load at once, and runs the ones
+// that read the same objects and events as one query. The selections of
+// every query in a batch are aggregated from a single scan of each servlet
+// and the results are split back out per query.
+type querySharer struct {
+	sync.Mutex
+	window  time.Duration
+	batches map[string]*querySharedBatch
+}
+
+// The queries that share one scan. The first query of a batch runs it for
+// the rest once the window passes or the batch fills up.
+type querySharedBatch struct {
+	queries []*Query
+	results []interface{}
+	err     error
+	full    chan bool
+	done    chan bool
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates a sharer that doesn't batch queries until it's given a window.
+func newQuerySharer() *querySharer {
+	return &querySharer{batches: make(map[string]*querySharedBatch)}
+}
+
+// Creates an empty batch.
+func newQuerySharedBatch() *querySharedBatch {
+	return &querySharedBatch{full: make(chan bool), done: make(chan bool)}
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Combines a batch of queries into one query whose selections are those of
+// every query. Each selection is renamed after its query so that their
+// results are kept apart. The queries must have the same share key.
+func newSharedQuery(queries []*Query) *Query {
+	first := queries[0]
+	shared := NewQuery(first.table, first.factors)
+	shared.snapshotId = first.snapshotId
+	shared.priority = first.priority
+	shared.SessionIdleTime = first.SessionIdleTime
+	shared.TimeRangeStart, shared.TimeRangeEnd = first.TimeRangeStart, first.TimeRangeEnd
+	shared.Sample = first.Sample
+	shared.MinEvents, shared.MinSpan = first.MinEvents, first.MinSpan
+	shared.State = first.State
+	shared.Cohort = first.Cohort
+
+	// The shared query runs until the last of its queries would time out.
+	for _, q := range queries {
+		if q.timeout <= 0 {
+			shared.timeout = 0
+			break
+		} else if q.timeout > shared.timeout {
+			shared.timeout = q.timeout
+		}
+	}
+
+	for i, q := range queries {
+		for _, step := range q.Steps {
+			selection := step.(*QuerySelection)
+			s := NewQuerySelection(shared)
+			s.Name = sharedQuerySelectionName(i, selection.Name)
+			s.Dimensions = selection.Dimensions
+			s.Fields = selection.Fields
+			s.Limit = selection.Limit
+			s.OrderBy = selection.OrderBy
+			shared.Steps = append(shared.Steps, s)
+		}
+	}
+	return shared
+}
+
+// The name that a selection of a query is given in a shared query.
+func sharedQuerySelectionName(index int, name string) string {
+	return fmt.Sprintf("q%d:%s", index, name)
+}
+
+// Splits the finalized results of a shared query into the results of each
+// of its queries. Unnamed selections of a query are moved back to the top
+// of its results.
+func splitSharedQueryResults(queries []*Query, data interface{}) []interface{} {
+	m, _ := data.(map[interface{}]interface{})
+	results := make([]interface{}, len(queries))
+	for i, q := range queries {
+		result := make(map[interface{}]interface{})
+		for _, step := range q.Steps {
+			name := step.(*QuerySelection).Name
+			value := m[sharedQuerySelectionName(i, name)]
+			if name != "" {
+				if value != nil {
+					result[name] = value
+				}
+			} else if inner, ok := value.(map[interface{}]interface{}); ok {
+				for k, v := range inner {
+					result[k] = v
+				}
+			}
+		}
+		results[i] = result
+	}
+	return results
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Queries
+//--------------------------------------
+
+// Returns the key that a query can share a scan under. Only queries made up
+// of selections can share a scan since their steps don't move the cursor,
+// and only with queries that read the same objects and events. Queries
+// that spill run on their own.
+func (q *Query) shareKey() (string, bool) {
+	if q.table == nil || !q.batchable() || len(q.Objects) > 0 || q.Spill {
+		return "", false
+	}
+	return fmt.Sprintf("%s|%s|%d|%s|%s|%d|%v|%d|%d|%v|%s", q.table.Name, q.snapshotId, q.priority,
+		q.TimeRangeStart.UTC(), q.TimeRangeEnd.UTC(), q.SessionIdleTime, q.Sample, q.MinEvents, q.MinSpan, q.State, q.Cohort), true
+}
+
+//--------------------------------------
+// Sharer
+//--------------------------------------
+
+// The time that the first query of a batch waits for others to share its
+// scan. Zero runs every query on its own.
+func (s *querySharer) Window() time.Duration {
+	s.Lock()
+	defer s.Unlock()
+	return s.window
+}
+
+// Sets the time that the first query of a batch waits for others.
+func (s *querySharer) SetWindow(window time.Duration) {
+	s.Lock()
+	defer s.Unlock()
+	s.window = window
+}
+
+// Adds a query to the open batch for its key, opening one if there isn't
+// one. Returns the batch and the query's index in it.
+func (s *querySharer) join(key string, query *Query) (*querySharedBatch, int) {
+	s.Lock()
+	defer s.Unlock()
+	b := s.batches[key]
+	if b == nil {
+		b = newQuerySharedBatch()
+		s.batches[key] = b
+	}
+	index := len(b.queries)
+	b.queries = append(b.queries, query)
+	if len(b.queries) == querySharedBatchMax {
+		delete(s.batches, key)
+		close(b.full)
+	}
+	return b, index
+}
+
+// Waits for the window to pass or a batch to fill up and then closes the
+// batch to new queries. Returns the queries of the batch.
+func (s *querySharer) flush(key string, b *querySharedBatch, window time.Duration) []*Query {
+	timer := time.NewTimer(window)
+	defer timer.Stop()
+	select {
+	case <-timer.C:
+	case <-b.full:
+	}
+
+	s.Lock()
+	defer s.Unlock()
+	if s.batches[key] == b {
+		delete(s.batches, key)
+	}
+	return b.queries
+}
+
+//--------------------------------------
+// Batches
+//--------------------------------------
+
+// Hands the results of the shared scan to the other queries of the batch.
+func (b *querySharedBatch) finish(results []interface{}, err error) {
+	b.results, b.err = results, err
+	close(b.done)
+}
+
+// Waits for the result of one of the batch's queries. The query stops
+// waiting if it times out or is cancelled but the shared scan keeps going
+// for the rest of the batch.
+func (b *querySharedBatch) result(index int, query *Query) (interface{}, error) {
+	var deadline <-chan time.Time
+	if timeout := query.Timeout(); timeout > 0 {
+		timer := time.NewTimer(timeout)
+		defer timer.Stop()
+		deadline = timer.C
+	}
+	select {
+	case <-b.done:
+		if b.err != nil {
+			return nil, b.err
+		}
+		return b.results[index], nil
+	case <-query.Cancelled():
+		return nil, errors.New("skyd.Server: Query cancelled by client")
+	case <-deadline:
+		return nil, fmt.Errorf("skyd.Server: Query timed out after %v", query.Timeout())
+	}
+}
@@ -0,0 +1,282 @@
+package skyd
+
+import (
+	"crypto/rand"
+	"encoding/hex"
+	"fmt"
+	"github.com/jmhodges/levigo"
+	"sync"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The time that a registered snapshot is kept for when none is given.
+const DefaultQuerySnapshotTTL = 1 * time.Minute
+
+// The longest time that a registered snapshot can be kept for. Snapshots
+// keep old versions of the data from being compacted away so they can't
+// be held indefinitely.
+const MaxQuerySnapshotTTL = 1 * time.Hour
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A QuerySnapshot is a point-in-time view of a table across every servlet
+// and their partitions. Every query takes one up front so that its
+// servlets are read as of the same moment while writes continue. A
+// snapshot can also be registered with the server so that several queries,
+// such as the pages of a paged query, read the same view.
+type QuerySnapshot struct {
+	sync.Mutex
+	id       string
+	table    *Table
+	servlets []*querySnapshotServlet
+	expires  time.Time
+	refs     int
+}
+
+// The view of a single servlet. Servlets whose cached results are used
+// aren't part of a query's snapshot.
+type querySnapshotServlet struct {
+	version uint64
+	views   []*querySnapshotView
+}
+
+// The view of a servlet's own database or of one of its partitions along
+// with the frozen files of the table.
+type querySnapshotView struct {
+	servlet   *Servlet
+	partition *servletPartition
+	snapshot  *levigo.Snapshot
+	frozen    []*frozenFile
+}
+
+// The snapshots registered with a server by id.
+type querySnapshotSet struct {
+	sync.Mutex
+	snapshots map[string]*QuerySnapshot
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Takes a snapshot of a table in the servlets at the given indexes and in
+// their partitions that overlap a time range, or in their memory stores of
+// a memory table. A zero time leaves that side of the range open. The
+// snapshot holds a single reference.
+func newQuerySnapshot(servlets []*Servlet, indexes []int, table *Table, prefix []byte, start time.Time, end time.Time) *QuerySnapshot {
+	q := &QuerySnapshot{table: table, servlets: make([]*querySnapshotServlet, len(servlets)), refs: 1}
+
+	// The versions are read first so that results cached under them never
+	// include writes newer than the snapshot.
+	for _, index := range indexes {
+		q.servlets[index] = &querySnapshotServlet{version: servlets[index].Version()}
+	}
+	for _, index := range indexes {
+		s := q.servlets[index]
+		s.views = append(s.views, newQuerySnapshotView(servlets[index], nil, prefix))
+		for _, partition := range servlets[index].acquirePartitions(start, end) {
+			s.views = append(s.views, newQuerySnapshotView(partition.servlet, partition, prefix))
+		}
+		if p, _ := servlets[index].acquireTableStore(table); p != nil {
+			s.views = append(s.views, newQuerySnapshotView(p.servlet, p, prefix))
+		}
+	}
+	return q
+}
+
+// Takes a snapshot of a servlet's database along with its frozen files. The
+// snapshot takes over the reference to the partition, if there is one.
+func newQuerySnapshotView(servlet *Servlet, partition *servletPartition, prefix []byte) *querySnapshotView {
+	snapshot, frozen := servlet.snapshotFrozen(prefix)
+	return &querySnapshotView{servlet: servlet, partition: partition, snapshot: snapshot, frozen: frozen}
+}
+
+// Creates an empty set of registered snapshots.
+func newQuerySnapshotSet() *querySnapshotSet {
+	return &querySnapshotSet{snapshots: make(map[string]*QuerySnapshot)}
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Accessors
+//--------------------------------------
+
+// The identifier of a registered snapshot.
+func (q *QuerySnapshot) Id() string {
+	return q.id
+}
+
+// The table that the snapshot is of.
+func (q *QuerySnapshot) Table() *Table {
+	return q.table
+}
+
+// The time that a registered snapshot is released at.
+func (q *QuerySnapshot) Expires() time.Time {
+	return q.expires
+}
+
+// Encodes a registered snapshot into an untyped map.
+func (q *QuerySnapshot) Serialize() map[string]interface{} {
+	return map[string]interface{}{
+		"id":      q.id,
+		"table":   q.table.Name,
+		"expires": q.expires.UTC().Format(time.RFC3339),
+	}
+}
+
+//--------------------------------------
+// References
+//--------------------------------------
+
+// Adds a reference to the snapshot unless it's already been released.
+func (q *QuerySnapshot) acquire() bool {
+	q.Lock()
+	defer q.Unlock()
+	if q.refs == 0 {
+		return false
+	}
+	q.refs++
+	return true
+}
+
+// Releases a reference to the snapshot. The database snapshots, frozen
+// files and partitions are released with the last reference.
+func (q *QuerySnapshot) release() {
+	q.Lock()
+	defer q.Unlock()
+	q.refs--
+	if q.refs > 0 {
+		return
+	}
+	for _, s := range q.servlets {
+		if s == nil {
+			continue
+		}
+		for _, view := range s.views {
+			view.servlet.db.ReleaseSnapshot(view.snapshot)
+			releaseFrozenFiles(view.frozen)
+			if view.partition != nil {
+				view.partition.release()
+			}
+		}
+	}
+	q.servlets = nil
+}
+
+// Retrieves the views of a servlet that overlap a time range.
+func (q *QuerySnapshot) views(index int, start time.Time, end time.Time) []*querySnapshotView {
+	views := make([]*querySnapshotView, 0)
+	for _, view := range q.servlets[index].views {
+		if view.partition == nil || view.partition.overlaps(start, end) {
+			views = append(views, view)
+		}
+	}
+	return views
+}
+
+// Whether the view is of one of a servlet's time partitions rather than
+// its own database or a table store.
+func (v *querySnapshotView) timePartition() bool {
+	return v.partition != nil && v.servlet.storeTable == nil
+}
+
+// Adds a reference to each of the view's frozen files for a scan.
+func (v *querySnapshotView) retainFrozen() []*frozenFile {
+	for _, f := range v.frozen {
+		f.retain()
+	}
+	return append([]*frozenFile{}, v.frozen...)
+}
+
+//--------------------------------------
+// Registration
+//--------------------------------------
+
+// Registers a snapshot under a new random id until it expires.
+func (set *querySnapshotSet) add(q *QuerySnapshot, ttl time.Duration) error {
+	b := make([]byte, 16)
+	if _, err := rand.Read(b); err != nil {
+		return err
+	}
+	q.id = hex.EncodeToString(b)
+	q.expires = time.Now().Add(ttl)
+
+	set.Lock()
+	defer set.Unlock()
+	set.snapshots[q.id] = q
+	return nil
+}
+
+// Retrieves a registered snapshot with a reference that must be released.
+// Expired snapshots are released first.
+func (set *querySnapshotSet) acquire(id string) (*QuerySnapshot, error) {
+	set.expire()
+	set.Lock()
+	q := set.snapshots[id]
+	set.Unlock()
+	if q == nil || !q.acquire() {
+		return nil, fmt.Errorf("skyd.Server: Snapshot not found: %s", id)
+	}
+	return q, nil
+}
+
+// Unregisters a snapshot and releases its reference. Queries still reading
+// the snapshot keep it until they finish. Returns false if the snapshot
+// isn't registered.
+func (set *querySnapshotSet) remove(id string) bool {
+	set.Lock()
+	q := set.snapshots[id]
+	delete(set.snapshots, id)
+	set.Unlock()
+	if q == nil {
+		return false
+	}
+	q.release()
+	return true
+}
+
+// Unregisters the snapshots that have expired.
+func (set *querySnapshotSet) expire() {
+	now := time.Now()
+	expired := make([]*QuerySnapshot, 0)
+	set.Lock()
+	for id, q := range set.snapshots {
+		if !now.Before(q.expires) {
+			delete(set.snapshots, id)
+			expired = append(expired, q)
+		}
+	}
+	set.Unlock()
+	for _, q := range expired {
+		q.release()
+	}
+}
+
+// Unregisters every snapshot.
+func (set *querySnapshotSet) clear() {
+	set.Lock()
+	snapshots := set.snapshots
+	set.snapshots = make(map[string]*QuerySnapshot)
+	set.Unlock()
+	for _, q := range snapshots {
+		q.release()
+	}
+}
@@ -0,0 +1,243 @@
+package skyd
+
+import (
+	"bufio"
+	"container/heap"
+	"io"
+	"io/ioutil"
+	"os"
+	"sort"
+	"sync"
+
+	"github.com/ugorji/go-msgpack"
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A querySpill holds the partial results that the aggregations of a query
+// handed back at their spill budget, such as for group-bys with more groups
+// than fit in an engine's heap. Each partial result is split into one record
+// per group, which are sorted by their group keys and written to a temporary
+// file as a run of msgpack key and record pairs. The runs are merged back a
+// group at a time so that only one record of each run is held in memory.
+type querySpill struct {
+	sync.Mutex
+	dir  string
+	runs []string
+}
+
+// A record of a run along with the key of its group.
+type querySpillRecord struct {
+	key  string
+	data map[interface{}]interface{}
+}
+
+type querySpillRecords []querySpillRecord
+
+// Reads the records of a run in order.
+type querySpillReader struct {
+	file    *os.File
+	decoder *msgpack.Decoder
+	querySpillRecord
+}
+
+// The runs being merged ordered by the key of their current record.
+type querySpillHeap []*querySpillReader
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates a spill that writes its runs to a directory.
+func newQuerySpill(dir string) *querySpill {
+	return &querySpill{dir: dir}
+}
+
+// Opens a run for reading.
+func openQuerySpillReader(path string) (*querySpillReader, error) {
+	file, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	return &querySpillReader{file: file, decoder: msgpack.NewDecoder(bufio.NewReader(file), nil)}, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Runs
+//--------------------------------------
+
+// Checks whether any partial result was spilled.
+func (s *querySpill) spilled() bool {
+	if s == nil {
+		return false
+	}
+	s.Lock()
+	defer s.Unlock()
+	return len(s.runs) > 0
+}
+
+// Splits a partial result into records and writes them as a new run. The
+// result is emptied.
+func (s *querySpill) add(q *Query, result interface{}) error {
+	data, ok := result.(map[interface{}]interface{})
+	if !ok {
+		return nil
+	}
+	records := make(querySpillRecords, 0)
+	err := q.splitKeyed(data, func(key string, record map[interface{}]interface{}) error {
+		records = append(records, querySpillRecord{key, record})
+		return nil
+	})
+	if err != nil || len(records) == 0 {
+		return err
+	}
+	sort.Sort(records)
+
+	file, err := ioutil.TempFile(s.dir, "run")
+	if err != nil {
+		return err
+	}
+	w := bufio.NewWriter(file)
+	encoder := msgpack.NewEncoder(w)
+	for _, record := range records {
+		if err = encoder.Encode(record.key); err != nil {
+			break
+		}
+		if err = encoder.Encode(record.data); err != nil {
+			break
+		}
+	}
+	if err == nil {
+		err = w.Flush()
+	}
+	if cerr := file.Close(); err == nil {
+		err = cerr
+	}
+	if err != nil {
+		os.Remove(file.Name())
+		return err
+	}
+
+	s.Lock()
+	s.runs = append(s.runs, file.Name())
+	s.Unlock()
+	return nil
+}
+
+// Merges the runs and passes the merged record of each group to a function
+// in the order of their keys, which puts the records that aren't part of a
+// group first.
+func (s *querySpill) each(q *Query, fn func(map[interface{}]interface{}) error) error {
+	s.Lock()
+	runs := s.runs
+	s.Unlock()
+
+	readers := make([]*querySpillReader, 0, len(runs))
+	defer func() {
+		for _, r := range readers {
+			r.file.Close()
+		}
+	}()
+	h := make(querySpillHeap, 0, len(runs))
+	for _, path := range runs {
+		r, err := openQuerySpillReader(path)
+		if err != nil {
+			return err
+		}
+		readers = append(readers, r)
+		if ok, err := r.next(); err != nil {
+			return err
+		} else if ok {
+			h = append(h, r)
+		}
+	}
+	heap.Init(&h)
+
+	for len(h) > 0 {
+		key := h[0].key
+		var merged interface{}
+		for len(h) > 0 && h[0].key == key {
+			r := h[0]
+			var err error
+			if merged, err = q.Merge(merged, r.data); err != nil {
+				return err
+			}
+			ok, err := r.next()
+			if err != nil {
+				return err
+			} else if ok {
+				heap.Fix(&h, 0)
+			} else {
+				heap.Pop(&h)
+			}
+		}
+		if err := fn(merged.(map[interface{}]interface{})); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// Removes the runs.
+func (s *querySpill) close() {
+	if s == nil {
+		return
+	}
+	s.Lock()
+	defer s.Unlock()
+	for _, path := range s.runs {
+		os.Remove(path)
+	}
+	s.runs = nil
+}
+
+//--------------------------------------
+// Reading
+//--------------------------------------
+
+// Reads the next record of the run. Returns false at the end of the run.
+func (r *querySpillReader) next() (bool, error) {
+	var key string
+	if err := r.decoder.Decode(&key); err == io.EOF {
+		return false, nil
+	} else if err != nil {
+		return false, err
+	}
+	var data map[interface{}]interface{}
+	if err := r.decoder.Decode(&data); err != nil {
+		return false, err
+	}
+	r.key, r.data = key, normalizeQueryResult(data).(map[interface{}]interface{})
+	return true, nil
+}
+
+//--------------------------------------
+// Sorting
+//--------------------------------------
+
+func (r querySpillRecords) Len() int           { return len(r) }
+func (r querySpillRecords) Swap(i, j int)      { r[i], r[j] = r[j], r[i] }
+func (r querySpillRecords) Less(i, j int) bool { return r[i].key < r[j].key }
+
+func (h querySpillHeap) Len() int            { return len(h) }
+func (h querySpillHeap) Swap(i, j int)       { h[i], h[j] = h[j], h[i] }
+func (h querySpillHeap) Less(i, j int) bool  { return h[i].key < h[j].key }
+func (h *querySpillHeap) Push(x interface{}) { *h = append(*h, x.(*querySpillReader)) }
+func (h *querySpillHeap) Pop() interface{} {
+	old := *h
+	r := old[len(old)-1]
+	*h = old[:len(old)-1]
+	return r
+}
@@ -30,6 +30,8 @@ type QueryStep interface {
 	Deserialize(map[string]interface{}) error
 	CodegenAggregateFunction() (string, error)
 	CodegenMergeFunction() (string, error)
+	Merge(results map[interface{}]interface{}, data map[interface{}]interface{}) error
+	Finalize(data interface{}) error
 	Defactorize(data interface{}) error
 }
 
@@ -88,11 +90,22 @@ func DeserializeQueryStepList(obj interface{}, q *Query) (QueryStepList, error)
 // Code Generation
 //--------------------------------------
 
-// Generates aggregate code for all steps.
+// Generates aggregate code for all steps. Adjacent selections are fused
+// into a single function so that they read the event once.
 func (l QueryStepList) CodegenAggregateFunctions() (string, error) {
 	buffer := new(bytes.Buffer)
-	for _, step := range l {
-		code, err := step.CodegenAggregateFunction()
+	for _, run := range l.aggregateRuns() {
+		var code string
+		var err error
+		if len(run) == 1 {
+			code, err = run[0].CodegenAggregateFunction()
+		} else {
+			selections := make([]*QuerySelection, 0, len(run))
+			for _, step := range run {
+				selections = append(selections, step.(*QuerySelection))
+			}
+			code, err = codegenSelectionsFunction(aggregateRunFunctionName(run), selections)
+		}
 		if err != nil {
 			return "", err
 		}
@@ -101,6 +114,45 @@ func (l QueryStepList) CodegenAggregateFunctions() (string, error) {
 	return buffer.String(), nil
 }
 
+// Generates the calls of the aggregate functions of all steps.
+func (l QueryStepList) CodegenAggregateInvoke(indent string) string {
+	buffer := new(bytes.Buffer)
+	for _, run := range l.aggregateRuns() {
+		fmt.Fprintf(buffer, "%s%s(cursor, data)\n", indent, aggregateRunFunctionName(run))
+	}
+	return buffer.String()
+}
+
+// Groups the steps into the runs that are each aggregated by one function.
+// Adjacent selections share a run as long as the properties they read fit
+// in the locals of a function and every other step runs on its own.
+func (l QueryStepList) aggregateRuns() [][]QueryStep {
+	runs := make([][]QueryStep, 0, len(l))
+	var selections []*QuerySelection
+	for _, step := range l {
+		selection, ok := step.(*QuerySelection)
+		if ok && len(selections) > 0 && len(selectionProperties(append(selections, selection))) <= queryCodegenMaxLocals {
+			runs[len(runs)-1] = append(runs[len(runs)-1], step)
+			selections = append(selections, selection)
+			continue
+		}
+		runs = append(runs, []QueryStep{step})
+		selections = nil
+		if ok {
+			selections = []*QuerySelection{selection}
+		}
+	}
+	return runs
+}
+
+// Retrieves the name of the function that aggregates a run of steps.
+func aggregateRunFunctionName(run []QueryStep) string {
+	if len(run) == 1 {
+		return run[0].FunctionName()
+	}
+	return run[0].FunctionName() + "_fused"
+}
+
 // Generates merge code for all steps.
 func (l QueryStepList) CodegenMergeFunctions() (string, error) {
 	buffer := new(bytes.Buffer)
@@ -132,6 +184,38 @@ func (l QueryStepList) CodegenMergeInvoke() string {
 	return buffer.String()
 }
 
+//--------------------------------------
+// Merging
+//--------------------------------------
+
+// Merges one aggregate result into another natively. This follows the same
+// order as the generated merge() function.
+func (l QueryStepList) Merge(results map[interface{}]interface{}, data map[interface{}]interface{}) error {
+	for _, step := range l {
+		if err := step.Merge(results, data); err != nil {
+			return err
+		}
+		if err := step.GetSteps().Merge(results, data); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+//--------------------------------------
+// Finalization
+//--------------------------------------
+
+// Finalizes the merged results of all steps.
+func (l QueryStepList) Finalize(data interface{}) error {
+	for _, step := range l {
+		if err := step.Finalize(data); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
 //--------------------------------------
 // Factorization
 //--------------------------------------
@@ -2,6 +2,7 @@ package skyd
 
 import (
 	"bytes"
+	"fmt"
 	"testing"
 )
 
@@ -28,3 +29,214 @@ func TestQueryEncodeDecode(t *testing.T) {
 		t.Fatalf("Query encoding error:\nexp: %s\ngot: %s", json, buffer.String())
 	}
 }
+
+// Ensure that aggregate results can be merged natively.
+func TestQueryMerge(t *testing.T) {
+	table := createTempTable(t)
+	table.Open()
+	defer table.Close()
+
+	json := `{"steps":[{"type":"condition","expression":"true","steps":[{"type":"selection","name":"xyz","dimensions":["foo"],"fields":[{"name":"sum","expression":"sum(x)"},{"name":"min","expression":"min(x)"},{"name":"max","expression":"max(x)"}]}]},{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`
+	q := NewQuery(table, nil)
+	if err := q.Decode(bytes.NewBufferString(json)); err != nil {
+		t.Fatalf("Query decoding error: %v", err)
+	}
+
+	results := map[interface{}]interface{}{
+		"count": uint64(3),
+		"xyz": map[interface{}]interface{}{"foo": map[interface{}]interface{}{
+			"a": map[interface{}]interface{}{"sum": int64(10), "min": int64(2), "max": int64(8)},
+		}},
+	}
+	data := map[interface{}]interface{}{
+		"count": uint64(4),
+		"xyz": map[interface{}]interface{}{"foo": map[interface{}]interface{}{
+			"a": map[interface{}]interface{}{"sum": 1.5, "min": int64(1), "max": int64(5)},
+			"b": map[interface{}]interface{}{"sum": int64(7), "min": int64(7), "max": int64(7)},
+		}},
+	}
+	merged, err := q.Merge(results, data)
+	if err != nil {
+		t.Fatalf("Merge error: %v", err)
+	}
+	exp := `map[count:7 xyz:map[foo:map[a:map[max:8 min:1 sum:11.5] b:map[max:7 min:7 sum:7]]]]`
+	if got := fmt.Sprintf("%v", merged); got != exp {
+		t.Fatalf("Unexpected merge:\nexp: %s\ngot: %s", exp, got)
+	}
+}
+
+// Ensure that merges of a limited selection keep only the heaviest
+// candidates and that finalizing keeps only the limit.
+func TestQueryMergeLimit(t *testing.T) {
+	table := createTempTable(t)
+	table.Open()
+	defer table.Close()
+
+	json := `{"steps":[{"type":"selection","dimensions":["foo"],"limit":1,"fields":[{"name":"count","expression":"count()"}]}]}`
+	q := NewQuery(table, nil)
+	if err := q.Decode(bytes.NewBufferString(json)); err != nil {
+		t.Fatalf("Query decoding error: %v", err)
+	}
+
+	results := map[interface{}]interface{}{"foo": map[interface{}]interface{}{}}
+	data := map[interface{}]interface{}{"foo": map[interface{}]interface{}{}}
+	for i := 0; i < 6; i++ {
+		results["foo"].(map[interface{}]interface{})[int64(i)] = map[interface{}]interface{}{"count": int64(i)}
+		data["foo"].(map[interface{}]interface{})[int64(i+6)] = map[interface{}]interface{}{"count": int64(i + 6)}
+	}
+	merged, err := q.Merge(results, data)
+	if err != nil {
+		t.Fatalf("Merge error: %v", err)
+	}
+	exp := `map[foo:map[8:map[count:8] 9:map[count:9] 10:map[count:10] 11:map[count:11]]]`
+	if got := fmt.Sprintf("%v", merged); got != exp {
+		t.Fatalf("Unexpected merge:\nexp: %s\ngot: %s", exp, got)
+	}
+	if err := q.Finalize(merged); err != nil {
+		t.Fatalf("Finalize error: %v", err)
+	}
+	if got := fmt.Sprintf("%v", merged); got != `map[foo:map[11:map[count:11]]]` {
+		t.Fatalf("Unexpected finalized result: %s", got)
+	}
+}
+
+// Ensure that the counts and sums of sampled queries are scaled up with
+// margins of error.
+func TestQuerySample(t *testing.T) {
+	table := createTempTable(t)
+	table.Open()
+	defer table.Close()
+
+	json := `{"sample":0.25,"sessionIdleTime":0,"steps":[{"dimensions":[],"fields":[{"expression":"count()","name":"count"},{"expression":"sum(x)","name":"total"}],"name":"","type":"selection"}]}` + "\n"
+	q := NewQuery(table, nil)
+	if err := q.Decode(bytes.NewBufferString(json)); err != nil {
+		t.Fatalf("Query decoding error: %v", err)
+	}
+	buffer := new(bytes.Buffer)
+	q.Encode(buffer)
+	if buffer.String() != json {
+		t.Fatalf("Query encoding error:\nexp: %s\ngot: %s", json, buffer.String())
+	}
+
+	result := map[interface{}]interface{}{"count": int64(10), "total": int64(40)}
+	if err := q.Finalize(result); err != nil {
+		t.Fatalf("Finalize error: %v", err)
+	}
+	exp := `count=40 count_error=21.47 total=160.00 total_error=85.88`
+	got := fmt.Sprintf("count=%v count_error=%.2f total=%.2f total_error=%.2f", result["count"], result["count_error"], result["total"], result["total_error"])
+	if got != exp {
+		t.Fatalf("Unexpected sampled result:\nexp: %s\ngot: %s", exp, got)
+	}
+
+	// Samples must be a fraction of the objects.
+	if err := q.Decode(bytes.NewBufferString(`{"sample":1.5,"steps":[]}`)); err == nil {
+		t.Fatalf("Expected an invalid sample to fail")
+	}
+}
+
+// Ensure that state queries are encoded and can't have a time range.
+func TestQueryState(t *testing.T) {
+	table := createTempTable(t)
+	table.Open()
+	defer table.Close()
+
+	json := `{"sessionIdleTime":0,"state":true,"steps":[{"dimensions":["foo"],"fields":[{"expression":"count()","name":"count"}],"name":"","type":"selection"}]}` + "\n"
+	q := NewQuery(table, nil)
+	if err := q.Decode(bytes.NewBufferString(json)); err != nil {
+		t.Fatalf("Query decoding error: %v", err)
+	}
+	buffer := new(bytes.Buffer)
+	q.Encode(buffer)
+	if buffer.String() != json {
+		t.Fatalf("Query encoding error:\nexp: %s\ngot: %s", json, buffer.String())
+	}
+
+	if err := q.Decode(bytes.NewBufferString(`{"state":true,"timeRange":["2012-01-01T00:00:00Z",null],"steps":[]}`)); err == nil {
+		t.Fatalf("Expected a state query with a time range to fail")
+	}
+	if err := q.Decode(bytes.NewBufferString(`{"state":1,"steps":[]}`)); err == nil {
+		t.Fatalf("Expected an invalid state to fail")
+	}
+}
+
+// Ensure that object bounds are encoded and can't be negative or set on
+// state queries.
+func TestQueryObjectBounds(t *testing.T) {
+	table := createTempTable(t)
+	table.Open()
+	defer table.Close()
+
+	json := `{"minEvents":3,"minSpan":86400,"sessionIdleTime":0,"steps":[{"dimensions":[],"fields":[{"expression":"count()","name":"count"}],"name":"","type":"selection"}]}` + "\n"
+	q := NewQuery(table, nil)
+	if err := q.Decode(bytes.NewBufferString(json)); err != nil {
+		t.Fatalf("Query decoding error: %v", err)
+	}
+	buffer := new(bytes.Buffer)
+	q.Encode(buffer)
+	if buffer.String() != json {
+		t.Fatalf("Query encoding error:\nexp: %s\ngot: %s", json, buffer.String())
+	}
+
+	if err := q.Decode(bytes.NewBufferString(`{"minEvents":-1,"steps":[]}`)); err == nil {
+		t.Fatalf("Expected negative min events to fail")
+	}
+	if err := q.Decode(bytes.NewBufferString(`{"state":true,"minSpan":60,"steps":[]}`)); err == nil {
+		t.Fatalf("Expected a state query with a min span to fail")
+	}
+}
+
+// Ensure that spilling is encoded and can't be used with limited selections.
+func TestQuerySpill(t *testing.T) {
+	table := createTempTable(t)
+	table.Open()
+	defer table.Close()
+
+	json := `{"sessionIdleTime":0,"spill":true,"steps":[{"dimensions":[],"fields":[{"expression":"count()","name":"count"}],"name":"","type":"selection"}]}` + "\n"
+	q := NewQuery(table, nil)
+	if err := q.Decode(bytes.NewBufferString(json)); err != nil {
+		t.Fatalf("Query decoding error: %v", err)
+	}
+	buffer := new(bytes.Buffer)
+	q.Encode(buffer)
+	if buffer.String() != json {
+		t.Fatalf("Query encoding error:\nexp: %s\ngot: %s", json, buffer.String())
+	}
+	if _, ok := q.shareKey(); ok {
+		t.Fatalf("Expected a query that spills not to share scans")
+	}
+
+	if err := q.Decode(bytes.NewBufferString(`{"spill":1,"steps":[]}`)); err == nil {
+		t.Fatalf("Expected a non-boolean spill to fail")
+	}
+	if err := q.Decode(bytes.NewBufferString(`{"spill":true,"steps":[{"type":"selection","dimensions":["foo"],"fields":[{"name":"count","expression":"count()"}],"limit":10}]}`)); err == nil {
+		t.Fatalf("Expected a limited selection that spills to fail")
+	}
+}
+
+// Ensure that object lists are encoded and must be lists of ids.
+func TestQueryObjects(t *testing.T) {
+	table := createTempTable(t)
+	table.Open()
+	defer table.Close()
+
+	json := `{"objects":["a1","a2"],"sessionIdleTime":0,"steps":[{"dimensions":[],"fields":[{"expression":"count()","name":"count"}],"name":"","type":"selection"}]}` + "\n"
+	q := NewQuery(table, nil)
+	if err := q.Decode(bytes.NewBufferString(json)); err != nil {
+		t.Fatalf("Query decoding error: %v", err)
+	}
+	buffer := new(bytes.Buffer)
+	q.Encode(buffer)
+	if buffer.String() != json {
+		t.Fatalf("Query encoding error:\nexp: %s\ngot: %s", json, buffer.String())
+	}
+	if _, ok := q.shareKey(); ok {
+		t.Fatalf("Expected a query of listed objects not to share a scan")
+	}
+
+	if err := q.Decode(bytes.NewBufferString(`{"objects":["a1",2],"steps":[]}`)); err == nil {
+		t.Fatalf("Expected an invalid object id to fail")
+	}
+	if err := q.Decode(bytes.NewBufferString(`{"objects":["a1"],"cohort":"buyers","steps":[]}`)); err == nil {
+		t.Fatalf("Expected a query of listed objects and a cohort to fail")
+	}
+}
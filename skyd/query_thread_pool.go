@@ -0,0 +1,199 @@
+package skyd
+
+/*
+#cgo LDFLAGS: -lcsky -lpthread
+#include <stdlib.h>
+#include <sky/worker_pool.h>
+*/
+import "C"
+
+import (
+	"errors"
+	"sync"
+	"syscall"
+	"unsafe"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of tasks that can be outstanding on a thread pool. Callers
+// past it wait for a slot before their task is submitted.
+const queryThreadPoolCapacity = 1024
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A QueryThreadPool runs aggregations on native threads that the Go
+// scheduler doesn't own. Without it each aggregation is one long cgo call
+// that pins an OS thread for the length of the scan, and enough of them at
+// once starve the goroutines serving HTTP and ingest. With it, a goroutine
+// hands its engine's Lua state and cursor to a worker through a lock-free
+// ring and parks on a channel until the worker is done. A single goroutine
+// waits on the pool's descriptor and wakes the owners of finished tasks.
+//
+// A task's state and cursor are only touched by the worker running it, and
+// an engine only ever has one task outstanding.
+type QueryThreadPool struct {
+	sync.Mutex
+	pool    *C.sky_worker_pool
+	threads int
+	pinned  bool
+	slots   chan bool
+	nextId  uint64
+	waiting map[uint64]chan bool
+	closed  bool
+	done    chan bool
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructor
+//
+//------------------------------------------------------------------------------
+
+// Starts a pool with a number of threads, pinned to the process's CPUs in
+// turn if requested.
+func NewQueryThreadPool(threads int, pinned bool) (*QueryThreadPool, error) {
+	if threads <= 0 {
+		return nil, errors.New("skyd.QueryThreadPool: Thread count must be positive")
+	}
+	return newQueryThreadPool(C.sky_worker_pool_new(C.uint32_t(threads), C.uint32_t(queryThreadPoolCapacity), C.bool(pinned)), threads, pinned)
+}
+
+// Starts a pool with a number of threads pinned to the CPUs of a NUMA node
+// in turn. The threads prefer the node's memory so that the Lua heaps that
+// grow while they aggregate and the blocks they read into the cache stay
+// local to them.
+func newQueryThreadPoolOnNode(threads int, node *numaNode) (*QueryThreadPool, error) {
+	if threads <= 0 {
+		return nil, errors.New("skyd.QueryThreadPool: Thread count must be positive")
+	}
+	cpus := make([]C.int, len(node.cpus))
+	for i, cpu := range node.cpus {
+		cpus[i] = C.int(cpu)
+	}
+	return newQueryThreadPool(C.sky_worker_pool_new_bound(C.uint32_t(threads), C.uint32_t(queryThreadPoolCapacity), &cpus[0], C.uint32_t(len(cpus)), C.int(node.id)), threads, true)
+}
+
+// Wraps a started C pool.
+func newQueryThreadPool(pool *C.sky_worker_pool, threads int, pinned bool) (*QueryThreadPool, error) {
+	if pool == nil {
+		return nil, errors.New("skyd.QueryThreadPool: Unable to start threads")
+	}
+	p := &QueryThreadPool{
+		pool:    pool,
+		threads: threads,
+		pinned:  pinned,
+		slots:   make(chan bool, queryThreadPoolCapacity),
+		waiting: make(map[uint64]chan bool),
+		done:    make(chan bool),
+	}
+	go p.poll()
+	return p, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Properties
+//
+//------------------------------------------------------------------------------
+
+// The number of threads that run tasks.
+func (p *QueryThreadPool) Threads() int {
+	return p.threads
+}
+
+// Whether each thread is pinned to a CPU.
+func (p *QueryThreadPool) Pinned() bool {
+	return p.pinned
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// Runs a C task on one of the pool's threads and waits for it to finish.
+// The argument must be allocated by C since the worker reads it after the
+// cgo call that submits it has returned. Returns false without running the
+// task if the pool is closed, so that the caller can run it itself.
+func (p *QueryThreadPool) run(fn C.sky_worker_task_func, arg unsafe.Pointer) bool {
+	p.slots <- true
+	defer func() { <-p.slots }()
+
+	done := make(chan bool, 1)
+	p.Lock()
+	if p.closed {
+		p.Unlock()
+		return false
+	}
+	p.nextId++
+	id := p.nextId
+	p.waiting[id] = done
+	submitted := C.sky_worker_pool_submit(p.pool, fn, arg, C.uint64_t(id)) == 0
+	if !submitted {
+		delete(p.waiting, id)
+	}
+	p.Unlock()
+
+	if submitted {
+		<-done
+	}
+	return submitted
+}
+
+// Waits on the pool's descriptor and wakes the goroutines whose tasks have
+// finished. Returns once the pool is stopped and every completion is read.
+func (p *QueryThreadPool) poll() {
+	defer close(p.done)
+	fd := int(C.sky_worker_pool_fd(p.pool))
+	buf := make([]byte, 64)
+	ids := make([]C.uint64_t, queryThreadPoolCapacity)
+	for {
+		n, err := syscall.Read(fd, buf)
+		if err == syscall.EINTR {
+			continue
+		} else if n <= 0 {
+			return
+		}
+		for {
+			count := int(C.sky_worker_pool_drain(p.pool, &ids[0], C.uint32_t(len(ids))))
+			if count == 0 {
+				break
+			}
+			p.Lock()
+			for _, id := range ids[:count] {
+				if done := p.waiting[uint64(id)]; done != nil {
+					delete(p.waiting, uint64(id))
+					done <- true
+				}
+			}
+			p.Unlock()
+		}
+	}
+}
+
+// Stops the threads once the tasks already submitted have finished and
+// releases the pool. Tasks run after the pool is closed are refused.
+func (p *QueryThreadPool) Close() {
+	p.Lock()
+	if p.closed {
+		p.Unlock()
+		return
+	}
+	p.closed = true
+	p.Unlock()
+
+	C.sky_worker_pool_stop(p.pool)
+	<-p.done
+	C.sky_worker_pool_free(p.pool)
+	p.pool = nil
+}
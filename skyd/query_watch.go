@@ -0,0 +1,274 @@
+package skyd
+
+import (
+	"errors"
+	"fmt"
+	"sync"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The interval that a watched query is evaluated at when none is given.
+const DefaultQueryWatchInterval = 10 * time.Second
+
+// The shortest interval that a watched query can be evaluated at.
+const MinQueryWatchInterval = 100 * time.Millisecond
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A QueryWatch is a query that's registered with the server and evaluated
+// continuously for its subscribers. Each evaluation only rescans the
+// servlets that have been written to since the last one. The results of
+// the others come from the query cache and are merged with the new ones.
+// When no servlet has been written to the evaluation is skipped and
+// nothing is pushed. Subscribers of the same query at the same interval
+// share a single watch.
+type QueryWatch struct {
+	sync.Mutex
+	server      *Server
+	table       *Table
+	key         string
+	obj         map[string]interface{}
+	priority    int
+	timeout     time.Duration
+	interval    time.Duration
+	versions    []uint64
+	last        *QueryWatchUpdate
+	subscribers map[*QueryWatchSubscription]bool
+	closing     chan bool
+	done        chan bool
+	stopped     bool
+}
+
+// A QueryWatchUpdate is the finalized result of one evaluation of a watched
+// query or the error that it failed with.
+type QueryWatchUpdate struct {
+	Result map[interface{}]interface{}
+	Err    error
+}
+
+// A QueryWatchSubscription receives the updates of a watched query. Only
+// the newest update is held for a subscriber that falls behind.
+type QueryWatchSubscription struct {
+	watch   *QueryWatch
+	updates chan *QueryWatchUpdate
+}
+
+// The watches registered with a server by table, query and interval.
+type queryWatchSet struct {
+	sync.Mutex
+	watches map[string]*QueryWatch
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates an empty set of watches.
+func newQueryWatchSet() *queryWatchSet {
+	return &queryWatchSet{watches: make(map[string]*QueryWatch)}
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Subscriptions
+//--------------------------------------
+
+// The channel that the subscription's updates arrive on. It's closed when
+// the server shuts down.
+func (s *QueryWatchSubscription) Updates() <-chan *QueryWatchUpdate {
+	return s.updates
+}
+
+// Stops receiving updates. The watch is stopped with its last subscriber.
+func (s *QueryWatchSubscription) Close() {
+	s.watch.server.watches.unsubscribe(s)
+}
+
+// Replaces any update that the subscriber hasn't received yet with a newer
+// one. Only the watch sends on the channel so the send can't block.
+func (s *QueryWatchSubscription) push(update *QueryWatchUpdate) {
+	select {
+	case s.updates <- update:
+	default:
+		select {
+		case <-s.updates:
+		default:
+		}
+		s.updates <- update
+	}
+}
+
+//--------------------------------------
+// Evaluation
+//--------------------------------------
+
+// Evaluates the query at every interval until the watch is stopped.
+func (w *QueryWatch) run() {
+	defer close(w.done)
+	ticker := time.NewTicker(w.interval)
+	defer ticker.Stop()
+	for {
+		w.evaluate()
+		select {
+		case <-w.closing:
+			return
+		case <-ticker.C:
+		}
+	}
+}
+
+// Runs the query if any servlet has been written to since the last
+// evaluation and pushes the result to the subscribers. The versions are
+// read before the query runs so that writes made during it are picked up
+// by the next evaluation. Failed evaluations are retried.
+func (w *QueryWatch) evaluate() {
+	versions := w.server.servletVersions()
+	if w.versions != nil && equalVersions(versions, w.versions) {
+		return
+	}
+
+	query := NewQuery(w.table, w.server.factors)
+	err := query.Deserialize(w.obj)
+	var result interface{}
+	if err == nil {
+		query.SetPriority(w.priority)
+		query.SetTimeout(w.timeout)
+		query.SetCancelled(w.closing)
+		result, err = w.server.RunQuery(w.table, query)
+	}
+
+	update := &QueryWatchUpdate{Err: err}
+	if err == nil {
+		update.Result, _ = result.(map[interface{}]interface{})
+		w.versions = versions
+	}
+
+	w.Lock()
+	defer w.Unlock()
+	if w.stopped {
+		return
+	}
+	w.last = update
+	for sub := range w.subscribers {
+		sub.push(update)
+	}
+}
+
+// Checks whether two lists of servlet versions are the same.
+func equalVersions(a []uint64, b []uint64) bool {
+	if len(a) != len(b) {
+		return false
+	}
+	for i := range a {
+		if a[i] != b[i] {
+			return false
+		}
+	}
+	return true
+}
+
+//--------------------------------------
+// Registration
+//--------------------------------------
+
+// Subscribes to the watch of a query of a table at an interval, starting
+// the watch if there isn't one yet. A new subscriber of a running watch
+// gets its last update right away.
+func (s *queryWatchSet) subscribe(server *Server, table *Table, query *Query, interval time.Duration) (*QueryWatchSubscription, error) {
+	if query.SnapshotId() != "" {
+		return nil, errors.New("skyd.Server: Queries of a snapshot can't be watched")
+	}
+	if interval <= 0 {
+		interval = DefaultQueryWatchInterval
+	} else if interval < MinQueryWatchInterval {
+		return nil, fmt.Errorf("skyd.Server: Watch interval is shorter than %v: %v", MinQueryWatchInterval, interval)
+	}
+	key, err := queryCacheKey(table, query)
+	if err != nil {
+		return nil, err
+	}
+	key = fmt.Sprintf("%s:%d:%v", key, query.Priority(), interval)
+
+	s.Lock()
+	defer s.Unlock()
+	w := s.watches[key]
+	if w == nil {
+		w = &QueryWatch{
+			server:      server,
+			table:       table,
+			key:         key,
+			obj:         query.Serialize(),
+			priority:    query.Priority(),
+			timeout:     query.Timeout(),
+			interval:    interval,
+			subscribers: make(map[*QueryWatchSubscription]bool),
+			closing:     make(chan bool),
+			done:        make(chan bool),
+		}
+		s.watches[key] = w
+		go w.run()
+	}
+
+	sub := &QueryWatchSubscription{watch: w, updates: make(chan *QueryWatchUpdate, 1)}
+	w.Lock()
+	w.subscribers[sub] = true
+	if w.last != nil {
+		sub.push(w.last)
+	}
+	w.Unlock()
+	return sub, nil
+}
+
+// Removes a subscriber from its watch and stops the watch if it was the
+// last one.
+func (s *queryWatchSet) unsubscribe(sub *QueryWatchSubscription) {
+	s.Lock()
+	defer s.Unlock()
+	w := sub.watch
+	w.Lock()
+	defer w.Unlock()
+	delete(w.subscribers, sub)
+	if len(w.subscribers) == 0 && !w.stopped {
+		w.stopped = true
+		close(w.closing)
+		delete(s.watches, w.key)
+	}
+}
+
+// Stops every watch and closes the update channels of their subscribers.
+// Evaluations in progress are cancelled and waited on so that nothing is
+// scanning once the servlets close.
+func (s *queryWatchSet) clear() {
+	s.Lock()
+	watches := s.watches
+	s.watches = make(map[string]*QueryWatch)
+	s.Unlock()
+	for _, w := range watches {
+		w.Lock()
+		w.stopped = true
+		close(w.closing)
+		for sub := range w.subscribers {
+			close(sub.updates)
+		}
+		w.subscribers = nil
+		w.Unlock()
+		<-w.done
+	}
+}
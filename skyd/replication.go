@@ -0,0 +1,787 @@
+package skyd
+
+import (
+	"crypto/rand"
+	"encoding/hex"
+	"encoding/json"
+	"fmt"
+	"github.com/jmhodges/levigo"
+	"github.com/ugorji/go-msgpack"
+	"io"
+	"io/ioutil"
+	"net/http"
+	"os"
+	"strconv"
+	"sync"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The kinds of change recorded in a change log.
+const (
+	changePut = iota
+	changeDelete
+	changeDeleteRange
+	changeMerge
+)
+
+// The most committed batches and bytes of changes that a change log keeps.
+// Replicas that fall further behind are sent a full copy of the database
+// instead.
+const (
+	changeLogSize      = 4096
+	changeLogByteLimit = 32 << 20
+)
+
+// The number of keys sent in each record of a full copy.
+const replicationDumpBatchSize = 1024
+
+// The time that a primary holds a request for changes open when there
+// aren't any yet.
+const replicationWait = 1 * time.Second
+
+// The time that a replica waits before retrying a primary that failed.
+const replicationRetryDelay = 1 * time.Second
+
+// The name of the change stream of the factors database. Servlets are named
+// by their index.
+const factorsReplicationSource = "factors"
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A writeBatch is a LevelDB write batch that also records its changes so
+// that they can be added to a change log once the batch is committed.
+type writeBatch struct {
+	*levigo.WriteBatch
+	ops     []*changeOp
+	index   *factorIndexChanges
+	rollups map[string]*rollupRow
+	stats   map[string]*tableStats
+}
+
+// A single change to a database. The value of a range delete is the end of
+// the range.
+type changeOp struct {
+	kind  int
+	key   []byte
+	value []byte
+}
+
+// A committed batch of changes and its position in a change log.
+type changeEntry struct {
+	seq  uint64
+	ops  []*changeOp
+	size int
+}
+
+// A changeLog is the ordered stream of the batches committed to a database.
+// The most recent batches are kept in memory for replicas to read. Each log
+// has a random epoch so that replicas can tell when the log they were
+// following was lost with a restart.
+type changeLog struct {
+	sync.Mutex
+	epoch   string
+	seq     uint64
+	entries []*changeEntry
+	size    int
+	notify  chan bool
+}
+
+// The options of a read replica.
+type ReplicationOptions struct {
+	// The "host:port" address of the server to replicate. Servers without
+	// one take writes and serve their change streams.
+	Primary string
+
+	// Queries fail once any of the replica's databases hasn't caught up
+	// with the primary for this long. Zero allows any staleness.
+	MaxStaleness time.Duration
+}
+
+// The replication state of a replica.
+type replicaState struct {
+	sync.Mutex
+	sources []*replicaSource
+	tables  time.Time
+	stop    chan bool
+	wait    sync.WaitGroup
+}
+
+// A database that a replica follows along with the position in the
+// primary's change log that it has applied up to. Servlet sources have a
+// servlet and the factors source doesn't.
+type replicaSource struct {
+	name    string
+	servlet *Servlet
+	epoch   string
+	seq     uint64
+	synced  time.Time
+}
+
+// The schema of a table as it's sent to replicas.
+type replicaTable struct {
+	Name       string      `json:"name"`
+	KeyFormat  string      `json:"keyFormat,omitempty"`
+	Id         uint32      `json:"id,omitempty"`
+	Properties []*Property `json:"properties"`
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates an empty write batch.
+func newWriteBatch() *writeBatch {
+	return &writeBatch{WriteBatch: levigo.NewWriteBatch()}
+}
+
+// Creates an empty change log with a new epoch.
+func newChangeLog() *changeLog {
+	return &changeLog{epoch: newChangeLogEpoch(), notify: make(chan bool)}
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Generates a random epoch for a change log.
+func newChangeLogEpoch() string {
+	b := make([]byte, 8)
+	rand.Read(b)
+	return hex.EncodeToString(b)
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Write Batch
+//--------------------------------------
+
+// Adds a key to the batch. The batch keeps the key and value slices.
+func (b *writeBatch) Put(key []byte, value []byte) {
+	b.WriteBatch.Put(key, value)
+	b.ops = append(b.ops, &changeOp{kind: changePut, key: key, value: value})
+}
+
+// Returns the size of the keys and values added to the batch since it held
+// a number of changes.
+func (b *writeBatch) sizeSince(n int) int {
+	size := 0
+	for _, op := range b.ops[n:] {
+		size += len(op.key) + len(op.value)
+	}
+	return size
+}
+
+// Removes a key in the batch.
+func (b *writeBatch) Delete(key []byte) {
+	b.WriteBatch.Delete(key)
+	b.ops = append(b.ops, &changeOp{kind: changeDelete, key: key})
+}
+
+// Removes every key in [start, end) in the batch.
+func (b *writeBatch) DeleteRange(start []byte, end []byte) {
+	batchDeleteRange(b.WriteBatch, start, end)
+	b.ops = append(b.ops, &changeOp{kind: changeDeleteRange, key: start, value: end})
+}
+
+// Adds a merge operand for a key in the batch.
+func (b *writeBatch) Merge(key []byte, value []byte) {
+	batchMerge(b.WriteBatch, key, value)
+	b.ops = append(b.ops, &changeOp{kind: changeMerge, key: key, value: value})
+}
+
+// Adds a change to the batch.
+func (b *writeBatch) apply(op *changeOp) {
+	switch op.kind {
+	case changePut:
+		b.Put(op.key, op.value)
+	case changeDelete:
+		b.Delete(op.key)
+	case changeDeleteRange:
+		b.DeleteRange(op.key, op.value)
+	case changeMerge:
+		b.Merge(op.key, op.value)
+	}
+}
+
+//--------------------------------------
+// Change Log
+//--------------------------------------
+
+// Commits a batch to a database and adds its changes to the log. Batches
+// are committed one at a time so that the log is in commit order.
+func (l *changeLog) write(db *levigo.DB, wo *levigo.WriteOptions, batch *writeBatch) error {
+	batch.putFactorIndexChanges()
+	batch.putRollupChanges()
+	batch.putTableStatsChanges()
+	l.Lock()
+	defer l.Unlock()
+	if err := db.Write(wo, batch.WriteBatch); err != nil {
+		return err
+	}
+	l.append(batch.ops)
+	return nil
+}
+
+// Removes every key in [start, end) from a database and adds the change to
+// the log.
+func (l *changeLog) deleteRange(db *levigo.DB, wo *levigo.WriteOptions, start []byte, end []byte) error {
+	l.Lock()
+	defer l.Unlock()
+	if err := deleteRange(db, wo, start, end); err != nil {
+		return err
+	}
+	l.append([]*changeOp{&changeOp{kind: changeDeleteRange, key: start, value: end}})
+	return nil
+}
+
+// Adds a table file written by a tableWriter to a database. Its keys don't
+// go through the log so the log starts over with a new epoch, which sends
+// replicas a full copy of the database.
+func (l *changeLog) ingest(db *levigo.DB, path string) error {
+	l.Lock()
+	defer l.Unlock()
+	if err := ingestTable(db, path); err != nil {
+		return err
+	}
+	l.epoch = newChangeLogEpoch()
+	l.entries, l.size = nil, 0
+	close(l.notify)
+	l.notify = make(chan bool)
+	return nil
+}
+
+// Adds a committed batch to the end of the log and wakes up waiting
+// readers. The log must be locked by the caller.
+func (l *changeLog) append(ops []*changeOp) {
+	if len(ops) == 0 {
+		return
+	}
+	entry := &changeEntry{seq: l.seq + 1, ops: ops}
+	for _, op := range ops {
+		entry.size += len(op.key) + len(op.value)
+	}
+	l.seq++
+	l.entries = append(l.entries, entry)
+	l.size += entry.size
+
+	// The oldest batches are dropped once the log is full.
+	n := 0
+	for len(l.entries)-n > 1 && (len(l.entries)-n > changeLogSize || l.size > changeLogByteLimit) {
+		l.size -= l.entries[n].size
+		n++
+	}
+	if n > 0 {
+		l.entries = append([]*changeEntry{}, l.entries[n:]...)
+	}
+	close(l.notify)
+	l.notify = make(chan bool)
+}
+
+// Retrieves the batches committed after a position in the log, waiting up
+// to a given time for one if there aren't any. Returns false if the log no
+// longer has every batch after the position.
+func (l *changeLog) since(seq uint64, wait time.Duration) ([]*changeEntry, bool) {
+	l.Lock()
+	if seq == l.seq && wait > 0 {
+		notify := l.notify
+		l.Unlock()
+		select {
+		case <-notify:
+		case <-time.After(wait):
+		}
+		l.Lock()
+	}
+	defer l.Unlock()
+
+	first := l.seq - uint64(len(l.entries))
+	if seq > l.seq || seq < first {
+		return nil, false
+	}
+	return append([]*changeEntry{}, l.entries[seq-first:]...), true
+}
+
+// Takes a snapshot of a database along with the position in the log that
+// it's at.
+func (l *changeLog) snapshot(db *levigo.DB) (*levigo.Snapshot, uint64) {
+	l.Lock()
+	defer l.Unlock()
+	return db.NewSnapshot(), l.seq
+}
+
+//--------------------------------------
+// Options
+//--------------------------------------
+
+// The primary that the server replicates and how stale it can be.
+func (s *Server) ReplicationOptions() ReplicationOptions {
+	return s.replication
+}
+
+// Sets the primary that the server replicates. This should be set before
+// the server is started.
+func (s *Server) SetReplicationOptions(options ReplicationOptions) {
+	s.replication = options
+}
+
+//--------------------------------------
+// Primary
+//--------------------------------------
+
+// Retrieves the database and change log of a replication source.
+func (s *Server) replicationSource(name string) (*levigo.DB, *changeLog, error) {
+	if name == factorsReplicationSource {
+		return s.factors.db, s.factors.changes, nil
+	}
+	index, err := strconv.Atoi(name)
+	if err != nil || index < 0 || index >= len(s.servlets) {
+		return nil, nil, fmt.Errorf("skyd.Server: Invalid replication source: %s", name)
+	}
+	servlet := s.servlets[index]
+	if servlet.partitionMonths > 0 {
+		return nil, nil, fmt.Errorf("skyd.Server: Partitioned servlets can't be replicated")
+	}
+	return servlet.db, servlet.changes, nil
+}
+
+// Writes the changes committed to a database after a position in its log
+// as records to a stream. Replicas following a different epoch or too far
+// behind are sent a full copy of the database instead, followed by the
+// position that the copy is at.
+func (s *Server) writeChanges(name string, epoch string, seq uint64, wait time.Duration, stream *queryStreamWriter) error {
+	db, changes, err := s.replicationSource(name)
+	if err != nil {
+		return err
+	}
+	var entries []*changeEntry
+	changes.Lock()
+	current := changes.epoch
+	changes.Unlock()
+	ok := epoch == current
+	if ok {
+		entries, ok = changes.since(seq, wait)
+	}
+	header := map[interface{}]interface{}{"epoch": current, "reset": !ok, "servlets": len(s.servlets)}
+	if err = stream.Write(header); err != nil {
+		return err
+	}
+	if ok {
+		for _, entry := range entries {
+			if err = stream.Write(encodeChangeEntry(entry.seq, entry.ops)); err != nil {
+				return err
+			}
+		}
+		return nil
+	}
+
+	// Copy every key as of a snapshot. Only the last record has a position
+	// so that a replica doesn't treat an interrupted copy as complete.
+	snapshot, seq := changes.snapshot(db)
+	defer db.ReleaseSnapshot(snapshot)
+	ro := levigo.NewReadOptions()
+	ro.SetSnapshot(snapshot)
+	ro.SetFillCache(false)
+	defer ro.Close()
+	iterator := db.NewIterator(ro)
+	defer iterator.Close()
+	ops := make([]*changeOp, 0, replicationDumpBatchSize)
+	for iterator.SeekToFirst(); iterator.Valid(); iterator.Next() {
+		ops = append(ops, &changeOp{kind: changePut, key: iterator.Key(), value: iterator.Value()})
+		if len(ops) == replicationDumpBatchSize {
+			if err = stream.Write(encodeChangeEntry(0, ops)); err != nil {
+				return err
+			}
+			ops = ops[:0]
+		}
+	}
+	if err = iterator.GetError(); err != nil {
+		return err
+	}
+	return stream.Write(encodeChangeEntry(seq, ops))
+}
+
+// Encodes the changes of a batch as a stream record.
+func encodeChangeEntry(seq uint64, ops []*changeOp) map[interface{}]interface{} {
+	list := make([]interface{}, 0, len(ops))
+	for _, op := range ops {
+		list = append(list, []interface{}{op.kind, op.key, op.value})
+	}
+	return map[interface{}]interface{}{"seq": seq, "ops": list}
+}
+
+// Decodes the changes of a stream record.
+func decodeChangeEntry(record map[interface{}]interface{}) (uint64, []*changeOp, error) {
+	seq, _ := normalize(record["seq"]).(int64)
+	list, _ := record["ops"].([]interface{})
+	ops := make([]*changeOp, 0, len(list))
+	for _, item := range list {
+		values, ok := item.([]interface{})
+		if !ok || len(values) != 3 {
+			return 0, nil, fmt.Errorf("skyd.Server: Invalid change: %v", item)
+		}
+		kind, _ := normalize(values[0]).(int64)
+		ops = append(ops, &changeOp{kind: int(kind), key: castBytes(values[1]), value: castBytes(values[2])})
+	}
+	return uint64(seq), ops, nil
+}
+
+// Converts a decoded msgpack raw to bytes.
+func castBytes(value interface{}) []byte {
+	switch v := value.(type) {
+	case []byte:
+		return v
+	case string:
+		return []byte(v)
+	}
+	return nil
+}
+
+// Retrieves the schemas of every table.
+func (s *Server) replicaTables() ([]*replicaTable, error) {
+	tables, err := s.GetAllTables()
+	if err != nil {
+		return nil, err
+	}
+	list := make([]*replicaTable, 0, len(tables))
+	for _, t := range tables {
+		table, err := s.OpenTable(t.Name)
+		if err != nil {
+			return nil, err
+		}
+		list = append(list, &replicaTable{Name: table.Name, KeyFormat: table.KeyFormat, Id: table.Id(), Properties: table.propertyFile.GetAllProperties()})
+	}
+	return list, nil
+}
+
+//--------------------------------------
+// Replica
+//--------------------------------------
+
+// Starts following the primary's tables, factors and servlets.
+func (s *Server) startReplication() {
+	if s.replication.Primary == "" {
+		return
+	}
+	state := &replicaState{stop: make(chan bool)}
+	state.sources = append(state.sources, &replicaSource{name: factorsReplicationSource})
+	for index, servlet := range s.servlets {
+		state.sources = append(state.sources, &replicaSource{name: strconv.Itoa(index), servlet: servlet})
+	}
+	s.replicas = state
+
+	state.wait.Add(len(state.sources) + 1)
+	go s.replicateTables(state)
+	for _, source := range state.sources {
+		go s.replicateSource(state, source)
+	}
+}
+
+// Stops following the primary and waits for changes being applied.
+func (s *Server) stopReplication() {
+	if s.replicas != nil {
+		close(s.replicas.stop)
+		s.replicas.wait.Wait()
+		s.replicas = nil
+	}
+}
+
+// Returns an error if any of the replica's databases haven't caught up
+// with the primary within the maximum staleness.
+func (s *Server) checkStaleness() error {
+	state := s.replicas
+	if state == nil || s.replication.MaxStaleness <= 0 {
+		return nil
+	}
+	state.Lock()
+	defer state.Unlock()
+	oldest := state.tables
+	for _, source := range state.sources {
+		if source.synced.Before(oldest) {
+			oldest = source.synced
+		}
+	}
+	if lag := time.Since(oldest); lag > s.replication.MaxStaleness {
+		return fmt.Errorf("skyd.Server: Replica is %v behind the primary", lag)
+	}
+	return nil
+}
+
+// Waits for a retry or for the replica to stop. Returns false once stopped.
+func (state *replicaState) sleep(d time.Duration) bool {
+	select {
+	case <-state.stop:
+		return false
+	case <-time.After(d):
+		return true
+	}
+}
+
+// Checks whether the replica has stopped.
+func (state *replicaState) stopped() bool {
+	select {
+	case <-state.stop:
+		return true
+	default:
+		return false
+	}
+}
+
+// Copies the primary's table schemas until the replica stops.
+func (s *Server) replicateTables(state *replicaState) {
+	defer state.wait.Done()
+	for !state.stopped() {
+		if err := s.pullTables(); err != nil {
+			s.logger.Printf("ERROR skyd.Server: Unable to replicate tables: %v", err)
+		} else {
+			state.Lock()
+			state.tables = time.Now()
+			state.Unlock()
+		}
+		if !state.sleep(replicationRetryDelay) {
+			return
+		}
+	}
+}
+
+// Creates, updates and removes tables to match the primary's.
+func (s *Server) pullTables() error {
+	resp, err := http.Get("http://" + s.replication.Primary + "/replication/tables")
+	if err != nil {
+		return err
+	}
+	defer resp.Body.Close()
+	if resp.StatusCode != http.StatusOK {
+		return fmt.Errorf("skyd.Server: Primary returned %v", resp.StatusCode)
+	}
+	tables := make([]*replicaTable, 0)
+	if err = json.NewDecoder(resp.Body).Decode(&tables); err != nil {
+		return err
+	}
+
+	names := make(map[string]bool)
+	for _, t := range tables {
+		names[t.Name] = true
+		if err = s.pullTable(t); err != nil {
+			return err
+		}
+	}
+
+	// The data of removed tables is removed by the servlet change streams.
+	local, err := s.GetAllTables()
+	if err != nil {
+		return err
+	}
+	for _, table := range local {
+		if !names[table.Name] {
+			delete(s.tables, table.Name)
+			table.Delete()
+		}
+	}
+	return nil
+}
+
+// Creates a table from the primary's schema or replaces its properties if
+// they've changed.
+func (s *Server) pullTable(t *replicaTable) error {
+	table := NewTable(t.Name, s.TablePath(t.Name))
+	if !table.Exists() {
+		if err := table.SetKeyFormat(t.KeyFormat, t.Id); err != nil {
+			return err
+		}
+		if err := table.Create(); err != nil {
+			return err
+		}
+	}
+
+	b, err := json.Marshal(t.Properties)
+	if err != nil {
+		return err
+	}
+	path := fmt.Sprintf("%v/%v", table.Path(), "properties")
+	if current, err := ioutil.ReadFile(path); err == nil && string(current) == string(b)+"\n" {
+		return nil
+	} else if err != nil && !os.IsNotExist(err) {
+		return err
+	}
+	if err = ioutil.WriteFile(path, append(b, '\n'), 0600); err != nil {
+		return err
+	}
+
+	// The table is reopened with its new properties on its next use.
+	delete(s.tables, t.Name)
+	return nil
+}
+
+// Applies a source's changes from the primary until the replica stops.
+func (s *Server) replicateSource(state *replicaState, source *replicaSource) {
+	defer state.wait.Done()
+	for !state.stopped() {
+		if err := s.pullChanges(state, source); err != nil {
+			s.logger.Printf("ERROR skyd.Server: Unable to replicate %s: %v", source.name, err)
+			if !state.sleep(replicationRetryDelay) {
+				return
+			}
+		}
+	}
+}
+
+// Requests the changes to a source after the position the replica has
+// applied and applies them.
+func (s *Server) pullChanges(state *replicaState, source *replicaSource) error {
+	url := fmt.Sprintf("http://%s/replication/%s?epoch=%s&after=%d&wait=%d", s.replication.Primary, source.name, source.epoch, source.seq, replicationWait/time.Millisecond)
+	resp, err := http.Get(url)
+	if err != nil {
+		return err
+	}
+	defer resp.Body.Close()
+	if resp.StatusCode != http.StatusOK {
+		return fmt.Errorf("skyd.Server: Primary returned %v", resp.StatusCode)
+	}
+
+	decoder := msgpack.NewDecoder(resp.Body, nil)
+	var header map[interface{}]interface{}
+	if err = decoder.Decode(&header); err != nil {
+		return err
+	}
+	if servlets, _ := normalize(header["servlets"]).(int64); int(servlets) != len(s.servlets) {
+		return fmt.Errorf("skyd.Server: Primary has %d servlets and replica has %d", servlets, len(s.servlets))
+	}
+	epoch, _ := header["epoch"].(string)
+	reset, _ := header["reset"].(bool)
+	if reset {
+		source.epoch, source.seq = "", 0
+		if err = s.clearReplicaSource(source); err != nil {
+			return err
+		}
+	}
+	applied := reset
+	defer func() {
+		if applied {
+			s.resetReplicaCaches(source, reset)
+		}
+	}()
+
+	for {
+		var record map[interface{}]interface{}
+		if err = decoder.Decode(&record); err == io.EOF {
+			break
+		} else if err != nil {
+			return err
+		}
+		seq, ops, err := decodeChangeEntry(record)
+		if err != nil {
+			return err
+		}
+		batch := newWriteBatch()
+		for _, op := range ops {
+			batch.apply(op)
+		}
+		err = s.writeReplicaSource(source, batch)
+		batch.Close()
+		if err != nil {
+			return err
+		}
+		applied = true
+		if seq > 0 {
+			source.epoch, source.seq = epoch, seq
+		}
+	}
+
+	if source.epoch == epoch {
+		state.Lock()
+		source.synced = time.Now()
+		state.Unlock()
+	}
+	return nil
+}
+
+// Commits a batch of replicated changes to a source's database. The changes
+// are added to the replica's own log so that it can be replicated too.
+func (s *Server) writeReplicaSource(source *replicaSource, batch *writeBatch) error {
+	wo := levigo.NewWriteOptions()
+	defer wo.Close()
+	if source.servlet == nil {
+		return s.factors.changes.write(s.factors.db, wo, batch)
+	}
+	source.servlet.Lock()
+	err := source.servlet.changes.write(source.servlet.db, wo, batch)
+	source.servlet.Unlock()
+	source.servlet.bumpVersion()
+	return err
+}
+
+// Removes every key from a source's database before a full copy.
+func (s *Server) clearReplicaSource(source *replicaSource) error {
+	db := s.factors.db
+	if source.servlet != nil {
+		db = source.servlet.db
+	}
+	ro := levigo.NewReadOptions()
+	ro.SetFillCache(false)
+	defer ro.Close()
+	iterator := db.NewIterator(ro)
+	defer iterator.Close()
+
+	batch := newWriteBatch()
+	defer func() { batch.Close() }()
+	for iterator.SeekToFirst(); iterator.Valid(); iterator.Next() {
+		batch.Delete(iterator.Key())
+		if len(batch.ops) == replicationDumpBatchSize {
+			if err := s.writeReplicaSource(source, batch); err != nil {
+				return err
+			}
+			batch.Close()
+			batch = newWriteBatch()
+		}
+	}
+	if err := iterator.GetError(); err != nil {
+		return err
+	}
+	return s.writeReplicaSource(source, batch)
+}
+
+// Drops what's cached from a source's database so that it's reloaded with
+// the replicated changes. Factors never change once they're created so
+// they're only dropped when the database is copied from a new primary.
+func (s *Server) resetReplicaCaches(source *replicaSource, reset bool) {
+	if source.servlet == nil {
+		if reset {
+			s.factors.clearCache()
+		}
+		return
+	}
+	source.servlet.zoneMutex.Lock()
+	source.servlet.zoneMaps = nil
+	source.servlet.zoneMutex.Unlock()
+	source.servlet.indexMutex.Lock()
+	source.servlet.indexes = nil
+	source.servlet.indexMutex.Unlock()
+}
+
+// Removes every cached factor.
+func (f *Factors) clearCache() {
+	for i := range f.shards {
+		f.shards[i].clear()
+	}
+	f.mutex.Lock()
+	f.dicts = make(map[string]*factorDictionary)
+	f.mutex.Unlock()
+}
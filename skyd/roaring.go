@@ -0,0 +1,329 @@
+package skyd
+
+import (
+	"encoding/binary"
+	"errors"
+	"sort"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The most values an array container holds before it's converted to a
+// bitset. Arrays are always smaller than a bitset when they're encoded so
+// the two can be told apart by their size.
+const roaringArrayMax = 4095
+
+// The number of words in a bitset container and its encoded size.
+const (
+	roaringBitsetWords = 1024
+	roaringBitsetSize  = roaringBitsetWords * 8
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A roaringBitmap is a compressed set of 32-bit integers. The integers are
+// grouped into containers by their upper 16 bits and each container holds
+// the lower 16 bits as a sorted array while there are few of them or as a
+// bitset once there are more.
+type roaringBitmap struct {
+	keys       []uint16
+	containers []*roaringContainer
+}
+
+// The lower 16 bits of the integers of a bitmap that share their upper 16
+// bits. Only one of the array and the bitset is set.
+type roaringContainer struct {
+	array []uint16
+	bits  []uint64
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates an empty bitmap.
+func newRoaringBitmap() *roaringBitmap {
+	return &roaringBitmap{}
+}
+
+// Creates an empty container.
+func newRoaringContainer() *roaringContainer {
+	return &roaringContainer{array: []uint16{}}
+}
+
+// Decodes a container from its little endian array or bitset.
+func decodeRoaringContainer(b []byte) (*roaringContainer, error) {
+	if len(b) == roaringBitsetSize {
+		c := &roaringContainer{bits: make([]uint64, roaringBitsetWords)}
+		for i := range c.bits {
+			c.bits[i] = binary.LittleEndian.Uint64(b[i*8:])
+		}
+		return c, nil
+	}
+	if len(b)%2 != 0 || len(b)/2 > roaringArrayMax {
+		return nil, errors.New("skyd.RoaringBitmap: Invalid container size")
+	}
+	c := &roaringContainer{array: make([]uint16, len(b)/2)}
+	for i := range c.array {
+		c.array[i] = binary.LittleEndian.Uint16(b[i*2:])
+	}
+	return c, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Containers
+//--------------------------------------
+
+// Encodes the container as a little endian array or bitset.
+func (c *roaringContainer) encode() []byte {
+	if c.bits != nil {
+		b := make([]byte, roaringBitsetSize)
+		for i, word := range c.bits {
+			binary.LittleEndian.PutUint64(b[i*8:], word)
+		}
+		return b
+	}
+	b := make([]byte, len(c.array)*2)
+	for i, v := range c.array {
+		binary.LittleEndian.PutUint16(b[i*2:], v)
+	}
+	return b
+}
+
+// Adds a value to the container. Returns false if it was already there.
+func (c *roaringContainer) add(v uint16) bool {
+	if c.bits != nil {
+		word, bit := v>>6, uint64(1)<<(v&63)
+		if c.bits[word]&bit != 0 {
+			return false
+		}
+		c.bits[word] |= bit
+		return true
+	}
+
+	i := sort.Search(len(c.array), func(i int) bool { return c.array[i] >= v })
+	if i < len(c.array) && c.array[i] == v {
+		return false
+	}
+	if len(c.array) == roaringArrayMax {
+		c.bits = make([]uint64, roaringBitsetWords)
+		for _, w := range c.array {
+			c.bits[w>>6] |= uint64(1) << (w & 63)
+		}
+		c.array = nil
+		return c.add(v)
+	}
+	c.array = append(c.array, 0)
+	copy(c.array[i+1:], c.array[i:])
+	c.array[i] = v
+	return true
+}
+
+// Checks if a value is in the container.
+func (c *roaringContainer) contains(v uint16) bool {
+	if c.bits != nil {
+		return c.bits[v>>6]&(uint64(1)<<(v&63)) != 0
+	}
+	i := sort.Search(len(c.array), func(i int) bool { return c.array[i] >= v })
+	return i < len(c.array) && c.array[i] == v
+}
+
+// The number of values in the container.
+func (c *roaringContainer) cardinality() int {
+	if c.bits == nil {
+		return len(c.array)
+	}
+	n := 0
+	for _, word := range c.bits {
+		for ; word != 0; word &= word - 1 {
+			n++
+		}
+	}
+	return n
+}
+
+// Calls a function with each value of the container in order.
+func (c *roaringContainer) each(fn func(uint16)) {
+	if c.bits == nil {
+		for _, v := range c.array {
+			fn(v)
+		}
+		return
+	}
+	for i, word := range c.bits {
+		for j := 0; word != 0; j, word = j+1, word>>1 {
+			if word&1 != 0 {
+				fn(uint16(i*64 + j))
+			}
+		}
+	}
+}
+
+// Returns the values in both containers.
+func (c *roaringContainer) and(other *roaringContainer) *roaringContainer {
+	if c.bits != nil && other.bits != nil {
+		result := &roaringContainer{bits: make([]uint64, roaringBitsetWords)}
+		for i := range result.bits {
+			result.bits[i] = c.bits[i] & other.bits[i]
+		}
+		return result
+	}
+	if c.bits != nil {
+		c, other = other, c
+	}
+	result := newRoaringContainer()
+	for _, v := range c.array {
+		if other.contains(v) {
+			result.array = append(result.array, v)
+		}
+	}
+	return result
+}
+
+// Returns the values in either container.
+func (c *roaringContainer) or(other *roaringContainer) *roaringContainer {
+	result := newRoaringContainer()
+	if c.bits == nil && other.bits == nil && len(c.array)+len(other.array) <= roaringArrayMax {
+		i, j := 0, 0
+		for i < len(c.array) || j < len(other.array) {
+			switch {
+			case j == len(other.array) || (i < len(c.array) && c.array[i] < other.array[j]):
+				result.array = append(result.array, c.array[i])
+				i++
+			case i == len(c.array) || other.array[j] < c.array[i]:
+				result.array = append(result.array, other.array[j])
+				j++
+			default:
+				result.array = append(result.array, c.array[i])
+				i, j = i+1, j+1
+			}
+		}
+		return result
+	}
+	result.bits, result.array = make([]uint64, roaringBitsetWords), nil
+	for _, src := range []*roaringContainer{c, other} {
+		if src.bits != nil {
+			for i, word := range src.bits {
+				result.bits[i] |= word
+			}
+		} else {
+			for _, v := range src.array {
+				result.bits[v>>6] |= uint64(1) << (v & 63)
+			}
+		}
+	}
+	return result
+}
+
+//--------------------------------------
+// Bitmaps
+//--------------------------------------
+
+// Returns the index of the container for the upper 16 bits of a value and
+// whether the bitmap has it.
+func (b *roaringBitmap) find(key uint16) (int, bool) {
+	i := sort.Search(len(b.keys), func(i int) bool { return b.keys[i] >= key })
+	return i, i < len(b.keys) && b.keys[i] == key
+}
+
+// Sets the container for the upper 16 bits of the values, replacing any
+// container already there.
+func (b *roaringBitmap) set(key uint16, c *roaringContainer) {
+	i, ok := b.find(key)
+	if ok {
+		b.containers[i] = c
+		return
+	}
+	b.keys = append(b.keys, 0)
+	copy(b.keys[i+1:], b.keys[i:])
+	b.keys[i] = key
+	b.containers = append(b.containers, nil)
+	copy(b.containers[i+1:], b.containers[i:])
+	b.containers[i] = c
+}
+
+// Adds a value to the bitmap.
+func (b *roaringBitmap) add(v uint32) {
+	i, ok := b.find(uint16(v >> 16))
+	if !ok {
+		b.set(uint16(v>>16), newRoaringContainer())
+	}
+	b.containers[i].add(uint16(v))
+}
+
+// Checks if a value is in the bitmap.
+func (b *roaringBitmap) contains(v uint32) bool {
+	i, ok := b.find(uint16(v >> 16))
+	return ok && b.containers[i].contains(uint16(v))
+}
+
+// The number of values in the bitmap.
+func (b *roaringBitmap) cardinality() int {
+	n := 0
+	for _, c := range b.containers {
+		n += c.cardinality()
+	}
+	return n
+}
+
+// Calls a function with each value of the bitmap in order.
+func (b *roaringBitmap) each(fn func(uint32)) {
+	for i, c := range b.containers {
+		high := uint32(b.keys[i]) << 16
+		c.each(func(v uint16) { fn(high | uint32(v)) })
+	}
+}
+
+// Returns the values in both bitmaps.
+func (b *roaringBitmap) and(other *roaringBitmap) *roaringBitmap {
+	result := newRoaringBitmap()
+	for i, key := range b.keys {
+		if j, ok := other.find(key); ok {
+			if c := b.containers[i].and(other.containers[j]); c.cardinality() > 0 {
+				result.keys = append(result.keys, key)
+				result.containers = append(result.containers, c)
+			}
+		}
+	}
+	return result
+}
+
+// Returns the values in either bitmap. Containers that are only in one of
+// the bitmaps are shared with it rather than copied.
+func (b *roaringBitmap) or(other *roaringBitmap) *roaringBitmap {
+	result := newRoaringBitmap()
+	i, j := 0, 0
+	for i < len(b.keys) || j < len(other.keys) {
+		switch {
+		case j == len(other.keys) || (i < len(b.keys) && b.keys[i] < other.keys[j]):
+			result.keys = append(result.keys, b.keys[i])
+			result.containers = append(result.containers, b.containers[i])
+			i++
+		case i == len(b.keys) || other.keys[j] < b.keys[i]:
+			result.keys = append(result.keys, other.keys[j])
+			result.containers = append(result.containers, other.containers[j])
+			j++
+		default:
+			result.keys = append(result.keys, b.keys[i])
+			result.containers = append(result.containers, b.containers[i].or(other.containers[j]))
+			i, j = i+1, j+1
+		}
+	}
+	return result
+}
@@ -7,19 +7,39 @@ import (
 	"fmt"
 	"github.com/gorilla/mux"
 	"github.com/jmhodges/levigo"
-	"hash/fnv"
+	"github.com/ugorji/go-msgpack"
 	"io"
 	"io/ioutil"
 	"log"
+	"math"
 	"net"
 	"net/http"
 	"net/http/pprof"
 	"os"
 	"regexp"
 	"runtime"
+	"strconv"
+	"sync"
+	"sync/atomic"
 	"time"
 )
 
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of idle, compiled execution engines kept for reuse by queries.
+const DefaultEnginePoolCapacity = 64
+
+// The number of queries whose per-servlet results are cached.
+const DefaultQueryCacheCapacity = 64
+
+// The share of the objects that the first round of an online query reads.
+// Each round after it doubles the share until every object has been read.
+const queryOnlineFirstSample = 1.0 / 64
+
 //------------------------------------------------------------------------------
 //
 // Typedefs
@@ -33,10 +53,56 @@ type Server struct {
 	logger          *log.Logger
 	path            string
 	listener        net.Listener
+	ingestPort      uint
+	ingestWindow    int
+	ingestMutex     sync.Mutex
+	ingestListener  net.Listener
+	ingestConns     map[net.Conn]bool
 	servlets        []*Servlet
+	placement       *servletPlacement
+	reshardMutex    sync.Mutex
+	checkpointMutex sync.Mutex
 	tables          map[string]*Table
+	tableIds        sync.Mutex
 	factors         *Factors
 	shutdownChannel chan bool
+	eventBlocks     bool
+	partitionMonths int
+	repairServlets  map[int]bool
+	compression     int
+	objectBuffer    ObjectBufferOptions
+	scanParallelism int
+	numaNodes       []*numaNode
+	enginePool      *ExecutionEnginePool
+	queryCache      *QueryCache
+	snapshots       *querySnapshotSet
+	cohorts         *queryCohortSet
+	rollups         *queryRollupSet
+	watches         *queryWatchSet
+	sharer          *querySharer
+	scheduler       *QueryScheduler
+	memory          *MemoryAccountant
+	cluster         ClusterOptions
+	replication     ReplicationOptions
+	replicas        *replicaState
+	warmup          WarmupOptions
+	warming         *warmupState
+	trace           TraceOptions
+	tracer          *traceWriter
+	slowQueries     SlowQueryLogOptions
+	slowQueryLog    *slowQueryLog
+	compactWindow   CompactionWindow
+	compactions     *compactionSet
+	servletStorage  StorageOptions
+	factorsStorage  StorageOptions
+	writeRates      WriteRateLimits
+	writeRatesMutex sync.Mutex
+	storage         *storage
+	routeMetrics    []*routeMetrics
+	queries         metricCounter
+	runningQueries  int64
+	queryLatency    [queryPhases]metricSummary
+	asyncWrites     sync.WaitGroup
 }
 
 //------------------------------------------------------------------------------
@@ -58,6 +124,23 @@ func (e *TextPlainContentTypeError) Error() string {
 	return ""
 }
 
+//--------------------------------------
+// Streamed Responses
+//--------------------------------------
+
+// Returned by handlers that have already written their own response. Err is
+// the error that ended the stream early, if any.
+type StreamedResponseError struct {
+	Err error
+}
+
+func (e *StreamedResponseError) Error() string {
+	if e.Err == nil {
+		return ""
+	}
+	return e.Err.Error()
+}
+
 //------------------------------------------------------------------------------
 //
 // Constructors
@@ -68,13 +151,33 @@ func (e *TextPlainContentTypeError) Error() string {
 func NewServer(port uint, path string) *Server {
 	r := mux.NewRouter()
 	s := &Server{
-		httpServer: &http.Server{Addr: fmt.Sprintf(":%d", port), Handler: r},
-		router:     r,
-		logger:     log.New(os.Stdout, "", log.LstdFlags),
-		path:       path,
-		tables:     make(map[string]*Table),
+		httpServer:     &http.Server{Addr: fmt.Sprintf(":%d", port), Handler: r},
+		router:         r,
+		logger:         log.New(os.Stdout, "", log.LstdFlags),
+		path:           path,
+		tables:         make(map[string]*Table),
+		enginePool:     NewExecutionEnginePool(DefaultEnginePoolCapacity),
+		queryCache:     NewQueryCache(DefaultQueryCacheCapacity),
+		snapshots:      newQuerySnapshotSet(),
+		cohorts:        newQueryCohortSet(),
+		rollups:        newQueryRollupSet(),
+		watches:        newQueryWatchSet(),
+		compactions:    newCompactionSet(),
+		sharer:         newQuerySharer(),
+		scheduler:      NewQueryScheduler(),
+		memory:         NewMemoryAccountant(),
+		servletStorage: DefaultServletStorageOptions(),
+		factorsStorage: DefaultFactorsStorageOptions(),
+		objectBuffer:   ObjectBufferOptions{Delay: DefaultObjectBufferDelay},
+		compression:    DefaultCompressionThreshold,
+		ingestWindow:   DefaultIngestWindow,
+		warmup:         WarmupOptions{Interval: DefaultWarmupInterval, Rate: DefaultWarmupRate},
 	}
 
+	s.enginePool.SetBytecodeCache(NewLuaBytecodeCache(s.BytecodePath(), DefaultLuaBytecodeCacheSize))
+	s.scheduler.SetMemoryAccountant(s.memory)
+	s.registerMemoryComponents()
+
 	s.router.HandleFunc("/debug/pprof", pprof.Index)
 	s.router.HandleFunc("/debug/pprof/cmdline", pprof.Cmdline)
 	s.router.HandleFunc("/debug/pprof/profile", pprof.Profile)
@@ -85,6 +188,7 @@ func NewServer(port uint, path string) *Server {
 	s.addPropertyHandlers()
 	s.addEventHandlers()
 	s.addQueryHandlers()
+	s.addReplicationHandlers()
 
 	return s
 }
@@ -120,6 +224,270 @@ func (s *Server) FactorsPath() string {
 	return fmt.Sprintf("%v/factors", s.path)
 }
 
+// The path to the file that stores how objects are placed on servlets.
+func (s *Server) PlacementPath() string {
+	return fmt.Sprintf("%v/placement", s.DataPath())
+}
+
+// The path to the directory of compiled query scripts.
+func (s *Server) BytecodePath() string {
+	return fmt.Sprintf("%v/bytecode", s.path)
+}
+
+// The path to the directory of the runs written by queries that spill.
+func (s *Server) SpillPath() string {
+	return fmt.Sprintf("%v/spill", s.path)
+}
+
+// The pool of compiled execution engines used by queries.
+func (s *Server) EnginePool() *ExecutionEnginePool {
+	return s.enginePool
+}
+
+// The LuaJIT and garbage collector options of query engines.
+func (s *Server) EngineOptions() EngineOptions {
+	return s.enginePool.Options()
+}
+
+// Sets the LuaJIT and garbage collector options of query engines. Idle
+// engines are recompiled with them.
+func (s *Server) SetEngineOptions(options EngineOptions) {
+	s.enginePool.SetOptions(options)
+}
+
+// The number of native threads that aggregations run on. Zero runs each
+// aggregation on the goroutine of its query.
+func (s *Server) QueryThreads() int {
+	count := 0
+	for _, threads := range s.enginePool.ThreadPools() {
+		count += threads.Threads()
+	}
+	return count
+}
+
+// Starts a number of native threads for aggregations to run on, pinned to
+// CPUs if requested, and stops the previous ones once their aggregations
+// finish. In NUMA mode the threads are split evenly between the nodes and
+// always pinned. Zero runs aggregations on the goroutines of their queries.
+func (s *Server) SetQueryThreads(count int, pinned bool) error {
+	pools := make([]*QueryThreadPool, 0)
+	if count > 0 && len(s.numaNodes) > 0 {
+		perNode := (count + len(s.numaNodes) - 1) / len(s.numaNodes)
+		for _, node := range s.numaNodes {
+			threads, err := newQueryThreadPoolOnNode(perNode, node)
+			if err != nil {
+				for _, threads := range pools {
+					threads.Close()
+				}
+				return err
+			}
+			pools = append(pools, threads)
+		}
+	} else if count > 0 {
+		threads, err := NewQueryThreadPool(count, pinned)
+		if err != nil {
+			return err
+		}
+		pools = append(pools, threads)
+	}
+
+	old := s.enginePool.ThreadPools()
+	s.enginePool.SetThreadPools(pools)
+	for _, threads := range old {
+		threads.Close()
+	}
+	return nil
+}
+
+// The number of NUMA nodes that servlets are placed on. Zero when NUMA
+// mode is off.
+func (s *Server) NUMANodes() int {
+	return len(s.numaNodes)
+}
+
+// Turns NUMA mode on or off. In NUMA mode servlets are assigned to the
+// machine's nodes in turn. Each node has its own share of the block cache
+// and of the compaction, flush and query threads, which are bound to the
+// node's CPUs and prefer its memory, so a servlet's cache, memtables and
+// Lua heaps stay local to the CPUs that scan it. Machines with a single
+// node are unaffected. This should be set before the server is opened and
+// before the query threads are set.
+func (s *Server) SetNUMAEnabled(enabled bool) {
+	s.numaNodes = nil
+	if enabled {
+		if nodes := readNUMANodes(numaNodePath); len(nodes) > 1 {
+			s.numaNodes = nodes
+		}
+	}
+}
+
+// The index of the NUMA node that the servlet at an index is placed on, or
+// -1 outside of NUMA mode.
+func (s *Server) servletNode(index int) int {
+	if len(s.numaNodes) == 0 {
+		return -1
+	}
+	return index % len(s.numaNodes)
+}
+
+// The cache of per-servlet query results.
+func (s *Server) QueryCache() *QueryCache {
+	return s.queryCache
+}
+
+// The limits on how many queries and sub-scans run at once and on the
+// memory and time that each query can use.
+func (s *Server) QuerySchedulerOptions() QuerySchedulerOptions {
+	return s.scheduler.Options()
+}
+
+// Sets the limits of the query scheduler.
+func (s *Server) SetQuerySchedulerOptions(options QuerySchedulerOptions) {
+	s.scheduler.SetOptions(options)
+}
+
+// The accountant that tracks the memory of the server's caches, buffers
+// and queries against its memory budget.
+func (s *Server) MemoryAccountant() *MemoryAccountant {
+	return s.memory
+}
+
+// The time that a query made up of selections waits for other queries that
+// can share its scan. Zero runs every query on its own.
+func (s *Server) SharedScanWindow() time.Duration {
+	return s.sharer.Window()
+}
+
+// Sets the time that queries wait for others to share their scan.
+func (s *Server) SetSharedScanWindow(window time.Duration) {
+	s.sharer.SetWindow(window)
+}
+
+// The number of key ranges each servlet is split into for queries. Zero
+// means the ranges are chosen so that there is one range per core.
+func (s *Server) ScanParallelism() int {
+	return s.scanParallelism
+}
+
+// Sets the number of key ranges each servlet is split into for queries.
+func (s *Server) SetScanParallelism(value int) {
+	s.scanParallelism = value
+}
+
+// Whether servlets write events in the columnar event block format.
+func (s *Server) EventBlocksEnabled() bool {
+	return s.eventBlocks
+}
+
+// Enables or disables the columnar event block format for writes. This
+// should be set before the server is started.
+func (s *Server) SetEventBlocksEnabled(value bool) {
+	s.eventBlocks = value
+}
+
+// The number of months covered by each time partition of a servlet. Zero
+// means servlets aren't partitioned.
+func (s *Server) PartitionMonths() int {
+	return s.partitionMonths
+}
+
+// Sets the number of months covered by each time partition of a servlet.
+// This should be set before the server is started. Queries that read
+// partitions can only select events by their time and transient
+// properties. Conditions, sessions, object bounds, time operands, permanent
+// properties, cohort materialization and state queries fail on them.
+func (s *Server) SetPartitionMonths(value int) {
+	s.partitionMonths = value
+}
+
+// The size that responses are compressed from, in bytes. Zero means
+// responses are never compressed.
+func (s *Server) CompressionThreshold() int {
+	return s.compression
+}
+
+// Sets the size that responses are compressed from when the client accepts
+// gzip or deflate. Streamed responses are compressed as they're flushed.
+// This should be set before the server is started.
+func (s *Server) SetCompressionThreshold(value int) {
+	s.compression = value
+}
+
+// The port that collectors write events to over the ingest protocol. Zero
+// means the protocol is disabled.
+func (s *Server) IngestPort() uint {
+	return s.ingestPort
+}
+
+// Sets the port that collectors write events to over persistent TCP
+// connections with the ingest protocol. This should be set before the
+// server is started.
+func (s *Server) SetIngestPort(port uint) {
+	s.ingestPort = port
+}
+
+// Sets the indexes of servlets whose databases are repaired before they're
+// opened, after their files were corrupted. Servlets are repaired while the
+// others open, and an interrupted repair resumes when the server is started
+// again. This should be set before the server is started.
+func (s *Server) SetRepairServlets(indexes []int) {
+	s.repairServlets = make(map[int]bool)
+	for _, index := range indexes {
+		s.repairServlets[index] = true
+	}
+}
+
+// The options of the buffer that each servlet keeps recently written
+// objects in.
+func (s *Server) ObjectBufferOptions() ObjectBufferOptions {
+	return s.objectBuffer
+}
+
+// Sets the options of the buffer that each servlet keeps recently written
+// objects in. This should be set before the server is started.
+func (s *Server) SetObjectBufferOptions(options ObjectBufferOptions) {
+	s.objectBuffer = options
+}
+
+// The options that servlet databases are opened with. The block cache is
+// shared by every servlet.
+func (s *Server) ServletStorageOptions() StorageOptions {
+	return s.servletStorage
+}
+
+// Sets the options that servlet databases are opened with. This should be
+// set before the server is started.
+func (s *Server) SetServletStorageOptions(options StorageOptions) {
+	s.servletStorage = options
+}
+
+// The options that the factors database is opened with.
+func (s *Server) FactorsStorageOptions() StorageOptions {
+	return s.factorsStorage
+}
+
+// Sets the options that the factors database is opened with. This should be
+// set before the server is started.
+func (s *Server) SetFactorsStorageOptions(options StorageOptions) {
+	s.factorsStorage = options
+}
+
+// The rates that the server's databases write files at.
+func (s *Server) WriteRateLimits() WriteRateLimits {
+	s.writeRatesMutex.Lock()
+	defer s.writeRatesMutex.Unlock()
+	return s.writeRates
+}
+
+// Sets the rates that the server's databases write files at. The limits
+// apply at once, including to the files that are being written.
+func (s *Server) SetWriteRateLimits(limits WriteRateLimits) {
+	s.writeRatesMutex.Lock()
+	defer s.writeRatesMutex.Unlock()
+	s.writeRates = limits
+	setWriteRateLimits(limits.Foreground, limits.Background)
+}
+
 //------------------------------------------------------------------------------
 //
 // Methods
@@ -149,14 +517,37 @@ func (s *Server) ListenAndServe(shutdownChannel chan bool) error {
 
 	s.logger.Printf("Sky v%s is now listening on http://localhost%s\n", Version, s.httpServer.Addr)
 
+	// Accept collector connections on the ingest port.
+	if s.ingestPort > 0 {
+		ingestListener, err := net.Listen("tcp", fmt.Sprintf(":%d", s.ingestPort))
+		if err != nil {
+			s.listener.Close()
+			s.listener = nil
+			s.close()
+			return err
+		}
+		s.ingestMutex.Lock()
+		s.ingestListener = ingestListener
+		s.ingestConns = make(map[net.Conn]bool)
+		s.ingestMutex.Unlock()
+		go s.serveIngest(ingestListener)
+		s.logger.Printf("Accepting events on port %d\n", s.ingestPort)
+	}
+
 	return nil
 }
 
 // Stops the server.
 func (s *Server) Shutdown() error {
+	// Stop ingesting events.
+	s.closeIngest()
+
 	// Close servlets.
 	s.close()
 
+	// Stop the aggregation threads.
+	s.SetQueryThreads(0, false)
+
 	// Close socket.
 	if s.listener != nil {
 		// Then stop the server.
@@ -192,46 +583,229 @@ func (s *Server) open() error {
 
 	// Open factors database.
 	s.factors = NewFactors(s.FactorsPath())
+	s.factors.SetStorageOptions(s.factorsStorage)
 	err = s.factors.Open()
 	if err != nil {
 		s.close()
 		return err
 	}
 
-	// Create servlets from child directories with numeric names.
+	// Count the servlets from child directories with numeric names, which
+	// are the servlets' indexes.
 	infos, err := ioutil.ReadDir(s.DataPath())
 	if err != nil {
 		return err
 	}
+	count := 0
 	for _, info := range infos {
-		match, _ := regexp.MatchString("^\\d$", info.Name())
+		match, _ := regexp.MatchString("^\\d+$", info.Name())
 		if info.IsDir() && match {
-			s.servlets = append(s.servlets, NewServlet(fmt.Sprintf("%s/%s", s.DataPath(), info.Name()), s.factors))
+			if index, _ := strconv.Atoi(info.Name()); index >= count {
+				count = index + 1
+			}
 		}
 	}
 
-	// If none exist then build them based on the number of logical CPUs available.
-	if len(s.servlets) == 0 {
-		cpuCount := runtime.NumCPU()
-		for i := 0; i < cpuCount; i++ {
-			s.servlets = append(s.servlets, NewServlet(fmt.Sprintf("%s/%v", s.DataPath(), i), s.factors))
+	// If none exist then build them based on the number of logical CPUs
+	// available and place objects on them with a ring.
+	s.placement, err = loadServletPlacement(s.PlacementPath(), count)
+	if err != nil {
+		s.close()
+		return err
+	}
+	if s.placement.ring == nil {
+		s.placement.ring = newServletRing(runtime.NumCPU())
+		if err = s.placement.save(); err != nil {
+			s.close()
+			return err
 		}
 	}
 
-	// Open servlets.
-	for _, servlet := range s.servlets {
-		err = servlet.Open()
-		if err != nil {
+	// Open servlets with a single shared block cache, split between the
+	// nodes in NUMA mode.
+	s.storage = newStorage(s.servletStorage)
+	s.storage.bindNodes(s.numaNodes)
+	s.storage.setEventBlocks(s.eventBlocks)
+	if err = s.loadRetentions(); err != nil {
+		s.close()
+		return err
+	}
+	if err = s.openServlets(s.placement.count()); err != nil {
+		s.close()
+		return err
+	}
+	if err = s.openTableStores(); err != nil {
+		s.close()
+		return err
+	}
+
+	// Finish a reshard that was interrupted.
+	if s.placement.next != nil {
+		if err = s.finishReshard(); err != nil {
 			s.close()
 			return err
 		}
 	}
 
+	// Read the blocks that were cached before the restart back in while
+	// the server starts serving.
+	s.startWarmup()
+
+	// Record a sample of the API calls once everything is open.
+	if err = s.startTrace(); err != nil {
+		s.close()
+		return err
+	}
+	if err = s.startSlowQueryLog(); err != nil {
+		s.close()
+		return err
+	}
+
+	// Replicas start following their primary once everything is open.
+	s.startReplication()
+
+	return nil
+}
+
+// Writes the memtables of every servlet's databases and of the factors
+// database to table files, flushing the servlets in parallel. A graceful
+// shutdown leaves empty logs behind so that the next open doesn't have to
+// replay them. Databases that fail to flush are replayed instead.
+func (s *Server) flushServlets() {
+	var wg sync.WaitGroup
+	for _, servlet := range s.servlets {
+		wg.Add(1)
+		go func(servlet *Servlet) {
+			defer wg.Done()
+			if err := servlet.flush(); err != nil {
+				s.logger.Printf("ERROR Unable to flush servlet %s: %v", servlet.path, err)
+			}
+		}(servlet)
+	}
+	wg.Wait()
+	if s.factors != nil && s.factors.db != nil {
+		if err := flushMemTable(s.factors.db); err != nil {
+			s.logger.Printf("ERROR Unable to flush factors: %v", err)
+		}
+	}
+}
+
+// Opens a number of servlets a few at a time and adds them to the server in
+// index order. Opening a servlet replays the write-ahead logs of its
+// databases, so after a crash the servlets are recovered in parallel and
+// startup takes about as long as the largest one. Servlets that opened are
+// added even if others fail so that they're closed with the server.
+func (s *Server) openServlets(count int) error {
+	servlets := make([]*Servlet, count)
+	errs := make([]error, count)
+	indexes := make(chan int, count)
+	for i := 0; i < count; i++ {
+		indexes <- i
+	}
+	close(indexes)
+
+	workers := runtime.NumCPU()
+	if workers > count {
+		workers = count
+	}
+	t0 := time.Now()
+	var opened int32
+	var wg sync.WaitGroup
+	for i := 0; i < workers; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for index := range indexes {
+				t := time.Now()
+				if servlets[index], errs[index] = s.newServlet(index); errs[index] == nil {
+					n := atomic.AddInt32(&opened, 1)
+					s.logger.Printf("Opened servlet %d (%d/%d) in %0.3fs", index, n, count, time.Since(t).Seconds())
+				}
+			}
+		}()
+	}
+	wg.Wait()
+
+	var err error
+	for index, servlet := range servlets {
+		if servlet != nil {
+			s.servlets = append(s.servlets, servlet)
+		} else if err == nil {
+			err = fmt.Errorf("skyd.Server: Unable to open servlet %d: %v", index, errs[index])
+		}
+	}
+	if err == nil && count > 0 {
+		s.logger.Printf("Opened %d servlets in %0.3fs", count, time.Since(t0).Seconds())
+	}
+	return err
+}
+
+// Opens the servlet at an index and adds it to the server.
+func (s *Server) openServlet(index int) error {
+	servlet, err := s.newServlet(index)
+	if err != nil {
+		return err
+	}
+	s.servlets = append(s.servlets, servlet)
 	return nil
 }
 
+// Creates and opens the servlet at an index.
+func (s *Server) newServlet(index int) (*Servlet, error) {
+	servlet := NewServlet(fmt.Sprintf("%s/%v", s.DataPath(), index), s.factors)
+	servlet.SetEventBlocksEnabled(s.eventBlocks)
+	servlet.SetPartitionMonths(s.partitionMonths)
+	servlet.SetObjectBufferOptions(s.objectBuffer)
+	servlet.setStorage(s.storage)
+	servlet.setNode(s.servletNode(index))
+	servlet.rollups = s.rollups
+	if s.repairServlets[index] {
+		t := time.Now()
+		if err := servlet.Repair(); err != nil {
+			return nil, err
+		}
+		s.logger.Printf("Repaired servlet %d in %0.3fs", index, time.Since(t).Seconds())
+	}
+	if err := servlet.Open(); err != nil {
+		servlet.Close()
+		return nil, err
+	}
+	return servlet, nil
+}
+
 // Closes the data directory and servlets.
 func (s *Server) close() {
+	// Stop applying changes from the primary before anything is closed.
+	s.stopReplication()
+
+	// Record the blocks in the cache for the next time the server opens.
+	s.stopWarmup()
+	s.stopTrace()
+	s.stopSlowQueryLog()
+
+	// Cancel manual compactions between ranges.
+	s.stopCompactions()
+
+	// Stop watched queries and release idle engines and registered
+	// snapshots.
+	s.watches.clear()
+	s.enginePool.Clear()
+	s.snapshots.clear()
+
+	// Finish the writes that were acknowledged before they were made and
+	// save the statistics they added to.
+	s.asyncWrites.Wait()
+	for _, table := range s.tables {
+		if stats := table.Statistics(); stats != nil {
+			if err := stats.Save(); err != nil {
+				s.logger.Printf("ERROR Unable to save statistics of %s: %v", table.Name, err)
+			}
+		}
+	}
+
+	// Flush the memtables so that the next open doesn't replay the logs.
+	s.flushServlets()
+
 	// Close servlets.
 	if s.servlets != nil {
 		for _, servlet := range s.servlets {
@@ -239,6 +813,10 @@ func (s *Server) close() {
 		}
 		s.servlets = nil
 	}
+	if s.storage != nil {
+		s.storage.Close()
+		s.storage = nil
+	}
 
 	// Close factors database.
 	if s.factors != nil {
@@ -267,6 +845,16 @@ func (s *Server) createIfNotExists() error {
 		return err
 	}
 
+	// Create the spill directory, without the runs of any queries that
+	// were running when the server last stopped.
+	if err = os.RemoveAll(s.SpillPath()); err != nil {
+		return err
+	}
+	err = os.MkdirAll(s.SpillPath(), 0700)
+	if err != nil {
+		return err
+	}
+
 	return nil
 }
 
@@ -284,17 +872,61 @@ func (s *Server) Silence() {
 //--------------------------------------
 
 // Parses incoming JSON objects and converts outgoing responses to JSON.
+// Requests with a msgpack Content-Type are parsed as msgpack and responses
+// to requests that accept msgpack are encoded as msgpack.
 func (s *Server) ApiHandleFunc(route string, handlerFunction func(http.ResponseWriter, *http.Request, map[string]interface{}) (interface{}, error)) *mux.Route {
+	return s.apiHandleFunc(route, true, handlerFunction)
+}
+
+// Parses incoming requests without reading the body so that the handler can
+// stream it. The params passed to the handler are always empty.
+func (s *Server) ApiStreamHandleFunc(route string, handlerFunction func(http.ResponseWriter, *http.Request, map[string]interface{}) (interface{}, error)) *mux.Route {
+	return s.apiHandleFunc(route, false, handlerFunction)
+}
+
+// Wraps a handler with request decoding, response encoding and logging.
+func (s *Server) apiHandleFunc(route string, decodeBody bool, handlerFunction func(http.ResponseWriter, *http.Request, map[string]interface{}) (interface{}, error)) *mux.Route {
+	metrics := newRouteMetrics(route)
+	s.routeMetrics = append(s.routeMetrics, metrics)
 	wrappedFunction := func(w http.ResponseWriter, req *http.Request) {
 		// warn("%s \"%s %s %s\"", req.RemoteAddr, req.Method, req.RequestURI, req.Proto)
 		t0 := time.Now()
+		status := http.StatusOK
+		trace := s.tracer.begin(route, req, t0)
+		defer func() {
+			metrics.Observe(req.Method, time.Since(t0))
+			trace.finish(status, time.Since(t0))
+		}()
+
+		// Compress large responses if the client accepts it.
+		if s.compression > 0 {
+			w.Header().Add("Vary", "Accept-Encoding")
+			if encoding := negotiateResponseEncoding(req.Header.Get("Accept-Encoding")); encoding != nil {
+				cw := newCompressedResponseWriter(w, encoding, s.compression)
+				defer cw.Close()
+				w = cw
+			}
+		}
 
 		var ret interface{}
-		params, err := s.decodeParams(w, req)
+		var err error
+		params := make(map[string]interface{})
+		if decodeBody {
+			params, err = s.decodeParams(w, req)
+		}
 		if err == nil {
 			ret, err = handlerFunction(w, req, params)
 		}
 
+		// Streamed responses have already been written.
+		if e, ok := err.(*StreamedResponseError); ok {
+			s.logger.Printf("%s \"%s %s %s\" %d %0.3f", req.RemoteAddr, req.Method, req.RequestURI, req.Proto, http.StatusOK, time.Since(t0).Seconds())
+			if e.Err != nil {
+				s.logger.Printf("ERROR %v", e.Err)
+			}
+			return
+		}
+
 		// If we're returning plain text then just dump out what's returned.
 		if _, ok := err.(*TextPlainContentTypeError); ok {
 			w.Header().Set("Content-Type", "text/plain")
@@ -311,11 +943,13 @@ func (s *Server) ApiHandleFunc(route string, handlerFunction func(http.ResponseW
 		}
 
 		// Write header status.
-		w.Header().Set("Content-Type", "application/json")
-		var status int
-		if err == nil {
-			status = http.StatusOK
+		msgpackResponse := isMsgpackMediaType(req.Header.Get("Accept"))
+		if msgpackResponse {
+			w.Header().Set("Content-Type", xMsgpackMediaType)
 		} else {
+			w.Header().Set("Content-Type", "application/json")
+		}
+		if err != nil {
 			status = http.StatusInternalServerError
 		}
 		w.WriteHeader(status)
@@ -328,8 +962,12 @@ func (s *Server) ApiHandleFunc(route string, handlerFunction func(http.ResponseW
 
 		// Encode the return value appropriately.
 		if ret != nil {
-			encoder := json.NewEncoder(w)
-			err := encoder.Encode(ConvertToStringKeys(ret))
+			var err error
+			if msgpackResponse {
+				err = encodeMsgpackResponse(w, ret)
+			} else {
+				err = json.NewEncoder(w).Encode(ConvertToStringKeys(ret))
+			}
 			if err != nil {
 				fmt.Printf("skyd.Server: Encoding error: %v\n", err.Error())
 				return
@@ -342,6 +980,19 @@ func (s *Server) ApiHandleFunc(route string, handlerFunction func(http.ResponseW
 
 // Decodes the body of the message into parameters.
 func (s *Server) decodeParams(w http.ResponseWriter, req *http.Request) (map[string]interface{}, error) {
+	if isMsgpackMediaType(req.Header.Get("Content-Type")) {
+		var raw interface{}
+		err := msgpack.NewDecoder(req.Body, nil).Decode(&raw)
+		if err == io.EOF {
+			return make(map[string]interface{}), nil
+		}
+		params, ok := ConvertToJSONTypes(raw).(map[string]interface{})
+		if err != nil || !ok {
+			return nil, errors.New("Malformed msgpack request.")
+		}
+		return params, nil
+	}
+
 	// Parses body parameters.
 	params := make(map[string]interface{})
 	decoder := json.NewDecoder(req.Body)
@@ -352,11 +1003,54 @@ func (s *Server) decodeParams(w http.ResponseWriter, req *http.Request) (map[str
 	return params, nil
 }
 
+// Writes a response value as msgpack. Query results are encoded as they
+// are, keeping their non-string keys and integers. Other values go through
+// JSON first so that structs are encoded with the same field names.
+func encodeMsgpackResponse(w io.Writer, ret interface{}) error {
+	if _, ok := ret.(map[interface{}]interface{}); !ok {
+		b, err := json.Marshal(ConvertToStringKeys(ret))
+		if err != nil {
+			return err
+		}
+		decoder := json.NewDecoder(bytes.NewReader(b))
+		decoder.UseNumber()
+		if err = decoder.Decode(&ret); err != nil {
+			return err
+		}
+		ret = convertJSONNumbers(ret)
+	}
+	return msgpack.NewEncoder(w).Encode(ret)
+}
+
+// Converts the numbers of a value decoded from JSON with UseNumber() into
+// integers where they have no fractional part and floats otherwise.
+func convertJSONNumbers(value interface{}) interface{} {
+	switch v := value.(type) {
+	case map[string]interface{}:
+		for k, item := range v {
+			v[k] = convertJSONNumbers(item)
+		}
+	case []interface{}:
+		for i, item := range v {
+			v[i] = convertJSONNumbers(item)
+		}
+	case json.Number:
+		if n, err := v.Int64(); err == nil {
+			return n
+		}
+		f, _ := v.Float64()
+		return f
+	}
+	return value
+}
+
 //--------------------------------------
 // Servlet Management
 //--------------------------------------
 
-// Executes a function through a single-threaded servlet context.
+// Retrieves the table and the servlet that an object is placed on. The
+// placement should be locked for reading by the caller until it's done with
+// the servlet.
 func (s *Server) GetObjectContext(tableName string, objectId string) (*Table, *Servlet, error) {
 	// Return an error if the table already exists.
 	table, err := s.OpenTable(tableName)
@@ -374,22 +1068,16 @@ func (s *Server) GetObjectContext(tableName string, objectId string) (*Table, *S
 	return table, servlet, nil
 }
 
-// Calculates a tablet index based on the object identifier even hash.
+// Calculates the index of the servlet that an object is placed on. The
+// placement should be locked for reading by the caller so that the object
+// isn't moved while it's used.
 func (s *Server) GetObjectServletIndex(t *Table, objectId string) (uint32, error) {
 	// Encode object identifier.
 	encodedObjectId, err := t.EncodeObjectId(objectId)
 	if err != nil {
 		return 0, err
 	}
-
-	// Calculate the even bits of the FNV1a hash.
-	h := fnv.New64a()
-	h.Reset()
-	h.Write(encodedObjectId)
-	hashcode := h.Sum64()
-	index := CondenseUint64Even(hashcode) % uint32(len(s.servlets))
-
-	return index, nil
+	return uint32(s.placement.owner(encodedObjectId)), nil
 }
 
 //--------------------------------------
@@ -420,6 +1108,38 @@ func (s *Server) GetAllTables() ([]*Table, error) {
 	return tables, nil
 }
 
+// Creates a table whose object keys are stored in a given format. Tables
+// with hashed keys are given the next unused table id.
+func (s *Server) CreateTable(name string, keyFormat string) (*Table, error) {
+	s.tableIds.Lock()
+	defer s.tableIds.Unlock()
+
+	table := NewTable(name, s.TablePath(name))
+	var id uint32
+	if keyFormat == HashedKeyFormat {
+		tables, err := s.GetAllTables()
+		if err != nil {
+			return nil, err
+		}
+		for _, t := range tables {
+			if err := t.loadMeta(); err != nil {
+				return nil, err
+			}
+			if t.Id() > id {
+				id = t.Id()
+			}
+		}
+		id++
+	}
+	if err := table.SetKeyFormat(keyFormat, id); err != nil {
+		return nil, err
+	}
+	if err := table.Create(); err != nil {
+		return nil, err
+	}
+	return table, nil
+}
+
 // Opens a table and returns a reference to it.
 func (s *Server) OpenTable(name string) (*Table, error) {
 	// If table already exists then use it.
@@ -435,6 +1155,10 @@ func (s *Server) OpenTable(name string) (*Table, error) {
 		table.Close()
 		return nil, err
 	}
+	if err := s.rollups.load(table); err != nil {
+		table.Close()
+		return nil, err
+	}
 	s.tables[name] = table
 
 	return table, nil
@@ -450,136 +1174,1453 @@ func (s *Server) DeleteTable(name string) error {
 	if !table.Exists() {
 		return fmt.Errorf("Table does not exist: %s", name)
 	}
+	if err := table.loadMeta(); err != nil {
+		return err
+	}
 
 	// Determine table prefix.
-	prefix, err := TablePrefix(table.Name)
+	prefix, err := table.Prefix()
 	if err != nil {
 		return err
 	}
 
-	// Delete data from each servlet.
+	// Delete data from each servlet and each of its partitions. Tables with
+	// stores of their own only have their stores dropped.
+	s.placement.RLock()
+	defer s.placement.RUnlock()
 	for _, servlet := range s.servlets {
-		servlet.Lock()
-		defer servlet.Unlock()
-
-		// Delete the data from disk.
-		ro := levigo.NewReadOptions()
-		defer ro.Close()
-		wo := levigo.NewWriteOptions()
-		defer wo.Close()
-		iterator := servlet.db.NewIterator(ro)
-		defer iterator.Close()
-
-		iterator.Seek(prefix)
-		for iterator = iterator; iterator.Valid(); iterator.Next() {
-			key := iterator.Key()
-			if bytes.HasPrefix(key, prefix) {
-				err := servlet.db.Delete(wo, key)
-				if err != nil {
-					return err
-				}
-			} else {
-				break
+		if table.hasStore() {
+			if err := servlet.dropTableStore(table); err != nil {
+				return err
 			}
+		} else if err := servlet.eachPartition(func(servlet *Servlet) error {
+			return servlet.deleteTable(prefix)
+		}); err != nil {
+			return err
 		}
 	}
 
-	// Remove the table from the lookup and remove it's schema.
-	delete(s.tables, name)
+	// Remove the table from the lookup and remove it's schema. Forks keep
+	// the retention of the prefix they share.
+	shared, err := s.tablesSharingPrefix(table)
+	if err != nil {
+		return err
+	}
+	if len(shared) == 0 {
+		s.storage.setRetention(prefix, 0)
+	}
+	delete(s.tables, name)
+	s.cohorts.drop(name)
+	s.rollups.drop(table)
 	return table.Delete()
 }
 
+// Sets the number of seconds that the events of a table are kept and saves
+// it. Compactions of every servlet start trimming older events right away.
+func (s *Server) SetTableRetention(table *Table, retention int) error {
+	shared, err := s.tablesSharingPrefix(table)
+	if err != nil {
+		return err
+	} else if len(shared) > 0 && retention != table.Retention {
+		return fmt.Errorf("skyd.Server: Retention of a table that shares its prefix with %s can't be changed", shared[0].Name)
+	}
+	if err := table.SetRetention(retention); err != nil {
+		return err
+	}
+	if err := table.SaveMeta(); err != nil {
+		return err
+	}
+	return s.applyRetention(table)
+}
+
+// Hands the retention of every table that has one to the servlets' storage
+// before the servlets are opened.
+func (s *Server) loadRetentions() error {
+	tables, err := s.GetAllTables()
+	if err != nil {
+		return err
+	}
+	for _, table := range tables {
+		if err := table.loadMeta(); err != nil {
+			return err
+		}
+		if table.Retention > 0 {
+			if err := s.applyRetention(table); err != nil {
+				return err
+			}
+		}
+	}
+	return nil
+}
+
+// Opens the stores that separate tables were written to on each servlet.
+func (s *Server) openTableStores() error {
+	tables, err := s.GetAllTables()
+	if err != nil {
+		return err
+	}
+	for _, table := range tables {
+		if err := table.loadMeta(); err != nil {
+			return err
+		}
+		for _, servlet := range s.servlets {
+			if err := servlet.openTableStore(table); err != nil {
+				return err
+			}
+		}
+	}
+	return nil
+}
+
+// Hands the retention of a table to the filter that compactions of the
+// servlets' databases pass objects through.
+func (s *Server) applyRetention(table *Table) error {
+	prefix, err := table.Prefix()
+	if err != nil {
+		return err
+	}
+	s.storage.setRetention(prefix, table.retention())
+	return nil
+}
+
+// Moves the objects of a table whose last event is before a given time
+// out of every servlet's database and into frozen files. A zero time
+// freezes every object. Returns the number of objects frozen.
+func (s *Server) FreezeTable(name string, before time.Time) (int, error) {
+	table, err := s.OpenTable(name)
+	if err != nil {
+		return 0, err
+	}
+
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+	count := 0
+	for _, servlet := range s.servlets {
+		err := servlet.eachPartition(func(servlet *Servlet) error {
+			n, err := servlet.Freeze(table, before)
+			count += n
+			return err
+		})
+		if err != nil {
+			return count, err
+		}
+	}
+	return count, nil
+}
+
+// Rebuilds the statistics of a table by reading every object in each
+// servlet, its partitions and its frozen files, and saves them. Writes made
+// while the table is analyzed may be left out.
+func (s *Server) AnalyzeTable(table *Table) error {
+	prefix, err := table.Prefix()
+	if err != nil {
+		return err
+	}
+	stats := NewTableStatistics("")
+
+	s.placement.RLock()
+	for _, servlet := range s.servlets {
+		if err = servlet.eachPartition(func(servlet *Servlet) error {
+			return servlet.analyzeTable(prefix, stats)
+		}); err != nil {
+			break
+		}
+	}
+	s.placement.RUnlock()
+	if err != nil {
+		return err
+	}
+
+	stats.analyzed = time.Now()
+	table.Statistics().replace(stats)
+	return table.Statistics().Save()
+}
+
+// Builds or removes the factor index of a property on every servlet and
+// each of its partitions and saves the property. Queries that select a
+// value of an indexed property seek to the objects that have had it rather
+// than scanning the whole table.
+func (s *Server) SetPropertyIndexed(table *Table, property *Property, indexed bool) error {
+	if indexed && property.DataType != FactorDataType {
+		return errors.New("skyd.Server: Only factor properties can be indexed")
+	} else if indexed && property.Family != "" {
+		return errors.New("skyd.Server: Properties in a family can't be indexed")
+	}
+	prefix, err := table.Prefix()
+	if err != nil {
+		return err
+	}
+
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+	for _, servlet := range s.servlets {
+		err := servlet.eachPartition(func(servlet *Servlet) error {
+			if indexed {
+				return servlet.indexFactor(prefix, property.Id)
+			}
+			return servlet.unindexFactor(prefix, property.Id)
+		})
+		if err != nil {
+			return err
+		}
+	}
+	if _, err := table.UpdateProperty(property.Id, func(p *Property) { p.Indexed = indexed }); err != nil {
+		return err
+	}
+	return table.SavePropertyFile()
+}
+
+// Drops every servlet's time partitions that end at or before a given time
+// and removes their databases from disk. Returns the number of partitions
+// dropped.
+func (s *Server) DropPartitions(before time.Time) int {
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+	count := 0
+	for _, servlet := range s.servlets {
+		count += servlet.DropPartitions(before)
+	}
+	return count
+}
+
+//--------------------------------------
+// Resharding
+//--------------------------------------
+
+// Adds servlets until there are a given number and moves the objects that
+// the new ring places on other servlets while reads, writes and queries
+// continue. Only the objects on the arcs of the ring that the new servlets
+// take over are moved. Frozen files stay with the servlet that froze them.
+func (s *Server) Reshard(count int) error {
+	s.reshardMutex.Lock()
+	defer s.reshardMutex.Unlock()
+
+	p := s.placement
+	p.Lock()
+	if count <= len(s.servlets) {
+		p.Unlock()
+		return fmt.Errorf("skyd.Server: Servlet count can only grow: %d", count)
+	}
+	for i := len(s.servlets); i < count; i++ {
+		if err := s.openServlet(i); err != nil {
+			p.Unlock()
+			return err
+		}
+	}
+	p.start(count)
+	err := p.save()
+	p.Unlock()
+	if err != nil {
+		return err
+	}
+	return s.finishReshard()
+}
+
+// Moves the objects of each servlet that the next ring places elsewhere a
+// batch at a time and then places every object by the next ring.
+func (s *Server) finishReshard() error {
+	p := s.placement
+	for index := range p.done {
+		for done := false; !done; {
+			var err error
+			if done, err = s.moveObjectBatch(index); err != nil {
+				return err
+			}
+		}
+	}
+
+	p.Lock()
+	defer p.Unlock()
+	p.finish()
+	return p.save()
+}
+
+// Moves the next batch of objects off a servlet. The batch ends at the
+// earliest key that's a batch of objects into any of the servlet's
+// databases so that each database moves at most a batch. Returns true once
+// the servlet's last object has been moved.
+func (s *Server) moveObjectBatch(index int) (bool, error) {
+	p := s.placement
+	p.Lock()
+	defer p.Unlock()
+	s.asyncWrites.Wait()
+
+	source := s.servlets[index]
+	partitions := source.acquirePartitions(time.Time{}, time.Time{})
+	partitions = append(partitions, source.acquireTableStores()...)
+	defer releasePartitions(partitions)
+
+	var start, end []byte
+	if p.cursors[index] != nil {
+		start = append(append([]byte{}, p.cursors[index]...), 0x01)
+	}
+	databases := []*Servlet{source}
+	for _, partition := range partitions {
+		databases = append(databases, partition.servlet)
+	}
+	for _, db := range databases {
+		if key := db.nthObjectKey(start, reshardBatchSize); key != nil && (end == nil || bytes.Compare(key, end) < 0) {
+			end = key
+		}
+	}
+
+	// The objects of a partition or a table store move to the matching
+	// partition or store of their new servlet.
+	for i, db := range databases {
+		var partition *servletPartition
+		if i > 0 {
+			partition = partitions[i-1]
+		}
+		dests := make(map[int]*Servlet)
+		acquired := make([]*servletPartition, 0)
+		var err error
+		target := func(key []byte) *Servlet {
+			owner := p.next.owner(objectKeyHash(key))
+			if owner == index {
+				return db
+			}
+			if dest := dests[owner]; dest != nil {
+				return dest
+			}
+			dest := s.servlets[owner]
+			if partition != nil {
+				var destPartition *servletPartition
+				if table := partition.servlet.storeTable; table != nil {
+					destPartition, err = dest.acquireTableStore(table)
+				} else {
+					destPartition, err = dest.acquirePartition(partition.start, true)
+				}
+				if destPartition != nil {
+					acquired = append(acquired, destPartition)
+					dest = destPartition.servlet
+				}
+			}
+			dests[owner] = dest
+			return dest
+		}
+		if e := db.moveObjects(start, end, target); e != nil && err == nil {
+			err = e
+		}
+		releasePartitions(acquired)
+		if err != nil {
+			return false, err
+		}
+	}
+
+	if end == nil {
+		p.done[index] = true
+	} else {
+		p.cursors[index] = end
+	}
+	return end == nil, nil
+}
+
 //--------------------------------------
 // Query
 //--------------------------------------
 
-// Runs a query against a table.
+// Runs a query against a table. The results for each servlet are cached so
+// that repeating a query only rescans the servlets written to since. Queries
+// made up of selections share a scan with the others that arrive within the
+// shared scan window, unless a rollup of the table can answer them.
 func (s *Server) RunQuery(table *Table, query *Query) (interface{}, error) {
-	var engine *ExecutionEngine
-	engines := make([]*ExecutionEngine, 0)
+	if result, ok, err := s.runRollupQuery(table, query); ok || err != nil {
+		return result, err
+	}
+	if window := s.sharer.Window(); window > 0 {
+		if key, ok := query.shareKey(); ok {
+			return s.runSharedQuery(table, query, key, window)
+		}
+	}
+	return s.runQuery(table, query, nil, nil)
+}
 
-	// Create a channel to receive aggregate responses.
-	rchannel := make(chan interface{}, len(s.servlets))
+// Runs a query in a batch that shares one scan. The first query of the
+// batch waits out the window and then runs every query of the batch as one
+// query, even if it's cancelled itself, since the others are waiting on it.
+func (s *Server) runSharedQuery(table *Table, query *Query, key string, window time.Duration) (interface{}, error) {
+	batch, index := s.sharer.join(key, query)
+	if index > 0 {
+		return batch.result(index, query)
+	}
+	queries := s.sharer.flush(key, batch, window)
+	if len(queries) == 1 {
+		result, err := s.runQuery(table, query, nil, nil)
+		batch.finish([]interface{}{result}, err)
+		return result, err
+	}
 
-	// Generate the query source code.
-	source, err := query.Codegen()
+	result, err := s.runQuery(table, newSharedQuery(queries), nil, nil)
 	if err != nil {
+		batch.finish(nil, err)
 		return nil, err
 	}
+	results := splitSharedQueryResults(queries, result)
+	batch.finish(results, nil)
+	return results[0], nil
+}
+
+// Runs a query against a table and profiles where its time went along with
+// the plan that it ran with. Every servlet is scanned, whether or not its
+// result is cached, unless a rollup answers the query.
+func (s *Server) RunQueryProfile(table *Table, query *Query) (interface{}, *QueryProfile, error) {
+	profile := &QueryProfile{}
+	t := time.Now()
+	if result, ok, err := s.runRollupQuery(table, query); ok || err != nil {
+		profile.Plan = &QueryPlan{AccessPath: QueryPlanRollup}
+		profile.TotalTime = time.Since(t)
+		return result, profile, err
+	}
+	query.profileSteps = true
+	result, err := s.runQuery(table, query, profile, nil)
+	return result, profile, err
+}
 
-	// Create an engine for merging results.
-	engine, err = NewExecutionEngine(table, source)
+// Runs a query and fills in its profile if one is given. Queries that
+// spill pass their result to the records function, if one is given, a
+// group at a time as they merge their runs and return no result. Queries
+// without a profile are still profiled for the slow query log if it's
+// enabled.
+func (s *Server) runQuery(table *Table, query *Query, profile *QueryProfile, records func(map[interface{}]interface{}) error) (interface{}, error) {
+	s.queryStarted()
+	defer s.queryFinished()
+	t := time.Now()
+	if profile == nil && s.slowQueryLogEnabled() {
+		profile = &QueryProfile{logOnly: true}
+	}
+	job, err := s.scheduler.Admit(table.Name, query.Priority())
+	if err != nil {
+		return nil, err
+	}
+	defer job.Finish()
+	s.queryLatency[queryPhaseQueue].Observe(time.Since(t))
+	if profile != nil {
+		profile.QueueTime = time.Since(t)
+	}
+	scanStart := time.Now()
+	var spill *querySpill
+	if query.Spill && (profile == nil || profile.logOnly) {
+		spill = newQuerySpill(s.SpillPath())
+		defer spill.close()
+	}
+	rchannel, engines, err := s.startQuery(table, query, job, spill, profile)
 	if err != nil {
 		return nil, err
 	}
-	defer engine.Destroy()
-	//fmt.Println(engine.FullAnnotatedSource())
+	canceler := newQueryCanceler(query, engines, t)
+	var mergeTime int64
+	pending, err := mergeQueryResults(query, rchannel, cap(rchannel), &mergeTime)
+	if cerr := canceler.close(); cerr != nil {
+		err = cerr
+	}
+	s.queryLatency[queryPhaseScan].Observe(time.Since(scanStart))
+
+	// Merge back any spilled runs, which are streamed a group at a time if
+	// the caller takes records, and then finalize and defactorize the final
+	// result.
+	result, ok := pending.(map[interface{}]interface{})
+	if !ok {
+		result = make(map[interface{}]interface{})
+	}
+	if err == nil && spill.spilled() {
+		if records != nil {
+			s.releaseEngines(engines)
+			if err = spill.add(query, result); err != nil {
+				return nil, err
+			}
+			return nil, spill.each(query, func(record map[interface{}]interface{}) error {
+				if err := query.Finalize(record); err != nil {
+					return err
+				}
+				if err := query.Defactorize(record); err != nil {
+					return err
+				}
+				return records(record)
+			})
+		}
+		err = spill.each(query, func(record map[interface{}]interface{}) error {
+			_, err := query.Merge(result, record)
+			return err
+		})
+	}
+	resultSize := queryResultSize(result)
+	finalizeStart := time.Now()
+	if err == nil {
+		err = query.Finalize(result)
+	}
+	defactorizeStart := time.Now()
+	if err == nil {
+		err = query.Defactorize(result)
+	}
 
-	// Initialize one execution engine for each servlet.
-	for _, servlet := range s.servlets {
-		// Create an engine for each servlet.
-		e, err := NewExecutionEngine(table, source)
+	// Return engines to the pool.
+	s.releaseEngines(engines)
+	if err == nil {
+		s.queryLatency[queryPhaseFinalize].Observe(time.Since(finalizeStart))
+		s.queryLatency[queryPhaseTotal].Observe(time.Since(t))
+	}
+
+	if profile != nil {
+		profile.MergeTime = time.Duration(mergeTime)
+		profile.FinalizeTime = defactorizeStart.Sub(finalizeStart)
+		profile.DefactorizeTime = time.Since(defactorizeStart)
+		profile.TotalTime = time.Since(t)
+		profile.ResultSize = resultSize
+		profile.sumSteps()
+		if err == nil {
+			s.logSlowQuery(table, query, profile)
+		}
+	}
+	return result, err
+}
+
+// Runs a query against a table and passes its final result to a function
+// one record at a time, as split by Query.Split. Queries that spill merge
+// their runs into records as they go instead of building the whole result
+// first.
+func (s *Server) RunQueryRecords(table *Table, query *Query, fn func(map[interface{}]interface{}) error) error {
+	var result interface{}
+	var err error
+	if !query.Spill {
+		result, err = s.RunQuery(table, query)
+	} else if rollup, ok, rerr := s.runRollupQuery(table, query); ok || rerr != nil {
+		result, err = rollup, rerr
+	} else {
+		result, err = s.runQuery(table, query, nil, fn)
+	}
+	if err != nil || result == nil {
+		return err
+	}
+	return query.Split(result.(map[interface{}]interface{}), fn)
+}
+
+// Runs a query against a table and passes the result of each servlet to a
+// function as soon as the servlet finishes instead of merging them. The
+// results are defactorized but not finalized so that they can still be
+// merged by the caller. Every servlet is waited on even if the function
+// returns an error.
+func (s *Server) RunQueryPartials(table *Table, query *Query, fn func(map[interface{}]interface{}) error) error {
+	s.queryStarted()
+	defer s.queryFinished()
+	t := time.Now()
+	job, err := s.scheduler.Admit(table.Name, query.Priority())
+	if err != nil {
+		return err
+	}
+	defer job.Finish()
+	rchannel, engines, err := s.startQuery(table, query, job, nil, nil)
+	if err != nil {
+		return err
+	}
+	defer s.releaseEngines(engines)
+	canceler := newQueryCanceler(query, engines, t)
+
+	for outstanding := cap(rchannel); outstanding > 0; outstanding-- {
+		ret := <-rchannel
+		if e, ok := ret.(error); ok {
+			if err == nil {
+				err = e
+			}
+			continue
+		}
+		result, ok := ret.(map[interface{}]interface{})
+		if !ok || err != nil {
+			continue
+		}
+		if err = query.Defactorize(result); err == nil {
+			err = fn(result)
+		}
+	}
+	if cerr := canceler.close(); cerr != nil {
+		err = cerr
+	}
+	return err
+}
+
+// Runs a query against a table in rounds that each read a bigger sample of
+// the objects and passes an estimate of the full result to a function after
+// every round along with the share of the objects read so far. Each round
+// only reads the slice of the hash space that the rounds before it haven't,
+// and its result is merged into theirs, so the objects are read once in all.
+// The estimates are scaled like those of a sampled query and carry the same
+// margins of error. The rounds stop once the largest margin of any field is
+// within a target share of its value, if one is given, after the last
+// round, or when the function returns an error. A query that samples itself
+// is read in rounds of its own sample.
+func (s *Server) RunQueryOnline(table *Table, query *Query, target float64, fn func(map[interface{}]interface{}, float64) error) error {
+	s.queryStarted()
+	defer s.queryFinished()
+	t := time.Now()
+	job, err := s.scheduler.Admit(table.Name, query.Priority())
+	if err != nil {
+		return err
+	}
+	defer job.Finish()
+
+	// The query is restricted to each round's slice while it runs.
+	base := 1.0
+	if query.sampled() {
+		base = query.Sample
+	}
+	defer func(sample float64) {
+		query.Sample, query.sampleFloor = sample, 0
+	}(query.Sample)
+
+	var total interface{}
+	for start, end := 0.0, queryOnlineFirstSample; start < 1; start, end = end, math.Min(end*2, 1) {
+		query.sampleFloor, query.Sample = start*base, end*base
+		if query.Sample >= 1 {
+			query.Sample = 0
+		}
+		rchannel, engines, err := s.startQuery(table, query, job, nil, nil)
+		if err != nil {
+			return err
+		}
+		canceler := newQueryCanceler(query, engines, t)
+		var mergeTime int64
+		result, err := mergeQueryResults(query, rchannel, cap(rchannel), &mergeTime)
+		if cerr := canceler.close(); cerr != nil {
+			err = cerr
+		}
+		s.releaseEngines(engines)
+		if err != nil {
+			return err
+		}
+		if total, err = query.Merge(total, result); err != nil {
+			return err
+		}
+
+		// Estimate from a copy so later rounds can still merge into the
+		// total.
+		estimate, ok := copyQueryResult(total).(map[interface{}]interface{})
+		if !ok {
+			estimate = make(map[interface{}]interface{})
+		}
+		if err = query.Finalize(estimate); err != nil {
+			return err
+		}
+		if err = query.Defactorize(estimate); err != nil {
+			return err
+		}
+		if err = fn(estimate, end*base); err != nil {
+			return err
+		}
+		if e, ok := queryResultError(estimate); ok && target > 0 && e <= target {
+			break
+		}
+	}
+	return nil
+}
+
+// Subscribes to a query of a table that's evaluated at every interval for
+// as long as it has subscribers. Evaluations only rescan the servlets
+// written to since the last one and are skipped if there were no writes.
+func (s *Server) WatchQuery(table *Table, query *Query, interval time.Duration) (*QueryWatchSubscription, error) {
+	return s.watches.subscribe(s, table, query, interval)
+}
+
+// Retrieves the write version of each servlet.
+func (s *Server) servletVersions() []uint64 {
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+	versions := make([]uint64, len(s.servlets))
+	for index, servlet := range s.servlets {
+		versions[index] = servlet.Version()
+	}
+	return versions
+}
+
+// Registers a snapshot of a table across every servlet and all of their
+// partitions. Queries given the snapshot's id read the table as it was when
+// the snapshot was taken. The snapshot is kept until it's deleted or the
+// time to live passes.
+func (s *Server) CreateQuerySnapshot(table *Table, ttl time.Duration) (*QuerySnapshot, error) {
+	if ttl <= 0 {
+		ttl = DefaultQuerySnapshotTTL
+	} else if ttl > MaxQuerySnapshotTTL {
+		return nil, fmt.Errorf("skyd.Server: Snapshot TTL is longer than %v: %v", MaxQuerySnapshotTTL, ttl)
+	}
+	prefix, err := table.Prefix()
+	if err != nil {
+		return nil, err
+	}
+
+	s.placement.RLock()
+	indexes := make([]int, len(s.servlets))
+	for i := range indexes {
+		indexes[i] = i
+	}
+	snapshot := newQuerySnapshot(s.servlets, indexes, table, prefix, time.Time{}, time.Time{})
+	s.placement.RUnlock()
+	if err := s.snapshots.add(snapshot, ttl); err != nil {
+		snapshot.release()
+		return nil, err
+	}
+	return snapshot, nil
+}
+
+// Unregisters a snapshot. Queries reading it keep it until they finish.
+// Returns false if there is no such snapshot.
+func (s *Server) DeleteQuerySnapshot(id string) bool {
+	return s.snapshots.remove(id)
+}
+
+// Retrieves the registered snapshot that a query reads, if any, with a
+// reference that must be released.
+func (s *Server) querySnapshot(table *Table, query *Query) (*QuerySnapshot, error) {
+	if query.SnapshotId() == "" {
+		return nil, nil
+	}
+	snapshot, err := s.snapshots.acquire(query.SnapshotId())
+	if err != nil {
+		return nil, err
+	}
+	if snapshot.Table().Name != table.Name {
+		snapshot.release()
+		return nil, fmt.Errorf("skyd.Server: Snapshot %s is not of table: %s", query.SnapshotId(), table.Name)
+	}
+	return snapshot, nil
+}
+
+// Runs a query that marks the objects that reach any of its selections and
+// saves them as a cohort of a table, replacing any cohort with the same
+// name. Queries that give the cohort's name only read its members.
+func (s *Server) MaterializeCohort(table *Table, name string, query *Query) (*QueryCohort, error) {
+	if err := validateQueryCohortName(name); err != nil {
+		return nil, err
+	}
+
+	// The members are kept by servlet so objects can't be moving between
+	// them.
+	s.placement.RLock()
+	count, resharding := len(s.servlets), s.placement.next != nil
+	s.placement.RUnlock()
+	if resharding {
+		return nil, errors.New("skyd.Server: Cohorts can't be materialized while resharding")
+	}
+
+	query.marks = newQueryCohortMarks()
+	if _, err := s.RunQuery(table, query); err != nil {
+		return nil, err
+	}
+	servlets, err := query.marks.members(count)
+	if err != nil {
+		return nil, err
+	}
+	cohort := newQueryCohort(table.Name, name, servlets)
+	if err := s.cohorts.put(table, cohort); err != nil {
+		return nil, err
+	}
+	return cohort, nil
+}
+
+// Groups the objects that a query lists into members by the servlet that
+// holds them so that each servlet only seeks to its own. Objects are placed
+// as of now, so a query of a registered snapshot, which may have been taken
+// before a reshard moved them, seeks to every object on every servlet. The
+// placement must be locked by the caller.
+func (s *Server) queryObjectMembers(table *Table, objectIds []string, count int, placed bool) ([]*queryCohortMembers, error) {
+	keys := make([][][]byte, count)
+	all := make([][]byte, 0, len(objectIds))
+	for _, objectId := range objectIds {
+		key, err := table.EncodeObjectId(objectId)
 		if err != nil {
 			return nil, err
 		}
+		if index := s.placement.owner(key); placed && index < count {
+			keys[index] = append(keys[index], key)
+		}
+		all = append(all, key)
+	}
 
-		// Initialize iterator.
-		ro := levigo.NewReadOptions()
-		iterator := servlet.db.NewIterator(ro)
-		err = e.SetIterator(iterator)
+	servlets := make([]*queryCohortMembers, count)
+	if !placed {
+		members, err := newQueryCohortMembers(all)
 		if err != nil {
 			return nil, err
 		}
+		for i := range servlets {
+			servlets[i] = members
+		}
+		return servlets, nil
+	}
+	for i := range servlets {
+		var err error
+		if servlets[i], err = newQueryCohortMembers(keys[i]); err != nil {
+			return nil, err
+		}
+	}
+	return servlets, nil
+}
 
-		engines = append(engines, e)
+// Retrieves a saved cohort of a table.
+func (s *Server) GetCohort(table *Table, name string) (*QueryCohort, error) {
+	return s.cohorts.get(table, name)
+}
+
+// Removes a saved cohort of a table. Returns false if there is no such
+// cohort.
+func (s *Server) DeleteCohort(table *Table, name string) (bool, error) {
+	return s.cohorts.remove(table, name)
+}
+
+// Creates a rollup of a table and builds its rows on every servlet,
+// replacing any rollup with the same name. Queries that the rollup can
+// answer read its rows instead of scanning.
+func (s *Server) CreateRollup(table *Table, name string, obj map[string]interface{}) (*QueryRollup, error) {
+	if err := validateQueryRollupName(name); err != nil {
+		return nil, err
+	}
+	r := NewQueryRollup(table, name)
+	if err := r.Deserialize(obj); err != nil {
+		return nil, err
+	}
+	if err := r.resolve(table); err != nil {
+		return nil, err
+	}
+
+	// Objects can't be moving between servlets while the rows are built.
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+	if s.placement.next != nil {
+		return nil, errors.New("skyd.Server: Rollups can't be created while resharding")
+	}
+	if err := r.save(table); err != nil {
+		return nil, err
+	}
+	if replaced := s.rollups.put(r); replaced != nil {
+		s.removeRollup(replaced)
+	}
+	for _, servlet := range s.servlets {
+		if err := servlet.eachPartition(func(servlet *Servlet) error {
+			return servlet.buildRollup(r)
+		}); err != nil {
+			return nil, err
+		}
+	}
+	return r, nil
+}
+
+// Retrieves a rollup of a table. Returns nil if there is no such rollup.
+func (s *Server) GetRollup(table *Table, name string) *QueryRollup {
+	return s.rollups.get(table, name)
+}
+
+// Removes a rollup of a table along with its rows. Returns false if there
+// is no such rollup.
+func (s *Server) DeleteRollup(table *Table, name string) (bool, error) {
+	r := s.rollups.get(table, name)
+	if r == nil {
+		return false, nil
+	}
+	s.rollups.remove(r)
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+	if err := s.removeRollup(r); err != nil {
+		return true, err
+	}
+	return true, r.unsave(table)
+}
+
+// Removes the rows of a rollup from every servlet. The placement should be
+// locked by the caller.
+func (s *Server) removeRollup(r *QueryRollup) error {
+	for _, servlet := range s.servlets {
+		if err := servlet.eachPartition(func(servlet *Servlet) error {
+			return servlet.removeRollup(r)
+		}); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// Answers a query from the rows of a rollup if one matches it. Returns
+// false if the query has to be scanned instead, such as when a servlet
+// doesn't hold the rollup's rows or objects are being resharded.
+func (s *Server) runRollupQuery(table *Table, query *Query) (interface{}, bool, error) {
+	r := s.rollups.match(table, query)
+	if r == nil {
+		return nil, false, nil
+	}
+	if err := s.checkStaleness(); err != nil {
+		return nil, false, err
+	}
+
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+	if s.placement.next != nil {
+		return nil, false, nil
+	}
+	result := make(map[interface{}]interface{})
+	fn := r.aggregator(query, result)
+	start, end := r.bucketRange(query)
+	for _, servlet := range s.servlets {
+		err := servlet.eachPartition(func(servlet *Servlet) error {
+			if built, err := servlet.readRollup(r, start, end, fn); err != nil {
+				return err
+			} else if !built {
+				return errQueryRollupNotBuilt
+			}
+			return nil
+		})
+		if err == errQueryRollupNotBuilt {
+			return nil, false, nil
+		} else if err != nil {
+			return nil, false, err
+		}
+	}
+
+	if err := query.Finalize(result); err != nil {
+		return nil, false, err
+	}
+	if err := query.Defactorize(result); err != nil {
+		return nil, false, err
+	}
+	return result, true, nil
+}
+
+// Returns the number of events, objects and approximate bytes of a table
+// from the counts that each database keeps. Databases count a table the
+// first time its stats are read. The events are counted with a query
+// instead while objects are being resharded or if a database can't count
+// the table.
+func (s *Server) TableStats(table *Table) (interface{}, error) {
+	prefix, err := table.Prefix()
+	if err != nil {
+		return nil, err
+	}
+
+	s.placement.RLock()
+	stats, size, counted := &tableStats{}, uint64(0), s.placement.next == nil
+	for _, servlet := range s.servlets {
+		if !counted || err != nil {
+			break
+		}
+		err = servlet.eachPartition(func(servlet *Servlet) error {
+			st, err := servlet.tableStats(prefix)
+			if err != nil {
+				return err
+			}
+			stats.objects += st.objects
+			stats.events += st.events
+			size += servlet.tableSize(prefix)
+			return nil
+		})
+	}
+	s.placement.RUnlock()
+	if err == errTableStatsFrozen {
+		counted, err = false, nil
+	}
+	if err != nil {
+		return nil, err
+	}
+
+	if !counted {
+		query := NewQuery(table, s.factors)
+		selection := NewQuerySelection(query)
+		selection.Fields = append(selection.Fields, NewQuerySelectionField("count", "count()"))
+		query.Steps = append(query.Steps, selection)
+		return s.RunQuery(table, query)
+	}
+	return map[string]interface{}{"count": stats.events, "objects": stats.objects, "bytes": size}, nil
+}
+
+// Starts the scan of every servlet for a query. Each engine's sub-scan is
+// run by the scheduler as part of the query's job. The result of each
+// servlet, or its error, is sent on the returned channel once it is merged.
+// The engines must be released once every servlet has been received. A
+// profile, if given, is filled in by the time every servlet has been
+// received. Aggregations that outgrow their spill budget write their
+// partial results to the spill, if one is given, and carry on.
+func (s *Server) startQuery(table *Table, query *Query, job *QueryJob, spill *querySpill, profile *QueryProfile) (chan interface{}, []*ExecutionEngine, error) {
+	engines := make([]*ExecutionEngine, 0)
+
+	// Replicas that have fallen too far behind their primary don't answer.
+	if err := s.checkStaleness(); err != nil {
+		return nil, nil, err
+	}
+
+	// Generate the query source code.
+	t := time.Now()
+	source, err := query.Codegen()
+	if err != nil {
+		return nil, nil, err
+	}
+	cacheKey, err := queryCacheKey(table, query)
+	if err != nil {
+		return nil, nil, err
+	}
+
+	// Queries of a cohort read the version of it that's saved now.
+	var cohort *QueryCohort
+	if query.Cohort != "" {
+		if cohort, err = s.cohorts.get(table, query.Cohort); err != nil {
+			return nil, nil, err
+		}
+		cacheKey = fmt.Sprintf("%s:%d", cacheKey, cohort.version)
+	}
+
+	prefix, err := table.Prefix()
+	if err != nil {
+		return nil, nil, err
+	}
+	filter, err := query.CodegenFilter()
+	if err != nil {
+		return nil, nil, err
+	}
+	plan := s.planQuery(table, query, filter)
+	if profile != nil {
+		profile.Source = source
+		profile.Plan = plan
+		profile.CodegenTime = time.Since(t)
+		t = time.Now()
+	}
+	factors := make(map[int64]bool)
+	for _, property := range table.propertyFile.GetAllProperties() {
+		if property.DataType == FactorDataType {
+			factors[property.Id] = true
+		}
+	}
+
+	// Queries read a registered snapshot if one is given. Otherwise the
+	// servlets that aren't cached are snapshotted together up front so
+	// that every servlet is read as of the same moment.
+	snapshot, err := s.querySnapshot(table, query)
+	if err != nil {
+		return nil, nil, err
+	}
+
+	// Use the cached result for each servlet that hasn't changed. Objects
+	// aren't moved by a reshard while the servlets are snapshotted, and a
+	// registered snapshot only covers the servlets there were when it was
+	// taken. Queries that mark objects always scan since the cached results
+	// don't have the marks. Queries that list their objects skip the
+	// servlets that hold none of them, so a lookup of a single object only
+	// snapshots and scans the servlet that holds it.
+	s.placement.RLock()
+	servlets := s.servlets
+	cohortServlets := len(s.servlets)
+	if s.placement.next != nil {
+		cohortServlets = 0
 	}
+	if snapshot != nil {
+		servlets = servlets[:len(snapshot.servlets)]
+	}
+	var objects []*queryCohortMembers
+	if len(query.Objects) > 0 {
+		if objects, err = s.queryObjectMembers(table, query.Objects, len(servlets), snapshot == nil); err != nil {
+			s.placement.RUnlock()
+			return nil, nil, err
+		}
+	}
+	cached := make(map[int]map[interface{}]interface{})
+	versions := make(map[int]uint64)
+	scans := make(map[int][]*ExecutionEngine)
+	profiles := make(map[int]*ServletProfile)
+	indexes := make([]int, 0)
+	for index, servlet := range servlets {
+		if objects != nil && objects[index].count() == 0 {
+			continue
+		}
+		if snapshot != nil {
+			versions[index] = snapshot.servlets[index].version
+		} else {
+			versions[index] = servlet.Version()
+		}
+		if profile == nil || profile.logOnly {
+			if result := s.queryCache.Get(cacheKey, index, versions[index]); result != nil && !query.marking() {
+				cached[index] = result
+				continue
+			}
+		}
+		if profile != nil {
+			profiles[index] = &ServletProfile{Index: index}
+			profile.Servlets = append(profile.Servlets, profiles[index])
+		}
+		indexes = append(indexes, index)
+	}
+	if snapshot == nil {
+		snapshot = newQuerySnapshot(servlets, indexes, table, prefix, query.TimeRangeStart, query.TimeRangeEnd)
+	}
+	s.placement.RUnlock()
+	defer snapshot.release()
+
+	// Initialize engines for the others. A servlet's own database and each
+	// of its time partitions that overlaps the query are scanned together.
+	// Each is split into key ranges in proportion to how much of the table
+	// it holds.
+	views := make(map[int][]*querySnapshotView, len(indexes))
+	for _, index := range indexes {
+		views[index] = snapshot.views(index, query.TimeRangeStart, query.TimeRangeEnd)
+	}
+	ranges := plan.viewRanges(views, prefix)
+
+	// Each time partition keeps its own head, chunks and state for an
+	// object and is scanned as a separate object, so queries whose results
+	// don't add up across the parts are rejected rather than answered
+	// wrongly.
+	if !query.partitionable() {
+		for _, index := range indexes {
+			for _, view := range views[index] {
+				if view.timePartition() {
+					return nil, nil, errors.New("skyd.Server: Only selections of events by their time and transient properties can read partitioned servlets")
+				}
+			}
+		}
+	}
+	for _, index := range indexes {
+		var members *queryCohortMembers
+		if cohort != nil {
+			if members, err = cohort.members(index, cohortServlets); err != nil {
+				s.releaseEngines(engines)
+				return nil, nil, err
+			}
+		} else if objects != nil {
+			members = objects[index]
+		}
+		servletEngines := make([]*ExecutionEngine, 0)
+		for _, view := range views[index] {
+			var viewEngines []*ExecutionEngine
+			viewEngines, err = s.servletEngines(view, table, source, query, plan, ranges[view], prefix, filter, factors, members, profiles[index])
+			servletEngines = append(servletEngines, viewEngines...)
+			if err != nil {
+				break
+			}
+		}
+		engines = append(engines, servletEngines...)
+		scans[index] = servletEngines
+		if err != nil {
+			s.releaseEngines(engines)
+			return nil, nil, err
+		}
+	}
+	if limit := job.MemoryLimit(len(engines)); limit > 0 {
+		for _, e := range engines {
+			e.SetMemoryLimit(limit)
+		}
+	}
+	if spill != nil {
+		for _, e := range engines {
+			e.SetSpill(true)
+		}
+	}
+	if profile != nil {
+		profile.SetupTime = time.Since(t)
+	}
+	rchannel := make(chan interface{}, len(cached)+len(scans))
 
 	// Execute servlets asynchronously and retrieve responses outside
-	// of the server context.
-	for index, _ := range s.servlets {
-		e := engines[index]
+	// of the server context. The merged result of each servlet is cached
+	// under the version it had before the scan started, unless part of it
+	// was spilled.
+	for _, result := range cached {
+		rchannel <- result
+	}
+	for index := range scans {
+		index, servletEngines, sp := index, scans[index], profiles[index]
 		go func() {
-			if result, err := e.Aggregate(); err != nil {
+			t := time.Now()
+			channel := make(chan interface{}, len(servletEngines))
+			engineProfiles := make([]ServletProfile, len(servletEngines))
+			var spilled int32
+			for i, e := range servletEngines {
+				e, ep := e, &engineProfiles[i]
+				job.Submit(index, func(err error) {
+					var result interface{}
+					aggregate := e.Aggregate
+					if sp != nil {
+						aggregate = func() (interface{}, error) { return e.ProfileAggregate(ep) }
+					}
+					if err == nil {
+						result, err = aggregate()
+						for err == nil && spill != nil && e.Spilled() {
+							atomic.StoreInt32(&spilled, 1)
+							if err = spill.add(query, result); err == nil {
+								result, err = aggregate()
+							}
+						}
+						if err == nil && query.marking() {
+							query.marks.add(index, e.Marks())
+						}
+						table.hot.addScan(index, e.HeavyObjects())
+					}
+					if err != nil {
+						channel <- err
+					} else {
+						channel <- result
+					}
+				})
+			}
+			var mergeTime int64
+			result, err := mergeQueryResults(query, channel, len(servletEngines), &mergeTime)
+			if sp != nil {
+				sp.addEngines(engineProfiles)
+				sp.MergeTime = time.Duration(mergeTime)
+				sp.TotalTime = time.Since(t)
+			}
+			if err != nil {
 				rchannel <- err
-			} else {
-				rchannel <- result
+				return
 			}
+			if m, ok := result.(map[interface{}]interface{}); ok && !query.marking() && atomic.LoadInt32(&spilled) == 0 {
+				s.queryCache.Put(cacheKey, index, versions[index], m)
+			}
+			rchannel <- result
 		}()
 	}
+	return rchannel, engines, nil
+}
+
+// Creates the engines that scan a table in the snapshot of a single
+// servlet database and its frozen files the way that a plan chose, split
+// into up to a number of key ranges. Each engine scanning a partition
+// holds a reference to it until its iterator is closed. The engines created
+// before an error are returned along with it. If a profile is given, the
+// engines count their block reads and the time spent seeking their
+// iterators is added to it. Engines only read the members of a cohort, if
+// one is given.
+func (s *Server) servletEngines(view *querySnapshotView, table *Table, source string, query *Query, plan *QueryPlan, ranges int, prefix []byte, filter []byte, factors map[int64]bool, members *queryCohortMembers, profile *ServletProfile) ([]*ExecutionEngine, error) {
+	engines := make([]*ExecutionEngine, 0)
+	servlet, partition := view.servlet, view.partition
+
+	// Split the key range so that the scan can use every core even when
+	// there are fewer servlets than cores, unless there's too little to
+	// read for it to pay off.
+	boundaries, err := servlet.SplitKeyRange(prefix, ranges)
+	if err != nil {
+		return engines, err
+	}
+
+	// Queries with a time range or a cursor filter seek past the zones
+	// that can't match them.
+	var skipRanges []keyRange
+	if plan.usesZones() && (filter != nil || !query.TimeRangeStart.IsZero() || !query.TimeRangeEnd.IsZero()) {
+		servlet.Lock()
+		m, err := servlet.zoneMap(prefix)
+		servlet.Unlock()
+		if err != nil {
+			return engines, err
+		}
+		start, end := shiftTimeRange(query.TimeRangeStart, query.TimeRangeEnd)
+		skipRanges = m.skipRanges(start, end, filter, factors)
+	}
+
+	// Filters that select values of indexed factors seek straight to the
+	// objects that have them.
+	if plan.usesIndex() && filter != nil {
+		ranges, err := servlet.factorIndexSkipRanges(prefix, filter, skipRanges)
+		if err != nil {
+			return engines, err
+		}
+		if ranges != nil {
+			skipRanges = ranges
+		}
+	}
+
+	// Queries of a cohort seek straight to its members when there are few
+	// enough. Otherwise the scan checks each object's key.
+	if members != nil {
+		if ranges := members.skipRanges(prefix, skipRanges); ranges != nil {
+			skipRanges = ranges
+		}
+	}
+
+	// The iterators read a snapshot taken together with the frozen
+	// files so that objects being frozen are scanned exactly once.
+	frozen := view.retainFrozen()
+
+	var startKey []byte
+	for i := 0; i <= len(boundaries); i++ {
+		var endKey []byte
+		if i < len(boundaries) {
+			endKey = boundaries[i]
+		}
+
+		// Retrieve a compiled engine for each range.
+		e, err := s.enginePool.GetOnNode(table, source, servlet.Node())
+		if err != nil {
+			releaseFrozenFiles(frozen)
+			return engines, err
+		}
+		engines = append(engines, e)
+		e.SetKeyRange(startKey, endKey)
+		e.SetTimeRange(query.TimeRangeStart, query.TimeRangeEnd)
+		e.SetSampleRange(query.sampleFloor, query.Sample)
+		e.SetObjectBounds(query.MinEvents, time.Duration(query.MinSpan)*time.Second)
+		e.SetStateOnly(query.State)
+		e.SetSkipRanges(skipRanges)
+		if err := e.SetMembers(members); err != nil {
+			releaseFrozenFiles(frozen)
+			return engines, err
+		}
+		if err := e.SetPipelineDepth(s.servletStorage.ScanPipelineDepth); err != nil {
+			releaseFrozenFiles(frozen)
+			return engines, err
+		}
+
+		// Initialize iterator. Query scans don't fill the block cache
+		// so they can't evict the blocks that writes read objects from,
+		// and they read ahead since they move through whole tables. The
+		// next blocks are read in the background while the engine
+		// aggregates the current one. The engine reads values in
+		// place, so the blocks of an object stay pinned until the
+		// cursor moves on to the next one. The iterator stops at the
+		// end of the range rather than reading past it.
+		ro := levigo.NewReadOptions()
+		ro.SetFillCache(false)
+		setSequentialScan(ro)
+		setPrefetchBlocks(ro, s.servletStorage.PrefetchBlocks)
+		setPrefixSameAsStart(ro)
+		upperBound := endKey
+		if upperBound == nil {
+			upperBound = incrementKey(prefix)
+		}
+		if upperBound != nil {
+			setIterateUpperBound(ro, upperBound)
+		}
+		setPinData(ro)
+		ro.SetSnapshot(view.snapshot)
+		if profile != nil {
+			setReadStats(ro, e.ReadStats())
+		}
+		t := time.Now()
+		iterator := servlet.db.NewIterator(ro)
+		ro.Close()
+		err = e.SetIterator(iterator)
+		if profile != nil {
+			profile.SeekTime += time.Since(t)
+		}
+		if err != nil {
+			releaseFrozenFiles(frozen)
+			return engines, err
+		}
+		if partition != nil {
+			partition.retain()
+			e.SetPartition(partition)
+		}
+
+		startKey = endKey
+	}
+
+	// Frozen objects are read in place from their mapped files and
+	// merged with the rest of the servlet.
+	frozenEngines, err := s.frozenEngines(table, source, query, frozen, members, ranges)
+	return append(engines, frozenEngines...), err
+}
+
+// Creates engines that scan the frozen files of a servlet that overlap a
+// query's time range, splitting each file into up to n ranges of objects.
+// The references to the files are passed on to the engines or released.
+func (s *Server) frozenEngines(table *Table, source string, query *Query, files []*frozenFile, members *queryCohortMembers, n int) ([]*ExecutionEngine, error) {
+	engines := make([]*ExecutionEngine, 0)
+	start, end := shiftTimeRange(query.TimeRangeStart, query.TimeRangeEnd)
+	for i, f := range files {
+		if !f.overlaps(start, end) {
+			f.release()
+			continue
+		}
+		count := n
+		if count > f.count {
+			count = f.count
+		}
+		for j := 0; j < count; j++ {
+			e, err := s.enginePool.Get(table, source)
+			if err != nil {
+				if j == 0 {
+					f.release()
+				}
+				releaseFrozenFiles(files[i+1:])
+				return engines, err
+			}
+			if j > 0 {
+				f.retain()
+			}
+			engines = append(engines, e)
+			e.SetTimeRange(query.TimeRangeStart, query.TimeRangeEnd)
+			e.SetSampleRange(query.sampleFloor, query.Sample)
+			e.SetObjectBounds(query.MinEvents, time.Duration(query.MinSpan)*time.Second)
+			e.SetStateOnly(query.State)
+			e.SetFrozenRange(f, j*f.count/count, (j+1)*f.count/count)
+			if err := e.SetMembers(members); err != nil {
+				releaseFrozenFiles(files[i+1:])
+				return engines, err
+			}
+		}
+	}
+	return engines, nil
+}
+
+// Releases references to a list of frozen files.
+func releaseFrozenFiles(files []*frozenFile) {
+	for _, f := range files {
+		f.release()
+	}
+}
 
-	// Wait for each servlet to complete and then merge the results.
+// Generates the key that a query's results are cached under.
+func queryCacheKey(table *Table, query *Query) (string, error) {
+	b, err := json.Marshal(query.Serialize())
+	if err != nil {
+		return "", err
+	}
+	key := fmt.Sprintf("%s:%d:%s", table.Name, table.propertyFile.Version(), b)
+	if query.sampleFloor > 0 {
+		key = fmt.Sprintf("%s:%v", key, query.sampleFloor)
+	}
+	return key, nil
+}
+
+// Merges a number of results as they arrive on a channel. Merges run pairwise
+// in parallel and send their output back through the channel until only a
+// single result is left. Errors are reported after every result has
+// arrived. The time spent in merges is added to mergeTime in nanoseconds.
+func mergeQueryResults(query *Query, rchannel chan interface{}, count int, mergeTime *int64) (interface{}, error) {
 	var servletError error
-	var result interface{}
-	result = make(map[interface{}]interface{})
-	for i := 0; i < len(s.servlets); i++ {
+	var pending interface{}
+	for outstanding := count; outstanding > 0; outstanding-- {
 		ret := <-rchannel
 		if err, ok := ret.(error); ok {
 			fmt.Printf("skyd.Server: Aggregate error: %v", err)
 			servletError = err
-		} else {
-			// Defactorize aggregate results.
-			err = query.Defactorize(ret)
-			if err != nil {
-				return nil, err
-			}
+			continue
+		}
+		if pending == nil {
+			pending = ret
+			continue
+		}
 
-			// Merge results.
-			if ret != nil {
-				result, err = engine.Merge(result, ret)
-				if err != nil {
-					fmt.Printf("skyd.Server: Merge error: %v", err)
-					servletError = err
-				}
+		a, b := pending, ret
+		pending = nil
+		outstanding++
+		go func() {
+			t := time.Now()
+			merged, err := query.Merge(a, b)
+			atomic.AddInt64(mergeTime, int64(time.Since(t)))
+			if err != nil {
+				rchannel <- err
+			} else {
+				rchannel <- merged
 			}
-		}
+		}()
 	}
-	err = servletError
+	return pending, servletError
+}
 
-	// Clean up engines.
-	// TODO: Defer clean up earlier on in case of failure.
+// Returns a list of engines to the engine pool.
+func (s *Server) releaseEngines(engines []*ExecutionEngine) {
 	for _, e := range engines {
-		e.Destroy()
+		s.enginePool.Put(e)
 	}
+}
 
-	return result, err
+// Returns the number of key ranges to split each servlet into for a query.
+func (s *Server) scanRangesPerServlet() int {
+	if s.scanParallelism > 0 {
+		return s.scanParallelism
+	}
+	if len(s.servlets) == 0 {
+		return 1
+	}
+	return (runtime.NumCPU() + len(s.servlets) - 1) / len(s.servlets)
 }
@@ -0,0 +1,297 @@
+package skyd
+
+import (
+	"compress/flate"
+	"compress/gzip"
+	"io"
+	"io/ioutil"
+	"net/http"
+	"strconv"
+	"strings"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The smallest response that's compressed by default. Smaller responses are
+// sent as they are since compressing them saves less transfer time than it
+// costs.
+const DefaultCompressionThreshold = 8 << 10
+
+// The number of idle encoders and buffers kept for reuse per encoding.
+const compressionPoolCapacity = 64
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A responseEncoder compresses a response body. Encoders are reset onto the
+// next response instead of being allocated for every request.
+type responseEncoder interface {
+	io.WriteCloser
+	Flush() error
+	Reset(w io.Writer)
+}
+
+// A responseEncoding is a content coding that responses can be compressed
+// with, along with its idle encoders.
+type responseEncoding struct {
+	name     string
+	encoders chan responseEncoder
+	create   func(w io.Writer) responseEncoder
+}
+
+// A compressedResponseWriter holds back a response until it reaches the
+// compression threshold or is flushed, and then compresses the rest of it.
+// Responses that end below the threshold are sent uncompressed.
+type compressedResponseWriter struct {
+	http.ResponseWriter
+	encoding    *responseEncoding
+	threshold   int
+	status      int
+	wroteHeader bool
+	passthrough bool
+	buffer      []byte
+	encoder     responseEncoder
+}
+
+//------------------------------------------------------------------------------
+//
+// Variables
+//
+//------------------------------------------------------------------------------
+
+// The content codings that responses can be compressed with, in order of
+// preference when the client accepts several equally.
+var responseEncodings = []*responseEncoding{
+	{
+		name:     "gzip",
+		encoders: make(chan responseEncoder, compressionPoolCapacity),
+		create: func(w io.Writer) responseEncoder {
+			e, _ := gzip.NewWriterLevel(w, gzip.BestSpeed)
+			return e
+		},
+	},
+	{
+		name:     "deflate",
+		encoders: make(chan responseEncoder, compressionPoolCapacity),
+		create: func(w io.Writer) responseEncoder {
+			e, _ := flate.NewWriter(w, flate.BestSpeed)
+			return e
+		},
+	},
+}
+
+// Idle buffers that hold back responses until they're large enough to
+// compress.
+var compressionBuffers = make(chan []byte, compressionPoolCapacity)
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Chooses the encoding to compress a response with from a request's
+// Accept-Encoding header. Returns nil if the client doesn't accept any of
+// them.
+func negotiateResponseEncoding(header string) *responseEncoding {
+	var best *responseEncoding
+	var bestQuality float64
+	for _, field := range strings.Split(header, ",") {
+		parts := strings.Split(field, ";")
+		name := strings.ToLower(strings.TrimSpace(parts[0]))
+		quality := 1.0
+		for _, param := range parts[1:] {
+			param = strings.TrimSpace(param)
+			if strings.HasPrefix(param, "q=") {
+				if q, err := strconv.ParseFloat(param[2:], 64); err == nil {
+					quality = q
+				}
+			}
+		}
+		if quality <= 0 {
+			continue
+		}
+		for _, encoding := range responseEncodings {
+			if (name == encoding.name || name == "*") && (quality > bestQuality || (quality == bestQuality && encoding.preferredTo(best))) {
+				best, bestQuality = encoding, quality
+			}
+		}
+	}
+	return best
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Encodings
+//--------------------------------------
+
+// Whether the encoding comes before another in the order of preference.
+func (e *responseEncoding) preferredTo(other *responseEncoding) bool {
+	if other == nil {
+		return true
+	}
+	for _, encoding := range responseEncodings {
+		if encoding == e {
+			return true
+		} else if encoding == other {
+			return false
+		}
+	}
+	return false
+}
+
+// Returns an idle encoder that writes to w, or a new one if there are none.
+func (e *responseEncoding) acquire(w io.Writer) responseEncoder {
+	select {
+	case encoder := <-e.encoders:
+		encoder.Reset(w)
+		return encoder
+	default:
+		return e.create(w)
+	}
+}
+
+// Returns an encoder to be reused by a later response.
+func (e *responseEncoding) release(encoder responseEncoder) {
+	encoder.Reset(ioutil.Discard)
+	select {
+	case e.encoders <- encoder:
+	default:
+	}
+}
+
+//--------------------------------------
+// Response Writer
+//--------------------------------------
+
+// Wraps a response writer so that the response is compressed once it
+// reaches a threshold. Close must be called after the handler returns.
+func newCompressedResponseWriter(w http.ResponseWriter, encoding *responseEncoding, threshold int) *compressedResponseWriter {
+	var buffer []byte
+	select {
+	case buffer = <-compressionBuffers:
+	default:
+	}
+	return &compressedResponseWriter{ResponseWriter: w, encoding: encoding, threshold: threshold, buffer: buffer[:0]}
+}
+
+// Records the response status. The header is sent once it's known whether
+// the response is compressed.
+func (w *compressedResponseWriter) WriteHeader(status int) {
+	if w.wroteHeader {
+		return
+	}
+	w.wroteHeader = true
+	w.status = status
+
+	// Handlers that encode their own response are left alone.
+	if w.Header().Get("Content-Encoding") != "" {
+		w.passthrough = true
+		w.ResponseWriter.WriteHeader(status)
+	}
+}
+
+// Holds back the response until it reaches the threshold and compresses
+// everything written after that.
+func (w *compressedResponseWriter) Write(p []byte) (int, error) {
+	if !w.wroteHeader {
+		w.WriteHeader(http.StatusOK)
+	}
+	if w.passthrough {
+		return w.ResponseWriter.Write(p)
+	} else if w.encoder == nil && len(w.buffer)+len(p) < w.threshold {
+		w.buffer = append(w.buffer, p...)
+		return len(p), nil
+	}
+	if err := w.startEncoding(); err != nil {
+		return 0, err
+	}
+	return w.encoder.Write(p)
+}
+
+// Sends the response written so far. Streamed responses are compressed from
+// their first flush since their final size isn't known.
+func (w *compressedResponseWriter) Flush() {
+	if !w.wroteHeader {
+		w.WriteHeader(http.StatusOK)
+	}
+	if !w.passthrough {
+		if err := w.startEncoding(); err != nil {
+			return
+		}
+		if err := w.encoder.Flush(); err != nil {
+			return
+		}
+	}
+	if f, ok := w.ResponseWriter.(http.Flusher); ok {
+		f.Flush()
+	}
+}
+
+// Passes on notifications that the client has disconnected.
+func (w *compressedResponseWriter) CloseNotify() <-chan bool {
+	if notifier, ok := w.ResponseWriter.(http.CloseNotifier); ok {
+		return notifier.CloseNotify()
+	}
+	return nil
+}
+
+// Sends the header for a compressed response along with anything held back.
+func (w *compressedResponseWriter) startEncoding() error {
+	if w.encoder != nil {
+		return nil
+	}
+	w.Header().Set("Content-Encoding", w.encoding.name)
+	w.Header().Del("Content-Length")
+	w.ResponseWriter.WriteHeader(w.status)
+	w.encoder = w.encoding.acquire(w.ResponseWriter)
+	if len(w.buffer) > 0 {
+		if _, err := w.encoder.Write(w.buffer); err != nil {
+			return err
+		}
+	}
+	w.releaseBuffer()
+	return nil
+}
+
+// Finishes the response. Responses that never reached the threshold are
+// sent uncompressed.
+func (w *compressedResponseWriter) Close() error {
+	var err error
+	if w.encoder != nil {
+		err = w.encoder.Close()
+		w.encoding.release(w.encoder)
+		w.encoder = nil
+	} else if w.wroteHeader && !w.passthrough {
+		w.ResponseWriter.WriteHeader(w.status)
+		if len(w.buffer) > 0 {
+			_, err = w.ResponseWriter.Write(w.buffer)
+		}
+	}
+	w.releaseBuffer()
+	return err
+}
+
+// Returns the buffer to be reused by a later response.
+func (w *compressedResponseWriter) releaseBuffer() {
+	if w.buffer == nil {
+		return
+	}
+	select {
+	case compressionBuffers <- w.buffer[:0]:
+	default:
+	}
+	w.buffer = nil
+}
@@ -1,13 +1,42 @@
 package skyd
 
 import (
+	"bufio"
+	"encoding/json"
+	"errors"
 	"fmt"
 	"github.com/gorilla/mux"
+	"github.com/ugorji/go-msgpack"
+	"io"
 	"net/http"
+	"strconv"
+	"sync"
 	"time"
 )
 
+// The number of imported events buffered for a servlet before they are
+// handed to it as a single group.
+const bulkImportBatchSize = 1000
+
+// The durability levels that writes can ask for with "?durability=". Writes
+// with no durability are acknowledged before they're made and their errors
+// are only logged. By default writes are acknowledged once they're in the
+// database's log, and fsync writes once the log is synced to disk.
+const (
+	DurabilityNone  = "none"
+	DurabilityWAL   = "wal"
+	DurabilityFsync = "fsync"
+)
+
 func (s *Server) addEventHandlers() {
+	s.ApiStreamHandleFunc("/tables/{name}/events", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.importEventsHandler(w, req, params)
+	}).Methods("POST")
+
+	s.ApiHandleFunc("/tables/{name}/objects", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.scanObjectsHandler(w, req, params)
+	}).Methods("GET")
+
 	s.ApiHandleFunc("/tables/{name}/objects/{objectId}/events", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
 		return s.getEventsHandler(w, req, params)
 	}).Methods("GET")
@@ -29,40 +58,133 @@ func (s *Server) addEventHandlers() {
 	}).Methods("DELETE")
 }
 
-// GET /tables/:name/objects/:objectId/events
-func (s *Server) getEventsHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+// GET /tables/:name/objects
+//
+// Returns a page of the table's "objects", each with its "id", its
+// "events" and its "state", along with a "bookmark" to pass back with
+// "?bookmark=<bookmark>" for the next page. The bookmark is left out of the
+// last page. Pages hold up to "?limit=<n>" objects. A failed page can be
+// retried with the same bookmark.
+func (s *Server) scanObjectsHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
 	vars := mux.Vars(req)
-	table, servlet, err := s.GetObjectContext(vars["name"], vars["objectId"])
+	options := req.URL.Query()
+	table, err := s.OpenTable(vars["name"])
 	if err != nil {
 		return nil, err
 	}
+	var limit int
+	if options.Get("limit") != "" {
+		if limit, err = strconv.Atoi(options.Get("limit")); err != nil || limit < 0 {
+			return nil, fmt.Errorf("skyd.Server: Invalid scan limit: %s", options.Get("limit"))
+		}
+	}
+	var bookmark *ObjectBookmark
+	if options.Get("bookmark") != "" {
+		if bookmark, err = ParseObjectBookmark(options.Get("bookmark")); err != nil {
+			return nil, err
+		}
+	}
 
-	// Retrieve raw events.
-	events, _, err := servlet.GetEvents(table, vars["objectId"])
+	objects, next, err := s.ScanObjects(table, bookmark, limit)
 	if err != nil {
 		return nil, err
 	}
+	serialized := make([]interface{}, 0, len(objects))
+	for _, o := range objects {
+		events := make([]interface{}, 0, len(o.Events))
+		for _, event := range o.Events {
+			if err = table.DefactorizeEvent(event, s.factors); err != nil {
+				return nil, err
+			}
+			e, err := table.SerializeEvent(event)
+			if err != nil {
+				return nil, err
+			}
+			events = append(events, e)
+		}
+		obj := map[string]interface{}{"id": o.Id, "events": events}
+		if o.State != nil {
+			if err = table.DefactorizeEvent(o.State, s.factors); err != nil {
+				return nil, err
+			}
+			if obj["state"], err = table.SerializeEvent(o.State); err != nil {
+				return nil, err
+			}
+		}
+		serialized = append(serialized, obj)
+	}
+	ret := map[string]interface{}{"objects": serialized}
+	if next != nil {
+		ret["bookmark"] = next.String()
+	}
+	return ret, nil
+}
 
-	// Denormalize events.
-	output := make([]map[string]interface{}, 0)
-	for _, event := range events {
-		e, err := table.SerializeEvent(event)
-		if err != nil {
-			return nil, err
+// GET /tables/:name/objects/:objectId/events
+//
+// Writes the events of an object in time order straight from their stored
+// form. Events are a JSON array unless "?format=msgpack" is given or the
+// request accepts msgpack, which writes one msgpack map per event. Pages of events are read with
+// "?after=<timestamp>", which only returns events after an RFC3339
+// timestamp, and "?limit=<n>".
+func (s *Server) getEventsHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	options := req.URL.Query()
+	var after time.Time
+	if options.Get("after") != "" {
+		var err error
+		if after, err = time.Parse(time.RFC3339, options.Get("after")); err != nil {
+			return nil, fmt.Errorf("skyd.Server: Invalid events position: %s", options.Get("after"))
 		}
-		err = table.DefactorizeEvent(event, s.factors)
-		if err != nil {
-			return nil, err
+	}
+	var limit int
+	if options.Get("limit") != "" {
+		var err error
+		if limit, err = strconv.Atoi(options.Get("limit")); err != nil || limit < 0 {
+			return nil, fmt.Errorf("skyd.Server: Invalid events limit: %s", options.Get("limit"))
 		}
-		output = append(output, e)
 	}
+	msgpackFormat := isMsgpackMediaType(req.Header.Get("Accept"))
+	switch options.Get("format") {
+	case "":
+	case "json":
+		msgpackFormat = false
+	case "msgpack":
+		msgpackFormat = true
+	default:
+		return nil, fmt.Errorf("skyd.Server: Invalid events format: %s", options.Get("format"))
+	}
+
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+	table, servlet, err := s.GetObjectContext(vars["name"], vars["objectId"])
+	if err != nil {
+		return nil, err
+	}
+	data, err := servlet.GetEventData(table, vars["objectId"], after)
+	if err != nil {
+		return nil, err
+	}
+
+	stream := newEventStreamWriter(w, table, s.factors, msgpackFormat)
+	stream.limit = limit
+	if !after.IsZero() {
+		stream.after = ShiftTime(after)
+	}
+	err = stream.write(data)
 
-	return output, nil
+	// Errors before anything is written are returned normally.
+	if err != nil && !stream.started {
+		return nil, err
+	}
+	return nil, &StreamedResponseError{err}
 }
 
 // DELETE /tables/:name/objects/:objectId/events
 func (s *Server) deleteEventsHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (ret interface{}, err error) {
 	vars := mux.Vars(req)
+	s.placement.RLock()
+	defer s.placement.RUnlock()
 	table, servlet, err := s.GetObjectContext(vars["name"], vars["objectId"])
 	if err != nil {
 		return nil, err
@@ -74,6 +196,8 @@ func (s *Server) deleteEventsHandler(w http.ResponseWriter, req *http.Request, p
 // GET /tables/:name/objects/:objectId/events/:timestamp
 func (s *Server) getEventHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (ret interface{}, err error) {
 	vars := mux.Vars(req)
+	s.placement.RLock()
+	defer s.placement.RUnlock()
 	table, servlet, err := s.GetObjectContext(vars["name"], vars["objectId"])
 	if err != nil {
 		return nil, err
@@ -110,11 +234,18 @@ func (s *Server) getEventHandler(w http.ResponseWriter, req *http.Request, param
 // PUT /tables/:name/objects/:objectId/events/:timestamp
 func (s *Server) replaceEventHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (ret interface{}, err error) {
 	vars := mux.Vars(req)
+	s.placement.RLock()
+	defer s.placement.RUnlock()
 	table, servlet, err := s.GetObjectContext(vars["name"], vars["objectId"])
 	if err != nil {
 		return nil, err
 	}
 
+	durability, err := parseDurability(req)
+	if err != nil {
+		return nil, err
+	}
+
 	params["timestamp"] = vars["timestamp"]
 	event, err := table.DeserializeEvent(params)
 	if err != nil {
@@ -125,17 +256,24 @@ func (s *Server) replaceEventHandler(w http.ResponseWriter, req *http.Request, p
 		return nil, err
 	}
 
-	return nil, servlet.PutEvent(table, vars["objectId"], event, true)
+	return nil, s.putEvents(servlet, table, []string{vars["objectId"]}, []*Event{event}, true, durability)
 }
 
 // PATCH /tables/:name/objects/:objectId/events/:timestamp
 func (s *Server) updateEventHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (ret interface{}, err error) {
 	vars := mux.Vars(req)
+	s.placement.RLock()
+	defer s.placement.RUnlock()
 	table, servlet, err := s.GetObjectContext(vars["name"], vars["objectId"])
 	if err != nil {
 		return nil, err
 	}
 
+	durability, err := parseDurability(req)
+	if err != nil {
+		return nil, err
+	}
+
 	params["timestamp"] = vars["timestamp"]
 	event, err := table.DeserializeEvent(params)
 	if err != nil {
@@ -145,12 +283,14 @@ func (s *Server) updateEventHandler(w http.ResponseWriter, req *http.Request, pa
 	if err != nil {
 		return nil, err
 	}
-	return nil, servlet.PutEvent(table, vars["objectId"], event, false)
+	return nil, s.putEvents(servlet, table, []string{vars["objectId"]}, []*Event{event}, false, durability)
 }
 
 // DELETE /tables/:name/objects/:objectId/events/:timestamp
 func (s *Server) deleteEventHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (ret interface{}, err error) {
 	vars := mux.Vars(req)
+	s.placement.RLock()
+	defer s.placement.RUnlock()
 	table, servlet, err := s.GetObjectContext(vars["name"], vars["objectId"])
 	if err != nil {
 		return nil, err
@@ -163,3 +303,227 @@ func (s *Server) deleteEventHandler(w http.ResponseWriter, req *http.Request, pa
 
 	return nil, servlet.DeleteEvent(table, vars["objectId"], timestamp)
 }
+
+// POST /tables/:name/events
+//
+// Imports a stream of events for any number of objects. The body is a series
+// of {"id":..., "timestamp":..., "data":{...}} records, either as newline
+// delimited JSON or, with a msgpack Content-Type, as
+// consecutive msgpack maps. Events are routed to their servlets and written
+// in groups as the stream is decoded. With "?durability=none" the count is
+// returned once the stream is decoded, without waiting for the writes.
+//
+// Records may carry an "eventId" that's unique within their object. Events
+// whose id was recently written to their servlet are counted but not
+// written again, so a collector can retry a stream that timed out without
+// rewriting the objects it already reached. Single event writes take an
+// "eventId" in their body as well.
+//
+// With "?load=true" each servlet's events are kept in memory until the
+// stream ends and are then written straight to a table file that's added to
+// the servlet's database, bypassing the log. This is meant for backfilling
+// objects that the table doesn't hold yet. Servlets already holding keys in
+// the range of the loaded objects write them as a regular import instead.
+func (s *Server) importEventsHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (ret interface{}, err error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	durability, err := parseDurability(req)
+	if err != nil {
+		return nil, err
+	}
+	load := req.URL.Query().Get("load") == "true"
+
+	// Choose a decoder for the stream.
+	var decode func() (map[string]interface{}, error)
+	reader := bufio.NewReader(req.Body)
+	if isMsgpackMediaType(req.Header.Get("Content-Type")) {
+		decoder := msgpack.NewDecoder(reader, nil)
+		decode = func() (map[string]interface{}, error) {
+			var raw interface{}
+			if err := decoder.Decode(&raw); err != nil {
+				return nil, err
+			}
+			record, _ := ConvertToStringKeys(raw).(map[string]interface{})
+			return record, nil
+		}
+	} else {
+		decoder := json.NewDecoder(reader)
+		decode = func() (map[string]interface{}, error) {
+			var record map[string]interface{}
+			err := decoder.Decode(&record)
+			return record, err
+		}
+	}
+
+	// Objects aren't moved by a reshard until the import is done.
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+
+	// Start a writer for each servlet. Writers factorize each batch as a
+	// whole while the stream is still being decoded. Imports with no
+	// durability still write each servlet's batches in order but aren't
+	// waited for. Loads collect every batch and write them once the stream
+	// has been decoded unless it couldn't be.
+	writeDurability := durability
+	if durability == DurabilityNone {
+		writeDurability = DurabilityWAL
+	}
+	var wg sync.WaitGroup
+	var errMutex sync.Mutex
+	var writeErr error
+	setWriteErr := func(err error) {
+		errMutex.Lock()
+		defer errMutex.Unlock()
+		if writeErr == nil {
+			writeErr = err
+		}
+	}
+	aborted := false
+	writers := make([]chan *bulkImportBatch, len(s.servlets))
+	for i := range s.servlets {
+		writers[i] = make(chan *bulkImportBatch, 1)
+		wg.Add(1)
+		go func(servlet *Servlet, c chan *bulkImportBatch) {
+			defer wg.Done()
+			loaded := &bulkImportBatch{}
+			for batch := range c {
+				if err := table.FactorizeEvents(batch.events, s.factors, true); err != nil {
+					setWriteErr(err)
+				} else if load {
+					loaded.objectIds = append(loaded.objectIds, batch.objectIds...)
+					loaded.events = append(loaded.events, batch.events...)
+				} else if err := s.putEvents(servlet, table, batch.objectIds, batch.events, true, writeDurability); err != nil {
+					setWriteErr(err)
+				}
+			}
+			if load && !aborted && len(loaded.events) > 0 {
+				if err := servlet.LoadEvents(table, loaded.objectIds, loaded.events); err != nil {
+					setWriteErr(err)
+				}
+			}
+		}(s.servlets[i], writers[i])
+	}
+
+	// Decode, factorize and route each record.
+	count := 0
+	batches := make([]*bulkImportBatch, len(s.servlets))
+	for {
+		record, err := decode()
+		if err == io.EOF {
+			break
+		} else if err == nil {
+			err = s.importEvent(table, record, batches, writers)
+		}
+		if err != nil {
+			aborted = true
+			for i := range writers {
+				close(writers[i])
+			}
+			wg.Wait()
+			return nil, fmt.Errorf("skyd: Unable to import event %d: %v", count, err)
+		}
+		count++
+	}
+
+	// Flush remaining batches and wait for the writers to finish.
+	for i := range writers {
+		if batches[i] != nil {
+			writers[i] <- batches[i]
+		}
+		close(writers[i])
+	}
+	if durability == DurabilityNone {
+		s.asyncWrites.Add(1)
+		go func() {
+			defer s.asyncWrites.Done()
+			wg.Wait()
+			if writeErr != nil {
+				s.logger.Printf("ERROR Unable to import events to %s: %v", table.Name, writeErr)
+			}
+		}()
+		return map[string]interface{}{"count": count}, nil
+	}
+	wg.Wait()
+	if writeErr != nil {
+		return nil, writeErr
+	}
+
+	return map[string]interface{}{"count": count}, nil
+}
+
+// Adds a single imported record to its servlet's batch and hands the batch
+// to the servlet's writer once it's full. The writer factorizes the batch.
+func (s *Server) importEvent(table *Table, record map[string]interface{}, batches []*bulkImportBatch, writers []chan *bulkImportBatch) error {
+	if record == nil {
+		return errors.New("Invalid record.")
+	}
+	objectId, ok := record["id"].(string)
+	if !ok || objectId == "" {
+		return errors.New("Object identifier required.")
+	}
+
+	event, err := table.DeserializeEvent(record)
+	if err != nil {
+		return err
+	}
+
+	index, err := s.GetObjectServletIndex(table, objectId)
+	if err != nil {
+		return err
+	}
+	batch := batches[index]
+	if batch == nil {
+		batch = &bulkImportBatch{}
+		batches[index] = batch
+	}
+	batch.objectIds = append(batch.objectIds, objectId)
+	batch.events = append(batch.events, event)
+	if len(batch.events) >= bulkImportBatchSize {
+		writers[index] <- batch
+		batches[index] = nil
+	}
+
+	return nil
+}
+
+// A group of imported events bound for a single servlet.
+type bulkImportBatch struct {
+	objectIds []string
+	events    []*Event
+}
+
+// Reads the durability that a write asks for.
+func parseDurability(req *http.Request) (string, error) {
+	switch durability := req.URL.Query().Get("durability"); durability {
+	case "":
+		return DurabilityWAL, nil
+	case DurabilityNone, DurabilityWAL, DurabilityFsync:
+		return durability, nil
+	default:
+		return "", fmt.Errorf("Invalid durability: %s", durability)
+	}
+}
+
+// Writes events to a servlet with a durability. Writes with no durability
+// are made in the background and reshards wait for them before moving any
+// objects. The placement should be locked for reading by the caller.
+func (s *Server) putEvents(servlet *Servlet, table *Table, objectIds []string, events []*Event, replace bool, durability string) error {
+	switch durability {
+	case DurabilityNone:
+		s.asyncWrites.Add(1)
+		go func() {
+			defer s.asyncWrites.Done()
+			if err := servlet.PutEvents(table, objectIds, events, replace); err != nil {
+				s.logger.Printf("ERROR Unable to write events to %s: %v", table.Name, err)
+			}
+		}()
+		return nil
+	case DurabilityFsync:
+		return servlet.PutDurableEvents(table, objectIds, events, replace)
+	default:
+		return servlet.PutEvents(table, objectIds, events, replace)
+	}
+}
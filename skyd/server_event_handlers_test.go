@@ -1,7 +1,12 @@
 package skyd
 
 import (
+	"bytes"
+	"encoding/json"
+	"fmt"
+	"github.com/ugorji/go-msgpack"
 	"testing"
+	"time"
 )
 
 // Ensure that we can put an event on the server.
@@ -35,6 +40,143 @@ func TestServerUpdateEvents(t *testing.T) {
 	})
 }
 
+// Ensure that writes can ask for each durability level.
+func TestServerEventDurability(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "bar", false, "string")
+
+		resp, _ := sendTestHttpRequest("PUT", "http://localhost:8586/tables/foo/objects/xyz/events/2012-01-01T02:00:00Z?durability=fsync", "application/json", `{"data":{"bar":"a"}}`)
+		assertResponse(t, resp, 200, "", "PUT /tables/:name/objects/:objectId/events failed.")
+		resp, _ = sendTestHttpRequest("PATCH", "http://localhost:8586/tables/foo/objects/xyz/events/2012-01-01T03:00:00Z?durability=wal", "application/json", `{"data":{"bar":"b"}}`)
+		assertResponse(t, resp, 200, "", "PATCH /tables/:name/objects/:objectId/events failed.")
+		resp, _ = sendTestHttpRequest("PUT", "http://localhost:8586/tables/foo/objects/xyz/events/2012-01-01T04:00:00Z?durability=none", "application/json", `{"data":{"bar":"c"}}`)
+		assertResponse(t, resp, 200, "", "PUT /tables/:name/objects/:objectId/events failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/events?durability=none", "application/json", `{"id":"xyz","timestamp":"2012-01-01T05:00:00Z","data":{"bar":"d"}}`)
+		assertResponse(t, resp, 200, `{"count":1}`+"\n", "POST /tables/:name/events failed.")
+		resp, _ = sendTestHttpRequest("PUT", "http://localhost:8586/tables/foo/objects/xyz/events/2012-01-01T06:00:00Z?durability=disk", "application/json", `{"data":{"bar":"e"}}`)
+		resp.Body.Close()
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected invalid durability to fail: %v", resp.StatusCode)
+		}
+
+		// Writes without durability are done by the time they're waited for.
+		s.asyncWrites.Wait()
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/xyz/events", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"bar":"a"},"timestamp":"2012-01-01T02:00:00Z"},{"data":{"bar":"b"},"timestamp":"2012-01-01T03:00:00Z"},{"data":{"bar":"c"},"timestamp":"2012-01-01T04:00:00Z"},{"data":{"bar":"d"},"timestamp":"2012-01-01T05:00:00Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events failed.")
+	})
+}
+
+// Ensure that events are read in pages with their factors and in msgpack.
+func TestServerGetEventsPaged(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "action", false, "factor")
+		setupTestProperty("foo", "baz", true, "integer")
+		setupTestData(t, "foo", [][]string{
+			[]string{"xyz", "2012-01-01T01:00:00Z", `{"data":{"action":"A<b>","baz":1}}`},
+			[]string{"xyz", "2012-01-01T02:00:00Z", `{"data":{"action":"B","baz":-200}}`},
+			[]string{"xyz", "2012-01-01T03:00:00Z", `{"data":{"action":"C"}}`},
+		})
+
+		resp, _ := sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/xyz/events", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"action":"A\u003cb\u003e","baz":1},"timestamp":"2012-01-01T01:00:00Z"},{"data":{"action":"B","baz":-200},"timestamp":"2012-01-01T02:00:00Z"},{"data":{"action":"C"},"timestamp":"2012-01-01T03:00:00Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events failed.")
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/xyz/events?after=2012-01-01T01:00:00Z&limit=1", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"action":"B","baz":-200},"timestamp":"2012-01-01T02:00:00Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events?after failed.")
+
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/xyz/events?after=2012-01-01T02:00:00Z&format=msgpack", "application/json", "")
+		var record map[string]interface{}
+		if err := msgpack.NewDecoder(resp.Body, nil).Decode(&record); err != nil {
+			t.Fatalf("Unable to decode msgpack event: %v", err)
+		}
+		resp.Body.Close()
+		if ts := fmt.Sprintf("%s", record["timestamp"]); ts != "2012-01-01T03:00:00Z" {
+			t.Fatalf("Unexpected msgpack event: %v", record)
+		}
+
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/xyz/events?limit=x", "application/json", "")
+		resp.Body.Close()
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected an invalid limit to fail: %v", resp.StatusCode)
+		}
+	})
+}
+
+// Ensure that every object of a table is scanned once across pages,
+// including frozen ones, and that a page can be read again.
+func TestServerScanObjects(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "bar", false, "integer")
+		data := make([][]string, 0)
+		for i := 0; i < 25; i++ {
+			ts := "2013-01-01T00:00:00Z"
+			if i < 10 {
+				ts = "2012-01-01T00:00:00Z"
+			}
+			data = append(data, []string{fmt.Sprintf("a%d", i), ts, fmt.Sprintf(`{"data":{"bar":%d}}`, i)})
+		}
+		setupTestData(t, "foo", data)
+		if n, err := s.FreezeTable("foo", time.Date(2012, 6, 1, 0, 0, 0, 0, time.UTC)); err != nil || n != 10 {
+			t.Fatalf("Unable to freeze objects: %v (%v)", n, err)
+		}
+
+		type page struct {
+			Objects []struct {
+				Id     string                   `json:"id"`
+				Events []map[string]interface{} `json:"events"`
+			} `json:"objects"`
+			Bookmark string `json:"bookmark"`
+		}
+		seen := make(map[string]bool)
+		var bookmark string
+		for pages := 0; ; pages++ {
+			if pages > 10 {
+				t.Fatalf("Scan didn't finish: %v", seen)
+			}
+			url := "http://localhost:8586/tables/foo/objects?limit=7&bookmark=" + bookmark
+			resp, _ := sendTestHttpRequest("GET", url, "application/json", "")
+			var p page
+			err := json.NewDecoder(resp.Body).Decode(&p)
+			resp.Body.Close()
+			if err != nil || resp.StatusCode != 200 {
+				t.Fatalf("Unexpected page: %v (%v)", resp.StatusCode, err)
+			}
+
+			// Retrying a page returns the same objects.
+			resp, _ = sendTestHttpRequest("GET", url, "application/json", "")
+			var retry page
+			json.NewDecoder(resp.Body).Decode(&retry)
+			resp.Body.Close()
+			if len(retry.Objects) != len(p.Objects) || retry.Bookmark != p.Bookmark {
+				t.Fatalf("Unexpected retried page: %v != %v", retry, p)
+			}
+
+			for _, o := range p.Objects {
+				if seen[o.Id] || len(o.Events) != 1 || fmt.Sprint(o.Events[0]["data"].(map[string]interface{})["bar"]) != o.Id[1:] {
+					t.Fatalf("Unexpected object: %v", o)
+				}
+				seen[o.Id] = true
+			}
+			if p.Bookmark == "" {
+				break
+			} else if len(p.Objects) != 7 {
+				t.Fatalf("Unexpected page size: %v", len(p.Objects))
+			}
+			bookmark = p.Bookmark
+		}
+		if len(seen) != 25 {
+			t.Fatalf("Unexpected objects: %v", seen)
+		}
+
+		resp, _ := sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects?bookmark=xyz", "application/json", "")
+		resp.Body.Close()
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected an invalid bookmark to fail: %v", resp.StatusCode)
+		}
+	})
+}
+
 // Ensure that we can delete all events for an object.
 func TestServerDeleteEvent(t *testing.T) {
 	runTestServer(func(s *Server) {
@@ -78,3 +220,38 @@ func TestServerDeleteEvents(t *testing.T) {
 		assertResponse(t, resp, 200, "[]\n", "GET /tables/:name/objects/:objectId/events failed.")
 	})
 }
+
+// Ensure that events can be imported in bulk.
+func TestServerImportEvents(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "bar", false, "string")
+		setupTestProperty("foo", "baz", true, "integer")
+
+		body := `{"id":"xyz","timestamp":"2012-01-01T03:00:00Z","data":{"bar":"myValue2"}}
+{"id":"abc","timestamp":"2012-01-01T02:00:00Z","data":{"baz":10}}
+{"id":"xyz","timestamp":"2012-01-01T02:00:00Z","data":{"bar":"myValue","baz":12}}
+`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/events", "application/json", body)
+		assertResponse(t, resp, 200, `{"count":3}`+"\n", "POST /tables/:name/events failed.")
+
+		// Import more events as msgpack.
+		buffer := new(bytes.Buffer)
+		encoder := msgpack.NewEncoder(buffer)
+		encoder.Encode(map[string]interface{}{"id": "abc", "timestamp": "2012-01-01T04:00:00Z", "data": map[string]interface{}{"baz": 20}})
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/events", "application/x-msgpack", buffer.String())
+		assertResponse(t, resp, 200, `{"count":1}`+"\n", "POST /tables/:name/events (msgpack) failed.")
+
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/xyz/events", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"bar":"myValue","baz":12},"timestamp":"2012-01-01T02:00:00Z"},{"data":{"bar":"myValue2"},"timestamp":"2012-01-01T03:00:00Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events failed.")
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/abc/events", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"baz":10},"timestamp":"2012-01-01T02:00:00Z"},{"data":{"baz":20},"timestamp":"2012-01-01T04:00:00Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events failed.")
+
+		// Reject records without an object id.
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/events", "application/json", `{"timestamp":"2012-01-01T02:00:00Z","data":{}}`)
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected import without an object id to fail: %v", resp.StatusCode)
+		}
+		resp.Body.Close()
+	})
+}
@@ -1,6 +1,7 @@
 package skyd
 
 import (
+	"fmt"
 	"net/http"
 )
 
@@ -8,9 +9,120 @@ func (s *Server) addHandlers() {
 	s.ApiHandleFunc("/ping", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
 		return s.pingHandler(w, req, params)
 	}).Methods("GET")
+	s.ApiHandleFunc("/debug/storage", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.storageStatsHandler(w, req, params)
+	}).Methods("GET")
+	s.ApiHandleFunc("/partitions", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.dropPartitionsHandler(w, req, params)
+	}).Methods("DELETE")
+	s.ApiHandleFunc("/reshard", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.reshardHandler(w, req, params)
+	}).Methods("POST")
+	s.ApiHandleFunc("/checkpoint", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.checkpointHandler(w, req, params)
+	}).Methods("POST")
+	s.ApiHandleFunc("/write-rates", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.getWriteRatesHandler(w, req, params)
+	}).Methods("GET")
+	s.ApiHandleFunc("/write-rates", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.setWriteRatesHandler(w, req, params)
+	}).Methods("PUT")
+	s.router.HandleFunc("/metrics", s.metricsHandler).Methods("GET")
 }
 
 // GET /ping
 func (s *Server) pingHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
 	return map[string]interface{}{"message": "ok"}, nil
 }
+
+// GET /debug/storage
+func (s *Server) storageStatsHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	servlets := make([]interface{}, 0, len(s.servlets))
+	for _, servlet := range s.servlets {
+		servlets = append(servlets, servlet.StorageStats())
+	}
+	return map[string]interface{}{"servlets": servlets}, nil
+}
+
+// GET /metrics
+//
+// Serves the server's metrics in the Prometheus text format.
+func (s *Server) metricsHandler(w http.ResponseWriter, req *http.Request) {
+	w.Header().Set("Content-Type", "text/plain; version=0.0.4")
+	if err := s.WriteMetrics(w); err != nil {
+		s.logger.Printf("ERROR %v", err)
+	}
+}
+
+// DELETE /partitions
+func (s *Server) dropPartitionsHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	before, err := parseQueryTime(params["before"])
+	if err != nil || before.IsZero() {
+		return nil, fmt.Errorf("Invalid 'before': %v", params["before"])
+	}
+	return map[string]interface{}{"count": s.DropPartitions(before)}, nil
+}
+
+// POST /reshard
+//
+// Grows the number of servlets to {"servlets":N} and moves the objects that
+// now belong on other servlets. Responds once every object has been moved.
+func (s *Server) reshardHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	count, ok := params["servlets"].(float64)
+	if !ok || count != float64(int(count)) {
+		return nil, fmt.Errorf("Invalid 'servlets': %v", params["servlets"])
+	}
+	if err := s.Reshard(int(count)); err != nil {
+		return nil, err
+	}
+	return map[string]interface{}{"servlets": int(count)}, nil
+}
+
+// POST /checkpoint
+//
+// Writes a checkpoint of the server's data to {"path":"..."} and lists its
+// files. Files that the checkpoint at the optional "since" path already has
+// are marked as not new so that incremental backups can skip them.
+func (s *Server) checkpointHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	path, ok := params["path"].(string)
+	if !ok {
+		return nil, fmt.Errorf("Invalid 'path': %v", params["path"])
+	}
+	since, _ := params["since"].(string)
+	files, err := s.Checkpoint(path, since)
+	if err != nil {
+		return nil, err
+	}
+	return map[string]interface{}{"path": path, "files": files}, nil
+}
+
+// GET /write-rates
+func (s *Server) getWriteRatesHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	limits := s.WriteRateLimits()
+	return map[string]interface{}{"foreground": limits.Foreground, "background": limits.Background}, nil
+}
+
+// PUT /write-rates
+//
+// Limits the rates that files are written at to {"foreground":N} and
+// {"background":N} bytes per second, where zero means no limit. A rate that
+// isn't given is left as it is.
+func (s *Server) setWriteRatesHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	limits := s.WriteRateLimits()
+	for _, name := range []string{"foreground", "background"} {
+		if params[name] == nil {
+			continue
+		}
+		rate, ok := params[name].(float64)
+		if !ok || rate < 0 || rate != float64(int(rate)) {
+			return nil, fmt.Errorf("Invalid '%s': %v", name, params[name])
+		}
+		if name == "foreground" {
+			limits.Foreground = int(rate)
+		} else {
+			limits.Background = int(rate)
+		}
+	}
+	s.SetWriteRateLimits(limits)
+	return s.getWriteRatesHandler(w, req, params)
+}
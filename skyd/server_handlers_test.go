@@ -1,6 +1,16 @@
 package skyd
 
 import (
+	"bytes"
+	"compress/gzip"
+	"encoding/json"
+	"fmt"
+	"github.com/ugorji/go-msgpack"
+	"io/ioutil"
+	"net/http"
+	"os"
+	"path/filepath"
+	"strings"
 	"testing"
 )
 
@@ -15,6 +25,285 @@ func TestServerPing(t *testing.T) {
 	})
 }
 
+// Ensure that requests and responses can be encoded as msgpack.
+func TestServerMsgpack(t *testing.T) {
+	runTestServer(func(s *Server) {
+		var body bytes.Buffer
+		msgpack.NewEncoder(&body).Encode(map[string]interface{}{"name": "foo", "reorderWindow": 100})
+		req, _ := http.NewRequest("POST", "http://localhost:8586/tables", &body)
+		req.Header.Set("Content-Type", "application/msgpack")
+		req.Header.Set("Accept", "application/msgpack")
+		client := &http.Client{Transport: &http.Transport{DisableKeepAlives: true}}
+		resp, err := client.Do(req)
+		if err != nil {
+			t.Fatalf("Unable to create table: %v", err)
+		}
+		defer resp.Body.Close()
+		var ret interface{}
+		if err := msgpack.NewDecoder(resp.Body, nil).Decode(&ret); err != nil {
+			t.Fatalf("Unable to decode response: %v", err)
+		}
+		table, _ := ConvertToJSONTypes(ret).(map[string]interface{})
+		if resp.StatusCode != 200 || table["name"] != "foo" || table["reorderWindow"] != float64(100) {
+			t.Fatalf("POST /tables failed: %v %v", resp.StatusCode, table)
+		}
+	})
+}
+
+// Ensure that responses are compressed once they reach the threshold.
+func TestServerCompressedResponse(t *testing.T) {
+	runConfiguredTestServer(func(s *Server) { s.SetCompressionThreshold(32) }, func(s *Server) {
+		client := &http.Client{Transport: &http.Transport{DisableKeepAlives: true, DisableCompression: true}}
+		req, _ := http.NewRequest("POST", "http://localhost:8586/tables", strings.NewReader(`{"name":"foo"}`))
+		req.Header.Set("Accept-Encoding", "deflate;q=0.5, gzip")
+		resp, err := client.Do(req)
+		if err != nil {
+			t.Fatalf("Unable to create table: %v", err)
+		}
+		defer resp.Body.Close()
+		if resp.Header.Get("Content-Encoding") != "gzip" {
+			t.Fatalf("Response not compressed: %v", resp.Header)
+		}
+		r, err := gzip.NewReader(resp.Body)
+		if err != nil {
+			t.Fatalf("Unable to read compressed response: %v", err)
+		}
+		body, _ := ioutil.ReadAll(r)
+		if resp.StatusCode != 200 || !strings.HasPrefix(string(body), `{"name":"foo"`) {
+			t.Fatalf("POST /tables failed: %v %s", resp.StatusCode, body)
+		}
+
+		// Responses below the threshold are sent as they are.
+		req, _ = http.NewRequest("GET", "http://localhost:8586/ping", nil)
+		req.Header.Set("Accept-Encoding", "gzip")
+		resp, err = client.Do(req)
+		if err != nil {
+			t.Fatalf("Unable to ping: %v", err)
+		}
+		defer resp.Body.Close()
+		if resp.Header.Get("Content-Encoding") != "" {
+			t.Fatalf("Small response compressed: %v", resp.Header)
+		}
+		assertResponse(t, resp, 200, `{"message":"ok"}`+"\n", "GET /ping failed.")
+	})
+}
+
+// Ensure that the storage stats of every servlet are reported.
+func TestServerDebugStorage(t *testing.T) {
+	runTestServer(func(s *Server) {
+		resp, err := sendTestHttpRequest("GET", "http://localhost:8586/debug/storage", "application/json", "")
+		if err != nil {
+			t.Fatalf("Unable to get storage stats: %v", err)
+		}
+		defer resp.Body.Close()
+		body, _ := ioutil.ReadAll(resp.Body)
+		var ret map[string][]map[string]interface{}
+		if resp.StatusCode != 200 || json.Unmarshal(body, &ret) != nil {
+			t.Fatalf("GET /debug/storage failed: [%v] %s", resp.StatusCode, body)
+		}
+		if len(ret["servlets"]) != len(s.servlets) {
+			t.Fatalf("Unexpected servlet count: %s", body)
+		}
+		for _, stats := range ret["servlets"] {
+			if stats["writes"] == nil || stats["latency"] == nil || stats["compactionBacklog"] == nil || stats["runningCompactions"] == nil {
+				t.Fatalf("Missing storage stats: %v", stats)
+			}
+		}
+	})
+}
+
+// Ensure that the write rate limits can be read and changed at runtime.
+func TestServerWriteRates(t *testing.T) {
+	runTestServer(func(s *Server) {
+		defer s.SetWriteRateLimits(WriteRateLimits{})
+		resp, _ := sendTestHttpRequest("GET", "http://localhost:8586/write-rates", "application/json", "")
+		assertResponse(t, resp, 200, `{"background":0,"foreground":0}`+"\n", "GET /write-rates failed.")
+		resp, _ = sendTestHttpRequest("PUT", "http://localhost:8586/write-rates", "application/json", `{"background":1048576}`)
+		assertResponse(t, resp, 200, `{"background":1048576,"foreground":0}`+"\n", "PUT /write-rates failed.")
+		if limits := s.WriteRateLimits(); limits.Background != 1<<20 || limits.Foreground != 0 {
+			t.Fatalf("Unexpected write rate limits: %v", limits)
+		}
+		resp, _ = sendTestHttpRequest("PUT", "http://localhost:8586/write-rates", "application/json", `{"foreground":-1}`)
+		assertResponse(t, resp, 500, `{"message":"Invalid 'foreground': -1"}`+"\n", "PUT /write-rates with a negative rate should fail.")
+	})
+}
+
+// Ensure that request, query, write and storage metrics are reported.
+func TestServerMetrics(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"grape"}}`},
+		})
+		resp, _ := sendTestHttpRequest("GET", "http://localhost:8586/ping", "application/json", "")
+		assertResponse(t, resp, 200, `{"message":"ok"}`+"\n", "GET /ping failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", `{"steps":[{"type":"selection","fields":[{"name":"count","expression":"count()"}]}]}`)
+		resp.Body.Close()
+
+		resp, err := sendTestHttpRequest("GET", "http://localhost:8586/metrics", "", "")
+		if err != nil {
+			t.Fatalf("Unable to get metrics: %v", err)
+		}
+		defer resp.Body.Close()
+		body, _ := ioutil.ReadAll(resp.Body)
+		if resp.StatusCode != 200 {
+			t.Fatalf("GET /metrics failed: [%v] %s", resp.StatusCode, body)
+		}
+		for _, line := range []string{
+			`sky_http_request_duration_seconds_count{route="/ping",method="GET"} 1`,
+			`sky_http_request_duration_seconds_bucket{route="/ping",method="GET",le="+Inf"} 1`,
+			`sky_http_request_latency_seconds{route="/ping",quantile="0.99"} `,
+			`sky_http_request_latency_seconds_count{route="/ping"} 1`,
+			`sky_queries_total 1`,
+			`sky_queries_running 0`,
+			`sky_query_phase_latency_seconds_count{phase="queue"} 1`,
+			`sky_query_phase_latency_seconds_count{phase="total"} 1`,
+			`sky_event_write_latency_seconds{quantile="0.5"} `,
+			`sky_leveldb_latency_seconds{servlet="0",op="write",quantile="0.999"} `,
+			`sky_leveldb_latency_seconds_count{servlet="0",op="get"} `,
+			`sky_leveldb_files{servlet="0",level="0"} `,
+			`sky_leveldb_memtable_bytes{servlet="0"} `,
+			`sky_leveldb_pinned_metadata_bytes{servlet="0"} `,
+			`sky_memory_budget_bytes 0`,
+			`sky_memory_reserved_bytes{component="block_cache"} `,
+			`sky_memory_reserved_bytes{component="queries"} 0`,
+			`sky_memory_used_bytes{component="go_heap"} `,
+			`sky_memory_query_rejections_total 0`,
+		} {
+			if !strings.Contains(string(body), line) {
+				t.Fatalf("Missing metric %q:\n%s", line, body)
+			}
+		}
+
+		var written uint64
+		for _, servlet := range s.servlets {
+			written += servlet.eventsWritten.Value()
+		}
+		if written != 2 || !strings.Contains(string(body), "sky_servlet_events_written_total{servlet=") {
+			t.Fatalf("Unexpected events written: %v\n%s", written, body)
+		}
+	})
+}
+
+// Ensure that resharding adds servlets and moves objects onto them.
+func TestServerReshard(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "string")
+		items := make([][]string, 0)
+		for i := 0; i < 100; i++ {
+			items = append(items, []string{fmt.Sprintf("o%d", i), "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`})
+		}
+		setupTestData(t, "foo", items)
+
+		count := len(s.servlets) + 2
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/reshard", "application/json", fmt.Sprintf(`{"servlets":%d}`, count))
+		assertResponse(t, resp, 200, fmt.Sprintf(`{"servlets":%d}`, count)+"\n", "POST /reshard failed.")
+		if len(s.servlets) != count {
+			t.Fatalf("Unexpected servlet count: %v", len(s.servlets))
+		}
+		if s.servlets[count-1].Version() == 0 {
+			t.Fatalf("No objects were moved onto the new servlets.")
+		}
+
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/o7/events", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"fruit":"apple"},"timestamp":"2012-01-01T00:00:00Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events failed.")
+		query := `{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":100}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that every servlet, including ones with multi-digit indexes, is
+// opened again when the server restarts.
+func TestServerReopenServlets(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "string")
+		items := make([][]string, 0)
+		for i := 0; i < 100; i++ {
+			items = append(items, []string{fmt.Sprintf("o%d", i), "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`})
+		}
+		setupTestData(t, "foo", items)
+		count := len(s.servlets) + 1
+		if count < 12 {
+			count = 12
+		}
+		if err := s.Reshard(count); err != nil {
+			t.Fatalf("Unable to reshard: %v", err)
+		}
+
+		s.close()
+		if err := s.open(); err != nil {
+			t.Fatalf("Unable to reopen: %v", err)
+		}
+		if len(s.servlets) != count {
+			t.Fatalf("Unexpected servlet count: %v", len(s.servlets))
+		}
+		for i, servlet := range s.servlets {
+			if servlet.path != fmt.Sprintf("%s/%d", s.DataPath(), i) {
+				t.Fatalf("Servlet %d opened out of order: %v", i, servlet.path)
+			}
+		}
+		query := `{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":100}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that a checkpoint can be opened as a server and that a checkpoint
+// taken after it only marks the data files written since as new.
+func TestServerCheckpoint(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"grape"}}`},
+		})
+
+		path, _ := ioutil.TempDir("", "")
+		defer os.RemoveAll(path)
+		first, err := s.Checkpoint(filepath.Join(path, "first"), "")
+		if err != nil || len(first) == 0 {
+			t.Fatalf("Unable to checkpoint: %v", err)
+		}
+		setupTestData(t, "foo", [][]string{
+			[]string{"a2", "2012-01-01T00:00:00Z", `{"data":{"fruit":"kiwi"}}`},
+		})
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/checkpoint", "application/json", fmt.Sprintf(`{"path":%q,"since":%q}`, filepath.Join(path, "second"), filepath.Join(path, "first")))
+		result := make(map[string][]*CheckpointFile)
+		err = json.NewDecoder(resp.Body).Decode(&result)
+		resp.Body.Close()
+		if err != nil || resp.StatusCode != 200 {
+			t.Fatalf("POST /checkpoint failed: %v, %v", resp.StatusCode, err)
+		}
+		var reused, added int
+		for _, f := range result["files"] {
+			if !strings.HasSuffix(f.Path, ".sst") {
+				continue
+			} else if f.New {
+				added++
+			} else {
+				reused++
+			}
+		}
+		if reused == 0 || added == 0 {
+			t.Fatalf("Unexpected data files: %d reused, %d new", reused, added)
+		}
+
+		restored := NewServer(8587, filepath.Join(path, "second"))
+		restored.Silence()
+		restored.ListenAndServe(nil)
+		defer restored.Shutdown()
+		query := `{"steps":[{"type":"selection","dimensions":["fruit"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8587/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"fruit":{"apple":{"count":1},"grape":{"count":1},"kiwi":{"count":1}}}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
 func BenchmarkPing(b *testing.B) {
 	runTestServer(func(s *Server) {
 		for i := 0; i < b.N; i++ {
@@ -0,0 +1,374 @@
+package skyd
+
+import (
+	"bufio"
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"github.com/ugorji/go-msgpack"
+	"io"
+	"net"
+	"sync"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The ingest protocol lets collectors write events over a persistent TCP
+// connection instead of making an HTTP request per event. Every frame is a
+// big-endian uint32 length followed by a one byte type and its payload.
+//
+// The client sends:
+//
+//	table: uint32 table id, table name
+//	event: uint32 table id, uint16 object id length, object id,
+//	       int64 timestamp in Unix nanoseconds, msgpack map of property names
+//	       to values
+//
+// Table ids are local to the connection and are bound to a table name by a
+// table frame before they're used. Frames are numbered from 1 in the order
+// they're sent.
+//
+// The server sends:
+//
+//	window: uint32 number of frames that may be unacknowledged
+//	ack:    uint64 number of the last frame written
+//	error:  uint64 number of the last frame written, error message
+//
+// The window is sent once the connection is accepted. Acknowledged events
+// are in their servlet's log. After an error the connection is closed and
+// the frames after the last one written should be sent again, which is safe
+// since events replace any with the same timestamp.
+const (
+	ingestTableFrame  = 1
+	ingestEventFrame  = 2
+	ingestWindowFrame = 3
+	ingestAckFrame    = 4
+	ingestErrorFrame  = 5
+)
+
+// The number of frames a collector may send ahead of the last acknowledgement.
+// Frames are read and written in rounds of up to this many, so a round only
+// ends once its writes are in the log. Writes held up by a servlet that's
+// stalling in LevelDB's MakeRoomForWrite() keep the next round from being
+// read, which pushes back on the collector through TCP flow control.
+const DefaultIngestWindow = 4096
+
+// The largest frame accepted from a collector.
+const maxIngestFrameSize = 1 << 20
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// An ingestConnection reads pipelined frames from a collector and writes
+// their events in rounds.
+type ingestConnection struct {
+	server   *Server
+	conn     net.Conn
+	reader   *bufio.Reader
+	writer   *bufio.Writer
+	window   int
+	tables   map[uint32]*Table
+	sequence uint64
+}
+
+// A decoded frame from a collector.
+type ingestFrame struct {
+	frameType byte
+	tableId   uint32
+	name      string
+	objectId  string
+	event     *Event
+	data      map[string]interface{}
+}
+
+// The events of a round bound for one table on one servlet.
+type ingestBatchKey struct {
+	index uint32
+	table *Table
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Listener
+//--------------------------------------
+
+// Accepts collector connections until the listener is closed.
+func (s *Server) serveIngest(listener net.Listener) {
+	for {
+		conn, err := listener.Accept()
+		if err != nil {
+			return
+		}
+		s.ingestMutex.Lock()
+		if s.ingestListener != listener {
+			s.ingestMutex.Unlock()
+			conn.Close()
+			return
+		}
+		s.ingestConns[conn] = true
+		s.ingestMutex.Unlock()
+
+		go func() {
+			c := &ingestConnection{
+				server: s,
+				conn:   conn,
+				reader: bufio.NewReader(conn),
+				writer: bufio.NewWriter(conn),
+				window: s.ingestWindow,
+				tables: make(map[uint32]*Table),
+			}
+			if err := c.serve(); err != nil {
+				s.logger.Printf("ERROR Ingest from %s: %v", conn.RemoteAddr(), err)
+			}
+			s.ingestMutex.Lock()
+			delete(s.ingestConns, conn)
+			s.ingestMutex.Unlock()
+			conn.Close()
+		}()
+	}
+}
+
+// Stops accepting collector connections and closes the open ones.
+func (s *Server) closeIngest() {
+	s.ingestMutex.Lock()
+	defer s.ingestMutex.Unlock()
+	if s.ingestListener != nil {
+		s.ingestListener.Close()
+		s.ingestListener = nil
+	}
+	for conn := range s.ingestConns {
+		conn.Close()
+	}
+	s.ingestConns = nil
+}
+
+//--------------------------------------
+// Connection
+//--------------------------------------
+
+// Sends the window and then writes rounds of frames until the collector
+// disconnects or a frame fails.
+func (c *ingestConnection) serve() error {
+	payload := make([]byte, 4)
+	binary.BigEndian.PutUint32(payload, uint32(c.window))
+	if err := c.send(ingestWindowFrame, payload); err != nil {
+		return err
+	}
+
+	for {
+		frames, readErr := c.readRound()
+		if len(frames) > 0 {
+			if err := c.apply(frames); err != nil {
+				c.fail(err)
+				return err
+			}
+			payload := make([]byte, 8)
+			binary.BigEndian.PutUint64(payload, c.sequence)
+			if err := c.send(ingestAckFrame, payload); err != nil {
+				return err
+			}
+		}
+		if readErr == io.EOF {
+			return nil
+		} else if readErr != nil {
+			c.fail(readErr)
+			return readErr
+		}
+	}
+}
+
+// Reads a round of frames. Blocks for the first one and then takes the
+// frames that have already arrived, up to the window. Returns the frames
+// read before any error.
+func (c *ingestConnection) readRound() ([]*ingestFrame, error) {
+	frames := make([]*ingestFrame, 0)
+	for len(frames) < c.window {
+		if len(frames) > 0 && c.reader.Buffered() == 0 {
+			break
+		}
+		frame, err := c.readFrame()
+		if err != nil {
+			if err == io.EOF && len(frames) == 0 {
+				return nil, io.EOF
+			}
+			return frames, err
+		}
+		frames = append(frames, frame)
+	}
+	return frames, nil
+}
+
+// Reads and decodes a single frame.
+func (c *ingestConnection) readFrame() (*ingestFrame, error) {
+	var header [4]byte
+	if _, err := io.ReadFull(c.reader, header[:]); err != nil {
+		return nil, err
+	}
+	size := binary.BigEndian.Uint32(header[:])
+	if size < 5 || size > maxIngestFrameSize {
+		return nil, fmt.Errorf("Invalid frame size: %d", size)
+	}
+	b := make([]byte, size)
+	if _, err := io.ReadFull(c.reader, b); err != nil {
+		if err == io.EOF {
+			err = io.ErrUnexpectedEOF
+		}
+		return nil, err
+	}
+
+	frame := &ingestFrame{frameType: b[0], tableId: binary.BigEndian.Uint32(b[1:5])}
+	b = b[5:]
+	switch frame.frameType {
+	case ingestTableFrame:
+		frame.name = string(b)
+	case ingestEventFrame:
+		if len(b) < 2 || len(b) < 2+int(binary.BigEndian.Uint16(b))+8 {
+			return nil, errors.New("Truncated event frame.")
+		}
+		n := int(binary.BigEndian.Uint16(b))
+		frame.objectId = string(b[2 : 2+n])
+		b = b[2+n:]
+		frame.event = &Event{Timestamp: time.Unix(0, int64(binary.BigEndian.Uint64(b))).UTC()}
+		if b = b[8:]; len(b) > 0 {
+			var raw interface{}
+			if err := msgpack.NewDecoder(bytes.NewReader(b), nil).Decode(&raw); err != nil {
+				return nil, err
+			}
+			data, ok := ConvertToStringKeys(raw).(map[string]interface{})
+			if !ok {
+				return nil, errors.New("Event data must be a map.")
+			}
+			frame.data = data
+		}
+	default:
+		return nil, fmt.Errorf("Invalid frame type: %d", frame.frameType)
+	}
+	return frame, nil
+}
+
+// Binds the tables and writes the events of a round. Events are grouped by
+// servlet and table and each group is factorized and written in parallel. The sequence is
+// advanced past the frames that were written.
+func (c *ingestConnection) apply(frames []*ingestFrame) error {
+	s := c.server
+
+	// Objects aren't moved by a reshard until the round is written.
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+
+	// Decode, factorize and route each event. A frame that fails ends the
+	// round after the frames before it are written.
+	batches := make(map[ingestBatchKey]*bulkImportBatch)
+	count := 0
+	var frameErr error
+	for _, frame := range frames {
+		if frameErr = c.route(frame, batches); frameErr != nil {
+			frameErr = fmt.Errorf("Unable to ingest frame %d: %v", c.sequence+uint64(count)+1, frameErr)
+			break
+		}
+		count++
+	}
+
+	var wg sync.WaitGroup
+	var errMutex sync.Mutex
+	var writeErr error
+	for key, batch := range batches {
+		wg.Add(1)
+		go func(servlet *Servlet, table *Table, batch *bulkImportBatch) {
+			defer wg.Done()
+			err := table.FactorizeEvents(batch.events, s.factors, true)
+			if err == nil {
+				err = s.putEvents(servlet, table, batch.objectIds, batch.events, true, DurabilityWAL)
+			}
+			if err != nil {
+				errMutex.Lock()
+				if writeErr == nil {
+					writeErr = err
+				}
+				errMutex.Unlock()
+			}
+		}(s.servlets[key.index], key.table, batch)
+	}
+	wg.Wait()
+	if writeErr != nil {
+		return writeErr
+	}
+	c.sequence += uint64(count)
+	return frameErr
+}
+
+// Binds a table frame or adds an event frame to its servlet's batch.
+func (c *ingestConnection) route(frame *ingestFrame, batches map[ingestBatchKey]*bulkImportBatch) error {
+	s := c.server
+	if frame.frameType == ingestTableFrame {
+		table, err := s.OpenTable(frame.name)
+		if err != nil {
+			return err
+		}
+		c.tables[frame.tableId] = table
+		return nil
+	}
+
+	table := c.tables[frame.tableId]
+	if table == nil {
+		return fmt.Errorf("Unbound table id: %d", frame.tableId)
+	} else if frame.objectId == "" {
+		return errors.New("Object identifier required.")
+	}
+	if frame.data != nil {
+		data, err := table.NormalizeMap(frame.data)
+		if err != nil {
+			return err
+		}
+		frame.event.Data = data
+	}
+
+	index, err := s.GetObjectServletIndex(table, frame.objectId)
+	if err != nil {
+		return err
+	}
+	key := ingestBatchKey{index, table}
+	batch := batches[key]
+	if batch == nil {
+		batch = &bulkImportBatch{}
+		batches[key] = batch
+	}
+	batch.objectIds = append(batch.objectIds, frame.objectId)
+	batch.events = append(batch.events, frame.event)
+	return nil
+}
+
+// Sends a frame to the collector.
+func (c *ingestConnection) send(frameType byte, payload []byte) error {
+	var header [5]byte
+	binary.BigEndian.PutUint32(header[:], uint32(len(payload)+1))
+	header[4] = frameType
+	c.writer.Write(header[:])
+	c.writer.Write(payload)
+	return c.writer.Flush()
+}
+
+// Tells the collector which frames were written before an error.
+func (c *ingestConnection) fail(err error) {
+	message := err.Error()
+	if len(message) > maxIngestFrameSize/2 {
+		message = message[:maxIngestFrameSize/2]
+	}
+	payload := make([]byte, 8, 8+len(message))
+	binary.BigEndian.PutUint64(payload, c.sequence)
+	c.send(ingestErrorFrame, append(payload, message...))
+}
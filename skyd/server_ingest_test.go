@@ -0,0 +1,87 @@
+package skyd
+
+import (
+	"bufio"
+	"encoding/binary"
+	"github.com/ugorji/go-msgpack"
+	"io"
+	"net"
+	"testing"
+	"time"
+)
+
+// Writes a frame of the ingest protocol.
+func writeTestIngestFrame(w io.Writer, frameType byte, payload []byte) {
+	header := make([]byte, 5)
+	binary.BigEndian.PutUint32(header, uint32(len(payload)+1))
+	header[4] = frameType
+	w.Write(append(header, payload...))
+}
+
+// Reads a frame of the ingest protocol.
+func readTestIngestFrame(t *testing.T, r io.Reader) (byte, []byte) {
+	header := make([]byte, 5)
+	if _, err := io.ReadFull(r, header); err != nil {
+		t.Fatalf("Unable to read ingest frame: %v", err)
+	}
+	payload := make([]byte, binary.BigEndian.Uint32(header)-1)
+	if _, err := io.ReadFull(r, payload); err != nil {
+		t.Fatalf("Unable to read ingest frame: %v", err)
+	}
+	return header[4], payload
+}
+
+// Builds the payload of an event frame.
+func testIngestEvent(tableId uint32, objectId string, timestamp string, data map[string]interface{}) []byte {
+	ts, _ := time.Parse(time.RFC3339, timestamp)
+	b := make([]byte, 6+len(objectId)+8)
+	binary.BigEndian.PutUint32(b, tableId)
+	binary.BigEndian.PutUint16(b[4:], uint16(len(objectId)))
+	copy(b[6:], objectId)
+	binary.BigEndian.PutUint64(b[6+len(objectId):], uint64(ts.UnixNano()))
+	encoded, _ := msgpack.Marshal(data)
+	return append(b, encoded...)
+}
+
+// Ensure that collectors can write pipelined events over the ingest port.
+func TestServerIngest(t *testing.T) {
+	runConfiguredTestServer(func(s *Server) { s.SetIngestPort(8587) }, func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "bar", false, "string")
+		setupTestProperty("foo", "baz", true, "integer")
+
+		conn, err := net.Dial("tcp", "localhost:8587")
+		if err != nil {
+			t.Fatalf("Unable to connect: %v", err)
+		}
+		defer conn.Close()
+		reader := bufio.NewReader(conn)
+		if frameType, payload := readTestIngestFrame(t, reader); frameType != ingestWindowFrame || binary.BigEndian.Uint32(payload) != DefaultIngestWindow {
+			t.Fatalf("Unexpected window: %d %v", frameType, payload)
+		}
+
+		// Send the frames in one write so they're pipelined.
+		writer := bufio.NewWriter(conn)
+		writeTestIngestFrame(writer, ingestTableFrame, append([]byte{0, 0, 0, 7}, "foo"...))
+		writeTestIngestFrame(writer, ingestEventFrame, testIngestEvent(7, "xyz", "2012-01-01T03:00:00Z", map[string]interface{}{"bar": "myValue2"}))
+		writeTestIngestFrame(writer, ingestEventFrame, testIngestEvent(7, "xyz", "2012-01-01T02:00:00Z", map[string]interface{}{"bar": "myValue", "baz": 12}))
+		writer.Flush()
+		var acked uint64
+		for acked < 3 {
+			frameType, payload := readTestIngestFrame(t, reader)
+			if frameType != ingestAckFrame {
+				t.Fatalf("Unexpected frame: %d %s", frameType, payload)
+			}
+			acked = binary.BigEndian.Uint64(payload)
+		}
+		resp, _ := sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/xyz/events", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"bar":"myValue","baz":12},"timestamp":"2012-01-01T02:00:00Z"},{"data":{"bar":"myValue2"},"timestamp":"2012-01-01T03:00:00Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events failed.")
+
+		// Events for an unbound table fail after the frames before them.
+		writeTestIngestFrame(conn, ingestEventFrame, testIngestEvent(8, "xyz", "2012-01-01T04:00:00Z", map[string]interface{}{}))
+		frameType, payload := readTestIngestFrame(t, reader)
+		if frameType != ingestErrorFrame || binary.BigEndian.Uint64(payload) != 3 || string(payload[8:]) != "Unable to ingest frame 4: Unbound table id: 8" {
+			t.Fatalf("Unexpected error: %d %v %s", frameType, payload, payload[8:])
+		}
+	})
+}
@@ -48,7 +48,29 @@ func (s *Server) createPropertyHandler(w http.ResponseWriter, req *http.Request,
 	name, _ := params["name"].(string)
 	transient, _ := params["transient"].(bool)
 	dataType, _ := params["dataType"].(string)
-	return table.CreateProperty(name, transient, dataType)
+	indexed, _ := params["indexed"].(bool)
+	if indexed && dataType != FactorDataType {
+		return nil, errors.New("Only factor properties can be indexed.")
+	}
+	family, _ := params["family"].(string)
+	var property *Property
+	if family != "" {
+		if !transient {
+			return nil, errors.New("Only transient properties can be in a family.")
+		} else if indexed {
+			return nil, errors.New("Properties in a family can't be indexed.")
+		}
+		property, err = table.CreateFamilyProperty(name, dataType, family)
+	} else {
+		property, err = table.CreateProperty(name, transient, dataType)
+	}
+	if err != nil || !indexed {
+		return property, err
+	}
+	if err = s.SetPropertyIndexed(table, property, true); err != nil {
+		return nil, err
+	}
+	return property, nil
 }
 
 // GET /tables/:name/properties/:propertyName
@@ -79,15 +101,25 @@ func (s *Server) updatePropertyHandler(w http.ResponseWriter, req *http.Request,
 		return nil, errors.New("Property does not exist.")
 	}
 
-	// Update property and save property file.
-	name, _ := params["name"].(string)
-	property.Name = name
+	// Build or remove the property's index.
+	if indexed, ok := params["indexed"].(bool); ok && indexed != property.Indexed {
+		if err = s.SetPropertyIndexed(table, property, indexed); err != nil {
+			return nil, err
+		}
+	}
+
+	// Rename property and save property file.
+	if name, ok := params["name"].(string); ok {
+		if _, err = table.UpdateProperty(property.Id, func(p *Property) { p.Name = name }); err != nil {
+			return nil, err
+		}
+	}
 	err = table.SavePropertyFile()
 	if err != nil {
 		return nil, err
 	}
 
-	return property, nil
+	return table.propertyFile.GetProperty(property.Id), nil
 }
 
 // DELETE /tables/:name/properties/:propertyName
@@ -1,10 +1,25 @@
 package skyd
 
 import (
+	"encoding/json"
+	"fmt"
 	"github.com/gorilla/mux"
+	"github.com/ugorji/go-msgpack"
 	"net/http"
+	"net/url"
+	"strconv"
+	"time"
 )
 
+// Writes the records of a streamed query response one at a time as either
+// newline delimited JSON or concatenated msgpack. Each record is flushed so
+// that it's sent as its own chunk.
+type queryStreamWriter struct {
+	w       http.ResponseWriter
+	msgpack bool
+	started bool
+}
+
 func (s *Server) addQueryHandlers() {
 	s.ApiHandleFunc("/tables/{name}/stats", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
 		return s.statsHandler(w, req, params)
@@ -12,31 +27,71 @@ func (s *Server) addQueryHandlers() {
 	s.ApiHandleFunc("/tables/{name}/query", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
 		return s.queryHandler(w, req, params)
 	}).Methods("POST")
+	s.ApiHandleFunc("/tables/{name}/query/stream", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.queryStreamHandler(w, req, params)
+	}).Methods("POST")
+	s.ApiHandleFunc("/tables/{name}/query/watch", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.queryWatchHandler(w, req, params)
+	}).Methods("POST")
+	s.ApiHandleFunc("/tables/{name}/query/partial", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.queryPartialHandler(w, req, params)
+	}).Methods("POST")
 	s.ApiHandleFunc("/tables/{name}/query/codegen", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
 		return s.queryCodegenHandler(w, req, params)
 	}).Methods("POST")
+	s.ApiHandleFunc("/tables/{name}/snapshots", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.createSnapshotHandler(w, req, params)
+	}).Methods("POST")
+	s.ApiHandleFunc("/tables/{name}/snapshots/{id}", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.deleteSnapshotHandler(w, req, params)
+	}).Methods("DELETE")
+	s.ApiHandleFunc("/tables/{name}/cohorts/{cohort}", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.materializeCohortHandler(w, req, params)
+	}).Methods("POST")
+	s.ApiHandleFunc("/tables/{name}/cohorts/{cohort}", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.getCohortHandler(w, req, params)
+	}).Methods("GET")
+	s.ApiHandleFunc("/tables/{name}/cohorts/{cohort}", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.deleteCohortHandler(w, req, params)
+	}).Methods("DELETE")
+	s.ApiHandleFunc("/tables/{name}/rollups/{rollup}", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.createRollupHandler(w, req, params)
+	}).Methods("POST")
+	s.ApiHandleFunc("/tables/{name}/rollups/{rollup}", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.getRollupHandler(w, req, params)
+	}).Methods("GET")
+	s.ApiHandleFunc("/tables/{name}/rollups/{rollup}", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.deleteRollupHandler(w, req, params)
+	}).Methods("DELETE")
 }
 
 // GET /tables/:name/stats
+//
+// Returns the event "count", the number of "objects" and the approximate
+// "bytes" on disk of the table. Only the count is returned while objects
+// are being resharded or if the table has frozen objects that were never
+// counted.
 func (s *Server) statsHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
 	vars := mux.Vars(req)
 
-	// Return an error if the table already exists.
+	// Return an error if the table doesn't exist.
 	table, err := s.OpenTable(vars["name"])
 	if err != nil {
 		return nil, err
 	}
-
-	// Run a simple count query.
-	query := NewQuery(table, s.factors)
-	selection := NewQuerySelection(query)
-	selection.Fields = append(selection.Fields, NewQuerySelectionField("count", "count()"))
-	query.Steps = append(query.Steps, selection)
-
-	return s.RunQuery(table, query)
+	return s.TableStats(table)
 }
 
 // POST /tables/:name/query
+//
+// With "?profile=true" the results are returned under "result" along with
+// a "profile" of where the query's time went in each servlet and the plan
+// it was read with. With
+// "?snapshot=<id>" the query reads a snapshot created through the snapshots
+// endpoint. Queries with a "cohort" only read the members of a cohort saved
+// through the cohorts endpoint. With "?priority=batch" the query is
+// scheduled behind interactive ones. With "?timeout=<ms>" the query fails once it runs for
+// longer. The query is cancelled if the client disconnects.
 func (s *Server) queryHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
 	vars := mux.Vars(req)
 
@@ -52,8 +107,53 @@ func (s *Server) queryHandler(w http.ResponseWriter, req *http.Request, params m
 	if err != nil {
 		return nil, err
 	}
+	if err = setQueryRequestOptions(query, w, req); err != nil {
+		return nil, err
+	}
 
-	return s.RunQuery(table, query)
+	// Queries are run across the cluster unless they read a snapshot or a
+	// cohort, which only exist on this server, or they're profiled.
+	options := req.URL.Query()
+	if s.clustered() && options.Get("local") != "true" && query.SnapshotId() == "" && query.Cohort == "" && options.Get("profile") != "true" {
+		return s.RunClusterQuery(table, query, url.Values{"priority": {options.Get("priority")}, "timeout": {options.Get("timeout")}})
+	}
+	if options.Get("profile") != "true" {
+		return s.RunQuery(table, query)
+	}
+	result, profile, err := s.RunQueryProfile(table, query)
+	if err != nil {
+		return nil, err
+	}
+	return map[string]interface{}{"result": result, "profile": profile.Serialize()}, nil
+}
+
+// POST /tables/:name/query/partial
+//
+// Runs a query against this server's servlets only and writes the merged
+// result as a single msgpack record before it's finalized. Coordinators
+// merge these from every peer. The "?priority=batch" and "?timeout=<ms>"
+// options are accepted.
+func (s *Server) queryPartialHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+
+	query := NewQuery(table, s.factors)
+	if err = query.Deserialize(params); err != nil {
+		return nil, err
+	}
+	if err = setQueryRequestOptions(query, w, req); err != nil {
+		return nil, err
+	}
+
+	result, err := s.RunQueryPartial(table, query)
+	if err != nil {
+		return nil, err
+	}
+	stream := &queryStreamWriter{w: w, msgpack: true}
+	return nil, &StreamedResponseError{stream.Write(result)}
 }
 
 // POST /tables/:name/query/codegen
@@ -81,3 +181,334 @@ func (s *Server) queryCodegenHandler(w http.ResponseWriter, req *http.Request, p
 
 	return source, &TextPlainContentTypeError{}
 }
+
+// POST /tables/:name/query/stream
+//
+// Streams the results of a query. By default the merged results are written
+// as one record per group of the first dimension of each selection and a
+// last record with everything else. Deep merging the records rebuilds the
+// results of a regular query. Queries that spill merge their spilled runs
+// a group at a time as the records are written, and write the record with
+// everything else first. With "?partials=true" the unfinalized result
+// of each servlet is written as soon as it's done and the client merges
+// them. With "?online=true" the query is read in rounds over a growing
+// sample of the objects and a record of {"sample": <share read>, "result":
+// <estimate>} is written after each round, with margins of error on the
+// count() and sum() fields. The rounds stop once every margin is within
+// "?error=<fraction>" of its estimate, if given, or when the client
+// disconnects. Records are newline delimited JSON unless "?format=msgpack" is
+// given or the request accepts msgpack. Sketch fields are binary so partials that contain them should use
+// msgpack. Regular query options such as "?snapshot=<id>", "?priority=batch"
+// and "?timeout=<ms>" are accepted too.
+func (s *Server) queryStreamHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+
+	// Deserialize the query.
+	query := NewQuery(table, s.factors)
+	err = query.Deserialize(params)
+	if err != nil {
+		return nil, err
+	}
+
+	if err = setQueryRequestOptions(query, w, req); err != nil {
+		return nil, err
+	}
+
+	options := req.URL.Query()
+	stream := &queryStreamWriter{w: w, msgpack: isMsgpackMediaType(req.Header.Get("Accept"))}
+	switch options.Get("format") {
+	case "":
+	case "ndjson":
+		stream.msgpack = false
+	case "msgpack":
+		stream.msgpack = true
+	default:
+		return nil, fmt.Errorf("skyd.Server: Invalid stream format: %s", options.Get("format"))
+	}
+
+	var target float64
+	if value := options.Get("error"); value != "" {
+		if target, err = strconv.ParseFloat(value, 64); err != nil || target <= 0 {
+			return nil, fmt.Errorf("skyd.Server: Invalid online query error: %s", value)
+		}
+	}
+
+	if options.Get("partials") == "true" {
+		err = s.RunQueryPartials(table, query, stream.Write)
+	} else if options.Get("online") == "true" {
+		err = s.RunQueryOnline(table, query, target, func(result map[interface{}]interface{}, sample float64) error {
+			return stream.Write(map[interface{}]interface{}{"sample": sample, "result": result})
+		})
+	} else {
+		err = s.RunQueryRecords(table, query, stream.Write)
+	}
+
+	// Errors before anything is written are returned normally.
+	if err != nil && !stream.started {
+		return nil, err
+	}
+	stream.start()
+	return nil, &StreamedResponseError{err}
+}
+
+// POST /tables/:name/query/watch
+//
+// Registers the query in the body as a continuous query and writes its
+// result as a newline delimited JSON record every time it changes, until
+// the client disconnects. The query is evaluated every "?interval=<ms>",
+// ten seconds by default, and only rescans the servlets written to since
+// the last evaluation. Clients watching the same query share evaluations.
+// The "?priority=batch" and "?timeout=<ms>" options apply to each
+// evaluation. The stream ends with a failed evaluation.
+func (s *Server) queryWatchHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+
+	query := NewQuery(table, s.factors)
+	if err = query.Deserialize(params); err != nil {
+		return nil, err
+	}
+	if err = setQueryRequestOptions(query, w, req); err != nil {
+		return nil, err
+	}
+
+	var interval time.Duration
+	if value := req.URL.Query().Get("interval"); value != "" {
+		ms, err := strconv.Atoi(value)
+		if err != nil || ms <= 0 {
+			return nil, fmt.Errorf("skyd.Server: Invalid watch interval: %s", value)
+		}
+		interval = time.Duration(ms) * time.Millisecond
+	}
+
+	sub, err := s.WatchQuery(table, query, interval)
+	if err != nil {
+		return nil, err
+	}
+	defer sub.Close()
+
+	stream := &queryStreamWriter{w: w}
+	for {
+		select {
+		case update, ok := <-sub.Updates():
+			if !ok {
+				stream.start()
+				return nil, &StreamedResponseError{}
+			}
+			if update.Err != nil && !stream.started {
+				return nil, update.Err
+			} else if update.Err != nil {
+				return nil, &StreamedResponseError{update.Err}
+			}
+			if err := stream.Write(update.Result); err != nil {
+				return nil, &StreamedResponseError{err}
+			}
+		case <-query.Cancelled():
+			return nil, &StreamedResponseError{}
+		}
+	}
+}
+
+// Applies the URL options shared by the query endpoints to a query and
+// cancels it if the client disconnects.
+func setQueryRequestOptions(query *Query, w http.ResponseWriter, req *http.Request) error {
+	options := req.URL.Query()
+	query.SetSnapshotId(options.Get("snapshot"))
+
+	priority, err := ParseQueryPriority(options.Get("priority"))
+	if err != nil {
+		return err
+	}
+	query.SetPriority(priority)
+
+	if options.Get("timeout") != "" {
+		timeout, err := strconv.Atoi(options.Get("timeout"))
+		if err != nil || timeout < 0 {
+			return fmt.Errorf("skyd.Server: Invalid query timeout: %s", options.Get("timeout"))
+		}
+		query.SetTimeout(time.Duration(timeout) * time.Millisecond)
+	}
+
+	if notifier, ok := w.(http.CloseNotifier); ok {
+		query.SetCancelled(notifier.CloseNotify())
+	}
+	return nil
+}
+
+// POST /tables/:name/snapshots
+//
+// Takes a snapshot of the table across every servlet that queries can read
+// with "?snapshot=<id>" until it's deleted or its "ttl" in seconds passes.
+func (s *Server) createSnapshotHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+
+	var ttl time.Duration
+	if value, ok := params["ttl"].(float64); ok && value > 0 {
+		ttl = time.Duration(value * float64(time.Second))
+	} else if params["ttl"] != nil {
+		return nil, fmt.Errorf("skyd.Server: Invalid snapshot ttl: %v", params["ttl"])
+	}
+
+	snapshot, err := s.CreateQuerySnapshot(table, ttl)
+	if err != nil {
+		return nil, err
+	}
+	return snapshot.Serialize(), nil
+}
+
+// DELETE /tables/:name/snapshots/:id
+func (s *Server) deleteSnapshotHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	if !s.DeleteQuerySnapshot(vars["id"]) {
+		return nil, fmt.Errorf("skyd.Server: Snapshot not found: %s", vars["id"])
+	}
+	return nil, nil
+}
+
+// POST /tables/:name/cohorts/:cohort
+//
+// Runs the query in the body and saves the objects that reach any of its
+// selections as a cohort of the table, replacing any cohort with the same
+// name. The "?priority=batch" and "?timeout=<ms>" options are accepted.
+func (s *Server) materializeCohortHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+
+	query := NewQuery(table, s.factors)
+	if err = query.Deserialize(params); err != nil {
+		return nil, err
+	}
+	if err = setQueryRequestOptions(query, w, req); err != nil {
+		return nil, err
+	}
+	cohort, err := s.MaterializeCohort(table, vars["cohort"], query)
+	if err != nil {
+		return nil, err
+	}
+	return cohort.Serialize(), nil
+}
+
+// GET /tables/:name/cohorts/:cohort
+func (s *Server) getCohortHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	cohort, err := s.GetCohort(table, vars["cohort"])
+	if err != nil {
+		return nil, err
+	}
+	return cohort.Serialize(), nil
+}
+
+// DELETE /tables/:name/cohorts/:cohort
+func (s *Server) deleteCohortHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	ok, err := s.DeleteCohort(table, vars["cohort"])
+	if err != nil {
+		return nil, err
+	} else if !ok {
+		return nil, fmt.Errorf("skyd.Server: Cohort not found: %s", vars["cohort"])
+	}
+	return nil, nil
+}
+
+// POST /tables/:name/rollups/:rollup
+//
+// Creates a rollup of the table from the "dimensions", "sums" and
+// "interval" in the body and builds its rows, replacing any rollup with the
+// same name. Queries of counts and sums by the dimensions over whole
+// intervals are then answered from the rollup.
+func (s *Server) createRollupHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	r, err := s.CreateRollup(table, vars["rollup"], params)
+	if err != nil {
+		return nil, err
+	}
+	return r.Serialize(), nil
+}
+
+// GET /tables/:name/rollups/:rollup
+func (s *Server) getRollupHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	r := s.GetRollup(table, vars["rollup"])
+	if r == nil {
+		return nil, fmt.Errorf("skyd.Server: Rollup not found: %s", vars["rollup"])
+	}
+	return r.Serialize(), nil
+}
+
+// DELETE /tables/:name/rollups/:rollup
+func (s *Server) deleteRollupHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	ok, err := s.DeleteRollup(table, vars["rollup"])
+	if err != nil {
+		return nil, err
+	} else if !ok {
+		return nil, fmt.Errorf("skyd.Server: Rollup not found: %s", vars["rollup"])
+	}
+	return nil, nil
+}
+
+// Writes the response header before the first record.
+func (sw *queryStreamWriter) start() {
+	if sw.started {
+		return
+	}
+	sw.started = true
+	if sw.msgpack {
+		sw.w.Header().Set("Content-Type", "application/x-msgpack")
+	} else {
+		sw.w.Header().Set("Content-Type", "application/x-ndjson")
+	}
+	sw.w.WriteHeader(http.StatusOK)
+}
+
+// Encodes a single record and flushes it to the client.
+func (sw *queryStreamWriter) Write(record map[interface{}]interface{}) error {
+	sw.start()
+	var err error
+	if sw.msgpack {
+		err = msgpack.NewEncoder(sw.w).Encode(record)
+	} else {
+		err = json.NewEncoder(sw.w).Encode(ConvertToStringKeys(record))
+	}
+	if err != nil {
+		return err
+	}
+	if f, ok := sw.w.(http.Flusher); ok {
+		f.Flush()
+	}
+	return nil
+}
@@ -1,7 +1,17 @@
 package skyd
 
 import (
+	"bytes"
+	"encoding/json"
+	"fmt"
+	"io/ioutil"
+	"math"
+	"os"
+	"reflect"
+	"sort"
+	"strings"
 	"testing"
+	"time"
 )
 
 // Ensure that we can query the server for a count of events.
@@ -36,6 +46,178 @@ func TestServerSimpleCountQuery(t *testing.T) {
 	})
 }
 
+// Ensure that objects stored as event blocks are queried the same as msgpack events.
+func TestServerEventBlockQuery(t *testing.T) {
+	runConfiguredTestServer(func(s *Server) { s.SetEventBlocksEnabled(true) }, func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "gender", false, "string")
+		setupTestProperty("foo", "state", false, "factor")
+		setupTestProperty("foo", "price", true, "float")
+		setupTestData(t, "foo", [][]string{
+			[]string{"c0", "2012-01-01T00:00:02Z", `{"data":{"state":"CA","price":10}}`},
+			[]string{"c0", "2012-01-01T00:00:01Z", `{"data":{"price":200}}`},
+			[]string{"c0", "2012-01-01T00:00:00Z", `{"data":{"gender":"m", "state":"NY", "price":100}}`},
+
+			[]string{"c1", "2012-01-01T00:00:01Z", `{"data":{}}`},
+			[]string{"c1", "2012-01-01T00:00:00Z", `{"data":{"gender":"m", "state":"CA", "price":20}}`},
+
+			[]string{"c2", "2012-01-01T00:00:00Z", `{"data":{"gender":"f", "state":"NY", "price":30}}`},
+		})
+
+		// Run query.
+		query := `{
+			"steps":[
+				{"type":"selection","dimensions":["gender","state"],"fields":[
+					{"name":"count","expression":"count()"},
+					{"name":"sum","expression":"sum(price)"}
+				]}
+			]
+		}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"gender":{"f":{"state":{"NY":{"count":1,"sum":30}}},"m":{"state":{"CA":{"count":3,"sum":30},"NY":{"count":2,"sum":300}}}}}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that a query split across key ranges returns the same result.
+func TestServerSplitKeyRangeQuery(t *testing.T) {
+	runConfiguredTestServer(func(s *Server) { s.SetScanParallelism(8) }, func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "gender", false, "string")
+		data := make([][]string, 0)
+		for i := 0; i < 40; i++ {
+			gender := "m"
+			if i%4 == 0 {
+				gender = "f"
+			}
+			data = append(data, []string{fmt.Sprintf("%c%d", 'a'+(i%26), i), "2012-01-01T00:00:00Z", `{"data":{"gender":"` + gender + `"}}`})
+		}
+		setupTestData(t, "foo", data)
+
+		query := `{"steps":[{"type":"selection","dimensions":["gender"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"gender":{"f":{"count":10},"m":{"count":30}}}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that aggregations run on native threads return the same results.
+func TestServerQueryThreads(t *testing.T) {
+	runConfiguredTestServer(func(s *Server) {
+		s.SetScanParallelism(8)
+		if err := s.SetQueryThreads(2, true); err != nil {
+			t.Fatalf("Unable to start query threads: %v", err)
+		}
+	}, func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "gender", false, "string")
+		setupTestProperty("foo", "price", false, "integer")
+		data := make([][]string, 0)
+		for i := 0; i < 40; i++ {
+			gender := "m"
+			if i%4 == 0 {
+				gender = "f"
+			}
+			data = append(data, []string{fmt.Sprintf("%c%d", 'a'+(i%26), i), "2012-01-01T00:00:00Z", `{"data":{"gender":"` + gender + `","price":2}}`})
+		}
+		setupTestData(t, "foo", data)
+
+		// Both the Lua script and the native kernel run on the threads.
+		query := `{"steps":[{"type":"selection","dimensions":["gender"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"gender":{"f":{"count":10},"m":{"count":30}}}`+"\n", "POST /tables/:name/query failed.")
+		query = `{"steps":[{"type":"selection","dimensions":["gender"],"fields":[{"name":"total","expression":"sum(price)"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"gender":{"f":{"total":20},"m":{"total":60}}}`+"\n", "POST /tables/:name/query failed.")
+		if s.QueryThreads() != 2 {
+			t.Fatalf("Unexpected query threads: %d", s.QueryThreads())
+		}
+	})
+}
+
+// Ensure that objects stored in multiple chunks are queried as one stream.
+func TestServerChunkedObjectQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "note", true, "string")
+		setupTestProperty("foo", "price", true, "float")
+		note := strings.Repeat("x", 1000)
+		data := make([][]string, 0)
+		for i := 0; i < 200; i++ {
+			data = append(data, []string{"c0", time.Unix(int64(1000+i), 0).UTC().Format(time.RFC3339), fmt.Sprintf(`{"data":{"note":"%s","price":%d}}`, note, i%10)})
+		}
+		setupTestData(t, "foo", data)
+
+		query := `{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"},{"name":"sum","expression":"sum(price)"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":200,"sum":900}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that queries read frozen objects along with the live ones.
+func TestServerFrozenQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "price", true, "float")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"price":10}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"price":20}}`},
+			[]string{"a1", "2012-01-02T00:00:00Z", `{"data":{"price":30}}`},
+			[]string{"a2", "2013-01-01T00:00:00Z", `{"data":{"price":40}}`},
+		})
+
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/freeze", "application/json", `{"before":"2012-06-01T00:00:00Z"}`)
+		assertResponse(t, resp, 200, `{"count":2}`+"\n", "POST /tables/:name/freeze failed.")
+
+		query := `{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"},{"name":"sum","expression":"sum(price)"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":4,"sum":100}`+"\n", "POST /tables/:name/query failed.")
+
+		// Frozen files outside of the time range are skipped.
+		query = `{"timeRange":["2012-06-01T00:00:00Z",null],"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":1}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that queries scan the time partitions that overlap their range.
+func TestServerPartitionedQuery(t *testing.T) {
+	runConfiguredTestServer(func(s *Server) { s.SetPartitionMonths(1) }, func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "price", true, "float")
+		setupTestProperty("foo", "category", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"price":10}}`},
+			[]string{"a0", "2012-02-01T00:00:00Z", `{"data":{"price":20}}`},
+			[]string{"a1", "2012-03-01T00:00:00Z", `{"data":{"price":30}}`},
+		})
+
+		query := `{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"},{"name":"sum","expression":"sum(price)"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":3,"sum":60}`+"\n", "POST /tables/:name/query failed.")
+		query = `{"timeRange":["2012-02-01T00:00:00Z",null],"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"sum","expression":"sum(price)"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"sum":50}`+"\n", "POST /tables/:name/query failed.")
+
+		// Queries that depend on an object's other events fail.
+		message := `{"message":"skyd.Server: Only selections of events by their time and transient properties can read partitioned servlets"}` + "\n"
+		for _, query := range []string{
+			`{"steps":[{"type":"selection","dimensions":["category"],"fields":[{"name":"count","expression":"count()"}]}]}`,
+			`{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"delta","expression":"sum(delta())"}]}]}`,
+			`{"steps":[{"type":"condition","expression":"true","within":[1,1],"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}]}`,
+			`{"sessionIdleTime":3600,"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`,
+			`{"state":true,"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`,
+		} {
+			resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+			assertResponse(t, resp, 500, message, "POST /tables/:name/query should fail.")
+		}
+
+		// Retention drops the old partitions.
+		resp, _ = sendTestHttpRequest("DELETE", "http://localhost:8586/partitions", "application/json", `{"before":"2012-03-01T00:00:00Z"}`)
+		resp.Body.Close()
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", `{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"sum","expression":"sum(price)"}]}]}`)
+		assertResponse(t, resp, 200, `{"sum":30}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
 // Ensure that we can query the server for a count of events with a single dimension.
 func TestServerOneDimensionCountQuery(t *testing.T) {
 	runTestServer(func(s *Server) {
@@ -95,6 +277,33 @@ func TestServerMultiDimensionalQuery(t *testing.T) {
 		//_codegen(t, "foo", query)
 		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
 		assertResponse(t, resp, 200, `{"gender":{"f":{"state":{"NY":{"maximum":30,"minimum":30}}},"m":{"state":{"CA":{"maximum":20,"minimum":0},"NY":{"maximum":200,"minimum":100}}}},"s1":{"gender":{"f":{"state":{"NY":{"count":1,"sum":30}}},"m":{"state":{"CA":{"count":3,"sum":30},"NY":{"count":2,"sum":300}}}}}}`+"\n", "POST /tables/:name/query failed.")
+
+		// Adjacent selections below a condition are fused into one function
+		// that reuses the group of the last event.
+		query = `{
+			"steps":[
+				{"type":"condition","expression":"true","steps":[
+					{"type":"selection","name":"s1","dimensions":["gender","state"],"fields":[
+						{"name":"count","expression":"count()"},
+						{"name":"sum","expression":"sum(price)"}
+					]},
+					{"type":"selection","dimensions":["gender","state"],"fields":[
+						{"name":"minimum","expression":"min(price)"},
+						{"name":"maximum","expression":"max(price)"}
+					]}
+				]}
+			]
+		}`
+		table, _ := s.OpenTable("foo")
+		q := NewQuery(table, s.factors)
+		if err := q.Decode(strings.NewReader(query)); err != nil {
+			t.Fatalf("Unable to decode query: %v", err)
+		}
+		if source, err := q.Codegen(); err != nil || !strings.Contains(source, "_fused(cursor, data)") || strings.Contains(source, "cursor.event:") {
+			t.Fatalf("Unexpected source (%v):\n%s", err, source)
+		}
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"gender":{"f":{"state":{"NY":{"maximum":30,"minimum":30}}},"m":{"state":{"CA":{"maximum":20,"minimum":0},"NY":{"maximum":200,"minimum":100}}}},"s1":{"gender":{"f":{"state":{"NY":{"count":1,"sum":30}}},"m":{"state":{"CA":{"count":3,"sum":30},"NY":{"count":2,"sum":300}}}}}}`+"\n", "POST /tables/:name/query failed.")
 	})
 }
 
@@ -166,3 +375,1403 @@ func TestServerSessionizedFunnelAnalysisQuery(t *testing.T) {
 		assertResponse(t, resp, 200, `{"action":{"A1":{"count":1}}}`+"\n", "POST /tables/:name/query failed.")
 	})
 }
+
+// Ensure that a funnel step can be limited to a time window after the step
+// before it.
+func TestServerTimeWindowFunnelQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "action", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"g0", "2012-01-01T00:00:00Z", `{"data":{"action":"A0"}}`},
+			[]string{"g0", "2012-01-01T00:30:00Z", `{"data":{"action":"A1"}}`},
+
+			// The event that ends the first window starts the second one.
+			[]string{"g1", "2012-01-01T00:00:00Z", `{"data":{"action":"A0"}}`},
+			[]string{"g1", "2012-01-01T02:00:00Z", `{"data":{"action":"A0"}}`},
+			[]string{"g1", "2012-01-01T02:10:00Z", `{"data":{"action":"A1"}}`},
+
+			// Too soon.
+			[]string{"g2", "2012-01-01T00:00:00Z", `{"data":{"action":"A0"}}`},
+			[]string{"g2", "2012-01-01T00:00:30Z", `{"data":{"action":"A1"}}`},
+		})
+
+		query := `{
+			"steps":[
+				{"type":"condition","expression":"action == 'A0'","steps":[
+					{"type":"condition","expression":"action == 'A1'","within":[1,60],"withinUnits":"minutes","steps":[
+						{"type":"selection","dimensions":["action"],"fields":[{"name":"count","expression":"count()"}]}
+					]}
+				]}
+			]
+		}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"action":{"A1":{"count":2}}}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that an overlapping condition counts the matches that start inside
+// of an earlier match.
+func TestServerOverlappingFunnelQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "action", false, "string")
+		setupTestData(t, "foo", [][]string{
+			// Both A0 events are followed by the A1 within two steps.
+			[]string{"h0", "2012-01-01T00:00:00Z", `{"data":{"action":"A0"}}`},
+			[]string{"h0", "2012-01-01T00:00:01Z", `{"data":{"action":"A0"}}`},
+			[]string{"h0", "2012-01-01T00:00:02Z", `{"data":{"action":"A1"}}`},
+			[]string{"h0", "2012-01-01T00:00:03Z", `{"data":{"action":"A0"}}`},
+		})
+
+		query := `{
+			"steps":[
+				{"type":"condition","expression":"action == 'A0'","steps":[
+					{"type":"condition","expression":"action == 'A1'","within":[1,2],"steps":[
+						{"type":"selection","dimensions":["action"],"fields":[{"name":"count","expression":"count()"}]}
+					]}
+				]}
+			]
+		}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"action":{"A1":{"count":1}}}`+"\n", "POST /tables/:name/query failed.")
+
+		query = `{
+			"steps":[
+				{"type":"condition","expression":"action == 'A0'","overlap":true,"steps":[
+					{"type":"condition","expression":"action == 'A1'","within":[1,2],"steps":[
+						{"type":"selection","dimensions":["action"],"fields":[{"name":"count","expression":"count()"}]}
+					]}
+				]}
+			]
+		}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"action":{"A1":{"count":2}}}`+"\n", "POST /tables/:name/query failed.")
+
+		query = `{"steps":[{"type":"condition","expression":"true","overlap":"yes","steps":[]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		if resp.StatusCode == 200 {
+			t.Fatalf("Expected an invalid 'overlap' to fail.")
+		}
+	})
+}
+
+// Ensure that a query can aggregate the time between events and the time
+// since a named condition matched.
+func TestServerTimeDeltaQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "action", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"g0", "2012-01-01T00:00:00Z", `{"data":{"action":"A0"}}`},
+			[]string{"g0", "2012-01-01T00:01:00Z", `{"data":{"action":"A1"}}`},
+			[]string{"g0", "2012-01-01T00:03:00Z", `{"data":{"action":"A1"}}`},
+			[]string{"g1", "2012-01-01T00:00:00Z", `{"data":{"action":"A0"}}`},
+			[]string{"g1", "2012-01-01T00:00:10Z", `{"data":{"action":"A1"}}`},
+		})
+
+		// The first event of each object has no delta.
+		query := `{"steps":[{"type":"selection","fields":[{"name":"total","expression":"sum(delta())"},{"name":"longest","expression":"max(delta())"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"longest":120,"total":190}`+"\n", "POST /tables/:name/query failed.")
+
+		query = `{
+			"steps":[
+				{"type":"condition","name":"start","expression":"action == 'A0'","steps":[
+					{"type":"condition","expression":"action == 'A1'","within":[1,10],"steps":[
+						{"type":"selection","fields":[{"name":"count","expression":"count()"},{"name":"elapsed","expression":"sum(elapsed_since(start))"}]}
+					]}
+				]}
+			]
+		}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":2,"elapsed":70}`+"\n", "POST /tables/:name/query failed.")
+
+		// Steps must enclose the selection.
+		query = `{"steps":[{"type":"selection","fields":[{"name":"elapsed","expression":"sum(elapsed_since(start))"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		if resp.StatusCode == 200 {
+			t.Fatalf("Expected elapsed_since() without a step to fail.")
+		}
+	})
+}
+
+// Ensure that top-level conditions on the current event are filtered in the
+// cursor and still produce the same results.
+func TestServerFilteredConditionQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "action", false, "factor")
+		setupTestProperty("foo", "price", false, "float")
+		setupTestProperty("foo", "tag", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"action":"A0","price":5}}`},
+			[]string{"a0", "2012-01-01T00:00:01Z", `{"data":{"action":"A1","price":20,"tag":"x"}}`},
+			[]string{"a0", "2012-01-01T00:00:02Z", `{"data":{"action":"A2","price":15}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"action":"A0","price":10,"tag":"y"}}`},
+			[]string{"a1", "2012-01-01T00:00:01Z", `{"data":{"action":"A1","price":1}}`},
+			[]string{"a1", "2012-01-01T00:00:02Z", `{"data":{"action":"A3","price":100}}`},
+		})
+
+		query := `{
+			"steps":[
+				{"type":"condition","expression":"action in ('A0', 'A2') and price >= 10","steps":[
+					{"type":"selection","dimensions":["action"],"fields":[{"name":"count","expression":"count()"},{"name":"sum","expression":"sum(price)"}]}
+				]},
+				{"type":"condition","expression":"(action == 'A1' or tag == \"y\") and price != 20","steps":[
+					{"type":"selection","name":"other","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}
+				]}
+			]
+		}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"action":{"A0":{"count":1,"sum":10},"A2":{"count":1,"sum":15}},"other":{"count":3}}`+"\n", "POST /tables/:name/query failed.")
+
+		// Factors can't be ordered.
+		query = `{"steps":[{"type":"condition","expression":"action < 'A1'","steps":[]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected ordered factor comparison to fail: %v", resp.StatusCode)
+		}
+	})
+}
+
+// Ensure that queries selecting values of an indexed factor only visit the
+// objects that have them, both for events indexed when the property is
+// indexed and for events written after.
+func TestServerIndexedFactorQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "action", true, "factor")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"action":"view"}}`},
+			[]string{"a0", "2012-01-01T00:00:01Z", `{"data":{"action":"checkout"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"action":"view"}}`},
+		})
+		resp, _ := sendTestHttpRequest("PATCH", "http://localhost:8586/tables/foo/properties/action", "application/json", `{"indexed":true}`)
+		assertResponse(t, resp, 200, `{"id":-1,"name":"action","transient":true,"dataType":"factor","indexed":true}`+"\n", "PATCH /tables/:name/properties/:propertyName failed.")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a2", "2012-01-01T00:00:00Z", `{"data":{"action":"checkout"}}`},
+			[]string{"a3", "2012-01-01T00:00:00Z", `{"data":{"action":"view"}}`},
+		})
+
+		query := `{"steps":[{"type":"condition","expression":"action == 'checkout'","steps":[{"type":"selection","dimensions":["action"],"fields":[{"name":"count","expression":"count()"}]}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"action":{"checkout":{"count":2}}}`+"\n", "POST /tables/:name/query failed.")
+
+		// Either of two values selects the objects with either one.
+		query = `{"steps":[{"type":"condition","expression":"action == 'view' or action == 'checkout'","steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":5}`+"\n", "POST /tables/:name/query failed.")
+
+		// Only factors can be indexed.
+		setupTestProperty("foo", "price", false, "float")
+		resp, _ = sendTestHttpRequest("PATCH", "http://localhost:8586/tables/foo/properties/price", "application/json", `{"indexed":true}`)
+		resp.Body.Close()
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected indexing a float to fail: %v", resp.StatusCode)
+		}
+	})
+}
+
+// Ensure that a query time range only sees the events inside of it.
+func TestServerTimeRangeQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "note", false, "string")
+		setupTestProperty("foo", "price", false, "float")
+		note := strings.Repeat("x", 1000)
+		data := make([][]string, 0)
+		for i := 0; i < 200; i++ {
+			data = append(data, []string{"t0", time.Unix(int64(1000+i), 0).UTC().Format(time.RFC3339), fmt.Sprintf(`{"data":{"note":"%s","price":%d}}`, note, i%10)})
+		}
+		data = append(data, []string{"t1", "2012-01-01T00:00:00Z", `{"data":{"price":1000}}`})
+		setupTestData(t, "foo", data)
+
+		start, end := time.Unix(1010, 0).UTC().Format(time.RFC3339), time.Unix(1190, 0).UTC().Format(time.RFC3339)
+		query := `{"timeRange":["` + start + `","` + end + `"],"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"},{"name":"sum","expression":"sum(price)"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":180,"sum":810}`+"\n", "POST /tables/:name/query failed.")
+
+		query = `{"timeRange":["2011-01-01T00:00:00Z",null],"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":1}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that object bounds only read the objects with enough events over a
+// long enough span.
+func TestServerObjectBoundsQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "action", true, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"u0", "2012-01-01T00:00:00Z", `{"data":{"action":"signup"}}`},
+			[]string{"u0", "2012-01-01T00:01:00Z", `{"data":{"action":"login"}}`},
+			[]string{"u0", "2012-01-01T00:02:00Z", `{"data":{"action":"buy"}}`},
+			[]string{"u1", "2012-01-01T00:00:00Z", `{"data":{"action":"signup"}}`},
+			[]string{"u2", "2012-01-01T00:00:00Z", `{"data":{"action":"signup"}}`},
+			[]string{"u2", "2012-01-03T00:00:00Z", `{"data":{"action":"login"}}`},
+		})
+
+		query := `{"minEvents":2,"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":5}`+"\n", "POST /tables/:name/query failed.")
+
+		query = `{"minEvents":2,"minSpan":3600,"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":2}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that state queries count each object once by its latest permanent
+// properties.
+func TestServerStateQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "plan", false, "string")
+		setupTestProperty("foo", "action", true, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"u0", "2012-01-01T00:00:00Z", `{"data":{"plan":"free","action":"signup"}}`},
+			[]string{"u0", "2012-01-02T00:00:00Z", `{"data":{"plan":"pro","action":"upgrade"}}`},
+			[]string{"u1", "2012-01-01T00:00:00Z", `{"data":{"plan":"free","action":"signup"}}`},
+			[]string{"u2", "2012-01-01T00:00:00Z", `{"data":{"plan":"pro","action":"signup"}}`},
+			[]string{"u2", "2012-01-03T00:00:00Z", `{"data":{"action":"login"}}`},
+		})
+
+		query := `{"state":true,"steps":[{"type":"selection","dimensions":["plan"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"plan":{"free":{"count":1},"pro":{"count":2}}}`+"\n", "POST /tables/:name/query failed.")
+
+		// States have no transient properties.
+		query = `{"state":true,"steps":[{"type":"selection","dimensions":["action"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"action":{"":{"count":3}}}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that repeated queries are served from the cache until a servlet is
+// written to.
+func TestServerCachedQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "price", false, "float")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"price":100}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"price":200}}`},
+		})
+
+		query := `{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"},{"name":"sum","expression":"sum(price)"}]}]}`
+		for i := 0; i < 2; i++ {
+			resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+			assertResponse(t, resp, 200, `{"count":2,"sum":300}`+"\n", "POST /tables/:name/query failed.")
+		}
+		if s.QueryCache().Len() != 1 {
+			t.Fatalf("Unexpected cache size: %v", s.QueryCache().Len())
+		}
+
+		setupTestData(t, "foo", [][]string{
+			[]string{"a2", "2012-01-02T00:00:00Z", `{"data":{"price":50}}`},
+		})
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":3,"sum":350}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that approximate distinct counts and quantiles are merged across
+// servlets and estimated once.
+func TestServerSketchQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "note", false, "string")
+		setupTestProperty("foo", "price", false, "float")
+		data := make([][]string, 0)
+		for i := 0; i < 200; i++ {
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-01T00:00:00Z", fmt.Sprintf(`{"data":{"note":"n%d","price":%d}}`, i%20, i+1)})
+		}
+		setupTestData(t, "foo", data)
+
+		fields := `[{"name":"prices","expression":"count_distinct(price)"},{"name":"notes","expression":"count_distinct(note)"},` +
+			`{"name":"median","expression":"quantile(price, 0.5)"},{"name":"p90","expression":"quantile(price, 0.9)"}]`
+		queries := []string{
+			`{"steps":[{"type":"selection","name":"x","dimensions":[],"fields":` + fields + `}]}`,
+			`{"steps":[{"type":"condition","expression":"true","steps":[{"type":"selection","name":"x","dimensions":[],"fields":` + fields + `}]}]}`,
+		}
+		for _, query := range queries {
+			resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+			if resp.StatusCode != 200 {
+				t.Fatalf("Unexpected status: %v", resp.StatusCode)
+			}
+			var result map[string]map[string]float64
+			if err := json.NewDecoder(resp.Body).Decode(&result); err != nil {
+				t.Fatalf("Unable to decode result: %v", err)
+			}
+			x := result["x"]
+			if math.Abs(x["prices"]-200) > 4 || x["notes"] != 20 {
+				t.Fatalf("Unexpected distinct counts: %v", x)
+			}
+			if math.Abs(x["median"]-100)/100 > quantileAccuracy || math.Abs(x["p90"]-180)/180 > quantileAccuracy {
+				t.Fatalf("Unexpected quantiles: %v", x)
+			}
+		}
+	})
+}
+
+// Ensure that histograms are merged across servlets and returned as bucket
+// counts with out of range values in the end buckets.
+func TestServerHistogramQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "price", false, "float")
+		data := make([][]string, 0)
+		for i := 0; i < 200; i++ {
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-01T00:00:00Z", fmt.Sprintf(`{"data":{"price":%d}}`, i+1)})
+		}
+		setupTestData(t, "foo", data)
+
+		fields := `[{"name":"prices","expression":"histogram(price, 0, 200, 4)"}]`
+		queries := []string{
+			`{"steps":[{"type":"selection","fields":` + fields + `}]}`,
+			`{"steps":[{"type":"condition","expression":"true","steps":[{"type":"selection","fields":` + fields + `}]}]}`,
+		}
+		for _, query := range queries {
+			resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+			assertResponse(t, resp, 200, `{"prices":[49,50,50,51]}`+"\n", "POST /tables/:name/query failed.")
+		}
+
+		query := `{"steps":[{"type":"selection","fields":[{"name":"prices","expression":"histogram(price, 200, 0, 4)"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		if resp.StatusCode == 200 {
+			t.Fatalf("Expected an empty histogram range to fail.")
+		}
+	})
+}
+
+// Ensure that properties with explicit widths are decoded at full precision.
+func TestServerPropertyWidthQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "level", false, "int8")
+		setupTestProperty("foo", "views", false, "int64")
+		setupTestProperty("foo", "ratio", false, "float32")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"level":3,"views":5000000000,"ratio":0.5}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"level":7,"views":6000000000,"ratio":0.25}}`},
+			[]string{"a2", "2012-01-01T00:00:00Z", `{"data":{"level":1,"views":1,"ratio":1}}`},
+		})
+
+		fields := `[{"name":"views","expression":"sum(views)"},{"name":"ratio","expression":"sum(ratio)"}]`
+		query := `{"steps":[{"type":"condition","expression":"level > 2","steps":[{"type":"selection","fields":` + fields + `}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"ratio":0.75,"views":11000000000}`+"\n", "POST /tables/:name/query failed.")
+
+		query = `{"steps":[{"type":"selection","fields":` + fields + `}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"ratio":1.75,"views":11000000001}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that a selection grouped by a factor counts factors past the end of
+// its flat aggregate into tables.
+func TestServerFlatSelectionQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "factor")
+		setupTestProperty("foo", "price", false, "integer")
+		data := [][]string{[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple","price":1}}`}}
+		for i := 0; i < querySelectionFlatSize+44; i++ {
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-01T00:00:01Z", fmt.Sprintf(`{"data":{"fruit":"f%d","price":%d}}`, i, i+1)})
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-01T00:00:02Z", `{"data":{"fruit":"apple","price":1}}`})
+		}
+		setupTestData(t, "foo", data)
+
+		selection := `{"type":"selection","name":"x","dimensions":["fruit"],"fields":[{"name":"count","expression":"count()"},{"name":"sum","expression":"sum(price)"}]}`
+		queries := []string{
+			`{"steps":[` + selection + `]}`,
+			`{"steps":[{"type":"condition","expression":"true","steps":[` + selection + `]}]}`,
+		}
+		for _, query := range queries {
+			resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+			if resp.StatusCode != 200 {
+				t.Fatalf("Unexpected status: %v", resp.StatusCode)
+			}
+			var result map[string]map[string]map[string]map[string]float64
+			if err := json.NewDecoder(resp.Body).Decode(&result); err != nil {
+				t.Fatalf("Unable to decode result: %v", err)
+			}
+			fruit := result["x"]["fruit"]
+			if len(fruit) != querySelectionFlatSize+45 {
+				t.Fatalf("Unexpected group count: %v", len(fruit))
+			}
+			if apple := fruit["apple"]; apple["count"] != querySelectionFlatSize+45 || apple["sum"] != querySelectionFlatSize+45 {
+				t.Fatalf("Unexpected flat group: %v", apple)
+			}
+			last := fmt.Sprintf("f%d", querySelectionFlatSize+43)
+			if f := fruit[last]; f["count"] != 1 || f["sum"] != querySelectionFlatSize+44 {
+				t.Fatalf("Unexpected table group: %v", f)
+			}
+		}
+	})
+}
+
+// Ensure that selections can group events by the hour, day or week of
+// their timestamp.
+func TestServerTimeDimensionQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "action", false, "factor")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"action":"signup"}}`},
+			[]string{"a0", "2012-01-01T10:00:00Z", `{"data":{"action":"purchase"}}`},
+			[]string{"a1", "2012-01-02T03:00:00Z", `{"data":{"action":"signup"}}`},
+			[]string{"a1", "2012-01-09T00:00:00Z", `{"data":{"action":"purchase"}}`},
+		})
+
+		query := `{"steps":[{"type":"selection","dimensions":["day(timestamp)"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"day(timestamp)":{"1325376000":{"count":2},"1325462400":{"count":1},"1326067200":{"count":1}}}`+"\n", "POST /tables/:name/query failed.")
+
+		// Weeks start on Monday.
+		query = `{"steps":[{"type":"condition","expression":"true","steps":[{"type":"selection","dimensions":["week(timestamp)","action"],"fields":[{"name":"count","expression":"count()"}]}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"week(timestamp)":{"1324857600":{"action":{"purchase":{"count":1},"signup":{"count":1}}},"1325462400":{"action":{"signup":{"count":1}}},"1326067200":{"action":{"purchase":{"count":1}}}}}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that counts and sums grouped by factors run as a native kernel and
+// return the same results as the Lua aggregation.
+func TestServerKernelQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "state", false, "factor")
+		setupTestProperty("foo", "action", true, "factor")
+		setupTestProperty("foo", "price", true, "integer")
+		setupTestProperty("foo", "score", true, "float")
+		data := make([][]string, 0)
+		for i := 0; i < 40; i++ {
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-01T00:00:00Z", fmt.Sprintf(`{"data":{"state":"s%d","action":"view","price":%d}}`, i%3, i)})
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-01T00:00:01Z", fmt.Sprintf(`{"data":{"action":"buy%d","score":%d.5}}`, i%4, i)})
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-01T00:00:02Z", `{}`})
+		}
+		setupTestData(t, "foo", data)
+
+		selections := `{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"},{"name":"price","expression":"sum(price)"}]},` +
+			`{"type":"selection","dimensions":["action"],"fields":[{"name":"count","expression":"count()"},{"name":"score","expression":"sum(score)"}]},` +
+			`{"type":"selection","name":"x","dimensions":["state","action"],"fields":[{"name":"count","expression":"count()"},{"name":"price","expression":"sum(price)"}]}`
+		queries := []string{
+			`{"steps":[` + selections + `]}`,
+			`{"steps":[{"type":"condition","expression":"true","steps":[` + selections + `]}]}`,
+		}
+		var results []interface{}
+		for i, query := range queries {
+			resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query?profile=true", "application/json", query)
+			var ret struct {
+				Result  interface{} `json:"result"`
+				Profile struct {
+					Servlets []map[string]interface{} `json:"servlets"`
+				} `json:"profile"`
+			}
+			if err := json.NewDecoder(resp.Body).Decode(&ret); err != nil {
+				t.Fatalf("Unable to decode result: %v", err)
+			}
+			var kernelScans float64
+			for _, servlet := range ret.Profile.Servlets {
+				kernelScans += servlet["kernelScans"].(float64)
+			}
+			if (i == 0) != (kernelScans > 0) {
+				t.Fatalf("Unexpected kernel scans for %s: %v", query, kernelScans)
+			}
+			results = append(results, ret.Result)
+		}
+		if !reflect.DeepEqual(results[0], results[1]) {
+			t.Fatalf("Kernel and Lua results differ:\n%v\n%v", results[0], results[1])
+		}
+		x := results[0].(map[string]interface{})
+		if x["count"] != 120.0 || x["price"] != 780.0 {
+			t.Fatalf("Unexpected totals: %v", x)
+		}
+	})
+}
+
+// Ensure that a limited selection only returns its heaviest groups.
+func TestServerTopKQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "product", false, "string")
+		data := make([][]string, 0)
+		for i := 0; i < 100; i++ {
+			id := fmt.Sprintf("a%d", i)
+			second := fmt.Sprintf("v%d", i)
+			if i%2 == 0 {
+				second = "p1"
+			}
+			data = append(data, []string{id, "2012-01-01T00:00:00Z", `{"data":{"product":"p0"}}`})
+			data = append(data, []string{id, "2012-01-01T00:00:01Z", fmt.Sprintf(`{"data":{"product":"u%d"}}`, i)})
+			data = append(data, []string{id, "2012-01-01T00:00:02Z", fmt.Sprintf(`{"data":{"product":"%s"}}`, second)})
+		}
+		setupTestData(t, "foo", data)
+
+		selection := `{"type":"selection","dimensions":["product"],"limit":2,"orderBy":"count","fields":[{"name":"count","expression":"count()"}]}`
+		for _, query := range []string{`{"steps":[` + selection + `]}`, `{"steps":[{"type":"condition","expression":"true","steps":[` + selection + `]}]}`} {
+			resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+			assertResponse(t, resp, 200, `{"product":{"p0":{"count":100},"p1":{"count":50}}}`+"\n", "POST /tables/:name/query failed.")
+		}
+
+		query := `{"steps":[{"type":"selection","dimensions":[],"limit":2,"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		if resp.StatusCode == 200 {
+			t.Fatalf("Expected a limit without a dimension to fail")
+		}
+	})
+}
+
+// Ensure that query results can be streamed as groups or servlet partials.
+func TestServerStreamQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "string")
+		data := make([][]string, 0)
+		for i := 0; i < 30; i++ {
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-01T00:00:00Z", fmt.Sprintf(`{"data":{"fruit":"f%d"}}`, i%3)})
+		}
+		setupTestData(t, "foo", data)
+
+		query := `{"steps":[{"type":"selection","dimensions":["fruit"],"fields":[{"name":"count","expression":"count()"}]},` +
+			`{"type":"selection","dimensions":[],"fields":[{"name":"total","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query/stream", "application/json", query)
+		if resp.StatusCode != 200 || resp.Header.Get("Content-Type") != "application/x-ndjson" {
+			t.Fatalf("Unexpected response: %v %v", resp.StatusCode, resp.Header.Get("Content-Type"))
+		}
+		lines := make([]string, 0)
+		decoder := json.NewDecoder(resp.Body)
+		for {
+			var record map[string]interface{}
+			if err := decoder.Decode(&record); err != nil {
+				break
+			}
+			b, _ := json.Marshal(record)
+			lines = append(lines, string(b))
+		}
+		sort.Strings(lines)
+		if strings.Join(lines, "\n") != `{"fruit":{"f0":{"count":10}}}`+"\n"+`{"fruit":{"f1":{"count":10}}}`+"\n"+`{"fruit":{"f2":{"count":10}}}`+"\n"+`{"total":30}` {
+			t.Fatalf("Unexpected records: %v", lines)
+		}
+
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query/stream?partials=true", "application/json", query)
+		decoder = json.NewDecoder(resp.Body)
+		records, total := 0, 0.0
+		for {
+			var record map[string]interface{}
+			if err := decoder.Decode(&record); err != nil {
+				break
+			}
+			records++
+			v, _ := record["total"].(float64)
+			total += v
+		}
+		if records != len(s.servlets) || total != 30 {
+			t.Fatalf("Unexpected partials: %v records, %v total", records, total)
+		}
+
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query/stream?format=xml", "application/json", query)
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected an invalid format to fail: %v", resp.StatusCode)
+		}
+	})
+}
+
+// Ensure that an online query streams estimates over a growing sample and
+// ends with the exact result, or stops early at its target error.
+func TestServerOnlineQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "price", false, "float")
+		data := make([][]string, 0)
+		for i := 0; i < 200; i++ {
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-01T00:00:00Z", `{"data":{"price":10}}`})
+		}
+		setupTestData(t, "foo", data)
+
+		query := `{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"},{"name":"sum","expression":"sum(price)"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query/stream?online=true", "application/json", query)
+		if resp.StatusCode != 200 {
+			t.Fatalf("Unexpected response: %v", resp.StatusCode)
+		}
+		decoder := json.NewDecoder(resp.Body)
+		records := make([]map[string]interface{}, 0)
+		for {
+			var record map[string]interface{}
+			if err := decoder.Decode(&record); err != nil {
+				break
+			}
+			records = append(records, record)
+		}
+		if len(records) != 7 {
+			t.Fatalf("Unexpected number of rounds: %v", len(records))
+		}
+		for i := 1; i < len(records); i++ {
+			if records[i]["sample"].(float64) <= records[i-1]["sample"].(float64) {
+				t.Fatalf("Expected growing samples: %v", records)
+			}
+		}
+		last := records[len(records)-1]
+		if result := last["result"].(map[string]interface{}); last["sample"] != 1.0 || result["count"] != 200.0 || result["sum"] != 2000.0 || result["count_error"] != nil {
+			t.Fatalf("Unexpected last round: %v", last)
+		}
+
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query/stream?online=true&error=1000", "application/json", query)
+		decoder = json.NewDecoder(resp.Body)
+		count := 0
+		for {
+			var record map[string]interface{}
+			if err := decoder.Decode(&record); err != nil {
+				break
+			}
+			count++
+		}
+		if count != 1 {
+			t.Fatalf("Expected the target error to stop after one round: %v", count)
+		}
+
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query/stream?online=true&error=0", "application/json", query)
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected an invalid error to fail: %v", resp.StatusCode)
+		}
+	})
+}
+
+// Ensure that a watched query pushes its result when the table is written
+// to and that subscribers of the same query share a watch.
+func TestServerWatchQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "price", false, "float")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"price":100}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"price":200}}`},
+		})
+
+		query := `{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"},{"name":"sum","expression":"sum(price)"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query/watch?interval=100", "application/json", query)
+		if resp.StatusCode != 200 || resp.Header.Get("Content-Type") != "application/x-ndjson" {
+			t.Fatalf("Unexpected response: %v %v", resp.StatusCode, resp.Header.Get("Content-Type"))
+		}
+		decoder := json.NewDecoder(resp.Body)
+		var record map[string]interface{}
+		if err := decoder.Decode(&record); err != nil || record["count"] != 2.0 || record["sum"] != 300.0 {
+			t.Fatalf("Unexpected first record: %v (%v)", record, err)
+		}
+
+		table, _ := s.OpenTable("foo")
+		q := NewQuery(table, s.factors)
+		var obj map[string]interface{}
+		json.Unmarshal([]byte(query), &obj)
+		q.Deserialize(obj)
+		sub, err := s.WatchQuery(table, q, 100*time.Millisecond)
+		if err != nil {
+			t.Fatalf("Unable to watch query: %v", err)
+		}
+		if update := <-sub.Updates(); update.Err != nil || fmt.Sprint(update.Result["count"]) != "2" {
+			t.Fatalf("Unexpected update: %v", update)
+		}
+		if len(s.watches.watches) != 1 {
+			t.Fatalf("Expected subscribers to share a watch: %v", len(s.watches.watches))
+		}
+
+		setupTestData(t, "foo", [][]string{
+			[]string{"a2", "2012-01-02T00:00:00Z", `{"data":{"price":50}}`},
+		})
+		record = nil
+		if err := decoder.Decode(&record); err != nil || record["count"] != 3.0 || record["sum"] != 350.0 {
+			t.Fatalf("Unexpected second record: %v (%v)", record, err)
+		}
+		resp.Body.Close()
+		sub.Close()
+
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query/watch?interval=1", "application/json", query)
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected a short interval to fail: %v", resp.StatusCode)
+		}
+	})
+}
+
+// Ensure that a query is run across peers and merged, falling through to
+// the next replica of a peer when one can't be reached.
+func TestServerClusterQuery(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	peer := NewServer(8587, path)
+	peer.Silence()
+	peer.ListenAndServe(nil)
+	defer peer.Shutdown()
+
+	configure := func(s *Server) {
+		s.SetClusterOptions(ClusterOptions{Peers: [][]string{{"localhost:1", "localhost:8587"}}, HedgeDelay: 10 * time.Millisecond})
+	}
+	runConfiguredTestServer(configure, func(s *Server) {
+		for _, host := range []string{"localhost:8586", "localhost:8587"} {
+			resp, _ := sendTestHttpRequest("POST", "http://"+host+"/tables", "application/json", `{"name":"foo"}`)
+			resp.Body.Close()
+			resp, _ = sendTestHttpRequest("POST", "http://"+host+"/tables/foo/properties", "application/json", `{"name":"fruit","transient":false,"dataType":"string"}`)
+			resp.Body.Close()
+			for i := 0; i < 10; i++ {
+				resp, _ = sendTestHttpRequest("PUT", fmt.Sprintf("http://%s/tables/foo/objects/%s%d/events/2012-01-01T00:00:00Z", host, host, i), "application/json", fmt.Sprintf(`{"data":{"fruit":"f%d"}}`, i%2))
+				resp.Body.Close()
+			}
+		}
+
+		query := `{"steps":[{"type":"selection","dimensions":["fruit"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"fruit":{"f0":{"count":10},"f1":{"count":10}}}`+"\n", "POST /tables/:name/query failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query?local=true", "application/json", query)
+		assertResponse(t, resp, 200, `{"fruit":{"f0":{"count":5},"f1":{"count":5}}}`+"\n", "POST /tables/:name/query?local=true failed.")
+	})
+}
+
+// Ensure that a profiled query returns its result along with the work done
+// in each servlet, even when the result is cached.
+func TestServerProfileQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "string")
+		data := make([][]string, 0)
+		for i := 0; i < 30; i++ {
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-01T00:00:00Z", fmt.Sprintf(`{"data":{"fruit":"f%d"}}`, i%3)})
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-02T00:00:00Z", `{}`})
+		}
+		setupTestData(t, "foo", data)
+
+		query := `{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":60}`+"\n", "POST /tables/:name/query failed.")
+
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query?profile=true", "application/json", query)
+		var ret struct {
+			Result  map[string]interface{} `json:"result"`
+			Profile struct {
+				Source    string                   `json:"source"`
+				TotalTime float64                  `json:"totalTime"`
+				Servlets  []map[string]interface{} `json:"servlets"`
+				Steps     []map[string]interface{} `json:"steps"`
+			} `json:"profile"`
+		}
+		if err := json.NewDecoder(resp.Body).Decode(&ret); err != nil {
+			t.Fatalf("Unable to decode profile: %v", err)
+		}
+		if ret.Result["count"] != 60.0 {
+			t.Fatalf("Unexpected result: %v", ret.Result)
+		}
+		if ret.Profile.Source == "" || ret.Profile.TotalTime <= 0 || len(ret.Profile.Servlets) != len(s.servlets) {
+			t.Fatalf("Unexpected profile: %v", ret.Profile)
+		}
+		var objects, events, bytes float64
+		for _, servlet := range ret.Profile.Servlets {
+			objects += servlet["objects"].(float64)
+			events += servlet["events"].(float64)
+			bytes += servlet["bytes"].(float64)
+		}
+		if objects != 30 || events != 60 || bytes <= 0 {
+			t.Fatalf("Unexpected counts: %v objects, %v events, %v bytes", objects, events, bytes)
+		}
+		if len(ret.Profile.Steps) != 1 || ret.Profile.Steps[0]["function"] != "a1" || ret.Profile.Steps[0]["line"].(float64) <= 0 {
+			t.Fatalf("Unexpected steps: %v", ret.Profile.Steps)
+		}
+	})
+}
+
+// Ensure that each query is planned from the table's statistics and that
+// the plan is shown in its profile.
+func TestServerQueryPlan(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "action", true, "factor")
+		data := make([][]string, 0)
+		for i := 0; i < 100; i++ {
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-01T00:00:00Z", `{"data":{"action":"view"}}`})
+		}
+		data = append(data, []string{"a0", "2012-06-01T00:00:00Z", `{"data":{"action":"buy"}}`})
+		setupTestData(t, "foo", data)
+
+		plan := func(q string, accessPath string, count float64) {
+			resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query?profile=true", "application/json", q)
+			var ret struct {
+				Result  map[string]interface{} `json:"result"`
+				Profile struct {
+					Plan map[string]interface{} `json:"plan"`
+				} `json:"profile"`
+			}
+			if err := json.NewDecoder(resp.Body).Decode(&ret); err != nil {
+				t.Fatalf("Unable to decode profile: %v", err)
+			}
+			if ret.Result["count"] != count {
+				t.Fatalf("Unexpected result for %s: %v", q, ret.Result)
+			}
+			if ret.Profile.Plan["accessPath"] != accessPath || (accessPath != QueryPlanRollup && ret.Profile.Plan["ranges"] != 1.0) {
+				t.Fatalf("Unexpected plan for %s: %v", q, ret.Profile.Plan)
+			}
+		}
+		plan(`{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`, QueryPlanScan, 101)
+		plan(`{"steps":[{"type":"condition","expression":"action == 'buy'","steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}]}`, QueryPlanIndex, 1)
+		plan(`{"steps":[{"type":"condition","expression":"action == 'view'","steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}]}`, QueryPlanScan, 100)
+		plan(`{"timeRange":["2012-06-01T00:00:00Z",null],"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`, QueryPlanZone, 1)
+		plan(`{"objects":["a0","a5","a5","missing"],"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`, QueryPlanObjects, 3)
+
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/rollups/daily", "application/json", `{"dimensions":[],"interval":86400}`)
+		resp.Body.Close()
+		plan(`{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`, QueryPlanRollup, 101)
+	})
+}
+
+// Ensure that a query of a single object only scans the servlet that
+// holds it.
+func TestServerQuerySingleObject(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "string")
+		data := make([][]string, 0)
+		for i := 0; i < 20; i++ {
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`})
+		}
+		data = append(data, []string{"a3", "2012-01-02T00:00:00Z", `{"data":{"fruit":"pear"}}`})
+		setupTestData(t, "foo", data)
+
+		query := `{"objects":["a3"],"steps":[{"type":"selection","dimensions":["fruit"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"fruit":{"apple":{"count":1},"pear":{"count":1}}}`+"\n", "POST /tables/:name/query failed.")
+
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query?profile=true", "application/json", query)
+		var ret struct {
+			Profile struct {
+				Servlets []map[string]interface{} `json:"servlets"`
+			} `json:"profile"`
+		}
+		if err := json.NewDecoder(resp.Body).Decode(&ret); err != nil {
+			t.Fatalf("Unable to decode profile: %v", err)
+		}
+		if len(ret.Profile.Servlets) != 1 || ret.Profile.Servlets[0]["objects"] != 1.0 {
+			t.Fatalf("Unexpected servlets: %v", ret.Profile.Servlets)
+		}
+	})
+}
+
+// Ensure that queries run the same with tuned LuaJIT and collector options,
+// including with the collector stopped during aggregation.
+func TestServerEngineOptionsQuery(t *testing.T) {
+	options := EngineOptions{MaxTrace: 2000, MaxMcode: 1024, HotLoop: 10, GCPause: 150, GCStepMul: 400, GCStopBudget: 1 << 20}
+	runConfiguredTestServer(func(s *Server) { s.SetEngineOptions(options) }, func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "string")
+		data := make([][]string, 0)
+		for i := 0; i < 30; i++ {
+			data = append(data, []string{fmt.Sprintf("a%d", i), "2012-01-01T00:00:00Z", fmt.Sprintf(`{"data":{"fruit":"f%d"}}`, i%3)})
+		}
+		setupTestData(t, "foo", data)
+
+		query := `{"steps":[{"type":"selection","dimensions":["fruit"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"fruit":{"f0":{"count":10},"f1":{"count":10},"f2":{"count":10}}}`+"\n", "POST /tables/:name/query failed.")
+		if s.EngineOptions() != options {
+			t.Fatalf("Unexpected engine options: %v", s.EngineOptions())
+		}
+	})
+}
+
+// Ensure that an aggregation over the engine memory limit fails cleanly and
+// that its engines aren't reused.
+func TestServerMemoryLimitQuery(t *testing.T) {
+	runConfiguredTestServer(func(s *Server) { s.SetEngineOptions(EngineOptions{MemoryLimit: 1}) }, func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "name", false, "string")
+
+		// Give each servlet enough objects for its heap to be checked.
+		var body bytes.Buffer
+		count := 256 * len(s.servlets)
+		for i := 0; i < count; i++ {
+			fmt.Fprintf(&body, `{"id":"a%d","timestamp":"2012-01-01T00:00:00Z","data":{"name":"n%d"}}`+"\n", i, i)
+		}
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/events", "application/json", body.String())
+		assertResponse(t, resp, 200, fmt.Sprintf(`{"count":%d}`, count)+"\n", "POST /tables/:name/events failed.")
+
+		query := `{"steps":[{"type":"selection","dimensions":["name"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		defer resp.Body.Close()
+		ret, _ := ioutil.ReadAll(resp.Body)
+		if resp.StatusCode != 500 || !strings.Contains(string(ret), "memory limit") {
+			t.Fatalf("Expected the query to exceed its memory limit: [%v] %s", resp.StatusCode, ret)
+		}
+		if s.EnginePool().Len() >= len(s.servlets) {
+			t.Fatalf("Expected engines over the limit to be destroyed, %v idle", s.EnginePool().Len())
+		}
+	})
+}
+
+// Ensure that aggregations that outgrow their spill budget write their
+// partial results to disk and that the runs merge back into the same
+// result, whole or streamed a group at a time, and are removed after.
+func TestServerSpillQuery(t *testing.T) {
+	runConfiguredTestServer(func(s *Server) { s.SetEngineOptions(EngineOptions{SpillBudget: 1}) }, func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "bucket", false, "integer")
+
+		// Give each servlet enough objects and groups to spill a few times.
+		var body bytes.Buffer
+		count := 256 * len(s.servlets)
+		for i := 0; i < count; i++ {
+			fmt.Fprintf(&body, `{"id":"a%d","timestamp":"2012-01-01T00:00:00Z","data":{"bucket":%d}}`+"\n", i, i%64)
+		}
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/events", "application/json", body.String())
+		assertResponse(t, resp, 200, fmt.Sprintf(`{"count":%d}`, count)+"\n", "POST /tables/:name/events failed.")
+
+		query := `{"spill":true,"steps":[{"type":"selection","dimensions":["bucket"],"fields":[{"name":"count","expression":"count()"}]},` +
+			`{"type":"selection","dimensions":[],"fields":[{"name":"total","expression":"count()"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		var result struct {
+			Bucket map[string]map[string]int `json:"bucket"`
+			Total  int                       `json:"total"`
+		}
+		if err := json.NewDecoder(resp.Body).Decode(&result); err != nil || resp.StatusCode != 200 {
+			t.Fatalf("Unexpected response: %v %v", resp.StatusCode, err)
+		}
+		resp.Body.Close()
+		if len(result.Bucket) != 64 || result.Total != count {
+			t.Fatalf("Unexpected result: %v buckets, %v total", len(result.Bucket), result.Total)
+		}
+		for bucket, group := range result.Bucket {
+			if group["count"] != count/64 {
+				t.Fatalf("Unexpected count of bucket %v: %v", bucket, group["count"])
+			}
+		}
+
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query/stream", "application/json", query)
+		decoder := json.NewDecoder(resp.Body)
+		buckets, total := make(map[string]int), 0
+		for {
+			var record map[string]interface{}
+			if err := decoder.Decode(&record); err != nil {
+				break
+			}
+			if groups, ok := record["bucket"].(map[string]interface{}); ok {
+				for bucket, group := range groups {
+					buckets[bucket] += int(group.(map[string]interface{})["count"].(float64))
+				}
+			}
+			if v, ok := record["total"].(float64); ok {
+				total += int(v)
+			}
+		}
+		resp.Body.Close()
+		if len(buckets) != 64 || total != count {
+			t.Fatalf("Unexpected records: %v buckets, %v total", len(buckets), total)
+		}
+		for bucket, n := range buckets {
+			if n != count/64 {
+				t.Fatalf("Unexpected streamed count of bucket %v: %v", bucket, n)
+			}
+		}
+
+		if files, err := ioutil.ReadDir(s.SpillPath()); err != nil || len(files) > 0 {
+			t.Fatalf("Expected the runs to be removed: %v %v", len(files), err)
+		}
+	})
+}
+
+// Ensure that queries whose memory budget doesn't fit in what's left of the
+// server's memory budget are rejected and that others reserve and release
+// theirs.
+func TestServerMemoryBudgetQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", true, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"grape"}}`},
+		})
+		s.MemoryAccountant().SetBudget(s.MemoryAccountant().Reserved() + 1<<20)
+
+		query := `{"steps":[{"type":"selection","dimensions":["fruit"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		s.SetQuerySchedulerOptions(QuerySchedulerOptions{QueryMemory: 2 << 20})
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		ret, _ := ioutil.ReadAll(resp.Body)
+		resp.Body.Close()
+		if resp.StatusCode != 500 || !strings.Contains(string(ret), "memory budget") {
+			t.Fatalf("Expected the query to be rejected: [%v] %s", resp.StatusCode, ret)
+		}
+		if n := s.MemoryAccountant().rejections.Value(); n != 1 {
+			t.Fatalf("Unexpected rejections: %v", n)
+		}
+
+		s.SetQuerySchedulerOptions(QuerySchedulerOptions{QueryMemory: 512 << 10})
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"fruit":{"apple":{"count":1},"grape":{"count":1}}}`+"\n", "POST /tables/:name/query failed.")
+		if s.MemoryAccountant().queries != 0 {
+			t.Fatalf("Expected the query to release its reservation: %v", s.MemoryAccountant().queries)
+		}
+	})
+}
+
+// Ensure that queries run through a single worker at either priority and
+// that the query memory budget is split across its engines.
+func TestServerScheduledQuery(t *testing.T) {
+	runConfiguredTestServer(func(s *Server) { s.SetQuerySchedulerOptions(QuerySchedulerOptions{Workers: 1, BatchQueries: 1}) }, func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", true, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"grape"}}`},
+			[]string{"a2", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+		})
+
+		query := `{"steps":[{"type":"selection","dimensions":["fruit"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"fruit":{"apple":{"count":2},"grape":{"count":1}}}`+"\n", "POST /tables/:name/query failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query?priority=batch", "application/json", query)
+		assertResponse(t, resp, 200, `{"fruit":{"apple":{"count":2},"grape":{"count":1}}}`+"\n", "POST /tables/:name/query?priority=batch failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query?priority=urgent", "application/json", query)
+		resp.Body.Close()
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected an invalid priority to fail: %v", resp.StatusCode)
+		}
+
+		s.SetQuerySchedulerOptions(QuerySchedulerOptions{QueryMemory: 1})
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		defer resp.Body.Close()
+		ret, _ := ioutil.ReadAll(resp.Body)
+		if resp.StatusCode != 500 || !strings.Contains(string(ret), "memory limit") {
+			t.Fatalf("Expected the query to exceed its memory budget: [%v] %s", resp.StatusCode, ret)
+		}
+	})
+}
+
+// Ensure that queries can be given a timeout and that cancelled queries fail
+// instead of returning partial results.
+func TestServerQueryCancel(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", true, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"grape"}}`},
+		})
+
+		query := `{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query?timeout=60000", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":2}`+"\n", "POST /tables/:name/query?timeout failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query?timeout=soon", "application/json", query)
+		resp.Body.Close()
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected an invalid timeout to fail: %v", resp.StatusCode)
+		}
+
+		table, _ := s.OpenTable("foo")
+		q := NewQuery(table, s.factors)
+		selection := NewQuerySelection(q)
+		selection.Fields = append(selection.Fields, NewQuerySelectionField("count", "count()"))
+		q.Steps = append(q.Steps, selection)
+		cancelled := make(chan bool, 1)
+		cancelled <- true
+		q.SetCancelled(cancelled)
+		if _, err := s.RunQuery(table, q); err == nil || !strings.Contains(err.Error(), "cancelled") {
+			t.Fatalf("Expected the query to be cancelled: %v", err)
+		}
+
+		// Engines are reset when they're released so the next query runs.
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":2}`+"\n", "POST /tables/:name/query after cancel failed.")
+	})
+}
+
+// Ensure that a cohort saves the objects that reach a query's selections
+// and that queries of it only read its members.
+func TestServerCohortQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "action", false, "factor")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"action":"signup"}}`},
+			[]string{"a0", "2012-01-01T00:00:01Z", `{"data":{"action":"purchase"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"action":"signup"}}`},
+			[]string{"a2", "2012-01-01T00:00:00Z", `{"data":{"action":"purchase"}}`},
+		})
+
+		cohort := `{"steps":[{"type":"condition","expression":"action == 'signup'","steps":[{"type":"condition","expression":"action == 'purchase'","within":[1,10],"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/cohorts/buyers", "application/json", cohort)
+		assertResponse(t, resp, 200, `{"count":1,"name":"buyers","table":"foo"}`+"\n", "POST /tables/:name/cohorts/:cohort failed.")
+
+		query := `{"cohort":"buyers","steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":2}`+"\n", "POST /tables/:name/query failed.")
+
+		// Members are kept until the cohort is materialized again.
+		setupTestData(t, "foo", [][]string{
+			[]string{"a1", "2012-01-01T00:00:02Z", `{"data":{"action":"purchase"}}`},
+		})
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":2}`+"\n", "POST /tables/:name/query failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/cohorts/buyers", "application/json", cohort)
+		assertResponse(t, resp, 200, `{"count":2,"name":"buyers","table":"foo"}`+"\n", "POST /tables/:name/cohorts/:cohort failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":4}`+"\n", "POST /tables/:name/query failed.")
+
+		// Saved cohorts are loaded after a restart.
+		s.cohorts = newQueryCohortSet()
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/cohorts/buyers", "application/json", "")
+		assertResponse(t, resp, 200, `{"count":2,"name":"buyers","table":"foo"}`+"\n", "GET /tables/:name/cohorts/:cohort failed.")
+
+		// Deleted cohorts can't be queried.
+		resp, _ = sendTestHttpRequest("DELETE", "http://localhost:8586/tables/foo/cohorts/buyers", "application/json", "")
+		assertResponse(t, resp, 200, "", "DELETE /tables/:name/cohorts/:cohort failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		resp.Body.Close()
+		if resp.StatusCode == 200 {
+			t.Fatalf("Expected query of deleted cohort to fail.")
+		}
+	})
+}
+
+// Ensure that queries of selections that arrive together share one scan
+// and each get back only their own results.
+func TestServerSharedScan(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "action", false, "factor")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"action":"signup"}}`},
+			[]string{"a0", "2012-01-01T00:00:01Z", `{"data":{"action":"purchase"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"action":"signup"}}`},
+		})
+
+		queries := []string{
+			`{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`,
+			`{"steps":[{"type":"selection","dimensions":["action"],"fields":[{"name":"count","expression":"count()"}]}]}`,
+			`{"steps":[{"type":"selection","name":"total","dimensions":[],"fields":[{"name":"count","expression":"count()"}]},{"type":"selection","dimensions":["action"],"fields":[{"name":"n","expression":"count()"}]}]}`,
+			`{"steps":[{"type":"condition","expression":"action == 'purchase'","steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}]}`,
+		}
+		expected := []string{
+			`{"count":3}`,
+			`{"action":{"purchase":{"count":1},"signup":{"count":2}}}`,
+			`{"action":{"purchase":{"n":1},"signup":{"n":2}},"total":{"count":3}}`,
+			`{"count":1}`,
+		}
+
+		s.SetSharedScanWindow(200 * time.Millisecond)
+		started := s.queries.Value()
+		results := make(chan error, len(queries))
+		for i := range queries {
+			go func(i int) {
+				resp, err := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", queries[i])
+				if err != nil {
+					results <- err
+					return
+				}
+				defer resp.Body.Close()
+				body, _ := ioutil.ReadAll(resp.Body)
+				if resp.StatusCode != 200 || string(body) != expected[i]+"\n" {
+					err = fmt.Errorf("Unexpected result for query %d: %d %s", i, resp.StatusCode, body)
+				}
+				results <- err
+			}(i)
+		}
+		for _ = range queries {
+			if err := <-results; err != nil {
+				t.Fatal(err)
+			}
+		}
+
+		// The three queries of selections ran as one.
+		if n := s.queries.Value() - started; n != 2 {
+			t.Fatalf("Unexpected number of scans: %d", n)
+		}
+	})
+}
+
+// Ensure that queries of counts and sums can be answered from a rollup that
+// is kept up to date as events are written.
+func TestServerRollupQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "action", true, "factor")
+		setupTestProperty("foo", "price", true, "integer")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"action":"buy","price":10}}`},
+			[]string{"a0", "2012-01-01T01:30:00Z", `{"data":{"action":"buy","price":20}}`},
+			[]string{"a1", "2012-01-01T00:10:00Z", `{"data":{"action":"view","price":1}}`},
+		})
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/rollups/hourly", "application/json", `{"dimensions":["action"],"sums":["price"]}`)
+		assertResponse(t, resp, 200, `{"dimensions":["action"],"interval":3600,"name":"hourly","sums":["price"],"table":"foo"}`+"\n", "POST /tables/:name/rollups/:rollup failed.")
+
+		query := func(q string, expected string) {
+			resp, err := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", q)
+			if err != nil {
+				t.Fatalf("Unable to query: %v", err)
+			}
+			assertResponse(t, resp, 200, expected+"\n", "POST /tables/:name/query failed.")
+		}
+		all := `{"steps":[{"type":"selection","dimensions":["action"],"fields":[{"name":"count","expression":"count()"},{"name":"total","expression":"sum(price)"}]}]}`
+		firstHour := `{"timeRange":["2012-01-01T00:00:00Z","2012-01-01T01:00:00Z"],"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`
+		started := s.queries.Value()
+		query(all, `{"action":{"buy":{"count":2,"total":30},"view":{"count":1,"total":1}}}`)
+		query(firstHour, `{"count":2}`)
+
+		// Rows follow new, replaced and deleted events.
+		setupTestData(t, "foo", [][]string{
+			[]string{"a1", "2012-01-01T00:20:00Z", `{"data":{"action":"buy","price":5}}`},
+			[]string{"a0", "2012-01-01T01:30:00Z", `{"data":{"action":"view","price":2}}`},
+		})
+		resp, _ = sendTestHttpRequest("DELETE", "http://localhost:8586/tables/foo/objects/a1/events/2012-01-01T00:10:00Z", "application/json", "")
+		assertResponse(t, resp, 200, "", "DELETE /tables/:name/objects/:objectId/events/:timestamp failed.")
+		query(all, `{"action":{"buy":{"count":2,"total":15},"view":{"count":1,"total":2}}}`)
+		query(firstHour, `{"count":2}`)
+		if n := s.queries.Value() - started; n != 0 {
+			t.Fatalf("Unexpected number of scans: %d", n)
+		}
+
+		// Queries that the rollup can't answer are scanned.
+		query(`{"timeRange":["2012-01-01T00:00:00Z","2012-01-01T00:15:00Z"],"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`, `{"count":1}`)
+		if n := s.queries.Value() - started; n != 1 {
+			t.Fatalf("Unexpected number of scans: %d", n)
+		}
+
+		resp, _ = sendTestHttpRequest("DELETE", "http://localhost:8586/tables/foo/rollups/hourly", "application/json", "")
+		assertResponse(t, resp, 200, "", "DELETE /tables/:name/rollups/:rollup failed.")
+		query(all, `{"action":{"buy":{"count":2,"total":15},"view":{"count":1,"total":2}}}`)
+		if n := s.queries.Value() - started; n != 2 {
+			t.Fatalf("Unexpected number of scans: %d", n)
+		}
+	})
+}
+
+// Ensure that table stats are read from counts kept by each servlet once
+// they've been built instead of scanning.
+func TestServerTableStats(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a0", "2012-01-01T01:00:00Z", `{"data":{"fruit":"pear"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"grape"}}`},
+		})
+
+		stats := func(events float64, objects float64) {
+			resp, _ := sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/stats", "application/json", "")
+			var result map[string]interface{}
+			json.NewDecoder(resp.Body).Decode(&result)
+			resp.Body.Close()
+			if resp.StatusCode != 200 || result["count"] != events || result["objects"] != objects || result["bytes"] == nil {
+				t.Fatalf("Unexpected stats: %v %v", resp.StatusCode, result)
+			}
+		}
+		started := s.queries.Value()
+		stats(3, 2)
+
+		// Counts follow new, replaced and deleted events and objects.
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T01:00:00Z", `{"data":{"fruit":"plum"}}`},
+			[]string{"a2", "2012-01-01T00:00:00Z", `{"data":{"fruit":"kiwi"}}`},
+			[]string{"a2", "2012-01-01T02:00:00Z", `{"data":{"fruit":"kiwi"}}`},
+		})
+		stats(5, 3)
+		resp, _ := sendTestHttpRequest("DELETE", "http://localhost:8586/tables/foo/objects/a0/events/2012-01-01T00:00:00Z", "application/json", "")
+		assertResponse(t, resp, 200, "", "DELETE /tables/:name/objects/:objectId/events/:timestamp failed.")
+		resp, _ = sendTestHttpRequest("DELETE", "http://localhost:8586/tables/foo/objects/a2/events", "application/json", "")
+		assertResponse(t, resp, 200, "", "DELETE /tables/:name/objects/:objectId/events failed.")
+		stats(2, 2)
+		if n := s.queries.Value() - started; n != 0 {
+			t.Fatalf("Unexpected number of scans: %d", n)
+		}
+	})
+}
+
+// Ensure that queries can read a registered snapshot while writes continue.
+func TestServerQuerySnapshot(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", true, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"grape"}}`},
+		})
+
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/snapshots", "application/json", `{"ttl":30}`)
+		var snapshot map[string]interface{}
+		json.NewDecoder(resp.Body).Decode(&snapshot)
+		resp.Body.Close()
+		id, _ := snapshot["id"].(string)
+		if resp.StatusCode != 200 || id == "" || snapshot["table"] != "foo" {
+			t.Fatalf("Unexpected snapshot: %v %v", resp.StatusCode, snapshot)
+		}
+
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:01Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a2", "2012-01-01T00:00:00Z", `{"data":{"fruit":"orange"}}`},
+		})
+
+		query := `{
+			"steps":[
+				{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}
+			]
+		}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query?snapshot="+id, "application/json", query)
+		assertResponse(t, resp, 200, `{"count":2}`+"\n", "POST /tables/:name/query?snapshot failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":4}`+"\n", "POST /tables/:name/query failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query/stream?partials=true&snapshot="+id, "application/json", query)
+		body, _ := ioutil.ReadAll(resp.Body)
+		resp.Body.Close()
+		total := 0
+		for _, line := range strings.Split(strings.TrimSpace(string(body)), "\n") {
+			var record map[string]interface{}
+			json.Unmarshal([]byte(line), &record)
+			if count, ok := record["count"].(float64); ok {
+				total += int(count)
+			}
+		}
+		if total != 2 {
+			t.Fatalf("Unexpected snapshot partials: %s", body)
+		}
+
+		// Deleted snapshots can't be queried.
+		resp, _ = sendTestHttpRequest("DELETE", "http://localhost:8586/tables/foo/snapshots/"+id, "application/json", "")
+		assertResponse(t, resp, 200, "", "DELETE /tables/:name/snapshots/:id failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query?snapshot="+id, "application/json", query)
+		resp.Body.Close()
+		if resp.StatusCode == 200 {
+			t.Fatalf("Expected query of deleted snapshot to fail.")
+		}
+	})
+}
+
+// Ensure that properties stored in a family are merged back into queries
+// and events.
+func TestServerPropertyFamilyQuery(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "gender", false, "string")
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/properties", "application/json", `{"name":"price", "transient":true, "dataType":"float", "family":"metrics"}`)
+		assertResponse(t, resp, 200, `{"id":-1,"name":"price","transient":true,"dataType":"float","family":"metrics"}`+"\n", "POST /tables/:name/properties failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/properties", "application/json", `{"name":"size", "transient":false, "dataType":"integer", "family":"metrics"}`)
+		resp.Body.Close()
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected a permanent family property to fail: %v", resp.StatusCode)
+		}
+		setupTestData(t, "foo", [][]string{
+			[]string{"c0", "2012-01-01T00:00:02Z", `{"data":{"price":10}}`},
+			[]string{"c0", "2012-01-01T00:00:01Z", `{"data":{"price":200}}`},
+			[]string{"c0", "2012-01-01T00:00:00Z", `{"data":{"gender":"m", "price":100}}`},
+
+			[]string{"c1", "2012-01-01T00:00:00Z", `{"data":{"gender":"m", "price":20}}`},
+			[]string{"c1", "2012-01-01T00:00:01Z", `{"data":{}}`},
+
+			[]string{"c2", "2012-01-01T00:00:00Z", `{"data":{"gender":"f", "price":30}}`},
+		})
+
+		query := `{"steps":[{"type":"selection","dimensions":["gender"],"fields":[{"name":"count","expression":"count()"},{"name":"sum","expression":"sum(price)"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"gender":{"f":{"count":1,"sum":30},"m":{"count":5,"sum":330}}}`+"\n", "POST /tables/:name/query failed.")
+		query = `{"steps":[{"type":"selection","dimensions":["gender"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"gender":{"f":{"count":1},"m":{"count":5}}}`+"\n", "POST /tables/:name/query failed.")
+
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/c0/events", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"gender":"m","price":100},"timestamp":"2012-01-01T00:00:00Z"},{"data":{"price":200},"timestamp":"2012-01-01T00:00:01Z"},{"data":{"price":10},"timestamp":"2012-01-01T00:00:02Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events failed.")
+	})
+}
@@ -0,0 +1,64 @@
+package skyd
+
+import (
+	"fmt"
+	"github.com/gorilla/mux"
+	"net/http"
+	"strconv"
+	"time"
+)
+
+func (s *Server) addReplicationHandlers() {
+	s.ApiHandleFunc("/replication/tables", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.replicationTablesHandler(w, req, params)
+	}).Methods("GET")
+	s.ApiHandleFunc("/replication/{source}", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.replicationChangesHandler(w, req, params)
+	}).Methods("GET")
+}
+
+// GET /replication/tables
+//
+// Lists the schema of every table for replicas to copy.
+func (s *Server) replicationTablesHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	return s.replicaTables()
+}
+
+// GET /replication/:source
+//
+// Streams the changes committed to the factors database ("factors") or to a
+// servlet (its index) after "?after=<seq>" in the log with "?epoch=<epoch>".
+// The first msgpack record has the log's epoch, whether the replica has to
+// start over and the server's servlet count. Each record after it is a
+// batch of changes. Replicas that have to start over are sent every key as
+// of a snapshot and only the last record has a position. Requests that are
+// caught up wait up to "?wait=<ms>" for a change.
+func (s *Server) replicationChangesHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	options := req.URL.Query()
+	var seq uint64
+	if options.Get("after") != "" {
+		var err error
+		if seq, err = strconv.ParseUint(options.Get("after"), 10, 64); err != nil {
+			return nil, fmt.Errorf("skyd.Server: Invalid replication position: %s", options.Get("after"))
+		}
+	}
+	var wait time.Duration
+	if options.Get("wait") != "" {
+		ms, err := strconv.Atoi(options.Get("wait"))
+		if err != nil || ms < 0 {
+			return nil, fmt.Errorf("skyd.Server: Invalid replication wait: %s", options.Get("wait"))
+		}
+		wait = time.Duration(ms) * time.Millisecond
+	}
+
+	stream := &queryStreamWriter{w: w, msgpack: true}
+	err := s.writeChanges(vars["source"], options.Get("epoch"), seq, wait, stream)
+
+	// Errors before anything is written are returned normally.
+	if err != nil && !stream.started {
+		return nil, err
+	}
+	stream.start()
+	return nil, &StreamedResponseError{err}
+}
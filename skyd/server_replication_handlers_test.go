@@ -0,0 +1,68 @@
+package skyd
+
+import (
+	"fmt"
+	"io/ioutil"
+	"os"
+	"testing"
+	"time"
+)
+
+// Ensure that a replica copies the tables, factors and events of its
+// primary and keeps up with later writes.
+func TestServerReplication(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"grape"}}`},
+		})
+
+		path, _ := ioutil.TempDir("", "")
+		defer os.RemoveAll(path)
+		replica := NewServer(8587, path)
+		replica.Silence()
+		replica.SetReplicationOptions(ReplicationOptions{Primary: "localhost:8586"})
+		replica.ListenAndServe(nil)
+		defer replica.Shutdown()
+
+		query := `{"steps":[{"type":"selection","dimensions":["fruit"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		waitForReplica(t, query, `{"fruit":{"apple":{"count":1},"grape":{"count":1}}}`)
+
+		setupTestData(t, "foo", [][]string{
+			[]string{"a2", "2012-01-01T00:00:00Z", `{"data":{"fruit":"kiwi"}}`},
+		})
+		resp, _ := sendTestHttpRequest("DELETE", "http://localhost:8586/tables/foo/objects/a0/events", "application/json", "")
+		resp.Body.Close()
+		waitForReplica(t, query, `{"fruit":{"grape":{"count":1},"kiwi":{"count":1}}}`)
+	})
+}
+
+// Polls the replica on port 8587 until a query returns the expected result.
+func waitForReplica(t *testing.T, query string, expected string) {
+	var body string
+	for i := 0; i < 50; i++ {
+		resp, err := sendTestHttpRequest("POST", "http://localhost:8587/tables/foo/query", "application/json", query)
+		if err == nil {
+			b, _ := ioutil.ReadAll(resp.Body)
+			resp.Body.Close()
+			if body = string(b); resp.StatusCode == 200 && body == expected+"\n" {
+				return
+			}
+		}
+		time.Sleep(100 * time.Millisecond)
+	}
+	t.Fatalf("Replica didn't catch up:\nexp: %s\ngot: %s", expected, body)
+}
+
+// Ensure that invalid replication sources are rejected.
+func TestServerReplicationInvalidSource(t *testing.T) {
+	runTestServer(func(s *Server) {
+		resp, _ := sendTestHttpRequest("GET", fmt.Sprintf("http://localhost:8586/replication/%d", len(s.servlets)), "application/json", "")
+		resp.Body.Close()
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected an invalid source to fail: %v", resp.StatusCode)
+		}
+	})
+}
@@ -2,8 +2,10 @@ package skyd
 
 import (
 	"errors"
+	"fmt"
 	"github.com/gorilla/mux"
 	"net/http"
+	"strconv"
 )
 
 func (s *Server) addTableHandlers() {
@@ -16,9 +18,42 @@ func (s *Server) addTableHandlers() {
 	s.ApiHandleFunc("/tables", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
 		return s.createTableHandler(w, req, params)
 	}).Methods("POST")
+	s.ApiHandleFunc("/tables/{name}", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.updateTableHandler(w, req, params)
+	}).Methods("PATCH")
 	s.ApiHandleFunc("/tables/{name}", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
 		return s.deleteTableHandler(w, req, params)
 	}).Methods("DELETE")
+	s.ApiHandleFunc("/tables/{name}/freeze", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.freezeTableHandler(w, req, params)
+	}).Methods("POST")
+	s.ApiHandleFunc("/tables/{name}/statistics", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.getTableStatisticsHandler(w, req, params)
+	}).Methods("GET")
+	s.ApiHandleFunc("/tables/{name}/statistics", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.analyzeTableHandler(w, req, params)
+	}).Methods("POST")
+	s.ApiHandleFunc("/tables/{name}/hot", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.getHotObjectsHandler(w, req, params)
+	}).Methods("GET")
+	s.ApiHandleFunc("/tables/{name}/compact", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.getTableCompactionHandler(w, req, params)
+	}).Methods("GET")
+	s.ApiHandleFunc("/tables/{name}/compact", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.compactTableHandler(w, req, params)
+	}).Methods("POST")
+	s.ApiHandleFunc("/tables/{name}/compact", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.cancelTableCompactionHandler(w, req, params)
+	}).Methods("DELETE")
+	s.ApiHandleFunc("/tables/{name}/fork", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.forkTableHandler(w, req, params)
+	}).Methods("POST")
+	s.ApiStreamHandleFunc("/tables/{name}/dump", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.dumpTableHandler(w, req, params)
+	}).Methods("GET")
+	s.ApiStreamHandleFunc("/tables/{name}/restore", func(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+		return s.restoreTableHandler(w, req, params)
+	}).Methods("POST")
 }
 
 // GET /tables
@@ -41,21 +76,148 @@ func (s *Server) createTableHandler(w http.ResponseWriter, req *http.Request, pa
 	}
 
 	// Return an error if the table already exists.
-	table, err := s.OpenTable(tableName)
+	table, _ := s.OpenTable(tableName)
 	if table != nil {
 		return nil, errors.New("Table already exists.")
 	}
 
-	// Otherwise create it.
-	table = NewTable(tableName, s.TablePath(tableName))
-	err = table.Create()
+	// Otherwise create it. Object keys use the msgpack format by default.
+	keyFormat, _ := params["keyFormat"].(string)
+	table, err := s.CreateTable(tableName, keyFormat)
 	if err != nil {
 		return nil, err
 	}
+	if value, ok := params["reorderWindow"]; ok {
+		if err = setTableReorderWindow(table, value); err != nil {
+			return nil, err
+		}
+	}
+	if value, ok := params["retention"]; ok {
+		if err = s.setTableRetention(table, value); err != nil {
+			return nil, err
+		}
+	}
+	if value, ok := params["storage"]; ok {
+		if err = setTableStorage(table, value); err != nil {
+			return nil, err
+		}
+	}
+	if value, ok := params["memoryLimit"]; ok {
+		if err = setTableMemoryLimit(table, value); err != nil {
+			return nil, err
+		}
+	}
+	if value, ok := params["compaction"]; ok {
+		if err = setTableCompaction(table, value); err != nil {
+			return nil, err
+		}
+	}
+	if value, ok := params["compression"]; ok {
+		if err = setTableCompression(table, value); err != nil {
+			return nil, err
+		}
+	}
+	return table, nil
+}
 
+// PATCH /tables/:name
+func (s *Server) updateTableHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	if value, ok := params["reorderWindow"]; ok {
+		if err = setTableReorderWindow(table, value); err != nil {
+			return nil, err
+		}
+	}
+	if value, ok := params["retention"]; ok {
+		if err = s.setTableRetention(table, value); err != nil {
+			return nil, err
+		}
+	}
+	if value, ok := params["memoryLimit"]; ok {
+		if err = setTableMemoryLimit(table, value); err != nil {
+			return nil, err
+		}
+	}
 	return table, nil
 }
 
+// Sets the storage of a new table from a request parameter and saves it.
+// Tables can't be moved between storages once they're created.
+func setTableStorage(table *Table, value interface{}) error {
+	storage, ok := value.(string)
+	if !ok {
+		return fmt.Errorf("Invalid 'storage': %v", value)
+	}
+	if err := table.SetStorage(storage); err != nil {
+		return err
+	}
+	return table.SaveMeta()
+}
+
+// Sets the compaction of a new separate table from a request parameter and
+// saves it.
+func setTableCompaction(table *Table, value interface{}) error {
+	compaction, ok := value.(string)
+	if !ok || table.Storage != SeparateTableStorage {
+		return fmt.Errorf("Invalid 'compaction': %v", value)
+	}
+	if err := table.SetCompaction(compaction); err != nil {
+		return err
+	}
+	return table.SaveMeta()
+}
+
+// Sets the compression of a new separate table from a request parameter and
+// saves it.
+func setTableCompression(table *Table, value interface{}) error {
+	compression, ok := value.(string)
+	if !ok || table.Storage != SeparateTableStorage {
+		return fmt.Errorf("Invalid 'compression': %v", value)
+	}
+	if err := table.SetCompression(compression); err != nil {
+		return err
+	}
+	return table.SaveMeta()
+}
+
+// Sets the memory limit of a table in megabytes from a request parameter
+// and saves it.
+func setTableMemoryLimit(table *Table, value interface{}) error {
+	limit, ok := value.(float64)
+	if !ok || limit != float64(int(limit)) {
+		return fmt.Errorf("Invalid 'memoryLimit': %v", value)
+	}
+	if err := table.SetMemoryLimit(int(limit)); err != nil {
+		return err
+	}
+	return table.SaveMeta()
+}
+
+// Sets the reorder window of a table from a request parameter and saves it.
+func setTableReorderWindow(table *Table, value interface{}) error {
+	window, ok := value.(float64)
+	if !ok || window != float64(int(window)) {
+		return fmt.Errorf("Invalid 'reorderWindow': %v", value)
+	}
+	if err := table.SetReorderWindow(int(window)); err != nil {
+		return err
+	}
+	return table.SaveMeta()
+}
+
+// Sets the retention of a table in seconds from a request parameter.
+func (s *Server) setTableRetention(table *Table, value interface{}) error {
+	retention, ok := value.(float64)
+	if !ok || retention != float64(int(retention)) {
+		return fmt.Errorf("Invalid 'retention': %v", value)
+	}
+	return s.SetTableRetention(table, int(retention))
+}
+
 // DELETE /tables/:name
 func (s *Server) deleteTableHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
 	vars := mux.Vars(req)
@@ -63,3 +225,176 @@ func (s *Server) deleteTableHandler(w http.ResponseWriter, req *http.Request, pa
 
 	return nil, s.DeleteTable(tableName)
 }
+
+// POST /tables/:name/freeze
+func (s *Server) freezeTableHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	before, err := parseQueryTime(params["before"])
+	if err != nil {
+		return nil, fmt.Errorf("Invalid 'before': %v", params["before"])
+	}
+
+	count, err := s.FreezeTable(vars["name"], before)
+	if err != nil {
+		return nil, err
+	}
+	return map[string]interface{}{"count": count}, nil
+}
+
+// POST /tables/:name/fork
+//
+// Creates a table named "name" that starts out with a copy of a separate
+// table's data.
+func (s *Server) forkTableHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	name, ok := params["name"].(string)
+	if !ok {
+		return nil, errors.New("Table name required.")
+	}
+	return s.ForkTable(vars["name"], name)
+}
+
+// GET /tables/:name/statistics
+//
+// Returns the statistics kept for the table: the number of "events", the
+// "timeRange" and event count of each of the "months" they cover, and the
+// "count", estimated "distinct" values and "frequent" values of each of the
+// "properties". Tables that have been analyzed also have the number of
+// "objects" and the distribution of "objectEvents".
+func (s *Server) getTableStatisticsHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	return table.Statistics().Serialize(table, s.factors)
+}
+
+// GET /tables/:name/hot
+//
+// Lists the objects of the table that the most events and bytes were
+// written to and the most events were scanned from, and its most frequent
+// property values. "?count=n" sets the number of objects in each list.
+func (s *Server) getHotObjectsHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	n := DefaultHotObjectCount
+	if value := req.URL.Query().Get("count"); value != "" {
+		if n, err = strconv.Atoi(value); err != nil || n <= 0 {
+			return nil, fmt.Errorf("skyd.Server: Invalid hot object count: %s", value)
+		}
+	}
+	return s.HotObjects(table, n)
+}
+
+// GET /tables/:name/compact
+//
+// Returns the progress of the last compaction of the table.
+func (s *Server) getTableCompactionHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	c := s.TableCompaction(table)
+	if c == nil {
+		return nil, fmt.Errorf("skyd.Server: Table hasn't been compacted: %s", table.Name)
+	}
+	return c, nil
+}
+
+// POST /tables/:name/compact
+//
+// Starts compacting the table's keys on the servlet at {"servlet":N}, or on
+// every servlet if it isn't given, and returns its progress. The compaction
+// is paced to {"rate":N} bytes a second if given and only runs during the
+// server's compaction window if {"offPeak":true}.
+func (s *Server) compactTableHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	servlet, rate := -1, 0
+	for _, name := range []string{"servlet", "rate"} {
+		if params[name] == nil {
+			continue
+		}
+		value, ok := params[name].(float64)
+		if !ok || value < 0 || value != float64(int(value)) {
+			return nil, fmt.Errorf("Invalid '%s': %v", name, params[name])
+		}
+		if name == "servlet" {
+			servlet = int(value)
+		} else {
+			rate = int(value)
+		}
+	}
+	offPeak, ok := params["offPeak"].(bool)
+	if !ok && params["offPeak"] != nil {
+		return nil, fmt.Errorf("Invalid 'offPeak': %v", params["offPeak"])
+	}
+	return s.CompactTable(table, servlet, rate, offPeak)
+}
+
+// DELETE /tables/:name/compact
+//
+// Cancels the compaction of the table and returns its progress.
+func (s *Server) cancelTableCompactionHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	c := s.CancelTableCompaction(table)
+	if c == nil {
+		return nil, fmt.Errorf("skyd.Server: Table isn't being compacted: %s", table.Name)
+	}
+	return c, nil
+}
+
+// POST /tables/:name/statistics
+//
+// Analyzes every object of the table to rebuild its statistics and returns
+// them.
+func (s *Server) analyzeTableHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	if err = s.AnalyzeTable(table); err != nil {
+		return nil, err
+	}
+	return table.Statistics().Serialize(table, s.factors)
+}
+
+// GET /tables/:name/dump
+//
+// Streams a dump of the table's schema, factors and stored keys that can be
+// restored on another server with POST /tables/:name/restore.
+func (s *Server) dumpTableHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	table, err := s.OpenTable(vars["name"])
+	if err != nil {
+		return nil, err
+	}
+	if err = s.checkTableDump(table); err != nil {
+		return nil, err
+	}
+	w.Header().Set("Content-Type", "application/octet-stream")
+	w.WriteHeader(http.StatusOK)
+	return nil, &StreamedResponseError{s.DumpTable(table, w)}
+}
+
+// POST /tables/:name/restore
+//
+// Creates the table from a dump in the request body. The server must place
+// objects on servlets the same way as the one that wrote the dump.
+func (s *Server) restoreTableHandler(w http.ResponseWriter, req *http.Request, params map[string]interface{}) (interface{}, error) {
+	vars := mux.Vars(req)
+	return s.RestoreTable(vars["name"], req.Body)
+}
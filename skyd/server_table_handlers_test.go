@@ -1,9 +1,14 @@
 package skyd
 
 import (
+	"encoding/json"
 	"fmt"
+	"io/ioutil"
 	"os"
+	"path/filepath"
+	"strings"
 	"testing"
+	"time"
 )
 
 // Ensure that we can retrieve a list of all available tables on the server.
@@ -51,6 +56,191 @@ func TestServerCreateTable(t *testing.T) {
 	})
 }
 
+// Ensure that tables with hashed keys store and query their objects.
+func TestServerHashedKeyTable(t *testing.T) {
+	runTestServer(func(s *Server) {
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables", "application/json", `{"name":"foo","keyFormat":"hashed"}`)
+		assertResponse(t, resp, 200, `{"name":"foo","keyFormat":"hashed"}`+"\n", "POST /tables failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables", "application/json", `{"name":"bar","keyFormat":"hashed"}`)
+		assertResponse(t, resp, 200, `{"name":"bar","keyFormat":"hashed"}`+"\n", "POST /tables failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables", "application/json", `{"name":"baz","keyFormat":"sorted"}`)
+		resp.Body.Close()
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected invalid key format to fail, got %v", resp.StatusCode)
+		}
+		if table, _ := s.OpenTable("bar"); table.Id() != 2 {
+			t.Fatalf("Unexpected table id: %v", table.Id())
+		}
+
+		setupTestProperty("foo", "fruit", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a0", "2012-01-01T00:00:01Z", `{"data":{"fruit":"grape"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"orange"}}`},
+		})
+		setupTestProperty("bar", "fruit", false, "string")
+		setupTestData(t, "bar", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"pear"}}`},
+		})
+
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/a0/events", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"fruit":"apple"},"timestamp":"2012-01-01T00:00:00Z"},{"data":{"fruit":"grape"},"timestamp":"2012-01-01T00:00:01Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events failed.")
+
+		query := `{
+			"steps":[
+				{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}
+			]
+		}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":3}`+"\n", "POST /tables/:name/query failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/bar/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":1}`+"\n", "POST /tables/:name/query failed.")
+	})
+}
+
+// Ensure that the reorder window of a table can be set and is kept.
+func TestServerTableReorderWindow(t *testing.T) {
+	runTestServer(func(s *Server) {
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables", "application/json", `{"name":"foo","reorderWindow":100}`)
+		assertResponse(t, resp, 200, `{"name":"foo","reorderWindow":100}`+"\n", "POST /tables failed.")
+		resp, _ = sendTestHttpRequest("PATCH", "http://localhost:8586/tables/foo", "application/json", `{"reorderWindow":-1}`)
+		resp.Body.Close()
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected invalid reorder window to fail, got %v", resp.StatusCode)
+		}
+		resp, _ = sendTestHttpRequest("PATCH", "http://localhost:8586/tables/foo", "application/json", `{"reorderWindow":250}`)
+		assertResponse(t, resp, 200, `{"name":"foo","reorderWindow":250}`+"\n", "PATCH /tables/:name failed.")
+		table := NewTable("foo", s.TablePath("foo"))
+		if err := table.loadMeta(); err != nil || table.ReorderWindow != 250 {
+			t.Fatalf("Reorder window not saved: %v, %v", table.ReorderWindow, err)
+		}
+
+		// Out of order events are sorted before they're read.
+		setupTestProperty("foo", "fruit", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:01Z", `{"data":{"fruit":"grape"}}`},
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+		})
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/a0/events", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"fruit":"apple"},"timestamp":"2012-01-01T00:00:00Z"},{"data":{"fruit":"grape"},"timestamp":"2012-01-01T00:00:01Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events failed.")
+	})
+}
+
+// Ensure that memory tables store and read their events without writing
+// them to disk.
+func TestServerMemoryTable(t *testing.T) {
+	runTestServer(func(s *Server) {
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables", "application/json", `{"name":"foo","storage":"memory","memoryLimit":64}`)
+		assertResponse(t, resp, 200, `{"name":"foo","storage":"memory","memoryLimit":64}`+"\n", "POST /tables failed.")
+		resp, _ = sendTestHttpRequest("PATCH", "http://localhost:8586/tables/foo", "application/json", `{"memoryLimit":128}`)
+		assertResponse(t, resp, 200, `{"name":"foo","storage":"memory","memoryLimit":128}`+"\n", "PATCH /tables/:name failed.")
+
+		setupTestProperty("foo", "fruit", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a0", "2012-01-01T00:00:01Z", `{"data":{"fruit":"grape"}}`},
+		})
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/a0/events", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"fruit":"apple"},"timestamp":"2012-01-01T00:00:00Z"},{"data":{"fruit":"grape"},"timestamp":"2012-01-01T00:00:01Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events failed.")
+		filepath.Walk(s.Path(), func(path string, info os.FileInfo, err error) error {
+			if err == nil && info.IsDir() && info.Name() == memoryStoreDir {
+				t.Fatalf("Memory table written to disk: %v", path)
+			}
+			return nil
+		})
+
+		// Writes fail once the table takes up its limit.
+		table, _ := s.OpenTable("foo")
+		table.SetMemoryLimit(1)
+		value := strings.Repeat("x", 4096)
+		var err error
+		for i := 0; i < 1000 && err == nil; i++ {
+			err = s.servlets[0].PutEvent(table, "a1", NewEvent(fmt.Sprintf("2012-01-01T00:%02d:%02dZ", i/60, i%60), map[int64]interface{}{1: value}), true)
+		}
+		if err != errMemoryTableFull {
+			t.Fatalf("Expected memory table to fill up, got %v", err)
+		}
+	})
+}
+
+// Ensure that separate tables are kept in stores of their own that are
+// removed along with the table.
+func TestServerSeparateTable(t *testing.T) {
+	runTestServer(func(s *Server) {
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables", "application/json", `{"name":"foo","storage":"separate","compaction":"tiered","compression":"zstd"}`)
+		assertResponse(t, resp, 200, `{"name":"foo","storage":"separate","compaction":"tiered","compression":"zstd"}`+"\n", "POST /tables failed.")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables", "application/json", `{"name":"bar","compression":"zstd"}`)
+		resp.Body.Close()
+		if resp.StatusCode == 200 {
+			t.Fatalf("Expected compression of a table without a store to fail.")
+		}
+
+		setupTestProperty("foo", "fruit", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a0", "2012-01-01T00:00:01Z", `{"data":{"fruit":"grape"}}`},
+		})
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/a0/events", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"fruit":"apple"},"timestamp":"2012-01-01T00:00:00Z"},{"data":{"fruit":"grape"},"timestamp":"2012-01-01T00:00:01Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events failed.")
+		stores := 0
+		for _, servlet := range s.servlets {
+			if _, err := os.Stat(filepath.Join(servlet.path, separateStoreDir, "foo")); err == nil {
+				stores++
+			}
+		}
+		if stores != 1 {
+			t.Fatalf("Expected one separate store, got %d", stores)
+		}
+
+		resp, _ = sendTestHttpRequest("DELETE", "http://localhost:8586/tables/foo", "application/json", "")
+		assertResponse(t, resp, 200, "", "DELETE /tables/:name failed.")
+		for _, servlet := range s.servlets {
+			if _, err := os.Stat(filepath.Join(servlet.path, separateStoreDir, "foo")); !os.IsNotExist(err) {
+				t.Fatalf("Separate store not removed: %v", servlet.path)
+			}
+		}
+	})
+}
+
+// Ensure that a fork of a separate table starts with its data and that
+// writes to either don't show up in the other.
+func TestServerForkTable(t *testing.T) {
+	runTestServer(func(s *Server) {
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables", "application/json", `{"name":"foo","storage":"separate"}`)
+		resp.Body.Close()
+		setupTestProperty("foo", "fruit", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"pear"}}`},
+		})
+
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/fork", "application/json", `{"name":"bar"}`)
+		assertResponse(t, resp, 200, `{"name":"bar","storage":"separate"}`+"\n", "POST /tables/:name/fork failed.")
+		setupTestData(t, "bar", [][]string{
+			[]string{"a0", "2012-01-02T00:00:00Z", `{"data":{"fruit":"grape"}}`},
+		})
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/bar/objects/a0/events", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"fruit":"apple"},"timestamp":"2012-01-01T00:00:00Z"},{"data":{"fruit":"grape"},"timestamp":"2012-01-02T00:00:00Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events failed.")
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/objects/a0/events", "application/json", "")
+		assertResponse(t, resp, 200, `[{"data":{"fruit":"apple"},"timestamp":"2012-01-01T00:00:00Z"}]`+"\n", "GET /tables/:name/objects/:objectId/events failed.")
+
+		// Deleting the original leaves the fork's data.
+		resp, _ = sendTestHttpRequest("DELETE", "http://localhost:8586/tables/foo", "application/json", "")
+		assertResponse(t, resp, 200, "", "DELETE /tables/:name failed.")
+		query := `{"steps":[{"type":"selection","dimensions":["fruit"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/bar/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"fruit":{"apple":{"count":1},"grape":{"count":1},"pear":{"count":1}}}`+"\n", "POST /tables/:name/query failed.")
+
+		// Tables in the servlets' databases can't be forked.
+		setupTestTable("baz")
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/baz/fork", "application/json", `{"name":"qux"}`)
+		resp.Body.Close()
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected fork of a shared table to fail: %d", resp.StatusCode)
+		}
+	})
+}
+
 // Ensure that we can delete a table through the server.
 func TestServerDeleteTable(t *testing.T) {
 	runTestServer(func(s *Server) {
@@ -72,3 +262,225 @@ func TestServerDeleteTable(t *testing.T) {
 		}
 	})
 }
+
+// Ensure that statistics are kept as events are written and rebuilt when
+// the table is analyzed.
+func TestServerTableStatistics(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "factor")
+		setupTestProperty("foo", "price", false, "integer")
+		data := make([][]string, 0)
+		apples := 0
+		for i := 0; i < 60; i++ {
+			fruit := fmt.Sprintf("f%d", i)
+			if i%2 == 0 {
+				fruit = "apple"
+			}
+			for j := 0; j <= i%3; j++ {
+				if fruit == "apple" {
+					apples++
+				}
+				data = append(data, []string{fmt.Sprintf("a%d", i), fmt.Sprintf("2012-0%d-01T00:00:00Z", j+1), fmt.Sprintf(`{"data":{"fruit":"%s","price":%d}}`, fruit, i)})
+			}
+		}
+		setupTestData(t, "foo", data)
+
+		var stats map[string]interface{}
+		resp, _ := sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/statistics", "application/json", "")
+		json.NewDecoder(resp.Body).Decode(&stats)
+		resp.Body.Close()
+		fruit, _ := stats["properties"].(map[string]interface{})["fruit"].(map[string]interface{})
+		if stats["events"] != 120.0 || stats["objects"] != nil || fruit == nil {
+			t.Fatalf("Unexpected statistics: %v", stats)
+		}
+		if distinct := fruit["distinct"].(float64); distinct < 30 || distinct > 32 {
+			t.Fatalf("Unexpected distinct fruits: %v", distinct)
+		}
+		if fruit["frequent"].(map[string]interface{})["apple"] != float64(apples) {
+			t.Fatalf("Unexpected frequent fruits: %v", fruit["frequent"])
+		}
+		if months := stats["months"].([]interface{}); len(months) != 3 {
+			t.Fatalf("Unexpected months: %v", months)
+		}
+
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/statistics", "application/json", "")
+		stats = nil
+		json.NewDecoder(resp.Body).Decode(&stats)
+		resp.Body.Close()
+		b, _ := json.Marshal(stats["objectEvents"])
+		if stats["events"] != 120.0 || stats["objects"] != 60.0 || string(b) != `[{"events":1,"objects":20},{"events":2,"objects":40}]` {
+			t.Fatalf("Unexpected analyzed statistics: %v", stats)
+		}
+		if _, err := os.Stat(s.TablePath("foo") + "/statistics"); err != nil {
+			t.Fatalf("Statistics weren't saved: %v", err)
+		}
+		table, _ := s.OpenTable("foo")
+		if n := table.Statistics().EventsInRange(time.Date(2012, 2, 1, 0, 0, 0, 0, time.UTC), time.Time{}); n != 60 {
+			t.Fatalf("Unexpected events in range: %v", n)
+		}
+	})
+}
+
+// Ensure that the objects that most events are written to and scanned from
+// are listed along with the most frequent values.
+func TestServerTableHotObjects(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "factor")
+		data := make([][]string, 0)
+		for i := 0; i < 10; i++ {
+			data = append(data, []string{"bot", fmt.Sprintf("2012-01-01T00:00:%02dZ", i), `{"data":{"fruit":"apple"}}`})
+		}
+		data = append(data, []string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"pear"}}`})
+		data = append(data, []string{"a2", "2012-01-01T00:00:00Z", `{"data":{"fruit":"pear"}}`})
+		setupTestData(t, "foo", data)
+
+		query := `{"steps":[{"type":"selection","dimensions":[],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"count":12}`+"\n", "POST /tables/:name/query failed.")
+
+		var hot struct {
+			Writes     []*HotObject                      `json:"writes"`
+			WriteBytes []*HotObject                      `json:"writeBytes"`
+			Scans      []*HotObject                      `json:"scans"`
+			Values     map[string]map[string]interface{} `json:"values"`
+		}
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/hot?count=2", "application/json", "")
+		if err := json.NewDecoder(resp.Body).Decode(&hot); err != nil {
+			t.Fatalf("Unable to decode hot objects: %v", err)
+		}
+		resp.Body.Close()
+		if len(hot.Writes) != 2 || hot.Writes[0].Id != "bot" || hot.Writes[0].Weight != 10 || hot.Writes[0].Error != 0 {
+			t.Fatalf("Unexpected writes: %v", hot.Writes)
+		}
+		if len(hot.WriteBytes) != 2 || hot.WriteBytes[0].Id != "bot" || hot.WriteBytes[0].Weight <= hot.WriteBytes[1].Weight {
+			t.Fatalf("Unexpected write bytes: %v", hot.WriteBytes)
+		}
+		if len(hot.Scans) != 2 || hot.Scans[0].Id != "bot" || hot.Scans[0].Weight != 10 {
+			t.Fatalf("Unexpected scans: %v", hot.Scans)
+		}
+		if hot.Values["fruit"]["apple"] != 10.0 {
+			t.Fatalf("Unexpected values: %v", hot.Values)
+		}
+
+		resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/hot?count=x", "application/json", "")
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected an invalid count: %d", resp.StatusCode)
+		}
+	})
+}
+
+// Ensure that a table can be compacted in the background and that its
+// progress can be read.
+func TestServerCompactTable(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"pear"}}`},
+		})
+
+		resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/compact", "application/json", `{}`)
+		if resp.StatusCode != 200 {
+			t.Fatalf("Unable to compact table: %d", resp.StatusCode)
+		}
+		resp.Body.Close()
+		var c TableCompaction
+		for i := 0; i < 100; i++ {
+			resp, _ = sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/compact", "application/json", "")
+			if err := json.NewDecoder(resp.Body).Decode(&c); err != nil {
+				t.Fatalf("Unable to decode compaction: %v", err)
+			}
+			resp.Body.Close()
+			if c.EndTime != nil {
+				break
+			}
+			time.Sleep(10 * time.Millisecond)
+		}
+		if c.Table != "foo" || c.Servlet != -1 || c.State != CompactionDone || c.Servlets != len(s.servlets) || c.ServletsDone != c.Servlets {
+			t.Fatalf("Unexpected compaction: %v", c)
+		}
+
+		// The data is still there afterwards.
+		query := `{"steps":[{"type":"selection","dimensions":["fruit"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"fruit":{"apple":{"count":1},"pear":{"count":1}}}`+"\n", "POST /tables/:name/query failed.")
+
+		// Invalid servlets and off-peak compactions without a window fail.
+		for _, body := range []string{`{"servlet":100}`, `{"rate":-1}`, `{"offPeak":true}`} {
+			resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/compact", "application/json", body)
+			if resp.StatusCode != 500 {
+				t.Fatalf("Expected an invalid compaction for %s: %d", body, resp.StatusCode)
+			}
+			resp.Body.Close()
+		}
+	})
+}
+
+// Ensure that a dumped table can be restored after it's deleted.
+func TestServerDumpAndRestoreTable(t *testing.T) {
+	runTestServer(func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"pear"}}`},
+			[]string{"a1", "2012-01-02T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+		})
+
+		resp, _ := sendTestHttpRequest("GET", "http://localhost:8586/tables/foo/dump", "application/json", "")
+		dump, err := ioutil.ReadAll(resp.Body)
+		resp.Body.Close()
+		if err != nil || resp.StatusCode != 200 || !strings.HasPrefix(string(dump), string(tableDumpMagic)) {
+			t.Fatalf("Unable to dump table: %d, %v", resp.StatusCode, err)
+		}
+		resp, _ = sendTestHttpRequest("DELETE", "http://localhost:8586/tables/foo", "application/json", ``)
+		assertResponse(t, resp, 200, "", "DELETE /tables/:name failed.")
+
+		// A corrupt dump is rejected before the table is created.
+		corrupt := append([]byte{}, dump...)
+		corrupt[len(corrupt)-1] ^= 0xff
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/restore", "application/octet-stream", string(corrupt))
+		if resp.StatusCode != 500 {
+			t.Fatalf("Expected a corrupt dump to fail: %d", resp.StatusCode)
+		}
+		resp.Body.Close()
+		if _, err := os.Stat(fmt.Sprintf("%v/tables/foo", s.Path())); !os.IsNotExist(err) {
+			t.Fatalf("Corrupt dump created the table.")
+		}
+
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/restore", "application/octet-stream", string(dump))
+		assertResponse(t, resp, 200, `{"name":"foo"}`+"\n", "POST /tables/:name/restore failed.")
+		query := `{"steps":[{"type":"selection","dimensions":["fruit"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+		assertResponse(t, resp, 200, `{"fruit":{"apple":{"count":2},"pear":{"count":1}}}`+"\n", "POST /tables/:name/query failed.")
+
+		// Existing tables and tables of another name can't be restored.
+		for _, name := range []string{"foo", "bar"} {
+			resp, _ = sendTestHttpRequest("POST", "http://localhost:8586/tables/"+name+"/restore", "application/octet-stream", string(dump))
+			if resp.StatusCode != 500 {
+				t.Fatalf("Expected restoring %s to fail: %d", name, resp.StatusCode)
+			}
+			resp.Body.Close()
+		}
+	})
+}
+
+// Ensure that the time until a compaction window opens is found.
+func TestCompactionWindowWait(t *testing.T) {
+	w, err := ParseCompactionWindow("22:30-04:00")
+	if err != nil {
+		t.Fatalf("Unable to parse window: %v", err)
+	}
+	for clock, wait := range map[string]time.Duration{"23:00": 0, "03:59": 0, "04:00": 18*time.Hour + 30*time.Minute, "22:00": 30 * time.Minute} {
+		now, _ := time.Parse("15:04", clock)
+		if d := w.wait(now); d != wait {
+			t.Fatalf("Unexpected wait at %s: %v", clock, d)
+		}
+	}
+	if _, err := ParseCompactionWindow("4am"); err == nil {
+		t.Fatalf("Expected an invalid window")
+	}
+}
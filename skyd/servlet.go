@@ -9,11 +9,32 @@ import (
 	"io"
 	"io/ioutil"
 	"os"
+	"path/filepath"
+	"runtime"
 	"sort"
+	"strconv"
 	"sync"
+	"sync/atomic"
 	"time"
 )
 
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of msgpack event bytes allowed to accumulate after an object's
+// event block before the object is re-encoded into a single block.
+const eventBlockTailThreshold = 4096
+
+// The maximum number of queued events committed in a single write batch.
+const maxWriteGroupSize = 1024
+
+// The number of locks that the objects of a servlet are striped across.
+// Objects under different locks are read and written concurrently.
+const servletObjectLockCount = 256
+
 //------------------------------------------------------------------------------
 //
 // Typedefs
@@ -22,10 +43,67 @@ import (
 
 // A Servlet is a small wrapper around a single shard of a LevelDB data file.
 type Servlet struct {
-	path    string
-	db      *levigo.DB
-	factors *Factors
-	mutex   sync.Mutex
+	version      uint64
+	parent       *Servlet
+	path         string
+	db           *levigo.DB
+	changes      *changeLog
+	factors      *Factors
+	storage      *storage
+	node         int
+	leveled      bool
+	mutex        sync.RWMutex
+	objectLocks  [servletObjectLockCount]sync.Mutex
+	commitMutex  sync.Mutex
+	eventBlocks  bool
+	writeMutex   sync.Mutex
+	writeQueue   []*servletWrite
+	writing      bool
+	zoneMutex    sync.Mutex
+	zoneMaps     map[string]*zoneMap
+	indexMutex   sync.Mutex
+	indexes      map[string]*factorIndex
+	rollups      *queryRollupSet
+	rollupMutex  sync.Mutex
+	builtRollups map[*QueryRollup]bool
+	statsMutex   sync.Mutex
+	builtStats   map[string]bool
+	frozenMutex  sync.RWMutex
+	frozen       map[string][]*frozenFile
+	frozenSeq    uint64
+	mergeMutex   sync.Mutex
+	mergeRuns    map[string]int
+	objectBuffer ObjectBufferOptions
+	bufferMutex  sync.Mutex
+	buffered     map[string]*bufferedObject
+	bufferedSize int
+	bufferStop   chan bool
+	bufferDone   chan bool
+	heldMutex    sync.Mutex
+	held         map[string]*heldWrites
+
+	partitionMonths int
+	partitionMutex  sync.RWMutex
+	partitions      []*servletPartition
+	storeTable      *Table
+	tableStores     map[string]*servletPartition
+
+	dedup eventDedup
+
+	eventsWritten   metricCounter
+	duplicateEvents metricCounter
+	writeLatency    metricSummary
+}
+
+// A queued event waiting to be committed by PutEvent(). Synced writes
+// aren't acknowledged until the database's log is synced to disk.
+type servletWrite struct {
+	table    *Table
+	objectId string
+	event    *Event
+	replace  bool
+	sync     bool
+	done     chan error
 }
 
 //------------------------------------------------------------------------------
@@ -38,7 +116,84 @@ type Servlet struct {
 func NewServlet(path string, factors *Factors) *Servlet {
 	return &Servlet{
 		path:    path,
+		changes: newChangeLog(),
 		factors: factors,
+		node:    -1,
+	}
+}
+
+//------------------------------------------------------------------------------
+//
+// Properties
+//
+//------------------------------------------------------------------------------
+
+// Whether events are written in the columnar event block format. Objects
+// written in either format can always be read back.
+func (s *Servlet) EventBlocksEnabled() bool {
+	return s.eventBlocks
+}
+
+// Enables or disables writing the columnar event block format.
+func (s *Servlet) SetEventBlocksEnabled(value bool) {
+	s.eventBlocks = value
+}
+
+// The number of months covered by each time partition of the servlet. Zero
+// disables partitioning and writes go to the servlet's own database.
+func (s *Servlet) PartitionMonths() int {
+	return s.partitionMonths
+}
+
+// Sets the number of months covered by each time partition. This should be
+// set before the servlet is opened.
+func (s *Servlet) SetPartitionMonths(value int) {
+	s.partitionMonths = value
+}
+
+// Sets the storage that the servlet's database is opened with. This should
+// be set before the servlet is opened.
+func (s *Servlet) setStorage(st *storage) {
+	s.storage = st
+}
+
+// The NUMA node of the servlet's storage that its database is placed on,
+// or -1 if it isn't placed on one.
+func (s *Servlet) Node() int {
+	return s.node
+}
+
+// Places the servlet's database on a NUMA node of its storage. This should
+// be set before the servlet is opened.
+func (s *Servlet) setNode(node int) {
+	s.node = node
+}
+
+// Whether the servlet's database keeps leveled compaction even if its
+// storage uses tiered compaction.
+func (s *Servlet) LeveledCompaction() bool {
+	return s.leveled
+}
+
+// Keeps the servlet's database on leveled compaction, which reads faster,
+// when its storage uses tiered compaction. Suits cold servlets that take
+// few writes. This should be set before the servlet is opened.
+func (s *Servlet) SetLeveledCompaction(value bool) {
+	s.leveled = value
+}
+
+// The write version of the servlet. It changes whenever data is written to
+// or deleted from the servlet.
+func (s *Servlet) Version() uint64 {
+	return atomic.LoadUint64(&s.version)
+}
+
+// Moves the servlet to a new write version. A partition also moves the
+// servlet it belongs to.
+func (s *Servlet) bumpVersion() {
+	atomic.AddUint64(&s.version, 1)
+	if s.parent != nil {
+		s.parent.bumpVersion()
 	}
 }
 
@@ -52,38 +207,178 @@ func NewServlet(path string, factors *Factors) *Servlet {
 // Lifecycle
 //--------------------------------------
 
-// Opens the underlying LevelDB database and starts the message loop.
+// Opens the underlying LevelDB database and starts the message loop. The
+// memory store of a table is opened in memory and the separate store of a
+// table with the table's options.
 func (s *Servlet) Open() error {
-	err := os.MkdirAll(s.path, 0700)
-	if err != nil {
-		return err
+	var db *levigo.DB
+	var err error
+	if s.inMemory() {
+		db, err = s.storage.openMemory(s.path, s.storeTable.Name)
+	} else if err = os.MkdirAll(s.path, 0700); err == nil && s.storeTable != nil {
+		db, err = s.storage.openSeparate(s.path, s.storeTable, s.node)
+	} else if err == nil {
+		db, err = s.storage.openLeveled(s.path, s.leveled, s.node)
 	}
-
-	opts := levigo.NewOptions()
-	opts.SetCreateIfMissing(true)
-	db, err := levigo.Open(s.path, opts)
 	if err != nil {
-		panic(fmt.Sprintf("skyd.Servlet: Unable to open LevelDB database: %v", err))
+		return fmt.Errorf("skyd.Servlet: Unable to open LevelDB database: %v", err)
 	}
 	s.db = db
 
+	if err = s.openFrozenFiles(); err != nil {
+		return err
+	}
+	if err = s.openPartitions(); err != nil {
+		return err
+	}
+	s.startObjectBuffer()
 	return nil
 }
 
-// Closes the underlying LevelDB database.
+// Closes the underlying LevelDB database. Held events and buffered objects
+// are written first.
 func (s *Servlet) Close() {
+	if s.db != nil {
+		s.releaseTableWrites(nil)
+	}
+	s.stopObjectBuffer()
 	if s.db != nil {
 		s.db.Close()
 	}
+	s.closePartitions()
+	s.closeTableStores()
+	s.closeFrozenFiles()
+	s.zoneMaps = nil
+	s.indexes = nil
+}
+
+// Commits the servlet's held writes and buffered objects and writes the
+// memtables of its database, partitions and separate stores to table files
+// so that their logs are empty when they're closed.
+func (s *Servlet) flush() error {
+	return s.eachPartition(func(servlet *Servlet) error {
+		if servlet.db == nil || servlet.inMemory() {
+			return nil
+		}
+		if err := servlet.releaseTableWrites(nil); err != nil {
+			return err
+		}
+		if err := servlet.flushObjectBuffer(false); err != nil {
+			return err
+		}
+		return flushMemTable(servlet.db)
+	})
+}
+
+// Deletes the files of the servlet's database once it's closed.
+func (s *Servlet) destroy() {
+	if s.inMemory() {
+		s.storage.destroyMemory(s.path, s.storeTable.Name)
+	} else {
+		os.RemoveAll(s.path)
+	}
+}
+
+// Repairs the servlet's database and those of its partitions and separate
+// stores so that they can be opened after their files were corrupted. Some
+// events may be lost. The servlet must not be open.
+func (s *Servlet) Repair() error {
+	if err := s.storage.repair(s.path); err != nil {
+		return fmt.Errorf("skyd.Servlet: Unable to repair LevelDB database: %v", err)
+	}
+	if err := s.repairTableStores(); err != nil {
+		return err
+	}
+	infos, err := ioutil.ReadDir(s.partitionPath())
+	if os.IsNotExist(err) {
+		return nil
+	} else if err != nil {
+		return err
+	}
+	for _, info := range infos {
+		if _, _, ok := parsePartitionName(info.Name()); !info.IsDir() || !ok {
+			continue
+		}
+		if err := s.storage.repair(filepath.Join(s.partitionPath(), info.Name())); err != nil {
+			return fmt.Errorf("skyd.Servlet: Unable to repair partition %s: %v", info.Name(), err)
+		}
+	}
+	return nil
+}
+
+//--------------------------------------
+// Tables
+//--------------------------------------
+
+// Removes every key of a table from the servlet's own database with a
+// single range tombstone, along with its frozen files and zones.
+func (s *Servlet) deleteTable(prefix []byte) error {
+	if err := s.releaseTableWrites(prefix); err != nil {
+		return err
+	}
+	s.Lock()
+	wo := levigo.NewWriteOptions()
+	err := s.changes.deleteRange(s.db, wo, prefix, incrementKey(prefix))
+	wo.Close()
+	s.Unlock()
+	if err != nil {
+		return err
+	}
+
+	if err = s.dropFrozenFiles(prefix); err != nil {
+		return err
+	}
+	s.dropZoneMap(prefix)
+	s.dropFactorIndex(prefix)
+	s.dropRollups(prefix)
+	s.dropTableStats(prefix)
+	s.bumpVersion()
+	return nil
+}
+
+//--------------------------------------
+// Stats
+//--------------------------------------
+
+// Returns the LevelDB statistics of the servlet's database: compaction work
+// per level, write stalls by cause, queued writers, batch group sizes and
+// write latencies, read, write and compaction latency percentiles, and the
+// compaction backlog.
+func (s *Servlet) StorageStats() map[string]interface{} {
+	stats := map[string]interface{}{"path": s.path}
+	if s.db == nil {
+		return stats
+	}
+	stats["compactions"] = s.db.PropertyValue("leveldb.stats")
+	if partitions := s.acquirePartitions(time.Time{}, time.Time{}); len(partitions) > 0 {
+		list := make([]interface{}, 0, len(partitions))
+		for _, p := range partitions {
+			list = append(list, p.servlet.StorageStats())
+		}
+		releasePartitions(partitions)
+		stats["partitions"] = list
+	}
+	stats["writes"] = s.db.PropertyValue("leveldb.write-stats")
+	stats["latency"] = s.db.PropertyValue("leveldb.latency")
+	if n, err := strconv.ParseUint(s.db.PropertyValue("leveldb.compaction-backlog"), 10, 64); err == nil {
+		stats["compactionBacklog"] = n
+	}
+	if n, err := strconv.Atoi(s.db.PropertyValue("leveldb.running-compactions")); err == nil {
+		stats["runningCompactions"] = n
+	}
+	return stats
 }
 
 //--------------------------------------
 // Lock Management
 //--------------------------------------
 
-// Locks the entire servlet.
+// Locks the entire servlet. This waits for the objects being written to be
+// unlocked and keeps any others from being locked until it's unlocked. The
+// objects in the buffer are written so the database holds every object.
 func (s *Servlet) Lock() {
 	s.mutex.Lock()
+	s.flushLockedObjectBuffer()
 }
 
 // Unlocks the entire servlet.
@@ -91,130 +386,577 @@ func (s *Servlet) Unlock() {
 	s.mutex.Unlock()
 }
 
+// Locks the objects with the given encoded ids so they can be read and
+// written without locking the entire servlet. Objects are striped across a
+// fixed number of locks by hash and the locks are taken in order so that
+// callers locking overlapping objects can't deadlock. Returns a function
+// that unlocks them.
+func (s *Servlet) lockObjects(keys [][]byte) func() {
+	stripes := make([]int, 0, len(keys))
+	for _, key := range keys {
+		stripes = append(stripes, objectLockIndex(key))
+	}
+	sort.Ints(stripes)
+	n := 0
+	for i, stripe := range stripes {
+		if i == 0 || stripe != stripes[n-1] {
+			stripes[n] = stripe
+			n++
+		}
+	}
+	stripes = stripes[:n]
+
+	s.mutex.RLock()
+	for _, stripe := range stripes {
+		s.objectLocks[stripe].Lock()
+	}
+	return func() {
+		for i := len(stripes) - 1; i >= 0; i-- {
+			s.objectLocks[stripes[i]].Unlock()
+		}
+		s.mutex.RUnlock()
+	}
+}
+
+// Locks a single object in a table. See lockObjects(). The object's held
+// events and the object itself are written from the buffer so that it can
+// be changed in the database.
+func (s *Servlet) lockObject(table *Table, objectId string) (func(), error) {
+	key, err := table.EncodeObjectId(objectId)
+	if err != nil {
+		return nil, err
+	}
+	if err = s.releaseObjectWrites(key); err != nil {
+		return nil, err
+	}
+	unlock := s.lockObjects([][]byte{key})
+	if err = s.unbufferObjects([][]byte{key}); err != nil {
+		unlock()
+		return nil, err
+	}
+	return unlock, nil
+}
+
+// Adds the changes made by a function to a write batch and commits it. No
+// other changes are committed in between so that zones are stored in the
+// order they're updated.
+func (s *Servlet) commit(fn func(batch *writeBatch) error) error {
+	batch := newWriteBatch()
+	defer batch.Close()
+	s.commitMutex.Lock()
+	defer s.commitMutex.Unlock()
+	if err := fn(batch); err != nil {
+		return err
+	}
+	wo := levigo.NewWriteOptions()
+	defer wo.Close()
+	err := s.changes.write(s.db, wo, batch)
+	s.bumpVersion()
+	return err
+}
+
+//--------------------------------------
+// Key Ranges
+//--------------------------------------
+
+// Splits the keys under a prefix into at most n contiguous ranges of roughly
+// equal size and returns the boundary keys between them. The first range
+// starts at the prefix and the last range runs to the end of the prefix.
+//
+// Candidate boundaries are found by seeking through the distinct two byte
+// continuations of the prefix and the ranges between them are weighted by
+// LevelDB's approximate sizes. Data that's only in the memtable has no size
+// so each candidate range is weighted equally in that case.
+func (s *Servlet) SplitKeyRange(prefix []byte, n int) ([][]byte, error) {
+	if s.db == nil {
+		return nil, fmt.Errorf("Servlet is not open: %v", s.path)
+	}
+	if n <= 1 {
+		return [][]byte{}, nil
+	}
+
+	// Find the distinct two byte continuations of the prefix.
+	ro := levigo.NewReadOptions()
+	ro.SetFillCache(false)
+	setPrefixSameAsStart(ro)
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+
+	candidates := make([][]byte, 0)
+	for iterator.Seek(prefix); iterator.Valid(); {
+		key := iterator.Key()
+		if !bytes.HasPrefix(key, prefix) {
+			break
+		}
+		if len(key) < len(prefix)+2 {
+			iterator.Next()
+			continue
+		}
+		candidate := append([]byte{}, key[:len(prefix)+2]...)
+		candidates = append(candidates, candidate)
+
+		next := incrementKey(candidate)
+		if next == nil {
+			break
+		}
+		iterator.Seek(next)
+	}
+	if len(candidates) < 2 {
+		return [][]byte{}, nil
+	}
+
+	// Weight each candidate range by its approximate size on disk.
+	ranges := make([]levigo.Range, len(candidates))
+	for i, candidate := range candidates {
+		limit := incrementKey(prefix)
+		if i+1 < len(candidates) {
+			limit = candidates[i+1]
+		}
+		ranges[i] = levigo.Range{Start: candidate, Limit: limit}
+	}
+	sizes := s.db.GetApproximateSizes(ranges)
+	var total uint64
+	for _, size := range sizes {
+		total += size
+	}
+	if total == 0 {
+		for i := range sizes {
+			sizes[i] = 1
+		}
+		total = uint64(len(sizes))
+	}
+
+	// Cut wherever the running total crosses the next multiple of 1/n.
+	boundaries := make([][]byte, 0, n-1)
+	var sum uint64
+	for i := 0; i < len(candidates)-1 && len(boundaries) < n-1; i++ {
+		sum += sizes[i]
+		if sum*uint64(n) >= total*uint64(len(boundaries)+1) {
+			boundaries = append(boundaries, candidates[i+1])
+		}
+	}
+
+	return boundaries, nil
+}
+
+// Returns the smallest key that is greater than every key beginning with the
+// given key or nil if no such key exists.
+func incrementKey(key []byte) []byte {
+	next := append([]byte{}, key...)
+	for i := len(next) - 1; i >= 0; i-- {
+		if next[i] < 0xFF {
+			next[i]++
+			return next[:i+1]
+		}
+	}
+	return nil
+}
+
 //--------------------------------------
 // Event Management
 //--------------------------------------
 
 // Adds an event for a given object in a table to a servlet.
+//
+// Concurrent calls are committed together. The first caller to find no
+// commit in progress becomes the leader and writes every queued event in a
+// single LevelDB write batch while the other callers wait for it to finish.
 func (s *Servlet) PutEvent(table *Table, objectId string, event *Event, replace bool) error {
-	s.Lock()
-	defer s.Unlock()
+	return s.PutEvents(table, []string{objectId}, []*Event{event}, replace)
+}
 
-	// Make sure the servlet is open.
-	if s.db == nil {
-		return fmt.Errorf("Servlet is not open: %v", s.path)
-	}
+// Adds a list of events for the given objects in a table to a servlet. The
+// events are queued together so they can be committed in the same group.
+// The first error encountered is returned. Events with an id that was
+// recently written to the servlet are retries and are acknowledged without
+// being written again.
+func (s *Servlet) PutEvents(table *Table, objectIds []string, events []*Event, replace bool) error {
+	return s.putNewEvents(table, objectIds, events, replace, false)
+}
 
-	// Do not allow empty events to be added.
-	if event == nil {
-		return errors.New("skyd.PutEvent: Cannot add nil event")
+// Adds a list of events like PutEvents() but only returns once the
+// database's log has been synced to disk. Synced writes that are committed
+// in the same group share a single sync. They aren't held by the table's
+// reorder window or kept in the object buffer.
+func (s *Servlet) PutDurableEvents(table *Table, objectIds []string, events []*Event, replace bool) error {
+	return s.putNewEvents(table, objectIds, events, replace, true)
+}
+
+// Adds the events that aren't retries of recent writes and remembers their
+// ids once they're written.
+func (s *Servlet) putNewEvents(table *Table, objectIds []string, events []*Event, replace bool, sync bool) error {
+	t := time.Now()
+	objectIds, events, ids := s.dropDuplicateEvents(table, objectIds, events, sync)
+	if len(objectIds) == 0 && len(events) == 0 {
+		return nil
+	}
+	err := s.putEvents(table, objectIds, events, replace, sync)
+	if err == nil {
+		s.dedup.add(ids, sync)
+		s.writeLatency.Observe(time.Since(t))
+		table.observeEvents(events)
 	}
+	return err
+}
 
-	// Check the current state and perform an optimized append if possible.
-	state, data, err := s.GetState(table, objectId)
-	if state == nil || state.Timestamp.Before(event.Timestamp) {
-		return s.appendEvent(table, objectId, event, state, data)
+// Adds a list of events, syncing the database's log before returning if
+// sync is set.
+func (s *Servlet) putEvents(table *Table, objectIds []string, events []*Event, replace bool, sync bool) error {
+	if len(objectIds) != len(events) {
+		return errors.New("skyd.PutEvents: Object and event counts do not match")
 	}
 
-	// Retrieve the events and state for the object.
-	tmp, state, err := s.GetEvents(table, objectId)
-	if err != nil {
+	// Memory tables are written to the servlet's memory store of the table.
+	if p, err := s.acquireTableStoreForWrite(table); err != nil {
+		return err
+	} else if p != nil {
+		defer p.release()
+		err := p.servlet.putEvents(table, objectIds, events, replace, sync)
+		if err == nil {
+			s.eventsWritten.Add(uint64(len(events)))
+		}
 		return err
 	}
 
-	// Remove any event matching the timestamp.
-	found := false
-	state = &Event{Timestamp: event.Timestamp, Data: map[int64]interface{}{}}
-	events := make([]*Event, 0)
-	for _, v := range tmp {
-		// Replace or merge with existing event.
-		if v.Timestamp.Equal(event.Timestamp) {
-			// Dedupe all permanent state.
-			event.Dedupe(state)
-
-			// Replace or merge.
-			if replace {
-				v = event
-			} else {
-				v.Merge(event)
-			}
-			found = true
+	// Do not allow empty events to be added.
+	writes := make([]*servletWrite, len(events))
+	for i, event := range events {
+		if event == nil {
+			return errors.New("skyd.PutEvent: Cannot add nil event")
+		}
+		writes[i] = &servletWrite{table: table, objectId: objectIds[i], event: event, replace: replace, sync: sync, done: make(chan error, 1)}
+	}
+
+	// Partitioned servlets pass the events on to their partitions.
+	if s.partitionMonths > 0 {
+		err := s.putPartitionEvents(table, objectIds, events, replace, sync)
+		if err == nil {
+			s.eventsWritten.Add(uint64(len(events)))
 		}
-		events = append(events, v)
+		return err
+	}
 
-		// Keep track of permanent state.
-		state.MergePermanent(v)
+	// Tables with a reorder window hold their events to be sorted first.
+	// Synced writes are committed after any events of their objects that
+	// are already held.
+	var err error
+	if table.reorderWindow() > 0 && !sync {
+		err = s.holdWrites(writes, table.reorderWindow())
+	} else if err = s.releaseHeldWrites(writes); err == nil {
+		err = s.queueWrites(writes)
 	}
-	// Add the event if it wasn't found.
-	if !found {
-		event.Dedupe(state)
-		events = append(events, event)
-		state.MergePermanent(event)
+	if err == nil {
+		s.eventsWritten.Add(uint64(len(events)))
 	}
+	return err
+}
 
-	// Write events back to the database.
-	err = s.SetEvents(table, objectId, events, state)
-	if err != nil {
-		return err
+// Queues writes, commits them if no other caller is, and waits for them to
+// be committed. The first error encountered is returned.
+func (s *Servlet) queueWrites(writes []*servletWrite) error {
+	s.writeMutex.Lock()
+	s.writeQueue = append(s.writeQueue, writes...)
+	leader := !s.writing
+	s.writing = true
+	s.writeMutex.Unlock()
+	if leader {
+		s.commitWrites()
 	}
 
-	return nil
+	var err error
+	for _, w := range writes {
+		if e := <-w.done; e != nil && err == nil {
+			err = e
+		}
+	}
+	return err
 }
 
-// Appends an event for a given object in a table to a servlet. This should not
-// be called directly but only through PutEvent().
-func (s *Servlet) appendEvent(table *Table, objectId string, event *Event, state *Event, data []byte) error {
-	if state == nil {
-		state = &Event{Data: map[int64]interface{}{}}
+// Commits queued writes in groups until the queue is empty.
+func (s *Servlet) commitWrites() {
+	for {
+		s.writeMutex.Lock()
+		writes := s.writeQueue
+		if len(writes) > maxWriteGroupSize {
+			writes = writes[:maxWriteGroupSize]
+		}
+		s.writeQueue = s.writeQueue[len(writes):]
+		if len(writes) == 0 {
+			s.writeQueue = nil
+			s.writing = false
+			s.writeMutex.Unlock()
+			return
+		}
+		s.writeMutex.Unlock()
+
+		s.commitWriteGroup(writes)
 	}
-	state.Timestamp = event.Timestamp
-	event.Dedupe(state)
-	state.MergePermanent(event)
+}
 
-	// Append new event.
-	buffer := bytes.NewBuffer(data)
-	if err := event.EncodeRaw(buffer); err != nil {
-		return err
+// Applies a group of writes in memory, merging events for the same object so
+// each object is read and written only once, and commits them in a single
+// write batch. The batch is synced if any write in it is. The objects in the group are locked while they're read and
+// written so objects outside of it can be written concurrently, and the
+// objects are read a few at a time. Every write in the group is acknowledged
+// once the batch has been committed.
+func (s *Servlet) commitWriteGroup(writes []*servletWrite) {
+	// Make sure the servlet is open.
+	if s.db == nil {
+		err := fmt.Errorf("Servlet is not open: %v", s.path)
+		for _, w := range writes {
+			w.done <- err
+		}
+		return
 	}
 
-	// Write everything to the database.
-	return s.SetRawEvents(table, objectId, buffer.Bytes(), state)
+	// Group writes by object while keeping their order.
+	keys := make([][]byte, 0)
+	groups := make(map[string][]*servletWrite)
+	for _, w := range writes {
+		encodedObjectId, err := w.table.EncodeObjectId(w.objectId)
+		if err != nil {
+			w.done <- err
+			continue
+		}
+		key := string(encodedObjectId)
+		if _, ok := groups[key]; !ok {
+			keys = append(keys, encodedObjectId)
+		}
+		groups[key] = append(groups[key], w)
+	}
+	unlock := s.lockObjects(keys)
+	defer unlock()
+
+	// Read each object once and apply its events.
+	changes := make([]func(batch *writeBatch) error, len(keys))
+	errs := make([]error, len(keys))
+	indexes := make(chan int, len(keys))
+	for i := range keys {
+		indexes <- i
+	}
+	close(indexes)
+	workers := runtime.NumCPU()
+	if workers > len(keys) {
+		workers = len(keys)
+	}
+	var wg sync.WaitGroup
+	for i := 0; i < workers; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for index := range indexes {
+				changes[index], errs[index] = s.putObjectEvents(keys[index], groups[string(keys[index])])
+			}
+		}()
+	}
+	wg.Wait()
+
+	// Queue the changes in order and commit them. An object that fails
+	// is left out of the batch.
+	batch := newWriteBatch()
+	defer batch.Close()
+	committed := make([]*servletWrite, 0, len(writes))
+	var err error
+	s.commitMutex.Lock()
+	for i, key := range keys {
+		group := groups[string(key)]
+		ops := len(batch.ops)
+		e := errs[i]
+		if e == nil {
+			e = changes[i](batch)
+		}
+		if e != nil {
+			for _, w := range group {
+				w.done <- e
+			}
+			continue
+		}
+		committed = append(committed, group...)
+		group[0].table.hot.addWrite(group[0].objectId, len(group), batch.sizeSince(ops))
+	}
+	if len(committed) > 0 {
+		wo := levigo.NewWriteOptions()
+		for _, w := range committed {
+			if w.sync {
+				wo.SetSync(true)
+				break
+			}
+		}
+		err = s.changes.write(s.db, wo, batch)
+		wo.Close()
+		s.bumpVersion()
+	}
+	s.commitMutex.Unlock()
+
+	// Acknowledge.
+	if err == nil {
+		err = s.splitZones()
+	}
+	for _, w := range committed {
+		w.done <- err
+	}
+}
+
+// Applies a list of writes to a single object and returns a function that
+// adds its changes to a write batch. The function should be called with the
+// commit mutex held. The object should be locked by the caller. Objects in
+// the buffer take the writes in memory and loaded objects are kept in it
+// if it's enabled, unless one of the writes is synced.
+func (s *Servlet) putObjectEvents(encodedObjectId []byte, writes []*servletWrite) (func(batch *writeBatch) error, error) {
+	table := writes[0].table
+	prefix, err := table.Prefix()
+	if err != nil {
+		return nil, err
+	}
+	id := table.storedObjectId(writes[0].objectId)
+	families := table.propertyFamilies()
+	o := s.bufferedObject(encodedObjectId)
+	if o == nil {
+		if fn, err := s.mergeObjectEvents(prefix, encodedObjectId, id, families, writes); fn != nil || err != nil {
+			return fn, err
+		}
+		if o, err = s.loadObject(prefix, encodedObjectId, id, families); err != nil {
+			return nil, err
+		}
+	}
+	synced := false
+	for _, w := range writes {
+		if err = o.putEvent(w.event, w.replace); err != nil {
+			return nil, err
+		}
+		synced = synced || w.sync
+	}
+	return func(batch *writeBatch) error {
+		if s.objectBuffer.Size > 0 {
+			return s.bufferObject(o, synced, batch)
+		}
+		s.resetMergeRun(encodedObjectId)
+		return o.write(batch)
+	}, nil
 }
 
 // Retrieves an event for a given object at a single point in time.
 func (s *Servlet) GetEvent(table *Table, objectId string, timestamp time.Time) (*Event, error) {
-	// Retrieve all events.
-	events, _, err := s.GetEvents(table, objectId)
+	if p, err := s.acquireTableStore(table); err != nil {
+		return nil, err
+	} else if p != nil {
+		defer p.release()
+		return p.servlet.GetEvent(table, objectId, timestamp)
+	}
+	event, err := s.getEvent(table, objectId, timestamp)
+	if event != nil || err != nil {
+		return event, err
+	}
+	p, err := s.acquirePartition(timestamp, false)
+	if p == nil || err != nil {
+		return nil, err
+	}
+	defer p.release()
+	return p.servlet.getEvent(table, objectId, timestamp)
+}
+
+// Retrieves an event from the servlet's own database. Only the chunk that
+// covers the timestamp is read and only the matching event is decoded.
+func (s *Servlet) getEvent(table *Table, objectId string, timestamp time.Time) (*Event, error) {
+	if err := s.unbufferObject(table, objectId); err != nil {
+		return nil, err
+	}
+	o, err := s.getObject(table, objectId)
 	if err != nil {
 		return nil, err
 	}
+	ts := ShiftTime(timestamp)
 
-	// Find an event at a given point in time.
-	for _, v := range events {
-		if v.Timestamp.Equal(timestamp) {
-			return v, nil
+	// Fall back to the frozen files if the object has been frozen.
+	if !o.exists {
+		value := s.getFrozenObject(o.prefix, o.key)
+		if value == nil {
+			return nil, nil
+		}
+		_, data, err := decodeObject(value)
+		if err != nil {
+			return nil, err
 		}
+		return findStreamEvent(data, ts)
 	}
 
-	return nil, nil
+	_, data, err := o.region(ts)
+	if err != nil {
+		return nil, err
+	}
+	event, err := findStreamEvent(data, ts)
+	if event == nil || err != nil {
+		return event, err
+	}
+
+	// Add the values that the object's families hold for the event.
+	for _, f := range o.families {
+		if err = o.loadFamily(f); err != nil {
+			return nil, err
+		}
+		e, err := findStreamEvent(f.data, ts)
+		if err != nil {
+			return nil, err
+		} else if e != nil {
+			event.Merge(e)
+		}
+	}
+	return event, nil
 }
 
-// Removes an event for a given object in a table to a servlet.
+// Removes an event for a given object in a table to a servlet. The event
+// is removed from the servlet's own database and the partition of its
+// timestamp.
 func (s *Servlet) DeleteEvent(table *Table, objectId string, timestamp time.Time) error {
-	s.Lock()
-	defer s.Unlock()
+	if p, err := s.acquireTableStore(table); err != nil {
+		return err
+	} else if p != nil {
+		defer p.release()
+		return p.servlet.DeleteEvent(table, objectId, timestamp)
+	}
+	if err := s.deleteEvent(table, objectId, timestamp); err != nil {
+		return err
+	}
+	p, err := s.acquirePartition(timestamp, false)
+	if p == nil || err != nil {
+		return err
+	}
+	defer p.release()
+	return p.servlet.deleteEvent(table, objectId, timestamp)
+}
 
+// Removes an event for a given object from the servlet's own database.
+func (s *Servlet) deleteEvent(table *Table, objectId string, timestamp time.Time) error {
 	// Make sure the servlet is open.
 	if s.db == nil {
 		return fmt.Errorf("Servlet is not open: %v", s.path)
 	}
+	unlock, err := s.lockObject(table, objectId)
+	if err != nil {
+		return err
+	}
+	defer unlock()
+
+	// Only the chunk that covers the timestamp is rewritten.
+	o, err := s.getObject(table, objectId)
+	if err != nil {
+		return err
+	}
+	if o.exists {
+		removed, err := o.deleteEvent(timestamp)
+		if !removed || err != nil {
+			return err
+		}
+		return s.writeObject(o)
+	}
 
-	// Retrieve the events for the object and append.
-	tmp, _, err := s.GetEvents(table, objectId)
+	// Frozen objects are written back with the rest of their events. The
+	// frozen events are taken out of any rollups that still count them.
+	tmp, _, err := s.getEvents(table, objectId)
 	if err != nil {
 		return err
 	}
-	// Remove any event matching the timestamp.
 	state := &Event{Data: map[int64]interface{}{}}
 	events := make([]*Event, 0)
 	for _, v := range tmp {
@@ -223,38 +965,81 @@ func (s *Servlet) DeleteEvent(table *Table, objectId string, timestamp time.Time
 			state.MergePermanent(v)
 		}
 	}
-
-	// Write events back to the database.
-	err = s.SetEvents(table, objectId, events, state)
-	if err != nil {
+	if len(events) == len(tmp) {
+		return nil
+	}
+	o.removed = tmp
+	if err = o.setEvents(events, state); err != nil {
 		return err
 	}
-
-	return nil
+	return s.writeObject(o)
 }
 
-// Retrieves the state and the remaining serialized event stream for an object.
-func (s *Servlet) GetState(table *Table, objectId string) (*Event, []byte, error) {
+// Retrieves the current state for an object. Only the state is read unless
+// the object was written before states had their own key or it has been
+// frozen.
+func (s *Servlet) GetState(table *Table, objectId string) (*Event, error) {
+	if p, err := s.acquireTableStore(table); err != nil {
+		return nil, err
+	} else if p != nil {
+		defer p.release()
+		return p.servlet.GetState(table, objectId)
+	}
+
 	// Make sure the servlet is open.
 	if s.db == nil {
-		return nil, nil, fmt.Errorf("Servlet is not open: %v", s.path)
+		return nil, fmt.Errorf("Servlet is not open: %v", s.path)
 	}
 
 	// Encode object identifier.
 	encodedObjectId, err := table.EncodeObjectId(objectId)
 	if err != nil {
-		return nil, nil, err
+		return nil, err
+	}
+	if err = s.unbufferObject(table, objectId); err != nil {
+		return nil, err
 	}
 
-	// Retrieve byte array.
 	ro := levigo.NewReadOptions()
-	data, err := s.db.Get(ro, encodedObjectId)
-	ro.Close()
+	defer ro.Close()
+	data, err := s.db.Get(ro, objectStateKey(encodedObjectId))
 	if err != nil {
-		return nil, nil, err
+		return nil, err
 	}
+	var state *Event
+	if data != nil {
+		if state, _, err = decodeObjectState(data); err != nil {
+			return nil, err
+		}
+	} else {
+		// Older objects keep their state in their head.
+		if data, err = s.db.Get(ro, encodedObjectId); err != nil {
+			return nil, err
+		}
 
-	// Decode the events into a slice.
+		// Fall back to the frozen files if the object has been frozen.
+		if data == nil {
+			prefix, err := table.Prefix()
+			if err != nil {
+				return nil, err
+			}
+			data = s.getFrozenObject(prefix, encodedObjectId)
+		}
+
+		if state, _, err = decodeObject(data); err != nil {
+			return nil, err
+		}
+	}
+	if err = takeStoredObjectId(state, table.storedObjectId(objectId)); err != nil {
+		return nil, err
+	}
+	return state, nil
+}
+
+// Splits a stored object value into its state and the serialized event
+// stream that follows it. Heads whose state is stored under its own key
+// have an empty state.
+func decodeObject(data []byte) (*Event, []byte, error) {
 	if data != nil {
 		reader := bytes.NewReader(data)
 
@@ -265,13 +1050,19 @@ func (s *Servlet) GetState(table *Table, objectId string) (*Event, []byte, error
 			return nil, nil, err
 		}
 		if b, ok := raw.(string); ok {
-			state := &Event{}
-			if err = state.DecodeRaw(bytes.NewReader([]byte(b))); err == nil {
-				eventData, _ := ioutil.ReadAll(reader)
-				return state, eventData, nil
-			} else if err != io.EOF {
+			var state *Event
+			if len(b) > 0 {
+				state = &Event{}
+				if err := state.DecodeRaw(bytes.NewReader([]byte(b))); err != nil {
+					return nil, nil, err
+				}
+			}
+			eventData, _ := ioutil.ReadAll(reader)
+			_, eventData, err := splitEventIndex(eventData)
+			if err != nil {
 				return nil, nil, err
 			}
+			return state, eventData, nil
 		} else {
 			return nil, nil, fmt.Errorf("skyd.Servlet: Invalid state: %v", raw)
 		}
@@ -280,36 +1071,235 @@ func (s *Servlet) GetState(table *Table, objectId string) (*Event, []byte, error
 	return nil, []byte{}, nil
 }
 
-// Retrieves a list of events and the current state for a given object in a table.
+// Removes the object id that tables with hashed keys keep in an object's
+// state. Returns an error if the state belongs to a different object whose
+// id hashes to the same key.
+func takeStoredObjectId(state *Event, objectId string) error {
+	if state == nil || objectId == "" {
+		return nil
+	}
+	stored, ok := state.Data[storedObjectIdPropertyId]
+	if !ok {
+		return nil
+	}
+	delete(state.Data, storedObjectIdPropertyId)
+	if stored != objectId {
+		return fmt.Errorf("skyd.Servlet: Object id collides with another object: %s, %v", objectId, stored)
+	}
+	return nil
+}
+
+// Retrieves a list of events and the current state for a given object in a
+// table. The events of every partition are read in time order and their
+// states are merged.
 func (s *Servlet) GetEvents(table *Table, objectId string) ([]*Event, *Event, error) {
-	state, data, err := s.GetState(table, objectId)
+	if p, err := s.acquireTableStore(table); err != nil {
+		return nil, nil, err
+	} else if p != nil {
+		defer p.release()
+		return p.servlet.GetEvents(table, objectId)
+	}
+	if err := s.unbufferObject(table, objectId); err != nil {
+		return nil, nil, err
+	}
+	events, state, err := s.getEvents(table, objectId)
 	if err != nil {
 		return nil, nil, err
 	}
 
-	events := make([]*Event, 0)
-	if data != nil {
-		reader := bytes.NewReader(data)
-		for {
-			// Decode the event and append it to our list.
-			event := &Event{}
-			err = event.DecodeRaw(reader)
-			if err == io.EOF {
-				err = nil
-				break
+	partitions := s.acquirePartitions(time.Time{}, time.Time{})
+	defer releasePartitions(partitions)
+	for _, p := range partitions {
+		if err := p.servlet.unbufferObject(table, objectId); err != nil {
+			return nil, nil, err
+		}
+		e, st, err := p.servlet.getEvents(table, objectId)
+		if err != nil {
+			return nil, nil, err
+		}
+		events = append(events, e...)
+		if st != nil {
+			if state == nil {
+				state = &Event{Data: map[int64]interface{}{}}
 			}
-			if err != nil {
+			state.MergePermanent(st)
+			if st.Timestamp.After(state.Timestamp) {
+				state.Timestamp = st.Timestamp
+			}
+		}
+	}
+	if len(partitions) > 0 {
+		sort.Stable(EventList(events))
+	}
+	return events, state, nil
+}
+
+// Retrieves the serialized event stream of an object in a table in time
+// order. Chunks that only hold events at or before a time aren't read, but
+// the stream may still start with events before it. A zero time reads
+// every event. The events of partitioned servlets are merged and encoded
+// again.
+func (s *Servlet) GetEventData(table *Table, objectId string, after time.Time) ([]byte, error) {
+	if p, err := s.acquireTableStore(table); err != nil {
+		return nil, err
+	} else if p != nil {
+		defer p.release()
+		return p.servlet.GetEventData(table, objectId, after)
+	}
+
+	partitions := s.acquirePartitions(time.Time{}, time.Time{})
+	count := len(partitions)
+	releasePartitions(partitions)
+	if count > 0 {
+		events, _, err := s.GetEvents(table, objectId)
+		if err != nil {
+			return nil, err
+		}
+		var data []byte
+		for _, event := range events {
+			if data, err = event.AppendRaw(data); err != nil {
+				return nil, err
+			}
+		}
+		return data, nil
+	}
+
+	if err := s.unbufferObject(table, objectId); err != nil {
+		return nil, err
+	}
+	o, err := s.getObject(table, objectId)
+	if err != nil {
+		return nil, err
+	}
+	if !o.exists {
+		if value := s.getFrozenObject(o.prefix, o.key); value != nil {
+			_, data, err := decodeObject(value)
+			return data, err
+		}
+	}
+	var data []byte
+	if after.IsZero() {
+		data, err = o.stream()
+	} else {
+		data, err = o.streamAfter(ShiftTime(after))
+	}
+	if err != nil || len(o.families) == 0 {
+		return data, err
+	}
+
+	// Objects with property families have their values merged back in.
+	events, err := DecodeEvents(data)
+	if err != nil {
+		return nil, err
+	}
+	if err = o.mergeFamilies(events); err != nil {
+		return nil, err
+	}
+	data = nil
+	for _, event := range events {
+		if data, err = event.AppendRaw(data); err != nil {
+			return nil, err
+		}
+	}
+	return data, nil
+}
+
+// Retrieves the events and state of an object from the servlet's own
+// database.
+func (s *Servlet) getEvents(table *Table, objectId string) ([]*Event, *Event, error) {
+	o, err := s.getObject(table, objectId)
+	if err != nil {
+		return nil, nil, err
+	}
+	data, err := o.stream()
+	if err != nil {
+		return nil, nil, err
+	}
+
+	// Fall back to the frozen files if the object has been frozen.
+	if !o.exists {
+		if value := s.getFrozenObject(o.prefix, o.key); value != nil {
+			if o.state, data, err = decodeObject(value); err != nil {
+				return nil, nil, err
+			}
+			if err = takeStoredObjectId(o.state, o.id); err != nil {
 				return nil, nil, err
 			}
-			events = append(events, event)
 		}
 	}
 
-	return events, state, nil
+	events, err := DecodeEvents(data)
+	if err != nil {
+		return nil, nil, err
+	}
+	if err = o.mergeFamilies(events); err != nil {
+		return nil, nil, err
+	}
+
+	return events, o.state, nil
+}
+
+// Reads the head and chunk list of an object.
+func (s *Servlet) getObject(table *Table, objectId string) (*servletObject, error) {
+	// Make sure the servlet is open.
+	if s.db == nil {
+		return nil, fmt.Errorf("Servlet is not open: %v", s.path)
+	}
+
+	// Encode object identifier.
+	encodedObjectId, err := table.EncodeObjectId(objectId)
+	if err != nil {
+		return nil, err
+	}
+	prefix, err := table.Prefix()
+	if err != nil {
+		return nil, err
+	}
+
+	return s.loadObject(prefix, encodedObjectId, table.storedObjectId(objectId), table.propertyFamilies())
 }
 
 // Writes a list of events for an object in table.
 func (s *Servlet) SetEvents(table *Table, objectId string, events []*Event, state *Event) error {
+	if p, err := s.acquireTableStoreForWrite(table); err != nil {
+		return err
+	} else if p != nil {
+		defer p.release()
+		return p.servlet.SetEvents(table, objectId, events, state)
+	}
+	unlock, err := s.lockObject(table, objectId)
+	if err != nil {
+		return err
+	}
+	defer unlock()
+	return s.setEvents(table, objectId, events, state)
+}
+
+// Writes a list of events for an object in table. The object should be
+// locked by the caller.
+func (s *Servlet) setEvents(table *Table, objectId string, events []*Event, state *Event) error {
+	o, err := s.getObject(table, objectId)
+	if err != nil {
+		return err
+	}
+	if err = o.setEvents(events, state); err != nil {
+		return err
+	}
+	return s.writeObject(o)
+}
+
+// Writes the changes to an object in a single batch.
+func (s *Servlet) writeObject(o *servletObject) error {
+	if err := s.commit(o.write); err != nil {
+		return err
+	}
+	s.resetMergeRun(o.key)
+	return s.splitZones()
+}
+
+// Sorts and serializes a list of events and returns the state that should be
+// stored with them.
+func (s *Servlet) encodeEvents(events []*Event, state *Event) (*Event, []byte, error) {
 	// Sort the events.
 	sort.Sort(EventList(events))
 
@@ -318,80 +1308,138 @@ func (s *Servlet) SetEvents(table *Table, objectId string, events []*Event, stat
 		if state != nil {
 			state.Timestamp = events[len(events)-1].Timestamp
 		} else {
-			return errors.New("skyd.Servlet: Missing state.")
+			return nil, nil, errors.New("skyd.Servlet: Missing state.")
 		}
 	} else {
 		state = nil
 	}
 
+	data, err := s.encodeEventData(events)
+	if err != nil {
+		return nil, nil, err
+	}
+	return state, data, nil
+}
+
+// Serializes a sorted list of events.
+func (s *Servlet) encodeEventData(events []*Event) ([]byte, error) {
+	// Encode the events as a block if enabled. Fall back to msgpack if any
+	// of the values can't be represented in a block.
+	if s.eventBlocks {
+		block, err := EncodeEventBlock(events)
+		if err != nil {
+			return nil, err
+		}
+		if block != nil {
+			return block, nil
+		}
+	}
+
 	// Encode the events.
-	buffer := new(bytes.Buffer)
+	var data []byte
 	for _, event := range events {
-		err := event.EncodeRaw(buffer)
-		if err != nil {
-			return err
+		var err error
+		if data, err = event.AppendRaw(data); err != nil {
+			return nil, err
 		}
 	}
 
-	// Set the raw bytes.
-	return s.SetRawEvents(table, objectId, buffer.Bytes(), state)
+	return data, nil
 }
 
-// Writes a list of events for an object in table.
+// Writes a serialized event stream for an object in table, replacing all of
+// its existing events.
 func (s *Servlet) SetRawEvents(table *Table, objectId string, data []byte, state *Event) error {
-	// Make sure the servlet is open.
-	if s.db == nil {
-		return fmt.Errorf("Servlet is not open: %v", s.path)
+	if p, err := s.acquireTableStoreForWrite(table); err != nil {
+		return err
+	} else if p != nil {
+		defer p.release()
+		return p.servlet.SetRawEvents(table, objectId, data, state)
 	}
-
-	// Encode object identifier.
-	encodedObjectId, err := table.EncodeObjectId(objectId)
+	unlock, err := s.lockObject(table, objectId)
+	if err != nil {
+		return err
+	}
+	defer unlock()
+	o, err := s.getObject(table, objectId)
 	if err != nil {
 		return err
 	}
+	if err = o.removeAll(); err != nil {
+		return err
+	}
+	for _, chunk := range o.chunks {
+		o.deleted = append(o.deleted, chunk.key)
+	}
+	events, err := DecodeEvents(data)
+	if err != nil {
+		return err
+	}
+	o.chunks, o.state, o.tail, o.added = nil, state, data, events
+	return s.writeObject(o)
+}
 
-	// Encode the state at the beginning.
+// Encodes an object's state and serialized event stream into a single value.
+// The stream's index is stored in between them.
+func encodeObject(state *Event, data []byte) ([]byte, error) {
 	buffer := new(bytes.Buffer)
 	var b []byte
+	var err error
 	if state != nil {
 		if b, err = state.MarshalRaw(); err != nil {
-			return err
+			return nil, err
 		}
 	} else {
 		b = []byte{}
 	}
 	b2, err := msgpack.Marshal(b)
 	if err != nil {
-		return err
+		return nil, err
 	}
 	buffer.Write(b2)
+	b3, err := indexEventStream(data)
+	if err != nil {
+		return nil, err
+	}
+	buffer.Write(b3)
 
-	// Encode the rest of the data.
-	buffer.Write(data)
-
-	// Write bytes to the database.
-	wo := levigo.NewWriteOptions()
-	defer wo.Close()
-	return s.db.Put(wo, encodedObjectId, buffer.Bytes())
+	return buffer.Bytes(), nil
 }
 
-// Deletes all events for a given object in a table.
+// Deletes all events for a given object in a table, including those in
+// every partition.
 func (s *Servlet) DeleteEvents(table *Table, objectId string) error {
-	// Make sure the servlet is open.
-	if s.db == nil {
-		return fmt.Errorf("Servlet is not open: %v", s.path)
-	}
+	return s.eachPartition(func(servlet *Servlet) error {
+		return servlet.deleteEvents(table, objectId)
+	})
+}
 
-	// Encode object identifier.
-	encodedObjectId, err := table.EncodeObjectId(objectId)
+// Deletes all events for a given object from the servlet's own database.
+func (s *Servlet) deleteEvents(table *Table, objectId string) error {
+	unlock, err := s.lockObject(table, objectId)
+	if err != nil {
+		return err
+	}
+	defer unlock()
+	o, err := s.getObject(table, objectId)
 	if err != nil {
 		return err
 	}
 
-	// Delete object from the database.
-	wo := levigo.NewWriteOptions()
-	err = s.db.Delete(wo, encodedObjectId)
-	wo.Close()
-
-	return nil
+	// Delete object and its chunks from the database, taking its events out
+	// of any rollups and the table's counts.
+	if err = o.removeAll(); err != nil {
+		return err
+	}
+	return s.commit(func(batch *writeBatch) error {
+		removed, objects := o.removed, int64(0)
+		if o.exists {
+			objects = -1
+		}
+		o.delete(batch)
+		if err := s.countTableStats(o.prefix, objects, -int64(len(removed)), batch); err != nil {
+			return err
+		}
+		return s.updateRollups(o.prefix, nil, removed, batch)
+	})
 }
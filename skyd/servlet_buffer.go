@@ -0,0 +1,291 @@
+package skyd
+
+import (
+	"bytes"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The default time that a buffered object is kept in memory before it's
+// written.
+const DefaultObjectBufferDelay = 1 * time.Second
+
+// The shortest interval that the object buffer is checked for objects
+// that have been kept longer than the delay.
+const minObjectBufferInterval = 10 * time.Millisecond
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// ObjectBufferOptions controls the in-memory buffer of recently written
+// objects that each servlet keeps. Objects that are loaded to be written are
+// kept in the buffer instead of being written back, and later events for
+// them are applied in memory, so that objects receiving many events in a
+// short time are only written once per flush rather than once per write
+// group. Buffered objects are written when they've been kept longer than
+// the delay, when the buffer is full, and before they're read, queried or
+// the servlet is locked. Writes are acknowledged before their buffered
+// objects are written so events still in the buffer are lost if the
+// process crashes.
+type ObjectBufferOptions struct {
+	// The number of bytes of buffered objects that each servlet keeps in
+	// memory. Objects that don't fit are written right away. Zero disables
+	// the buffer.
+	Size int
+
+	// The longest time that an object is kept in the buffer.
+	Delay time.Duration
+}
+
+// An object kept in a servlet's buffer along with its size and when it was
+// first buffered.
+type bufferedObject struct {
+	object *servletObject
+	size   int
+	since  time.Time
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Objects
+//--------------------------------------
+
+// Returns the number of bytes that a loaded object holds in memory.
+func (o *servletObject) bufferSize() int {
+	size := len(o.key) + len(o.tail)
+	for _, chunk := range o.chunks {
+		size += len(chunk.key) + len(chunk.data)
+	}
+	for _, f := range o.families {
+		size += len(f.key) + len(f.data) + len(f.appended)
+	}
+	return size
+}
+
+//--------------------------------------
+// Servlets
+//--------------------------------------
+
+// The options of the servlet's object buffer.
+func (s *Servlet) ObjectBufferOptions() ObjectBufferOptions {
+	return s.objectBuffer
+}
+
+// Sets the options of the servlet's object buffer. This should be set
+// before the servlet is opened.
+func (s *Servlet) SetObjectBufferOptions(options ObjectBufferOptions) {
+	s.objectBuffer = options
+}
+
+// Starts writing buffered objects once they've been kept longer than the
+// buffer's delay.
+func (s *Servlet) startObjectBuffer() {
+	if s.objectBuffer.Size <= 0 {
+		return
+	}
+	interval := s.objectBuffer.Delay / 2
+	if interval < minObjectBufferInterval {
+		interval = minObjectBufferInterval
+	}
+	s.bufferStop = make(chan bool)
+	s.bufferDone = make(chan bool)
+	go func(stop chan bool, done chan bool) {
+		defer close(done)
+		ticker := time.NewTicker(interval)
+		defer ticker.Stop()
+		for {
+			select {
+			case <-stop:
+				return
+			case <-ticker.C:
+				s.flushObjectBuffer(true)
+			}
+		}
+	}(s.bufferStop, s.bufferDone)
+}
+
+// Stops writing expired objects in the background and writes every object
+// still in the buffer.
+func (s *Servlet) stopObjectBuffer() {
+	if s.bufferStop == nil {
+		return
+	}
+	close(s.bufferStop)
+	<-s.bufferDone
+	s.bufferStop, s.bufferDone = nil, nil
+	s.flushObjectBuffer(false)
+}
+
+// Retrieves the buffered object stored under an encoded object id or nil if
+// it isn't buffered. The object should be locked by the caller.
+func (s *Servlet) bufferedObject(key []byte) *servletObject {
+	s.bufferMutex.Lock()
+	defer s.bufferMutex.Unlock()
+	if b := s.buffered[string(key)]; b != nil {
+		return b.object
+	}
+	return nil
+}
+
+// Keeps an object with changes in the buffer instead of adding them to a
+// write batch. The object is written to the batch instead once it's been
+// kept longer than the delay, if it doesn't fit in the buffer or if it's
+// written by a synced write. It should be called with the commit mutex
+// held and the object locked.
+func (s *Servlet) bufferObject(o *servletObject, synced bool, batch *writeBatch) error {
+	s.bufferMutex.Lock()
+	defer s.bufferMutex.Unlock()
+	key := string(o.key)
+	b := s.buffered[key]
+	size := o.bufferSize()
+	if b == nil {
+		b = &bufferedObject{object: o, since: time.Now()}
+	}
+	if !synced && time.Since(b.since) < s.objectBuffer.Delay && s.bufferedSize-b.size+size <= s.objectBuffer.Size {
+		if s.buffered == nil {
+			s.buffered = make(map[string]*bufferedObject)
+		}
+		s.buffered[key] = b
+		s.bufferedSize += size - b.size
+		b.size = size
+		return nil
+	}
+
+	if s.buffered[key] != nil {
+		delete(s.buffered, key)
+		s.bufferedSize -= b.size
+	}
+	s.resetMergeRun(o.key)
+	return o.write(batch)
+}
+
+// Writes the buffered objects stored under a list of encoded object ids.
+// The objects should be locked by the caller.
+func (s *Servlet) unbufferObjects(keys [][]byte) error {
+	s.bufferMutex.Lock()
+	found := false
+	for _, key := range keys {
+		if s.buffered[string(key)] != nil {
+			found = true
+			break
+		}
+	}
+	s.bufferMutex.Unlock()
+	if !found {
+		return nil
+	}
+	if err := s.commit(func(batch *writeBatch) error {
+		s.bufferMutex.Lock()
+		defer s.bufferMutex.Unlock()
+		for _, key := range keys {
+			if b := s.buffered[string(key)]; b != nil {
+				if err := b.object.write(batch); err != nil {
+					return err
+				}
+			}
+		}
+		return nil
+	}); err != nil {
+		return err
+	}
+
+	// The objects are only taken out once they've been committed.
+	s.bufferMutex.Lock()
+	for _, key := range keys {
+		if b := s.buffered[string(key)]; b != nil {
+			delete(s.buffered, string(key))
+			s.bufferedSize -= b.size
+			s.resetMergeRun(key)
+		}
+	}
+	s.bufferMutex.Unlock()
+	return s.splitZones()
+}
+
+// Writes the held events of an object of a table and the object itself
+// from the buffer before it's read without locking it.
+func (s *Servlet) unbufferObject(table *Table, objectId string) error {
+	key, err := table.EncodeObjectId(objectId)
+	if err != nil {
+		return err
+	}
+	if err = s.releaseObjectWrites(key); err != nil {
+		return err
+	}
+	if s.objectBuffer.Size <= 0 || s.bufferedObject(key) == nil {
+		return nil
+	}
+	unlock := s.lockObjects([][]byte{key})
+	defer unlock()
+	return s.unbufferObjects([][]byte{key})
+}
+
+// Writes the held events and buffered objects of a table prefix before the
+// table is read.
+func (s *Servlet) unbufferTable(prefix []byte) error {
+	if err := s.releaseTableWrites(prefix); err != nil {
+		return err
+	}
+	if s.objectBuffer.Size <= 0 {
+		return nil
+	}
+	keys := s.bufferedKeys(func(b *bufferedObject) bool {
+		return bytes.Equal(b.object.prefix, prefix)
+	})
+	if len(keys) == 0 {
+		return nil
+	}
+	unlock := s.lockObjects(keys)
+	defer unlock()
+	return s.unbufferObjects(keys)
+}
+
+// Writes the objects in the buffer that have been kept longer than the delay
+// or every object if expired is false. Errors leave the objects in the
+// buffer to be written again later.
+func (s *Servlet) flushObjectBuffer(expired bool) error {
+	now := time.Now()
+	keys := s.bufferedKeys(func(b *bufferedObject) bool {
+		return !expired || now.Sub(b.since) >= s.objectBuffer.Delay
+	})
+	if len(keys) == 0 {
+		return nil
+	}
+	unlock := s.lockObjects(keys)
+	defer unlock()
+	return s.unbufferObjects(keys)
+}
+
+// Writes every object in the buffer while the entire servlet is locked so
+// that no object is locked by the caller.
+func (s *Servlet) flushLockedObjectBuffer() error {
+	keys := s.bufferedKeys(func(b *bufferedObject) bool { return true })
+	return s.unbufferObjects(keys)
+}
+
+// Returns the encoded object ids of the buffered objects that match a
+// function.
+func (s *Servlet) bufferedKeys(fn func(b *bufferedObject) bool) [][]byte {
+	s.bufferMutex.Lock()
+	defer s.bufferMutex.Unlock()
+	var keys [][]byte
+	for _, b := range s.buffered {
+		if fn(b) {
+			keys = append(keys, b.object.key)
+		}
+	}
+	return keys
+}
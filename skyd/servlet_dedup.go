@@ -0,0 +1,198 @@
+package skyd
+
+import (
+	"hash/fnv"
+	"sync"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of recently written event ids that each servlet remembers
+// exactly. Each generation of its bloom filter also takes this many ids
+// before it replaces the older one.
+const eventDedupSize = 1 << 16
+
+// The number of bloom filter bits kept per id and the number of probes made
+// for each id, which gives a false positive rate of about 1%.
+const (
+	eventDedupBitsPerId = 10
+	eventDedupProbes    = 7
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// The client-supplied ids of the events recently written to a servlet, kept
+// so that retried writes can be acknowledged without reading and rewriting
+// their objects. Ids are checked against two generations of a bloom filter
+// first so new ids rarely reach the exact cache, and only ids found in the
+// cache are treated as duplicates. The filters and cache are allocated when
+// the first id is added.
+type eventDedup struct {
+	sync.Mutex
+	blooms [2][]uint64
+	count  int
+	recent map[string]bool
+	ring   []string
+	next   int
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// The key that an event id is remembered under. Ids only need to be unique
+// within an object of a table.
+func eventDedupKey(table *Table, objectId string, event *Event) string {
+	return table.Name + "\x00" + objectId + "\x00" + event.Id
+}
+
+// Hashes an id key. The high half is used as the step between probes and is
+// kept odd so the probes don't repeat.
+func eventDedupHash(key string) uint64 {
+	h := fnv.New64a()
+	h.Write([]byte(key))
+	return h.Sum64() | 1<<32
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Servlet
+//--------------------------------------
+
+// Drops the events whose ids were written to the servlet recently, along
+// with repeats of an id within the list, and returns the remaining object
+// ids and events with the keys of their ids. Durable writes are only
+// dropped if the earlier write was durable too. Events without an id are
+// always kept. Concurrent retries of an event may both be written, which
+// is still safe since an event replaces or merges into any with the same
+// timestamp.
+func (s *Servlet) dropDuplicateEvents(table *Table, objectIds []string, events []*Event, durable bool) ([]string, []*Event, []string) {
+	if len(objectIds) != len(events) {
+		return objectIds, events, nil
+	}
+	var keys []string
+	for i, event := range events {
+		if event != nil && event.Id != "" {
+			keys = make([]string, 0, len(events)-i)
+			break
+		}
+	}
+	if keys == nil {
+		return objectIds, events, nil
+	}
+
+	keptIds := make([]string, 0, len(objectIds))
+	kept := make([]*Event, 0, len(events))
+	seen := make(map[string]bool)
+	for i, event := range events {
+		if event != nil && event.Id != "" {
+			key := eventDedupKey(table, objectIds[i], event)
+			if seen[key] || s.dedup.contains(key, durable) {
+				s.duplicateEvents.Add(1)
+				continue
+			}
+			seen[key] = true
+			keys = append(keys, key)
+		}
+		keptIds = append(keptIds, objectIds[i])
+		kept = append(kept, event)
+	}
+	return keptIds, kept, keys
+}
+
+//--------------------------------------
+// Dedup
+//--------------------------------------
+
+// Whether an id was added recently, by a durable write if durable is set.
+func (d *eventDedup) contains(key string, durable bool) bool {
+	h := eventDedupHash(key)
+	d.Lock()
+	defer d.Unlock()
+	if d.recent == nil || !(d.bloomContains(0, h) || d.bloomContains(1, h)) {
+		return false
+	}
+	wasDurable, ok := d.recent[key]
+	return ok && (wasDurable || !durable)
+}
+
+// Adds the ids of written events. Ids of durable writes are marked as such.
+func (d *eventDedup) add(keys []string, durable bool) {
+	if len(keys) == 0 {
+		return
+	}
+	d.Lock()
+	defer d.Unlock()
+	if d.recent == nil {
+		d.blooms[0] = make([]uint64, eventDedupSize*eventDedupBitsPerId/64)
+		d.recent = make(map[string]bool, eventDedupSize)
+		d.ring = make([]string, eventDedupSize)
+	}
+	for _, key := range keys {
+		if wasDurable, ok := d.recent[key]; ok {
+			d.recent[key] = wasDurable || durable
+			continue
+		}
+
+		// Start a new generation once the current one is full.
+		if d.count == eventDedupSize {
+			old := d.blooms[1]
+			if old == nil {
+				old = make([]uint64, len(d.blooms[0]))
+			} else {
+				for i := range old {
+					old[i] = 0
+				}
+			}
+			d.blooms[0], d.blooms[1] = old, d.blooms[0]
+			d.count = 0
+		}
+		h := eventDedupHash(key)
+		bloom := d.blooms[0]
+		bits := uint32(len(bloom) * 64)
+		for i := uint32(0); i < eventDedupProbes; i++ {
+			bit := (uint32(h) + i*uint32(h>>32)) % bits
+			bloom[bit/64] |= 1 << (bit % 64)
+		}
+		d.count++
+
+		// Replace the oldest id in the cache.
+		if old := d.ring[d.next]; old != "" {
+			delete(d.recent, old)
+		}
+		d.ring[d.next] = key
+		d.recent[key] = durable
+		d.next = (d.next + 1) % len(d.ring)
+	}
+}
+
+// Whether a generation of the bloom filter may hold a hash.
+func (d *eventDedup) bloomContains(generation int, h uint64) bool {
+	bloom := d.blooms[generation]
+	if bloom == nil {
+		return false
+	}
+	bits := uint32(len(bloom) * 64)
+	for i := uint32(0); i < eventDedupProbes; i++ {
+		bit := (uint32(h) + i*uint32(h>>32)) % bits
+		if bloom[bit/64]&(1<<(bit%64)) == 0 {
+			return false
+		}
+	}
+	return true
+}
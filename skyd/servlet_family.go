@@ -0,0 +1,335 @@
+package skyd
+
+import (
+	"bytes"
+	"github.com/jmhodges/levigo"
+	"sort"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The byte that follows an object key in the keys of the object's property
+// families, before the family name. It sorts the families after the state.
+//
+// Each family of an object is stored as a single event stream that holds
+// only the values of the family's properties, behind an empty state and an
+// index like a head. Its events share the timestamps of the object's own
+// events. Appends are merged onto the stream without reading it, and it's
+// only loaded when an event of the object is inserted or removed out of
+// order.
+const objectFamilyMarker = 0x02
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// The event stream of one property family of an object.
+type objectFamily struct {
+	key      []byte
+	data     []byte
+	appended []byte
+	loaded   bool
+	dirty    bool
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Generates the key that a property family of an object is stored under.
+func objectFamilyKey(objectKey []byte, family string) []byte {
+	key := make([]byte, len(objectKey)+1+len(family))
+	copy(key, objectKey)
+	key[len(objectKey)] = objectFamilyMarker
+	copy(key[len(objectKey)+1:], family)
+	return key
+}
+
+// Checks if a key is the key of a property family belonging to an object key.
+func isObjectFamilyKey(objectKey []byte, key []byte) bool {
+	return len(key) > len(objectKey)+1 && key[len(objectKey)] == objectFamilyMarker && bytes.HasPrefix(key, objectKey)
+}
+
+// Merges the events of a property family into a time ordered list of
+// events by timestamp. Family events without an event are dropped.
+func mergeFamilyEvents(events []*Event, data []byte) error {
+	family, err := DecodeEvents(data)
+	if err != nil {
+		return err
+	}
+	i := 0
+	for _, f := range family {
+		for i < len(events) && events[i].Timestamp.Before(f.Timestamp) {
+			i++
+		}
+		if i < len(events) && events[i].Timestamp.Equal(f.Timestamp) {
+			events[i].Merge(f)
+		}
+	}
+	return nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Tables
+//--------------------------------------
+
+// Retrieves the family of each property of the table that is stored in one
+// or nil if the table has no property families.
+func (t *Table) propertyFamilies() map[int64]string {
+	if t.propertyFile == nil {
+		return nil
+	}
+	return t.propertyFile.PropertyFamilies()
+}
+
+//--------------------------------------
+// Splitting
+//--------------------------------------
+
+// Splits the values of family properties off an event. Returns the event
+// without them, which is a copy if any were split off, and an event for
+// each family that had values.
+func splitFamilyEvent(event *Event, families map[int64]string) (*Event, map[string]*Event) {
+	if len(families) == 0 {
+		return event, nil
+	}
+	var split map[string]*Event
+	var rest *Event
+	for k, v := range event.Data {
+		family := families[k]
+		if family == "" {
+			continue
+		}
+		if split == nil {
+			split = make(map[string]*Event)
+			rest = &Event{Timestamp: event.Timestamp, Data: make(map[int64]interface{}, len(event.Data))}
+			for k, v := range event.Data {
+				if families[k] == "" {
+					rest.Data[k] = v
+				}
+			}
+		}
+		e := split[family]
+		if e == nil {
+			e = &Event{Timestamp: event.Timestamp, Data: map[int64]interface{}{}}
+			split[family] = e
+		}
+		e.Data[k] = v
+	}
+	if split == nil {
+		return event, nil
+	}
+	return rest, split
+}
+
+//--------------------------------------
+// Loading
+//--------------------------------------
+
+// Returns a family of the object, adding it if the object hasn't stored any
+// of its values yet.
+func (o *servletObject) family(name string) *objectFamily {
+	if o.families == nil {
+		o.families = make(map[string]*objectFamily)
+	}
+	f := o.families[name]
+	if f == nil {
+		f = &objectFamily{key: objectFamilyKey(o.key, name)}
+		o.families[name] = f
+	}
+	return f
+}
+
+// Reads the events of a family if they haven't been read yet. Events
+// appended since the object was loaded are kept after them.
+func (o *servletObject) loadFamily(f *objectFamily) error {
+	if f.loaded {
+		return nil
+	}
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	value, err := o.servlet.db.Get(ro, f.key)
+	if err != nil {
+		return err
+	}
+	_, data, err := decodeObject(value)
+	if err != nil {
+		return err
+	}
+	f.data = append(data, f.appended...)
+	f.dirty = f.dirty || len(f.appended) > 0
+	f.appended, f.loaded = nil, true
+	return nil
+}
+
+// Merges the values of every family of the object into a time ordered list
+// of its events.
+func (o *servletObject) mergeFamilies(events []*Event) error {
+	for _, f := range o.families {
+		if err := o.loadFamily(f); err != nil {
+			return err
+		}
+		if err := mergeFamilyEvents(events, f.data); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+//--------------------------------------
+// Writing
+//--------------------------------------
+
+// Appends the family values of an event that is newer than every event of
+// the object. Families that haven't been loaded aren't read.
+func (o *servletObject) appendFamilies(split map[string]*Event) error {
+	for name, event := range split {
+		f := o.family(name)
+		var err error
+		if f.loaded {
+			f.data, err = event.AppendRaw(f.data)
+			f.dirty = true
+		} else {
+			f.appended, err = event.AppendRaw(f.appended)
+		}
+		if err != nil {
+			return err
+		}
+		o.familyAdded = append(o.familyAdded, event)
+	}
+	return nil
+}
+
+// Puts the family values of an event at a timestamp that the object may
+// already have an event at. A replacement removes the values that every
+// other family held for the timestamp.
+func (o *servletObject) insertFamilies(timestamp time.Time, split map[string]*Event, replace bool) error {
+	names := make(map[string]bool)
+	for name := range split {
+		names[name] = true
+	}
+	if replace {
+		for name := range o.families {
+			names[name] = true
+		}
+	}
+	for name := range names {
+		f := o.family(name)
+		if err := o.loadFamily(f); err != nil {
+			return err
+		}
+		events, err := DecodeEvents(f.data)
+		if err != nil {
+			return err
+		}
+		event := split[name]
+		index := sort.Search(len(events), func(i int) bool { return !events[i].Timestamp.Before(timestamp) })
+		found := index < len(events) && events[index].Timestamp.Equal(timestamp)
+		switch {
+		case event == nil && !found:
+			continue
+		case event == nil:
+			events = append(events[:index], events[index+1:]...)
+		case found && !replace:
+			events[index].Merge(event)
+		case found:
+			events[index] = event
+		default:
+			events = append(events[:index], append([]*Event{event}, events[index:]...)...)
+		}
+		if event != nil {
+			o.familyAdded = append(o.familyAdded, event)
+		}
+		if err = o.setFamilyEvents(f, events); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// Removes the family values of the event at a timestamp.
+func (o *servletObject) deleteFamilies(timestamp time.Time) error {
+	return o.insertFamilies(timestamp, nil, true)
+}
+
+// Replaces the events of every family of the object with the family values
+// of a time ordered list of events.
+func (o *servletObject) resetFamilies(events []*Event, families map[int64]string) error {
+	lists := make(map[string][]*Event)
+	for name := range o.families {
+		lists[name] = nil
+	}
+	for _, event := range events {
+		_, split := splitFamilyEvent(event, families)
+		for name, e := range split {
+			lists[name] = append(lists[name], e)
+			o.familyAdded = append(o.familyAdded, e)
+		}
+	}
+	for name, list := range lists {
+		f := o.family(name)
+		f.appended, f.loaded = nil, true
+		if err := o.setFamilyEvents(f, list); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// Rewrites the events of a family.
+func (o *servletObject) setFamilyEvents(f *objectFamily, events []*Event) error {
+	var data []byte
+	for _, event := range events {
+		var err error
+		if data, err = event.AppendRaw(data); err != nil {
+			return err
+		}
+	}
+	f.data, f.dirty = data, true
+	return nil
+}
+
+// Adds the changed families of the object to a write batch. Rewritten
+// families replace the stored stream, or remove it once it's empty, and
+// appended events are merged onto it.
+func (o *servletObject) writeFamilies(batch *writeBatch) error {
+	for _, f := range o.families {
+		switch {
+		case f.dirty && len(f.data) == 0:
+			batch.Delete(f.key)
+		case f.dirty:
+			value, err := encodeObject(nil, f.data)
+			if err != nil {
+				return err
+			}
+			batch.Put(f.key, value)
+		case len(f.appended) > 0:
+			value, err := encodeObject(nil, f.appended)
+			if err != nil {
+				return err
+			}
+			batch.Merge(f.key, value)
+		}
+		f.appended, f.dirty = nil, false
+		if !f.loaded {
+			f.data = nil
+		}
+	}
+	o.familyAdded = nil
+	return nil
+}
@@ -0,0 +1,271 @@
+package skyd
+
+import (
+	"bytes"
+	"errors"
+	"fmt"
+	"github.com/jmhodges/levigo"
+	"io/ioutil"
+	"os"
+	"sort"
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// The events of a bulk load bound for a single object.
+type loadGroup struct {
+	objectId string
+	events   []*Event
+}
+
+// An object written to a bulk load's table file along with the events that
+// it adds to its table's zones, factor index, rollups and counts.
+type loadedObject struct {
+	key        []byte
+	added      []*Event
+	zoneEvents []*Event
+}
+
+// A list of changes sorted by key.
+type changeOpList []*changeOp
+
+func (l changeOpList) Len() int           { return len(l) }
+func (l changeOpList) Swap(i, j int)      { l[i], l[j] = l[j], l[i] }
+func (l changeOpList) Less(i, j int) bool { return bytes.Compare(l[i].key, l[j].key) < 0 }
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Sorts the events of an object and drops every event followed by another at
+// the same time, the way that replacing imports would.
+func uniqueEvents(events []*Event) []*Event {
+	sort.Stable(EventList(events))
+	unique := events[:0]
+	for i, event := range events {
+		if i+1 < len(events) && events[i+1].Timestamp.Equal(event.Timestamp) {
+			continue
+		}
+		unique = append(unique, event)
+	}
+	return unique
+}
+
+// Adds the keys that a new object was written to in a batch to a table file
+// in key order. Deletes are dropped since the database holds none of the
+// object's keys and merges become puts since there's nothing to merge them
+// onto.
+func putLoadOps(w *tableWriter, ops []*changeOp) error {
+	puts := make(changeOpList, 0, len(ops))
+	for _, op := range ops {
+		if op.kind == changePut || op.kind == changeMerge {
+			puts = append(puts, op)
+		}
+	}
+	sort.Sort(puts)
+	for _, op := range puts {
+		if err := w.Put(op.key, op.value); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// LoadEvents writes the events of objects that the servlet doesn't hold yet
+// to a table file that's added straight to its database, so that backfills
+// aren't written to the log and the memtable and then rewritten by every
+// compaction on their way down. The objects are built in memory and sorted
+// by encoded object id. Events of an object at the same time replace each
+// other in the order they're given, as they do for imports.
+//
+// The table's zones, factor index, rollups and counts are updated with a
+// regular batch once the file is added, and replicas are sent a full copy
+// of the database. If the database holds any key in the range of the loaded
+// objects, including a range deletion left by a deleted table, the events
+// are written with PutEvents() instead, as they are for partitioned
+// servlets and tables with stores of their own.
+func (s *Servlet) LoadEvents(table *Table, objectIds []string, events []*Event) error {
+	if len(objectIds) != len(events) {
+		return errors.New("skyd.LoadEvents: Object and event counts do not match")
+	}
+	if len(events) == 0 || s.partitionMonths > 0 || table.hasStore() {
+		return s.PutEvents(table, objectIds, events, true)
+	}
+	if s.db == nil {
+		return fmt.Errorf("Servlet is not open: %v", s.path)
+	}
+	prefix, err := table.Prefix()
+	if err != nil {
+		return err
+	}
+
+	// Group the events by encoded object id.
+	groups := make(map[string]*loadGroup)
+	for i, event := range events {
+		if event == nil {
+			return errors.New("skyd.LoadEvents: Cannot add nil event")
+		}
+		key, err := table.EncodeObjectId(objectIds[i])
+		if err != nil {
+			return err
+		}
+		g := groups[string(key)]
+		if g == nil {
+			g = &loadGroup{objectId: objectIds[i]}
+			groups[string(key)] = g
+		}
+		g.events = append(g.events, event)
+	}
+	keys := make([]string, 0, len(groups))
+	for key := range groups {
+		keys = append(keys, key)
+	}
+	sort.Strings(keys)
+
+	// Every key of the last object sorts before its id followed by the byte
+	// after the family marker.
+	start := []byte(keys[0])
+	end := append([]byte(keys[len(keys)-1]), objectFamilyMarker+1)
+	if err = s.unbufferTable(prefix); err != nil {
+		return err
+	}
+	if held, err := s.holdsKeys(start, end); err != nil {
+		return err
+	} else if held {
+		return s.PutEvents(table, objectIds, events, true)
+	}
+
+	path, objects, err := s.writeLoadTable(table, prefix, keys, groups)
+	if path != "" {
+		defer os.Remove(path)
+	}
+	if err != nil {
+		return err
+	}
+	if ingested, err := s.ingestLoadTable(prefix, path, start, end, objects); err != nil {
+		return err
+	} else if !ingested {
+		return s.PutEvents(table, objectIds, events, true)
+	}
+	s.eventsWritten.Add(uint64(len(events)))
+	table.observeEvents(events)
+	return s.splitZones()
+}
+
+// Builds the objects of a bulk load in key order and writes them to a new
+// table file in the servlet's directory. Returns the path of the file along
+// with the loaded objects.
+func (s *Servlet) writeLoadTable(table *Table, prefix []byte, keys []string, groups map[string]*loadGroup) (string, []*loadedObject, error) {
+	f, err := ioutil.TempFile(s.path, "load-")
+	if err != nil {
+		return "", nil, err
+	}
+	path := f.Name()
+	f.Close()
+	w, err := newTableWriter(s.db, path)
+	if err != nil {
+		return path, nil, err
+	}
+	defer w.Close()
+
+	families := table.propertyFamilies()
+	objects := make([]*loadedObject, 0, len(keys))
+	for _, key := range keys {
+		g := groups[key]
+		o := &servletObject{servlet: s, prefix: prefix, key: []byte(key), id: table.storedObjectId(g.objectId), tail: []byte{}, familyOf: families}
+		if err := o.setEvents(uniqueEvents(g.events), nil); err != nil {
+			return path, nil, err
+		}
+		loaded := &loadedObject{key: o.key, added: o.added, zoneEvents: o.added}
+		if len(o.familyAdded) > 0 {
+			loaded.zoneEvents = append(append([]*Event{}, o.added...), o.familyAdded...)
+		}
+
+		batch := newWriteBatch()
+		err := o.writeData(batch)
+		if err == nil {
+			err = putLoadOps(w, batch.ops)
+		}
+		batch.Close()
+		if err != nil {
+			return path, nil, err
+		}
+		objects = append(objects, loaded)
+	}
+	return path, objects, w.Finish()
+}
+
+// Adds a bulk load's table file to the database and then the loaded objects
+// to their table's zones, factor index, rollups and counts. The entire
+// servlet is locked so that no object in the range [start, end) is written
+// between the check that the database holds none of its keys and the
+// ingest. Returns false without changing anything if it holds one.
+func (s *Servlet) ingestLoadTable(prefix []byte, path string, start []byte, end []byte, objects []*loadedObject) (bool, error) {
+	if err := s.releaseTableWrites(prefix); err != nil {
+		return false, err
+	}
+	s.Lock()
+	defer s.Unlock()
+	if held, err := s.holdsKeys(start, end); err != nil || held {
+		return false, err
+	}
+
+	// The zones and index are read before the objects are added so that
+	// a table summarized for the first time doesn't count them twice.
+	if _, err := s.zoneMap(prefix); err != nil {
+		return false, err
+	}
+	if _, err := s.factorIndex(prefix); err != nil {
+		return false, err
+	}
+	if err := s.changes.ingest(s.db, path); err == errTableOverlaps {
+		return false, nil
+	} else if err != nil {
+		return false, err
+	}
+
+	return true, s.commit(func(batch *writeBatch) error {
+		var added []*Event
+		keys := make([][]byte, len(objects))
+		zoneEvents := make([][]*Event, len(objects))
+		for i, o := range objects {
+			if err := s.updateFactorIndex(prefix, o.key, o.zoneEvents, batch); err != nil {
+				return err
+			}
+			keys[i], zoneEvents[i] = o.key, o.zoneEvents
+			added = append(added, o.added...)
+		}
+		if err := s.addZoneObjects(prefix, keys, zoneEvents, batch); err != nil {
+			return err
+		}
+		if err := s.updateRollups(prefix, added, nil, batch); err != nil {
+			return err
+		}
+		return s.countTableStats(prefix, int64(len(objects)), int64(len(added)), batch)
+	})
+}
+
+// Checks whether the database holds any key in the range [start, end).
+func (s *Servlet) holdsKeys(start []byte, end []byte) (bool, error) {
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+	iterator.Seek(start)
+	if iterator.Valid() {
+		return bytes.Compare(iterator.Key(), end) < 0, nil
+	}
+	return false, iterator.GetError()
+}
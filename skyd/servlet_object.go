@@ -0,0 +1,1032 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/binary"
+	"fmt"
+	"github.com/jmhodges/levigo"
+	"math"
+	"sort"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of serialized event bytes an object's tail can hold before it
+// is sealed into a chunk. Chunks that grow past twice this size from
+// out-of-order inserts are split in half.
+const objectChunkSize = 64 * 1024
+
+// The byte that separates an object key from a chunk's start timestamp.
+const objectChunkMarker = 0x00
+
+// The number of bytes a chunk key adds to its object key.
+const objectChunkSuffixSize = 9
+
+// The byte that follows an object key in the key of the object's state. It
+// sorts the state after the object's chunks.
+const objectStateMarker = 0x01
+
+// The number of appends that can be merged onto an object in a row before
+// the next write rewrites it. This bounds the merge operands that reads have
+// to apply until a compaction folds them into the object.
+const objectMergeRunLimit = 16
+
+// The number of objects whose merged appends are counted before the counts
+// start over.
+const objectMergeRunsSize = 64 * 1024
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A servletObject is an object being modified by a servlet.
+//
+// An object is stored as a head value under its object key that holds the
+// most recent events (the tail), followed by zero or more sealed chunks of
+// older events and then the current state. Each chunk is stored under the
+// object key plus its start timestamp so that chunks sort in time order
+// directly after the head. The state is stored on its own under the object
+// key plus a marker, along with the size of the tail, so that it can be read
+// without the events. Objects written before that keep their state at the
+// front of their head until they're next written. Appends and out-of-order
+// inserts only rewrite the head, the state and the single chunk that the
+// event falls into. Chunks are only loaded when they are needed. The tail
+// and each chunk are stored with an event index so that queries can skip
+// the parts outside of their time range. The events added since the object
+// was loaded widen its zone when it's written, and along with the events
+// removed since, update the rollups and counts of its table. Appends embed
+// checkpoints of the state in the tail from time to time, including one at
+// the front of each new tail, so that queries can start from one instead of
+// the object's first event. Objects in tables with hashed
+// keys also keep their id in their stored state. The values of properties
+// in a family are split off each event and kept in the family's stream
+// after the state, whose events are added to the zone along with the rest.
+type servletObject struct {
+	servlet     *Servlet
+	prefix      []byte
+	key         []byte
+	id          string
+	exists      bool
+	state       *Event
+	tail        []byte
+	chunks      []*objectChunk
+	deleted     [][]byte
+	added       []*Event
+	removed     []*Event
+	familyOf    map[int64]string
+	families    map[string]*objectFamily
+	familyAdded []*Event
+
+	// The events in the tail after its last checkpoint, counted for a
+	// tail of the given size.
+	checkpointTail  int
+	checkpointStart int64
+	checkpointCount int
+}
+
+// A sealed, time-ordered run of events belonging to an object.
+type objectChunk struct {
+	key    []byte
+	start  int64
+	data   []byte
+	loaded bool
+	dirty  bool
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Generates the key for a chunk of an object starting at a shifted timestamp.
+func objectChunkKey(objectKey []byte, start int64) []byte {
+	key := make([]byte, len(objectKey)+objectChunkSuffixSize)
+	copy(key, objectKey)
+	key[len(objectKey)] = objectChunkMarker
+	binary.BigEndian.PutUint64(key[len(objectKey)+1:], uint64(start)^(1<<63))
+	return key
+}
+
+// Checks if a key is a chunk key belonging to an object key.
+func isObjectChunkKey(objectKey []byte, key []byte) bool {
+	return len(key) == len(objectKey)+objectChunkSuffixSize && key[len(objectKey)] == objectChunkMarker && bytes.HasPrefix(key, objectKey)
+}
+
+// Extracts the shifted start timestamp from a chunk key.
+func objectChunkStart(key []byte) int64 {
+	return int64(binary.BigEndian.Uint64(key[len(key)-8:]) ^ (1 << 63))
+}
+
+// Generates the key that an object's state is stored under.
+func objectStateKey(objectKey []byte) []byte {
+	key := make([]byte, len(objectKey)+1)
+	copy(key, objectKey)
+	key[len(objectKey)] = objectStateMarker
+	return key
+}
+
+// Checks if a key is the state key belonging to an object key.
+func isObjectStateKey(objectKey []byte, key []byte) bool {
+	return len(key) == len(objectKey)+1 && key[len(objectKey)] == objectStateMarker && bytes.HasPrefix(key, objectKey)
+}
+
+// Encodes an object's state and the size of its tail into a state value.
+func encodeObjectState(state *Event, tailSize int) ([]byte, error) {
+	b, err := state.MarshalRaw()
+	if err != nil {
+		return nil, err
+	}
+	value := make([]byte, binary.MaxVarintLen64, binary.MaxVarintLen64+len(b))
+	value = append(value[:binary.PutUvarint(value, uint64(tailSize))], b...)
+	return value, nil
+}
+
+// Decodes a state value into the object's state and the size of its tail.
+func decodeObjectState(value []byte) (*Event, int, error) {
+	tailSize, n := binary.Uvarint(value)
+	if n <= 0 {
+		return nil, 0, fmt.Errorf("skyd.Servlet: Invalid object state")
+	}
+	state := &Event{}
+	if err := state.UnmarshalRaw(value[n:]); err != nil {
+		return nil, 0, err
+	}
+	return state, int(tailSize), nil
+}
+
+// Returns the index of the lock that an encoded object id is striped onto.
+// The odd bits of its hash are used since servlets with modulo placement
+// are picked by the even bits.
+func objectLockIndex(key []byte) int {
+	return int(CondenseUint64Odd(objectKeyHash(key)) % servletObjectLockCount)
+}
+
+// Returns the size of the object key at the beginning of a key in a table
+// with the given prefix length or zero if the key is malformed.
+func objectKeySize(key []byte, prefixSize int) int {
+	n := rawSize(key[prefixSize:])
+	if n == 0 {
+		return 0
+	}
+	return prefixSize + n
+}
+
+// Returns the size of the msgpack raw value at the beginning of the data,
+// including its header, or zero if the data doesn't start with a raw.
+func rawSize(data []byte) int {
+	if len(data) == 0 {
+		return 0
+	}
+	var n int
+	switch b := data[0]; {
+	case b >= 0xa0 && b <= 0xbf:
+		n = 1 + int(b&0x1f)
+	case (b == 0xd9 || b == 0xc4) && len(data) >= 2:
+		n = 2 + int(data[1])
+	case (b == 0xda || b == 0xc5) && len(data) >= 3:
+		n = 3 + int(binary.BigEndian.Uint16(data[1:]))
+	case (b == 0xdb || b == 0xc6) && len(data) >= 5:
+		n = 5 + int(binary.BigEndian.Uint32(data[1:]))
+	}
+	if n > len(data) {
+		return 0
+	}
+	return n
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Loading
+//--------------------------------------
+
+// Reads an object's head, the keys of its chunks and its state from a table
+// with the given prefix, along with the keys of its property families if
+// the table has any. The id is only given for tables with hashed keys. The
+// object should be locked by the caller.
+func (s *Servlet) loadObject(prefix []byte, key []byte, id string, families map[int64]string) (*servletObject, error) {
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	value, err := s.db.Get(ro, key)
+	if err != nil {
+		return nil, err
+	}
+	state, tail, err := decodeObject(value)
+	if err != nil {
+		return nil, err
+	}
+	o := &servletObject{servlet: s, prefix: prefix, key: key, id: id, exists: value != nil, state: state, tail: tail, familyOf: families}
+
+	// Find the chunk keys that follow the head and the state and families
+	// after them.
+	setPrefixSameAsStart(ro)
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+	for iterator.Seek(append(append([]byte{}, key...), objectChunkMarker)); iterator.Valid(); iterator.Next() {
+		k := iterator.Key()
+		if isObjectStateKey(key, k) {
+			if o.state, _, err = decodeObjectState(iterator.Value()); err != nil {
+				return nil, err
+			}
+			if len(families) == 0 {
+				break
+			}
+			continue
+		}
+		if isObjectFamilyKey(key, k) {
+			o.family(string(k[len(key)+1:]))
+			continue
+		}
+		if !isObjectChunkKey(key, k) {
+			break
+		}
+		o.chunks = append(o.chunks, &objectChunk{key: k, start: objectChunkStart(k)})
+	}
+	if err = takeStoredObjectId(o.state, id); err != nil {
+		return nil, err
+	}
+
+	return o, nil
+}
+
+// Reads the data for a chunk if it hasn't been read yet.
+func (o *servletObject) loadChunk(chunk *objectChunk) error {
+	if chunk.loaded {
+		return nil
+	}
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	data, err := o.servlet.db.Get(ro, chunk.key)
+	if err != nil {
+		return err
+	}
+	if _, data, err = splitEventIndex(data); err != nil {
+		return err
+	}
+	chunk.data = data
+	chunk.loaded = true
+	return nil
+}
+
+// Returns the full serialized event stream for the object.
+func (o *servletObject) stream() ([]byte, error) {
+	return o.streamAfter(math.MinInt64)
+}
+
+// Returns the serialized event stream for the object, leaving out the
+// chunks that only hold events at or before a shifted timestamp. Those
+// chunks aren't loaded.
+func (o *servletObject) streamAfter(after int64) ([]byte, error) {
+	if len(o.chunks) == 0 {
+		return o.tail, nil
+	}
+	buffer := new(bytes.Buffer)
+	for i, chunk := range o.chunks {
+		if i+1 < len(o.chunks) && o.chunks[i+1].start <= after {
+			continue
+		}
+		if err := o.loadChunk(chunk); err != nil {
+			return nil, err
+		}
+		buffer.Write(chunk.data)
+	}
+	buffer.Write(o.tail)
+	return buffer.Bytes(), nil
+}
+
+//--------------------------------------
+// Merging
+//--------------------------------------
+
+// Appends events that are all newer than an object's state without loading
+// or rewriting the object. Only the object's state is read. Returns a
+// function that writes the new state in its place and adds the new events
+// to the batch as a merge operand that the database appends to the head.
+// It should be called with the commit mutex held. Returns nil if the events
+// have to be put on the loaded object instead, which is safe to do with
+// events that were already deduped here. The values of family properties
+// are merged onto their families the same way. The object should be locked
+// by the caller.
+func (s *Servlet) mergeObjectEvents(prefix []byte, key []byte, id string, families map[int64]string, writes []*servletWrite) (func(batch *writeBatch) error, error) {
+	if s.eventBlocks || s.mergeRunCount(key) >= objectMergeRunLimit {
+		return nil, nil
+	}
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	stateKey := objectStateKey(key)
+	value, err := s.db.Get(ro, stateKey)
+	if err != nil || value == nil {
+		return nil, err
+	}
+	state, tailSize, err := decodeObjectState(value)
+	if err != nil {
+		return nil, err
+	}
+
+	// An empty tail follows a chunk and starts with a checkpoint, which
+	// only appendEvent() adds.
+	if tailSize == 0 {
+		return nil, nil
+	}
+	if err = takeStoredObjectId(state, id); err != nil {
+		return nil, err
+	}
+	timestamp := state.Timestamp
+	for _, w := range writes {
+		if !timestamp.Before(w.event.Timestamp) {
+			return nil, nil
+		}
+		timestamp = w.event.Timestamp
+	}
+
+	// Apply the events to the state the same way appendEvent() does.
+	if state.Data == nil {
+		state.Data = map[int64]interface{}{}
+	}
+	events := make([]*Event, 0, len(writes))
+	var data []byte
+	var familyData map[string][]byte
+	var familyEvents []*Event
+	for _, w := range writes {
+		state.Timestamp = w.event.Timestamp
+		w.event.Dedupe(state)
+		state.MergePermanent(w.event)
+		event, split := splitFamilyEvent(w.event, families)
+		if data, err = event.AppendRaw(data); err != nil {
+			return nil, err
+		}
+		events = append(events, event)
+		for name, e := range split {
+			if familyData == nil {
+				familyData = make(map[string][]byte)
+			}
+			if familyData[name], err = e.AppendRaw(familyData[name]); err != nil {
+				return nil, err
+			}
+			familyEvents = append(familyEvents, e)
+		}
+	}
+	if tailSize+len(data) >= objectChunkSize {
+		return nil, nil
+	}
+	familyValues := make(map[string][]byte, len(familyData))
+	for name, b := range familyData {
+		if familyValues[name], err = encodeObject(nil, b); err != nil {
+			return nil, err
+		}
+	}
+
+	if id != "" {
+		state.Data[storedObjectIdPropertyId] = id
+	}
+	if value, err = encodeObjectState(state, tailSize+len(data)); err != nil {
+		return nil, err
+	}
+	head, err := encodeObject(nil, data)
+	if err != nil {
+		return nil, err
+	}
+	return func(batch *writeBatch) error {
+		batch.Put(stateKey, value)
+		batch.Merge(key, head)
+		for name, value := range familyValues {
+			batch.Merge(objectFamilyKey(key, name), value)
+		}
+		if err := s.updateZone(prefix, key, false, append(append([]*Event{}, events...), familyEvents...), batch); err != nil {
+			return err
+		}
+		if err := s.updateRollups(prefix, events, nil, batch); err != nil {
+			return err
+		}
+		if err := s.countTableStats(prefix, 0, int64(len(events)), batch); err != nil {
+			return err
+		}
+		s.countMergeRun(key)
+		return nil
+	}, nil
+}
+
+// Returns the number of appends merged onto an object in a row.
+func (s *Servlet) mergeRunCount(key []byte) int {
+	s.mergeMutex.Lock()
+	defer s.mergeMutex.Unlock()
+	return s.mergeRuns[string(key)]
+}
+
+// Counts an append merged onto an object.
+func (s *Servlet) countMergeRun(key []byte) {
+	s.mergeMutex.Lock()
+	defer s.mergeMutex.Unlock()
+	if s.mergeRuns == nil || len(s.mergeRuns) >= objectMergeRunsSize {
+		s.mergeRuns = make(map[string]int)
+	}
+	s.mergeRuns[string(key)]++
+}
+
+// Starts counting the appends merged onto an object over after it has been
+// rewritten.
+func (s *Servlet) resetMergeRun(key []byte) {
+	s.mergeMutex.Lock()
+	defer s.mergeMutex.Unlock()
+	delete(s.mergeRuns, string(key))
+}
+
+//--------------------------------------
+// Writing
+//--------------------------------------
+
+// Adds an event to the object. The values of family properties are put in
+// their families.
+func (o *servletObject) putEvent(event *Event, replace bool) error {
+	event, split := splitFamilyEvent(event, o.familyOf)
+
+	// Perform an optimized append if possible.
+	if o.state == nil || o.state.Timestamp.Before(event.Timestamp) {
+		if err := o.appendEvent(event); err != nil {
+			return err
+		}
+		return o.appendFamilies(split)
+	}
+	if err := o.insertEvent(event, replace); err != nil {
+		return err
+	}
+	return o.insertFamilies(event.Timestamp, split, replace)
+}
+
+// Appends an event to the tail and seals the tail into a chunk once it
+// reaches the chunk size.
+func (o *servletObject) appendEvent(event *Event) error {
+	if o.state == nil {
+		o.state = &Event{Data: map[int64]interface{}{}}
+	} else if err := o.checkpoint(event); err != nil {
+		return err
+	}
+	o.state.Timestamp = event.Timestamp
+	event.Dedupe(o.state)
+	o.state.MergePermanent(event)
+	o.added = append(o.added, event)
+
+	// Append new event and count it if the tail's events were counted.
+	tail, err := event.AppendRaw(o.tail)
+	if err != nil {
+		return err
+	}
+	if o.checkpointTail == len(o.tail) {
+		if len(o.tail) == 0 {
+			o.checkpointStart = ShiftTime(event.Timestamp)
+		}
+		o.checkpointTail, o.checkpointCount = len(tail), o.checkpointCount+1
+	}
+	o.tail = tail
+
+	// Fold the appended events back into a single block once enough of them
+	// have accumulated. Only a checkpoint at the front of the tail is kept.
+	if o.servlet.eventBlocks && eventBlockTailSize(o.tail) >= eventBlockTailThreshold {
+		events, err := DecodeEvents(o.tail)
+		if err != nil {
+			return err
+		}
+		lead := 0
+		if o.tail[0] == eventCheckpointFlag {
+			if _, _, lead, err = eventStreamElement(o.tail); err != nil {
+				return err
+			}
+		}
+		data, err := o.servlet.encodeEventData(events)
+		if err != nil {
+			return err
+		}
+		o.tail = append(append([]byte{}, o.tail[:lead]...), data...)
+	}
+
+	// Seal the tail once it's full.
+	if len(o.tail) >= objectChunkSize {
+		events, err := DecodeEvents(o.tail)
+		if err != nil {
+			return err
+		}
+		if len(events) > 0 {
+			start := ShiftTime(events[0].Timestamp)
+			o.chunks = append(o.chunks, &objectChunk{start: start, data: o.tail, loaded: true, dirty: true})
+			o.tail = []byte{}
+		}
+	}
+
+	return nil
+}
+
+// Adds a checkpoint of the state to the tail in front of an appended event
+// if the tail is new and follows a chunk or if enough events have been
+// appended since its last checkpoint.
+func (o *servletObject) checkpoint(event *Event) error {
+	if o.checkpointTail != len(o.tail) {
+		start, count, err := eventCheckpointDistance(o.tail)
+		if err != nil {
+			return err
+		}
+		o.checkpointTail, o.checkpointStart, o.checkpointCount = len(o.tail), start, count
+	}
+	ts := ShiftTime(event.Timestamp)
+	if len(o.tail) == 0 && len(o.chunks) == 0 {
+		return nil
+	} else if len(o.tail) > 0 && !eventCheckpointDue(o.checkpointStart, o.checkpointCount, ts) {
+		return nil
+	}
+
+	tail, err := appendEventCheckpoint(o.tail, event.Timestamp, o.state)
+	if err != nil {
+		return err
+	}
+	o.tail = tail
+	o.checkpointTail, o.checkpointStart, o.checkpointCount = len(o.tail), ts, 0
+	return nil
+}
+
+// Drops the checkpoints after an out-of-order write that may hold stale
+// values of the permanent properties it changed, starting from the region
+// at an index. The events of the written region are passed in since any
+// that follow the write and set a property make its later values current.
+func (o *servletObject) dropStaleCheckpoints(index int, timestamp time.Time, events []*Event, properties map[int64]bool) error {
+	stale := make(map[int64]bool, len(properties))
+	for k := range properties {
+		stale[k] = true
+	}
+	for _, event := range events {
+		if event.Timestamp.After(timestamp) {
+			for k := range event.Data {
+				delete(stale, k)
+			}
+		}
+	}
+
+	for i := index; i <= len(o.chunks) && len(stale) > 0; i++ {
+		if i == len(o.chunks) {
+			data, _, err := dropEventCheckpoints(o.tail, stale)
+			if err != nil {
+				return err
+			}
+			o.tail = data
+			break
+		}
+		chunk := o.chunks[i]
+		if err := o.loadChunk(chunk); err != nil {
+			return err
+		}
+		data, dropped, err := dropEventCheckpoints(chunk.data, stale)
+		if err != nil {
+			return err
+		}
+		if dropped {
+			chunk.data, chunk.dirty = data, true
+		}
+	}
+	return nil
+}
+
+// Returns the index of the chunk that covers a shifted timestamp, or the
+// chunk count for the tail, along with its events. Timestamps before the
+// first chunk are covered by the first chunk. Only that chunk is loaded.
+func (o *servletObject) region(ts int64) (int, []byte, error) {
+	index := len(o.chunks)
+	if len(o.chunks) > 0 {
+		var first int64
+		if len(o.tail) > 0 {
+			var err error
+			if first, _, _, err = eventStreamElement(o.tail); err != nil {
+				return 0, nil, err
+			}
+		}
+		if len(o.tail) == 0 || ts < first {
+			index = 0
+			for i, chunk := range o.chunks {
+				if chunk.start <= ts {
+					index = i
+				}
+			}
+		}
+	}
+	if index == len(o.chunks) {
+		return index, o.tail, nil
+	}
+	if err := o.loadChunk(o.chunks[index]); err != nil {
+		return 0, nil, err
+	}
+	return index, o.chunks[index].data, nil
+}
+
+// Inserts an event that is not newer than the current state into the chunk
+// or tail that covers its timestamp.
+func (o *servletObject) insertEvent(event *Event, replace bool) error {
+	index, data, err := o.region(ShiftTime(event.Timestamp))
+	if err != nil {
+		return err
+	}
+	events, err := DecodeEvents(data)
+	if err != nil {
+		return err
+	}
+
+	// Replace or merge with an existing event. A replacement is deduped
+	// against the earlier events in the same region and a new event against
+	// the object's state.
+	affected := make(map[int64]bool)
+	for k := range event.Data {
+		if k > 0 {
+			affected[k] = true
+		}
+	}
+	found := false
+	prior := &Event{Data: map[int64]interface{}{}}
+	for i, v := range events {
+		if v.Timestamp.Equal(event.Timestamp) {
+			event.Dedupe(prior)
+			for k := range v.Data {
+				if k > 0 {
+					affected[k] = true
+				}
+			}
+			old := &Event{Timestamp: v.Timestamp}
+			old.Merge(v)
+			o.removed = append(o.removed, old)
+			if replace {
+				events[i] = event
+				o.added = append(o.added, event)
+			} else {
+				v.Merge(event)
+				o.added = append(o.added, v)
+			}
+			found = true
+			break
+		} else if v.Timestamp.After(event.Timestamp) {
+			break
+		}
+		prior.MergePermanent(v)
+	}
+	if !found {
+		event.Dedupe(o.state)
+		events = append(events, event)
+		o.added = append(o.added, event)
+	}
+	sort.Sort(EventList(events))
+
+	// Write the region back. Its checkpoints are dropped along with the
+	// later ones that the event makes stale.
+	if index == len(o.chunks) {
+		if o.tail, err = o.servlet.encodeEventData(events); err != nil {
+			return err
+		}
+	} else if err = o.setChunkEvents(index, events); err != nil {
+		return err
+	}
+	if err = o.dropStaleCheckpoints(index+1, event.Timestamp, events, affected); err != nil {
+		return err
+	}
+
+	return o.updateState(affected)
+}
+
+// Removes the event at a timestamp from the chunk or tail that covers it
+// and updates the state for the permanent properties it had. Returns false
+// if there is no event at the timestamp.
+func (o *servletObject) deleteEvent(timestamp time.Time) (bool, error) {
+	index, data, err := o.region(ShiftTime(timestamp))
+	if err != nil {
+		return false, err
+	}
+	events, err := DecodeEvents(data)
+	if err != nil {
+		return false, err
+	}
+	affected := make(map[int64]bool)
+	found := false
+	for i, v := range events {
+		if v.Timestamp.Equal(timestamp) {
+			for k := range v.Data {
+				if k > 0 {
+					affected[k] = true
+				}
+			}
+			o.removed = append(o.removed, v)
+			events = append(events[:i], events[i+1:]...)
+			found = true
+			break
+		}
+	}
+	if !found || o.state == nil {
+		return false, nil
+	}
+	if err = o.deleteFamilies(timestamp); err != nil {
+		return false, err
+	}
+
+	// Write the region back. A chunk without events is removed. The
+	// checkpoints of the region are dropped along with the later ones that
+	// still hold the event's values.
+	next := index + 1
+	if index == len(o.chunks) {
+		if o.tail, err = o.servlet.encodeEventData(events); err != nil {
+			return false, err
+		}
+	} else if len(events) > 0 {
+		if err = o.setChunkEvents(index, events); err != nil {
+			return false, err
+		}
+	} else {
+		if key := o.chunks[index].key; key != nil {
+			o.deleted = append(o.deleted, key)
+		}
+		o.chunks = append(o.chunks[:index], o.chunks[index+1:]...)
+		next = index
+	}
+	if err = o.dropStaleCheckpoints(next, timestamp, events, affected); err != nil {
+		return false, err
+	}
+
+	// The state follows the most recent event that's left.
+	if o.state.Timestamp.Equal(timestamp) {
+		last, err := o.lastEvent()
+		if err != nil {
+			return false, err
+		}
+		if last == nil {
+			o.state = nil
+			return true, nil
+		}
+		o.state.Timestamp = last.Timestamp
+	}
+	return true, o.updateState(affected)
+}
+
+// Returns the most recent event of the object or nil if it has no events.
+func (o *servletObject) lastEvent() (*Event, error) {
+	for i := len(o.chunks); i >= 0; i-- {
+		var data []byte
+		if i == len(o.chunks) {
+			data = o.tail
+		} else {
+			if err := o.loadChunk(o.chunks[i]); err != nil {
+				return nil, err
+			}
+			data = o.chunks[i].data
+		}
+		events, err := DecodeEvents(data)
+		if err != nil {
+			return nil, err
+		}
+		if len(events) > 0 {
+			return events[len(events)-1], nil
+		}
+	}
+	return nil, nil
+}
+
+// Rewrites the events of a chunk and splits the chunk if it has grown too
+// large.
+func (o *servletObject) setChunkEvents(index int, events []*Event) error {
+	chunk := o.chunks[index]
+	data, err := o.servlet.encodeEventData(events)
+	if err != nil {
+		return err
+	}
+	if len(data) <= 2*objectChunkSize || len(events) < 2 {
+		chunk.start, chunk.data, chunk.dirty = ShiftTime(events[0].Timestamp), data, true
+		return nil
+	}
+
+	// Split into two chunks.
+	mid := len(events) / 2
+	first, err := o.servlet.encodeEventData(events[:mid])
+	if err != nil {
+		return err
+	}
+	second, err := o.servlet.encodeEventData(events[mid:])
+	if err != nil {
+		return err
+	}
+	chunk.start, chunk.data, chunk.dirty = ShiftTime(events[0].Timestamp), first, true
+	next := &objectChunk{start: ShiftTime(events[mid].Timestamp), data: second, loaded: true, dirty: true}
+	o.chunks = append(o.chunks[:index+1], append([]*objectChunk{next}, o.chunks[index+1:]...)...)
+	return nil
+}
+
+// Recalculates the state for a set of permanent properties by searching
+// backwards from the most recent event for the last value of each one.
+func (o *servletObject) updateState(properties map[int64]bool) error {
+	for k := range properties {
+		delete(o.state.Data, k)
+	}
+	for i := len(o.chunks); i >= 0 && len(properties) > 0; i-- {
+		var data []byte
+		if i == len(o.chunks) {
+			data = o.tail
+		} else {
+			if err := o.loadChunk(o.chunks[i]); err != nil {
+				return err
+			}
+			data = o.chunks[i].data
+		}
+		events, err := DecodeEvents(data)
+		if err != nil {
+			return err
+		}
+		for j := len(events) - 1; j >= 0 && len(properties) > 0; j-- {
+			for k, v := range events[j].Data {
+				if properties[k] {
+					o.state.Data[k] = v
+					delete(properties, k)
+				}
+			}
+		}
+	}
+	return nil
+}
+
+// Replaces all of the object's events, sealing them into chunks of roughly
+// the chunk size. The most recent events are kept in the tail and the values
+// of family properties replace the events of their families.
+func (o *servletObject) setEvents(events []*Event, state *Event) error {
+	sort.Sort(EventList(events))
+	if err := o.removeAll(); err != nil {
+		return err
+	}
+	if err := o.resetFamilies(events, o.familyOf); err != nil {
+		return err
+	}
+	if len(o.familyOf) > 0 {
+		split := make([]*Event, len(events))
+		for i, event := range events {
+			split[i], _ = splitFamilyEvent(event, o.familyOf)
+		}
+		events = split
+	}
+	o.added = append(o.added, events...)
+	for _, chunk := range o.chunks {
+		if chunk.key != nil {
+			o.deleted = append(o.deleted, chunk.key)
+		}
+	}
+	o.chunks = nil
+
+	// Cut the events wherever their encoded size reaches the chunk size.
+	start, size := 0, 0
+	var buffer []byte
+	for i, event := range events {
+		var err error
+		if buffer, err = event.AppendRaw(buffer[:0]); err != nil {
+			return err
+		}
+		size += len(buffer)
+		if size >= objectChunkSize && i+1 < len(events) {
+			data, err := o.servlet.encodeEventData(events[start : i+1])
+			if err != nil {
+				return err
+			}
+			o.chunks = append(o.chunks, &objectChunk{start: ShiftTime(events[start].Timestamp), data: data, loaded: true, dirty: true})
+			start, size = i+1, 0
+		}
+	}
+
+	state, tail, err := o.servlet.encodeEvents(events[start:], state)
+	if err != nil {
+		return err
+	}
+	o.state, o.tail = state, tail
+	return nil
+}
+
+// Adds the object's head and changed chunks to a write batch. The commit
+// mutex should be held by the caller.
+func (o *servletObject) write(batch *writeBatch) error {
+	zoneEvents := o.added
+	if len(o.familyAdded) > 0 {
+		zoneEvents = append(append([]*Event{}, o.added...), o.familyAdded...)
+	}
+	if err := o.writeData(batch); err != nil {
+		return err
+	}
+	if err := o.servlet.updateZone(o.prefix, o.key, !o.exists, zoneEvents, batch); err != nil {
+		return err
+	}
+	if err := o.servlet.updateRollups(o.prefix, o.added, o.removed, batch); err != nil {
+		return err
+	}
+	var objects int64
+	if !o.exists {
+		objects = 1
+	}
+	if err := o.servlet.countTableStats(o.prefix, objects, int64(len(o.added)-len(o.removed)), batch); err != nil {
+		return err
+	}
+	o.exists, o.added, o.removed = true, nil, nil
+	return nil
+}
+
+// Adds the keys that the object itself is stored under to a write batch
+// without updating the zones, rollups and counts of its table.
+func (o *servletObject) writeData(batch *writeBatch) error {
+	for _, key := range o.deleted {
+		batch.Delete(key)
+	}
+	o.deleted = nil
+
+	for _, chunk := range o.chunks {
+		if !chunk.dirty {
+			continue
+		}
+		key := objectChunkKey(o.key, chunk.start)
+		if chunk.key != nil && !bytes.Equal(chunk.key, key) {
+			batch.Delete(chunk.key)
+		}
+		value, err := indexEventStream(chunk.data)
+		if err != nil {
+			return err
+		}
+		batch.Put(key, value)
+		chunk.key, chunk.dirty = key, false
+	}
+
+	value, err := encodeObject(nil, o.tail)
+	if err != nil {
+		return err
+	}
+	batch.Put(o.key, value)
+
+	// The id is only kept in the stored state.
+	if o.id != "" {
+		if o.state == nil {
+			o.state = &Event{}
+		}
+		if o.state.Data == nil {
+			o.state.Data = map[int64]interface{}{}
+		}
+		o.state.Data[storedObjectIdPropertyId] = o.id
+	}
+	if o.state != nil {
+		value, err = encodeObjectState(o.state, len(o.tail))
+		if o.id != "" {
+			delete(o.state.Data, storedObjectIdPropertyId)
+		}
+		if err != nil {
+			return err
+		}
+		batch.Put(objectStateKey(o.key), value)
+	} else {
+		batch.Delete(objectStateKey(o.key))
+	}
+	return o.writeFamilies(batch)
+}
+
+// Records every event of the object as removed when its table has rollups
+// or counts that need to subtract them. The chunks are loaded to read their
+// events.
+func (o *servletObject) removeAll() error {
+	if rollups, err := o.servlet.activeRollups(o.prefix); err != nil {
+		return err
+	} else if len(rollups) == 0 {
+		if built, err := o.servlet.tableStatsBuilt(o.prefix); err != nil || !built {
+			return err
+		}
+	}
+	for _, chunk := range o.chunks {
+		if err := o.loadChunk(chunk); err != nil {
+			return err
+		}
+		events, err := DecodeEvents(chunk.data)
+		if err != nil {
+			return err
+		}
+		o.removed = append(o.removed, events...)
+	}
+	events, err := DecodeEvents(o.tail)
+	if err != nil {
+		return err
+	}
+	o.removed = append(o.removed, events...)
+	return nil
+}
+
+// Removes the object's head, its state and all of its chunks and families
+// in a write batch.
+func (o *servletObject) delete(batch *writeBatch) {
+	// One tombstone covers every chunk, including ones not loaded yet, and
+	// the state and families after them.
+	start := append(append([]byte{}, o.key...), objectChunkMarker)
+	end := append(append([]byte{}, o.key...), objectFamilyMarker+1)
+	batch.DeleteRange(start, end)
+	batch.Delete(o.key)
+	o.state, o.tail, o.chunks, o.deleted, o.added, o.removed = nil, []byte{}, nil, nil, nil, nil
+	o.families, o.familyAdded = nil, nil
+	o.exists = false
+}
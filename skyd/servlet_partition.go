@@ -0,0 +1,380 @@
+package skyd
+
+import (
+	"fmt"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"sort"
+	"strings"
+	"sync"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// A servlet can split its events into time partitions of a number of months
+// that each have their own LevelDB database. Writes go to the partition of
+// the event's timestamp, queries only open the partitions that overlap their
+// time range and old partitions are dropped as whole directories. Data that
+// was written before partitioning was enabled stays in the servlet's own
+// database and is read along with the partitions.
+//
+// Each partition holds its own head, chunks and state for an object. Reads
+// of an object concatenate its events across partitions, but queries see
+// each partition's part of an object as a separate object. Queries that read
+// partitions are therefore limited to selections of events by their time
+// and transient properties, whose results add up across the parts. Others,
+// including state queries, fail instead. See Query.partitionable().
+//
+// Partitions are stored in the "partitions" directory of the servlet and
+// are named after the months they start and end at.
+const partitionTimeFormat = "2006-01"
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A time partition of a servlet covering the events in [start, end). The
+// partition is reference counted so that a dropped partition stays open
+// until the scans and writes using it are done.
+type servletPartition struct {
+	sync.Mutex
+	servlet *Servlet
+	start   time.Time
+	end     time.Time
+	refs    int
+	dropped bool
+	remove  bool
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Returns the start of the partition of a given number of months that a
+// time falls into.
+func partitionStart(t time.Time, months int) time.Time {
+	t = t.UTC()
+	month := t.Year()*12 + int(t.Month()) - 1
+	month -= month % months
+	return time.Date(month/12, time.Month(month%12+1), 1, 0, 0, 0, 0, time.UTC)
+}
+
+// Splits a partition directory name into its start and end.
+func parsePartitionName(name string) (time.Time, time.Time, bool) {
+	parts := strings.Split(name, "_")
+	if len(parts) != 2 {
+		return time.Time{}, time.Time{}, false
+	}
+	start, err := time.Parse(partitionTimeFormat, parts[0])
+	if err != nil {
+		return time.Time{}, time.Time{}, false
+	}
+	end, err := time.Parse(partitionTimeFormat, parts[1])
+	if err != nil || !start.Before(end) {
+		return time.Time{}, time.Time{}, false
+	}
+	return start, end, true
+}
+
+// Releases references to a list of partitions.
+func releasePartitions(partitions []*servletPartition) {
+	for _, p := range partitions {
+		p.release()
+	}
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Partition
+//--------------------------------------
+
+// Adds a reference to the partition. Returns false if it has already been
+// dropped.
+func (p *servletPartition) acquire() bool {
+	p.Lock()
+	defer p.Unlock()
+	if p.dropped {
+		return false
+	}
+	p.refs++
+	return true
+}
+
+// Adds another reference to the partition on behalf of a holder of one.
+func (p *servletPartition) retain() {
+	p.Lock()
+	p.refs++
+	p.Unlock()
+}
+
+// Releases a reference to the partition and closes it once the last one is
+// gone. A partition dropped for removal has its files deleted.
+func (p *servletPartition) release() {
+	p.Lock()
+	defer p.Unlock()
+	p.refs--
+	if p.refs == 0 {
+		p.servlet.Close()
+		if p.remove {
+			p.servlet.destroy()
+		}
+	}
+}
+
+// Stops handing out new references and releases the servlet's own.
+func (p *servletPartition) drop(remove bool) {
+	p.Lock()
+	dropped := p.dropped
+	p.dropped, p.remove = true, remove
+	p.Unlock()
+	if !dropped {
+		p.release()
+	}
+}
+
+// Checks if the partition overlaps a time range. A zero time leaves that
+// side of the range unbounded.
+func (p *servletPartition) overlaps(start time.Time, end time.Time) bool {
+	return (start.IsZero() || start.Before(p.end)) && (end.IsZero() || p.start.Before(end))
+}
+
+//--------------------------------------
+// Servlets
+//--------------------------------------
+
+// The directory that the servlet's partitions are stored in. LevelDB
+// ignores it since it doesn't parse as one of its own files.
+func (s *Servlet) partitionPath() string {
+	return filepath.Join(s.path, "partitions")
+}
+
+// Opens a partition database with the servlet's settings.
+func (s *Servlet) openPartition(start time.Time, end time.Time) (*servletPartition, error) {
+	name := fmt.Sprintf("%s_%s", start.Format(partitionTimeFormat), end.Format(partitionTimeFormat))
+	child := NewServlet(filepath.Join(s.partitionPath(), name), s.factors)
+	child.parent = s
+	child.rollups = s.rollups
+	child.SetEventBlocksEnabled(s.eventBlocks)
+	child.SetObjectBufferOptions(s.objectBuffer)
+	child.setStorage(s.storage)
+	child.setNode(s.node)
+
+	// Partitions of months that have ended only take late events.
+	child.SetLeveledCompaction(s.leveled || !end.After(time.Now()))
+	if err := child.Open(); err != nil {
+		return nil, err
+	}
+	return &servletPartition{servlet: child, start: start, end: end, refs: 1}, nil
+}
+
+// Opens every partition of the servlet when it's opened, whether or not
+// partitioning is enabled.
+func (s *Servlet) openPartitions() error {
+	infos, err := ioutil.ReadDir(s.partitionPath())
+	if os.IsNotExist(err) {
+		return nil
+	} else if err != nil {
+		return err
+	}
+
+	for _, info := range infos {
+		start, end, ok := parsePartitionName(info.Name())
+		if !info.IsDir() || !ok {
+			continue
+		}
+		p, err := s.openPartition(start, end)
+		if err != nil {
+			s.closePartitions()
+			return err
+		}
+		s.partitions = append(s.partitions, p)
+	}
+	sort.Sort(servletPartitionList(s.partitions))
+	return nil
+}
+
+// Releases the servlet's references to its partitions.
+func (s *Servlet) closePartitions() {
+	s.partitionMutex.Lock()
+	partitions := s.partitions
+	s.partitions = nil
+	s.partitionMutex.Unlock()
+	for _, p := range partitions {
+		p.drop(false)
+	}
+}
+
+// Returns a reference to the partition that a time falls into, creating it
+// if requested. Returns nil if there is no such partition.
+func (s *Servlet) acquirePartition(t time.Time, create bool) (*servletPartition, error) {
+	s.partitionMutex.RLock()
+	for _, p := range s.partitions {
+		if !t.Before(p.start) && t.Before(p.end) && p.acquire() {
+			s.partitionMutex.RUnlock()
+			return p, nil
+		}
+	}
+	s.partitionMutex.RUnlock()
+	if !create || s.partitionMonths <= 0 {
+		return nil, nil
+	}
+
+	s.partitionMutex.Lock()
+	defer s.partitionMutex.Unlock()
+	for _, p := range s.partitions {
+		if !t.Before(p.start) && t.Before(p.end) && p.acquire() {
+			return p, nil
+		}
+	}
+
+	// New partitions are clipped to their neighbors in case the partition
+	// size has changed since they were created.
+	start := partitionStart(t, s.partitionMonths)
+	end := start.AddDate(0, s.partitionMonths, 0)
+	for _, p := range s.partitions {
+		if !p.end.After(t) && p.end.After(start) {
+			start = p.end
+		}
+		if p.start.After(t) && p.start.Before(end) {
+			end = p.start
+		}
+	}
+	p, err := s.openPartition(start, end)
+	if err != nil {
+		return nil, err
+	}
+	if err := p.servlet.markRollups(); err != nil {
+		p.drop(true)
+		return nil, err
+	}
+	p.refs++
+	s.partitions = append(s.partitions, p)
+	sort.Sort(servletPartitionList(s.partitions))
+	return p, nil
+}
+
+// Returns references to the partitions that overlap a time range in time
+// order. A zero time leaves that side of the range unbounded.
+func (s *Servlet) acquirePartitions(start time.Time, end time.Time) []*servletPartition {
+	s.partitionMutex.RLock()
+	defer s.partitionMutex.RUnlock()
+	partitions := make([]*servletPartition, 0)
+	for _, p := range s.partitions {
+		if p.overlaps(start, end) && p.acquire() {
+			partitions = append(partitions, p)
+		}
+	}
+	return partitions
+}
+
+// Calls a function with the servlet's own database, then with each of its
+// partitions in time order and then with its table stores. Stops at the
+// first error.
+func (s *Servlet) eachPartition(fn func(*Servlet) error) error {
+	if err := fn(s); err != nil {
+		return err
+	}
+	partitions := s.acquirePartitions(time.Time{}, time.Time{})
+	partitions = append(partitions, s.acquireTableStores()...)
+	defer releasePartitions(partitions)
+	for _, p := range partitions {
+		if err := fn(p.servlet); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// Adds events to the partitions of their timestamps, syncing each
+// partition's log if sync is set.
+func (s *Servlet) putPartitionEvents(table *Table, objectIds []string, events []*Event, replace bool, sync bool) error {
+	// Group the events by partition while keeping their order.
+	partitions := make([]*servletPartition, 0)
+	groups := make(map[*servletPartition][]int)
+	for i, event := range events {
+		p, err := s.acquirePartition(event.Timestamp, true)
+		if err != nil {
+			releasePartitions(partitions)
+			return err
+		}
+		if _, ok := groups[p]; ok {
+			p.release()
+		} else {
+			partitions = append(partitions, p)
+		}
+		groups[p] = append(groups[p], i)
+	}
+	defer releasePartitions(partitions)
+
+	var err error
+	for _, p := range partitions {
+		group := groups[p]
+		ids, list := make([]string, len(group)), make([]*Event, len(group))
+		for j, i := range group {
+			ids[j], list[j] = objectIds[i], events[i]
+		}
+		if e := p.servlet.putEvents(table, ids, list, replace, sync); e != nil && err == nil {
+			err = e
+		}
+	}
+	return err
+}
+
+// Drops the partitions that end at or before a given time and deletes them
+// from disk once they're no longer in use. Returns the number of partitions
+// dropped.
+func (s *Servlet) DropPartitions(before time.Time) int {
+	s.partitionMutex.Lock()
+	dropped := make([]*servletPartition, 0)
+	partitions := make([]*servletPartition, 0, len(s.partitions))
+	for _, p := range s.partitions {
+		if !p.end.After(before) {
+			dropped = append(dropped, p)
+		} else {
+			partitions = append(partitions, p)
+		}
+	}
+	s.partitions = partitions
+	s.partitionMutex.Unlock()
+
+	for _, p := range dropped {
+		p.drop(true)
+	}
+	if len(dropped) > 0 {
+		s.bumpVersion()
+	}
+	return len(dropped)
+}
+
+//--------------------------------------
+// Sorting
+//--------------------------------------
+
+type servletPartitionList []*servletPartition
+
+func (l servletPartitionList) Len() int {
+	return len(l)
+}
+
+func (l servletPartitionList) Less(i, j int) bool {
+	return l[i].start.Before(l[j].start)
+}
+
+func (l servletPartitionList) Swap(i, j int) {
+	l[i], l[j] = l[j], l[i]
+}
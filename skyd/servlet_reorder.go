@@ -0,0 +1,137 @@
+package skyd
+
+import (
+	"bytes"
+	"sort"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// The writes to an object in a table with a reorder window that are being
+// held. They're kept in time order and released together once the window
+// has passed since the first of them was held.
+type heldWrites struct {
+	prefix []byte
+	writes []*servletWrite
+	timer  *time.Timer
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// Holds writes to a table for its reorder window instead of committing them.
+// Events that arrive out of order within the window are sorted in memory so
+// that they're appended when they're released rather than inserted into
+// their objects. The writes are acknowledged once they're held, so held
+// events are lost if the process crashes. Held events are written before
+// their object is read or locked, before their table is read, and when the
+// servlet closes.
+func (s *Servlet) holdWrites(writes []*servletWrite, window time.Duration) error {
+	prefix, err := writes[0].table.Prefix()
+	if err != nil {
+		return err
+	}
+	keys := make([]string, len(writes))
+	for i, w := range writes {
+		key, err := w.table.EncodeObjectId(w.objectId)
+		if err != nil {
+			return err
+		}
+		keys[i] = string(key)
+	}
+
+	s.heldMutex.Lock()
+	defer s.heldMutex.Unlock()
+	if s.held == nil {
+		s.held = make(map[string]*heldWrites)
+	}
+	for i, w := range writes {
+		h := s.held[keys[i]]
+		if h == nil {
+			key := []byte(keys[i])
+			h = &heldWrites{prefix: prefix}
+			h.timer = time.AfterFunc(window, func() { s.releaseObjectWrites(key) })
+			s.held[keys[i]] = h
+		}
+
+		// Events at the same time keep the order they were written in.
+		index := sort.Search(len(h.writes), func(j int) bool { return h.writes[j].event.Timestamp.After(w.event.Timestamp) })
+		h.writes = append(h.writes, nil)
+		copy(h.writes[index+1:], h.writes[index:])
+		h.writes[index] = w
+	}
+	return nil
+}
+
+// Commits the held writes of the object stored under an encoded object id.
+func (s *Servlet) releaseObjectWrites(key []byte) error {
+	s.heldMutex.Lock()
+	h := s.held[string(key)]
+	if h != nil {
+		h.timer.Stop()
+		delete(s.held, string(key))
+	}
+	s.heldMutex.Unlock()
+	if h == nil {
+		return nil
+	}
+	return s.commitHeldWrites(h.writes)
+}
+
+// Commits the held writes of the objects that a list of writes are to so
+// that they're committed before them. Writes whose object ids can't be
+// encoded fail once they're queued instead.
+func (s *Servlet) releaseHeldWrites(writes []*servletWrite) error {
+	s.heldMutex.Lock()
+	empty := len(s.held) == 0
+	s.heldMutex.Unlock()
+	if empty {
+		return nil
+	}
+	for _, w := range writes {
+		key, err := w.table.EncodeObjectId(w.objectId)
+		if err != nil {
+			continue
+		}
+		if err = s.releaseObjectWrites(key); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// Commits the held writes of a table prefix or of every table if the prefix
+// is nil.
+func (s *Servlet) releaseTableWrites(prefix []byte) error {
+	var writes []*servletWrite
+	s.heldMutex.Lock()
+	for key, h := range s.held {
+		if prefix == nil || bytes.Equal(h.prefix, prefix) {
+			h.timer.Stop()
+			writes = append(writes, h.writes...)
+			delete(s.held, key)
+		}
+	}
+	s.heldMutex.Unlock()
+	return s.commitHeldWrites(writes)
+}
+
+// Queues released writes to be committed and waits for them. They were
+// acknowledged when they were held so they're given new channels.
+func (s *Servlet) commitHeldWrites(writes []*servletWrite) error {
+	if len(writes) == 0 {
+		return nil
+	}
+	for _, w := range writes {
+		w.done = make(chan error, 1)
+	}
+	return s.queueWrites(writes)
+}
@@ -0,0 +1,407 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/json"
+	"github.com/jmhodges/levigo"
+	"hash/fnv"
+	"io/ioutil"
+	"os"
+	"sort"
+	"sync"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of points that each servlet has on a ring. More points spread
+// objects more evenly across servlets at the cost of a larger ring.
+const servletRingVirtualNodes = 128
+
+// The number of objects in each database of a servlet that a reshard moves
+// at a time. Reads and writes wait while a batch is moved.
+const reshardBatchSize = 256
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// A servletRing places objects on servlets by consistent hashing. Each
+// servlet owns the arcs of the hash space that end at its virtual nodes so
+// that adding servlets only moves the objects on the arcs that the new
+// servlets take over. A ring without points places objects by their hash
+// modulo the servlet count, which is how servers placed them before rings
+// were stored.
+type servletRing struct {
+	count  int
+	points []servletRingPoint
+}
+
+// A virtual node of a servlet on a ring.
+type servletRingPoint struct {
+	hash  uint64
+	index int
+}
+
+type servletRingPointList []servletRingPoint
+
+// The placement of objects on a server's servlets. While a reshard runs,
+// the objects of each servlet are moved in key order so that the ones up to
+// the servlet's cursor are placed by the next ring and the rest are still
+// placed by the current one. Objects are only moved while the lock is held
+// for writing so reads, writes and query snapshots hold it for reading.
+type servletPlacement struct {
+	sync.RWMutex
+	path    string
+	ring    *servletRing
+	next    *servletRing
+	cursors [][]byte
+	done    []bool
+}
+
+// The placement as it's stored in the data directory.
+type servletPlacementFile struct {
+	Servlets   int  `json:"servlets"`
+	Modulo     bool `json:"modulo,omitempty"`
+	Resharding int  `json:"resharding,omitempty"`
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates a ring with the virtual nodes of a number of servlets.
+func newServletRing(count int) *servletRing {
+	r := &servletRing{count: count, points: make([]servletRingPoint, 0, count*servletRingVirtualNodes)}
+	for index := 0; index < count; index++ {
+		for node := 0; node < servletRingVirtualNodes; node++ {
+			r.points = append(r.points, servletRingPoint{hash: servletRingNodeHash(index, node), index: index})
+		}
+	}
+	sort.Sort(servletRingPointList(r.points))
+	return r
+}
+
+// Creates a ring that places objects by their hash modulo the servlet count.
+func newModuloServletRing(count int) *servletRing {
+	return &servletRing{count: count}
+}
+
+// Reads the placement stored at a path. Servers whose servlets were created
+// before placements were stored use a modulo ring over their servlets. New
+// servers have no servlets and are given a ring once they're created.
+func loadServletPlacement(path string, count int) (*servletPlacement, error) {
+	p := &servletPlacement{path: path}
+	b, err := ioutil.ReadFile(path)
+	if os.IsNotExist(err) {
+		if count > 0 {
+			p.ring = newModuloServletRing(count)
+		}
+		return p, nil
+	} else if err != nil {
+		return nil, err
+	}
+
+	file := &servletPlacementFile{}
+	if err := json.Unmarshal(b, file); err != nil {
+		return nil, err
+	}
+	if file.Modulo {
+		p.ring = newModuloServletRing(file.Servlets)
+	} else {
+		p.ring = newServletRing(file.Servlets)
+	}
+	if file.Resharding > file.Servlets {
+		p.start(file.Resharding)
+	}
+	return p, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Returns the hash of a servlet's virtual node on a ring.
+func servletRingNodeHash(index int, node int) uint64 {
+	h := uint64(index)<<32 | uint64(node)
+	h ^= h >> 33
+	h *= 0xff51afd7ed558ccd
+	h ^= h >> 33
+	h *= 0xc4ceb9fe1a85ec53
+	h ^= h >> 33
+	return h
+}
+
+// Returns the hash that places an encoded object id.
+func objectKeyHash(key []byte) uint64 {
+	h := fnv.New64a()
+	h.Write(key)
+	return h.Sum64()
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Ring
+//--------------------------------------
+
+// Returns the index of the servlet that owns a hash.
+func (r *servletRing) owner(hash uint64) int {
+	if len(r.points) == 0 {
+		return int(CondenseUint64Even(hash) % uint32(r.count))
+	}
+	i := sort.Search(len(r.points), func(i int) bool { return r.points[i].hash >= hash })
+	if i == len(r.points) {
+		i = 0
+	}
+	return r.points[i].index
+}
+
+func (l servletRingPointList) Len() int {
+	return len(l)
+}
+
+func (l servletRingPointList) Less(i, j int) bool {
+	return l[i].hash < l[j].hash
+}
+
+func (l servletRingPointList) Swap(i, j int) {
+	l[i], l[j] = l[j], l[i]
+}
+
+//--------------------------------------
+// Placement
+//--------------------------------------
+
+// The number of servlets that objects are placed on, including the ones
+// being added by a reshard.
+func (p *servletPlacement) count() int {
+	if p.next != nil {
+		return p.next.count
+	}
+	return p.ring.count
+}
+
+// Returns the index of the servlet that an encoded object id is placed on.
+// The lock should be held by the caller.
+func (p *servletPlacement) owner(key []byte) int {
+	hash := objectKeyHash(key)
+	index := p.ring.owner(hash)
+	if p.next != nil && (p.done[index] || (p.cursors[index] != nil && bytes.Compare(key, p.cursors[index]) <= 0)) {
+		return p.next.owner(hash)
+	}
+	return index
+}
+
+// Starts moving objects onto a ring over a larger number of servlets.
+func (p *servletPlacement) start(count int) {
+	p.next = newServletRing(count)
+	p.cursors = make([][]byte, p.ring.count)
+	p.done = make([]bool, p.ring.count)
+}
+
+// Places every object by the next ring once all of them have been moved.
+func (p *servletPlacement) finish() {
+	p.ring, p.next, p.cursors, p.done = p.next, nil, nil, nil
+}
+
+// Writes the placement to the data directory.
+func (p *servletPlacement) save() error {
+	file := &servletPlacementFile{Servlets: p.ring.count, Modulo: len(p.ring.points) == 0}
+	if p.next != nil {
+		file.Resharding = p.next.count
+	}
+	b, err := json.Marshal(file)
+	if err != nil {
+		return err
+	}
+	return ioutil.WriteFile(p.path, b, 0600)
+}
+
+//--------------------------------------
+// Moving
+//--------------------------------------
+
+// Moves the objects from a start key up to and including an end key to the
+// servlets that a function places them on. Objects placed on this servlet
+// are left where they are. A nil start begins at the first key and a nil
+// end runs to the last. Nothing else should write to any of the servlets
+// while objects are moved.
+func (s *Servlet) moveObjects(start []byte, end []byte, target func(key []byte) *Servlet) error {
+	// Held events and buffered objects are written so that they're moved.
+	if err := s.releaseTableWrites(nil); err != nil {
+		return err
+	}
+	if err := s.flushObjectBuffer(false); err != nil {
+		return err
+	}
+
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+	deletes := newWriteBatch()
+	defer deletes.Close()
+	batches := make(map[*Servlet]*writeBatch)
+	defer func() {
+		for _, batch := range batches {
+			batch.Close()
+		}
+	}()
+
+	// Objects are added to the zones, rollups and counts of their new servlet
+	// once all of their keys have been read, and taken out of the rollups and
+	// counts here. Family values only go into the zones.
+	var prefix, objectKey []byte
+	var dest *Servlet
+	var events, familyEvents []*Event
+	flush := func() error {
+		if dest == nil || dest == s {
+			return nil
+		}
+		if err := s.updateRollups(prefix, nil, events, deletes); err != nil {
+			return err
+		}
+		if err := s.countTableStats(prefix, -1, -int64(len(events)), deletes); err != nil {
+			return err
+		}
+		dest.Lock()
+		defer dest.Unlock()
+		zoneEvents := append(append([]*Event{}, events...), familyEvents...)
+		if err := dest.updateZone(prefix, objectKey, true, zoneEvents, batches[dest]); err != nil {
+			return err
+		}
+		if err := dest.countTableStats(prefix, 1, int64(len(events)), batches[dest]); err != nil {
+			return err
+		}
+		return dest.updateRollups(prefix, events, nil, batches[dest])
+	}
+
+	if start == nil {
+		iterator.SeekToFirst()
+	} else {
+		iterator.Seek(start)
+	}
+	for ; iterator.Valid(); iterator.Next() {
+		key := iterator.Key()
+		size := tablePrefixSize(key)
+		if size == 0 || isZoneKey(key, size) {
+			continue
+		}
+		n := objectKeySize(key, size)
+		if n == 0 {
+			continue
+		}
+		if end != nil && bytes.Compare(key[:n], end) > 0 {
+			break
+		}
+
+		// Chunks and the state follow the head of their object.
+		if objectKey == nil || !bytes.Equal(key[:n], objectKey) {
+			if err := flush(); err != nil {
+				return err
+			}
+			prefix, objectKey = key[:size], key[:n]
+			dest, events, familyEvents = target(objectKey), nil, nil
+			if dest != s && batches[dest] == nil {
+				batches[dest] = newWriteBatch()
+			}
+		}
+		if dest == s {
+			continue
+		}
+
+		value := iterator.Value()
+		var data []byte
+		var err error
+		family := isObjectFamilyKey(objectKey, key)
+		if n == len(key) || family {
+			_, data, err = decodeObject(value)
+		} else if !isObjectStateKey(objectKey, key) {
+			_, data, err = splitEventIndex(value)
+		}
+		if err != nil {
+			return err
+		}
+		e, err := DecodeEvents(data)
+		if err != nil {
+			return err
+		}
+		if family {
+			familyEvents = append(familyEvents, e...)
+		} else {
+			events = append(events, e...)
+		}
+		batches[dest].Put(key, value)
+		deletes.Delete(key)
+	}
+	if err := iterator.GetError(); err != nil {
+		return err
+	}
+	if err := flush(); err != nil {
+		return err
+	}
+	if len(batches) == 0 {
+		return nil
+	}
+
+	// Objects are written to their new servlets before they're removed so
+	// that an interrupted move leaves copies rather than losing them.
+	wo := levigo.NewWriteOptions()
+	defer wo.Close()
+	for dest, batch := range batches {
+		dest.Lock()
+		err := dest.changes.write(dest.db, wo, batch)
+		dest.Unlock()
+		if err != nil {
+			return err
+		}
+		dest.bumpVersion()
+		if err = dest.splitZones(); err != nil {
+			return err
+		}
+	}
+	s.Lock()
+	err := s.changes.write(s.db, wo, deletes)
+	s.Unlock()
+	s.bumpVersion()
+	return err
+}
+
+// Returns the key of the object a number of objects after a key, or nil if
+// there aren't that many. A nil start begins at the first key.
+func (s *Servlet) nthObjectKey(start []byte, n int) []byte {
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+	if start == nil {
+		iterator.SeekToFirst()
+	} else {
+		iterator.Seek(start)
+	}
+	for ; iterator.Valid(); iterator.Next() {
+		key := iterator.Key()
+		size := tablePrefixSize(key)
+		if size == 0 || isZoneKey(key, size) || objectKeySize(key, size) != len(key) {
+			continue
+		}
+		if n--; n == 0 {
+			return key
+		}
+	}
+	return nil
+}
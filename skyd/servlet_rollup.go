@@ -0,0 +1,424 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"github.com/jmhodges/levigo"
+	"math"
+	"sort"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The rows of a rollup are kept in each database with the factor index of
+// their table. Each row holds the event count and the sums of a time bucket
+// and a combination of dimension values:
+//
+//	'u' name                                                 definition
+//	'v' name size (1) name bucket (8) dimension values (8)   count (8) sums (8)
+//
+// Buckets and values are big endian with their sign bit flipped so that
+// they sort numerically, and the row values are little endian. A database
+// only keeps the rows of a rollup up to date once it holds the rollup's
+// definition, which is written along with the rows when they're built.
+const (
+	rollupDefinitionKind = 'u'
+	rollupRowKind        = 'v'
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// The totals of the events in a rollup row.
+type rollupRow struct {
+	count int64
+	sums  []float64
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Generates the key that a rollup's definition is stored under.
+func rollupDefinitionKey(prefix []byte, name string) []byte {
+	key := factorIndexKey(prefix, rollupDefinitionKind, len(name))
+	return append(key, name...)
+}
+
+// Generates the start of the keys of a rollup's rows.
+func rollupRowPrefix(prefix []byte, name string) []byte {
+	key := factorIndexKey(prefix, rollupRowKind, 1+len(name)+8)
+	key = append(key, byte(len(name)))
+	return append(key, name...)
+}
+
+// Generates the key of a rollup row.
+func rollupRowKey(prefix []byte, name string, bucket int64, values []int64) []byte {
+	key := appendUint64(rollupRowPrefix(prefix, name), uint64(bucket)^(1<<63))
+	for _, v := range values {
+		key = appendUint64(key, uint64(v)^(1<<63))
+	}
+	return key
+}
+
+// Decodes the bucket and dimension values from the key of a rollup row.
+func decodeRollupRowKey(key []byte, start int, dimensions int) (int64, []int64, error) {
+	if len(key) != start+8*(dimensions+1) {
+		return 0, nil, errors.New("skyd.Rollup: Invalid row key")
+	}
+	bucket := int64(binary.BigEndian.Uint64(key[start:]) ^ (1 << 63))
+	values := make([]int64, dimensions)
+	for i := range values {
+		values[i] = int64(binary.BigEndian.Uint64(key[start+8*(i+1):]) ^ (1 << 63))
+	}
+	return bucket, values, nil
+}
+
+// Encodes a rollup row as a stored value.
+func encodeRollupRow(row *rollupRow) []byte {
+	b := make([]byte, 8*(len(row.sums)+1))
+	binary.LittleEndian.PutUint64(b, uint64(row.count))
+	for i, sum := range row.sums {
+		binary.LittleEndian.PutUint64(b[8*(i+1):], math.Float64bits(sum))
+	}
+	return b
+}
+
+// Decodes a stored rollup row with a number of sums.
+func decodeRollupRow(b []byte, sums int) (*rollupRow, error) {
+	if len(b) != 8*(sums+1) {
+		return nil, errors.New("skyd.Rollup: Invalid row")
+	}
+	row := &rollupRow{count: int64(binary.LittleEndian.Uint64(b)), sums: make([]float64, sums)}
+	for i := range row.sums {
+		row.sums[i] = math.Float64frombits(binary.LittleEndian.Uint64(b[8*(i+1):]))
+	}
+	return row, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Batches
+//--------------------------------------
+
+// Returns the rollup rows changed by writes to a batch so far, creating
+// them if needed. Later writes to the same batch read them back since they
+// aren't in the database until the batch is written.
+func (b *writeBatch) rollupChanges() map[string]*rollupRow {
+	if b.rollups == nil {
+		b.rollups = make(map[string]*rollupRow)
+	}
+	return b.rollups
+}
+
+// Adds the changed rollup rows to the batch. Rows without any events left
+// are removed.
+func (b *writeBatch) putRollupChanges() {
+	if b.rollups == nil {
+		return
+	}
+	keys := make([]string, 0, len(b.rollups))
+	for key := range b.rollups {
+		keys = append(keys, key)
+	}
+	sort.Strings(keys)
+	for _, key := range keys {
+		if row := b.rollups[key]; row.count > 0 {
+			b.Put([]byte(key), encodeRollupRow(row))
+		} else {
+			b.Delete([]byte(key))
+		}
+	}
+	b.rollups = nil
+}
+
+//--------------------------------------
+// Servlets
+//--------------------------------------
+
+// Checks whether the database holds the rows of a rollup. The answer is
+// remembered for writes to the servlet.
+func (s *Servlet) rollupBuilt(r *QueryRollup) (bool, error) {
+	s.rollupMutex.Lock()
+	built, ok := s.builtRollups[r]
+	s.rollupMutex.Unlock()
+	if ok {
+		return built, nil
+	}
+
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	value, err := s.db.Get(ro, rollupDefinitionKey(r.prefix, r.name))
+	if err != nil {
+		return false, err
+	}
+	built = value != nil && bytes.Equal(value, r.fingerprint())
+	s.setRollupBuilt(r, built)
+	return built, nil
+}
+
+// Remembers whether the database holds the rows of a rollup.
+func (s *Servlet) setRollupBuilt(r *QueryRollup, built bool) {
+	s.rollupMutex.Lock()
+	defer s.rollupMutex.Unlock()
+	if s.builtRollups == nil {
+		s.builtRollups = make(map[*QueryRollup]bool)
+	}
+	s.builtRollups[r] = built
+}
+
+// Forgets the rollups of a table prefix after its data has been removed.
+func (s *Servlet) dropRollups(prefix []byte) {
+	s.rollupMutex.Lock()
+	defer s.rollupMutex.Unlock()
+	for r := range s.builtRollups {
+		if bytes.Equal(r.prefix, prefix) {
+			delete(s.builtRollups, r)
+		}
+	}
+}
+
+// Updates the rows of every rollup of a table that the database holds for
+// the events added to and removed from an object. The commit mutex or the
+// entire servlet should be locked by the caller.
+func (s *Servlet) updateRollups(prefix []byte, added []*Event, removed []*Event, batch *writeBatch) error {
+	if len(added) == 0 && len(removed) == 0 {
+		return nil
+	}
+	rollups, err := s.activeRollups(prefix)
+	if err != nil {
+		return err
+	}
+	for _, r := range rollups {
+		if err := s.rollEvents(r, added, 1, batch); err != nil {
+			return err
+		}
+		if err := s.rollEvents(r, removed, -1, batch); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// Returns the rollups of a table that the database holds.
+func (s *Servlet) activeRollups(prefix []byte) ([]*QueryRollup, error) {
+	var active []*QueryRollup
+	for _, r := range s.rollups.list(prefix) {
+		built, err := s.rollupBuilt(r)
+		if err != nil {
+			return nil, err
+		} else if built {
+			active = append(active, r)
+		}
+	}
+	return active, nil
+}
+
+// Adds a list of events to the rows of a rollup, or subtracts them if the
+// sign is negative.
+func (s *Servlet) rollEvents(r *QueryRollup, events []*Event, sign int64, batch *writeBatch) error {
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	changes := batch.rollupChanges()
+	for _, event := range events {
+		bucket, values := r.rowOf(event)
+		key := rollupRowKey(r.prefix, r.name, bucket, values)
+		row := changes[string(key)]
+		if row == nil {
+			stored, err := s.db.Get(ro, key)
+			if err != nil {
+				return err
+			}
+			if stored == nil {
+				row = &rollupRow{sums: make([]float64, len(r.sumIds))}
+			} else if row, err = decodeRollupRow(stored, len(r.sumIds)); err != nil {
+				return err
+			}
+			changes[string(key)] = row
+		}
+		row.count += sign
+		for i, id := range r.sumIds {
+			if v, ok := toFloat(normalize(event.Data[id])); ok {
+				row.sums[i] += float64(sign) * v
+			}
+		}
+	}
+	return nil
+}
+
+// Builds the rows of a rollup from every event of its table in the
+// database, replacing any rows kept for an earlier rollup of the same name.
+// Objects that have been frozen can't be read back so tables with frozen
+// files can't be rolled up. Writes to the servlet wait until the rows have
+// been built.
+func (s *Servlet) buildRollup(r *QueryRollup) error {
+	s.Lock()
+	defer s.Unlock()
+	s.frozenMutex.RLock()
+	frozen := len(s.frozen[string(r.prefix)]) > 0
+	s.frozenMutex.RUnlock()
+	if frozen {
+		return errors.New("skyd.Servlet: Tables with frozen objects can't be rolled up")
+	}
+
+	wo := levigo.NewWriteOptions()
+	defer wo.Close()
+	start := rollupRowPrefix(r.prefix, r.name)
+	if err := s.changes.deleteRange(s.db, wo, start, incrementKey(start)); err != nil {
+		return err
+	}
+
+	ro := levigo.NewReadOptions()
+	ro.SetFillCache(false)
+	setSequentialScan(ro)
+	setPrefixSameAsStart(ro)
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+	batch := newWriteBatch()
+	defer batch.Close()
+
+	// Only heads and chunks hold events. Rollups don't use family values.
+	prefix := r.prefix
+	for iterator.Seek(prefix); iterator.Valid(); iterator.Next() {
+		key := iterator.Key()
+		if !bytes.HasPrefix(key, prefix) {
+			break
+		}
+		n := objectKeySize(key, len(prefix))
+		if isZoneKey(key, len(prefix)) || n == 0 || isObjectStateKey(key[:n], key) || isObjectFamilyKey(key[:n], key) {
+			continue
+		}
+		var data []byte
+		var err error
+		if n == len(key) {
+			_, data, err = decodeObject(iterator.Value())
+		} else {
+			_, data, err = splitEventIndex(iterator.Value())
+		}
+		if err != nil {
+			return err
+		}
+		events, err := DecodeEvents(data)
+		if err != nil {
+			return err
+		}
+		if err = s.rollEvents(r, events, 1, batch); err != nil {
+			return err
+		}
+	}
+	if err := iterator.GetError(); err != nil {
+		return err
+	}
+
+	batch.Put(rollupDefinitionKey(r.prefix, r.name), r.fingerprint())
+	if err := s.changes.write(s.db, wo, batch); err != nil {
+		return err
+	}
+	s.setRollupBuilt(r, true)
+	s.bumpVersion()
+	return nil
+}
+
+// Removes the rows and the definition of a rollup from the database. Any
+// rollup of the same name is no longer known to be built.
+func (s *Servlet) removeRollup(r *QueryRollup) error {
+	s.Lock()
+	defer s.Unlock()
+	wo := levigo.NewWriteOptions()
+	defer wo.Close()
+	start := rollupRowPrefix(r.prefix, r.name)
+	if err := s.changes.deleteRange(s.db, wo, start, incrementKey(start)); err != nil {
+		return err
+	}
+	batch := newWriteBatch()
+	defer batch.Close()
+	batch.Delete(rollupDefinitionKey(r.prefix, r.name))
+	if err := s.changes.write(s.db, wo, batch); err != nil {
+		return err
+	}
+	s.rollupMutex.Lock()
+	for other := range s.builtRollups {
+		if other.name == r.name && bytes.Equal(other.prefix, r.prefix) {
+			delete(s.builtRollups, other)
+		}
+	}
+	s.rollupMutex.Unlock()
+	return nil
+}
+
+// Marks every registered rollup as built in a database that was just
+// created, since it has no events to roll up yet.
+func (s *Servlet) markRollups() error {
+	rollups := s.rollups.all()
+	if len(rollups) == 0 {
+		return nil
+	}
+	batch := newWriteBatch()
+	defer batch.Close()
+	for _, r := range rollups {
+		batch.Put(rollupDefinitionKey(r.prefix, r.name), r.fingerprint())
+	}
+	wo := levigo.NewWriteOptions()
+	defer wo.Close()
+	if err := s.changes.write(s.db, wo, batch); err != nil {
+		return err
+	}
+	for _, r := range rollups {
+		s.setRollupBuilt(r, true)
+	}
+	return nil
+}
+
+// Calls a function with each row of a rollup whose bucket is in the range
+// [start, end). Returns false without reading any rows if the database
+// doesn't hold the rollup. The table's buffered objects are written first.
+func (s *Servlet) readRollup(r *QueryRollup, start int64, end int64, fn func(values []int64, row *rollupRow)) (bool, error) {
+	if err := s.unbufferTable(r.prefix); err != nil {
+		return false, err
+	}
+	built, err := s.rollupBuilt(r)
+	if err != nil || !built {
+		return false, err
+	}
+
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+	rowPrefix := rollupRowPrefix(r.prefix, r.name)
+	for iterator.Seek(appendUint64(rowPrefix, uint64(start)^(1<<63))); iterator.Valid(); iterator.Next() {
+		key := iterator.Key()
+		if !bytes.HasPrefix(key, rowPrefix) {
+			break
+		}
+		bucket, values, err := decodeRollupRowKey(key, len(rowPrefix), len(r.dimensionIds))
+		if err != nil {
+			return false, err
+		}
+		if bucket >= end {
+			break
+		}
+		row, err := decodeRollupRow(iterator.Value(), len(r.sumIds))
+		if err != nil {
+			return false, err
+		}
+		fn(values, row)
+	}
+	return true, iterator.GetError()
+}
@@ -0,0 +1,272 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"github.com/jmhodges/levigo"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The object and event counts of a table are kept in each database with the
+// factor index of the table so that table stats don't need a scan:
+//
+//	'w'    objects (8) events (8)
+//
+// The counts are little endian. A database only keeps the counts of a table
+// up to date once it holds them, which is when they're first built. Frozen
+// objects stay counted since queries still read them.
+const tableStatsKind = 'w'
+
+// Returned when the counts of a table can't be built because some of its
+// objects have been frozen and can't be read back.
+var errTableStatsFrozen = errors.New("skyd.Servlet: Tables with frozen objects can't be counted")
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// The number of objects and events of a table in a database.
+type tableStats struct {
+	objects int64
+	events  int64
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Generates the key that the counts of a table are stored under.
+func tableStatsKey(prefix []byte) []byte {
+	return factorIndexKey(prefix, tableStatsKind, 0)
+}
+
+// Encodes the counts of a table as a stored value.
+func encodeTableStats(stats *tableStats) []byte {
+	b := make([]byte, 16)
+	binary.LittleEndian.PutUint64(b, uint64(stats.objects))
+	binary.LittleEndian.PutUint64(b[8:], uint64(stats.events))
+	return b
+}
+
+// Decodes the stored counts of a table.
+func decodeTableStats(b []byte) (*tableStats, error) {
+	if len(b) != 16 {
+		return nil, errors.New("skyd.Servlet: Invalid table stats")
+	}
+	return &tableStats{
+		objects: int64(binary.LittleEndian.Uint64(b)),
+		events:  int64(binary.LittleEndian.Uint64(b[8:])),
+	}, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Batches
+//--------------------------------------
+
+// Returns the table counts changed by writes to a batch so far, creating
+// them if needed. Later writes to the same batch read them back since they
+// aren't in the database until the batch is written.
+func (b *writeBatch) tableStatsChanges() map[string]*tableStats {
+	if b.stats == nil {
+		b.stats = make(map[string]*tableStats)
+	}
+	return b.stats
+}
+
+// Adds the changed table counts to the batch.
+func (b *writeBatch) putTableStatsChanges() {
+	for key, stats := range b.stats {
+		b.Put([]byte(key), encodeTableStats(stats))
+	}
+	b.stats = nil
+}
+
+//--------------------------------------
+// Servlets
+//--------------------------------------
+
+// Checks whether the database keeps the counts of a table. The answer is
+// remembered for writes to the servlet.
+func (s *Servlet) tableStatsBuilt(prefix []byte) (bool, error) {
+	s.statsMutex.Lock()
+	built, ok := s.builtStats[string(prefix)]
+	s.statsMutex.Unlock()
+	if ok {
+		return built, nil
+	}
+
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	value, err := s.db.Get(ro, tableStatsKey(prefix))
+	if err != nil {
+		return false, err
+	}
+	s.setTableStatsBuilt(prefix, value != nil)
+	return value != nil, nil
+}
+
+// Remembers whether the database keeps the counts of a table.
+func (s *Servlet) setTableStatsBuilt(prefix []byte, built bool) {
+	s.statsMutex.Lock()
+	defer s.statsMutex.Unlock()
+	if s.builtStats == nil {
+		s.builtStats = make(map[string]bool)
+	}
+	s.builtStats[string(prefix)] = built
+}
+
+// Forgets the counts of a table prefix after its data has been removed.
+func (s *Servlet) dropTableStats(prefix []byte) {
+	s.statsMutex.Lock()
+	defer s.statsMutex.Unlock()
+	delete(s.builtStats, string(prefix))
+}
+
+// Adds to the counts of a table if the database keeps them. The commit
+// mutex or the entire servlet should be locked by the caller.
+func (s *Servlet) countTableStats(prefix []byte, objects int64, events int64, batch *writeBatch) error {
+	if objects == 0 && events == 0 {
+		return nil
+	}
+	if built, err := s.tableStatsBuilt(prefix); err != nil || !built {
+		return err
+	}
+
+	key := string(tableStatsKey(prefix))
+	changes := batch.tableStatsChanges()
+	stats := changes[key]
+	if stats == nil {
+		ro := levigo.NewReadOptions()
+		defer ro.Close()
+		stored, err := s.db.Get(ro, []byte(key))
+		if err != nil {
+			return err
+		}
+		if stored == nil {
+			stats = &tableStats{}
+		} else if stats, err = decodeTableStats(stored); err != nil {
+			return err
+		}
+		changes[key] = stats
+	}
+	stats.objects += objects
+	stats.events += events
+	return nil
+}
+
+// Retrieves the counts of a table, building them from every object of the
+// table in the database the first time. Writes to the servlet wait while
+// the counts are built. The table's buffered objects are written first.
+func (s *Servlet) tableStats(prefix []byte) (*tableStats, error) {
+	if err := s.unbufferTable(prefix); err != nil {
+		return nil, err
+	}
+	if built, err := s.tableStatsBuilt(prefix); err != nil {
+		return nil, err
+	} else if !built {
+		if err := s.buildTableStats(prefix); err != nil {
+			return nil, err
+		}
+	}
+
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	value, err := s.db.Get(ro, tableStatsKey(prefix))
+	if err != nil {
+		return nil, err
+	} else if value == nil {
+		return &tableStats{}, nil
+	}
+	return decodeTableStats(value)
+}
+
+// Counts the objects and events of a table in the database. Objects that
+// have been frozen can't be read back so tables with frozen files can't be
+// counted.
+func (s *Servlet) buildTableStats(prefix []byte) error {
+	s.Lock()
+	defer s.Unlock()
+	if built, err := s.tableStatsBuilt(prefix); err != nil || built {
+		return err
+	}
+	s.frozenMutex.RLock()
+	frozen := len(s.frozen[string(prefix)]) > 0
+	s.frozenMutex.RUnlock()
+	if frozen {
+		return errTableStatsFrozen
+	}
+
+	ro := levigo.NewReadOptions()
+	ro.SetFillCache(false)
+	setSequentialScan(ro)
+	setPrefixSameAsStart(ro)
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+
+	// Only heads and chunks hold events and every object has a head.
+	stats := &tableStats{}
+	for iterator.Seek(prefix); iterator.Valid(); iterator.Next() {
+		key := iterator.Key()
+		if !bytes.HasPrefix(key, prefix) {
+			break
+		}
+		n := objectKeySize(key, len(prefix))
+		if isZoneKey(key, len(prefix)) || n == 0 || isObjectStateKey(key[:n], key) || isObjectFamilyKey(key[:n], key) {
+			continue
+		}
+		var data []byte
+		var err error
+		if n == len(key) {
+			stats.objects++
+			_, data, err = decodeObject(iterator.Value())
+		} else {
+			_, data, err = splitEventIndex(iterator.Value())
+		}
+		if err != nil {
+			return err
+		}
+		events, err := DecodeEvents(data)
+		if err != nil {
+			return err
+		}
+		stats.events += int64(len(events))
+	}
+	if err := iterator.GetError(); err != nil {
+		return err
+	}
+
+	batch := newWriteBatch()
+	defer batch.Close()
+	batch.Put(tableStatsKey(prefix), encodeTableStats(stats))
+	wo := levigo.NewWriteOptions()
+	defer wo.Close()
+	if err := s.changes.write(s.db, wo, batch); err != nil {
+		return err
+	}
+	s.setTableStatsBuilt(prefix, true)
+	return nil
+}
+
+// Returns the approximate number of bytes that a table takes up on disk in
+// the database. Data that's only in the memtable isn't counted.
+func (s *Servlet) tableSize(prefix []byte) uint64 {
+	sizes := s.db.GetApproximateSizes([]levigo.Range{{Start: prefix, Limit: incrementKey(prefix)}})
+	return sizes[0]
+}
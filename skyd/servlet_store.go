@@ -0,0 +1,193 @@
+package skyd
+
+import (
+	"errors"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// A servlet keeps the objects of each memory table and each separate table
+// in a database of its own, its store for the table.
+//
+// Memory stores are kept in memory so that scratch tables built during an
+// analysis are written and queried without any disk I/O or syncs. The
+// databases of a table share one in-memory environment across servlets,
+// which is what the table's memory limit is checked against. They're
+// opened the first time their table is used and are dropped along with
+// their data when the servlet is closed or the table is deleted.
+//
+// Separate stores are kept on disk in the servlet's "tables" directory and
+// are compacted and compressed with their table's options, so a large,
+// churning table's compactions never rewrite the data of the others. They
+// share the servlet's block cache and are opened along with the servlet.
+// Deleting the table removes their directories.
+//
+// Stores are included when a servlet's partitions are visited. Memory
+// stores aren't checkpointed or warmed up.
+const (
+	memoryStoreDir   = "memory"
+	separateStoreDir = "tables"
+)
+
+// Returned by writes to a memory table once its databases take up its
+// memory limit.
+var errMemoryTableFull = errors.New("skyd.Servlet: Memory table is full")
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// The path of the servlet's store for a table.
+func (s *Servlet) storePath(table *Table) string {
+	if table.InMemory() {
+		return filepath.Join(s.path, memoryStoreDir, table.Name)
+	}
+	return filepath.Join(s.path, separateStoreDir, table.Name)
+}
+
+// Whether the servlet is a store kept in memory.
+func (s *Servlet) inMemory() bool {
+	return s.storeTable != nil && s.storeTable.InMemory()
+}
+
+// Returns a reference to the database that the servlet keeps a table in,
+// opening it if needed. Returns nil if the table is stored in the servlet's
+// own database or the servlet is itself a store.
+func (s *Servlet) acquireTableStore(table *Table) (*servletPartition, error) {
+	if !table.hasStore() || s.storeTable != nil {
+		return nil, nil
+	}
+	s.partitionMutex.Lock()
+	defer s.partitionMutex.Unlock()
+	if p := s.tableStores[table.Name]; p != nil && p.acquire() {
+		return p, nil
+	}
+
+	child := NewServlet(s.storePath(table), s.factors)
+	child.parent = s
+	child.storeTable = table
+	child.rollups = s.rollups
+	child.SetEventBlocksEnabled(s.eventBlocks)
+	child.SetObjectBufferOptions(s.objectBuffer)
+	child.setStorage(s.storage)
+	if table.InMemory() {
+		child.SetLeveledCompaction(true)
+	} else {
+		child.setNode(s.node)
+	}
+	if err := child.Open(); err != nil {
+		return nil, err
+	}
+	p := &servletPartition{servlet: child, refs: 1}
+	if err := child.markRollups(); err != nil {
+		p.drop(table.InMemory())
+		return nil, err
+	}
+	p.refs++
+	if s.tableStores == nil {
+		s.tableStores = make(map[string]*servletPartition)
+	}
+	s.tableStores[table.Name] = p
+	return p, nil
+}
+
+// Like acquireTableStore, but fails once a memory table's databases take up
+// its memory limit so that the write isn't made.
+func (s *Servlet) acquireTableStoreForWrite(table *Table) (*servletPartition, error) {
+	p, err := s.acquireTableStore(table)
+	if p != nil && table.InMemory() && s.storage.memoryFull(table) {
+		p.release()
+		return nil, errMemoryTableFull
+	}
+	return p, err
+}
+
+// Returns references to every open store of the servlet.
+func (s *Servlet) acquireTableStores() []*servletPartition {
+	s.partitionMutex.RLock()
+	defer s.partitionMutex.RUnlock()
+	stores := make([]*servletPartition, 0, len(s.tableStores))
+	for _, p := range s.tableStores {
+		if p.acquire() {
+			stores = append(stores, p)
+		}
+	}
+	return stores
+}
+
+// Opens the servlet's store for a separate table if it was written to
+// before, so that it's checkpointed and warmed up along with the servlet.
+func (s *Servlet) openTableStore(table *Table) error {
+	if table.Storage != SeparateTableStorage {
+		return nil
+	}
+	if _, err := os.Stat(s.storePath(table)); os.IsNotExist(err) {
+		return nil
+	} else if err != nil {
+		return err
+	}
+	p, err := s.acquireTableStore(table)
+	if p != nil {
+		p.release()
+	}
+	return err
+}
+
+// Drops the store of a table, which frees its memory or removes its files
+// once the scans and writes using it are done. The directory of a separate
+// store is removed even if it isn't open.
+func (s *Servlet) dropTableStore(table *Table) error {
+	s.partitionMutex.Lock()
+	p := s.tableStores[table.Name]
+	delete(s.tableStores, table.Name)
+	s.partitionMutex.Unlock()
+	if p != nil {
+		p.drop(true)
+		s.bumpVersion()
+	} else if table.Storage == SeparateTableStorage {
+		return os.RemoveAll(s.storePath(table))
+	}
+	return nil
+}
+
+// Closes every store of the servlet. Memory stores are dropped along with
+// their data.
+func (s *Servlet) closeTableStores() {
+	s.partitionMutex.Lock()
+	stores := s.tableStores
+	s.tableStores = nil
+	s.partitionMutex.Unlock()
+	for _, p := range stores {
+		p.drop(p.servlet.inMemory())
+	}
+}
+
+// Repairs the databases of the servlet's separate stores.
+func (s *Servlet) repairTableStores() error {
+	dir := filepath.Join(s.path, separateStoreDir)
+	infos, err := ioutil.ReadDir(dir)
+	if os.IsNotExist(err) {
+		return nil
+	} else if err != nil {
+		return err
+	}
+	for _, info := range infos {
+		if !info.IsDir() {
+			continue
+		}
+		if err := s.storage.repair(filepath.Join(dir, info.Name())); err != nil {
+			return fmt.Errorf("skyd.Servlet: Unable to repair table store %s: %v", info.Name(), err)
+		}
+	}
+	return nil
+}
@@ -1,9 +1,16 @@
 package skyd
 
 import (
+	"bytes"
+	"fmt"
+	"github.com/jmhodges/levigo"
 	"io/ioutil"
 	"os"
+	"path/filepath"
+	"strings"
+	"sync"
 	"testing"
+	"time"
 )
 
 // Ensure that we can open and close a servlet.
@@ -67,3 +74,864 @@ func TestServletPutEvent(t *testing.T) {
 		}
 	}
 }
+
+// Ensure that events written as blocks can be read back and appended to.
+func TestServletPutEventBlocks(t *testing.T) {
+	path, err := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	servlet.SetEventBlocksEnabled(true)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	// Add an out-of-order event so the object is rewritten as a block and
+	// then append enough events to fold them into the block again.
+	expected := make([]*Event, 0)
+	for i := 0; i < 300; i++ {
+		e := &Event{Timestamp: time.Unix(int64(1000+i), 0).UTC(), Data: map[int64]interface{}{-1: fmt.Sprintf("action%d", i), 2: int64(i)}}
+		expected = append(expected, &Event{Timestamp: e.Timestamp, Data: map[int64]interface{}{-1: e.Data[-1], 2: e.Data[2]}})
+		if i == 1 {
+			e0 := &Event{Timestamp: time.Unix(999, 0).UTC(), Data: map[int64]interface{}{-1: "first"}}
+			expected = append([]*Event{&Event{Timestamp: e0.Timestamp, Data: map[int64]interface{}{-1: "first"}}}, expected...)
+			if err = servlet.PutEvent(table, "bob", e0, true); err != nil {
+				t.Fatalf("Unable to add event: %v", err)
+			}
+		}
+		if err = servlet.PutEvent(table, "bob", e, true); err != nil {
+			t.Fatalf("Unable to add event: %v", err)
+		}
+	}
+
+	o, err := servlet.getObject(table, "bob")
+	if err != nil || len(o.tail) == 0 || o.tail[0] != eventBlockFlag {
+		t.Fatalf("Expected event block: %v", err)
+	}
+	if eventBlockTailSize(o.tail) >= eventBlockTailThreshold {
+		t.Fatalf("Appended events were not folded into the block: %v", eventBlockTailSize(o.tail))
+	}
+	output, _, err := servlet.GetEvents(table, "bob")
+	if err != nil {
+		t.Fatalf("Unable to retrieve events: %v", err)
+	}
+	assertEvents(t, expected, output)
+}
+
+// Ensure that a servlet's key range can be split into contiguous ranges.
+func TestServletSplitKeyRange(t *testing.T) {
+	path, err := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	for i := 0; i < 20; i++ {
+		e := NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{-1: "foo"})
+		if err = servlet.PutEvent(table, fmt.Sprintf("%c-obj", 'a'+i), e, true); err != nil {
+			t.Fatalf("Unable to add event: %v", err)
+		}
+	}
+
+	prefix, _ := TablePrefix(table.Name)
+	boundaries, err := servlet.SplitKeyRange(prefix, 4)
+	if err != nil {
+		t.Fatalf("Unable to split key range: %v", err)
+	}
+	if len(boundaries) != 3 {
+		t.Fatalf("Expected 3 boundaries, got %v", len(boundaries))
+	}
+	for i := range boundaries {
+		if !bytes.HasPrefix(boundaries[i], prefix) {
+			t.Fatalf("Boundary outside of prefix: %v", boundaries[i])
+		}
+		if i > 0 && bytes.Compare(boundaries[i-1], boundaries[i]) >= 0 {
+			t.Fatalf("Boundaries out of order: %v", boundaries)
+		}
+	}
+
+	boundaries, err = servlet.SplitKeyRange(prefix, 1)
+	if err != nil || len(boundaries) != 0 {
+		t.Fatalf("Expected no boundaries: %v, %v", boundaries, err)
+	}
+}
+
+// Ensure that concurrent event writes are grouped without losing events.
+func TestServletPutEventConcurrent(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	var wg sync.WaitGroup
+	errs := make(chan error, 200)
+	for i := 0; i < 200; i++ {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			e := &Event{Timestamp: time.Unix(int64(1000+(i*7)%200), 0).UTC(), Data: map[int64]interface{}{2: int64(i)}}
+			errs <- servlet.PutEvent(table, fmt.Sprintf("obj%d", i%4), e, true)
+		}(i)
+	}
+	wg.Wait()
+	close(errs)
+	for err := range errs {
+		if err != nil {
+			t.Fatalf("Unable to add event: %v", err)
+		}
+	}
+
+	for i := 0; i < 4; i++ {
+		events, _, err := servlet.GetEvents(table, fmt.Sprintf("obj%d", i))
+		if err != nil {
+			t.Fatalf("Unable to retrieve events: %v", err)
+		}
+		if len(events) != 50 {
+			t.Fatalf("Expected 50 events for obj%d, got %v", i, len(events))
+		}
+		for j := 1; j < len(events); j++ {
+			if !events[j-1].Timestamp.Before(events[j].Timestamp) {
+				t.Fatalf("Events out of order: %v", events)
+			}
+		}
+	}
+}
+
+// Ensure that events can be added and deleted for different objects at the
+// same time.
+func TestServletDeleteEventConcurrent(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+	for i := 0; i < 200; i++ {
+		e := &Event{Timestamp: time.Unix(int64(1+i/20), 0).UTC(), Data: map[int64]interface{}{2: int64(i)}}
+		if err := servlet.PutEvent(table, fmt.Sprintf("del%d", i%20), e, true); err != nil {
+			t.Fatalf("Unable to add event: %v", err)
+		}
+	}
+
+	var wg sync.WaitGroup
+	errs := make(chan error, 400)
+	for i := 0; i < 200; i++ {
+		wg.Add(2)
+		go func(i int) {
+			defer wg.Done()
+			e := &Event{Timestamp: time.Unix(int64(1000+i), 0).UTC(), Data: map[int64]interface{}{2: int64(i)}}
+			errs <- servlet.PutEvent(table, fmt.Sprintf("obj%d", i%20), e, true)
+		}(i)
+		go func(i int) {
+			defer wg.Done()
+			errs <- servlet.DeleteEvent(table, fmt.Sprintf("del%d", i%20), time.Unix(int64(1+i/20), 0).UTC())
+		}(i)
+	}
+	wg.Wait()
+	close(errs)
+	for err := range errs {
+		if err != nil {
+			t.Fatalf("Unable to write object: %v", err)
+		}
+	}
+
+	for i := 0; i < 20; i++ {
+		events, _, err := servlet.GetEvents(table, fmt.Sprintf("obj%d", i))
+		if err != nil || len(events) != 10 {
+			t.Fatalf("Expected 10 events for obj%d, got %v (%v)", i, len(events), err)
+		}
+		events, _, err = servlet.GetEvents(table, fmt.Sprintf("del%d", i))
+		if err != nil || len(events) != 0 {
+			t.Fatalf("Expected no events for del%d, got %v (%v)", i, len(events), err)
+		}
+	}
+}
+
+// Ensure that large objects are split into chunks and that out-of-order
+// inserts only rewrite the chunk they fall into.
+func TestServletPutEventChunks(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	payload := strings.Repeat("x", 1000)
+	expected := make([]*Event, 0)
+	for i := 0; i < 300; i++ {
+		if i == 150 {
+			continue
+		}
+		e := &Event{Timestamp: time.Unix(int64(1000+i), 0).UTC(), Data: map[int64]interface{}{-1: payload, 1: int64(i)}}
+		expected = append(expected, &Event{Timestamp: e.Timestamp, Data: map[int64]interface{}{-1: payload, 1: int64(i)}})
+		if err := servlet.PutEvent(table, "bob", e, true); err != nil {
+			t.Fatalf("Unable to add event: %v", err)
+		}
+	}
+
+	// Insert the missing event into one of the sealed chunks.
+	e := &Event{Timestamp: time.Unix(1150, 0).UTC(), Data: map[int64]interface{}{-1: "inserted", 2: "foo"}}
+	if err := servlet.PutEvent(table, "bob", e, true); err != nil {
+		t.Fatalf("Unable to insert event: %v", err)
+	}
+	expected = append(expected[:150], append([]*Event{&Event{Timestamp: e.Timestamp, Data: map[int64]interface{}{-1: "inserted", 2: "foo"}}}, expected[150:]...)...)
+
+	o, err := servlet.getObject(table, "bob")
+	if err != nil {
+		t.Fatalf("Unable to read object: %v", err)
+	}
+	if len(o.chunks) < 3 {
+		t.Fatalf("Expected object to be split into chunks, got %v", len(o.chunks))
+	}
+	if len(o.tail) >= objectChunkSize {
+		t.Fatalf("Tail was not sealed: %v", len(o.tail))
+	}
+	output, state, err := servlet.GetEvents(table, "bob")
+	if err != nil {
+		t.Fatalf("Unable to retrieve events: %v", err)
+	}
+	assertEvents(t, expected, output)
+	if state.Data[1] != int64(299) || state.Data[2] != "foo" {
+		t.Fatalf("Incorrect state: %v", state)
+	}
+
+	// Deleting the object removes its chunks.
+	if err = servlet.DeleteEvents(table, "bob"); err != nil {
+		t.Fatalf("Unable to delete events: %v", err)
+	}
+	if o, _ = servlet.getObject(table, "bob"); len(o.chunks) != 0 || o.state != nil {
+		t.Fatalf("Chunks were not deleted: %v", len(o.chunks))
+	}
+}
+
+// Ensure that single events can be found and deleted in the chunks of an
+// object.
+func TestServletGetEventChunks(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	payload := strings.Repeat("x", 1000)
+	expected := make([]*Event, 0)
+	for i := 0; i < 300; i++ {
+		e := &Event{Timestamp: time.Unix(int64(1000+i), 0).UTC(), Data: map[int64]interface{}{-1: payload, 1: int64(i)}}
+		expected = append(expected, &Event{Timestamp: e.Timestamp, Data: map[int64]interface{}{-1: payload, 1: int64(i)}})
+		if err := servlet.PutEvent(table, "bob", e, true); err != nil {
+			t.Fatalf("Unable to add event: %v", err)
+		}
+	}
+	if o, _ := servlet.getObject(table, "bob"); len(o.chunks) < 3 {
+		t.Fatalf("Expected object to be split into chunks, got %v", len(o.chunks))
+	}
+
+	// Find events in the first chunk, a middle chunk and the tail.
+	for _, i := range []int{0, 150, 299} {
+		event, err := servlet.GetEvent(table, "bob", expected[i].Timestamp)
+		if err != nil || event == nil {
+			t.Fatalf("Unable to find event %d: %v", i, err)
+		}
+		assertEvents(t, []*Event{expected[i]}, []*Event{event})
+	}
+	if event, err := servlet.GetEvent(table, "bob", time.Unix(999, 0).UTC()); event != nil || err != nil {
+		t.Fatalf("Unexpected event: %v (%v)", event, err)
+	}
+	if event, err := servlet.GetEvent(table, "bob", time.Unix(1150, 500000).UTC()); event != nil || err != nil {
+		t.Fatalf("Unexpected event: %v (%v)", event, err)
+	}
+
+	// Delete an event from a middle chunk and the most recent event.
+	for _, i := range []int{299, 150} {
+		if err := servlet.DeleteEvent(table, "bob", expected[i].Timestamp); err != nil {
+			t.Fatalf("Unable to delete event %d: %v", i, err)
+		}
+		expected = append(expected[:i], expected[i+1:]...)
+	}
+	if event, _ := servlet.GetEvent(table, "bob", time.Unix(1150, 0).UTC()); event != nil {
+		t.Fatalf("Event was not deleted: %v", event)
+	}
+	output, state, err := servlet.GetEvents(table, "bob")
+	if err != nil {
+		t.Fatalf("Unable to retrieve events: %v", err)
+	}
+	assertEvents(t, expected, output)
+	if !state.Timestamp.Equal(time.Unix(1298, 0)) || state.Data[1] != int64(298) {
+		t.Fatalf("Incorrect state: %v", state)
+	}
+}
+
+// Ensure that each new tail starts with a checkpoint of the state and that
+// out-of-order writes drop the checkpoints they make stale.
+func TestServletEventCheckpoints(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	payload := strings.Repeat("x", 1000)
+	for i := 0; i < 300; i++ {
+		e := &Event{Timestamp: time.Unix(int64(1000+i), 0).UTC(), Data: map[int64]interface{}{-1: payload, 1: int64(i / 100)}}
+		if err := servlet.PutEvent(table, "bob", e, true); err != nil {
+			t.Fatalf("Unable to add event: %v", err)
+		}
+	}
+	o, err := servlet.getObject(table, "bob")
+	if err != nil || len(o.chunks) < 3 {
+		t.Fatalf("Expected object to be split into chunks: %v", err)
+	}
+	if err = o.loadChunk(o.chunks[2]); err != nil {
+		t.Fatalf("Unable to load chunk: %v", err)
+	}
+	data := o.chunks[2].data
+	if data[0] != eventCheckpointFlag {
+		t.Fatalf("Expected chunk to start with a checkpoint")
+	}
+	checkpoint := &Event{}
+	if err = checkpoint.UnmarshalRaw(data[1:]); err != nil || checkpoint.Data[1] != int64((UnshiftTime(o.chunks[2].start).Unix()-1001)/100) {
+		t.Fatalf("Invalid checkpoint: %v (%v)", checkpoint, err)
+	}
+	if events, _ := DecodeEvents(data); !events[0].Timestamp.Equal(checkpoint.Timestamp) {
+		t.Fatalf("Checkpoint is not in front of an event: %v", checkpoint.Timestamp)
+	}
+
+	// An insert into the first chunk with a new permanent property drops the
+	// checkpoints after it.
+	e := &Event{Timestamp: time.Unix(1000, 500000).UTC(), Data: map[int64]interface{}{2: "foo"}}
+	if err = servlet.PutEvent(table, "bob", e, true); err != nil {
+		t.Fatalf("Unable to insert event: %v", err)
+	}
+	if o, err = servlet.getObject(table, "bob"); err != nil {
+		t.Fatalf("Unable to read object: %v", err)
+	}
+	for i, chunk := range o.chunks {
+		if err = o.loadChunk(chunk); err != nil || chunk.data[0] == eventCheckpointFlag {
+			t.Fatalf("Stale checkpoint in chunk %d: %v", i, err)
+		}
+	}
+	output, _, err := servlet.GetEvents(table, "bob")
+	if err != nil || len(output) != 301 {
+		t.Fatalf("Unable to retrieve events: %v (%v)", len(output), err)
+	}
+}
+
+// Ensure that appends merged onto an object read back in order and that
+// inserts and reopening see the merged events.
+func TestServletPutEventMerge(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	// Append more events than a single run of merges allows.
+	expected := make([]*Event, 0)
+	for i := 0; i < 2*objectMergeRunLimit+5; i++ {
+		e := &Event{Timestamp: time.Unix(int64(1000+(2*i)), 0).UTC(), Data: map[int64]interface{}{-1: int64(i), 1: "foo"}}
+		if i == 0 {
+			expected = append(expected, &Event{Timestamp: e.Timestamp, Data: map[int64]interface{}{-1: int64(i), 1: "foo"}})
+		} else {
+			expected = append(expected, &Event{Timestamp: e.Timestamp, Data: map[int64]interface{}{-1: int64(i)}})
+		}
+		if err := servlet.PutEvent(table, "bob", e, true); err != nil {
+			t.Fatalf("Unable to add event: %v", err)
+		}
+	}
+	if len(servlet.mergeRuns) == 0 {
+		t.Fatalf("Expected appends to be merged")
+	}
+	output, state, err := servlet.GetEvents(table, "bob")
+	if err != nil {
+		t.Fatalf("Unable to retrieve events: %v", err)
+	}
+	assertEvents(t, expected, output)
+	if state.Data[1] != "foo" || !state.Timestamp.Equal(expected[len(expected)-1].Timestamp) {
+		t.Fatalf("Incorrect state: %v", state)
+	}
+
+	// Insert an event between merged appends.
+	e := &Event{Timestamp: time.Unix(1003, 0).UTC(), Data: map[int64]interface{}{-1: "inserted", 2: "bar"}}
+	if err = servlet.PutEvent(table, "bob", e, true); err != nil {
+		t.Fatalf("Unable to insert event: %v", err)
+	}
+	expected = append(expected[:2], append([]*Event{&Event{Timestamp: e.Timestamp, Data: map[int64]interface{}{-1: "inserted", 2: "bar"}}}, expected[2:]...)...)
+
+	// Merged events survive a reopen and a compaction.
+	servlet.Close()
+	if err = servlet.Open(); err != nil {
+		t.Fatalf("Unable to reopen servlet: %v", err)
+	}
+	e = &Event{Timestamp: time.Unix(5000, 0).UTC(), Data: map[int64]interface{}{-1: "last", 1: "foo"}}
+	if err = servlet.PutEvent(table, "bob", e, true); err != nil {
+		t.Fatalf("Unable to add event: %v", err)
+	}
+	expected = append(expected, &Event{Timestamp: e.Timestamp, Data: map[int64]interface{}{-1: "last"}})
+	servlet.db.CompactRange(levigo.Range{})
+	output, state, err = servlet.GetEvents(table, "bob")
+	if err != nil {
+		t.Fatalf("Unable to retrieve events: %v", err)
+	}
+	assertEvents(t, expected, output)
+	if state.Data[1] != "foo" || state.Data[2] != "bar" {
+		t.Fatalf("Incorrect state: %v", state)
+	}
+}
+
+// Ensure that retried events with a recently written id aren't written again.
+func TestServletPutEventDuplicateIds(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	// Repeats within a write and retries of a write are dropped.
+	e0 := &Event{Timestamp: time.Unix(1000, 0).UTC(), Data: map[int64]interface{}{-1: "first"}, Id: "a"}
+	e1 := &Event{Timestamp: time.Unix(1000, 0).UTC(), Data: map[int64]interface{}{-1: "repeat"}, Id: "a"}
+	e2 := &Event{Timestamp: time.Unix(2000, 0).UTC(), Data: map[int64]interface{}{-1: "second"}, Id: "b"}
+	if err := servlet.PutEvents(table, []string{"bob", "bob", "bob"}, []*Event{e0, e1, e2}, false); err != nil {
+		t.Fatalf("Unable to add events: %v", err)
+	}
+	retry := &Event{Timestamp: time.Unix(2000, 0).UTC(), Data: map[int64]interface{}{-1: "retry"}, Id: "b"}
+	if err := servlet.PutEvent(table, "bob", retry, true); err != nil {
+		t.Fatalf("Unable to retry event: %v", err)
+	}
+	if n := servlet.duplicateEvents.Value(); n != 2 {
+		t.Fatalf("Expected 2 duplicates, got %d", n)
+	}
+
+	// Ids are per object, and events without one are always written.
+	other := &Event{Timestamp: time.Unix(1000, 0).UTC(), Data: map[int64]interface{}{-1: "other"}, Id: "a"}
+	if err := servlet.PutEvent(table, "susy", other, true); err != nil {
+		t.Fatalf("Unable to add event: %v", err)
+	}
+	plain := &Event{Timestamp: time.Unix(2000, 0).UTC(), Data: map[int64]interface{}{-1: "plain"}}
+	if err := servlet.PutEvent(table, "bob", plain, false); err != nil {
+		t.Fatalf("Unable to add event: %v", err)
+	}
+
+	// A durable retry of an event that wasn't written durably is written.
+	durable := &Event{Timestamp: time.Unix(1000, 0).UTC(), Data: map[int64]interface{}{-1: "durable"}, Id: "a"}
+	if err := servlet.PutDurableEvents(table, []string{"bob"}, []*Event{durable}, true); err != nil {
+		t.Fatalf("Unable to add durable event: %v", err)
+	}
+	if err := servlet.PutDurableEvents(table, []string{"bob"}, []*Event{e0}, true); err != nil {
+		t.Fatalf("Unable to retry durable event: %v", err)
+	}
+	if n := servlet.duplicateEvents.Value(); n != 3 {
+		t.Fatalf("Expected 3 duplicates, got %d", n)
+	}
+
+	output, _, err := servlet.GetEvents(table, "bob")
+	if err != nil {
+		t.Fatalf("Unable to retrieve events: %v", err)
+	}
+	assertEvents(t, []*Event{
+		&Event{Timestamp: time.Unix(1000, 0).UTC(), Data: map[int64]interface{}{-1: "durable"}},
+		&Event{Timestamp: time.Unix(2000, 0).UTC(), Data: map[int64]interface{}{-1: "plain"}},
+	}, output)
+}
+
+// Ensure that the ids of a servlet's dedup filter are forgotten once they
+// fall out of its recent ids.
+func TestEventDedupRotation(t *testing.T) {
+	d := &eventDedup{}
+	for i := 0; i < 3*eventDedupSize; i++ {
+		d.add([]string{fmt.Sprint(i)}, false)
+	}
+	if d.contains("0", false) || d.contains(fmt.Sprint(2*eventDedupSize-1), false) {
+		t.Fatalf("Expected old ids to be forgotten")
+	}
+	for _, i := range []int{2 * eventDedupSize, 3*eventDedupSize - 1} {
+		if !d.contains(fmt.Sprint(i), false) {
+			t.Fatalf("Expected id %d to be remembered", i)
+		}
+	}
+	if len(d.recent) != eventDedupSize {
+		t.Fatalf("Expected %d recent ids, got %d", eventDedupSize, len(d.recent))
+	}
+}
+
+// Ensure that buffered objects take writes in memory and are written before
+// they're read, when they expire and when the servlet closes.
+func TestServletObjectBuffer(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	servlet.SetEventBlocksEnabled(true)
+	servlet.SetObjectBufferOptions(ObjectBufferOptions{Size: 1 << 20, Delay: time.Hour})
+	defer servlet.Close()
+	_ = servlet.Open()
+	buffered := func() int {
+		servlet.bufferMutex.Lock()
+		defer servlet.bufferMutex.Unlock()
+		return len(servlet.buffered)
+	}
+
+	expected := make([]*Event, 0)
+	for i := 0; i < 10; i++ {
+		e := &Event{Timestamp: time.Unix(int64(1000+i), 0).UTC(), Data: map[int64]interface{}{-1: int64(i)}}
+		expected = append(expected, &Event{Timestamp: e.Timestamp, Data: map[int64]interface{}{-1: int64(i)}})
+		if err := servlet.PutEvent(table, "bob", e, true); err != nil {
+			t.Fatalf("Unable to add event: %v", err)
+		}
+	}
+	key, _ := table.EncodeObjectId("bob")
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	if value, _ := servlet.db.Get(ro, key); value != nil || buffered() != 1 {
+		t.Fatalf("Expected the object to be buffered: %v", buffered())
+	}
+
+	// Reads write the object first.
+	output, _, err := servlet.GetEvents(table, "bob")
+	if err != nil {
+		t.Fatalf("Unable to retrieve events: %v", err)
+	}
+	assertEvents(t, expected, output)
+	if value, _ := servlet.db.Get(ro, key); value == nil || buffered() != 0 {
+		t.Fatalf("Expected the object to be written: %v", buffered())
+	}
+
+	// Closing writes the buffer.
+	e := &Event{Timestamp: time.Unix(2000, 0).UTC(), Data: map[int64]interface{}{-1: "last"}}
+	if err = servlet.PutEvent(table, "bob", e, true); err != nil {
+		t.Fatalf("Unable to add event: %v", err)
+	}
+	expected = append(expected, &Event{Timestamp: e.Timestamp, Data: map[int64]interface{}{-1: "last"}})
+	servlet.Close()
+	servlet.SetObjectBufferOptions(ObjectBufferOptions{Size: 1 << 20, Delay: 10 * time.Millisecond})
+	if err = servlet.Open(); err != nil {
+		t.Fatalf("Unable to reopen servlet: %v", err)
+	}
+	output, _, err = servlet.GetEvents(table, "bob")
+	if err != nil {
+		t.Fatalf("Unable to retrieve events: %v", err)
+	}
+	assertEvents(t, expected, output)
+
+	// Expired objects are written in the background.
+	if err = servlet.PutEvent(table, "susy", e, true); err != nil {
+		t.Fatalf("Unable to add event: %v", err)
+	}
+	for i := 0; i < 100 && buffered() > 0; i++ {
+		time.Sleep(10 * time.Millisecond)
+	}
+	key, _ = table.EncodeObjectId("susy")
+	if value, _ := servlet.db.Get(ro, key); value == nil {
+		t.Fatalf("Expected the expired object to be written")
+	}
+}
+
+// Ensure that events written to a table with a reorder window are held and
+// sorted before they're written.
+func TestServletReorderWindow(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	table.SetReorderWindow(50)
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+	held := func() int {
+		servlet.heldMutex.Lock()
+		defer servlet.heldMutex.Unlock()
+		return len(servlet.held)
+	}
+
+	for _, i := range []int{3, 1, 2} {
+		e := &Event{Timestamp: time.Unix(int64(1000+i), 0).UTC(), Data: map[int64]interface{}{-1: int64(i)}}
+		if err := servlet.PutEvent(table, "bob", e, true); err != nil {
+			t.Fatalf("Unable to add event: %v", err)
+		}
+	}
+	if held() != 1 {
+		t.Fatalf("Expected the events to be held: %v", held())
+	}
+
+	// Reads write the held events first.
+	output, _, err := servlet.GetEvents(table, "bob")
+	if err != nil {
+		t.Fatalf("Unable to retrieve events: %v", err)
+	}
+	assertEvents(t, []*Event{
+		&Event{Timestamp: time.Unix(1001, 0).UTC(), Data: map[int64]interface{}{-1: int64(1)}},
+		&Event{Timestamp: time.Unix(1002, 0).UTC(), Data: map[int64]interface{}{-1: int64(2)}},
+		&Event{Timestamp: time.Unix(1003, 0).UTC(), Data: map[int64]interface{}{-1: int64(3)}},
+	}, output)
+	if held() != 0 {
+		t.Fatalf("Expected the events to be released: %v", held())
+	}
+
+	// Held events are released once the window passes.
+	e := &Event{Timestamp: time.Unix(2000, 0).UTC(), Data: map[int64]interface{}{-1: int64(4)}}
+	if err = servlet.PutEvent(table, "susy", e, true); err != nil {
+		t.Fatalf("Unable to add event: %v", err)
+	}
+	for i := 0; i < 100 && held() > 0; i++ {
+		time.Sleep(10 * time.Millisecond)
+	}
+	key, _ := table.EncodeObjectId("susy")
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	if value, _ := servlet.db.Get(ro, key); value == nil {
+		t.Fatalf("Expected the held events to be written")
+	}
+}
+
+// Ensure that states are read from their own key and that objects that
+// keep their state in their head are moved over when they're written.
+func TestServletObjectState(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	// Write an object the way it was stored before states had their own key.
+	key, _ := table.EncodeObjectId("bob")
+	e := &Event{Timestamp: time.Unix(1000, 0).UTC(), Data: map[int64]interface{}{-1: "first", 1: "foo"}}
+	data, _ := e.MarshalRaw()
+	value, _ := encodeObject(&Event{Timestamp: e.Timestamp, Data: map[int64]interface{}{1: "foo"}}, data)
+	ro, wo := levigo.NewReadOptions(), levigo.NewWriteOptions()
+	defer ro.Close()
+	defer wo.Close()
+	servlet.db.Put(wo, key, value)
+	if state, err := servlet.GetState(table, "bob"); err != nil || state.Data[1] != "foo" {
+		t.Fatalf("Unable to read state from head: %v, %v", state, err)
+	}
+
+	// Writing the object moves its state out of its head.
+	if err := servlet.PutEvent(table, "bob", &Event{Timestamp: time.Unix(1001, 0).UTC(), Data: map[int64]interface{}{2: "bar"}}, true); err != nil {
+		t.Fatalf("Unable to add event: %v", err)
+	}
+	value, _ = servlet.db.Get(ro, key)
+	if head, _, err := decodeObject(value); err != nil || head != nil {
+		t.Fatalf("Expected head without a state: %v, %v", head, err)
+	}
+	value, _ = servlet.db.Get(ro, objectStateKey(key))
+	if state, tailSize, err := decodeObjectState(value); err != nil || tailSize == 0 || state.Data[2] != "bar" {
+		t.Fatalf("Unable to read state key: %v, %v, %v", state, tailSize, err)
+	}
+	state, err := servlet.GetState(table, "bob")
+	if err != nil || state.Data[1] != "foo" || state.Data[2] != "bar" || !state.Timestamp.Equal(time.Unix(1001, 0).UTC()) {
+		t.Fatalf("Incorrect state: %v, %v", state, err)
+	}
+	output, _, err := servlet.GetEvents(table, "bob")
+	if err != nil || len(output) != 2 {
+		t.Fatalf("Unable to retrieve events: %v, %v", output, err)
+	}
+
+	// Deleting the object removes its state.
+	if err = servlet.DeleteEvents(table, "bob"); err != nil {
+		t.Fatalf("Unable to delete events: %v", err)
+	}
+	if value, _ = servlet.db.Get(ro, objectStateKey(key)); value != nil {
+		t.Fatalf("State was not deleted")
+	}
+}
+
+// Ensure that frozen objects are moved out of the database and can still be
+// read after the servlet is reopened.
+func TestServletFreeze(t *testing.T) {
+	path, err := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	old := NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{-1: 10})
+	recent := NewEvent("2013-01-01T00:00:00Z", map[int64]interface{}{-1: 20})
+	if err = servlet.PutEvent(table, "bob", old, true); err != nil {
+		t.Fatalf("Unable to add event: %v", err)
+	}
+	if err = servlet.PutEvent(table, "susy", recent, true); err != nil {
+		t.Fatalf("Unable to add event: %v", err)
+	}
+
+	// Only the object older than the cutoff is frozen.
+	n, err := servlet.Freeze(table, time.Date(2012, 6, 1, 0, 0, 0, 0, time.UTC))
+	if err != nil || n != 1 {
+		t.Fatalf("Unable to freeze: %v (%v)", n, err)
+	}
+	if o, _ := servlet.getObject(table, "bob"); o.exists {
+		t.Fatalf("Frozen object is still in the database")
+	}
+
+	// Frozen objects are read back from the file, before and after reopening.
+	for i := 0; i < 2; i++ {
+		output, state, err := servlet.GetEvents(table, "bob")
+		if err != nil || state == nil {
+			t.Fatalf("Unable to retrieve events: %v", err)
+		}
+		assertEvents(t, []*Event{old}, output)
+		if output, _, _ = servlet.GetEvents(table, "susy"); len(output) != 1 {
+			t.Fatalf("Expected live object, got %v events", len(output))
+		}
+		servlet.Close()
+		if err = servlet.Open(); err != nil {
+			t.Fatalf("Unable to reopen servlet: %v", err)
+		}
+	}
+
+	// Nothing is left to freeze before the cutoff.
+	if n, err = servlet.Freeze(table, time.Date(2012, 6, 1, 0, 0, 0, 0, time.UTC)); err != nil || n != 0 {
+		t.Fatalf("Unexpected freeze: %v (%v)", n, err)
+	}
+}
+
+// Ensure that a partitioned servlet writes events to the partition of their
+// timestamp, reads them back across partitions and drops whole partitions.
+func TestServletPartitions(t *testing.T) {
+	path, err := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	servlet.SetPartitionMonths(1)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	input := []*Event{
+		NewEvent("2012-03-01T00:00:00Z", map[int64]interface{}{-1: 30, 2: "baz"}),
+		NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{-1: 10, 1: "foo"}),
+		NewEvent("2012-01-02T00:00:00Z", map[int64]interface{}{-1: 20}),
+	}
+	if err = servlet.PutEvents(table, []string{"bob", "bob", "bob"}, input, true); err != nil {
+		t.Fatalf("Unable to add events: %v", err)
+	}
+	if infos, _ := ioutil.ReadDir(servlet.partitionPath()); len(infos) != 2 || infos[0].Name() != "2012-01_2012-02" {
+		t.Fatalf("Unexpected partitions: %v", infos)
+	}
+
+	// Events are read in time order with the state merged across partitions.
+	output, state, err := servlet.GetEvents(table, "bob")
+	if err != nil {
+		t.Fatalf("Unable to retrieve events: %v", err)
+	}
+	assertEvents(t, []*Event{input[1], input[2], input[0]}, output)
+	if state.Data[1] != "foo" || state.Data[2] != "baz" {
+		t.Fatalf("Incorrect state: %v", state)
+	}
+
+	// Partitions are reopened with the servlet and dropped as a whole.
+	servlet.Close()
+	if err = servlet.Open(); err != nil {
+		t.Fatalf("Unable to reopen servlet: %v", err)
+	}
+	if n := servlet.DropPartitions(time.Date(2012, 2, 1, 0, 0, 0, 0, time.UTC)); n != 1 {
+		t.Fatalf("Expected one dropped partition, got %v", n)
+	}
+	if output, _, _ = servlet.GetEvents(table, "bob"); len(output) != 1 {
+		t.Fatalf("Expected one event, got %v", len(output))
+	}
+	if infos, _ := ioutil.ReadDir(servlet.partitionPath()); len(infos) != 1 {
+		t.Fatalf("Dropped partition was not removed: %v", infos)
+	}
+}
+
+// Ensure that a servlet records the blocks in its cache for each of its
+// databases and reads a recorded list back until it's stopped.
+func TestServletWarmCache(t *testing.T) {
+	path, err := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	servlet.SetPartitionMonths(1)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	e := NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{-1: 10, 1: "foo"})
+	if err = servlet.PutEvent(table, "bob", e, true); err != nil {
+		t.Fatalf("Unable to add event: %v", err)
+	}
+	if err = servlet.saveCachedBlocks(); err != nil {
+		t.Fatalf("Unable to record cached blocks: %v", err)
+	}
+	for _, p := range []string{servlet.path, filepath.Join(servlet.partitionPath(), "2012-01_2012-02")} {
+		if _, err = os.Stat(filepath.Join(p, warmupFileName)); err != nil {
+			t.Fatalf("Cached blocks not recorded in %s: %v", p, err)
+		}
+	}
+
+	// Blocks of tables that no longer exist are skipped.
+	blocks := []byte{0x80, 0x01, 0x00, 0x80, 0x01, 0x80, 0x20, 0x81, 0x01, 0x00}
+	if lists := splitBlockList(blocks, 2); len(lists) != 2 || !bytes.Equal(lists[1], blocks[7:]) {
+		t.Fatalf("Unexpected block lists: %v", lists)
+	}
+	ioutil.WriteFile(servlet.warmupPath(), blocks, 0600)
+	if stopped, err := servlet.warmCache(0, make(chan bool)); stopped || err != nil {
+		t.Fatalf("Unable to warm cache: %v (%v)", stopped, err)
+	}
+	stop := make(chan bool)
+	close(stop)
+	if stopped, _ := servlet.warmCache(0, stop); !stopped {
+		t.Fatalf("Expected the warm-up to stop")
+	}
+
+	// Malformed lists are reported.
+	ioutil.WriteFile(servlet.warmupPath(), []byte{0x80}, 0600)
+	if _, err = servlet.warmCache(0, make(chan bool)); err == nil {
+		t.Fatalf("Expected a malformed block list to fail")
+	}
+}
+
+// Ensure that loaded objects are written to a table file that's added to the
+// database and that loads overlapping existing objects are written normally.
+func TestServletLoadEvents(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+	epoch := servlet.changes.epoch
+
+	objectIds := []string{"susy", "bob", "bob", "bob"}
+	events := []*Event{
+		NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{-1: 10}),
+		NewEvent("2012-01-03T00:00:00Z", map[int64]interface{}{-1: 30}),
+		NewEvent("2012-01-02T00:00:00Z", map[int64]interface{}{-1: 20}),
+		NewEvent("2012-01-02T00:00:00Z", map[int64]interface{}{-1: 21}),
+	}
+	if err := servlet.LoadEvents(table, objectIds, events); err != nil {
+		t.Fatalf("Unable to load events: %v", err)
+	}
+	if servlet.changes.epoch == epoch {
+		t.Fatalf("Expected the change log to start a new epoch")
+	}
+	if files, _ := filepath.Glob(filepath.Join(path, "load-*")); len(files) != 0 {
+		t.Fatalf("Expected the load file to be removed: %v", files)
+	}
+	output, _, err := servlet.GetEvents(table, "bob")
+	if err != nil {
+		t.Fatalf("Unable to retrieve events: %v", err)
+	}
+	assertEvents(t, []*Event{events[3], events[1]}, output)
+	if output, _, _ = servlet.GetEvents(table, "susy"); len(output) != 1 {
+		t.Fatalf("Expected one loaded event: %v", output)
+	}
+
+	// Loads into objects that already exist are added to them.
+	epoch = servlet.changes.epoch
+	e := NewEvent("2012-01-04T00:00:00Z", map[int64]interface{}{-1: 40})
+	if err = servlet.LoadEvents(table, []string{"bob"}, []*Event{e}); err != nil {
+		t.Fatalf("Unable to load events: %v", err)
+	}
+	if servlet.changes.epoch != epoch {
+		t.Fatalf("Expected the overlapping load to go through the change log")
+	}
+	if output, _, _ = servlet.GetEvents(table, "bob"); len(output) != 3 {
+		t.Fatalf("Expected three events: %v", output)
+	}
+}
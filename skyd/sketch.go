@@ -0,0 +1,190 @@
+package skyd
+
+import (
+	"encoding/binary"
+	"errors"
+	"math"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// Sketch layouts built by the generated aggregate functions. These match the
+// definitions in csky's sketch.h.
+const (
+	sketchTypeHLL       = 1
+	sketchTypeQuantile  = 2
+	sketchTypeHistogram = 3
+	sketchVersion       = 1
+	sketchHeaderSize    = 2
+)
+
+const (
+	hllPrecision     = 12
+	hllRegisterCount = 1 << hllPrecision
+	hllSize          = sketchHeaderSize + hllRegisterCount
+)
+
+const (
+	quantileAccuracy    = 0.02
+	quantileBucketCount = 1024
+	quantileSize        = sketchHeaderSize + 8 + (8 * quantileBucketCount)
+)
+
+const (
+	histogramHeaderSize = sketchHeaderSize + 4 + 8 + 8
+	histogramMaxBuckets = 4096
+)
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Returns the type of a serialized sketch after checking its size.
+func sketchType(sketch string) (byte, error) {
+	if len(sketch) < sketchHeaderSize || sketch[1] != sketchVersion {
+		return 0, errors.New("skyd.Sketch: Invalid sketch header")
+	}
+	switch {
+	case sketch[0] == sketchTypeHLL && len(sketch) == hllSize:
+	case sketch[0] == sketchTypeQuantile && len(sketch) == quantileSize:
+	case sketch[0] == sketchTypeHistogram && len(sketch) >= histogramHeaderSize &&
+		len(sketch) == histogramHeaderSize+4*int(binary.LittleEndian.Uint32([]byte(sketch[sketchHeaderSize:]))):
+	default:
+		return 0, errors.New("skyd.Sketch: Invalid sketch size")
+	}
+	return sketch[0], nil
+}
+
+// Merges two serialized sketches of the same type.
+func mergeSketches(a string, b string) (string, error) {
+	t, err := sketchType(a)
+	if err != nil {
+		return "", err
+	}
+	if other, err := sketchType(b); err != nil {
+		return "", err
+	} else if other != t || (t == sketchTypeHistogram && a[:histogramHeaderSize] != b[:histogramHeaderSize]) {
+		return "", errors.New("skyd.Sketch: Mismatched sketch types")
+	}
+
+	merged := []byte(a)
+	switch t {
+	case sketchTypeHLL:
+		for i := sketchHeaderSize; i < hllSize; i++ {
+			if b[i] > merged[i] {
+				merged[i] = b[i]
+			}
+		}
+	case sketchTypeQuantile:
+		zero := merged[sketchHeaderSize:]
+		binary.LittleEndian.PutUint64(zero, binary.LittleEndian.Uint64(zero)+binary.LittleEndian.Uint64([]byte(b[sketchHeaderSize:sketchHeaderSize+8])))
+		for i := sketchHeaderSize + 8; i < quantileSize; i += 4 {
+			count := uint64(binary.LittleEndian.Uint32(merged[i:])) + uint64(binary.LittleEndian.Uint32([]byte(b[i:i+4])))
+			if count > math.MaxUint32 {
+				count = math.MaxUint32
+			}
+			binary.LittleEndian.PutUint32(merged[i:], uint32(count))
+		}
+	case sketchTypeHistogram:
+		for i := histogramHeaderSize; i < len(merged); i += 4 {
+			count := uint64(binary.LittleEndian.Uint32(merged[i:])) + uint64(binary.LittleEndian.Uint32([]byte(b[i:i+4])))
+			if count > math.MaxUint32 {
+				count = math.MaxUint32
+			}
+			binary.LittleEndian.PutUint32(merged[i:], uint32(count))
+		}
+	}
+	return string(merged), nil
+}
+
+// Estimates the number of distinct values added to a HyperLogLog sketch.
+// Small cardinalities use linear counting of the empty registers.
+func hllEstimate(sketch string) (int64, error) {
+	if t, err := sketchType(sketch); err != nil {
+		return 0, err
+	} else if t != sketchTypeHLL {
+		return 0, errors.New("skyd.Sketch: Not a distinct count sketch")
+	}
+
+	m := float64(hllRegisterCount)
+	sum, zeros := 0.0, 0
+	for i := sketchHeaderSize; i < hllSize; i++ {
+		sum += math.Ldexp(1, -int(sketch[i]))
+		if sketch[i] == 0 {
+			zeros++
+		}
+	}
+	estimate := (0.7213 / (1 + 1.079/m)) * m * m / sum
+	if estimate <= 2.5*m && zeros > 0 {
+		estimate = m * math.Log(m/float64(zeros))
+	}
+	return int64(estimate + 0.5), nil
+}
+
+// Returns the value at a quantile between 0 and 1 of a quantile sketch. The
+// value is within the sketch's relative accuracy of the true value. An empty
+// sketch has no value and nil is returned.
+func quantileValue(sketch string, q float64) (interface{}, error) {
+	if t, err := sketchType(sketch); err != nil {
+		return nil, err
+	} else if t != sketchTypeQuantile {
+		return nil, errors.New("skyd.Sketch: Not a quantile sketch")
+	}
+
+	zero := binary.LittleEndian.Uint64([]byte(sketch[sketchHeaderSize:]))
+	negative := []byte(sketch[sketchHeaderSize+8:])
+	positive := negative[4*quantileBucketCount:]
+	count := func(buckets []byte, i int) uint64 {
+		return uint64(binary.LittleEndian.Uint32(buckets[4*i:]))
+	}
+	total := zero
+	for i := 0; i < quantileBucketCount; i++ {
+		total += count(negative, i) + count(positive, i)
+	}
+	if total == 0 {
+		return nil, nil
+	}
+
+	// Walk the buckets in value order until the rank is passed.
+	gamma := (1 + quantileAccuracy) / (1 - quantileAccuracy)
+	value := func(i int) float64 {
+		return 2 * math.Pow(gamma, float64(i-(quantileBucketCount/2))) / (gamma + 1)
+	}
+	rank := uint64(q * float64(total-1))
+	var seen uint64
+	for i := quantileBucketCount - 1; i >= 0; i-- {
+		if seen += count(negative, i); seen > rank {
+			return -value(i), nil
+		}
+	}
+	if seen += zero; seen > rank {
+		return 0.0, nil
+	}
+	for i := 0; i < quantileBucketCount; i++ {
+		if seen += count(positive, i); seen > rank {
+			return value(i), nil
+		}
+	}
+	return value(quantileBucketCount - 1), nil
+}
+
+// Returns the count of each bucket of a histogram sketch in value order.
+func histogramCounts(sketch string) ([]uint32, error) {
+	if t, err := sketchType(sketch); err != nil {
+		return nil, err
+	} else if t != sketchTypeHistogram {
+		return nil, errors.New("skyd.Sketch: Not a histogram sketch")
+	}
+
+	counts := make([]uint32, (len(sketch)-histogramHeaderSize)/4)
+	for i := range counts {
+		counts[i] = binary.LittleEndian.Uint32([]byte(sketch[histogramHeaderSize+4*i:]))
+	}
+	return counts, nil
+}
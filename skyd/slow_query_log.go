@@ -0,0 +1,244 @@
+package skyd
+
+import (
+	"encoding/json"
+	"fmt"
+	"os"
+	"sync"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The size that a slow query log grows to before it's rotated by default.
+const DefaultSlowQueryLogSize = 64 << 20
+
+// The number of rotated slow query logs kept by default.
+const DefaultSlowQueryLogFiles = 4
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// SlowQueryLogOptions controls the log of queries that take longer than a
+// threshold. Each entry is a line of JSON with the query, the plan it ran
+// with, its phase timings in each servlet and the resources it used.
+//
+// Every query is profiled while the log is enabled, which costs a few
+// counters per block read. Unlike a requested profile, it doesn't skip
+// the query cache or stop the query from spilling, so cached servlets
+// are left out of the entry.
+type SlowQueryLogOptions struct {
+	// The time after which a query is logged. Zero disables the log.
+	Threshold time.Duration
+
+	// The file that entries are appended to. The entries are written to the
+	// server log instead if it's empty.
+	Path string
+
+	// The size in bytes after which the file is renamed with a ".1"
+	// suffix, shifting older files up, and a new file is started. Zero
+	// never rotates it.
+	MaxSize int64
+
+	// The number of rotated files that are kept.
+	MaxFiles int
+}
+
+// The open slow query log of a server.
+type slowQueryLog struct {
+	sync.Mutex
+	options SlowQueryLogOptions
+	file    *os.File
+	size    int64
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Opens a slow query log for appending.
+func openSlowQueryLog(options SlowQueryLogOptions) (*slowQueryLog, error) {
+	l := &slowQueryLog{options: options}
+	if err := l.open(); err != nil {
+		return nil, err
+	}
+	return l, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Options
+//--------------------------------------
+
+// The options that slow queries are logged with.
+func (s *Server) SlowQueryLogOptions() SlowQueryLogOptions {
+	return s.slowQueries
+}
+
+// Sets the options that slow queries are logged with. This should be set
+// before the server is opened.
+func (s *Server) SetSlowQueryLogOptions(options SlowQueryLogOptions) {
+	s.slowQueries = options
+}
+
+//--------------------------------------
+// Server
+//--------------------------------------
+
+// Opens the slow query log if it's enabled and written to its own file.
+func (s *Server) startSlowQueryLog() error {
+	if s.slowQueries.Threshold <= 0 || s.slowQueries.Path == "" {
+		return nil
+	}
+	log, err := openSlowQueryLog(s.slowQueries)
+	if err != nil {
+		return err
+	}
+	s.slowQueryLog = log
+	return nil
+}
+
+// Closes the slow query log. Queries that finish afterwards aren't logged.
+func (s *Server) stopSlowQueryLog() {
+	if s.slowQueryLog != nil {
+		s.slowQueryLog.close()
+	}
+}
+
+// Returns whether queries are profiled for the slow query log.
+func (s *Server) slowQueryLogEnabled() bool {
+	return s.slowQueries.Threshold > 0
+}
+
+// Logs a query if it took longer than the threshold.
+func (s *Server) logSlowQuery(table *Table, query *Query, profile *QueryProfile) {
+	if !s.slowQueryLogEnabled() || profile.TotalTime < s.slowQueries.Threshold {
+		return
+	}
+	entry := newSlowQueryEntry(table, query, profile)
+	b, err := json.Marshal(entry)
+	if err != nil {
+		s.logger.Printf("ERROR Unable to encode slow query: %v", err)
+		return
+	}
+	if s.slowQueryLog == nil {
+		s.logger.Printf("SLOW QUERY %s", b)
+	} else if err := s.slowQueryLog.write(b); err != nil {
+		s.logger.Printf("ERROR Unable to write slow query log: %v", err)
+	}
+}
+
+//--------------------------------------
+// Entries
+//--------------------------------------
+
+// Builds the log entry of a query from its profile. The generated source
+// is left out since it can be rebuilt from the query.
+func newSlowQueryEntry(table *Table, query *Query, profile *QueryProfile) map[string]interface{} {
+	entry := profile.Serialize()
+	delete(entry, "source")
+	entry["time"] = time.Now().UTC().Format(time.RFC3339Nano)
+	entry["table"] = table.Name
+	entry["query"] = query.Serialize()
+
+	var objects, events, bytes, readBytes, hits, misses, heap uint64
+	for _, p := range profile.Servlets {
+		objects += p.Objects
+		events += p.Events
+		bytes += p.Bytes
+		readBytes += p.BlockReadBytes
+		hits += p.BlockCacheHits
+		misses += p.BlockCacheMisses
+		if p.LuaHeapBytes > heap {
+			heap = p.LuaHeapBytes
+		}
+	}
+	var hitRate float64
+	if hits+misses > 0 {
+		hitRate = float64(hits) / float64(hits+misses)
+	}
+	entry["objects"] = objects
+	entry["events"] = events
+	entry["bytes"] = bytes
+	entry["blockReadBytes"] = readBytes
+	entry["blockCacheHitRate"] = hitRate
+	entry["maxLuaHeapBytes"] = heap
+	return entry
+}
+
+//--------------------------------------
+// File
+//--------------------------------------
+
+func (l *slowQueryLog) open() error {
+	file, err := os.OpenFile(l.options.Path, os.O_WRONLY|os.O_APPEND|os.O_CREATE, 0644)
+	if err != nil {
+		return err
+	}
+	info, err := file.Stat()
+	if err != nil {
+		file.Close()
+		return err
+	}
+	l.file, l.size = file, info.Size()
+	return nil
+}
+
+// Appends an entry as a line, rotating the file first if it would grow
+// past its maximum size.
+func (l *slowQueryLog) write(entry []byte) error {
+	l.Lock()
+	defer l.Unlock()
+	if l.file == nil {
+		return nil
+	}
+	if l.options.MaxSize > 0 && l.size > 0 && l.size+int64(len(entry))+1 > l.options.MaxSize {
+		if err := l.rotate(); err != nil {
+			return err
+		}
+	}
+	n, err := l.file.Write(append(entry, '\n'))
+	l.size += int64(n)
+	return err
+}
+
+// Shifts the rotated files up by one, dropping the oldest, and starts a
+// new file.
+func (l *slowQueryLog) rotate() error {
+	l.file.Close()
+	l.file = nil
+	if l.options.MaxFiles > 0 {
+		for i := l.options.MaxFiles - 1; i > 0; i-- {
+			os.Rename(fmt.Sprintf("%s.%d", l.options.Path, i), fmt.Sprintf("%s.%d", l.options.Path, i+1))
+		}
+		if err := os.Rename(l.options.Path, l.options.Path+".1"); err != nil {
+			return err
+		}
+	} else if err := os.Remove(l.options.Path); err != nil {
+		return err
+	}
+	return l.open()
+}
+
+func (l *slowQueryLog) close() {
+	l.Lock()
+	defer l.Unlock()
+	if l.file != nil {
+		l.file.Close()
+		l.file = nil
+	}
+}
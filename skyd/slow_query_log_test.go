@@ -0,0 +1,57 @@
+package skyd
+
+import (
+	"encoding/json"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strings"
+	"testing"
+	"time"
+)
+
+// Ensure that queries over the threshold are logged with their plan and
+// profile and that the log is rotated as it grows.
+func TestServerSlowQueryLog(t *testing.T) {
+	dir, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(dir)
+	path := filepath.Join(dir, "slow.log")
+	runConfiguredTestServer(func(s *Server) {
+		s.SetSlowQueryLogOptions(SlowQueryLogOptions{Threshold: time.Nanosecond, Path: path, MaxSize: 1, MaxFiles: 1})
+	}, func(s *Server) {
+		setupTestTable("foo")
+		setupTestProperty("foo", "fruit", false, "string")
+		setupTestData(t, "foo", [][]string{
+			[]string{"a0", "2012-01-01T00:00:00Z", `{"data":{"fruit":"apple"}}`},
+			[]string{"a1", "2012-01-01T00:00:00Z", `{"data":{"fruit":"pear"}}`},
+		})
+		query := `{"steps":[{"type":"selection","dimensions":["fruit"],"fields":[{"name":"count","expression":"count()"}]}]}`
+		for i := 0; i < 2; i++ {
+			resp, _ := sendTestHttpRequest("POST", "http://localhost:8586/tables/foo/query", "application/json", query)
+			assertResponse(t, resp, 200, `{"fruit":{"apple":{"count":1},"pear":{"count":1}}}`+"\n", "POST /tables/:name/query failed.")
+		}
+		s.stopSlowQueryLog()
+
+		// Each entry is past the maximum size so the first is rotated out.
+		for _, p := range []string{path, path + ".1"} {
+			data, err := ioutil.ReadFile(p)
+			if err != nil {
+				t.Fatalf("Unable to read slow query log: %v", err)
+			}
+			lines := strings.Split(strings.TrimSpace(string(data)), "\n")
+			if len(lines) != 1 {
+				t.Fatalf("Unexpected entries: %s", data)
+			}
+			var entry map[string]interface{}
+			if err := json.Unmarshal([]byte(lines[0]), &entry); err != nil {
+				t.Fatalf("Unable to decode entry: %v", err)
+			}
+			if size, _ := entry["resultSize"].(float64); entry["table"] != "foo" || entry["query"] == nil || entry["plan"] == nil || entry["source"] != nil || size <= 0 {
+				t.Fatalf("Unexpected entry: %v", entry)
+			}
+		}
+		if _, err := os.Stat(path + ".2"); !os.IsNotExist(err) {
+			t.Fatalf("Expected only one rotated file: %v", err)
+		}
+	})
+}
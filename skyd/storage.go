@@ -0,0 +1,2212 @@
+package skyd
+
+/*
+#cgo LDFLAGS: -lleveldb -lpthread
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <leveldb/c.h>
+
+// Returns the length of the table prefix of a key, which is the msgpack
+// array header and table name that start every key or the marker and table
+// id of tables with hashed keys, or 0 if it has none.
+static size_t sky_table_prefix_length(const char* key, size_t length) {
+	const unsigned char* k = (const unsigned char*)key;
+	size_t header, n;
+	if (length >= 5 && k[0] == 0xc1) {
+		return 5;
+	}
+	if (length < 2 || k[0] != 0x92) {
+		return 0;
+	}
+	if (k[1] >= 0xa0 && k[1] <= 0xbf) {
+		header = 1;
+		n = k[1] & 0x1f;
+	} else if (k[1] == 0xd9 && length >= 3) {
+		header = 2;
+		n = k[2];
+	} else if (k[1] == 0xda && length >= 4) {
+		header = 3;
+		n = ((size_t)k[2] << 8) | k[3];
+	} else if (k[1] == 0xdb && length >= 6) {
+		header = 5;
+		n = ((size_t)k[2] << 24) | ((size_t)k[3] << 16) | ((size_t)k[4] << 8) | k[5];
+	} else {
+		return 0;
+	}
+	if (1 + header + n > length) {
+		return 0;
+	}
+	return 1 + header + n;
+}
+
+static void sky_table_prefix_destroy(void* arg) { }
+static const char* sky_table_prefix_name(void* arg) {
+	return "sky.TablePrefix";
+}
+static size_t sky_table_prefix_transform(void* arg, const char* key, size_t length) {
+	return sky_table_prefix_length(key, length);
+}
+static unsigned char sky_table_prefix_in_domain(void* arg, const char* key, size_t length) {
+	return sky_table_prefix_length(key, length) > 0;
+}
+
+static leveldb_slicetransform_t* sky_table_prefix_create() {
+	return leveldb_slicetransform_create(NULL, sky_table_prefix_destroy,
+		sky_table_prefix_transform, sky_table_prefix_in_domain,
+		sky_table_prefix_name);
+}
+
+// The layout of the event index stored in front of an object's events. See
+// event_index.go.
+#define SKY_EVENT_INDEX_VERSION     2
+#define SKY_EVENT_INDEX_HEADER_SIZE 25
+#define SKY_EVENT_INDEX_ENTRY_SIZE  12
+#define SKY_EVENT_INDEX_NO_COUNT    0xffffffff
+#define SKY_EVENT_INDEX_V1_VERSION  1
+#define SKY_EVENT_INDEX_V1_HEADER_SIZE 21
+#define SKY_EVENT_BLOCK_FLAG        0xc1
+#define SKY_EVENT_CHECKPOINT_FLAG   0xc7
+
+// The bytes that follow an object id in the keys of its chunks and
+// property families. See servlet_object.go and servlet_family.go.
+#define SKY_OBJECT_CHUNK_MARKER      0x00
+#define SKY_OBJECT_CHUNK_SUFFIX_SIZE 9
+#define SKY_OBJECT_FAMILY_MARKER     0x02
+
+// The fewest event bytes between the index entries of appended events that
+// are kept when objects are merged, so that indexes of many small appends
+// don't grow an entry per append.
+#define SKY_MERGE_INDEX_SPACING 2048
+
+// Returns the size of the msgpack raw at the start of the data, including
+// its header, or 0 if it doesn't start with a raw.
+static size_t sky_raw_size(const unsigned char* p, size_t length, size_t* header) {
+	size_t n;
+	if (length == 0) {
+		return 0;
+	}
+	if (p[0] >= 0xa0 && p[0] <= 0xbf) {
+		*header = 1;
+		n = p[0] & 0x1f;
+	} else if ((p[0] == 0xd9 || p[0] == 0xc4) && length >= 2) {
+		*header = 2;
+		n = p[1];
+	} else if ((p[0] == 0xda || p[0] == 0xc5) && length >= 3) {
+		*header = 3;
+		n = ((size_t)p[1] << 8) | p[2];
+	} else if ((p[0] == 0xdb || p[0] == 0xc6) && length >= 5) {
+		*header = 5;
+		n = ((size_t)p[1] << 24) | ((size_t)p[2] << 16) | ((size_t)p[3] << 8) | p[4];
+	} else {
+		return 0;
+	}
+	if (*header + n > length) {
+		return 0;
+	}
+	return *header + n;
+}
+
+// Returns the length of the object prefix of a key, which is its table
+// prefix and the object id after it, or 0 if it has none. Hashed memtables
+// keep the keys of each object in a list of their own by it.
+static size_t sky_object_prefix_length(const char* key, size_t length) {
+	size_t prefix_length, id_length, header;
+	prefix_length = sky_table_prefix_length(key, length);
+	if (prefix_length == 0) {
+		return 0;
+	}
+	id_length = sky_raw_size((const unsigned char*)key + prefix_length, length - prefix_length, &header);
+	if (id_length == 0) {
+		return 0;
+	}
+	return prefix_length + id_length;
+}
+
+static void sky_object_prefix_destroy(void* arg) { }
+static const char* sky_object_prefix_name(void* arg) {
+	return "sky.ObjectPrefix";
+}
+static size_t sky_object_prefix_transform(void* arg, const char* key, size_t length) {
+	return sky_object_prefix_length(key, length);
+}
+static unsigned char sky_object_prefix_in_domain(void* arg, const char* key, size_t length) {
+	return sky_object_prefix_length(key, length) > 0;
+}
+
+static leveldb_slicetransform_t* sky_object_prefix_create() {
+	return leveldb_slicetransform_create(NULL, sky_object_prefix_destroy,
+		sky_object_prefix_transform, sky_object_prefix_in_domain,
+		sky_object_prefix_name);
+}
+
+static unsigned char* sky_write_raw_header(unsigned char* p, size_t n) {
+	if (n < 32) {
+		*p++ = 0xa0 | n;
+	} else if (n < 65536) {
+		*p++ = 0xda;
+		*p++ = n >> 8;
+		*p++ = n;
+	} else {
+		*p++ = 0xdb;
+		*p++ = n >> 24;
+		*p++ = n >> 16;
+		*p++ = n >> 8;
+		*p++ = n;
+	}
+	return p;
+}
+
+static uint32_t sky_read_uint32(const unsigned char* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void sky_write_uint32(unsigned char* p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static int64_t sky_read_int64(const unsigned char* p) {
+	return (int64_t)((uint64_t)sky_read_uint32(p) | ((uint64_t)sky_read_uint32(p + 4) << 32));
+}
+
+static void sky_write_int64(unsigned char* p, int64_t v) {
+	sky_write_uint32(p, (uint64_t)v);
+	sky_write_uint32(p + 4, (uint64_t)v >> 32);
+}
+
+// Returns the size of the header of an event index by its version, or 0 if
+// the version is unknown. Version 1 indexes have no event count.
+static size_t sky_event_index_header_size(const unsigned char* index) {
+	if (index[0] == SKY_EVENT_INDEX_VERSION) {
+		return SKY_EVENT_INDEX_HEADER_SIZE;
+	} else if (index[0] == SKY_EVENT_INDEX_V1_VERSION) {
+		return SKY_EVENT_INDEX_V1_HEADER_SIZE;
+	}
+	return 0;
+}
+
+// Returns the event count of an event index, or SKY_EVENT_INDEX_NO_COUNT if
+// it doesn't have one.
+static uint32_t sky_event_index_count(const unsigned char* index) {
+	if (index[0] != SKY_EVENT_INDEX_VERSION) {
+		return SKY_EVENT_INDEX_NO_COUNT;
+	}
+	return sky_read_uint32(index + 21);
+}
+
+// Checks the header and size of the payload of an event index.
+static int sky_event_index_valid(const unsigned char* index, size_t length) {
+	size_t header = (length > 0 ? sky_event_index_header_size(index) : 0);
+	return header > 0 && length >= header &&
+		length == header + (size_t)sky_read_uint32(index + 17) * SKY_EVENT_INDEX_ENTRY_SIZE;
+}
+
+// A stored object split into its state raw, the payload of its event index
+// and its events.
+typedef struct {
+	const unsigned char* state;
+	size_t state_length;
+	const unsigned char* index;
+	size_t index_length;
+	const unsigned char* events;
+	size_t events_length;
+} sky_object_parts;
+
+// Splits a stored object. Objects written before events were indexed have
+// no index raw. Returns 0 if the object or its index is malformed.
+static int sky_object_split(const char* data, size_t length, sky_object_parts* parts) {
+	const unsigned char* p = (const unsigned char*)data;
+	size_t header, n;
+	parts->state = p;
+	parts->state_length = sky_raw_size(p, length, &header);
+	if (parts->state_length == 0) {
+		return 0;
+	}
+	p += parts->state_length;
+	length -= parts->state_length;
+	parts->index = NULL;
+	parts->index_length = 0;
+	if ((n = sky_raw_size(p, length, &header)) > 0) {
+		parts->index = p + header;
+		parts->index_length = n - header;
+		p += n;
+		length -= n;
+	}
+	if (parts->index_length > 0 && !sky_event_index_valid(parts->index, parts->index_length)) {
+		return 0;
+	}
+	parts->events = p;
+	parts->events_length = length;
+	return 1;
+}
+
+// Merges an object operand into an older object or operand. The newer
+// state replaces the older one unless it's empty, which it is for objects
+// whose state is stored under its own key. The events are concatenated and
+// so are their indexes, with the entries of the newer events thinned out
+// except for those of blocks and checkpoints, and their event counts are
+// summed when both indexes have one.
+// Objects either side of the merge without an index are left without one so
+// that readers scan all of their events.
+static char* sky_object_merge(void* arg,
+	const char* key, size_t key_length,
+	const char* existing, size_t existing_length,
+	const char* value, size_t value_length,
+	unsigned char* success, size_t* new_value_length)
+{
+	sky_object_parts older, newer;
+	const sky_object_parts *state, *index_source = NULL;
+	unsigned char *result, *p, *index, *entry;
+	uint32_t count, i, offset, last_offset, events, newer_events;
+	size_t max_index, older_header, newer_header;
+
+	*success = 0;
+	if (!sky_object_split(value, value_length, &newer)) {
+		return NULL;
+	}
+	if (existing == NULL) {
+		result = malloc(value_length);
+		memcpy(result, value, value_length);
+		*new_value_length = value_length;
+		*success = 1;
+		return (char*)result;
+	}
+	if (!sky_object_split(existing, existing_length, &older)) {
+		return NULL;
+	}
+
+	if (older.events_length == 0) {
+		index_source = &newer;
+	} else if (newer.events_length == 0) {
+		index_source = &older;
+	}
+	state = (newer.state_length > 1 ? &newer : &older);
+	max_index = SKY_EVENT_INDEX_HEADER_SIZE + older.index_length + newer.index_length;
+	result = malloc(state->state_length + 5 + max_index + older.events_length + newer.events_length);
+	memcpy(result, state->state, state->state_length);
+	p = result + state->state_length;
+
+	if (index_source != NULL) {
+		p = sky_write_raw_header(p, index_source->index_length);
+		memcpy(p, index_source->index, index_source->index_length);
+		p += index_source->index_length;
+	} else if (older.index_length == 0 || newer.index_length == 0) {
+		p = sky_write_raw_header(p, 0);
+	} else {
+		// Build the index after the largest header it can have and then
+		// move it up behind the real one.
+		index = p + 5;
+		older_header = sky_event_index_header_size(older.index);
+		newer_header = sky_event_index_header_size(newer.index);
+		memcpy(index, older.index, 17);
+		index[0] = SKY_EVENT_INDEX_VERSION;
+		memcpy(index + 9, newer.index + 9, 8);
+		events = sky_event_index_count(older.index);
+		newer_events = sky_event_index_count(newer.index);
+		if (events == SKY_EVENT_INDEX_NO_COUNT || newer_events == SKY_EVENT_INDEX_NO_COUNT ||
+			newer_events >= SKY_EVENT_INDEX_NO_COUNT - events) {
+			events = SKY_EVENT_INDEX_NO_COUNT;
+		} else {
+			events += newer_events;
+		}
+		sky_write_uint32(index + 21, events);
+		entry = index + SKY_EVENT_INDEX_HEADER_SIZE;
+		count = sky_read_uint32(older.index + 17);
+		memcpy(entry, older.index + older_header, (size_t)count * SKY_EVENT_INDEX_ENTRY_SIZE);
+		entry += (size_t)count * SKY_EVENT_INDEX_ENTRY_SIZE;
+		last_offset = count > 0 ? sky_read_uint32(entry - 4) : 0;
+		for (i = 0; i < sky_read_uint32(newer.index + 17); i++) {
+			const unsigned char* e = newer.index + newer_header + ((size_t)i * SKY_EVENT_INDEX_ENTRY_SIZE);
+			uint32_t o = sky_read_uint32(e + 8);
+			offset = (uint32_t)older.events_length + o;
+			if (offset - last_offset < SKY_MERGE_INDEX_SPACING && o < newer.events_length &&
+				newer.events[o] != SKY_EVENT_BLOCK_FLAG && newer.events[o] != SKY_EVENT_CHECKPOINT_FLAG) {
+				continue;
+			}
+			memcpy(entry, e, 8);
+			sky_write_uint32(entry + 8, offset);
+			entry += SKY_EVENT_INDEX_ENTRY_SIZE;
+			last_offset = offset;
+			count++;
+		}
+		sky_write_uint32(index + 17, count);
+		p = sky_write_raw_header(p, entry - index);
+		memmove(p, index, entry - index);
+		p += entry - index;
+	}
+
+	memcpy(p, older.events, older.events_length);
+	p += older.events_length;
+	memcpy(p, newer.events, newer.events_length);
+	p += newer.events_length;
+	*new_value_length = p - result;
+	*success = 1;
+	return (char*)result;
+}
+
+static void sky_object_merge_destroy(void* arg) { }
+static const char* sky_object_merge_name(void* arg) {
+	return "sky.ObjectAppend";
+}
+
+static leveldb_mergeoperator_t* sky_object_merge_create() {
+	return leveldb_mergeoperator_create(NULL, sky_object_merge_destroy,
+		sky_object_merge, sky_object_merge_name);
+}
+
+// The layout of event blocks. See event_block.go.
+#define SKY_EVENT_BLOCK_VERSION          2
+#define SKY_EVENT_BLOCK_FIXED_TS_VERSION 1
+#define SKY_EVENT_BLOCK_HEADER_SIZE      24
+
+// The number of events between index entries. See event_index.go.
+#define SKY_EVENT_INDEX_INTERVAL 32
+
+// The fewest bytes of consecutive msgpack events that compactions move into
+// an event block, like eventBlockTailThreshold does for appends. See
+// servlet.go.
+#define SKY_EVENT_BLOCK_RUN_SIZE 4096
+
+// Encodes the runs of msgpack events in a stream into event blocks. See
+// storage_blocks.go.
+extern void* skyEncodeEventRuns(void* events, size_t length, size_t* new_length);
+
+static uint64_t sky_read_big_endian(const unsigned char* p, size_t n) {
+	uint64_t v = 0;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+// Returns the size of the msgpack element at the start of the data,
+// including any nested elements, or 0 if it's truncated or invalid. See
+// msgpackSize() in event_index.go.
+static size_t sky_msgpack_size(const unsigned char* p, size_t length) {
+	size_t header = 0, n = 0, children = 0, size, child, i;
+	unsigned char b;
+	if (length == 0) {
+		return 0;
+	}
+	b = p[0];
+	if (b <= 0x7f || b >= 0xe0 || b == 0xc0 || b == 0xc2 || b == 0xc3) {
+		return 1;
+	} else if (b >= 0x80 && b <= 0x8f) {
+		header = 1;
+		children = 2 * (b & 0x0f);
+	} else if (b >= 0x90 && b <= 0x9f) {
+		header = 1;
+		children = b & 0x0f;
+	} else if (b >= 0xa0 && b <= 0xbf) {
+		header = 1;
+		n = b & 0x1f;
+	} else if (b == 0xcc || b == 0xd0) {
+		header = 2;
+	} else if (b == 0xcd || b == 0xd1) {
+		header = 3;
+	} else if (b == 0xca || b == 0xce || b == 0xd2) {
+		header = 5;
+	} else if (b == 0xcb || b == 0xcf || b == 0xd3) {
+		header = 9;
+	} else if ((b == 0xd9 || b == 0xc4) && length >= 2) {
+		header = 2;
+		n = p[1];
+	} else if ((b == 0xda || b == 0xc5) && length >= 3) {
+		header = 3;
+		n = sky_read_big_endian(p + 1, 2);
+	} else if ((b == 0xdb || b == 0xc6) && length >= 5) {
+		header = 5;
+		n = sky_read_big_endian(p + 1, 4);
+	} else if (b == 0xdc && length >= 3) {
+		header = 3;
+		children = sky_read_big_endian(p + 1, 2);
+	} else if (b == 0xdd && length >= 5) {
+		header = 5;
+		children = sky_read_big_endian(p + 1, 4);
+	} else if (b == 0xde && length >= 3) {
+		header = 3;
+		children = 2 * sky_read_big_endian(p + 1, 2);
+	} else if (b == 0xdf && length >= 5) {
+		header = 5;
+		children = 2 * sky_read_big_endian(p + 1, 4);
+	} else {
+		return 0;
+	}
+
+	if (n > length || header > length - n) {
+		return 0;
+	}
+	size = header + n;
+	for (i = 0; i < children; i++) {
+		if ((child = sky_msgpack_size(p + size, length - size)) == 0) {
+			return 0;
+		}
+		size += child;
+	}
+	return size;
+}
+
+// Reads the msgpack integer at the start of the data. Returns its size, or
+// 0 if the data doesn't start with an integer.
+static size_t sky_msgpack_int(const unsigned char* p, size_t length, int64_t* value) {
+	unsigned char b;
+	if (length == 0) {
+		return 0;
+	}
+	b = p[0];
+	if (b <= 0x7f) {
+		*value = b;
+		return 1;
+	} else if (b >= 0xe0) {
+		*value = (int8_t)b;
+		return 1;
+	} else if ((b == 0xcc || b == 0xd0) && length >= 2) {
+		*value = (b == 0xcc ? (int64_t)p[1] : (int64_t)(int8_t)p[1]);
+		return 2;
+	} else if ((b == 0xcd || b == 0xd1) && length >= 3) {
+		uint16_t v = sky_read_big_endian(p + 1, 2);
+		*value = (b == 0xcd ? (int64_t)v : (int64_t)(int16_t)v);
+		return 3;
+	} else if ((b == 0xce || b == 0xd2) && length >= 5) {
+		uint32_t v = sky_read_big_endian(p + 1, 4);
+		*value = (b == 0xce ? (int64_t)v : (int64_t)(int32_t)v);
+		return 5;
+	} else if ((b == 0xcf || b == 0xd3) && length >= 9) {
+		*value = (int64_t)sky_read_big_endian(p + 1, 8);
+		return 9;
+	}
+	return 0;
+}
+
+// Reads the shifted timestamps of the first and last events of an event
+// block. See eventBlockTimestamps() in event_block.go.
+static int sky_event_block_range(const unsigned char* block, size_t size, uint32_t count,
+	int64_t* first, int64_t* last)
+{
+	int64_t base = sky_read_int64(block + 16), prev, delta = 0;
+	const unsigned char *p, *end;
+	uint64_t v;
+	uint32_t i;
+	int shift;
+
+	if (block[1] == SKY_EVENT_BLOCK_FIXED_TS_VERSION) {
+		if ((size - SKY_EVENT_BLOCK_HEADER_SIZE) / 8 < count) {
+			return 0;
+		}
+		*first = base + sky_read_int64(block + SKY_EVENT_BLOCK_HEADER_SIZE);
+		*last = base + sky_read_int64(block + SKY_EVENT_BLOCK_HEADER_SIZE + ((size_t)(count - 1) * 8));
+		return 1;
+	} else if (block[1] != SKY_EVENT_BLOCK_VERSION ||
+		sky_read_uint32(block + 12) > size - SKY_EVENT_BLOCK_HEADER_SIZE) {
+		return 0;
+	}
+
+	// Timestamps are zigzag varints of the change in the gap between events.
+	p = block + SKY_EVENT_BLOCK_HEADER_SIZE;
+	end = p + sky_read_uint32(block + 12);
+	prev = base;
+	for (i = 0; i < count; i++) {
+		for (v = 0, shift = 0; p < end && shift < 64 && (*p & 0x80); p++, shift += 7) {
+			v |= (uint64_t)(*p & 0x7f) << shift;
+		}
+		if (p == end || shift >= 64) {
+			return 0;
+		}
+		v |= (uint64_t)*p++ << shift;
+		delta += (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+		prev += delta;
+		if (i == 0) {
+			*first = prev;
+		}
+	}
+	*last = prev;
+	return 1;
+}
+
+// Reads the shifted timestamps, event count and size of the event, event
+// block or checkpoint at the start of a stream. A checkpoint has the
+// timestamp of the event after it and no events. Returns 0 if the element
+// is malformed. See eventStreamElement() in event_index.go.
+static size_t sky_event_stream_element(const unsigned char* p, size_t length,
+	int64_t* first, int64_t* last, uint32_t* events)
+{
+	size_t size;
+	uint32_t count;
+	if (p[0] == SKY_EVENT_CHECKPOINT_FLAG) {
+		if (length < 2 || p[1] != 0x92 || (size = sky_event_stream_element(p + 1, length - 1, first, last, events)) == 0) {
+			return 0;
+		}
+		*events = 0;
+		return size + 1;
+	}
+
+	if (p[0] == SKY_EVENT_BLOCK_FLAG) {
+		if (length < SKY_EVENT_BLOCK_HEADER_SIZE) {
+			return 0;
+		}
+		count = sky_read_uint32(p + 4);
+		size = sky_read_uint32(p + 8);
+		if (count == 0 || size < SKY_EVENT_BLOCK_HEADER_SIZE || size > length ||
+			!sky_event_block_range(p, size, count, first, last)) {
+			return 0;
+		}
+		*events = count;
+		return size;
+	}
+
+	// A msgpack event is a two element array of the timestamp and data.
+	if (p[0] != 0x92 || (size = sky_msgpack_size(p, length)) == 0 ||
+		sky_msgpack_int(p + 1, length - 1, first) == 0) {
+		return 0;
+	}
+	*last = *first;
+	*events = 1;
+	return size;
+}
+
+// Walks an event stream to build its index like newEventIndex() in
+// event_index.go does. Only the number of entries is found if the index is
+// NULL, otherwise it must have room for them. Returns 0 if the stream is
+// malformed or too large to index.
+static int sky_event_index_build(const unsigned char* events, size_t length,
+	unsigned char* index, uint32_t* entry_count)
+{
+	size_t offset, size;
+	uint32_t entries = 0, count = 0, total = 0, n;
+	int64_t first, last;
+	unsigned char* entry = (index != NULL ? index + SKY_EVENT_INDEX_HEADER_SIZE : NULL);
+
+	if (length >= SKY_EVENT_INDEX_NO_COUNT) {
+		return 0;
+	}
+	for (offset = 0; offset < length; offset += size) {
+		if ((size = sky_event_stream_element(events + offset, length - offset, &first, &last, &n)) == 0) {
+			return 0;
+		}
+		if (index != NULL) {
+			if (offset == 0) {
+				sky_write_int64(index + 1, first);
+			}
+			sky_write_int64(index + 9, last);
+		}
+
+		// Every block and checkpoint starts an entry.
+		if (events[offset] == SKY_EVENT_BLOCK_FLAG || events[offset] == SKY_EVENT_CHECKPOINT_FLAG ||
+			count % SKY_EVENT_INDEX_INTERVAL == 0) {
+			if (entry != NULL) {
+				sky_write_int64(entry, first);
+				sky_write_uint32(entry + 8, offset);
+				entry += SKY_EVENT_INDEX_ENTRY_SIZE;
+			}
+			entries++;
+		}
+		if (events[offset] == SKY_EVENT_BLOCK_FLAG) {
+			count = 0;
+		} else if (events[offset] != SKY_EVENT_CHECKPOINT_FLAG) {
+			count++;
+		}
+		total = (n >= SKY_EVENT_INDEX_NO_COUNT - total ? SKY_EVENT_INDEX_NO_COUNT : total + n);
+	}
+	if (index != NULL) {
+		index[0] = SKY_EVENT_INDEX_VERSION;
+		sky_write_uint32(index + 17, entries);
+		sky_write_uint32(index + 21, total);
+	}
+	*entry_count = entries;
+	return 1;
+}
+
+// Checks whether a stream has a run of consecutive msgpack events of at
+// least SKY_EVENT_BLOCK_RUN_SIZE bytes, so that streams already in blocks
+// aren't handed to Go on every compaction.
+static int sky_event_stream_has_run(const unsigned char* events, size_t length) {
+	size_t offset, size, run = 0;
+	int64_t first, last;
+	uint32_t n;
+
+	for (offset = 0; offset < length; offset += size) {
+		if ((size = sky_event_stream_element(events + offset, length - offset, &first, &last, &n)) == 0) {
+			return 0;
+		}
+		if (events[offset] == SKY_EVENT_BLOCK_FLAG || events[offset] == SKY_EVENT_CHECKPOINT_FLAG) {
+			run = 0;
+		} else if ((run += size) >= SKY_EVENT_BLOCK_RUN_SIZE) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Rebuilds the index of an event stream that was written without one, or
+// with a version 1 index, so that scans can skip it by time and count. The
+// state, if any, and the events are kept as they are. Returns NULL if the
+// stream is empty, already has a current index or can't be indexed.
+static unsigned char* sky_event_stream_upgrade(const sky_object_parts* parts, size_t* length) {
+	unsigned char *result, *p;
+	uint32_t entries;
+	size_t n;
+
+	if (parts->events_length == 0 || (parts->index_length > 0 && parts->index[0] == SKY_EVENT_INDEX_VERSION)) {
+		return NULL;
+	}
+	if (!sky_event_index_build(parts->events, parts->events_length, NULL, &entries)) {
+		return NULL;
+	}
+
+	n = SKY_EVENT_INDEX_HEADER_SIZE + (size_t)entries * SKY_EVENT_INDEX_ENTRY_SIZE;
+	result = malloc(parts->state_length + 5 + n + parts->events_length);
+	memcpy(result, parts->state, parts->state_length);
+	p = sky_write_raw_header(result + parts->state_length, n);
+	sky_event_index_build(parts->events, parts->events_length, p, &entries);
+	p += n;
+	memcpy(p, parts->events, parts->events_length);
+	p += parts->events_length;
+	*length = p - result;
+	return result;
+}
+
+// The time that the events of each table are kept, which the compaction
+// filter reads while compactions run. The rules are a list of the length
+// of a table prefix (4), the prefix and the retention in seconds (8), in
+// little endian. Event blocks are set when msgpack events are moved into
+// blocks as they're compacted.
+typedef struct {
+	pthread_mutex_t lock;
+	unsigned char* rules;
+	size_t rules_length;
+	int event_blocks;
+} sky_retention;
+
+static sky_retention* sky_retention_create() {
+	sky_retention* r = calloc(1, sizeof(sky_retention));
+	pthread_mutex_init(&r->lock, NULL);
+	return r;
+}
+
+static void sky_retention_destroy(void* arg) {
+	sky_retention* r = arg;
+	pthread_mutex_destroy(&r->lock);
+	free(r->rules);
+	free(r);
+}
+
+// Replaces the rules with a copy of new ones.
+static void sky_retention_set(sky_retention* r, const char* rules, size_t length) {
+	unsigned char* copy = NULL;
+	if (length > 0) {
+		copy = malloc(length);
+		memcpy(copy, rules, length);
+	}
+	pthread_mutex_lock(&r->lock);
+	free(r->rules);
+	r->rules = copy;
+	r->rules_length = length;
+	pthread_mutex_unlock(&r->lock);
+}
+
+// Sets whether compactions move msgpack events into event blocks.
+static void sky_retention_set_event_blocks(sky_retention* r, int value) {
+	pthread_mutex_lock(&r->lock);
+	r->event_blocks = value;
+	pthread_mutex_unlock(&r->lock);
+}
+
+static int sky_retention_event_blocks(sky_retention* r) {
+	int value;
+	pthread_mutex_lock(&r->lock);
+	value = r->event_blocks;
+	pthread_mutex_unlock(&r->lock);
+	return value;
+}
+
+// Finds the shifted timestamp that events of the table with a prefix must
+// be at or after to be kept. Returns 0 if the table keeps every event.
+static int sky_retention_cutoff(sky_retention* r, const char* prefix, size_t length, int64_t* cutoff) {
+	const unsigned char* p;
+	size_t n;
+	int found = 0;
+	pthread_mutex_lock(&r->lock);
+	for (p = r->rules; p != NULL && p < r->rules + r->rules_length; p += 12 + n) {
+		n = sky_read_uint32(p);
+		if (n == length && memcmp(p + 4, prefix, n) == 0) {
+			*cutoff = ((int64_t)time(NULL) - sky_read_int64(p + 4 + n)) << 20;
+			found = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&r->lock);
+	return found;
+}
+
+// Splits the value of an object's head, chunk or property family into its
+// parts. Chunks have no state. Returns 0 for the other keys of a table,
+// which aren't event streams, and for malformed values.
+static int sky_event_stream_split(const char* key, size_t key_length, size_t prefix_length,
+	const char* value, size_t value_length, sky_object_parts* parts, int* head)
+{
+	const unsigned char* k = (const unsigned char*)key;
+	size_t id_length, header, rest, n;
+
+	id_length = sky_raw_size(k + prefix_length, key_length - prefix_length, &header);
+	if (id_length == 0) {
+		return 0;
+	}
+	rest = key_length - prefix_length - id_length;
+	*head = (rest == 0);
+	if (rest == 0 || (rest > 1 && k[prefix_length + id_length] == SKY_OBJECT_FAMILY_MARKER)) {
+		return sky_object_split(value, value_length, parts);
+	} else if (rest != SKY_OBJECT_CHUNK_SUFFIX_SIZE || k[prefix_length + id_length] != SKY_OBJECT_CHUNK_MARKER) {
+		return 0;
+	}
+	parts->state = NULL;
+	parts->state_length = 0;
+	parts->index = NULL;
+	parts->index_length = 0;
+	if ((n = sky_raw_size((const unsigned char*)value, value_length, &header)) > 0) {
+		parts->index = (const unsigned char*)value + header;
+		parts->index_length = n - header;
+	}
+	parts->events = (const unsigned char*)value + n;
+	parts->events_length = value_length - n;
+	return parts->index_length == 0 || sky_event_index_valid(parts->index, parts->index_length);
+}
+
+// Trims the events that are older than a cutoff off the front of a stream.
+// Streams are in time order so events are dropped up to the last index
+// entry before the cutoff, which means none have to be decoded but a few
+// older events can be kept until more events follow them. Trimmed indexes
+// lose their event count since the dropped events aren't counted. Chunks
+// and families left without events are removed while heads keep their
+// state. Streams without an index are kept whole.
+static unsigned char sky_retention_trim(const sky_object_parts* parts, int head, int64_t cutoff,
+	char** new_value, size_t* new_value_length, unsigned char* value_changed)
+{
+	const unsigned char* e;
+	size_t n, index_header;
+	uint32_t count, i, cut, offset;
+	unsigned char *result, *p;
+
+	if (parts->index_length == 0 || sky_read_int64(parts->index + 1) >= cutoff) {
+		return 0;
+	}
+
+	// Chunks and families with only expired events are removed.
+	if (sky_read_int64(parts->index + 9) < cutoff) {
+		if (!head) {
+			return 1;
+		}
+		result = malloc(parts->state_length + 1);
+		memcpy(result, parts->state, parts->state_length);
+		sky_write_raw_header(result + parts->state_length, 0);
+		*new_value = (char*)result;
+		*new_value_length = parts->state_length + 1;
+		*value_changed = 1;
+		return 0;
+	}
+
+	// Every event before an entry is no newer than the entry.
+	index_header = sky_event_index_header_size(parts->index);
+	count = sky_read_uint32(parts->index + 17);
+	cut = count;
+	for (i = 0; i < count; i++) {
+		e = parts->index + index_header + ((size_t)i * SKY_EVENT_INDEX_ENTRY_SIZE);
+		if (sky_read_int64(e) >= cutoff) {
+			break;
+		}
+		cut = i;
+	}
+	if (cut == count) {
+		return 0;
+	}
+	e = parts->index + index_header + ((size_t)cut * SKY_EVENT_INDEX_ENTRY_SIZE);
+	offset = sky_read_uint32(e + 8);
+	if (offset == 0 || offset >= parts->events_length) {
+		return 0;
+	}
+
+	n = SKY_EVENT_INDEX_HEADER_SIZE + (size_t)(count - cut) * SKY_EVENT_INDEX_ENTRY_SIZE;
+	result = malloc(parts->state_length + 5 + n + parts->events_length - offset);
+	memcpy(result, parts->state, parts->state_length);
+	p = sky_write_raw_header(result + parts->state_length, n);
+	p[0] = SKY_EVENT_INDEX_VERSION;
+	memcpy(p + 1, e, 8);
+	memcpy(p + 9, parts->index + 9, 8);
+	sky_write_uint32(p + 17, count - cut);
+	sky_write_uint32(p + 21, SKY_EVENT_INDEX_NO_COUNT);
+	p += SKY_EVENT_INDEX_HEADER_SIZE;
+	for (i = cut; i < count; i++) {
+		e = parts->index + index_header + ((size_t)i * SKY_EVENT_INDEX_ENTRY_SIZE);
+		memcpy(p, e, 8);
+		sky_write_uint32(p + 8, sky_read_uint32(e + 8) - offset);
+		p += SKY_EVENT_INDEX_ENTRY_SIZE;
+	}
+	memcpy(p, parts->events + offset, parts->events_length - offset);
+	p += parts->events_length - offset;
+	*new_value = (char*)result;
+	*new_value_length = p - result;
+	*value_changed = 1;
+	return 0;
+}
+
+// Rewrites the heads, chunks and property families of objects as
+// compactions pass over them. Streams written without an index, or with a
+// version 1 index, get a current index so that data written before indexes
+// existed migrates as its tables are rewritten, and events older than
+// their table's retention are then trimmed off. When event blocks are
+// enabled, long runs of msgpack events in heads and chunks, such as the
+// streams that SetRawEvents() writes, are moved into blocks with delta
+// timestamps and their index is rebuilt. Families are always msgpack.
+static unsigned char sky_compaction_filter(void* arg, int level,
+	const char* key, size_t key_length,
+	const char* existing, size_t existing_length,
+	char** new_value, size_t* new_value_length,
+	unsigned char* value_changed)
+{
+	sky_object_parts parts;
+	size_t prefix_length, upgraded_length = 0, blocks_length = 0;
+	unsigned char *upgraded, *blocks = NULL;
+	unsigned char remove = 0;
+	int64_t cutoff;
+	int head;
+
+	prefix_length = sky_table_prefix_length(key, key_length);
+	if (prefix_length == 0 ||
+		!sky_event_stream_split(key, key_length, prefix_length, existing, existing_length, &parts, &head)) {
+		return 0;
+	}
+
+	// Chunks have no state.
+	if ((head || parts.state == NULL) && sky_retention_event_blocks(arg) &&
+		sky_event_stream_has_run(parts.events, parts.events_length)) {
+		blocks = skyEncodeEventRuns((void*)parts.events, parts.events_length, &blocks_length);
+		if (blocks != NULL) {
+			parts.events = blocks;
+			parts.events_length = blocks_length;
+			parts.index = NULL;
+			parts.index_length = 0;
+		}
+	}
+	upgraded = sky_event_stream_upgrade(&parts, &upgraded_length);
+	if (upgraded != NULL) {
+		sky_event_stream_split(key, key_length, prefix_length, (const char*)upgraded, upgraded_length, &parts, &head);
+	}
+	if (sky_retention_cutoff(arg, key, prefix_length, &cutoff)) {
+		remove = sky_retention_trim(&parts, head, cutoff, new_value, new_value_length, value_changed);
+	}
+
+	// Trimming copies what it keeps of the upgraded value.
+	if (upgraded != NULL) {
+		if (remove || *value_changed) {
+			free(upgraded);
+		} else {
+			*new_value = (char*)upgraded;
+			*new_value_length = upgraded_length;
+			*value_changed = 1;
+		}
+	}
+	free(blocks);
+	return remove;
+}
+
+static const char* sky_compaction_filter_name(void* arg) {
+	return "sky.ObjectCompaction";
+}
+
+static leveldb_compactionfilter_t* sky_compaction_filter_create(sky_retention* r) {
+	return leveldb_compactionfilter_create(r, sky_retention_destroy,
+		sky_compaction_filter, sky_compaction_filter_name);
+}
+*/
+import "C"
+
+import (
+	"encoding/binary"
+	"errors"
+	"github.com/jmhodges/levigo"
+	"strings"
+	"sync"
+	"time"
+	"unsafe"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The compression types of LevelDB table blocks.
+const (
+	NoCompression     = 0
+	SnappyCompression = 1
+	LZ4Compression    = 2
+	ZstdCompression   = 3
+)
+
+// How memtables, cached blocks and Lua heaps are backed with 2MB huge
+// pages. Transparent huge pages need the kernel's setting to be "madvise"
+// or "always". Explicit huge pages come from the pages reserved in
+// vm.nr_hugepages and fall back to transparent ones once they run out.
+const (
+	NoHugePages          = 0
+	TransparentHugePages = 1
+	ExplicitHugePages    = 2
+)
+
+// How memtables hold the events written to a database until they're
+// flushed. Vector memtables take bulk imports far faster but sort what was
+// written since the last read before every read. Hashed memtables keep the
+// keys of each object in a short list of their own, so that appends to many
+// objects and reads of their recent events don't search the whole memtable,
+// but every scan sorts it.
+const (
+	SkipListMemTable = 0
+	VectorMemTable   = 1
+	HashMemTable     = 2
+)
+
+// The merge operator that applies the events appended to an object with
+// batch merges to its stored value. Every database is opened with it and
+// it's never released.
+var objectMergeOperator = C.sky_object_merge_create()
+
+// Returned by ingestTable() when the database holds a key or a range
+// deletion within the range of the table file.
+var errTableOverlaps = errors.New("skyd: Table file overlaps the keys of the database")
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// StorageOptions configures the LevelDB databases that data is stored in. A
+// zero value for any option leaves LevelDB's default in place.
+type StorageOptions struct {
+	// The size of the block cache in bytes. The cache is shared by every
+	// database opened with the same storage.
+	CacheSize int
+
+	// Whether the block cache uses midpoint insertion so that blocks read
+	// once by a scan can't evict blocks that are read repeatedly.
+	ScanResistantCache bool
+
+	// Whether the block cache uses CLOCK eviction. Lookups that hit don't
+	// take a lock so it scales better with many concurrent queries. It
+	// takes precedence over ScanResistantCache.
+	ClockCache bool
+
+	// The block cache is split into 2^CacheShardBits shards when it uses
+	// CLOCK eviction.
+	CacheShardBits int
+
+	// The size in bytes of a second block cache that holds blocks still
+	// compressed, as they are on disk. Blocks that fall out of the main
+	// cache are uncompressed from it instead of being read again.
+	CompressedCacheSize int
+
+	// The number of bloom filter bits stored per key. Filters let point
+	// reads skip tables that don't contain a key.
+	BloomFilterBits int
+
+	// Whether bloom filters keep every probe for a key within one cache
+	// line, so that lookups of keys a table doesn't hold, most of the
+	// lookups in older levels, read one line of the filter instead of one
+	// per probe. Filters of either kind are read by both.
+	BlockedBloomFilter bool
+
+	// The approximate size of uncompressed data in each table block.
+	BlockSize int
+
+	// The approximate size of each partition of a table's index. Only a
+	// small top-level index stays in memory per open table and partitions
+	// are read through the block cache. Zero keeps whole index blocks.
+	IndexPartitionSize int
+
+	// The memory in bytes that the filter and index blocks of level 0 and
+	// 1 tables are kept in once a point read uses them, so that writes
+	// looking up objects never read metadata from disk for the newest
+	// tables, which every lookup probes. Zero keeps them only while the
+	// tables are open and index partitions only in the block cache.
+	PinnedMetadataSize int
+
+	// Whether each table block stores a hash index of its keys so that
+	// point reads find a key in a block without a binary search.
+	BlockHashIndex bool
+
+	// Whether table blocks store every key whole rather than sharing a
+	// prefix with the key before it. Scans then don't rebuild each key,
+	// at the cost of larger blocks. Suits servlets whose tables mostly use
+	// hashed keys, which share little beyond the table prefix.
+	UncompressedBlockKeys bool
+
+	// The number of bytes buffered in memory before being sorted and written
+	// to a table.
+	WriteBufferSize int
+
+	// The size of the blocks that memtables allocate events from. Zero
+	// leaves LevelDB's default.
+	ArenaBlockSize int
+
+	// Whether memtables and the blocks read into the block cache are backed
+	// by huge pages, so that a large cache takes far fewer TLB entries.
+	// Memtable blocks are then rounded up to 2MB.
+	HugePages int
+
+	// How memtables hold events: SkipListMemTable, VectorMemTable or
+	// HashMemTable.
+	MemTableRep int
+
+	// The number of open files that each database can use.
+	MaxOpenFiles int
+
+	// The number of table blocks that query scans read ahead on background
+	// threads while the current block is aggregated.
+	PrefetchBlocks int
+
+	// The number of objects that a thread of each query scan reads ahead of
+	// the aggregation, plus the one being aggregated, so that block reads,
+	// decompression and merging overlap with decoding. Objects are copied
+	// out of the blocks as they're read ahead. Zero or one reads objects on
+	// the aggregation's thread.
+	ScanPipelineDepth int
+
+	// The number of compactions that can run at once for each database.
+	// Concurrent compactions work on different levels.
+	MaxBackgroundCompactions int
+
+	// The number of compaction threads shared by every database in the
+	// process. Databases are served in the order their work was queued.
+	CompactionThreads int
+
+	// The number of memtable flush threads shared by every database in the
+	// process. Flushes never wait behind compactions, so writes stall for
+	// at most the time a flush takes.
+	FlushThreads int
+
+	// The number of bytes written to a file between asking the OS to start
+	// writing it back, so that the sync at the end of a flush or compaction
+	// doesn't write the whole table at once. Zero leaves writeback to the
+	// OS. Shared by every database in the process.
+	BytesPerSync int
+
+	// Whether files are written with buffered write calls instead of
+	// through a memory mapping. Shared by every database in the process.
+	BufferedWrites bool
+
+	// The number of table files that are read through a memory mapping at
+	// once, with hints for point reads and scans, rather than with read
+	// calls. Scans of mapped tables read uncached blocks in place instead
+	// of copying them. Zero leaves LevelDB's default of every file on 64-bit
+	// builds and a negative limit reads every file with read calls. Shared
+	// by every database in the process.
+	MmapLimit int
+
+	// The number of threads that a single large compaction is split
+	// across. Each thread merges a separate key range of the inputs.
+	MaxSubcompactions int
+
+	// The number of threads that a repair converts logs and scans tables
+	// on. Zero leaves LevelDB's default of one.
+	RepairThreads int
+
+	// Whether databases merge sorted runs of similar size instead of
+	// compacting each level into the next. Events are rewritten far less
+	// often while they're ingested but reads check more tables. Servlets
+	// can still be opened with leveled compaction.
+	TieredCompaction bool
+
+	// How many percent larger than the newer runs next to it a run can be
+	// and still be merged with them by tiered compaction. Zero leaves
+	// LevelDB's default.
+	TieredSizeRatio int
+
+	// The most runs that tiered compaction merges at once. Zero leaves
+	// LevelDB's default.
+	TieredMaxFanIn int
+
+	// The size in bytes of the tables that compactions write into level 1,
+	// multiplied by TargetFileSizeMultiplier for each deeper level. Large
+	// servlets use large tables so they keep fewer files open and each
+	// compaction does more work. Zero leaves LevelDB's defaults.
+	TargetFileSize           int
+	TargetFileSizeMultiplier int
+
+	// The bytes level 1 holds before it is compacted, multiplied by
+	// LevelSizeMultiplier for each deeper level. Zero leaves LevelDB's
+	// defaults.
+	MaxBytesForLevelBase int
+	LevelSizeMultiplier  int
+
+	// Whether the size of each level is derived from the size of the
+	// deepest one, so that the upper levels stay a small fraction of the
+	// data however much of it a servlet holds.
+	DynamicLevelBytes bool
+
+	// The number of level 0 tables at which a compaction of level 0
+	// starts, writes are slowed down and writes stop. Higher limits let
+	// bulk loads run ahead of compactions without stalling, at the cost of
+	// reads checking more tables. Zero leaves LevelDB's defaults.
+	L0CompactionTrigger int
+	L0SlowdownTrigger   int
+	L0StopTrigger       int
+
+	// Whether compactions read and write tables with direct I/O so that
+	// they don't evict the table pages that queries scan from the page
+	// cache.
+	DirectCompaction bool
+
+	// The size of each read of a compaction input table. Direct I/O gets
+	// no readahead from the OS, so this should be large. Zero leaves
+	// LevelDB's default.
+	CompactionReadahead int
+
+	// The size from which event values are kept in blob files outside the
+	// tables, so that compactions move a pointer instead of the whole
+	// value. Reads of such values take an extra read. Zero keeps every
+	// value in the tables.
+	MinBlobSize int
+
+	// Lets the writers batched into one log record insert their own
+	// events into the memtable in parallel.
+	ConcurrentMemtableWrites bool
+
+	// Lets a batch of writers apply its events to the memtable while the
+	// next batch writes the log. Overrides ConcurrentMemtableWrites.
+	PipelinedWrites bool
+
+	// The compression of each record of the write-ahead logs, one of the
+	// table block compressions. Records that don't shrink are logged as is.
+	// Servlets logged with compression can't be opened by older builds.
+	LogCompression int
+
+	// The time a synced write waits after the last sync of a database's log
+	// so that the writes that arrive meanwhile are synced with it. Zero
+	// syncs each synced write at once.
+	LogSyncInterval time.Duration
+
+	// The block compression of tables written to each level. Levels past
+	// the end use the last entry. Empty leaves LevelDB's default.
+	CompressionPerLevel []int
+
+	// A Zstd dictionary, such as one trained with "zstd --train" on
+	// sample events, used for ZstdCompression blocks.
+	CompressionDictionary []byte
+
+	// The number of data blocks of a table that are compressed at once on
+	// threads shared by every database, so that flushes and compactions
+	// aren't limited to the speed one thread compresses at. Zero or one
+	// compresses blocks on the thread that writes the table.
+	CompressionThreads int
+
+	// Whether the bloom filters also hold the table prefix of every key so
+	// that seeks within a table skip data files that have none of its
+	// keys. Requires BloomFilterBits.
+	TablePrefixFilter bool
+}
+
+// The rates that the databases of the process write files at, in bytes per
+// second. Compactions and flushes are limited separately from the logs so
+// that a compaction backlog can't take the disk bandwidth that writes and
+// queries need. Zero means no limit.
+type WriteRateLimits struct {
+	Foreground int
+	Background int
+}
+
+// A storage holds the LevelDB block cache, filter policy and compaction
+// filter shared by the databases opened with a set of options.
+type storage struct {
+	options          StorageOptions
+	cache            *levigo.Cache
+	compressedCache  *levigo.Cache
+	filter           *levigo.FilterPolicy
+	dict             *C.char
+	prefix           *C.leveldb_slicetransform_t
+	objectPrefix     *C.leveldb_slicetransform_t
+	retention        *C.sky_retention
+	compactionFilter *C.leveldb_compactionfilter_t
+	retentionMutex   sync.Mutex
+	retentions       map[string]time.Duration
+	nodes            []*storageNode
+	memoryMutex      sync.Mutex
+	memoryEnvs       map[string]*C.leveldb_env_t
+}
+
+// A storageNode holds the block cache and background threads of the
+// databases placed on a NUMA node.
+type storageNode struct {
+	cache *levigo.Cache
+	env   *C.leveldb_env_t
+}
+
+// A tableWriter writes a table file of keys in increasing order that
+// ingestTable() adds to the database it was created for.
+type tableWriter struct {
+	writer *C.leveldb_tablewriter_t
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// The default options for servlets. Servlets hold large per-object values
+// that are mostly scanned in order so they use large blocks and a large
+// cache shared by every servlet. Bloom filters speed up the object lookups
+// made by writes.
+func DefaultServletStorageOptions() StorageOptions {
+	return StorageOptions{
+		CacheSize:           128 << 20,
+		ScanResistantCache:  true,
+		CacheShardBits:      6,
+		CompressedCacheSize: 64 << 20,
+		BloomFilterBits:     10,
+		BlockedBloomFilter:  true,
+		BlockSize:           64 << 10,
+		IndexPartitionSize:  4 << 10,
+		PinnedMetadataSize:  32 << 20,
+		BlockHashIndex:      true,
+		WriteBufferSize:     16 << 20,
+		ArenaBlockSize:      64 << 10,
+		PrefetchBlocks:      4,
+
+		MaxBackgroundCompactions: 2,
+		CompactionThreads:        4,
+		FlushThreads:             2,
+		BytesPerSync:             1 << 20,
+		MaxSubcompactions:        2,
+		RepairThreads:            8,
+		TargetFileSize:           64 << 20,
+		MaxBytesForLevelBase:     256 << 20,
+		DynamicLevelBytes:        true,
+		L0SlowdownTrigger:        20,
+		L0StopTrigger:            36,
+		ConcurrentMemtableWrites: true,
+		TablePrefixFilter:        true,
+
+		// Fast compression where events are written and rewritten, dense
+		// compression for the bulk of the data in the bottom levels.
+		CompressionPerLevel: []int{LZ4Compression, LZ4Compression, ZstdCompression},
+	}
+}
+
+// The default options for the factors database. It is almost all point
+// lookups of small values so it uses small blocks and bloom filters.
+func DefaultFactorsStorageOptions() StorageOptions {
+	return StorageOptions{
+		CacheSize:          16 << 20,
+		BloomFilterBits:    10,
+		BlockedBloomFilter: true,
+		BlockSize:          4 << 10,
+		BlockHashIndex:     true,
+		PinnedMetadataSize: 8 << 20,
+		WriteBufferSize:    4 << 20,
+	}
+}
+
+// Creates the shared cache and filter policy for a set of options.
+func newStorage(options StorageOptions) *storage {
+	st := &storage{options: options}
+	st.cache = newBlockCache(options, options.CacheSize)
+	if options.CompressedCacheSize > 0 {
+		st.compressedCache = levigo.NewLRUCache(options.CompressedCacheSize)
+	}
+	if options.BloomFilterBits > 0 && options.BlockedBloomFilter {
+		st.filter = newBlockedBloomFilter(options.BloomFilterBits)
+	} else if options.BloomFilterBits > 0 {
+		st.filter = levigo.NewBloomFilter(options.BloomFilterBits)
+	}
+	if len(options.CompressionDictionary) > 0 {
+		// LevelDB doesn't copy the dictionary so it lives in C memory.
+		st.dict = C.CString(string(options.CompressionDictionary))
+	}
+	if options.TablePrefixFilter && st.filter != nil {
+		st.prefix = C.sky_table_prefix_create()
+	}
+	if options.MemTableRep == HashMemTable {
+		st.objectPrefix = C.sky_object_prefix_create()
+	}
+	st.retention = C.sky_retention_create()
+	st.compactionFilter = C.sky_compaction_filter_create(st.retention)
+	return st
+}
+
+// Creates a block cache of a given size of the kind that a set of options
+// asks for. A zero size has no cache.
+func newBlockCache(options StorageOptions, size int) *levigo.Cache {
+	if size <= 0 {
+		return nil
+	} else if options.ClockCache {
+		return newClockCache(size, options.CacheShardBits)
+	} else if options.ScanResistantCache {
+		return newScanResistantCache(size)
+	}
+	return levigo.NewLRUCache(size)
+}
+
+// Creates a block cache that uses midpoint insertion. levigo only wraps the
+// plain LRU cache so the C handle is set on its cache type directly.
+func newScanResistantCache(capacity int) *levigo.Cache {
+	cache := &levigo.Cache{}
+	*(**C.leveldb_cache_t)(unsafe.Pointer(cache)) = C.leveldb_cache_create_scan_resistant_lru(C.size_t(capacity))
+	return cache
+}
+
+// Creates a sharded block cache that uses CLOCK eviction.
+func newClockCache(capacity int, shardBits int) *levigo.Cache {
+	cache := &levigo.Cache{}
+	*(**C.leveldb_cache_t)(unsafe.Pointer(cache)) = C.leveldb_cache_create_clock(C.size_t(capacity), C.int(shardBits))
+	return cache
+}
+
+// Creates a bloom filter policy that keeps the probes of each key within one
+// cache line. levigo only wraps the original bloom filter.
+func newBlockedBloomFilter(bitsPerKey int) *levigo.FilterPolicy {
+	policy := &levigo.FilterPolicy{}
+	*(**C.leveldb_filterpolicy_t)(unsafe.Pointer(policy)) = C.leveldb_filterpolicy_create_blocked_bloom(C.int(bitsPerKey))
+	return policy
+}
+
+// Marks a read as a scan over a large part of a database so that LevelDB
+// reads tables ahead of the iterator. levigo doesn't wrap the option.
+func setSequentialScan(ro *levigo.ReadOptions) {
+	C.leveldb_readoptions_set_sequential_scan(*(**C.leveldb_readoptions_t)(unsafe.Pointer(ro)), 1)
+}
+
+// Splits the index of each table into partitions of about n bytes.
+func setIndexPartitionSize(opts *levigo.Options, n int) {
+	C.leveldb_options_set_index_partition_size(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), C.size_t(n))
+}
+
+// Keeps the filter and index blocks of level 0 and 1 tables in up to n bytes
+// of memory.
+func setPinnedMetadataSize(opts *levigo.Options, n int) {
+	C.leveldb_options_set_pinned_metadata_size(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), C.size_t(n))
+}
+
+// Adds a hash index of its keys to each table block.
+func setDataBlockHashIndex(opts *levigo.Options) {
+	C.leveldb_options_set_data_block_hash_index(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), 1)
+}
+
+// Stores every key of each table block whole.
+func setUncompressedBlockKeys(opts *levigo.Options) {
+	C.leveldb_options_set_uncompressed_block_keys(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), 1)
+}
+
+// Sets the number of compactions that can run at once for a database.
+func setMaxBackgroundCompactions(opts *levigo.Options, n int) {
+	C.leveldb_options_set_max_background_compactions(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), C.int(n))
+}
+
+// Sets the number of threads that a repair of a database runs on.
+func setRepairThreads(opts *levigo.Options, n int) {
+	C.leveldb_options_set_repair_threads(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), C.int(n))
+}
+
+// Sets the number of threads that a large compaction is split across.
+func setMaxSubcompactions(opts *levigo.Options, n int) {
+	C.leveldb_options_set_max_subcompactions(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), C.int(n))
+}
+
+// Makes compactions read and write tables with direct I/O.
+func setDirectCompaction(opts *levigo.Options) {
+	C.leveldb_options_set_use_direct_io_for_compaction(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), 1)
+}
+
+// Sets the size of each read of a compaction input table.
+func setCompactionReadahead(opts *levigo.Options, n int) {
+	C.leveldb_options_set_compaction_readahead_size(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), C.size_t(n))
+}
+
+// Sets the size from which values are kept in blob files.
+func setMinBlobSize(opts *levigo.Options, n int) {
+	C.leveldb_options_set_min_blob_size(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), C.size_t(n))
+}
+
+// Switches a database to tiered compaction. Zero leaves the size ratio or
+// fan in at LevelDB's default.
+func setTieredCompaction(opts *levigo.Options, sizeRatio int, maxFanIn int) {
+	copts := *(**C.leveldb_options_t)(unsafe.Pointer(opts))
+	C.leveldb_options_set_compaction_style(copts, C.int(C.leveldb_tiered_compaction))
+	if sizeRatio > 0 {
+		C.leveldb_options_set_tiered_size_ratio(copts, C.int(sizeRatio))
+	}
+	if maxFanIn > 0 {
+		C.leveldb_options_set_tiered_max_fan_in(copts, C.int(maxFanIn))
+	}
+}
+
+// Sets the size of the tables written into level 1 and the factor it grows
+// by for each deeper level. Zero leaves either at LevelDB's default.
+func setTargetFileSize(opts *levigo.Options, size int, multiplier int) {
+	copts := *(**C.leveldb_options_t)(unsafe.Pointer(opts))
+	if size > 0 {
+		C.leveldb_options_set_target_file_size_base(copts, C.uint64_t(size))
+	}
+	if multiplier > 0 {
+		C.leveldb_options_set_target_file_size_multiplier(copts, C.int(multiplier))
+	}
+}
+
+// Sets the bytes level 1 holds before it is compacted and the factor it
+// grows by for each deeper level. Zero leaves either at LevelDB's default.
+func setMaxBytesForLevel(opts *levigo.Options, base int, multiplier int) {
+	copts := *(**C.leveldb_options_t)(unsafe.Pointer(opts))
+	if base > 0 {
+		C.leveldb_options_set_max_bytes_for_level_base(copts, C.uint64_t(base))
+	}
+	if multiplier > 0 {
+		C.leveldb_options_set_max_bytes_for_level_multiplier(copts, C.int(multiplier))
+	}
+}
+
+// Derives the size of each level from the size of the deepest one.
+func setDynamicLevelBytes(opts *levigo.Options) {
+	C.leveldb_options_set_level_compaction_dynamic_level_bytes(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), 1)
+}
+
+// Sets the number of level 0 tables at which compaction starts, writes
+// slow down and writes stop. Zero leaves a limit at LevelDB's default.
+// LevelDB raises a limit below the one before it.
+func setLevel0Triggers(opts *levigo.Options, compaction int, slowdown int, stop int) {
+	copts := *(**C.leveldb_options_t)(unsafe.Pointer(opts))
+	if compaction > 0 {
+		C.leveldb_options_set_level0_file_num_compaction_trigger(copts, C.int(compaction))
+	}
+	if slowdown > 0 {
+		C.leveldb_options_set_level0_slowdown_writes_trigger(copts, C.int(slowdown))
+	}
+	if stop > 0 {
+		C.leveldb_options_set_level0_stop_writes_trigger(copts, C.int(stop))
+	}
+}
+
+// Lets batched writers insert into the memtable in parallel.
+func setConcurrentMemtableWrites(opts *levigo.Options) {
+	C.leveldb_options_set_allow_concurrent_memtable_write(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), 1)
+}
+
+// Lets the next batch of writers write the log while the previous batch
+// applies to the memtable.
+func setPipelinedWrites(opts *levigo.Options) {
+	C.leveldb_options_set_enable_pipelined_write(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), 1)
+}
+
+// Compresses the records of the write-ahead log.
+func setLogCompression(opts *levigo.Options, compression int) {
+	C.leveldb_options_set_log_compression(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), C.int(compression))
+}
+
+// Sets the time that synced writes wait after the last sync of the log.
+func setLogSyncInterval(opts *levigo.Options, interval time.Duration) {
+	C.leveldb_options_set_log_sync_interval(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), C.uint64_t(interval/time.Microsecond))
+}
+
+// Sets the size of the blocks that memtables allocate from.
+func setArenaBlockSize(opts *levigo.Options, n int) {
+	C.leveldb_options_set_arena_block_size(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), C.size_t(n))
+}
+
+// Backs memtables and the blocks read into the block cache with huge pages.
+func setHugePages(opts *levigo.Options, mode int) {
+	C.leveldb_options_set_huge_pages(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), C.int(mode))
+}
+
+// Sets how memtables hold their entries and the prefix that hashed
+// memtables group keys by.
+func setMemTableRep(opts *levigo.Options, rep int, prefix *C.leveldb_slicetransform_t) {
+	copts := *(**C.leveldb_options_t)(unsafe.Pointer(opts))
+	C.leveldb_options_set_memtable_rep(copts, C.int(rep))
+	if prefix != nil {
+		C.leveldb_options_set_memtable_prefix_extractor(copts, prefix)
+	}
+}
+
+// Sets the cache of compressed blocks below the block cache.
+func setCompressedCache(opts *levigo.Options, cache *levigo.Cache) {
+	C.leveldb_options_set_compressed_cache(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), *(**C.leveldb_cache_t)(unsafe.Pointer(cache)))
+}
+
+// Sets the block compression of each level.
+func setCompressionPerLevel(opts *levigo.Options, levels []int) {
+	clevels := make([]C.int, len(levels))
+	for i, level := range levels {
+		clevels[i] = C.int(level)
+	}
+	C.leveldb_options_set_compression_per_level(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), &clevels[0], C.size_t(len(clevels)))
+}
+
+// Sets the environment that runs a database's background work.
+func setEnv(opts *levigo.Options, env *C.leveldb_env_t) {
+	C.leveldb_options_set_env(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), env)
+}
+
+// Sets the dictionary used by Zstd compressed blocks.
+func setCompressionDictionary(opts *levigo.Options, dict *C.char, n int) {
+	C.leveldb_options_set_compression_dictionary(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), dict, C.size_t(n))
+}
+
+// Sets the number of data blocks of a table compressed at once.
+func setCompressionThreads(opts *levigo.Options, n int) {
+	C.leveldb_options_set_compression_threads(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), C.int(n))
+}
+
+// Grows the compaction thread pool of LevelDB's default environment, which
+// every database shares.
+func setCompactionThreads(n int) {
+	env := C.leveldb_create_default_env()
+	C.leveldb_env_set_background_threads(env, C.int(n))
+	C.leveldb_env_destroy(env)
+}
+
+// Sets the number of memtable flush threads shared by every database.
+func setFlushThreads(n int) {
+	env := C.leveldb_create_default_env()
+	C.leveldb_env_set_flush_threads(env, C.int(n))
+	C.leveldb_env_destroy(env)
+}
+
+// Sets the bytes that every database writes to a file between starting
+// its writeback.
+func setBytesPerSync(n int) {
+	env := C.leveldb_create_default_env()
+	C.leveldb_env_set_bytes_per_sync(env, C.uint64_t(n))
+	C.leveldb_env_destroy(env)
+}
+
+// Makes every database write files with buffered write calls instead of
+// through a memory mapping.
+func setBufferedWrites() {
+	env := C.leveldb_create_default_env()
+	C.leveldb_env_set_use_mmap_writes(env, 0)
+	C.leveldb_env_destroy(env)
+}
+
+// Sets the number of table files that every database in the process reads
+// through a memory mapping. Negative limits map none of them.
+func setMmapLimit(n int) {
+	if n < 0 {
+		n = 0
+	}
+	env := C.leveldb_create_default_env()
+	C.leveldb_env_set_mmap_limit(env, C.int(n))
+	C.leveldb_env_destroy(env)
+}
+
+// Limits the rates that every database in the process writes files at, in
+// bytes per second. The background rate covers flushes and compactions and
+// the foreground rate covers logs and manifests. Zero means no limit.
+func setWriteRateLimits(foreground int, background int) {
+	env := C.leveldb_create_default_env()
+	C.leveldb_env_set_write_rate_limits(env, C.uint64_t(foreground), C.uint64_t(background))
+	C.leveldb_env_destroy(env)
+}
+
+// Sets the table prefix extractor used by the bloom filters.
+func setPrefixExtractor(opts *levigo.Options, prefix *C.leveldb_slicetransform_t) {
+	C.leveldb_options_set_prefix_extractor(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), prefix)
+}
+
+// Sets the merge operator that batch merges are applied with.
+func setMergeOperator(opts *levigo.Options, op *C.leveldb_mergeoperator_t) {
+	C.leveldb_options_set_merge_operator(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), op)
+}
+
+// Sets the filter that compactions pass the values they keep through.
+func setCompactionFilter(opts *levigo.Options, filter *C.leveldb_compactionfilter_t) {
+	C.leveldb_options_set_compaction_filter(*(**C.leveldb_options_t)(unsafe.Pointer(opts)), filter)
+}
+
+// Restricts an iterator to the table prefix of each seek target so that
+// LevelDB can skip the data files whose filters rule the table out. The
+// iterator becomes invalid at the end of the table.
+func setPrefixSameAsStart(ro *levigo.ReadOptions) {
+	C.leveldb_readoptions_set_prefix_same_as_start(*(**C.leveldb_readoptions_t)(unsafe.Pointer(ro)), 1)
+}
+
+// Deletes every key in [start, end) with a single range tombstone. levigo
+// doesn't wrap range deletes.
+func deleteRange(db *levigo.DB, wo *levigo.WriteOptions, start []byte, end []byte) error {
+	var errStr *C.char
+	cstart, cend := (*C.char)(unsafe.Pointer(&start[0])), (*C.char)(unsafe.Pointer(&end[0]))
+	C.leveldb_delete_range(*(**C.leveldb_t)(unsafe.Pointer(db)), *(**C.leveldb_writeoptions_t)(unsafe.Pointer(wo)), cstart, C.size_t(len(start)), cend, C.size_t(len(end)), &errStr)
+	if errStr != nil {
+		defer C.free(unsafe.Pointer(errStr))
+		return levigo.DatabaseError(C.GoString(errStr))
+	}
+	return nil
+}
+
+// Writes a database's memtable to a table file so that the writes in its
+// log don't have to be replayed the next time it's opened.
+func flushMemTable(db *levigo.DB) error {
+	var errStr *C.char
+	C.leveldb_flush_memtable(*(**C.leveldb_t)(unsafe.Pointer(db)), &errStr)
+	if errStr != nil {
+		defer C.free(unsafe.Pointer(errStr))
+		return levigo.DatabaseError(C.GoString(errStr))
+	}
+	return nil
+}
+
+// Writes a consistent copy of a database to a directory by hard linking its
+// data files. A directory that holds an earlier checkpoint of the same
+// database only gains the files written since.
+func createCheckpoint(db *levigo.DB, dir string) error {
+	var errStr *C.char
+	cdir := C.CString(dir)
+	defer C.free(unsafe.Pointer(cdir))
+	C.leveldb_create_checkpoint(*(**C.leveldb_t)(unsafe.Pointer(db)), cdir, &errStr)
+	if errStr != nil {
+		defer C.free(unsafe.Pointer(errStr))
+		return levigo.DatabaseError(C.GoString(errStr))
+	}
+	return nil
+}
+
+// Creates a writer for a table file at a path that can be ingested into a
+// database. The table is written with the options of the database's bottom
+// level.
+func newTableWriter(db *levigo.DB, path string) (*tableWriter, error) {
+	var errStr *C.char
+	cpath := C.CString(path)
+	defer C.free(unsafe.Pointer(cpath))
+	writer := C.leveldb_tablewriter_create(*(**C.leveldb_t)(unsafe.Pointer(db)), cpath, &errStr)
+	if errStr != nil {
+		defer C.free(unsafe.Pointer(errStr))
+		return nil, levigo.DatabaseError(C.GoString(errStr))
+	}
+	return &tableWriter{writer: writer}, nil
+}
+
+// Adds a table file finished by a tableWriter of a database to the
+// database without writing its keys to the log, provided that the database
+// holds no keys in the table's range.
+func ingestTable(db *levigo.DB, path string) error {
+	var errStr *C.char
+	cpath := C.CString(path)
+	defer C.free(unsafe.Pointer(cpath))
+	C.leveldb_ingest_table(*(**C.leveldb_t)(unsafe.Pointer(db)), cpath, &errStr)
+	if errStr != nil {
+		defer C.free(unsafe.Pointer(errStr))
+		msg := C.GoString(errStr)
+		if strings.HasPrefix(msg, "Invalid argument: table overlaps") {
+			return errTableOverlaps
+		}
+		return levigo.DatabaseError(msg)
+	}
+	return nil
+}
+
+// Returns the locations of the database's blocks that are in the block
+// cache so that they can be read back in after a restart.
+func getCachedBlocks(db *levigo.DB) ([]byte, error) {
+	var errStr *C.char
+	var length C.size_t
+	value := C.leveldb_get_cached_blocks(*(**C.leveldb_t)(unsafe.Pointer(db)), &length, &errStr)
+	if errStr != nil {
+		defer C.free(unsafe.Pointer(errStr))
+		return nil, levigo.DatabaseError(C.GoString(errStr))
+	}
+	if value == nil {
+		return nil, nil
+	}
+	defer C.free(unsafe.Pointer(value))
+	return C.GoBytes(unsafe.Pointer(value), C.int(length)), nil
+}
+
+// Reads a list of blocks from getCachedBlocks() into the block cache at
+// most a number of bytes a second, or as fast as possible if it's zero.
+func warmCache(db *levigo.DB, blocks []byte, bytesPerSecond int) error {
+	if len(blocks) == 0 {
+		return nil
+	}
+	var errStr *C.char
+	C.leveldb_warm_cache(*(**C.leveldb_t)(unsafe.Pointer(db)), (*C.char)(unsafe.Pointer(&blocks[0])), C.size_t(len(blocks)), C.uint64_t(bytesPerSecond), &errStr)
+	if errStr != nil {
+		defer C.free(unsafe.Pointer(errStr))
+		return levigo.DatabaseError(C.GoString(errStr))
+	}
+	return nil
+}
+
+// Reads several keys from the same state of a database at once. The keys
+// are probed in order so that keys sharing a table block read it once.
+// Returns nil for the keys that aren't found. levigo doesn't wrap MultiGet.
+func multiGet(db *levigo.DB, ro *levigo.ReadOptions, keys [][]byte) ([][]byte, error) {
+	n := len(keys)
+	if n == 0 {
+		return nil, nil
+	}
+
+	// The keys and the arrays are copied into C memory since cgo can't
+	// pass arrays of Go pointers.
+	size := 0
+	for _, key := range keys {
+		size += len(key)
+	}
+	pointerSize, lengthSize := C.size_t(unsafe.Sizeof((*C.char)(nil))), C.size_t(unsafe.Sizeof(C.size_t(0)))
+	buffer := C.malloc(C.size_t(size) + 2*C.size_t(n)*(pointerSize+lengthSize))
+	defer C.free(buffer)
+	ckeys := (*[1 << 28]*C.char)(unsafe.Pointer(uintptr(buffer) + uintptr(size)))[:n:n]
+	ckeylens := (*[1 << 28]C.size_t)(unsafe.Pointer(uintptr(buffer) + uintptr(size) + uintptr(C.size_t(n)*pointerSize)))[:n:n]
+	cvalues := (*[1 << 28]*C.char)(unsafe.Pointer(uintptr(buffer) + uintptr(size) + uintptr(C.size_t(n)*(pointerSize+lengthSize))))[:n:n]
+	cvallens := (*[1 << 28]C.size_t)(unsafe.Pointer(uintptr(buffer) + uintptr(size) + uintptr(C.size_t(n)*(2*pointerSize+lengthSize))))[:n:n]
+	data := (*[1 << 30]byte)(buffer)[:size:size]
+	offset := 0
+	for i, key := range keys {
+		copy(data[offset:], key)
+		ckeys[i] = (*C.char)(unsafe.Pointer(uintptr(buffer) + uintptr(offset)))
+		ckeylens[i] = C.size_t(len(key))
+		offset += len(key)
+	}
+
+	var errStr *C.char
+	C.leveldb_multi_get(*(**C.leveldb_t)(unsafe.Pointer(db)), *(**C.leveldb_readoptions_t)(unsafe.Pointer(ro)), C.size_t(n), &ckeys[0], &ckeylens[0], &cvalues[0], &cvallens[0], &errStr)
+	values := make([][]byte, n)
+	for i := range values {
+		if cvalues[i] != nil {
+			values[i] = C.GoBytes(unsafe.Pointer(cvalues[i]), C.int(cvallens[i]))
+			C.free(unsafe.Pointer(cvalues[i]))
+		}
+	}
+	if errStr != nil {
+		defer C.free(unsafe.Pointer(errStr))
+		return nil, levigo.DatabaseError(C.GoString(errStr))
+	}
+	return values, nil
+}
+
+// Adds a range tombstone for every key in [start, end) to a write batch.
+func batchDeleteRange(batch *levigo.WriteBatch, start []byte, end []byte) {
+	cstart, cend := (*C.char)(unsafe.Pointer(&start[0])), (*C.char)(unsafe.Pointer(&end[0]))
+	C.leveldb_writebatch_delete_range(*(**C.leveldb_writebatch_t)(unsafe.Pointer(batch)), cstart, C.size_t(len(start)), cend, C.size_t(len(end)))
+}
+
+// Adds a merge operand for a key to a write batch. levigo doesn't wrap
+// merges.
+func batchMerge(batch *levigo.WriteBatch, key []byte, value []byte) {
+	ckey, cvalue := (*C.char)(unsafe.Pointer(&key[0])), (*C.char)(unsafe.Pointer(&value[0]))
+	C.leveldb_writebatch_merge(*(**C.leveldb_writebatch_t)(unsafe.Pointer(batch)), ckey, C.size_t(len(key)), cvalue, C.size_t(len(value)))
+}
+
+// Sets the number of blocks that an iterator reads ahead in the background.
+func setPrefetchBlocks(ro *levigo.ReadOptions, n int) {
+	C.leveldb_readoptions_set_prefetch_blocks(*(**C.leveldb_readoptions_t)(unsafe.Pointer(ro)), C.int(n))
+}
+
+// Makes an iterator invalid at the first key at or after a bound so that it
+// doesn't read the blocks and files past it. The bound is copied by the
+// iterator, so the read options can be closed once it's created.
+func setIterateUpperBound(ro *levigo.ReadOptions, key []byte) {
+	C.leveldb_readoptions_set_iterate_upper_bound(*(**C.leveldb_readoptions_t)(unsafe.Pointer(ro)), (*C.char)(unsafe.Pointer(&key[0])), C.size_t(len(key)))
+}
+
+// Keeps the blocks that an iterator's values point into alive until its
+// pinned data is released, so values can be read without copying them.
+func setPinData(ro *levigo.ReadOptions) {
+	C.leveldb_readoptions_set_pin_data(*(**C.leveldb_readoptions_t)(unsafe.Pointer(ro)), 1)
+}
+
+// Counts the table blocks read by the iterators created with the options.
+// The counters aren't synchronized, so each iterator needs its own.
+func setReadStats(ro *levigo.ReadOptions, stats *C.leveldb_readstats_t) {
+	C.leveldb_readoptions_set_stats(*(**C.leveldb_readoptions_t)(unsafe.Pointer(ro)), stats)
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+// Opens a database at a given path, creating it if it doesn't exist. A nil
+// storage opens the database with LevelDB's defaults.
+func (st *storage) open(path string) (*levigo.DB, error) {
+	return st.openLeveled(path, false, -1)
+}
+
+// Opens the database at a path like open, except that it keeps leveled
+// compaction when the storage's options ask for tiered compaction if
+// leveled is true. A database can switch between the two when reopened.
+// A database placed on one of the storage's NUMA nodes uses the node's
+// block cache and runs its compactions and flushes on the node's CPUs.
+func (st *storage) openLeveled(path string, leveled bool, node int) (*levigo.DB, error) {
+	opts := st.newOptions(leveled, node)
+	defer opts.Close()
+	opts.SetCreateIfMissing(true)
+	return levigo.Open(path, opts)
+}
+
+// Opens a database of a separate table at a path like openLeveled, except
+// that the table's own compaction and compression replace the storage's.
+func (st *storage) openSeparate(path string, table *Table, node int) (*levigo.DB, error) {
+	opts := st.newOptions(table.Compaction == LeveledTableCompaction, node)
+	defer opts.Close()
+	if table.Compaction == TieredTableCompaction && (st == nil || !st.options.TieredCompaction) {
+		var sizeRatio, maxFanIn int
+		if st != nil {
+			sizeRatio, maxFanIn = st.options.TieredSizeRatio, st.options.TieredMaxFanIn
+		}
+		setTieredCompaction(opts, sizeRatio, maxFanIn)
+	}
+	if compression, ok := tableCompressions[table.Compression]; ok {
+		setCompressionPerLevel(opts, []int{compression})
+	}
+	opts.SetCreateIfMissing(true)
+	return levigo.Open(path, opts)
+}
+
+// Repairs the database at a path so that it can be opened again after its
+// files were corrupted, keeping as much of its data as it can. Repairs
+// resume where they left off if they're interrupted.
+func (st *storage) repair(path string) error {
+	opts := st.newOptions(false, -1)
+	defer opts.Close()
+	if st != nil && st.options.RepairThreads > 0 {
+		setRepairThreads(opts, st.options.RepairThreads)
+	}
+	return levigo.RepairDatabase(path, opts)
+}
+
+// Creates the LevelDB options of the storage's databases. The caller must
+// close them.
+func (st *storage) newOptions(leveled bool, node int) *levigo.Options {
+	opts := levigo.NewOptions()
+	setMergeOperator(opts, objectMergeOperator)
+	if st != nil {
+		cache := st.cache
+		if node >= 0 && node < len(st.nodes) {
+			cache = st.nodes[node].cache
+			setEnv(opts, st.nodes[node].env)
+		}
+		if cache != nil {
+			opts.SetCache(cache)
+		}
+		if st.compressedCache != nil {
+			setCompressedCache(opts, st.compressedCache)
+		}
+		if st.filter != nil {
+			opts.SetFilterPolicy(st.filter)
+		}
+		if st.prefix != nil {
+			setPrefixExtractor(opts, st.prefix)
+		}
+		if st.compactionFilter != nil {
+			setCompactionFilter(opts, st.compactionFilter)
+		}
+		if st.options.BlockSize > 0 {
+			opts.SetBlockSize(st.options.BlockSize)
+		}
+		if st.options.IndexPartitionSize > 0 {
+			setIndexPartitionSize(opts, st.options.IndexPartitionSize)
+		}
+		if st.options.PinnedMetadataSize > 0 {
+			setPinnedMetadataSize(opts, st.options.PinnedMetadataSize)
+		}
+		if st.options.BlockHashIndex {
+			setDataBlockHashIndex(opts)
+		}
+		if st.options.UncompressedBlockKeys {
+			setUncompressedBlockKeys(opts)
+		}
+		if st.options.WriteBufferSize > 0 {
+			opts.SetWriteBufferSize(st.options.WriteBufferSize)
+		}
+		if st.options.ArenaBlockSize > 0 {
+			setArenaBlockSize(opts, st.options.ArenaBlockSize)
+		}
+		if st.options.HugePages != NoHugePages {
+			setHugePages(opts, st.options.HugePages)
+		}
+		if st.options.MemTableRep != SkipListMemTable {
+			setMemTableRep(opts, st.options.MemTableRep, st.objectPrefix)
+		}
+		if st.options.MaxOpenFiles > 0 {
+			opts.SetMaxOpenFiles(st.options.MaxOpenFiles)
+		}
+		if st.options.MaxBackgroundCompactions > 0 {
+			setMaxBackgroundCompactions(opts, st.options.MaxBackgroundCompactions)
+		}
+		if st.options.MaxSubcompactions > 0 {
+			setMaxSubcompactions(opts, st.options.MaxSubcompactions)
+		}
+		if st.options.TieredCompaction && !leveled {
+			setTieredCompaction(opts, st.options.TieredSizeRatio, st.options.TieredMaxFanIn)
+		}
+		setTargetFileSize(opts, st.options.TargetFileSize, st.options.TargetFileSizeMultiplier)
+		setMaxBytesForLevel(opts, st.options.MaxBytesForLevelBase, st.options.LevelSizeMultiplier)
+		if st.options.DynamicLevelBytes {
+			setDynamicLevelBytes(opts)
+		}
+		setLevel0Triggers(opts, st.options.L0CompactionTrigger, st.options.L0SlowdownTrigger, st.options.L0StopTrigger)
+		if st.options.DirectCompaction {
+			setDirectCompaction(opts)
+		}
+		if st.options.CompactionReadahead > 0 {
+			setCompactionReadahead(opts, st.options.CompactionReadahead)
+		}
+		if st.options.MinBlobSize > 0 {
+			setMinBlobSize(opts, st.options.MinBlobSize)
+		}
+		if st.options.ConcurrentMemtableWrites {
+			setConcurrentMemtableWrites(opts)
+		}
+		if st.options.PipelinedWrites {
+			setPipelinedWrites(opts)
+		}
+		if st.options.LogCompression != NoCompression {
+			setLogCompression(opts, st.options.LogCompression)
+		}
+		if st.options.LogSyncInterval > 0 {
+			setLogSyncInterval(opts, st.options.LogSyncInterval)
+		}
+		if len(st.options.CompressionPerLevel) > 0 {
+			setCompressionPerLevel(opts, st.options.CompressionPerLevel)
+		}
+		if st.dict != nil {
+			setCompressionDictionary(opts, st.dict, len(st.options.CompressionDictionary))
+		}
+		if st.options.CompressionThreads > 1 {
+			setCompressionThreads(opts, st.options.CompressionThreads)
+		}
+		if st.options.CompactionThreads > 0 {
+			setCompactionThreads(st.options.CompactionThreads)
+		}
+		if st.options.FlushThreads > 0 {
+			setFlushThreads(st.options.FlushThreads)
+		}
+		if st.options.BytesPerSync > 0 {
+			setBytesPerSync(st.options.BytesPerSync)
+		}
+		if st.options.BufferedWrites {
+			setBufferedWrites()
+		}
+		if st.options.MmapLimit != 0 {
+			setMmapLimit(st.options.MmapLimit)
+		}
+	}
+	return opts
+}
+
+// Returns the in-memory environment that the databases of a memory table
+// are stored in, creating it the first time. Every servlet keeps its part
+// of the table in the same environment so that its usage is the table's.
+func (st *storage) memoryEnv(table string) *C.leveldb_env_t {
+	st.memoryMutex.Lock()
+	defer st.memoryMutex.Unlock()
+	if st.memoryEnvs == nil {
+		st.memoryEnvs = make(map[string]*C.leveldb_env_t)
+	}
+	env := st.memoryEnvs[table]
+	if env == nil {
+		env = C.leveldb_create_mem_env()
+		st.memoryEnvs[table] = env
+	}
+	return env
+}
+
+// Opens a database of a memory table at a path in the table's in-memory
+// environment. The database never touches the disk and its data is lost
+// once it's destroyed or the process exits.
+func (st *storage) openMemory(path string, table string) (*levigo.DB, error) {
+	opts := st.newOptions(true, -1)
+	defer opts.Close()
+	setEnv(opts, st.memoryEnv(table))
+	opts.SetCreateIfMissing(true)
+	return levigo.Open(path, opts)
+}
+
+// Deletes the files of a closed database of a memory table, which frees
+// their memory.
+func (st *storage) destroyMemory(path string, table string) error {
+	opts := levigo.NewOptions()
+	defer opts.Close()
+	setEnv(opts, st.memoryEnv(table))
+	return levigo.DestroyDatabase(path, opts)
+}
+
+// Checks if the databases of a memory table take up its memory limit. The
+// files of its logs and of tables waiting to be deleted by compactions are
+// included.
+func (st *storage) memoryFull(table *Table) bool {
+	if table.MemoryLimit <= 0 {
+		return false
+	}
+	usage := uint64(C.leveldb_mem_env_usage(st.memoryEnv(table.Name)))
+	return usage >= uint64(table.MemoryLimit)<<20
+}
+
+// Sets whether compactions of the databases opened with the storage move
+// runs of msgpack events into event blocks, so that objects written before
+// blocks were enabled, or through SetRawEvents(), migrate as their tables
+// are rewritten.
+func (st *storage) setEventBlocks(value bool) {
+	var v C.int
+	if value {
+		v = 1
+	}
+	C.sky_retention_set_event_blocks(st.retention, v)
+}
+
+// Sets the time that the events of the table with a prefix are kept in the
+// databases opened with the storage. Compactions trim older events off the
+// objects they rewrite, so they're removed without any writes of their own
+// but only once their objects are compacted. The table's zones, rollups and
+// counts still include them. Zero keeps every event.
+func (st *storage) setRetention(prefix []byte, retention time.Duration) {
+	st.retentionMutex.Lock()
+	defer st.retentionMutex.Unlock()
+	if st.retentions == nil {
+		st.retentions = make(map[string]time.Duration)
+	}
+	if retention > 0 {
+		st.retentions[string(prefix)] = retention
+	} else {
+		delete(st.retentions, string(prefix))
+	}
+
+	var rules []byte
+	for prefix, retention := range st.retentions {
+		b := make([]byte, 12+len(prefix))
+		binary.LittleEndian.PutUint32(b, uint32(len(prefix)))
+		copy(b[4:], prefix)
+		binary.LittleEndian.PutUint64(b[4+len(prefix):], uint64(retention/time.Second))
+		rules = append(rules, b...)
+	}
+	var crules *C.char
+	if len(rules) > 0 {
+		crules = (*C.char)(unsafe.Pointer(&rules[0]))
+	}
+	C.sky_retention_set(st.retention, crules, C.size_t(len(rules)))
+}
+
+// Splits the block cache and background threads of the storage between
+// NUMA nodes. Each node gets an equal share of the cache and of the
+// compaction and flush threads, which run on the node's CPUs and prefer its
+// memory. Must be called before any database is opened.
+func (st *storage) bindNodes(nodes []*numaNode) {
+	if len(nodes) == 0 {
+		return
+	}
+	if st.cache != nil {
+		st.cache.Close()
+		st.cache = nil
+	}
+	share := func(n int) int {
+		if n = (n + len(nodes) - 1) / len(nodes); n < 1 {
+			n = 1
+		}
+		return n
+	}
+	for _, node := range nodes {
+		cpus := make([]C.int, len(node.cpus))
+		for i, cpu := range node.cpus {
+			cpus[i] = C.int(cpu)
+		}
+		env := C.leveldb_create_bound_env(&cpus[0], C.size_t(len(cpus)), C.int(node.id))
+		C.leveldb_env_set_background_threads(env, C.int(share(st.options.CompactionThreads)))
+		C.leveldb_env_set_flush_threads(env, C.int(share(st.options.FlushThreads)))
+		st.nodes = append(st.nodes, &storageNode{
+			cache: newBlockCache(st.options, st.options.CacheSize/len(nodes)),
+			env:   env,
+		})
+	}
+}
+
+// Releases the caches, filter policy, prefix extractor, dictionary,
+// compaction filter and the environments of memory tables. Every database
+// opened with the storage must be closed first.
+func (st *storage) Close() {
+	if st.cache != nil {
+		st.cache.Close()
+		st.cache = nil
+	}
+	for _, node := range st.nodes {
+		if node.cache != nil {
+			node.cache.Close()
+		}
+		C.leveldb_env_destroy(node.env)
+	}
+	st.nodes = nil
+	for _, env := range st.memoryEnvs {
+		C.leveldb_env_destroy(env)
+	}
+	st.memoryEnvs = nil
+	if st.compressedCache != nil {
+		st.compressedCache.Close()
+		st.compressedCache = nil
+	}
+	if st.filter != nil {
+		st.filter.Close()
+		st.filter = nil
+	}
+	if st.dict != nil {
+		C.free(unsafe.Pointer(st.dict))
+		st.dict = nil
+	}
+	if st.prefix != nil {
+		C.leveldb_slicetransform_destroy(st.prefix)
+		st.prefix = nil
+	}
+	if st.objectPrefix != nil {
+		C.leveldb_slicetransform_destroy(st.objectPrefix)
+		st.objectPrefix = nil
+	}
+	if st.compactionFilter != nil {
+		C.leveldb_compactionfilter_destroy(st.compactionFilter)
+		st.compactionFilter, st.retention = nil, nil
+	}
+}
+
+//--------------------------------------
+// Table Writers
+//--------------------------------------
+
+// Adds a key to the table. Keys must be added in increasing order.
+func (w *tableWriter) Put(key []byte, value []byte) error {
+	var errStr *C.char
+	var cvalue *C.char
+	if len(value) > 0 {
+		cvalue = (*C.char)(unsafe.Pointer(&value[0]))
+	}
+	C.leveldb_tablewriter_add(w.writer, (*C.char)(unsafe.Pointer(&key[0])), C.size_t(len(key)), cvalue, C.size_t(len(value)), &errStr)
+	if errStr != nil {
+		defer C.free(unsafe.Pointer(errStr))
+		return levigo.DatabaseError(C.GoString(errStr))
+	}
+	return nil
+}
+
+// Writes the rest of the table and syncs the file.
+func (w *tableWriter) Finish() error {
+	var errStr *C.char
+	C.leveldb_tablewriter_finish(w.writer, &errStr)
+	if errStr != nil {
+		defer C.free(unsafe.Pointer(errStr))
+		return levigo.DatabaseError(C.GoString(errStr))
+	}
+	return nil
+}
+
+// The number of bytes written to the table file so far.
+func (w *tableWriter) Size() uint64 {
+	return uint64(C.leveldb_tablewriter_file_size(w.writer))
+}
+
+// Releases the writer. A table that wasn't finished is left incomplete.
+func (w *tableWriter) Close() {
+	if w.writer != nil {
+		C.leveldb_tablewriter_destroy(w.writer)
+		w.writer = nil
+	}
+}
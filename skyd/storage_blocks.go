@@ -0,0 +1,75 @@
+package skyd
+
+/*
+#include <stdlib.h>
+*/
+import "C"
+
+import (
+	"unsafe"
+)
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Encodes the runs of msgpack events in an event stream into event blocks
+// for the compaction filter in storage.go. Returns a copy of the stream in
+// C memory, which the filter frees, or nil if no run was encoded.
+//
+//export skyEncodeEventRuns
+func skyEncodeEventRuns(events unsafe.Pointer, length C.size_t, newLength *C.size_t) unsafe.Pointer {
+	data, changed := encodeEventRuns(C.GoBytes(events, C.int(length)))
+	if !changed {
+		return nil
+	}
+	p := C.malloc(C.size_t(len(data)))
+	copy((*[1 << 30]byte)(p)[:len(data):len(data)], data)
+	*newLength = C.size_t(len(data))
+	return p
+}
+
+// Replaces the runs of consecutive msgpack events in an event stream with
+// event blocks. Event blocks and checkpoints are kept where they are and end
+// a run. Runs are cut once they reach the size of a chunk so that the index
+// can still skip through them, and runs shorter than a tail that appends
+// would fold are left as they are. Runs holding values that blocks can't
+// represent stay msgpack. Returns whether any run was encoded.
+func encodeEventRuns(data []byte) ([]byte, bool) {
+	var result []byte
+	changed := false
+	start := 0
+	flush := func(end int) {
+		if end-start >= eventBlockTailThreshold {
+			if events, err := DecodeEvents(data[start:end]); err == nil {
+				if block, err := EncodeEventBlock(events); err == nil && block != nil {
+					result = append(result, block...)
+					changed = true
+					start = end
+					return
+				}
+			}
+		}
+		result = append(result, data[start:end]...)
+		start = end
+	}
+
+	for offset := 0; offset < len(data); {
+		_, _, size, err := eventStreamElement(data[offset:])
+		if err != nil {
+			return nil, false
+		}
+		if flag := data[offset]; flag == eventBlockFlag || flag == eventCheckpointFlag {
+			flush(offset)
+			result = append(result, data[offset:offset+size]...)
+			start = offset + size
+		} else if offset+size-start >= objectChunkSize {
+			flush(offset + size)
+		}
+		offset += size
+	}
+	flush(len(data))
+	return result, changed
+}
@@ -0,0 +1,496 @@
+package skyd
+
+import (
+	"bytes"
+	"fmt"
+	"github.com/jmhodges/levigo"
+	"io/ioutil"
+	"os"
+	"strings"
+	"testing"
+	"time"
+)
+
+// Ensure that several databases can share a storage's cache and filter.
+func TestStorageOpen(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+
+	st := newStorage(StorageOptions{CacheSize: 1 << 20, ScanResistantCache: true, BloomFilterBits: 10, BlockSize: 16 << 10, IndexPartitionSize: 1 << 10, BlockHashIndex: true, WriteBufferSize: 1 << 20, MaxOpenFiles: 64, MaxBackgroundCompactions: 2, CompactionThreads: 2})
+	defer st.Close()
+	dbs := make([]*levigo.DB, 0)
+	for i := 0; i < 2; i++ {
+		db, err := st.open(fmt.Sprintf("%s/%d", path, i))
+		if err != nil {
+			t.Fatalf("Unable to open database: %v", err)
+		}
+		defer db.Close()
+		dbs = append(dbs, db)
+	}
+
+	ro, wo := levigo.NewReadOptions(), levigo.NewWriteOptions()
+	defer ro.Close()
+	defer wo.Close()
+	for i, db := range dbs {
+		if err := db.Put(wo, []byte("foo"), []byte(fmt.Sprintf("bar%d", i))); err != nil {
+			t.Fatalf("Unable to put: %v", err)
+		}
+	}
+	for i, db := range dbs {
+		if value, err := db.Get(ro, []byte("foo")); err != nil || string(value) != fmt.Sprintf("bar%d", i) {
+			t.Fatalf("Unexpected value: %q (%v)", value, err)
+		}
+	}
+}
+
+// Ensure that databases placed on NUMA nodes use the nodes' caches and
+// threads.
+func TestStorageNUMANodes(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+
+	// Fake the kernel's listing of two nodes that share the first CPU.
+	for i, list := range []string{"0", "0", "bad"} {
+		os.MkdirAll(fmt.Sprintf("%s/sys/node%d", path, i), 0700)
+		ioutil.WriteFile(fmt.Sprintf("%s/sys/node%d/cpulist", path, i), []byte(list+"\n"), 0600)
+	}
+	nodes := readNUMANodes(path + "/sys")
+	if len(nodes) != 2 || nodes[1].id != 1 || len(nodes[1].cpus) != 1 {
+		t.Fatalf("Unexpected nodes: %v", nodes)
+	}
+	if cpus, err := parseCPUList("0-2,8,10-11"); err != nil || fmt.Sprint(cpus) != "[0 1 2 8 10 11]" {
+		t.Fatalf("Unexpected CPUs: %v (%v)", cpus, err)
+	}
+
+	st := newStorage(StorageOptions{CacheSize: 1 << 20, WriteBufferSize: 1 << 20, CompactionThreads: 2, FlushThreads: 1})
+	st.bindNodes(nodes)
+	defer st.Close()
+	if st.cache != nil || len(st.nodes) != 2 || st.nodes[1].cache == nil {
+		t.Fatalf("Unexpected node caches: %v", st.nodes)
+	}
+	db, err := st.openLeveled(path+"/db", false, 1)
+	if err != nil {
+		t.Fatalf("Unable to open database: %v", err)
+	}
+	defer db.Close()
+
+	ro, wo := levigo.NewReadOptions(), levigo.NewWriteOptions()
+	defer ro.Close()
+	defer wo.Close()
+	for i := 0; i < 1000; i++ {
+		if err := db.Put(wo, []byte(fmt.Sprintf("key%04d", i)), bytes.Repeat([]byte("x"), 4096)); err != nil {
+			t.Fatalf("Unable to put: %v", err)
+		}
+	}
+	db.CompactRange(levigo.Range{})
+	if value, err := db.Get(ro, []byte("key0500")); err != nil || len(value) != 4096 {
+		t.Fatalf("Unexpected value: %d bytes (%v)", len(value), err)
+	}
+}
+
+// Ensure that a database can switch between tiered and leveled compaction
+// when it's reopened.
+func TestStorageOpenTieredCompaction(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+
+	st := newStorage(StorageOptions{WriteBufferSize: 64 << 10, TieredCompaction: true, TieredSizeRatio: 10, TieredMaxFanIn: 4})
+	defer st.Close()
+	ro, wo := levigo.NewReadOptions(), levigo.NewWriteOptions()
+	defer ro.Close()
+	defer wo.Close()
+	for _, leveled := range []bool{false, true, false} {
+		db, err := st.openLeveled(path, leveled, -1)
+		if err != nil {
+			t.Fatalf("Unable to open database: %v", err)
+		}
+		for i := 0; i < 2000; i++ {
+			if err := db.Put(wo, []byte(fmt.Sprintf("key%d", i%500)), []byte(fmt.Sprintf("%01000d", i))); err != nil {
+				t.Fatalf("Unable to put: %v", err)
+			}
+		}
+		for i := 0; i < 500; i++ {
+			if value, err := db.Get(ro, []byte(fmt.Sprintf("key%d", i))); err != nil || string(value) != fmt.Sprintf("%01000d", 1500+i) {
+				t.Fatalf("Unexpected value for key%d: %q (%v)", i, value, err)
+			}
+		}
+		db.Close()
+	}
+}
+
+// Ensure that a database can be read through a CLOCK block cache.
+func TestStorageOpenClockCache(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+
+	st := newStorage(StorageOptions{CacheSize: 1 << 20, ClockCache: true, CacheShardBits: 2})
+	defer st.Close()
+	db, err := st.open(path)
+	if err != nil {
+		t.Fatalf("Unable to open database: %v", err)
+	}
+	defer db.Close()
+
+	ro, wo := levigo.NewReadOptions(), levigo.NewWriteOptions()
+	defer ro.Close()
+	defer wo.Close()
+	if err := db.Put(wo, []byte("foo"), []byte("bar")); err != nil {
+		t.Fatalf("Unable to put: %v", err)
+	}
+	if value, err := db.Get(ro, []byte("foo")); err != nil || string(value) != "bar" {
+		t.Fatalf("Unexpected value: %q (%v)", value, err)
+	}
+}
+
+// Ensure that a database can be written and read with per-level
+// compression and a Zstd dictionary.
+func TestStorageOpenCompression(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+
+	st := newStorage(StorageOptions{CacheSize: 1 << 20, CompressedCacheSize: 1 << 20, CompressionPerLevel: []int{LZ4Compression, ZstdCompression}, CompressionDictionary: []byte("foo bar baz")})
+	defer st.Close()
+	db, err := st.open(path)
+	if err != nil {
+		t.Fatalf("Unable to open database: %v", err)
+	}
+	defer db.Close()
+
+	ro, wo := levigo.NewReadOptions(), levigo.NewWriteOptions()
+	defer ro.Close()
+	defer wo.Close()
+	if err := db.Put(wo, []byte("foo"), []byte("bar")); err != nil {
+		t.Fatalf("Unable to put: %v", err)
+	}
+	db.CompactRange(levigo.Range{})
+	if value, err := db.Get(ro, []byte("foo")); err != nil || string(value) != "bar" {
+		t.Fatalf("Unexpected value: %q (%v)", value, err)
+	}
+}
+
+// Ensure that a database can be written and read with its memtables and
+// cached blocks backed by huge pages.
+func TestStorageOpenHugePages(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+
+	st := newStorage(StorageOptions{CacheSize: 1 << 20, WriteBufferSize: 16 << 20, ArenaBlockSize: 64 << 10, HugePages: TransparentHugePages})
+	defer st.Close()
+	db, err := st.open(path)
+	if err != nil {
+		t.Fatalf("Unable to open database: %v", err)
+	}
+	defer db.Close()
+
+	ro, wo := levigo.NewReadOptions(), levigo.NewWriteOptions()
+	defer ro.Close()
+	defer wo.Close()
+	if err := db.Put(wo, []byte("foo"), []byte("bar")); err != nil {
+		t.Fatalf("Unable to put: %v", err)
+	}
+	db.CompactRange(levigo.Range{})
+	if value, err := db.Get(ro, []byte("foo")); err != nil || string(value) != "bar" {
+		t.Fatalf("Unexpected value: %q (%v)", value, err)
+	}
+}
+
+// Ensure that databases can be opened with each memtable representation.
+func TestStorageOpenMemTableRep(t *testing.T) {
+	for _, rep := range []int{VectorMemTable, HashMemTable} {
+		path, _ := ioutil.TempDir("", "")
+		defer os.RemoveAll(path)
+
+		st := newStorage(StorageOptions{CacheSize: 1 << 20, MemTableRep: rep})
+		defer st.Close()
+		db, err := st.open(path)
+		if err != nil {
+			t.Fatalf("Unable to open database (%d): %v", rep, err)
+		}
+		defer db.Close()
+
+		ro, wo := levigo.NewReadOptions(), levigo.NewWriteOptions()
+		defer ro.Close()
+		defer wo.Close()
+		for _, key := range []string{"foo", "bar", "baz"} {
+			if err := db.Put(wo, []byte(key), []byte(key+"!")); err != nil {
+				t.Fatalf("Unable to put (%d): %v", rep, err)
+			}
+		}
+		if value, err := db.Get(ro, []byte("bar")); err != nil || string(value) != "bar!" {
+			t.Fatalf("Unexpected value (%d): %q (%v)", rep, value, err)
+		}
+		iter := db.NewIterator(ro)
+		keys := make([]string, 0)
+		for iter.SeekToFirst(); iter.Valid(); iter.Next() {
+			keys = append(keys, string(iter.Key()))
+		}
+		iter.Close()
+		if strings.Join(keys, ",") != "bar,baz,foo" {
+			t.Fatalf("Unexpected keys (%d): %v", rep, keys)
+		}
+	}
+}
+
+// Ensure that a seek within a table stops at the end of the table when its
+// prefix is in the bloom filters.
+func TestStorageOpenTablePrefixFilter(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+
+	st := newStorage(StorageOptions{BloomFilterBits: 10, TablePrefixFilter: true})
+	defer st.Close()
+	db, err := st.open(path)
+	if err != nil {
+		t.Fatalf("Unable to open database: %v", err)
+	}
+	defer db.Close()
+
+	ro, wo := levigo.NewReadOptions(), levigo.NewWriteOptions()
+	defer ro.Close()
+	defer wo.Close()
+	foo, _ := TablePrefix("foo")
+	fooo, _ := TablePrefix("fooo")
+	for _, prefix := range [][]byte{foo, fooo} {
+		for i := 0; i < 3; i++ {
+			key := append(append([]byte{}, prefix...), byte(0xa1), byte('a'+i))
+			if err := db.Put(wo, key, []byte("bar")); err != nil {
+				t.Fatalf("Unable to put: %v", err)
+			}
+		}
+	}
+	db.CompactRange(levigo.Range{})
+
+	setPrefixSameAsStart(ro)
+	iterator := db.NewIterator(ro)
+	defer iterator.Close()
+	count := 0
+	for iterator.Seek(foo); iterator.Valid(); iterator.Next() {
+		count++
+	}
+	if count != 3 {
+		t.Fatalf("Unexpected key count: %d", count)
+	}
+	missing, _ := TablePrefix("bar")
+	if iterator.Seek(missing); iterator.Valid() {
+		t.Fatalf("Unexpected key: %q", iterator.Key())
+	}
+}
+
+// Ensure that a range delete removes the keys of one table and no others.
+func TestStorageDeleteRange(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+
+	st := newStorage(StorageOptions{})
+	defer st.Close()
+	db, err := st.open(path)
+	if err != nil {
+		t.Fatalf("Unable to open database: %v", err)
+	}
+	defer db.Close()
+
+	ro, wo := levigo.NewReadOptions(), levigo.NewWriteOptions()
+	defer ro.Close()
+	defer wo.Close()
+	foo, _ := TablePrefix("foo")
+	fooo, _ := TablePrefix("fooo")
+	for _, prefix := range [][]byte{foo, fooo} {
+		for i := 0; i < 3; i++ {
+			key := append(append([]byte{}, prefix...), byte(0xa1), byte('a'+i))
+			if err := db.Put(wo, key, []byte("bar")); err != nil {
+				t.Fatalf("Unable to put: %v", err)
+			}
+		}
+	}
+	if err := deleteRange(db, wo, foo, incrementKey(foo)); err != nil {
+		t.Fatalf("Unable to delete range: %v", err)
+	}
+	batch := levigo.NewWriteBatch()
+	defer batch.Close()
+	batchDeleteRange(batch, append(append([]byte{}, fooo...), byte(0xa1), byte('a')), append(append([]byte{}, fooo...), byte(0xa1), byte('b')))
+	if err := db.Write(wo, batch); err != nil {
+		t.Fatalf("Unable to write batch: %v", err)
+	}
+
+	iterator := db.NewIterator(ro)
+	defer iterator.Close()
+	count := 0
+	for iterator.SeekToFirst(); iterator.Valid(); iterator.Next() {
+		if !bytes.HasPrefix(iterator.Key(), fooo) {
+			t.Fatalf("Unexpected key: %q", iterator.Key())
+		}
+		count++
+	}
+	if count != 2 {
+		t.Fatalf("Unexpected key count: %d", count)
+	}
+}
+
+// Ensure that compactions trim the events of tables with a retention off
+// the front of their objects and leave other tables alone.
+func TestStorageRetention(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+
+	st := newStorage(StorageOptions{})
+	defer st.Close()
+	db, err := st.open(path)
+	if err != nil {
+		t.Fatalf("Unable to open database: %v", err)
+	}
+	defer db.Close()
+
+	// Forty old events followed by forty recent ones. The stream is indexed
+	// every 32 events so the old events after the second entry are kept.
+	var data []byte
+	for i := 0; i < 80; i++ {
+		timestamp := time.Now().Add(-time.Duration(80-i) * time.Second)
+		if i < 40 {
+			timestamp = timestamp.Add(-24 * time.Hour)
+		}
+		e := &Event{Timestamp: timestamp, Data: map[int64]interface{}{-1: int64(i)}}
+		if data, err = e.AppendRaw(data); err != nil {
+			t.Fatalf("Unable to encode event: %v", err)
+		}
+	}
+	value, _ := encodeObject(nil, data)
+	foo, _ := TablePrefix("foo")
+	bar, _ := TablePrefix("bar")
+	st.setRetention(foo, time.Hour)
+
+	wo := levigo.NewWriteOptions()
+	defer wo.Close()
+	for _, prefix := range [][]byte{foo, bar} {
+		if err := db.Put(wo, append(append([]byte{}, prefix...), 0xa3, 'b', 'o', 'b'), value); err != nil {
+			t.Fatalf("Unable to put: %v", err)
+		}
+	}
+
+	// The first range compaction only moves the memtable into a table so a
+	// key inside it is written before the second.
+	db.CompactRange(levigo.Range{})
+	baz, _ := TablePrefix("baz")
+	db.Put(wo, baz, []byte{})
+	db.CompactRange(levigo.Range{})
+
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	for _, prefix := range [][]byte{foo, bar} {
+		stored, _ := db.Get(ro, append(append([]byte{}, prefix...), 0xa3, 'b', 'o', 'b'))
+		_, stream, err := decodeObject(stored)
+		if err != nil {
+			t.Fatalf("Unable to decode object: %v", err)
+		}
+		events, err := DecodeEvents(stream)
+		if err != nil {
+			t.Fatalf("Unable to decode events: %v", err)
+		}
+		if expected := map[bool]int{true: 48, false: 80}[bytes.Equal(prefix, foo)]; len(events) != expected {
+			t.Fatalf("Expected %d events in %q, got %d", expected, prefix, len(events))
+		}
+	}
+}
+
+// Ensure that compactions index the objects that were written before
+// events were indexed the same way that writes index them.
+func TestStorageUpgradeObjects(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+
+	st := newStorage(StorageOptions{})
+	defer st.Close()
+	db, err := st.open(path)
+	if err != nil {
+		t.Fatalf("Unable to open database: %v", err)
+	}
+	defer db.Close()
+
+	// Forty msgpack events followed by a block of ten.
+	var data []byte
+	var block []*Event
+	for i := 0; i < 50; i++ {
+		e := &Event{Timestamp: time.Unix(int64(1000+i), 0).UTC(), Data: map[int64]interface{}{1: int64(i)}}
+		if i >= 40 {
+			block = append(block, e)
+		} else if data, err = e.AppendRaw(data); err != nil {
+			t.Fatalf("Unable to encode event: %v", err)
+		}
+	}
+	b, err := EncodeEventBlock(block)
+	if err != nil || b == nil {
+		t.Fatalf("Unable to encode block: %v", err)
+	}
+	data = append(data, b...)
+	expected, _ := encodeObject(nil, data)
+
+	// The legacy layout is the state raw followed by the events.
+	foo, _ := TablePrefix("foo")
+	key := append(append([]byte{}, foo...), 0xa3, 'b', 'o', 'b')
+	wo := levigo.NewWriteOptions()
+	defer wo.Close()
+	if err := db.Put(wo, key, append([]byte{0xa0}, data...)); err != nil {
+		t.Fatalf("Unable to put: %v", err)
+	}
+	db.CompactRange(levigo.Range{})
+	bar, _ := TablePrefix("bar")
+	db.Put(wo, bar, []byte{})
+	db.CompactRange(levigo.Range{})
+
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	stored, _ := db.Get(ro, key)
+	if !bytes.Equal(stored, expected) {
+		t.Fatalf("Unexpected object:\n%x\nexpected:\n%x", stored, expected)
+	}
+}
+
+// Ensure that compactions move runs of msgpack events into event blocks.
+func TestStorageEncodeEventBlocks(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+
+	st := newStorage(StorageOptions{})
+	defer st.Close()
+	st.setEventBlocks(true)
+	db, err := st.open(path)
+	if err != nil {
+		t.Fatalf("Unable to open database: %v", err)
+	}
+	defer db.Close()
+
+	// Enough msgpack events to fill a block, stored like SetRawEvents()
+	// stores them.
+	var data []byte
+	for i := 0; i < 500; i++ {
+		e := &Event{Timestamp: time.Unix(int64(1000+i), 0).UTC(), Data: map[int64]interface{}{1: int64(i)}}
+		if data, err = e.AppendRaw(data); err != nil {
+			t.Fatalf("Unable to encode event: %v", err)
+		}
+	}
+	value, _ := encodeObject(nil, data)
+	events, _ := DecodeEvents(data)
+	b, err := EncodeEventBlock(events)
+	if err != nil || b == nil {
+		t.Fatalf("Unable to encode block: %v", err)
+	}
+	expected, _ := encodeObject(nil, b)
+
+	foo, _ := TablePrefix("foo")
+	key := append(append([]byte{}, foo...), 0xa3, 'b', 'o', 'b')
+	wo := levigo.NewWriteOptions()
+	defer wo.Close()
+	if err := db.Put(wo, key, value); err != nil {
+		t.Fatalf("Unable to put: %v", err)
+	}
+	db.CompactRange(levigo.Range{})
+	bar, _ := TablePrefix("bar")
+	db.Put(wo, bar, []byte{})
+	db.CompactRange(levigo.Range{})
+
+	ro := levigo.NewReadOptions()
+	defer ro.Close()
+	stored, _ := db.Get(ro, key)
+	if !bytes.Equal(stored, expected) {
+		t.Fatalf("Unexpected object:\n%x\nexpected:\n%x", stored, expected)
+	}
+}
@@ -1,25 +1,121 @@
 package skyd
 
 import (
+	"encoding/binary"
+	"encoding/json"
 	"errors"
 	"fmt"
 	"github.com/ugorji/go-msgpack"
+	"hash/fnv"
+	"io/ioutil"
 	"os"
 	"path/filepath"
 	"time"
 )
 
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The formats that the object keys of a table can be stored in. Msgpack
+// keys hold the table name and the object id so their width varies with
+// both. Hashed keys are a fixed-width table id and object id hash, and the
+// object id is kept in the object's state instead.
+const (
+	MsgpackKeyFormat = "msgpack"
+	HashedKeyFormat  = "hashed"
+)
+
+// Where the data of a table is kept. Memory tables are kept in databases
+// stored in memory next to each servlet's database, so that scratch tables
+// built during an analysis are written and queried without disk I/O. Only
+// their schema is kept on disk and their events are lost when the server
+// stops. Separate tables are kept on disk in databases of their own next
+// to each servlet's database, sharing its block cache. Compactions of a
+// separate table never rewrite the data of other tables, it's compacted
+// and compressed with options of its own, and deleting it removes its
+// databases instead of deleting its keys.
+const (
+	DiskTableStorage     = "disk"
+	MemoryTableStorage   = "memory"
+	SeparateTableStorage = "separate"
+)
+
+// How the databases of a separate table are compacted. Leveled compaction
+// reads faster and tiered compaction writes less. Empty uses the
+// compaction of the servlets' storage.
+const (
+	LeveledTableCompaction = "leveled"
+	TieredTableCompaction  = "tiered"
+)
+
+// The block compressions that the databases of a separate table can be
+// written with, by name. Empty uses the compression of the servlets'
+// storage.
+var tableCompressions = map[string]int{
+	"none":   NoCompression,
+	"snappy": SnappyCompression,
+	"lz4":    LZ4Compression,
+	"zstd":   ZstdCompression,
+}
+
+// The byte that starts the prefix of tables with hashed keys. It's never
+// used by msgpack so it can't start the prefix of any other table.
+const hashedTablePrefixMarker = 0xc1
+
+// The size of the prefix of tables with hashed keys: the marker followed by
+// the big endian table id.
+const hashedTablePrefixSize = 5
+
+// The property id that the object id is stored under in the state of an
+// object in a table with hashed keys. Property ids start at one for
+// permanent properties and minus one for transient ones so it's never used.
+const storedObjectIdPropertyId = 0
+
 //------------------------------------------------------------------------------
 //
 // Typedefs
 //
 //------------------------------------------------------------------------------
 
-// A Table is a collection of objects.
+// A Table is a collection of objects. Events written to a table with a
+// reorder window are held for that many milliseconds and sorted before
+// they're written so that events arriving a little out of order are still
+// appended. Events of a table with a retention are removed by compactions
+// once they're that many seconds old. Writes to a memory table fail once
+// its databases take up its memory limit in megabytes. A separate table's
+// databases use its compaction and compression if it has them.
 type Table struct {
-	Name         string `json:"name"`
-	path         string
-	propertyFile *PropertyFile
+	Name          string `json:"name"`
+	KeyFormat     string `json:"keyFormat,omitempty"`
+	ReorderWindow int    `json:"reorderWindow,omitempty"`
+	Retention     int    `json:"retention,omitempty"`
+	Storage       string `json:"storage,omitempty"`
+	MemoryLimit   int    `json:"memoryLimit,omitempty"`
+	Compaction    string `json:"compaction,omitempty"`
+	Compression   string `json:"compression,omitempty"`
+	id            uint32
+	prefix        []byte
+	path          string
+	propertyFile  *PropertyFile
+	statistics    *TableStatistics
+	hot           *tableHotObjects
+}
+
+// The metadata stored with a table that doesn't use msgpack keys or that
+// has a reorder window, a retention or its data in databases of its own.
+type tableMeta struct {
+	KeyFormat     string `json:"keyFormat"`
+	Id            uint32 `json:"id"`
+	ReorderWindow int    `json:"reorderWindow,omitempty"`
+	Retention     int    `json:"retention,omitempty"`
+	Storage       string `json:"storage,omitempty"`
+	MemoryLimit   int    `json:"memoryLimit,omitempty"`
+	Compaction    string `json:"compaction,omitempty"`
+	Compression   string `json:"compression,omitempty"`
+	Prefix        []byte `json:"prefix,omitempty"`
 }
 
 //------------------------------------------------------------------------------
@@ -38,6 +134,7 @@ func NewTable(name string, path string) *Table {
 	return &Table{
 		Name: name,
 		path: path,
+		hot:  newTableHotObjects(),
 	}
 }
 
@@ -47,11 +144,136 @@ func NewTable(name string, path string) *Table {
 //
 //------------------------------------------------------------------------------
 
+// Retrieves the statistics of the table's data. Nil is returned if the
+// table isn't open.
+func (t *Table) Statistics() *TableStatistics {
+	return t.statistics
+}
+
+// Adds events written to the table to its statistics.
+func (t *Table) observeEvents(events []*Event) {
+	if t.statistics != nil {
+		t.statistics.addEvents(events)
+	}
+}
+
 // Retrieves the path on the table.
 func (t *Table) Path() string {
 	return t.path
 }
 
+// The identifier that prefixes the keys of a table with hashed keys.
+func (t *Table) Id() uint32 {
+	return t.id
+}
+
+// Sets the format of the table's object keys and, for hashed keys, the
+// table's identifier. This can only be set before the table is created.
+func (t *Table) SetKeyFormat(format string, id uint32) error {
+	switch format {
+	case "", MsgpackKeyFormat:
+		t.KeyFormat, t.id = "", 0
+	case HashedKeyFormat:
+		if id == 0 {
+			return errors.New("skyd.Table: Table id required for hashed keys")
+		}
+		t.KeyFormat, t.id = format, id
+	default:
+		return fmt.Errorf("skyd.Table: Invalid key format: %s", format)
+	}
+	return nil
+}
+
+// The time that events written to the table are held to be sorted. Zero
+// writes them right away.
+func (t *Table) reorderWindow() time.Duration {
+	return time.Duration(t.ReorderWindow) * time.Millisecond
+}
+
+// Sets the number of milliseconds that events written to the table are
+// held to be sorted. Changes are kept once the table's metadata is saved.
+func (t *Table) SetReorderWindow(value int) error {
+	if value < 0 {
+		return fmt.Errorf("skyd.Table: Invalid reorder window: %d", value)
+	}
+	t.ReorderWindow = value
+	return nil
+}
+
+// The age at which events of the table are removed. Zero keeps them.
+func (t *Table) retention() time.Duration {
+	return time.Duration(t.Retention) * time.Second
+}
+
+// Sets the number of seconds that events of the table are kept. Changes
+// are kept once the table's metadata is saved.
+func (t *Table) SetRetention(value int) error {
+	if value < 0 {
+		return fmt.Errorf("skyd.Table: Invalid retention: %d", value)
+	}
+	t.Retention = value
+	return nil
+}
+
+// Whether the table's data is kept in memory.
+func (t *Table) InMemory() bool {
+	return t.Storage == MemoryTableStorage
+}
+
+// Whether the table's data is kept in databases of its own in memory or
+// on disk instead of in the servlets' databases.
+func (t *Table) hasStore() bool {
+	return t.Storage == MemoryTableStorage || t.Storage == SeparateTableStorage
+}
+
+// Sets where the table's data is kept. This can only be set before any
+// events are written to the table.
+func (t *Table) SetStorage(storage string) error {
+	switch storage {
+	case "", DiskTableStorage:
+		t.Storage = ""
+	case MemoryTableStorage, SeparateTableStorage:
+		t.Storage = storage
+	default:
+		return fmt.Errorf("skyd.Table: Invalid storage: %s", storage)
+	}
+	return nil
+}
+
+// Sets the megabytes of memory that a memory table can take up before its
+// writes fail. Zero doesn't limit it. Changes are kept once the table's
+// metadata is saved.
+func (t *Table) SetMemoryLimit(value int) error {
+	if value < 0 {
+		return fmt.Errorf("skyd.Table: Invalid memory limit: %d", value)
+	}
+	t.MemoryLimit = value
+	return nil
+}
+
+// Sets how the databases of a separate table are compacted. This can only
+// be set before the table's databases are opened.
+func (t *Table) SetCompaction(compaction string) error {
+	switch compaction {
+	case "", LeveledTableCompaction, TieredTableCompaction:
+		t.Compaction = compaction
+	default:
+		return fmt.Errorf("skyd.Table: Invalid compaction: %s", compaction)
+	}
+	return nil
+}
+
+// Sets the block compression that the databases of a separate table are
+// written with. This can only be set before the table's databases are
+// opened.
+func (t *Table) SetCompression(compression string) error {
+	if _, ok := tableCompressions[compression]; !ok && compression != "" {
+		return fmt.Errorf("skyd.Table: Invalid compression: %s", compression)
+	}
+	t.Compression = compression
+	return nil
+}
+
 //------------------------------------------------------------------------------
 //
 // Methods
@@ -74,7 +296,11 @@ func (t *Table) Create() error {
 		return err
 	}
 
-	return nil
+	// Tables with msgpack keys don't need any metadata.
+	if t.KeyFormat == "" && t.ReorderWindow == 0 && t.Retention == 0 && t.Storage == "" && t.Compaction == "" && t.Compression == "" {
+		return nil
+	}
+	return t.SaveMeta()
 }
 
 // Deletes a table.
@@ -99,6 +325,9 @@ func (t *Table) Open() error {
 	if !t.Exists() {
 		return errors.New("Table does not exist")
 	}
+	if err := t.loadMeta(); err != nil {
+		return err
+	}
 
 	// Load property file.
 	t.propertyFile = NewPropertyFile(fmt.Sprintf("%v/%v", t.path, "properties"))
@@ -108,15 +337,26 @@ func (t *Table) Open() error {
 		return err
 	}
 
+	// Load the statistics kept next to it.
+	t.statistics = NewTableStatistics(fmt.Sprintf("%v/%v", t.path, "statistics"))
+	if err = t.statistics.Load(); err != nil {
+		t.Close()
+		return err
+	}
+
 	return nil
 }
 
-// Closes the table.
+// Closes the table. Statistics that have changed are saved.
 func (t *Table) Close() {
 	if t.propertyFile != nil {
 		t.propertyFile.Close()
 	}
 	t.propertyFile = nil
+	if t.statistics != nil {
+		t.statistics.Save()
+	}
+	t.statistics = nil
 }
 
 // Checks if the table is currently open.
@@ -132,7 +372,94 @@ func (t *Table) Exists() bool {
 	return true
 }
 
-// Generates a prefix key used for iterating over the table's data.
+// The path of the file that holds the table's key format.
+func (t *Table) metaPath() string {
+	return fmt.Sprintf("%v/%v", t.path, "meta")
+}
+
+// Writes the table's key format, reorder window, retention and storage to
+// its metadata file.
+func (t *Table) SaveMeta() error {
+	b, err := json.Marshal(&tableMeta{KeyFormat: t.KeyFormat, Id: t.id, ReorderWindow: t.ReorderWindow, Retention: t.Retention, Storage: t.Storage, MemoryLimit: t.MemoryLimit, Compaction: t.Compaction, Compression: t.Compression, Prefix: t.prefix})
+	if err != nil {
+		return err
+	}
+	return ioutil.WriteFile(t.metaPath(), b, 0600)
+}
+
+// Reads the table's key format, reorder window, retention, storage and
+// store options.
+// Tables without a metadata file use msgpack keys.
+func (t *Table) loadMeta() error {
+	b, err := ioutil.ReadFile(t.metaPath())
+	if os.IsNotExist(err) {
+		return nil
+	} else if err != nil {
+		return err
+	}
+	meta := &tableMeta{}
+	if err := json.Unmarshal(b, meta); err != nil {
+		return fmt.Errorf("skyd.Table: Invalid metadata: %v", err)
+	}
+	if err := t.SetReorderWindow(meta.ReorderWindow); err != nil {
+		return err
+	}
+	if err := t.SetRetention(meta.Retention); err != nil {
+		return err
+	}
+	if err := t.SetStorage(meta.Storage); err != nil {
+		return err
+	}
+	if err := t.SetMemoryLimit(meta.MemoryLimit); err != nil {
+		return err
+	}
+	if err := t.SetCompaction(meta.Compaction); err != nil {
+		return err
+	}
+	if err := t.SetCompression(meta.Compression); err != nil {
+		return err
+	}
+	if err := t.SetKeyFormat(meta.KeyFormat, meta.Id); err != nil {
+		return err
+	}
+	t.prefix = meta.Prefix
+	return nil
+}
+
+// Generates the prefix key used for iterating over the table's data. Forks
+// keep the prefix of the table they were forked from since their stores
+// start with its keys.
+func (t *Table) Prefix() ([]byte, error) {
+	if t.prefix != nil {
+		return append([]byte{}, t.prefix...), nil
+	}
+	if t.KeyFormat != HashedKeyFormat {
+		return TablePrefix(t.Name)
+	}
+	prefix := make([]byte, hashedTablePrefixSize)
+	prefix[0] = hashedTablePrefixMarker
+	binary.BigEndian.PutUint32(prefix[1:], t.id)
+	return prefix, nil
+}
+
+// Returns the size of the table prefix that starts a key, which is either
+// the msgpack array header and table name or the marker and table id of a
+// table with hashed keys, or zero if the key doesn't start with one.
+func tablePrefixSize(key []byte) int {
+	if len(key) >= hashedTablePrefixSize && key[0] == hashedTablePrefixMarker {
+		return hashedTablePrefixSize
+	}
+	if len(key) < 2 || key[0] != 0x92 {
+		return 0
+	}
+	if n := rawSize(key[1:]); n > 0 {
+		return 1 + n
+	}
+	return 0
+}
+
+// Generates a prefix key used for iterating over the data of a table with
+// msgpack keys.
 func TablePrefix(tableName string) ([]byte, error) {
 	// The table prefix should match the encoded object id syntax but without the last item.
 	prefix, err := msgpack.Marshal([]interface{}{tableName, nil})
@@ -167,6 +494,22 @@ func (t *Table) CreateProperty(name string, transient bool, dataType string) (*P
 	return property, err
 }
 
+// Adds a transient property to the table whose values are stored in a
+// property family.
+func (t *Table) CreateFamilyProperty(name string, dataType string, family string) (*Property, error) {
+	if !t.IsOpen() {
+		return nil, errors.New("Table is not open")
+	}
+	property, err := t.propertyFile.CreateFamilyProperty(name, dataType, family)
+	if err != nil {
+		return nil, err
+	}
+	if err = t.propertyFile.Save(); err != nil {
+		return nil, err
+	}
+	return property, nil
+}
+
 // Retrieves a list of all properties on the table.
 func (t *Table) GetProperties() ([]*Property, error) {
 	if !t.IsOpen() {
@@ -200,6 +543,15 @@ func (t *Table) DeleteProperty(property *Property) error {
 	return nil
 }
 
+// Changes a copy of a property on the table and returns the copy. Readers
+// of the property file see either the old or the new property.
+func (t *Table) UpdateProperty(id int64, update func(property *Property)) (*Property, error) {
+	if !t.IsOpen() {
+		return nil, errors.New("Table is not open")
+	}
+	return t.propertyFile.UpdateProperty(id, update)
+}
+
 // Saves the property file on the table.
 func (t *Table) SavePropertyFile() error {
 	if !t.IsOpen() {
@@ -222,9 +574,37 @@ func (t *Table) DenormalizeMap(m map[int64]interface{}) (map[string]interface{},
 // Event Encoding
 //--------------------------------------
 
-// Encodes an object identifier for this table.
+// Encodes an object identifier for this table. Hashed keys end with the
+// object id hash wrapped in an 8 byte msgpack raw so that they're read the
+// same way as msgpack keys.
 func (t *Table) EncodeObjectId(objectId string) ([]byte, error) {
-	return msgpack.Marshal([]string{t.Name, objectId})
+	if t.KeyFormat != HashedKeyFormat {
+		if t.prefix != nil {
+			id, err := msgpack.Marshal(objectId)
+			if err != nil {
+				return nil, err
+			}
+			return append(append([]byte{}, t.prefix...), id...), nil
+		}
+		return msgpack.Marshal([]string{t.Name, objectId})
+	}
+	h := fnv.New64a()
+	h.Write([]byte(objectId))
+	prefix, _ := t.Prefix()
+	key := make([]byte, hashedTablePrefixSize+9)
+	copy(key, prefix)
+	key[hashedTablePrefixSize] = 0xa8
+	binary.BigEndian.PutUint64(key[hashedTablePrefixSize+1:], h.Sum64())
+	return key, nil
+}
+
+// The object id to keep in the state of an object so that hash collisions
+// can be found. Only tables with hashed keys keep it.
+func (t *Table) storedObjectId(objectId string) string {
+	if t.KeyFormat != HashedKeyFormat {
+		return ""
+	}
+	return objectId
 }
 
 // Deserializes a map into a normalized event.
@@ -242,6 +622,13 @@ func (t *Table) DeserializeEvent(m map[string]interface{}) (*Event, error) {
 		return nil, errors.New("Timestamp required.")
 	}
 
+	// Read the event's id, if it has one.
+	if id, ok := m["eventId"]; ok && id != nil {
+		if event.Id, ok = id.(string); !ok {
+			return nil, fmt.Errorf("Invalid event id: %v", id)
+		}
+	}
+
 	// Convert maps to use property identifiers.
 	if data, ok := m["data"].(map[string]interface{}); ok {
 		normalizedData, err := t.NormalizeMap(data)
@@ -284,20 +671,44 @@ func (t *Table) FactorizeEvent(event *Event, factors *Factors, createIfMissing b
 	if event == nil {
 		return nil
 	}
+	return t.FactorizeEvents([]*Event{event}, factors, createIfMissing)
+}
 
-	propertyFile := t.propertyFile
-	for k, v := range event.Data {
-		property := propertyFile.GetProperty(k)
-		if property.DataType == FactorDataType {
-			if stringValue, ok := v.(string); ok {
-				sequence, err := factors.Factorize(t.Name, property.Name, stringValue, createIfMissing)
-				if err != nil {
-					return err
+// Factorizes the values in a group of events. The factor values of every
+// event are factorized at once so that each distinct value is resolved a
+// single time and missing values are created in a single write.
+func (t *Table) FactorizeEvents(events []*Event, factors *Factors, createIfMissing bool) error {
+	schema := t.propertyFile.schema()
+	var targets []*Event
+	var keys []int64
+	var ids, values []string
+	for _, event := range events {
+		if event == nil {
+			continue
+		}
+		for k, v := range event.Data {
+			property := schema.GetProperty(k)
+			if property.DataType == FactorDataType {
+				if stringValue, ok := v.(string); ok {
+					targets = append(targets, event)
+					keys = append(keys, k)
+					ids = append(ids, property.Name)
+					values = append(values, stringValue)
 				}
-				event.Data[k] = sequence
 			}
 		}
 	}
+	if len(keys) == 0 {
+		return nil
+	}
+
+	sequences, err := factors.FactorizeValues(t.Name, ids, values, createIfMissing)
+	if err != nil {
+		return err
+	}
+	for i, k := range keys {
+		targets[i].Data[k] = sequences[i]
+	}
 
 	return nil
 }
@@ -308,9 +719,9 @@ func (t *Table) DefactorizeEvent(event *Event, factors *Factors) error {
 		return nil
 	}
 
-	propertyFile := t.propertyFile
+	schema := t.propertyFile.schema()
 	for k, v := range event.Data {
-		property := propertyFile.GetProperty(k)
+		property := schema.GetProperty(k)
 		if property.DataType == FactorDataType {
 			if sequence, ok := v.(uint64); ok {
 				stringValue, err := factors.Defactorize(t.Name, property.Name, sequence)
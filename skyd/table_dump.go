@@ -0,0 +1,595 @@
+package skyd
+
+import (
+	"bufio"
+	"bytes"
+	"compress/flate"
+	"encoding/binary"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"github.com/jmhodges/levigo"
+	"hash/crc32"
+	"io"
+	"io/ioutil"
+	"os"
+	"strconv"
+	"strings"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The bytes that a table dump starts with, the last of which is the version
+// of its format.
+var tableDumpMagic = []byte("SKYDUMP\x01")
+
+// A table dump is a series of chunks after the magic. Each chunk is its
+// kind (1), the uvarint size of its compressed payload, the CRC-32C of the
+// uncompressed payload (4, little endian) and the payload compressed with
+// DEFLATE. The schema chunk comes first and holds the table's schema and
+// the number of servlets as JSON. Factor chunks hold the table's factor
+// dictionary and key chunks hold the keys of one servlet's table prefix
+// range after the uvarint index of the servlet. Both are lists of pairs of
+// uvarint sized keys and values. The end chunk holds the uvarint number of
+// pairs in the dump so that truncated dumps are rejected.
+const (
+	tableDumpSchemaChunk  = 1
+	tableDumpFactorsChunk = 2
+	tableDumpKeysChunk    = 3
+	tableDumpEndChunk     = 4
+)
+
+// The size of the pairs that are gathered into each chunk before it's
+// compressed.
+const tableDumpChunkSize = 4 << 20
+
+// The largest compressed chunk that's read from a dump.
+const tableDumpMaxChunkSize = 64 << 20
+
+var tableDumpChecksumTable = crc32.MakeTable(crc32.Castagnoli)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// The schema chunk of a table dump.
+type tableDumpSchema struct {
+	Table    *replicaTable `json:"table"`
+	Servlets int           `json:"servlets"`
+}
+
+// Writes the chunks of a table dump. Pairs are gathered until the chunk is
+// full or a pair of another kind or servlet is added.
+type tableDumpWriter struct {
+	w          io.Writer
+	flater     *flate.Writer
+	compressed bytes.Buffer
+	payload    []byte
+	kind       byte
+	servlet    int
+	pairs      uint64
+}
+
+// Reads the chunks of a table dump.
+type tableDumpReader struct {
+	r          *bufio.Reader
+	compressed []byte
+	pairs      uint64
+}
+
+//------------------------------------------------------------------------------
+//
+// Errors
+//
+//------------------------------------------------------------------------------
+
+var errInvalidTableDump = errors.New("skyd.TableDump: Invalid table dump")
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates a dump writer and writes the magic.
+func newTableDumpWriter(w io.Writer) (*tableDumpWriter, error) {
+	flater, err := flate.NewWriter(nil, flate.BestSpeed)
+	if err != nil {
+		return nil, err
+	}
+	if _, err := w.Write(tableDumpMagic); err != nil {
+		return nil, err
+	}
+	return &tableDumpWriter{w: w, flater: flater}, nil
+}
+
+// Creates a dump reader and checks the magic.
+func newTableDumpReader(r io.Reader) (*tableDumpReader, error) {
+	br := bufio.NewReaderSize(r, 1<<20)
+	magic := make([]byte, len(tableDumpMagic))
+	if _, err := io.ReadFull(br, magic); err != nil || !bytes.Equal(magic, tableDumpMagic) {
+		return nil, errInvalidTableDump
+	}
+	return &tableDumpReader{r: br}, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+func appendTableDumpUvarint(b []byte, v uint64) []byte {
+	var buf [binary.MaxVarintLen64]byte
+	return append(b, buf[:binary.PutUvarint(buf[:], v)]...)
+}
+
+// Calls a function with each pair of a factor or key chunk payload.
+func eachTableDumpPair(payload []byte, fn func(key []byte, value []byte) error) error {
+	for len(payload) > 0 {
+		var pair [2][]byte
+		for i := range pair {
+			n, size := binary.Uvarint(payload)
+			if size <= 0 || n > uint64(len(payload)-size) {
+				return errInvalidTableDump
+			}
+			pair[i] = payload[size : size+int(n)]
+			payload = payload[size+int(n):]
+		}
+		if err := fn(pair[0], pair[1]); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Dump
+//--------------------------------------
+
+// Checks that a table's data is all in its servlets' databases, which
+// dumps and restores copy as they are.
+func (s *Server) checkTableDump(table *Table) error {
+	if table.hasStore() {
+		return fmt.Errorf("skyd.Server: Tables with stores of their own can't be dumped: %s", table.Name)
+	}
+	prefix, err := table.Prefix()
+	if err != nil {
+		return err
+	}
+	for _, servlet := range s.servlets {
+		if servlet.partitionMonths > 0 {
+			return errors.New("skyd.Server: Partitioned servlets can't be dumped")
+		}
+		servlet.frozenMutex.RLock()
+		frozen := len(servlet.frozen[string(prefix)])
+		servlet.frozenMutex.RUnlock()
+		if frozen > 0 {
+			return fmt.Errorf("skyd.Server: Tables with frozen objects can't be dumped: %s", table.Name)
+		}
+	}
+	return nil
+}
+
+// DumpTable writes a table's schema, factor dictionary and the keys and
+// values of its prefix range in each servlet to a compressed dump that
+// RestoreTable() can load into another server with the same placement.
+// Keys and values are copied as they're stored, so nothing is decoded, and
+// each servlet is read as of a snapshot.
+func (s *Server) DumpTable(table *Table, w io.Writer) error {
+	if err := s.checkTableDump(table); err != nil {
+		return err
+	}
+	prefix, err := table.Prefix()
+	if err != nil {
+		return err
+	}
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+
+	d, err := newTableDumpWriter(w)
+	if err != nil {
+		return err
+	}
+	schema, err := json.Marshal(&tableDumpSchema{
+		Table:    &replicaTable{Name: table.Name, KeyFormat: table.KeyFormat, Id: table.Id(), Properties: table.propertyFile.GetAllProperties()},
+		Servlets: len(s.servlets),
+	})
+	if err != nil {
+		return err
+	}
+	if err = d.writeChunk(tableDumpSchemaChunk, schema); err != nil {
+		return err
+	}
+	if err = s.factors.dump(table.Name, func(key []byte, value []byte) error {
+		return d.add(tableDumpFactorsChunk, 0, key, value)
+	}); err != nil {
+		return err
+	}
+	for i, servlet := range s.servlets {
+		if err = servlet.dumpTable(prefix, func(key []byte, value []byte) error {
+			return d.add(tableDumpKeysChunk, i, key, value)
+		}); err != nil {
+			return err
+		}
+	}
+	return d.close()
+}
+
+// Calls a function with every factor key of a namespace in key order.
+func (f *Factors) dump(namespace string, fn func(key []byte, value []byte) error) error {
+	ro := levigo.NewReadOptions()
+	ro.SetFillCache(false)
+	defer ro.Close()
+	iterator := f.db.NewIterator(ro)
+	defer iterator.Close()
+	start := []byte(namespace + ">")
+	for iterator.Seek(start); iterator.Valid() && bytes.HasPrefix(iterator.Key(), start); iterator.Next() {
+		if err := fn(iterator.Key(), iterator.Value()); err != nil {
+			return err
+		}
+	}
+	return iterator.GetError()
+}
+
+// Calls a function with every key of a table prefix in key order as of a
+// snapshot. Buffered and held writes are committed first.
+func (s *Servlet) dumpTable(prefix []byte, fn func(key []byte, value []byte) error) error {
+	if err := s.unbufferTable(prefix); err != nil {
+		return err
+	}
+	snapshot := s.db.NewSnapshot()
+	defer s.db.ReleaseSnapshot(snapshot)
+	ro := levigo.NewReadOptions()
+	ro.SetSnapshot(snapshot)
+	ro.SetFillCache(false)
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+	end := incrementKey(prefix)
+	for iterator.Seek(prefix); iterator.Valid() && bytes.Compare(iterator.Key(), end) < 0; iterator.Next() {
+		if err := fn(iterator.Key(), iterator.Value()); err != nil {
+			return err
+		}
+	}
+	return iterator.GetError()
+}
+
+//--------------------------------------
+// Restore
+//--------------------------------------
+
+// RestoreTable creates a table from a dump written by DumpTable(). The
+// table can't exist yet and the server must place objects on the same
+// servlets as the one that wrote the dump. The factors are added to the
+// factors database, and fail the restore if they conflict with factors
+// left there by a deleted table. Each servlet's keys are written to a table
+// file that's added straight to its database once the whole dump has been
+// read and checked.
+func (s *Server) RestoreTable(name string, r io.Reader) (*Table, error) {
+	if NewTable(name, s.TablePath(name)).Exists() {
+		return nil, errors.New("Table already exists.")
+	}
+	d, err := newTableDumpReader(r)
+	if err != nil {
+		return nil, err
+	}
+	kind, payload, err := d.next()
+	if err != nil {
+		return nil, err
+	} else if kind != tableDumpSchemaChunk {
+		return nil, errInvalidTableDump
+	}
+	schema := &tableDumpSchema{}
+	if err = json.Unmarshal(payload, schema); err != nil || schema.Table == nil {
+		return nil, errInvalidTableDump
+	}
+	if schema.Table.Name != name {
+		return nil, fmt.Errorf("skyd.Server: Dump is of table %s", schema.Table.Name)
+	} else if schema.Servlets != len(s.servlets) {
+		return nil, fmt.Errorf("skyd.Server: Dump has %d servlets and server has %d", schema.Servlets, len(s.servlets))
+	}
+	table := NewTable(name, s.TablePath(name))
+	if err = table.SetKeyFormat(schema.Table.KeyFormat, schema.Table.Id); err != nil {
+		return nil, err
+	}
+	prefix, err := table.Prefix()
+	if err != nil {
+		return nil, err
+	}
+	s.placement.RLock()
+	defer s.placement.RUnlock()
+
+	// Write each servlet's keys to a table file of its own.
+	paths := make([]string, len(s.servlets))
+	writers := make([]*tableWriter, len(s.servlets))
+	defer func() {
+		for i, w := range writers {
+			if w != nil {
+				w.Close()
+				os.Remove(paths[i])
+			}
+		}
+	}()
+	for {
+		if kind, payload, err = d.next(); err != nil {
+			return nil, err
+		}
+		if kind == tableDumpEndChunk {
+			if n, size := binary.Uvarint(payload); size <= 0 || n != d.pairs {
+				return nil, errInvalidTableDump
+			}
+			break
+		} else if kind == tableDumpFactorsChunk {
+			if err = s.factors.restore(name, payload); err != nil {
+				return nil, err
+			}
+			continue
+		} else if kind != tableDumpKeysChunk {
+			return nil, errInvalidTableDump
+		}
+
+		index, size := binary.Uvarint(payload)
+		if size <= 0 || index >= uint64(len(s.servlets)) {
+			return nil, errInvalidTableDump
+		}
+		servlet := s.servlets[index]
+		if writers[index] == nil {
+			f, err := ioutil.TempFile(servlet.path, "restore-")
+			if err != nil {
+				return nil, err
+			}
+			paths[index] = f.Name()
+			f.Close()
+			if writers[index], err = newTableWriter(servlet.db, paths[index]); err != nil {
+				os.Remove(paths[index])
+				return nil, err
+			}
+		}
+		var object []byte
+		if err = eachTableDumpPair(payload[size:], func(key []byte, value []byte) error {
+			if !bytes.HasPrefix(key, prefix) {
+				return errInvalidTableDump
+			}
+
+			// Every object must be owned by the servlet it's restored to.
+			if n := rawSize(key[len(prefix):]); n > 0 && !bytes.Equal(key[:len(prefix)+n], object) {
+				object = append(object[:0], key[:len(prefix)+n]...)
+				if s.placement.owner(object) != int(index) {
+					return fmt.Errorf("skyd.Server: Dump places objects on other servlets than the server")
+				}
+			}
+			d.pairs++
+			return writers[index].Put(key, value)
+		}); err != nil {
+			return nil, err
+		}
+	}
+
+	// Create the table and add the files to the servlets.
+	if err = s.createRestoredTable(table, schema.Table.Properties); err != nil {
+		return nil, err
+	}
+	if table, err = s.OpenTable(name); err != nil {
+		return nil, err
+	}
+	for i, w := range writers {
+		if w == nil {
+			continue
+		}
+		if err = w.Finish(); err == nil {
+			err = s.servlets[i].restoreTable(prefix, paths[i])
+		}
+		if err != nil {
+			s.placement.RUnlock()
+			s.DeleteTable(name)
+			s.placement.RLock()
+			return nil, err
+		}
+	}
+	return table, nil
+}
+
+// Creates the directory, metadata and property file of a restored table.
+// Tables with hashed keys keep the id they were dumped with.
+func (s *Server) createRestoredTable(table *Table, properties []*Property) error {
+	s.tableIds.Lock()
+	defer s.tableIds.Unlock()
+	if table.KeyFormat == HashedKeyFormat {
+		tables, err := s.GetAllTables()
+		if err != nil {
+			return err
+		}
+		for _, t := range tables {
+			if err := t.loadMeta(); err != nil {
+				return err
+			}
+			if t.KeyFormat == HashedKeyFormat && t.Id() == table.Id() {
+				return fmt.Errorf("skyd.Server: Table id %d is used by %s", table.Id(), t.Name)
+			}
+		}
+	}
+	if err := table.Create(); err != nil {
+		return err
+	}
+	b, err := json.Marshal(properties)
+	if err != nil {
+		return err
+	}
+	return ioutil.WriteFile(fmt.Sprintf("%v/%v", table.Path(), "properties"), append(b, '\n'), 0600)
+}
+
+// Adds the factors of a dump chunk to a namespace. Factors that are already
+// in the database must match and sequences are only moved forward. The
+// cached sequence blocks of the namespace are dropped so that new factors
+// are numbered after the restored ones.
+func (f *Factors) restore(namespace string, payload []byte) error {
+	batch := newWriteBatch()
+	defer batch.Close()
+	sequences := make(map[string]bool)
+	if err := eachTableDumpPair(payload, func(key []byte, value []byte) error {
+		if !strings.HasPrefix(string(key), namespace+">") {
+			return errInvalidTableDump
+		}
+		rest := string(key[len(namespace)+1:])
+		current, err := f.db.Get(f.ro, key)
+		if err != nil {
+			return err
+		}
+		if strings.IndexByte(rest, ':') >= 0 {
+			if current != nil && !bytes.Equal(current, value) {
+				return fmt.Errorf("skyd.Factors: Restored factor conflicts with %q: %q", key, current)
+			}
+		} else if strings.HasSuffix(rest, "!") {
+			sequences[f.prefix(namespace, strings.TrimSuffix(rest, "!"))] = true
+			if current != nil {
+				n, _ := strconv.ParseUint(string(current), 10, 64)
+				if m, err := strconv.ParseUint(string(value), 10, 64); err != nil || m <= n {
+					return nil
+				}
+			}
+		} else {
+			return errInvalidTableDump
+		}
+		batch.Put(key, value)
+		return nil
+	}); err != nil {
+		return err
+	}
+	if err := f.changes.write(f.db, f.wo, batch); err != nil {
+		return err
+	}
+	for prefix := range sequences {
+		seq := f.sequence(prefix)
+		seq.Lock()
+		seq.next, seq.limit = 0, 0
+		seq.Unlock()
+	}
+	return nil
+}
+
+// Adds a restored table file to the database and drops the table's cached
+// summaries so that they're read from the restored keys.
+func (s *Servlet) restoreTable(prefix []byte, path string) error {
+	s.Lock()
+	err := s.changes.ingest(s.db, path)
+	s.Unlock()
+	if err == errTableOverlaps {
+		return fmt.Errorf("skyd.Servlet: Restored table overlaps existing keys: %v", s.path)
+	} else if err != nil {
+		return err
+	}
+	s.dropZoneMap(prefix)
+	s.dropFactorIndex(prefix)
+	s.dropRollups(prefix)
+	s.dropTableStats(prefix)
+	s.bumpVersion()
+	return nil
+}
+
+//--------------------------------------
+// Writer
+//--------------------------------------
+
+// Adds a pair to the chunk being gathered, writing the chunk first if it's
+// of another kind or servlet.
+func (d *tableDumpWriter) add(kind byte, servlet int, key []byte, value []byte) error {
+	if len(d.payload) > 0 && (kind != d.kind || servlet != d.servlet) {
+		if err := d.flush(); err != nil {
+			return err
+		}
+	}
+	if len(d.payload) == 0 {
+		d.kind, d.servlet = kind, servlet
+		if kind == tableDumpKeysChunk {
+			d.payload = appendTableDumpUvarint(d.payload, uint64(servlet))
+		}
+	}
+	d.payload = appendTableDumpUvarint(d.payload, uint64(len(key)))
+	d.payload = append(d.payload, key...)
+	d.payload = appendTableDumpUvarint(d.payload, uint64(len(value)))
+	d.payload = append(d.payload, value...)
+	d.pairs++
+	if len(d.payload) >= tableDumpChunkSize {
+		return d.flush()
+	}
+	return nil
+}
+
+// Writes the chunk being gathered.
+func (d *tableDumpWriter) flush() error {
+	if len(d.payload) == 0 {
+		return nil
+	}
+	err := d.writeChunk(d.kind, d.payload)
+	d.payload = d.payload[:0]
+	return err
+}
+
+// Compresses and writes a chunk.
+func (d *tableDumpWriter) writeChunk(kind byte, payload []byte) error {
+	d.compressed.Reset()
+	d.flater.Reset(&d.compressed)
+	if _, err := d.flater.Write(payload); err != nil {
+		return err
+	}
+	if err := d.flater.Close(); err != nil {
+		return err
+	}
+	header := appendTableDumpUvarint([]byte{kind}, uint64(d.compressed.Len()))
+	var checksum [4]byte
+	binary.LittleEndian.PutUint32(checksum[:], crc32.Checksum(payload, tableDumpChecksumTable))
+	if _, err := d.w.Write(append(header, checksum[:]...)); err != nil {
+		return err
+	}
+	_, err := d.w.Write(d.compressed.Bytes())
+	return err
+}
+
+// Writes the last chunk and the end of the dump.
+func (d *tableDumpWriter) close() error {
+	if err := d.flush(); err != nil {
+		return err
+	}
+	return d.writeChunk(tableDumpEndChunk, appendTableDumpUvarint(nil, d.pairs))
+}
+
+//--------------------------------------
+// Reader
+//--------------------------------------
+
+// Reads, decompresses and checks the next chunk.
+func (d *tableDumpReader) next() (byte, []byte, error) {
+	kind, err := d.r.ReadByte()
+	if err != nil {
+		return 0, nil, errInvalidTableDump
+	}
+	size, err := binary.ReadUvarint(d.r)
+	if err != nil || size > tableDumpMaxChunkSize {
+		return 0, nil, errInvalidTableDump
+	}
+	if uint64(cap(d.compressed)) < size+4 {
+		d.compressed = make([]byte, size+4)
+	}
+	b := d.compressed[:size+4]
+	if _, err := io.ReadFull(d.r, b); err != nil {
+		return 0, nil, errInvalidTableDump
+	}
+	payload, err := ioutil.ReadAll(flate.NewReader(bytes.NewReader(b[4:])))
+	if err != nil || crc32.Checksum(payload, tableDumpChecksumTable) != binary.LittleEndian.Uint32(b) {
+		return 0, nil, errInvalidTableDump
+	}
+	return kind, payload, nil
+}
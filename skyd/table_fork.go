@@ -0,0 +1,198 @@
+package skyd
+
+import (
+	"bytes"
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+)
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Fork
+//--------------------------------------
+
+// ForkTable creates a table that starts out with the data of a separate
+// table, so that transforms can be tried on it without touching the
+// original. Each servlet's store of the table is checkpointed into a store
+// for the fork, which hard links its data and frozen files instead of
+// copying them, and the fork's settings, properties and factors are copied.
+// The fork shares the original's files until compactions of either rewrite
+// them, so it takes no more space until the two diverge.
+//
+// The fork keeps the key prefix of the original since its stores start
+// with the same keys, and so shares the original's retention. Each store
+// is forked as of its own point in time, like a checkpoint.
+func (s *Server) ForkTable(name string, forkName string) (*Table, error) {
+	table, err := s.OpenTable(name)
+	if err != nil {
+		return nil, err
+	}
+	if table.Storage != SeparateTableStorage {
+		return nil, fmt.Errorf("skyd.Server: Only separate tables can be forked: %s", name)
+	}
+	prefix, err := table.Prefix()
+	if err != nil {
+		return nil, err
+	}
+
+	s.tableIds.Lock()
+	defer s.tableIds.Unlock()
+	fork := NewTable(forkName, s.TablePath(forkName))
+	if fork.Exists() {
+		return nil, errors.New("Table already exists.")
+	}
+	fork.Storage = table.Storage
+
+	// Remove anything forked so far if the fork fails.
+	success := false
+	defer func() {
+		if !success {
+			for _, servlet := range s.servlets {
+				os.RemoveAll(servlet.storePath(fork))
+			}
+			os.RemoveAll(fork.Path())
+		}
+	}()
+
+	// Objects aren't moved between servlets while their stores are forked.
+	s.placement.RLock()
+	for _, servlet := range s.servlets {
+		if err = servlet.forkTableStore(table, prefix, servlet.storePath(fork)); err != nil {
+			break
+		}
+	}
+	s.placement.RUnlock()
+	if err != nil {
+		return nil, err
+	}
+	if err = s.factors.fork(name, forkName); err != nil {
+		return nil, err
+	}
+
+	// Copy the table's settings and properties and keep its prefix.
+	if err = copyDir(table.Path(), fork.Path()); err != nil {
+		return nil, err
+	}
+	if err = fork.loadMeta(); err != nil {
+		return nil, err
+	}
+	fork.prefix = prefix
+	if err = fork.SaveMeta(); err != nil {
+		return nil, err
+	}
+	opened, err := s.OpenTable(forkName)
+	if err != nil {
+		return nil, err
+	}
+	for _, servlet := range s.servlets {
+		if err = servlet.openTableStore(opened); err != nil {
+			delete(s.tables, forkName)
+			opened.Close()
+			return nil, err
+		}
+	}
+	success = true
+	return opened, nil
+}
+
+// Returns the other tables that share a table's key prefix because one was
+// forked from the other.
+func (s *Server) tablesSharingPrefix(table *Table) ([]*Table, error) {
+	prefix, err := table.Prefix()
+	if err != nil {
+		return nil, err
+	}
+	tables, err := s.GetAllTables()
+	if err != nil {
+		return nil, err
+	}
+	shared := make([]*Table, 0)
+	for _, t := range tables {
+		if t.Name == table.Name {
+			continue
+		}
+		if err := t.loadMeta(); err != nil {
+			return nil, err
+		}
+		if p, err := t.Prefix(); err == nil && bytes.Equal(p, prefix) {
+			shared = append(shared, t)
+		}
+	}
+	return shared, nil
+}
+
+// Checkpoints the servlet's store of a table into the directory of a fork's
+// store. Buffered and held writes are committed first. Servlets that never
+// stored any of the table's objects are skipped.
+func (s *Servlet) forkTableStore(table *Table, prefix []byte, path string) error {
+	if _, err := os.Stat(s.storePath(table)); os.IsNotExist(err) {
+		return nil
+	} else if err != nil {
+		return err
+	}
+	p, err := s.acquireTableStore(table)
+	if err != nil {
+		return err
+	}
+	defer p.release()
+	if err := p.servlet.unbufferTable(prefix); err != nil {
+		return err
+	}
+	if err := os.RemoveAll(path); err != nil {
+		return err
+	}
+	return p.servlet.checkpoint(path)
+}
+
+// Copies the factors of a namespace into another one, in chunks, with the
+// same checks that a restored dump's factors get.
+func (f *Factors) fork(namespace string, forkNamespace string) error {
+	var payload []byte
+	err := f.dump(namespace, func(key []byte, value []byte) error {
+		key = append([]byte(forkNamespace), key[len(namespace):]...)
+		payload = appendTableDumpUvarint(payload, uint64(len(key)))
+		payload = append(payload, key...)
+		payload = appendTableDumpUvarint(payload, uint64(len(value)))
+		payload = append(payload, value...)
+		if len(payload) < tableDumpChunkSize {
+			return nil
+		}
+		err := f.restore(forkNamespace, payload)
+		payload = payload[:0]
+		return err
+	})
+	if err != nil || len(payload) == 0 {
+		return err
+	}
+	return f.restore(forkNamespace, payload)
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Copies the files of a directory and its subdirectories.
+func copyDir(src string, target string) error {
+	return filepath.Walk(src, func(path string, info os.FileInfo, err error) error {
+		if err != nil {
+			return err
+		}
+		rel, err := filepath.Rel(src, path)
+		if err != nil {
+			return err
+		}
+		if info.IsDir() {
+			return os.MkdirAll(filepath.Join(target, rel), 0700)
+		}
+		return copyFile(path, filepath.Join(target, rel))
+	})
+}
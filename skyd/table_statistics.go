@@ -0,0 +1,554 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/json"
+	"fmt"
+	"github.com/jmhodges/levigo"
+	"hash/fnv"
+	"io/ioutil"
+	"os"
+	"sort"
+	"strconv"
+	"sync"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The number of values of each property whose frequencies are tracked.
+const tableStatisticsFrequentSize = 32
+
+// The number of power of two buckets that the event counts of objects are
+// grouped into. The last bucket holds every larger count.
+const tableStatisticsObjectBuckets = 32
+
+// The layout of the month that event counts are grouped by.
+const tableStatisticsMonthFormat = "2006-01"
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// TableStatistics describe the data of a table so that queries can estimate
+// how much of it they'll read. The event counts, time range and property
+// statistics are updated as events are written, but events that are
+// removed or replaced aren't taken back out, and the distribution of
+// events per object is only known once the table has been analyzed.
+// Analyzing reads every object and replaces the statistics. They're saved
+// in the table's directory next to its property file.
+type TableStatistics struct {
+	sync.Mutex
+	path         string
+	dirty        bool
+	analyzed     time.Time
+	events       int64
+	objects      int64
+	start        time.Time
+	end          time.Time
+	months       map[string]int64
+	objectEvents []int64
+	properties   map[int64]*PropertyStatistics
+}
+
+// PropertyStatistics describe the values of a single property: the number
+// of events that have one, an approximate distinct count and the most
+// frequent values with a lower bound on their counts.
+type PropertyStatistics struct {
+	Count    int64            `json:"count"`
+	Distinct []byte           `json:"distinct"`
+	Frequent map[string]int64 `json:"frequent,omitempty"`
+}
+
+// The stored form of table statistics.
+type tableStatisticsFile struct {
+	Analyzed     time.Time                      `json:"analyzed"`
+	Events       int64                          `json:"events"`
+	Objects      int64                          `json:"objects"`
+	Start        time.Time                      `json:"start"`
+	End          time.Time                      `json:"end"`
+	Months       map[string]int64               `json:"months"`
+	ObjectEvents []int64                        `json:"objectEvents"`
+	Properties   map[string]*PropertyStatistics `json:"properties"`
+}
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates empty statistics that are saved at a given path.
+func NewTableStatistics(path string) *TableStatistics {
+	return &TableStatistics{
+		path:         path,
+		months:       make(map[string]int64),
+		objectEvents: make([]int64, tableStatisticsObjectBuckets),
+		properties:   make(map[int64]*PropertyStatistics),
+	}
+}
+
+// Creates empty statistics for a property.
+func newPropertyStatistics() *PropertyStatistics {
+	distinct := make([]byte, hllSize)
+	distinct[0], distinct[1] = sketchTypeHLL, sketchVersion
+	return &PropertyStatistics{Distinct: distinct, Frequent: make(map[string]int64)}
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Returns the bucket of the distribution of events per object that an
+// event count falls into.
+func objectEventsBucket(count int64) int {
+	bucket := 0
+	for count > 1 && bucket < tableStatisticsObjectBuckets-1 {
+		count >>= 1
+		bucket++
+	}
+	return bucket
+}
+
+// Scrambles a hash so that every bit depends on every input bit. FNV's
+// high bits vary too little across short values to index registers.
+func mixHash(h uint64) uint64 {
+	h ^= h >> 33
+	h *= 0xff51afd7ed558ccd
+	h ^= h >> 33
+	h *= 0xc4ceb9fe1a85ec53
+	h ^= h >> 33
+	return h
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Accessors
+//--------------------------------------
+
+// The time that the table was last analyzed or zero if it never was.
+func (s *TableStatistics) Analyzed() time.Time {
+	s.Lock()
+	defer s.Unlock()
+	return s.analyzed
+}
+
+// The number of events written to the table.
+func (s *TableStatistics) Events() int64 {
+	s.Lock()
+	defer s.Unlock()
+	return s.events
+}
+
+// The number of objects in the table when it was last analyzed.
+func (s *TableStatistics) Objects() int64 {
+	s.Lock()
+	defer s.Unlock()
+	return s.objects
+}
+
+// The timestamps of the first and last events written to the table.
+func (s *TableStatistics) TimeRange() (time.Time, time.Time) {
+	s.Lock()
+	defer s.Unlock()
+	return s.start, s.end
+}
+
+// Estimates the number of events whose timestamps fall in a time range. A
+// zero time leaves that side of the range open. Months that the range only
+// covers part of are counted in proportion.
+func (s *TableStatistics) EventsInRange(start time.Time, end time.Time) int64 {
+	s.Lock()
+	defer s.Unlock()
+	var total float64
+	for month, count := range s.months {
+		t, err := time.Parse(tableStatisticsMonthFormat, month)
+		if err != nil {
+			continue
+		}
+		next := t.AddDate(0, 1, 0)
+		from, to := t, next
+		if !start.IsZero() && start.After(from) {
+			from = start
+		}
+		if !end.IsZero() && end.Before(to) {
+			to = end
+		}
+		if to.After(from) {
+			total += float64(count) * float64(to.Sub(from)) / float64(next.Sub(t))
+		}
+	}
+	return int64(total + 0.5)
+}
+
+// Estimates the number of distinct values of a property.
+func (s *TableStatistics) DistinctValues(id int64) int64 {
+	s.Lock()
+	defer s.Unlock()
+	p := s.properties[id]
+	if p == nil {
+		return 0
+	}
+	estimate, _ := hllEstimate(string(p.Distinct))
+	return estimate
+}
+
+// Estimates the number of events that have a given value of a property.
+// Frequent values use their tracked counts and the rest share the events
+// that remain evenly.
+func (s *TableStatistics) EventsWithValue(id int64, value interface{}) int64 {
+	s.Lock()
+	defer s.Unlock()
+	p := s.properties[id]
+	if p == nil {
+		return 0
+	}
+	if count, ok := p.Frequent[fmt.Sprint(value)]; ok {
+		return count
+	}
+	remaining := p.Count
+	for _, count := range p.Frequent {
+		remaining -= count
+	}
+	distinct, _ := hllEstimate(string(p.Distinct))
+	if others := distinct - int64(len(p.Frequent)); others > 1 {
+		return remaining / others
+	}
+	if remaining < 0 {
+		return 0
+	}
+	return remaining
+}
+
+//--------------------------------------
+// Collection
+//--------------------------------------
+
+// Adds written events to the statistics.
+func (s *TableStatistics) addEvents(events []*Event) {
+	s.Lock()
+	defer s.Unlock()
+	for _, event := range events {
+		s.addEvent(event)
+	}
+	s.dirty = true
+}
+
+// Adds a single event to the statistics. The statistics should be locked
+// by the caller.
+func (s *TableStatistics) addEvent(event *Event) {
+	s.events++
+	if s.start.IsZero() || event.Timestamp.Before(s.start) {
+		s.start = event.Timestamp
+	}
+	if event.Timestamp.After(s.end) {
+		s.end = event.Timestamp
+	}
+	s.months[event.Timestamp.UTC().Format(tableStatisticsMonthFormat)]++
+	for id, value := range event.Data {
+		if id == storedObjectIdPropertyId {
+			continue
+		}
+		p := s.properties[id]
+		if p == nil {
+			p = newPropertyStatistics()
+			s.properties[id] = p
+		}
+		p.add(value)
+	}
+}
+
+// Adds the number of events of an object to the distribution of events per
+// object.
+func (s *TableStatistics) addObject(events int64) {
+	s.objects++
+	s.objectEvents[objectEventsBucket(events)]++
+}
+
+// Adds a value to the distinct count and the frequent values. Frequent
+// values are counted with the Misra-Gries summary: a value that isn't
+// tracked when the summary is full takes one off every tracked count
+// instead, so the counts are lower bounds.
+func (p *PropertyStatistics) add(value interface{}) {
+	key := fmt.Sprint(value)
+	p.Count++
+
+	h := fnv.New64a()
+	h.Write([]byte(key))
+	hash := mixHash(h.Sum64())
+	register := sketchHeaderSize + int(hash>>(64-hllPrecision))
+	rank := byte(1)
+	for rest := hash << hllPrecision; rest&(1<<63) == 0 && rank <= 64-hllPrecision; rest <<= 1 {
+		rank++
+	}
+	if rank > p.Distinct[register] {
+		p.Distinct[register] = rank
+	}
+
+	if _, ok := p.Frequent[key]; ok || len(p.Frequent) < tableStatisticsFrequentSize {
+		p.Frequent[key]++
+		return
+	}
+	for k := range p.Frequent {
+		if p.Frequent[k]--; p.Frequent[k] == 0 {
+			delete(p.Frequent, k)
+		}
+	}
+}
+
+// Replaces the statistics with ones that were built by analyzing the table.
+func (s *TableStatistics) replace(other *TableStatistics) {
+	s.Lock()
+	defer s.Unlock()
+	other.Lock()
+	defer other.Unlock()
+	s.analyzed, s.events, s.objects = other.analyzed, other.events, other.objects
+	s.start, s.end, s.months = other.start, other.end, other.months
+	s.objectEvents, s.properties = other.objectEvents, other.properties
+	s.dirty = true
+}
+
+//--------------------------------------
+// Analysis
+//--------------------------------------
+
+// Reads every object of a table in a database and its frozen files into
+// the statistics. The table's buffered objects are written first. Objects
+// that have events in several partitions are counted once in each.
+func (s *Servlet) analyzeTable(prefix []byte, stats *TableStatistics) error {
+	if err := s.unbufferTable(prefix); err != nil {
+		return err
+	}
+	ro := levigo.NewReadOptions()
+	ro.SetFillCache(false)
+	setSequentialScan(ro)
+	setPrefixSameAsStart(ro)
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+
+	stats.Lock()
+	defer stats.Unlock()
+	var objectKey []byte
+	var objectEvents int64
+	for iterator.Seek(prefix); iterator.Valid(); iterator.Next() {
+		key := iterator.Key()
+		if !bytes.HasPrefix(key, prefix) {
+			break
+		}
+		n := objectKeySize(key, len(prefix))
+		if isZoneKey(key, len(prefix)) || n == 0 || isObjectStateKey(key[:n], key) || isObjectFamilyKey(key[:n], key) {
+			continue
+		}
+		var data []byte
+		var err error
+		if n == len(key) {
+			if objectKey != nil {
+				stats.addObject(objectEvents)
+			}
+			objectKey, objectEvents = key, 0
+			_, data, err = decodeObject(iterator.Value())
+		} else {
+			_, data, err = splitEventIndex(iterator.Value())
+		}
+		if err != nil {
+			return err
+		}
+		events, err := DecodeEvents(data)
+		if err != nil {
+			return err
+		}
+		for _, event := range events {
+			stats.addEvent(event)
+		}
+		objectEvents += int64(len(events))
+	}
+	if err := iterator.GetError(); err != nil {
+		return err
+	}
+	if objectKey != nil {
+		stats.addObject(objectEvents)
+	}
+
+	s.frozenMutex.RLock()
+	defer s.frozenMutex.RUnlock()
+	for _, f := range s.frozen[string(prefix)] {
+		for i := 0; i < f.count; i++ {
+			_, data, err := decodeObject(f.object(i))
+			if err != nil {
+				return err
+			}
+			events, err := DecodeEvents(data)
+			if err != nil {
+				return err
+			}
+			for _, event := range events {
+				stats.addEvent(event)
+			}
+			stats.addObject(int64(len(events)))
+		}
+	}
+	return nil
+}
+
+//--------------------------------------
+// Serialization
+//--------------------------------------
+
+// Encodes the statistics into an untyped map with property names, the
+// estimated distinct count of each property and the frequent values of
+// factor properties defactorized.
+func (s *TableStatistics) Serialize(table *Table, factors *Factors) (map[string]interface{}, error) {
+	s.Lock()
+	defer s.Unlock()
+	properties := make(map[string]interface{})
+	for id, p := range s.properties {
+		property := table.propertyFile.GetProperty(id)
+		if property == nil {
+			continue
+		}
+		distinct, err := hllEstimate(string(p.Distinct))
+		if err != nil {
+			return nil, err
+		}
+		frequent := make(map[string]interface{})
+		for value, count := range p.Frequent {
+			if property.DataType == FactorDataType {
+				sequence, err := strconv.ParseUint(value, 10, 64)
+				if err != nil {
+					continue
+				}
+				if value, err = factors.Defactorize(table.Name, property.Name, sequence); err != nil {
+					return nil, err
+				}
+			}
+			frequent[value] = count
+		}
+		properties[property.Name] = map[string]interface{}{"count": p.Count, "distinct": distinct, "frequent": frequent}
+	}
+
+	// The distribution is the number of objects with at least each power
+	// of two events and fewer than the next.
+	var distribution []interface{}
+	if !s.analyzed.IsZero() {
+		distribution = make([]interface{}, 0)
+		for bucket, count := range s.objectEvents {
+			if count > 0 {
+				distribution = append(distribution, map[string]interface{}{"events": int64(1) << uint(bucket), "objects": count})
+			}
+		}
+	}
+
+	months := make([]string, 0, len(s.months))
+	for month := range s.months {
+		months = append(months, month)
+	}
+	sort.Strings(months)
+	coverage := make([]interface{}, 0, len(months))
+	for _, month := range months {
+		coverage = append(coverage, map[string]interface{}{"month": month, "events": s.months[month]})
+	}
+
+	obj := map[string]interface{}{
+		"events":     s.events,
+		"months":     coverage,
+		"properties": properties,
+	}
+	if !s.start.IsZero() {
+		obj["timeRange"] = []interface{}{formatQueryTime(s.start), formatQueryTime(s.end)}
+	}
+	if !s.analyzed.IsZero() {
+		obj["analyzed"] = s.analyzed.UTC().Format(time.RFC3339)
+		obj["objects"] = s.objects
+		obj["objectEvents"] = distribution
+	}
+	return obj, nil
+}
+
+//--------------------------------------
+// Persistence
+//--------------------------------------
+
+// Reads the statistics from their file. Missing statistics are left empty.
+func (s *TableStatistics) Load() error {
+	b, err := ioutil.ReadFile(s.path)
+	if os.IsNotExist(err) {
+		return nil
+	} else if err != nil {
+		return err
+	}
+	f := &tableStatisticsFile{}
+	if err := json.Unmarshal(b, f); err != nil {
+		return fmt.Errorf("skyd.TableStatistics: Invalid statistics: %v", err)
+	}
+
+	s.Lock()
+	defer s.Unlock()
+	s.analyzed, s.events, s.objects = f.Analyzed, f.Events, f.Objects
+	s.start, s.end = f.Start, f.End
+	if f.Months != nil {
+		s.months = f.Months
+	}
+	if len(f.ObjectEvents) == tableStatisticsObjectBuckets {
+		s.objectEvents = f.ObjectEvents
+	}
+	for key, p := range f.Properties {
+		id, err := strconv.ParseInt(key, 10, 64)
+		if err != nil || len(p.Distinct) != hllSize {
+			return fmt.Errorf("skyd.TableStatistics: Invalid property statistics: %s", key)
+		}
+		if p.Frequent == nil {
+			p.Frequent = make(map[string]int64)
+		}
+		s.properties[id] = p
+	}
+	return nil
+}
+
+// Writes the statistics to their file if they've changed since they were
+// last saved.
+func (s *TableStatistics) Save() error {
+	s.Lock()
+	if !s.dirty {
+		s.Unlock()
+		return nil
+	}
+	f := &tableStatisticsFile{
+		Analyzed:     s.analyzed,
+		Events:       s.events,
+		Objects:      s.objects,
+		Start:        s.start,
+		End:          s.end,
+		Months:       s.months,
+		ObjectEvents: s.objectEvents,
+		Properties:   make(map[string]*PropertyStatistics),
+	}
+	for id, p := range s.properties {
+		f.Properties[strconv.FormatInt(id, 10)] = p
+	}
+	b, err := json.Marshal(f)
+	s.Unlock()
+	if err == nil {
+		err = ioutil.WriteFile(s.path, b, 0600)
+	}
+	if err != nil {
+		return err
+	}
+	s.Lock()
+	s.dirty = false
+	s.Unlock()
+	return nil
+}
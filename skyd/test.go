@@ -24,6 +24,17 @@ func assertProperty(t *testing.T, property *Property, id int64, name string, tra
 	}
 }
 
+func assertEvents(t *testing.T, expected []*Event, actual []*Event) {
+	if len(expected) != len(actual) {
+		t.Fatalf("Expected %v events, received %v", len(expected), len(actual))
+	}
+	for i := range expected {
+		if !expected[i].Equal(actual[i]) {
+			t.Fatalf("Events not equal:\n  IN:  %v\n  OUT: %v", expected[i], actual[i])
+		}
+	}
+}
+
 func assertResponse(t *testing.T, resp *http.Response, statusCode int, content string, message string) {
 	defer resp.Body.Close()
 	body, _ := ioutil.ReadAll(resp.Body)
@@ -40,10 +51,17 @@ func sendTestHttpRequest(method string, url string, contentType string, body str
 }
 
 func runTestServer(f func(s *Server)) {
+	runConfiguredTestServer(nil, f)
+}
+
+func runConfiguredTestServer(configure func(s *Server), f func(s *Server)) {
 	path, _ := ioutil.TempDir("", "")
 	defer os.RemoveAll(path)
 	server := NewServer(8586, path)
 	server.Silence()
+	if configure != nil {
+		configure(server)
+	}
 	server.ListenAndServe(nil)
 	defer server.Shutdown()
 	f(server)
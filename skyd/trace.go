@@ -0,0 +1,320 @@
+package skyd
+
+import (
+	"bufio"
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"io"
+	"net/http"
+	"os"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The bytes that a trace file starts with, the last of which is the version
+// of its format.
+var traceMagic = []byte("SKYTRACE\x01")
+
+// The largest request body that's recorded. Calls with larger bodies, such
+// as bulk loads, are left out of the trace since they can't be replayed
+// from a part of their body.
+const traceMaxBody = 4 << 20
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// TraceOptions controls the recording of a sample of the API calls made to
+// the server, which can be replayed against another server with
+// ReplayTrace() to reproduce its workload.
+type TraceOptions struct {
+	// The file that the trace is written to, which is replaced each time
+	// the server opens. An empty path disables tracing.
+	Path string
+
+	// The fraction of calls that are recorded. Calls are sampled evenly
+	// rather than at random, so a rate of 0.1 records every tenth call.
+	SampleRate float64
+}
+
+// A TraceCall is an API call recorded in a trace: when it was made relative
+// to the start of the trace, how long it took and what it returned, and
+// everything needed to make it again.
+type TraceCall struct {
+	Offset      time.Duration
+	Duration    time.Duration
+	Status      int
+	Route       string
+	Method      string
+	URI         string
+	ContentType string
+	Accept      string
+	Body        []byte
+}
+
+// A TraceReader reads the calls of a trace file in the order they finished.
+type TraceReader struct {
+	r *bufio.Reader
+}
+
+// Writes sampled calls to a trace file. Calls are encoded as they finish
+// with their times in microseconds, status and route and then their
+// request, each as a uvarint or a uvarint length followed by its bytes.
+type traceWriter struct {
+	sync.Mutex
+	options TraceOptions
+	file    *os.File
+	w       *bufio.Writer
+	start   time.Time
+	calls   uint64
+}
+
+// A call being recorded. Its request body is copied as the handler reads
+// it.
+type traceRecord struct {
+	tracer *traceWriter
+	call   TraceCall
+	body   *traceBody
+}
+
+// Copies a request body as it's read, up to traceMaxBody bytes.
+type traceBody struct {
+	io.ReadCloser
+	buf       bytes.Buffer
+	truncated bool
+}
+
+//------------------------------------------------------------------------------
+//
+// Errors
+//
+//------------------------------------------------------------------------------
+
+var errInvalidTrace = errors.New("skyd.TraceReader: Invalid trace file")
+
+//------------------------------------------------------------------------------
+//
+// Constructors
+//
+//------------------------------------------------------------------------------
+
+// Creates a trace file and writes its header.
+func openTraceWriter(options TraceOptions) (*traceWriter, error) {
+	file, err := os.Create(options.Path)
+	if err != nil {
+		return nil, err
+	}
+	t := &traceWriter{options: options, file: file, w: bufio.NewWriter(file), start: time.Now()}
+	t.w.Write(traceMagic)
+	return t, nil
+}
+
+// Creates a reader of a trace and checks its header.
+func NewTraceReader(r io.Reader) (*TraceReader, error) {
+	t := &TraceReader{r: bufio.NewReader(r)}
+	magic := make([]byte, len(traceMagic))
+	if _, err := io.ReadFull(t.r, magic); err != nil || !bytes.Equal(magic, traceMagic) {
+		return nil, errInvalidTrace
+	}
+	return t, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Options
+//--------------------------------------
+
+// The options that API calls are traced with.
+func (s *Server) TraceOptions() TraceOptions {
+	return s.trace
+}
+
+// Sets the options that API calls are traced with. This should be set
+// before the server is opened.
+func (s *Server) SetTraceOptions(options TraceOptions) {
+	s.trace = options
+}
+
+//--------------------------------------
+// Server
+//--------------------------------------
+
+// Creates the trace file if tracing is enabled.
+func (s *Server) startTrace() error {
+	if s.trace.Path == "" || s.trace.SampleRate <= 0 {
+		return nil
+	}
+	tracer, err := openTraceWriter(s.trace)
+	if err != nil {
+		return err
+	}
+	s.tracer = tracer
+	return nil
+}
+
+// Flushes and closes the trace file. Calls that finish afterwards aren't
+// recorded.
+func (s *Server) stopTrace() {
+	if s.tracer != nil {
+		if err := s.tracer.close(); err != nil {
+			s.logger.Printf("ERROR Unable to write trace: %v", err)
+		}
+	}
+}
+
+//--------------------------------------
+// Recording
+//--------------------------------------
+
+// Starts recording a call if it's sampled. Returns nil if it isn't, which
+// finish() ignores.
+func (t *traceWriter) begin(route string, req *http.Request, start time.Time) *traceRecord {
+	if t == nil {
+		return nil
+	}
+	n := atomic.AddUint64(&t.calls, 1)
+	if uint64(float64(n)*t.options.SampleRate) == uint64(float64(n-1)*t.options.SampleRate) {
+		return nil
+	}
+	r := &traceRecord{tracer: t}
+	r.call = TraceCall{
+		Offset:      start.Sub(t.start),
+		Route:       route,
+		Method:      req.Method,
+		URI:         req.URL.RequestURI(),
+		ContentType: req.Header.Get("Content-Type"),
+		Accept:      req.Header.Get("Accept"),
+	}
+	if req.Body != nil {
+		r.body = &traceBody{ReadCloser: req.Body}
+		req.Body = r.body
+	}
+	return r
+}
+
+// Records the status and duration of a call and appends it to the trace.
+func (r *traceRecord) finish(status int, d time.Duration) {
+	if r == nil {
+		return
+	}
+	if r.body != nil {
+		if r.body.truncated {
+			return
+		}
+		r.call.Body = r.body.buf.Bytes()
+	}
+	r.call.Status, r.call.Duration = status, d
+	r.tracer.write(&r.call)
+}
+
+func (t *traceWriter) write(call *TraceCall) {
+	var b []byte
+	b = appendTraceUvarint(b, uint64(call.Offset/time.Microsecond))
+	b = appendTraceUvarint(b, uint64(call.Duration/time.Microsecond))
+	b = appendTraceUvarint(b, uint64(call.Status))
+	for _, field := range []string{call.Route, call.Method, call.URI, call.ContentType, call.Accept} {
+		b = appendTraceUvarint(b, uint64(len(field)))
+		b = append(b, field...)
+	}
+	b = appendTraceUvarint(b, uint64(len(call.Body)))
+	b = append(b, call.Body...)
+
+	t.Lock()
+	defer t.Unlock()
+	if t.w != nil {
+		t.w.Write(b)
+	}
+}
+
+func (t *traceWriter) close() error {
+	t.Lock()
+	defer t.Unlock()
+	if t.file == nil {
+		return nil
+	}
+	err := t.w.Flush()
+	if cerr := t.file.Close(); err == nil {
+		err = cerr
+	}
+	t.file, t.w = nil, nil
+	return err
+}
+
+func (b *traceBody) Read(p []byte) (int, error) {
+	n, err := b.ReadCloser.Read(p)
+	if !b.truncated {
+		if b.buf.Len()+n > traceMaxBody {
+			b.truncated = true
+			b.buf = bytes.Buffer{}
+		} else {
+			b.buf.Write(p[:n])
+		}
+	}
+	return n, err
+}
+
+func appendTraceUvarint(b []byte, v uint64) []byte {
+	var buf [binary.MaxVarintLen64]byte
+	return append(b, buf[:binary.PutUvarint(buf[:], v)]...)
+}
+
+//--------------------------------------
+// Reading
+//--------------------------------------
+
+// Reads the next call of the trace. Returns io.EOF at the end of the trace.
+func (t *TraceReader) Next() (*TraceCall, error) {
+	offset, err := binary.ReadUvarint(t.r)
+	if err == io.EOF {
+		return nil, io.EOF
+	} else if err != nil {
+		return nil, errInvalidTrace
+	}
+	call := &TraceCall{Offset: time.Duration(offset) * time.Microsecond}
+	var duration, status uint64
+	if duration, err = binary.ReadUvarint(t.r); err != nil {
+		return nil, errInvalidTrace
+	}
+	if status, err = binary.ReadUvarint(t.r); err != nil {
+		return nil, errInvalidTrace
+	}
+	call.Duration, call.Status = time.Duration(duration)*time.Microsecond, int(status)
+	for _, field := range []*string{&call.Route, &call.Method, &call.URI, &call.ContentType, &call.Accept} {
+		b, err := t.readBytes()
+		if err != nil {
+			return nil, err
+		}
+		*field = string(b)
+	}
+	if call.Body, err = t.readBytes(); err != nil {
+		return nil, err
+	}
+	return call, nil
+}
+
+func (t *TraceReader) readBytes() ([]byte, error) {
+	n, err := binary.ReadUvarint(t.r)
+	if err != nil || n > traceMaxBody {
+		return nil, errInvalidTrace
+	}
+	b := make([]byte, n)
+	if _, err := io.ReadFull(t.r, b); err != nil {
+		return nil, errInvalidTrace
+	}
+	return b, nil
+}
@@ -0,0 +1,170 @@
+package skyd
+
+import (
+	"bytes"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"net/http"
+	"sort"
+	"sync"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// ReplayOptions controls how a trace is replayed by ReplayTrace().
+type ReplayOptions struct {
+	// The host and port of the server that the calls are made to.
+	Host string
+
+	// How many times faster than they were recorded the calls are made. A
+	// speed of 2 makes them in half the time. Zero replays at the
+	// original speed.
+	Speed float64
+}
+
+// The latencies of the calls to a route in a replay, along with the
+// latencies they had when they were recorded.
+type ReplayResult struct {
+	Route    string
+	Calls    int
+	Errors   int
+	Replayed metricSummary
+	Recorded metricSummary
+}
+
+// The calls of a trace ordered by when they were made.
+type traceCalls []*TraceCall
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Replays the calls of a trace against a server and writes the latency
+// quantiles of each route next to the recorded ones. Each call is made at
+// its offset in the trace, scaled by the speed, without waiting for the
+// calls before it, so calls that overlapped when they were recorded
+// overlap again. A call fails if it returns a different status than it
+// was recorded with. Calls are read into memory first since the trace
+// holds them in the order they finished.
+func ReplayTrace(r io.Reader, options ReplayOptions, w io.Writer) ([]*ReplayResult, error) {
+	reader, err := NewTraceReader(r)
+	if err != nil {
+		return nil, err
+	}
+	calls := make(traceCalls, 0)
+	for {
+		call, err := reader.Next()
+		if err == io.EOF {
+			break
+		} else if err != nil {
+			return nil, err
+		}
+		calls = append(calls, call)
+	}
+	sort.Stable(calls)
+
+	speed := options.Speed
+	if speed <= 0 {
+		speed = 1
+	}
+	results := make(map[string]*ReplayResult)
+	routes := make([]string, 0)
+	for _, call := range calls {
+		if _, ok := results[call.Route]; !ok {
+			results[call.Route] = &ReplayResult{Route: call.Route}
+			routes = append(routes, call.Route)
+		}
+	}
+	sort.Strings(routes)
+
+	var mutex sync.Mutex
+	var wg sync.WaitGroup
+	client := &http.Client{}
+	start := time.Now()
+	for _, call := range calls {
+		if d := time.Duration(float64(call.Offset)/speed) - time.Since(start); d > 0 {
+			time.Sleep(d)
+		}
+		wg.Add(1)
+		go func(call *TraceCall) {
+			defer wg.Done()
+			t := time.Now()
+			status, err := replayTraceCall(client, options.Host, call)
+			d := time.Since(t)
+
+			result := results[call.Route]
+			mutex.Lock()
+			defer mutex.Unlock()
+			result.Calls++
+			if err != nil || status != call.Status {
+				result.Errors++
+			}
+			result.Replayed.Observe(d)
+			result.Recorded.Observe(call.Duration)
+		}(call)
+	}
+	wg.Wait()
+	elapsed := time.Since(start)
+
+	fmt.Fprintf(w, "Calls:      %d\n", len(calls))
+	fmt.Fprintf(w, "Speed:      %gx\n", speed)
+	fmt.Fprintf(w, "Elapsed:    %.3f s\n", elapsed.Seconds())
+	fmt.Fprintf(w, "------------------------------------------------\n")
+	list := make([]*ReplayResult, 0, len(routes))
+	for _, route := range routes {
+		result := results[route]
+		list = append(list, result)
+		fmt.Fprintf(w, "%-40s : %7d calls; %5d errors; p50 %9.3f ms (%9.3f); p99 %9.3f ms (%9.3f); p999 %9.3f ms (%9.3f)\n",
+			result.Route, result.Calls, result.Errors,
+			result.Replayed.Quantile(0.5)*1e3, result.Recorded.Quantile(0.5)*1e3,
+			result.Replayed.Quantile(0.99)*1e3, result.Recorded.Quantile(0.99)*1e3,
+			result.Replayed.Quantile(0.999)*1e3, result.Recorded.Quantile(0.999)*1e3)
+	}
+	return list, nil
+}
+
+// Makes a recorded call and returns its status once its response has been
+// read.
+func replayTraceCall(client *http.Client, host string, call *TraceCall) (int, error) {
+	req, err := http.NewRequest(call.Method, "http://"+host+call.URI, bytes.NewReader(call.Body))
+	if err != nil {
+		return 0, err
+	}
+	if call.ContentType != "" {
+		req.Header.Set("Content-Type", call.ContentType)
+	}
+	if call.Accept != "" {
+		req.Header.Set("Accept", call.Accept)
+	}
+	resp, err := client.Do(req)
+	if err != nil {
+		return 0, err
+	}
+	defer resp.Body.Close()
+	if _, err := io.Copy(ioutil.Discard, resp.Body); err != nil {
+		return 0, err
+	}
+	return resp.StatusCode, nil
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Sorting
+//--------------------------------------
+
+func (c traceCalls) Len() int           { return len(c) }
+func (c traceCalls) Swap(i, j int)      { c[i], c[j] = c[j], c[i] }
+func (c traceCalls) Less(i, j int) bool { return c[i].Offset < c[j].Offset }
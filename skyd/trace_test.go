@@ -0,0 +1,72 @@
+package skyd
+
+import (
+	"bytes"
+	"io"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"testing"
+)
+
+// Ensure that sampled API calls are recorded to a trace and can be replayed.
+func TestServerTrace(t *testing.T) {
+	dir, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(dir)
+	path := filepath.Join(dir, "trace")
+	runConfiguredTestServer(func(s *Server) {
+		s.SetTraceOptions(TraceOptions{Path: path, SampleRate: 0.5})
+	}, func(s *Server) {
+		for i := 0; i < 4; i++ {
+			if i == 1 {
+				setupTestTable("foo")
+				continue
+			}
+			resp, _ := sendTestHttpRequest("GET", "http://localhost:8586/ping", "application/json", "")
+			assertResponse(t, resp, 200, `{"message":"ok"}`+"\n", "GET /ping failed.")
+		}
+		s.stopTrace()
+
+		// Every other call is recorded: the table and the last ping.
+		data, err := ioutil.ReadFile(path)
+		if err != nil {
+			t.Fatalf("Unable to read trace: %v", err)
+		}
+		r, err := NewTraceReader(bytes.NewReader(data))
+		if err != nil {
+			t.Fatalf("Unable to open trace: %v", err)
+		}
+		calls := make([]*TraceCall, 0)
+		for {
+			call, err := r.Next()
+			if err == io.EOF {
+				break
+			} else if err != nil {
+				t.Fatalf("Unable to read call: %v", err)
+			}
+			calls = append(calls, call)
+		}
+		if len(calls) != 2 {
+			t.Fatalf("Unexpected call count: %d", len(calls))
+		}
+		if calls[0].Route != "/tables" || calls[0].Method != "POST" || calls[0].ContentType != "application/json" || string(calls[0].Body) != `{"name":"foo"}` || calls[0].Status != 200 {
+			t.Fatalf("Unexpected call: %v", calls[0])
+		}
+		if calls[1].URI != "/ping" || calls[1].Status != 200 || calls[1].Offset < calls[0].Offset {
+			t.Fatalf("Unexpected call: %v", calls[1])
+		}
+
+		// Replaying the table fails since it exists.
+		var out bytes.Buffer
+		results, err := ReplayTrace(bytes.NewReader(data), ReplayOptions{Host: "localhost:8586", Speed: 100}, &out)
+		if err != nil {
+			t.Fatalf("Unable to replay trace: %v", err)
+		}
+		if len(results) != 2 || results[0].Route != "/ping" || results[0].Calls != 1 || results[0].Errors != 0 || results[1].Route != "/tables" || results[1].Errors != 1 {
+			t.Fatalf("Unexpected replay results:\n%s", out.String())
+		}
+		if _, err := ReplayTrace(bytes.NewReader([]byte("trace")), ReplayOptions{}, &out); err != errInvalidTrace {
+			t.Fatalf("Expected an invalid trace: %v", err)
+		}
+	})
+}
@@ -3,6 +3,14 @@ package skyd
 import (
 	"fmt"
 	"os"
+	"strings"
+)
+
+// The media types that request and response bodies are encoded as msgpack
+// with instead of JSON.
+const (
+	msgpackMediaType  = "application/msgpack"
+	xMsgpackMediaType = "application/x-msgpack"
 )
 
 // Converts untyped map to a map[string]interface{} if passed a map.
@@ -18,6 +26,41 @@ func ConvertToStringKeys(value interface{}) interface{} {
 	return value
 }
 
+// Converts a value decoded from msgpack into the types that decoding the
+// same value from JSON produces: maps with string keys, strings instead of
+// raw bytes and float64 numbers. Handlers see the same params whichever
+// format a request is in.
+func ConvertToJSONTypes(value interface{}) interface{} {
+	switch v := value.(type) {
+	case map[interface{}]interface{}:
+		ret := make(map[string]interface{}, len(v))
+		for k, item := range v {
+			if b, ok := k.([]byte); ok {
+				k = string(b)
+			}
+			ret[fmt.Sprintf("%v", k)] = ConvertToJSONTypes(item)
+		}
+		return ret
+	case []interface{}:
+		ret := make([]interface{}, len(v))
+		for i, item := range v {
+			ret[i] = ConvertToJSONTypes(item)
+		}
+		return ret
+	case []byte:
+		return string(v)
+	}
+	if f, ok := toFloat(normalize(value)); ok {
+		return f
+	}
+	return value
+}
+
+// Checks if a Content-Type or Accept header asks for msgpack.
+func isMsgpackMediaType(header string) bool {
+	return strings.Contains(header, msgpackMediaType) || strings.Contains(header, xMsgpackMediaType)
+}
+
 // Writes to standard error.
 func warn(msg string, v ...interface{}) {
 	fmt.Fprintf(os.Stderr, msg+"\n", v...)
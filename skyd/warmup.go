@@ -0,0 +1,240 @@
+package skyd
+
+import (
+	"encoding/binary"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"sync"
+	"time"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// The file in each servlet and partition directory that lists the blocks of
+// its database that were in the block cache when it was last recorded.
+// LevelDB ignores it since it doesn't parse as one of its own files.
+const warmupFileName = "WARMUP"
+
+// The number of blocks read back into the cache between checks for the
+// server closing.
+const warmupBatchSize = 1024
+
+// How often the blocks in the cache are recorded by default.
+const DefaultWarmupInterval = 10 * time.Minute
+
+// The rate that blocks are read back into the cache by default, in bytes a
+// second.
+const DefaultWarmupRate = 32 << 20
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// WarmupOptions controls how the block cache is carried across restarts.
+// Each servlet periodically records which of its blocks are in the cache
+// and, when the server is opened, the recorded blocks are read back in file
+// order in the background so that queries after a restart don't wait on
+// random reads while the cache refills.
+type WarmupOptions struct {
+	// How often the blocks in the cache are recorded. The blocks are also
+	// recorded when the server closes. Zero only records them on close.
+	Interval time.Duration
+
+	// The number of bytes a second read back into the cache. Zero reads as
+	// fast as the disk allows.
+	Rate int
+}
+
+// The background warm-up of a server's servlets.
+type warmupState struct {
+	stop   chan bool
+	wait   sync.WaitGroup
+	warmed bool
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Splits a block list from getCachedBlocks() into lists of at most a number
+// of blocks. A malformed list ends with the rest of its bytes so that
+// LevelDB reports it.
+func splitBlockList(blocks []byte, n int) [][]byte {
+	lists := make([][]byte, 0)
+	start, pos, count := 0, 0, 0
+	for pos < len(blocks) {
+		_, a := binary.Uvarint(blocks[pos:])
+		if a <= 0 {
+			break
+		}
+		_, b := binary.Uvarint(blocks[pos+a:])
+		if b <= 0 {
+			break
+		}
+		pos += a + b
+		if count++; count == n {
+			lists = append(lists, blocks[start:pos])
+			start, count = pos, 0
+		}
+	}
+	if start < len(blocks) {
+		lists = append(lists, blocks[start:])
+	}
+	return lists
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Options
+//--------------------------------------
+
+// The options that the block cache is carried across restarts with.
+func (s *Server) WarmupOptions() WarmupOptions {
+	return s.warmup
+}
+
+// Sets the options that the block cache is carried across restarts with.
+// This should be set before the server is opened.
+func (s *Server) SetWarmupOptions(options WarmupOptions) {
+	s.warmup = options
+}
+
+//--------------------------------------
+// Server
+//--------------------------------------
+
+// Starts reading the recorded blocks of each servlet back into the cache,
+// one servlet at a time, and then recording the blocks in the cache at
+// every interval.
+func (s *Server) startWarmup() {
+	state := &warmupState{stop: make(chan bool)}
+	s.warming = state
+	servlets := append([]*Servlet{}, s.servlets...)
+
+	state.wait.Add(1)
+	go func() {
+		defer state.wait.Done()
+		t0 := time.Now()
+		for _, servlet := range servlets {
+			stopped, err := servlet.warmCache(s.warmup.Rate, state.stop)
+			if err != nil {
+				s.logger.Printf("Unable to warm the block cache of %s: %v", servlet.path, err)
+			}
+			if stopped {
+				return
+			}
+		}
+		state.warmed = true
+		s.logger.Printf("Warmed the block cache in %0.3fs", time.Since(t0).Seconds())
+
+		if s.warmup.Interval <= 0 {
+			return
+		}
+		ticker := time.NewTicker(s.warmup.Interval)
+		defer ticker.Stop()
+		for {
+			select {
+			case <-state.stop:
+				return
+			case <-ticker.C:
+				s.saveCachedBlocks(servlets)
+			}
+		}
+	}()
+}
+
+// Stops the warm-up and records the blocks in the cache. A cache that
+// hadn't finished warming up is left unrecorded so that the blocks listed
+// before the restart are read back next time.
+func (s *Server) stopWarmup() {
+	state := s.warming
+	if state == nil {
+		return
+	}
+	close(state.stop)
+	state.wait.Wait()
+	s.warming = nil
+	if state.warmed {
+		s.saveCachedBlocks(s.servlets)
+	}
+}
+
+// Records the blocks in the cache for a list of servlets.
+func (s *Server) saveCachedBlocks(servlets []*Servlet) {
+	for _, servlet := range servlets {
+		if err := servlet.saveCachedBlocks(); err != nil {
+			s.logger.Printf("Unable to record the block cache of %s: %v", servlet.path, err)
+		}
+	}
+}
+
+//--------------------------------------
+// Servlet
+//--------------------------------------
+
+// The path of the file that lists the servlet's blocks in the cache.
+func (s *Servlet) warmupPath() string {
+	return filepath.Join(s.path, warmupFileName)
+}
+
+// Writes the blocks of the servlet and its partitions that are in the cache
+// to their directories. Each list replaces the last one whole. Memory stores
+// have no directory and aren't warmed up.
+func (s *Servlet) saveCachedBlocks() error {
+	return s.eachPartition(func(servlet *Servlet) error {
+		if servlet.db == nil || servlet.inMemory() {
+			return nil
+		}
+		blocks, err := getCachedBlocks(servlet.db)
+		if err != nil {
+			return err
+		}
+		tmp := servlet.warmupPath() + ".tmp"
+		if err = ioutil.WriteFile(tmp, blocks, 0600); err != nil {
+			return err
+		}
+		return os.Rename(tmp, servlet.warmupPath())
+	})
+}
+
+// Reads the recorded blocks of the servlet and its partitions back into the
+// cache at most a number of bytes a second. Returns true if it was stopped
+// before it finished.
+func (s *Servlet) warmCache(rate int, stop chan bool) (bool, error) {
+	stopped := false
+	err := s.eachPartition(func(servlet *Servlet) error {
+		blocks, err := ioutil.ReadFile(servlet.warmupPath())
+		if os.IsNotExist(err) {
+			return nil
+		} else if err != nil {
+			return err
+		}
+		for _, list := range splitBlockList(blocks, warmupBatchSize) {
+			select {
+			case <-stop:
+				stopped = true
+				return nil
+			default:
+			}
+			if err = warmCache(servlet.db, list, rate); err != nil {
+				return err
+			}
+		}
+		return nil
+	})
+	return stopped, err
+}
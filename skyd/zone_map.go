@@ -0,0 +1,557 @@
+package skyd
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"github.com/jmhodges/levigo"
+	"hash/fnv"
+	"math"
+	"sort"
+	"sync"
+)
+
+//------------------------------------------------------------------------------
+//
+// Constants
+//
+//------------------------------------------------------------------------------
+
+// A zone map summarizes contiguous key ranges of a table's objects within a
+// servlet so that queries can seek past ranges that can't match. Each zone
+// holds the object count, the minimum and maximum event timestamp and a
+// bloom filter of the integer values seen for each property, which covers
+// every factor value. Zones only ever widen as events are written and are
+// summarized exactly again when they are split.
+//
+// Zones are stored under the table prefix followed by a zero byte and the
+// rest of the zone's start key so that they sort before the table's objects
+// and are removed with the table. The value is little endian:
+//
+//	count (4), min ts (8), max ts (8), bloom filter
+const zoneMarker = 0x00
+
+// The number of objects a zone is split into once it holds twice as many.
+const zoneObjectCount = 256
+
+// The size of a zone's bloom filter in bytes and the number of bits that
+// are set for each value.
+const (
+	zoneBloomSize   = 512
+	zoneBloomHashes = 3
+)
+
+const zoneHeaderSize = 20
+
+//------------------------------------------------------------------------------
+//
+// Typedefs
+//
+//------------------------------------------------------------------------------
+
+// The zones of a single table in a servlet, sorted by start key. The first
+// zone starts at the table prefix and each zone runs to the start of the
+// next one. Zones are replaced rather than modified so that a list of zones
+// can be read without holding the lock.
+type zoneMap struct {
+	sync.RWMutex
+	prefix    []byte
+	zones     []*zone
+	oversized bool
+}
+
+// A summary of the objects in a key range.
+type zone struct {
+	start []byte
+	count int
+	min   int64
+	max   int64
+	bloom []byte
+}
+
+// A range of keys [start, end). A nil end runs to the end of the table.
+type keyRange struct {
+	start []byte
+	end   []byte
+}
+
+//------------------------------------------------------------------------------
+//
+// Functions
+//
+//------------------------------------------------------------------------------
+
+// Creates an empty zone starting at a key.
+func newZone(start []byte) *zone {
+	return &zone{start: start, min: math.MaxInt64, max: math.MinInt64, bloom: make([]byte, zoneBloomSize)}
+}
+
+// Generates the key a zone is stored under.
+func zoneKey(prefix []byte, start []byte) []byte {
+	key := make([]byte, 0, len(start)+1)
+	key = append(key, prefix...)
+	key = append(key, zoneMarker)
+	return append(key, start[len(prefix):]...)
+}
+
+// Checks if a key within a table is a stored zone rather than an object.
+func isZoneKey(key []byte, prefixSize int) bool {
+	return len(key) > prefixSize && key[prefixSize] == zoneMarker
+}
+
+// Encodes a zone as a stored value.
+func encodeZone(z *zone) []byte {
+	b := make([]byte, zoneHeaderSize+len(z.bloom))
+	binary.LittleEndian.PutUint32(b, uint32(z.count))
+	binary.LittleEndian.PutUint64(b[4:], uint64(z.min))
+	binary.LittleEndian.PutUint64(b[12:], uint64(z.max))
+	copy(b[zoneHeaderSize:], z.bloom)
+	return b
+}
+
+// Decodes a stored zone.
+func decodeZone(start []byte, value []byte) (*zone, error) {
+	if len(value) != zoneHeaderSize+zoneBloomSize {
+		return nil, errors.New("skyd.ZoneMap: Invalid zone size")
+	}
+	return &zone{
+		start: start,
+		count: int(binary.LittleEndian.Uint32(value)),
+		min:   int64(binary.LittleEndian.Uint64(value[4:])),
+		max:   int64(binary.LittleEndian.Uint64(value[12:])),
+		bloom: append([]byte{}, value[zoneHeaderSize:]...),
+	}, nil
+}
+
+// Returns the bloom filter bits for a property value.
+func zoneBloomBits(id int64, value int64) [zoneBloomHashes]uint32 {
+	var b [16]byte
+	binary.LittleEndian.PutUint64(b[:], uint64(id))
+	binary.LittleEndian.PutUint64(b[8:], uint64(value))
+	h := fnv.New64a()
+	h.Write(b[:])
+	sum := h.Sum64()
+	h1, h2 := uint32(sum), uint32(sum>>32)|1
+
+	var bits [zoneBloomHashes]uint32
+	for i := range bits {
+		bits[i] = (h1 + uint32(i)*h2) % (zoneBloomSize * 8)
+	}
+	return bits
+}
+
+// Evaluates a cursor filter program against a zone. A comparison is only
+// known to fail when it tests a factor property for equality with a value
+// that isn't in the zone's bloom filter. Every other comparison may match.
+func zoneFilterMatches(z *zone, filter []byte, factors map[int64]bool) bool {
+	stack := make([]bool, 0, maxQueryFilterDepth)
+	for i := 0; i < len(filter); {
+		switch filter[i] {
+		case queryFilterOpTrue:
+			stack = append(stack, true)
+			i++
+		case queryFilterOpFalse:
+			stack = append(stack, false)
+			i++
+		case queryFilterOpAnd, queryFilterOpOr:
+			if len(stack) < 2 {
+				return true
+			}
+			lhs, rhs := stack[len(stack)-2], stack[len(stack)-1]
+			stack = stack[:len(stack)-1]
+			if filter[i] == queryFilterOpAnd {
+				stack[len(stack)-1] = lhs && rhs
+			} else {
+				stack[len(stack)-1] = lhs || rhs
+			}
+			i++
+		case queryFilterOpCmp:
+			if len(filter) < i+11 {
+				return true
+			}
+			cmp, valueType := filter[i+1], filter[i+2]
+			id := int64(binary.LittleEndian.Uint64(filter[i+3:]))
+			value := filter[i+11:]
+			match := true
+			switch valueType {
+			case queryFilterValueNumber:
+				if len(value) < 8 {
+					return true
+				}
+				// Missing values compare as zero so zero always may match.
+				number := math.Float64frombits(binary.LittleEndian.Uint64(value))
+				if cmp == queryFilterComparisons["=="] && factors[id] && number != 0 && number == math.Trunc(number) {
+					match = z.contains(id, int64(number))
+				}
+				i += 19
+			case queryFilterValueBoolean:
+				i += 12
+			case queryFilterValueString:
+				if len(value) < 4 {
+					return true
+				}
+				i += 15 + int(binary.LittleEndian.Uint32(value))
+			default:
+				return true
+			}
+			stack = append(stack, match)
+		default:
+			return true
+		}
+	}
+	return len(stack) == 0 || stack[0]
+}
+
+//------------------------------------------------------------------------------
+//
+// Methods
+//
+//------------------------------------------------------------------------------
+
+//--------------------------------------
+// Zones
+//--------------------------------------
+
+// Creates a copy of a zone that can be widened.
+func (z *zone) clone() *zone {
+	other := *z
+	other.bloom = append([]byte{}, z.bloom...)
+	return &other
+}
+
+// Widens a zone to cover an event.
+func (z *zone) add(event *Event) {
+	ts := ShiftTime(event.Timestamp)
+	if ts < z.min {
+		z.min = ts
+	}
+	if ts > z.max {
+		z.max = ts
+	}
+	for id, value := range event.Data {
+		if value, ok := normalize(value).(int64); ok {
+			for _, bit := range zoneBloomBits(id, value) {
+				z.bloom[bit/8] |= 1 << (bit % 8)
+			}
+		}
+	}
+}
+
+// Checks if a property value may have been seen in the zone.
+func (z *zone) contains(id int64, value int64) bool {
+	for _, bit := range zoneBloomBits(id, value) {
+		if z.bloom[bit/8]&(1<<(bit%8)) == 0 {
+			return false
+		}
+	}
+	return true
+}
+
+// Checks if any event in the zone falls in the range of shifted timestamps
+// [start, end).
+func (z *zone) overlaps(start int64, end int64) bool {
+	return z.max >= start && z.min < end
+}
+
+//--------------------------------------
+// Zone Maps
+//--------------------------------------
+
+// Returns the index of the zone containing a key.
+func (m *zoneMap) find(key []byte) int {
+	i := sort.Search(len(m.zones), func(i int) bool { return bytes.Compare(m.zones[i].start, key) > 0 })
+	if i == 0 {
+		return 0
+	}
+	return i - 1
+}
+
+// Returns the key ranges whose zones can't contain an object with events
+// that match a time range and a cursor filter. Adjacent ranges are merged.
+func (m *zoneMap) skipRanges(start int64, end int64, filter []byte, factors map[int64]bool) []keyRange {
+	m.RLock()
+	zones := m.zones
+	m.RUnlock()
+
+	ranges := make([]keyRange, 0)
+	skipping := false
+	for i, z := range zones {
+		skip := !z.overlaps(start, end) || (filter != nil && !zoneFilterMatches(z, filter, factors))
+		if skip && !skipping {
+			ranges = append(ranges, keyRange{start: z.start})
+		}
+		if !skip && skipping {
+			ranges[len(ranges)-1].end = zones[i].start
+		}
+		skipping = skip
+	}
+	return ranges
+}
+
+//--------------------------------------
+// Servlets
+//--------------------------------------
+
+// Returns the zone map for a table prefix, loading it or summarizing the
+// table's objects if it has never been stored. The commit mutex or the
+// entire servlet should be locked by the caller.
+func (s *Servlet) zoneMap(prefix []byte) (*zoneMap, error) {
+	s.zoneMutex.Lock()
+	m := s.zoneMaps[string(prefix)]
+	s.zoneMutex.Unlock()
+	if m != nil {
+		return m, nil
+	}
+
+	m = &zoneMap{prefix: prefix}
+	ro := levigo.NewReadOptions()
+	setPrefixSameAsStart(ro)
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+	zonePrefix := append(append([]byte{}, prefix...), zoneMarker)
+	for iterator.Seek(zonePrefix); iterator.Valid(); iterator.Next() {
+		key := iterator.Key()
+		if !bytes.HasPrefix(key, zonePrefix) {
+			break
+		}
+		if isFactorIndexKey(key, len(prefix)) {
+			continue
+		}
+		start := append(append([]byte{}, prefix...), key[len(zonePrefix):]...)
+		z, err := decodeZone(start, iterator.Value())
+		if err != nil {
+			return nil, err
+		}
+		m.zones = append(m.zones, z)
+	}
+	if len(m.zones) == 0 {
+		zones, err := s.summarizeZones(prefix, prefix, nil)
+		if err != nil {
+			return nil, err
+		}
+		if err = s.putZones(prefix, nil, zones); err != nil {
+			return nil, err
+		}
+		m.zones = zones
+	}
+
+	s.zoneMutex.Lock()
+	if s.zoneMaps == nil {
+		s.zoneMaps = make(map[string]*zoneMap)
+	}
+	s.zoneMaps[string(prefix)] = m
+	s.zoneMutex.Unlock()
+	return m, nil
+}
+
+// Forgets the zone map for a table prefix after its data has been removed.
+func (s *Servlet) dropZoneMap(prefix []byte) {
+	s.zoneMutex.Lock()
+	delete(s.zoneMaps, string(prefix))
+	s.zoneMutex.Unlock()
+}
+
+// Summarizes the objects in the key range [start, end) of a table into
+// zones of up to the zone object count. The first zone starts at the start
+// key.
+func (s *Servlet) summarizeZones(prefix []byte, start []byte, end []byte) ([]*zone, error) {
+	ro := levigo.NewReadOptions()
+	ro.SetFillCache(false)
+	setSequentialScan(ro)
+	setPrefixSameAsStart(ro)
+	defer ro.Close()
+	iterator := s.db.NewIterator(ro)
+	defer iterator.Close()
+
+	current := newZone(start)
+	zones := []*zone{current}
+	for iterator.Seek(start); iterator.Valid(); iterator.Next() {
+		key := iterator.Key()
+		if !bytes.HasPrefix(key, prefix) || (end != nil && bytes.Compare(key, end) >= 0) {
+			break
+		}
+		if isZoneKey(key, len(prefix)) {
+			continue
+		}
+
+		// Chunks and families belong to the object before them. Heads start
+		// a new zone once the current one is full. States have no events.
+		var data []byte
+		var err error
+		n := objectKeySize(key, len(prefix))
+		if n > 0 && isObjectStateKey(key[:n], key) {
+			continue
+		}
+		if n > 0 && isObjectFamilyKey(key[:n], key) {
+			_, data, err = decodeObject(iterator.Value())
+		} else if n == len(key) {
+			if current.count >= zoneObjectCount {
+				current = newZone(append([]byte{}, key...))
+				zones = append(zones, current)
+			}
+			current.count++
+			_, data, err = decodeObject(iterator.Value())
+		} else {
+			_, data, err = splitEventIndex(iterator.Value())
+		}
+		if err != nil {
+			return nil, err
+		}
+
+		events, err := DecodeEvents(data)
+		if err != nil {
+			return nil, err
+		}
+		for _, event := range events {
+			current.add(event)
+		}
+	}
+	return zones, nil
+}
+
+// Stores a list of zones, replacing a list of previously stored zones.
+func (s *Servlet) putZones(prefix []byte, previous []*zone, zones []*zone) error {
+	batch := newWriteBatch()
+	defer batch.Close()
+	for _, z := range previous {
+		batch.Delete(zoneKey(prefix, z.start))
+	}
+	for _, z := range zones {
+		batch.Put(zoneKey(prefix, z.start), encodeZone(z))
+	}
+	wo := levigo.NewWriteOptions()
+	defer wo.Close()
+	return s.changes.write(s.db, wo, batch)
+}
+
+// Widens the zone containing an object to cover the events written to it
+// and adds the zone to the object's write batch. The object is also added
+// to the factor indexes of the values in the events. The commit mutex
+// should be held by the caller.
+func (s *Servlet) updateZone(prefix []byte, key []byte, created bool, events []*Event, batch *writeBatch) error {
+	if !created && len(events) == 0 {
+		return nil
+	}
+	if err := s.updateFactorIndex(prefix, key, events, batch); err != nil {
+		return err
+	}
+	m, err := s.zoneMap(prefix)
+	if err != nil {
+		return err
+	}
+
+	m.Lock()
+	defer m.Unlock()
+	zones := append([]*zone{}, m.zones...)
+	index := m.find(key)
+	z := zones[index].clone()
+	if created {
+		z.count++
+	}
+	for _, event := range events {
+		z.add(event)
+	}
+	zones[index] = z
+	m.zones = zones
+	m.oversized = m.oversized || z.count >= 2*zoneObjectCount
+	batch.Put(zoneKey(prefix, z.start), encodeZone(z))
+	return nil
+}
+
+// Adds new objects and their events to the zones containing them and adds
+// each changed zone to a write batch once. The object keys should be in
+// order. The commit mutex or the entire servlet should be locked by the
+// caller.
+func (s *Servlet) addZoneObjects(prefix []byte, keys [][]byte, events [][]*Event, batch *writeBatch) error {
+	m, err := s.zoneMap(prefix)
+	if err != nil {
+		return err
+	}
+
+	m.Lock()
+	defer m.Unlock()
+	zones := append([]*zone{}, m.zones...)
+	var changed []int
+	for i, key := range keys {
+		index := m.find(key)
+		if len(changed) == 0 || changed[len(changed)-1] != index {
+			zones[index] = zones[index].clone()
+			changed = append(changed, index)
+		}
+		z := zones[index]
+		z.count++
+		for _, event := range events[i] {
+			z.add(event)
+		}
+		m.oversized = m.oversized || z.count >= 2*zoneObjectCount
+	}
+	m.zones = zones
+	for _, index := range changed {
+		batch.Put(zoneKey(prefix, zones[index].start), encodeZone(zones[index]))
+	}
+	return nil
+}
+
+// Splits any zones that have grown to twice the zone object count. This
+// resummarizes them exactly from their committed objects so it must be
+// called after the writes that grew them have been committed. The commit
+// mutex shouldn't be held by the caller.
+func (s *Servlet) splitZones() error {
+	s.zoneMutex.Lock()
+	maps := make([]*zoneMap, 0)
+	for _, m := range s.zoneMaps {
+		maps = append(maps, m)
+	}
+	s.zoneMutex.Unlock()
+
+	for _, m := range maps {
+		m.RLock()
+		oversized := m.oversized
+		m.RUnlock()
+		if oversized {
+			if err := s.splitZoneMap(m); err != nil {
+				return err
+			}
+		}
+	}
+	return nil
+}
+
+// Splits the oversized zones of a zone map. Nothing else is committed while
+// they're resummarized so that no object is written to them in between.
+func (s *Servlet) splitZoneMap(m *zoneMap) error {
+	s.commitMutex.Lock()
+	defer s.commitMutex.Unlock()
+	m.RLock()
+	oversized, zones := m.oversized, m.zones
+	m.RUnlock()
+	if !oversized {
+		return nil
+	}
+
+	result := make([]*zone, 0, len(zones))
+	for i, z := range zones {
+		if z.count < 2*zoneObjectCount {
+			result = append(result, z)
+			continue
+		}
+		var end []byte
+		if i+1 < len(zones) {
+			end = zones[i+1].start
+		}
+		split, err := s.summarizeZones(m.prefix, z.start, end)
+		if err != nil {
+			return err
+		}
+		if err = s.putZones(m.prefix, []*zone{z}, split); err != nil {
+			return err
+		}
+		result = append(result, split...)
+	}
+
+	m.Lock()
+	m.zones, m.oversized = result, false
+	m.Unlock()
+	return nil
+}
@@ -0,0 +1,80 @@
+package skyd
+
+import (
+	"bytes"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"testing"
+)
+
+// Ensure that zones are split as objects are added and can be used to skip
+// key ranges by time and by factor value.
+func TestZoneMapSkipRanges(t *testing.T) {
+	path, _ := ioutil.TempDir("", "")
+	defer os.RemoveAll(path)
+	table := NewTable("test", "/tmp/test")
+	prefix, _ := TablePrefix(table.Name)
+	servlet := NewServlet(path, nil)
+	defer servlet.Close()
+	_ = servlet.Open()
+
+	// Older objects have an action of 1 and newer ones have an action of 2.
+	objectIds := make([]string, 0)
+	events := make([]*Event, 0)
+	for i := 0; i < 3*zoneObjectCount; i++ {
+		objectIds = append(objectIds, fmt.Sprintf("obj%04d", i))
+		if i < zoneObjectCount {
+			events = append(events, NewEvent("2012-01-01T00:00:00Z", map[int64]interface{}{1: uint64(1)}))
+		} else {
+			events = append(events, NewEvent("2013-01-01T00:00:00Z", map[int64]interface{}{1: uint64(2)}))
+		}
+	}
+	if err := servlet.PutEvents(table, objectIds, events, true); err != nil {
+		t.Fatalf("Unable to add events: %v", err)
+	}
+
+	m, err := servlet.zoneMap(prefix)
+	if err != nil || len(m.zones) != 3 {
+		t.Fatalf("Unexpected zones: %v (%v)", len(m.zones), err)
+	}
+	second, _ := table.EncodeObjectId(objectIds[zoneObjectCount])
+	if !bytes.Equal(m.zones[1].start, second) {
+		t.Fatalf("Unexpected zone start: %v", m.zones[1].start)
+	}
+
+	// Skip the older objects by time.
+	start, end := shiftTimeRange(NewEvent("2012-06-01T00:00:00Z", nil).Timestamp, NewEvent("2014-01-01T00:00:00Z", nil).Timestamp)
+	ranges := m.skipRanges(start, end, nil, nil)
+	if len(ranges) != 1 || !bytes.Equal(ranges[0].start, prefix) || !bytes.Equal(ranges[0].end, second) {
+		t.Fatalf("Unexpected time skip ranges: %v", ranges)
+	}
+
+	// Skip the newer objects by factor.
+	factors := map[int64]bool{1: true}
+	buffer := new(bytes.Buffer)
+	expr := &queryComparisonExpression{property: &Property{Id: 1, DataType: FactorDataType}, op: "==", value: float64(1)}
+	expr.codegenFilter(buffer)
+	start, end = shiftTimeRange(NewEvent("2011-01-01T00:00:00Z", nil).Timestamp, NewEvent("2014-01-01T00:00:00Z", nil).Timestamp)
+	ranges = m.skipRanges(start, end, buffer.Bytes(), factors)
+	if len(ranges) != 1 || !bytes.Equal(ranges[0].start, second) || ranges[0].end != nil {
+		t.Fatalf("Unexpected factor skip ranges: %v", ranges)
+	}
+	if ranges = m.skipRanges(start, end, buffer.Bytes(), nil); len(ranges) != 0 {
+		t.Fatalf("Unexpected skip ranges for a non-factor property: %v", ranges)
+	}
+
+	// Zones are read back after reopening and widened by new events.
+	servlet.Close()
+	_ = servlet.Open()
+	if err := servlet.PutEvent(table, "obj9999", NewEvent("2013-02-01T00:00:00Z", map[int64]interface{}{1: uint64(1)}), true); err != nil {
+		t.Fatalf("Unable to add event: %v", err)
+	}
+	m, _ = servlet.zoneMap(prefix)
+	if len(m.zones) != 3 || m.zones[2].count != zoneObjectCount+1 {
+		t.Fatalf("Unexpected zones after reopen: %v", len(m.zones))
+	}
+	if ranges = m.skipRanges(start, end, buffer.Bytes(), factors); len(ranges) != 1 || !bytes.Equal(ranges[0].start, second) || ranges[0].end == nil {
+		t.Fatalf("Unexpected skip ranges after reopen: %v", ranges)
+	}
+}